@@ -34,6 +34,7 @@ from .ui import ui_world
 from .ui import ui_camera
 from .ui import ui_light
 from .ui import ui_material
+from .ui import ui_object
 
 @base.register_class
 class SORTAddonPreferences(bpy.types.AddonPreferences):
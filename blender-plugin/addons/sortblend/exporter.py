@@ -21,13 +21,19 @@ import tempfile
 import struct
 import numpy as np
 from time import time
-from math import degrees
+from math import degrees, floor
 from .log import log, logD
 from .strid import SID
 from .stream import stream
 
 BLENDER_VERSION = f'{bpy.app.version[0]}.{bpy.app.version[1]}'
 
+# layout of the exported meshes, it needs to be updated together with MESH_SERIALIZATION_VERSION in SORT
+MESH_SERIALIZATION_VERSION = 1
+
+# layout of the exported scene, it needs to be updated together with SCENE_SERIALIZATION_VERSION in SORT
+SCENE_SERIALIZATION_VERSION = 2
+
 def depsgraph_objects(depsgraph: bpy.types.Depsgraph):
     """ Iterates evaluated objects in depsgraph with ITERATED_OBJECT_TYPES """
     ITERATED_OBJECT_TYPES = ('MESH', 'LIGHT')
@@ -70,6 +76,8 @@ def get_sort_bin_path():
     return sort_bin_path
 
 intermediate_dir = ''
+# the scene published in shared memory, it is released once SORT is done with it
+shared_scene = None
 def get_intermediate_dir(force_debug=False):
     global intermediate_dir
     return_path = intermediate_dir if force_debug is False else get_sort_dir()
@@ -172,10 +180,17 @@ def export_blender(depsgraph, force_debug=False, is_preview=False):
     sort_resource_path = create_path(scene, force_debug)
 
     # initialize the file to be fed as main input for the renderer
-    # this will potentially be replaced with socket streaming in the future
+    # the scene is handed to SORT through shared memory when rendering, unless it is exported for debugging, compressed or a preview
+    global shared_scene
     sort_config_file = sort_resource_path + 'scene.sort'
-    fs = stream.FileStream( sort_config_file )
-    log("Exporting sort file %s" % sort_config_file)
+    shared_scene = None
+    if force_debug is False and is_preview is False and scene.name != 'preview' and not scene.sort_data.compressScene:
+        shared_scene = stream.SharedMemoryStream( sort_resource_path )
+        fs = shared_scene
+        log("Exporting sort scene to shared memory %s" % shared_scene.name)
+    else:
+        fs = stream.CompressedFileStream( sort_config_file ) if scene.sort_data.compressScene else stream.FileStream( sort_config_file )
+        log("Exporting sort file %s" % sort_config_file)
 
     # export global settings for the renderer
     current_time = time()
@@ -198,6 +213,8 @@ def export_blender(depsgraph, force_debug=False, is_preview=False):
 
     # make sure the result of the file writting is flushed because it could be problematic on some machines
     fs.flush()
+    if shared_scene is not None:
+        shared_scene.publish()
     del fs
 
 # clear old data and create new path
@@ -236,60 +253,135 @@ def export_scene(depsgraph, is_preview, fs):
     # this is a special code for the render to identify that the serialized input is still valid.
     vericiation_bits = SID('verification bits')
     fs.serialize( vericiation_bits )
+    fs.serialize( SCENE_SERIALIZATION_VERSION )
+
+    # Each entity is exported with the size of its data so that SORT could deserialize entities in parallel.
+    def serialize_entity(entity_type, es):
+        data = es.getvalue()
+        fs.serialize(SID(entity_type))
+        fs.serialize(len(data))
+        fs.serialize(data)
+
+    def serialize_camera(camera):
+        pos, target, up = lookat_camera(camera)
+        sensor_w = camera.data.sensor_width
+        sensor_h = camera.data.sensor_height
+        sensor_fit = 0.0 # auto
+        sfit = camera.data.sensor_fit
+        if sfit == 'VERTICAL':
+            sensor_fit = 2.0
+        elif sfit == 'HORIZONTAL':
+            sensor_fit = 1.0
+        aspect_ratio_x = scene.render.pixel_aspect_x
+        aspect_ratio_y = scene.render.pixel_aspect_y
+        fov_angle = camera.data.angle
+
+        es = stream.MemoryStream()
+        es.serialize(vec3_to_tuple(pos))
+        es.serialize(vec3_to_tuple(up))
+        es.serialize(vec3_to_tuple(target))
+        es.serialize(camera.data.sort_data.lens_size)
+        es.serialize((sensor_w,sensor_h))
+        es.serialize(int(sensor_fit))
+        es.serialize((aspect_ratio_x,aspect_ratio_y))
+        es.serialize(fov_angle)
+        serialize_entity('PerspectiveCameraEntity', es)
 
     # camera node
     camera = scene.camera
     if camera is None:
         print("There is no active camera.")
         return
-
-    pos, target, up = lookat_camera(camera)
-    sensor_w = bpy.data.cameras[0].sensor_width
-    sensor_h = bpy.data.cameras[0].sensor_height
-    sensor_fit = 0.0 # auto
-    sfit = bpy.data.cameras[0].sensor_fit
-    if sfit == 'VERTICAL':
-        sensor_fit = 2.0
-    elif sfit == 'HORIZONTAL':
-        sensor_fit = 1.0
-    aspect_ratio_x = scene.render.pixel_aspect_x
-    aspect_ratio_y = scene.render.pixel_aspect_y
-    fov_angle = bpy.data.cameras[0].angle
-
-    fs.serialize(SID('PerspectiveCameraEntity'))
-    fs.serialize(vec3_to_tuple(pos))
-    fs.serialize(vec3_to_tuple(up))
-    fs.serialize(vec3_to_tuple(target))
-    fs.serialize(camera.data.sort_data.lens_size)
-    fs.serialize((sensor_w,sensor_h))
-    fs.serialize(int(sensor_fit))
-    fs.serialize((aspect_ratio_x,aspect_ratio_y))
-    fs.serialize(fov_angle)
+    serialize_camera(camera)
+
+    # With motion blur, meshes are also evaluated at the closing of the shutter, the shutter opens at the current frame.
+    # It is done before any evaluated object is referred, changing frames evaluates all of them again.
+    # Only transforms are exported, deformation of the meshes is not captured.
+    motion_matrices = {}
+    if not is_preview and scene.render.use_motion_blur:
+        frame, subframe = scene.frame_current, scene.frame_subframe
+        close = frame + subframe + scene.render.motion_blur_shutter
+        scene.frame_set(int(floor(close)), subframe=close - floor(close))
+        motion_matrices = { obj.name : obj.matrix_world.copy() for obj in depsgraph_objects(depsgraph) if obj.type == 'MESH' }
+        scene.frame_set(frame, subframe=subframe)
 
     all_lights = [ ob for ob in depsgraph_objects(depsgraph) if ob.type == 'LIGHT' ]
-    all_objs = [ ob for ob in depsgraph_objects(depsgraph) if ob.type == 'MESH' ]
+
+    # Objects with positive emission strength are exported as mesh lights.
+    def is_emissive(obj):
+        return obj.sort_data.emission_strength > 0.0
+
+    # Objects hidden from every kind of ray in the visibility panel can't be seen in any way, they are not exported at
+    # all. Lights are kept since they still emit light. Versions of Blender without these flags have everything visible.
+    def is_invisible(obj):
+        flags = ( 'visible_camera' , 'visible_diffuse' , 'visible_glossy' , 'visible_transmission' , 'visible_volume_scatter' , 'visible_shadow' )
+        return not is_emissive(obj) and not any( getattr(obj, flag, True) for flag in flags )
+
+    all_objs = [ ob for ob in depsgraph_objects(depsgraph) if ob.type == 'MESH' and not is_invisible(ob) ]
+
+    # Objects sharing the same mesh data are exported as instances of the mesh, the mesh itself is only exported once.
+    # Objects with modifiers or with materials linked to themselves instead of the mesh are not instanced since their
+    # geometry or materials could differ from each other.
+    def is_instanced(obj):
+        # objects in dependency graph are evaluated copies, the number of users needs to come from the original mesh
+        if obj.original.data.users <= 1 or obj.is_modified(scene, 'RENDER'):
+            return False
+        # emissive meshes are lights, the triangles of lights are sampled in world space
+        if is_emissive(obj):
+            return False
+        return all( slot.link == 'DATA' for slot in obj.material_slots )
+
+    # the transform at the closing of the shutter follows a flag telling whether the object moves at all
+    def serialize_motion(obj, es):
+        close = motion_matrices.get(obj.name)
+        # emissive meshes are lights, they don't move
+        moving = close is not None and not is_emissive(obj) and close != obj.matrix_world
+        es.serialize(moving)
+        if moving:
+            es.serialize( matrix_to_tuple( MatrixBlenderToSort() @ close ) )
 
     total_vert_cnt = 0
     total_prim_cnt = 0
+    total_inst_cnt = 0
+    exported_instanced_meshes = set()
     # export meshes
     for obj in all_objs:
-        fs.serialize(SID('VisualEntity'))
-        fs.serialize( matrix_to_tuple( MatrixBlenderToSort() @ obj.matrix_world ) )
-        fs.serialize( 1 )   # only one mesh for each mesh entity
+        es = stream.MemoryStream()
+        es.serialize( matrix_to_tuple( MatrixBlenderToSort() @ obj.matrix_world ) )
+        serialize_motion( obj , es )
+        es.serialize( 1 )   # only one mesh for each mesh entity
         stat = None
+        if is_instanced(obj):
+            # only the first instance carries the mesh data
+            has_mesh = obj.data.name not in exported_instanced_meshes
+            es.serialize(SID('InstancedMeshVisual'))
+            es.serialize(SID(obj.data.name))
+            es.serialize(has_mesh)
+            total_inst_cnt += 1
+            if has_mesh:
+                exported_instanced_meshes.add(obj.data.name)
+                stat = export_mesh_data(obj, obj.data, es)
         # apply the modifier if there is one
-        if obj.type != 'MESH' or obj.is_modified(scene, 'RENDER'):
+        elif obj.type != 'MESH' or obj.is_modified(scene, 'RENDER'):
             try:
                 evaluated_obj = obj.evaluated_get(depsgraph)
                 mesh = evaluated_obj.to_mesh()
-                stat = export_mesh(evaluated_obj, mesh, fs)
+                stat = export_mesh(evaluated_obj, mesh, es)
             finally:
                 evaluated_obj.to_mesh_clear()
         else:
-            stat = export_mesh(obj, obj.data, fs)
+            stat = export_mesh(obj, obj.data, es)
+
+        if is_emissive(obj):
+            # radiance emitted from the surface of the mesh
+            es.serialize(tuple( c * obj.sort_data.emission_strength for c in obj.sort_data.emission_color ))
+            serialize_entity('MeshLightEntity', es)
+        else:
+            serialize_entity('VisualEntity', es)
 
-        total_vert_cnt += stat[0]
-        total_prim_cnt += stat[1]
+        if stat is not None:
+            total_vert_cnt += stat[0]
+            total_prim_cnt += stat[1]
 
     # output hair/fur exporting
     for obj in all_objs:
@@ -297,21 +389,30 @@ def export_scene(depsgraph, is_preview, fs):
 
         # output hair/fur information
         if len( evaluted_obj.particle_systems ) > 0:
-            fs.serialize( SID('VisualEntity') )
-            fs.serialize( matrix_to_tuple( MatrixBlenderToSort() @ evaluted_obj.matrix_world ) )
-            fs.serialize( len( evaluted_obj.particle_systems ) )
+            es = stream.MemoryStream()
+            es.serialize( matrix_to_tuple( MatrixBlenderToSort() @ evaluted_obj.matrix_world ) )
+            es.serialize( False )   # hair doesn't move during the shutter interval
+            es.serialize( len( evaluted_obj.particle_systems ) )
             for ps in evaluted_obj.particle_systems:
-                stat = export_hair( ps , evaluted_obj , scene , is_preview, fs )
+                stat = export_hair( ps , evaluted_obj , scene , is_preview, es )
                 total_vert_cnt += stat[0]
                 total_prim_cnt += stat[1]
+            serialize_entity('VisualEntity', es)
 
     log( "Total vertices: %d." % total_vert_cnt )
     log( "Total primitives: %d." % total_prim_cnt )
+    log( "Total instances: %d." % total_inst_cnt )
 
     mapping = {'SUN': 'DirLightEntity', 'POINT': 'PointLightEntity', 'SPOT': 'SpotLightEntity', 'AREA': 'AreaLightEntity' }
+    portals = []
     for ob in all_lights:
         lamp = ob.data
 
+        # portals don't emit light, they are exported along with the sky light
+        if lamp.type == 'AREA' and lamp.shape in ( 'SQUARE' , 'RECTANGLE' ) and lamp.sort_data.is_portal:
+            portals.append( ob )
+            continue
+
         # This matrix will be used to transform data in SORT coodinate. So it needs to start from SORT coodinate system instead of Blender's.
         # light faces forward Y+ in SORT, while it faces Z- in Blender, needs to flip the direction
         flip_mat = mathutils.Matrix([[ 1.0 , 0.0 , 0.0 , 0.0 ] , [ 0.0 , -1.0 , 0.0 , 0.0 ] , [ 0.0 , 0.0 , 1.0 , 0.0 ] , [ 0.0 , 0.0 , 0.0 , 1.0 ]])
@@ -320,42 +421,67 @@ def export_scene(depsgraph, is_preview, fs):
         # make sure the type of the light is supported
         assert( lamp.type in mapping )
 
-        # name identifier of the light
-        fs.serialize( SID(mapping[lamp.type]) )
+        es = stream.MemoryStream()
 
         # transformation of light source
-        fs.serialize(matrix_to_tuple(world_matrix))
+        es.serialize(matrix_to_tuple(world_matrix))
 
         # total light power, it defines how bright light is
-        fs.serialize(lamp.energy)
+        es.serialize(lamp.energy)
 
         # light spectrum color, it defines color of the light
-        fs.serialize(lamp.color[:])
+        es.serialize(lamp.color[:])
 
         # spot light and area light have extra properties to be serialized
         if lamp.type == 'SPOT':
             falloff_start = degrees(lamp.spot_size * ( 1.0 - lamp.spot_blend ) * 0.5)
             falloff_range = degrees(lamp.spot_size*0.5)
-            fs.serialize(falloff_start)
-            fs.serialize(falloff_range)
+            es.serialize(falloff_start)
+            es.serialize(falloff_range)
         elif lamp.type == 'AREA':
-            fs.serialize( SID(lamp.shape) )
+            es.serialize( SID(lamp.shape) )
             if lamp.shape == 'SQUARE':
-                fs.serialize(lamp.size)
+                es.serialize(lamp.size)
             elif lamp.shape == 'RECTANGLE':
-                fs.serialize(lamp.size)
-                fs.serialize(lamp.size_y)
+                es.serialize(lamp.size)
+                es.serialize(lamp.size_y)
             elif lamp.shape == 'DISK':
-                fs.serialize(lamp.size * 0.5)
+                es.serialize(lamp.size * 0.5)
+
+        serialize_entity(mapping[lamp.type], es)
 
     hdr_sky_image = scene.sort_hdr_sky.hdr_image
     if hdr_sky_image is not None:
-        fs.serialize(SID('SkyLightEntity'))
+        es = stream.MemoryStream()
         global_matrix = mathutils.Matrix()
-        fs.serialize(matrix_to_tuple(global_matrix))
-        fs.serialize(( 1.0 , 1.0 , 1.0 ))   # light tint color
-        fs.serialize( 1.0 )                 # sky light scaling, not supported since it is not pbs.
-        fs.serialize(bpy.path.abspath( hdr_sky_image.filepath ))
+        es.serialize(matrix_to_tuple(global_matrix))
+        es.serialize(( 1.0 , 1.0 , 1.0 ))   # light tint color
+        es.serialize( 1.0 )                 # sky light scaling, not supported since it is not pbs.
+        es.serialize(bpy.path.abspath( hdr_sky_image.filepath ))
+
+        # a portal is exported as a corner, two edges and the direction towards the sky, which is Z+ of the area light
+        es.serialize( len( portals ) )
+        for ob in portals:
+            lamp = ob.data
+            size_x = lamp.size
+            size_y = lamp.size_y if lamp.shape == 'RECTANGLE' else lamp.size
+            matrix = MatrixBlenderToSort() @ ob.matrix_world
+            corner = matrix @ mathutils.Vector( ( -0.5 * size_x , -0.5 * size_y , 0.0 ) )
+            edge_x = matrix.to_3x3() @ mathutils.Vector( ( size_x , 0.0 , 0.0 ) )
+            edge_y = matrix.to_3x3() @ mathutils.Vector( ( 0.0 , size_y , 0.0 ) )
+            outward = matrix.to_3x3() @ mathutils.Vector( ( 0.0 , 0.0 , 1.0 ) )
+            es.serialize( corner[:] )
+            es.serialize( edge_x[:] )
+            es.serialize( edge_y[:] )
+            es.serialize( outward[:] )
+        serialize_entity('SkyLightEntity', es)
+
+    # Cameras rendered as extra views go after everything else, indices of the other entities don't change with them.
+    # Previews only take the active camera.
+    if not is_preview:
+        for ob in depsgraph.objects:
+            if ob.type == 'CAMERA' and ob.name != camera.name and ob.data.sort_data.extra_view:
+                serialize_camera(ob)
 
     # to indicate the scene stream comes to an end
     fs.serialize(SID('End of Entities'))
@@ -388,11 +514,27 @@ def export_global_config(scene, fs, sort_resource_path):
     fs.serialize( int(xres) )
     fs.serialize( int(yres) )
     fs.serialize( sort_data.clampping )
+    fs.serialize( sort_data.adaptive_sampling )
+    fs.serialize( int(sort_data.adaptive_min_samples) )
+    fs.serialize( sort_data.adaptive_threshold )
+    fs.serialize( sort_data.progressive )
+    fs.serialize( sort_data.progressive_time_budget )
+    fs.serialize( sort_data.progressive and sort_data.quick_preview )
+    fs.serialize( sort_data.denoise )
+    fs.serialize( sort_data.denoise and sort_data.progressive and sort_data.denoise_passes )
+    fs.serialize( SID(sort_data.sampler_type_prop) )
 
     if accelerator_type == "bvh":
         fs.serialize( SID('Bvh') )
         fs.serialize( int(sort_data.bvh_max_node_depth) )
         fs.serialize( int(sort_data.bvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.bvh_spatial_split) )
+        fs.serialize( float(sort_data.bvh_spatial_split_budget) )
+    elif accelerator_type == "Lbvh":
+        fs.serialize( SID('Lbvh') )
+        fs.serialize( int(sort_data.lbvh_max_node_depth) )
+        fs.serialize( int(sort_data.lbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.lbvh_treelet_optimization) )
     elif accelerator_type == "KDTree":
         fs.serialize( SID('KDTree') )
         fs.serialize( int(sort_data.kdtree_max_node_depth) )
@@ -405,10 +547,23 @@ def export_global_config(scene, fs, sort_resource_path):
         fs.serialize( SID('Qbvh') )
         fs.serialize( int(sort_data.qbvh_max_node_depth) )
         fs.serialize( int(sort_data.qbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.qbvh_spatial_split) )
+        fs.serialize( float(sort_data.qbvh_spatial_split_budget) )
     elif accelerator_type == "Obvh":
         fs.serialize( SID('Obvh') )
         fs.serialize( int(sort_data.obvh_max_node_depth) )
         fs.serialize( int(sort_data.obvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.obvh_spatial_split) )
+        fs.serialize( float(sort_data.obvh_spatial_split_budget) )
+    elif accelerator_type == "Hbvh":
+        fs.serialize( SID('Hbvh') )
+        fs.serialize( int(sort_data.hbvh_max_node_depth) )
+        fs.serialize( int(sort_data.hbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.hbvh_spatial_split) )
+        fs.serialize( float(sort_data.hbvh_spatial_split_budget) )
+    elif accelerator_type == "Auto":
+        fs.serialize( SID('Auto') )
+        fs.serialize( float(sort_data.auto_build_budget) )
     else:
         fs.serialize( SID('UniGrid') )
 
@@ -416,14 +571,29 @@ def export_global_config(scene, fs, sort_resource_path):
     fs.serialize( int(sort_data.inte_max_recur_depth) )
     if integrator_type == "PathTracing":
         fs.serialize( int(sort_data.max_bssrdf_bounces) )
+        fs.serialize( bool(sort_data.path_guiding) )
+        fs.serialize( bool(sort_data.efficiency_aware_rr) )
+        fs.serialize( bool(sort_data.radiance_cache) )
+        fs.serialize( bool(sort_data.sss_irradiance_cache) )
+        fs.serialize( bool(sort_data.light_selection_cache) )
+        fs.serialize( int(sort_data.first_bounce_light_samples) )
+        fs.serialize( int(sort_data.first_bounce_bsdf_samples) )
     if integrator_type == "AmbientOcclusion":
         fs.serialize( sort_data.ao_max_dist )
+        fs.serialize( int(sort_data.ao_sample_count) )
+    if integrator_type == "DirectLight":
+        fs.serialize( int(sort_data.direct_ris_candidates) )
+        fs.serialize( bool(sort_data.direct_pixel_reuse) )
     if integrator_type == "BidirPathTracing" or integrator_type == "LightTracing":
         fs.serialize( bool(sort_data.bdpt_mis) )
+        fs.serialize( bool(sort_data.bdpt_light_vertex_cache) )
     if integrator_type == "InstantRadiosity":
         fs.serialize( sort_data.ir_light_path_set_num )
         fs.serialize( sort_data.ir_light_path_num )
         fs.serialize( sort_data.ir_min_dist )
+    if integrator_type == "ProgressivePhotonMapping":
+        fs.serialize( int(sort_data.ppm_photon_count) )
+        fs.serialize( float(sort_data.ppm_initial_radius) )
 
 # export smoke information
 def export_smoke(obj, fs):
@@ -462,12 +632,17 @@ def export_smoke(obj, fs):
 
 # export a mesh
 def export_mesh(obj, mesh, fs):
+    fs.serialize(SID('MeshVisual'))
+    return export_mesh_data(obj, mesh, fs)
+
+# export the data of a mesh, it is shared by mesh visual and instanced mesh visual
+def export_mesh_data(obj, mesh, fs):
     LENFMT = struct.Struct('=i')
     FLTFMT = struct.Struct('=f')
-    VERTFMT = struct.Struct('=ffffffff')
-    LINEFMT = struct.Struct('=iiffi')
     POINTFMT = struct.Struct('=fff')
-    TRIFMT = struct.Struct('=iiii')
+    UVFMT = struct.Struct('=ff')
+    TRIFMT = struct.Struct('=iii')
+    MATFMT = struct.Struct('=i')
 
     materials = mesh.materials[:]
     material_names = [m.name if m else None for m in materials]
@@ -475,8 +650,12 @@ def export_mesh(obj, mesh, fs):
     vert_cnt = 0
     primitive_cnt = 0
     verts = mesh.vertices
-    wo3_verts = bytearray()
+    # each attribute is exported as a contiguous array so that SORT can load it in bulk
+    wo3_positions = bytearray()
+    wo3_normals = bytearray()
+    wo3_uvs = bytearray()
     wo3_tris = bytearray()
+    wo3_mats = bytearray()
 
     global matname_to_id
 
@@ -533,7 +712,9 @@ def export_mesh(obj, mesh, fs):
             if out_idx is None:
                 out_idx = vert_cnt
                 remapping[key] = out_idx
-                wo3_verts += VERTFMT.pack(vert.co[0], vert.co[1], vert.co[2], normal[0], normal[1], normal[2], uvcoord[0], uvcoord[1])
+                wo3_positions += POINTFMT.pack(vert.co[0], vert.co[1], vert.co[2])
+                wo3_normals += POINTFMT.pack(normal[0], normal[1], normal[2])
+                wo3_uvs += UVFMT.pack(uvcoord[0], uvcoord[1])
                 vert_cnt += 1
             oi.append(out_idx)
 
@@ -542,24 +723,31 @@ def export_mesh(obj, mesh, fs):
         matid = matname_to_id[matname] if matname in matname_to_id else -1
         if len(oi) == 3:
             # triangle
-            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2], matid)
+            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2])
+            wo3_mats += MATFMT.pack(matid)
             primitive_cnt += 1
         elif len(oi) == 4:
             # quad
-            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2], matid)
-            wo3_tris += TRIFMT.pack(oi[0], oi[2], oi[3], matid)
+            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2])
+            wo3_tris += TRIFMT.pack(oi[0], oi[2], oi[3])
+            wo3_mats += MATFMT.pack(matid)
+            wo3_mats += MATFMT.pack(matid)
             primitive_cnt += 2
         else:
             # no other primitive supported in mesh
             # assert( False )
             log("Warning, there is unsupported geometry. The exported scene may be incomplete.")
 
-    fs.serialize(SID('MeshVisual'))
+    fs.serialize(MESH_SERIALIZATION_VERSION)
     fs.serialize(bool(has_uv))
     fs.serialize(LENFMT.pack(vert_cnt))
-    fs.serialize(wo3_verts)
+    fs.serialize(wo3_positions)
+    fs.serialize(wo3_normals)
+    if has_uv:
+        fs.serialize(wo3_uvs)
     fs.serialize(LENFMT.pack(primitive_cnt))
     fs.serialize(wo3_tris)
+    fs.serialize(wo3_mats)
 
     # export smoke data if needed, this is for volumetric rendering
     export_smoke(obj, fs)
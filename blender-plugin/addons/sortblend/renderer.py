@@ -52,8 +52,11 @@ class SORT_Thread():
         # setup shared memory
         self.shared_memory = sm
 
-        # pack image content as float
-        self.float_shared_memory = struct.pack('%sf'%(self.render_engine.image_size_in_bytes), *sm[self.render_engine.image_header_size:self.render_engine.image_size_in_bytes + self.render_engine.image_header_size] )
+        # sequence number of the tiles displayed so far
+        self.displayed_seq = [0] * self.render_engine.image_header_size
+
+    def tileseq(self, i):
+        return struct.unpack_from( 'I', self.shared_memory, self.render_engine.image_seq_offset + i * 4 )[0]
 
     def update(self, final_update=False):
         # total pixel count
@@ -78,9 +81,14 @@ class SORT_Thread():
                 # y offset
                 offset_y = max( mod - tile_y_offset , 0 )
 
-                # load shared memory
-                self.shared_memory.seek( self.render_engine.image_header_size + i * self.render_engine.image_tile_size_in_bytes + offset_y * tile_size_x * 16)
-                byptes = self.shared_memory.read(self.render_engine.image_tile_size_in_bytes - offset_y * tile_size_x * 16)
+                # load the buffer SORT published last, it is read again if SORT flips the buffers twice during reading
+                while True:
+                    seq = self.tileseq(i)
+                    buffer = ( seq & 1 ) * self.render_engine.image_header_size + i
+                    self.shared_memory.seek( self.render_engine.image_data_offset + buffer * self.render_engine.image_tile_size_in_bytes + offset_y * tile_size_x * 16)
+                    byptes = self.shared_memory.read(self.render_engine.image_tile_size_in_bytes - offset_y * tile_size_x * 16)
+                    if self.tileseq(i) - seq < 2:
+                        break
 
                 # convert binary to two dimensional array
                 tile_data = numpy.fromstring(byptes, dtype=numpy.float32)
@@ -95,8 +103,8 @@ class SORT_Thread():
                 # refresh the update
                 self.render_engine.end_result(result)
 
-                # update header info to make sure it is not processed again
-                self.shared_memory[i] = self.shared_memory[i] + 1
+                # make sure it is not processed again until SORT publishes the tile again
+                self.displayed_seq[i] = seq
 
             if all_done is True:
                 break
@@ -109,10 +117,14 @@ class SORT_Thread():
         active_tiles = []
         all_done = True
         for i in range( self.render_engine.image_header_size ):
-            if self.shared_memory[i] is 1:
+            if self.shared_memory[i] == 0:
+                all_done = False
+            elif self.tileseq(i) != self.displayed_seq[i]:
                 active_tiles.append(i)
-            elif self.shared_memory[i] is 0:
                 all_done = False
+        # tiles could be refreshed again with splatted radiance until the final update
+        if self.shared_memory[self.render_engine.image_progress_offset + 1] != 1:
+            all_done = False
         return ( active_tiles , all_done )
 
 @base.register_class
@@ -134,7 +146,7 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         import mmap
 
         # setup shared memory size
-        self.sm_size = self.image_size_in_bytes * 2 + self.image_header_size + 2
+        self.sm_size = self.image_progress_offset + 2
 
         intermediate_dir = exporter.get_intermediate_dir()
         sm_full_path = intermediate_dir + "sharedmem.bin"
@@ -173,6 +185,10 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         self.image_tile_pixel_count = self.image_tile_size * self.image_tile_size
         self.image_tile_size_in_bytes = self.image_tile_pixel_count * 16
         self.image_size_in_bytes = self.image_tile_count_x * self.image_tile_count_y * self.image_tile_size_in_bytes
+        # flags, sequence numbers and two buffers of each tile, then the progress and the final update flag
+        self.image_seq_offset = ( self.image_header_size + 3 ) // 4 * 4
+        self.image_data_offset = self.image_seq_offset + self.image_header_size * 4
+        self.image_progress_offset = self.image_data_offset + self.image_size_in_bytes * 2
 
     # update frame
     def update(self, data, depsgraph):
@@ -225,7 +241,7 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         while subprocess.Popen.poll(process) is None:
             if self.test_break():
                 break
-            progress = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size]
+            progress = self.sharedmemory[self.image_progress_offset]
             self.update_progress(progress/100)
 
         # terminate the process by force
@@ -264,7 +280,10 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         intermediate_dir = exporter.get_intermediate_dir()
         # execute binary
         self.cmd_argument = [binary_path];
-        self.cmd_argument.append( '--input:' + intermediate_dir + 'scene.sort')
+        if exporter.shared_scene is not None:
+            self.cmd_argument.append( '--sharedinput:' + exporter.shared_scene.name )
+        else:
+            self.cmd_argument.append( '--input:' + intermediate_dir + 'scene.sort')
         self.cmd_argument.append( '--blendermode' )
         if scene.sort_data.profilingEnabled is True:
             self.cmd_argument.append( '--profiling:on' )
@@ -276,37 +295,26 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         while subprocess.Popen.poll(process) is None:
             if self.test_break():
                 break
-            progress = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size]
+            progress = self.sharedmemory[self.image_progress_offset]
             self.update_progress(progress/100)
 
         # terminate the process by force
         if subprocess.Popen.poll(process) is None:
             subprocess.Popen.terminate(process)
 
-        # wait for the thread to finish
-        self.sort_thread.stop()
+        # the thread picks up the tiles published with the final update by itself, it is only stopped if there is none
+        final_update = self.sharedmemory[self.image_progress_offset + 1]
+        if self.test_break() or not final_update:
+            self.sort_thread.stop()
         self.sort_thread.join()
 
-        # if final update is necessary
-        final_update = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size + 1]
-        if final_update:
-            # begin result
-            result = self.begin_result(0, 0, bpy.data.scenes[0].render.resolution_x, bpy.data.scenes[0].render.resolution_y)
-
-            self.sharedmemory.seek( self.image_header_size + self.image_size_in_bytes)
-            byptes = self.sharedmemory.read(self.image_pixel_count * 16)
-
-            tile_data = numpy.fromstring(byptes, dtype=numpy.float32)
-            tile_rect = tile_data.reshape( self.image_pixel_count , 4 )
-
-            # update image memory
-            result.layers[0].passes[0].rect = tile_rect
-
-            # refresh the update
-            self.end_result(result)
-
         # close shared memory connection
         self.sharedmemory.close()
 
+        # release the scene in shared memory
+        if exporter.shared_scene is not None:
+            exporter.shared_scene.release()
+            exporter.shared_scene = None
+
         # clear immediate directory
         shutil.rmtree(intermediate_dir)
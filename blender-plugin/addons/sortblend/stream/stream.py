@@ -14,7 +14,12 @@
 #    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
 
 import bpy
+import io
+import os
+import mmap
+import platform
 import struct
+import zlib
 
 class Stream():
     def __init__(self):
@@ -60,3 +65,94 @@ class FileStream(Stream):
         else:
             serialize_type(data)
         self.file.flush()
+
+# Memory stream serializes data into memory, the data is retrieved by getvalue.
+class MemoryStream(FileStream):
+    def __init__(self):
+        self.file = io.BytesIO()
+
+    def getvalue(self):
+        return self.file.getvalue()
+
+# Compressed file is a file like object writing data as zlib compressed chunks.
+# The layout needs to match the one read by ICompressedFileStream in SORT.
+class CompressedFile():
+    MAGIC = 0x5a524f53
+    VERSION = 0
+
+    def __init__(self,filename,chunk_size=4*1024*1024):
+        self.file = open( filename , 'wb' )
+        self.chunk_size = chunk_size
+        self.pending = bytearray()
+        self.index = bytearray()
+        self.chunk_cnt = 0
+        self.file.write(struct.pack( '=III' , CompressedFile.MAGIC , CompressedFile.VERSION , chunk_size ))
+
+    def write(self,data):
+        self.pending += data
+        while len(self.pending) >= self.chunk_size:
+            self.write_chunk(self.pending[:self.chunk_size])
+            del self.pending[:self.chunk_size]
+
+    def write_chunk(self,data):
+        compressed = zlib.compress( bytes(data) , 1 )
+        self.file.write(compressed)
+        self.index += struct.pack( '=II' , len(compressed) , len(data) )
+        self.chunk_cnt += 1
+
+    # chunks are only written once they are full, there is nothing to flush before closing the file
+    def flush(self):
+        pass
+
+    def close(self):
+        if self.file.closed:
+            return
+        if len(self.pending) > 0:
+            self.write_chunk(self.pending)
+            self.pending = bytearray()
+        self.file.write(self.index)
+        self.file.write(struct.pack( '=II' , self.chunk_cnt , CompressedFile.MAGIC ))
+        self.file.close()
+
+# Compressed file stream serializes data into a compressed file, which is smaller to be copied around.
+class CompressedFileStream(FileStream):
+    def __init__(self,filename):
+        self.file = CompressedFile( filename )
+
+# Shared memory stream serializes data into memory, which is published to SORT once it is done, saving the round trip
+# through the disk. The layout needs to match the one read by ISharedMemoryStream in SORT.
+# Same as the shared memory for the rendered image, it is a file mapped by both processes on Linux and Mac OS, the
+# file lives in '/dev/shm' if it is available so that it never touches the disk.
+class SharedMemoryStream(MemoryStream):
+    MAGIC = 0x4d485353
+
+    def __init__(self,intermediate_dir):
+        super().__init__()
+        self.shared_memory = None
+        if platform.system() == 'Linux' and os.path.isdir('/dev/shm'):
+            self.name = '/dev/shm/sort_' + os.path.basename(os.path.normpath(intermediate_dir)) + '_scene.sort'
+        else:
+            self.name = intermediate_dir + 'scene.sort'
+
+    # Publish the serialized data, it needs to be called before SORT is launched.
+    def publish(self):
+        data = self.getvalue()
+        header = struct.pack( '=II' , SharedMemoryStream.MAGIC , len(data) )
+        if platform.system() == 'Windows':
+            # the mapping is gone with its last handle, it is kept alive until SORT is done with it
+            self.shared_memory = mmap.mmap( 0 , len(header) + len(data) , self.name )
+            self.shared_memory.write(header)
+            self.shared_memory.write(data)
+        else:
+            with open( self.name , 'wb' ) as file:
+                file.write(header)
+                file.write(data)
+        self.file = io.BytesIO()
+
+    # Release the shared memory once SORT is done.
+    def release(self):
+        if self.shared_memory is not None:
+            self.shared_memory.close()
+            self.shared_memory = None
+        elif os.path.exists(self.name):
+            os.remove(self.name)
@@ -21,6 +21,7 @@ from .. import base
 @base.register_class
 class SORTCameraData(bpy.types.PropertyGroup):
     lens_size : bpy.props.FloatProperty( name='Lens Size', default=0.0)
+    extra_view : bpy.props.BoolProperty( name='Extra View', default=False, description='Render the camera as an extra view of the scene along with the active camera, to its own output file')
     @classmethod
     def register(cls):
         bpy.types.Camera.sort_data = bpy.props.PointerProperty(name="SORT Data", type=cls)
@@ -49,3 +50,9 @@ class CAMERA_PT_SORTDOFPanel(SORTCameraPanel, bpy.types.Panel):
         row.active = ( camera.dof.focus_object == None )
         row.prop(camera.dof, "focus_distance")
         layout.prop(camera.sort_data, "lens_size")
+
+@base.register_class
+class CAMERA_PT_SORTViewPanel(SORTCameraPanel, bpy.types.Panel):
+    bl_label = 'Multi-View'
+    def draw(self, context):
+        self.layout.prop(context.camera.sort_data, "extra_view")
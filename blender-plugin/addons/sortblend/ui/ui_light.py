@@ -17,6 +17,16 @@ import bpy
 import bl_ui
 from .. import base
 
+@base.register_class
+class SORTLightData(bpy.types.PropertyGroup):
+    is_portal : bpy.props.BoolProperty( name='Sky Portal', default=False, description='Mark an opening that the sky is visible through instead of emitting light, sky samples are restricted to the directions through portals.')
+    @classmethod
+    def register(cls):
+        bpy.types.Light.sort_data = bpy.props.PointerProperty(name="SORT Data", type=cls)
+    @classmethod
+    def unregister(cls):
+        del bpy.types.Light.sort_data
+
 class SORTLightPanel(bl_ui.properties_data_light.DataButtonsPanel):
     bl_space_type = "PROPERTIES"
     bl_region_type = "WINDOW"
@@ -50,5 +60,7 @@ class LIGHT_PT_SORTPanel(SORTLightPanel, bpy.types.Panel):
             elif shape == 'RECTANGLE':
                 self.layout.prop( light , "size" )
                 self.layout.prop( light , "size_y" )
+            if shape == 'SQUARE' or shape == 'RECTANGLE':
+                self.layout.prop( light.sort_data , "is_portal" )
             elif shape == 'DISK':
                 self.layout.prop( light , "size" )
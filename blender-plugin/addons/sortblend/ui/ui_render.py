@@ -33,7 +33,9 @@ class SORTRenderData(bpy.types.PropertyGroup):
                          ("InstantRadiosity", "Instant Radiosity", "", 4),
                          ("AmbientOcclusion", "Ambient Occlusion", "", 5),
                          ("DirectLight", "Direct Lighting", "", 6),
-                         ("WhittedRT", "Whitted", "", 7) ]
+                         ("WhittedRT", "Whitted", "", 7),
+                         ("WavefrontPathTracing", "Wavefront Path Tracing", "", 8),
+                         ("ProgressivePhotonMapping", "Progressive Photon Mapping", "", 9) ]
     integrator_type_prop : bpy.props.EnumProperty(items=integrator_types, name='Accelerator')
 
     # general integrator parameters
@@ -42,8 +44,22 @@ class SORTRenderData(bpy.types.PropertyGroup):
     # maxmum bounces supported in BSSRDF, exceeding the threshold will result in replacing BSSRDF with Lambert
     max_bssrdf_bounces : bpy.props.IntProperty(name='Maximum Bounces in SSS path', default=4, min=1)
 
+    # guide paths with the radiance learned during progressive rendering
+    path_guiding : bpy.props.BoolProperty(name='Path Guiding', default=False, description='Learn the incident radiance during progressive rendering to guide paths')
+    efficiency_aware_rr : bpy.props.BoolProperty(name='Efficiency-Aware Russian Roulette', default=False, description='Kill and split paths depending on their expected contribution and cost learned during progressive rendering')
+    radiance_cache : bpy.props.BoolProperty(name='Radiance Cache', default=False, description='Take indirect illumination of diffuse surfaces after the first bounce from a cache, this is biased and only meant for previews')
+    sss_irradiance_cache : bpy.props.BoolProperty(name='SSS Irradiance Cache', default=False, description='Integrate subsurface scattering over irradiance cached on SSS surfaces before rendering instead of tracing probe rays, this is biased but free of their noise')
+    light_selection_cache : bpy.props.BoolProperty(name='Light Selection Cache', default=False, description='Pick lights by their shadowed contribution learned in space during the first passes of progressive rendering, it helps scenes with many occluded lights')
+    first_bounce_light_samples : bpy.props.IntProperty(name='Light Samples at First Bounce', default=1, min=1, max=64, description='Number of light samples taken where camera rays hit, other bounces take one light sample')
+    first_bounce_bsdf_samples : bpy.props.IntProperty(name='BSDF Samples at First Bounce', default=1, min=1, max=64, description='Number of paths continued from where camera rays hit, each of them samples the BSDF on its own')
+
     # ao integrator parameters
     ao_max_dist : bpy.props.FloatProperty(name='Maximum Distance', default=3.0, min=0.01)
+    ao_sample_count : bpy.props.IntProperty(name='Sample Count', default=1, min=1, description='Number of occlusion rays of a shading point, they are traced in packets')
+
+    # direct light parameters
+    direct_ris_candidates : bpy.props.IntProperty(name='Candidate Light Samples', default=0, min=0, description='Number of candidate light samples resampled for each shading point, all lights are sampled if it is zero')
+    direct_pixel_reuse : bpy.props.BoolProperty(name='Reuse Light Samples in Pixel', default=False, description='Samples of a pixel reuse the resampled light samples of each other')
 
     # instant radiosity parameters
     ir_light_path_set_num : bpy.props.IntProperty(name='Light Path Set Num', default=1, min=1)
@@ -52,6 +68,11 @@ class SORTRenderData(bpy.types.PropertyGroup):
 
     # bidirectional path tracing parameters
     bdpt_mis : bpy.props.BoolProperty(name='Multiple Importance Sampling', default=True)
+    bdpt_light_vertex_cache : bpy.props.BoolProperty(name='Light Vertex Cache', default=False, description='Connect camera vertices to light vertices cached across pixels instead of tracing a light path for every sample')
+
+    # progressive photon mapping parameters
+    ppm_photon_count : bpy.props.IntProperty(name='Photon Count', default=1000000, min=1, description='Number of photon paths traced in each pass')
+    ppm_initial_radius : bpy.props.FloatProperty(name='Initial Radius', default=0.0, min=0.0, description='Radius of the photon look-ups in the first pass, it depends on the size of the scene if it is zero')
 
     #------------------------------------------------------------------------------------#
     #                              Spatial Accelerator Settings                          #
@@ -62,20 +83,40 @@ class SORTRenderData(bpy.types.PropertyGroup):
                           ("bvh", "BVH", "Binary Bounding Volume Hierarchy", 2),
                           ("KDTree", "SAH KDTree", "K-dimentional Tree", 3),
                           ("UniGrid", "Uniform Grid", "This is not quite practical in all cases.", 4),
-                          ("OcTree" , "OcTree" , "This is not quite practical in all cases." , 5)]
+                          ("OcTree" , "OcTree" , "This is not quite practical in all cases." , 5),
+                          ("Lbvh", "LBVH", "Linear BVH, it is fast to build but slower to trace, suitable for previews.", 6),
+                          ("Hbvh", "HBVH", "SIMD(AVX512) Optimized BVH", 7),
+                          ("Auto", "Auto", "Pick the accelerator based on statistics of the scene.", 8)]
     accelerator_type_prop : bpy.props.EnumProperty(items=accelerator_types, name='Accelerator')
 
     # bvh properties
     bvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     bvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=8, min=8, max=64)
+    bvh_spatial_split : bpy.props.BoolProperty(name='Spatial Split', default=False, description='Split primitives spatially during construction, it trades more memory for faster ray tracing.')
+    bvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget', default=0.3, min=0.0, max=4.0, description='Maximum number of duplicated primitive references, relative to the number of primitives.')
+
+    # lbvh properties
+    lbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
+    lbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=8, min=1, max=64)
+    lbvh_treelet_optimization : bpy.props.BoolProperty(name='Treelet Optimization', default=False, description='Restructure small treelets to reduce SAH cost, it trades longer construction for faster ray tracing.')
 
     # qbvh properties
     qbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     qbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=4, max=64)
+    qbvh_spatial_split : bpy.props.BoolProperty(name='Spatial Split', default=False, description='Split primitives spatially during construction, it trades more memory for faster ray tracing.')
+    qbvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget', default=0.3, min=0.0, max=4.0, description='Maximum number of duplicated primitive references, relative to the number of primitives.')
 
     # obvh properties
     obvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     obvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=8, max=64)
+    obvh_spatial_split : bpy.props.BoolProperty(name='Spatial Split', default=False, description='Split primitives spatially during construction, it trades more memory for faster ray tracing.')
+    obvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget', default=0.3, min=0.0, max=4.0, description='Maximum number of duplicated primitive references, relative to the number of primitives.')
+
+    # hbvh properties
+    hbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
+    hbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=32, min=16, max=64)
+    hbvh_spatial_split : bpy.props.BoolProperty(name='Spatial Split', default=False, description='Split primitives spatially during construction, it trades more memory for faster ray tracing.')
+    hbvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget', default=0.3, min=0.0, max=4.0, description='Maximum number of duplicated primitive references, relative to the number of primitives.')
 
     # kdtree properties
     kdtree_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
@@ -85,6 +126,9 @@ class SORTRenderData(bpy.types.PropertyGroup):
     octree_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=16, min=8)
     octree_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=8, max=64)
 
+    # auto properties
+    auto_build_budget : bpy.props.FloatProperty(name='Build Time Budget', default=0.0, min=0.0, description='Maximum time in seconds to build the accelerator, zero means there is no limit. Faster structures to build are picked for tighter budgets.')
+
     #------------------------------------------------------------------------------------#
     #                                 Clampping Settings                                 #
     #------------------------------------------------------------------------------------#
@@ -93,12 +137,25 @@ class SORTRenderData(bpy.types.PropertyGroup):
     #------------------------------------------------------------------------------------#
     #                                 Sampling Settings                                  #
     #------------------------------------------------------------------------------------#
+    sampler_types = [ ("RandomSampler", "Random", "Independent random numbers in every sample.", 1),
+                      ("SobolSampler", "Sobol", "Owen-scrambled Sobol sequence, converging faster with the same number of samples.", 2),
+                      ("BlueNoiseSampler", "Blue Noise", "Sobol sequence distributing the noise as blue noise among pixels, for previews with few samples.", 3),
+                      ("CMJSampler", "Correlated Multi-Jittered", "Jittered samples well stratified with any number of samples, not only powers of two or perfect squares.", 4) ]
+    sampler_type_prop : bpy.props.EnumProperty(items=sampler_types, name='Sampler', default="SobolSampler")
     sampler_count_prop : bpy.props.IntProperty(name='Count',default=1, min=1)
+    adaptive_sampling : bpy.props.BoolProperty(name='Adaptive Sampling', default=False, description='Stop taking samples in converged pixels and take more in noisy pixels instead.')
+    adaptive_min_samples : bpy.props.IntProperty(name='Minimum Count', default=16, min=1, description='Number of samples taken in each pixel before checking whether it converges.')
+    adaptive_threshold : bpy.props.FloatProperty(name='Noise Threshold', default=0.01, min=0.0001, max=1.0, description='A pixel converges once its relative error is below this value.')
+    progressive : bpy.props.BoolProperty(name='Progressive', default=False, description='Render the whole image in passes, doubling the samples in each pass, for a quick preview.')
+    progressive_time_budget : bpy.props.FloatProperty(name='Time Budget', default=0.0, min=0.0, description='Seconds that progressive rendering could take, 0 means there is no limit.')
+    quick_preview : bpy.props.BoolProperty(name='Quick Preview', default=False, description='Render 1/16 and 1/4 of the pixels before the first pass, for a preview right after the scene changes.')
+    denoise : bpy.props.BoolProperty(name='Denoise', default=False, description='Remove the noise of the image once it is rendered, guided by the albedo and normal of the surfaces.')
+    denoise_passes : bpy.props.BoolProperty(name='Denoise Passes', default=False, description='Remove the noise of the preview of each progressive pass as well.')
 
     #------------------------------------------------------------------------------------#
     #                                 Threading Settings                                 #
     #------------------------------------------------------------------------------------#
-    thread_num_prop : bpy.props.IntProperty(name='Thread Num', default=8, min=1, max=32)
+    thread_num_prop : bpy.props.IntProperty(name='Thread Num', default=8, min=0, max=256, description='Number of worker threads, 0 means one per physical core of the machine')
 
     #------------------------------------------------------------------------------------#
     #                                 Debugging Settings                                 #
@@ -106,6 +163,7 @@ class SORTRenderData(bpy.types.PropertyGroup):
     detailedLog : bpy.props.BoolProperty( name='Output Detailed Output', default=False, description='Whether outputing detail log information in blender plugin.' )
     profilingEnabled : bpy.props.BoolProperty(name='Enable Profiling',default=False,description='Enabling profiling will have a big impact on performance, only use it for simple scene')
     allUseDefaultMaterial : bpy.props.BoolProperty(name='No Material',default=False,description='Disable all materials in SORT, use the default one.')
+    compressScene : bpy.props.BoolProperty(name='Compress Scene',default=False,description='Compress the exported scene file, it is smaller to be copied to other machines, but takes longer to export.')
 
     @classmethod
     def register(cls):
@@ -152,14 +210,29 @@ class RENDER_PT_IntegratorPanel(SORTRenderPanel,bpy.types.Panel):
             self.layout.prop(data,"inte_max_recur_depth")
         if integrator_type == "PathTracing":
             self.layout.prop(data,"max_bssrdf_bounces" )
+            self.layout.prop(data,"path_guiding" )
+            self.layout.prop(data,"efficiency_aware_rr" )
+            self.layout.prop(data,"radiance_cache" )
+            self.layout.prop(data,"sss_irradiance_cache" )
+            self.layout.prop(data,"light_selection_cache" )
+            self.layout.prop(data,"first_bounce_light_samples" )
+            self.layout.prop(data,"first_bounce_bsdf_samples" )
         if integrator_type == "AmbientOcclusion":
             self.layout.prop(data,"ao_max_dist")
+            self.layout.prop(data,"ao_sample_count")
+        if integrator_type == "DirectLight":
+            self.layout.prop(data,"direct_ris_candidates")
+            self.layout.prop(data,"direct_pixel_reuse")
         if integrator_type == "BidirPathTracing":
             self.layout.prop(data,"bdpt_mis")
+            self.layout.prop(data,"bdpt_light_vertex_cache")
         if integrator_type == "InstantRadiosity":
             self.layout.prop(data,"ir_light_path_set_num")
             self.layout.prop(data,"ir_light_path_num")
             self.layout.prop(data, "ir_min_dist")
+        if integrator_type == "ProgressivePhotonMapping":
+            self.layout.prop(data,"ppm_photon_count")
+            self.layout.prop(data,"ppm_initial_radius")
 
 @base.register_class
 class RENDER_PT_AcceleratorPanel(SORTRenderPanel,bpy.types.Panel):
@@ -171,18 +244,39 @@ class RENDER_PT_AcceleratorPanel(SORTRenderPanel,bpy.types.Panel):
         if accelerator_type == "bvh":
             self.layout.prop(data,"bvh_max_node_depth")
             self.layout.prop(data,"bvh_max_pri_in_leaf")
+            self.layout.prop(data,"bvh_spatial_split")
+            if data.bvh_spatial_split:
+                self.layout.prop(data,"bvh_spatial_split_budget")
+        elif accelerator_type == "Lbvh":
+            self.layout.prop(data,"lbvh_max_node_depth")
+            self.layout.prop(data,"lbvh_max_pri_in_leaf")
+            self.layout.prop(data,"lbvh_treelet_optimization")
         elif accelerator_type == "Qbvh":
             self.layout.prop(data,"qbvh_max_node_depth")
             self.layout.prop(data,"qbvh_max_pri_in_leaf")
+            self.layout.prop(data,"qbvh_spatial_split")
+            if data.qbvh_spatial_split:
+                self.layout.prop(data,"qbvh_spatial_split_budget")
         elif accelerator_type == "Obvh":
             self.layout.prop(data,"obvh_max_node_depth")
             self.layout.prop(data,"obvh_max_pri_in_leaf")
+            self.layout.prop(data,"obvh_spatial_split")
+            if data.obvh_spatial_split:
+                self.layout.prop(data,"obvh_spatial_split_budget")
+        elif accelerator_type == "Hbvh":
+            self.layout.prop(data,"hbvh_max_node_depth")
+            self.layout.prop(data,"hbvh_max_pri_in_leaf")
+            self.layout.prop(data,"hbvh_spatial_split")
+            if data.hbvh_spatial_split:
+                self.layout.prop(data,"hbvh_spatial_split_budget")
         elif accelerator_type == "KDTree":
             self.layout.prop(data,"kdtree_max_node_depth")
             self.layout.prop(data,"kdtree_max_pri_in_leaf")
         elif accelerator_type == "OcTree":
             self.layout.prop(data,"octree_max_node_depth")
             self.layout.prop(data,"octree_max_pri_in_leaf")
+        elif accelerator_type == "Auto":
+            self.layout.prop(data,"auto_build_budget")
 
 @base.register_class
 class RENDER_PT_ClamppingPanel(SORTRenderPanel,bpy.types.Panel):
@@ -201,7 +295,20 @@ class RENDER_PT_MultiThreadPanel(SORTRenderPanel, bpy.types.Panel):
 class RENDER_PT_SamplerPanel(SORTRenderPanel, bpy.types.Panel):
     bl_label = 'Sample'
     def draw(self, context):
-        self.layout.prop(context.scene.sort_data,"sampler_count_prop")
+        data = context.scene.sort_data
+        self.layout.prop(data,"sampler_type_prop")
+        self.layout.prop(data,"sampler_count_prop")
+        self.layout.prop(data,"adaptive_sampling")
+        if data.adaptive_sampling:
+            self.layout.prop(data,"adaptive_min_samples")
+            self.layout.prop(data,"adaptive_threshold")
+        self.layout.prop(data,"progressive")
+        if data.progressive:
+            self.layout.prop(data,"progressive_time_budget")
+            self.layout.prop(data,"quick_preview")
+        self.layout.prop(data,"denoise")
+        if data.denoise and data.progressive:
+            self.layout.prop(data,"denoise_passes")
 
 @base.register_class
 class SORT_export_debug_scene(bpy.types.Operator):
@@ -244,4 +351,5 @@ class RENDER_PT_DebugPanel(SORTRenderPanel, bpy.types.Panel):
         self.layout.prop(data, "detailedLog")
         self.layout.prop(data, "profilingEnabled")
         self.layout.prop(data, "allUseDefaultMaterial")
+        self.layout.prop(data, "compressScene")
 
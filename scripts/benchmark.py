@@ -0,0 +1,131 @@
+#
+#    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+#    platform physically based renderer.
+#
+#    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+#
+#    SORT is a free software written for educational purpose. Anyone can distribute
+#    or modify it under the the terms of the GNU General Public License Version 3 as
+#    published by the Free Software Foundation. However, there is NO warranty that
+#    all components are functional in a perfect manner. Without even the implied
+#    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+#    General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License along with
+#    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+#
+
+# Render the reference scenes of the benchmark suite and compare the performance against a baseline.
+#
+# Each scene is rendered with '--timing', the line of JSON printed by SORT is collected into the result file. If a
+# baseline, a result file of an earlier run on the same machine, is given, every metric is compared against it and
+# the script fails if any of them regresses more than the tolerance.
+#
+#   python3 scripts/benchmark.py --scenes <scene folder> [--sort bin/sort_r] [--output result.json]
+#                                [--baseline baseline.json] [--tolerance 0.05] [--repeat 3] [--only name,...]
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+# metrics compared against the baseline, and whether a larger value is better.
+metrics = [ ( 'mrays_per_second' , True ) ,
+            ( 'samples_per_second' , True ) ,
+            ( 'seconds' , False ) ,
+            ( 'time_to_first_pixel' , False ) ,
+            ( 'peak_memory_mb' , False ) ]
+
+def parse_arguments():
+    root = os.path.dirname( os.path.dirname( os.path.abspath( __file__ ) ) )
+    parser = argparse.ArgumentParser( description = 'Benchmark SORT with the reference scenes.' )
+    parser.add_argument( '--scenes' , required = True , help = 'Folder of the reference scenes.' )
+    parser.add_argument( '--suite' , default = os.path.join( root , 'scripts' , 'benchmark_scenes.json' ) , help = 'Description of the benchmark suite.' )
+    parser.add_argument( '--sort' , default = os.path.join( root , 'bin' , 'sort_r' ) , help = 'SORT executable to benchmark.' )
+    parser.add_argument( '--output' , default = 'benchmark_result.json' , help = 'File to save the results in.' )
+    parser.add_argument( '--baseline' , help = 'Results of an earlier run to compare against.' )
+    parser.add_argument( '--tolerance' , type = float , default = 0.05 , help = 'Relative regression allowed before failing, 5%% by default.' )
+    parser.add_argument( '--repeat' , type = int , default = 1 , help = 'Render each scene a few times and keep the fastest run.' )
+    parser.add_argument( '--only' , help = 'Comma separated names of the scenes to render, all by default.' )
+    parser.add_argument( 'extra' , nargs = '*' , help = 'Extra arguments passed to SORT, like --threads:8.' )
+    return parser.parse_args()
+
+# render a scene once, return the timing printed by SORT or None if it failed.
+def render( sort , scene_file , args ):
+    command = [ sort , '--input:' + scene_file , '--timing' ] + args
+    process = subprocess.run( command , stdout = subprocess.PIPE , stderr = subprocess.STDOUT , universal_newlines = True )
+    timing = None
+    for line in process.stdout.splitlines():
+        line = line.strip()
+        if line.startswith( '{' ) and '"seconds"' in line:
+            timing = json.loads( line )
+    if process.returncode != 0 or timing is None:
+        print( '    failed with return code %d.' % process.returncode )
+        return None
+    return timing
+
+# compare a scene against the baseline, return the regressed metrics.
+def compare( name , result , baseline , tolerance ):
+    regressions = []
+    for metric , larger_is_better in metrics:
+        if metric not in result or metric not in baseline or baseline[metric] <= 0:
+            continue
+        change = ( result[metric] - baseline[metric] ) / baseline[metric]
+        regressed = -change > tolerance if larger_is_better else change > tolerance
+        print( '    %-20s %12.3f -> %12.3f (%+.1f%%)%s' % ( metric , baseline[metric] , result[metric] , change * 100.0 , '  REGRESSED' if regressed else '' ) )
+        if regressed:
+            regressions.append( '%s.%s' % ( name , metric ) )
+    return regressions
+
+def main():
+    args = parse_arguments()
+    with open( args.suite ) as f:
+        suite = json.load( f )
+
+    baseline = {}
+    if args.baseline:
+        with open( args.baseline ) as f:
+            baseline = json.load( f )[ 'scenes' ]
+
+    only = set( args.only.split( ',' ) ) if args.only else None
+    results = {}
+    regressions = []
+    for scene in suite[ 'scenes' ]:
+        name = scene[ 'name' ]
+        if only is not None and name not in only:
+            continue
+
+        scene_file = os.path.join( args.scenes , scene[ 'file' ] )
+        if not os.path.isfile( scene_file ):
+            print( '%s is skipped, %s is not found.' % ( name , scene_file ) )
+            continue
+
+        # the fastest run is the one least disturbed by other processes on the machine.
+        print( 'Rendering %s.' % name )
+        best = None
+        for i in range( max( args.repeat , 1 ) ):
+            timing = render( args.sort , scene_file , scene.get( 'args' , [] ) + args.extra )
+            if timing is not None and ( best is None or timing[ 'seconds' ] < best[ 'seconds' ] ):
+                best = timing
+        if best is None:
+            regressions.append( name )
+            continue
+
+        results[ name ] = best
+        print( '    %.3f Mrays/s, %.3fs to the first pixel, %.1f MB at peak, %.3fs in total.' %
+               ( best[ 'mrays_per_second' ] , best[ 'time_to_first_pixel' ] , best[ 'peak_memory_mb' ] , best[ 'seconds' ] ) )
+        if name in baseline:
+            regressions += compare( name , best , baseline[ name ] , args.tolerance )
+
+    with open( args.output , 'w' ) as f:
+        json.dump( { 'sort' : os.path.abspath( args.sort ) , 'arguments' : args.extra , 'scenes' : results } , f , indent = 4 )
+    print( 'Results are saved in %s.' % args.output )
+
+    if regressions:
+        print( 'Regressions: %s' % ', '.join( regressions ) )
+        return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit( main() )
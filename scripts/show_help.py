@@ -39,6 +39,9 @@ Available commands
         Introduction about SORT and myself.
     * dep_info
         Introduction about the third party libraries used in SORT.
+    * benchmark SCENES=<folder> [BASELINE=<file>]
+        Render the reference scenes with the release build and compare the
+        performance against the results of an earlier run.
 
 Convenience targets
 
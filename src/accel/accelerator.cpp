@@ -15,15 +15,255 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <string.h>
+#include <cstdio>
+#include <fstream>
 #include "accelerator.h"
 #include "core/primitive.h"
+#include "core/log.h"
+#include "stream/fstream.h"
+#include "stream/mmapstream.h"
 
-SORT_STATS_DEFINE_COUNTER(sRayCount)
-SORT_STATS_DEFINE_COUNTER(sShadowRayCount)
-SORT_STATS_DEFINE_COUNTER(sIntersectionTest)
+#if defined(SORT_IN_WINDOWS)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+SORT_STATS_DEFINE_HOT_COUNTER(sRayCount)
+SORT_STATS_DEFINE_HOT_COUNTER(sShadowRayCount)
+SORT_STATS_DEFINE_HOT_COUNTER(sRayPacketCount)
+SORT_STATS_DEFINE_HOT_COUNTER(sIntersectionTest)
+SORT_STATS_DEFINE_COUNTER(sSimdIsa)
+
+// Identifier of acceleration structure cache files.
+static constexpr unsigned   ACCELERATOR_CACHE_MAGIC     = 0x43434153;
+// Version of acceleration structure cache files, it needs to be bumped whenever the layout of any cache changes.
+static constexpr unsigned   ACCELERATOR_CACHE_VERSION   = 2;
+
+//! @brief Hash the geometry of all primitives in order.
+//!
+//! @param primitives       Primitives to be hashed.
+//! @return                 Hash of the primitives.
+SORT_STATIC_FORCEINLINE unsigned long long hashPrimitives( const std::vector<const Primitive*>& primitives ){
+    auto hash = HASH_INITIAL_VALUE;
+    const auto primitive_cnt = (unsigned)primitives.size();
+    hashData( hash , &primitive_cnt , sizeof( primitive_cnt ) );
+    for( const auto primitive : primitives )
+        primitive->HashGeometry( hash );
+    return hash;
+}
+
+namespace {
+    //! @brief  An accelerator with SIMD kernels and the instruction set they are compiled with.
+    struct SimdAccelerator{
+        StringID    type;       /**< Type of the accelerator. */
+        const char* name;       /**< Name of the accelerator. */
+        SimdIsa     isa;        /**< Instruction set of the SIMD kernels. */
+    };
+
+    //! @brief  Accelerators sorted from the widest to the narrowest, each one falls back to the next one.
+    //!
+    //! An accelerator built without its SIMD kernels is a scalar one that could run anywhere.
+    const SimdAccelerator SIMD_ACCELERATORS[] = {
+#ifdef AVX512_ENABLED
+        { SID("Hbvh") , "Hbvh" , SimdIsa::AVX512 } ,
+#else
+        { SID("Hbvh") , "Hbvh" , SimdIsa::Scalar } ,
+#endif
+#ifdef AVX_ENABLED
+        { SID("Obvh") , "Obvh" , SimdIsa::AVX } ,
+#else
+        { SID("Obvh") , "Obvh" , SimdIsa::Scalar } ,
+#endif
+#if defined(SSE_ENABLED)
+        { SID("Qbvh") , "Qbvh" , SimdIsa::SSE } ,
+#elif defined(NEON_ENABLED)
+        { SID("Qbvh") , "Qbvh" , SimdIsa::NEON } ,
+#else
+        { SID("Qbvh") , "Qbvh" , SimdIsa::Scalar } ,
+#endif
+        { SID("Bvh") , "Bvh" , SimdIsa::Scalar } ,
+    };
+    constexpr unsigned SIMD_ACCELERATOR_CNT = (unsigned)( sizeof( SIMD_ACCELERATORS ) / sizeof( SIMD_ACCELERATORS[0] ) );
+}
+
+//! @brief Hash the topology of all primitives in order.
+//!
+//! @param primitives       Primitives to be hashed.
+//! @return                 Hash of the topology of the primitives.
+SORT_STATIC_FORCEINLINE unsigned long long hashTopology( const std::vector<const Primitive*>& primitives ){
+    auto hash = HASH_INITIAL_VALUE;
+    const auto primitive_cnt = (unsigned)primitives.size();
+    hashData( hash , &primitive_cnt , sizeof( primitive_cnt ) );
+    for( const auto primitive : primitives )
+        primitive->HashTopology( hash );
+    return hash;
+}
+
+void Accelerator::BuildWithCache( const std::vector<const Primitive*>& primitives , const BBox& bbox , const std::string& cache_folder ){
+    if( primitives.empty() ){
+        Build( primitives , bbox );
+        return;
+    }
+
+    const auto primitive_cnt = (unsigned)primitives.size();
+    const auto topology_hash = hashTopology( primitives );
+    const auto topology_low = (unsigned)( topology_hash & 0xffffffffull );
+    const auto topology_high = (unsigned)( topology_hash >> 32 );
+    const auto hash = hashPrimitives( primitives );
+    const auto hash_low = (unsigned)( hash & 0xffffffffull );
+    const auto hash_high = (unsigned)( hash >> 32 );
+
+    // Frames of an animation share the same cache as long as the topology doesn't change.
+    char cache_name[64];
+    snprintf( cache_name , sizeof( cache_name ) , "accel_%08x%08x.cache" , topology_high , topology_low );
+    const auto cache_file = cache_folder + cache_name;
+
+    // check whether the file exists first since missing cache is not worth a warning
+    auto built = false;
+    if( std::ifstream( cache_file , std::ios::in | std::ios::binary ).good() ){
+        IMappedFileStream stream( cache_file );
+
+        unsigned magic = 0 , version = 0 , t_low = 0 , t_high = 0 , low = 0 , high = 0 , cnt = 0;
+        stream >> magic >> version >> t_low >> t_high >> low >> high >> cnt;
+        if( stream.IsValid() && ACCELERATOR_CACHE_MAGIC == magic && ACCELERATOR_CACHE_VERSION == version &&
+            topology_low == t_low && topology_high == t_high && primitive_cnt == cnt ){
+            m_primitives = &primitives;
+            m_bbox = bbox;
+            if( loadCache( stream ) && stream.IsValid() ){
+                m_isValid = true;
+                if( hash_low == low && hash_high == high ){
+                    slog( INFO , SPATIAL_ACCELERATOR , "Spatial acceleration structure is loaded from cache %s." , cache_file.c_str() );
+                    return;
+                }
+
+                // The cache is not updated after refitting so that the quality is always compared with the structure
+                // built for the geometry in the cache, instead of degrading frame after frame.
+                if( Update( bbox ) ){
+                    slog( INFO , SPATIAL_ACCELERATOR , "Spatial acceleration structure is loaded from cache %s and refitted." , cache_file.c_str() );
+                    return;
+                }
+                built = true;
+            }
+        }
+
+        if( !built )
+            slog( WARNING , SPATIAL_ACCELERATOR , "Cache %s doesn't match the spatial acceleration structure, it will be rebuilt." , cache_file.c_str() );
+    }
+
+    if( !built )
+        Build( primitives , bbox );
+    if( !m_isValid )
+        return;
+
+    std::unordered_map<const Primitive*, unsigned> indices;
+    indices.reserve( primitive_cnt );
+    for( auto i = 0u ; i < primitive_cnt ; ++i )
+        indices[primitives[i]] = i;
+
+    // The cache is saved to a temporary file first so that other renderings sharing the same resource folder won't
+    // load a partially saved cache. Its name is unique to the process and the accelerator, nobody else writes to it.
+    char suffix[64];
+    snprintf( suffix , sizeof( suffix ) , ".%d.%p.tmp" , (int)getpid() , (const void*)this );
+    const auto tmp_file = cache_file + suffix;
+    auto saved = false;
+    {
+        OFileStream stream( tmp_file );
+        stream << ACCELERATOR_CACHE_MAGIC << ACCELERATOR_CACHE_VERSION << topology_low << topology_high << hash_low << hash_high << primitive_cnt;
+        saved = saveCache( stream , indices );
+    }
+
+    if( saved ){
+        std::remove( cache_file.c_str() );
+        std::rename( tmp_file.c_str() , cache_file.c_str() );
+    }else{
+        std::remove( tmp_file.c_str() );
+    }
+}
+
+SimdIsa AcceleratorSimdIsa( const StringID type ){
+    for( const auto& accel : SIMD_ACCELERATORS )
+        if( accel.type == type )
+            return accel.isa;
+    return SimdIsa::Scalar;
+}
+
+std::unique_ptr<Accelerator> MakeAccelerator( const StringID type ){
+    auto requested = 0u;
+    while( requested < SIMD_ACCELERATOR_CNT && SIMD_ACCELERATORS[requested].type != type )
+        ++requested;
+
+    // Accelerators without SIMD kernels run on any CPU.
+    if( requested == SIMD_ACCELERATOR_CNT ){
+        SORT_STATS(sSimdIsa = (StatsInt)SimdIsa::Scalar);
+        return MakeUniqueInstance<Accelerator>( type );
+    }
+
+    for( auto i = requested ; i < SIMD_ACCELERATOR_CNT ; ++i ){
+        const auto& candidate = SIMD_ACCELERATORS[i];
+        if( !IsSimdIsaSupported( candidate.isa ) )
+            continue;
+
+        auto accel = MakeUniqueInstance<Accelerator>( candidate.type );
+        if( IS_PTR_INVALID( accel ) )
+            continue;
+
+        if( i != requested )
+            slog( WARNING , SPATIAL_ACCELERATOR , "%s is not supported by the CPU, %s is used instead." , SIMD_ACCELERATORS[requested].name , candidate.name );
+        SORT_STATS(sSimdIsa = (StatsInt)candidate.isa);
+        return accel;
+    }
+    return nullptr;
+}
+
+bool Accelerator::Update( const BBox& bbox , const float max_sah_ratio ){
+    sAssert( IS_PTR_VALID( m_primitives ) , SPATIAL_ACCELERATOR );
+
+    // the cost is evaluated before refitting since it depends on the bounding boxes of the nodes only
+    const auto sah = EvaluateSAH();
+    if( m_isValid && Refit() ){
+        const auto refitted_sah = EvaluateSAH();
+        if( max_sah_ratio <= 0.0f || refitted_sah <= sah * max_sah_ratio )
+            return true;
+
+        slog( INFO , SPATIAL_ACCELERATOR , "SAH cost of the refitted spatial acceleration structure grows from %f to %f, it will be rebuilt." , sah , refitted_sah );
+    }
+
+    // the primitive list is referred by the accelerator, it can't be a temporary copy
+    const auto& primitives = *m_primitives;
+    m_isValid = false;
+    Build( primitives , bbox );
+    return false;
+}
+
+unsigned Accelerator::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+
+    auto mask = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( GetIntersect( rays[i] , intersects[i] ) )
+            mask |= ( 1u << i );
+    }
+    return mask;
+}
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+unsigned Accelerator::IsOccluded( const Ray* rays , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+
+    auto mask = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( IsOccluded( rays[i] ) )
+            mask |= ( 1u << i );
+    }
+    return mask;
+}
+#endif
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack* ms ) const {
+bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack* ms , const Primitive** occluder ) const {
     SurfaceInteraction intersection;
     intersection.query_shadow = true;
     if (!GetIntersect(ray, intersection)) {
@@ -35,6 +275,8 @@ bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack
     // primitive being null is a special coding meaning the ray is blocked by an opaque primitive.
     if( IS_PTR_INVALID( intersection.primitive ) ){
         attenuation = 0.0f;
+        if( occluder && intersection.occluder )
+            *occluder = intersection.occluder;
         return true;
     }
 
@@ -60,8 +302,8 @@ bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack
         material->UpdateMediumStack(mi, interaction_flag, *ms);
     }
 
-    ray.m_Ori = intersection.intersect;
-    ray.m_fMin = 0.001f;              // avoid self collision again.
+    ray.m_Ori = intersection.SpawnOrigin( ray.m_Dir );   // avoid self collision again.
+    ray.m_fMin = 0.0f;
     ray.m_fMax -= intersection.t;
 
     return true;
@@ -108,8 +350,8 @@ bool Accelerator::UpdateMediumStack( Ray& ray , MediumStack& ms , const bool rev
     mi.mesh = intersection.primitive->GetMesh();
 	material->UpdateMediumStack(mi, interaction_flag, ms);
 
-	ray.m_Ori = intersection.intersect;
-	ray.m_fMin = 0.001f;              // avoid self collision again.
+	ray.m_Ori = intersection.SpawnOrigin( ray.m_Dir );   // avoid self collision again.
+	ray.m_fMin = 0.0f;
 	ray.m_fMax -= intersection.t;
 
 	return true;
@@ -18,7 +18,10 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <unordered_map>
 #include "core/define.h"
+#include "core/cpu.h"
 #include "math/bbox.h"
 #include "core/rtti.h"
 #include "core/stats.h"
@@ -30,6 +33,12 @@ class Ray;
 struct SurfaceInteraction;
 struct BSSRDFIntersections;
 
+//! @brief  Maximum number of rays in a ray packet.
+static constexpr unsigned RAY_PACKET_SIZE = 8;
+
+//! @brief  A refitted acceleration structure is rebuilt if its SAH cost grows more than this ratio.
+static constexpr float ACCELERATOR_REFIT_SAH_RATIO = 1.5f;
+
 #ifdef ENABLE_TRANSPARENT_SHADOW
 SORT_FORCEINLINE bool isShadowRay( const SurfaceInteraction* intersection ){
     return intersection->query_shadow;
@@ -70,6 +79,20 @@ public:
     //!                     it returns false.
     virtual bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const = 0;
 
+    //! @brief Get intersections between a packet of rays and the primitive set.
+    //!
+    //! This is for coherent rays, like camera rays, so that spatial data structure could traverse the rays together
+    //! and access each node only once for the whole packet. The result of each ray is exactly the same with calling
+    //! the above interface for it. By default, the rays are traced one by one.
+    //! Whether a ray intersects anything is indicated by the primitive of its intersection, except for shadow rays blocked
+    //! by opaque primitives, which have no primitive in their intersections. Such rays are only in the returned mask.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays intersecting anything, the i-th bit is for the i-th ray.
+    virtual unsigned GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const;
+
 #ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
@@ -80,6 +103,16 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     virtual bool IsOccluded( const Ray& r ) const = 0;
+
+    //! @brief Detect occlusion of a packet of shadow rays.
+    //!
+    //! This is for shadow rays sharing the same origin, like the ones towards all lights of a shading point. By default,
+    //! the rays are tested one by one.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays occluded by anything, the i-th bit is for the i-th ray.
+    virtual unsigned IsOccluded( const Ray* rays , const unsigned cnt ) const;
 #else
     //! @brief  Evaluate attenuation along a ray segment.
     //!
@@ -89,8 +122,9 @@ public:
     //! @param r            The ray to be tested. Its origin will be updated upon intersection.
     //! @param attenuation  The occlusion along the ray.
     //! @param ms           The medium stack used to evaluate shadow attenuation.
+    //! @param occluder     The opaque primitive blocking the ray if it is known, it is untouched otherwise.
     //! @return             Whether there is an intersection along the ray.
-    bool         GetAttenuation( Ray& r , Spectrum& attenuation , MediumStack* ms = nullptr ) const;
+    bool         GetAttenuation( Ray& r , Spectrum& attenuation , MediumStack* ms = nullptr , const Primitive** occluder = nullptr ) const;
 #endif
 
 	//! @brief	Update medium stack.
@@ -124,6 +158,47 @@ public:
     //! @param bbox             The bounding box of the scene.
     virtual void Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) = 0;
 
+    //! @brief Build the acceleration structure, or load it from the cache if it was built before.
+    //!
+    //! The cache file is named after a hash of the topology of all primitives. If there is a valid cache with the same
+    //! configuration, the structure is loaded from it instead of being built, otherwise it is built and saved as a
+    //! cache for later renderings. If only the geometry changed since the cache was saved, like in the following frames
+    //! of an animation, the loaded structure is updated by 'Update'.
+    //! Accelerators not supporting cache are simply built.
+    //!
+    //! @param primitives       A vector holding all primitives.
+    //! @param bbox             The bounding box of the scene.
+    //! @param cache_folder     Folder where cache files are saved.
+    void    BuildWithCache(const std::vector<const Primitive*>& primitives, const BBox& bbox, const std::string& cache_folder);
+
+    //! @brief Refit the acceleration structure after the primitives are moved or deformed.
+    //!
+    //! The hierarchy is kept as it is, only bounding boxes of nodes are evaluated again from bottom to top. It is a lot
+    //! cheaper than building the structure again, but the quality of the structure degrades as the primitives move
+    //! further away from where they were during construction.
+    //! The primitive list has to be exactly the same with the one used to build the structure.
+    //!
+    //! @return                 False if the accelerator doesn't support refitting.
+    virtual bool    Refit() { return false; }
+
+    //! @brief Evaluate the SAH cost of the built acceleration structure.
+    //!
+    //! The cost is relative to the surface area of the whole structure, it is used to measure how much a refitted
+    //! structure degrades.
+    //!
+    //! @return                 SAH cost of the structure, 0 if the accelerator doesn't support it.
+    virtual float   EvaluateSAH() const { return 0.0f; }
+
+    //! @brief Update the acceleration structure after the primitives are moved or deformed.
+    //!
+    //! The structure is refitted first. It is built again from scratch if refitting is not supported or the SAH cost
+    //! after refitting is more than 'max_sah_ratio' times of the one before refitting.
+    //!
+    //! @param bbox             The bounding box of the scene, it is only used if the structure is built again.
+    //! @param max_sah_ratio    Maximum ratio of SAH cost growth. Zero means the refitted structure is always accepted.
+    //! @return                 Whether the structure is refitted instead of built again.
+    bool    Update(const BBox& bbox, const float max_sah_ratio = ACCELERATOR_REFIT_SAH_RATIO);
+
     //! @brief Get the bounding box of the primitive set.
     //!
     //! @return Bounding box of the spatial acceleration structure.
@@ -146,6 +221,25 @@ public:
 	virtual std::unique_ptr<Accelerator>	Clone() const = 0;
 
 protected:
+    //! @brief Save the built acceleration structure to the cache.
+    //!
+    //! Primitives are saved as their indices in the primitive list since pointers are not persistent. Configuration
+    //! that affects the construction needs to be saved too so that it could be verified during loading.
+    //!
+    //! @param stream           Stream to save the structure to.
+    //! @param indices          Index of each primitive in the primitive list.
+    //! @return                 Whether the accelerator supports cache.
+    virtual bool    saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const { return false; }
+
+    //! @brief Load the acceleration structure from the cache.
+    //!
+    //! The primitive list and bounding box are already set before this is called. Implementation needs to make sure
+    //! that everything loaded is in range, a corrupted cache file should be rejected instead of crashing.
+    //!
+    //! @param stream           Stream to load the structure from.
+    //! @return                 False if the cache doesn't match the accelerator.
+    virtual bool    loadCache( IStreamBase& stream ) { return false; }
+
     /**< The vector holding all primitive pointers. */
     const std::vector<const Primitive*>*    m_primitives = nullptr;
     /**< The bounding box of all primitives. */
@@ -153,3 +247,20 @@ protected:
     /**< Whether the spatial structure is constructed before. */
     bool                                    m_isValid = false;
 };
+
+//! @brief  Instruction set that the SIMD kernels of an accelerator are compiled with.
+//!
+//! @param  type        Type of the accelerator.
+//! @return             The instruction set that the CPU needs to support to run the accelerator, it is
+//!                     SimdIsa::Scalar for accelerators that don't have SIMD kernels.
+SimdIsa AcceleratorSimdIsa( const StringID type );
+
+//! @brief  Create an accelerator that could run on the current CPU.
+//!
+//! SIMD kernels of QBVH, OBVH and HBVH are compiled with different instruction sets. If the CPU doesn't support the
+//! instruction set of the requested accelerator, the widest one that it does support is created instead, ending
+//! with the scalar BVH. All of them share the same serialization format so that the configuration still applies.
+//!
+//! @param  type        Type of the requested accelerator.
+//! @return             The created accelerator, it could be nullptr if the type is not registered.
+std::unique_ptr<Accelerator> MakeAccelerator( const StringID type );
@@ -0,0 +1,218 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "auto.h"
+#include "core/primitive.h"
+#include "core/log.h"
+#include "core/globalconfig.h"
+#include "stream/mstream.h"
+
+SORT_STATS_DEFINE_COUNTER(sAutoPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sAutoTriangleCount)
+SORT_STATS_DEFINE_COUNTER(sAutoLineCount)
+SORT_STATS_DEFINE_COUNTER(sAutoInstanceCount)
+SORT_STATS_DEFINE_FCOUNTER(sAutoSizeSpread)
+SORT_STATS_DEFINE_COUNTER(sAutoSahBuildTime)
+SORT_STATS_DEFINE_COUNTER(sAutoPickedAccelerator)
+SORT_STATS_DEFINE_COUNTER(sAutoSpatialSplit)
+
+SORT_STATS_COUNTER("Spatial-Structure(Auto)", "Primitive Count", sAutoPrimitiveCount);
+SORT_STATS_COUNTER("Spatial-Structure(Auto)", "Triangle Count", sAutoTriangleCount);
+SORT_STATS_COUNTER("Spatial-Structure(Auto)", "Line Count", sAutoLineCount);
+SORT_STATS_COUNTER("Spatial-Structure(Auto)", "Instance Count", sAutoInstanceCount);
+SORT_STATS_FCOUNTER("Spatial-Structure(Auto)", "Primitive Size Spread", sAutoSizeSpread);
+SORT_STATS_TIME_US("Spatial-Structure(Auto)", "Estimated SAH Build Time", sAutoSahBuildTime);
+SORT_STATS_COUNTER("Spatial-Structure(Auto)", "Spatial Split", sAutoSpatialSplit);
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+// The picked structure is recorded as its type, it is printed as the name of the accelerator.
+SORT_STATS_FORMATTER( StatsFormatter_PickedAccelerator , StatsInt )
+std::string StatsFormatter_PickedAccelerator::ToString( StatsInt v ){
+    return Factory<Accelerator>::GetSingleton().GetTypeName( StringID( (sid_t)v ) );
+}
+SORT_STATS_INT_TYPE("Spatial-Structure(Auto)", "Picked Structure", sAutoPickedAccelerator, StatsFormatter_PickedAccelerator);
+#endif
+
+// Scenes with no more primitives than this use the binary BVH.
+static constexpr unsigned   AUTO_SMALL_SCENE            = 256;
+// Scenes with at least this many primitives use the 16-wide BVH if the CPU supports it.
+static constexpr unsigned   AUTO_LARGE_SCENE            = 1u << 20;
+// Rough time of building a SAH BVH on one thread, per primitive and per level of the tree, in seconds.
+static constexpr float      AUTO_SAH_BUILD_COST         = 1.0e-7f;
+// How many times slower a SAH BVH with spatial splits is built.
+static constexpr float      AUTO_SPATIAL_SPLIT_COST     = 2.0f;
+// Rough time of building a LBVH on one thread, per primitive, in seconds.
+static constexpr float      AUTO_LBVH_BUILD_COST        = 2.0e-8f;
+// Rough time of treelet optimization of a LBVH on one thread, per primitive, in seconds.
+static constexpr float      AUTO_TREELET_COST           = 5.0e-7f;
+// Primitives whose size spread is below this are considered to be of similar sizes.
+static constexpr float      AUTO_UNIFORM_SIZE_SPREAD    = 1.0f;
+// Primitives whose size spread is above this benefit from spatial splits.
+static constexpr float      AUTO_SPATIAL_SPLIT_SPREAD   = 2.5f;
+// Scenes with more lines than this portion are considered as hair, which benefits from spatial splits.
+static constexpr float      AUTO_HAIR_RATIO             = 0.5f;
+// Maximum depth of all picked BVHs.
+static constexpr unsigned   AUTO_MAX_NODE_DEPTH         = 28;
+// Maximum number of duplicated primitive references of spatial splits, relative to the number of primitives.
+static constexpr float      AUTO_SPATIAL_SPLIT_BUDGET   = 0.3f;
+
+//! @brief Create the picked accelerator and configure it through its serialization, the same way the exporter does.
+//!
+//! @param choice           The picked accelerator and its configuration.
+//! @return                 The created accelerator.
+static std::unique_ptr<Accelerator> makeAccelerator( const AutoAccelChoice& choice ){
+    auto accel = MakeAccelerator( choice.type );
+    if( choice.type == SID("UniGrid") )
+        return accel;
+
+    IMemoryStream config;
+    if( choice.type == SID("Lbvh") )
+        config << AUTO_MAX_NODE_DEPTH << choice.max_pri_in_leaf << choice.treelet_optimization;
+    else
+        config << AUTO_MAX_NODE_DEPTH << choice.max_pri_in_leaf << choice.spatial_split << AUTO_SPATIAL_SPLIT_BUDGET;
+    OMemoryStream stream( config );
+    accel->Serialize( stream );
+    return accel;
+}
+
+AutoAccelStats Auto::GatherStats( const std::vector<const Primitive*>& primitives ){
+    AutoAccelStats stats;
+    stats.primitive_cnt = (unsigned)primitives.size();
+    if( primitives.empty() )
+        return stats;
+
+    // Sizes are measured by the diagonal of the bounding boxes instead of the surface area, which is zero for
+    // axis aligned lines.
+    auto sum = 0.0 , sum_sq = 0.0;
+    for( const auto primitive : primitives ){
+        switch( primitive->GetShapeType() ){
+        case SHAPE_TRIANGLE:
+            ++stats.triangle_cnt;
+            break;
+        case SHAPE_LINE:
+            ++stats.line_cnt;
+            break;
+        case SHAPE_INSTANCE:
+            ++stats.instance_cnt;
+            break;
+        default:
+            break;
+        }
+
+        const auto& bbox = primitive->GetBBox();
+        const auto size = (double)std::log2( std::max( ( bbox.m_Max - bbox.m_Min ).Length() , 1.0e-8f ) );
+        sum += size;
+        sum_sq += size * size;
+    }
+
+    const auto mean = sum / stats.primitive_cnt;
+    stats.size_spread = (float)std::sqrt( std::max( 0.0 , sum_sq / stats.primitive_cnt - mean * mean ) );
+
+    const auto levels = std::log2( (float)std::max( stats.primitive_cnt , 2u ) );
+    stats.sah_build_time = stats.primitive_cnt * levels * AUTO_SAH_BUILD_COST / (float)std::max( g_threadCnt , 1u );
+    return stats;
+}
+
+AutoAccelChoice Auto::PickAccelerator( const AutoAccelStats& stats , const float budget ){
+    AutoAccelChoice choice;
+
+    if( stats.primitive_cnt <= AUTO_SMALL_SCENE ){
+        choice.type = SID("Bvh");
+        choice.max_pri_in_leaf = 8;
+        return choice;
+    }
+
+    const auto thread_cnt = (float)std::max( g_threadCnt , 1u );
+    if( budget > 0.0f && stats.sah_build_time > budget ){
+        // Primitives of similar sizes fit nicely in grid cells.
+        if( stats.size_spread < AUTO_UNIFORM_SIZE_SPREAD && stats.triangle_cnt == stats.primitive_cnt ){
+            choice.type = SID("UniGrid");
+            return choice;
+        }
+
+        const auto lbvh_time = stats.primitive_cnt * AUTO_LBVH_BUILD_COST / thread_cnt;
+        const auto treelet_time = stats.primitive_cnt * AUTO_TREELET_COST / thread_cnt;
+        choice.type = SID("Lbvh");
+        choice.max_pri_in_leaf = 8;
+        choice.treelet_optimization = lbvh_time + treelet_time <= budget;
+        return choice;
+    }
+
+    // A scalar build of a SIMD BVH is picked only if the CPU supports no SIMD at all, the binary BVH is faster then.
+    choice.type = SID("Bvh");
+    choice.max_pri_in_leaf = 8;
+    const std::pair<StringID, unsigned> candidates[] = { { SID("Hbvh") , 32 } , { SID("Obvh") , 16 } , { SID("Qbvh") , 16 } };
+    for( const auto& candidate : candidates ){
+        if( candidate.first == SID("Hbvh") && stats.primitive_cnt < AUTO_LARGE_SCENE )
+            continue;
+        const auto isa = AcceleratorSimdIsa( candidate.first );
+        if( isa != SimdIsa::Scalar && IsSimdIsaSupported( isa ) ){
+            choice.type = candidate.first;
+            choice.max_pri_in_leaf = candidate.second;
+            break;
+        }
+    }
+
+    const auto hair = stats.line_cnt > stats.primitive_cnt * AUTO_HAIR_RATIO;
+    const auto spatial_split_time = stats.sah_build_time * AUTO_SPATIAL_SPLIT_COST;
+    choice.spatial_split = ( hair || stats.size_spread > AUTO_SPATIAL_SPLIT_SPREAD ) && ( budget <= 0.0f || spatial_split_time <= budget );
+    return choice;
+}
+
+void Auto::Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ){
+    SORT_PROFILE("Build Auto");
+
+    m_primitives = &primitives;
+    m_bbox = bbox;
+
+    const auto stats = GatherStats( primitives );
+    const auto choice = PickAccelerator( stats , m_buildBudget );
+    m_accelerator = makeAccelerator( choice );
+    m_accelerator->Build( primitives , bbox );
+    m_bbox = m_accelerator->GetBBox();
+    m_isValid = m_accelerator->GetIsValid();
+
+    const auto name = Factory<Accelerator>::GetSingleton().GetTypeName( choice.type );
+    slog( INFO , SPATIAL_ACCELERATOR , "%s is picked for %d primitives (%d triangles, %d lines, %d instances), size spread %.2f, estimated SAH build time %.3fs%s." ,
+          name.c_str() , stats.primitive_cnt , stats.triangle_cnt , stats.line_cnt , stats.instance_cnt , stats.size_spread ,
+          stats.sah_build_time , choice.spatial_split ? ", with spatial splits" : "" );
+
+    SORT_STATS(sAutoPrimitiveCount = stats.primitive_cnt);
+    SORT_STATS(sAutoTriangleCount = stats.triangle_cnt);
+    SORT_STATS(sAutoLineCount = stats.line_cnt);
+    SORT_STATS(sAutoInstanceCount = stats.instance_cnt);
+    SORT_STATS(sAutoSizeSpread = stats.size_spread);
+    SORT_STATS(sAutoSahBuildTime = (StatsInt)( stats.sah_build_time * 1.0e6f ));
+    SORT_STATS(sAutoPickedAccelerator = (StatsInt)choice.type.m_sid);
+    SORT_STATS(sAutoSpatialSplit = choice.spatial_split ? 1 : 0);
+}
+
+bool Auto::Refit(){
+    if( !m_accelerator || !m_accelerator->Refit() )
+        return false;
+    m_bbox = m_accelerator->GetBBox();
+    return true;
+}
+
+std::unique_ptr<Accelerator> Auto::Clone() const {
+	auto ret = std::make_unique<Auto>();
+	ret->m_buildBudget = m_buildBudget;
+
+	return ret;
+}
@@ -0,0 +1,176 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include "accelerator.h"
+
+//! @brief Statistics of primitives that the automatic accelerator selection is based on.
+struct AutoAccelStats{
+    /**< Total number of primitives. */
+    unsigned    primitive_cnt = 0;
+    /**< Number of triangles. */
+    unsigned    triangle_cnt = 0;
+    /**< Number of lines, which are mostly hair strands. */
+    unsigned    line_cnt = 0;
+    /**< Number of instances. */
+    unsigned    instance_cnt = 0;
+    /**< Standard deviation of the base-2 logarithm of the diagonal lengths of primitive bounding boxes. */
+    float       size_spread = 0.0f;
+    /**< Estimated time of building a SAH BVH, in seconds. */
+    float       sah_build_time = 0.0f;
+};
+
+//! @brief The acceleration structure picked from statistics of primitives and its configuration.
+struct AutoAccelChoice{
+    /**< Type of the picked accelerator. */
+    StringID    type;
+    /**< Maximum number of primitives in leaf nodes, it is not used by the uniform grid. */
+    unsigned    max_pri_in_leaf = 0;
+    /**< Whether spatial splits are enabled, it is only used by SAH BVHs. */
+    bool        spatial_split = false;
+    /**< Whether treelets are restructured, it is only used by LBVH. */
+    bool        treelet_optimization = false;
+};
+
+//! @brief Spatial acceleration structure picked from statistics of the scene.
+/**
+ * There is no single spatial acceleration structure that works best for all scenes. Instead of picking one by
+ * hand, this accelerator examines the primitives right before construction, the number of them, the mix of
+ * triangles, lines and other shapes, how much their sizes vary and how long the construction would take.
+ * The most suitable structure is then configured and built, all queries are forwarded to it.
+ *  - Tiny scenes use the binary BVH, wider nodes don't pay off with only a few levels.
+ *  - If a SAH BVH can't be built within the build time budget, the uniform grid is picked for scenes with
+ *    primitives of similar sizes, the LBVH for the rest.
+ *  - Otherwise the widest SIMD BVH that the CPU supports is picked. Spatial splits are enabled for scenes with
+ *    primitives of very different sizes and for hair, whose long and thin strands have loose bounding boxes.
+ * KD-Tree and OcTree are never picked, they are slower than the SIMD BVHs in all benchmarked scenes.
+ * The decision is logged and recorded in stats.
+ */
+class Auto : public Accelerator{
+public:
+    DEFINE_RTTI( Auto , Accelerator );
+
+    //! @brief Get intersection between the ray and the primitive set with the picked acceleration structure.
+    //!
+    //! @param r            The input ray to be tested.
+    //! @param intersect    The intersection result.
+    //! @return             It will return true if there is an intersection, otherwise it returns false.
+    bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override{
+        return m_accelerator->GetIntersect( r , intersect );
+    }
+
+    //! @brief Get intersections between a packet of rays and the primitive set with the picked acceleration structure.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays intersecting anything, the i-th bit is for the i-th ray.
+    unsigned GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const override{
+        return m_accelerator->GetIntersect( rays , intersects , cnt );
+    }
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Detect occlusion of a shadow ray with the picked acceleration structure.
+    //!
+    //! @param r            The ray to be tested.
+    //! @return             Whether the ray is occluded by anything.
+    bool IsOccluded( const Ray& r ) const override{
+        return m_accelerator->IsOccluded( r );
+    }
+
+    //! @brief Detect occlusion of a packet of shadow rays with the picked acceleration structure.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays occluded by anything, the i-th bit is for the i-th ray.
+    unsigned IsOccluded( const Ray* rays , const unsigned cnt ) const override{
+        return m_accelerator->IsOccluded( rays , cnt );
+    }
+#endif
+
+    //! @brief Get multiple intersections between the ray and the primitive set with the picked acceleration structure.
+    //!
+    //! @param  r           The input ray to be tested.
+    //! @param  intersect   The intersection result that holds all intersection.
+    //! @param  matID       We are only interested in intersection with the same material, whose material id should be set to matID.
+    void GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const override{
+        m_accelerator->GetIntersect( r , intersect , matID );
+    }
+
+    //! @brief Pick an acceleration structure based on statistics of the primitives and build it.
+    //!
+    //! @param primitives       A vector holding all primitives.
+    //! @param bbox             The bounding box of the scene.
+    void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
+
+    //! @brief Refit the picked acceleration structure.
+    //!
+    //! @return                 False if the picked accelerator doesn't support refitting.
+    bool    Refit() override;
+
+    //! @brief Evaluate the SAH cost of the picked acceleration structure.
+    //!
+    //! @return                 SAH cost of the structure, 0 if the picked accelerator doesn't support it.
+    float   EvaluateSAH() const override{
+        return m_accelerator ? m_accelerator->EvaluateSAH() : 0.0f;
+    }
+
+    //! @brief      Serializing data from stream.
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different
+    //!             situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override{
+        stream >> m_buildBudget;
+    }
+
+	//! @brief	Clone the accelerator.
+	//!
+	//! Only configuration will be cloned, not the data inside the accelerator, this is for primitives that has volumes attached.
+	//!
+	//! @return		Cloned accelerator.
+	std::unique_ptr<Accelerator>	Clone() const override;
+
+    //! @brief Gather statistics of primitives.
+    //!
+    //! @param primitives       Primitives to be examined.
+    //! @return                 Statistics of the primitives.
+    static AutoAccelStats   GatherStats( const std::vector<const Primitive*>& primitives );
+
+    //! @brief Pick an acceleration structure and its configuration.
+    //!
+    //! @param stats            Statistics of primitives.
+    //! @param budget           Build time budget in seconds, zero means there is no limit.
+    //! @return                 The picked accelerator and its configuration.
+    static AutoAccelChoice  PickAccelerator( const AutoAccelStats& stats , const float budget );
+
+    //! @brief Get the picked acceleration structure.
+    //!
+    //! @return                 The picked acceleration structure, it is nullptr before construction.
+    SORT_FORCEINLINE const Accelerator* GetPickedAccelerator() const{
+        return m_accelerator.get();
+    }
+
+private:
+    /**< Build time budget in seconds, zero means there is no limit. */
+    float                           m_buildBudget = 0.0f;
+    /**< The picked acceleration structure. */
+    std::unique_ptr<Accelerator>    m_accelerator;
+
+    SORT_STATS_ENABLE( "Spatial-Structure(Auto)" )
+};
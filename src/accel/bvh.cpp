@@ -22,6 +22,7 @@
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
+#include "core/hwcounter.h"
 
 SORT_STATS_DEFINE_COUNTER(sBvhNodeCount)
 SORT_STATS_DEFINE_COUNTER(sBvhLeafNodeCount)
@@ -46,18 +47,28 @@ void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbo
 	if (primitives.empty())
 		return;
 
-    m_bvhpri = std::make_unique<Bvh_Primitive[]>(m_primitives->size());
+    // extra slots are reserved for references duplicated by spatial splits
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto capacity = bvhReferenceCapacity( primitive_cnt , m_spatialSplit , m_spatialSplitBudget );
+    m_bvhpri = std::make_unique<Bvh_Primitive[]>(capacity);
+    SORT_STATS_MEMORY_RECORD(build_memory)
+    SORT_STATS(build_memory.Track( &sBvhBuildMemory , (StatsInt)( sizeof(Bvh_Primitive) * capacity ) ));
 
     m_bbox = bbox;
 
     // generate BVH primitives
-    const auto primitive_cnt = m_primitives->size();
     for (auto i = 0u; i < primitive_cnt; ++i)
         m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
 
     // recursively split node
     m_root = std::make_unique<Bvh_Node>();
-    splitNode( m_root.get() , 0u , (unsigned)m_primitives->size() , 1u );
+    splitNode( m_root.get() , { 0u , primitive_cnt , capacity } , 1u );
+
+    // wait for all sub-trees built in other tasks
+    WAIT_FOR_CHILDREN();
+
+    releaseBuildData();
+    fitMotion( m_root.get() );
 
     m_isValid = true;
 
@@ -65,9 +76,12 @@ void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbo
     SORT_STATS(sBvhPrimitiveCount=primitive_cnt);
 }
 
-void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth ){
+void Bvh::splitNode( Bvh_Node* node , const Bvh_Range& range , unsigned depth ){
     SORT_STATS(sBVHDepth = std::max( sBVHDepth , (StatsInt)depth ) );
 
+    const auto start = range.start;
+    const auto end = range.end;
+
     // generate the bounding box for the node
     for( auto i = start ; i < end ; i++ )
         node->bbox.Union( m_bvhpri[i].GetBBox() );
@@ -78,35 +92,51 @@ void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned d
         return;
     }
 
-    // pick best split plane
-    unsigned    split_axis;
-    float       split_pos;
-    const auto sah = pickBestSplit( split_axis , split_pos , m_bvhpri.get() , node->bbox , start , end );
-    if( sah >= primitive_num ){
+    // pick the best split and partition the data
+    Bvh_Range left_range , right_range;
+    if( !splitBvhNode( m_bvhpri.get() , m_bbox , node->bbox , range , left_range , right_range ) ){
         makeLeaf( node , start , end );
         return;
     }
 
-    // partition the data
-    auto compare = [split_pos,split_axis](const Bvh_Primitive& pri){return pri.m_centroid[split_axis] < split_pos;};
-    auto middle = std::partition( m_bvhpri.get() + start , m_bvhpri.get() + end, compare );
-    auto mid = (unsigned)(middle - m_bvhpri.get());
+    node->left = std::make_unique<Bvh_Node>();
+    node->right = std::make_unique<Bvh_Node>();
 
-    // To avoid degenerated node that has nothing in it.
-    // Technically, this shouldn't happen. Unlike KD-Tree implementation, there is only 16 split plane candidate, it is
-    // totally possible to pick one with no primitive on one side of the plane, resulting a crash later during ray tracing.
-    if (mid == start || mid == end){
-        makeLeaf(node, start, end);
-        return;
+    // Large sub-trees are built in separate tasks. Both of them need to be spawned as tasks, otherwise the serial
+    // construction of one sub-tree would wait for the other one during parallel binning.
+    if( primitive_num >= BVH_PARALLEL_SUBTREE_THRESHOLD && isParallelBvhConstructionAvailable() ){
+        auto left = node->left.get();
+        auto right = node->right.get();
+        SPAWN_TASK<Function_Task>( "Build BVH Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( left , left_range , depth + 1 ); } );
+        SPAWN_TASK<Function_Task>( "Build BVH Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( right , right_range , depth + 1 ); } );
+    }else{
+        splitNode( node->left.get() , left_range , depth + 1 );
+        splitNode( node->right.get() , right_range , depth + 1 );
     }
 
-    node->left = std::make_unique<Bvh_Node>();
-    splitNode( node->left.get() , start , mid , depth + 1 );
+    SORT_STATS(sBvhNodeCount+=2);
+}
 
-    node->right = std::make_unique<Bvh_Node>();
-    splitNode( node->right.get() , mid , end , depth + 1 );
+void Bvh::releaseBuildData(){
+    // there are more references than primitives only if spatial splits duplicate some of them
+    m_references.clear();
+    m_references.reserve( m_primitives->size() );
+    compactNode( m_root.get() );
+    m_references.shrink_to_fit();
+    m_bvhpri = nullptr;
+}
 
-    SORT_STATS(sBvhNodeCount+=2);
+void Bvh::compactNode( Bvh_Node* node ){
+    if( node->pri_num != 0 ){
+        const auto offset = (unsigned)m_references.size();
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_num ; ++i )
+            m_references.push_back( m_bvhpri[i].primitive );
+        node->pri_offset = offset;
+        return;
+    }
+
+    compactNode( node->left.get() );
+    compactNode( node->right.get() );
 }
 
 void Bvh::makeLeaf( Bvh_Node* node , unsigned start , unsigned end ){
@@ -119,10 +149,11 @@ void Bvh::makeLeaf( Bvh_Node* node , unsigned start , unsigned end ){
 
 bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     SORT_PROFILE("Traverse Bvh");
-    SORT_STATS(++sRayCount);
+    SORT_HW_COUNTERS("Traversal");
+    SORT_STATS_HOT(++sRayCount);
     
 #ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
 #endif
 
     ray.Prepare();
@@ -144,8 +175,9 @@ bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool Bvh::IsOccluded( const Ray& ray ) const{
     SORT_PROFILE("Traverse Bvh");
-    SORT_STATS(++sRayCount);
-    SORT_STATS(++sShadowRayCount);
+    SORT_HW_COUNTERS("Traversal");
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
 
     ray.Prepare();
 
@@ -171,23 +203,13 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
 
         auto found = false;
         for(auto i = _start ; i < _end ; i++ ){
-            SORT_STATS(++sIntersectionTest);
-            found |= m_bvhpri[i].primitive->GetIntersect( ray , intersect );
+            SORT_STATS_HOT(++sIntersectionTest);
+            found |= m_references[i]->GetIntersect( ray , intersect );
             
-            // a quick branching out if a shadow ray is hit by an opaque object
-            const auto is_shadow_ray_blocked = isShadowRay( intersect ) && found;
-            if( is_shadow_ray_blocked ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR);
-                sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR);
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                    // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                    // that the above level logic will take advantage of.
-                    intersect->primitive = nullptr;
-                }
-#endif
+            // a quick branching out if a shadow ray is hit by anything, opaque primitives are already reported
+            // with no primitive in the intersection
+            if( isShadowRay( intersect ) && found )
                 return true;
-            }
         }
         return found;
     }
@@ -195,8 +217,9 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
     const auto left = node->left.get();
     const auto right = node->right.get();
 
-    const auto fmin0 = Intersect( ray , left->bbox );
-    const auto fmin1 = Intersect( ray , right->bbox );
+    BBox bbox0 , bbox1;
+    const auto fmin0 = Intersect( ray , nodeBBox( left , ray , bbox0 ) );
+    const auto fmin1 = Intersect( ray , nodeBBox( right , ray , bbox1 ) );
 
     auto inter = false;
     if( fmin1 > fmin0 ){
@@ -214,7 +237,7 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
 
 void Bvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
     SORT_PROFILE("Traverse Bvh");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
     ray.Prepare();
 
@@ -240,12 +263,24 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
 
         SurfaceInteraction intersection;
         for(auto i = _start ; i < _end ; i++ ){
-            if( matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID() )
+            if( matID != m_references[i]->GetMaterial()->GetUniqueID() )
+                continue;
+
+            // make sure the primitive is not checked before, spatial splits could reference it in multiple leaves
+            auto checked = false;
+            for( auto j = 0u ; j < intersect.cnt ; ++j ){
+                if( m_references[i] == intersect.intersections[j]->intersection.primitive ){
+                    checked = true;
+                    break;
+                }
+            }
+            if( checked )
                 continue;
-            SORT_STATS(++sIntersectionTest);
+
+            SORT_STATS_HOT(++sIntersectionTest);
         
             intersection.Reset();
-            const auto intersected = m_bvhpri[i].primitive->GetIntersect( ray , &intersection );
+            const auto intersected = m_references[i]->GetIntersect( ray , &intersection );
             if( intersected ){
                 if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
                     intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
@@ -275,8 +310,9 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
     const auto left = node->left.get();
     const auto right = node->right.get();
 
-    const auto fmin0 = Intersect( ray , left->bbox );
-    const auto fmin1 = Intersect( ray , right->bbox );
+    BBox bbox0 , bbox1;
+    const auto fmin0 = Intersect( ray , nodeBBox( left , ray , bbox0 ) );
+    const auto fmin1 = Intersect( ray , nodeBBox( right , ray , bbox1 ) );
 
     if( fmin1 > fmin0 ){
         if( fmin0 >= 0.0f )
@@ -291,10 +327,166 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
     }
 }
 
+bool Bvh::Refit(){
+    if( !m_isValid || !m_root )
+        return false;
+
+    for( const auto primitive : *m_primitives )
+        primitive->InvalidateBBox();
+
+    refitNode( m_root.get() );
+    fitMotion( m_root.get() );
+    m_bbox = m_root->bbox;
+
+    return true;
+}
+
+float Bvh::EvaluateSAH() const{
+    if( !m_isValid || !m_root )
+        return 0.0f;
+
+    const auto area = m_root->bbox.HalfSurfaceArea();
+    if( area <= 0.0f )
+        return 0.0f;
+    return evaluateSAH( m_root.get() ) / area;
+}
+
+void Bvh::refitNode( Bvh_Node* node ){
+    node->bbox.InvalidBBox();
+    if( node->pri_num != 0 ){
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_num ; ++i )
+            node->bbox.Union( m_references[i]->GetBBox() );
+        return;
+    }
+
+    refitNode( node->left.get() );
+    refitNode( node->right.get() );
+    node->bbox = Union( node->left->bbox , node->right->bbox );
+}
+
+bool Bvh::fitMotion( Bvh_Node* node ){
+    node->motion = nullptr;
+    if( node->pri_num != 0 ){
+        auto moving = false;
+        MotionBBox motion;
+        motion.open.InvalidBBox();
+        motion.close.InvalidBBox();
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_num ; ++i ){
+            BBox open , close;
+            if( m_references[i]->GetMotionBBox( open , close ) ){
+                moving = true;
+            }else{
+                open = m_references[i]->GetBBox();
+                close = open;
+            }
+            motion.open.Union( open );
+            motion.close.Union( close );
+        }
+        if( moving )
+            node->motion = std::make_unique<MotionBBox>( motion );
+        return moving;
+    }
+
+    const auto left = node->left.get();
+    const auto right = node->right.get();
+    const auto moving_left = fitMotion( left );
+    const auto moving_right = fitMotion( right );
+    if( !moving_left && !moving_right )
+        return false;
+
+    node->motion = std::make_unique<MotionBBox>();
+    node->motion->open = Union( left->motion ? left->motion->open : left->bbox , right->motion ? right->motion->open : right->bbox );
+    node->motion->close = Union( left->motion ? left->motion->close : left->bbox , right->motion ? right->motion->close : right->bbox );
+    return true;
+}
+
+float Bvh::evaluateSAH( const Bvh_Node* node ) const{
+    const auto area = node->bbox.HalfSurfaceArea();
+    if( node->pri_num != 0 )
+        return area * node->pri_num;
+    return area * BVH_SAH_TRAVERSAL_COST + evaluateSAH( node->left.get() ) + evaluateSAH( node->right.get() );
+}
+
+bool Bvh::saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const{
+    stream << SID("Bvh") << m_maxNodeDepth << m_maxPriInLeaf << m_spatialSplit << m_spatialSplitBudget;
+    saveNode( stream , m_root.get() , indices );
+    return true;
+}
+
+bool Bvh::loadCache( IStreamBase& stream ){
+    StringID    type;
+    unsigned    max_node_depth = 0 , max_pri_in_leaf = 0;
+    bool        spatial_split = false;
+    float       spatial_split_budget = 0.0f;
+    stream >> type >> max_node_depth >> max_pri_in_leaf >> spatial_split >> spatial_split_budget;
+    if( type != SID("Bvh") || max_node_depth != m_maxNodeDepth || max_pri_in_leaf != m_maxPriInLeaf ||
+        spatial_split != m_spatialSplit || spatial_split_budget != m_spatialSplitBudget )
+        return false;
+
+    std::vector<const Primitive*> references;
+    auto root = std::make_unique<Bvh_Node>();
+    if( !loadNode( stream , root.get() , references , 1u ) )
+        return false;
+
+    m_references = std::move( references );
+    m_root = std::move( root );
+    fitMotion( m_root.get() );
+
+    return true;
+}
+
+void Bvh::saveNode( OStreamBase& stream , const Bvh_Node* node , const std::unordered_map<const Primitive*, unsigned>& indices ) const{
+    stream << node->bbox.m_Min.x << node->bbox.m_Min.y << node->bbox.m_Min.z;
+    stream << node->bbox.m_Max.x << node->bbox.m_Max.y << node->bbox.m_Max.z;
+    stream << node->pri_num;
+
+    if( node->pri_num != 0 ){
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_num ; ++i )
+            stream << indices.at( m_references[i] );
+        return;
+    }
+
+    saveNode( stream , node->left.get() , indices );
+    saveNode( stream , node->right.get() , indices );
+}
+
+bool Bvh::loadNode( IStreamBase& stream , Bvh_Node* node , std::vector<const Primitive*>& references , unsigned depth ){
+    if( depth > m_maxNodeDepth )
+        return false;
+
+    stream >> node->bbox.m_Min.x >> node->bbox.m_Min.y >> node->bbox.m_Min.z;
+    stream >> node->bbox.m_Max.x >> node->bbox.m_Max.y >> node->bbox.m_Max.z;
+
+    auto pri_num = 0u;
+    stream >> pri_num;
+    if( pri_num != 0 ){
+        if( pri_num > m_primitives->size() )
+            return false;
+
+        node->pri_num = pri_num;
+        node->pri_offset = (unsigned)references.size();
+        for( auto i = 0u ; i < pri_num ; ++i ){
+            auto index = (unsigned)m_primitives->size();
+            stream >> index;
+            if( index >= m_primitives->size() )
+                return false;
+            references.push_back( (*m_primitives)[index] );
+        }
+        return true;
+    }
+
+    node->left = std::make_unique<Bvh_Node>();
+    node->right = std::make_unique<Bvh_Node>();
+    return loadNode( stream , node->left.get() , references , depth + 1 ) &&
+           loadNode( stream , node->right.get() , references , depth + 1 );
+}
+
 std::unique_ptr<Accelerator> Bvh::Clone() const {
 	auto ret = std::make_unique<Bvh>();
 	ret->m_maxNodeDepth = m_maxNodeDepth;
 	ret->m_maxPriInLeaf = m_maxPriInLeaf;
+	ret->m_spatialSplit = m_spatialSplit;
+	ret->m_spatialSplitBudget = m_spatialSplitBudget;
 
 	return ret;
 }
\ No newline at end of file
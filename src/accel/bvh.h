@@ -39,6 +39,7 @@
  * On fast Construction of SAH-based Bounding Volume Hierarchies</a> for further details.
  */
 class Bvh : public Accelerator{
+protected:
     //! @brief Bounding volume hierarchy node.
     struct Bvh_Node {
         BBox                        bbox;                   /**< Bounding box of the BVH node. */
@@ -46,6 +47,7 @@ class Bvh : public Accelerator{
         unsigned                    pri_offset = 0;         /**< Offset in the primitive buffer. It is 0 for interior nodes. */
         std::unique_ptr<Bvh_Node>   left = nullptr;         /**< Left child of the BVH node. */
         std::unique_ptr<Bvh_Node>   right = nullptr;        /**< Right child of the BVH node. */
+        std::unique_ptr<MotionBBox> motion = nullptr;       /**< Bounding boxes at both ends of the shutter, only for sub-trees with moving primitives. */
     };
 
 public:
@@ -105,6 +107,19 @@ public:
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
 
+    //! @brief Refit the BVH after the primitives are moved or deformed.
+    //!
+    //! Primitives duplicated by spatial splits are bounded by their whole bounding boxes after refitting, which is
+    //! conservative but still correct.
+    //!
+    //! @return                 It always returns true since BVH supports refitting.
+    bool    Refit() override;
+
+    //! @brief Evaluate the SAH cost of the built BVH.
+    //!
+    //! @return                 SAH cost of the BVH relative to the surface area of the root node.
+    float   EvaluateSAH() const override;
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
@@ -112,6 +127,8 @@ public:
     void    Serialize( IStreamBase& stream ) override{
         stream >> m_maxNodeDepth;
         stream >> m_maxPriInLeaf;
+        stream >> m_spatialSplit;
+        stream >> m_spatialSplitBudget;
     }
 
 	//! @brief	Clone the accelerator.
@@ -121,23 +138,40 @@ public:
 	//! @return		Cloned accelerator.
 	std::unique_ptr<Accelerator>	Clone() const override;
 
-private:
-    /**< Primitive list during BVH construction. */
+protected:
+    /**< Primitive references during BVH construction, it is released once the tree is built. */
     std::unique_ptr<Bvh_Primitive[]>        m_bvhpri = nullptr;
+    /**< Primitives referenced by leaf nodes, each leaf node refers to a contiguous range of it. */
+    std::vector<const Primitive*>           m_references;
     /**< Root node of the BVH structure. */
     std::unique_ptr<Bvh_Node>               m_root = nullptr;
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                                m_maxPriInLeaf = 8;
     /**< Maximum depth of node in BVH. */
     unsigned                                m_maxNodeDepth = 16;
+    /**< Whether spatial splits are evaluated during BVH construction. */
+    bool                                    m_spatialSplit = false;
+    /**< Maximum number of references duplicated by spatial splits, relative to the number of primitives. */
+    float                                   m_spatialSplitBudget = 0.3f;
+
+    //! @brief Replace the references used during construction with the primitives referenced by leaf nodes.
+    //!
+    //! Bounding boxes of the references and free slots reserved for spatial splits are only needed during construction,
+    //! leaf nodes are updated to refer to the compact primitive list that is kept for rendering.
+    void    releaseBuildData();
+
+private:
+    //! @brief A recursive helper function that moves primitives of leaf nodes into the compact primitive list.
+    //!
+    //! @param node         The root node of the (sub)tree to be compacted.
+    void    compactNode( Bvh_Node* node );
 
     //! @brief Split current BVH node.
     //!
     //! @param node         The BVH node to be split.
-    //! @param start        The start offset of primitives that the node holds.
-    //! @param end          The end offset of primitives that the node holds.
+    //! @param range        The range of primitive references that the node holds.
     //! @param depth        The current depth of the node. Starting from 1 for root node.
-    void    splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth );
+    void    splitNode( Bvh_Node* node , const Bvh_Range& range , unsigned depth );
 
     //! @brief Mark the current node as leaf node.
     //!
@@ -166,5 +200,67 @@ private:
     //! @param              Material ID to avoid if it is not invalid.
     void    traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , const StringID matID ) const;
 
+    //! @brief A recursive helper function that refits the bounding boxes of the sub-tree.
+    //!
+    //! @param node         The root node of the (sub)tree to be refitted.
+    void    refitNode( Bvh_Node* node );
+
+    //! @brief  Recursively evaluate the shutter-end bounding boxes of sub-trees holding moving primitives.
+    //!
+    //! @param node     The node to be fitted.
+    //! @return         Whether there is any moving primitive in the sub-tree.
+    bool    fitMotion( Bvh_Node* node );
+
+    //! @brief  Bounding box of a node at the time of the ray.
+    //!
+    //! @param node     The node to be tested.
+    //! @param ray      The ray carrying the time.
+    //! @param storage  Storage for the interpolated bounding box of moving nodes.
+    //! @return         The bounding box of the node at the time of the ray.
+    static SORT_FORCEINLINE const BBox& nodeBBox( const Bvh_Node* node , const Ray& ray , BBox& storage ){
+        if( !node->motion )
+            return node->bbox;
+        storage = node->motion->At( ray.m_time );
+        return storage;
+    }
+
+    //! @brief A recursive helper function that sums up the SAH cost of the sub-tree.
+    //!
+    //! @param node         The root node of the (sub)tree to be evaluated.
+    //! @return             SAH cost of the sub-tree, it is not normalized by the surface area of the root node.
+    float   evaluateSAH( const Bvh_Node* node ) const;
+
+    //! @brief Save the built BVH to the cache.
+    //!
+    //! @param stream       Stream to save the BVH to.
+    //! @param indices      Index of each primitive in the primitive list.
+    //! @return             It always returns true since BVH supports cache.
+    bool    saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const override;
+
+    //! @brief Load the BVH from the cache.
+    //!
+    //! @param stream       Stream to load the BVH from.
+    //! @return             False if the cache doesn't match the configuration or it is corrupted.
+    bool    loadCache( IStreamBase& stream ) override;
+
+    //! @brief A recursive helper function that saves the sub-tree in depth first order.
+    //!
+    //! Primitives in leaf nodes are saved right after their nodes so that the primitive buffer doesn't need to be
+    //! saved, which also drops the free slots reserved for spatial splits.
+    //!
+    //! @param stream       Stream to save the sub-tree to.
+    //! @param node         The root node of the (sub)tree to be saved.
+    //! @param indices      Index of each primitive in the primitive list.
+    void    saveNode( OStreamBase& stream , const Bvh_Node* node , const std::unordered_map<const Primitive*, unsigned>& indices ) const;
+
+    //! @brief A recursive helper function that loads the sub-tree saved by 'saveNode'.
+    //!
+    //! @param stream       Stream to load the sub-tree from.
+    //! @param node         The root node of the (sub)tree to be loaded.
+    //! @param references   Primitives referenced by leaf nodes loaded so far.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @return             False if the sub-tree is corrupted.
+    bool    loadNode( IStreamBase& stream , Bvh_Node* node , std::vector<const Primitive*>& references , unsigned depth );
+
     SORT_STATS_ENABLE( "Spatial-Structure(BVH)" )
 };
@@ -0,0 +1,217 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "core/primitive.h"
+#include "bvh_utils.h"
+
+SORT_STATS_DEFINE_MEMORY(sBvhBuildMemory)
+
+SORT_STATS_MEMORY("BVH Construction", sBvhBuildMemory);
+
+//! @brief Pick the best spatial split plane.
+//!
+//! Unlike object splits, references are binned by their bounding boxes instead of centroids. A reference straddling
+//! multiple bins is clipped by the planes between them, so that each bin only grows by the part of the primitive
+//! inside it. Only the axis with the longest edge of the references' bounding box is evaluated.
+//!
+//! @param axis         The selected axis id of the picked split plane.
+//! @param split_pos    Position of the selected split plane.
+//! @param primitives   The buffer hold all references.
+//! @param node_bbox    The bounding box of the node.
+//! @param range        Range of references of the node.
+//! @return             The SAH value of the selected best split plane.
+SORT_STATIC_FORCEINLINE float pickBestSpatialSplit( unsigned& axis , float& split_pos , const Bvh_Primitive* const primitives , const BBox& node_bbox , const Bvh_Range& range ){
+    BBox bounds;
+    for( auto i = range.start ; i < range.end ; ++i )
+        bounds.Union( primitives[i].GetBBox() );
+
+    axis = bounds.MaxAxisId();
+    const auto split_start = bounds.m_Min[axis];
+    const auto split_delta = bounds.Delta(axis) / (float)BVH_SPLIT_COUNT;
+    if( split_delta <= 0.0f )
+        return FLT_MAX;
+    const auto inv_split_delta = 1.0f / split_delta;
+
+    const auto bin_index = [&]( const float x ){
+        const auto index = (int)( ( x - split_start ) * inv_split_delta );
+        return (unsigned)std::max( 0 , std::min( index , (int)( BVH_SPLIT_COUNT - 1 ) ) );
+    };
+
+    // number of references starting/ending in each bin
+    unsigned    enter[BVH_SPLIT_COUNT] = { 0 };
+    unsigned    leave[BVH_SPLIT_COUNT] = { 0 };
+    BBox        bbox[BVH_SPLIT_COUNT];
+    for( auto i = range.start ; i < range.end ; ++i ){
+        const auto& ref = primitives[i];
+        const auto& ref_bbox = ref.GetBBox();
+        const auto first = bin_index( ref_bbox.m_Min[axis] );
+        const auto last = std::max( first , bin_index( ref_bbox.m_Max[axis] ) );
+        ++enter[first];
+        ++leave[last];
+
+        auto rest = ref_bbox;
+        for( auto b = first ; b < last ; ++b ){
+            BBox part , remaining;
+            ref.primitive->SplitBBox( rest , axis , split_start + split_delta * (float)( b + 1 ) , part , remaining );
+            bbox[b].Union( part );
+            rest = remaining;
+        }
+        bbox[last].Union( rest );
+    }
+
+    BBox        rbox[BVH_SPLIT_COUNT-1];
+    unsigned    rcnt[BVH_SPLIT_COUNT-1];
+    rbox[BVH_SPLIT_COUNT-2] = bbox[BVH_SPLIT_COUNT-1];
+    rcnt[BVH_SPLIT_COUNT-2] = leave[BVH_SPLIT_COUNT-1];
+    for( int i = BVH_SPLIT_COUNT-3; i >= 0 ; i-- ){
+        rbox[i] = Union( rbox[i+1] , bbox[i+1] );
+        rcnt[i] = rcnt[i+1] + leave[i+1];
+    }
+
+    auto        min_sah = FLT_MAX;
+    auto        left = 0u;
+    BBox        lbox;
+    for( auto i = 0u ; i < BVH_SPLIT_COUNT - 1 ; ++i ){
+        left += enter[i];
+        lbox.Union( bbox[i] );
+        if( 0 == left || 0 == rcnt[i] )
+            continue;
+
+        const auto sah_value = sah( left , rcnt[i] , lbox , rbox[i] , node_bbox );
+        if( sah_value < min_sah ){
+            min_sah = sah_value;
+            split_pos = split_start + split_delta * (float)( i + 1 );
+        }
+    }
+
+    return min_sah;
+}
+
+//! @brief Split the references of a node with a spatial split plane.
+//!
+//! References are partitioned into three groups, the ones on the left side, the straddling ones and ones on the right
+//! side. The straddling references are duplicated into the free slots of the range, the layout after splitting is,
+//! [ left | straddling(clipped left) | free slots of left child | straddling(clipped right) | right | free slots of right child ]
+//!
+//! @param primitives   The buffer hold all references.
+//! @param range        Range of references of the node.
+//! @param axis         Axis of the split plane.
+//! @param pos          Position of the split plane.
+//! @param left         Range of references of the left child.
+//! @param right        Range of references of the right child.
+//! @return             False if there are not enough free slots for the duplicated references.
+SORT_STATIC_FORCEINLINE bool performSpatialSplit( Bvh_Primitive* const primitives , const Bvh_Range& range , const unsigned axis , const float pos , Bvh_Range& left , Bvh_Range& right ){
+    // A reference whose clipped part on one side is empty doesn't need to be duplicated, tighten its bounding box so
+    // that it will be classified correctly below.
+    for( auto i = range.start ; i < range.end ; ++i ){
+        auto& ref = primitives[i];
+        if( ref.GetBBox().m_Min[axis] >= pos || ref.GetBBox().m_Max[axis] <= pos )
+            continue;
+
+        BBox lbox , rbox;
+        ref.primitive->SplitBBox( ref.GetBBox() , axis , pos , lbox , rbox );
+        const auto lbox_valid = IsValid( lbox );
+        const auto rbox_valid = IsValid( rbox );
+        if( !lbox_valid && rbox_valid )
+            ref.SetBBox( rbox );
+        else if( lbox_valid && !rbox_valid )
+            ref.SetBBox( lbox );
+    }
+
+    const auto begin = primitives + range.start;
+    const auto end = primitives + range.end;
+    const auto straddling_begin = std::partition( begin , end , [axis,pos](const Bvh_Primitive& pri){ return pri.GetBBox().m_Max[axis] <= pos; } );
+    const auto right_begin = std::partition( straddling_begin , end , [axis,pos](const Bvh_Primitive& pri){ return pri.GetBBox().m_Min[axis] < pos; } );
+
+    const auto straddling_cnt = (unsigned)( right_begin - straddling_begin );
+    const auto left_cnt = (unsigned)( straddling_begin - begin ) + straddling_cnt;
+    const auto right_cnt = (unsigned)( end - right_begin ) + straddling_cnt;
+    const auto total_cnt = left_cnt + right_cnt;
+    if( left_cnt == straddling_cnt || right_cnt == straddling_cnt || range.start + total_cnt > range.capacity )
+        return false;
+
+    const auto free_cnt = range.capacity - range.start - total_cnt;
+    const auto left_free_cnt = (unsigned)( (unsigned long long)free_cnt * left_cnt / total_cnt );
+    const auto right_start = range.start + left_cnt + left_free_cnt;
+
+    // move the right references to the right child before duplicating the straddling ones
+    std::move_backward( right_begin , end , primitives + right_start + right_cnt );
+    for( auto i = 0u ; i < straddling_cnt ; ++i ){
+        auto& ref = straddling_begin[i];
+        BBox lbox , rbox;
+        ref.primitive->SplitBBox( ref.GetBBox() , axis , pos , lbox , rbox );
+
+        auto& duplicated = primitives[right_start + i];
+        duplicated.primitive = ref.primitive;
+        duplicated.SetBBox( rbox );
+        ref.SetBBox( lbox );
+    }
+
+    left = { range.start , range.start + left_cnt , right_start };
+    right = { right_start , right_start + right_cnt , range.capacity };
+    return true;
+}
+
+bool splitBvhNode( Bvh_Primitive* const primitives , const BBox& root_bbox , const BBox& node_bbox , const Bvh_Range& range , Bvh_Range& left , Bvh_Range& right ){
+    const auto primitive_num = range.end - range.start;
+
+    unsigned    split_axis;
+    float       split_pos;
+    BBox        lbox , rbox;
+    const auto sah = pickBestSplit( split_axis , split_pos , primitives , node_bbox , range.start , range.end , &lbox , &rbox );
+
+    // Only try spatial splits if there is room for duplicated references and the object split is not good enough.
+    if( range.capacity > range.end ){
+        const auto overlap = Intersection( lbox , rbox );
+        const auto overlapped = FLT_MAX == sah || ( IsValid( overlap ) && overlap.HalfSurfaceArea() > BVH_SPATIAL_SPLIT_ALPHA * root_bbox.HalfSurfaceArea() );
+        if( overlapped ){
+            unsigned    spatial_axis;
+            float       spatial_pos;
+            const auto spatial_sah = pickBestSpatialSplit( spatial_axis , spatial_pos , primitives , node_bbox , range );
+            if( spatial_sah < sah && spatial_sah < primitive_num && performSpatialSplit( primitives , range , spatial_axis , spatial_pos , left , right ) )
+                return true;
+        }
+    }
+
+    if( sah >= primitive_num )
+        return false;
+
+    // partition the data
+    auto compare = [split_pos,split_axis](const Bvh_Primitive& pri){return pri.GetCentroid()[split_axis] < split_pos;};
+    auto middle = std::partition( primitives + range.start , primitives + range.end , compare );
+    auto mid = (unsigned)(middle - primitives);
+
+    // To avoid degenerated node that has nothing in it.
+    // Technically, this shouldn't happen. Unlike KD-Tree implementation, there is only 16 split plane candidate, it is
+    // totally possible to pick one with no primitive on one side of the plane, resulting a crash later during ray tracing.
+    if( mid == range.start || mid == range.end )
+        return false;
+
+    // distribute the free slots to both children
+    const auto left_cnt = mid - range.start;
+    const auto right_cnt = range.end - mid;
+    const auto free_cnt = range.capacity - range.end;
+    const auto left_free_cnt = (unsigned)( (unsigned long long)free_cnt * left_cnt / primitive_num );
+    const auto right_start = mid + left_free_cnt;
+    if( left_free_cnt > 0 )
+        std::move_backward( primitives + mid , primitives + range.end , primitives + right_start + right_cnt );
+
+    left = { range.start , mid , right_start };
+    right = { right_start , right_start + right_cnt , range.capacity };
+    return true;
+}
@@ -18,33 +18,74 @@
 #pragma once
 
 #include <string.h>
+#include <vector>
 #include "core/define.h"
 #include "math/point.h"
 #include "math/bbox.h"
+#include "task/task.h"
+#include "core/stats.h"
 
 class Primitive;
 
-//! @brief Bounding volume hierarchy node primitives. It is used during BVH construction.
+//! @brief Memory only needed during BVH construction, like the reference buffer and the temporary tree.
+//!
+//! It drops back to zero once the built structures are ready for rendering, its peak is what construction costs on top
+//! of the structures themselves.
+SORT_STATS_DECLARE_MEMORY(sBvhBuildMemory)
+
+//! @brief Bounding volume hierarchy node primitives. It is used during BVH construction only.
+//!
+//! It is kept as small as possible since there is one for each reference, the centroid is derived from the bounding box
+//! whenever it is needed instead of being stored. Built structures only keep the primitive pointers.
 struct Bvh_Primitive {
     const Primitive*    primitive;              /**< Primitive lists for this node. */
-    Point               m_centroid;             /**< Center point of the BVH node. */
+    BBox                m_bbox;                 /**< Bounding box of the part of the primitive referenced by the node. */
 
     //! @brief Set primitive.
     //!
     //! @param p    Primitive list holding all primitives in the node.
     void SetPrimitive(const Primitive* p){
         primitive = p;
-        m_centroid = (p->GetBBox().m_Max + p->GetBBox().m_Min) * 0.5f;
+        SetBBox( p->GetBBox() );
+    }
+
+    //! @brief Set the bounding box of the referenced part of the primitive.
+    //!
+    //! Spatial splits could split a primitive into multiple references, each reference only covers part of the primitive.
+    //!
+    //! @param bbox Bounding box of the referenced part of the primitive.
+    void SetBBox(const BBox& bbox){
+        m_bbox = bbox;
+    }
+
+    //! @brief Get the center of the bounding box.
+    //!
+    //! @return     Centroid used to bin and partition the reference.
+    SORT_FORCEINLINE Point GetCentroid() const {
+        return (m_bbox.m_Max + m_bbox.m_Min) * 0.5f;
     }
 
     //! Get bounding box of this primitive set.
     //!
     //! @return     Axis-Aligned bounding box holding all the primitives.
     const BBox& GetBBox() const {
-        return primitive->GetBBox();
+        return m_bbox;
     }
 };
 
+// zero tolerance in any extra size in this structure.
+static_assert( sizeof( Bvh_Primitive ) == sizeof( const Primitive* ) + sizeof( BBox ) , "Incorrect BVH primitive size." );
+
+//! @brief A range of primitive references in the buffer during BVH construction.
+//!
+//! With spatial splits, a primitive could be referenced by multiple nodes. Each range reserves some free slots after its
+//! references so that duplicated references could be placed there without touching the ranges of other nodes.
+struct Bvh_Range {
+    unsigned    start;      /**< Offset of the first reference in the range. */
+    unsigned    end;        /**< Offset after the last reference in the range. */
+    unsigned    capacity;   /**< Offset after the last slot reserved for the range. */
+};
+
 //! @brief Evaluate the SAH value of a specific splitting.
 //!
 //! @param left         The number of primitives in the left node to be split.
@@ -57,44 +98,141 @@ SORT_FORCEINLINE float sah( unsigned left , unsigned right , const BBox& lbox ,
     return (left * lbox.HalfSurfaceArea() + right * rbox.HalfSurfaceArea()) / box.HalfSurfaceArea();
 }
 
+// Number of split plane candidates along the picked axis.
+static constexpr unsigned   BVH_SPLIT_COUNT                     = 16;
+// Nodes with at least this number of primitives will bin their primitives in multiple threads.
+static constexpr unsigned   BVH_PARALLEL_BINNING_THRESHOLD      = 65536;
+// Number of primitives binned by each task during parallel binning.
+static constexpr unsigned   BVH_PARALLEL_BINNING_CHUNK          = 16384;
+// Sub-trees with at least this number of primitives will be built in a separate task.
+// This has to be smaller than the binning threshold, see 'pickBestSplit' for further detail.
+static constexpr unsigned   BVH_PARALLEL_SUBTREE_THRESHOLD      = 4096;
+static_assert( BVH_PARALLEL_SUBTREE_THRESHOLD <= BVH_PARALLEL_BINNING_THRESHOLD , "Incorrect BVH parallel construction thresholds." );
+// Spatial splits are only tried when the children of the best object split overlap more than this portion of the root node.
+static constexpr float      BVH_SPATIAL_SPLIT_ALPHA             = 1e-5f;
+// Cost of visiting a node relative to intersecting a primitive, it is only used to evaluate the quality of a built BVH.
+static constexpr float      BVH_SAH_TRAVERSAL_COST              = 1.0f;
+
+//! @brief Bins for evaluating SAH of the split plane candidates.
+struct Bvh_Bins {
+    unsigned    bin[BVH_SPLIT_COUNT] = { 0 };   /**< Number of primitives in each bin. */
+    BBox        bbox[BVH_SPLIT_COUNT];          /**< Bounding box of primitives in each bin. */
+
+    //! @brief Distribute primitives into the bins.
+    //!
+    //! @param primitives       The buffer hold all primitives.
+    //! @param start            The start offset of primitives to be binned.
+    //! @param end              The end offset of primitives to be binned.
+    //! @param axis             The axis to split.
+    //! @param split_start      Position of the first bin along the axis.
+    //! @param inv_split_delta  Reciprocal of the size of each bin.
+    SORT_FORCEINLINE void Add( const Bvh_Primitive* const primitives , const unsigned start , const unsigned end , const unsigned axis , const float split_start , const float inv_split_delta ){
+        for(auto i = start ; i < end ; i++ ){
+            auto index = (int)((primitives[i].GetCentroid()[axis] - split_start) * inv_split_delta);
+            index = std::min( index , (int)(BVH_SPLIT_COUNT - 1) );
+            ++bin[index];
+            bbox[index].Union( primitives[i].GetBBox() );
+        }
+    }
+
+    //! @brief Merge bins collected from another range of primitives.
+    //!
+    //! @param bins             Bins to be merged.
+    SORT_FORCEINLINE void Merge( const Bvh_Bins& bins ){
+        for( auto i = 0u ; i < BVH_SPLIT_COUNT ; ++i ){
+            bin[i] += bins.bin[i];
+            bbox[i].Union( bins.bbox[i] );
+        }
+    }
+};
+
+//! @brief Whether the current thread could build BVH in parallel.
+//!
+//! Parallel construction is only possible in a task, in case BVH is built outside the task system, like in unit tests,
+//! it will fall back to single thread construction.
+//!
+//! @return             Whether parallel construction is possible.
+SORT_FORCEINLINE bool isParallelBvhConstructionAvailable(){
+    return IS_PTR_VALID( GetCurrentTask() );
+}
+
 //! @brief Pick the best split among all possible splits.
 //!
+//! For nodes with a lot of primitives, the evaluation of centroid bounding box and primitive binning is distributed
+//! among multiple tasks. Since the current task will wait for all of its children, the caller needs to make sure it
+//! hasn't spawned any sub-tree construction task before, which is why the sub-tree threshold has to be smaller than
+//! the binning threshold.
+//!
 //! @param axis         The selected axis id of the picked split plane.
 //! @param split_pos    Position of the selected split plane.
 //! @param primitives   The buffer hold all primitives.
 //! @param node         The node to be split.
 //! @param start        The start offset of primitives that the node holds.
 //! @param end          The end offset of primitives that the node holds.
+//! @param best_lbox    Bounding box of the left child of the selected split, it is optional.
+//! @param best_rbox    Bounding box of the right child of the selected split, it is optional.
 //! @return             The SAH value of the selected best split plane.
-SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const Bvh_Primitive* const primitives , const BBox& node_bbox , const unsigned start , const unsigned end ){
-    static constexpr unsigned   BVH_SPLIT_COUNT         = 16;
+SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const Bvh_Primitive* const primitives , const BBox& node_bbox , const unsigned start , const unsigned end ,
+                                      BBox* best_lbox = nullptr , BBox* best_rbox = nullptr ){
     static constexpr float      BVH_INV_SPLIT_COUNT     = 1.0f / (float)BVH_SPLIT_COUNT;
 
+    auto primitive_num = end - start;
+    const auto chunk_cnt = ( primitive_num >= BVH_PARALLEL_BINNING_THRESHOLD && isParallelBvhConstructionAvailable() ) ?
+                           ( primitive_num + BVH_PARALLEL_BINNING_CHUNK - 1 ) / BVH_PARALLEL_BINNING_CHUNK : 1u;
+
+    // evaluate the bounding box of all centroids
     BBox inner;
-    for(auto i = start ; i < end ; i++ )
-        inner.Union( primitives[i].m_centroid );
+    if( 1u == chunk_cnt ){
+        for(auto i = start ; i < end ; i++ )
+            inner.Union( primitives[i].GetCentroid() );
+    }else{
+        std::vector<BBox> partial_inner( chunk_cnt );
+        for( auto c = 0u ; c < chunk_cnt ; ++c ){
+            SPAWN_TASK<Function_Task>( "BVH Centroid Bounding" , DEFAULT_TASK_PRIORITY , {} , [&,c](){
+                const auto chunk_start = start + c * BVH_PARALLEL_BINNING_CHUNK;
+                const auto chunk_end = std::min( end , chunk_start + BVH_PARALLEL_BINNING_CHUNK );
+                for(auto i = chunk_start ; i < chunk_end ; i++ )
+                    partial_inner[c].Union( primitives[i].GetCentroid() );
+            });
+        }
+        WAIT_FOR_CHILDREN();
+
+        for( const auto& bb : partial_inner )
+            inner.Union( bb );
+    }
 
-    auto primitive_num = end - start;
     axis = inner.MaxAxisId();
     auto min_sah = FLT_MAX;
 
     // distribute the primitives into bins
-    unsigned    bin[BVH_SPLIT_COUNT];
-    BBox        bbox[BVH_SPLIT_COUNT];
-    BBox        rbox[BVH_SPLIT_COUNT-1];
-    memset( bin , 0 , sizeof( unsigned ) * BVH_SPLIT_COUNT );
     auto split_start = inner.m_Min[axis];
     auto split_delta = inner.Delta(axis) * BVH_INV_SPLIT_COUNT;
     if( split_delta == 0.0f )
         return FLT_MAX;
     auto inv_split_delta = 1.0f / split_delta;
-    for(auto i = start ; i < end ; i++ ){
-        auto index = (int)((primitives[i].m_centroid[axis] - split_start) * inv_split_delta);
-        index = std::min( index , (int)(BVH_SPLIT_COUNT - 1) );
-        ++bin[index];
-        bbox[index].Union( primitives[i].GetBBox() );
+
+    Bvh_Bins bins;
+    if( 1u == chunk_cnt ){
+        bins.Add( primitives , start , end , axis , split_start , inv_split_delta );
+    }else{
+        std::vector<Bvh_Bins> partial_bins( chunk_cnt );
+        for( auto c = 0u ; c < chunk_cnt ; ++c ){
+            SPAWN_TASK<Function_Task>( "BVH Binning" , DEFAULT_TASK_PRIORITY , {} , [&,c](){
+                const auto chunk_start = start + c * BVH_PARALLEL_BINNING_CHUNK;
+                const auto chunk_end = std::min( end , chunk_start + BVH_PARALLEL_BINNING_CHUNK );
+                partial_bins[c].Add( primitives , chunk_start , chunk_end , axis , split_start , inv_split_delta );
+            });
+        }
+        WAIT_FOR_CHILDREN();
+
+        for( const auto& partial : partial_bins )
+            bins.Merge( partial );
     }
 
+    const auto& bin = bins.bin;
+    const auto& bbox = bins.bbox;
+
+    BBox        rbox[BVH_SPLIT_COUNT-1];
     rbox[BVH_SPLIT_COUNT-2].Union( bbox[BVH_SPLIT_COUNT-1] );
     for( int i = BVH_SPLIT_COUNT-3; i >= 0 ; i-- )
         rbox[i] = Union( rbox[i+1] , bbox[i+1] );
@@ -107,6 +245,10 @@ SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const B
         if( sah_value < min_sah ){
             min_sah = sah_value;
             splitPos = pos;
+            if( best_lbox )
+                *best_lbox = lbox;
+            if( best_rbox )
+                *best_rbox = rbox[i];
         }
         left += bin[i+1];
         lbox.Union( bbox[i+1] );
@@ -114,4 +256,35 @@ SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const B
     }
 
     return min_sah;
-}
\ No newline at end of file
+}
+
+//! @brief Number of reference slots to allocate for BVH construction.
+//!
+//! @param primitive_cnt    Number of primitives in the BVH.
+//! @param spatial_split    Whether spatial splits are enabled.
+//! @param budget           Maximum number of duplicated references, relative to the number of primitives.
+//! @return                 Number of reference slots.
+SORT_FORCEINLINE unsigned bvhReferenceCapacity( const unsigned primitive_cnt , const bool spatial_split , const float budget ){
+    if( !spatial_split || budget <= 0.0f )
+        return primitive_cnt;
+    return primitive_cnt + (unsigned)( (double)primitive_cnt * budget );
+}
+
+//! @brief Split the references of a node into two children.
+//!
+//! The best object split is picked first. If the range has free slots and the children of the object split overlap a
+//! lot, spatial splits are also evaluated, in a similar way described in this paper
+//! <a href="https://www.nvidia.com/docs/IO/77714/sbvh.pdf">Spatial Splits in Bounding Volume Hierarchies</a>.
+//! References straddling a spatial split plane are clipped and duplicated into both children. Free slots of the range
+//! are distributed to the children based on their number of references, a node without free slots won't try spatial
+//! splits any more, which caps the memory used by duplicated references.
+//!
+//! @param primitives   The buffer hold all references.
+//! @param root_bbox    The bounding box of the root node.
+//! @param node_bbox    The bounding box of the node.
+//! @param range        Range of references of the node.
+//! @param left         Range of references of the left child.
+//! @param right        Range of references of the right child.
+//! @return             False if it is not worth splitting the node.
+bool splitBvhNode( Bvh_Primitive* const primitives , const BBox& root_bbox , const BBox& node_bbox , const Bvh_Range& range , Bvh_Range& left , Bvh_Range& right );
+
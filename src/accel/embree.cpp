@@ -0,0 +1,593 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include "embree.h"
+
+#ifdef SORT_ENABLE_EMBREE
+
+#include <cmath>
+#include <cstddef>
+#include <unordered_map>
+#include "core/primitive.h"
+#include "core/mesh.h"
+#include "entity/visual.h"
+#include "shape/triangle.h"
+#include "math/interaction.h"
+#include "core/log.h"
+#include "core/sassert.h"
+#include "core/profile.h"
+#include "core/memory.h"
+#include "scatteringevent/scatteringevent.h"
+
+SORT_STATS_DEFINE_COUNTER(sEmbreePrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sEmbreeTriangleCount)
+
+SORT_STATS_COUNTER("Spatial-Structure(Embree)", "Total Ray Count", sRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(Embree)", "Shadow Ray Count", sShadowRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(Embree)", "Intersection Test", sIntersectionTest );
+SORT_STATS_COUNTER("Spatial-Structure(Embree)", "Primitive Count", sEmbreePrimitiveCount);
+SORT_STATS_COUNTER("Spatial-Structure(Embree)", "Triangles Intersected by Embree", sEmbreeTriangleCount);
+SORT_STATS_AVG_COUNT("Spatial-Structure(Embree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+
+// Embree reads positions as three floats right from the vertices of meshes.
+static_assert( sizeof( Point ) == 3 * sizeof( float ) , "Positions can't be shared with Embree." );
+static_assert( sizeof( MeshFaceIndex ) % sizeof( unsigned ) == 0 , "Indices can't be shared with Embree." );
+
+namespace {
+    //! @brief  State of a query shared with the user geometry callbacks.
+    //!
+    //! The Embree context has to be the first member so that callbacks could cast it back to the query.
+    struct EmbreeQuery{
+        /**< Embree context passed to the query. */
+        RTCRayQueryContext          context;
+        /**< The rays of the query, the id of an Embree ray is its index in this array. */
+        const Ray*                  rays = nullptr;
+        /**< The intersection of each ray, it is nullptr for occlusion queries. */
+        SurfaceInteraction*         intersects = nullptr;
+        /**< Intersections with the material, it is only used by BSSRDF queries. */
+        BSSRDFIntersections*        sss = nullptr;
+        /**< The material of the BSSRDF query. */
+        StringID                    matID = INVALID_SID;
+        /**< Mask of rays intersecting anything, the i-th bit is for the i-th ray. */
+        unsigned                    found = 0;
+    };
+
+    //! @brief  Report any error of Embree.
+    void embreeError( void* , const RTCError code , const char* str ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "Embree error %d: %s" , (int)code , str ? str : "" );
+    }
+
+    //! @brief  Fill an Embree ray with a SORT ray.
+    SORT_FORCEINLINE void setupRay( RTCRay& dst , const Ray& ray , const unsigned id ){
+        dst.org_x = ray.m_Ori.x;
+        dst.org_y = ray.m_Ori.y;
+        dst.org_z = ray.m_Ori.z;
+        dst.dir_x = ray.m_Dir.x;
+        dst.dir_y = ray.m_Dir.y;
+        dst.dir_z = ray.m_Dir.z;
+        dst.tnear = ray.m_fMin;
+        dst.tfar = ray.m_fMax;
+        dst.time = 0.0f;
+        dst.mask = 0xffffffff;
+        dst.id = id;
+        dst.flags = 0;
+    }
+
+    //! @brief  Fill a lane of an Embree ray packet with a SORT ray.
+    SORT_FORCEINLINE void setupRay( RTCRay8& dst , const unsigned i , const Ray& ray ){
+        dst.org_x[i] = ray.m_Ori.x;
+        dst.org_y[i] = ray.m_Ori.y;
+        dst.org_z[i] = ray.m_Ori.z;
+        dst.dir_x[i] = ray.m_Dir.x;
+        dst.dir_y[i] = ray.m_Dir.y;
+        dst.dir_z[i] = ray.m_Dir.z;
+        dst.tnear[i] = ray.m_fMin;
+        dst.tfar[i] = ray.m_fMax;
+        dst.time[i] = 0.0f;
+        dst.mask[i] = 0xffffffff;
+        dst.id[i] = i;
+        dst.flags[i] = 0;
+    }
+
+    //! @brief  Bounding box of a primitive, it covers the whole shutter interval for moving primitives.
+    void embreeBounds( const RTCBoundsFunctionArguments* args ){
+        const auto& primitives = *(const std::vector<const Primitive*>*)args->geometryUserPtr;
+        const auto& bbox = primitives[args->primID]->GetBBox();
+        auto bounds = args->bounds_o;
+        bounds->lower_x = bbox.m_Min.x;
+        bounds->lower_y = bbox.m_Min.y;
+        bounds->lower_z = bbox.m_Min.z;
+        bounds->upper_x = bbox.m_Max.x;
+        bounds->upper_y = bbox.m_Max.y;
+        bounds->upper_z = bbox.m_Max.z;
+    }
+
+    //! @brief  Keep an intersection if it is among the nearest ones of a BSSRDF query.
+    //!
+    //! @return         The distance beyond which intersections are not interesting any more.
+    float bssrdfRecord( const SurfaceInteraction& intersection , BSSRDFIntersections& intersect ){
+        if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
+            intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
+            intersect.intersections[intersect.cnt++]->intersection = intersection;
+            return intersect.maxt;
+        }
+
+        auto picked_i = -1;
+        auto t = 0.0f;
+        for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
+            if( t < intersect.intersections[i]->intersection.t ){
+                t = intersect.intersections[i]->intersection.t;
+                picked_i = i;
+            }
+        }
+        if( picked_i >= 0 )
+            intersect.intersections[picked_i]->intersection = intersection;
+
+        intersect.maxt = 0.0f;
+        for( auto i = 0u ; i < intersect.cnt ; ++i )
+            intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
+        return intersect.maxt;
+    }
+
+    //! @brief  Keep the nearest intersections with the material for BSSRDF queries.
+    //!
+    //! @return         The distance beyond which intersections are not interesting any more.
+    float bssrdfIntersect( const Ray& ray , const Primitive* primitive , BSSRDFIntersections& intersect , const StringID matID ){
+        if( matID != primitive->GetMaterial()->GetUniqueID() )
+            return intersect.maxt;
+
+        SORT_STATS_HOT(++sIntersectionTest);
+
+        SurfaceInteraction intersection;
+        if( !primitive->GetIntersect( ray , &intersection ) )
+            return intersect.maxt;
+        return bssrdfRecord( intersection , intersect );
+    }
+
+    //! @brief  Record hits on triangle geometries for BSSRDF queries.
+    //!
+    //! Every hit is rejected so that Embree keeps looking for the others behind it.
+    void embreeBssrdfFilter( const RTCFilterFunctionNArguments* args ){
+        const auto& primitives = *(const std::vector<const Primitive*>*)args->geometryUserPtr;
+        auto query = (EmbreeQuery*)args->context;
+
+        const auto n = args->N;
+        for( auto i = 0u ; i < n ; ++i ){
+            if( !args->valid[i] )
+                continue;
+            args->valid[i] = 0;
+
+            const auto primitive = primitives[RTCHitN_primID( args->hit , n , i )];
+            if( query->matID != primitive->GetMaterial()->GetUniqueID() )
+                continue;
+
+            // the distance of the hit is in the ray during filtering
+            const auto& ray = query->rays[RTCRayN_id( args->ray , n , i )];
+            SurfaceInteraction intersection;
+            static_cast<const Triangle*>( primitive->GetShape() )->SetupIntersection( ray , RTCRayN_tfar( args->ray , n , i ) ,
+                                                                                     RTCHitN_u( args->hit , n , i ) , RTCHitN_v( args->hit , n , i ) , &intersection );
+            intersection.primitive = primitive;
+            bssrdfRecord( intersection , *query->sss );
+        }
+    }
+
+    //! @brief  Intersect rays with a primitive.
+    //!
+    //! Hits are reported to Embree by shrinking the ray, the intersection itself is kept in the query.
+    void embreeIntersect( const RTCIntersectFunctionNArguments* args ){
+        const auto& primitives = *(const std::vector<const Primitive*>*)args->geometryUserPtr;
+        const auto primitive = primitives[args->primID];
+        auto query = (EmbreeQuery*)args->context;
+
+        const auto n = args->N;
+        auto rays = RTCRayHitN_RayN( args->rayhit , n );
+        auto hits = RTCRayHitN_HitN( args->rayhit , n );
+        for( auto i = 0u ; i < n ; ++i ){
+            if( !args->valid[i] )
+                continue;
+
+            const auto id = RTCRayN_id( rays , n , i );
+            const auto& ray = query->rays[id];
+
+            if( query->sss ){
+                RTCRayN_tfar( rays , n , i ) = bssrdfIntersect( ray , primitive , *query->sss , query->matID );
+                continue;
+            }
+
+            SORT_STATS_HOT(++sIntersectionTest);
+
+            // A closer hit on a triangle geometry is only filled after the query, hits behind it are not interesting.
+            auto& intersect = query->intersects[id];
+            if( RTC_INVALID_GEOMETRY_ID != RTCHitN_geomID( hits , n , i ) )
+                intersect.t = std::min( intersect.t , RTCRayN_tfar( rays , n , i ) );
+            if( !primitive->GetIntersect( ray , &intersect ) )
+                continue;
+
+            query->found |= ( 1u << id );
+            RTCHitN_geomID( hits , n , i ) = args->geomID;
+            RTCHitN_primID( hits , n , i ) = args->primID;
+
+            // a shadow ray hit by anything is done, opaque primitives are already reported with no primitive in the intersection
+            RTCRayN_tfar( rays , n , i ) = isShadowRay( &intersect ) ? -INFINITY : intersect.t;
+        }
+    }
+
+    //! @brief  Test occlusion of rays by a primitive.
+    void embreeOccluded( const RTCOccludedFunctionNArguments* args ){
+        const auto& primitives = *(const std::vector<const Primitive*>*)args->geometryUserPtr;
+        const auto primitive = primitives[args->primID];
+        auto query = (EmbreeQuery*)args->context;
+
+        const auto n = args->N;
+        for( auto i = 0u ; i < n ; ++i ){
+            if( !args->valid[i] )
+                continue;
+
+            SORT_STATS_HOT(++sIntersectionTest);
+
+            const auto id = RTCRayN_id( args->ray , n , i );
+            if( primitive->GetIntersect( query->rays[id] , nullptr ) ){
+                query->found |= ( 1u << id );
+                RTCRayN_tfar( args->ray , n , i ) = -INFINITY;
+            }
+        }
+    }
+
+    //! @brief  Whether a ray intersects anything, given the intersection found by the query.
+    SORT_FORCEINLINE bool isIntersected( const SurfaceInteraction& intersect ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        return intersect.query_shadow || IS_PTR_VALID(intersect.primitive);
+#else
+        return IS_PTR_VALID(intersect.primitive);
+#endif
+    }
+}
+
+Embree::~Embree(){
+    release();
+}
+
+void Embree::release(){
+    for( auto& geometry : m_geometries )
+        rtcReleaseGeometry( geometry.geometry );
+    if( m_scene )
+        rtcReleaseScene( m_scene );
+    if( m_device )
+        rtcReleaseDevice( m_device );
+    m_geometries.clear();
+    m_scene = nullptr;
+    m_device = nullptr;
+}
+
+void Embree::shareTriangleBuffers( Geometry& geometry ){
+    const auto& mesh = *geometry.visual->m_memory;
+    const auto triangle_cnt = geometry.primitives.size();
+    const auto triangle = [&]( size_t i ){
+        return static_cast<const Triangle*>( geometry.primitives[i]->GetShape() );
+    };
+
+    // The vertex buffer can be reallocated when the mesh is deformed, it is shared again whenever the geometry is refit.
+    rtcSetSharedGeometryBuffer( geometry.geometry , RTC_BUFFER_TYPE_VERTEX , 0 , RTC_FORMAT_FLOAT3 , mesh.m_vertices.data() ,
+                                offsetof( MeshVertex , m_position ) , sizeof( MeshVertex ) , mesh.m_vertices.size() );
+
+    // The index buffer of the mesh is shared if all of its triangles are in the geometry in the same order.
+    auto whole_mesh = triangle_cnt == mesh.m_indices.size();
+    for( auto i = 0u ; whole_mesh && i < triangle_cnt ; ++i )
+        whole_mesh = &triangle( i )->GetIndex() == &mesh.m_indices[i];
+    if( whole_mesh ){
+        geometry.indices.clear();
+        rtcSetSharedGeometryBuffer( geometry.geometry , RTC_BUFFER_TYPE_INDEX , 0 , RTC_FORMAT_UINT3 , mesh.m_indices.data() ,
+                                    offsetof( MeshFaceIndex , m_id ) , sizeof( MeshFaceIndex ) , triangle_cnt );
+        return;
+    }
+
+    geometry.indices.resize( triangle_cnt * 3 );
+    for( auto i = 0u ; i < triangle_cnt ; ++i ){
+        for( auto k = 0u ; k < 3u ; ++k )
+            geometry.indices[i * 3 + k] = (unsigned)triangle( i )->GetIndex().m_id[k];
+    }
+    rtcSetSharedGeometryBuffer( geometry.geometry , RTC_BUFFER_TYPE_INDEX , 0 , RTC_FORMAT_UINT3 , geometry.indices.data() ,
+                                0 , 3 * sizeof( unsigned ) , triangle_cnt );
+}
+
+bool Embree::resolveTriangleHit( const Ray& ray , unsigned geom_id , unsigned prim_id , float t , float u , float v , SurfaceInteraction& intersect ) const{
+    if( RTC_INVALID_GEOMETRY_ID == geom_id || IS_PTR_INVALID( m_geometries[geom_id].visual ) )
+        return false;
+
+    const auto primitive = m_geometries[geom_id].primitives[prim_id];
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    // same as testing the primitive, shadow rays only need to know what blocks them if it is opaque
+    if( intersect.query_shadow && primitive->IsOpaque() ){
+        intersect.primitive = nullptr;
+        intersect.occluder = primitive;
+        return true;
+    }
+#endif
+
+    static_cast<const Triangle*>( primitive->GetShape() )->SetupIntersection( ray , t , u , v , &intersect );
+    intersect.primitive = primitive;
+    return true;
+}
+
+void Embree::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
+    SORT_PROFILE("Build Embree");
+
+    release();
+    m_isValid = false;
+    m_primitives = &primitives;
+    m_bbox = bbox;
+    if( primitives.empty() )
+        return;
+
+    m_device = rtcNewDevice( nullptr );
+    if( IS_PTR_INVALID( m_device ) ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "Failed to create Embree device, error %d." , (int)rtcGetDeviceError( nullptr ) );
+        return;
+    }
+    rtcSetDeviceErrorFunction( m_device , embreeError , nullptr );
+
+    // Triangles of static meshes without alpha masks are grouped by their meshes, the rest are all in the user geometry.
+    Geometry user;
+    std::unordered_map<const MeshVisual*, size_t> mesh_geometries;
+    for( const auto primitive : primitives ){
+        const auto triangle = SHAPE_TRIANGLE == primitive->GetShapeType() && !primitive->HasAlphaMask() ?
+                              static_cast<const Triangle*>( primitive->GetShape() ) : nullptr;
+        if( !triangle || triangle->IsMoving() ){
+            user.primitives.push_back( primitive );
+            continue;
+        }
+
+        const auto visual = triangle->GetMeshVisual();
+        const auto it = mesh_geometries.find( visual );
+        if( it == mesh_geometries.end() ){
+            mesh_geometries[visual] = m_geometries.size();
+            m_geometries.emplace_back();
+            m_geometries.back().visual = visual;
+            m_geometries.back().primitives.push_back( primitive );
+        }else{
+            m_geometries[it->second].primitives.push_back( primitive );
+        }
+        SORT_STATS(++sEmbreeTriangleCount);
+    }
+    if( !user.primitives.empty() )
+        m_geometries.push_back( std::move( user ) );
+
+    m_scene = rtcNewScene( m_device );
+    rtcSetSceneBuildQuality( m_scene , RTC_BUILD_QUALITY_HIGH );
+
+    // The array is not touched any more, the primitives of the geometries are safe to be referred by Embree.
+    for( auto i = 0u ; i < m_geometries.size() ; ++i ){
+        auto& geometry = m_geometries[i];
+        if( geometry.visual ){
+            geometry.geometry = rtcNewGeometry( m_device , RTC_GEOMETRY_TYPE_TRIANGLE );
+            shareTriangleBuffers( geometry );
+
+            // only BSSRDF queries have a filter, they need all hits
+            rtcSetGeometryEnableFilterFunctionFromArguments( geometry.geometry , true );
+        }else{
+            geometry.geometry = rtcNewGeometry( m_device , RTC_GEOMETRY_TYPE_USER );
+            rtcSetGeometryUserPrimitiveCount( geometry.geometry , (unsigned)geometry.primitives.size() );
+            rtcSetGeometryBoundsFunction( geometry.geometry , embreeBounds , nullptr );
+            rtcSetGeometryIntersectFunction( geometry.geometry , embreeIntersect );
+            rtcSetGeometryOccludedFunction( geometry.geometry , embreeOccluded );
+        }
+        rtcSetGeometryUserData( geometry.geometry , (void*)&geometry.primitives );
+        rtcCommitGeometry( geometry.geometry );
+        rtcAttachGeometryByID( m_scene , geometry.geometry , i );
+    }
+    rtcCommitScene( m_scene );
+
+    SORT_STATS(sEmbreePrimitiveCount = (StatsInt)primitives.size());
+
+    m_isValid = RTC_ERROR_NONE == rtcGetDeviceError( m_device );
+}
+
+bool Embree::Refit(){
+    if( IS_PTR_INVALID( m_scene ) )
+        return false;
+
+    for( auto& geometry : m_geometries ){
+        if( geometry.visual )
+            shareTriangleBuffers( geometry );
+        rtcCommitGeometry( geometry.geometry );
+    }
+    rtcCommitScene( m_scene );
+
+    RTCBounds bounds;
+    rtcGetSceneBounds( m_scene , &bounds );
+    m_bbox.m_Min = Point( bounds.lower_x , bounds.lower_y , bounds.lower_z );
+    m_bbox.m_Max = Point( bounds.upper_x , bounds.upper_y , bounds.upper_z );
+
+    return RTC_ERROR_NONE == rtcGetDeviceError( m_device );
+}
+
+bool Embree::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
+    SORT_PROFILE("Traverse Embree");
+    SORT_STATS_HOT(++sRayCount);
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
+#endif
+
+    if( IS_PTR_INVALID( m_scene ) )
+        return false;
+
+    ray.Prepare();
+
+    EmbreeQuery query;
+    rtcInitRayQueryContext( &query.context );
+    query.rays = &ray;
+    query.intersects = &intersect;
+
+    RTCIntersectArguments args;
+    rtcInitIntersectArguments( &args );
+    args.context = &query.context;
+
+    RTCRayHit rayhit;
+    setupRay( rayhit.ray , ray , 0 );
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1( m_scene , &rayhit , &args );
+
+    if( resolveTriangleHit( ray , rayhit.hit.geomID , rayhit.hit.primID , rayhit.ray.tfar , rayhit.hit.u , rayhit.hit.v , intersect ) )
+        return true;
+    return query.found && isIntersected( intersect );
+}
+
+unsigned Embree::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+    SORT_PROFILE("Traverse Embree");
+    SORT_STATS_HOT(sRayCount += cnt);
+
+    if( IS_PTR_INVALID( m_scene ) )
+        return 0;
+
+    EmbreeQuery query;
+    rtcInitRayQueryContext( &query.context );
+    query.rays = rays;
+    query.intersects = intersects;
+
+    RTCIntersectArguments args;
+    rtcInitIntersectArguments( &args );
+    args.context = &query.context;
+
+    int valid[RAY_PACKET_SIZE];
+    RTCRayHit8 rayhit;
+    for( auto i = 0u ; i < RAY_PACKET_SIZE ; ++i ){
+        valid[i] = i < cnt ? -1 : 0;
+        rayhit.hit.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+        if( i >= cnt )
+            continue;
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        SORT_STATS_HOT(sShadowRayCount += intersects[i].query_shadow);
+#endif
+        rays[i].Prepare();
+        setupRay( rayhit.ray , i , rays[i] );
+    }
+    rtcIntersect8( valid , m_scene , &rayhit , &args );
+
+    auto mask = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto triangle_hit = resolveTriangleHit( rays[i] , rayhit.hit.geomID[i] , rayhit.hit.primID[i] , rayhit.ray.tfar[i] ,
+                                                      rayhit.hit.u[i] , rayhit.hit.v[i] , intersects[i] );
+        if( triangle_hit || ( ( query.found & ( 1u << i ) ) && isIntersected( intersects[i] ) ) )
+            mask |= ( 1u << i );
+    }
+    return mask;
+}
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+bool Embree::IsOccluded( const Ray& ray ) const{
+    SORT_PROFILE("Traverse Embree");
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
+
+    if( IS_PTR_INVALID( m_scene ) )
+        return false;
+
+    ray.Prepare();
+
+    EmbreeQuery query;
+    rtcInitRayQueryContext( &query.context );
+    query.rays = &ray;
+
+    RTCOccludedArguments args;
+    rtcInitOccludedArguments( &args );
+    args.context = &query.context;
+
+    RTCRay embree_ray;
+    setupRay( embree_ray , ray , 0 );
+    rtcOccluded1( m_scene , &embree_ray , &args );
+
+    // Embree marks occluded rays this way, whether they are blocked by triangles or the user geometry.
+    return -INFINITY == embree_ray.tfar;
+}
+
+unsigned Embree::IsOccluded( const Ray* rays , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+    SORT_PROFILE("Traverse Embree");
+    SORT_STATS_HOT(sRayCount += cnt);
+    SORT_STATS_HOT(sShadowRayCount += cnt);
+
+    if( IS_PTR_INVALID( m_scene ) )
+        return 0;
+
+    EmbreeQuery query;
+    rtcInitRayQueryContext( &query.context );
+    query.rays = rays;
+
+    RTCOccludedArguments args;
+    rtcInitOccludedArguments( &args );
+    args.context = &query.context;
+
+    int valid[RAY_PACKET_SIZE];
+    RTCRay8 embree_rays;
+    for( auto i = 0u ; i < RAY_PACKET_SIZE ; ++i ){
+        valid[i] = i < cnt ? -1 : 0;
+        if( i >= cnt )
+            continue;
+
+        rays[i].Prepare();
+        setupRay( embree_rays , i , rays[i] );
+    }
+    rtcOccluded8( valid , m_scene , &embree_rays , &args );
+
+    auto mask = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( -INFINITY == embree_rays.tfar[i] )
+            mask |= ( 1u << i );
+    }
+    return mask;
+}
+#endif
+
+void Embree::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
+    SORT_PROFILE("Traverse Embree");
+    SORT_STATS_HOT(++sRayCount);
+
+    intersect.cnt = 0;
+    intersect.maxt = FLT_MAX;
+
+    if( IS_PTR_INVALID( m_scene ) )
+        return;
+
+    ray.Prepare();
+
+    EmbreeQuery query;
+    rtcInitRayQueryContext( &query.context );
+    query.rays = &ray;
+    query.sss = &intersect;
+    query.matID = matID;
+
+    RTCIntersectArguments args;
+    rtcInitIntersectArguments( &args );
+    args.context = &query.context;
+    args.filter = embreeBssrdfFilter;
+    args.flags = RTC_RAY_QUERY_FLAG_INVOKE_ARGUMENT_FILTER;
+
+    RTCRayHit rayhit;
+    setupRay( rayhit.ray , ray , 0 );
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1( m_scene , &rayhit , &args );
+}
+
+std::unique_ptr<Accelerator> Embree::Clone() const {
+	return std::make_unique<Embree>();
+}
+
+#endif
@@ -0,0 +1,168 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+#ifdef SORT_ENABLE_EMBREE
+
+#include <vector>
+#include <embree4/rtcore.h>
+#include "accelerator.h"
+
+class MeshVisual;
+
+//! @brief Accelerator backed by Intel Embree on the CPU.
+/**
+ * The hierarchy is built and traversed by Embree, with packets of rays traversed together by its
+ * SIMD kernels. Triangles of static meshes without alpha masks are registered as Embree triangle
+ * geometries, one for each mesh, sharing the vertex buffer and, if the whole mesh is in the scene,
+ * the index buffer of the mesh. They are intersected by the native triangle kernels of Embree and
+ * the intersection is only filled by SORT for the closest hit.
+ * Everything else, like lines, spheres, instances, moving and alpha masked triangles, is kept in one
+ * user geometry whose callbacks run the intersection tests of SORT.
+ * Integrators don't need to know about it, the single ray and ray packet interfaces are all
+ * mapped to the corresponding Embree queries.
+ * It is only available if SORT is built with ENABLE_EMBREE.
+ */
+class Embree : public Accelerator{
+public:
+    DEFINE_RTTI( Embree , Accelerator );
+
+    //! @brief  Release the Embree scene and device.
+    ~Embree() override;
+
+    //! @brief      Get intersection between the ray and the primitive set using Embree.
+    //!
+    //! It will return true if there is intersection between the ray and the primitive set.
+    //! In case of an intersection, it will fill the structure and return the nearest intersection.
+    //! This intersection could possibly be a fully transparent intersection, it is up to the higher
+    //! level logic to handle (semi)transparency later.
+    //!
+    //! @param r            The input ray to be tested.
+    //! @param intersect    The intersection result.
+    //! @return             It will return true if there is an intersection, otherwise
+    //!                     it returns false.
+    bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
+
+    //! @brief Get intersections between a packet of rays and the primitive set.
+    //!
+    //! The packet is traversed with a single Embree packet query.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays intersecting anything, the i-th bit is for the i-th ray.
+    unsigned GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const override;
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief This is a dedicated interface for detecting shadow rays.
+    //!
+    //! @param r            The ray to be tested.
+    //! @return             Whether the ray is occluded by anything.
+    bool IsOccluded( const Ray& r ) const override;
+
+    //! @brief Detect occlusion of a packet of shadow rays with a single Embree packet query.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays occluded by anything, the i-th bit is for the i-th ray.
+    unsigned IsOccluded( const Ray* rays , const unsigned cnt ) const override;
+#endif
+
+    //! @brief Get multiple intersections between the ray and the primitive set using Embree.
+    //!
+    //! This is a specific interface designed for SSS during disk ray casting. The intersection returned doesn't guarantee
+    //! the order of the intersection of the results, but it does guarantee to get the nearest N intersections.
+    //!
+    //! @param  r           The input ray to be tested.
+    //! @param  intersect   The intersection result that holds all intersection.
+    //! @param  matID       We are only interested in intersection with the same material, whose material id should be set to matID.
+    void GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const override;
+
+    //! @brief Build the Embree scene.
+    //!
+    //! @param primitives       A vector holding all primitives.
+    //! @param bbox             The bounding box of the scene.
+    void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
+
+    //! @brief Commit the Embree scene again after the primitives are moved or deformed.
+    //!
+    //! The bounding boxes of all primitives are queried again, Embree decides how to update its hierarchy.
+    //!
+    //! @return                 Whether the scene is committed successfully.
+    bool    Refit() override;
+
+    //! @brief      Serializing data from stream, this data structure is not configurable in Blender.
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different
+    //!             situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override{}
+
+	//! @brief	Clone the accelerator.
+	//!
+	//! Only configuration will be cloned, not the data inside the accelerator, this is for primitives that has volumes attached.
+	//!
+	//! @return		Cloned accelerator.
+	std::unique_ptr<Accelerator>	Clone() const override;
+
+private:
+    //! @brief  An Embree geometry, the id of an Embree primitive is the index of the primitive in it.
+    struct Geometry{
+        /**< The Embree geometry. */
+        RTCGeometry                     geometry = nullptr;
+        /**< Primitives of the geometry. */
+        std::vector<const Primitive*>   primitives;
+        /**< Visual holding the vertices of a triangle geometry, it is nullptr for the user geometry. */
+        const MeshVisual*               visual = nullptr;
+        /**< Indices of the triangles, it is only filled if not all triangles of the mesh are in the geometry. */
+        std::vector<unsigned>           indices;
+    };
+
+    /**< Embree device that the scene is created on. */
+    RTCDevice               m_device = nullptr;
+    /**< Embree scene holding all primitives. */
+    RTCScene                m_scene = nullptr;
+    /**< Geometries in the scene, the id of an Embree geometry is its index in this array. */
+    std::vector<Geometry>   m_geometries;
+
+    //! @brief  Release the Embree scene and device.
+    void    release();
+
+    //! @brief  Share the vertex and index buffers of the mesh of a triangle geometry with Embree.
+    //!
+    //! @param  geometry    The triangle geometry.
+    void    shareTriangleBuffers( Geometry& geometry );
+
+    //! @brief  Fill the intersection of the closest hit if it is on a triangle geometry.
+    //!
+    //! Hits on the user geometry are filled by its callbacks already.
+    //!
+    //! @param  ray         The ray of the hit.
+    //! @param  geom_id     Id of the Embree geometry hit by the ray.
+    //! @param  prim_id     Id of the Embree primitive hit by the ray.
+    //! @param  t           Distance from the origin of the ray to the hit.
+    //! @param  u           Barycentric coordinate of the second vertex of the triangle.
+    //! @param  v           Barycentric coordinate of the third vertex of the triangle.
+    //! @param  intersect   The intersection to be filled.
+    //! @return             Whether the hit is on a triangle geometry.
+    bool    resolveTriangleHit( const Ray& ray , unsigned geom_id , unsigned prim_id , float t , float u , float v , SurfaceInteraction& intersect ) const;
+
+    SORT_STATS_ENABLE( "Spatial-Structure(Embree)" )
+};
+
+#endif
@@ -17,51 +17,70 @@
 
 #pragma once
 
+#include <atomic>
+#include <vector>
 #include "accelerator.h"
 #include "bvh_utils.h"
 #include "core/primitive.h"
+#include "core/stats.h"
+#include "core/memory.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.h");
 #endif
 
-#if defined(QBVH_IMPLEMENTATION) || defined(OBVH_IMPLEMENTATION)
+#if defined(QBVH_IMPLEMENTATION) || defined(OBVH_IMPLEMENTATION) || defined(HBVH_IMPLEMENTATION)
 
 #if defined(QBVH_IMPLEMENTATION)
-#define Fast_Bvh_Node   Qbvh_Node
-#define FBVH_CHILD_CNT  4
+#define Fast_Bvh_Node           Qbvh_Node
+#define Fast_Bvh_Linear_Node    Qbvh_Linear_Node
+#define Fast_Bvh_Leaf           Qbvh_Leaf
+#define FBVH_CHILD_CNT          4
 #endif
 
 #if defined(OBVH_IMPLEMENTATION)
-#define Fast_Bvh_Node   Obvh_Node
-#define FBVH_CHILD_CNT  8
+#define Fast_Bvh_Node           Obvh_Node
+#define Fast_Bvh_Linear_Node    Obvh_Linear_Node
+#define Fast_Bvh_Leaf           Obvh_Leaf
+#define FBVH_CHILD_CNT          8
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+// Bounding boxes of children are quantized in linearized OBVH nodes so that a node fits in two cache lines instead of four.
+#define FBVH_QUANTIZED_BBOX
+#endif
 #endif
 
+#if defined(HBVH_IMPLEMENTATION)
+#define Fast_Bvh_Node           Hbvh_Node
+#define Fast_Bvh_Linear_Node    Hbvh_Linear_Node
+#define Fast_Bvh_Leaf           Hbvh_Leaf
+#define FBVH_CHILD_CNT          16
+
 #ifdef SIMD_BVH_IMPLEMENTATION
-struct Fast_Bvh_Node_Deallocator{
-    void operator()(void* p){
-        free_aligned(p);
-    }
-};
+// A node with sixteen full precision bounding boxes takes eight cache lines, it is three with quantized ones.
+#define FBVH_QUANTIZED_BBOX
+#endif
+#endif
 
-struct Fast_Bvh_Node;
-using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node,Fast_Bvh_Node_Deallocator>;
+//! @brief  Reference to a node in the linearized QBVH/OBVH/HBVH.
+//!
+//! The highest bit indicates whether it is a leaf node, the rest bits are the offset of the node in either the
+//! interior node array or the leaf node array.
+using Fbvh_Node_Ref = unsigned int;
+static constexpr Fbvh_Node_Ref  FBVH_LEAF_NODE_FLAG = 0x80000000u;
 
-#else
 struct Fast_Bvh_Node;
 using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node>;
-#endif
 
+//! @brief  QBVH/OBVH/HBVH node used during construction only.
+/**
+ * Once the construction is done, the tree will be linearized into 'Fast_Bvh_Linear_Node' and 'Fast_Bvh_Leaf', the
+ * nodes here are all destroyed after that. Primitives of leaf nodes are only packed in SIMD data structures after the
+ * tree is linearized, so that the temporary nodes don't hold copies of them.
+ */
 struct Fast_Bvh_Node {
 #ifdef SIMD_BVH_IMPLEMENTATION
-    using Simd_Triangle_Container   = std::unique_ptr<Simd_Triangle[]>;
-    using Simd_Line_Container       = std::unique_ptr<Simd_Line[]>;
     Simd_BBox                       bbox;                       /**< Bounding boxes of its four children. */
-    Simd_Triangle_Container         tri_list;
-    Simd_Line_Container             line_list;
-    unsigned int                    tri_cnt = 0;
-    unsigned int                    line_cnt = 0;
-    std::vector<const Primitive*>   other_list;
 #else
     BBox                            bbox[FBVH_CHILD_CNT];       /**< Bounding boxes of its children. */
 #endif
@@ -70,21 +89,73 @@ struct Fast_Bvh_Node {
 
     unsigned                        pri_cnt = 0;                /**< Number of primitives in the node. */
     unsigned                        pri_offset = 0;             /**< Offset of primitives in the buffer. */
+    unsigned                        pri_capacity = 0;           /**< Offset after the last slot reserved for the node in the buffer. */
     unsigned                        child_cnt = 0;              /**< 0 means it is a leaf node. */
 
     //! @brief  Constructor.
     //!
-    //! @param  offset      The offset of the first primitive in the whole buffer.
-    //! @param  cnt         Number of primitives in the node.
-    Fast_Bvh_Node(unsigned offset, unsigned cnt) : pri_cnt(cnt), pri_offset(offset) {}
+    //! @param  range       The range of primitive references in the whole buffer.
+    Fast_Bvh_Node(const Bvh_Range& range) : pri_cnt(range.end - range.start), pri_offset(range.start), pri_capacity(range.capacity) {}
 
     //! @brief  Default constructor.
     Fast_Bvh_Node() : pri_cnt(0), pri_offset(0), child_cnt(0) {}  
 };
 
+//! @brief  Interior node in the linearized QBVH/OBVH/HBVH.
+/**
+ * All interior nodes are saved in one contiguous array in depth first order, children are referred by 32 bits offsets
+ * instead of pointers. There is nothing else in the node so that visiting a QBVH node only touches two cache lines, so
+ * does an OBVH node with quantized bounding boxes.
+ * Invalid children are masked out, or saved as inverted boxes if quantized, in the bounding boxes for SIMD version,
+ * otherwise 'child_cnt' is used.
+ */
+struct alignas(64) Fast_Bvh_Linear_Node {
+#if defined(FBVH_QUANTIZED_BBOX)
+    Simd_Quantized_BBox             bbox;                       /**< Quantized bounding boxes of its children. */
+#elif defined(SIMD_BVH_IMPLEMENTATION)
+    Simd_BBox                       bbox;                       /**< Bounding boxes of its children. */
+#else
+    BBox                            bbox[FBVH_CHILD_CNT];       /**< Bounding boxes of its children. */
+    unsigned                        child_cnt = 0;              /**< Number of children of the node. */
+#endif
+    Fbvh_Node_Ref                   children[FBVH_CHILD_CNT];   /**< References to its children. */
+};
+
+//! @brief  Bounding boxes of the children of a linearized node at both ends of the shutter interval.
+/**
+ * They are only kept when there is any moving primitive in the scene, parallel to the linearized interior nodes. Boxes
+ * of static children are identical at both ends.
+ */
+struct alignas(64) Fast_Bvh_Motion_Node {
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_BBox                       open;                       /**< Bounding boxes of its children at the opening of the shutter. */
+    Simd_BBox                       close;                      /**< Bounding boxes of its children at the closing of the shutter. */
+#else
+    MotionBBox                      bbox[FBVH_CHILD_CNT];       /**< Bounding boxes of its children at both ends of the shutter. */
+#endif
+};
+
+//! @brief  Leaf node in the linearized QBVH/OBVH/HBVH.
+/**
+ * Primitives of all leaf nodes are packed in separate buffers, a leaf node only keeps the ranges of them.
+ */
+struct Fast_Bvh_Leaf {
+    unsigned                        pri_offset = 0;             /**< Offset of primitives in the buffer. */
+    unsigned                        pri_cnt = 0;                /**< Number of primitives in the node. */
 #ifdef SIMD_BVH_IMPLEMENTATION
-    static_assert( sizeof( Fast_Bvh_Node ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Fast_Bvh_Node." );
+    unsigned                        tri_offset = 0;             /**< Offset of the first SIMD triangle in the buffer. */
+    unsigned                        tri_cnt = 0;                /**< Number of SIMD triangles in the node. */
+    unsigned                        line_offset = 0;            /**< Offset of the first SIMD line in the buffer. */
+    unsigned                        line_cnt = 0;               /**< Number of SIMD lines in the node. */
+    unsigned                        sphere_offset = 0;          /**< Offset of the first SIMD sphere in the buffer. */
+    unsigned                        sphere_cnt = 0;             /**< Number of SIMD spheres in the node. */
+    unsigned                        planar_offset = 0;          /**< Offset of the first SIMD quad or disk in the buffer. */
+    unsigned                        planar_cnt = 0;             /**< Number of SIMD quads and disks in the node. */
+    unsigned                        other_offset = 0;           /**< Offset of the first other primitive in the buffer. */
+    unsigned                        other_cnt = 0;              /**< Number of other primitives in the node. */
+    bool                            opaque = false;             /**< Whether all primitives in the node are opaque. */
 #endif
+};
 
 #endif
 
@@ -97,6 +168,7 @@ struct Fast_Bvh_Node {
  * a binary tree. It easily opens the door for SSE/AVX optimization during BVH traversal since we can do ray-AABB intersection 
  * four/eight times more efficient. And also we can do the same to primitive ray intersection, instead of doing it one at a time,
  * QBVH/OBVH will check four/eight primitives at a time, boosting the performance of ray intersection test.
+ * HBVH is the sixteen-ary version of it, which matches the width of AVX512.
  */
 class Fbvh : public Accelerator{
 public:
@@ -106,6 +178,9 @@ public:
 #ifdef OBVH_IMPLEMENTATION
     DEFINE_RTTI( Obvh , Accelerator );
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    DEFINE_RTTI( Hbvh , Accelerator );
+#endif
 
     //! @brief Get intersection between the ray and the primitive set using QBVH/OBVH.
     //!
@@ -122,6 +197,17 @@ public:
     //! @return             It will return true if there is an intersection, otherwise it returns false.
     bool    GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
+    //! @brief Get intersections between a packet of rays and the primitive set using QBVH/OBVH.
+    //!
+    //! All rays in the packet share one traversal stack, each node is fetched once and tested against all rays that are
+    //! still interested in it. Rays that miss a child are masked out in the whole sub-tree below the child.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays intersecting anything, the i-th bit is for the i-th ray.
+    unsigned    GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const override;
+
 #ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
@@ -132,6 +218,17 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const override;
+
+    //! @brief Detect occlusion of a packet of shadow rays using QBVH/OBVH.
+    //!
+    //! Like the packet version of 'GetIntersect', all rays share one traversal stack. Since any occluder is enough, children
+    //! are not sorted and a ray leaves the traversal as soon as it is occluded, the traversal stops once all rays are.
+    //! Children beyond the extent of a ray are culled for it.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param cnt          Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of rays occluded by anything, the i-th bit is for the i-th ray.
+    unsigned    IsOccluded( const Ray* rays , const unsigned cnt ) const override;
 #endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
@@ -152,6 +249,19 @@ public:
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
 
+    //! @brief Refit the QBVH/OBVH after the primitives are moved or deformed.
+    //!
+    //! Since linearized children are always after their parents, interior nodes are refitted in reverse order. SIMD data
+    //! of leaf nodes is packed again since it holds copies of the vertices.
+    //!
+    //! @return                 It always returns true since QBVH/OBVH supports refitting.
+    bool    Refit() override;
+
+    //! @brief Evaluate the SAH cost of the built QBVH/OBVH.
+    //!
+    //! @return                 SAH cost of the QBVH/OBVH relative to the surface area of the root node.
+    float   EvaluateSAH() const override;
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
@@ -159,6 +269,8 @@ public:
     void    Serialize( IStreamBase& stream ) override{
         stream >> m_maxNodeDepth;
         stream >> m_maxPriInLeaf;
+        stream >> m_spatialSplit;
+        stream >> m_spatialSplitBudget;
     }
 
 	//! @brief	Clone the accelerator.
@@ -169,19 +281,46 @@ public:
 	std::unique_ptr<Accelerator>	Clone() const override;
 
 private:
-    /**< Primitive list during QBVH/OBVH construction. */
+    /**< Primitive references during QBVH/OBVH construction, it is released once the tree is linearized. */
     std::unique_ptr<Bvh_Primitive[]>    m_bvhpri = nullptr;
-
-    /**< Root node of the BVH. */
-    Fast_Bvh_Node_Ptr                   m_root;
+    /**< Primitives referenced by leaf nodes, each leaf node refers to a contiguous range of it. */
+    std::vector<const Primitive*>       m_references;
+
+    /**< Reference to the root node of the BVH. */
+    Fbvh_Node_Ref                       m_root = 0;
+    /**< Interior nodes of the linearized BVH, they are backed by large pages if it is enabled. */
+    LargePageVector<Fast_Bvh_Linear_Node>   m_nodes;
+    /**< Leaf nodes of the linearized BVH. */
+    LargePageVector<Fast_Bvh_Leaf>          m_leaves;
+    /**< Shutter-end bounding boxes of the interior nodes, it is empty if nothing moves. */
+    LargePageVector<Fast_Bvh_Motion_Node>   m_motion;
+#ifdef SIMD_BVH_IMPLEMENTATION
+    /**< SIMD triangles of all leaf nodes. */
+    LargePageVector<Simd_Triangle>          m_triangles;
+    /**< SIMD lines of all leaf nodes. */
+    LargePageVector<Simd_Line>              m_lines;
+    /**< SIMD spheres of all leaf nodes. */
+    LargePageVector<Simd_Sphere>            m_spheres;
+    /**< SIMD quads and disks of all leaf nodes. */
+    LargePageVector<Simd_Planar>            m_planars;
+    /**< Primitives of all leaf nodes that don't have a SIMD version. */
+    std::vector<const Primitive*>       m_others;
+#endif
 
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                            m_maxPriInLeaf = 8;
     /**< Maximum depth of node in BVH. */
     unsigned                            m_maxNodeDepth = 16;
+    /**< Whether spatial splits are evaluated during BVH construction. */
+    bool                                m_spatialSplit = false;
+    /**< Maximum number of references duplicated by spatial splits, relative to the number of primitives. */
+    float                               m_spatialSplitBudget = 0.3f;
+
+    /**< Depth of the QBVH/OBVH. It is updated by multiple tasks during construction. */
+    std::atomic<unsigned>               m_depth = { 0 };
 
-    /**< Depth of the QBVH/OBVH. */
-    unsigned                            m_depth = 0;
+    /**< Memory of the linearized nodes and primitive references accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
 
     //! @brief Split current QBVH/OBVH node.
     //!
@@ -198,6 +337,89 @@ private:
     //! @param depth        Depth of the current node.
     void    makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , unsigned depth );
 
+    //! @brief Linearize the sub-tree into contiguous node arrays.
+    //!
+    //! @param node         The root node of the sub-tree to be linearized.
+    //! @return             Reference to the linearized node.
+    Fbvh_Node_Ref   linearizeNode( const Fbvh_Node* const node );
+
+    //! @brief Account the memory of the built QBVH/OBVH in stats.
+    void    trackMemory();
+
+    //! @brief Save the built QBVH/OBVH to the cache.
+    //!
+    //! @param stream       Stream to save the QBVH/OBVH to.
+    //! @param indices      Index of each primitive in the primitive list.
+    //! @return             It always returns true since QBVH/OBVH supports cache.
+    bool    saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const override;
+
+    //! @brief Load the QBVH/OBVH from the cache.
+    //!
+    //! The linearized interior nodes are loaded as they are, SIMD data of leaf nodes is packed again since it holds
+    //! pointers to primitives.
+    //!
+    //! @param stream       Stream to load the QBVH/OBVH from.
+    //! @return             False if the cache doesn't match the configuration or it is corrupted.
+    bool    loadCache( IStreamBase& stream ) override;
+
+    //! @brief Evaluate the shutter-end bounding boxes of all interior nodes.
+    //!
+    //! Nothing is kept if there is no moving primitive. Similar to refitting, interior nodes are visited in reverse order.
+    void    fitMotion();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    //! @brief Intersect a ray against the bounding boxes of the children of an interior node.
+    //!
+    //! @param ray          The ray to be tested.
+    //! @param simd_ray     The SIMD version of the ray.
+    //! @param node_ref     Reference to the interior node.
+    //! @param f_min        Distances to the children, it is negative for children that are missed.
+    //! @return             Mask of children hit by the ray.
+    int     intersectNode( const Ray& ray , const Simd_Ray_Data& simd_ray , const Fbvh_Node_Ref node_ref , simd_data& f_min ) const;
+#else
+    //! @brief Intersect a ray against the bounding box of a child of an interior node.
+    //!
+    //! @param ray          The ray to be tested.
+    //! @param node_ref     Reference to the interior node.
+    //! @param i            Index of the child.
+    //! @return             Distance to the child, it is negative if the child is missed.
+    float   intersectChild( const Ray& ray , const Fbvh_Node_Ref node_ref , const unsigned i ) const;
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    //! @brief Pack primitives of all leaf nodes into SIMD data structures.
+    //!
+    //! SIMD data of the leaf nodes is replaced, its offsets and counts in the leaf nodes are updated too.
+    void    packLeaves();
+#endif
+
+    //! @brief Intersect a ray against all primitives in a leaf node.
+    //!
+    //! @param leaf         The leaf node to be tested.
+    //! @param ray          The ray to be tested.
+    //! @param simd_ray     The SIMD version of the ray.
+    //! @param intersect    The intersection result.
+    //! @return             Whether the shadow ray is blocked by an opaque primitive, the traversal could stop then.
+#ifdef SIMD_BVH_IMPLEMENTATION
+    bool    intersectLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , const Simd_Ray_Data& simd_ray , SurfaceInteraction& intersect ) const;
+#else
+    bool    intersectLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , SurfaceInteraction& intersect ) const;
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    //! @brief Test whether a shadow ray is blocked by any primitive in a leaf node.
+    //!
+    //! It stops as long as there is an intersection, no intersection is evaluated.
+    //!
+    //! @param leaf         The leaf node to be tested.
+    //! @param ray          The ray to be tested.
+    //! @param simd_ray     The SIMD version of the ray.
+    //! @param occluder     The primitive blocking the ray if it is a triangle or one of the other primitives, it is
+    //!                     untouched otherwise. It is not needed if nullptr is passed in.
+    //! @return             Whether the ray is blocked by any primitive in the leaf node.
+    bool    occludeLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , const Simd_Ray_Data& simd_ray , const Primitive** occluder = nullptr ) const;
+#endif
+
 #ifdef SIMD_BVH_IMPLEMENTATION
     //! @brief A helper function calculating bounding box of a node.
     //!
@@ -212,4 +434,7 @@ private:
 #ifdef OBVH_IMPLEMENTATION
     SORT_STATS_ENABLE( "Spatial-Structure(OBVH)" )
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_STATS_ENABLE( "Spatial-Structure(HBVH)" )
+#endif
 };
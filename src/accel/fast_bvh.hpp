@@ -16,31 +16,141 @@
  */
 
 #include <queue>
+#include <algorithm>
 #include "core/memory.h"
 #include "core/stats.h"
+#include "core/hwcounter.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
 
-SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( unsigned int start , unsigned int end ){
+SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( const Bvh_Range& range ){
+    return std::make_unique<Fast_Bvh_Node>( range );
+}
+
+SORT_STATIC_FORCEINLINE bool isLeafNode( const Fbvh_Node_Ref ref ){
+    return 0 != ( ref & FBVH_LEAF_NODE_FLAG );
+}
+
+SORT_STATIC_FORCEINLINE unsigned leafNodeIndex( const Fbvh_Node_Ref ref ){
+    return ref & ~FBVH_LEAF_NODE_FLAG;
+}
+
+SORT_STATIC_FORCEINLINE unsigned childCount( const Fast_Bvh_Linear_Node& node ){
 #ifdef SIMD_BVH_IMPLEMENTATION
-    auto* address = malloc_aligned( sizeof(Fast_Bvh_Node) , SIMD_ALIGNMENT );
-    auto* node = new (address) Fast_Bvh_Node( start , end );
-    return std::move(Fast_Bvh_Node_Ptr(node));
+    // children are always populated from the first slot, unused ones are 0
+    auto child_cnt = 0u;
+    while( child_cnt < FBVH_CHILD_CNT && 0 != node.children[child_cnt] )
+        ++child_cnt;
+    return child_cnt;
 #else
-    return std::move( std::make_unique<Fast_Bvh_Node>( start , end ) );
+    return node.child_cnt;
 #endif
 }
 
-template<class T>
-SORT_STATIC_FORCEINLINE std::unique_ptr<T[]> makePrimitiveList( unsigned int cnt ){
 #ifdef SIMD_BVH_IMPLEMENTATION
-    auto* address = malloc_aligned( sizeof(T) * cnt , SIMD_ALIGNMENT );
-    return std::move(std::unique_ptr<T[]>((T*)address));
+SORT_STATIC_FORCEINLINE BBox extractBBox( const Simd_BBox& bbox , const unsigned i ){
+    return BBox( Point( bbox.m_min_x[i] , bbox.m_min_y[i] , bbox.m_min_z[i] ) ,
+                 Point( bbox.m_max_x[i] , bbox.m_max_y[i] , bbox.m_max_z[i] ) );
+}
+#endif
+
+SORT_STATIC_FORCEINLINE BBox childBBox( const Fast_Bvh_Linear_Node& node , const unsigned i ){
+#if defined(FBVH_QUANTIZED_BBOX)
+    return DequantizeBBox_SIMD( node.bbox , i );
+#elif defined(SIMD_BVH_IMPLEMENTATION)
+    return extractBBox( node.bbox , i );
 #else
-    return std::move(std::unique_ptr<T[]>(cnt));
+    return node.bbox[i];
 #endif
 }
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#ifdef SIMD_BVH_IMPLEMENTATION
+SORT_STATIC_FORCEINLINE Simd_BBox packBoundingBoxSIMD( const BBox* bbox , const bool* valid ){
+    Simd_BBox node_bbox;
+
+    float   min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL];
+    float   max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        min_x[i] = bbox[i].m_Min.x;
+        min_y[i] = bbox[i].m_Min.y;
+        min_z[i] = bbox[i].m_Min.z;
+        max_x[i] = bbox[i].m_Max.x;
+        max_y[i] = bbox[i].m_Max.y;
+        max_z[i] = bbox[i].m_Max.z;
+    }
+
+    node_bbox.m_min_x = simd_set_ps( min_x );
+    node_bbox.m_min_y = simd_set_ps( min_y );
+    node_bbox.m_min_z = simd_set_ps( min_z );
+    
+    node_bbox.m_max_x = simd_set_ps( max_x );
+    node_bbox.m_max_y = simd_set_ps( max_y );
+    node_bbox.m_max_z = simd_set_ps( max_z );
+
+    node_bbox.m_mask = simd_set_mask( valid );
+
+    return node_bbox;
+}
+#endif
+
+//! @brief Traversal stack of QBVH/OBVH.
+//!
+//! Stacks are allocated once per thread and reused by all later traversals. An instance could start traversing another
+//! QBVH/OBVH in the middle of a traversal, each nesting level has its own stack so that it won't overwrite the one of the
+//! outer traversal. A stack is reallocated if it is not large enough for the tree being traversed.
+template<class T>
+class Fbvh_Stack{
+public:
+    //! @brief Acquire the stack of the current nesting level.
+    //!
+    //! @param size     Number of elements needed in the stack.
+    Fbvh_Stack( const unsigned size ){
+        auto& stacks = getStacks();
+        m_level = getLevel()++;
+        if( stacks.size() <= m_level )
+            stacks.resize( m_level + 1 );
+
+        auto& stack = stacks[m_level];
+        if( UNLIKELY( stack.second < size ) ){
+            stack.first = std::make_unique<T[]>( size );
+            stack.second = size;
+        }
+        m_data = stack.first.get();
+    }
+
+    //! @brief Release the stack so that it could be reused by the next traversal at the same nesting level.
+    ~Fbvh_Stack(){
+        --getLevel();
+    }
+
+    SORT_FORCEINLINE T& operator []( const unsigned i ){
+        return m_data[i];
+    }
+
+private:
+    T*          m_data = nullptr;   /**< Elements of the stack. */
+    unsigned    m_level = 0;        /**< Nesting level of the traversal. */
+
+    //! @brief Get the current nesting level of the thread.
+    static unsigned& getLevel(){
+        static thread_local unsigned level = 0;
+        return level;
+    }
+
+    //! @brief Get stacks of all nesting levels of the thread along with their sizes.
+    static std::vector<std::pair<std::unique_ptr<T[]>, unsigned>>& getStacks(){
+        static thread_local std::vector<std::pair<std::unique_ptr<T[]>, unsigned>> stacks;
+        return stacks;
+    }
+};
+
+//! @brief Stack entry of packet traversal.
+struct Fbvh_Packet_Entry{
+    Fbvh_Node_Ref   node;                   /**< The node to be visited. */
+    unsigned        mask;                   /**< Mask of rays that are interested in the node. */
+    float           fmin[RAY_PACKET_SIZE];  /**< Distance to the node along each ray in the mask. */
+};
+
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.hpp");
 #endif
 
@@ -51,9 +161,11 @@ SORT_STATS_DEFINE_COUNTER(sQbvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sQbvhDepth)
 SORT_STATS_DEFINE_COUNTER(sQbvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sQbvhPrimitiveCount)
+SORT_STATS_DEFINE_MEMORY(sQbvhMemory)
 
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Shadow Ray Count", sShadowRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Ray Packet Count", sRayPacketCount);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Intersection Test", sIntersectionTest );
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Node Count", sQbvhNodeCount);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Leaf Node Count", sQbvhLeafNodeCount);
@@ -61,12 +173,16 @@ SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "BVH Depth", sQbvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Maximum Primitive in Leaf", sQbvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Count in Leaf", sQbvhPrimitiveCount , sQbvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_MEMORY("QBVH Nodes", sQbvhMemory);
 
 #define sFbvhNodeCount          sQbvhNodeCount
 #define sFbvhLeafNodeCount      sQbvhLeafNodeCount
 #define sFbvhDepth              sQbvhDepth
 #define sFbvhMaxPriCountInLeaf  sQbvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sQbvhPrimitiveCount
+#define sFbvhMemory             sQbvhMemory
+
+#define FBVH_CACHE_TYPE         SID("Qbvh")
 
 #endif
 
@@ -77,9 +193,11 @@ SORT_STATS_DEFINE_COUNTER(sObvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sObvhDepth)
 SORT_STATS_DEFINE_COUNTER(sObvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sObvhPrimitiveCount)
+SORT_STATS_DEFINE_MEMORY(sObvhMemory)
 
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Shadow Ray Count", sShadowRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Ray Packet Count", sRayPacketCount);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Intersection Test", sIntersectionTest );
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Node Count", sObvhNodeCount);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Leaf Node Count", sObvhLeafNodeCount);
@@ -87,13 +205,131 @@ SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "BVH Depth", sObvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Maximum Primitive in Leaf", sObvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Count in Leaf", sObvhPrimitiveCount , sObvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_MEMORY("OBVH Nodes", sObvhMemory);
 
 #define sFbvhNodeCount          sObvhNodeCount
 #define sFbvhLeafNodeCount      sObvhLeafNodeCount
 #define sFbvhDepth              sObvhDepth
 #define sFbvhMaxPriCountInLeaf  sObvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sObvhPrimitiveCount
+#define sFbvhMemory             sObvhMemory
+
+#define FBVH_CACHE_TYPE         SID("Obvh")
+
+#endif
+
+#ifdef HBVH_IMPLEMENTATION
+
+SORT_STATS_DEFINE_COUNTER(sHbvhNodeCount)
+SORT_STATS_DEFINE_COUNTER(sHbvhLeafNodeCount)
+SORT_STATS_DEFINE_COUNTER(sHbvhDepth)
+SORT_STATS_DEFINE_COUNTER(sHbvhMaxPriCountInLeaf)
+SORT_STATS_DEFINE_COUNTER(sHbvhPrimitiveCount)
+SORT_STATS_DEFINE_MEMORY(sHbvhMemory)
+
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Total Ray Count", sRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Shadow Ray Count", sShadowRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Ray Packet Count", sRayPacketCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Intersection Test", sIntersectionTest );
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Node Count", sHbvhNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Leaf Node Count", sHbvhLeafNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "BVH Depth", sHbvhDepth);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Maximum Primitive in Leaf", sHbvhMaxPriCountInLeaf);
+SORT_STATS_AVG_COUNT("Spatial-Structure(HBVH)", "Average Primitive Count in Leaf", sHbvhPrimitiveCount , sHbvhLeafNodeCount );
+SORT_STATS_AVG_COUNT("Spatial-Structure(HBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_MEMORY("HBVH Nodes", sHbvhMemory);
+
+#define sFbvhNodeCount          sHbvhNodeCount
+#define sFbvhLeafNodeCount      sHbvhLeafNodeCount
+#define sFbvhDepth              sHbvhDepth
+#define sFbvhMaxPriCountInLeaf  sHbvhMaxPriCountInLeaf
+#define sFbvhPrimitiveCount     sHbvhPrimitiveCount
+#define sFbvhMemory             sHbvhMemory
+
+#define FBVH_CACHE_TYPE         SID("Hbvh")
+
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+//! @brief Pack primitives of a leaf node into SIMD data structures.
+//!
+//! @param primitives   The buffer hold all references.
+//! @param start        The start offset of primitives in the leaf node.
+//! @param end          The end offset of primitives in the leaf node.
+//! @param tri_list     SIMD triangles are appended to it.
+//! @param line_list    SIMD lines are appended to it.
+//! @param sphere_list  SIMD spheres are appended to it.
+//! @param planar_list  SIMD quads and disks are appended to it.
+//! @param other_list   Primitives that don't have a SIMD version are appended to it.
+SORT_STATIC_FORCEINLINE void packLeafPrimitives( const Primitive* const* const primitives , const unsigned start , const unsigned end ,
+                                                 LargePageVector<Simd_Triangle>& tri_list , LargePageVector<Simd_Line>& line_list ,
+                                                 LargePageVector<Simd_Sphere>& sphere_list , LargePageVector<Simd_Planar>& planar_list ,
+                                                 std::vector<const Primitive*>& other_list ){
+    Simd_Triangle   sind_tri;
+    Simd_Line       simd_line;
+    Simd_Sphere     simd_sphere;
+    Simd_Planar     simd_planar;
+    for(auto i = start ; i < end ; i++ ){
+        const Primitive* primitive = primitives[i];
+        const auto shape_type = primitive->GetShapeType();
+        // Cut out hits are rejected by the primitive itself, which packed primitives skip, so are moving primitives.
+        if( UNLIKELY( primitive->HasAlphaMask() || primitive->IsMoving() ) ){
+            other_list.push_back( primitive );
+        }else if( SHAPE_TRIANGLE == shape_type ){
+            if( sind_tri.PushTriangle( primitive ) ){
+                if( sind_tri.PackData() ){
+                    tri_list.push_back( sind_tri );
+                    sind_tri.Reset();
+                }
+            }
+        }else if( SHAPE_LINE == shape_type ){
+            if( simd_line.PushLine( primitive ) ){
+                if( simd_line.PackData() ){
+                    line_list.push_back( simd_line );
+                    simd_line.Reset();
+                }
+            }
+        }else if( SHAPE_SPHERE == shape_type ){
+            if( simd_sphere.PushSphere( primitive ) ){
+                if( simd_sphere.PackData() ){
+                    sphere_list.push_back( simd_sphere );
+                    simd_sphere.Reset();
+                }
+            }
+        }else if( SHAPE_QUAD == shape_type || SHAPE_DISK == shape_type ){
+            if( simd_planar.PushPlanar( primitive ) ){
+                if( simd_planar.PackData() ){
+                    planar_list.push_back( simd_planar );
+                    simd_planar.Reset();
+                }
+            }
+        }else{
+            other_list.push_back( primitive );
+        }
+    }
+    if (sind_tri.PackData())
+        tri_list.push_back(sind_tri);
+    if (simd_line.PackData())
+        line_list.push_back(simd_line);
+    if (simd_sphere.PackData())
+        sphere_list.push_back(simd_sphere);
+    if (simd_planar.PackData())
+        planar_list.push_back(simd_planar);
+}
 
+//! @brief Whether all primitives of a leaf node are opaque.
+//!
+//! @param primitives   The buffer hold all references.
+//! @param start        The start offset of primitives in the leaf node.
+//! @param end          The end offset of primitives in the leaf node.
+//! @return             Whether shadow rays only need an any-hit test against the leaf node.
+SORT_STATIC_FORCEINLINE bool isOpaqueLeaf( const Primitive* const* const primitives , const unsigned start , const unsigned end ){
+    for( auto i = start ; i < end ; ++i ){
+        if( !primitives[i]->IsOpaque() )
+            return false;
+    }
+    return true;
+}
 #endif
 
 SORT_STATIC_FORCEINLINE BBox calcBoundingBox(const Fbvh_Node* const node , const Bvh_Primitive* const primitives ) {
@@ -112,18 +348,55 @@ void Fbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bb
 	if( primitives.empty() )
 		return;
 
-    m_bvhpri = std::make_unique<Bvh_Primitive[]>(m_primitives->size());
+    // the structure could be built again after refitting degrades it too much
+    m_nodes.clear();
+    m_leaves.clear();
+    m_motion.clear();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    m_triangles.clear();
+    m_lines.clear();
+    m_spheres.clear();
+    m_planars.clear();
+    m_others.clear();
+#endif
+    m_references.clear();
+    m_depth = 0;
+
+    // extra slots are reserved for references duplicated by spatial splits
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto capacity = bvhReferenceCapacity( primitive_cnt , m_spatialSplit , m_spatialSplitBudget );
+    m_bvhpri = std::make_unique<Bvh_Primitive[]>(capacity);
+    SORT_STATS_MEMORY_RECORD(build_memory)
 
     m_bbox = bbox;
 
     // generate BVH primitives
-    const auto primitive_cnt = m_primitives->size();
     for (auto i = 0u; i < primitive_cnt; ++i)
         m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
     
     // recursively split node
-    m_root = makeFastBvhNode( 0 , (unsigned)m_primitives->size() );
-    splitNode( m_root.get() , m_bbox , 1u );
+    auto root = makeFastBvhNode( { 0u , primitive_cnt , capacity } );
+    splitNode( root.get() , m_bbox , 1u );
+
+    // wait for all sub-trees built in other tasks
+    WAIT_FOR_CHILDREN();
+
+    // Linearize the tree so that there is no pointer chasing during traversal. This is when construction takes the most
+    // memory, there is one linearized node for each temporary one, which are all destroyed right after this together
+    // with the references. Leaf nodes are only packed in SIMD data afterwards, directly into the linearized buffers.
+    m_references.reserve( primitive_cnt );
+    m_root = linearizeNode( root.get() );
+    SORT_STATS(build_memory.Track( &sBvhBuildMemory , (StatsInt)( sizeof(Bvh_Primitive) * capacity + sizeof(Fast_Bvh_Node) * ( m_nodes.size() + m_leaves.size() ) ) ));
+    root = nullptr;
+    m_bvhpri = nullptr;
+    SORT_STATS(build_memory.Release());
+    m_references.shrink_to_fit();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    packLeaves();
+#endif
+    fitMotion();
+    trackMemory();
 
     // if the algorithm reaches here, it is a valid QBVH
     m_isValid = true;
@@ -143,33 +416,21 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
         return;
     }
 
-    std::queue< std::pair<unsigned int, unsigned int> > to_split, done_splitting;
-    to_split.push( std::make_pair( start , end ) );
+    std::queue<Bvh_Range> to_split, done_splitting;
+    to_split.push( { start , end , node->pri_capacity } );
 
     while( !to_split.empty() && to_split.size() + done_splitting.size() < (unsigned int)FBVH_CHILD_CNT ){
-        auto cur_split = to_split.front();
+        const auto cur_split = to_split.front();
         to_split.pop();
 
-        const auto start    = cur_split.first;
-        const auto end      = cur_split.second;
-        const auto prim_cnt = end - start;
+        const auto prim_cnt = cur_split.end - cur_split.start;
 
-        unsigned    split_axis;
-        float       split_pos;
-        const auto sah = pickBestSplit(split_axis, split_pos, m_bvhpri.get(), node_bbox, start, end);
-        if (sah >= prim_cnt || prim_cnt <= m_maxPriInLeaf )
-            done_splitting.push( std::make_pair( start , end ) );
+        Bvh_Range left , right;
+        if( prim_cnt <= m_maxPriInLeaf || !splitBvhNode( m_bvhpri.get() , m_bbox , node_bbox , cur_split , left , right ) )
+            done_splitting.push( cur_split );
         else{
-            const auto compare = [split_pos, split_axis](const Bvh_Primitive& pri) {return pri.m_centroid[split_axis] < split_pos; };
-            const auto middle = std::partition(m_bvhpri.get() + start, m_bvhpri.get() + end, compare);
-            const auto mid = (unsigned)(middle - m_bvhpri.get());
-
-            if (mid == start || mid == end){
-                done_splitting.push( std::make_pair( start , end ) );
-            }else{
-                to_split.push( std::make_pair( start , mid ) );
-                to_split.push( std::make_pair( mid , end ) );
-            }
+            to_split.push( left );
+            to_split.push( right );
         }
     }
 
@@ -177,11 +438,10 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
         makeLeaf( node , start , end , depth );
         return;
     }else{
-        const auto populate_child = [&] ( Fbvh_Node* node , std::queue<std::pair<unsigned,unsigned>>& q ){
+        const auto populate_child = [&] ( Fbvh_Node* node , std::queue<Bvh_Range>& q ){
             while (!q.empty()) {
-                const auto cur = q.front();
+                node->children[node->child_cnt++] = makeFastBvhNode( q.front() );
                 q.pop();
-                node->children[node->child_cnt++] = makeFastBvhNode( cur.first , cur.second - cur.first );
             }
         };
 
@@ -189,20 +449,24 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
         populate_child( node , done_splitting );
     }
 
-    // split children if needed.
-    for( auto j = 0u ; j < node->child_cnt ; ++j ){
 #ifdef SIMD_BVH_IMPLEMENTATION
-        const auto bbox = calcBoundingBox(node->children[j].get(), m_bvhpri.get());
-        splitNode(node->children[j].get(), bbox, depth + 1);
-#else
-        node->bbox[j] = calcBoundingBox( node->children[j].get() , m_bvhpri.get() );
-        splitNode( node->children[j].get() , node->bbox[j] , depth + 1 );
+    // This has to be done before splitting children since the primitives could be re-ordered in other tasks.
+    node->bbox = calcBoundingBoxSIMD( node->children );
 #endif
-    }
 
-#ifdef SIMD_BVH_IMPLEMENTATION
-    node->bbox = calcBoundingBoxSIMD( node->children );
+    // split children if needed, large sub-trees are built in separate tasks.
+    const auto parallel = isParallelBvhConstructionAvailable();
+    for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        auto child = node->children[j].get();
+        const auto bbox = calcBoundingBox( child , m_bvhpri.get() );
+#ifndef SIMD_BVH_IMPLEMENTATION
+        node->bbox[j] = bbox;
 #endif
+        if( parallel && child->pri_cnt >= BVH_PARALLEL_SUBTREE_THRESHOLD )
+            SPAWN_TASK<Function_Task>( "Build Fbvh Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( child , bbox , depth + 1 ); } );
+        else
+            splitNode( child , bbox , depth + 1 );
+    }
 
     SORT_STATS(sFbvhNodeCount+=node->child_cnt);
 }
@@ -212,98 +476,239 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
     node->pri_offset = start;
     node->child_cnt = 0;
 
-    m_depth = fmax( m_depth , depth );
+    auto cur_depth = m_depth.load( std::memory_order_relaxed );
+    while( cur_depth < depth && !m_depth.compare_exchange_weak( cur_depth , depth , std::memory_order_relaxed ) );
 
-#ifdef SIMD_BVH_IMPLEMENTATION
-    Simd_Triangle   sind_tri;
-    Simd_Line       simd_line;
-    std::vector<Simd_Triangle>  tri_list;
-    std::vector<Simd_Line>      line_list;
-    const auto _start = node->pri_offset;
-    const auto _end = _start + node->pri_cnt;
-    for(auto i = _start ; i < _end ; i++ ){
-        const Primitive* primitive = m_bvhpri[i].primitive;
-        const auto shape_type = primitive->GetShapeType();
-        if( SHAPE_TRIANGLE == shape_type ){
-            if( sind_tri.PushTriangle( primitive ) ){
-                if( sind_tri.PackData() ){
-                    tri_list.push_back( sind_tri );
-                    sind_tri.Reset();
-                }
-            }
-        }else if( SHAPE_LINE == shape_type ){
-            if( simd_line.PushLine( primitive ) ){
-                if( simd_line.PackData() ){
-                    line_list.push_back( simd_line );
-                    simd_line.Reset();
-                }
-            }
-        }else{
-            // line will also be specially treated in the future.
-            node->other_list.push_back( primitive );
-        }
-    }
-    if (sind_tri.PackData())
-        tri_list.push_back(sind_tri);
-    if (simd_line.PackData())
-        line_list.push_back(simd_line);
-    
-    if( tri_list.size() ){
-        node->tri_list = makePrimitiveList<Simd_Triangle>( (unsigned int)tri_list.size() );
-        node->tri_cnt = (unsigned int)tri_list.size();
-        for( auto i = 0u ; i < tri_list.size() ; ++i )
-            node->tri_list[i] = tri_list[i];
+    SORT_STATS(++sFbvhLeafNodeCount);
+    SORT_STATS(sFbvhMaxPriCountInLeaf = std::max( sFbvhMaxPriCountInLeaf , (StatsInt)node->pri_cnt) );
+}
+
+Fbvh_Node_Ref Fbvh::linearizeNode( const Fbvh_Node* const node ){
+    if( 0 == node->child_cnt ){
+        // primitives of leaf nodes are compacted, free slots reserved for spatial splits are dropped
+        Fast_Bvh_Leaf leaf;
+        leaf.pri_offset = (unsigned)m_references.size();
+        leaf.pri_cnt = node->pri_cnt;
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_cnt ; ++i )
+            m_references.push_back( m_bvhpri[i].primitive );
+
+        m_leaves.push_back( leaf );
+        return (Fbvh_Node_Ref)( m_leaves.size() - 1 ) | FBVH_LEAF_NODE_FLAG;
     }
-    if( line_list.size() ){
-        node->line_list = makePrimitiveList<Simd_Line>( (unsigned int)line_list.size() );
-        node->line_cnt = (unsigned int)line_list.size();
-        for( auto i = 0u ; i < line_list.size() ; ++i )
-            node->line_list[i] = line_list[i];
+
+    // The parent is always right before its first child, which is friendly to cache during traversal.
+    const auto index = (Fbvh_Node_Ref)m_nodes.size();
+    m_nodes.emplace_back();
+
+#if defined(FBVH_QUANTIZED_BBOX)
+    BBox bbox[FBVH_CHILD_CNT];
+    bool valid[FBVH_CHILD_CNT] = { false };
+    for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        bbox[j] = extractBBox( node->bbox , j );
+        valid[j] = true;
     }
+    m_nodes[index].bbox = QuantizeBBox_SIMD( bbox , valid );
+#elif defined(SIMD_BVH_IMPLEMENTATION)
+    m_nodes[index].bbox = node->bbox;
+#else
+    m_nodes[index].child_cnt = node->child_cnt;
+    for( auto j = 0u ; j < node->child_cnt ; ++j )
+        m_nodes[index].bbox[j] = node->bbox[j];
 #endif
 
-    SORT_STATS(++sFbvhLeafNodeCount);
-    SORT_STATS(sFbvhMaxPriCountInLeaf = std::max( sFbvhMaxPriCountInLeaf , (StatsInt)node->pri_cnt) );
+    for( auto j = 0u ; j < FBVH_CHILD_CNT ; ++j ){
+        // 'm_nodes' could be reallocated during linearizing the children, the node can't be cached here.
+        const auto child = j < node->child_cnt ? linearizeNode( node->children[j].get() ) : 0u;
+        m_nodes[index].children[j] = child;
+    }
+
+    return index;
 }
 
 #ifdef SIMD_BVH_IMPLEMENTATION
 Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
-    Simd_BBox node_bbox;
-
-    float   min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL];
-    float   max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
+    BBox    bb[SIMD_CHANNEL];
     bool    bb_valid[SIMD_CHANNEL] = { false };
     for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
-        const auto bb = calcBoundingBox( children[i].get() , m_bvhpri.get() );
-        min_x[i] = bb.m_Min.x;
-        min_y[i] = bb.m_Min.y;
-        min_z[i] = bb.m_Min.z;
-        max_x[i] = bb.m_Max.x;
-        max_y[i] = bb.m_Max.y;
-        max_z[i] = bb.m_Max.z;
-
+        bb[i] = calcBoundingBox( children[i].get() , m_bvhpri.get() );
         bb_valid[i] = (IS_PTR_VALID(children[i].get()));
     }
+    return packBoundingBoxSIMD( bb , bb_valid );
+}
+#endif
 
-    node_bbox.m_min_x = simd_set_ps( min_x );
-    node_bbox.m_min_y = simd_set_ps( min_y );
-    node_bbox.m_min_z = simd_set_ps( min_z );
-    
-    node_bbox.m_max_x = simd_set_ps( max_x );
-    node_bbox.m_max_y = simd_set_ps( max_y );
-    node_bbox.m_max_z = simd_set_ps( max_z );
+#ifdef SIMD_BVH_IMPLEMENTATION
+bool Fbvh::intersectLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , const Simd_Ray_Data& simd_ray , SurfaceInteraction& intersect ) const{
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    // Nothing but whether the shadow ray is blocked matters if all primitives in the leaf are opaque.
+    if( intersect.query_shadow && leaf.opaque ){
+        if( !occludeLeaf( leaf , ray , simd_ray , &intersect.occluder ) )
+            return false;
+
+        // setting primitive to be nullptr and return true at the same time is a special 'code'
+        // that the above level logic will take advantage of.
+        intersect.primitive = nullptr;
+        return true;
+    }
+#endif
 
-    node_bbox.m_mask = simd_set_mask( bb_valid );
+    for( auto i = 0u ; i < leaf.tri_cnt ; ++i ){
+        const auto blocked = intersectTriangle_SIMD( ray , simd_ray , m_triangles[leaf.tri_offset + i] , &intersect );
 
-    return node_bbox;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // A quick branching out for shadow ray if there is no semi-transparent shadow, this only happens in leaves mixing
+        // transparent and opaque primitives since fully opaque leaves are handled above.
+        // There is still possibility for false positives to survive this branch since only the nearest among four/eight possible intersections
+        // will be tested here. If the nearest intersection happens to have transparency while not the others, it won't branch out, leading to
+        // some potential defficiency. However, testing every single intersection in all possible intersections among all SIMD channels also 
+        // comes at a cost and given the chance of mixing transparent primitive and non-transparent primitives in one BVH node is not fairly high, 
+        // it makes sense to just check the nearest one.
+        if( intersect.query_shadow && blocked ){
+            sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
+            if( intersect.primitive->IsOpaque() ){
+                SORT_STATS_HOT(sIntersectionTest += ( i + 1 ) * 4);
+
+                // setting primitive to be nullptr and return true at the same time is a special 'code' 
+                // that the above level logic will take advantage of.
+                intersect.occluder = intersect.primitive;
+                intersect.primitive = nullptr;
+                return true;
+            }
+        }
+#endif
+    }
+    for( auto i = 0u ; i < leaf.line_cnt ; ++i ){
+        const auto blocked = intersectLine_SIMD( ray , simd_ray , m_lines[leaf.line_offset + i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        if( intersect.query_shadow && blocked ){
+            SORT_STATS_HOT(sIntersectionTest += (i + 1 + leaf.tri_cnt) * 4);
+            if( LIKELY(intersect.primitive->IsOpaque()) ){
+                SORT_STATS_HOT(sIntersectionTest += i + 1 + ( leaf.tri_cnt ) * 4);
+                intersect.occluder = intersect.primitive;
+                intersect.primitive = nullptr;
+            }
+            return true;
+        }
+#endif
+    }
+    for( auto i = 0u ; i < leaf.sphere_cnt ; ++i ){
+        const auto blocked = intersectSphere_SIMD( ray , simd_ray , m_spheres[leaf.sphere_offset + i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // the closest hit is resolved by the primitive itself, opaque ones blocking a shadow ray report no primitive
+        if( intersect.query_shadow && blocked && IS_PTR_INVALID(intersect.primitive) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 + leaf.tri_cnt + leaf.line_cnt ) * SIMD_CHANNEL);
+            return true;
+        }
+#endif
+    }
+    for( auto i = 0u ; i < leaf.planar_cnt ; ++i ){
+        const auto blocked = intersectPlanar_SIMD( ray , simd_ray , m_planars[leaf.planar_offset + i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // the closest hit is resolved by the primitive itself, opaque ones blocking a shadow ray report no primitive
+        if( intersect.query_shadow && blocked && IS_PTR_INVALID(intersect.primitive) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 + leaf.tri_cnt + leaf.line_cnt + leaf.sphere_cnt ) * SIMD_CHANNEL);
+            return true;
+        }
+#endif
+    }
+    if( UNLIKELY(0 != leaf.other_cnt) ){
+        for( auto i = 0u ; i < leaf.other_cnt ; ++i ){
+            const auto blocked = m_others[leaf.other_offset + i]->GetIntersect( ray , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+            // opaque primitives blocking a shadow ray are already reported with no primitive in the intersection
+            if( intersect.query_shadow && blocked && IS_PTR_INVALID(intersect.primitive) ){
+                SORT_STATS_HOT(sIntersectionTest += i + 1 + ( leaf.tri_cnt + leaf.line_cnt + leaf.sphere_cnt + leaf.planar_cnt ) * 4);
+                return true;
+            }
+#endif
+        }
+    }
+    SORT_STATS_HOT(sIntersectionTest+=leaf.pri_cnt);
+    return false;
+}
+
+bool Fbvh::occludeLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , const Simd_Ray_Data& simd_ray , const Primitive** occluder ) const{
+    for( auto i = 0u ; i < leaf.tri_cnt ; ++i ){
+        if( intersectTriangleFast_SIMD( ray , simd_ray , m_triangles[leaf.tri_offset + i] , occluder ) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 ) * 4);
+            return true;
+        }
+    }
+    for( auto i = 0u ; i < leaf.line_cnt ; ++i ){
+        if( intersectLineFast_SIMD( ray , simd_ray , m_lines[leaf.line_offset + i] ) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 + leaf.tri_cnt ) * 4);
+            return true;
+        }
+    }
+    for( auto i = 0u ; i < leaf.sphere_cnt ; ++i ){
+        if( intersectSphereFast_SIMD( ray , simd_ray , m_spheres[leaf.sphere_offset + i] ) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 + leaf.tri_cnt + leaf.line_cnt ) * SIMD_CHANNEL);
+            return true;
+        }
+    }
+    for( auto i = 0u ; i < leaf.planar_cnt ; ++i ){
+        if( intersectPlanarFast_SIMD( ray , simd_ray , m_planars[leaf.planar_offset + i] ) ){
+            SORT_STATS_HOT(sIntersectionTest += ( i + 1 + leaf.tri_cnt + leaf.line_cnt + leaf.sphere_cnt ) * SIMD_CHANNEL);
+            return true;
+        }
+    }
+    if( UNLIKELY(0 != leaf.other_cnt) ){
+        for( auto i = 0u ; i < leaf.other_cnt ; ++i ){
+            if( m_others[leaf.other_offset + i]->GetIntersect( ray , nullptr ) ){
+                SORT_STATS_HOT(sIntersectionTest += i + 1 + ( leaf.tri_cnt + leaf.line_cnt + leaf.sphere_cnt + leaf.planar_cnt ) * 4);
+                if( occluder )
+                    *occluder = m_others[leaf.other_offset + i];
+                return true;
+            }
+        }
+    }
+    SORT_STATS_HOT(sIntersectionTest += leaf.pri_cnt);
+    return false;
+}
+#else
+bool Fbvh::intersectLeaf( const Fast_Bvh_Leaf& leaf , const Ray& ray , SurfaceInteraction& intersect ) const{
+    const auto _start = leaf.pri_offset;
+    const auto _end = _start + leaf.pri_cnt;
+
+    for(auto i = _start ; i < _end ; i++ ){
+        const auto blocked = m_references[i]->GetIntersect( ray , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // opaque primitives blocking a shadow ray are already reported with no primitive in the intersection
+        if( intersect.query_shadow && blocked && IS_PTR_INVALID(intersect.primitive) ){
+            SORT_STATS_HOT(sIntersectionTest += i - _start + 1);
+            return true;
+        }
+#endif
+    }
+    SORT_STATS_HOT(sIntersectionTest+=leaf.pri_cnt);
+    return false;
+}
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+SORT_FORCEINLINE int Fbvh::intersectNode( const Ray& ray , const Simd_Ray_Data& simd_ray , const Fbvh_Node_Ref node_ref , simd_data& f_min ) const{
+    if( UNLIKELY( !m_motion.empty() ) ){
+        const auto& motion = m_motion[node_ref];
+        return IntersectBBox_SIMD( ray , simd_ray , InterpolateBBox_SIMD( motion.open , motion.close , ray.m_time ) , f_min );
+    }
+    return IntersectBBox_SIMD( ray , simd_ray , m_nodes[node_ref].bbox , f_min );
+}
+#else
+SORT_FORCEINLINE float Fbvh::intersectChild( const Ray& ray , const Fbvh_Node_Ref node_ref , const unsigned i ) const{
+    if( UNLIKELY( !m_motion.empty() ) )
+        return Intersect( ray , m_motion[node_ref].bbox[i].At( ray.m_time ) );
+    return Intersect( ray , m_nodes[node_ref].bbox[i] );
 }
 #endif
 
 bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
     // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if (UNLIKELY(IS_PTR_INVALID(bvh_stack)))
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+    Fbvh_Stack<std::pair<Fbvh_Node_Ref, float>> bvh_stack( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
@@ -311,11 +716,15 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
 #ifdef OBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Obvh");
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
+    SORT_HW_COUNTERS("Traversal");
 
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
 #endif
 
     ray.Prepare();
@@ -331,83 +740,28 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = std::make_pair( m_root.get() , fmin );
+    bvh_stack[si++] = std::make_pair( m_root , fmin );
 
     while( si > 0 ){
         const auto top = bvh_stack[--si];
 
-        const auto node = top.first;
+        const auto node_ref = top.first;
         const auto fmin = top.second;
         if( intersect.t < fmin )
             continue;
 
 #ifdef SIMD_BVH_IMPLEMENTATION
         // check if it is a leaf node
-        if( 0 == node->child_cnt ){
-            for( auto i = 0u ; i < node->tri_cnt ; ++i ){
-                const auto blocked = intersectTriangle_SIMD( ray , simd_ray , node->tri_list[i] , &intersect );
-
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                // A quick branching out for shadow ray if there is no semi-transparent shadow
-                // There is still possibility for false positives to survive this branch since only the nearest among four/eight possible intersections
-                // will be tested here. If the nearest intersection happens to have transparency while not the others, it won't branch out, leading to
-                // some potential defficiency. However, testing every single intersection in all possible intersections among all SIMD channels also 
-                // comes at a cost and given the chance of mixing transparent primitive and non-transparent primitives in one BVH node is not fairly high, 
-                // it makes sense to just check the nearest one. It should work pretty well for fully opaque scene.
-                // With C++ 17 compile time if, this branch can totally be resolved during compilation, which may further reduce a bit of overhead, which
-                // might not be very obvious. there could be ways to achieve it in C++ 11. Since it won't boost the performance, I will keep it this way
-                // until I have C++ 17 updated.
-                if( intersect.query_shadow && blocked ){
-                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                    sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()) , SPATIAL_ACCELERATOR );
-                    if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                        SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
-
-                        // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                        // that the above level logic will take advantage of.
-                        intersect.primitive = nullptr;
-                        return true;
-                    }
-                }
-#endif
-            }
-            for( auto i = 0u ; i < node->line_cnt ; ++i ){
-                const auto blocked = intersectLine_SIMD( ray , simd_ray , node->line_list[i] , &intersect );
-
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                if( intersect.query_shadow && blocked ){
-                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt) * 4);
-                    if( LIKELY(!intersect.primitive->GetMaterial()->HasTransparency()) ){
-                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt ) * 4);
-                        intersect.primitive = nullptr;
-                    }
-                    return true;
-                }
-#endif
-            }
-            if( UNLIKELY(!node->other_list.empty()) ){
-                for( auto i = 0u ; i < node->other_list.size() ; ++i ){
-                    const auto blocked = node->other_list[i]->GetIntersect( ray , &intersect );
-
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                    if( intersect.query_shadow && blocked ){
-                        sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                        sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                        if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                            SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
-                            intersect.primitive = nullptr;
-                            return true;
-                        }
-                    }
-#endif
-                }
-            }
-            SORT_STATS(sIntersectionTest+=node->pri_cnt);
+        if( isLeafNode( node_ref ) ){
+            if( intersectLeaf( m_leaves[leafNodeIndex( node_ref )] , ray , simd_ray , intersect ) )
+                return true;
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD( ray , simd_ray , node->bbox , sse_f_min );
+        auto m = intersectNode( ray , simd_ray , node_ref , sse_f_min );
         if( 0 == m )
             continue;
 
@@ -416,7 +770,7 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
         m &= m - 1;
         if( LIKELY( 0 == m ) ){
             sAssert( t0 >= 0.0f , SPATIAL_ACCELERATOR );
-            bvh_stack[si++] = std::make_pair( node->children[k0].get() , t0 );
+            bvh_stack[si++] = std::make_pair( node->children[k0] , t0 );
         }else{
             const int k1 = __bsf( m );
             m &= m - 1;
@@ -426,17 +780,17 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                 sAssert( t1 >= 0.0f , SPATIAL_ACCELERATOR );
 
                 if( t0 < t1 ){
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1 );
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0 );
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1 );
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0 );
                 }else{
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
                 }
             }else{
-                for (auto i = 0u; i < node->child_cnt; ++i) {
+                for (auto i = 0u; i < FBVH_CHILD_CNT; ++i) {
                     auto k = -1;
                     auto maxDist = -1.0f;
-                    for (auto j = 0u; j < node->child_cnt; ++j) {
+                    for (auto j = 0u; j < FBVH_CHILD_CNT; ++j) {
                         if (sse_f_min[j] > maxDist) {
                             maxDist = sse_f_min[j];
                             k = j;
@@ -447,38 +801,23 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                         break;
 
                     sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+                    bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
                 }
             }
         }
 #else
         // check if it is a leaf node
-        if( 0 == node->child_cnt ){
-            const auto _start = node->pri_offset;
-            const auto _end = _start + node->pri_cnt;
-
-            for(auto i = _start ; i < _end ; i++ ){
-                const auto blocked = m_bvhpri[i].primitive->GetIntersect( ray , &intersect );
-
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                if( intersect.query_shadow && blocked ){
-                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                    sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                    if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                        SORT_STATS(sIntersectionTest += i - _start + 1);
-                        intersect.primitive = nullptr;
-                        return true;
-                    }
-                }
-#endif
-            }
-            SORT_STATS(sIntersectionTest+=node->pri_cnt);
+        if( isLeafNode( node_ref ) ){
+            if( intersectLeaf( m_leaves[leafNodeIndex( node_ref )] , ray , intersect ) )
+                return true;
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
         for( auto i = 0u ; i < node->child_cnt ; ++i )
-            f_min[i] = Intersect( ray , node->bbox[i] );
+            f_min[i] = intersectChild( ray , node_ref , i );
 
         for( auto i = 0u ; i < node->child_cnt ; ++i ){
             auto k = -1;
@@ -494,30 +833,186 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
                 break;
 
             f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair( node->children[k].get() , maxDist );
+            bvh_stack[si++] = std::make_pair( node->children[k] , maxDist );
         }
 #endif
     }
     return intersect.primitive;
 }
 
+unsigned Fbvh::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+
+    // Each entry keeps the node to be visited, the mask of rays that are still interested in it and how far it is along each of them.
+    Fbvh_Stack<Fbvh_Packet_Entry> bvh_stack( m_depth * FBVH_CHILD_CNT );
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh Packet");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh Packet");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh Packet");
+#endif
+
+    SORT_STATS_HOT(sRayCount += cnt);
+    SORT_STATS_HOT(++sRayPacketCount);
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_rays[RAY_PACKET_SIZE];
+#endif
+
+    // rays that missed the whole scene are never active
+    auto active = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        SORT_STATS_HOT(sShadowRayCount += intersects[i].query_shadow);
+#endif
+
+        rays[i].Prepare();
+#ifdef SIMD_BVH_IMPLEMENTATION
+        resolveRayData( rays[i] , simd_rays[i] );
+#endif
+
+        if( Intersect( rays[i] , m_bbox ) >= 0.0f )
+            active |= ( 1u << i );
+    }
+
+    if( 0 == active )
+        return 0;
+
+    // shadow rays blocked by opaque primitives, they have no primitive in their intersections
+    auto blocked = 0u;
+
+    // stack index
+    auto si = 0;
+    bvh_stack[si].node = m_root;
+    bvh_stack[si].mask = active;
+    std::fill( bvh_stack[si].fmin , bvh_stack[si].fmin + RAY_PACKET_SIZE , 0.0f );
+    ++si;
+
+    while( si > 0 ){
+        const auto& top = bvh_stack[--si];
+
+        const auto node_ref = top.node;
+
+        // rays blocked by opaque primitives are done with the traversal.
+        auto mask = top.mask & active;
+
+        // Rays finding closer intersections after the node was pushed are not interested in it any more, even if the
+        // rest of the packet still is.
+        for( auto m = mask ; m ; m &= m - 1 ){
+            const auto i = __bsf( m );
+            if( intersects[i].t < top.fmin[i] )
+                mask &= ~( 1u << i );
+        }
+        if( 0 == mask )
+            continue;
+
+        if( isLeafNode( node_ref ) ){
+            const auto& leaf = m_leaves[leafNodeIndex( node_ref )];
+            while( mask ){
+                const auto i = __bsf( mask );
+                mask &= mask - 1;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+                if( intersectLeaf( leaf , rays[i] , simd_rays[i] , intersects[i] ) ){
+#else
+                if( intersectLeaf( leaf , rays[i] , intersects[i] ) ){
+#endif
+                    active &= ~( 1u << i );
+                    blocked |= ( 1u << i );
+                }
+            }
+            continue;
+        }
+
+        const auto node = &m_nodes[node_ref];
+
+        // Test all interested rays against the children of the node, the node is only fetched once for the whole packet.
+        unsigned    child_mask[FBVH_CHILD_CNT] = { 0 };
+        float       child_fmin[FBVH_CHILD_CNT];
+        float       child_ray_fmin[FBVH_CHILD_CNT][RAY_PACKET_SIZE];
+        for( auto k = 0u ; k < FBVH_CHILD_CNT ; ++k )
+            child_fmin[k] = FLT_MAX;
+
+        while( mask ){
+            const auto i = __bsf( mask );
+            mask &= mask - 1;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+            simd_data sse_f_min;
+            auto m = intersectNode( rays[i] , simd_rays[i] , node_ref , sse_f_min );
+            while( m ){
+                const auto k = __bsf( m );
+                m &= m - 1;
+
+                const auto fmin = sse_f_min[k];
+#else
+            for( auto k = 0u ; k < node->child_cnt ; ++k ){
+                const auto fmin = intersectChild( rays[i] , node_ref , k );
+                if( fmin < 0.0f )
+                    continue;
+#endif
+                // skip the child if there is a closer intersection for this ray already
+                if( intersects[i].t < fmin )
+                    continue;
+
+                child_mask[k] |= ( 1u << i );
+                child_fmin[k] = std::min( child_fmin[k] , fmin );
+                child_ray_fmin[k][i] = fmin;
+            }
+        }
+
+        // push the nearest child at last so that it is visited first.
+        for( auto i = 0u ; i < FBVH_CHILD_CNT ; ++i ){
+            auto k = -1;
+            auto maxDist = -1.0f;
+            for( auto j = 0u ; j < FBVH_CHILD_CNT ; ++j ){
+                if( child_mask[j] && child_fmin[j] > maxDist ){
+                    maxDist = child_fmin[j];
+                    k = j;
+                }
+            }
+
+            if( k == -1 )
+                break;
+
+            auto& entry = bvh_stack[si++];
+            entry.node = node->children[k];
+            entry.mask = child_mask[k];
+            std::copy( child_ray_fmin[k] , child_ray_fmin[k] + RAY_PACKET_SIZE , entry.fmin );
+            child_mask[k] = 0;
+        }
+    }
+
+    auto mask = blocked;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( IS_PTR_VALID( intersects[i].primitive ) )
+            mask |= ( 1u << i );
+    }
+    return mask;
+}
+
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool  Fbvh::IsOccluded(const Ray& ray) const{
     // std::stack is by no means an option here due to its overhead under the hood.
-    using Fbvh_Node_Ptr = Fbvh_Node*;
-    static thread_local std::unique_ptr<Fbvh_Node_Ptr[]> bvh_stack = nullptr;
-    if (UNLIKELY(IS_PTR_INVALID(bvh_stack)))
-        bvh_stack = std::make_unique<Fbvh_Node_Ptr[]>(m_depth * FBVH_CHILD_CNT);
+    Fbvh_Stack<Fbvh_Node_Ref> bvh_stack( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
 #endif
-#ifdef QBVH_IMPLEMENTATION
+#ifdef OBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Obvh");
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
+    SORT_HW_COUNTERS("Traversal");
 
-    SORT_STATS(++sRayCount);
-    SORT_STATS(++sShadowRayCount);
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
 
     ray.Prepare();
 #ifdef SIMD_BVH_IMPLEMENTATION
@@ -531,40 +1026,23 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = m_root.get();
+    bvh_stack[si++] = m_root;
 
     while (si > 0) {
-        const auto node = bvh_stack[--si];
+        const auto node_ref = bvh_stack[--si];
 
 #ifdef SIMD_BVH_IMPLEMENTATION
         // check if it is a leaf node
-        if (0 == node->child_cnt) {
-            for (auto i = 0u; i < node->tri_cnt; ++i) {
-                if (intersectTriangleFast_SIMD(ray, simd_ray , node->tri_list[i])) {
-                    SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
-                    return true;
-                }
-            }
-            for (auto i = 0u; i < node->line_cnt; ++i) {
-                if (intersectLineFast_SIMD(ray, simd_ray , node->line_list[i])) {
-                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt) * 4);
-                    return true;
-                }
-            }
-            if (UNLIKELY(!node->other_list.empty())) {
-                for (auto i = 0u; i < node->other_list.size(); ++i) {
-                    if (node->other_list[i]->GetIntersect(ray, nullptr)) {
-                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
-                        return true;
-                    }
-                }
-            }
-            SORT_STATS(sIntersectionTest += node->pri_cnt);
+        if (isLeafNode(node_ref)) {
+            if( occludeLeaf( m_leaves[leafNodeIndex(node_ref)] , ray , simd_ray ) )
+                return true;
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD(ray, simd_ray, node->bbox, sse_f_min);
+        auto m = intersectNode( ray , simd_ray , node_ref , sse_f_min );
         if (0 == m)
             continue;
 
@@ -572,7 +1050,7 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
         m &= m - 1;
         if (LIKELY(0 == m)) {
             sAssert(sse_f_min[k0] >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = node->children[k0].get();
+            bvh_stack[si++] = node->children[k0];
         }
         else {
             const int k1 = __bsf(m);
@@ -581,8 +1059,8 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
             sAssert(sse_f_min[k1] >= 0.0f, SPATIAL_ACCELERATOR);
 
             if (LIKELY(0 == m)) {
-                bvh_stack[si++] = node->children[k1].get();
-                bvh_stack[si++] = node->children[k0].get();
+                bvh_stack[si++] = node->children[k1];
+                bvh_stack[si++] = node->children[k0];
             } else {
                 const int k2 = __bsf(m);
                 sAssert(sse_f_min[k2] >= 0.0f, SPATIAL_ACCELERATOR);
@@ -590,15 +1068,15 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
                 m &= m - 1;
 
                 if( LIKELY(0==m) ){
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
+                    bvh_stack[si++] = node->children[k2];
+                    bvh_stack[si++] = node->children[k1];
+                    bvh_stack[si++] = node->children[k0];
                 }else{
-#if defined(SIMD_AVX_IMPLEMENTATION)
-                    for (auto i = 0u; i < node->child_cnt; ++i) {
+#if defined(SIMD_AVX_IMPLEMENTATION) || defined(SIMD_AVX512_IMPLEMENTATION)
+                    for (auto i = 0u; i < FBVH_CHILD_CNT; ++i) {
                         auto k = -1;
                         auto maxDist = -1.0f;
-                        for (auto j = 0u; j < node->child_cnt; ++j) {
+                        for (auto j = 0u; j < FBVH_CHILD_CNT; ++j) {
                             if (sse_f_min[j] > maxDist) {
                                 maxDist = sse_f_min[j];
                                 k = j;
@@ -609,64 +1087,175 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
                             break;
 
                         sse_f_min[k] = -1.0f;
-                        bvh_stack[si++] = node->children[k].get();
+                        bvh_stack[si++] = node->children[k];
                     }
 #endif
 #if defined(SIMD_SSE_IMPLEMENTATION)
                     const int k3 = __bsf(m);
                     sAssert(sse_f_min[k3] >= 0.0f, SPATIAL_ACCELERATOR);
 
-                    bvh_stack[si++] = node->children[k3].get();
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
+                    bvh_stack[si++] = node->children[k3];
+                    bvh_stack[si++] = node->children[k2];
+                    bvh_stack[si++] = node->children[k1];
+                    bvh_stack[si++] = node->children[k0];
 #endif
                 }
             }
         }
 #else
         // check if it is a leaf node
-        if (0 == node->child_cnt) {
-            const auto _start = node->pri_offset;
-            const auto _end = _start + node->pri_cnt;
+        if (isLeafNode(node_ref)) {
+            const auto leaf = &m_leaves[leafNodeIndex(node_ref)];
+            const auto _start = leaf->pri_offset;
+            const auto _end = _start + leaf->pri_cnt;
 
             for (auto i = _start; i < _end; i++) {
-                if (m_bvhpri[i].primitive->GetIntersect(ray, nullptr)) {
-                    SORT_STATS(sIntersectionTest += i - _start + 1);
+                if (m_references[i]->GetIntersect(ray, nullptr)) {
+                    SORT_STATS_HOT(sIntersectionTest += i - _start + 1);
                     return true;
                 }
             }
-            SORT_STATS(sIntersectionTest += node->pri_cnt);
+            SORT_STATS_HOT(sIntersectionTest += leaf->pri_cnt);
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
         for (auto i = 0u; i < node->child_cnt; ++i)
-            f_min[i] = Intersect(ray, node->bbox[i]);
+            f_min[i] = intersectChild( ray , node_ref , i );
 
         for (auto i = 0u; i < node->child_cnt; ++i)
             if( f_min[i] >= 0.0f )
-                bvh_stack[si++] = node->children[i].get();
+                bvh_stack[si++] = node->children[i];
 #endif
     }
     return false;
 }
+
+unsigned Fbvh::IsOccluded( const Ray* rays , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+
+    // Each entry keeps the node to be visited and the mask of rays that are still interested in it.
+    Fbvh_Stack<std::pair<Fbvh_Node_Ref, unsigned>> bvh_stack( m_depth * FBVH_CHILD_CNT );
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh Shadow Packet");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh Shadow Packet");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh Shadow Packet");
+#endif
+
+    SORT_STATS_HOT(sRayCount += cnt);
+    SORT_STATS_HOT(sShadowRayCount += cnt);
+    SORT_STATS_HOT(++sRayPacketCount);
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_rays[RAY_PACKET_SIZE];
+#endif
+
+    // rays that missed the whole scene are never active
+    auto active = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        rays[i].Prepare();
+#ifdef SIMD_BVH_IMPLEMENTATION
+        resolveRayData( rays[i] , simd_rays[i] );
+#endif
+
+        if( Intersect( rays[i] , m_bbox ) >= 0.0f )
+            active |= ( 1u << i );
+    }
+
+    auto occluded = 0u;
+
+    // stack index
+    auto si = 0;
+    if( active )
+        bvh_stack[si++] = std::make_pair( m_root , active );
+
+    // the traversal is done as soon as all rays are occluded
+    while( si > 0 && active ){
+        const auto top = bvh_stack[--si];
+
+        const auto node_ref = top.first;
+        auto mask = top.second & active;
+        if( 0 == mask )
+            continue;
+
+        if( isLeafNode( node_ref ) ){
+            const auto& leaf = m_leaves[leafNodeIndex( node_ref )];
+            while( mask ){
+                const auto i = __bsf( mask );
+                mask &= mask - 1;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+                const auto hit = occludeLeaf( leaf , rays[i] , simd_rays[i] );
+#else
+                auto hit = false;
+                for( auto k = leaf.pri_offset ; k < leaf.pri_offset + leaf.pri_cnt && !hit ; ++k )
+                    hit = m_references[k]->GetIntersect( rays[i] , nullptr );
+                SORT_STATS_HOT(sIntersectionTest += leaf.pri_cnt);
+#endif
+                if( hit ){
+                    active &= ~( 1u << i );
+                    occluded |= ( 1u << i );
+                }
+            }
+            continue;
+        }
+
+        const auto node = &m_nodes[node_ref];
+
+        // the node is only fetched once for the whole packet, children are pushed in any order.
+        unsigned    child_mask[FBVH_CHILD_CNT] = { 0 };
+        while( mask ){
+            const auto i = __bsf( mask );
+            mask &= mask - 1;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+            simd_data sse_f_min;
+            auto m = intersectNode( rays[i] , simd_rays[i] , node_ref , sse_f_min );
+            while( m ){
+                const auto k = __bsf( m );
+                m &= m - 1;
+                child_mask[k] |= ( 1u << i );
+            }
+#else
+            for( auto k = 0u ; k < node->child_cnt ; ++k ){
+                if( intersectChild( rays[i] , node_ref , k ) >= 0.0f )
+                    child_mask[k] |= ( 1u << i );
+            }
+#endif
+        }
+
+        for( auto k = 0u ; k < FBVH_CHILD_CNT ; ++k ){
+            if( child_mask[k] )
+                bvh_stack[si++] = std::make_pair( node->children[k] , child_mask[k] );
+        }
+    }
+
+    return occluded;
+}
 #endif
 
 void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
     // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if ( UNLIKELY(IS_PTR_INVALID(bvh_stack) ) )
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+    Fbvh_Stack<std::pair<Fbvh_Node_Ref, float>> bvh_stack( m_depth * FBVH_CHILD_CNT );
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
 #endif
-#ifdef QBVH_IMPLEMENTATION
+#ifdef OBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Obvh");
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
 
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
     ray.Prepare();
 #ifdef SIMD_BVH_IMPLEMENTATION
@@ -683,30 +1272,33 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = std::make_pair(m_root.get(), fmin);
+    bvh_stack[si++] = std::make_pair(m_root, fmin);
 
     while (si > 0) {
         const auto top = bvh_stack[--si];
 
-        const auto node = top.first;
+        const auto node_ref = top.first;
         const auto fmin = top.second;
         if (intersect.maxt < fmin)
             continue;
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-        if (0 == node->child_cnt) {
+        if (isLeafNode(node_ref)) {
+            const auto leaf = &m_leaves[leafNodeIndex(node_ref)];
             // Note, only triangle shape support SSS here. This is the only big difference between AVX and non-AVX version implementation.
             // There are only two major primitives in SORT, line and triangle.
             // Line is usually used for hair, which has its own hair shader.
             // Triangle is the only major primitive that has SSS.
-            for ( auto i = 0u ; i < node->tri_cnt ; ++i )
-                intersectTriangleMulti_SIMD(ray, simd_ray, node->tri_list[i] , matID, intersect);
-            SORT_STATS(sIntersectionTest += node->tri_cnt);
+            for ( auto i = 0u ; i < leaf->tri_cnt ; ++i )
+                intersectTriangleMulti_SIMD(ray, simd_ray, m_triangles[leaf->tri_offset + i] , matID, intersect);
+            SORT_STATS_HOT(sIntersectionTest += leaf->tri_cnt);
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD(ray, simd_ray, node->bbox, sse_f_min);
+        auto m = intersectNode( ray , simd_ray , node_ref , sse_f_min );
         if (0 == m)
             continue;
 
@@ -715,7 +1307,7 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
         m &= m - 1;
         if (LIKELY(0 == m)) {
             sAssert(t0 >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
+            bvh_stack[si++] = std::make_pair(node->children[k0], t0);
         }
         else {
             const int k1 = __bsf(m);
@@ -726,20 +1318,20 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                 sAssert(t1 >= 0.0f, SPATIAL_ACCELERATOR);
 
                 if (t0 < t1) {
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
                 }
                 else {
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
+                    bvh_stack[si++] = std::make_pair(node->children[k0], t0);
+                    bvh_stack[si++] = std::make_pair(node->children[k1], t1);
                 }
             }
             else {
                 // fall back to the worst case
-                for (auto i = 0u; i < node->child_cnt; ++i) {
+                for (auto i = 0u; i < FBVH_CHILD_CNT; ++i) {
                     auto k = -1;
                     auto maxDist = -1.0f;
-                    for (auto j = 0u; j < node->child_cnt; ++j) {
+                    for (auto j = 0u; j < FBVH_CHILD_CNT; ++j) {
                         if (sse_f_min[j] > maxDist) {
                             maxDist = sse_f_min[j];
                             k = j;
@@ -750,26 +1342,38 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                         break;
 
                     sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+                    bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
                 }
             }
         }
 #else
         // check if it is a leaf node, to be optimized by SSE/AVX
-        if (0 == node->child_cnt) {
-            auto _start = node->pri_offset;
-            auto _pri = node->pri_cnt;
+        if (isLeafNode(node_ref)) {
+            const auto leaf = &m_leaves[leafNodeIndex(node_ref)];
+            auto _start = leaf->pri_offset;
+            auto _pri = leaf->pri_cnt;
             auto _end = _start + _pri;
 
             SurfaceInteraction intersection;
             for (auto i = _start; i < _end; i++) {
-                if (matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID())
+                if (matID != m_references[i]->GetMaterial()->GetUniqueID())
                     continue;
 
-                SORT_STATS(++sIntersectionTest);
+                // make sure the primitive is not checked before, spatial splits could reference it in multiple leaves
+                auto checked = false;
+                for (auto j = 0u; j < intersect.cnt; ++j) {
+                    if (m_references[i] == intersect.intersections[j]->intersection.primitive) {
+                        checked = true;
+                        break;
+                    }
+                }
+                if (checked)
+                    continue;
+
+                SORT_STATS_HOT(++sIntersectionTest);
 
                 intersection.Reset();
-                const auto intersected = m_bvhpri[i].primitive->GetIntersect(ray, &intersection);
+                const auto intersected = m_references[i]->GetIntersect(ray, &intersection);
                 if (intersected) {
                     if (intersect.cnt < TOTAL_SSS_INTERSECTION_CNT) {
                         intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
@@ -795,9 +1399,11 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
             continue;
         }
 
+        const auto node = &m_nodes[node_ref];
+
         float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
         for (auto i = 0u; i < node->child_cnt; ++i)
-            f_min[i] = Intersect(ray, node->bbox[i]);
+            f_min[i] = intersectChild( ray , node_ref , i );
 
         for (auto i = 0u; i < node->child_cnt; ++i) {
             int k = -1;
@@ -813,16 +1419,321 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
                 break;
 
             f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+            bvh_stack[si++] = std::make_pair(node->children[k], maxDist);
         }
 #endif
     }
 }
 
+// The layout of nodes depends on whether SIMD is enabled, a cache can't be shared between the two.
+#ifdef SIMD_BVH_IMPLEMENTATION
+static constexpr bool FBVH_CACHE_SIMD = true;
+#else
+static constexpr bool FBVH_CACHE_SIMD = false;
+#endif
+
+bool Fbvh::saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const{
+    stream << FBVH_CACHE_TYPE << FBVH_CACHE_SIMD << (unsigned)sizeof( Fast_Bvh_Linear_Node );
+    stream << m_maxNodeDepth << m_maxPriInLeaf << m_spatialSplit << m_spatialSplitBudget;
+
+    // interior nodes have no pointers in them, they are saved as they are
+    stream << m_root << (unsigned)m_nodes.size();
+    stream.Write( (char*)m_nodes.data() , (int)( m_nodes.size() * sizeof( Fast_Bvh_Linear_Node ) ) );
+
+    // SIMD data of leaf nodes is packed again during loading, only primitives are saved
+    stream << (unsigned)m_leaves.size();
+    for( const auto& leaf : m_leaves ){
+        stream << leaf.pri_cnt;
+        for( auto i = leaf.pri_offset ; i < leaf.pri_offset + leaf.pri_cnt ; ++i )
+            stream << indices.at( m_references[i] );
+    }
+
+    return true;
+}
+
+bool Fbvh::loadCache( IStreamBase& stream ){
+    StringID    type;
+    bool        simd = !FBVH_CACHE_SIMD;
+    unsigned    node_size = 0 , max_node_depth = 0 , max_pri_in_leaf = 0;
+    bool        spatial_split = false;
+    float       spatial_split_budget = 0.0f;
+    stream >> type >> simd >> node_size;
+    stream >> max_node_depth >> max_pri_in_leaf >> spatial_split >> spatial_split_budget;
+    if( type != FBVH_CACHE_TYPE || simd != FBVH_CACHE_SIMD || node_size != (unsigned)sizeof( Fast_Bvh_Linear_Node ) ||
+        max_node_depth != m_maxNodeDepth || max_pri_in_leaf != m_maxPriInLeaf || spatial_split != m_spatialSplit ||
+        spatial_split_budget != m_spatialSplitBudget )
+        return false;
+
+    // there can't be more nodes than references, this protects against corrupted cache
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto capacity = bvhReferenceCapacity( primitive_cnt , m_spatialSplit , m_spatialSplitBudget );
+
+    Fbvh_Node_Ref root = 0;
+    auto node_cnt = capacity + 1;
+    stream >> root >> node_cnt;
+    if( node_cnt > capacity )
+        return false;
+
+    LargePageVector<Fast_Bvh_Linear_Node> nodes( node_cnt );
+    stream.Load( (char*)nodes.data() , (int)( node_cnt * sizeof( Fast_Bvh_Linear_Node ) ) );
+
+    auto leaf_cnt = capacity + 1;
+    stream >> leaf_cnt;
+    if( 0 == leaf_cnt || leaf_cnt > capacity )
+        return false;
+
+    LargePageVector<Fast_Bvh_Leaf> leaves( leaf_cnt );
+    std::vector<const Primitive*> references;
+    for( auto& leaf : leaves ){
+        auto pri_cnt = 0u;
+        stream >> pri_cnt;
+        if( 0 == pri_cnt || pri_cnt > capacity - references.size() )
+            return false;
+
+        leaf.pri_offset = (unsigned)references.size();
+        leaf.pri_cnt = pri_cnt;
+        for( auto i = 0u ; i < pri_cnt ; ++i ){
+            auto index = primitive_cnt;
+            stream >> index;
+            if( index >= primitive_cnt )
+                return false;
+            references.push_back( (*m_primitives)[index] );
+        }
+    }
+
+    // Children are always after their parent in depth first order, this makes sure there is no cycle in the tree.
+    // Unused children are 0, which can't be a valid child since it is the root.
+    // The depth of the tree is evaluated along the way since it decides the size of the traversal stack.
+    if( isLeafNode( root ) ? leafNodeIndex( root ) >= leaf_cnt : root >= node_cnt )
+        return false;
+    std::vector<unsigned> node_depth( node_cnt , 0 );
+    auto depth = 1u;
+    if( !isLeafNode( root ) )
+        node_depth[root] = 1;
+    const auto visit_child = [&]( const Fbvh_Node_Ref parent , const Fbvh_Node_Ref child ){
+        const auto child_depth = node_depth[parent] + 1;
+        if( isLeafNode( child ) ){
+            depth = std::max( depth , child_depth );
+            return leafNodeIndex( child ) < leaf_cnt;
+        }
+        if( child <= parent || child >= node_cnt )
+            return false;
+        node_depth[child] = std::max( node_depth[child] , child_depth );
+        return true;
+    };
+    for( auto i = 0u ; i < node_cnt ; ++i ){
+        // nodes that are not reachable from the root are never traversed
+        if( 0 == node_depth[i] )
+            continue;
+#ifdef SIMD_BVH_IMPLEMENTATION
+        for( const auto child : nodes[i].children ){
+            if( 0 != child && !visit_child( i , child ) )
+                return false;
+        }
+#else
+        if( nodes[i].child_cnt > FBVH_CHILD_CNT )
+            return false;
+        for( auto j = 0u ; j < nodes[i].child_cnt ; ++j ){
+            if( !visit_child( i , nodes[i].children[j] ) )
+                return false;
+        }
+#endif
+    }
+    if( depth > m_maxNodeDepth )
+        return false;
+
+    m_root = root;
+    m_depth = depth;
+    m_nodes = std::move( nodes );
+    m_leaves = std::move( leaves );
+    m_references = std::move( references );
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    packLeaves();
+#endif
+    fitMotion();
+
+    trackMemory();
+
+    return true;
+}
+
+void Fbvh::trackMemory(){
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    auto bytes = (StatsInt)( sizeof(const Primitive*) * m_references.capacity() + sizeof(Fast_Bvh_Linear_Node) * m_nodes.capacity() +
+                             sizeof(Fast_Bvh_Leaf) * m_leaves.capacity() + sizeof(Fast_Bvh_Motion_Node) * m_motion.capacity() );
+#ifdef SIMD_BVH_IMPLEMENTATION
+    bytes += (StatsInt)( sizeof(Simd_Triangle) * m_triangles.capacity() + sizeof(Simd_Line) * m_lines.capacity() +
+                         sizeof(Simd_Sphere) * m_spheres.capacity() + sizeof(Simd_Planar) * m_planars.capacity() +
+                         sizeof(const Primitive*) * m_others.capacity() );
+#endif
+    m_memoryRecord.Track( &sFbvhMemory , bytes );
+#endif
+}
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+void Fbvh::packLeaves(){
+    m_triangles.clear();
+    m_lines.clear();
+    m_spheres.clear();
+    m_planars.clear();
+    m_others.clear();
+    for( auto& leaf : m_leaves ){
+        leaf.tri_offset = (unsigned)m_triangles.size();
+        leaf.line_offset = (unsigned)m_lines.size();
+        leaf.sphere_offset = (unsigned)m_spheres.size();
+        leaf.planar_offset = (unsigned)m_planars.size();
+        leaf.other_offset = (unsigned)m_others.size();
+        packLeafPrimitives( m_references.data() , leaf.pri_offset , leaf.pri_offset + leaf.pri_cnt , m_triangles , m_lines , m_spheres , m_planars , m_others );
+        leaf.tri_cnt = (unsigned)m_triangles.size() - leaf.tri_offset;
+        leaf.line_cnt = (unsigned)m_lines.size() - leaf.line_offset;
+        leaf.sphere_cnt = (unsigned)m_spheres.size() - leaf.sphere_offset;
+        leaf.planar_cnt = (unsigned)m_planars.size() - leaf.planar_offset;
+        leaf.other_cnt = (unsigned)m_others.size() - leaf.other_offset;
+        leaf.opaque = isOpaqueLeaf( m_references.data() , leaf.pri_offset , leaf.pri_offset + leaf.pri_cnt );
+    }
+}
+#endif
+
+void Fbvh::fitMotion(){
+    m_motion.clear();
+
+    const auto moving = std::any_of( m_primitives->begin() , m_primitives->end() , []( const Primitive* primitive ){
+        return primitive->IsMoving();
+    } );
+    if( !moving || isLeafNode( m_root ) )
+        return;
+
+    const auto leaf_motion = [&]( const Fbvh_Node_Ref ref ){
+        const auto& leaf = m_leaves[leafNodeIndex( ref )];
+        MotionBBox motion;
+        for( auto i = leaf.pri_offset ; i < leaf.pri_offset + leaf.pri_cnt ; ++i ){
+            BBox open , close;
+            if( !m_references[i]->GetMotionBBox( open , close ) )
+                open = close = m_references[i]->GetBBox();
+            motion.open.Union( open );
+            motion.close.Union( close );
+        }
+        return motion;
+    };
+
+    // children are always visited before their parents since they are after their parents in the node array
+    m_motion.resize( m_nodes.size() );
+    std::vector<MotionBBox> node_motion( m_nodes.size() );
+    for( auto i = (unsigned)m_nodes.size() ; i > 0 ; --i ){
+        const auto& node = m_nodes[i - 1];
+
+        MotionBBox  motion[FBVH_CHILD_CNT];
+        const auto child_cnt = childCount( node );
+        for( auto j = 0u ; j < child_cnt ; ++j ){
+            const auto child = node.children[j];
+            motion[j] = isLeafNode( child ) ? leaf_motion( child ) : node_motion[child];
+            node_motion[i - 1].open.Union( motion[j].open );
+            node_motion[i - 1].close.Union( motion[j].close );
+        }
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+        BBox open[FBVH_CHILD_CNT] , close[FBVH_CHILD_CNT];
+        bool valid[FBVH_CHILD_CNT] = { false };
+        for( auto j = 0u ; j < child_cnt ; ++j ){
+            open[j] = motion[j].open;
+            close[j] = motion[j].close;
+            valid[j] = true;
+        }
+        m_motion[i - 1].open = packBoundingBoxSIMD( open , valid );
+        m_motion[i - 1].close = packBoundingBoxSIMD( close , valid );
+#else
+        for( auto j = 0u ; j < child_cnt ; ++j )
+            m_motion[i - 1].bbox[j] = motion[j];
+#endif
+    }
+}
+
+bool Fbvh::Refit(){
+    if( !m_isValid )
+        return false;
+
+    for( const auto primitive : *m_primitives )
+        primitive->InvalidateBBox();
+
+    const auto leaf_bbox = [&]( const Fbvh_Node_Ref ref ){
+        const auto& leaf = m_leaves[leafNodeIndex( ref )];
+        BBox bbox;
+        for( auto i = leaf.pri_offset ; i < leaf.pri_offset + leaf.pri_cnt ; ++i )
+            bbox.Union( m_references[i]->GetBBox() );
+        return bbox;
+    };
+
+    // children are always refitted before their parents since they are after their parents in the node array
+    std::vector<BBox> node_bbox( m_nodes.size() );
+    for( auto i = (unsigned)m_nodes.size() ; i > 0 ; --i ){
+        auto& node = m_nodes[i - 1];
+
+        BBox    bbox[FBVH_CHILD_CNT];
+        bool    valid[FBVH_CHILD_CNT] = { false };
+        const auto child_cnt = childCount( node );
+        for( auto j = 0u ; j < child_cnt ; ++j ){
+            const auto child = node.children[j];
+            bbox[j] = isLeafNode( child ) ? leaf_bbox( child ) : node_bbox[child];
+            valid[j] = true;
+            node_bbox[i - 1].Union( bbox[j] );
+        }
+
+#if defined(FBVH_QUANTIZED_BBOX)
+        node.bbox = QuantizeBBox_SIMD( bbox , valid );
+#elif defined(SIMD_BVH_IMPLEMENTATION)
+        node.bbox = packBoundingBoxSIMD( bbox , valid );
+#else
+        for( auto j = 0u ; j < child_cnt ; ++j )
+            node.bbox[j] = bbox[j];
+#endif
+    }
+
+    m_bbox = isLeafNode( m_root ) ? leaf_bbox( m_root ) : node_bbox[m_root];
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    packLeaves();
+#endif
+    fitMotion();
+
+    return true;
+}
+
+float Fbvh::EvaluateSAH() const{
+    if( !m_isValid )
+        return 0.0f;
+    if( isLeafNode( m_root ) )
+        return (float)m_leaves[leafNodeIndex( m_root )].pri_cnt;
+
+    // The cost of a child is evaluated with the bounding box kept in its parent, only the root needs to be evaluated
+    // separately. Nodes that are not reachable from the root don't exist in a built tree.
+    BBox    root_bbox;
+    auto    cost = 0.0f;
+    for( auto i = 0u ; i < (unsigned)m_nodes.size() ; ++i ){
+        const auto& node = m_nodes[i];
+        const auto child_cnt = childCount( node );
+        for( auto j = 0u ; j < child_cnt ; ++j ){
+            const auto child = node.children[j];
+            const auto bbox = childBBox( node , j );
+            const auto child_cost = isLeafNode( child ) ? (float)m_leaves[leafNodeIndex( child )].pri_cnt : BVH_SAH_TRAVERSAL_COST;
+            cost += bbox.HalfSurfaceArea() * child_cost;
+            if( i == m_root )
+                root_bbox.Union( bbox );
+        }
+    }
+
+    const auto area = root_bbox.HalfSurfaceArea();
+    if( area <= 0.0f )
+        return 0.0f;
+    return BVH_SAH_TRAVERSAL_COST + cost / area;
+}
+
 std::unique_ptr<Accelerator> Fbvh::Clone() const {
 	auto ret = std::make_unique<Fbvh>();
 	ret->m_maxNodeDepth = m_maxNodeDepth;
 	ret->m_maxPriInLeaf = m_maxPriInLeaf;
+	ret->m_spatialSplit = m_spatialSplit;
+	ret->m_spatialSplitBudget = m_spatialSplitBudget;
 
 	return ret;
 }
\ No newline at end of file
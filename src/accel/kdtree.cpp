@@ -21,6 +21,7 @@
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
+#include "task/task.h"
 
 SORT_STATS_DEFINE_COUNTER(sKDTreeNodeCount)
 SORT_STATS_DEFINE_COUNTER(sKDTreeLeafNodeCount)
@@ -38,6 +39,79 @@ SORT_STATS_COUNTER("Spatial-Structure(KDTree)", "Maximum Primitive in Leaf", sKD
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Count in Leaf", sKDTreePrimitiveCount , sKDTreeLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
 
+// Nodes are grouped every four levels in the stats of each depth.
+#define KDTREE_DEPTH_STATS( i , depths ) \
+    SORT_STATS_DEFINE_COUNTER(sKDTreeDepthNodeCount##i) \
+    SORT_STATS_DEFINE_COUNTER(sKDTreeDepthPrimitiveCount##i) \
+    SORT_STATS_COUNTER("Spatial-Structure(KDTree)", "Node Count at Depth " depths, sKDTreeDepthNodeCount##i); \
+    SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Count in Node at Depth " depths, sKDTreeDepthPrimitiveCount##i, sKDTreeDepthNodeCount##i);
+
+KDTREE_DEPTH_STATS( 0 , "01-04" )
+KDTREE_DEPTH_STATS( 1 , "05-08" )
+KDTREE_DEPTH_STATS( 2 , "09-12" )
+KDTREE_DEPTH_STATS( 3 , "13-16" )
+KDTREE_DEPTH_STATS( 4 , "17-20" )
+KDTREE_DEPTH_STATS( 5 , "21-24" )
+KDTREE_DEPTH_STATS( 6 , "25-28" )
+KDTREE_DEPTH_STATS( 7 , "29+" )
+
+// Nodes with at least this number of primitives evaluate and distribute their split candidates along each axis in a separate task.
+static constexpr unsigned   KDTREE_PARALLEL_SPLIT_THRESHOLD     = 65536;
+// Sub-trees with at least this number of primitives will be built in a separate task.
+// This has to be smaller than the split threshold, see 'splitNode' for further detail.
+static constexpr unsigned   KDTREE_PARALLEL_SUBTREE_THRESHOLD   = 4096;
+static_assert( KDTREE_PARALLEL_SUBTREE_THRESHOLD <= KDTREE_PARALLEL_SPLIT_THRESHOLD , "Incorrect KD-Tree parallel construction thresholds." );
+// Primitives not referenced by a child node.
+static constexpr unsigned   KDTREE_INVALID_ID                   = 0xffffffff;
+
+//! @brief Whether the current thread could build KD-Tree in parallel.
+//!
+//! Parallel construction is only possible in a task, in case KD-Tree is built outside the task system, like in unit
+//! tests, it will fall back to single thread construction.
+//!
+//! @return             Whether parallel construction is possible.
+static SORT_FORCEINLINE bool isParallelKDTreeConstructionAvailable(){
+    return IS_PTR_VALID( GetCurrentTask() );
+}
+
+//! @brief Execute the function for all three axes, each axis is executed in a separate task if in parallel.
+//!
+//! @param parallel     Whether the axes are processed in parallel.
+//! @param func         Function processing an axis, it takes the id of the axis.
+template<class T>
+static void forEachAxis( const bool parallel , const T& func ){
+    if( !parallel ){
+        for( auto k = 0u ; k < 3u ; ++k )
+            func( k );
+        return;
+    }
+
+    for( auto k = 0u ; k < 3u ; ++k )
+        SPAWN_TASK<Function_Task>( "KD-Tree Split Candidates" , DEFAULT_TASK_PRIORITY , {} , [&,k](){ func( k ); } );
+    WAIT_FOR_CHILDREN();
+}
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+//! @brief Record the stats of a node based on its depth.
+//!
+//! @param depth        Depth of the node.
+//! @param prinum       Number of primitives in the node.
+static void recordDepthStats( const unsigned depth , const unsigned prinum ){
+    switch( std::min( ( depth - 1 ) / 4 , 7u ) ){
+#define KDTREE_DEPTH_STATS_CASE( i )    case i: ++sKDTreeDepthNodeCount##i; sKDTreeDepthPrimitiveCount##i += prinum; break;
+        KDTREE_DEPTH_STATS_CASE( 0 )
+        KDTREE_DEPTH_STATS_CASE( 1 )
+        KDTREE_DEPTH_STATS_CASE( 2 )
+        KDTREE_DEPTH_STATS_CASE( 3 )
+        KDTREE_DEPTH_STATS_CASE( 4 )
+        KDTREE_DEPTH_STATS_CASE( 5 )
+        KDTREE_DEPTH_STATS_CASE( 6 )
+        KDTREE_DEPTH_STATS_CASE( 7 )
+#undef KDTREE_DEPTH_STATS_CASE
+    }
+}
+#endif
+
 void KDTree::Build( const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build KdTree");
 
@@ -45,52 +119,77 @@ void KDTree::Build( const std::vector<const Primitive*>& primitives, const BBox&
 	if (primitives.empty())
 		return;
 
-    // pre-malloc node and leaf primitive list memory
-    auto tmp = std::make_unique<unsigned char[]>(m_primitives->size());
-
     m_bbox = bbox;
 
-    // create the split candidates
+    // make sure the bounding boxes are evaluated before they are accessed in multiple tasks
     auto count = (unsigned int)m_primitives->size();
+    for( const auto primitive : primitives )
+        primitive->GetBBox();
+
+    // Create the split candidates. They are only sorted once here, each node keeps their order while distributing them
+    // to its children, which makes the construction O(N*lg(N)).
     Splits splits;
-    for(auto i = 0 ; i < 3 ; i++ )
-        splits.split[i] = std::make_unique<Split[]>(2*count);
-    for(auto k = 0 ; k < 3 ; k++ ){
+    const auto parallel = count >= KDTREE_PARALLEL_SPLIT_THRESHOLD && isParallelKDTreeConstructionAvailable();
+    forEachAxis( parallel , [&]( unsigned k ){
+        splits.split[k] = std::make_unique<Split[]>(2*count);
         for(auto i = 0u ; i < count ; i++ ){
             auto pri = (*m_primitives)[i];
-            auto box = pri->GetBBox();
+            const auto& box = pri->GetBBox();
             splits.split[k][2*i] = Split(box.m_Min[k], Split_Type::Split_Start, i, pri);
             splits.split[k][2*i+1] = Split(box.m_Max[k], Split_Type::Split_End, i, pri);
         }
-    }
-    for(auto i = 0 ; i < 3 ; i++ )
-        std::sort( splits.split[i].get() , splits.split[i].get() + 2 * count);
+        std::sort( splits.split[k].get() , splits.split[k].get() + 2 * count);
+    });
 
     // create root node
     m_root = std::make_unique<Kd_Node>(m_bbox);
 
     // build kd-tree
-    splitNode( m_root.get() , splits , count , 1u , tmp.get() );
+    splitNode( m_root.get() , splits , count , 1u );
 
     SORT_STATS(++sKDTreeNodeCount);
 
+    // wait for all sub-trees built in other tasks
+    WAIT_FOR_CHILDREN();
+
+    // sub-trees are built in different threads, maximum values can't be gathered in per-thread stats during construction
+    SORT_STATS(collectStats( m_root.get() , 1u ));
+
     m_isValid = true;
 }
 
-void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp ){
-    SORT_STATS(sKDTreeDepth = std::max(sKDTreeDepth, (StatsInt)depth));
+void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth ){
+    SORT_STATS(recordDepthStats( depth , prinum ));
 
     if( prinum < m_maxPriInLeaf || depth >= m_maxDepth ){
         makeLeaf( node , splits , prinum );
         return;
     }
 
+    // Large nodes evaluate and distribute split candidates of each axis in a separate task. Since the current task will
+    // wait for all of its children, the caller needs to make sure it hasn't spawned any sub-tree construction task
+    // before, which is why the sub-tree threshold has to be smaller than the split threshold.
+    const auto parallel = prinum >= KDTREE_PARALLEL_SPLIT_THRESHOLD && isParallelKDTreeConstructionAvailable();
+
     // ----------------------------------------------------------------------------------------
     // step 1
     // pick best split
-    unsigned    split_offset;
-    unsigned    split_Axis;
-    auto sah = pickSplitting( splits , prinum , node->bbox , split_Axis , split_offset);
+    float       axis_sah[3];
+    unsigned    axis_offset[3];
+    forEachAxis( parallel , [&]( unsigned k ){
+        axis_sah[k] = pickSplitting( splits.split[k].get() , prinum , node->bbox , k , axis_offset[k] );
+    });
+
+    unsigned    split_offset = 0;
+    unsigned    split_Axis = 0;
+    auto sah = FLT_MAX;
+    for( auto k = 0u ; k < 3u ; ++k ){
+        if( axis_sah[k] < sah ){
+            sah = axis_sah[k];
+            split_Axis = k;
+            split_offset = axis_offset[k];
+        }
+    }
     if( sah >= prinum ){
         makeLeaf( node , splits , prinum );
         return;
@@ -101,24 +200,21 @@ void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsig
     // ----------------------------------------------------------------------------------------
     // step 2
     // distribute primitives
+    // Primitives are re-indexed in each child so that marking them only takes buffers as large as the node, instead of
+    // a buffer shared by all nodes, which would prevent nodes from being split in parallel.
     const auto split_count = prinum * 2;
     auto _splits = splits.split[split_Axis].get();
-    auto l_num = 0 , r_num = 0;
-    for(auto i = 0u ; i < split_count; i++ )
-        tmp[splits.split[split_Axis][i].id] = 0;
+    auto l_num = 0u , r_num = 0u;
+    std::vector<unsigned> l_ids( prinum , KDTREE_INVALID_ID ) , r_ids( prinum , KDTREE_INVALID_ID );
     for(auto i = 0u ; i < split_count; i++ )
     {
         if (i < split_offset) {
-            if (_splits[i].type == Split_Type::Split_Start) {
-                tmp[_splits[i].id] |= 1;
-                ++l_num;
-            }
+            if (_splits[i].type == Split_Type::Split_Start)
+                l_ids[_splits[i].id] = l_num++;
         }
         else if (i > split_offset) {
-            if (_splits[i].type == Split_Type::Split_End) {
-                tmp[_splits[i].id] |= 2;
-                ++r_num;
-            }
+            if (_splits[i].type == Split_Type::Split_End)
+                r_ids[_splits[i].id] = r_num++;
         }
     }
 
@@ -127,38 +223,56 @@ void KDTree::splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsig
     // generate new events
     Splits l_splits;
     Splits r_splits;
-    for(auto k = 0 ; k < 3 ; k++ ){
+    forEachAxis( parallel , [&]( unsigned k ){
         l_splits.split[k] = std::make_unique<Split[]>(2*l_num);
         r_splits.split[k] = std::make_unique<Split[]>(2*r_num);
-    }
-    for(auto k = 0 ; k < 3 ; k++ ){
-        auto l_offset = 0, r_offset = 0;
+
+        auto l_offset = 0u, r_offset = 0u;
         for(auto i = 0u ; i < split_count ; i++ ){
             const Split& old = splits.split[k][i];
-            auto id = old.id;
-            if (tmp[id] & 0x01)
-                l_splits.split[k][l_offset++] = old;
-            if (tmp[id] & 0x02)
-                r_splits.split[k][r_offset++] = old;
+            const auto l_id = l_ids[old.id];
+            const auto r_id = r_ids[old.id];
+            if( KDTREE_INVALID_ID != l_id ){
+                l_splits.split[k][l_offset] = old;
+                l_splits.split[k][l_offset++].id = l_id;
+            }
+            if( KDTREE_INVALID_ID != r_id ){
+                r_splits.split[k][r_offset] = old;
+                r_splits.split[k][r_offset++].id = r_id;
+            }
         }
         sAssert(l_offset == 2 * l_num, SPATIAL_ACCELERATOR);
         sAssert(r_offset == 2 * r_num, SPATIAL_ACCELERATOR);
-    }
+
+        // split candidates of this node are not needed any more
+        splits.split[k] = nullptr;
+    });
 
     auto left_box = node->bbox;
     left_box.m_Max[split_Axis] = node->split;
     node->leftChild = std::make_unique<Kd_Node>(left_box);
-    splitNode( node->leftChild.get() , l_splits , l_num , depth + 1 , tmp );
 
     auto right_box = node->bbox;
     right_box.m_Min[split_Axis] = node->split;
     node->rightChild = std::make_unique<Kd_Node>(right_box);
-    splitNode( node->rightChild.get() , r_splits , r_num , depth + 1 , tmp );
+
+    // Large sub-trees are built in separate tasks, the split candidates are owned by the tasks from now on.
+    if( prinum >= KDTREE_PARALLEL_SUBTREE_THRESHOLD && isParallelKDTreeConstructionAvailable() ){
+        auto left = node->leftChild.get();
+        auto right = node->rightChild.get();
+        auto left_splits = std::make_shared<Splits>( std::move( l_splits ) );
+        auto right_splits = std::make_shared<Splits>( std::move( r_splits ) );
+        SPAWN_TASK<Function_Task>( "Build KD-Tree Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( left , *left_splits , l_num , depth + 1 ); } );
+        SPAWN_TASK<Function_Task>( "Build KD-Tree Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( right , *right_splits , r_num , depth + 1 ); } );
+    }else{
+        splitNode( node->leftChild.get() , l_splits , l_num , depth + 1 );
+        splitNode( node->rightChild.get() , r_splits , r_num , depth + 1 );
+    }
 
     SORT_STATS(sKDTreeNodeCount += 2);
 }
 
-float KDTree::sah( unsigned l , unsigned r , unsigned axis , float split , const BBox& box ){
+float KDTree::sah( unsigned l , unsigned r , unsigned axis , float split , const BBox& box ) const{
     auto inv_sarea = 1.0f / box.HalfSurfaceArea();
 
     auto delta = box.m_Max - box.m_Min;
@@ -170,37 +284,35 @@ float KDTree::sah( unsigned l , unsigned r , unsigned axis , float split , const
     return ( l * l_sarea + r * r_sarea ) * inv_sarea;
 }
 
-float KDTree::pickSplitting( const Splits& splits , unsigned prinum , const BBox& box , unsigned& splitAxis , unsigned& split_offset ){
+float KDTree::pickSplitting( const Split* splits , unsigned prinum , const BBox& box , unsigned axis , unsigned& split_offset ) const{
     auto min_sah = FLT_MAX;
-    for(auto k = 0 ; k < 3 ; k++ ){
-        auto n_l = 0 ;
-        auto n_r = prinum ;
-        auto split_count = prinum * 2;
-        auto i = 0u;
-        while( i < split_count ){
-            if (splits.split[k][i].pos <= box.m_Min[k] ){
-                ++i;
-                continue;
-            }
-            if( splits.split[k][i].pos >= box.m_Max[k] )
-                break;
-
-            if (splits.split[k][i].type == Split_Type::Split_End)
-                --n_r;
-
-            // get the sah
-            auto sahv = sah( n_l , n_r , k , splits.split[k][i].pos , box );
-            if( sahv < min_sah ){
-                min_sah = sahv;
-                splitAxis = k;
-                split_offset = i;
-            }
+    const auto k = axis;
+    auto n_l = 0u ;
+    auto n_r = prinum ;
+    auto split_count = prinum * 2;
+    auto i = 0u;
+    while( i < split_count ){
+        if (splits[i].pos <= box.m_Min[k] ){
+            ++i;
+            continue;
+        }
+        if( splits[i].pos >= box.m_Max[k] )
+            break;
 
-            if (splits.split[k][i].type == Split_Type::Split_Start)
-                ++n_l;
+        if (splits[i].type == Split_Type::Split_End)
+            --n_r;
 
-            ++i;
+        // get the sah
+        auto sahv = sah( n_l , n_r , k , splits[i].pos , box );
+        if( sahv < min_sah ){
+            min_sah = sahv;
+            split_offset = i;
         }
+
+        if (splits[i].type == Split_Type::Split_Start)
+            ++n_l;
+
+        ++i;
     }
 
     return min_sah;
@@ -219,15 +331,25 @@ void KDTree::makeLeaf( Kd_Node* node , Splits& splits , unsigned prinum ){
     SORT_STATS(++sKDTreeLeafNodeCount);
     SORT_STATS(++sKDTreeNodeCount);
     SORT_STATS(sKDTreePrimitiveCount += prinum);
-    SORT_STATS(sKDTreeMaxPriCountInLeaf = std::max(sKDTreeMaxPriCountInLeaf, (StatsInt)prinum));
+}
+
+void KDTree::collectStats( const Kd_Node* node , unsigned depth ) const{
+    SORT_STATS(sKDTreeDepth = std::max(sKDTreeDepth, (StatsInt)depth));
+    if( node->flag == 3 ){
+        SORT_STATS(sKDTreeMaxPriCountInLeaf = std::max(sKDTreeMaxPriCountInLeaf, (StatsInt)node->primitivelist.size()));
+        return;
+    }
+
+    collectStats( node->leftChild.get() , depth + 1 );
+    collectStats( node->rightChild.get() , depth + 1 );
 }
 
 bool KDTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     SORT_PROFILE("Traverse KD-Tree");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
 #endif
 
     r.Prepare();
@@ -243,8 +365,8 @@ bool KDTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool KDTree::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse KD-Tree");
-    SORT_STATS(++sRayCount);
-    SORT_STATS(++sShadowRayCount);
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
 
     r.Prepare();
 
@@ -270,20 +392,11 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
     if( (node->flag & mask) == 3 ){
         auto inter = false;
         for( auto primitive : node->primitivelist ){
-            SORT_STATS(++sIntersectionTest);
+            SORT_STATS_HOT(++sIntersectionTest);
             inter |= primitive->GetIntersect( ray , intersect );
-            if( isShadowRay( intersect ) && inter ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID( intersect->primitive ), SPATIAL_ACCELERATOR );
-                sAssert(IS_PTR_VALID( intersect->primitive->GetMaterial() ), SPATIAL_ACCELERATOR );
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                    // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                    // that the above level logic will take advantage of.
-                    intersect->primitive = nullptr;
-                }
-#endif
+            // opaque primitives blocking a shadow ray are already reported with no primitive in the intersection
+            if( isShadowRay( intersect ) && inter )
                 return true;
-            }
         }
         return inter && ( intersect->t < ( fmax + delta ) && intersect->t > ( fmin - delta ) );
     }
@@ -311,7 +424,7 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
 
 void KDTree::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
     SORT_PROFILE("Traverse KD-Tree");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
     
     ray.Prepare();
 
@@ -355,7 +468,7 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
             if( checked )
                 continue;
 
-            SORT_STATS(++sIntersectionTest);
+            SORT_STATS_HOT(++sIntersectionTest);
         
             intersection.Reset();
             const auto intersected = primitive->GetIntersect( ray , &intersection );
@@ -401,6 +514,76 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
         traverse( second , ray , intersect , std::max( t , fmin ) , fmax , matID );
 }
 
+bool KDTree::saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const{
+    stream << SID("KDTree") << m_maxDepth << m_maxPriInLeaf;
+    saveNode( stream , m_root.get() , indices );
+    return true;
+}
+
+bool KDTree::loadCache( IStreamBase& stream ){
+    StringID    type;
+    unsigned    max_depth = 0 , max_pri_in_leaf = 0;
+    stream >> type >> max_depth >> max_pri_in_leaf;
+    if( type != SID("KDTree") || max_depth != m_maxDepth || max_pri_in_leaf != m_maxPriInLeaf )
+        return false;
+
+    auto root = std::make_unique<Kd_Node>( m_bbox );
+    if( !loadNode( stream , root.get() , 1u ) )
+        return false;
+
+    m_root = std::move( root );
+    return true;
+}
+
+void KDTree::saveNode( OStreamBase& stream , const Kd_Node* node , const std::unordered_map<const Primitive*, unsigned>& indices ) const{
+    stream << node->bbox.m_Min.x << node->bbox.m_Min.y << node->bbox.m_Min.z;
+    stream << node->bbox.m_Max.x << node->bbox.m_Max.y << node->bbox.m_Max.z;
+    stream << node->flag << node->split;
+
+    if( node->flag == 3 ){
+        stream << (unsigned)node->primitivelist.size();
+        for( const auto primitive : node->primitivelist )
+            stream << indices.at( primitive );
+        return;
+    }
+
+    saveNode( stream , node->leftChild.get() , indices );
+    saveNode( stream , node->rightChild.get() , indices );
+}
+
+bool KDTree::loadNode( IStreamBase& stream , Kd_Node* node , unsigned depth ){
+    if( depth > m_maxDepth )
+        return false;
+
+    stream >> node->bbox.m_Min.x >> node->bbox.m_Min.y >> node->bbox.m_Min.z;
+    stream >> node->bbox.m_Max.x >> node->bbox.m_Max.y >> node->bbox.m_Max.z;
+    stream >> node->flag >> node->split;
+    if( node->flag > 3 )
+        return false;
+
+    if( node->flag == 3 ){
+        auto pri_num = (unsigned)m_primitives->size() + 1;
+        stream >> pri_num;
+        if( pri_num > m_primitives->size() )
+            return false;
+
+        node->primitivelist.reserve( pri_num );
+        for( auto i = 0u ; i < pri_num ; ++i ){
+            auto index = (unsigned)m_primitives->size();
+            stream >> index;
+            if( index >= m_primitives->size() )
+                return false;
+            node->primitivelist.push_back( (*m_primitives)[index] );
+        }
+        return true;
+    }
+
+    node->leftChild = std::make_unique<Kd_Node>( BBox() );
+    node->rightChild = std::make_unique<Kd_Node>( BBox() );
+    return loadNode( stream , node->leftChild.get() , depth + 1 ) &&
+           loadNode( stream , node->rightChild.get() , depth + 1 );
+}
+
 std::unique_ptr<Accelerator> KDTree::Clone() const {
 	auto ret = std::make_unique<KDTree>();
 	ret->m_maxDepth = m_maxDepth;
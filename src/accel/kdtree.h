@@ -141,7 +141,8 @@ public:
     //! @brief Build KD-Tree structure in O(N*lg(N)).
     //!
     //! The construction of this KD-Tree works in O(N*lg(N)), which is proved to be the
-    //! optimal solution in one single thread.
+    //! optimal solution in one single thread. Large sub-trees are built in separate tasks
+    //! and split candidates of large nodes are evaluated along each axis in parallel.
     //! Please refer to this paper <a href = "http://www.eng.utah.edu/~cs6965/papers/kdtree.pdf">
     //! On building fast KD-Trees for Ray Tracing, and on doing that in O(N log N)</a>
     //! for further details.
@@ -181,8 +182,7 @@ private:
     //! @param splits       The split plane that holds all primitive pointers.
     //! @param prinum       The number of primitives in the node.
     //! @param depth        The current depth of the node.
-    //! @param tmp          Temporary buffer for marking primitives.
-    void splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth , unsigned char* tmp );
+    void splitNode( Kd_Node* node , Splits& splits , unsigned prinum , unsigned depth );
 
     //! @brief  Evaluate SAH value for a specific split plane.
     //!
@@ -192,19 +192,20 @@ private:
     //! @param split        Position along the splitting axis of the split plane.
     //! @param box          Bounding box of the KD-Tree node.
     //! @return             The Evaluated SAH value for the split.
-    float sah( unsigned l , unsigned r , unsigned axis , float split , const BBox& box );
+    float sah( unsigned l , unsigned r , unsigned axis , float split , const BBox& box ) const;
 
-    //! @brief  Pick the split plane with minimal SAH value.
+    //! @brief  Pick the split plane with minimal SAH value along an axis.
     //!
-    //! @param splits       Split information that holds all possible split plane information.
+    //! @param splits       Sorted split planes along the axis.
     //! @param prinum       Number of all primitives in the current node.
     //! @param box          Axis aligned bounding box of the node.
-    //! @param splitAxis    ID of the splitting axis.
-    //! @param split_offset ID of the best split plane that is picked.
+    //! @param axis         ID of the splitting axis.
+    //! @param split_offset ID of the best split plane that is picked. It is untouched if there is no
+    //!                     split plane inside the node.
     //! @return             The SAH value of the selected split that has the minimal
     //!                     SAH value.
-    float pickSplitting( const Splits& splits , unsigned prinum , const BBox& box ,
-                         unsigned& splitAxis , unsigned& split_offset );
+    float pickSplitting( const Split* splits , unsigned prinum , const BBox& box ,
+                         unsigned axis , unsigned& split_offset ) const;
 
     //! @brief  Mark the current node as leaf node.
     //!
@@ -213,6 +214,12 @@ private:
     //! @param prinum   The number of primitives in the node.
     void makeLeaf( Kd_Node* node , Splits& splits , unsigned prinum );
 
+    //! @brief  A recursive helper function that gathers the maximum depth and leaf size of the sub-tree in stats.
+    //!
+    //! @param node         The root node of the (sub)tree.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    void collectStats( const Kd_Node* node , unsigned depth ) const;
+
     //! @brief  A recursive function that traverses the KD-Tree node.
     //!
     //! @param node         The node to be traversed.
@@ -242,5 +249,33 @@ private:
     //! @param node         The KD-Tree node to be deleted.
     void deleteKdNode( Kd_Node* node );
 
+    //! @brief Save the built KD-Tree to the cache.
+    //!
+    //! @param stream       Stream to save the KD-Tree to.
+    //! @param indices      Index of each primitive in the primitive list.
+    //! @return             It always returns true since KD-Tree supports cache.
+    bool saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const override;
+
+    //! @brief Load the KD-Tree from the cache.
+    //!
+    //! @param stream       Stream to load the KD-Tree from.
+    //! @return             False if the cache doesn't match the configuration or it is corrupted.
+    bool loadCache( IStreamBase& stream ) override;
+
+    //! @brief  A recursive helper function that saves the sub-tree in depth first order.
+    //!
+    //! @param stream       Stream to save the sub-tree to.
+    //! @param node         The root node of the (sub)tree to be saved.
+    //! @param indices      Index of each primitive in the primitive list.
+    void saveNode( OStreamBase& stream , const Kd_Node* node , const std::unordered_map<const Primitive*, unsigned>& indices ) const;
+
+    //! @brief  A recursive helper function that loads the sub-tree saved by 'saveNode'.
+    //!
+    //! @param stream       Stream to load the sub-tree from.
+    //! @param node         The root node of the (sub)tree to be loaded.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @return             False if the sub-tree is corrupted.
+    bool loadNode( IStreamBase& stream , Kd_Node* node , unsigned depth );
+
     SORT_STATS_ENABLE( "Spatial-Structure(KDTree)" )
 };
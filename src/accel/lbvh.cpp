@@ -0,0 +1,423 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "lbvh.h"
+
+SORT_STATS_DEFINE_COUNTER(sLbvhNodeCount)
+SORT_STATS_DEFINE_COUNTER(sLbvhLeafNodeCount)
+SORT_STATS_DEFINE_COUNTER(sLbvhDepth)
+SORT_STATS_DEFINE_COUNTER(sLbvhMaxPriCountInLeaf)
+SORT_STATS_DEFINE_COUNTER(sLbvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sLbvhRestructuredTreelet)
+
+SORT_STATS_COUNTER("Spatial-Structure(LBVH)", "Node Count", sLbvhNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(LBVH)", "Leaf Node Count", sLbvhLeafNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(LBVH)", "LBVH Depth", sLbvhDepth);
+SORT_STATS_COUNTER("Spatial-Structure(LBVH)", "Maximum Primitive in Leaf", sLbvhMaxPriCountInLeaf);
+SORT_STATS_AVG_COUNT("Spatial-Structure(LBVH)", "Average Primitive Count in Leaf", sLbvhPrimitiveCount , sLbvhLeafNodeCount );
+SORT_STATS_COUNTER("Spatial-Structure(LBVH)", "Restructured Treelet Count", sLbvhRestructuredTreelet);
+
+// Number of bits of each axis in Morton codes.
+static constexpr unsigned   LBVH_MORTON_AXIS_BITS           = 10;
+// Number of bits sorted in each pass of the radix sort.
+static constexpr unsigned   LBVH_RADIX_BITS                 = 8;
+static constexpr unsigned   LBVH_RADIX_SIZE                 = 1u << LBVH_RADIX_BITS;
+static constexpr unsigned   LBVH_RADIX_MASK                 = LBVH_RADIX_SIZE - 1;
+// Number of primitives processed by each task during parallel construction.
+static constexpr unsigned   LBVH_PARALLEL_CHUNK             = 16384;
+// Maximum number of leaves in a treelet, the optimization is exponential in it.
+static constexpr unsigned   LBVH_TREELET_SIZE               = 7;
+// A treelet is only restructured if its SAH cost is reduced by at least this portion.
+static constexpr float      LBVH_TREELET_MIN_IMPROVEMENT    = 1e-3f;
+
+//! @brief Morton code of a primitive during sorting.
+struct Lbvh_Morton {
+    unsigned    code;       /**< Morton code of the centroid of the primitive. */
+    unsigned    index;      /**< Index of the primitive in the primitive list. */
+};
+
+//! @brief Number of chunks to split the primitives in during parallel construction.
+//!
+//! @param cnt          Number of primitives.
+//! @return             Number of chunks, it is 1 if the primitives are processed in the current task.
+static SORT_FORCEINLINE unsigned chunkCount( const unsigned cnt ){
+    if( cnt < 2 * LBVH_PARALLEL_CHUNK || !isParallelBvhConstructionAvailable() )
+        return 1u;
+    return ( cnt + LBVH_PARALLEL_CHUNK - 1 ) / LBVH_PARALLEL_CHUNK;
+}
+
+//! @brief Process the primitives chunk by chunk, each chunk is processed in a separate task if there are multiple chunks.
+//!
+//! @param chunk_cnt    Number of chunks returned by 'chunkCount'.
+//! @param cnt          Number of primitives.
+//! @param func         Function processing a chunk, it takes the index of the chunk and the range of primitives in it.
+template<class T>
+static void forEachChunk( const unsigned chunk_cnt , const unsigned cnt , const T& func ){
+    if( 1u == chunk_cnt ){
+        func( 0u , 0u , cnt );
+        return;
+    }
+
+    for( auto c = 0u ; c < chunk_cnt ; ++c ){
+        SPAWN_TASK<Function_Task>( "LBVH Chunk" , DEFAULT_TASK_PRIORITY , {} , [&,c](){
+            const auto start = c * LBVH_PARALLEL_CHUNK;
+            func( c , start , std::min( cnt , start + LBVH_PARALLEL_CHUNK ) );
+        });
+    }
+    WAIT_FOR_CHILDREN();
+}
+
+//! @brief Spread the lower 10 bits of the value so that there are two zero bits between each of them.
+//!
+//! @param v            The value to be spread.
+//! @return             The spread value.
+static SORT_FORCEINLINE unsigned spreadBits( unsigned v ){
+    v = ( v * 0x00010001u ) & 0xFF0000FFu;
+    v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+    v = ( v * 0x00000011u ) & 0xC30C30C3u;
+    v = ( v * 0x00000005u ) & 0x49249249u;
+    return v;
+}
+
+//! @brief Find the first primitive in the right child of a node.
+//!
+//! All Morton codes of the primitives in the node share the bits above the highest bit where the first and the last
+//! one differ, the sorted codes are split where this bit changes.
+//!
+//! @param codes        Morton codes of the sorted primitives.
+//! @param start        The start offset of primitives that the node holds.
+//! @param end          The end offset of primitives that the node holds.
+//! @return             The offset of the first primitive in the right child.
+static SORT_FORCEINLINE unsigned findSplit( const unsigned* codes , const unsigned start , const unsigned end ){
+    const auto diff = codes[start] ^ codes[end - 1];
+
+    // primitives with identical Morton codes are simply split in the middle
+    if( 0 == diff )
+        return ( start + end ) >> 1;
+
+    auto mask = 1u << 31;
+    while( 0 == ( diff & mask ) )
+        mask >>= 1;
+
+    // the first code has the bit cleared and the last one has it set
+    auto lo = start , hi = end - 1;
+    while( lo + 1 < hi ){
+        const auto mid = ( lo + hi ) >> 1;
+        if( codes[mid] & mask )
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return hi;
+}
+
+void Lbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
+    SORT_PROFILE("Build Lbvh");
+
+    m_primitives = &primitives;
+    if (primitives.empty())
+        return;
+
+    m_bbox = bbox;
+
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    m_bvhpri = std::make_unique<Bvh_Primitive[]>(primitive_cnt);
+
+    // the references, the Morton codes and the two key buffers of the radix sort live at the same time
+    SORT_STATS_MEMORY_RECORD(build_memory)
+    SORT_STATS(build_memory.Track( &sBvhBuildMemory , (StatsInt)( ( sizeof(Bvh_Primitive) + sizeof(unsigned) + 2 * sizeof(Lbvh_Morton) ) * primitive_cnt ) ));
+
+    std::vector<unsigned> codes;
+    sortPrimitives( codes );
+
+    m_root = std::make_unique<Bvh_Node>();
+    splitNode( m_root.get() , codes.data() , 0u , primitive_cnt , 1u );
+
+    releaseBuildData();
+
+    m_isValid = true;
+
+    SORT_STATS(++sLbvhNodeCount);
+    SORT_STATS(sLbvhPrimitiveCount=primitive_cnt);
+}
+
+void Lbvh::sortPrimitives( std::vector<unsigned>& codes ){
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto chunk_cnt = chunkCount( primitive_cnt );
+
+    // generate BVH primitives and the bounding box of all centroids
+    std::vector<BBox> partial_inner( chunk_cnt );
+    forEachChunk( chunk_cnt , primitive_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+        for( auto i = start ; i < end ; ++i ){
+            m_bvhpri[i].SetPrimitive( (*m_primitives)[i] );
+            partial_inner[c].Union( m_bvhpri[i].GetCentroid() );
+        }
+    });
+
+    BBox inner;
+    for( const auto& bb : partial_inner )
+        inner.Union( bb );
+
+    // quantize the centroids in the bounding box
+    static constexpr unsigned   LBVH_MORTON_AXIS_MAX    = ( 1u << LBVH_MORTON_AXIS_BITS ) - 1;
+    float scale[3];
+    for( auto k = 0u ; k < 3u ; ++k ){
+        const auto delta = inner.Delta( k );
+        scale[k] = delta > 0.0f ? (float)( LBVH_MORTON_AXIS_MAX + 1 ) / delta : 0.0f;
+    }
+
+    std::vector<Lbvh_Morton> keys( primitive_cnt ) , sorted_keys( primitive_cnt );
+    forEachChunk( chunk_cnt , primitive_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+        for( auto i = start ; i < end ; ++i ){
+            auto code = 0u;
+            for( auto k = 0u ; k < 3u ; ++k ){
+                const auto q = std::min( (unsigned)( ( m_bvhpri[i].GetCentroid()[k] - inner.m_Min[k] ) * scale[k] ) , LBVH_MORTON_AXIS_MAX );
+                code |= spreadBits( q ) << ( 2 - k );
+            }
+            keys[i] = { code , i };
+        }
+    });
+
+    // Least significant digit radix sort. Each chunk counts its digits first, the chunk then scatters its primitives
+    // starting from the total count of smaller digits and the same digit in preceding chunks, which keeps it stable.
+    std::vector<unsigned> histogram( chunk_cnt * LBVH_RADIX_SIZE );
+    for( auto shift = 0u ; shift < 3 * LBVH_MORTON_AXIS_BITS ; shift += LBVH_RADIX_BITS ){
+        std::fill( histogram.begin() , histogram.end() , 0u );
+        forEachChunk( chunk_cnt , primitive_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+            auto count = histogram.data() + c * LBVH_RADIX_SIZE;
+            for( auto i = start ; i < end ; ++i )
+                ++count[ ( keys[i].code >> shift ) & LBVH_RADIX_MASK ];
+        });
+
+        auto offset = 0u;
+        for( auto d = 0u ; d < LBVH_RADIX_SIZE ; ++d ){
+            for( auto c = 0u ; c < chunk_cnt ; ++c ){
+                const auto cnt = histogram[ c * LBVH_RADIX_SIZE + d ];
+                histogram[ c * LBVH_RADIX_SIZE + d ] = offset;
+                offset += cnt;
+            }
+        }
+
+        forEachChunk( chunk_cnt , primitive_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+            auto dest = histogram.data() + c * LBVH_RADIX_SIZE;
+            for( auto i = start ; i < end ; ++i )
+                sorted_keys[ dest[ ( keys[i].code >> shift ) & LBVH_RADIX_MASK ]++ ] = keys[i];
+        });
+
+        keys.swap( sorted_keys );
+    }
+    sorted_keys = std::vector<Lbvh_Morton>();
+
+    codes.resize( primitive_cnt );
+    forEachChunk( chunk_cnt , primitive_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+        for( auto i = start ; i < end ; ++i )
+            codes[i] = keys[i].code;
+    });
+
+    // Reorder the primitives along the Morton curve in place instead of copying them to a second buffer. Each cycle of
+    // the permutation is followed once, visited slots are marked by pointing them to themselves.
+    for( auto i = 0u ; i < primitive_cnt ; ++i ){
+        if( keys[i].index == i )
+            continue;
+        const auto first = m_bvhpri[i];
+        auto j = i;
+        while( keys[j].index != i ){
+            const auto next = keys[j].index;
+            m_bvhpri[j] = m_bvhpri[next];
+            keys[j].index = j;
+            j = next;
+        }
+        m_bvhpri[j] = first;
+        keys[j].index = j;
+    }
+}
+
+void Lbvh::splitNode( Bvh_Node* node , const unsigned* codes , unsigned start , unsigned end , unsigned depth ){
+    SORT_STATS(sLbvhDepth = std::max( sLbvhDepth , (StatsInt)depth ) );
+
+    const auto primitive_num = end - start;
+    if( primitive_num <= m_maxPriInLeaf || depth >= m_maxNodeDepth ){
+        makeLeaf( node , start , end );
+        return;
+    }
+
+    const auto split = findSplit( codes , start , end );
+
+    node->left = std::make_unique<Bvh_Node>();
+    node->right = std::make_unique<Bvh_Node>();
+
+    const auto left = node->left.get();
+    const auto right = node->right.get();
+
+    // Unlike the SAH BVH, the bounding box of a node is only known after both of its children are built. A node with
+    // enough primitives is always built at the beginning of a separate task, waiting here only waits for its own sub-trees.
+    if( primitive_num >= BVH_PARALLEL_SUBTREE_THRESHOLD && isParallelBvhConstructionAvailable() ){
+        SPAWN_TASK<Function_Task>( "Build LBVH Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( left , codes , start , split , depth + 1 ); } );
+        SPAWN_TASK<Function_Task>( "Build LBVH Sub-tree" , DEFAULT_TASK_PRIORITY , {} , [=](){ splitNode( right , codes , split , end , depth + 1 ); } );
+        WAIT_FOR_CHILDREN();
+    }else{
+        splitNode( left , codes , start , split , depth + 1 );
+        splitNode( right , codes , split , end , depth + 1 );
+    }
+
+    node->bbox = Union( left->bbox , right->bbox );
+
+    if( m_treeletOptimization )
+        optimizeTreelet( node );
+
+    SORT_STATS(sLbvhNodeCount+=2);
+}
+
+void Lbvh::makeLeaf( Bvh_Node* node , unsigned start , unsigned end ){
+    for( auto i = start ; i < end ; i++ )
+        node->bbox.Union( m_bvhpri[i].GetBBox() );
+
+    node->pri_num = end - start;
+    node->pri_offset = start;
+
+    SORT_STATS(++sLbvhLeafNodeCount);
+    SORT_STATS(sLbvhMaxPriCountInLeaf = std::max( sLbvhMaxPriCountInLeaf , (StatsInt)node->pri_num) );
+}
+
+void Lbvh::optimizeTreelet( Bvh_Node* node ){
+    static constexpr unsigned   LBVH_TREELET_SUBSET_CNT = 1u << LBVH_TREELET_SIZE;
+
+    // form the treelet, the interior nodes are the ones expanded
+    Bvh_Node* leaves[LBVH_TREELET_SIZE] = { node->left.get() , node->right.get() };
+    Bvh_Node* interiors[LBVH_TREELET_SIZE - 2];
+    auto leaf_cnt = 2u , interior_cnt = 0u;
+    auto cost = 0.0f;
+    while( leaf_cnt < LBVH_TREELET_SIZE ){
+        auto picked = leaf_cnt;
+        auto max_area = -1.0f;
+        for( auto i = 0u ; i < leaf_cnt ; ++i ){
+            const auto area = leaves[i]->bbox.HalfSurfaceArea();
+            if( 0 == leaves[i]->pri_num && area > max_area ){
+                max_area = area;
+                picked = i;
+            }
+        }
+        if( picked == leaf_cnt )
+            break;
+
+        const auto interior = leaves[picked];
+        interiors[interior_cnt++] = interior;
+        leaves[picked] = interior->left.get();
+        leaves[leaf_cnt++] = interior->right.get();
+        cost += max_area;
+    }
+
+    // there is only one possible topology with less than three leaves
+    if( leaf_cnt < 3 )
+        return;
+
+    // Neither the cost of the treelet root nor the cost of the treelet leaves depends on the topology, only the surface
+    // area of the interior nodes is minimized. The optimal topology of each subset of the leaves is found from
+    // the smaller subsets, each partition of a subset is visited once by keeping its lowest leaf on the left.
+    BBox            bbox[LBVH_TREELET_SUBSET_CNT];
+    float           area_cost[LBVH_TREELET_SUBSET_CNT];
+    unsigned char   partition[LBVH_TREELET_SUBSET_CNT];
+    const auto subset_cnt = 1u << leaf_cnt;
+    for( auto i = 0u ; i < leaf_cnt ; ++i ){
+        bbox[1u << i] = leaves[i]->bbox;
+        area_cost[1u << i] = 0.0f;
+    }
+    for( auto s = 1u ; s < subset_cnt ; ++s ){
+        const auto lowest = s & ( ~s + 1u );
+        if( lowest == s )
+            continue;
+
+        bbox[s] = Union( bbox[s ^ lowest] , bbox[lowest] );
+
+        auto best_cost = FLT_MAX;
+        auto best_partition = lowest;
+        for( auto p = ( s - 1u ) & s ; p ; p = ( p - 1u ) & s ){
+            if( 0 == ( p & lowest ) )
+                continue;
+            const auto partition_cost = area_cost[p] + area_cost[s ^ p];
+            if( partition_cost < best_cost ){
+                best_cost = partition_cost;
+                best_partition = p;
+            }
+        }
+        area_cost[s] = bbox[s].HalfSurfaceArea() + best_cost;
+        partition[s] = (unsigned char)best_partition;
+    }
+
+    const auto full = subset_cnt - 1u;
+    const auto optimized_cost = area_cost[full] - bbox[full].HalfSurfaceArea();
+    if( optimized_cost >= cost * ( 1.0f - LBVH_TREELET_MIN_IMPROVEMENT ) )
+        return;
+
+    // detach the treelet, the interior nodes are reused in the new topology
+    std::unique_ptr<Bvh_Node> leaf_nodes[LBVH_TREELET_SIZE];
+    std::unique_ptr<Bvh_Node> interior_nodes[LBVH_TREELET_SIZE - 2];
+    auto pool_cnt = 0u;
+    auto detach = [&]( std::unique_ptr<Bvh_Node>& child ){
+        for( auto i = 0u ; i < leaf_cnt ; ++i ){
+            if( child.get() == leaves[i] ){
+                leaf_nodes[i] = std::move( child );
+                return;
+            }
+        }
+        interior_nodes[pool_cnt++] = std::move( child );
+    };
+    detach( node->left );
+    detach( node->right );
+    for( auto i = 0u ; i < interior_cnt ; ++i ){
+        detach( interiors[i]->left );
+        detach( interiors[i]->right );
+    }
+
+    // rebuild the treelet top down
+    std::pair<Bvh_Node*, unsigned> stack[LBVH_TREELET_SIZE];
+    auto stack_cnt = 0u;
+    stack[stack_cnt++] = std::make_pair( node , full );
+    while( stack_cnt > 0 ){
+        const auto parent = stack[--stack_cnt];
+        const unsigned halves[2] = { partition[parent.second] , parent.second ^ partition[parent.second] };
+
+        std::unique_ptr<Bvh_Node> children[2];
+        for( auto k = 0u ; k < 2u ; ++k ){
+            const auto subset = halves[k];
+            if( 0 == ( subset & ( subset - 1u ) ) ){
+                auto i = 0u;
+                while( ( 1u << i ) != subset )
+                    ++i;
+                children[k] = std::move( leaf_nodes[i] );
+            }else{
+                children[k] = std::move( interior_nodes[--pool_cnt] );
+                children[k]->bbox = bbox[subset];
+                stack[stack_cnt++] = std::make_pair( children[k].get() , subset );
+            }
+        }
+        parent.first->left = std::move( children[0] );
+        parent.first->right = std::move( children[1] );
+    }
+
+    SORT_STATS(++sLbvhRestructuredTreelet);
+}
+
+std::unique_ptr<Accelerator> Lbvh::Clone() const {
+	auto ret = std::make_unique<Lbvh>();
+	ret->m_maxNodeDepth = m_maxNodeDepth;
+	ret->m_maxPriInLeaf = m_maxPriInLeaf;
+	ret->m_treeletOptimization = m_treeletOptimization;
+
+	return ret;
+}
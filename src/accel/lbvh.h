@@ -0,0 +1,112 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "bvh.h"
+
+//! @brief Linear bounding volume hierarchy.
+/**
+ * LBVH is a BVH whose hierarchy is derived from Morton codes of the primitive centroids instead of
+ * evaluating SAH of split candidates. Primitives are sorted along the Morton curve with a parallel radix
+ * sort first, each node is then split at the highest bit where the Morton codes of its primitives differ,
+ * which is a binary search over its sorted codes. There is no SAH evaluation at all, which makes it a lot
+ * faster to build than the SAH BVH at the cost of slower ray traversal. It is a good fit for preview
+ * renders, where time to first pixel matters more than trace performance.
+ * Optionally, the quality of the hierarchy could be improved by restructuring small treelets of each node
+ * to minimize their SAH costs, this is described in this paper
+ * <a href="https://research.nvidia.com/sites/default/files/pubs/2013-07_Fast-Parallel-Construction/karras2013hpg_paper.pdf">
+ * Fast Parallel Construction of High-Quality Bounding Volume Hierarchies</a>.
+ * The built hierarchy has exactly the same layout as the SAH BVH, so that traversal and refitting are shared.
+ */
+class Lbvh : public Bvh{
+public:
+    DEFINE_RTTI( Lbvh , Accelerator );
+
+    //! @brief Build LBVH structure.
+    //!
+    //! The radix sort of Morton codes is linear in the number of primitives, it dominates the construction.
+    //!
+    //! @param primitives       A vector holding all primitives.
+    //! @param bbox             The bounding box of the scene.
+    void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
+
+    //! @brief      Serializing data from stream.
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation,
+    //!             it could come from different places.
+    void    Serialize( IStreamBase& stream ) override{
+        stream >> m_maxNodeDepth;
+        stream >> m_maxPriInLeaf;
+        stream >> m_treeletOptimization;
+    }
+
+    //! @brief	Clone the accelerator.
+    //!
+    //! Only configuration will be cloned, not the data inside the accelerator, this is for primitives that has volumes attached.
+    //!
+    //! @return		Cloned accelerator.
+    std::unique_ptr<Accelerator>	Clone() const override;
+
+private:
+    /**< Whether treelets are restructured to reduce the SAH cost of the LBVH. */
+    bool                                    m_treeletOptimization = false;
+
+    //! @brief Sort the primitives along the Morton curve.
+    //!
+    //! @param codes        Morton codes of the sorted primitives.
+    void    sortPrimitives( std::vector<unsigned>& codes );
+
+    //! @brief Split current LBVH node at the highest different bit of Morton codes of its primitives.
+    //!
+    //! @param node         The LBVH node to be split.
+    //! @param codes        Morton codes of the sorted primitives.
+    //! @param start        The start offset of primitives that the node holds.
+    //! @param end          The end offset of primitives that the node holds.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    void    splitNode( Bvh_Node* node , const unsigned* codes , unsigned start , unsigned end , unsigned depth );
+
+    //! @brief Mark the current node as leaf node.
+    //!
+    //! @param node         The LBVH node to be marked as leaf node.
+    //! @param start        The start offset of primitives that the node holds.
+    //! @param end          The end offset of primitives that the node holds.
+    void    makeLeaf( Bvh_Node* node , unsigned start , unsigned end );
+
+    //! @brief Restructure the treelet rooted at the node to the topology with minimal SAH cost.
+    //!
+    //! The treelet is formed by expanding the child with the largest surface area until there are enough leaves,
+    //! its optimal topology is then found through dynamic programming over all subsets of the treelet leaves.
+    //! Both children of the node need to be optimized before.
+    //!
+    //! @param node         Root node of the treelet.
+    void    optimizeTreelet( Bvh_Node* node );
+
+    //! @brief LBVH cache is not supported.
+    //!
+    //! Loading the cache is not much faster than building LBVH, it is not worth the disk space.
+    //!
+    //! @return             It always returns false.
+    bool    saveCache( OStreamBase& stream , const std::unordered_map<const Primitive*, unsigned>& indices ) const override { return false; }
+
+    //! @brief LBVH cache is not supported.
+    //!
+    //! @return             It always returns false.
+    bool    loadCache( IStreamBase& stream ) override { return false; }
+
+    SORT_STATS_ENABLE( "Spatial-Structure(LBVH)" )
+};
@@ -18,6 +18,7 @@
 #include "octree.h"
 #include "core/primitive.h"
 #include "core/log.h"
+#include "core/cpu.h"
 #include "scatteringevent/scatteringevent.h"
 #include "core/memory.h"
 
@@ -37,9 +38,21 @@ SORT_STATS_COUNTER("Spatial-Structure(OcTree)", "Maximum Primitive in Leaf", sOc
 SORT_STATS_AVG_COUNT("Spatial-Structure(OcTree)", "Average Primitive Count in Leaf", sOcTreePrimitiveCount , sOcTreeLeafNodeCount);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OcTree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
 
+OcTree::~OcTree(){
+#ifdef AVX_ENABLED
+    releaseSimd();
+#endif
+}
+
 void OcTree::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build OcTree");
 
+    m_nodes.clear();
+    m_leafPrimitives.clear();
+#ifdef AVX_ENABLED
+    releaseSimd();
+#endif
+
     m_primitives = &primitives;
 	if (m_primitives->empty())
 		return;
@@ -52,42 +65,48 @@ void OcTree::Build(const std::vector<const Primitive*>& primitives, const BBox&
         container->primitives.push_back( primitive );
 
     // create root node
-    m_root = std::make_unique<OcTreeNode>();
-    m_root->bb = m_bbox;
+    m_nodes.emplace_back();
+    m_nodes[0].bb = m_bbox;
 
     // split OCTree node
-    splitNode( m_root.get() , container.get() , 1u );
+    splitNode( 0 , container.get() , 1u , std::min( m_maxDepthInOcTree , OCTREE_MAX_DEPTH ) );
+
+#ifdef AVX_ENABLED
+    if( IsSimdIsaSupported( SimdIsa::AVX ) )
+        packSimd();
+#endif
 
     m_isValid = true;
 
     SORT_STATS(++sOcTreeNodeCount);
 }
 
-void OcTree::splitNode( OcTreeNode* node , NodePrimitiveContainer* container , unsigned depth ){
+void OcTree::splitNode( unsigned node , NodePrimitiveContainer* container , unsigned depth , unsigned max_depth ){
     SORT_STATS( sOcTreeDepth = std::max( sOcTreeDepth , (StatsInt) depth ) );
 
     // make a leaf if there are not enough points
-    if( container->primitives.size() <= (int)m_maxPriInLeaf || depth >= m_maxDepthInOcTree ){
+    if( container->primitives.size() <= (int)m_maxPriInLeaf || depth >= max_depth ){
         makeLeaf( node , container );
         return;
     }
 
-    // container for child node
+    // container for child node, children are appended to the end of the node array next to each other.
+    const auto child_offset = (unsigned)m_nodes.size();
+    m_nodes.resize( child_offset + 8 );
     std::unique_ptr<NodePrimitiveContainer> childcontainer[8];
-    for (auto i = 0; i < 8; ++i) {
-        node->child[i] = std::make_unique<OcTreeNode>();
+    for (auto i = 0; i < 8; ++i)
         childcontainer[i] = std::make_unique<NodePrimitiveContainer>();
-    }
 
     // get the center point of this tree node
-    auto offset = 0;
-    auto length = ( node->bb.m_Max - node->bb.m_Min ) * 0.5f;
+    auto offset = child_offset;
+    const auto bb = m_nodes[node].bb;
+    auto length = ( bb.m_Max - bb.m_Min ) * 0.5f;
     for(auto i = 0 ; i < 2; ++i ){
         for(auto j = 0 ; j < 2 ; ++j ){
             for(auto k = 0 ; k < 2 ; ++k ){
                 // setup the lower left bottom point
-                node->child[offset]->bb.m_Min = node->bb.m_Min + Vector( (float)k , (float)j , (float)i ) * length;
-                node->child[offset]->bb.m_Max = node->child[offset]->bb.m_Min + length;
+                m_nodes[offset].bb.m_Min = bb.m_Min + Vector( (float)k , (float)j , (float)i ) * length;
+                m_nodes[offset].bb.m_Max = m_nodes[offset].bb.m_Min + length;
                 ++offset;
             }
         }
@@ -98,7 +117,7 @@ void OcTree::splitNode( OcTreeNode* node , NodePrimitiveContainer* container , u
     while( it != container->primitives.end() ){
         for(auto i = 0 ; i < 8 ; ++i ){
             // check for intersection
-            if( (*it)->GetIntersect( node->child[i]->bb ) )
+            if( (*it)->GetIntersect( m_nodes[child_offset + i].bb ) )
                 childcontainer[i]->primitives.push_back( *it );
         }
         ++it;
@@ -111,39 +130,58 @@ void OcTree::splitNode( OcTreeNode* node , NodePrimitiveContainer* container , u
     for(auto i = 0 ; i < 8 ; ++i )
         total_child_pri += (int)childcontainer[i]->primitives.size();
     if( total_child_pri > (int)(2 * container->primitives.size()) && depth > 8 ){
+        // splitting plane information is no useful anymore, the children are the last nodes in the array.
+        m_nodes.resize( child_offset );
+
         // make leaf
         makeLeaf( node , container );
 
-        // splitting plane information is no useful anymore.
-        for (int i = 0; i < 8; ++i)
-            node->child[i].reset();
-
         // no need to process any more
         return;
     }
 
     // split children node
-    for(auto i = 0 ; i < 8 ; ++i )
-        splitNode( node->child[i].get() , childcontainer[i].get() , depth + 1 );
+    m_nodes[node].child_offset = child_offset;
+    for(auto i = 0u ; i < 8 ; ++i ){
+        splitNode( child_offset + i , childcontainer[i].get() , depth + 1 , max_depth );
+
+        const auto& child = m_nodes[child_offset + i];
+        if( child.child_offset || child.pri_cnt )
+            m_nodes[node].child_mask |= 1u << i;
+    }
 
     SORT_STATS(sOcTreeNodeCount+=8);
 }
 
-void OcTree::makeLeaf( OcTreeNode* node , NodePrimitiveContainer* container ){
+void OcTree::makeLeaf( unsigned node , NodePrimitiveContainer* container ){
     SORT_STATS(++sOcTreeLeafNodeCount);
     SORT_STATS(sOcTreeMaxPriCountInLeaf = std::max( sOcTreeMaxPriCountInLeaf , (StatsInt)container->primitives.size()) );
     SORT_STATS(sOcTreePrimitiveCount += (StatsInt)container->primitives.size());
 
-    for( auto primitive : container->primitives )
-        node->primitives.push_back( primitive );
+    auto& leaf = m_nodes[node];
+    leaf.pri_offset = (unsigned)m_leafPrimitives.size();
+    leaf.pri_cnt = (unsigned)container->primitives.size();
+    // Alpha masked and moving triangles are tested one by one with the other shapes, the primitive handles them itself.
+    const auto packable = []( const Primitive* primitive ){
+        return SHAPE_TRIANGLE == primitive->GetShapeType() && !primitive->HasAlphaMask() && !primitive->IsMoving();
+    };
+    for( auto primitive : container->primitives ){
+        if( !packable( primitive ) )
+            m_leafPrimitives.push_back( primitive );
+    }
+    leaf.other_cnt = (unsigned)m_leafPrimitives.size() - leaf.pri_offset;
+    for( auto primitive : container->primitives ){
+        if( packable( primitive ) )
+            m_leafPrimitives.push_back( primitive );
+    }
 }
 
 bool OcTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     SORT_PROFILE("Traverse OcTree");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
 #endif
 
     r.Prepare();
@@ -153,14 +191,19 @@ bool OcTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverseOcTree( m_root.get() , r , &intersect , fmin , fmax );
+#ifdef AVX_ENABLED
+    if( m_simd )
+        return traverseOcTreeSimd( r , intersect , fmin );
+#endif
+
+    return traverseOcTree( m_nodes[0] , r , &intersect , fmin , fmax );
 }
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool OcTree::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse OcTree");
-    SORT_STATS(++sRayCount);
-    SORT_STATS(++sShadowRayCount);
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
 
     r.Prepare();
 
@@ -169,11 +212,16 @@ bool OcTree::IsOccluded( const Ray& r ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverseOcTree( m_root.get() , r , nullptr , fmin , fmax );
+#ifdef AVX_ENABLED
+    if( m_simd )
+        return occludeOcTreeSimd( r );
+#endif
+
+    return traverseOcTree( m_nodes[0] , r , nullptr , fmin , fmax );
 }
 #endif
 
-bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
+bool OcTree::traverseOcTree( const OcTreeNode& node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
     constexpr auto   delta = 0.001f;
     auto found = false;
 
@@ -184,42 +232,33 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
         return true;
 
     // Iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
-    if(IS_PTR_INVALID(node->child[0])){
-        for( auto primitive : node->primitives ){
-            SORT_STATS(++sIntersectionTest);
-            found |= primitive->GetIntersect( ray , intersect );
-
-            // a quick branching out if a shadow ray is hit by an opaque object
-            const auto is_shadow_ray_blocked = isShadowRay( intersect ) && found;
-            if( is_shadow_ray_blocked ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR );
-                sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                    // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                    // that the above level logic will take advantage of.
-                    intersect->primitive = nullptr;
-                }
-#endif
+    if( 0 == node.child_offset ){
+        for( auto i = node.pri_offset ; i < node.pri_offset + node.pri_cnt ; ++i ){
+            SORT_STATS_HOT(++sIntersectionTest);
+            found |= m_leafPrimitives[i]->GetIntersect( ray , intersect );
+
+            // a quick branching out if a shadow ray is hit by anything, opaque primitives are already reported
+            // with no primitive in the intersection
+            if( isShadowRay( intersect ) && found )
                 return true;
-            }
         }
         return found && ( intersect->t < ( fmax + delta ) && intersect->t > ( fmin - delta ) );
     }
 
     const auto contact = ray(fmin);
-    const auto center = ( node->bb.m_Max + node->bb.m_Min ) * 0.5f;
+    const auto center = ( node.bb.m_Max + node.bb.m_Min ) * 0.5f;
     auto node_index = ( contact.x > center.x ) + ( contact.y > center.y ) * 2 + ( contact.z > center.z ) * 4;
+    const auto children = &m_nodes[node.child_offset];
 
     auto            _curt = fmin;
     int             _dir[3];
     float           _delta[3],_next[3];
     for(auto i = 0 ; i < 3 ; i++ ){
         _dir[i] = ( ray.m_Dir[i] > 0.0f ) ? 1 : -1;
-        _delta[i] = ( ray.m_Dir[i] != 0.0f )?fabs( node->bb.Delta(i) / ray.m_Dir[i] ) * 0.5f : FLT_MAX;
+        _delta[i] = ( ray.m_Dir[i] != 0.0f )?fabs( node.bb.Delta(i) / ray.m_Dir[i] ) * 0.5f : FLT_MAX;
     }
     for(auto i = 0 ; i < 3 ; i++ ){
-        const auto target = node->child[node_index]->bb.m_Min[i] + ((_dir[i]+1)>>1) * node->bb.Delta(i) * 0.5f;
+        const auto target = children[node_index].bb.m_Min[i] + ((_dir[i]+1)>>1) * node.bb.Delta(i) * 0.5f;
         _next[i] = ( ray.m_Dir[i] == 0.0f )?FLT_MAX:( target - ray.m_Ori[i] ) / ray.m_Dir[i];
     }
 
@@ -230,7 +269,7 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
         nextAxis = (_next[nextAxis] <= _next[2]) ? nextAxis : 2;
 
         // check if there is intersection in the current grid
-        if( traverseOcTree( node->child[node_index].get() , ray , intersect , _curt , _next[nextAxis] ) )
+        if( traverseOcTree( children[node_index] , ray , intersect , _curt , _next[nextAxis] ) )
             return true;
 
         // get to the next node based on distance
@@ -252,7 +291,7 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
 
 void OcTree::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
     SORT_PROFILE("Traverse OcTree");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
     r.Prepare();
 
@@ -264,10 +303,10 @@ void OcTree::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const
     if( fmin < 0.0f )
         return;
 
-    traverseOcTree( m_root.get() , r , intersect , fmin , fmax , matID );
+    traverseOcTree( m_nodes[0] , r , intersect , fmin , fmax , matID );
 }
 
-void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
+void OcTree::traverseOcTree( const OcTreeNode& node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
     constexpr auto   delta = 0.001f;
 
     // early rejections
@@ -277,9 +316,10 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
         return;
 
     // iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
-    if(IS_PTR_INVALID(node->child[0])){
+    if( 0 == node.child_offset ){
         SurfaceInteraction intersection;
-        for( auto primitive : node->primitives ){
+        for( auto i = node.pri_offset ; i < node.pri_offset + node.pri_cnt ; ++i ){
+            const auto primitive = m_leafPrimitives[i];
             if( matID != primitive->GetMaterial()->GetUniqueID() )
                 continue;
             
@@ -294,7 +334,7 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
             if( checked )
                 continue;
 
-            SORT_STATS(++sIntersectionTest);
+            SORT_STATS_HOT(++sIntersectionTest);
         
             intersection.Reset();
             const auto intersected = primitive->GetIntersect( ray , &intersection );
@@ -324,18 +364,19 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
     }
 
     const auto contact = ray(fmin);
-    const auto center = ( node->bb.m_Max + node->bb.m_Min ) * 0.5f;
+    const auto center = ( node.bb.m_Max + node.bb.m_Min ) * 0.5f;
     auto node_index = ( contact.x > center.x ) + ( contact.y > center.y ) * 2 + ( contact.z > center.z ) * 4;
+    const auto children = &m_nodes[node.child_offset];
 
     auto            _curt = fmin;
     int             _dir[3];
     float           _delta[3],_next[3];
     for(auto i = 0 ; i < 3 ; i++ ){
         _dir[i] = ( ray.m_Dir[i] > 0.0f ) ? 1 : -1;
-        _delta[i] = ( ray.m_Dir[i] != 0.0f )?fabs( node->bb.Delta(i) / ray.m_Dir[i] ) * 0.5f : FLT_MAX;
+        _delta[i] = ( ray.m_Dir[i] != 0.0f )?fabs( node.bb.Delta(i) / ray.m_Dir[i] ) * 0.5f : FLT_MAX;
     }
     for(auto i = 0 ; i < 3 ; i++ ){
-        const auto target = node->child[node_index]->bb.m_Min[i] + ((_dir[i]+1)>>1) * node->bb.Delta(i) * 0.5f;
+        const auto target = children[node_index].bb.m_Min[i] + ((_dir[i]+1)>>1) * node.bb.Delta(i) * 0.5f;
         _next[i] = ( ray.m_Dir[i] == 0.0f )?FLT_MAX:( target - ray.m_Ori[i] ) / ray.m_Dir[i];
     }
 
@@ -346,7 +387,7 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
         nextAxis = (_next[nextAxis] <= _next[2]) ? nextAxis : 2;
 
         // check if there is intersection in the current grid
-        traverseOcTree( node->child[node_index].get() , ray , intersect , _curt , _next[nextAxis] , matID );
+        traverseOcTree( children[node_index] , ray , intersect , _curt , _next[nextAxis] , matID );
 
         // get to the next node based on distance
         node_index += ( 1 << nextAxis ) * _dir[nextAxis];
@@ -19,21 +19,37 @@
 
 #include "accelerator.h"
 
+// The stack of the SIMD traversal is on the stack of the thread, so the depth of the OcTree is limited.
+static constexpr unsigned OCTREE_MAX_DEPTH = 32;
+
 //! @brief OcTree
 /**
  * OcTree is a popular data structure in scene management, which is commonly seen in game engines.
  * Instead of scene visibility management, it can also serves for the purpose of accelerating ray
  * tracer applications.
+ * All nodes are saved in one contiguous array, the eight children of a node are next to each other so that they
+ * map to the eight lanes of AVX. If the CPU supports AVX, the boxes of all children are tested at once and the
+ * triangles of large leaves are packed in SIMD data structures, the same way OBVH does.
  */
 class OcTree : public Accelerator{
     //! @brief      OcTree node structure
     struct OcTreeNode{
-        /**< Child node pointers, all will be NULL if current node is a leaf.*/
-        std::unique_ptr<OcTreeNode>     child[8] = {nullptr};
-        /**< Primitives buffer.*/
-        std::vector<const Primitive*>   primitives;
         /**< Bounding box for this OcTree node.*/
-        BBox                            bb;
+        BBox        bb;
+        /**< Offset of the first of the eight children in the node array, 0 if current node is a leaf.*/
+        unsigned    child_offset = 0;
+        /**< Offset of primitives of the leaf in the primitive buffer.*/
+        unsigned    pri_offset = 0;
+        /**< Number of primitives in the leaf.*/
+        unsigned    pri_cnt = 0;
+        /**< Number of primitives in the leaf that are not packed in SIMD triangles, they are in front of the others.*/
+        unsigned    other_cnt = 0;
+        /**< Offset of the first SIMD triangle of the leaf.*/
+        unsigned    tri_offset = 0;
+        /**< Number of SIMD triangles of the leaf.*/
+        unsigned    tri_cnt = 0;
+        /**< The i-th bit indicates whether there is any primitive in the i-th child.*/
+        unsigned    child_mask = 0;
     };
 
 public:
@@ -79,6 +95,9 @@ public:
     //! @param  matID       We are only interested in intersection with the same material, whose material id should be set to matID.
     void GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const override;
     
+    //! @brief Release the OcTree.
+    ~OcTree() override;
+
     //! Build the OcTree in O(Nlg(N)) time.
     //!
     //! @param primitives       A vector holding all primitives.
@@ -108,29 +127,62 @@ public:
 	std::unique_ptr<Accelerator>	Clone() const override;
 
 private:
-    /**< Pointer to the root node of this OcTree.*/
-    std::unique_ptr<OcTreeNode> m_root = nullptr;
+    /**< All nodes of the OcTree, the first one is the root.*/
+    std::vector<OcTreeNode>         m_nodes;
+    /**< Primitives of all leaf nodes.*/
+    std::vector<const Primitive*>   m_leafPrimitives;
     /**< Maximum number of primitives allowed in a leaf node, 16 is the default value.*/
     unsigned    m_maxPriInLeaf = 16;
     /**< Maximum depth of the OcTree, 16 is the default value.*/
     unsigned    m_maxDepthInOcTree = 16;
 
+#ifdef AVX_ENABLED
+    /**< Data of the SIMD traversal, it is only defined in the source file compiled with AVX.*/
+    struct OcTreeSimdData;
+    /**< SIMD data, it is nullptr if the CPU doesn't support AVX.*/
+    OcTreeSimdData*     m_simd = nullptr;
+
+    //! @brief  Pack triangles of large leaves in SIMD data structures.
+    void packSimd();
+
+    //! @brief  Release the SIMD data.
+    void releaseSimd();
+
+    //! @brief  Traverse OcTree with the boxes of all eight children tested at once.
+    //!
+    //! @param ray          The input ray to be tested.
+    //! @param intersect    The intersection result.
+    //! @param fmin         Distance along the ray where it enters the OcTree.
+    //! @return             Whether the ray intersects anything in the primitive set.
+    bool traverseOcTreeSimd( const Ray& ray , SurfaceInteraction& intersect , float fmin ) const;
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief  Detect occlusion with the boxes of all eight children tested at once.
+    //!
+    //! @param ray          The ray to be tested.
+    //! @return             Whether the ray is occluded by anything.
+    bool occludeOcTreeSimd( const Ray& ray ) const;
+#endif
+#endif
+
     //! @brief  Split current node into eight if criteria is not met. Otherwise, it will make it a leaf.
     //!
     //! This function invokes itself recursively, so the whole sub-tree will be built
-    //! once it is called.
+    //! once it is called. Children are appended to the node array, so nodes are referred by their offsets.
     //!
-    //! @param node         Node to be slitted.
+    //! @param node         Offset of the node to be slitted.
     //! @param container    Container holding all primitive information in this node.
-    //! @param bb           Bounding box of this node.
     //! @param depth        Current depth of this node.
-    void splitNode( OcTreeNode* node , NodePrimitiveContainer* container , unsigned depth );
+    //! @param max_depth    Maximum depth of the OcTree.
+    void splitNode( unsigned node , NodePrimitiveContainer* container , unsigned depth , unsigned max_depth );
 
     //! @brief Making the current node as a leaf node.
-    //! An new index buffer will be allocated in this node.
-    //! @param node         Node to be made as a leaf node.
+    //!
+    //! Primitives that are not triangles are put in front of the triangles so that the triangles can be packed later.
+    //!
+    //! @param node         Offset of the node to be made as a leaf node.
     //! @param container    Container holding all primitive information in this node.
-    void makeLeaf( OcTreeNode* node , NodePrimitiveContainer* container );
+    void makeLeaf( unsigned node , NodePrimitiveContainer* container );
 
     //! @brief  Traverse OcTree recursively and return if there is intersection.
     //!
@@ -143,7 +195,7 @@ private:
     //! @param fmax         Current maximum value along the ray.
     //! @param matID        Material ID to avoid if it is not invalid.
     //! @return             Whether the ray intersects anything in the primitive set
-    bool traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceInteraction* intersect ,
+    bool traverseOcTree( const OcTreeNode& node , const Ray& ray , SurfaceInteraction* intersect ,
                          float fmin , float fmax ) const;
 
     //! @brief  Traverse OcTree recursively and return if there is intersection.
@@ -154,13 +206,8 @@ private:
     //! @param fmin         Current minimum value along the ray
     //! @param fmax         Current maximum value along the ray.
     //! @param matID        Material ID to avoid if it is not invalid.
-    void traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFIntersections& intersect ,
+    void traverseOcTree( const OcTreeNode& node , const Ray& ray , BSSRDFIntersections& intersect ,
                          float fmin , float fmax , const StringID matID ) const;
 
-    //! @brief  Release OcTree memory.
-    //!
-    //! @param node     Sub-tree belongs to this node will be released recursively.
-    void releaseOcTree( OcTreeNode* node );
-
     SORT_STATS_ENABLE( "Spatial-Structure(OcTree)" )
 };
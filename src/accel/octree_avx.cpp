@@ -0,0 +1,217 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "octree.h"
+
+#ifdef AVX_ENABLED
+
+#define SIMD_AVX_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+
+#include "core/primitive.h"
+#include "core/memory.h"
+#include "simd/simd_ray_utils.h"
+#include "simd/avx_bbox.h"
+#include "simd/avx_triangle.h"
+
+SORT_STATS_DECLARE_COUNTER(sIntersectionTest)
+
+// Leaves with fewer triangles than this are not packed, a mostly empty pack costs more than a few scalar tests.
+static constexpr unsigned OCTREE_SIMD_MIN_TRIANGLE_CNT = 3;
+
+// Size of the traversal stack, at most seven siblings are pushed on each level besides the one being visited.
+static constexpr unsigned OCTREE_STACK_SIZE = OCTREE_MAX_DEPTH * 7 + 1;
+
+// Offsets of the eight children of a node in units of half of the node, the i-th child is in the i-th lane.
+static const float OCTREE_CHILD_OFFSET_X[] = { 0.0f , 1.0f , 0.0f , 1.0f , 0.0f , 1.0f , 0.0f , 1.0f };
+static const float OCTREE_CHILD_OFFSET_Y[] = { 0.0f , 0.0f , 1.0f , 1.0f , 0.0f , 0.0f , 1.0f , 1.0f };
+static const float OCTREE_CHILD_OFFSET_Z[] = { 0.0f , 0.0f , 0.0f , 0.0f , 1.0f , 1.0f , 1.0f , 1.0f };
+
+struct OcTree::OcTreeSimdData{
+    /**< Triangles of large leaves packed in SIMD data structure.*/
+    LargePageVector<Simd_Triangle>  triangles;
+};
+
+//! @brief  Test the boxes of all eight children of a node at once.
+//!
+//! The boxes of children are not saved, they are derived from the box of the node since it is split evenly.
+//!
+//! @param node         The interior node whose children are tested.
+//! @param ray          The ray to be tested.
+//! @param simd_ray     The SIMD version of the ray.
+//! @param f_min        Distances along the ray where it enters the children.
+//! @return             The i-th bit indicates whether the ray hits the i-th child with any primitive in it.
+template<class Node>
+SORT_STATIC_FORCEINLINE int intersectChildren( const Node& node , const Ray& ray , const Simd_Ray_Data& simd_ray , simd_data& f_min ){
+    const auto half = ( node.bb.m_Max - node.bb.m_Min ) * 0.5f;
+
+    Simd_BBox bb;
+    bb.m_min_x = simd_mad_ps( simd_set_ps( OCTREE_CHILD_OFFSET_X ) , simd_set_ps1( half.x ) , simd_set_ps1( node.bb.m_Min.x ) );
+    bb.m_min_y = simd_mad_ps( simd_set_ps( OCTREE_CHILD_OFFSET_Y ) , simd_set_ps1( half.y ) , simd_set_ps1( node.bb.m_Min.y ) );
+    bb.m_min_z = simd_mad_ps( simd_set_ps( OCTREE_CHILD_OFFSET_Z ) , simd_set_ps1( half.z ) , simd_set_ps1( node.bb.m_Min.z ) );
+    bb.m_max_x = simd_add_ps( bb.m_min_x , simd_set_ps1( half.x ) );
+    bb.m_max_y = simd_add_ps( bb.m_min_y , simd_set_ps1( half.y ) );
+    bb.m_max_z = simd_add_ps( bb.m_min_z , simd_set_ps1( half.z ) );
+    bb.m_mask = simd_cmpeq_ps( simd_zeros , simd_zeros );
+
+    return IntersectBBox_SIMD( ray , simd_ray , bb , f_min ) & (int)node.child_mask;
+}
+
+void OcTree::packSimd(){
+    m_simd = new OcTreeSimdData();
+
+    for( auto& node : m_nodes ){
+        if( node.child_offset || node.pri_cnt - node.other_cnt < OCTREE_SIMD_MIN_TRIANGLE_CNT ){
+            node.other_cnt = node.pri_cnt;
+            continue;
+        }
+
+        node.tri_offset = (unsigned)m_simd->triangles.size();
+
+        Simd_Triangle simd_tri;
+        for( auto i = node.pri_offset + node.other_cnt ; i < node.pri_offset + node.pri_cnt ; ++i ){
+            if( simd_tri.PushTriangle( m_leafPrimitives[i] ) ){
+                if( simd_tri.PackData() ){
+                    m_simd->triangles.push_back( simd_tri );
+                    simd_tri.Reset();
+                }
+            }
+        }
+        if( simd_tri.PackData() )
+            m_simd->triangles.push_back( simd_tri );
+
+        node.tri_cnt = (unsigned)m_simd->triangles.size() - node.tri_offset;
+    }
+}
+
+void OcTree::releaseSimd(){
+    delete m_simd;
+    m_simd = nullptr;
+}
+
+bool OcTree::traverseOcTreeSimd( const Ray& ray , SurfaceInteraction& intersect , float fmin ) const{
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( ray , simd_ray );
+
+    std::pair<unsigned, float> stack[OCTREE_STACK_SIZE];
+    auto si = 0;
+    stack[si++] = std::make_pair( 0u , fmin );
+
+    while( si > 0 ){
+        const auto top = stack[--si];
+        if( intersect.t < top.second )
+            continue;
+
+        const auto& node = m_nodes[top.first];
+        if( 0 == node.child_offset ){
+            // primitives span across leaves, the ones hit outside the leaf are not necessarily the closest, unlike
+            // the scalar traversal, the search goes on until no leaf is closer than the intersection.
+            for( auto i = node.pri_offset ; i < node.pri_offset + node.other_cnt ; ++i ){
+                SORT_STATS_HOT(++sIntersectionTest);
+                const auto blocked = m_leafPrimitives[i]->GetIntersect( ray , &intersect );
+
+                // opaque primitives blocking a shadow ray are already reported with no primitive in the intersection
+                if( isShadowRay( &intersect ) && blocked && IS_PTR_INVALID(intersect.primitive) )
+                    return true;
+            }
+            for( auto i = 0u ; i < node.tri_cnt ; ++i ){
+                SORT_STATS_HOT(sIntersectionTest += SIMD_CHANNEL);
+                const auto blocked = intersectTriangle_SIMD( ray , simd_ray , m_simd->triangles[node.tri_offset + i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                // only the nearest of the triangles in the pack is checked, the same as OBVH does.
+                if( intersect.query_shadow && blocked && intersect.primitive->IsOpaque() ){
+                    intersect.occluder = intersect.primitive;
+                    intersect.primitive = nullptr;
+                    return true;
+                }
+#else
+                (void)blocked;
+#endif
+            }
+            continue;
+        }
+
+        simd_data f_min;
+        auto m = intersectChildren( node , ray , simd_ray , f_min );
+        if( 0 == m )
+            continue;
+
+        // children are pushed from the farthest to the closest so that the closest is visited first.
+        std::pair<unsigned, float> hits[8];
+        auto hit_cnt = 0;
+        while( m ){
+            const auto k = __bsf( m );
+            m &= m - 1;
+
+            auto j = hit_cnt++;
+            const auto t = f_min[k];
+            while( j > 0 && hits[j - 1].second < t ){
+                hits[j] = hits[j - 1];
+                --j;
+            }
+            hits[j] = std::make_pair( node.child_offset + k , t );
+        }
+        for( auto i = 0 ; i < hit_cnt ; ++i )
+            stack[si++] = hits[i];
+    }
+
+    return intersect.primitive;
+}
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+bool OcTree::occludeOcTreeSimd( const Ray& ray ) const{
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( ray , simd_ray );
+
+    unsigned stack[OCTREE_STACK_SIZE];
+    auto si = 0;
+    stack[si++] = 0u;
+
+    while( si > 0 ){
+        const auto& node = m_nodes[stack[--si]];
+        if( 0 == node.child_offset ){
+            for( auto i = node.pri_offset ; i < node.pri_offset + node.other_cnt ; ++i ){
+                SORT_STATS_HOT(++sIntersectionTest);
+                if( m_leafPrimitives[i]->GetIntersect( ray , nullptr ) )
+                    return true;
+            }
+            for( auto i = 0u ; i < node.tri_cnt ; ++i ){
+                SORT_STATS_HOT(sIntersectionTest += SIMD_CHANNEL);
+                if( intersectTriangleFast_SIMD( ray , simd_ray , m_simd->triangles[node.tri_offset + i] ) )
+                    return true;
+            }
+            continue;
+        }
+
+        // the order doesn't matter since any occluder stops the search
+        simd_data f_min;
+        auto m = intersectChildren( node , ray , simd_ray , f_min );
+        while( m ){
+            stack[si++] = node.child_offset + __bsf( m );
+            m &= m - 1;
+        }
+    }
+
+    return false;
+}
+#endif
+
+#undef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_AVX_IMPLEMENTATION
+
+#endif
@@ -21,14 +21,14 @@
 #define Fbvh        Qbvh
 #define Fbvh_Node   Qbvh_Node
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #define SIMD_SSE_IMPLEMENTATION
 #define SIMD_BVH_IMPLEMENTATION
 #endif
 
 #include "fast_bvh.hpp"
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #undef SIMD_BVH_IMPLEMENTATION
 #undef SIMD_SSE_IMPLEMENTATION
 #endif
@@ -23,7 +23,7 @@
 #define Fbvh        Qbvh
 #define Fbvh_Node   Qbvh_Node
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #define SIMD_SSE_IMPLEMENTATION
 #define SIMD_BVH_IMPLEMENTATION
 #endif
@@ -32,9 +32,10 @@
 #include "simd/sse_bbox.h"
 #include "simd/sse_triangle.h"
 #include "simd/sse_line.h"
+#include "simd/sse_shape.h"
 #include "fast_bvh.h"
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #undef SIMD_BVH_IMPLEMENTATION
 #undef SIMD_SSE_IMPLEMENTATION
 #endif
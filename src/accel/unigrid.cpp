@@ -25,6 +25,8 @@
 #include "core/memory.h"
 
 SORT_STATS_DEFINE_COUNTER(sUGGridCount)
+SORT_STATS_DEFINE_COUNTER(sUGLeafCount)
+SORT_STATS_DEFINE_COUNTER(sUGReferenceCount)
 SORT_STATS_DEFINE_COUNTER(sUniformGridX)
 SORT_STATS_DEFINE_COUNTER(sUniformGridY)
 SORT_STATS_DEFINE_COUNTER(sUniformGridZ)
@@ -33,11 +35,162 @@ SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Total Ray Count", sRayCoun
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Shadow Ray Count", sShadowRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Intersection Test", sIntersectionTest );
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Grid Count", sUGGridCount);
+SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Leaf Cell Count", sUGLeafCount);
+SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Primitive Reference Count", sUGReferenceCount);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension X", sUniformGridX);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension Y", sUniformGridY);
 SORT_STATS_COUNTER("Spatial-Structure(UniformGrid)", "Dimension Z", sUniformGridZ);
 SORT_STATS_AVG_COUNT("Spatial-Structure(UniformGrid)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
 
+// Expected number of top level cells per primitive.
+static constexpr float      UNIGRID_TOP_DENSITY     = 1.0f;
+// Expected number of leaf cells per primitive reference in a top level cell.
+static constexpr float      UNIGRID_LEAF_DENSITY    = 8.0f;
+// Maximum resolution of the top level grid along each axis.
+static constexpr unsigned   UNIGRID_MAX_TOP_RES     = 128;
+// Maximum resolution of a sub-grid along each axis, it has to fit in an unsigned char.
+static constexpr unsigned   UNIGRID_MAX_LEAF_RES    = 64;
+
+//! @brief Evaluate the resolution of a grid so that the cells are roughly cubes.
+//!
+//! @param extent       Extent of the grid along each axis.
+//! @param cellCnt      Expected number of cells in the grid.
+//! @param maxRes       Maximum resolution along each axis.
+//! @param res          Resolution of the grid along each axis.
+SORT_STATIC_FORCEINLINE void gridResolution( const Vector& extent , const float cellCnt , const unsigned maxRes , unsigned res[3] ){
+    // axes too thin to be split are left out, so that the cells are still roughly cubes in flat grids
+    bool thin[3] = { !( extent[0] > 0.0f ) , !( extent[1] > 0.0f ) , !( extent[2] > 0.0f ) };
+    auto cellPerDistance = 0.0f;
+    for( auto iteration = 0 ; iteration < 3 ; ++iteration ){
+        auto volume = 1.0f;
+        auto dims = 0;
+        for( auto i = 0 ; i < 3 ; ++i ){
+            if( thin[i] )
+                continue;
+            volume *= extent[i];
+            ++dims;
+        }
+        if( 0 == dims )
+            break;
+
+        cellPerDistance = powf( cellCnt / volume , 1.0f / (float)dims );
+
+        auto changed = false;
+        for( auto i = 0 ; i < 3 ; ++i ){
+            if( !thin[i] && extent[i] * cellPerDistance < 1.0f ){
+                thin[i] = true;
+                changed = true;
+            }
+        }
+        if( !changed )
+            break;
+    }
+
+    for( auto i = 0 ; i < 3 ; ++i )
+        res[i] = thin[i] ? 1u : std::max( 1u , std::min( maxRes , (unsigned)ceilf( extent[i] * cellPerDistance ) ) );
+}
+
+//! @brief Sort primitive references by their cells.
+//!
+//! @param refs         Pairs of cell index and primitive.
+//! @param cellCnt      Number of cells.
+//! @param offsets      Offset of the first primitive of each cell, there is one more at the end.
+//! @param primitives   Primitives sorted by their cells.
+static void sortReferences( const std::vector<std::pair<unsigned, const Primitive*>>& refs , const unsigned cellCnt ,
+                            std::vector<unsigned>& offsets , std::vector<const Primitive*>& primitives ){
+    offsets.assign( cellCnt + 1 , 0 );
+    for( const auto& ref : refs )
+        ++offsets[ref.first + 1];
+    for( auto i = 0u ; i < cellCnt ; ++i )
+        offsets[i + 1] += offsets[i];
+
+    std::vector<unsigned> cursor( offsets.begin() , offsets.end() - 1 );
+    primitives.resize( refs.size() );
+    for( const auto& ref : refs )
+        primitives[cursor[ref.first]++] = ref.second;
+}
+
+//! @brief Clip a ray segment by a bounding box.
+//!
+//! @param r            The ray to be clipped.
+//! @param bb           The bounding box.
+//! @param t0           Start of the ray segment, it is updated with the clipped one.
+//! @param t1           End of the ray segment, it is updated with the clipped one.
+//! @return             Whether there is anything left in the segment.
+SORT_STATIC_FORCEINLINE bool clipRay( const Ray& r , const BBox& bb , float& t0 , float& t1 ){
+    for( auto i = 0 ; i < 3 ; ++i ){
+        if( r.m_Dir[i] == 0.0f ){
+            if( r.m_Ori[i] < bb.m_Min[i] || r.m_Ori[i] > bb.m_Max[i] )
+                return false;
+            continue;
+        }
+        const auto inv = 1.0f / r.m_Dir[i];
+        auto tn = ( bb.m_Min[i] - r.m_Ori[i] ) * inv;
+        auto tf = ( bb.m_Max[i] - r.m_Ori[i] ) * inv;
+        if( tn > tf )
+            std::swap( tn , tf );
+        t0 = std::max( t0 , tn );
+        t1 = std::min( t1 , tf );
+    }
+    return t0 <= t1;
+}
+
+//! @brief State of 3D-DDA of a ray in a grid.
+struct GridDDA{
+    int     cell[3];        /**< Current cell along each axis. */
+    int     step[3];        /**< Step of cell id along each axis. */
+    int     out[3];         /**< Cell id along each axis where the ray leaves the grid. */
+    float   next[3];        /**< Distance where the ray enters the next cell along each axis. */
+    float   delta[3];       /**< Distance between two cell boundaries along each axis. */
+
+    //! @brief Set up the DDA from a point on the ray.
+    //!
+    //! @param r            The ray to traverse.
+    //! @param t            Distance of the starting point on the ray.
+    //! @param origin       The min corner of the grid.
+    //! @param extent       Extent of one cell along each axis.
+    //! @param invExtent    Inverse of extent of one cell along each axis.
+    //! @param res          Resolution of the grid along each axis.
+    SORT_FORCEINLINE GridDDA( const Ray& r , const float t , const Point& origin , const Vector& extent , const Vector& invExtent , const unsigned res[3] ){
+        const auto p = r( t );
+        for( auto i = 0 ; i < 3 ; ++i ){
+            cell[i] = std::max( 0 , std::min( (int)res[i] - 1 , (int)( ( p[i] - origin[i] ) * invExtent[i] ) ) );
+            if( r.m_Dir[i] > 0.0f ){
+                step[i] = 1;
+                out[i] = (int)res[i];
+            }else{
+                step[i] = -1;
+                out[i] = -1;
+            }
+            if( r.m_Dir[i] != 0.0f ){
+                const auto target = origin[i] + ( cell[i] + ( ( step[i] + 1 ) >> 1 ) ) * extent[i];
+                next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
+                delta[i] = fabs( extent[i] / r.m_Dir[i] );
+            }else{
+                next[i] = FLT_MAX;
+                delta[i] = FLT_MAX;
+            }
+        }
+    }
+
+    //! @brief The axis along which the ray leaves the current cell.
+    SORT_FORCEINLINE unsigned Axis() const{
+        static const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
+        return idArray[(next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4];
+    }
+
+    //! @brief Step to the next cell along an axis.
+    //!
+    //! @return     Whether the ray is still inside the grid.
+    SORT_FORCEINLINE bool Step( const unsigned axis ){
+        cell[axis] += step[axis];
+        if( cell[axis] == out[axis] )
+            return false;
+        next[axis] += delta[axis];
+        return true;
+    }
+};
+
 void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ){
     SORT_PROFILE("Build Uniform Grid");
 
@@ -47,30 +200,27 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
 
     m_bbox = bbox;
 
-    // get the maximum extent id and distance
-    auto id = m_bbox.MaxAxisId();
-    auto delta = m_bbox.m_Max - m_bbox.m_Min;
-    auto extent = delta[id];
-
-    // get the total number of primitives
-    auto count = (unsigned)m_primitives->size();
-
-    // grid per distance
-    auto gridPerDistance = 3 * powf( (float)count , 0.333f ) / extent ;
+    // flat scenes would have infinitely thin voxels, the grid is inflated a bit along such axes
+    const auto padding = std::max( 0.0001f , ( m_bbox.m_Max - m_bbox.m_Min ).Length() * 0.0001f );
+    for( auto i = 0 ; i < 3 ; ++i ){
+        if( m_bbox.m_Max[i] - m_bbox.m_Min[i] < padding ){
+            m_bbox.m_Min[i] -= padding;
+            m_bbox.m_Max[i] += padding;
+        }
+    }
+    const auto delta = m_bbox.m_Max - m_bbox.m_Min;
 
-    // the grid size
+    // the resolution of the top level grid only depends on the number of primitives
+    gridResolution( delta , (float)m_primitives->size() * UNIGRID_TOP_DENSITY , UNIGRID_MAX_TOP_RES , m_voxelNum );
     for(auto i = 0 ; i < 3 ; i++ ){
-        m_voxelNum[i] = (unsigned)(std::min( 256.0f , gridPerDistance * delta[i] ));
         m_voxelInvExtent[i] = m_voxelNum[i] / delta[i];
         m_voxelExtent[i] = 1.0f / m_voxelInvExtent[i];
     }
-
     m_voxelCount = m_voxelNum[0] * m_voxelNum[1] * m_voxelNum[2];
 
-    // allocate the memory
-    m_voxels.resize( m_voxelCount );
-
-    // distribute the primitives
+    // distribute the primitives in the top level grid
+    std::vector<std::pair<unsigned, const Primitive*>> refs;
+    refs.reserve( m_primitives->size() );
     for( auto& primitive : *m_primitives ){
         unsigned maxGridId[3];
         unsigned minGridId[3];
@@ -79,6 +229,8 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
             maxGridId[i] = point2VoxelId(primitive->GetBBox().m_Max , i );
         }
 
+        // there is no need to test the primitive if it is only in one voxel
+        const auto single = minGridId[0] == maxGridId[0] && minGridId[1] == maxGridId[1] && minGridId[2] == maxGridId[2];
         for(auto i = minGridId[2] ; i <= maxGridId[2] ; i++ )
             for(auto j = minGridId[1] ; j <= maxGridId[1] ; j++ )
                 for(auto k = minGridId[0] ; k <= maxGridId[0] ; k++ ){
@@ -87,21 +239,102 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
                     bb.m_Max = bb.m_Min + m_voxelExtent;
 
                     // only add the primitives if it is actually intersected
-                    if( primitive->GetIntersect( bb ) )
-                        m_voxels[offset( k , j , i )].push_back(primitive);
+                    if( single || primitive->GetIntersect( bb ) )
+                        refs.push_back( std::make_pair( offset( k , j , i ) , primitive ) );
                 }
     }
 
+    std::vector<unsigned> topOffsets;
+    std::vector<const Primitive*> topPrimitives;
+    sortReferences( refs , m_voxelCount , topOffsets , topPrimitives );
+
+    // resolution of each sub-grid depends on the number of primitives in the top level voxel
+    m_topCells.clear();
+    m_topCells.resize( m_voxelCount );
+    auto leafCnt = 0u;
+    for( auto i = 0u ; i < m_voxelCount ; ++i ){
+        const auto cnt = topOffsets[i + 1] - topOffsets[i];
+        if( 0 == cnt )
+            continue;
+
+        // the sub-grid only covers the primitives in the voxel, it is slightly inflated to avoid precision issues
+        const auto z = i / ( m_voxelNum[0] * m_voxelNum[1] ) , y = ( i / m_voxelNum[0] ) % m_voxelNum[1] , x = i % m_voxelNum[0];
+        const auto voxelMin = m_bbox.m_Min + Vector( (float)x , (float)y , (float)z ) * m_voxelExtent;
+        const auto voxelMax = voxelMin + m_voxelExtent;
+        auto& cell = m_topCells[i];
+        for( auto p = topOffsets[i] ; p < topOffsets[i + 1] ; ++p )
+            cell.bounds.Union( topPrimitives[p]->GetBBox() );
+        for( auto j = 0 ; j < 3 ; ++j ){
+            const auto margin = m_voxelExtent[j] * 0.001f;
+            cell.bounds.m_Min[j] = std::max( cell.bounds.m_Min[j] , voxelMin[j] ) - margin;
+            cell.bounds.m_Max[j] = std::min( cell.bounds.m_Max[j] , voxelMax[j] ) + margin;
+        }
+
+        unsigned res[3];
+        gridResolution( cell.bounds.m_Max - cell.bounds.m_Min , (float)cnt * UNIGRID_LEAF_DENSITY , UNIGRID_MAX_LEAF_RES , res );
+
+        cell.leafOffset = leafCnt;
+        for( auto j = 0 ; j < 3 ; ++j )
+            cell.resolution[j] = (unsigned char)res[j];
+        leafCnt += res[0] * res[1] * res[2];
+    }
+
+    // distribute the primitives in the sub-grids
+    refs.clear();
+    for( auto z = 0u ; z < m_voxelNum[2] ; ++z )
+        for( auto y = 0u ; y < m_voxelNum[1] ; ++y )
+            for( auto x = 0u ; x < m_voxelNum[0] ; ++x ){
+                const auto id = offset( x , y , z );
+                const auto& cell = m_topCells[id];
+                if( 0 == cell.resolution[0] )
+                    continue;
+
+                const unsigned res[3] = { cell.resolution[0] , cell.resolution[1] , cell.resolution[2] };
+                const auto& origin = cell.bounds.m_Min;
+                const auto extent = ( cell.bounds.m_Max - cell.bounds.m_Min ) / Vector( (float)res[0] , (float)res[1] , (float)res[2] );
+                const auto leafId = [&]( const Point& p , const unsigned axis ){
+                    const auto id = (int)( ( p[axis] - origin[axis] ) / extent[axis] );
+                    return (unsigned)std::max( 0 , std::min( (int)res[axis] - 1 , id ) );
+                };
+
+                for( auto p = topOffsets[id] ; p < topOffsets[id + 1] ; ++p ){
+                    const auto primitive = topPrimitives[p];
+                    unsigned maxLeafId[3];
+                    unsigned minLeafId[3];
+                    for( auto i = 0u ; i < 3 ; ++i ){
+                        minLeafId[i] = leafId( primitive->GetBBox().m_Min , i );
+                        maxLeafId[i] = leafId( primitive->GetBBox().m_Max , i );
+                    }
+
+                    // the primitive is known to overlap the top level voxel already, which is covered by the sub-grid
+                    const auto single = minLeafId[0] == maxLeafId[0] && minLeafId[1] == maxLeafId[1] && minLeafId[2] == maxLeafId[2];
+                    for( auto i = minLeafId[2] ; i <= maxLeafId[2] ; ++i )
+                        for( auto j = minLeafId[1] ; j <= maxLeafId[1] ; ++j )
+                            for( auto k = minLeafId[0] ; k <= maxLeafId[0] ; ++k ){
+                                BBox bb;
+                                bb.m_Min = origin + Vector( (float)k , (float)j , (float)i ) * extent;
+                                bb.m_Max = bb.m_Min + extent;
+
+                                if( single || primitive->GetIntersect( bb ) )
+                                    refs.push_back( std::make_pair( cell.leafOffset + ( i * res[1] + j ) * res[0] + k , primitive ) );
+                            }
+                }
+            }
+
+    sortReferences( refs , leafCnt , m_leafCells , m_cellPrimitives );
+
     m_isValid = true;
 
     SORT_STATS(sUniformGridX = m_voxelNum[0]);
     SORT_STATS(sUniformGridY = m_voxelNum[1]);
     SORT_STATS(sUniformGridZ = m_voxelNum[2]);
     SORT_STATS(sUGGridCount = m_voxelCount);
+    SORT_STATS(sUGLeafCount = leafCnt);
+    SORT_STATS(sUGReferenceCount = (StatsInt)m_cellPrimitives.size());
 }
 
 unsigned UniGrid::point2VoxelId( const Point& p , unsigned axis ) const{
-    return std::min( m_voxelNum[axis] - 1 , (unsigned)( ( p[axis] - m_bbox.m_Min[axis] ) * m_voxelInvExtent[axis] ) );
+    return std::min( m_voxelNum[axis] - 1 , (unsigned)std::max( 0.0f , ( p[axis] - m_bbox.m_Min[axis] ) * m_voxelInvExtent[axis] ) );
 }
 
 // get the id offset
@@ -109,24 +342,56 @@ unsigned UniGrid::offset( unsigned x , unsigned y , unsigned z ) const{
     return z * m_voxelNum[1] * m_voxelNum[0] + y * m_voxelNum[0] + x;
 }
 
+template<class Visitor>
+void UniGrid::traverse( const Ray& r , float t , const float& maxT , Visitor& visitor ) const{
+    GridDDA top( r , t , m_bbox.m_Min , m_voxelExtent , m_voxelInvExtent , m_voxelNum );
+    while( t < maxT ){
+        const auto axis = top.Axis();
+        const auto exitT = top.next[axis];
+
+        // empty top level voxels are skipped without touching any sub-grid
+        const auto& cell = m_topCells[offset( top.cell[0] , top.cell[1] , top.cell[2] )];
+        auto leafT = t , subExitT = std::min( exitT , maxT );
+        if( cell.resolution[0] && clipRay( r , cell.bounds , leafT , subExitT ) ){
+            const unsigned res[3] = { cell.resolution[0] , cell.resolution[1] , cell.resolution[2] };
+            const auto extent = ( cell.bounds.m_Max - cell.bounds.m_Min ) / Vector( (float)res[0] , (float)res[1] , (float)res[2] );
+            const auto invExtent = Vector( (float)res[0] , (float)res[1] , (float)res[2] ) / ( cell.bounds.m_Max - cell.bounds.m_Min );
+
+            GridDDA leaf( r , leafT , cell.bounds.m_Min , extent , invExtent , res );
+            while( leafT < maxT ){
+                const auto leafAxis = leaf.Axis();
+                const auto leafExitT = std::min( leaf.next[leafAxis] , subExitT );
+
+                const auto id = cell.leafOffset + ( leaf.cell[2] * res[1] + leaf.cell[1] ) * res[0] + leaf.cell[0];
+                sAssertMsg( id + 1 < m_leafCells.size() , SPATIAL_ACCELERATOR , "Invalid voxel id." );
+
+                const auto begin = m_leafCells[id] , end = m_leafCells[id + 1];
+                if( begin != end && visitor( m_cellPrimitives.data() + begin , m_cellPrimitives.data() + end , leafExitT ) )
+                    return;
+
+                if( leafExitT >= subExitT || !leaf.Step( leafAxis ) )
+                    break;
+                leafT = leafExitT;
+            }
+        }
+
+        // get to the next voxel
+        if( !top.Step( axis ) )
+            return;
+        t = exitT;
+    }
+}
+
 bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     SORT_PROFILE("Traverse Uniform Grid");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+    SORT_STATS_HOT(sShadowRayCount += intersect.query_shadow);
 #endif
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
     // get the intersect point
     float maxt;
     auto cur_t = Intersect( r , m_bbox , &maxt );
@@ -134,222 +399,85 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
         return false;
     intersect.t = std::min( intersect.t , maxt );
 
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( cur_t < intersect.t ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
-
-        // check if there is intersection in the current grid
-        if( traverse( r , &intersect , voxelId , next[nextAxis] ) )
-            return true;
-
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
-
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            return intersect.t < maxt && intersect.primitive;
+    auto occluded = false;
+    auto visitor = [&]( const Primitive* const* begin , const Primitive* const* end , const float exitT ){
+        auto inter = false;
+        for( auto primitive = begin ; primitive != end ; ++primitive ){
+            SORT_STATS_HOT(++sIntersectionTest);
+            // get intersection
+            inter |= (*primitive)->GetIntersect( r , &intersect );
+
+            // a quick branching out if a shadow ray is hit by anything, opaque primitives are already reported
+            // with no primitive in the intersection
+            if( isShadowRay( &intersect ) && inter ){
+                occluded = true;
+                return true;
+            }
+        }
+        return inter && ( intersect.t < exitT + 0.00001f );
+    };
+    traverse( r , cur_t , intersect.t , visitor );
 
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
-    return intersect.t < maxt && IS_PTR_VALID(intersect.primitive);
+    return occluded || ( intersect.t < maxt && IS_PTR_VALID(intersect.primitive) );
 }
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool UniGrid::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse Uniform Grid");
-    SORT_STATS(++sRayCount);
-    SORT_STATS(++sShadowRayCount);
+    SORT_STATS_HOT(++sRayCount);
+    SORT_STATS_HOT(++sShadowRayCount);
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
     // get the intersect point
     float maxt;
     auto cur_t = Intersect( r , m_bbox , &maxt );
     if( cur_t < 0.0f )
         return false;
 
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( true ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
-
-        // check if there is intersection in the current grid
-        if( traverse( r , nullptr , voxelId , next[nextAxis] ) )
-            return true;
-
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
-
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            break;
-
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
-
-    return false;
-}
-#endif
-
-bool UniGrid::traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const{
-    sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
-
-    auto inter = false;
-    for( auto voxel : m_voxels[voxelId] ){
-        SORT_STATS(++sIntersectionTest);
-        // get intersection
-        inter |= voxel->GetIntersect( r , intersect );
-
-        // a quick branching out if a shadow ray is hit by an opaque object
-        const auto is_shadow_ray_blocked = isShadowRay( intersect ) && inter;
-        if( is_shadow_ray_blocked ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-            sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR );
-            sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-            if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                // that the above level logic will take advantage of.
-                intersect->primitive = nullptr;
+    auto occluded = false;
+    auto visitor = [&]( const Primitive* const* begin , const Primitive* const* end , const float exitT ){
+        for( auto primitive = begin ; primitive != end ; ++primitive ){
+            SORT_STATS_HOT(++sIntersectionTest);
+            if( (*primitive)->GetIntersect( r , nullptr ) ){
+                occluded = true;
+                return true;
             }
-#endif
-            return true;
         }
-    }
+        return false;
+    };
+    traverse( r , cur_t , maxt , visitor );
 
-    return inter && ( intersect->t < nextT + 0.00001f );
+    return occluded;
 }
+#endif
 
 void UniGrid::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
     SORT_PROFILE("Traverse Uniform Grid");
-    SORT_STATS(++sRayCount);
+    SORT_STATS_HOT(++sRayCount);
 
     r.Prepare();
 
     intersect.cnt = 0;
     intersect.maxt = FLT_MAX;
 
-    static const auto voxelId2Point = [&]( int id[3] ){
-        Point p;
-        p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
-        p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
-        p.z = m_bbox.m_Min.z + id[2] * m_voxelExtent[2];
-        return p;
-    };
-
     // get the intersect point
     float maxt;
     auto cur_t = Intersect( r , m_bbox , &maxt );
     if( cur_t < 0.0f )
         return;
 
-    int     curGrid[3] , dir[3];
-    float   delta[3] , next[3];
-    for(auto i = 0 ; i < 3 ; i++ ){
-        curGrid[i] = point2VoxelId( r(cur_t) , i );
-        dir[i] = ( r.m_Dir[i] > 0.0f ) ? 1 : -1;
-        if( r.m_Dir[i] != 0.0f )
-            delta[i] = fabs( m_voxelExtent[i] / r.m_Dir[i] );
-        else
-            delta[i] = FLT_MAX;
-    }
-    Point gridCorner = voxelId2Point( curGrid );
-    for(auto i = 0 ; i < 3 ; i++ ){
-        // get the next t
-        auto target = gridCorner[i] + ((dir[i]+1)>>1) * m_voxelExtent[i];
-        next[i] = ( target - r.m_Ori[i] ) / r.m_Dir[i];
-        if( r.m_Dir[i] == 0.0f )
-            next[i] = FLT_MAX;
-    }
-
-    // traverse the uniform grid
-    const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
-    while( cur_t < intersect.maxt ){
-        // current voxel id
-        auto voxelId = offset( curGrid[0] , curGrid[1] , curGrid[2] );
-
-        // get the next t
-        auto nextAxis = (next[0] <= next[1])+((unsigned)(next[1] <= next[2]))*2+((unsigned)(next[2] <= next[0]))*4;
-        nextAxis = idArray[nextAxis];
-
-        // check if there is intersection in the current grid
-        traverse( r , intersect , voxelId , next[nextAxis] , matID );
-
-        // get to the next voxel
-        curGrid[nextAxis] += dir[nextAxis];
-
-        if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            return;
-
-        // update next
-        cur_t = next[nextAxis];
-        next[nextAxis] += delta[nextAxis];
-    }
+    auto visitor = [&]( const Primitive* const* begin , const Primitive* const* end , const float exitT ){
+        traverse( r , intersect , begin , end , matID );
+        return false;
+    };
+    traverse( r , cur_t , intersect.maxt , visitor );
 }
 
-void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , unsigned voxelId , float nextT , const StringID matID ) const{
-    sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
-
+void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , const Primitive* const* begin , const Primitive* const* end , const StringID matID ) const{
     SurfaceInteraction intersection;
-    for( auto primitive : m_voxels[voxelId] ){
+    for( auto it = begin ; it != end ; ++it ){
+        const auto primitive = *it;
         if( matID != primitive->GetMaterial()->GetUniqueID() )
             continue;
 
@@ -364,7 +492,7 @@ void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , unsign
         if( checked )
             continue;
 
-        SORT_STATS(++sIntersectionTest);
+        SORT_STATS_HOT(++sIntersectionTest);
 
         intersection.Reset();
         const auto intersected = primitive->GetIntersect( ray , &intersection );
@@ -25,6 +25,14 @@
  * Unlike other complex data structure, like KD-Tree, uniform grid takes linear
  * time complexity to build. However the traversal efficiency may be lower than
  * its peers.
+ * A single global resolution doesn't work well for scenes with uneven primitive
+ * density, a small detailed object in a large scene either consumes a lot of
+ * memory or ends up in a few voxels. To avoid it, this is a two-level grid, each
+ * cell of a coarse top level grid holds a sub-grid whose resolution depends on
+ * the number of primitives in it, this is described in this paper
+ * <a href="https://graphics.cg.uni-saarland.de/fileadmin/cguds/papers/2011/kalojanov_hpg2011/kalojanov_hpg2011.pdf">
+ * Two-Level Grids for Ray Tracing on GPUs</a>.
+ * Primitives of all leaf cells are stored in one compact array.
  */
 class UniGrid : public Accelerator{
 public:
@@ -93,16 +101,33 @@ public:
 	std::unique_ptr<Accelerator>	Clone() const override;
 
 private:
-    /**< Total number of voxels. */
+    //! @brief  A cell of the top level grid.
+    //!
+    //! The sub-grid only covers the primitives inside the cell instead of the whole cell, so that a small and
+    //! detailed object doesn't end up in a few huge leaf cells.
+    struct TopCell{
+        /**< Bounding box of the sub-grid, it is the bounding box of primitives clipped by the cell. */
+        BBox            bounds;
+        /**< Index of the first leaf cell of the sub-grid. */
+        unsigned        leafOffset = 0;
+        /**< Resolution of the sub-grid along each axis, it is zero if there is no primitive in the cell. */
+        unsigned char   resolution[3] = {};
+    };
+
+    /**< Total number of voxels in the top level grid. */
     unsigned                                    m_voxelCount = 0;
-    /**< Number of voxels along each axis. */
+    /**< Number of voxels along each axis in the top level grid. */
     unsigned                                    m_voxelNum[3] = {};
-    /**< Extent of one voxel along each axis. */
+    /**< Extent of one voxel along each axis in the top level grid. */
     Vector                                      m_voxelExtent;
-    /**< Inverse of extent of one voxel along each axis. */
+    /**< Inverse of extent of one voxel along each axis in the top level grid. */
     Vector                                      m_voxelInvExtent;
-    /**< Vector holding all voxels. */
-    std::vector<std::vector<const Primitive*>>  m_voxels;
+    /**< Cells of the top level grid. */
+    std::vector<TopCell>                        m_topCells;
+    /**< Offset of the first primitive of each leaf cell in m_cellPrimitives, there is one more at the end. */
+    std::vector<unsigned>                       m_leafCells;
+    /**< Primitives of all leaf cells. */
+    std::vector<const Primitive*>               m_cellPrimitives;
 
     //! @brief      Locate the id of the voxel that the point belongs to along a specific axis.
     //!
@@ -118,25 +143,23 @@ private:
     //! @return         ID of the voxel in one single dimension.
     unsigned offset( unsigned x , unsigned y , unsigned z ) const;
 
-    //! @brief      Get the nearest intersection between a ray and the primitive set.
-    //! @param r            The ray to be tested.
-    //! @param intersect    A pointer to the intersection information. If it is empty, it will return
-    //!                     true as long as there is an intersection detected, which is not necessarily
-    //!                     the nearest one.
-    //! @param voxelId      ID of the voxel to be tested.
-    //! @param nextT        The intersected position of the ray and the next to-be-traversed voxel along
-    //!                     the ray.
-    //! @return             It will return true if there is an intersection, otherwise it returns false.
-    bool traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const;
-
-    //! @brief      Get the nearest intersection between a ray and the primitive set.
+    //! @brief      Visit all non-empty leaf cells along the ray in order with a two-level 3D-DDA.
+    //!
+    //! @param r            The ray to be tested, it needs to be prepared before.
+    //! @param t            The distance where the ray enters the grid.
+    //! @param maxT         The traversal stops once it is beyond this distance, it could be updated by the visitor.
+    //! @param visitor      It is called with the primitives of a leaf cell and the distance where the ray leaves
+    //!                     the cell, the traversal stops if it returns true.
+    template<class Visitor>
+    void traverse( const Ray& r , float t , const float& maxT , Visitor& visitor ) const;
+
+    //! @brief      Get the nearest intersection between a ray and the primitives of a leaf cell.
     //! @param r            The ray to be tested.
     //! @param intersect    Intersection data structure holds all intersection results.
-    //! @param voxelId      ID of the voxel to be tested.
-    //! @param nextT        The intersected position of the ray and the next to-be-traversed voxel along
-    //!                     the ray.
+    //! @param begin        The first primitive of the leaf cell.
+    //! @param end          The end of primitives of the leaf cell.
     //! @param matID        Material ID to avoid if it is not invalid.
-    void traverse( const Ray& r , BSSRDFIntersections& intersect , unsigned voxelId , float nextT , const StringID matID ) const;
+    void traverse( const Ray& r , BSSRDFIntersections& intersect , const Primitive* const* begin , const Primitive* const* end , const StringID matID ) const;
 
     SORT_STATS_ENABLE( "Spatial-Structure(UniformGrid)" )
 };
@@ -22,8 +22,8 @@
 #include "spectrum/spectrum.h"
 #include "math/vector2.h"
 #include "math/matrix.h"
+#include "sampler/sample.h"
 
-class PixelSample;
 class Visibility;
 struct SurfaceInteraction;
 
@@ -50,11 +50,40 @@ public:
     //! @return     The generated ray based on the input.
     virtual Ray GenerateRay( float x, float y, const PixelSample& ps) const = 0;
 
+    //! @brief Generating primary rays of a batch of samples in the same pixel.
+    //!
+    //! Cameras could override this to hoist the work shared by all rays out of the loop. By default, the rays are
+    //! generated one after another.
+    //!
+    //! @param x    Coordinate along horizontal axis on the image sensor.
+    //! @param y    Coordinate along vertical axis on the image sensor.
+    //! @param ps   Pixel samples, one for each ray.
+    //! @param cnt  Number of rays to generate.
+    //! @param rays The generated rays.
+    virtual void GenerateRays( float x , float y , const PixelSample* ps , unsigned cnt , Ray* rays ) const {
+        for( auto i = 0u ; i < cnt ; ++i )
+            rays[i] = GenerateRay( x , y , ps[i] );
+    }
+
     //! @brief      Get viewing direction.
     //!
     //! @return     Camera forward direction in world space.
     virtual Vector GetForward() const = 0;
 
+    //! @brief      Get the viewing point.
+    //!
+    //! @return     Viewing point of the camera in world space.
+    const Point& GetEye() const {
+        return m_eye;
+    }
+
+    //! @brief      Get the width of a pixel at unit distance from the camera.
+    //!
+    //! @return     Width of a pixel at unit distance, 0 if pixels don't get larger with distance.
+    virtual float GetPixelSpread() const {
+        return 0.0f;
+    }
+
     //! @brief Get camera coordinate according to a view direction in world space. It is used in light tracing or bi-directional path tracing algorithm.
     //! @param inter            The intersection to be considered when randomly sampling a point on the sensor.
     //! @param pdfw             PDF w.r.t the solid angle of choosing the direction.
@@ -37,6 +37,7 @@ Ray EnvironmentCamera::GenerateRay( float x , float y , const PixelSample& ps )
 
     // transform the ray
     r = m_transform(r);
+    r.m_time = ps.time;
 
     return r;
 }
\ No newline at end of file
@@ -34,7 +34,11 @@ Ray OrthoCamera::GenerateRay( float x, float y, const PixelSample &ps) const{
     const auto ori = world2camera.TransformPoint( Point( x , y , 0.0f ) );
     const auto dir = world2camera.TransformVector( Vector( 0.0f , 0.0f , 1.0f ) );
 
-    return Ray( ori , dir );
+    // rays of an orthographic camera are as wide as a pixel and never spread
+    Ray r( ori , dir );
+    r.m_coneWidth = m_camWidth / w;
+    r.m_time = ps.time;
+    return r;
 }
 
 // set the camera range
@@ -24,6 +24,9 @@
 #include "core/globalconfig.h"
 #include "light/light.h"
 
+// Number of rays generated together in a chunk.
+static constexpr unsigned CAMERA_RAY_CHUNK = 16;
+
 void PerspectiveCamera::PreProcess()
 {
     float w = (float)g_resultResollutionWidth;
@@ -103,9 +106,79 @@ Ray PerspectiveCamera::GenerateRay( float x , float y , const PixelSample& ps )
     // cos at camera
     r.m_fCosAtCamera = cosAtCamera;
 
+    // a pinhole camera ray starts as a point and spreads by the angle covered by one pixel, the lens makes no difference at the focal plane
+    r.m_coneWidth = 0.0f;
+    r.m_coneSpread = cosAtCamera * cosAtCamera / m_imagePlaneDist;
+
+    r.m_time = ps.time;
+
     return r;
 }
 
+void PerspectiveCamera::GenerateRays( float x , float y , const PixelSample* ps , unsigned cnt , Ray* rays ) const{
+    const auto& raster_to_camera = m_cameraToRaster.invMatrix.m;
+    const auto& camera_to_world = m_worldToCamera.invMatrix.m;
+    const auto has_lens = m_lensRadius != 0.0f;
+
+    float ori_x[CAMERA_RAY_CHUNK] , ori_y[CAMERA_RAY_CHUNK];
+    float dir_x[CAMERA_RAY_CHUNK] , dir_y[CAMERA_RAY_CHUNK] , dir_z[CAMERA_RAY_CHUNK];
+    for( auto base = 0u ; base < cnt ; base += CAMERA_RAY_CHUNK ){
+        const auto n = std::min( CAMERA_RAY_CHUNK , cnt - base );
+        const auto samples = ps + base;
+
+        // points on the lens, sampling the disk takes branches so it is separated from the rest.
+        for( auto k = 0u ; k < n ; ++k ){
+            ori_x[k] = ori_y[k] = 0.0f;
+            if( has_lens ){
+                UniformSampleDisk( samples[k].dof_u , samples[k].dof_v , ori_x[k] , ori_y[k] );
+                ori_x[k] *= m_lensRadius;
+                ori_y[k] *= m_lensRadius;
+            }
+        }
+
+        // directions in camera space, rays through the lens point to where the pinhole ray hits the focal plane.
+        for( auto k = 0u ; k < n ; ++k ){
+            const auto px = x + samples[k].img_u;
+            const auto py = y + samples[k].img_v;
+            const auto hx = raster_to_camera[0] * px + raster_to_camera[1] * py + raster_to_camera[3];
+            const auto hy = raster_to_camera[4] * px + raster_to_camera[5] * py + raster_to_camera[7];
+            const auto hz = raster_to_camera[8] * px + raster_to_camera[9] * py + raster_to_camera[11];
+            const auto hw = raster_to_camera[12] * px + raster_to_camera[13] * py + raster_to_camera[15];
+            const auto vz = hz / hw;
+            const auto scale = ( has_lens ? m_focalDistance / vz : 1.0f ) / hw;
+            const auto dx = hx * scale - ori_x[k];
+            const auto dy = hy * scale - ori_y[k];
+            const auto dz = hz * scale;
+            const auto inv_len = 1.0f / sqrt( dx * dx + dy * dy + dz * dz );
+            dir_x[k] = dx * inv_len;
+            dir_y[k] = dy * inv_len;
+            dir_z[k] = dz * inv_len;
+        }
+
+        // transform the rays to world space and fill the rest of the rays, the forward axis is z in camera space.
+        for( auto k = 0u ; k < n ; ++k ){
+            auto& r = rays[base + k];
+            r = Ray();
+            r.m_Ori = Point( camera_to_world[0] * ori_x[k] + camera_to_world[1] * ori_y[k] + camera_to_world[3] ,
+                             camera_to_world[4] * ori_x[k] + camera_to_world[5] * ori_y[k] + camera_to_world[7] ,
+                             camera_to_world[8] * ori_x[k] + camera_to_world[9] * ori_y[k] + camera_to_world[11] );
+            r.m_Dir = Vector( camera_to_world[0] * dir_x[k] + camera_to_world[1] * dir_y[k] + camera_to_world[2] * dir_z[k] ,
+                              camera_to_world[4] * dir_x[k] + camera_to_world[5] * dir_y[k] + camera_to_world[6] * dir_z[k] ,
+                              camera_to_world[8] * dir_x[k] + camera_to_world[9] * dir_y[k] + camera_to_world[10] * dir_z[k] );
+
+            const auto cosAtCamera = dir_z[k];
+            const auto imagePointToCameraDist = m_imagePlaneDist / cosAtCamera;
+            r.m_fPdfW = imagePointToCameraDist * imagePointToCameraDist / cosAtCamera;
+            r.m_fPdfA = m_inverseApartureSize;
+            r.m_we = r.m_fPdfW * r.m_fPdfA / cosAtCamera;
+            r.m_fCosAtCamera = cosAtCamera;
+            r.m_coneWidth = 0.0f;
+            r.m_coneSpread = cosAtCamera * cosAtCamera / m_imagePlaneDist;
+            r.m_time = samples[k].time;
+        }
+    }
+}
+
 // get camera coordinate according to a view direction in world space
 Vector2i PerspectiveCamera::GetScreenCoord( const SurfaceInteraction& inter, float* pdfw, float* pdfa, float& cosAtCamera , Spectrum* we ,
                                             Point* eyeP , Visibility* visibility) const{
@@ -38,6 +38,18 @@ public:
     //! @return     The generated ray based on the input.
     Ray GenerateRay( float x , float y , const PixelSample& ps ) const override;
 
+    //! @brief Generating primary rays of a batch of samples in the same pixel.
+    //!
+    //! The rays are generated in chunks, each step of the chunk is done for all rays in structure of arrays so that
+    //! the loops without branches could be vectorized by the compiler.
+    //!
+    //! @param x    Coordinate along horizontal axis on the image sensor.
+    //! @param y    Coordinate along vertical axis on the image sensor.
+    //! @param ps   Pixel samples, one for each ray.
+    //! @param cnt  Number of rays to generate.
+    //! @param rays The generated rays.
+    void GenerateRays( float x , float y , const PixelSample* ps , unsigned cnt , Ray* rays ) const override;
+
     //! @brief Get camera coordinate according to a view direction in world space. It is used in light tracing or bi-directional path tracing algorithm.
     //! @param inter            The intersection to be considered when randomly sampling a point on the sensor.
     //! @param pdfw             PDF w.r.t the solid angle of choosing the direction.
@@ -56,6 +68,12 @@ public:
         return m_forward;
     }
 
+    //! @brief Get the width of a pixel at unit distance from the camera.
+    //! @return One over the distance to the image plane.
+    float GetPixelSpread() const override {
+        return 1.0f / m_imagePlaneDist;
+    }
+
 protected:
     Point   m_target;                       /**< Viewing target of the camera. */
     Vector  m_up;                           /**< Up direction of the camera. */
@@ -0,0 +1,451 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <unordered_set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "assetresolver.h"
+#include "core/hash.h"
+#include "core/log.h"
+#include "core/stats.h"
+#include "core/timer.h"
+#include "core/globalconfig.h"
+#include "platform/socket/socket.h"
+
+#if defined(SORT_IN_WINDOWS)
+    #include <direct.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+SORT_STATS_DEFINE_COUNTER(sAssetsFetched)
+SORT_STATS_DEFINE_COUNTER(sAssetFetchedBytes)
+SORT_STATS_DEFINE_COUNTER(sAssetCacheHits)
+SORT_STATS_DEFINE_COUNTER(sAssetFetchFailures)
+SORT_STATS_DEFINE_COUNTER(sAssetPrefetchTime)
+
+SORT_STATS_COUNTER("Asset Cache", "Assets Fetched", sAssetsFetched);
+SORT_STATS_COUNTER("Asset Cache", "Bytes Fetched", sAssetFetchedBytes);
+SORT_STATS_COUNTER("Asset Cache", "Assets in Cache", sAssetCacheHits);
+SORT_STATS_COUNTER("Asset Cache", "Assets Failed to Fetch", sAssetFetchFailures);
+SORT_STATS_TIME_US("Asset Cache", "Prefetch Time", sAssetPrefetchTime);
+
+// Maximum number of assets fetched at the same time, fetching is bound by the network instead of the cpu.
+static constexpr unsigned   ASSET_PREFETCH_THREADS  = 16;
+// Another process fetching the same asset is waited for this long, it most likely died if it takes longer.
+static constexpr auto       ASSET_LOCK_WAIT         = std::chrono::seconds( 300 );
+// How often the asset fetched by another process is checked.
+static constexpr auto       ASSET_LOCK_POLL         = std::chrono::milliseconds( 100 );
+// The connection is considered lost if nothing is received for this long.
+static constexpr int        ASSET_HTTP_TIMEOUT_MS   = 30000;
+// Maximum number of http redirections followed.
+static constexpr int        ASSET_MAX_REDIRECTS     = 4;
+
+// Hexadecimal string of a hash.
+static std::string hexHash( unsigned long long hash ){
+    char str[32];
+    snprintf( str , sizeof( str ) , "%016llx" , hash );
+    return str;
+}
+
+static bool fileExists( const std::string& filename ){
+    return std::ifstream( filename ).good();
+}
+
+// Create a folder and all its parents, the ones existing already are skipped.
+static void createFolder( const std::string& folder ){
+    for( auto pos = folder.find_first_of( "/\\" , 1 ) ; pos != std::string::npos ; pos = folder.find_first_of( "/\\" , pos + 1 ) ){
+        const auto parent = folder.substr( 0 , pos );
+#if defined(SORT_IN_WINDOWS)
+        _mkdir( parent.c_str() );
+#else
+        mkdir( parent.c_str() , 0755 );
+#endif
+    }
+}
+
+// The temporary folder of the system, ending with a separator.
+static std::string tempFolder(){
+#if defined(SORT_IN_WINDOWS)
+    const char* tmp = getenv( "TEMP" );
+    std::string dir = ( tmp && *tmp ) ? tmp : ".";
+#else
+    const char* tmp = getenv( "TMPDIR" );
+    std::string dir = ( tmp && *tmp ) ? tmp : "/tmp";
+#endif
+    if( dir.back() != '/' && dir.back() != '\\' )
+        dir += '/';
+    return dir;
+}
+
+// Extension of the asset in the url, including the dot. Files in the cache keep it since some loaders depend on it.
+static std::string extension( const std::string& url ){
+    const auto end = url.find_first_of( "?#" , url.find( "://" ) + 3 );
+    const auto path = url.substr( 0 , end );
+    const auto dot = path.find_last_of( '.' );
+    const auto slash = path.find_last_of( '/' );
+    if( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) || path.size() - dot > 8 )
+        return "";
+    const auto ext = path.substr( dot );
+    for( auto i = 1u ; i < ext.size() ; ++i ){
+        if( !isalnum( (unsigned char)ext[i] ) )
+            return "";
+    }
+    return ext;
+}
+
+//! @brief  Download assets through plain http.
+class HttpFetcher : public AssetFetcher{
+public:
+    //! @brief  Download an asset, redirections are followed.
+    bool Fetch( const std::string& url , const std::string& filename ) override{
+        auto current = url;
+        for( auto i = 0 ; i <= ASSET_MAX_REDIRECTS ; ++i ){
+            auto status = 0;
+            std::string location;
+            if( !get( current , filename , status , location ) )
+                return false;
+            if( status < 300 || status >= 400 || location.empty() )
+                return status == 200;
+
+            // relative redirections are on the same host
+            if( location[0] == '/' )
+                location = current.substr( 0 , current.find( '/' , current.find( "://" ) + 3 ) ) + location;
+            current = location;
+        }
+        slog( WARNING , RESOURCE , "Too many redirections fetching %s." , url.c_str() );
+        return false;
+    }
+
+private:
+    //! @brief  Send a GET request, the body is only saved if the status is 200.
+    static bool get( const std::string& url , const std::string& filename , int& status , std::string& location ){
+        if( url.compare( 0 , 7 , "http://" ) != 0 ){
+            slog( WARNING , RESOURCE , "Only plain http is supported, %s needs a fetcher registered." , url.c_str() );
+            return false;
+        }
+
+        const auto path_start = url.find( '/' , 7 );
+        const auto authority = url.substr( 7 , path_start == std::string::npos ? std::string::npos : path_start - 7 );
+        const auto path = path_start == std::string::npos ? std::string( "/" ) : url.substr( path_start , url.find( '#' ) - path_start );
+        const auto colon = authority.find( ':' );
+        const auto host = authority.substr( 0 , colon );
+        const auto port = colon == std::string::npos ? 80 : atoi( authority.c_str() + colon + 1 );
+
+        Socket socket;
+        if( !socket.Connect( host , (unsigned short)port ) )
+            return false;
+
+        // http 1.0 never sends the body in chunks
+        const auto request = "GET " + path + " HTTP/1.0\r\nHost: " + authority + "\r\nUser-Agent: SORT\r\nConnection: close\r\n\r\n";
+        if( !socket.Send( request.c_str() , (int)request.size() ) )
+            return false;
+
+        std::vector<char> buffer( 64 * 1024 );
+        const auto receive = [&](){
+            return socket.WaitForData( ASSET_HTTP_TIMEOUT_MS ) ? socket.Receive( buffer.data() , (int)buffer.size() ) : 0;
+        };
+
+        std::string header;
+        auto header_end = std::string::npos;
+        while( header_end == std::string::npos ){
+            const auto received = receive();
+            if( received <= 0 )
+                return false;
+            header.append( buffer.data() , received );
+            header_end = header.find( "\r\n\r\n" );
+        }
+
+        if( 1 != sscanf( header.c_str() , "HTTP/%*d.%*d %d" , &status ) )
+            return false;
+
+        // header fields are case insensitive
+        auto content_length = -1ll;
+        std::string lower_header = header.substr( 0 , header_end + 2 );
+        for( auto& c : lower_header )
+            c = (char)tolower( (unsigned char)c );
+        const auto field = [&]( const char* name ){
+            const auto pos = lower_header.find( std::string( "\r\n" ) + name + ":" );
+            if( pos == std::string::npos )
+                return std::string();
+            const auto start = header.find_first_not_of( ' ' , pos + strlen( name ) + 3 );
+            return header.substr( start , header.find( "\r\n" , start ) - start );
+        };
+        location = field( "location" );
+        const auto length = field( "content-length" );
+        if( !length.empty() )
+            content_length = atoll( length.c_str() );
+
+        if( status != 200 ){
+            if( status < 300 || status >= 400 )
+                slog( WARNING , RESOURCE , "Fetching %s fails with http status %d." , url.c_str() , status );
+            return true;
+        }
+
+        std::ofstream file( filename , std::ios::binary );
+        if( !file.is_open() )
+            return false;
+        auto size = (long long)( header.size() - header_end - 4 );
+        file.write( header.data() + header_end + 4 , size );
+        while( true ){
+            const auto received = receive();
+            if( received <= 0 )
+                break;
+            file.write( buffer.data() , received );
+            size += received;
+        }
+
+        // the connection is closed once the whole body is sent, it could be lost in the middle too
+        return file.good() && ( content_length < 0 || size == content_length );
+    }
+};
+
+//! @brief  Download assets in S3 buckets through the plain http endpoint.
+class S3Fetcher : public AssetFetcher{
+public:
+    //! @brief  Download 's3://bucket/key' as 'http://endpoint/bucket/key', or from the public endpoint of the bucket.
+    bool Fetch( const std::string& url , const std::string& filename ) override{
+        const auto slash = url.find( '/' , 5 );
+        if( slash == std::string::npos )
+            return false;
+        const auto bucket = url.substr( 5 , slash - 5 );
+        const auto key = url.substr( slash + 1 );
+        const auto& endpoint = g_s3Endpoint;
+        const auto http_url = endpoint.empty() ? "http://" + bucket + ".s3.amazonaws.com/" + key : "http://" + endpoint + "/" + bucket + "/" + key;
+        return m_http.Fetch( http_url , filename );
+    }
+
+private:
+    HttpFetcher m_http;     /**< S3 is just http. */
+};
+
+//! @brief  Copy files, like the ones on a network file system, to the cache.
+class FileFetcher : public AssetFetcher{
+public:
+    //! @brief  Copy the file of 'file://path'.
+    bool Fetch( const std::string& url , const std::string& filename ) override{
+        std::ifstream src( url.substr( 7 ) , std::ios::binary );
+        if( !src.is_open() )
+            return false;
+        std::ofstream dst( filename , std::ios::binary );
+        dst << src.rdbuf();
+        return dst.good();
+    }
+};
+
+AssetResolver::AssetResolver(){
+    m_fetchers["http"] = std::make_unique<HttpFetcher>();
+    m_fetchers["s3"] = std::make_unique<S3Fetcher>();
+    m_fetchers["file"] = std::make_unique<FileFetcher>();
+
+    const auto& folder = g_assetCachePath;
+    SetCacheFolder( folder.empty() ? tempFolder() + "sort_assets" : folder );
+}
+
+bool AssetResolver::IsRemote( const std::string& path ){
+    const auto pos = path.find( "://" );
+    if( pos == std::string::npos || pos == 0 )
+        return false;
+    for( auto i = 0u ; i < pos ; ++i ){
+        if( !isalnum( (unsigned char)path[i] ) && path[i] != '+' && path[i] != '-' && path[i] != '.' )
+            return false;
+    }
+    return true;
+}
+
+void AssetResolver::RegisterFetcher( const std::string& scheme , std::unique_ptr<AssetFetcher> fetcher ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_fetchers[scheme] = std::move( fetcher );
+}
+
+void AssetResolver::SetCacheFolder( const std::string& folder ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_cacheFolder = folder;
+    if( m_cacheFolder.empty() || ( m_cacheFolder.back() != '/' && m_cacheFolder.back() != '\\' ) )
+        m_cacheFolder += '/';
+}
+
+std::string AssetResolver::Resolve( const std::string& path ){
+    if( !IsRemote( path ) )
+        return path;
+
+    auto result = ResolveResult::Waited;
+    size_t size = 0;
+    const auto filename = resolveOnce( path , &result , &size );
+    SORT_STATS(sAssetsFetched += result == ResolveResult::Fetched ? 1 : 0);
+    SORT_STATS(sAssetFetchedBytes += result == ResolveResult::Fetched ? (StatsInt)size : 0);
+    SORT_STATS(sAssetCacheHits += result == ResolveResult::Cached ? 1 : 0);
+    SORT_STATS(sAssetFetchFailures += result == ResolveResult::Failed ? 1 : 0);
+    return filename;
+}
+
+void AssetResolver::Prefetch( const std::vector<std::string>& paths ){
+    std::vector<std::string> remote;
+    std::unordered_set<std::string> visited;
+    for( const auto& path : paths ){
+        if( IsRemote( path ) && visited.insert( path ).second )
+            remote.push_back( path );
+    }
+    if( remote.empty() )
+        return;
+
+    SORT_STATS(Timer timer);
+    std::atomic<unsigned> next = { 0 } , fetched = { 0 } , cached = { 0 } , failed = { 0 };
+    std::atomic<size_t> bytes = { 0 };
+    const auto worker = [&](){
+        for( auto i = next++ ; i < remote.size() ; i = next++ ){
+            auto result = ResolveResult::Waited;
+            size_t size = 0;
+            resolveOnce( remote[i] , &result , &size );
+            if( result == ResolveResult::Fetched ){
+                ++fetched;
+                bytes += size;
+            }else if( result == ResolveResult::Cached ){
+                ++cached;
+            }else if( result == ResolveResult::Failed ){
+                ++failed;
+            }
+        }
+    };
+
+    const auto thread_cnt = std::min( (unsigned)remote.size() , ASSET_PREFETCH_THREADS );
+    std::vector<std::thread> threads;
+    for( auto i = 1u ; i < thread_cnt ; ++i )
+        threads.emplace_back( worker );
+    worker();
+    for( auto& thread : threads )
+        thread.join();
+
+    // stats are only collected on the calling thread
+    SORT_STATS(sAssetsFetched += fetched);
+    SORT_STATS(sAssetFetchedBytes += (StatsInt)bytes);
+    SORT_STATS(sAssetCacheHits += cached);
+    SORT_STATS(sAssetFetchFailures += failed);
+    SORT_STATS(sAssetPrefetchTime += timer.GetElapsedTimeInUs());
+
+    slog( INFO , RESOURCE , "%d remote assets are prefetched, %d fetched, %d in the cache already, %d failed." ,
+          (int)remote.size() , (int)fetched , (int)cached , (int)failed );
+}
+
+std::string AssetResolver::resolveOnce( const std::string& url , ResolveResult* result , size_t* size ){
+    std::promise<std::string> promise;
+    std::shared_future<std::string> future;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        const auto it = m_resolved.find( url );
+        if( it != m_resolved.end() ){
+            future = it->second;
+        }else{
+            m_resolved[url] = promise.get_future().share();
+        }
+    }
+
+    // The url is resolved by another thread, which takes the lock too, it is waited for after the lock is released.
+    if( future.valid() )
+        return future.get();
+
+    std::string filename;
+    size_t file_size = 0;
+    const auto ret = resolve( url , filename , file_size );
+    promise.set_value( filename );
+
+    if( result )
+        *result = ret;
+    if( size )
+        *size = file_size;
+    return filename;
+}
+
+AssetResolver::ResolveResult AssetResolver::resolve( const std::string& url , std::string& filename , size_t& size ){
+    AssetFetcher* fetcher = nullptr;
+    std::string folder;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        const auto it = m_fetchers.find( url.substr( 0 , url.find( "://" ) ) );
+        fetcher = it == m_fetchers.end() ? nullptr : it->second.get();
+        folder = m_cacheFolder;
+    }
+    if( !fetcher ){
+        slog( WARNING , RESOURCE , "There is no fetcher for %s." , url.c_str() );
+        return ResolveResult::Failed;
+    }
+    createFolder( folder );
+
+    // The index of an url holds the name of the file of its content, the file is named after the hash of the content.
+    auto url_hash = HASH_INITIAL_VALUE;
+    hashData( url_hash , url.data() , url.size() );
+    const auto index = folder + "url_" + hexHash( url_hash );
+    const auto cached = [&](){
+        std::string object;
+        if( !( std::ifstream( index ) >> object ) || !fileExists( folder + object ) )
+            return false;
+        filename = folder + object;
+        return true;
+    };
+    if( cached() )
+        return ResolveResult::Cached;
+
+    // Only one process on the machine fetches an asset, the others wait for it. The lock file is only created if it
+    // doesn't exist, it is taken over if the process holding it takes too long, which most likely died.
+    const auto lock_file = index + ".lock";
+    const auto wait_start = std::chrono::steady_clock::now();
+    FILE* lock = nullptr;
+    while( !( lock = fopen( lock_file.c_str() , "wx" ) ) ){
+        if( cached() )
+            return ResolveResult::Cached;
+        if( std::chrono::steady_clock::now() - wait_start > ASSET_LOCK_WAIT ){
+            slog( WARNING , RESOURCE , "Taking over fetching %s from a process that takes too long." , url.c_str() );
+            std::remove( lock_file.c_str() );
+        }
+        std::this_thread::sleep_for( ASSET_LOCK_POLL );
+    }
+
+    auto ret = ResolveResult::Cached;
+    if( !cached() ){
+        const auto tmp_file = index + ".tmp";
+        auto content_hash = HASH_INITIAL_VALUE;
+        if( fetcher->Fetch( url , tmp_file ) && hashFile( content_hash , tmp_file , &size ) ){
+            // identical content fetched from another url is stored once
+            const auto object = hexHash( content_hash ) + extension( url );
+            if( fileExists( folder + object ) )
+                std::remove( tmp_file.c_str() );
+            else
+                std::rename( tmp_file.c_str() , ( folder + object ).c_str() );
+
+            const auto tmp_index = index + ".idx.tmp";
+            std::ofstream( tmp_index ) << object;
+            std::remove( index.c_str() );
+            std::rename( tmp_index.c_str() , index.c_str() );
+
+            filename = folder + object;
+            ret = ResolveResult::Fetched;
+        }else{
+            std::remove( tmp_file.c_str() );
+            slog( WARNING , RESOURCE , "Failed to fetch %s." , url.c_str() );
+            ret = ResolveResult::Failed;
+        }
+    }
+
+    fclose( lock );
+    std::remove( lock_file.c_str() );
+    return ret;
+}
@@ -0,0 +1,113 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <future>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "core/define.h"
+#include "core/singleton.h"
+
+//! @brief  Download remote assets of a scheme, like 'http', into local files.
+class AssetFetcher{
+public:
+    //! @brief  Default virtual destructor.
+    virtual ~AssetFetcher() = default;
+
+    //! @brief  Download an asset.
+    //!
+    //! It could be called from several threads at the same time, with different assets.
+    //!
+    //! @param  url         Url of the asset, including the scheme.
+    //! @param  filename    Local file to be filled, partial files are removed by the caller if it fails.
+    //! @return             Whether the whole asset is downloaded.
+    virtual bool    Fetch( const std::string& url , const std::string& filename ) = 0;
+};
+
+//! @brief  Resolve paths of assets, like textures and measured BRDFs, to local files.
+/**
+ * Paths with a scheme, like 'http://host/a.exr', are downloaded into a content addressed cache folder on the local
+ * disk, which is shared by all SORT processes on the machine. Each asset is downloaded only once per machine, files
+ * in the cache are named after the hash of their content so identical assets from different urls are stored once.
+ * Cleaning the cache up is left to the user, it needs to be done to pick up assets changed on the server too.
+ *  - 'http' is downloaded directly. There is no TLS support, 'https' needs a fetcher registered by the user.
+ *  - 's3://bucket/key' is downloaded from the plain http endpoint set by '--s3endpoint', or the public endpoint of
+ *    the bucket if it is not set. Signed requests need a fetcher registered by the user.
+ *  - 'file' copies a file, like one on a network file system, to the cache so that it is read only once per machine.
+ * Paths without a scheme are local files already, they are returned as they are.
+ */
+class AssetResolver : public Singleton<AssetResolver>{
+public:
+    //! @brief  Whether the path is a remote asset to be fetched.
+    //!
+    //! @param  path        Path of the asset.
+    //! @return             True if the path has a scheme, like 'http://'.
+    static bool     IsRemote( const std::string& path );
+
+    //! @brief  Register a fetcher of a scheme, the fetcher registered before is replaced.
+    //!
+    //! @param  scheme      Scheme of the urls, like 'http', without '://'.
+    //! @param  fetcher     The fetcher.
+    void            RegisterFetcher( const std::string& scheme , std::unique_ptr<AssetFetcher> fetcher );
+
+    //! @brief  Set the folder of the cache, it needs to be set before resolving any asset.
+    //!
+    //! It is '--assetcache' by default, or 'sort_assets' in the temporary folder if it is not set.
+    //!
+    //! @param  folder      Folder of the cache.
+    void            SetCacheFolder( const std::string& folder );
+
+    //! @brief  Resolve the path of an asset to a local file, remote assets are fetched if they are not cached yet.
+    //!
+    //! @param  path        Path of the asset.
+    //! @return             Path of the local file, empty if it fails to fetch the asset.
+    std::string     Resolve( const std::string& path );
+
+    //! @brief  Fetch all remote assets in parallel, resolving them later doesn't wait at all.
+    //!
+    //! Fetching is bound by the network, it is done in its own threads instead of the worker threads.
+    //!
+    //! @param  paths       Paths of the assets, local files and duplicated paths are skipped.
+    void            Prefetch( const std::vector<std::string>& paths );
+
+private:
+    //! @brief  How a remote asset is resolved.
+    enum class ResolveResult{
+        Cached ,        /**< It is in the cache already. */
+        Fetched ,       /**< It is fetched by this process. */
+        Failed ,        /**< It fails to be fetched. */
+        Waited          /**< It is resolved by another thread in the process. */
+    };
+
+    std::mutex                                                          m_mutex;        /**< Mutex protecting the members. */
+    std::unordered_map<std::string, std::unique_ptr<AssetFetcher>>      m_fetchers;     /**< Fetchers keyed by scheme. */
+    std::unordered_map<std::string, std::shared_future<std::string>>    m_resolved;     /**< Local files of remote assets resolved or being resolved. */
+    std::string                                                         m_cacheFolder;  /**< Folder of the cache, ending with a separator. */
+
+    //! @brief  Resolve a remote asset, it is only called once per asset in a process.
+    ResolveResult   resolve( const std::string& url , std::string& filename , size_t& size );
+
+    //! @brief  Resolve a remote asset once in the process, the others resolving it wait for it.
+    std::string     resolveOnce( const std::string& url , ResolveResult* result , size_t* size );
+
+    AssetResolver();
+    friend class Singleton<AssetResolver>;
+};
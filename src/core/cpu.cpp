@@ -0,0 +1,132 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "cpu.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define SORT_X86_CPU
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+    #define SORT_ARM64_CPU
+#endif
+
+#if defined(SORT_X86_CPU) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+//! @brief  Query the CPU for an instruction set.
+//!
+//! Besides the CPU, the OS also needs to save the wider registers during context switching,
+//! which is why XCR0 is checked for AVX and AVX512.
+//!
+//! @param  isa     The instruction set to check.
+//! @return         Whether the instruction set is supported.
+static bool querySimdIsa( const SimdIsa isa ){
+#if defined(SORT_ARM64_CPU)
+    // NEON is a mandatory part of ARMv8-A.
+    return isa == SimdIsa::Scalar || isa == SimdIsa::NEON;
+#elif !defined(SORT_X86_CPU)
+    return isa == SimdIsa::Scalar;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid( info , 0 );
+    const auto max_leaf = info[0];
+
+    __cpuid( info , 1 );
+    const auto sse41 = ( info[2] & ( 1 << 19 ) ) != 0;
+    const auto osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+    const auto avx = ( info[2] & ( 1 << 28 ) ) != 0;
+    const auto xcr0 = osxsave ? _xgetbv( 0 ) : 0;
+
+    auto avx512 = false;
+    if( max_leaf >= 7 ){
+        __cpuidex( info , 7 , 0 );
+        avx512 = ( info[1] & ( 1 << 16 ) ) != 0 && ( info[1] & ( 1 << 17 ) ) != 0;
+    }
+
+    switch( isa ){
+    case SimdIsa::Scalar:
+        return true;
+    case SimdIsa::SSE:
+        return sse41;
+    case SimdIsa::AVX:
+        return avx && ( xcr0 & 0x06 ) == 0x06;
+    case SimdIsa::AVX512:
+        return avx && avx512 && ( xcr0 & 0xe6 ) == 0xe6;
+    case SimdIsa::NEON:
+        return false;
+    }
+    return false;
+#else
+    // GCC and Clang take care of the OS support of the registers already.
+    __builtin_cpu_init();
+    switch( isa ){
+    case SimdIsa::Scalar:
+        return true;
+    case SimdIsa::SSE:
+        return __builtin_cpu_supports( "sse4.1" );
+    case SimdIsa::AVX:
+        return __builtin_cpu_supports( "avx" );
+    case SimdIsa::AVX512:
+        return __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512dq" );
+    case SimdIsa::NEON:
+        return false;
+    }
+    return false;
+#endif
+}
+
+bool IsSimdIsaSupported( const SimdIsa isa ){
+    static const bool supported[] = {
+        querySimdIsa( SimdIsa::Scalar ) ,
+        querySimdIsa( SimdIsa::SSE ) ,
+        querySimdIsa( SimdIsa::AVX ) ,
+        querySimdIsa( SimdIsa::AVX512 ) ,
+        querySimdIsa( SimdIsa::NEON ) ,
+    };
+    const auto index = (int)isa;
+    return index >= 0 && index < (int)( sizeof( supported ) / sizeof( supported[0] ) ) && supported[index];
+}
+
+SimdIsa BestSimdIsa(){
+    if( IsSimdIsaSupported( SimdIsa::AVX512 ) )
+        return SimdIsa::AVX512;
+    if( IsSimdIsaSupported( SimdIsa::AVX ) )
+        return SimdIsa::AVX;
+    if( IsSimdIsaSupported( SimdIsa::SSE ) )
+        return SimdIsa::SSE;
+    if( IsSimdIsaSupported( SimdIsa::NEON ) )
+        return SimdIsa::NEON;
+    return SimdIsa::Scalar;
+}
+
+const char* SimdIsaName( const SimdIsa isa ){
+    switch( isa ){
+    case SimdIsa::Scalar:
+        return "Scalar";
+    case SimdIsa::SSE:
+        return "SSE4.1";
+    case SimdIsa::AVX:
+        return "AVX";
+    case SimdIsa::AVX512:
+        return "AVX512";
+    case SimdIsa::NEON:
+        return "NEON";
+    }
+    return "Unknown";
+}
@@ -0,0 +1,50 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+//! @brief  Instruction set used by the SIMD code paths of SORT.
+/**
+ * They are sorted from the least capable to the most capable one, a later instruction set
+ * always implies the earlier ones in the way SORT uses them.
+ */
+enum class SimdIsa : int {
+    Scalar = 0,     /**< No SIMD instruction at all. */
+    SSE,            /**< SSE4.1, used by QBVH. */
+    AVX,            /**< AVX, used by OBVH. */
+    AVX512,         /**< AVX512F and AVX512DQ, used by HBVH. */
+    NEON,           /**< NEON on ARM64, used by QBVH in place of SSE4.1. It is not comparable with the others. */
+};
+
+//! @brief  Whether the running CPU and OS support an instruction set.
+//!
+//! The CPU is only queried once, the result is cached after the first call.
+//!
+//! @param  isa     The instruction set to check.
+//! @return         Whether the instruction set could be executed on this machine.
+bool        IsSimdIsaSupported( const SimdIsa isa );
+
+//! @brief  The most capable instruction set supported by the running CPU.
+//!
+//! @return         The most capable instruction set supported by the running CPU.
+SimdIsa     BestSimdIsa();
+
+//! @brief  Readable name of an instruction set.
+//!
+//! @param  isa     The instruction set.
+//! @return         Name of the instruction set.
+const char* SimdIsaName( const SimdIsa isa );
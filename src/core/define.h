@@ -55,6 +55,14 @@
 
 #define SORT_STATIC_FORCEINLINE     static SORT_FORCEINLINE
 
+// QBVH and the other SIMD kernels of four lanes are implemented with SSE on x86 and with NEON on ARM64.
+#if defined(SSE_ENABLED) && defined(NEON_ENABLED)
+    #error "SSE and NEON can't be enabled at the same time."
+#endif
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    #define SIMD4_ENABLED
+#endif
+
 #define IS_PTR_INVALID(p)           (nullptr == p)
 #define IS_PTR_VALID(p)             (nullptr != p)
 
@@ -63,6 +71,8 @@
 // The firefly is caused by multiple path with more bounces so that it leads to very low pdf because of each bounce.
 // Blending a red diffuse and Cyan will also results in the same firefly problem. Further investigation needs to be
 // done before enabling this feature.
+// SSS is still replaced where it is not visible, when the footprint of the ray covers many mean free paths, which only
+// happens far away from the camera or after a few bounces.
 // #define SSS_REPLACE_WITH_LAMBERT
 
 // By default, transparent shadow is enabled. Meaning transparent material node will cast transparent shadow.
@@ -77,28 +87,14 @@
 #define ENABLE_TRANSPARENT_SHADOW
 
 // Multi-thread shader compilation.
-// This is not a functional feature since there could be some data race problem in the TSL library. By default, this
-// is disabled.
-// Also, before I have a refactored job system with more flexible design so that I can spawn jobs inside a job, multi-
-// thread shader compilation is not a done feature. The current solution is just the first iteration that only
-// bulids material shader group in seperate thread since I know for a fact there is no dependencies between material
-// shader group. However, in an ideal world, even shader unit should be compiled in a multi-thread environment to fully
-// utilize the power of TSL's multi-thread compilation, this does require a more robust job system, which SORT currently
-// doesn't have.
-// This will be disabled since the efficiency of the current task system will be the main performance bottleneck,
-// leading to worse performance with multi-thread shader compilation enabled.
-// #define ENABLE_MULTI_THREAD_SHADER_COMPILATION
-
-// This macro offers a cheap way to mult-thread shader compilation without the task system. However, there is no sign
-// indicating there is significant gain in performance. Probably because the overhead of thread switching, allocating
-// new thread context and also the mutex inside TSL lib.
-// Eventually this will be replaced with a proper job system. However, given that I have very limited time and there is
-// so much things to do, this may be lower priority before I get a chance to work on it.
-// This is disabled since it is significantly slower on my 2015 Macbook.
-// #define ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-
-// This is a temporary quick solution to enable multi-thread texture loading. It is by no means a very good idea to 
-// parallel a bunch of IO bound threads. However, my newly planned job system is far from being ready yet, I'll live 
-// with it for now. This async loading eventually will be less useful since I'm planning to implement a texture cache
-// system in the future to do lazy texture loading in the future.
-#define ENABLE_ASYNC_TEXTURE_LOADING
\ No newline at end of file
+// Shader compilation is a DAG, shader unit templates don't depend on anything, shader group templates depend on the
+// templates they are made of and materials depend on all of them. All shaders are streamed first, each level of the DAG
+// is then compiled in child tasks of the loading task, every thread compiles with its own shading context.
+// Disabling this compiles everything on the loading thread, which is handy when investigating issues in TSL.
+#define ENABLE_MULTI_THREAD_SHADER_COMPILATION
+
+// Resources, like textures, are loaded in their own tasks, larger files first. Reading files is IO bound, there is no
+// point reading a bunch of them at the same time, this is the number of textures read in parallel. Decoding them is
+// not limited. With the texture cache enabled, textures converted to tiles before are not decoded at all, tiles are
+// loaded lazily during rendering.
+#define TEXTURE_IO_CONCURRENCY      4
\ No newline at end of file
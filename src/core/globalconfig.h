@@ -18,19 +18,33 @@
 #pragma once
 
 #include <string.h>
+#include <stdio.h>
 #include <regex>
+#include <sstream>
+#include <vector>
+#include <utility>
 #include "core/log.h"
 #include "stream/stream.h"
 #include "core/singleton.h"
 #include "accel/accelerator.h"
 #include "integrator/integrator.h"
 #include "core/rtti.h"
+#include "core/numa.h"
 #include "imagesensor/blenderimage.h"
 #include "imagesensor/rendertargetimage.h"
+#include "imagesensor/tiledexrimage.h"
+#include "imagesensor/filteredfilm.h"
 
 //! @brief  This needs to be update every time the content of GlobalConfiguration changes.
 constexpr unsigned int GLOBAL_CONFIGURATION_VERSION = 0;
 
+//! @brief  Order of tiles to be rendered, and of pixels to be rendered inside each tile.
+enum class TileOrder : int {
+    Spiral = 0,     /**< Tiles start from the center of the image in a spiral, pixels are rendered row by row. */
+    Morton,         /**< Both tiles and pixels follow the Morton curve. */
+    Hilbert,        /**< Both tiles and pixels follow the Hilbert curve. */
+};
+
 //! @brief  GlobalConfiguration saves some global state.
 class GlobalConfiguration : public Singleton<GlobalConfiguration> , SerializableObject {
 public:
@@ -41,6 +55,30 @@ public:
         return m_tileSize;
     }
 
+    //! @brief  Get the order of tiles and pixels to be rendered.
+    //!
+    //! Space filling curves keep consecutive rays of each worker thread spatially coherent, the spiral
+    //! shows the center of the image first, which is nicer for previewing.
+    //!
+    //! @return     The order of tiles and pixels to be rendered.
+    TileOrder       GetTileOrder() const {
+        return m_tileOrder;
+    }
+
+    //! @brief  Get the reconstruction filter of camera samples.
+    //!
+    //! @return     The pixel filter, box by default.
+    PixelFilterType GetPixelFilter() const {
+        return m_pixelFilter;
+    }
+
+    //! @brief  Get the radius of the reconstruction filter in pixels.
+    //!
+    //! @return     Radius of the pixel filter, it is ignored by the box filter.
+    float           GetFilterRadius() const {
+        return m_filterRadius;
+    }
+
     //! @brief  Whether SORT is ran in Blender mode.
     //!
     //! Blender mode will stream the result directly to shared memory through IPC.
@@ -89,6 +127,8 @@ public:
 
     //! @brief      Get the number of worker threads.
     //!
+    //! If the input file or the command line asks for 0 or 'auto', it is one per physical core.
+    //!
     //! @return     Number of worker thread. Default value is 16.
     unsigned int                    GetThreadCnt() const {
         return m_threadCnt;
@@ -101,6 +141,13 @@ public:
         return m_samplePerPixel;
     }
 
+    //! @brief      Get the type of the sampler taking samples in pixels.
+    //!
+    //! @return     Name of the sampler class.
+    StringID                        GetSamplerType() const {
+        return m_samplerType;
+    }
+
     //! @brief      Get full path of the resource.
     //!
     //! @return     Full path of the resources files.
@@ -122,6 +169,31 @@ public:
         return Vector2i( m_resWidth , m_resHeight );
     }
 
+    //! @brief      Whether only a region of the image is rendered.
+    //!
+    //! @return     Whether a render region is set in the command line.
+    bool                            GetHasRenderRegion() const {
+        return m_hasRenderRegion;
+    }
+
+    //! @brief      Get the top-left corner of the region to be rendered, it is inclusive.
+    //!
+    //! @return     Top-left corner of the render region, it is the origin if there is no render region.
+    const Vector2i                  GetRenderRegionMin() const {
+        if( !m_hasRenderRegion )
+            return Vector2i( 0 , 0 );
+        return Vector2i( std::min( m_regionMin.x , (int)m_resWidth ) , std::min( m_regionMin.y , (int)m_resHeight ) );
+    }
+
+    //! @brief      Get the bottom-right corner of the region to be rendered, it is exclusive.
+    //!
+    //! @return     Bottom-right corner of the render region, it is the resolution if there is no render region.
+    const Vector2i                  GetRenderRegionMax() const {
+        if( !m_hasRenderRegion )
+            return GetResultResolution();
+        return Vector2i( std::min( m_regionMax.x , (int)m_resWidth ) , std::min( m_regionMax.y , (int)m_resHeight ) );
+    }
+
     //! @brief      Get full path to the input file.
     //!
     //! @return     Full path to the input file.
@@ -129,6 +201,13 @@ public:
         return m_inputFile;
     }
 
+    //! @brief      Get name of the shared memory the input is streamed from.
+    //!
+    //! @return     Name of the shared memory, empty if the input is a file.
+    const std::string&              GetSharedInputName() const{
+        return m_sharedInput;
+    }
+
     //! @brief      Get image sensor.
     //!
     //! @return     Image sensor.
@@ -143,6 +222,331 @@ public:
         return m_noMaterialSupport;
     }
 
+    //! @brief      Whether the spatial accelerator is cached on disk.
+    //!
+    //! @return     'True' if the spatial accelerator is loaded from cache when the geometry is unchanged.
+    bool            GetAccelCacheEnabled() const{
+        return m_accelCacheEnabled;
+    }
+
+    //! @brief      Whether processed meshes are cached on disk.
+    //!
+    //! @return     'True' if world space vertices are loaded from cache when the mesh and its transform are unchanged.
+    bool            GetMeshCacheEnabled() const{
+        return m_meshCacheEnabled;
+    }
+
+    //! @brief      Memory budget of vertices paged in from mesh cache files.
+    //!
+    //! This is vertex only paging, nodes and packed leaves of spatial accelerators are never paged out. A scene whose
+    //! accelerators don't fit in memory can't be rendered with it.
+    //!
+    //! @return     Budget in megabytes, 0 means vertices of cached meshes are loaded in memory instead of paged in.
+    unsigned        GetOutOfCoreBudget() const{
+        return m_outOfCoreBudget;
+    }
+
+    //! @brief      Memory budget of the texture cache.
+    //!
+    //! @return     Budget in megabytes, 0 means textures are fully loaded in memory instead of being paged in by tiles.
+    unsigned        GetTextureCacheBudget() const{
+        return m_textureCacheBudget;
+    }
+
+    //! @brief      Resolution of the grids volume shaders are baked into before rendering.
+    //!
+    //! @return     Number of texels along each axis of the grids, 0 means volume shaders are evaluated at every step.
+    unsigned        GetVolumeBakeResolution() const{
+        return m_volumeBakeResolution;
+    }
+
+    //! @brief      Whether decoded resources are shared with other SORT processes on the same machine.
+    //!
+    //! @return     'True' if decoded textures and measured BRDFs are published in or mapped from named shared memory.
+    bool            GetSharedResourcesEnabled() const{
+        return m_sharedResourcesEnabled;
+    }
+
+    //! @brief      Memory budget of shared resources that no process uses anymore.
+    //!
+    //! @return     Budget in megabytes, 0 means shared resources are removed once the last process using them is done.
+    unsigned        GetSharedResourcesBudget() const{
+        return m_sharedResourcesBudget;
+    }
+
+    //! @brief      Whether worker threads are pinned to logical cores.
+    //!
+    //! @return     'True' if each worker thread, including the main thread, is pinned to a logical core.
+    bool            GetThreadPinningEnabled() const{
+        return m_threadPinningEnabled;
+    }
+
+    //! @brief      Whether scene data is interleaved across NUMA nodes.
+    //!
+    //! Scene data, like meshes, textures and spatial accelerators, is first touched by whichever thread
+    //! loads or builds it. Interleaving its pages across NUMA nodes avoids all worker threads on the
+    //! other sockets fetching it across the interconnect. Memory allocated during rendering is kept
+    //! local to the thread.
+    //!
+    //! @return     'True' if scene data is interleaved across NUMA nodes.
+    bool            GetNumaInterleaveEnabled() const{
+        return m_numaInterleaveEnabled;
+    }
+
+    //! @brief      Whether large read-only scene data is backed by large pages.
+    //!
+    //! BVH nodes, mesh vertices and textures of big scenes span a lot of pages, large pages reduce TLB misses
+    //! when accessing them randomly during rendering.
+    //!
+    //! @return     'True' if large arrays of scene data are backed by large pages when available.
+    bool            GetLargePagesEnabled() const{
+        return m_largePagesEnabled;
+    }
+
+    //! @brief      Get the sampling rate of hot path stats.
+    //!
+    //! Hot path stats, like the number of rays and intersection tests, are only measured in one of every
+    //! few pixels and scaled, so that stats could be kept enabled without slowing down rendering much.
+    //!
+    //! @return     Hot path stats are measured in one of every this number of pixels, 1 means all pixels.
+    unsigned        GetStatsSamplingRate() const{
+        return m_statsSamplingRate;
+    }
+
+    //! @brief      Get the file stats are saved to as JSON, like the breakdown of scene loading time.
+    //!
+    //! @return     Name of the JSON file, stats are not saved as JSON if it is empty.
+    const std::string& GetStatsJsonFile() const{
+        return m_statsJsonFile;
+    }
+
+    //! @brief      Get how often radiance splatted by splatting integrators is refreshed for display.
+    //!
+    //! Splatted radiance is only merged into the image once rendering is done by default. It could be reduced
+    //! every few finished tiles as well for progressive display in Blender, at the cost of a pass over the image.
+    //!
+    //! @return     Splatted radiance is refreshed every this number of finished tiles, 0 means never.
+    unsigned        GetSplatRefreshInterval() const{
+        return m_splatRefreshInterval;
+    }
+
+    //! @brief      Get how often the state of rendering is saved to a checkpoint file.
+    //!
+    //! Rendered tiles are saved in the resource folder every few seconds, so that rendering preempted on a farm could
+    //! be resumed later instead of starting over.
+    //!
+    //! @return     The checkpoint is saved every this number of seconds, 0 means never.
+    unsigned        GetCheckpointInterval() const{
+        return m_checkpointInterval;
+    }
+
+    //! @brief      Whether rendering is resumed from the checkpoint in the resource folder if there is one.
+    //!
+    //! @return     'True' if tiles rendered in the checkpoint are not rendered again.
+    bool            GetResumeEnabled() const{
+        return m_resumeEnabled;
+    }
+
+    //! @brief      Whether the image is streamed to a tiled OpenEXR file while it is being rendered.
+    //!
+    //! @return     'True' if each tile is written to the output file as soon as it is finished.
+    bool            GetTiledExrEnabled() const{
+        return m_tiledExrEnabled;
+    }
+
+    //! @brief      Get the storage format of the pixels of the image.
+    //!
+    //! Half floats take half of the memory, pixels are converted to floats when the image is written.
+    //!
+    //! @return     Storage format of the pixels of the image.
+    RenderTargetFormat GetRenderTargetFormat() const{
+        return m_renderTargetFormat;
+    }
+
+    //! @brief      Whether MERL measured BRDF data is stored as half floats.
+    //!
+    //! Half floats take half of the memory of floats, which matters with lots of measured materials.
+    //!
+    //! @return     'True' if MERL measured BRDF data is stored as half floats.
+    bool            GetMerlHalfPrecision() const{
+        return m_merlHalfPrecision;
+    }
+
+    //! @brief      Whether hair bxdfs share tables of their parameters.
+    //!
+    //! Terms depending on roughness and index of refraction of hair are computed once per material instead of at every hit.
+    //!
+    //! @return     'True' if hair bxdfs are evaluated with shared tables.
+    bool            GetHairTabulated() const{
+        return m_hairTabulated;
+    }
+
+    //! @brief      Whether indirect sky lookups use the prefiltered levels of the sky.
+    //!
+    //! Sky radiance arriving at vertices after the first one is looked up in the mip-map of the sky at the width of
+    //! the BSDF lobe, small levels stay in cache at the cost of a little blur in rough reflections.
+    //!
+    //! @return     'True' if indirect sky lookups are prefiltered.
+    bool            GetSkyProxy() const{
+        return m_skyProxy;
+    }
+
+    //! @brief      Threshold of the russian roulette on shadow rays.
+    //!
+    //! Shadow rays whose unoccluded contribution is below the threshold are traced with a probability proportional to
+    //! the contribution and weighted by its inverse, occlusion queries of faint light samples mostly go away.
+    //!
+    //! @return     Threshold of the contribution, 0 means every shadow ray is traced.
+    float           GetShadowRoulette() const{
+        return m_shadowRoulette;
+    }
+
+    //! @brief      Whether scattering in media is also sampled around point lights.
+    //!
+    //! Besides the scattering point picked by distance sampling, a point is picked along each segment in media with
+    //! equiangular sampling towards a point or spot light, both are combined with multiple importance sampling.
+    //!
+    //! @return     'True' if equiangular sampling is enabled.
+    bool            GetEquiangular() const{
+        return m_equiangular;
+    }
+
+    //! @brief      Margin out of the view frustums within which surface primitives are kept.
+    //!
+    //! Surface primitives far away from what the cameras see are removed before accelerators are built, which saves
+    //! both build time and memory of large scenes. It is biased, the margin relative to the size of the scene keeps
+    //! what is around the view for secondary bounces.
+    //!
+    //! @return     Margin relative to the size of the scene, negative means nothing is pruned.
+    float           GetFrustumPrune() const{
+        return m_frustumPrune;
+    }
+
+    //! @brief      Size in pixels below which geometry is replaced with simplified levels of detail.
+    //!
+    //! Instanced meshes are intersected with a coarser version once the footprint of the ray covers details smaller than
+    //! this, hair strands thinner than this on screen are randomly dropped with the rest of them getting wider.
+    //!
+    //! @return     Size in pixels, 0 means geometry is always rendered in full detail.
+    float           GetLodPixels() const{
+        return m_lodPixels;
+    }
+
+    //! @brief      Weight of what integrators learned in the last frame when they warm start the next frame.
+    //!
+    //! Path guiding, efficiency-aware roulette and the radiance cache keep what they learn in a frame, in memory for
+    //! the following frames of a sequence and in the resource folder for frames rendered one process after another.
+    //!
+    //! @return     The decay of what is learned per frame, 0 means everything is learned from scratch in every frame.
+    float           GetWarmStartDecay() const{
+        return m_warmStartDecay;
+    }
+
+    //! @brief      Get the AOVs to be rendered along with the image.
+    //!
+    //! @return     Bit i is set if AOV i is enabled, 0 means there is no AOV.
+    unsigned        GetAovMask() const{
+        return m_aovMask;
+    }
+
+    //! @brief      Get the port to listen on as the coordinator of distributed rendering.
+    //!
+    //! The coordinator doesn't render anything itself, it hands out tiles to worker nodes and assembles the image.
+    //!
+    //! @return     Port to listen on, 0 means the current node is not the coordinator.
+    unsigned        GetCoordinatorPort() const{
+        return m_coordinatorPort;
+    }
+
+    //! @brief      Get the address of the coordinator as a worker node of distributed rendering.
+    //!
+    //! Each worker node loads the scene itself, renders the tiles handed out by the coordinator and sends them back.
+    //!
+    //! @return     Address of the coordinator in the format of 'host:port', empty if the current node is not a worker.
+    const std::string&  GetCoordinatorAddress() const{
+        return m_coordinatorAddress;
+    }
+
+    //! @brief      Get the port to listen on for render jobs as a render server.
+    //!
+    //! A render server keeps the scene loaded between jobs, each job could have a different camera, resolution,
+    //! sample count and output file.
+    //!
+    //! @return     Port to listen on, 0 means the current instance renders the input file once and quits.
+    unsigned        GetServerPort() const{
+        return m_serverPort;
+    }
+
+    //! @brief      Get the folder caching remote assets, like textures fetched through http.
+    //!
+    //! @return     Folder of the cache, empty means 'sort_assets' in the temporary folder.
+    const std::string&  GetAssetCachePath() const{
+        return m_assetCachePath;
+    }
+
+    //! @brief      Get the plain http endpoint of S3 buckets, like a gateway on the local network.
+    //!
+    //! @return     Endpoint in the format of 'host:port', empty means the public endpoint of each bucket.
+    const std::string&  GetS3Endpoint() const{
+        return m_s3Endpoint;
+    }
+
+    //! @brief      Get the port serving metrics of a render server in the Prometheus text format.
+    //!
+    //! @return     Port serving metrics, 0 means metrics are not served.
+    unsigned        GetMetricsPort() const{
+        return m_metricsPort;
+    }
+
+    //! @brief  Whether spatial accelerators are benchmarked instead of rendering the scene.
+    //!
+    //! @return     Whether the current running instance is in benchmark mode.
+    bool            GetIsBenchmarkMode() const{
+        return m_benchmarkMode;
+    }
+
+    //! @brief  Fraction of pixels rendered to estimate the cost of rendering, instead of rendering the whole image.
+    //!
+    //! @return     Fraction of pixels, 0 means the scene is rendered instead of being estimated.
+    float           GetEstimateFraction() const{
+        return m_estimateFraction;
+    }
+
+    //! @brief  Get the interval of logging the progress and throughput of rendering.
+    //!
+    //! @return     Seconds between two reports, 0 means nothing is logged until rendering is done.
+    float           GetTelemetryInterval() const{
+        return m_telemetryInterval;
+    }
+
+    //! @brief  Whether the timing of rendering is printed in a machine readable line once rendering is done.
+    //!
+    //! @return     Whether the timing is printed.
+    bool            GetTimingEnabled() const{
+        return m_timingEnabled;
+    }
+
+    //! @brief  Whether rendering is deterministic, the image is bitwise identical for any thread count and schedule.
+    //!
+    //! @return     Whether rendering is deterministic.
+    bool            GetDeterministic() const{
+        return m_deterministic;
+    }
+
+    //! @brief      Get the type of the spatial accelerator, after the overrides in the command line.
+    //!
+    //! @return     Name of the accelerator class.
+    StringID        GetAcceleratorType() const{
+        return m_acceleratorType;
+    }
+
+    //! @brief      Get the type of the integrator, after the overrides in the command line.
+    //!
+    //! @return     Name of the integrator class.
+    StringID        GetIntegratorType() const{
+        return m_integratorType;
+    }
+
     //! @brief      Get clampping of radiance value.
     //!
     //! Before there is a better firefly cancelling solution, clampping is the easy low hanging fruit.
@@ -153,6 +557,92 @@ public:
         return m_clampping;
     }
 
+    //! @brief      Whether samples are distributed adaptively among pixels.
+    //!
+    //! With adaptive sampling, a pixel stops taking samples once its estimated error is low enough, the samples saved
+    //! are taken by the noisiest pixels of the same tile instead. The averaged sample count per pixel stays the same.
+    //!
+    //! @return     Whether adaptive sampling is enabled.
+    bool            GetAdaptiveSampling() const{
+        return m_adaptiveSampling;
+    }
+
+    //! @brief      Get the minimum number of samples taken in each pixel with adaptive sampling.
+    //!
+    //! @return     Number of samples taken before checking whether a pixel converges.
+    unsigned        GetAdaptiveMinSamples() const{
+        return m_adaptiveMinSamples;
+    }
+
+    //! @brief      Get the target error of adaptive sampling.
+    //!
+    //! @return     A pixel converges once the standard error of its luminance relative to the luminance is below this.
+    float           GetAdaptiveThreshold() const{
+        return m_adaptiveThreshold;
+    }
+
+    //! @brief      Whether the image is rendered progressively.
+    //!
+    //! In progressive rendering, the whole image is rendered in passes with increasing samples per pixel, so that
+    //! there is a full preview of the image very quickly.
+    //!
+    //! @return     Whether progressive rendering is enabled.
+    bool            GetProgressive() const{
+        return m_progressive;
+    }
+
+    //! @brief      Get the time budget of progressive rendering.
+    //!
+    //! @return     Progressive rendering stops after this number of seconds, 0 means there is no time limit.
+    float           GetProgressiveTimeBudget() const{
+        return m_progressiveTimeBudget;
+    }
+
+    //! @brief      Whether quick preview passes go before the first pass of progressive rendering.
+    //!
+    //! Preview passes render 1/16 and then 1/4 of the pixels with one sample, the display fills the rest of the pixels,
+    //! so that there is something to see right after the camera moves in interactive rendering.
+    //!
+    //! @return     Whether quick preview passes are rendered.
+    bool            GetPreviewPasses() const{
+        return m_previewPasses;
+    }
+
+    //! @brief      Whether the noise of the image is removed once it is rendered.
+    //!
+    //! The albedo and normal AOVs are always rendered along with the image if denoising is enabled, they guide the
+    //! denoiser to keep edges and textures.
+    //!
+    //! @return     Whether the image is denoised in post process.
+    bool            GetDenoise() const{
+        return m_denoise;
+    }
+
+    //! @brief      Whether the noise of the image is removed after each pass of progressive rendering.
+    //!
+    //! It is only for previews in Blender, the image in the render target stays the same.
+    //!
+    //! @return     Whether the preview of each pass is denoised.
+    bool            GetDenoisePasses() const{
+        return m_denoisePasses;
+    }
+
+    //! @brief      Update the settings of a job of the render server.
+    //!
+    //! The image sensor is created again with the new resolution.
+    //!
+    //! @param  width   Width of the result resolution.
+    //! @param  height  Height of the result resolution.
+    //! @param  spp     Sample of per-pixel.
+    //! @param  output  Name of the output file.
+    void            SetRenderJob( unsigned width , unsigned height , unsigned spp , const std::string& output ){
+        m_resWidth = width;
+        m_resHeight = height;
+        m_samplePerPixel = spp;
+        m_outputFile = output;
+        createImageSensor();
+    }
+
     //! @brief      Parse command line.
     //!
     //! This is not a perfect way to parse command line arguments. If there is a space in the path,
@@ -187,6 +677,9 @@ public:
             if (key_str == "input") {
                 m_inputFile = value_str;
                 com_arg_valid = true;
+            }else if (key_str == "sharedinput") {
+                m_sharedInput = value_str;
+                com_arg_valid = true;
             }else if (key_str == "blendermode"){
                 m_blenderMode = true;
             }else if (key_str == "unittest") {
@@ -196,6 +689,134 @@ public:
                 m_profilingEnalbed = value_str == "on";
             }else if (key_str == "nomaterial" ){
                 m_noMaterialSupport = true;
+            }else if (key_str == "accelcache" ){
+                m_accelCacheEnabled = true;
+            }else if (key_str == "meshcache" ){
+                m_meshCacheEnabled = true;
+            }else if (key_str == "outofcore" ){
+                m_outOfCoreBudget = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "texturecache" ){
+                m_textureCacheBudget = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "volumebake" ){
+                m_volumeBakeResolution = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "sharedresources" ){
+                m_sharedResourcesEnabled = true;
+                m_sharedResourcesBudget = value_str.empty() ? 1024u : (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "benchmark" ){
+                m_benchmarkMode = true;
+            }else if (key_str == "estimate" ){
+                m_estimateFraction = value_str.empty() ? 0.01f : std::min( std::max( 0.0f , (float)atof( value_str.c_str() ) ) , 1.0f );
+            }else if (key_str == "pinthreads" ){
+                m_threadPinningEnabled = true;
+            }else if (key_str == "numa" ){
+                m_numaInterleaveEnabled = true;
+            }else if (key_str == "hugepages" ){
+                m_largePagesEnabled = true;
+            }else if (key_str == "statssampling" ){
+                m_statsSamplingRate = (unsigned)std::max( 1 , atoi( value_str.c_str() ) );
+            }else if (key_str == "statsjson" ){
+                m_statsJsonFile = value_str;
+            }else if (key_str == "splatrefresh" ){
+                m_splatRefreshInterval = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "checkpoint" ){
+                m_checkpointInterval = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "resume" ){
+                m_resumeEnabled = true;
+            }else if (key_str == "tiledexr" ){
+                m_tiledExrEnabled = true;
+            }else if (key_str == "framebuffer" ){
+                m_renderTargetFormat = value_str == "half" ? RenderTargetFormat::Half : RenderTargetFormat::Float;
+            }else if (key_str == "merlhalf" ){
+                m_merlHalfPrecision = true;
+            }else if (key_str == "hairtable" ){
+                m_hairTabulated = true;
+            }else if (key_str == "skyproxy" ){
+                m_skyProxy = true;
+            }else if (key_str == "shadowroulette" ){
+                m_shadowRoulette = value_str.empty() ? 0.01f : std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "equiangular" ){
+                m_equiangular = true;
+            }else if (key_str == "frustumprune" ){
+                m_frustumPrune = value_str.empty() ? 0.1f : std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "lod" ){
+                m_lodPixels = value_str.empty() ? 1.0f : std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "warmstart" ){
+                m_warmStartDecay = value_str.empty() ? 0.5f : std::min( std::max( 0.0f , (float)atof( value_str.c_str() ) ) , 1.0f );
+            }else if (key_str == "aov" ){
+                // names are separated by commas
+                std::stringstream names( value_str );
+                std::string name;
+                while( std::getline( names , name , ',' ) ){
+                    for( auto i = 0 ; i < AOV_CNT ; ++i ){
+                        // the cost is not for denoisers, it is only saved if it is named
+                        if( name == AovName( i ) || ( name == "all" && i != AOV_COST ) )
+                            m_aovMask |= 1u << i;
+                    }
+                }
+            }else if (key_str == "coordinator" ){
+                m_coordinatorPort = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "worker" ){
+                m_coordinatorAddress = value_str;
+            }else if (key_str == "server" ){
+                m_serverPort = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "assetcache" ){
+                m_assetCachePath = value_str;
+            }else if (key_str == "s3endpoint" ){
+                m_s3Endpoint = value_str;
+            }else if (key_str == "metrics" ){
+                m_metricsPort = (unsigned)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "telemetry" ){
+                m_telemetryInterval = value_str.empty() ? 5.0f : std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "timing" ){
+                m_timingEnabled = true;
+            }else if (key_str == "deterministic" ){
+                m_deterministic = true;
+            }else if (key_str == "preview" ){
+                m_previewPasses = true;
+            }else if (key_str == "denoise" ){
+                m_denoise = true;
+                m_denoisePasses = value_str == "passes";
+            }else if (key_str == "threads" || key_str == "spp" || key_str == "tilesize" || key_str == "resolution" ||
+                      key_str == "clamp" || key_str == "sampler" || key_str == "accelerator" || key_str == "integrator" ){
+                // settings in the input file are overridden once it is loaded.
+                m_overrides.push_back( std::make_pair( key_str , value_str ) );
+            }else if (key_str == "region" ){
+                unsigned x0 = 0 , y0 = 0 , x1 = 0 , y1 = 0;
+                if( sscanf( value_str.c_str() , "%u,%u,%u,%u" , &x0 , &y0 , &x1 , &y1 ) == 4 && x0 < x1 && y0 < y1 ){
+                    m_hasRenderRegion = true;
+                    m_regionMin = Vector2i( (int)x0 , (int)y0 );
+                    m_regionMax = Vector2i( (int)x1 , (int)y1 );
+                }else{
+                    slog( WARNING , GENERAL , "Invalid render region '%s', it should be like 0,0,128,128." , value_str.c_str() );
+                }
+            }else if (key_str == "filter" ){
+                const auto comma = value_str.find( ',' );
+                const auto name = value_str.substr( 0 , comma );
+                if( name == "gaussian" ){
+                    m_pixelFilter = PixelFilterType::Gaussian;
+                    m_filterRadius = 1.5f;
+                }else if( name == "blackmanharris" ){
+                    m_pixelFilter = PixelFilterType::BlackmanHarris;
+                    m_filterRadius = 2.0f;
+                }else{
+                    m_pixelFilter = PixelFilterType::Box;
+                    if( name != "box" )
+                        slog( WARNING , GENERAL , "Unknown pixel filter '%s', the box filter is used." , name.c_str() );
+                }
+                if( comma != std::string::npos ){
+                    const auto radius = (float)atof( value_str.c_str() + comma + 1 );
+                    if( radius >= 0.5f )
+                        m_filterRadius = radius;
+                    else
+                        slog( WARNING , GENERAL , "Invalid pixel filter radius '%s', it should be no less than 0.5." , value_str.c_str() + comma + 1 );
+                }
+            }else if (key_str == "tileorder" ){
+                if( value_str == "morton" )
+                    m_tileOrder = TileOrder::Morton;
+                else if( value_str == "hilbert" )
+                    m_tileOrder = TileOrder::Hilbert;
+                else
+                    m_tileOrder = TileOrder::Spiral;
             }
         }
 
@@ -218,33 +839,53 @@ public:
         stream >> m_samplePerPixel;
         stream >> m_resWidth >> m_resHeight;
         stream >> m_clampping;
-        StringID accelType , integratorType;
-        stream >> accelType;
-        m_accelerator = MakeUniqueInstance<Accelerator>(accelType);
+        stream >> m_adaptiveSampling >> m_adaptiveMinSamples >> m_adaptiveThreshold;
+        stream >> m_progressive >> m_progressiveTimeBudget;
+        bool preview_passes = false;
+        stream >> preview_passes;
+        m_previewPasses |= preview_passes;
+        bool denoise = false , denoise_passes = false;
+        stream >> denoise >> denoise_passes;
+        m_denoise |= denoise;
+        m_denoisePasses |= denoise_passes;
+        stream >> m_samplerType;
+        stream >> m_acceleratorType;
+        m_accelerator = MakeAccelerator(m_acceleratorType);
         if( m_accelerator )
             m_accelerator->Serialize( stream );
-		m_acceleratorVol = std::move(m_accelerator->Clone());
 
-        stream >> integratorType;
-        m_integrator = MakeUniqueInstance<Integrator>(integratorType);
+        stream >> m_integratorType;
+        m_integrator = MakeUniqueInstance<Integrator>(m_integratorType);
         if(IS_PTR_VALID(m_integrator))
             m_integrator->Serialize( stream );
 
-        if( m_blenderMode )
-            m_imageSensor = std::make_unique<BlenderImage>( m_resWidth , m_resHeight );
-        else
-            m_imageSensor = std::make_unique<RenderTargetImage>( m_resWidth , m_resHeight );
-        m_imageSensor->PreProcess();
+        applyOverrides();
+        if( 0 == m_threadCnt )
+            m_threadCnt = DefaultThreadCount();
+
+        // denoisers are guided by the albedo and the normal
+        if( m_denoise || m_denoisePasses )
+            m_aovMask |= ( 1u << AOV_ALBEDO ) | ( 1u << AOV_NORMAL );
+
+		m_acceleratorVol = std::move(m_accelerator->Clone());
+        createImageSensor();
     };
 
 private:
     std::string                     m_resourcePath = "";            /**< Full path of the resource files. */
     std::string                     m_outputFile;                   /**< Name of the output file. */
     unsigned int                    m_tileSize = 64;                /**< Size of tile for tasks to render each time. */
+    TileOrder                       m_tileOrder = TileOrder::Spiral;/**< Order of tiles and pixels to be rendered. */
+    PixelFilterType                 m_pixelFilter = PixelFilterType::Box;/**< Reconstruction filter of camera samples. */
+    float                           m_filterRadius = 0.5f;          /**< Radius of the reconstruction filter in pixels. */
     unsigned int                    m_resWidth = 1024;              /**< Width of the result resolution. */
     unsigned int                    m_resHeight = 1024;             /**< Height of the result resolution. */
+    bool                            m_hasRenderRegion = false;      /**< Whether only a region of the image is rendered. */
+    Vector2i                        m_regionMin;                    /**< Top-left corner of the render region, inclusive. */
+    Vector2i                        m_regionMax;                    /**< Bottom-right corner of the render region, exclusive. */
     unsigned int                    m_threadCnt = 16;               /**< Number of worker thread ( including the main thread as a woker thread ). */
     unsigned int                    m_samplePerPixel = 4;           /**< Sample of per-pixel. Default value is 4 for fast iteration. */
+    StringID                        m_samplerType = SID("RandomSampler");  /**< Type of the sampler taking samples in pixels. */
     std::unique_ptr<Accelerator>    m_accelerator = nullptr;        /**< Spatial accelerator for accelerating primitive/ray intersection test. */
     std::unique_ptr<Accelerator>    m_acceleratorVol = nullptr;     /**< Spatial accelerator for accelerating primitive/ray intersection test, this is only for primitives that has volumes attached to them. */
     std::unique_ptr<Integrator>     m_integrator = nullptr;         /**< Integrator used to evaluate rendering equation. */
@@ -254,32 +895,202 @@ private:
     bool                            m_unitTestMode = false;         /**< Whether the current running instance is in unit test mode. */
     bool                            m_profilingEnalbed = false;     /**< Whether profiling is enabled in SORT. Since there is a big performance issue during rendering, it is turned off by default.*/
     bool                            m_noMaterialSupport = false;    /**< Disable material support in SORT. */
+    bool                            m_accelCacheEnabled = false;    /**< Cache spatial accelerator in the resource folder. */
+    bool                            m_meshCacheEnabled = false;     /**< Cache processed meshes in the resource folder. */
+    unsigned                        m_outOfCoreBudget = 0;          /**< Memory budget of paged in vertices in megabytes. */
+    unsigned                        m_textureCacheBudget = 0;       /**< Memory budget of texture tiles in megabytes. */
+    unsigned                        m_volumeBakeResolution = 0;     /**< Resolution of the grids volume shaders are baked into. */
+    bool                            m_sharedResourcesEnabled = false;   /**< Share decoded resources with other processes. */
+    unsigned                        m_sharedResourcesBudget = 1024; /**< Memory budget of unused shared resources in megabytes. */
+    bool                            m_benchmarkMode = false;        /**< Benchmark spatial accelerators instead of rendering. */
+    float                           m_estimateFraction = 0.0f;      /**< Fraction of pixels rendered to estimate the cost of rendering. */
+    bool                            m_timingEnabled = false;        /**< Print the timing of rendering in a machine readable line. */
+    bool                            m_deterministic = false;        /**< Render the same image for any thread count and schedule. */
+    std::vector<std::pair<std::string,std::string>> m_overrides;    /**< Settings in the command line overriding the ones in the input file. */
+    StringID                        m_acceleratorType;              /**< Type of the spatial accelerator. */
+    StringID                        m_integratorType;               /**< Type of the integrator. */
+    bool                            m_threadPinningEnabled = false; /**< Pin worker threads to logical cores. */
+    bool                            m_numaInterleaveEnabled = false;/**< Interleave scene data across NUMA nodes. */
+    bool                            m_largePagesEnabled = false;    /**< Back large arrays of scene data with large pages. */
+    unsigned                        m_statsSamplingRate = 1;        /**< Hot path stats are measured in one of every this number of pixels. */
+    std::string                     m_statsJsonFile;                /**< Stats are saved to this file as JSON. */
+    unsigned                        m_splatRefreshInterval = 0;     /**< Splatted radiance is refreshed every this number of finished tiles. */
+    unsigned                        m_checkpointInterval = 0;       /**< The checkpoint is saved every this number of seconds. */
+    bool                            m_resumeEnabled = false;        /**< Resume rendering from the checkpoint. */
+    bool                            m_tiledExrEnabled = false;      /**< Stream the image to a tiled OpenEXR file. */
+    RenderTargetFormat              m_renderTargetFormat = RenderTargetFormat::Float;   /**< Storage format of the pixels of the image. */
+    bool                            m_merlHalfPrecision = false;    /**< Store MERL measured BRDF data as half floats. */
+    bool                            m_hairTabulated = false;        /**< Evaluate hair bxdfs with tables shared across hits. */
+    bool                            m_skyProxy = false;             /**< Look up prefiltered sky levels for indirect lighting. */
+    float                           m_shadowRoulette = 0.0f;        /**< Contribution below which shadow rays go through russian roulette. */
+    bool                            m_equiangular = false;          /**< Sample scattering in media around point lights too. */
+    float                           m_frustumPrune = -1.0f;         /**< Margin out of the view frustums within which primitives are kept. */
+    float                           m_lodPixels = 0.0f;             /**< Size in pixels below which geometry is simplified. */
+    float                           m_warmStartDecay = 0.0f;        /**< Weight of what is learned in the last frame. */
+    unsigned                        m_aovMask = 0;                  /**< AOVs to be rendered along with the image. */
+    unsigned                        m_coordinatorPort = 0;          /**< Port to listen on as the coordinator of distributed rendering. */
+    std::string                     m_coordinatorAddress;           /**< Address of the coordinator as a worker node of distributed rendering. */
+    unsigned                        m_serverPort = 0;               /**< Port to listen on for render jobs as a render server. */
+    std::string                     m_assetCachePath;               /**< Folder caching remote assets. */
+    std::string                     m_s3Endpoint;                   /**< Plain http endpoint of S3 buckets. */
+    unsigned                        m_metricsPort = 0;              /**< Port serving metrics of a render server. */
+    float                           m_telemetryInterval = 0.0f;     /**< Seconds between two logs of the progress of rendering. */
     std::string                     m_inputFile;                    /**< Full path of the input file. */
+    std::string                     m_sharedInput;                  /**< Name of the shared memory the input is streamed from. */
     float                           m_clampping = 0.0f;             /**< Clapping value of evaluated radiance. */
+    bool                            m_adaptiveSampling = false;     /**< Whether samples are distributed adaptively among pixels. */
+    unsigned int                    m_adaptiveMinSamples = 16;      /**< Minimum number of samples per pixel with adaptive sampling. */
+    float                           m_adaptiveThreshold = 0.01f;    /**< Target relative error of pixels with adaptive sampling. */
+    bool                            m_progressive = false;          /**< Whether the image is rendered progressively. */
+    float                           m_progressiveTimeBudget = 0.0f; /**< Seconds that progressive rendering could take, 0 for no limit. */
+    bool                            m_previewPasses = false;        /**< Whether quick preview passes go before progressive rendering. */
+    bool                            m_denoise = false;              /**< Whether the image is denoised in post process. */
+    bool                            m_denoisePasses = false;        /**< Whether the preview of each progressive pass is denoised. */
 
     //! @brief  Make constructor private
     GlobalConfiguration(){}
     //! @brief  Make copy constructor private
     GlobalConfiguration( const GlobalConfiguration& ){}
 
+    //! @brief  Override settings loaded from the input file with the ones in the command line.
+    //!
+    //! Performance sweeps try lots of variants of the same scene, exporting the scene again for each of them is
+    //! not necessary this way. An overridden accelerator or integrator takes its default settings.
+    void    applyOverrides(){
+        for( const auto& over : m_overrides ){
+            const auto& key = over.first;
+            const auto& value = over.second;
+            const auto number = atoi( value.c_str() );
+            if( key == "threads" && ( number > 0 || value == "auto" ) ){
+                m_threadCnt = (unsigned)number;
+            }else if( key == "spp" && number > 0 ){
+                m_samplePerPixel = (unsigned)number;
+            }else if( key == "tilesize" && number > 0 ){
+                m_tileSize = (unsigned)number;
+            }else if( key == "resolution" ){
+                unsigned width = 0 , height = 0;
+                if( sscanf( value.c_str() , "%ux%u" , &width , &height ) == 2 && width > 0 && height > 0 ){
+                    m_resWidth = width;
+                    m_resHeight = height;
+                }else{
+                    slog( WARNING , GENERAL , "Invalid resolution '%s', it should be like 1920x1080." , value.c_str() );
+                }
+            }else if( key == "clamp" ){
+                m_clampping = std::max( 0.0f , (float)atof( value.c_str() ) );
+            }else if( key == "sampler" ){
+                const auto type = Factory<Sampler>::GetSingleton().FindType( value );
+                if( type != StringID() )
+                    m_samplerType = type;
+                else
+                    slog( WARNING , GENERAL , "There is no sampler named '%s'." , value.c_str() );
+            }else if( key == "accelerator" ){
+                const auto type = Factory<Accelerator>::GetSingleton().FindType( value );
+                auto accelerator = type != StringID() ? MakeAccelerator( type ) : nullptr;
+                if( accelerator ){
+                    m_accelerator = std::move( accelerator );
+                    m_acceleratorType = type;
+                }else{
+                    slog( WARNING , GENERAL , "There is no accelerator named '%s'." , value.c_str() );
+                }
+            }else if( key == "integrator" ){
+                const auto type = Factory<Integrator>::GetSingleton().FindType( value );
+                auto integrator = type != StringID() ? MakeUniqueInstance<Integrator>( type ) : nullptr;
+                if( integrator ){
+                    m_integrator = std::move( integrator );
+                    m_integratorType = type;
+                }else{
+                    slog( WARNING , GENERAL , "There is no integrator named '%s'." , value.c_str() );
+                }
+            }else{
+                slog( WARNING , GENERAL , "Invalid value '%s' of the command line argument '%s'." , value.c_str() , key.c_str() );
+                continue;
+            }
+            slog( INFO , GENERAL , "Setting '%s' is overridden with '%s' in the command line." , key.c_str() , value.c_str() );
+        }
+    }
+
+    //! @brief  Create the image sensor with the current resolution.
+    void    createImageSensor(){
+        if( m_blenderMode )
+            m_imageSensor = std::make_unique<BlenderImage>( m_resWidth , m_resHeight );
+        else if( m_tiledExrEnabled )
+            m_imageSensor = std::make_unique<TiledExrImage>( m_resWidth , m_resHeight );
+        else
+            m_imageSensor = std::make_unique<RenderTargetImage>( m_resWidth , m_resHeight );
+        m_imageSensor->PreProcess();
+    }
+
     friend class Singleton<GlobalConfiguration>;
 };
 
 #define g_tileSize                  GlobalConfiguration::GetSingleton().GetTileSize()
+#define g_tileOrder                 GlobalConfiguration::GetSingleton().GetTileOrder()
+#define g_pixelFilter               GlobalConfiguration::GetSingleton().GetPixelFilter()
+#define g_filterRadius              GlobalConfiguration::GetSingleton().GetFilterRadius()
 #define g_blenderMode               GlobalConfiguration::GetSingleton().GetBlenderMode()
 #define g_accelerator               GlobalConfiguration::GetSingleton().GetAccelerator()
 #define g_acceleratorVol            GlobalConfiguration::GetSingleton().GetAcceleratorVol()
 #define g_integrator                GlobalConfiguration::GetSingleton().GetIntegrator()
 #define g_threadCnt                 GlobalConfiguration::GetSingleton().GetThreadCnt()
 #define g_samplePerPixel            GlobalConfiguration::GetSingleton().GetSamplePerPixel()
+#define g_samplerType               GlobalConfiguration::GetSingleton().GetSamplerType()
 #define g_resourcePath              GlobalConfiguration::GetSingleton().GetResourcePath()
 #define g_outputFileName            GlobalConfiguration::GetSingleton().GetOutputFileName()
 #define g_resultResollution         GlobalConfiguration::GetSingleton().GetResultResolution()
+#define g_hasRenderRegion           GlobalConfiguration::GetSingleton().GetHasRenderRegion()
+#define g_renderRegionMin           GlobalConfiguration::GetSingleton().GetRenderRegionMin()
+#define g_renderRegionMax           GlobalConfiguration::GetSingleton().GetRenderRegionMax()
 #define g_resultResollutionWidth    GlobalConfiguration::GetSingleton().GetResultResolution().x
 #define g_resultResollutionHeight   GlobalConfiguration::GetSingleton().GetResultResolution().y
 #define g_unitTestMode              GlobalConfiguration::GetSingleton().GetIsUnitTestMode()
 #define g_inputFilePath             GlobalConfiguration::GetSingleton().GetInputFilePath()
+#define g_sharedInputName           GlobalConfiguration::GetSingleton().GetSharedInputName()
 #define g_imageSensor               GlobalConfiguration::GetSingleton().GetImageSensor()
 #define g_profilingEnabled          GlobalConfiguration::GetSingleton().GetIsProfilingEnabled()
 #define g_noMaterial                GlobalConfiguration::GetSingleton().GetNoMaterial()
-#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
\ No newline at end of file
+#define g_accelCacheEnabled         GlobalConfiguration::GetSingleton().GetAccelCacheEnabled()
+#define g_meshCacheEnabled          GlobalConfiguration::GetSingleton().GetMeshCacheEnabled()
+#define g_outOfCoreBudget           GlobalConfiguration::GetSingleton().GetOutOfCoreBudget()
+#define g_textureCacheBudget        GlobalConfiguration::GetSingleton().GetTextureCacheBudget()
+#define g_volumeBakeResolution      GlobalConfiguration::GetSingleton().GetVolumeBakeResolution()
+#define g_sharedResourcesEnabled    GlobalConfiguration::GetSingleton().GetSharedResourcesEnabled()
+#define g_sharedResourcesBudget     GlobalConfiguration::GetSingleton().GetSharedResourcesBudget()
+#define g_benchmarkMode             GlobalConfiguration::GetSingleton().GetIsBenchmarkMode()
+#define g_estimateFraction          GlobalConfiguration::GetSingleton().GetEstimateFraction()
+#define g_timingEnabled             GlobalConfiguration::GetSingleton().GetTimingEnabled()
+#define g_telemetryInterval         GlobalConfiguration::GetSingleton().GetTelemetryInterval()
+#define g_deterministic             GlobalConfiguration::GetSingleton().GetDeterministic()
+#define g_threadPinningEnabled      GlobalConfiguration::GetSingleton().GetThreadPinningEnabled()
+#define g_numaInterleaveEnabled     GlobalConfiguration::GetSingleton().GetNumaInterleaveEnabled()
+#define g_largePagesEnabled         GlobalConfiguration::GetSingleton().GetLargePagesEnabled()
+#define g_statsSamplingRate         GlobalConfiguration::GetSingleton().GetStatsSamplingRate()
+#define g_statsJsonFile             GlobalConfiguration::GetSingleton().GetStatsJsonFile()
+#define g_splatRefreshInterval      GlobalConfiguration::GetSingleton().GetSplatRefreshInterval()
+#define g_checkpointInterval        GlobalConfiguration::GetSingleton().GetCheckpointInterval()
+#define g_resumeEnabled             GlobalConfiguration::GetSingleton().GetResumeEnabled()
+#define g_tiledExrEnabled           GlobalConfiguration::GetSingleton().GetTiledExrEnabled()
+#define g_renderTargetFormat        GlobalConfiguration::GetSingleton().GetRenderTargetFormat()
+#define g_merlHalfPrecision         GlobalConfiguration::GetSingleton().GetMerlHalfPrecision()
+#define g_hairTabulated             GlobalConfiguration::GetSingleton().GetHairTabulated()
+#define g_skyProxy                  GlobalConfiguration::GetSingleton().GetSkyProxy()
+#define g_shadowRoulette            GlobalConfiguration::GetSingleton().GetShadowRoulette()
+#define g_equiangular               GlobalConfiguration::GetSingleton().GetEquiangular()
+#define g_frustumPrune              GlobalConfiguration::GetSingleton().GetFrustumPrune()
+#define g_lodPixels                 GlobalConfiguration::GetSingleton().GetLodPixels()
+#define g_warmStartDecay            GlobalConfiguration::GetSingleton().GetWarmStartDecay()
+#define g_aovMask                   GlobalConfiguration::GetSingleton().GetAovMask()
+#define g_coordinatorPort           GlobalConfiguration::GetSingleton().GetCoordinatorPort()
+#define g_coordinatorAddress        GlobalConfiguration::GetSingleton().GetCoordinatorAddress()
+#define g_serverPort                GlobalConfiguration::GetSingleton().GetServerPort()
+#define g_assetCachePath            GlobalConfiguration::GetSingleton().GetAssetCachePath()
+#define g_s3Endpoint                GlobalConfiguration::GetSingleton().GetS3Endpoint()
+#define g_metricsPort               GlobalConfiguration::GetSingleton().GetMetricsPort()
+#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
+#define g_adaptiveSampling          GlobalConfiguration::GetSingleton().GetAdaptiveSampling()
+#define g_adaptiveMinSamples        GlobalConfiguration::GetSingleton().GetAdaptiveMinSamples()
+#define g_adaptiveThreshold         GlobalConfiguration::GetSingleton().GetAdaptiveThreshold()
+#define g_progressive               GlobalConfiguration::GetSingleton().GetProgressive()
+#define g_progressiveTimeBudget     GlobalConfiguration::GetSingleton().GetProgressiveTimeBudget()
+#define g_previewPasses             GlobalConfiguration::GetSingleton().GetPreviewPasses()
+#define g_denoise                   GlobalConfiguration::GetSingleton().GetDenoise()
+#define g_denoisePasses             GlobalConfiguration::GetSingleton().GetDenoisePasses()
\ No newline at end of file
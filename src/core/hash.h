@@ -0,0 +1,66 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include "core/define.h"
+
+//! @brief  Initial value of a 64 bits FNV-1a hash.
+static constexpr unsigned long long HASH_INITIAL_VALUE = 14695981039346656037ull;
+
+//! @brief  Feed some data into a 64 bits FNV-1a hash.
+//!
+//! Unlike the CRC32 used by StringID, this is for hashing a large amount of binary data, like geometry, where the 32 bits
+//! of CRC32 is not quite enough to avoid collision.
+//!
+//! @param  hash    The hash to be updated.
+//! @param  data    Data to be hashed.
+//! @param  size    Size of the data in bytes.
+SORT_FORCEINLINE void hashData( unsigned long long& hash , const void* data , const size_t size ){
+    const auto bytes = static_cast<const unsigned char*>( data );
+    for( auto i = 0u ; i < size ; ++i ){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+//! @brief  Feed the content of a file into a 64 bits FNV-1a hash.
+//!
+//! @param  hash        The hash to be updated.
+//! @param  filename    Name of the file to be hashed.
+//! @param  size        Size of the file in bytes, it is optional.
+//! @return             Whether the file could be read.
+inline bool hashFile( unsigned long long& hash , const std::string& filename , size_t* size = nullptr ){
+    std::ifstream file( filename , std::ios::binary );
+    if( !file.is_open() )
+        return false;
+
+    if( size )
+        *size = 0;
+    std::vector<char> buffer( 1024 * 1024 );
+    while( file ){
+        file.read( buffer.data() , buffer.size() );
+        hashData( hash , buffer.data() , (size_t)file.gcount() );
+        if( size )
+            *size += (size_t)file.gcount();
+    }
+    return true;
+}
@@ -0,0 +1,128 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "hwcounter.h"
+
+#if defined(SORT_ENABLE_HW_COUNTERS) && defined(SORT_ENABLE_STATS_COLLECTION) && defined(SORT_IN_LINUX)
+
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "log.h"
+
+SORT_STATS_DEFINE_HW_COUNTERS(sHwCounters)
+
+SORT_STATS_HW_COUNTERS("Performance", "Hardware Counters", sHwCounters);
+
+namespace {
+    //! @brief  A group of counters of the current thread, all of them are read at once.
+    class HwCounterGroup{
+    public:
+        //! @brief  Open the counters, nothing is counted if any of them is not available.
+        HwCounterGroup(){
+            static const std::pair<unsigned, unsigned long long> events[StatsHwCounters::EVENT_CNT] = {
+                { PERF_TYPE_HARDWARE , PERF_COUNT_HW_CPU_CYCLES } ,
+                { PERF_TYPE_HARDWARE , PERF_COUNT_HW_INSTRUCTIONS } ,
+                { PERF_TYPE_HARDWARE , PERF_COUNT_HW_CACHE_MISSES } ,
+                { PERF_TYPE_HARDWARE , PERF_COUNT_HW_BRANCH_MISSES } ,
+            };
+            for( auto i = 0 ; i < StatsHwCounters::EVENT_CNT ; ++i ){
+                perf_event_attr attr;
+                memset( &attr , 0 , sizeof( attr ) );
+                attr.size = sizeof( attr );
+                attr.type = events[i].first;
+                attr.config = events[i].second;
+                attr.read_format = PERF_FORMAT_GROUP;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                // the counters only count the current thread on whichever cpu it runs.
+                m_fds[i] = (int)syscall( __NR_perf_event_open , &attr , 0 , -1 , i ? m_fds[0] : -1 , 0 );
+                if( m_fds[i] < 0 ){
+                    close();
+                    static std::atomic<bool> warned( false );
+                    if( !warned.exchange( true ) )
+                        slog( WARNING , GENERAL , "Hardware counters are not available, check '/proc/sys/kernel/perf_event_paranoid'." );
+                    return;
+                }
+            }
+        }
+
+        //! @brief  Close the counters.
+        ~HwCounterGroup(){
+            close();
+        }
+
+        //! @brief  Whether the counters are available.
+        //!
+        //! @return     Whether the counters are opened.
+        bool IsValid() const{
+            return m_fds[0] >= 0;
+        }
+
+        //! @brief  Read all counters.
+        //!
+        //! @param  values      Values of the counters.
+        //! @return             Whether the counters are read.
+        bool Read( StatsInt* values ) const{
+            unsigned long long data[1 + StatsHwCounters::EVENT_CNT];
+            if( read( m_fds[0] , data , sizeof( data ) ) != (ssize_t)sizeof( data ) || data[0] != StatsHwCounters::EVENT_CNT )
+                return false;
+            for( auto i = 0 ; i < StatsHwCounters::EVENT_CNT ; ++i )
+                values[i] = (StatsInt)data[i + 1];
+            return true;
+        }
+
+    private:
+        int m_fds[StatsHwCounters::EVENT_CNT] = { -1 , -1 , -1 , -1 };
+
+        void close(){
+            for( auto& fd : m_fds ){
+                if( fd >= 0 )
+                    ::close( fd );
+                fd = -1;
+            }
+        }
+    };
+
+    //! @brief  Counters of the current thread, they are opened once the thread measures anything.
+    const HwCounterGroup& threadCounters(){
+        static thread_local HwCounterGroup group;
+        return group;
+    }
+}
+
+HwCounterScope::HwCounterScope( const char* region ){
+    if( !g_StatsSampled || !threadCounters().IsValid() )
+        return;
+    // the region is looked up before counting starts, so that it is not counted in the region.
+    auto counters = &sHwCounters.Get( region );
+    if( threadCounters().Read( m_begin ) )
+        m_counters = counters;
+}
+
+HwCounterScope::~HwCounterScope(){
+    StatsInt end[StatsHwCounters::EVENT_CNT];
+    if( !m_counters || !threadCounters().Read( end ) )
+        return;
+    ++m_counters->cnt;
+    for( auto i = 0 ; i < StatsHwCounters::EVENT_CNT ; ++i )
+        m_counters->events[i] += end[i] - m_begin[i];
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/define.h"
+#include "core/stats.h"
+
+// Hardware performance counters, like cycles, instructions, cache misses and branch misses, of regions of hot code,
+// like spatial accelerator traversal and material shading. They are read with perf_event on Linux, which costs a
+// system call on both ends of a region, so they are only compiled in with 'ENABLE_HW_COUNTERS' and only measured in
+// sampled units of stats. Numbers of each thread are merged into the 'Performance' stats once rendering is done.
+
+#if defined(SORT_ENABLE_HW_COUNTERS) && defined(SORT_ENABLE_STATS_COLLECTION) && defined(SORT_IN_LINUX)
+
+//! @brief  HwCounterScope adds hardware events of its life time to a region of the current thread.
+class HwCounterScope{
+public:
+    //! @brief  Start counting.
+    //!
+    //! @param  region      Name of the region, regions with the same name are counted together.
+    explicit HwCounterScope( const char* region );
+
+    //! @brief  Stop counting.
+    ~HwCounterScope();
+
+private:
+    StatsHwCounters*    m_counters = nullptr;                               /**< Counters of the region, nullptr if nothing is counted. */
+    StatsInt            m_begin[StatsHwCounters::EVENT_CNT] = { 0 };        /**< Values of the counters once the scope starts. */
+};
+
+#define SORT_HW_COUNTERS_CONCAT_IMPL(a,b)   a##b
+#define SORT_HW_COUNTERS_CONCAT(a,b)        SORT_HW_COUNTERS_CONCAT_IMPL(a,b)
+#define SORT_HW_COUNTERS(region)            HwCounterScope SORT_HW_COUNTERS_CONCAT(localHwCounterScope,__LINE__)((region));
+
+#else
+
+#define SORT_HW_COUNTERS(region)
+
+#endif
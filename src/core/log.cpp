@@ -17,10 +17,14 @@
 
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <ctime>
 #include <chrono>
 #include <string>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
 #include "core/define.h"
 #include "core/path.h"
 #include "log.h"
@@ -32,15 +36,236 @@ static bool g_logTime = true;
 static bool g_logLineInfo = false;
 static LOG_LEVEL logDefaultLevel = LOG_LEVEL::LOG_DEBUG;     // By default, debug information is avoided.
 
+// Number of messages each ring buffer could hold.
+static constexpr size_t     LOG_RING_SIZE = 1024;
+// Messages from the same line of code are suppressed if there are more than this number of them in a thread within a window.
+static constexpr int        LOG_RATE_LIMIT = 16;
+// The window of rate limiting in milliseconds.
+static constexpr long long  LOG_RATE_LIMIT_WINDOW = 1000;
+// The background thread drains all ring buffers every this many milliseconds.
+static constexpr int        LOG_DRAIN_INTERVAL = 2;
+
+namespace {
+    //! @brief  A log message waiting to be dispatched.
+    struct LogRecord{
+        LOG_LEVEL       level = LOG_LEVEL::LOG_INFO;
+        LOG_TYPE        type = LOG_TYPE::LOG_GENERAL;
+        std::string     str;
+        const char*     file = "";
+        int             line = 0;
+    };
+
+    //! @brief  Single producer single consumer lock-free ring buffer of log messages.
+    class LogRing{
+    public:
+        //! @brief  Push a message, only the owner thread pushes messages.
+        //!
+        //! @return     False if the ring buffer is full.
+        bool    Push( LogRecord&& record ){
+            const auto tail = m_tail.load( std::memory_order_relaxed );
+            if( tail - m_head.load( std::memory_order_acquire ) >= LOG_RING_SIZE )
+                return false;
+            m_records[tail % LOG_RING_SIZE] = std::move( record );
+            m_tail.store( tail + 1 , std::memory_order_release );
+            return true;
+        }
+
+        //! @brief  Pop a message, only the thread holding the drain lock pops messages.
+        //!
+        //! @return     False if the ring buffer is empty.
+        bool    Pop( LogRecord& record ){
+            const auto head = m_head.load( std::memory_order_relaxed );
+            if( head == m_tail.load( std::memory_order_acquire ) )
+                return false;
+            record = std::move( m_records[head % LOG_RING_SIZE] );
+            m_head.store( head + 1 , std::memory_order_release );
+            return true;
+        }
+
+        std::atomic<unsigned>   m_dropped = { 0 };      /**< Number of messages dropped since the ring buffer was full. */
+        std::atomic<int>        m_suppressed = { 0 };   /**< Number of messages suppressed by rate limiting that are not reported yet. */
+        std::atomic<bool>       m_orphaned = { false }; /**< Whether the owner thread has exited. */
+
+    private:
+        LogRecord                           m_records[LOG_RING_SIZE];
+        alignas(64) std::atomic<size_t>     m_head = { 0 };
+        alignas(64) std::atomic<size_t>     m_tail = { 0 };
+    };
+
+    //! @brief  The ring buffer of a thread, it is released by the background thread after the thread exits.
+    struct LogRingHolder{
+        std::shared_ptr<LogRing>    ring;
+        ~LogRingHolder(){
+            if( ring )
+                ring->m_orphaned = true;
+        }
+    };
+
+    //! @brief  How often a line of code logs in a thread.
+    struct LogRate{
+        long long   windowStart = 0;
+        int         count = 0;
+        int         suppressed = 0;
+    };
+}
+
+static std::atomic<bool>                        g_asyncLogging = { false };
+static std::mutex                               g_logRingsMutex;
+static std::mutex                               g_logDrainMutex;
+static std::vector<std::shared_ptr<LogRing>>    g_logRings;
+
+static void dispatchLog( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ){
+    for( const auto& it : g_logDispatcher )
+        it->Dispatch( level , type , str , file , line );
+}
+
+static LogRing& currentLogRing(){
+    static thread_local LogRingHolder holder;
+    if( !holder.ring ){
+        holder.ring = std::make_shared<LogRing>();
+        std::lock_guard<std::mutex> lock( g_logRingsMutex );
+        g_logRings.push_back( holder.ring );
+    }
+    return *holder.ring;
+}
+
+//! @brief  Dispatch all queued messages.
+//!
+//! @param  final   Whether it is the last drain before logging stops, messages suppressed so far are reported then since
+//!                 nothing later from the same lines of code would report them.
+static void drainLogs( bool final = false ){
+    // rings are single consumer, messages are drained by the background thread and threads logging critical messages
+    std::lock_guard<std::mutex> drain_lock( g_logDrainMutex );
+
+    std::vector<std::shared_ptr<LogRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock( g_logRingsMutex );
+        rings = g_logRings;
+    }
+
+    LogRecord record;
+    for( const auto& ring : rings ){
+        // the owner might push more messages after checking, it is only released once it has exited.
+        const auto orphaned = ring->m_orphaned.load();
+        while( ring->Pop( record ) )
+            dispatchLog( record.level , record.type , record.str.c_str() , record.file , record.line );
+
+        const auto dropped = ring->m_dropped.exchange( 0 );
+        if( dropped > 0 ){
+            const auto msg = std::to_string( dropped ) + " log messages are dropped since logging is too frequent.";
+            dispatchLog( LOG_LEVEL::LOG_WARNING , LOG_TYPE::LOG_GENERAL , msg.c_str() , __FILE__ , __LINE__ );
+        }
+
+        const auto suppressed = final || orphaned ? ring->m_suppressed.exchange( 0 ) : 0;
+        if( suppressed > 0 ){
+            const auto msg = std::to_string( suppressed ) + " log messages were suppressed since logging is too frequent.";
+            dispatchLog( LOG_LEVEL::LOG_WARNING , LOG_TYPE::LOG_GENERAL , msg.c_str() , __FILE__ , __LINE__ );
+        }
+
+        if( orphaned ){
+            std::lock_guard<std::mutex> lock( g_logRingsMutex );
+            g_logRings.erase( std::remove( g_logRings.begin() , g_logRings.end() , ring ) , g_logRings.end() );
+        }
+    }
+}
+
+//! @brief  The background thread draining all ring buffers.
+class AsyncLogger{
+public:
+    void Start(){
+        if( g_asyncLogging.exchange( true ) )
+            return;
+        m_thread = std::thread( [](){
+            while( g_asyncLogging ){
+                drainLogs();
+                std::this_thread::sleep_for( std::chrono::milliseconds( LOG_DRAIN_INTERVAL ) );
+            }
+            drainLogs( true );
+        } );
+    }
+
+    void Stop(){
+        if( !g_asyncLogging.exchange( false ) )
+            return;
+        m_thread.join();
+    }
+
+    //! @brief  Pending logs are dispatched even if logging is not stopped explicitly.
+    ~AsyncLogger(){
+        Stop();
+    }
+
+private:
+    std::thread     m_thread;
+};
+
+// It is destroyed before the dispatchers since it is defined after them.
+static AsyncLogger g_asyncLogger;
+
+//! @brief  Whether a message is suppressed since the line of code logs too often in the thread.
+//!
+//! @return     The number of messages suppressed before this one, or a negative number if it is suppressed.
+static int rateLimit( const char* file , const int line ){
+    static thread_local std::unordered_map<std::string, LogRate> rates;
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+
+    auto& rate = rates[std::string( file ) + ":" + std::to_string( line )];
+    if( now - rate.windowStart >= LOG_RATE_LIMIT_WINDOW ){
+        const auto suppressed = rate.suppressed;
+        rate = { now , 1 , 0 };
+        return suppressed;
+    }
+    if( ++rate.count > LOG_RATE_LIMIT ){
+        ++rate.suppressed;
+        return -1;
+    }
+    return 0;
+}
+
 void addLogDispatcher( std::unique_ptr<LogDispatcher> logDispatcher ){
     g_logDispatcher.push_back( std::move(logDispatcher) );
 }
 
+void startAsyncLogging(){
+    g_asyncLogger.Start();
+}
+
+void stopAsyncLogging(){
+    g_asyncLogger.Stop();
+}
+
 void sortLog( LOG_LEVEL level , LOG_TYPE type , const std::string& str , const char* file , const int line ){
     if( level < logDefaultLevel )
         return;
-    for( const auto& it : g_logDispatcher )
-        it->Dispatch( level , type , str.c_str() , file , line );
+
+    if( !g_asyncLogging ){
+        dispatchLog( level , type , str.c_str() , file , line );
+        return;
+    }
+
+    // Critical messages are written right away, the program might not live long enough for the background thread. Anything
+    // queued before them is written first so that they don't show up out of order.
+    if( level == LOG_LEVEL::LOG_CRITICAL ){
+        drainLogs();
+        dispatchLog( level , type , str.c_str() , file , line );
+        return;
+    }
+
+    auto& ring = currentLogRing();
+    const auto suppressed = rateLimit( file , line );
+    if( suppressed < 0 ){
+        ++ring.m_suppressed;
+        return;
+    }
+
+    if( suppressed > 0 ){
+        ring.m_suppressed -= suppressed;
+        const auto msg = std::to_string( suppressed ) + " similar messages were suppressed.";
+        if( !ring.Push( { level , type , msg , file , line } ) )
+            ++ring.m_dropped;
+    }
+    if( !ring.Push( { level , type , str , file , line } ) )
+        ++ring.m_dropped;
 }
 
 void LogDispatcher::Dispatch( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ){
@@ -99,13 +324,15 @@ const std::string typeToString( LOG_TYPE type ){
     ( LOG_TYPE::LOG_INTEGRATOR == type ) ? "[Integrator]" :
     ( LOG_TYPE::LOG_LIGHT == type ) ? "[Light]" :
     ( LOG_TYPE::LOG_MATERIAL == type ) ? "[Material]" :
+    ( LOG_TYPE::LOG_VOLUME == type ) ? "[Volume]" :
     ( LOG_TYPE::LOG_IMAGE == type ) ? "[Image]" :
     ( LOG_TYPE::LOG_SAMPLING == type ) ? "[Sampling]" :
     ( LOG_TYPE::LOG_CAMERA == type ) ? "[Camera]" :
     ( LOG_TYPE::LOG_SHAPE == type ) ? "[Shape]" :
     ( LOG_TYPE::LOG_STREAM == type ) ? "[Stream]" :
     ( LOG_TYPE::LOG_RESOURCE == type ) ? "[Resource]" :
-    ( LOG_TYPE::LOG_TASK == type ) ? "[Task]" : "[Unknown]";
+    ( LOG_TYPE::LOG_TASK == type ) ? "[Task]" :
+    ( LOG_TYPE::LOG_MEMORY == type ) ? "[Memory]" : "[Unknown]";
 }
 
 const std::string lineInfoString( const char* file , int line , LOG_LEVEL level ){
@@ -140,5 +140,18 @@ void sortLog( LOG_LEVEL level , LOG_TYPE type , const std::string& str , const c
 
 //! @brief  Add a dispatcher to the log system.
 //!
+//! Dispatchers need to be added before asynchronous logging starts.
+//!
 //! @param  logDispatcher   Dispatcher to add in the log system.
 void addLogDispatcher( std::unique_ptr<LogDispatcher> logDispatcher );
+
+//! @brief  Start dispatching logs asynchronously.
+//!
+//! Once it starts, logging threads only push messages to their own lock-free ring buffers, which are drained by
+//! a background thread, so that logging never blocks rendering or loading threads. Messages are dropped instead
+//! if the ring buffer is full. Messages repeated too often from the same line of code are suppressed temporarily.
+//! Critical messages are still dispatched synchronously, so that they are not lost if the program crashes.
+void startAsyncLogging();
+
+//! @brief  Dispatch all pending logs and stop the background thread.
+void stopAsyncLogging();
@@ -0,0 +1,175 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <mutex>
+#include <unordered_map>
+#include "memory.h"
+#include "core/globalconfig.h"
+#include "core/log.h"
+
+#if defined(SORT_IN_LINUX) || defined(SORT_IN_MAC)
+    #include <sys/mman.h>
+#endif
+#if defined(SORT_IN_MAC)
+    #include <mach/vm_statistics.h>
+#endif
+#if defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+#endif
+
+SORT_STATS_DEFINE_MEMORY(sMemoryPoolMemory)
+SORT_STATS_DEFINE_MEMORY(sLargePageMemory)
+SORT_STATS_DEFINE_MEMORY(sTransparentHugePageMemory)
+
+SORT_STATS_MEMORY("Memory Pool", sMemoryPoolMemory);
+SORT_STATS_MEMORY("Large Pages", sLargePageMemory);
+SORT_STATS_MEMORY("Transparent Huge Pages", sTransparentHugePageMemory);
+
+namespace {
+    constexpr size_t LARGE_PAGE_SIZE = 2u << 20;
+    constexpr size_t HUGE_PAGE_SIZE = 1u << 30;
+    constexpr size_t LARGE_PAGE_ALIGNMENT = 64u;
+
+    //! @brief  A mapping allocated by the OS directly.
+    struct LargePageMapping{
+        size_t          size;           /**< Size of the whole mapping. */
+        bool            transparent;    /**< Whether it is backed by transparent huge pages. */
+    };
+
+    //! @brief  Mappings allocated through 'malloc_large_pages', memory not in it comes from 'malloc_aligned'.
+    std::unordered_map<void*, LargePageMapping>    g_mappings;
+    std::mutex                                      g_mappingsMutex;
+
+    SORT_FORCEINLINE size_t roundUp( size_t size , size_t alignment ){
+        return ( size + alignment - 1 ) / alignment * alignment;
+    }
+
+    void* registerMapping( void* p , size_t size , bool transparent ){
+        SORT_STATS(( transparent ? sTransparentHugePageMemory : sLargePageMemory ).Add( (StatsInt)size ));
+        std::lock_guard<std::mutex> lock( g_mappingsMutex );
+        g_mappings[p] = { size , transparent };
+        return p;
+    }
+
+    //! @brief  Warn only once if large pages are requested but not available.
+    void warnUnavailable(){
+        static std::once_flag flag;
+        std::call_once( flag , [](){
+            slog( WARNING , MEMORY , "Large pages are not available, regular pages are used instead." );
+        } );
+    }
+
+#if defined(SORT_IN_WINDOWS)
+    //! @brief  Large pages on Windows need the 'Lock pages in memory' privilege of the process.
+    bool acquireLockMemoryPrivilege(){
+        static const auto acquired = [](){
+            HANDLE token = nullptr;
+            if( !OpenProcessToken( GetCurrentProcess() , TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY , &token ) )
+                return false;
+            TOKEN_PRIVILEGES privileges;
+            privileges.PrivilegeCount = 1;
+            privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+            auto ret = LookupPrivilegeValue( nullptr , SE_LOCK_MEMORY_NAME , &privileges.Privileges[0].Luid ) &&
+                       AdjustTokenPrivileges( token , FALSE , &privileges , 0 , nullptr , nullptr ) && GetLastError() == ERROR_SUCCESS;
+            CloseHandle( token );
+            return ret;
+        }();
+        return acquired;
+    }
+#endif
+}
+
+void* malloc_large_pages( size_t size ){
+    if( 0 == size )
+        return nullptr;
+
+    if( g_largePagesEnabled ){
+#if defined(SORT_IN_LINUX)
+        constexpr auto flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+        // explicit huge pages only work if they are reserved by the system administrator.
+#ifdef MAP_HUGE_1GB
+        if( size >= HUGE_PAGE_SIZE ){
+            const auto mapping_size = roundUp( size , HUGE_PAGE_SIZE );
+            auto ret = mmap( nullptr , mapping_size , PROT_READ | PROT_WRITE , flags | MAP_HUGETLB | MAP_HUGE_1GB , -1 , 0 );
+            if( MAP_FAILED != ret )
+                return registerMapping( ret , mapping_size , false );
+        }
+#endif
+        const auto mapping_size = roundUp( size , LARGE_PAGE_SIZE );
+        auto ret = mmap( nullptr , mapping_size , PROT_READ | PROT_WRITE , flags | MAP_HUGETLB , -1 , 0 );
+        if( MAP_FAILED != ret )
+            return registerMapping( ret , mapping_size , false );
+
+        // fall back to transparent huge pages, the mapping needs to be aligned to the large page size for it.
+        ret = mmap( nullptr , mapping_size + LARGE_PAGE_SIZE , PROT_READ | PROT_WRITE , flags , -1 , 0 );
+        if( MAP_FAILED != ret ){
+            const auto address = (uintptr_t)ret;
+            const auto aligned = roundUp( address , LARGE_PAGE_SIZE );
+            if( aligned > address )
+                munmap( ret , aligned - address );
+            munmap( (void*)( aligned + mapping_size ) , address + LARGE_PAGE_SIZE - aligned );
+            if( 0 == madvise( (void*)aligned , mapping_size , MADV_HUGEPAGE ) )
+                return registerMapping( (void*)aligned , mapping_size , true );
+            munmap( (void*)aligned , mapping_size );
+        }
+#elif defined(SORT_IN_WINDOWS)
+        const auto page_size = GetLargePageMinimum();
+        if( page_size > 0 && acquireLockMemoryPrivilege() ){
+            const auto mapping_size = roundUp( size , page_size );
+            auto ret = VirtualAlloc( nullptr , mapping_size , MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES , PAGE_READWRITE );
+            if( ret )
+                return registerMapping( ret , mapping_size , false );
+        }
+#elif defined(SORT_IN_MAC) && defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+        const auto mapping_size = roundUp( size , LARGE_PAGE_SIZE );
+        auto ret = mmap( nullptr , mapping_size , PROT_READ | PROT_WRITE , MAP_PRIVATE | MAP_ANONYMOUS , VM_FLAGS_SUPERPAGE_SIZE_2MB , 0 );
+        if( MAP_FAILED != ret )
+            return registerMapping( ret , mapping_size , false );
+#endif
+        warnUnavailable();
+    }
+
+    return malloc_aligned( size , (unsigned int)LARGE_PAGE_ALIGNMENT );
+}
+
+void free_large_pages( void* p ){
+    if( IS_PTR_INVALID(p) )
+        return;
+
+    LargePageMapping mapping = { 0 , false };
+    {
+        std::lock_guard<std::mutex> lock( g_mappingsMutex );
+        auto it = g_mappings.find( p );
+        if( it != g_mappings.end() ){
+            mapping = it->second;
+            g_mappings.erase( it );
+        }
+    }
+
+    if( 0 == mapping.size ){
+        free_aligned( p );
+        return;
+    }
+
+    SORT_STATS(( mapping.transparent ? sTransparentHugePageMemory : sLargePageMemory ).Add( -(StatsInt)mapping.size ));
+#if defined(SORT_IN_WINDOWS)
+    VirtualFree( p , 0 , MEM_RELEASE );
+#else
+    munmap( p , mapping.size );
+#endif
+}
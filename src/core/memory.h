@@ -17,23 +17,143 @@
 
 #pragma once
 
-#include <list>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <new>
 #include "core/sassert.h"
+#include "core/stats.h"
 
 // 32KB memory for each memory block by default.
 #define MEM_BLOCK_SIZE                  32768
-// Memory alignment size
+// Minimal memory alignment size, allocations are aligned to the alignment of the type if it is larger.
 #define MEM_ALIGN_SIZE                  4u
-#define MEM_SIZE_ALIGNED(s)             (((s+MEM_ALIGN_SIZE-1)/MEM_ALIGN_SIZE) * MEM_ALIGN_SIZE)
+// Allocations larger than a fraction of the block size don't go to memory blocks.
+#define MEM_LARGE_ALLOCATION_RATIO      4u
+// Arrays of scene data at least this large are backed by large pages if it is enabled.
+#define MEM_LARGE_PAGE_THRESHOLD        ( 1u << 20 )
+
+SORT_STATS_DECLARE_MEMORY(sMemoryPoolMemory)
+
+//! @brief  A helper utility function that allocate memory with alignment.
+//!
+//! @param size         The size of the memory to be allocated.
+//! @param alignment    The bytes to be aligned.
+//! @return             The returned pointer pointing to allocated memory.
+SORT_FORCEINLINE void* malloc_aligned( size_t size , unsigned int alignment ){
+    void* ret = nullptr;
+    if( 0 == size )
+        return ret;
+
+#ifdef SORT_IN_WINDOWS
+    ret = _aligned_malloc( size , alignment );
+#else
+    if( 0 != posix_memalign( &ret , alignment , size ) )
+        return nullptr;
+#endif
+
+    sAssert( ( ((uintptr_t)ret) & (alignment-1) ) == 0 , MEMORY );
+    
+    return ret;
+}
+
+//! @brief  A helper function that frees the memory allocated with the interface defined above.
+//!
+//! @param  p           The address of memory allocated.
+SORT_FORCEINLINE void free_aligned( void* p ){
+    if( p ){
+#ifdef SORT_IN_WINDOWS
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+//! @brief  Allocate memory backed by large pages if it is enabled.
+//!
+//! Large pages, 2MB or 1GB, reduce TLB misses when accessing large read-only scene data randomly, like BVH nodes
+//! during traversal. It falls back to transparent huge pages on Linux, or regular pages if large pages are not
+//! available. The memory is aligned to at least 64 bytes.
+//!
+//! @param size         The size of the memory to be allocated.
+//! @return             The returned pointer pointing to allocated memory.
+void*   malloc_large_pages( size_t size );
+
+//! @brief  Free the memory allocated by 'malloc_large_pages'.
+//!
+//! @param  p           The address of memory allocated.
+void    free_large_pages( void* p );
+
+//! @brief  STL allocator for large arrays of read-only scene data.
+/**
+ * Arrays smaller than MEM_LARGE_PAGE_THRESHOLD are allocated as usual, larger ones are backed by large pages
+ * if it is enabled in the global configuration.
+ */
+template<class T>
+class LargePageAllocator {
+public:
+    using value_type = T;
+
+    LargePageAllocator() = default;
+    template<class U>
+    LargePageAllocator( const LargePageAllocator<U>& ) {}
+
+    //! @brief  Allocate memory for an array.
+    //!
+    //! @param  cnt     Number of elements in the array.
+    //! @return         The pointer pointing to allocated memory.
+    T*      allocate( size_t cnt ) {
+        const auto size = sizeof(T) * cnt;
+        auto ret = size >= MEM_LARGE_PAGE_THRESHOLD ? malloc_large_pages( size ) :
+                                                      malloc_aligned( size , (unsigned int)std::max( alignof(T) , sizeof(void*) ) );
+        if( IS_PTR_INVALID(ret) )
+            throw std::bad_alloc();
+        return (T*)ret;
+    }
+
+    //! @brief  Free the memory of an array.
+    //!
+    //! @param  p       The address of memory allocated.
+    //! @param  cnt     Number of elements in the array.
+    void    deallocate( T* p , size_t cnt ) {
+        if( sizeof(T) * cnt >= MEM_LARGE_PAGE_THRESHOLD )
+            free_large_pages( p );
+        else
+            free_aligned( p );
+    }
+
+    template<class U>
+    bool operator == ( const LargePageAllocator<U>& ) const { return true; }
+    template<class U>
+    bool operator != ( const LargePageAllocator<U>& ) const { return false; }
+};
+
+template<class T>
+using LargePageVector = std::vector<T, LargePageAllocator<T>>;
 
 //! @brief  Memory block allocated in MemoryAllocator.
 class MemoryBlock {
 public:
+    //! @brief  Constructor allocating the memory of the block.
+    //!
+    //! @param  size    Size of the memory block in bytes.
+    explicit MemoryBlock( size_t size ) : m_data(std::make_unique<char[]>(size)), m_size(size) {}
+
     /**< Real data of the memory block. */
-    std::unique_ptr<char[]> m_data = std::make_unique<char[]>(MEM_BLOCK_SIZE);
-    /**< Current position of available memory. */
-    unsigned int            m_start = 0;
+    std::unique_ptr<char[]> m_data;
+    /**< Size of the memory block in bytes. */
+    size_t                  m_size;
+};
+
+//! @brief  A position in MemoryAllocator that the allocator could be reset to.
+struct MemoryMarker {
+    /**< Index of the block being used. */
+    size_t  m_block = 0;
+    /**< Offset of available memory in the block being used. */
+    size_t  m_offset = 0;
+    /**< Number of large allocations. */
+    size_t  m_largeAllocationCnt = 0;
 };
 
 //! @brief   MemoryAllocator is responsible for allocating small trunk of memory in a fast way.
@@ -42,50 +162,140 @@ public:
  * naive 'new' method. MemoryAllocator achieves this by allocating a memory pool beforehand.
  * With a memory pool, memory allocation through MemoryAllocator benefits from avoiding page
  * allocation under the hood. And the other benefit it gets is memory deallocation is not needed
- * any more. There is no way to release allocated memory block for simplicity. Although SORT is
- * memory protected by std::unique_ptrs, there is still a possibility for it to leak memory if
- * a std::unique_ptr is allocated through this memory allocator. It is up to the higher level
- * code to make sure it doesn't happen.
+ * any more. Memory is only released in a stack manner, either all at once or back to a marker
+ * taken earlier, so that per-bounce scratch memory could be released without touching memory
+ * allocated before. Although SORT is memory protected by std::unique_ptrs, there is still a
+ * possibility for it to leak memory if a std::unique_ptr is allocated through this memory
+ * allocator. It is up to the higher level code to make sure it doesn't happen.
+ *
+ * There are two size classes. Small allocations are packed in memory blocks with the alignment
+ * of their types, allocations larger than a fraction of the block size fall back to individual
+ * aligned allocations owned by the allocator, they are freed once the allocator is reset.
  */
 class MemoryAllocator {
 public:
+    //! @brief  Constructor.
+    //!
+    //! @param  blockSize   Size of the memory blocks to be allocated.
+    explicit MemoryAllocator( size_t blockSize = MEM_BLOCK_SIZE ) : m_blockSize(blockSize) {}
+
+    //! @brief  Destructor releasing large allocations.
+    ~MemoryAllocator() {
+        releaseLargeAllocations(0);
+    }
+
+    MemoryAllocator( const MemoryAllocator& ) = delete;
+    MemoryAllocator& operator = ( const MemoryAllocator& ) = delete;
+
     //! @brief  Allocate memory from memory pool.
     //!
     //! @param  cnt     Number of instance it needs allocate.
     //! @return         The pointer pointing to memory that could hold the instance(s).
     template<class T>
     T*  Allocate(unsigned int cnt = 1u) {
-        unsigned int size_to_allocate = (unsigned int)(sizeof(T) * cnt);
-        sAssert( size_to_allocate <= MEM_BLOCK_SIZE , MEMORY );
-        MemoryBlock* currentBlock = m_availableBlocks.size() ? m_availableBlocks.front().get() : nullptr;
-        if (IS_PTR_INVALID(currentBlock) || (currentBlock->m_start + size_to_allocate > MEM_BLOCK_SIZE)) {
-            if (currentBlock) {
-                auto block = std::move(m_availableBlocks.front());
-                m_availableBlocks.pop_front();
-                m_usedBlocks.push_back(std::move(block));
+        return (T*)AllocateBytes( sizeof(T) * cnt , alignof(T) );
+    }
+
+    //! @brief  Allocate raw memory from memory pool.
+    //!
+    //! @param  size        Size of the memory in bytes.
+    //! @param  alignment   Alignment of the memory, it has to be power of two.
+    //! @return             The pointer pointing to the allocated memory.
+    void*   AllocateBytes( size_t size , size_t alignment ) {
+        alignment = std::max( alignment , (size_t)MEM_ALIGN_SIZE );
+        sAssert( ( alignment & ( alignment - 1 ) ) == 0 , MEMORY );
+
+        if( size > m_blockSize / MEM_LARGE_ALLOCATION_RATIO ){
+            auto ret = malloc_aligned( size , (unsigned int)std::max( alignment , sizeof(void*) ) );
+            sAssert( IS_PTR_VALID(ret) , MEMORY );
+            m_largeAllocations.push_back( std::make_pair( ret , size ) );
+            updateMemoryRecord( (StatsInt)size );
+            return ret;
+        }
+
+        while( m_current < m_blocks.size() ){
+            const auto& block = m_blocks[m_current];
+            const auto base = (uintptr_t)block->m_data.get();
+            const auto offset = (size_t)( ( ( base + m_offset + alignment - 1 ) & ~( (uintptr_t)alignment - 1 ) ) - base );
+            if( offset + size <= block->m_size ){
+                m_offset = offset + size;
+                return block->m_data.get() + offset;
             }
 
-            if( m_availableBlocks.empty() )
-                m_availableBlocks.push_front(std::make_unique<MemoryBlock>());
-            currentBlock = m_availableBlocks.front().get();
+            // blocks after the current one are all free, the first one that fits will be used.
+            ++m_current;
+            m_offset = 0;
         }
-        auto ret = currentBlock->m_data.get() + currentBlock->m_start;
-        currentBlock->m_start += MEM_SIZE_ALIGNED(size_to_allocate);
-        return (T*)ret;
+
+        // the block is large enough to hold the allocation with any padding for alignment.
+        m_blocks.push_back( std::make_unique<MemoryBlock>( std::max( m_blockSize , size + alignment ) ) );
+        updateMemoryRecord( (StatsInt)m_blocks.back()->m_size );
+        return AllocateBytes( size , alignment );
+    }
+
+    //! @brief  Set the size of memory blocks to be allocated later.
+    //!
+    //! @param  blockSize   Size of new memory blocks in bytes.
+    void    SetBlockSize( size_t blockSize ) {
+        m_blockSize = blockSize;
+    }
+
+    //! @brief  Get the current position of the allocator.
+    //!
+    //! @return         The marker that the allocator could be reset to later.
+    MemoryMarker GetMarker() const {
+        return { m_current , m_offset , m_largeAllocations.size() };
+    }
+
+    //! @brief  Release all memory allocated after the marker was taken.
+    //!
+    //! @param  marker  The marker taken from this allocator earlier.
+    void    ResetTo( const MemoryMarker& marker ) {
+        sAssert( marker.m_block < m_current || ( marker.m_block == m_current && marker.m_offset <= m_offset ) , MEMORY );
+        m_current = marker.m_block;
+        m_offset = marker.m_offset;
+        releaseLargeAllocations( marker.m_largeAllocationCnt );
     }
 
     //! @brief  Reset the memory allocator.
     void Reset() {
-        m_availableBlocks.splice(m_availableBlocks.begin(), m_usedBlocks);
-        for (auto& block : m_availableBlocks)
-            block->m_start = 0;
+        ResetTo( MemoryMarker() );
     }
 
 private:
-    /**< Currently availably blocks, the front one is the one being used. */
-    std::list<std::unique_ptr<MemoryBlock>>  m_availableBlocks;
-    /**< Blocks that has been consumed. */
-    std::list<std::unique_ptr<MemoryBlock>>  m_usedBlocks;
+    /**< All memory blocks, the ones after the current block are not used yet. */
+    std::vector<std::unique_ptr<MemoryBlock>>   m_blocks;
+    /**< Large allocations that don't fit in memory blocks and their sizes. */
+    std::vector<std::pair<void*, size_t>>       m_largeAllocations;
+    /**< Index of the block being used. */
+    size_t                                      m_current = 0;
+    /**< Offset of available memory in the current block. */
+    size_t                                      m_offset = 0;
+    /**< Size of new memory blocks. */
+    size_t                                      m_blockSize;
+    /**< Total bytes of blocks and large allocations. */
+    StatsInt                                    m_reservedBytes = 0;
+    /**< Memory of the blocks accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
+
+    //! @brief  Update the bytes of memory reserved by the allocator.
+    //!
+    //! @param  bytes   Bytes of memory allocated, it is negative if memory is released.
+    void    updateMemoryRecord( StatsInt bytes ) {
+        m_reservedBytes += bytes;
+        SORT_STATS(m_memoryRecord.Track( &sMemoryPoolMemory , m_reservedBytes ));
+    }
+
+    //! @brief  Free the large allocations after the first few ones.
+    //!
+    //! @param  cnt     Number of large allocations to be kept.
+    void    releaseLargeAllocations( size_t cnt ) {
+        for( auto i = cnt ; i < m_largeAllocations.size() ; ++i ){
+            free_aligned( m_largeAllocations[i].first );
+            updateMemoryRecord( -(StatsInt)m_largeAllocations[i].second );
+        }
+        m_largeAllocations.resize( std::min( cnt , m_largeAllocations.size() ) );
+    }
 };
 
 //! @brief Get static allocator.
@@ -97,41 +307,33 @@ SORT_FORCEINLINE ::MemoryAllocator& GetStaticAllocator() {
     return memoryAllocator;
 }
 
-#define SORT_MALLOC(T)              new (GetStaticAllocator().Allocate<T>()) T
-#define SORT_MALLOC_ARRAY(T,cnt)    new (GetStaticAllocator().Allocate<T>(cnt)) T
-#define SORT_CLEAR_MEMPOOL()        GetStaticAllocator().Reset()
+//! @brief  Memory allocated in the life time of MemoryScope is released once it goes out of scope.
+class MemoryScope {
+public:
+    //! @brief  Constructor taking a marker of the allocator.
+    //!
+    //! @param  allocator   The allocator to be reset to the marker later.
+    explicit MemoryScope( MemoryAllocator& allocator = GetStaticAllocator() ) : m_allocator(allocator), m_marker(allocator.GetMarker()) {}
 
-//! @brief  A helper utility function that allocate memory with alignment.
-//!
-//! @param size         The size of the memory to be allocated.
-//! @param alignment    The bytes to be aligned.
-//! @return             The returned pointer pointing to allocated memory.
-SORT_FORCEINLINE void* malloc_aligned( unsigned int size , unsigned int alignment ){
-    void* ret = nullptr;
-    if( 0 == size )
-        return ret;
+    //! @brief  Destructor resetting the allocator to the marker.
+    ~MemoryScope() {
+        m_allocator.ResetTo( m_marker );
+    }
 
-#ifdef SORT_IN_WINDOWS
-    ret = _aligned_malloc( size , alignment );
-#else
-    if( 0 != posix_memalign( &ret , alignment , size ) )
-        return nullptr;
-#endif
+    MemoryScope( const MemoryScope& ) = delete;
+    MemoryScope& operator = ( const MemoryScope& ) = delete;
 
-    sAssert( ( ((uintptr_t)ret) & (alignment-1) ) == 0 , MEMORY );
-    
-    return ret;
-}
+private:
+    /**< The allocator to be reset. */
+    MemoryAllocator&    m_allocator;
+    /**< The position of the allocator when the scope started. */
+    MemoryMarker        m_marker;
+};
 
-//! @brief  A helper function that frees the memory allocated with the interface defined above.
-//!
-//! @param  p           The address of memory allocated.
-SORT_FORCEINLINE void free_aligned( void* p ){
-    if( p ){
-#ifdef SORT_IN_WINDOWS
-        _aligned_free(p);
-#else
-        free(p);
-#endif
-    }
-}
\ No newline at end of file
+#define SORT_MEM_CAT_PROXY(v0, v1)  v0 ## v1
+#define SORT_MEM_CAT(v0, v1)        SORT_MEM_CAT_PROXY(v0, v1)
+
+#define SORT_MALLOC(T)              new (GetStaticAllocator().Allocate<T>()) T
+#define SORT_MALLOC_ARRAY(T,cnt)    new (GetStaticAllocator().Allocate<T>(cnt)) T
+#define SORT_CLEAR_MEMPOOL()        GetStaticAllocator().Reset()
+#define SORT_MEMPOOL_SCOPE()        MemoryScope SORT_MEM_CAT(sort_memory_scope_, __LINE__)
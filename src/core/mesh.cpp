@@ -16,17 +16,61 @@
  */
 
 #include "mesh.h"
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
 #include "entity/visual.h"
 #include "stream/stream.h"
 #include "material/matmanager.h"
+#include "material/material.h"
+#include "medium/medium.h"
+#include "math/interaction.h"
 #include "entity/entity.h"
 #include "stream/stream.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
+#include "core/stats.h"
+#include "core/globalconfig.h"
+#include "stream/fstream.h"
+#include "stream/mmapstream.h"
+
+SORT_STATS_DEFINE_MEMORY(sMeshVertexMemory)
+
+SORT_STATS_DEFINE_COUNTER(sMeshCacheHits)
+SORT_STATS_DEFINE_COUNTER(sMeshCacheMisses)
+SORT_STATS_DEFINE_COUNTER(sPagedMeshes)
+SORT_STATS_DEFINE_COUNTER(sPagedMeshEvictions)
+
+SORT_STATS_MEMORY("Mesh Vertices", sMeshVertexMemory);
+SORT_STATS_COUNTER("Mesh Cache", "Meshes loaded from cache", sMeshCacheHits);
+SORT_STATS_COUNTER("Mesh Cache", "Meshes processed and cached", sMeshCacheMisses);
+SORT_STATS_COUNTER("Mesh Cache", "Meshes paged in from cache", sPagedMeshes);
+SORT_STATS_COUNTER("Mesh Cache", "Paged meshes evicted from memory", sPagedMeshEvictions);
+
+// Identifier and version of mesh cache files.
+static constexpr unsigned MESH_CACHE_MAGIC = 0x48534d53;
+static constexpr unsigned MESH_CACHE_VERSION = 1;
+
+// Mesh cache file whose vertices are paged in on demand.
+struct PagedMeshFile {
+    std::weak_ptr<IMappedFileStream>    file;           /**< Mapped cache file, it is gone once the mesh is destroyed. */
+    size_t                              resident = 0;   /**< Resident size measured by the last trim pass. */
+    unsigned                            lastUse = 0;    /**< The last trim pass that found the file paged in further. */
+};
+
+// Paged mesh cache files, the least recently used ones are evicted first to meet the budget.
+static std::mutex                                       g_pagedMutex;
+static std::vector<PagedMeshFile>                       g_pagedFiles;
+static unsigned                                         g_pagedTrimCount = 0;
+static std::chrono::steady_clock::time_point            g_pagedLastTrim;
 
 void Mesh::ApplyTransform( const Transform& transform ){
+    // vertices paged in from the mesh cache are read only
+    m_vertices.Unmap();
     for (MeshVertex& mv : m_vertices) {
         mv.m_position = transform.TransformPoint(mv.m_position);
-        mv.m_normal = transform.TransformNormal((mv.m_normal).Normalize());
+        mv.SetNormal(transform.TransformNormal(mv.GetNormal()));
 
         // Warning this function seems to cause quite some trouble on MacOS during the first renderer somehow.
         // And this problem only exists on MacOS not the other two OS.
@@ -39,6 +83,14 @@ void Mesh::ApplyTransform( const Transform& transform ){
     m_world2Volume = m_local2Volume * transform.invMatrix;
 }
 
+void Mesh::ApplyMotion( const Transform& transform , const Transform& motion ){
+    // vertices are in world space already, they are moved back to the local space first.
+    const auto to_close = motion * Inverse( transform );
+    m_motionPositions.resize( m_vertices.size() );
+    for( auto i = 0u ; i < m_vertices.size() ; ++i )
+        m_motionPositions[i] = to_close.TransformPoint( m_vertices[i].m_position );
+}
+
 void Mesh::GenSmoothTagent(){
     // generate tangent for each triangle
     std::vector<std::vector<Vector>> tangent(m_vertices.size());
@@ -53,7 +105,77 @@ void Mesh::GenSmoothTagent(){
         Vector t;
         for (auto v : tangent[i])
             t += v;
-        m_vertices[i].m_tangent = t.Normalize();
+        m_vertices[i].SetTangent(t);
+    }
+}
+
+void Mesh::Simplify( const float cell , Mesh& simplified ) const{
+    sAssert( cell > 0.0f , GENERAL );
+
+    simplified.m_materials = m_materials;
+    simplified.m_hasUV = m_hasUV;
+    if( m_vertices.empty() )
+        return;
+
+    Point origin = m_vertices[0].m_position;
+    for( const MeshVertex& mv : m_vertices ){
+        origin.x = std::min( origin.x , mv.m_position.x );
+        origin.y = std::min( origin.y , mv.m_position.y );
+        origin.z = std::min( origin.z , mv.m_position.z );
+    }
+
+    struct Cluster{
+        Vector      position;
+        Vector      normal;
+        Vector      tangent;
+        Vector2f    texCoord;
+        unsigned    cnt = 0;
+    };
+
+    // 21 bits per axis is way more than enough, meshes are only simplified with cells larger than their triangles
+    std::unordered_map<unsigned long long, int> cells;
+    std::vector<Cluster> clusters;
+    std::vector<int> remap( m_vertices.size() );
+    const auto inv_cell = 1.0f / cell;
+    for( auto i = 0u ; i < m_vertices.size() ; ++i ){
+        const auto& mv = m_vertices[i];
+        const auto d = ( mv.m_position - origin ) * inv_cell;
+        const auto key = ( (unsigned long long)d.x & 0x1fffff ) | ( ( (unsigned long long)d.y & 0x1fffff ) << 21 ) |
+                         ( ( (unsigned long long)d.z & 0x1fffff ) << 42 );
+
+        const auto it = cells.emplace( key , (int)clusters.size() ).first;
+        if( it->second == (int)clusters.size() )
+            clusters.emplace_back();
+
+        auto& cluster = clusters[it->second];
+        cluster.position += Vector( mv.m_position.x , mv.m_position.y , mv.m_position.z );
+        cluster.normal += mv.GetNormal();
+        cluster.tangent += mv.GetTangent();
+        cluster.texCoord += mv.m_texCoord;
+        ++cluster.cnt;
+        remap[i] = it->second;
+    }
+
+    simplified.m_vertices.resize( clusters.size() );
+    for( auto i = 0u ; i < clusters.size() ; ++i ){
+        const auto& cluster = clusters[i];
+        const auto inv_cnt = 1.0f / (float)cluster.cnt;
+        auto& mv = simplified.m_vertices[i];
+        mv.m_position = Point( cluster.position.x * inv_cnt , cluster.position.y * inv_cnt , cluster.position.z * inv_cnt );
+        mv.SetNormal( cluster.normal );
+        mv.SetTangent( cluster.tangent );
+        mv.m_texCoord = cluster.texCoord * inv_cnt;
+    }
+
+    simplified.m_indices.clear();
+    for( const auto& mi : m_indices ){
+        MeshFaceIndex face;
+        face.m_id[0] = remap[mi.m_id[0]];
+        face.m_id[1] = remap[mi.m_id[1]];
+        face.m_id[2] = remap[mi.m_id[2]];
+        face.m_matId = mi.m_matId;
+        if( face.m_id[0] != face.m_id[1] && face.m_id[1] != face.m_id[2] && face.m_id[2] != face.m_id[0] )
+            simplified.m_indices.push_back( face );
     }
 }
 
@@ -108,24 +230,89 @@ Vector Mesh::genTagentForTri( const MeshFaceIndex& mi ) const{
     return ( dv2 * dp1 - dv1 * dp2 ) / determinant;
 }
 
+// Stream an array in bulk. Load takes the size as an int, huge arrays are split into a few calls.
+template<typename T>
+static void loadArray(IStreamBase& stream, std::vector<T>& data, size_t cnt) {
+    constexpr size_t max_chunk = 1u << 30;
+    data.resize(cnt);
+    auto bytes = (char*)data.data();
+    for (size_t size = sizeof(T) * cnt; size > 0;) {
+        const auto chunk = std::min(size, max_chunk);
+        stream.Load(bytes, (int)chunk);
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
 void Mesh::Serialize(IStreamBase& stream) {
+    unsigned int version = 0;
+    stream >> version;
+    sAssertMsg(MESH_SERIALIZATION_VERSION == version, GENERAL, "Incompatible mesh layout in the resource file with this version SORT.");
+
     stream >> m_hasUV;
-    unsigned int vb_cnt, ib_cnt;
+    unsigned int vb_cnt = 0, ib_cnt = 0;
     stream >> vb_cnt;
+
+    // Each attribute of the vertices comes as a contiguous array.
+    std::vector<float> positions, normals, uvs;
+    loadArray(stream, positions, 3 * (size_t)vb_cnt);
+    loadArray(stream, normals, 3 * (size_t)vb_cnt);
+    if (m_hasUV)
+        loadArray(stream, uvs, 2 * (size_t)vb_cnt);
+
+    // the content of the mesh identifies its cache
+    if (g_meshCacheEnabled) {
+        hashData(m_contentHash, &m_hasUV, sizeof(m_hasUV));
+        hashData(m_contentHash, &vb_cnt, sizeof(vb_cnt));
+        hashData(m_contentHash, positions.data(), sizeof(float) * positions.size());
+        hashData(m_contentHash, normals.data(), sizeof(float) * normals.size());
+        hashData(m_contentHash, uvs.data(), sizeof(float) * uvs.size());
+    }
+
     m_vertices.resize(vb_cnt);
-    for (MeshVertex& mv : m_vertices)
-        stream >> mv.m_position >> mv.m_normal >> mv.m_texCoord;
+    for (unsigned int i = 0; i < vb_cnt; ++i) {
+        MeshVertex& mv = m_vertices[i];
+        mv.m_position = Point(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+        mv.SetNormal(Vector(normals[3 * i], normals[3 * i + 1], normals[3 * i + 2]));
+        mv.m_texCoord = m_hasUV ? Vector2f(uvs[2 * i], uvs[2 * i + 1]) : Vector2f(0.0f, 0.0f);
+    }
+    SORT_STATS(m_memoryRecord.Track(&sMeshVertexMemory, (StatsInt)(sizeof(MeshVertex) * m_vertices.capacity())));
+
+    // Indices of the triangles are followed by the materials of them.
+    stream >> ib_cnt;
+    std::vector<int> indices, mat_ids;
+    loadArray(stream, indices, 3 * (size_t)ib_cnt);
+    loadArray(stream, mat_ids, ib_cnt);
+
+    // tangents depend on the triangles
+    if (g_meshCacheEnabled) {
+        hashData(m_contentHash, &ib_cnt, sizeof(ib_cnt));
+        hashData(m_contentHash, indices.data(), sizeof(int) * indices.size());
+    }
+
+    // materials are only built once something is bound to them
+    MatManager::GetSingleton().BindMaterials(mat_ids);
 
     // mapping from original material to material proxy
     std::unordered_map<const MaterialBase*, const MaterialBase*> mapping;
+    // mapping from material id in the stream to the index in the material table of the mesh
+    std::unordered_map<int, unsigned> table;
 
-    stream >> ib_cnt;
+    m_materials.clear();
     m_indices.resize(ib_cnt);
-    for (auto& mi : m_indices) {
-        stream >> mi.m_id[0] >> mi.m_id[1] >> mi.m_id[2];
-        int mat_id = -1;
-        stream >> mat_id;
-        mi.m_mat = MatManager::GetSingleton().GetMaterial(mat_id);
+    for (unsigned int i = 0; i < ib_cnt; ++i) {
+        auto& mi = m_indices[i];
+        mi.m_id[0] = indices[3 * i];
+        mi.m_id[1] = indices[3 * i + 1];
+        mi.m_id[2] = indices[3 * i + 2];
+
+        const auto it = table.find(mat_ids[i]);
+        if (it != table.end()) {
+            mi.m_matId = it->second;
+            continue;
+        }
+
+        auto mat = MatManager::GetSingleton().GetMaterial(mat_ids[i]);
 
         // If there is SSS in the material or volume is attached to the material, it is necessary to create a material proxy to
         // prevent the same material used in multiple places being recognized as the same one.
@@ -133,13 +320,17 @@ void Mesh::Serialize(IStreamBase& stream) {
         // This doesn't handle the corner cases that the same material used in two separate parts in a same mesh, the two parts
         // will still have SSS bleeding together. But it doesn't prevent a same material used by two meshes being bleeding from
         // each other.
-        if (mi.m_mat->HasSSS() || mi.m_mat->HasVolumeAttached()) {
+        if (mat->HasSSS() || mat->HasVolumeAttached()) {
             // material proxy of this material is not created yet.
-            if (0 == mapping.count(mi.m_mat))
-                mapping[mi.m_mat] = MatManager::GetSingleton().CreateMaterialProxy(*mi.m_mat);
+            if (0 == mapping.count(mat))
+                mapping[mat] = MatManager::GetSingleton().CreateMaterialProxy(*mat);
 
-            mi.m_mat = mapping[mi.m_mat];
+            mat = mapping[mat];
         }
+
+        mi.m_matId = (unsigned)m_materials.size();
+        table[mat_ids[i]] = mi.m_matId;
+        m_materials.push_back(mat);
     }
 
     static const StringID has_volume_sid("has_volume");
@@ -177,6 +368,90 @@ void Mesh::Serialize(IStreamBase& stream) {
     sAssert(eom_sid == end_of_mesh, GENERAL);
 }
 
+// Name of the cache file of a mesh with a transform.
+static std::string meshCacheFile(unsigned long long hash, const Transform& transform, const std::string& folder) {
+    hashData(hash, transform.matrix.m, sizeof(transform.matrix.m));
+
+    char name[64];
+    snprintf(name, sizeof(name), "mesh_%016llx.cache", hash);
+    return folder + name;
+}
+
+bool Mesh::LoadCache(const Transform& transform, const std::string& folder) {
+    if (HASH_INITIAL_VALUE == m_contentHash)
+        return false;
+    const auto cache_file = meshCacheFile(m_contentHash, transform, folder);
+
+    // check whether the file exists first since missing cache is not worth a warning
+    if (!std::ifstream(cache_file, std::ios::in | std::ios::binary).good())
+        return false;
+
+    auto stream = std::make_shared<IMappedFileStream>(cache_file);
+    unsigned magic = 0, version = 0, vertex_size = 0, vb_cnt = 0;
+    *stream >> magic >> version >> vertex_size >> vb_cnt;
+    if (!stream->IsValid() || MESH_CACHE_MAGIC != magic || MESH_CACHE_VERSION != version ||
+        sizeof(MeshVertex) != vertex_size || m_vertices.size() != vb_cnt)
+        return false;
+
+    // the vertices are laid out in the file exactly the same as in memory
+    const auto header_size = 4 * sizeof(unsigned);
+    if (stream->GetSize() != header_size + sizeof(MeshVertex) * vb_cnt)
+        return false;
+
+    // With an out of core budget, vertices are paged in from the file when triangles are hit instead of being copied.
+    const auto vertices = reinterpret_cast<const MeshVertex*>(stream->GetData() + header_size);
+    if (g_outOfCoreBudget > 0 && vb_cnt > 0) {
+        stream->AdviseRandomAccess();
+        {
+            std::lock_guard<std::mutex> lock(g_pagedMutex);
+            g_pagedFiles.push_back({ stream , 0 , g_pagedTrimCount });
+        }
+        m_vertices.Map(stream, vertices, vb_cnt);
+        SORT_STATS(m_memoryRecord.Release());
+        SORT_STATS(++sPagedMeshes);
+    } else if (vb_cnt > 0) {
+        memcpy(m_vertices.data(), vertices, sizeof(MeshVertex) * vb_cnt);
+    }
+
+    m_world2Volume = m_local2Volume * transform.invMatrix;
+    SORT_STATS(++sMeshCacheHits);
+    return true;
+}
+
+void Mesh::SaveCache(const Transform& transform, const std::string& folder) const {
+    if (HASH_INITIAL_VALUE == m_contentHash)
+        return;
+    const auto cache_file = meshCacheFile(m_contentHash, transform, folder);
+
+    // Meshes are loaded in parallel, the same mesh with the same transform could be saved by two threads at the same time.
+    // The cache is saved to a temporary file first so that nobody loads a partially saved cache.
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%p.tmp", (const void*)this);
+    const auto tmp_file = cache_file + suffix;
+    auto saved = false;
+    {
+        OFileStream stream(tmp_file);
+        const auto vb_cnt = (unsigned)m_vertices.size();
+        stream << MESH_CACHE_MAGIC << MESH_CACHE_VERSION << (unsigned)sizeof(MeshVertex) << vb_cnt;
+        auto data = (char*)m_vertices.data();
+        for (size_t size = sizeof(MeshVertex) * vb_cnt; size > 0;) {
+            const auto chunk = std::min(size, (size_t)1 << 30);
+            stream.Write(data, (int)chunk);
+            data += chunk;
+            size -= chunk;
+        }
+        saved = stream.IsValid();
+    }
+
+    if (saved) {
+        std::remove(cache_file.c_str());
+        std::rename(tmp_file.c_str(), cache_file.c_str());
+        SORT_STATS(++sMeshCacheMisses);
+    } else {
+        std::remove(tmp_file.c_str());
+    }
+}
+
 float Mesh::SampleVolumeDensity(const Point& pos) const {
     if (IS_PTR_INVALID(m_volumeDensity))
         return 0.0f;
@@ -189,4 +464,107 @@ Spectrum Mesh::SampleVolumeColor(const Point& pos) const {
         return 0.0f;
     const auto uvw = m_world2Volume.TransformPoint(pos);
     return m_volumeColor->Sample(uvw);
-}
\ No newline at end of file
+}
+
+const MediumMajorant* Mesh::GetVolumeMajorant(const MaterialBase* material) const {
+    if (IS_PTR_INVALID(m_volumeDensity))
+        return nullptr;
+
+    // the grid is only built once, the function is not evaluated for the rest of the rays
+    return m_volumeDensity->GetMajorant(material, [this, material](const Point& uvw) {
+        Matrix volume2World;
+        m_world2Volume.Inverse(volume2World);
+
+        MediumInteraction mi;
+        mi.intersect = volume2World.TransformPoint(uvw);
+        mi.mesh = this;
+        MediumSample ms;
+        material->EvaluateMediumSample(mi, ms);
+
+        const auto extinction = ms.basecolor * ms.extinction;
+        return std::max(extinction[0], std::max(extinction[1], extinction[2]));
+    });
+}
+
+void Mesh::BakeVolumes() {
+    m_bakedMedia.clear();
+    if (IS_PTR_INVALID(m_volumeDensity) || 0 == g_volumeBakeResolution)
+        return;
+
+    Matrix volume2World;
+    m_world2Volume.Inverse(volume2World);
+    for (const auto material : m_materials) {
+        if (!material->HasVolumeAttached() || GetBakedMedium(material))
+            continue;
+
+        auto baked = std::make_unique<BakedMedium>();
+        baked->Bake(g_volumeBakeResolution, [&](const Point& uvw, MediumSample& ms) {
+            MediumInteraction mi;
+            mi.intersect = volume2World.TransformPoint(uvw);
+            mi.mesh = this;
+            material->EvaluateMediumSample(mi, ms);
+        });
+        m_bakedMedia.emplace_back(material, std::move(baked));
+    }
+}
+
+const BakedMedium* Mesh::GetBakedMedium(const MaterialBase* material) const {
+    for (const auto& baked : m_bakedMedia) {
+        if (baked.first == material)
+            return baked.second.get();
+    }
+    return nullptr;
+}
+
+void Mesh::TrimPagedVertices() {
+    if (0 == g_outOfCoreBudget)
+        return;
+
+    // Measuring the resident memory is not free, nobody should wait for it either.
+    std::unique_lock<std::mutex> lock(g_pagedMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - g_pagedLastTrim < std::chrono::seconds(1))
+        return;
+    g_pagedLastTrim = now;
+
+    // files of meshes that are already destroyed are not tracked anymore
+    g_pagedFiles.erase(std::remove_if(g_pagedFiles.begin(), g_pagedFiles.end(),
+                                      [](const PagedMeshFile& paged) { return paged.file.expired(); }),
+                       g_pagedFiles.end());
+    if (g_pagedFiles.empty())
+        return;
+
+    // There is no way to tell whether resident pages are read, a file counts as used when more of it is paged in since
+    // the last pass. Files that stay resident without growing age until they are evicted and paged in again.
+    ++g_pagedTrimCount;
+    std::vector<std::shared_ptr<IMappedFileStream>> files;
+    size_t total = 0;
+    for (auto& paged : g_pagedFiles) {
+        files.push_back(paged.file.lock());
+        const auto resident = files.back() ? files.back()->GetResidentSize() : 0;
+        if (resident > paged.resident)
+            paged.lastUse = g_pagedTrimCount;
+        paged.resident = resident;
+        total += resident;
+    }
+
+    const auto budget = (size_t)g_outOfCoreBudget * 1024 * 1024;
+    if (total <= budget)
+        return;
+
+    std::vector<size_t> order(files.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [](size_t a, size_t b) { return g_pagedFiles[a].lastUse < g_pagedFiles[b].lastUse; });
+    for (size_t i = 0; i < order.size() && total > budget; ++i) {
+        auto& paged = g_pagedFiles[order[i]];
+        if (!files[order[i]] || 0 == paged.resident)
+            continue;
+        files[order[i]]->Evict();
+        total -= paged.resident;
+        paged.resident = 0;
+        SORT_STATS(++sPagedMeshEvictions);
+    }
+}
@@ -25,21 +25,122 @@
 #include "math/transform.h"
 #include "stream/stream.h"
 #include "medium/mediumdata.h"
+#include "core/stats.h"
+#include "core/memory.h"
+#include "core/hash.h"
 
 class MaterialBase;
+class IMappedFileStream;
+
+//! @brief  This needs to be updated every time the layout of serialized meshes changes.
+constexpr unsigned int MESH_SERIALIZATION_VERSION = 1;
 
 //! @brief  MeshVertex defines the basic information for a vertex in mesh.
+/**
+ * Normals and tangents are saved with octahedral encoding, which takes 28 bytes per vertex instead of 44. Positions and
+ * texture coordinates stay in full precision, half floats can't even address each texel of a 4K texture near 1.0.
+ */
 struct MeshVertex {
     Point       m_position;     /**< The position of the vertex in world space. */
-    Vector      m_normal;       /**< The normal of the vertex in world space. */
-    Vector      m_tangent;      /**< The tangent of the vertex in world space. */
+    unsigned    m_normal = 0;   /**< The octahedral encoded normal of the vertex in world space. */
+    unsigned    m_tangent = 0;  /**< The octahedral encoded tangent of the vertex in world space. */
     Vector2f    m_texCoord;     /**< The only channel of texture coordinate of the vertex. */
+
+    //! @brief  Get the normal of the vertex.
+    SORT_FORCEINLINE Vector GetNormal() const { return DecodeOctahedral( m_normal ); }
+
+    //! @brief  Get the tangent of the vertex.
+    SORT_FORCEINLINE Vector GetTangent() const { return DecodeOctahedral( m_tangent ); }
+
+    //! @brief  Set the normal of the vertex, it doesn't need to be normalized.
+    SORT_FORCEINLINE void SetNormal( const Vector& n ) { m_normal = EncodeOctahedral( n ); }
+
+    //! @brief  Set the tangent of the vertex, it doesn't need to be normalized.
+    SORT_FORCEINLINE void SetTangent( const Vector& t ) { m_tangent = EncodeOctahedral( t ); }
 };
 
 //! @brief  MeshFaceIndex defines the indices of the three vertices and also the material index of the face.
+/**
+ * The material is an index to the material table of the mesh instead of a pointer, meshes only have a handful of
+ * materials and it keeps the face index in sixteen bytes, which matters for meshes with millions of triangles.
+ */
 struct MeshFaceIndex {
     int                     m_id[3] = { -1 };   /**< Indices for one triangle. */
-    const MaterialBase*     m_mat = nullptr;    /**< Materials attached to the triangle. */
+    unsigned                m_matId = 0;        /**< Index of the material of the triangle in the material table of the mesh. */
+};
+
+//! @brief  Vertices of a mesh.
+/**
+ * Vertices are either owned in memory, or paged in on demand from a mesh cache file mapped in memory. Mapped vertices
+ * are read only, they are only used for meshes whose vertices are already processed and cached. Copying mapped
+ * vertices results in vertices owned in memory.
+ */
+class MeshVertexBuffer {
+public:
+    MeshVertexBuffer() = default;
+    MeshVertexBuffer( const MeshVertexBuffer& buffer ) { *this = buffer; }
+
+    //! @brief  Copy vertices in memory.
+    MeshVertexBuffer& operator = ( const MeshVertexBuffer& buffer ) {
+        if( this == &buffer )
+            return *this;
+        m_vertices.assign( buffer.begin() , buffer.end() );
+        m_mapping.reset();
+        m_data = m_vertices.data();
+        m_size = m_vertices.size();
+        return *this;
+    }
+
+    //! @brief  Resize vertices owned in memory, mapped vertices are released.
+    void resize( size_t cnt ) {
+        m_mapping.reset();
+        m_vertices.resize( cnt );
+        m_data = m_vertices.data();
+        m_size = cnt;
+    }
+
+    //! @brief  Page vertices in from a mapped file instead of keeping them in memory.
+    //!
+    //! @param  mapping     The mapped file.
+    //! @param  vertices    Vertices in the mapped file.
+    //! @param  cnt         Number of vertices.
+    void Map( std::shared_ptr<IMappedFileStream> mapping , const MeshVertex* vertices , size_t cnt ) {
+        LargePageVector<MeshVertex>().swap( m_vertices );
+        m_mapping = std::move( mapping );
+        m_data = const_cast<MeshVertex*>( vertices );
+        m_size = cnt;
+    }
+
+    //! @brief  Copy mapped vertices in memory so that they could be modified.
+    void Unmap() {
+        if( m_mapping ){
+            m_vertices.assign( begin() , end() );
+            m_mapping.reset();
+            m_data = m_vertices.data();
+        }
+    }
+
+    //! @brief  Whether the vertices are paged in from a mapped file.
+    bool IsMapped() const { return (bool)m_mapping; }
+
+    SORT_FORCEINLINE const MeshVertex& operator [] ( size_t i ) const { return m_data[i]; }
+    SORT_FORCEINLINE MeshVertex& operator [] ( size_t i ) { return m_data[i]; }
+
+    size_t              size() const { return m_size; }
+    bool                empty() const { return 0 == m_size; }
+    size_t              capacity() const { return m_vertices.capacity(); }
+    MeshVertex*         data() { return m_data; }
+    const MeshVertex*   data() const { return m_data; }
+    MeshVertex*         begin() { return m_data; }
+    MeshVertex*         end() { return m_data + m_size; }
+    const MeshVertex*   begin() const { return m_data; }
+    const MeshVertex*   end() const { return m_data + m_size; }
+
+private:
+    LargePageVector<MeshVertex>         m_vertices;             /**< Vertices owned in memory. */
+    std::shared_ptr<IMappedFileStream>  m_mapping;              /**< The mapped file the vertices are paged in from. */
+    MeshVertex*                         m_data = nullptr;       /**< Vertices, either owned or mapped. */
+    size_t                              m_size = 0;             /**< Number of vertices. */
 };
 
 //! @brief  A wrapper for mesh information.
@@ -52,28 +153,85 @@ struct MeshFaceIndex {
 //! layout of date requires quite some time in Blender, due to which reason, it was deprecated.
 class Mesh : public SerializableObject{
 public:
-    std::vector<MeshVertex>     m_vertices;         /**< Vertex information including position, normal and etc.*/
-    std::vector<MeshFaceIndex>  m_indices;          /**< Index information of the mesh, there is also material id in it. */
+    MeshVertexBuffer                m_vertices;     /**< Vertex information including position, normal and etc.*/
+    LargePageVector<MeshFaceIndex>  m_indices;      /**< Index information of the mesh, there is also material id in it. */
+    std::vector<const MaterialBase*> m_materials;   /**< Materials of the mesh, faces refer to them by index. */
     bool                        m_hasUV = false;    /**< Whether the mesh has UV information. */
+    LargePageVector<Point>      m_motionPositions;  /**< Positions of the vertices at the closing of the shutter, it is empty if the mesh doesn't move. */
 
     //! @brief      Generate UV coordinate for the vertices.
     void    GenUV();
 
+    //! @brief      Get the material of a face.
+    //!
+    //! @param mi   The face of the mesh.
+    //! @return     The material of the face, nullptr if it is not in the material table.
+    const MaterialBase* GetMaterial( const MeshFaceIndex& mi ) const {
+        return mi.m_matId < m_materials.size() ? m_materials[mi.m_matId] : nullptr;
+    }
+
     //! @brief      Apply transformation.
     //!
     //! Triangle is the most common shape used in rendering a scene. Unlike other shape in SORT, which transform the
     //! ray to local space, triangle vertices are pre-transformed to world space for better performance.
     void    ApplyTransform( const Transform& );
 
+    //! @brief      Evaluate the positions of the vertices at the closing of the shutter.
+    //!
+    //! Vertices move linearly from their positions in world space to the ones at the closing of the shutter during the
+    //! shutter interval. It needs to be called after the transform is applied.
+    //!
+    //! @param  transform   Transform applied to the mesh, it is where the mesh is at the opening of the shutter.
+    //! @param  motion      Transform of the mesh at the closing of the shutter.
+    void    ApplyMotion( const Transform& transform , const Transform& motion );
+
+    //! @brief      Whether the mesh moves during the shutter interval.
+    //!
+    //! @return     Whether there are positions of the vertices at the closing of the shutter.
+    bool    IsMoving() const {
+        return !m_motionPositions.empty();
+    }
+
     //! @brief      Generate tangent for the triangle mesh.
     void    GenSmoothTagent();
 
+    //! @brief      Simplify the mesh by clustering vertices in a uniform grid.
+    //!
+    //! Each cell of the grid is represented by the average of the vertices inside it, triangles collapsing into an edge
+    //! or a point are dropped. It is meant for geometry far away, texture coordinates are averaged across seams too.
+    //!
+    //! @param  cell        Size of the cells of the grid.
+    //! @param  simplified  The simplified mesh, it refers to the same materials.
+    void    Simplify( const float cell , Mesh& simplified ) const;
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
     //!             it could come from different places.
     void    Serialize( IStreamBase& stream ) override;
 
+    //! @brief      Load vertices that are already transformed and processed from the cache.
+    //!
+    //! The cache is identified by the content of the mesh in the stream and the transform, it replaces applying the
+    //! transform and generating UV and tangents.
+    //!
+    //! @param  transform   Transform of the mesh.
+    //! @param  folder      Folder of the cache files.
+    //! @return             Whether there is a cache matching the mesh.
+    bool    LoadCache( const Transform& transform , const std::string& folder );
+
+    //! @brief      Save the processed vertices to the cache.
+    //!
+    //! @param  transform   Transform applied to the mesh.
+    //! @param  folder      Folder of the cache files.
+    void    SaveCache( const Transform& transform , const std::string& folder ) const;
+
+    //! @brief      Drop vertices paged in from mesh cache files from memory if they take more than the budget.
+    //!
+    //! The least recently used mapped files are evicted until the budget is met. It is cheap to call it frequently,
+    //! the resident memory is only measured once a second at most.
+    static void TrimPagedVertices();
+
     //! @brief      Sample volume density
     //!
     //! For meshes that don't have volume inside, this function should not even be called.
@@ -89,6 +247,31 @@ public:
     //! @return         The color of the volume.
     Spectrum    SampleVolumeColor(const Point& pos) const;
 
+    //! @brief      Get the majorant grid of the volume inside the mesh.
+    //!
+    //! @param  material    The material that evaluates the medium inside the mesh.
+    //! @return             The majorant grid, nullptr if there is no volume data in the mesh.
+    const MediumMajorant* GetVolumeMajorant(const MaterialBase* material) const;
+
+    //! @brief      Bake the volume shaders of the materials of the mesh into grids covering its volume data.
+    //!
+    //! It only does something with a bake resolution in the command line and volume data in the mesh. It needs to be
+    //! done again once the mesh is moved since volume shaders are evaluated in world space.
+    void        BakeVolumes();
+
+    //! @brief      Get the volume shader of a material baked into grids.
+    //!
+    //! @param  material    The material that evaluates the medium inside the mesh.
+    //! @return             The baked volume shader, nullptr if it is not baked.
+    const BakedMedium* GetBakedMedium(const MaterialBase* material) const;
+
+    //! @brief      Get the transform from world space to volume texture space.
+    //!
+    //! @return     The transform from world space to volume texture space.
+    const Matrix& GetWorldToVolume() const {
+        return m_world2Volume;
+    }
+
 private:
     //! @brief      Generate tangent for the triangles.
     //!
@@ -110,4 +293,12 @@ private:
     std::unique_ptr<MediumDensity>  m_volumeDensity;
     /**< The color of the volume data inside this mesh. */
     std::unique_ptr<MediumColor>    m_volumeColor;
+    /**< Volume shaders of the materials baked into grids. */
+    std::vector<std::pair<const MaterialBase*, std::unique_ptr<BakedMedium>>>  m_bakedMedia;
+
+    /**< Hash of the mesh in the stream, it stays HASH_INITIAL_VALUE unless meshes are cached. */
+    unsigned long long  m_contentHash = HASH_INITIAL_VALUE;
+
+    /**< Memory of the vertices accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
 };
\ No newline at end of file
@@ -0,0 +1,123 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <chrono>
+#include "metrics.h"
+#include "perfreport.h"
+#include "globalconfig.h"
+#include "log.h"
+
+MetricsServer::~MetricsServer(){
+    Stop();
+}
+
+bool MetricsServer::Start( unsigned short port ){
+    if( !m_listener.Listen( port ) )
+        return false;
+    slog( INFO , GENERAL , "Serving metrics on port %d." , port );
+
+    m_quit = false;
+    m_thread = std::thread( [this](){ serve(); } );
+    return true;
+}
+
+void MetricsServer::Stop(){
+    m_quit = true;
+    if( m_thread.joinable() )
+        m_thread.join();
+    m_listener.Close();
+}
+
+void MetricsServer::FinishJob( bool interrupted ){
+    ++m_jobs;
+    if( interrupted )
+        ++m_interruptedJobs;
+}
+
+std::string MetricsServer::Metrics( double raysPerSecond ) const{
+    const auto& report = PerfReport::GetSingleton();
+    const auto tiles = report.GetTileCount();
+    const auto finished = report.GetFinishedTileCount();
+
+    std::string ret;
+    auto metric = [&ret]( const char* name , const char* type , const char* help , double value ){
+        char line[256];
+        snprintf( line , sizeof( line ) , "# HELP %s %s\n# TYPE %s %s\n%s %.17g\n" , name , help , name , type , name , value );
+        ret += line;
+    };
+    metric( "sort_rays_total" , "counter" , "Rays traced in the current render job." , (double)report.GetRayCount() );
+    metric( "sort_rays_per_second" , "gauge" , "Rays traced per second since the previous scrape." , raysPerSecond );
+    metric( "sort_tiles" , "gauge" , "Tiles scheduled in the current render job." , (double)tiles );
+    metric( "sort_tiles_finished_total" , "counter" , "Tiles finished in the current render job." , (double)finished );
+    metric( "sort_render_progress" , "gauge" , "Fraction of scheduled tiles that are finished." , tiles ? (double)finished / (double)tiles : 0.0 );
+    metric( "sort_render_eta_seconds" , "gauge" , "Estimated time left to finish scheduled tiles, -1 if unknown." , report.GetEstimatedTimeLeft() );
+    metric( "sort_render_jobs_total" , "counter" , "Render jobs done since the server started." , (double)m_jobs.load() );
+    metric( "sort_render_jobs_interrupted_total" , "counter" , "Render jobs interrupted by their clients." , (double)m_interruptedJobs.load() );
+    metric( "sort_peak_memory_bytes" , "gauge" , "Peak resident memory of the process." , (double)PerfReport::GetPeakMemory() );
+    metric( "sort_threads" , "gauge" , "Number of worker threads." , (double)g_threadCnt );
+
+    ret += "# HELP sort_thread_busy_seconds_total Time each worker thread spends on rendering tiles.\n# TYPE sort_thread_busy_seconds_total counter\n";
+    for( auto t = 0u ; t < report.GetThreadCount() ; ++t ){
+        char line[128];
+        snprintf( line , sizeof( line ) , "sort_thread_busy_seconds_total{thread=\"%u\"} %.6f\n" , t , report.GetThreadBusyTime( t ) );
+        ret += line;
+    }
+    return ret;
+}
+
+void MetricsServer::serve(){
+    auto last_time = std::chrono::steady_clock::now();
+    auto last_rays = PerfReport::GetSingleton().GetRayCount();
+    while( !m_quit ){
+        auto socket = m_listener.Accept( 200 );
+        if( !socket )
+            continue;
+
+        // rays are counted from zero again once a new job starts.
+        const auto time = std::chrono::steady_clock::now();
+        const auto rays = PerfReport::GetSingleton().GetRayCount();
+        const auto elapsed = std::chrono::duration<double>( time - last_time ).count();
+        const auto delta = rays >= last_rays ? rays - last_rays : rays;
+        answer( *socket , elapsed > 0.0 ? (double)delta / elapsed : 0.0 );
+        last_time = time;
+        last_rays = rays;
+    }
+}
+
+void MetricsServer::answer( Socket& socket , double raysPerSecond ) const{
+    // only the request line matters, the rest of the header is read and ignored.
+    std::string request;
+    char buffer[1024];
+    while( request.find( "\r\n\r\n" ) == std::string::npos && request.size() < 8192 ){
+        if( !socket.WaitForData( 1000 ) )
+            return;
+        const auto size = socket.Receive( buffer , sizeof( buffer ) );
+        if( size <= 0 )
+            return;
+        request.append( buffer , size );
+    }
+
+    std::string status = "200 OK" , body;
+    if( request.compare( 0 , 13 , "GET /metrics " ) == 0 || request.compare( 0 , 13 , "GET /metrics?" ) == 0 )
+        body = Metrics( raysPerSecond );
+    else
+        status = "404 Not Found";
+
+    const auto response = "HTTP/1.1 " + status + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                          std::to_string( body.size() ) + "\r\nConnection: close\r\n\r\n" + body;
+    socket.Send( response.data() , (int)response.size() );
+}
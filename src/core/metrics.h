@@ -0,0 +1,71 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "platform/socket/socket.h"
+
+//! @brief  MetricsServer exposes the progress of a render server to Prometheus.
+/**
+ * A background thread answers 'GET /metrics' on its own port with the Prometheus text format, so that a long running
+ * render server could be monitored by scraping it. Numbers come from PerfReport, which is reset for each render job,
+ * rays per second are measured between two scrapes.
+ */
+class MetricsServer{
+public:
+    //! @brief  Destructor stops the server.
+    ~MetricsServer();
+
+    //! @brief  Start answering scrapes on a port.
+    //!
+    //! @param  port        Port to listen on.
+    //! @return             Whether the server is listening.
+    bool    Start( unsigned short port );
+
+    //! @brief  Stop answering scrapes, it waits for the background thread to quit.
+    void    Stop();
+
+    //! @brief  A render job is done.
+    //!
+    //! @param  interrupted Whether the job is interrupted by its client.
+    void    FinishJob( bool interrupted );
+
+    //! @brief  Metrics in the Prometheus text format.
+    //!
+    //! @param  raysPerSecond   Rays traced per second recently.
+    //! @return                 All metrics.
+    std::string Metrics( double raysPerSecond ) const;
+
+private:
+    Socket                      m_listener;                     /**< Socket listening for scrapes. */
+    std::thread                 m_thread;                       /**< The background thread answering scrapes. */
+    std::atomic<bool>           m_quit = { false };             /**< Whether the background thread should quit. */
+    std::atomic<unsigned>       m_jobs = { 0 };                 /**< Number of finished render jobs. */
+    std::atomic<unsigned>       m_interruptedJobs = { 0 };      /**< Number of render jobs interrupted by clients. */
+
+    //! @brief  Answer scrapes until the server is stopped.
+    void    serve();
+
+    //! @brief  Answer one HTTP request of a connection.
+    //!
+    //! @param  socket          The connection.
+    //! @param  raysPerSecond   Rays traced per second recently.
+    void    answer( Socket& socket , double raysPerSecond ) const;
+};
@@ -0,0 +1,398 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "numa.h"
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <thread>
+#include "core/define.h"
+
+#if defined(SORT_IN_LINUX)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#elif defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+#elif defined(SORT_IN_MAC)
+    #include <sys/sysctl.h>
+#endif
+
+namespace {
+    //! @brief  A NUMA node with logical cores.
+    struct NumaNode{
+        unsigned            id;     /**< Id of the NUMA node in the OS. */
+        std::vector<int>    cores;  /**< Logical cores of the NUMA node. */
+    };
+    using NumaTopology = std::vector<NumaNode>;
+
+    //! @brief  A logical core.
+    struct LogicalCore{
+        int         id;         /**< Id of the logical core in the OS. */
+        int         core;       /**< Index of the physical core it belongs to. */
+        int         package;    /**< Index of the socket it belongs to. */
+        float       speed;      /**< Speed of its physical core relative to the fastest ones. */
+        bool        sibling;    /**< Whether it is not the first hardware thread of its physical core. */
+    };
+
+    // Relative speed of efficiency cores if the OS only tells which cores are slower, but not how much.
+    constexpr float EFFICIENCY_CORE_SPEED = 0.6f;
+    // Extra throughput of a physical core with its SMT sibling busy too, it is rather small for SIMD heavy work.
+    constexpr float SMT_SIBLING_SPEED = 0.25f;
+    // Cores slower than this relative to the fastest ones are considered efficiency cores.
+    constexpr float PERFORMANCE_CORE_SPEED = 0.9f;
+
+#if defined(SORT_IN_LINUX)
+    // Values from linux/mempolicy.h, libnuma is not needed just for setting the memory policy.
+    constexpr int MPOL_DEFAULT_POLICY = 0;
+    constexpr int MPOL_INTERLEAVE_POLICY = 3;
+
+    //! @brief  Parse a cpu list in sysfs, like '0-15,32-47'.
+    std::vector<int> parseCpuList( const std::string& list ){
+        std::vector<int> ret;
+        size_t pos = 0;
+        while( pos < list.size() ){
+            auto end = list.find( ',' , pos );
+            if( end == std::string::npos )
+                end = list.size();
+            const auto range = list.substr( pos , end - pos );
+            const auto dash = range.find( '-' );
+            try{
+                const auto first = std::stoi( range.substr( 0 , dash ) );
+                const auto last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+                for( auto i = first ; i <= last ; ++i )
+                    ret.push_back( i );
+            }catch( ... ){
+            }
+            pos = end + 1;
+        }
+        return ret;
+    }
+#endif
+
+    //! @brief  Query the logical cores of each NUMA node from the OS.
+    NumaTopology queryTopology(){
+        NumaTopology topology;
+#if defined(SORT_IN_LINUX)
+        // node ids are not necessarily contiguous, only the ones fitting in the memory policy mask are checked.
+        for( auto node = 0 ; node < 64 ; ++node ){
+            std::ifstream file( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+            if( !file.is_open() )
+                continue;
+            std::string list;
+            std::getline( file , list );
+            topology.push_back( { (unsigned)node , parseCpuList( list ) } );
+        }
+#elif defined(SORT_IN_WINDOWS)
+        ULONG highest = 0;
+        if( GetNumaHighestNodeNumber( &highest ) ){
+            for( auto node = 0u ; node <= highest ; ++node ){
+                ULONGLONG mask = 0;
+                std::vector<int> cores;
+                if( GetNumaNodeProcessorMask( (UCHAR)node , &mask ) ){
+                    for( auto i = 0 ; i < 64 ; ++i )
+                        if( mask & ( 1ull << i ) )
+                            cores.push_back( i );
+                }
+                topology.push_back( { node , cores } );
+            }
+        }
+#endif
+        // nodes without cores, which are memory only nodes, are not interesting for thread placement.
+        topology.erase( std::remove_if( topology.begin() , topology.end() , []( const NumaNode& node ){ return node.cores.empty(); } ) , topology.end() );
+        return topology;
+    }
+
+    const NumaTopology& topology(){
+        static const NumaTopology s_topology = queryTopology();
+        return s_topology;
+    }
+
+#if defined(SORT_IN_LINUX)
+    //! @brief  Read a value of a logical core in sysfs, -1 if it is not available.
+    long long readCoreValue( int id , const char* name ){
+        std::ifstream file( "/sys/devices/system/cpu/cpu" + std::to_string( id ) + "/" + name );
+        long long value = -1;
+        if( !( file >> value ) )
+            return -1;
+        return value;
+    }
+
+    //! @brief  Read a cpu list in sysfs, empty if it is not available.
+    std::vector<int> readCpuList( const std::string& filename ){
+        std::ifstream file( filename );
+        std::string list;
+        if( !file.is_open() || !std::getline( file , list ) )
+            return {};
+        return parseCpuList( list );
+    }
+#endif
+
+    //! @brief  Query the logical cores from the OS, the speed of physical cores is not normalized yet.
+    std::vector<LogicalCore> queryLogicalCores(){
+        std::vector<LogicalCore> cores;
+#if defined(SORT_IN_LINUX)
+        // Hybrid Intel CPUs list their P-cores and E-cores as different PMUs. Otherwise the capacity of the cores is
+        // used, which is set on ARM big.LITTLE, or the maximum frequency as the last resort.
+        // Cores the process is not allowed to run on, like the ones out of the cpuset of a container, are skipped.
+        const auto atom_cores = readCpuList( "/sys/devices/cpu_atom/cpus" );
+        cpu_set_t allowed;
+        CPU_ZERO( &allowed );
+        const auto has_allowed = 0 == sched_getaffinity( 0 , sizeof( allowed ) , &allowed );
+        std::vector<std::pair<int, int>> physical_cores;
+        for( const auto id : readCpuList( "/sys/devices/system/cpu/online" ) ){
+            if( has_allowed && id < CPU_SETSIZE && !CPU_ISSET( id , &allowed ) )
+                continue;
+            const auto core_id = (int)readCoreValue( id , "topology/core_id" );
+            const auto package = (int)std::max( 0ll , readCoreValue( id , "topology/physical_package_id" ) );
+            const auto key = std::make_pair( package , core_id < 0 ? id : core_id );
+            const auto it = std::find( physical_cores.begin() , physical_cores.end() , key );
+            const auto sibling = it != physical_cores.end();
+            if( !sibling )
+                physical_cores.push_back( key );
+
+            auto speed = (float)readCoreValue( id , "cpu_capacity" );
+            if( speed <= 0.0f )
+                speed = (float)readCoreValue( id , "cpufreq/cpuinfo_max_freq" );
+            if( std::find( atom_cores.begin() , atom_cores.end() , id ) != atom_cores.end() )
+                speed = -EFFICIENCY_CORE_SPEED;
+            cores.push_back( { id , (int)( std::find( physical_cores.begin() , physical_cores.end() , key ) - physical_cores.begin() ) , package , speed , sibling } );
+        }
+#elif defined(SORT_IN_WINDOWS)
+        DWORD len = 0;
+        GetLogicalProcessorInformationEx( RelationAll , nullptr , &len );
+        std::vector<char> buffer( len );
+        if( len == 0 || !GetLogicalProcessorInformationEx( RelationAll , (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data() , &len ) )
+            return cores;
+
+        // Only the first processor group is used, the same as the NUMA topology. A higher efficiency class is faster.
+        std::vector<int> packages( 64 , 0 );
+        auto core_cnt = 0 , package_cnt = 0;
+        for( DWORD offset = 0 ; offset < len ; ){
+            const auto info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)( buffer.data() + offset );
+            if( info->Relationship == RelationProcessorPackage ){
+                for( auto g = 0 ; g < info->Processor.GroupCount ; ++g ){
+                    if( info->Processor.GroupMask[g].Group != 0 )
+                        continue;
+                    for( auto i = 0 ; i < 64 ; ++i )
+                        if( info->Processor.GroupMask[g].Mask & ( 1ull << i ) )
+                            packages[i] = package_cnt;
+                }
+                ++package_cnt;
+            }else if( info->Relationship == RelationProcessorCore && info->Processor.GroupMask[0].Group == 0 ){
+                auto sibling = false;
+                for( auto i = 0 ; i < 64 ; ++i ){
+                    if( info->Processor.GroupMask[0].Mask & ( 1ull << i ) ){
+                        cores.push_back( { i , core_cnt , 0 , -(float)info->Processor.EfficiencyClass - 1.0f , sibling } );
+                        sibling = true;
+                    }
+                }
+                ++core_cnt;
+            }
+            offset += info->Size;
+        }
+        for( auto& core : cores )
+            core.package = packages[core.id];
+
+        // efficiency classes are ranks instead of speeds
+        auto highest = 0.0f;
+        for( const auto& core : cores )
+            highest = std::min( highest , core.speed );
+        for( auto& core : cores )
+            core.speed = core.speed == highest ? 1.0f : -EFFICIENCY_CORE_SPEED;
+#endif
+        if( cores.empty() )
+            return cores;
+
+        // Positive speeds are measured, negative ones are already relative to the fastest cores. Cores without any
+        // information are considered to be as fast as the fastest ones.
+        auto fastest = 0.0f;
+        for( const auto& core : cores )
+            fastest = std::max( fastest , core.speed );
+        for( auto& core : cores ){
+            if( core.speed < 0.0f )
+                core.speed = -core.speed;
+            else if( core.speed > 0.0f )
+                core.speed /= fastest;
+            else
+                core.speed = 1.0f;
+        }
+        return cores;
+    }
+
+    //! @brief  Logical cores in the order they are taken by worker threads.
+    std::vector<LogicalCore> placementOrder(){
+        auto cores = queryLogicalCores();
+
+        // Without the logical cores, NUMA nodes are still walked round robin.
+        if( cores.empty() ){
+            for( const auto& node : topology() )
+                for( const auto id : node.cores )
+                    cores.push_back( { id , id , 0 , 1.0f , false } );
+        }
+
+        const auto node_of = [&]( int id ){
+            const auto& nodes = topology();
+            for( auto i = 0u ; i < nodes.size() ; ++i )
+                if( std::find( nodes[i].cores.begin() , nodes[i].cores.end() , id ) != nodes[i].cores.end() )
+                    return i;
+            return 0u;
+        };
+
+        // Performance cores go first, then efficiency cores from the fastest to the slowest, SMT siblings go last.
+        // Cores of the same kind are walked node by node round robin, keeping the order of the OS within each node.
+        std::vector<int> rank_in_node( cores.size() );
+        std::vector<unsigned> node_cnt( std::max( 1u , (unsigned)topology().size() ) * 2 , 0 );
+        for( auto i = 0u ; i < cores.size() ; ++i ){
+            const auto node = node_of( cores[i].id );
+            rank_in_node[i] = (int)node_cnt[node * 2 + ( cores[i].sibling ? 1 : 0 )]++;
+        }
+        std::vector<unsigned> order( cores.size() );
+        for( auto i = 0u ; i < order.size() ; ++i )
+            order[i] = i;
+        std::stable_sort( order.begin() , order.end() , [&]( unsigned a , unsigned b ){
+            const auto& ca = cores[a];
+            const auto& cb = cores[b];
+            if( ca.sibling != cb.sibling )
+                return !ca.sibling;
+            const auto fast_a = ca.speed >= PERFORMANCE_CORE_SPEED , fast_b = cb.speed >= PERFORMANCE_CORE_SPEED;
+            if( fast_a != fast_b )
+                return fast_a;
+            if( !fast_a && ca.speed != cb.speed )
+                return ca.speed > cb.speed;
+            return rank_in_node[a] < rank_in_node[b];
+        } );
+
+        std::vector<LogicalCore> ret;
+        for( const auto i : order )
+            ret.push_back( cores[i] );
+        return ret;
+    }
+
+    const std::vector<LogicalCore>& placement(){
+        static const std::vector<LogicalCore> s_placement = placementOrder();
+        return s_placement;
+    }
+
+    CpuTopologyInfo queryCpuTopology(){
+        CpuTopologyInfo info;
+        const auto& cores = placement();
+        std::vector<int> packages;
+        for( const auto& core : cores ){
+            ++info.logical_cnt;
+            if( std::find( packages.begin() , packages.end() , core.package ) == packages.end() )
+                packages.push_back( core.package );
+            if( core.sibling )
+                continue;
+            ++info.physical_cnt;
+            if( core.speed >= PERFORMANCE_CORE_SPEED )
+                ++info.performance_cnt;
+            else
+                ++info.efficiency_cnt;
+        }
+        info.package_cnt = (unsigned)packages.size();
+
+#if defined(SORT_IN_MAC)
+        // Apple silicon reports performance levels, level 0 is the fastest one.
+        const auto sysctl_value = []( const char* name ){
+            int value = 0;
+            size_t size = sizeof( value );
+            return 0 == sysctlbyname( name , &value , &size , nullptr , 0 ) ? (unsigned)value : 0u;
+        };
+        info.logical_cnt = sysctl_value( "hw.logicalcpu" );
+        info.physical_cnt = sysctl_value( "hw.physicalcpu" );
+        info.package_cnt = std::max( 1u , sysctl_value( "hw.packages" ) );
+        const auto levels = sysctl_value( "hw.nperflevels" );
+        info.performance_cnt = levels > 1 ? sysctl_value( "hw.perflevel0.physicalcpu" ) : info.physical_cnt;
+        info.efficiency_cnt = info.physical_cnt - std::min( info.physical_cnt , info.performance_cnt );
+#endif
+
+        // every core is considered a performance core if the topology is not available at all
+        if( 0 == info.logical_cnt ){
+            info.logical_cnt = std::max( 1u , std::thread::hardware_concurrency() );
+            info.physical_cnt = info.performance_cnt = info.logical_cnt;
+            info.package_cnt = 1;
+        }
+        return info;
+    }
+}
+
+const CpuTopologyInfo& CpuTopology(){
+    static const CpuTopologyInfo s_info = queryCpuTopology();
+    return s_info;
+}
+
+unsigned DefaultThreadCount(){
+    return std::max( 1u , CpuTopology().physical_cnt );
+}
+
+unsigned NumaNodeCount(){
+    return std::max( 1u , (unsigned)topology().size() );
+}
+
+int NumaThreadCore( unsigned tid ){
+    const auto& cores = placement();
+    if( cores.empty() )
+        return -1;
+    return cores[tid % cores.size()].id;
+}
+
+float NumaThreadSpeed( unsigned tid ){
+    const auto& cores = placement();
+    if( cores.empty() )
+        return 1.0f;
+    const auto& core = cores[tid % cores.size()];
+    return core.sibling ? core.speed * SMT_SIBLING_SPEED : core.speed;
+}
+
+bool PinCurrentThread( unsigned tid ){
+    const auto core = NumaThreadCore( tid );
+    if( core < 0 )
+        return false;
+#if defined(SORT_IN_LINUX)
+    if( core >= CPU_SETSIZE )
+        return false;
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( core , &set );
+    return 0 == pthread_setaffinity_np( pthread_self() , sizeof( set ) , &set );
+#elif defined(SORT_IN_WINDOWS)
+    return 0 != SetThreadAffinityMask( GetCurrentThread() , (DWORD_PTR)1 << core );
+#else
+    return false;
+#endif
+}
+
+bool SetCurrentThreadMemoryPolicy( const NumaMemoryPolicy policy ){
+#if defined(SORT_IN_LINUX)
+    if( policy == NumaMemoryPolicy::Local )
+        return 0 == syscall( SYS_set_mempolicy , MPOL_DEFAULT_POLICY , nullptr , 0 );
+
+    // Memory only nodes are usually slower memory, only nodes with cores are interleaved.
+    unsigned long mask = 0;
+    for( const auto& node : topology() )
+        if( node.id < sizeof( mask ) * 8 )
+            mask |= 1ul << node.id;
+    if( 0 == mask )
+        return false;
+    return 0 == syscall( SYS_set_mempolicy , MPOL_INTERLEAVE_POLICY , &mask , sizeof( mask ) * 8 + 1 );
+#else
+    return false;
+#endif
+}
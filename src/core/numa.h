@@ -0,0 +1,91 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+//! @brief  Memory placement policy of the pages touched by the current thread.
+enum class NumaMemoryPolicy : int {
+    Local = 0,      /**< Pages are allocated on the NUMA node of the thread touching them first, which is the default of the OS. */
+    Interleave,     /**< Pages are distributed across all NUMA nodes round robin. */
+};
+
+//! @brief  Cores of the machine, queried from the OS.
+struct CpuTopologyInfo{
+    unsigned    logical_cnt = 0;        /**< Number of logical cores, including the SMT siblings. */
+    unsigned    physical_cnt = 0;       /**< Number of physical cores. */
+    unsigned    performance_cnt = 0;    /**< Number of the fastest physical cores, like P-cores of hybrid CPUs. */
+    unsigned    efficiency_cnt = 0;     /**< Number of the slower physical cores, like E-cores of hybrid CPUs. */
+    unsigned    package_cnt = 0;        /**< Number of sockets. */
+};
+
+//! @brief  Cores of the machine.
+//!
+//! The topology is only queried once, the result is cached after the first call. The physical cores are all
+//! performance cores and there is only one socket on platforms where the topology is not available.
+//!
+//! @return         Cores of the machine.
+const CpuTopologyInfo&  CpuTopology();
+
+//! @brief  Default number of worker threads, one per physical core.
+//!
+//! SMT siblings share the SIMD units of their core, SIMD heavy ray traversal barely gets any faster with them
+//! while the per-thread memory grows, they are not used by default.
+//!
+//! @return         Number of worker threads, including the main thread.
+unsigned    DefaultThreadCount();
+
+//! @brief  Number of NUMA nodes of the machine.
+//!
+//! The topology is only queried once, the result is cached after the first call.
+//! It is always 1 on platforms where the topology is not available.
+//!
+//! @return         Number of NUMA nodes.
+unsigned    NumaNodeCount();
+
+//! @brief  Logical core that a worker thread is pinned to.
+//!
+//! Consecutive threads are distributed across NUMA nodes round robin, so that the memory
+//! bandwidth of all sockets is used even if there are fewer threads than cores. Threads take
+//! the first hardware thread of performance cores first, then efficiency cores, SMT siblings
+//! come last.
+//!
+//! @param  tid     Id of the worker thread, 0 is the main thread.
+//! @return         Index of the logical core, -1 if the topology is not available.
+int         NumaThreadCore( unsigned tid );
+
+//! @brief  Relative speed of the logical core that a worker thread is pinned to.
+//!
+//! SMT siblings only count the extra throughput they add to their core.
+//!
+//! @param  tid     Id of the worker thread, 0 is the main thread.
+//! @return         Speed relative to the first hardware thread of a performance core, 1 if the topology is not available.
+float       NumaThreadSpeed( unsigned tid );
+
+//! @brief  Pin the current thread to the logical core returned by NumaThreadCore.
+//!
+//! @param  tid     Id of the current worker thread, 0 is the main thread.
+//! @return         Whether the thread is pinned.
+bool        PinCurrentThread( unsigned tid );
+
+//! @brief  Set the memory placement policy of the current thread.
+//!
+//! The policy only affects pages touched for the first time after the call, it is only
+//! supported on Linux.
+//!
+//! @param  policy  The memory placement policy.
+//! @return         Whether the policy is applied.
+bool        SetCurrentThreadMemoryPolicy( const NumaMemoryPolicy policy );
@@ -0,0 +1,151 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <limits>
+#include <algorithm>
+#include "perfreport.h"
+
+#if defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+static constexpr long long PHASE_NOT_STARTED = std::numeric_limits<long long>::max();
+
+PerfReport::PerfReport(){
+    for( auto i = 0u ; i < (unsigned)PerfPhase::Count ; ++i ){
+        m_phaseBegin[i].store( PHASE_NOT_STARTED , std::memory_order_relaxed );
+        m_phaseEnd[i].store( -1 , std::memory_order_relaxed );
+    }
+}
+
+void PerfReport::Reset( unsigned threadCnt ){
+    m_start = std::chrono::steady_clock::now();
+    // counters are kept if the number of threads doesn't change, the metrics endpoint could be reading them.
+    if( threadCnt != m_threadCnt ){
+        m_threads = std::make_unique<ThreadCounter[]>( threadCnt );
+        m_threadCnt = threadCnt;
+    }
+    for( auto t = 0u ; t < m_threadCnt ; ++t ){
+        m_threads[t].cnt.store( 0 , std::memory_order_relaxed );
+        m_threads[t].extension.store( 0 , std::memory_order_relaxed );
+        m_threads[t].busy.store( 0 , std::memory_order_relaxed );
+    }
+    for( auto i = 0u ; i < (unsigned)PerfPhase::Count ; ++i ){
+        m_phaseBegin[i].store( PHASE_NOT_STARTED , std::memory_order_relaxed );
+        m_phaseEnd[i].store( -1 , std::memory_order_relaxed );
+    }
+    m_firstPixel.store( -1 , std::memory_order_relaxed );
+    m_tiles.store( 0 , std::memory_order_relaxed );
+    m_finishedTiles.store( 0 , std::memory_order_relaxed );
+}
+
+void PerfReport::BeginPhase( PerfPhase phase ){
+    const auto t = now();
+    auto& begin = m_phaseBegin[(unsigned)phase];
+    auto current = begin.load( std::memory_order_relaxed );
+    while( t < current && !begin.compare_exchange_weak( current , t , std::memory_order_relaxed ) );
+}
+
+void PerfReport::EndPhase( PerfPhase phase ){
+    const auto t = now();
+    auto& end = m_phaseEnd[(unsigned)phase];
+    auto current = end.load( std::memory_order_relaxed );
+    while( t > current && !end.compare_exchange_weak( current , t , std::memory_order_relaxed ) );
+}
+
+void PerfReport::AddTiles( unsigned cnt ){
+    m_tiles.fetch_add( cnt , std::memory_order_relaxed );
+}
+
+void PerfReport::FinishTile(){
+    m_finishedTiles.fetch_add( 1 , std::memory_order_relaxed );
+    auto expected = -1ll;
+    if( m_firstPixel.load( std::memory_order_relaxed ) < 0 )
+        m_firstPixel.compare_exchange_strong( expected , now() , std::memory_order_relaxed );
+}
+
+unsigned long long PerfReport::GetRayCount() const{
+    auto total = 0ull;
+    for( auto t = 0u ; t < m_threadCnt ; ++t )
+        total += m_threads[t].cnt.load( std::memory_order_relaxed );
+    return total;
+}
+
+double PerfReport::GetThreadBusyTime( unsigned tid ) const{
+    return tid < m_threadCnt ? (double)m_threads[tid].busy.load( std::memory_order_relaxed ) * 1e-6 : 0.0;
+}
+
+double PerfReport::GetPhaseTime( PerfPhase phase ) const{
+    const auto begin = m_phaseBegin[(unsigned)phase].load( std::memory_order_relaxed );
+    const auto end = m_phaseEnd[(unsigned)phase].load( std::memory_order_relaxed );
+    return end >= begin ? (double)( end - begin ) * 1e-6 : 0.0;
+}
+
+double PerfReport::GetTimeInPhase( PerfPhase phase ) const{
+    const auto begin = m_phaseBegin[(unsigned)phase].load( std::memory_order_relaxed );
+    return begin != PHASE_NOT_STARTED ? (double)std::max( now() - begin , 0ll ) * 1e-6 : 0.0;
+}
+
+double PerfReport::GetEstimatedTimeLeft() const{
+    const auto tiles = GetTileCount();
+    const auto finished = GetFinishedTileCount();
+    if( 0 == finished )
+        return -1.0;
+    return GetTimeInPhase( PerfPhase::Rendering ) * (double)( tiles > finished ? tiles - finished : 0 ) / (double)finished;
+}
+
+double PerfReport::GetTimeToFirstPixel() const{
+    const auto t = m_firstPixel.load( std::memory_order_relaxed );
+    return t >= 0 ? (double)t * 1e-6 : 0.0;
+}
+
+unsigned long long PerfReport::GetPeakMemory(){
+#if defined(SORT_IN_WINDOWS)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if( GetProcessMemoryInfo( GetCurrentProcess() , &pmc , sizeof( pmc ) ) )
+        return pmc.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage;
+    if( getrusage( RUSAGE_SELF , &usage ) != 0 )
+        return 0;
+    #if defined(SORT_IN_MAC)
+        // it is in bytes on Mac OS, but in kilobytes on Linux.
+        return (unsigned long long)usage.ru_maxrss;
+    #else
+        return (unsigned long long)usage.ru_maxrss * 1024ull;
+    #endif
+#endif
+}
+
+const char* PerfReport::GetPhaseName( PerfPhase phase ){
+    switch( phase ){
+        case PerfPhase::Loading:            return "loading";
+        case PerfPhase::AcceleratorBuild:   return "accelerator";
+        case PerfPhase::PreProcess:         return "preprocess";
+        case PerfPhase::Rendering:          return "rendering";
+        case PerfPhase::PostProcess:        return "postprocess";
+        default:                            return "unknown";
+    }
+}
+
+long long PerfReport::now() const{
+    return (long long)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - m_start ).count();
+}
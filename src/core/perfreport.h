@@ -0,0 +1,218 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "core/define.h"
+#include "core/singleton.h"
+#include "core/thread.h"
+
+//! @brief  Phases of rendering timed in the performance report.
+enum class PerfPhase : unsigned {
+    Loading = 0 ,           /**< Loading materials and entities of the scene. */
+    AcceleratorBuild ,      /**< Building all spatial accelerators. */
+    PreProcess ,            /**< Pre-processing of the integrator. */
+    Rendering ,             /**< Rendering all tiles. */
+    PostProcess ,           /**< Post-processing of the image sensor, like saving the image. */
+    Count
+};
+
+//! @brief  PerfReport collects the numbers printed with '--timing', so that performance could be compared across commits.
+/**
+ * Unlike stats, it is available in all builds and only tracks a handful of numbers that are cheap to collect. Each
+ * worker thread counts its rays in its own cache line, a phase keeps the earliest start and the latest end of all
+ * tasks running it, since tasks of the same phase, like building accelerators, could run in parallel.
+ */
+class PerfReport : public Singleton<PerfReport>{
+public:
+    //! @brief  Start a new report, all times are relative to this moment.
+    //!
+    //! @param  threadCnt   Number of worker threads, including the main thread.
+    void    Reset( unsigned threadCnt );
+
+    //! @brief  A task of a phase starts.
+    //!
+    //! @param  phase       The phase.
+    void    BeginPhase( PerfPhase phase );
+
+    //! @brief  A task of a phase is done.
+    //!
+    //! @param  phase       The phase.
+    void    EndPhase( PerfPhase phase );
+
+    //! @brief  Tiles of pixels are scheduled to be rendered.
+    //!
+    //! @param  cnt         Number of tiles.
+    void    AddTiles( unsigned cnt );
+
+    //! @brief  A tile of pixels is done, the first one is recorded as the time to first pixel.
+    void    FinishTile();
+
+    //! @brief  Count rays traced by the current thread.
+    //!
+    //! @param  cnt         Number of rays.
+    //! @param  extension   Whether the rays extend paths, instead of testing visibility or probing subsurface scattering.
+    SORT_FORCEINLINE void AddRays( unsigned cnt , bool extension ){
+        const auto tid = (unsigned)ThreadId();
+        if( tid < m_threadCnt ){
+            // only the owner thread writes its counters, it doesn't need an atomic read-modify-write operation.
+            auto& counter = m_threads[tid];
+            counter.cnt.store( counter.cnt.load( std::memory_order_relaxed ) + cnt , std::memory_order_relaxed );
+            if( extension )
+                counter.extension.store( counter.extension.load( std::memory_order_relaxed ) + cnt , std::memory_order_relaxed );
+        }
+    }
+
+    //! @brief  Total number of rays traced by all threads.
+    //!
+    //! @return     Number of rays.
+    unsigned long long  GetRayCount() const;
+
+    //! @brief  Number of rays traced by the current thread so far.
+    //!
+    //! @param  extension   Whether only rays extending paths are counted.
+    //! @return             Number of rays.
+    SORT_FORCEINLINE unsigned long long GetThreadRayCount( bool extension ) const {
+        const auto tid = (unsigned)ThreadId();
+        if( tid >= m_threadCnt )
+            return 0;
+        return ( extension ? m_threads[tid].extension : m_threads[tid].cnt ).load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Count time the current thread spends on rendering tiles.
+    //!
+    //! @param  us          Microseconds.
+    SORT_FORCEINLINE void AddBusyTime( long long us ){
+        const auto tid = (unsigned)ThreadId();
+        if( tid < m_threadCnt ){
+            auto& counter = m_threads[tid];
+            counter.busy.store( counter.busy.load( std::memory_order_relaxed ) + us , std::memory_order_relaxed );
+        }
+    }
+
+    //! @brief  Number of worker threads in the report.
+    //!
+    //! @return     Number of worker threads, including the main thread.
+    unsigned    GetThreadCount() const{
+        return m_threadCnt;
+    }
+
+    //! @brief  Time a worker thread spends on rendering tiles.
+    //!
+    //! @param  tid         Id of the thread.
+    //! @return             Seconds, only tasks that are done are counted.
+    double  GetThreadBusyTime( unsigned tid ) const;
+
+    //! @brief  Number of tiles scheduled since the report is reset.
+    //!
+    //! @return     Number of tiles, tiles of all passes are counted in progressive rendering.
+    unsigned long long  GetTileCount() const{
+        return m_tiles.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Number of tiles done since the report is reset.
+    //!
+    //! @return     Number of tiles.
+    unsigned long long  GetFinishedTileCount() const{
+        return m_finishedTiles.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Time of a phase.
+    //!
+    //! @param  phase       The phase.
+    //! @return             Seconds from the start of the first task of the phase to the end of the last one, 0 if it never ran.
+    double  GetPhaseTime( PerfPhase phase ) const;
+
+    //! @brief  Time since a phase started, it keeps growing even if no task of the phase is running for now.
+    //!
+    //! @param  phase       The phase.
+    //! @return             Seconds since the start of the first task of the phase, 0 if it never ran.
+    double  GetTimeInPhase( PerfPhase phase ) const;
+
+    //! @brief  Estimated time left to finish all scheduled tiles, assuming the rest are rendered as fast as the done ones.
+    //!
+    //! @return     Seconds, negative if there is nothing done to estimate it with.
+    double  GetEstimatedTimeLeft() const;
+
+    //! @brief  Time until the first tile is done.
+    //!
+    //! @return     Seconds since the report is reset, 0 if no tile is done.
+    double  GetTimeToFirstPixel() const;
+
+    //! @brief  Peak resident memory of the process.
+    //!
+    //! @return     Peak resident memory in bytes, 0 if it is not available on the platform.
+    static unsigned long long GetPeakMemory();
+
+    //! @brief  Name of a phase in the report.
+    //!
+    //! @param  phase       The phase.
+    //! @return             Name of the phase.
+    static const char*  GetPhaseName( PerfPhase phase );
+
+private:
+    //! @brief  Counters of a thread, padded to a cache line to avoid false sharing.
+    struct alignas(64) ThreadCounter{
+        std::atomic<unsigned long long> cnt = { 0 };            /**< All rays. */
+        std::atomic<unsigned long long> extension = { 0 };      /**< Rays extending paths, including camera rays. */
+        std::atomic<long long>          busy = { 0 };           /**< Microseconds spent on rendering tiles. */
+    };
+
+    std::chrono::steady_clock::time_point   m_start = std::chrono::steady_clock::now();    /**< The moment the report is reset. */
+    std::unique_ptr<ThreadCounter[]>        m_threads;                                      /**< Counters of worker threads. */
+    unsigned                                m_threadCnt = 0;                                /**< Number of worker threads. */
+    std::atomic<long long>                  m_phaseBegin[(unsigned)PerfPhase::Count];       /**< Earliest start of each phase in microseconds. */
+    std::atomic<long long>                  m_phaseEnd[(unsigned)PerfPhase::Count];         /**< Latest end of each phase in microseconds. */
+    std::atomic<long long>                  m_firstPixel = { -1 };                          /**< The moment the first tile is done in microseconds. */
+    std::atomic<unsigned long long>         m_tiles = { 0 };                                /**< Number of scheduled tiles. */
+    std::atomic<unsigned long long>         m_finishedTiles = { 0 };                        /**< Number of finished tiles. */
+
+    //! @brief  Microseconds since the report is reset.
+    long long   now() const;
+
+    // It is a singleton.
+    PerfReport();
+    friend class Singleton<PerfReport>;
+};
+
+//! @brief  Time a phase during the life time of the instance.
+class PerfPhaseScope{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  phase       The phase.
+    explicit PerfPhaseScope( PerfPhase phase ) : m_phase( phase ) {
+        PerfReport::GetSingleton().BeginPhase( m_phase );
+    }
+
+    //! @brief  The phase is done once the instance is destroyed, time of rendering is counted as busy time of the thread.
+    ~PerfPhaseScope(){
+        auto& report = PerfReport::GetSingleton();
+        report.EndPhase( m_phase );
+        if( PerfPhase::Rendering == m_phase )
+            report.AddBusyTime( (long long)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - m_start ).count() );
+    }
+
+private:
+    const PerfPhase                                 m_phase;                                        /**< The phase. */
+    const std::chrono::steady_clock::time_point     m_start = std::chrono::steady_clock::now();    /**< The moment the scope starts. */
+};
+
+#define PERF_PHASE( phase )     PerfPhaseScope  localPerfPhaseScope( phase );
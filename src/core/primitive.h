@@ -42,7 +42,12 @@ public:
     //! @param  shape   Shape of the material.
     //! @param  light   Light source attached to the material.
     Primitive(const Mesh* mesh, const MaterialBase* mat , const Shape* shape , class Light* light = nullptr ):
-        m_mesh(mesh), m_mat(mat), m_shape(shape), m_light(light){}
+        m_mesh(mesh), m_mat(mat), m_shape(shape), m_light(light){
+        // Instances are never tagged as opaque since what is inside them could be transparent.
+        m_opaque = SHAPE_INSTANCE != m_shape->GetShapeType() && !GetMaterial()->HasTransparency();
+        // Materials are not necessarily built yet, whether the opacity is a cutout is only known during traversal.
+        m_alphaMasked = SHAPE_INSTANCE != m_shape->GetShapeType() && OpacityClass::Textured == GetMaterial()->GetOpacityClass();
+    }
 
     //! @brief  Get the intersection between a ray and the primitive.
     //!
@@ -51,9 +56,30 @@ public:
     //!                     The information of the intersection is also returned in world space.
     //! @return             Whether the ray intersects the primitive.
     SORT_FORCEINLINE bool GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // Shadow rays don't need anything from opaque primitives other than whether they are blocked, which is a lot
+        // cheaper to tell than evaluating the intersection. Setting primitive to be nullptr and returning true at the
+        // same time is a special 'code' that the shadow ray is blocked by an opaque primitive.
+        if( m_opaque && intersect && intersect->query_shadow ){
+            if( !m_shape->GetIntersect( r , nullptr ) )
+                return false;
+            intersect->primitive = nullptr;
+            intersect->occluder = this;
+            return true;
+        }
+#endif
+
+        if( UNLIKELY( m_alphaMasked ) ){
+            if( const auto mask = GetMaterial()->GetAlphaMask() )
+                return getMaskedIntersect( r , intersect , *mask );
+        }
+
         auto ret = m_shape->GetIntersect( r , intersect );
         if( ret && intersect ){
-            intersect->primitive = this;
+            // Instances resolve the intersected primitive inside them, it is left as nullptr if a shadow ray is blocked
+            // by an opaque primitive inside the instance.
+            if( SHAPE_INSTANCE != m_shape->GetShapeType() )
+                intersect->primitive = this;
             return true;
         }
         return ret;
@@ -70,6 +96,40 @@ public:
         return m_shape->GetIntersect( box );
     }
 
+    //! @brief  Split the part of the primitive inside a bounding box with an axis aligned plane.
+    //!
+    //! @param  box     Bounding box of the part of the primitive to be split.
+    //! @param  axis    Axis perpendicular to the split plane.
+    //! @param  pos     Position of the split plane along the axis.
+    //! @param  left    Bounding box of the part of the primitive on the negative side of the plane.
+    //! @param  right   Bounding box of the part of the primitive on the positive side of the plane.
+    SORT_FORCEINLINE void SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const {
+        m_shape->SplitBBox( box , axis , pos , left , right );
+    }
+
+    //! @brief  Hash the geometry of the primitive.
+    //!
+    //! @param  hash    The hash to be updated.
+    SORT_FORCEINLINE void HashGeometry( unsigned long long& hash ) const {
+        const auto shape_type = (unsigned)m_shape->GetShapeType();
+        hashData( hash , &shape_type , sizeof( shape_type ) );
+        m_shape->HashGeometry( hash );
+    }
+
+    //! @brief  Hash the topology of the primitive.
+    //!
+    //! @param  hash    The hash to be updated.
+    SORT_FORCEINLINE void HashTopology( unsigned long long& hash ) const {
+        const auto shape_type = (unsigned)m_shape->GetShapeType();
+        hashData( hash , &shape_type , sizeof( shape_type ) );
+        m_shape->HashTopology( hash );
+    }
+
+    //! @brief  Drop the cached bounding box of the primitive after it is moved or deformed.
+    SORT_FORCEINLINE void InvalidateBBox() const {
+        m_shape->InvalidateBBox();
+    }
+
     //! @brief  Get the axis aligned bounding box of the primitive in world space.
     //!
     //! @return         AABB in world space.
@@ -77,6 +137,25 @@ public:
         return m_shape->GetBBox();
     }
 
+    //! @brief  Get the bounding boxes of the primitive at the opening and closing of the shutter.
+    //!
+    //! @param  open    Bounding box at the opening of the shutter.
+    //! @param  close   Bounding box at the closing of the shutter.
+    //! @return         Whether the primitive moves during the shutter interval, the boxes are not touched otherwise.
+    SORT_FORCEINLINE bool GetMotionBBox( BBox& open , BBox& close ) const {
+        return m_shape->GetMotionBBox( open , close );
+    }
+
+    //! @brief  Whether the primitive moves during the shutter interval.
+    //!
+    //! Moving primitives are placed at the time of rays, SIMD accelerators need to test them one by one instead of
+    //! packing them with others.
+    //!
+    //! @return         Whether the primitive moves.
+    SORT_FORCEINLINE bool IsMoving() const {
+        return m_shape->IsMoving();
+    }
+
     //! @brief  Get the surface area of the primitive.
     //!
     //! @return         Surface area of the primitive.
@@ -101,6 +180,26 @@ public:
     SORT_FORCEINLINE Light* GetLight() const {
         return m_light;
     }
+
+    //! @brief  Whether the primitive is opaque.
+    //!
+    //! The primitive is tagged during loading, it is opaque if there is no transparency in its material.
+    //! Shadow rays only need an any-hit test against opaque primitives.
+    //!
+    //! @return         Whether the primitive is opaque.
+    SORT_FORCEINLINE bool IsOpaque() const {
+        return m_opaque;
+    }
+
+    //! @brief  Whether the opacity of the primitive varies on its surface and could be a cutout.
+    //!
+    //! Hits on cut out parts of these primitives are rejected by the primitives themselves, SIMD accelerators need to
+    //! test them one by one instead of packing them with others.
+    //!
+    //! @return         Whether the primitive could be alpha masked.
+    SORT_FORCEINLINE bool HasAlphaMask() const {
+        return m_alphaMasked;
+    }
     
     //! @brief  Get the type of the shape attached to the primitive.
     //!
@@ -127,8 +226,41 @@ public:
     }
 
 private:
+    //! @brief  Get the intersection between a ray and the primitive, skipping its cut out parts.
+    //!
+    //! The hit is evaluated in a separate interaction so that the closest one found so far is kept if the hit is cut
+    //! out, in which case the traversal simply goes on as if the primitive was not there.
+    //!
+    //! @param  r           Ray to be tested against the primitive.
+    //! @param  intersect   Intersected result, it could be nullptr.
+    //! @param  mask        Alpha mask of the material of the primitive.
+    //! @return             Whether the ray intersects the primitive where it is not cut out.
+    bool getMaskedIntersect( const Ray& r , SurfaceInteraction* intersect , const AlphaMask& mask ) const{
+        SurfaceInteraction candidate;
+        candidate.time = r.m_time;
+        if( intersect )
+            candidate.t = intersect->t;
+        if( !m_shape->GetIntersect( r , &candidate ) || mask.IsCutOut( candidate.u , candidate.v ) )
+            return false;
+        if( !intersect )
+            return true;
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        // Parts that are not cut out are fully opaque, shadow rays are blocked.
+        if( intersect->query_shadow ){
+            intersect->primitive = nullptr;
+            return true;
+        }
+#endif
+        *intersect = candidate;
+        intersect->primitive = this;
+        return true;
+    }
+
     const MaterialBase*     m_mat;      /**< The material attached to the primitive. */
     const Shape*            m_shape;    /**< The shape of the primitive. */
     class Light*            m_light;    /**< Light source attached to the primitive. */
     const Mesh*             m_mesh;     /**< The mesh that owns this primitive. */
+    bool                    m_opaque;   /**< Whether there is no transparency in the material of the primitive. */
+    bool                    m_alphaMasked;  /**< Whether the opacity of the material varies on the surface. */
 };
\ No newline at end of file
@@ -0,0 +1,181 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "profile.h"
+
+#ifndef SORT_ENABLE_PROFILER
+
+#include <stdio.h>
+#include <algorithm>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "core/log.h"
+#include "core/thread.h"
+
+std::atomic<bool> g_nativeProfilerEnabled( false );
+
+namespace {
+    // Names longer than this are truncated.
+    constexpr unsigned PROFILE_NAME_LENGTH = 48;
+    // Blocks are stored in chunks allocated on demand, blocks beyond the last chunk of a thread are dropped.
+    constexpr unsigned PROFILE_CHUNK_SIZE = 16384;
+    constexpr unsigned PROFILE_MAX_CHUNKS = 64;
+
+    //! @brief  A closed block.
+    struct ProfileEvent{
+        unsigned long long  begin;                          /**< The moment the block is opened in nanoseconds. */
+        unsigned long long  end;                            /**< The moment the block is closed in nanoseconds. */
+        char                name[PROFILE_NAME_LENGTH];      /**< Name of the block. */
+    };
+
+    //! @brief  A chunk of blocks.
+    struct ProfileChunk{
+        ProfileEvent        events[PROFILE_CHUNK_SIZE];
+    };
+
+    //! @brief  Blocks recorded by a thread, only the owner thread appends blocks to it.
+    struct ThreadProfile{
+        int                                 tid = 0;            /**< Id of the worker thread. */
+        std::unique_ptr<ProfileChunk>       chunks[PROFILE_MAX_CHUNKS];
+        std::atomic<unsigned>               count = { 0 };      /**< Number of blocks recorded. */
+        std::atomic<unsigned long long>     dropped = { 0 };    /**< Number of blocks dropped since the buffer is full. */
+    };
+
+    // Buffers of all threads that ever recorded a block, they outlive the threads so that they could be saved later.
+    std::mutex                                  g_profilesMutex;
+    std::vector<std::unique_ptr<ThreadProfile>> g_profiles;
+
+    thread_local ThreadProfile*     g_threadProfile = nullptr;
+    thread_local ProfileBlock*      g_innermostBlock = nullptr;
+
+    const auto g_profileEpoch = std::chrono::steady_clock::now();
+
+    unsigned long long nowNs(){
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - g_profileEpoch ).count();
+    }
+
+    ThreadProfile* threadProfile(){
+        if( !g_threadProfile ){
+            auto profile = std::make_unique<ThreadProfile>();
+            profile->tid = ThreadId();
+            g_threadProfile = profile.get();
+
+            std::lock_guard<std::mutex> lock( g_profilesMutex );
+            g_profiles.push_back( std::move( profile ) );
+        }
+        return g_threadProfile;
+    }
+
+    // Names are written as JSON strings.
+    void writeName( FILE* file , const char* name ){
+        for( auto c = name ; *c ; ++c ){
+            if( *c == '"' || *c == '\\' )
+                fputc( '\\' , file );
+            if( (unsigned char)*c >= 0x20 )
+                fputc( *c , file );
+        }
+    }
+}
+
+void ProfilerSetEnabled( bool enabled ){
+    g_nativeProfilerEnabled.store( enabled , std::memory_order_relaxed );
+}
+
+void ProfileBlock::open( const char* name ){
+    m_name = name ? name : "";
+    m_parent = g_innermostBlock;
+    g_innermostBlock = this;
+    m_begin = nowNs();
+}
+
+void ProfileBlock::Close(){
+    const auto end = nowNs();
+    g_innermostBlock = m_parent;
+
+    auto profile = threadProfile();
+    const auto index = profile->count.load( std::memory_order_relaxed );
+    const auto chunk_index = index / PROFILE_CHUNK_SIZE;
+    if( chunk_index >= PROFILE_MAX_CHUNKS ){
+        profile->dropped.store( profile->dropped.load( std::memory_order_relaxed ) + 1 , std::memory_order_relaxed );
+        m_name = nullptr;
+        return;
+    }
+
+    auto& chunk = profile->chunks[chunk_index];
+    if( !chunk )
+        chunk = std::make_unique<ProfileChunk>();
+    auto& event = chunk->events[index % PROFILE_CHUNK_SIZE];
+    event.begin = m_begin;
+    event.end = end;
+    strncpy( event.name , m_name , PROFILE_NAME_LENGTH - 1 );
+    event.name[PROFILE_NAME_LENGTH - 1] = 0;
+
+    // the block is published to the thread saving the blocks.
+    profile->count.store( index + 1 , std::memory_order_release );
+    m_name = nullptr;
+}
+
+void ProfileBlock::CloseInnermost(){
+    if( g_innermostBlock )
+        g_innermostBlock->Close();
+}
+
+unsigned ProfilerDump( const char* filename ){
+    auto file = fopen( filename , "w" );
+    if( !file ){
+        slog( WARNING , GENERAL , "Failed to save profiling file %s." , filename );
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock( g_profilesMutex );
+
+    // Threads of the same worker id are shown in the same row, worker threads are created again for every render.
+    fprintf( file , "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+    std::vector<int> named;
+    auto saved = 0u;
+    auto dropped = 0ull;
+    for( const auto& profile : g_profiles ){
+        if( std::find( named.begin() , named.end() , profile->tid ) == named.end() ){
+            named.push_back( profile->tid );
+            const auto name = profile->tid ? "Thread " + std::to_string( profile->tid ) : std::string( "Main Thread" );
+            fprintf( file , "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}" ,
+                     named.size() > 1 ? ",\n" : "" , profile->tid , name.c_str() );
+        }
+
+        const auto cnt = profile->count.load( std::memory_order_acquire );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto& event = profile->chunks[i / PROFILE_CHUNK_SIZE]->events[i % PROFILE_CHUNK_SIZE];
+            fprintf( file , ",\n{\"name\":\"" );
+            writeName( file , event.name );
+            fprintf( file , "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}" ,
+                     profile->tid , (double)event.begin * 1e-3 , (double)( event.end - event.begin ) * 1e-3 );
+        }
+        saved += cnt;
+        dropped += profile->dropped.load( std::memory_order_relaxed );
+    }
+    fprintf( file , "\n]}\n" );
+    fclose( file );
+
+    if( dropped > 0 )
+        slog( WARNING , GENERAL , "%llu profiling blocks are dropped, at most %u blocks are recorded by a thread." , dropped , PROFILE_CHUNK_SIZE * PROFILE_MAX_CHUNKS );
+    return saved;
+}
+
+#endif
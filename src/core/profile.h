@@ -21,6 +21,10 @@
 
 // SORT used to use easy profiler as default one.
 // It is a open-source cross-platform project, which is available on git https://github.com/yse/easy_profiler
+//
+// Without easy profiler, SORT_PROFILE is backed by a light weight native profiler that is always compiled in. It
+// costs nothing but checking a flag unless profiling is turned on with '--profiling:on', the blocks are then exported
+// in the Chrome trace format, which could be viewed in chrome://tracing or https://ui.perfetto.dev.
 
 #ifdef SORT_ENABLE_PROFILER
 
@@ -32,14 +36,83 @@
 #define SORT_PROFILE(e)             EASY_BLOCK((e))
 #define SORT_PROFILE_END            EASY_END_BLOCK
 #define SORT_PROFILE_DUMP(file)     profiler::dumpBlocksToFile(file)
+#define SORT_PROFILE_FILE           "sort.prof"
 
 #else
 
-#define SORT_PROFILE_ENABLE         {}
-#define SORT_PROFILE_DISABLE        {}
-#define SORT_PROFILE_ISENABLED      false
-#define SORT_PROFILE(e)
-#define SORT_PROFILE_END
-#define SORT_PROFILE_DUMP(file)     0
+#include <atomic>
+#include <string>
+
+//! @brief  Whether the native profiler records blocks, it is read on every profiled block.
+extern std::atomic<bool> g_nativeProfilerEnabled;
+
+//! @brief  Turn the native profiler on or off.
+//!
+//! @param  enabled     Whether blocks are recorded from now on.
+void    ProfilerSetEnabled( bool enabled );
+
+//! @brief  Save all recorded blocks in the Chrome trace format.
+//!
+//! It should only be called once no thread is recording blocks anymore.
+//!
+//! @param  filename    The file to save the blocks in.
+//! @return             Number of blocks saved.
+unsigned    ProfilerDump( const char* filename );
+
+//! @brief  ProfileBlock records the time of its life time as a block of the current thread.
+/**
+ * Each thread appends its blocks to its own buffer without any synchronization, the buffers are only reduced when
+ * they are saved. Blocks are closed in the reverse order of being opened, so that 'SORT_PROFILE_END' could close the
+ * innermost block before it goes out of scope.
+ */
+class ProfileBlock{
+public:
+    //! @brief  Open a block.
+    //!
+    //! @param  name        Name of the block, it is copied once the block is closed.
+    explicit ProfileBlock( const char* name ){
+        if( !g_nativeProfilerEnabled.load( std::memory_order_relaxed ) )
+            return;
+        open( name );
+    }
+
+    //! @brief  Open a block.
+    //!
+    //! @param  name        Name of the block, it is copied once the block is closed.
+    explicit ProfileBlock( const std::string& name ) : ProfileBlock( name.c_str() ) {}
+
+    //! @brief  Close the block if it is still open.
+    ~ProfileBlock(){
+        if( m_name )
+            Close();
+    }
+
+    //! @brief  Close the block before it goes out of scope.
+    void    Close();
+
+    //! @brief  Close the innermost open block of the current thread.
+    static void CloseInnermost();
+
+private:
+    const char*         m_name = nullptr;       /**< Name of the block, nullptr if it is not recorded. */
+    unsigned long long  m_begin = 0;            /**< The moment the block is opened in nanoseconds. */
+    ProfileBlock*       m_parent = nullptr;     /**< The block that is open when this block is opened. */
+
+    //! @brief  Start recording the block.
+    //!
+    //! @param  name        Name of the block.
+    void    open( const char* name );
+};
+
+#define SORT_PROFILE_CONCAT_IMPL(a,b)   a##b
+#define SORT_PROFILE_CONCAT(a,b)        SORT_PROFILE_CONCAT_IMPL(a,b)
+
+#define SORT_PROFILE_ENABLE         ProfilerSetEnabled( true )
+#define SORT_PROFILE_DISABLE        ProfilerSetEnabled( false )
+#define SORT_PROFILE_ISENABLED      g_nativeProfilerEnabled.load( std::memory_order_relaxed )
+#define SORT_PROFILE(e)             ProfileBlock SORT_PROFILE_CONCAT(localProfileBlock,__LINE__)((e));
+#define SORT_PROFILE_END            ProfileBlock::CloseInnermost()
+#define SORT_PROFILE_DUMP(file)     ProfilerDump(file)
+#define SORT_PROFILE_FILE           "sort_trace.json"
 
 #endif
@@ -15,117 +15,62 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <atomic>
 #include "rand.h"
 #include "core/define.h"
 #include "core/thread.h"
 
-#if defined(SORT_IN_LINUX)
-#elif defined(SORT_IN_WINDOWS)
-#include <time.h>
-#endif
+// The generator is counter-based, the n-th number of a stream is a hash of the key of the stream and n.
+// It is SplitMix64, the state of a thread is only the key and the counter, numbers drawn in a stream only depend
+// on the key of the stream and the order they are drawn, no matter which thread draws them.
+static thread_local unsigned long long  rng_key = 0;
+static thread_local unsigned long long  rng_counter = 0;
+static thread_local bool                seed_setup = false;
 
-#include <random>
+// sequence taking over 'sort_canonical' on the current thread
+static thread_local CanonicalSequence* canonical_sequence = nullptr;
 
-// different implementation of the random generator on different platforms could cause problems, switched to old solution until I have time to work on it later.
-// #define HIDE_OLD_RANDDOM_GENERATOR
-
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-// Random Number Method Definitions
-#define M 397
-#define MATRIX_A 0x9908b0dfUL   /* constant vector a */
-#define UPPER_MASK 0x80000000UL /* most significant w-r bits */
-#define LOWER_MASK 0x7fffffffUL /* least significant r bits */
-
-// variables used for random number generation
-static const int N = 624;
-static thread_local unsigned long mt[N]; /* the array for the state vector  */
-static thread_local int mti;
-static thread_local bool seed_setup = false;
-
-#else
-
-static thread_local std::default_random_engine  re;
-
-static thread_local std::uniform_int_distribution<unsigned>    dist_uint;
-static thread_local std::uniform_real_distribution<float>      dist_float( 0.0f , 1.0f );
-
-#endif
+static SORT_FORCEINLINE unsigned long long mix64( unsigned long long x ){
+    x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ull;
+    x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebull;
+    return x ^ ( x >> 31 );
+}
 
 // set the seed
 void sort_seed()
 {
-    unsigned _seed = ( ThreadId() + 1 ) * (unsigned)time(0);
-
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    mt[0]= _seed & 0xffffffffUL;
-    for (mti=1; mti<N; mti++) {
-        mt[mti] =
-        (1812433253UL * (mt[mti-1] ^ (mt[mti-1] >> 30)) + mti);
-        /* See Knuth TAOCP Vol2. 3rd Ed. P.106 for multiplier. */
-        /* In the previous versions, MSBs of the seed affect   */
-        /* only MSBs of the array mt[].                        */
-        /* 2002/01/09 modified by Makoto Matsumoto             */
-        mt[mti] &= 0xffffffffUL;
-        /* for >32 bit machines */
-    }
+    // each thread has its own stream, threads not spawned by the scheduler share the same thread id, they are
+    // told apart by the order they get seeded.
+    static std::atomic<unsigned> seeded_threads( 0 );
+    sort_seed( (unsigned)ThreadId() + 1 , ~seeded_threads.fetch_add( 1 , std::memory_order_relaxed ) );
+}
 
+// start drawing numbers of a stream
+void sort_seed( unsigned key , unsigned stream )
+{
+    rng_key = mix64( ( (unsigned long long)key << 32 ) | stream );
+    rng_counter = 0;
     seed_setup = true;
-#else
-    re.seed( _seed );
-#endif
 }
 
 // generate a unsigned integer
 unsigned sort_rand()
 {
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    unsigned long y;
-    {
-        static thread_local unsigned long mag01[2]={0x0UL, MATRIX_A};
-        /* mag01[x] = x * MATRIX_A  for x=0,1 */
+    if( UNLIKELY( !seed_setup ) )
+        sort_seed();
 
-        if( seed_setup == false )
-            sort_seed();
-
-        if (mti >= N) { /* generate N words at one time */
-            int kk;
-
-            if (mti == N+1)   /* if Seed() has not been called, */
-                sort_seed(); /* default initial seed */
-
-            for (kk=0;kk<N-M;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            for (;kk<N-1;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-            mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-            mti = 0;
-        }
-
-        y = mt[mti++];
-
-        /* Tempering */
-        y ^= (y >> 11);
-        y ^= (y << 7) & 0x9d2c5680UL;
-        y ^= (y << 15) & 0xefc60000UL;
-        y ^= (y >> 18);
-    }
-    return y;
-#else
-    return dist_uint(re);
-#endif
+    return (unsigned)( mix64( rng_key + ( ++rng_counter ) * 0x9e3779b97f4a7c15ull ) >> 32 );
 }
 
 // generate a canonical random number
 float sort_canonical(){
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    return (sort_rand() & 0xffffff) / float(1 << 24);
-#else
-    return dist_float(re);
-#endif
+    if( canonical_sequence )
+        return canonical_sequence->Next();
+
+    return (sort_rand() >> 8) / float(1 << 24);
+}
+
+// draw canonical numbers from the sequence on the current thread
+void sort_set_sequence( CanonicalSequence* sequence ){
+    canonical_sequence = sequence;
 }
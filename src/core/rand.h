@@ -20,14 +20,33 @@
 /*
 description :
     Random number generation method, the default 'rand' function provided by c++ standard library is not so good,
-    another random number generation method is adapted here.
+    another random number generation method is adapted here. It is a counter-based generator, renders seeding it
+    with pixels and samples are deterministic regardless of how pixels are scheduled among threads.
 */
 
-// set the seed
+// set the seed of the current thread, it is only used if no stream is selected on the thread
 void        sort_seed();
 
+// start drawing numbers of a stream on the current thread, numbers of a stream are the same no matter which thread draws them
+// para 'key'    : key of the streams, like the index of a pixel
+// para 'stream' : index of the stream with the key, like the index of a sample in the pixel
+void        sort_seed( unsigned key , unsigned stream );
+
 // generate a unsigned integer
 unsigned    sort_rand();
 
 // generate a canonical random number
 float       sort_canonical();
+
+// a sequence drawing canonical numbers one dimension after another, like a low discrepancy sampler
+class CanonicalSequence
+{
+public:
+    virtual ~CanonicalSequence() = default;
+
+    // draw the number of the next dimension
+    virtual float Next() = 0;
+};
+
+// draw canonical numbers from the sequence on the current thread, nullptr switches back to the random number generator
+void        sort_set_sequence( CanonicalSequence* sequence );
@@ -34,4 +34,16 @@ public:
     //! @param  filename        Name of the external file holding the data.
     //! @return                 Whether the file has been loaded successfully.
     virtual bool LoadResource(const std::string filename) = 0;
+
+    //! @brief  Share the decoded data with other SORT processes on the same machine.
+    //!
+    //! It needs to be called before the resource is loaded, resources not supporting it just ignore it.
+    //!
+    //! @param  hash            Hash of the type and the content of the resource file.
+    void ShareAcrossProcesses(unsigned long long hash) {
+        m_sharedHash = hash;
+    }
+
+protected:
+    unsigned long long  m_sharedHash = 0;   /**< Hash of the resource file if it is shared across processes, 0 otherwise. */
 };
\ No newline at end of file
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <string>
 #include <unordered_map>
 #include <algorithm>
 #include "core/singleton.h"
@@ -63,9 +64,45 @@ public:
         return m_factoryMap;
     }
 
+    //! @brief  Keep the name of a class, the factory map only has the hashed names.
+    //!
+    //! @param  sid         Hashed name of the class.
+    //! @param  name        Name of the class.
+    void RegisterName( const StringID sid , const char* name ){
+        m_nameMap[sid] = name;
+    }
+
+    //! @brief  Find the class with a name, regardless of the case of the name.
+    //!
+    //! @param  name        Name of the class, like the ones in the command line.
+    //! @return             Hashed name of the class, INVALID_SID if there is no such class.
+    StringID FindType( const std::string& name ) const{
+        const auto lower = []( std::string str ){
+            std::transform( str.begin() , str.end() , str.begin() , ::tolower );
+            return str;
+        };
+        const auto target = lower( name );
+        for( const auto& it : m_nameMap ){
+            if( lower( it.second ) == target )
+                return it.first;
+        }
+        return INVALID_SID;
+    }
+
+    //! @brief  Get the name of a class.
+    //!
+    //! @param  sid         Hashed name of the class.
+    //! @return             Name of the class, empty if there is no such class.
+    std::string GetTypeName( const StringID sid ) const{
+        const auto it = m_nameMap.find( sid );
+        return it == m_nameMap.end() ? std::string() : it->second;
+    }
+
 private:
     /**< Container for the factory methods. */
     FACTORY_MAP     m_factoryMap;
+    /**< Names of the classes. */
+    std::unordered_map<StringID,std::string>    m_nameMap;
 
     //! @brief  Make sure constructor is private.
     Factory(){}
@@ -103,6 +140,7 @@ std::unique_ptr<T> MakeUniqueInstance( const StringID sid ) {
             return;\
         }\
         factoryMap[sid] = this;\
+        Factory<B>::GetSingleton().RegisterName( sid , #T );\
     }\
     std::shared_ptr<B> CreateSharedInstance() const { return std::make_shared<T>(); }\
     std::unique_ptr<B> CreateUniqueInstance() const { return std::make_unique<T>(); }\
@@ -20,8 +20,10 @@
 #include <vector>
 #include <algorithm>
 #include "core/define.h"
+#include "math/point.h"
 #include "texture/texturebase.h"
 #include "core/sassert.h"
+#include "stream/stream.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 /*
@@ -125,53 +127,155 @@ SORT_FORCEINLINE float UniformSpherePdf(){
     return INV_TWOPI * 0.5f;
 }
 
+// spherical rectangle, the solid angle a rectangle subtends when seen from a point
+// Directions toward the rectangle are sampled uniformly in solid angle with the area preserving parameterization in
+// 'An Area-Preserving Parametrization for Spherical Rectangles' by Urena et al. It falls apart numerically for tiny
+// spherical rectangles, whose solid angle is reported as zero so that they are sampled by area instead.
+class SphericalRectangle{
+public:
+    // para 'o'  : the point where the rectangle is seen from
+    // para 's'  : a corner of the rectangle
+    // para 'ex' : an edge of the rectangle starting from 's'
+    // para 'ey' : the other edge of the rectangle starting from 's', it is perpendicular to 'ex'
+    SphericalRectangle( const Point& o , const Point& s , const Vector& ex , const Vector& ey ){
+        const auto exl = ex.Length();
+        const auto eyl = ey.Length();
+        if( exl == 0.0f || eyl == 0.0f )
+            return;
+
+        m_o = o;
+        m_x = ex / exl;
+        m_y = ey / eyl;
+        m_z = cross( m_x , m_y );
+
+        // the local frame is flipped so that the rectangle is always below the point
+        const auto d = s - o;
+        m_z0 = dot( d , m_z );
+        if( m_z0 > 0.0f ){
+            m_z = -m_z;
+            m_z0 = -m_z0;
+        }
+        if( m_z0 == 0.0f )
+            return;
+        m_x0 = dot( d , m_x );
+        m_y0 = dot( d , m_y );
+        m_x1 = m_x0 + exl;
+        m_y1 = m_y0 + eyl;
+
+        // normals of the planes containing the edges and the point
+        const auto n0 = normalize( Vector( 0.0f , m_z0 , -m_y0 ) );
+        const auto n1 = normalize( Vector( -m_z0 , 0.0f , m_x1 ) );
+        const auto n2 = normalize( Vector( 0.0f , -m_z0 , m_y1 ) );
+        const auto n3 = normalize( Vector( m_z0 , 0.0f , -m_x0 ) );
+
+        // interior angles of the spherical rectangle
+        const auto g0 = acos( std::clamp( -dot( n0 , n1 ) , -1.0f , 1.0f ) );
+        const auto g1 = acos( std::clamp( -dot( n1 , n2 ) , -1.0f , 1.0f ) );
+        const auto g2 = acos( std::clamp( -dot( n2 , n3 ) , -1.0f , 1.0f ) );
+        const auto g3 = acos( std::clamp( -dot( n3 , n0 ) , -1.0f , 1.0f ) );
+
+        m_b0 = n0.z;
+        m_b1 = n2.z;
+        m_k = TWO_PI - g2 - g3;
+        const auto solid_angle = g0 + g1 - m_k;
+        m_solidAngle = solid_angle >= MIN_SOLID_ANGLE ? solid_angle : 0.0f;
+    }
+
+    // the solid angle of the spherical rectangle, it is zero if it is too small to be sampled accurately
+    float SolidAngle() const{
+        return m_solidAngle;
+    }
+
+    // sample a point on the rectangle, the direction from the point of view toward it is uniformly distributed in
+    // solid angle, it should only be called if the solid angle is not zero.
+    // para 'u' : a canonical random variable
+    // para 'v' : a canonical random variable
+    Point Sample( float u , float v ) const{
+        sAssert( m_solidAngle > 0.0f , SAMPLING );
+
+        // the first canonical number picks the x coordinate by the solid angle on its left side
+        const auto au = u * m_solidAngle + m_k;
+        const auto fu = ( cos( au ) * m_b0 - m_b1 ) / sin( au );
+        const auto cu = std::clamp( ( fu >= 0.0f ? 1.0f : -1.0f ) / sqrt( fu * fu + m_b0 * m_b0 ) , -1.0f , 1.0f );
+        const auto xu = std::clamp( -( cu * m_z0 ) / std::max( sqrt( 1.0f - cu * cu ) , 1e-7f ) , m_x0 , m_x1 );
+
+        // the second canonical number picks the y coordinate along the arc at x
+        const auto d = sqrt( xu * xu + m_z0 * m_z0 );
+        const auto h0 = m_y0 / sqrt( d * d + m_y0 * m_y0 );
+        const auto h1 = m_y1 / sqrt( d * d + m_y1 * m_y1 );
+        const auto hv = h0 + v * ( h1 - h0 );
+        const auto hv2 = hv * hv;
+        const auto yv = hv2 < 1.0f - 1e-6f ? std::clamp( hv * d / sqrt( 1.0f - hv2 ) , m_y0 , m_y1 ) : m_y1;
+
+        return m_o + xu * m_x + yv * m_y + m_z0 * m_z;
+    }
+
+    // spherical rectangles smaller than this in solid angle are not sampled accurately with single precision
+    static constexpr float MIN_SOLID_ANGLE = 3e-4f;
+
+private:
+    Point   m_o;                    // the point where the rectangle is seen from
+    Vector  m_x , m_y , m_z;        // the local frame of the rectangle
+    float   m_x0 = 0.0f , m_x1 = 0.0f , m_y0 = 0.0f , m_y1 = 0.0f , m_z0 = 0.0f;   // the rectangle in the local frame
+    float   m_b0 = 0.0f , m_b1 = 0.0f , m_k = 0.0f;
+    float   m_solidAngle = 0.0f;    // the solid angle of the spherical rectangle
+};
+
 // one dimensional distribution
+// Discrete samples are drawn from an alias table in constant time, each bin packs everything a sample touches so that
+// it only takes one cache line fetch no matter how many bins there are. Continuous samples still invert the cdf, the alias
+// table doesn't map u to the domain monotonically and that would break stratification of u along with warping of its neighbourhood.
 class Distribution1D{
 public:
     // constructor
     Distribution1D( const float* f , unsigned n ):
         count(n)
     {
-        cdf = 0;
         sum = 0.0f;
         if( f == 0 || n == 0 )
             return;
 
-        cdf = std::make_unique<float[]>(n + 1);
-        cdf[0] = 0;
         for( unsigned i = 0 ; i < n ; i++ )
-            cdf[i+1] = cdf[i] + f[i];
-        sum = cdf[n];
+            sum += f[i];
+
+        bins = std::make_unique<AliasBin[]>(n);
+        for( unsigned i = 0 ; i < n ; i++ )
+            bins[i].p = ( sum != 0.0f ) ? f[i] / sum : 1.0f / (float)n;
+        _buildAliasTable();
+        _buildCdf();
+    }
+
+    // constructor from the data saved by 'Serialize'
+    Distribution1D( IStreamBase& stream ):
+        count( [&](){ unsigned n = 0; stream >> n; return n; }() )
+    {
+        stream >> sum;
+        if( count == 0 )
+            return;
+        bins = std::make_unique<AliasBin[]>(count);
+        stream.Load( (char*)bins.get() , (int)( sizeof( AliasBin ) * count ) );
+        _buildCdf();
+    }
 
-        if( sum != 0.0f )
-            for( unsigned i = 0 ; i < n+1 ; ++i )
-                cdf[i] /= sum;
-        else
-            for( unsigned i = 0 ; i < n+1 ; ++i )
-                cdf[i] = (float)i / (float)(n);
+    // save the alias table so that it doesn't need to be built again
+    void Serialize( OStreamBase& stream ) const{
+        stream << count << sum;
+        if( count > 0 )
+            stream.Write( (char*)bins.get() , (int)( sizeof( AliasBin ) * count ) );
     }
 
     // get a discrete sample
     // para 'u' : a canonical random variable
     // para 'pdf' : probability density function value for the sample
-    // result   : corresponding bucket straddle the u, -1 if there is no data in the distribution
-    int SampleDiscrete( float u , float* pdf ) const{
-        sAssert( count != 0 && cdf != 0 , SAMPLING );
+    // para 'remapped' : u remapped to a new canonical random variable, it is free to be reused for further sampling
+    // result   : corresponding bucket picked by u
+    int SampleDiscrete( float u , float* pdf , float* remapped = nullptr ) const{
+        sAssert( count != 0 && bins != 0 , SAMPLING );
         sAssert( u <= 1.0f && u >= 0.0f , SAMPLING );
 
-        float* target = std::lower_bound( cdf.get() , cdf.get() + count + 1 , u );
-        unsigned offset = (u<=0.0f)? 0:(int)(target-cdf.get()-1);
-        // special care needs to be payed to situation when u == 0.0f
-        if( offset == 0 ){
-            while( offset < count && cdf[offset+1] == 0.0f )
-                offset++;
-        }
-        if( offset == count ){
-            if( pdf ) *pdf = 0.0f;
-            return 0;
-        }
+        const auto offset = _sampleAlias( u , remapped );
         if( pdf )
-            *pdf = cdf[offset+1] - cdf[offset];
+            *pdf = bins[offset].p;
         return offset;
     }
 
@@ -197,8 +301,9 @@ public:
         }
         if( pdf )
             *pdf = (cdf[offset+1]-cdf[offset]) * count;
+        // samples stay in [0,1) like canonical numbers, even if u is exactly one
         float du = ( u - cdf[offset] ) / ( cdf[offset+1] - cdf[offset] );
-        return ( du + (float)offset ) / (float)count;
+        return std::min( ( du + (float)offset ) / (float)count , 0x1.fffffep-1f );
     }
 
     // get the sum of the original data
@@ -214,13 +319,82 @@ public:
     // get property of the unit
     float GetProperty( unsigned i ) const{
         sAssert( i < count , GENERAL );
-        return cdf[i+1]-cdf[i];
+        return bins[i].p;
     }
 
 private:
+    // a bin keeps itself with probability 'q', otherwise it is redirected to its alias
+    struct AliasBin{
+        float       q = 1.0f;       // probability of keeping the bin itself
+        unsigned    alias = 0;      // the bin redirected to
+        float       p = 0.0f;       // normalized probability of the bin
+    };
+
     const unsigned              count;
+    std::unique_ptr<AliasBin[]> bins;
     std::unique_ptr<float[]>    cdf;
     float                       sum;
+
+    // normalized cdf for continuous samples, it is rebuilt from the bins instead of being saved along with them
+    void _buildCdf(){
+        cdf = std::make_unique<float[]>(count + 1);
+        cdf[0] = 0.0f;
+        for( unsigned i = 0 ; i < count ; i++ )
+            cdf[i+1] = cdf[i] + bins[i].p;
+        for( unsigned i = 1 ; i < count ; i++ )
+            cdf[i] /= cdf[count];
+        cdf[count] = 1.0f;
+    }
+
+    // Vose's method, bins with less than average probability are topped up by the ones with more
+    void _buildAliasTable(){
+        std::vector<float> scaled( count );
+        std::vector<unsigned> small , large;
+        for( unsigned i = 0 ; i < count ; i++ ){
+            scaled[i] = bins[i].p * count;
+            bins[i].alias = i;
+            ( scaled[i] < 1.0f ? small : large ).push_back( i );
+        }
+
+        while( !small.empty() && !large.empty() ){
+            const auto s = small.back() , l = large.back();
+            small.pop_back();
+
+            bins[s].q = scaled[s];
+            bins[s].alias = l;
+
+            scaled[l] = ( scaled[l] + scaled[s] ) - 1.0f;
+            if( scaled[l] < 1.0f ){
+                large.pop_back();
+                small.push_back( l );
+            }
+        }
+
+        // whatever is left is full up to floating point error
+        for( const auto i : small )
+            bins[i].q = 1.0f;
+        for( const auto i : large )
+            bins[i].q = 1.0f;
+    }
+
+    // pick a bin, the fraction of u left after picking it is remapped to [0,1) if needed
+    SORT_FORCEINLINE unsigned _sampleAlias( float u , float* remapped ) const{
+        static constexpr float one_minus_epsilon = 0x1.fffffep-1f;
+
+        const auto scaled = u * count;
+        const auto i = std::min( (unsigned)scaled , count - 1 );
+        const auto frac = std::min( scaled - (float)i , one_minus_epsilon );
+
+        const auto& bin = bins[i];
+        if( frac < bin.q ){
+            if( remapped )
+                *remapped = frac / bin.q;
+            return i;
+        }
+        if( remapped )
+            *remapped = std::min( ( frac - bin.q ) / ( 1.0f - bin.q ) , one_minus_epsilon );
+        return bin.alias;
+    }
 };
 
 // two dimensional distribution
@@ -243,6 +417,34 @@ public:
         }
         _init( data.get() , nu , nv );
     }
+    // constructor from the distribution of each row, which could be built in parallel
+    Distribution2D( std::vector<std::unique_ptr<Distribution1D>>&& conditions ){
+        _init( std::move( conditions ) );
+    }
+    // constructor from the data saved by 'Serialize'
+    Distribution2D( IStreamBase& stream ){
+        unsigned nv = 0;
+        stream >> nv;
+        std::vector<std::unique_ptr<Distribution1D>> conditions( nv );
+        for( auto& condition : conditions )
+            condition = std::make_unique<Distribution1D>( stream );
+        _init( std::move( conditions ) );
+    }
+
+    // save the conditional distributions, the marginal one is cheap to rebuild
+    void Serialize( OStreamBase& stream ) const{
+        stream << m_nv;
+        for( const auto& condition : pConditions )
+            condition->Serialize( stream );
+    }
+
+    // size of the distribution
+    unsigned GetWidth() const{
+        return m_nu;
+    }
+    unsigned GetHeight() const{
+        return m_nv;
+    }
 
     // get a sample point
     void SampleContinuous( float u , float v , float uv[2] , float* pdf ){
@@ -278,13 +480,139 @@ private:
 
     // initialize data
     void _init( const float* data , unsigned nu , unsigned nv ){
+        std::vector<std::unique_ptr<Distribution1D>> conditions;
         for( unsigned i = 0 ; i < nv ; i++ )
-            pConditions.push_back( std::make_unique<Distribution1D>( &data[i*nu] , nu ) );
+            conditions.push_back( std::make_unique<Distribution1D>( &data[i*nu] , nu ) );
+        _init( std::move( conditions ) );
+    }
+    void _init( std::vector<std::unique_ptr<Distribution1D>>&& conditions ){
+        pConditions = std::move( conditions );
+        const auto nv = (unsigned)pConditions.size();
         std::unique_ptr<float[]> m = std::make_unique<float[]>(nv);
         for( unsigned i = 0 ; i < nv ; i++ )
             m[i] = pConditions[i]->GetSum();
         marginal = std::make_unique<Distribution1D>( m.get() , nv );
-        m_nu = nu;
+        m_nu = nv ? pConditions[0]->GetCount() : 0;
         m_nv = nv;
     }
 };
+
+// two dimensional piecewise constant distribution that could be sampled within any rectangular window of it
+// Integrals over windows are evaluated with a summed area table, it is exact with bilinear interpolation since the
+// integral of a piecewise constant function is bilinear inside each cell.
+class WindowedDistribution2D{
+public:
+    // constructor, data is stored row by row, there are 'nv' rows, each of which has 'nu' values
+    WindowedDistribution2D( const float* data , unsigned nu , unsigned nv ):
+        m_nu(nu) , m_nv(nv) , m_data( data , data + nu * nv ) , m_sat( ( nu + 1 ) * ( nv + 1 ) , 0.0 ) , m_columns( nu * ( nv + 1 ) , 0.0 )
+    {
+        sAssert( nu != 0 && nv != 0 , SAMPLING );
+
+        const auto cell_area = 1.0 / ( (double)nu * (double)nv );
+        for( auto j = 0u ; j < nv ; ++j ){
+            auto row = 0.0;
+            for( auto i = 0u ; i < nu ; ++i ){
+                const auto f = (double)std::max( 0.0f , data[ j * nu + i ] );
+                row += f * cell_area;
+                m_sat[ ( j + 1 ) * ( nu + 1 ) + i + 1 ] = m_sat[ j * ( nu + 1 ) + i + 1 ] + row;
+                m_columns[ i * ( nv + 1 ) + j + 1 ] = m_columns[ i * ( nv + 1 ) + j ] + f / (double)nv;
+            }
+        }
+    }
+
+    // integral of the function over the window [u0,u1]x[v0,v1] inside [0,1]x[0,1]
+    float Integral( float u0 , float v0 , float u1 , float v1 ) const{
+        return (float)( _sat( u1 , v1 ) - _sat( u0 , v1 ) - _sat( u1 , v0 ) + _sat( u0 , v0 ) );
+    }
+
+    // get a sample point inside the window
+    // para 'window' : the window to sample in, it is { u0 , v0 , u1 , v1 }
+    // para 'pdf' : pdf of the sample w.r.t the area of [0,1]x[0,1], given that it is inside the window
+    // result : false if there is nothing to sample in the window
+    bool SampleContinuous( float u , float v , const float window[4] , float uv[2] , float* pdf ) const{
+        const auto total = Integral( window[0] , window[1] , window[2] , window[3] );
+        if( total <= 0.0f )
+            return false;
+
+        // the marginal cdf along u is linear inside each column of cells
+        const auto marginal = [&]( double x ){ return _sat( x , window[3] ) - _sat( x , window[1] ) - _sat( window[0] , window[3] ) + _sat( window[0] , window[1] ); };
+        uv[0] = _invert( marginal , (double)u * total , window[0] , window[2] , m_nu );
+
+        // the conditional cdf along v is linear inside each cell of the column
+        const auto column = std::min( (unsigned)( uv[0] * m_nu ) , m_nu - 1 );
+        const auto conditional = [&]( double y ){ return _column( column , y ) - _column( column , window[1] ); };
+        const auto column_total = conditional( window[3] );
+        if( column_total <= 0.0 )
+            return false;
+        uv[1] = _invert( conditional , (double)v * column_total , window[1] , window[3] , m_nv );
+
+        if( pdf )
+            *pdf = Pdf( uv[0] , uv[1] , window );
+        return true;
+    }
+
+    // get pdf of a point w.r.t the area of [0,1]x[0,1], given that it is sampled inside the window
+    float Pdf( float u , float v , const float window[4] ) const{
+        if( u < window[0] || u > window[2] || v < window[1] || v > window[3] )
+            return 0.0f;
+        const auto total = Integral( window[0] , window[1] , window[2] , window[3] );
+        if( total <= 0.0f )
+            return 0.0f;
+        const auto iu = std::min( (unsigned)( clamp( u , 0.0f , 1.0f ) * m_nu ) , m_nu - 1 );
+        const auto iv = std::min( (unsigned)( clamp( v , 0.0f , 1.0f ) * m_nv ) , m_nv - 1 );
+        return std::max( 0.0f , m_data[ iv * m_nu + iu ] ) / total;
+    }
+
+private:
+    // size of the two dimensions
+    const unsigned      m_nu , m_nv;
+    // the original data
+    std::vector<float>  m_data;
+    // summed area table, integral of the function over [0,i/nu]x[0,j/nv] is at ( j * ( nu + 1 ) + i )
+    std::vector<double> m_sat;
+    // integral of the function in each column over [0,j/nv], it is at ( i * ( nv + 1 ) + j ) for column i
+    std::vector<double> m_columns;
+
+    // integral over [0,u]x[0,v]
+    double _sat( double u , double v ) const{
+        const auto x = std::clamp( u , 0.0 , 1.0 ) * m_nu , y = std::clamp( v , 0.0 , 1.0 ) * m_nv;
+        const auto i = std::min( (unsigned)x , m_nu - 1 ) , j = std::min( (unsigned)y , m_nv - 1 );
+        const auto fx = x - i , fy = y - j;
+        const auto s = [&]( unsigned a , unsigned b ){ return m_sat[ b * ( m_nu + 1 ) + a ]; };
+        return ( s( i , j ) * ( 1.0 - fx ) + s( i + 1 , j ) * fx ) * ( 1.0 - fy ) + ( s( i , j + 1 ) * ( 1.0 - fx ) + s( i + 1 , j + 1 ) * fx ) * fy;
+    }
+
+    // integral of column i over [0,v]
+    double _column( unsigned i , double v ) const{
+        const auto y = std::clamp( v , 0.0 , 1.0 ) * m_nv;
+        const auto j = std::min( (unsigned)y , m_nv - 1 );
+        const auto fy = y - j;
+        const auto c = &m_columns[ i * ( m_nv + 1 ) ];
+        return c[j] * ( 1.0 - fy ) + c[j + 1] * fy;
+    }
+
+    // find where the monotonic cdf, which is linear between cell boundaries, reaches the target inside [lo,hi]
+    template<class Cdf>
+    static float _invert( const Cdf& cdf , double target , double lo , double hi , unsigned n ){
+        // binary search the last cell boundary inside the range that the cdf doesn't exceed the target
+        auto a = lo;
+        auto cell = std::min( (unsigned)std::floor( lo * n ) , n - 1 );
+        auto first = (unsigned)std::ceil( lo * n ) , last = std::min( (unsigned)std::floor( hi * n ) , n );
+        if( first <= last && cdf( (double)first / n ) <= target ){
+            while( first < last ){
+                const auto mid = ( first + last + 1 ) / 2;
+                if( cdf( (double)mid / n ) <= target )
+                    first = mid;
+                else
+                    last = mid - 1;
+            }
+            a = std::max( lo , (double)first / n );
+            cell = std::min( first , n - 1 );
+        }
+        const auto b = std::min( hi , (double)( cell + 1 ) / n );
+
+        const auto ca = cdf( a ) , cb = cdf( b );
+        const auto t = cb > ca ? ( target - ca ) / ( cb - ca ) : 0.0;
+        return (float)std::clamp( a + std::clamp( t , 0.0 , 1.0 ) * ( b - a ) , lo , hi );
+    }
+};
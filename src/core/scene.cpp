@@ -16,6 +16,7 @@
  */
 
 #include <memory>
+#include <algorithm>
 #include "scene.h"
 #include "math/interaction.h"
 #include "accel/accelerator.h"
@@ -28,25 +29,58 @@
 #include "core/globalconfig.h"
 #include "core/strid.h"
 #include "core/primitive.h"
+#include "core/timer.h"
+#include "core/perfreport.h"
 #include "entity/visual_entity.h"
 #include "entity/visual.h"
 #include "stream/fstream.h"
+#include "stream/mstream.h"
+#include "task/task.h"
 #include "light/light.h"
+#include "light/lighttree.h"
 #include "shape/shape.h"
+#include "sampler/sample.h"
+#include <atomic>
+#include <cstdint>
 
 SORT_STATS_DEFINE_COUNTER(sScenePrimitiveCount)
 SORT_STATS_DEFINE_COUNTER(sSceneLightCount)
+SORT_STATS_DEFINE_COUNTER(sSceneUpdateCount)
+SORT_STATS_DEFINE_COUNTER(sSceneRebuildCount)
+SORT_STATS_DEFINE_HOT_COUNTER(sShadowCacheQuery)
+SORT_STATS_DEFINE_HOT_COUNTER(sShadowCacheHit)
+SORT_STATS_DEFINE_LOAD_REPORT(sSceneLoadReport)
 
 SORT_STATS_COUNTER("Statistics", "Total Primitive Count", sScenePrimitiveCount);
 SORT_STATS_COUNTER("Statistics", "Total Light Count", sSceneLightCount);
+SORT_STATS_COUNTER("Statistics", "Scene updates with moved primitives", sSceneUpdateCount);
+SORT_STATS_COUNTER("Statistics", "Spatial acceleration structure rebuilds", sSceneRebuildCount);
+SORT_STATS_COUNTER("Shadow Cache", "Shadow Rays Towards Lights", sShadowCacheQuery);
+SORT_STATS_RATIO("Shadow Cache", "Last Occluder Hit Rate", sShadowCacheHit, sShadowCacheQuery);
+SORT_STATS_LOAD_REPORT("Performance", "Scene Loading Breakdown", sSceneLoadReport);
+
+Scene::Scene() = default;
+Scene::~Scene() = default;
+
+// Generation of the last loaded scene.
+static std::atomic<unsigned> g_sceneGeneration( 0 );
 
 bool Scene::LoadScene( IStreamBase& stream ){
+    m_generation = ++g_sceneGeneration;
+
     const StringID verificationBit( "verification bits" );
 
     StringID checkingBit;
     stream >> checkingBit;
     sAssertMsg( checkingBit == verificationBit , RESOURCE , "Serialization is broken." );
 
+    unsigned int version = 0;
+    stream >> version;
+    sAssertMsg( SCENE_SERIALIZATION_VERSION == version , RESOURCE , "Incompatible scene layout in the resource file with this version SORT." );
+
+    // Entities are deserialized in parallel if it is loaded in a task, otherwise, like in unit tests, one after another.
+    const auto parallel = IS_PTR_VALID( GetCurrentTask() );
+
     while( true ){
         StringID class_id;
         stream >> class_id;
@@ -56,13 +90,43 @@ bool Scene::LoadScene( IStreamBase& stream ){
         auto entity = MakeUniqueInstance<Entity>( class_id );
         sAssertMsg( entity , RESOURCE , "Serialization is broken." );
 
-        entity->Serialize(stream);
-        m_entities.push_back(std::move(entity));
+        // Each entity comes with the size of its data, the data is copied out so that the stream could move on to the
+        // next entity while this one is being deserialized.
+        unsigned int size = 0;
+        stream >> size;
+        auto data = std::make_unique<char[]>( size );
+        for( unsigned int offset = 0 ; offset < size ; ){
+            const auto chunk = std::min( size - offset , 1u << 30 );
+            stream.Load( data.get() + offset , (int)chunk );
+            offset += chunk;
+        }
+
+        const auto entity_stream = std::make_shared<OMemoryStream>( std::move( data ) , size );
+        const auto raw_entity = entity.get();
+        const auto entity_name = "Entity #" + std::to_string( m_entities.size() );
+        const auto load_entity = [raw_entity , entity_stream , entity_name , size](){
+            SORT_STATS( Timer timer );
+            raw_entity->Serialize( *entity_stream );
+            SORT_STATS( sSceneLoadReport.Add( "Entities" , entity_name , timer.GetElapsedTimeInUs() , size ) );
+        };
+        if( parallel )
+            SPAWN_TASK<Function_Task>( "Deserialize Entity" , DEFAULT_TASK_PRIORITY , {} , load_entity );
+        else
+            load_entity();
+
+        m_entities.push_back( std::move( entity ) );
     }
 
+    // Entities fill the scene in the order they are loaded, which doesn't depend on how they are deserialized.
+    WAIT_FOR_CHILDREN();
+
     // generate triangle buffer after parsing from stream
+    SORT_STATS( Timer timer );
     generatePriBuf();
+    SORT_STATS( sSceneLoadReport.Add( "Scene" , "Primitive buffer" , timer.GetElapsedTimeInUs() , (StatsInt)( sizeof( Primitive* ) * m_primitives.size() ) ) );
+    SORT_STATS( timer.Reset() );
     genLightDistribution();
+    SORT_STATS( sSceneLoadReport.Add( "Scene" , "Light distribution" , timer.GetElapsedTimeInUs() , (StatsInt)( sizeof( float ) * m_lights.size() ) ) );
 
     SORT_STATS(sScenePrimitiveCount=(StatsInt)m_primitives.size());
     SORT_STATS(sSceneLightCount=(StatsInt)m_lights.size());
@@ -70,33 +134,141 @@ bool Scene::LoadScene( IStreamBase& stream ){
     return true;
 }
 
+bool Scene::UpdateScene( IStreamBase& stream ){
+    unsigned int cnt = 0;
+    stream >> cnt;
+
+    auto moved = false;
+    while( cnt-- > 0 ){
+        unsigned int index = 0;
+        stream >> index;
+        if( index >= m_entities.size() || !m_entities[index]->Update( stream ) ){
+            slog( WARNING , RESOURCE , "Entity %d can't be updated." , index );
+            return false;
+        }
+        moved |= m_entities[index]->HasVisuals();
+    }
+
+    // power of lights could change
+    genLightDistribution();
+
+    if( !moved )
+        return true;
+
+    for( const auto primitive : m_primitives )
+        primitive->InvalidateBBox();
+    genBBox();
+
+    SORT_STATS(++sSceneUpdateCount);
+    if( !g_accelerator->Update( m_bbox ) )
+        SORT_STATS(++sSceneRebuildCount);
+    if( g_acceleratorVol->GetIsValid() )
+        g_acceleratorVol->Update( m_bboxVol );
+    for( auto& it : m_sssAccelerators ){
+        if( it.second->GetIsValid() )
+            it.second->Update( m_bbox );
+    }
+    return true;
+}
+
 bool Scene::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
+    PerfReport::GetSingleton().AddRays( 1 , true );
     intersect.t = FLT_MAX;
+    intersect.time = r.m_time;
     return g_accelerator->GetIntersect( r , intersect );
 }
 
+void Scene::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i ){
+        intersects[i].t = FLT_MAX;
+        intersects[i].time = rays[i].m_time;
+    }
+    PerfReport::GetSingleton().AddRays( cnt , true );
+    g_accelerator->GetIntersect( rays , intersects , cnt );
+}
+
 #ifndef ENABLE_TRANSPARENT_SHADOW
 bool Scene::IsOccluded(const Ray& r) const{
+    PerfReport::GetSingleton().AddRays( 1 , false );
     return g_accelerator->IsOccluded(r);
 }
+
+unsigned Scene::IsVisible( const Ray* rays , const unsigned cnt ) const{
+    PerfReport::GetSingleton().AddRays( cnt , false );
+    return ~g_accelerator->IsOccluded( rays , cnt ) & ( ( 1u << cnt ) - 1u );
+}
 #else
-Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms ) const{
+// Size of the table of last occluders of each thread, lights mapped to the same entry replace each other.
+static constexpr unsigned SHADOW_CACHE_SIZE = 64;
+
+// The last opaque primitive blocking a shadow ray towards a light.
+struct ShadowCacheEntry{
+    unsigned            generation = 0;
+    const Light*        light = nullptr;
+    const Primitive*    occluder = nullptr;
+};
+static thread_local ShadowCacheEntry g_shadowCache[SHADOW_CACHE_SIZE];
+
+Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms , const Light* light ) const{
+    ShadowCacheEntry* entry = nullptr;
+    if( light ){
+        SORT_STATS_HOT(++sShadowCacheQuery);
+        entry = &g_shadowCache[( reinterpret_cast<std::uintptr_t>( light ) / sizeof( void* ) ) % SHADOW_CACHE_SIZE];
+        if( entry->generation == m_generation && entry->light == light && entry->occluder->GetIntersect( const_ray , nullptr ) ){
+            SORT_STATS_HOT(++sShadowCacheHit);
+            return 0.0f;
+        }
+    }
+
     auto ray = const_ray;
 
     Spectrum attenuation( 1.0f );
     while( !attenuation.IsBlack() ){
         Spectrum att;
-        if( !g_accelerator->GetAttenuation(ray, att, ms) )
+        const Primitive* occluder = nullptr;
+        PerfReport::GetSingleton().AddRays( 1 , false );
+        if( !g_accelerator->GetAttenuation(ray, att, ms, &occluder) )
             break;
 
-        if( att.IsBlack() )
+        if( att.IsBlack() ){
+            // only opaque primitives outside instances are cached, testing them again is exactly the same as traversal.
+            if( entry && occluder && occluder->IsOpaque() ){
+                entry->generation = m_generation;
+                entry->light = light;
+                entry->occluder = occluder;
+            }
             return att;
+        }
 
         attenuation *= att;
     }
     
     return attenuation;
 }
+
+unsigned Scene::GetAttenuation( const Ray* rays , Spectrum* attenuations , const unsigned cnt ) const{
+    sAssert( cnt <= RAY_PACKET_SIZE , SPATIAL_ACCELERATOR );
+
+    SurfaceInteraction intersects[RAY_PACKET_SIZE];
+    for( auto i = 0u ; i < cnt ; ++i )
+        intersects[i].query_shadow = true;
+    PerfReport::GetSingleton().AddRays( cnt , false );
+    const auto blocked = g_accelerator->GetIntersect( rays , intersects , cnt );
+
+    auto visible = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( 0 == ( blocked & ( 1u << i ) ) )
+            attenuations[i] = 1.0f;
+        else if( IS_PTR_INVALID( intersects[i].primitive ) )
+            attenuations[i] = 0.0f;
+        else
+            attenuations[i] = GetAttenuation( rays[i] );
+
+        if( !attenuations[i].IsBlack() )
+            visible |= ( 1u << i );
+    }
+    return visible;
+}
 #endif
 
 void Scene::RestoreMediumStack( const Point& p , MediumStack& ms ) const{
@@ -111,15 +283,117 @@ void Scene::RestoreMediumStack( const Point& p , MediumStack& ms ) const{
 }
 
 void Scene::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
+    // probe rays only need to traverse primitives of their own material
+    PerfReport::GetSingleton().AddRays( 1 , false );
+    const auto it = m_sssAccelerators.find( matID );
+    if( it != m_sssAccelerators.end() && it->second->GetIsValid() ){
+        it->second->GetIntersect( r , intersect , matID );
+        return;
+    }
+
     // no brute force support in BSSRDF
     if(IS_PTR_VALID(g_accelerator))
         g_accelerator->GetIntersect( r , intersect , matID );
 }
 
+void Scene::SetAcceleratorSSS( const StringID matID , std::unique_ptr<Accelerator> accelerator ){
+    m_sssAccelerators[matID] = std::move( accelerator );
+}
+
 void Scene::generatePriBuf(){
-    for( auto& entity : m_entities )
+    // Entities without visuals, like cameras, go first. Visuals could depend on the camera, like decimating hair.
+    // Every camera setting itself up is a view of the scene, the first one is the camera of the scene.
+    for( auto& entity : m_entities ){
+        if( entity->HasVisuals() )
+            continue;
+        const auto camera = m_camera;
         entity->FillScene( *this );
-    
+        if( m_camera != camera )
+            m_views.push_back( m_camera );
+    }
+    if( !m_views.empty() )
+        m_camera = m_views.front();
+    for( auto& entity : m_entities ){
+        if( entity->HasVisuals() )
+            entity->FillScene( *this );
+    }
+
+    genBBox();
+}
+
+// Planes bounding what a camera sees, built from the rays through the corners of the image, the normals point inwards.
+// Cameras seeing a hemisphere or more, like environment cameras, can't be bounded by planes.
+static bool viewFrustum( const Camera* camera , Vector normals[4] , float offsets[4] ){
+    const auto w = (float)g_resultResollutionWidth;
+    const auto h = (float)g_resultResollutionHeight;
+    const PixelSample ps;
+    const auto center = camera->GenerateRay( w * 0.5f , h * 0.5f , ps );
+    const Ray corners[4] = { camera->GenerateRay( 0.0f , 0.0f , ps ) , camera->GenerateRay( w , 0.0f , ps ) ,
+                             camera->GenerateRay( w , h , ps ) , camera->GenerateRay( 0.0f , h , ps ) };
+    for( const auto& corner : corners ){
+        if( dot( corner.m_Dir , center.m_Dir ) <= 0.0f )
+            return false;
+    }
+
+    // each plane goes through two neighboring corner rays, it works for both perspective and orthographic cameras.
+    const auto inside = center( 1.0f );
+    for( auto i = 0u ; i < 4u ; ++i ){
+        const auto& a = corners[i];
+        const auto& b = corners[( i + 1 ) % 4];
+        const auto n = cross( a.m_Dir , b( 1.0f ) - a.m_Ori );
+        if( isZero( n ) )
+            return false;
+        normals[i] = normalize( n );
+        offsets[i] = -dot( normals[i] , (Vector)a.m_Ori );
+        if( dot( normals[i] , (Vector)inside ) + offsets[i] < 0.0f ){
+            normals[i] = -normals[i];
+            offsets[i] = -offsets[i];
+        }
+    }
+    return true;
+}
+
+unsigned Scene::PruneOutsideViews( const float margin ){
+    if( m_views.empty() )
+        return 0;
+
+    const auto view_cnt = m_views.size();
+    std::vector<Vector> normals( 4 * view_cnt );
+    std::vector<float>  offsets( 4 * view_cnt );
+    for( auto i = 0u ; i < view_cnt ; ++i ){
+        if( !viewFrustum( m_views[i] , &normals[4 * i] , &offsets[4 * i] ) )
+            return 0;
+    }
+
+    const auto distance = margin * ( m_bbox.m_Max - m_bbox.m_Min ).Length();
+    const auto visible = [&]( const BBox& bbox ){
+        for( auto i = 0u ; i < view_cnt ; ++i ){
+            auto inside = true;
+            for( auto k = 4 * i ; inside && k < 4 * i + 4 ; ++k ){
+                // the corner of the box farthest along the normal is the one most likely inside the plane.
+                const auto& n = normals[k];
+                const Vector corner( n.x > 0.0f ? bbox.m_Max.x : bbox.m_Min.x , n.y > 0.0f ? bbox.m_Max.y : bbox.m_Min.y , n.z > 0.0f ? bbox.m_Max.z : bbox.m_Min.z );
+                inside = dot( n , corner ) + offsets[k] >= -distance;
+            }
+            if( inside )
+                return true;
+        }
+        return false;
+    };
+
+    const auto cnt = m_primitives.size();
+    m_primitives.erase( std::remove_if( m_primitives.begin() , m_primitives.end() , [&]( const Primitive* primitive ){
+        return !primitive->GetLight() && !primitive->GetMaterial()->HasVolumeAttached() && !visible( primitive->GetBBox() );
+    } ) , m_primitives.end() );
+
+    const auto pruned = (unsigned)( cnt - m_primitives.size() );
+    if( pruned > 0 )
+        genBBox();
+    SORT_STATS(sScenePrimitiveCount=(StatsInt)m_primitives.size());
+    return pruned;
+}
+
+void Scene::genBBox(){
     auto generate_bbox = [](const std::vector<const Primitive*>& primitives) {
         BBox bbox;
 
@@ -138,6 +412,9 @@ void Scene::generatePriBuf(){
 
     m_bbox      = generate_bbox(m_primitives);
     m_bboxVol   = generate_bbox(m_volPrimitives);
+
+    // primitives stop moving once they are updated in a sequence
+    m_hasMotion = std::any_of( m_primitives.begin() , m_primitives.end() , []( const Primitive* primitive ){ return primitive->IsMoving(); } );
 }
 
 void Scene::genLightDistribution(){
@@ -157,6 +434,7 @@ void Scene::genLightDistribution(){
         m_lights[i]->SetPickPDF( pdf[i] / total_pdf );
 
     m_lightsDis = std::make_unique<Distribution1D>( pdf.get() , count );
+    m_lightTree = std::make_unique<LightTree>( m_lights );
 }
 
 const Light* Scene::SampleLight( float u , float* pdf ) const{
@@ -172,6 +450,22 @@ const Light* Scene::SampleLight( float u , float* pdf ) const{
     return nullptr;
 }
 
+const Light* Scene::SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const{
+    sAssert( u >= 0.0f && u <= 1.0f , SAMPLING );
+    sAssertMsg(IS_PTR_VALID(m_lightTree), SAMPLING , "No light in the scene." );
+
+    float _pdf = 0.0f;
+    const auto light = m_lightTree->Sample( p , n , u , &_pdf );
+    if( light && pdf )
+        *pdf = _pdf;
+    return _pdf > 0.0f ? light : nullptr;
+}
+
+float Scene::LightPdf( const Point& p , const Vector& n , const Light* light ) const{
+    sAssertMsg(IS_PTR_VALID(m_lightTree), SAMPLING , "No light in the scene." );
+    return m_lightTree->Pdf( p , n , light );
+}
+
 float Scene::LightProperbility( unsigned i ) const{
     sAssert(IS_PTR_VALID(m_lightsDis), LIGHT );
     return m_lightsDis->GetProperty( i );
@@ -179,8 +473,12 @@ float Scene::LightProperbility( unsigned i ) const{
 
 Spectrum Scene::Le( const Ray& ray ) const{
     if( m_skyLight ){
+        // the sky seen directly is looked up exactly, only lighting is looked up with a spread
+        auto exact = ray;
+        exact.m_coneSpread = 0.0f;
+
         Spectrum r;
-        m_skyLight->Le( ray , 0 , r );
+        m_skyLight->Le( exact , 0 , r );
         return r;
     }
     return 0.0f;
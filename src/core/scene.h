@@ -19,6 +19,7 @@
 
 #include "core/define.h"
 #include <vector>
+#include <unordered_map>
 #include "core/sassert.h"
 #include "math/bbox.h"
 #include "spectrum/spectrum.h"
@@ -28,8 +29,17 @@
 #include "entity/entity.h"
 #include "core/primitive.h"
 #include "core/samplemethod.h"
+#include "core/stats.h"
 
 class Light;
+class LightTree;
+class Accelerator;
+
+// Breakdown of the time and bytes of everything loaded in the scene, per phase and per item.
+SORT_STATS_DECLARE_LOAD_REPORT(sSceneLoadReport)
+
+//! @brief  This needs to be updated every time the layout of serialized scenes changes.
+constexpr unsigned int SCENE_SERIALIZATION_VERSION = 2;
 struct BSSRDFIntersections;
 
 //! @brief  Data structure representing the whole scene.
@@ -38,12 +48,28 @@ struct BSSRDFIntersections;
  */
 class   Scene{
 public:
+    //! @brief  Constructor is defined where the light tree is not an incomplete type.
+    Scene();
+
+    //! @brief  Destructor is defined where the accelerator is not an incomplete type.
+    ~Scene();
+
     //! @brief Serialize scene from stream.
     //!
     //! @param  stream      The streaming source where scene information is loaded from.
     //! @return             Whether the scene is loaded correctly.
     bool    LoadScene( class IStreamBase& stream );
 
+    //! @brief Update the scene for the next frame of a sequence.
+    //!
+    //! The stream has the number of updated entities, followed by the index of each of them in the order they were
+    //! loaded and its update data. Materials, textures and geometry of meshes are kept, spatial acceleration structures
+    //! are refitted if anything moves and rebuilt only if refitting degrades them too much.
+    //!
+    //! @param  stream      The streaming source where the changes of the scene are loaded from.
+    //! @return             Whether the scene is updated correctly.
+    bool    UpdateScene( class IStreamBase& stream );
+
     //! @brief  Find the first intersection between a ray and the whole scene.
     //!
     //! @param  intersect   Intersection information at exitant point.
@@ -52,6 +78,15 @@ public:
     //! @return             Whether there is an intersection between the ray and the scene.
     bool    GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const;
 
+    //! @brief  Find the first intersections between a packet of coherent rays and the whole scene.
+    //!
+    //! Whether a ray intersects the scene is indicated by the primitive of its intersection.
+    //!
+    //! @param  rays        The rays to be tested.
+    //! @param  intersects  The intersection results, one for each ray.
+    //! @param  cnt         Number of rays in the packet, it can't be larger than RAY_PACKET_SIZE.
+    void    GetIntersect( const Ray* rays , SurfaceInteraction* intersects , const unsigned cnt ) const;
+
 #ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief  This is a dedicated interface for detecting shadow rays.
     //!
@@ -62,6 +97,16 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const;
+
+    //! @brief  Detect occlusion of a batch of shadow rays.
+    //!
+    //! Shadow rays sharing the same origin, like the ones towards all lights of a shading point, are traced together
+    //! so that the spatial data structure could share the traversal among them.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param cnt          Number of rays in the batch, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of visible rays, the i-th bit is for the i-th ray.
+    unsigned    IsVisible( const Ray* rays , const unsigned cnt ) const;
 #else
     //! @brief  Evaluate occlusion along a ray segment.
     //!
@@ -70,10 +115,27 @@ public:
     //! The returned value is the spectrum dependent percentage of un-occluded radiance. Put it in other words, 0 means fully
     //! occluded, 1.0 means fully un-occluded.
     //!
+    //! Shadow rays towards a light from nearby shading points are often blocked by the same primitive. Each thread keeps
+    //! the last opaque primitive blocking a shadow ray towards each light, which is tested before traversing the scene.
+    //!
     //! @param  r           The ray to be tested.
     //! @param  ms          The medium stack to be passed in. Medium aware integrator needs to pass non-empty pointer.
+    //! @param  light       The light the ray is shot towards, the last occluder is not cached if it is nullptr.
     //! @return             The occlusion along the ray.
-    Spectrum    GetAttenuation( const Ray& r , MediumStack* ms = nullptr ) const;
+    Spectrum    GetAttenuation( const Ray& r , MediumStack* ms = nullptr , const Light* light = nullptr ) const;
+
+    //! @brief  Evaluate occlusion of a batch of shadow rays.
+    //!
+    //! Shadow rays sharing the same origin, like the ones towards all lights of a shading point, are traced together
+    //! so that the spatial data structure could share the traversal among them. Only rays reaching transparent
+    //! primitives need their attenuation evaluated one by one afterwards, rays blocked by opaque primitives are done
+    //! with the batch. Medium is not considered here.
+    //!
+    //! @param rays         The rays to be tested.
+    //! @param attenuations The occlusion along the rays, one for each ray.
+    //! @param cnt          Number of rays in the batch, it can't be larger than RAY_PACKET_SIZE.
+    //! @return             Mask of visible rays, whose attenuation is not black, the i-th bit is for the i-th ray.
+    unsigned    GetAttenuation( const Ray* rays , Spectrum* attenuations , const unsigned cnt ) const;
 #endif
 
 	//! @brief	Restore the medium stack at a specific point.
@@ -88,6 +150,7 @@ public:
     //! above one to acquire all intersections in a brute force way, which obviously introduces quite some duplicated work.
     //! The intersection returned doesn't guarrantee the order of the intersection of the results, but it does guarrantee to get the
     //! nearest N intersections.
+    //! Materials with SSS have their own accelerators holding only their primitives, the rays only traverse them if available.
     //!
     //! @param  r           The input ray to be tested.
     //! @param  intersect   The intersection result that holds all intersection.
@@ -111,6 +174,23 @@ public:
     }
     // get sampled light
     const Light* SampleLight( float u , float* pdf ) const;
+
+    //! @brief  Pick a light for a shading point, lights close to and facing the point are more likely to be picked.
+    //!
+    //! @param  p       The position of the shading point.
+    //! @param  n       The normal of the shading point, zero vector if there is no surface, like inside media.
+    //! @param  u       A canonical random variable.
+    //! @param  pdf     The probability of picking the light.
+    //! @return         The light picked, nullptr if no light could contribute to the shading point.
+    const Light* SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Probability of picking a light for a shading point through 'SampleLight'.
+    //!
+    //! @param  p       The position of the shading point.
+    //! @param  n       The normal of the shading point, zero vector if there is no surface, like inside media.
+    //! @param  light   The light of interest.
+    //! @return         The probability of picking the light.
+    float LightPdf( const Point& p , const Vector& n , const Light* light ) const;
     // get the properbility of the sample
     float LightProperbility( unsigned i ) const;
     // get the number of lights
@@ -131,6 +211,15 @@ public:
     const BBox& GetBBoxVol() const {
         return m_bboxVol;
     }
+
+    //! @brief  Whether anything in the scene moves during the shutter interval.
+    //!
+    //! Camera rays are only sampled in time with motion blur in the scene.
+    //!
+    //! @return     Whether there is any moving primitive in the scene.
+    bool HasMotion() const {
+        return m_hasMotion;
+    }
     
     //! @brief  Add a primitive in the scene.
     void AddPrimitive( const Primitive* primitive) {
@@ -139,8 +228,27 @@ public:
 		const auto material = primitive->GetMaterial();
 		if( material->HasVolumeAttached() )
 			m_volPrimitives.push_back( primitive );
+        if( material->HasSSS() )
+            m_sssPrimitives[material->GetUniqueID()].push_back( primitive );
     }
     
+    //! @brief  Register a mesh that is shared by instances.
+    //!
+    //! @param  name    Name of the mesh.
+    //! @param  mesh    The geometry shared by all instances of the mesh.
+    void AddInstancedMesh( const StringID name , const std::shared_ptr<InstancedMesh>& mesh ){
+        m_instancedMeshes[name] = mesh;
+    }
+
+    //! @brief  Get a mesh that is shared by instances.
+    //!
+    //! @param  name    Name of the mesh.
+    //! @return         The geometry shared by all instances of the mesh, nullptr if it is not registered.
+    std::shared_ptr<InstancedMesh> GetInstancedMesh( const StringID name ) const{
+        const auto it = m_instancedMeshes.find( name );
+        return it == m_instancedMeshes.end() ? nullptr : it->second;
+    }
+
     //! @brief  Get all of the primitives in the scene.
     //!
     //! @return     A vector that holds all primitives in the scene.
@@ -148,6 +256,16 @@ public:
         return m_primitives;
     }
 
+    //! @brief  Remove surface primitives far away from what the cameras of the scene see.
+    //!
+    //! Primitives farther than the margin out of the view frustums of all cameras are removed before accelerators are
+    //! built, primitives of lights and ones with volumes attached are always kept. It is biased, light bounced off the
+    //! removed primitives is lost, the margin keeps what is around the view for secondary bounces.
+    //!
+    //! @param  margin      Distance out of the frustums within which primitives are kept, relative to the size of the scene.
+    //! @return             Number of primitives removed, nothing is removed if any camera can't be bounded by a frustum.
+    unsigned    PruneOutsideViews( float margin );
+
 	//! @brief  Get all of the primitives that has volume attached in the scene.
 	//!
 	//! @return     A vector that holds all primitives in the scene.
@@ -155,6 +273,21 @@ public:
 		return m_volPrimitives;
 	}
 
+    //! @brief  Get all of the primitives with SSS, grouped by their materials.
+    //!
+    //! @return     Primitives of each material with SSS.
+    const std::unordered_map<StringID, std::vector<const Primitive*>>& GetPrimitivesSSS() const {
+        return m_sssPrimitives;
+    }
+
+    //! @brief  Set the accelerator for probe rays of a material with SSS.
+    //!
+    //! It is not thread safe, all of them need to be set before rendering.
+    //!
+    //! @param  matID       Unique id of the material.
+    //! @param  accelerator The accelerator holding primitives of the material only.
+    void    SetAcceleratorSSS( const StringID matID , std::unique_ptr<Accelerator> accelerator );
+
     // Evaluate sky
     Spectrum    Le( const Ray& ray ) const;
 
@@ -167,6 +300,16 @@ public:
         return m_camera;
     }
 
+    //! @brief  Get all cameras the scene is loaded with.
+    //!
+    //! A scene could carry more than one camera, like the two eyes of a stereo pair. The first one is the camera
+    //! of the scene once it is loaded, the others are extra views rendered with the same loaded scene.
+    //!
+    //! @return     Cameras in the order of the entities, it is empty if the scene has no camera.
+    const std::vector<Camera*>& GetViews() const {
+        return m_views;
+    }
+
 private:
     std::vector<std::unique_ptr<Entity>>        m_entities;             /**< Entities in the scene. */
     std::vector<Light*>                         m_lights;               /**< Lights in the scene. */
@@ -174,19 +317,36 @@ private:
     std::vector<const Primitive*>               m_primitives;           /**< A list holding all primitives. */
     std::vector<const Primitive*>               m_volPrimitives;        /**< A list holding all primitives that has volume attached to it. */
 
+    std::unordered_map<StringID, std::vector<const Primitive*>>     m_sssPrimitives;    /**< Primitives with SSS grouped by their materials. */
+    std::unordered_map<StringID, std::unique_ptr<Accelerator>>      m_sssAccelerators;  /**< Accelerators for probe rays of each material with SSS. */
+
+    std::unordered_map<StringID, std::shared_ptr<InstancedMesh>>  m_instancedMeshes;  /**< Meshes shared by instances. */
+
     Light*                  m_skyLight = nullptr;   /**< Sky light if available. */
     Camera*                 m_camera = nullptr;     /**< Camera of the scene. */
+    std::vector<Camera*>    m_views;                /**< All cameras the scene is loaded with. */
 
     /**< distribution of light power */
     std::unique_ptr<Distribution1D>             m_lightsDis = nullptr;
+    /**< light tree for picking lights for shading points */
+    std::unique_ptr<LightTree>                  m_lightTree;
 
     // bounding box for the scene
     BBox    m_bbox;
     BBox    m_bboxVol;
 
+    // whether there is any moving primitive in the scene
+    bool    m_hasMotion = false;
+
+    // unique among all loaded scenes, occluders cached for an earlier scene are never used for this one.
+    unsigned    m_generation = 0;
+
     // generate primitive buffer
     void    generatePriBuf();
 
+    // update bounding box of the scene and whether anything in it moves
+    void    genBBox();
+
     // compute light cdf
     void    genLightDistribution();
 
@@ -0,0 +1,289 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "sharedresource.h"
+#include "core/stats.h"
+#include "core/log.h"
+#include "core/globalconfig.h"
+
+#if defined(SORT_IN_LINUX) || defined(SORT_IN_MAC)
+    #include <sys/stat.h>
+    #include <sys/file.h>
+    #include <dirent.h>
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <unistd.h>
+#endif
+
+SORT_STATS_DEFINE_COUNTER(sAttachedResources)
+SORT_STATS_DEFINE_COUNTER(sPublishedResources)
+SORT_STATS_DEFINE_COUNTER(sTrimmedResources)
+
+SORT_STATS_COUNTER("Statistics", "Resources Attached from Other Processes", sAttachedResources);
+SORT_STATS_COUNTER("Statistics", "Resources Published to Other Processes", sPublishedResources);
+SORT_STATS_COUNTER("Statistics", "Unused Shared Resources Removed", sTrimmedResources);
+
+static constexpr unsigned SHARED_RESOURCE_MAGIC = 0x53524853;
+static constexpr size_t   SHARED_RESOURCE_HEADER_SIZE = 64;
+
+// Another process filling the data is waited for this long, it most likely died if it takes longer.
+static constexpr auto     SHARED_RESOURCE_WAIT = std::chrono::seconds( 30 );
+
+// States of the data in the shared memory.
+enum SharedResourceState : unsigned {
+    SHARED_RESOURCE_FILLING = 0 ,
+    SHARED_RESOURCE_READY ,
+    SHARED_RESOURCE_ABANDONED
+};
+
+// The header of the shared memory, the data follows it at the next 64 bytes boundary.
+struct SharedResourceHeader{
+    unsigned int            magic;      /**< SHARED_RESOURCE_MAGIC. */
+    std::atomic<unsigned>   state;      /**< SharedResourceState of the data. */
+    unsigned long long      size;       /**< Size of the data in bytes. */
+};
+static_assert( sizeof( SharedResourceHeader ) <= SHARED_RESOURCE_HEADER_SIZE , "Header of shared resources is too large." );
+
+// Full name of the shared memory for the platform.
+static std::string sharedMemoryName( const std::string& name ){
+#if defined(SORT_IN_WINDOWS)
+    return "Local\\" + name;
+#else
+    #if defined(SORT_IN_LINUX)
+        struct stat st;
+        if( stat( "/dev/shm" , &st ) == 0 && S_ISDIR( st.st_mode ) )
+            return "/dev/shm/" + name;
+    #endif
+    const char* tmp = getenv( "TMPDIR" );
+    std::string dir = ( tmp && *tmp ) ? tmp : "/tmp";
+    if( dir.back() != '/' )
+        dir += '/';
+    return dir + name;
+#endif
+}
+
+#if !defined(SORT_IN_WINDOWS)
+// Open the file of a shared memory with a shared lock, which tells other processes that it is being used.
+static int lockSharedMemory( const std::string& full_name ){
+    const auto fd = open( full_name.c_str() , O_RDONLY );
+    if( fd == -1 )
+        return -1;
+    if( flock( fd , LOCK_SH ) != 0 ){
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+SharedResourceData::~SharedResourceData(){
+#if !defined(SORT_IN_WINDOWS)
+    m_memory = nullptr;
+    if( m_lock == -1 )
+        return;
+
+    // Nobody else holds a lock if an exclusive one can be taken, this process is the last one using the data.
+    const auto last_user = flock( m_lock , LOCK_EX | LOCK_NB ) == 0;
+    close( m_lock );
+    if( last_user )
+        Trim( (size_t)g_sharedResourcesBudget * 1024 * 1024 );
+#endif
+}
+
+std::string SharedResourceData::Name( const char* kind , unsigned long long hash ){
+    char name[64];
+    snprintf( name , sizeof( name ) , "sort_%s_%016llx" , kind , hash );
+    return name;
+}
+
+void SharedResourceData::Remove( const std::string& name ){
+#if !defined(SORT_IN_WINDOWS)
+    unlink( sharedMemoryName( name ).c_str() );
+#endif
+}
+
+void SharedResourceData::Trim( size_t budget ){
+#if !defined(SORT_IN_WINDOWS)
+    const auto folder = sharedMemoryName( "" );
+    const auto dir = opendir( folder.c_str() );
+    if( !dir )
+        return;
+
+    struct UnusedResource{
+        time_t          time;       /**< The last time the data is published or attached. */
+        size_t          size;       /**< Size of the file. */
+        std::string     name;       /**< Full name of the file. */
+    };
+    std::vector<UnusedResource> unused;
+    size_t total = 0;
+    while( const auto entry = readdir( dir ) ){
+        const std::string name = entry->d_name;
+        if( name.compare( 0 , 5 , "sort_" ) != 0 )
+            continue;
+        const auto full_name = folder + name;
+
+        // Data still being filled is named after the process filling it, the process crashed if it is gone.
+        const auto dot = name.rfind( '.' );
+        if( dot != std::string::npos ){
+            const auto pid = atoi( name.c_str() + dot + 1 );
+            if( pid > 0 && kill( pid , 0 ) != 0 && errno == ESRCH )
+                unlink( full_name.c_str() );
+            continue;
+        }
+
+        const auto fd = open( full_name.c_str() , O_RDONLY );
+        if( fd == -1 )
+            continue;
+        struct stat st;
+        if( fstat( fd , &st ) == 0 && flock( fd , LOCK_EX | LOCK_NB ) == 0 ){
+            unused.push_back( { st.st_mtime , (size_t)st.st_size , full_name } );
+            total += (size_t)st.st_size;
+        }
+        close( fd );
+    }
+    closedir( dir );
+
+    // A process could map the data right after it is checked, removing the file doesn't affect processes mapping it.
+    std::sort( unused.begin() , unused.end() , []( const UnusedResource& a , const UnusedResource& b ){ return a.time < b.time; } );
+    for( auto it = unused.begin() ; it != unused.end() && total > budget ; ++it ){
+        if( unlink( it->name.c_str() ) == 0 )
+            SORT_STATS(++sTrimmedResources);
+        total -= it->size;
+    }
+#endif
+}
+
+bool SharedResourceData::Attach( const std::string& name ){
+    const auto full_name = sharedMemoryName( name );
+
+#if !defined(SORT_IN_WINDOWS)
+    // The lock is taken before the data is mapped so that it is not trimmed in between. Attaching counts as using it.
+    const auto lock = lockSharedMemory( full_name );
+    if( lock == -1 )
+        return false;
+    futimens( lock , nullptr );
+    const auto unlock = [&](){ close( lock ); return false; };
+#else
+    const auto unlock = [](){ return false; };
+#endif
+
+    // The size of the data is only known after its header is mapped.
+    auto size = 0ull;
+    {
+        PlatformSharedMemory memory;
+        memory.CreateSharedMemory( full_name , (int)SHARED_RESOURCE_HEADER_SIZE , SharedMemory_Read | SharedMemory_Optional );
+        if( !memory.sharedmemory.bytes )
+            return unlock();
+
+        const auto header = (const SharedResourceHeader*)memory.sharedmemory.bytes;
+        if( SHARED_RESOURCE_MAGIC != header->magic )
+            return unlock();
+
+        const auto deadline = std::chrono::steady_clock::now() + SHARED_RESOURCE_WAIT;
+        while( SHARED_RESOURCE_FILLING == header->state.load( std::memory_order_acquire ) && std::chrono::steady_clock::now() < deadline )
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        if( SHARED_RESOURCE_READY != header->state.load( std::memory_order_acquire ) )
+            return unlock();
+
+        size = header->size;
+        if( size > (unsigned long long)INT_MAX - SHARED_RESOURCE_HEADER_SIZE )
+            return unlock();
+    }
+
+    auto memory = std::make_unique<PlatformSharedMemory>();
+    memory->CreateSharedMemory( full_name , (int)( SHARED_RESOURCE_HEADER_SIZE + size ) , SharedMemory_Read | SharedMemory_Optional );
+    if( !memory->sharedmemory.bytes )
+        return unlock();
+
+    m_memory = std::move( memory );
+    m_data = m_memory->sharedmemory.bytes + SHARED_RESOURCE_HEADER_SIZE;
+    m_size = (size_t)size;
+#if !defined(SORT_IN_WINDOWS)
+    m_lock = lock;
+#endif
+    SORT_STATS(++sAttachedResources);
+    return true;
+}
+
+bool SharedResourceData::Publish( const std::string& name , size_t size , const std::function<bool(char*)>& fill ){
+    if( size > (size_t)INT_MAX - SHARED_RESOURCE_HEADER_SIZE )
+        return false;
+
+    const auto full_name = sharedMemoryName( name );
+    auto memory = std::make_unique<PlatformSharedMemory>();
+#if defined(SORT_IN_WINDOWS)
+    // the other process creating it first is filling the data, which is waited for
+    memory->CreateSharedMemory( full_name , (int)( SHARED_RESOURCE_HEADER_SIZE + size ) , SharedMemory_Create );
+    if( !memory->sharedmemory.bytes )
+        return Attach( name );
+#else
+    // the file is filled under a name of this process, processes filling the same data at the same time don't wait for each other
+    const auto filling_name = full_name + "." + std::to_string( getpid() );
+    unlink( filling_name.c_str() );
+    memory->CreateSharedMemory( filling_name , (int)( SHARED_RESOURCE_HEADER_SIZE + size ) , SharedMemory_Create );
+    if( !memory->sharedmemory.bytes ){
+        unlink( filling_name.c_str() );
+        return false;
+    }
+#endif
+
+    auto header = new ( memory->sharedmemory.bytes ) SharedResourceHeader();
+    header->magic = SHARED_RESOURCE_MAGIC;
+    header->size = size;
+    header->state.store( SHARED_RESOURCE_FILLING , std::memory_order_relaxed );
+
+    const auto data = memory->sharedmemory.bytes + SHARED_RESOURCE_HEADER_SIZE;
+    if( !fill( data ) ){
+        header->state.store( SHARED_RESOURCE_ABANDONED , std::memory_order_release );
+#if !defined(SORT_IN_WINDOWS)
+        unlink( filling_name.c_str() );
+#endif
+        return false;
+    }
+    header->state.store( SHARED_RESOURCE_READY , std::memory_order_release );
+
+#if !defined(SORT_IN_WINDOWS)
+    // The lock is taken before the file gets its name, nobody could see it unused.
+    const auto lock = lockSharedMemory( filling_name );
+
+    // renaming replaces a file published by another process at the same time, processes mapping it keep the old one
+    if( rename( filling_name.c_str() , full_name.c_str() ) != 0 ){
+        slog( WARNING , GENERAL , "Failed to publish shared resource %s." , full_name.c_str() );
+        unlink( filling_name.c_str() );
+    }
+
+    // the budget is checked whenever more memory is taken by shared resources
+    Trim( (size_t)g_sharedResourcesBudget * 1024 * 1024 );
+    m_lock = lock;
+#endif
+
+    m_memory = std::move( memory );
+    m_data = data;
+    m_size = size;
+    SORT_STATS(++sPublishedResources);
+    return true;
+}
@@ -0,0 +1,104 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <functional>
+#include "core/define.h"
+#include "platform/sharedmemory/sharedmemory.h"
+
+//! @brief  Read only data of a resource shared by all SORT processes on the same machine.
+/**
+ * Several SORT processes running on the same machine, like one per frame, usually load identical textures and measured
+ * BRDFs. The first process decoding a resource publishes the decoded data in a named shared memory, the others map it
+ * instead of decoding their own copy, only one copy stays resident no matter how many processes use it.
+ *
+ * The name of the shared memory comes from the hash of the type and the content of the resource file, the data is never
+ * modified once it is published. On Linux and Mac OS it is a file in '/dev/shm', or the temporary folder if there is
+ * none, which only gets its name once it is filled so that it is never seen half written. Processes hold a shared lock
+ * on the file while they map it, which counts the users of the data and is released by the OS even if they crash. Files
+ * nobody uses stay for later renderings to skip decoding too, the least recently used ones are removed once they take
+ * more memory than the budget. On Windows it is gone once the last process using it exits.
+ */
+class SharedResourceData{
+public:
+    SharedResourceData() = default;
+
+    //! @brief  Unmap the data, shared resources nobody uses anymore are trimmed if this process was the last user.
+    ~SharedResourceData();
+
+    //! @brief  Name of the shared memory of a resource.
+    //!
+    //! @param  kind        Kind of the decoded data, it needs to change whenever the layout of the data changes.
+    //! @param  hash        Hash of the type and the content of the resource file.
+    //! @return             Name of the shared memory.
+    static std::string Name( const char* kind , unsigned long long hash );
+
+    //! @brief  Remove the shared memory of a resource, processes mapping it keep their data.
+    //!
+    //! It only matters on Linux and Mac OS, where shared memory outlives the processes.
+    //!
+    //! @param  name        Name of the shared memory.
+    static void Remove( const std::string& name );
+
+    //! @brief  Remove shared memory left behind by other processes.
+    //!
+    //! Shared memory still being filled by a process that doesn't exist anymore is removed. Of those that no process
+    //! maps, the least recently used ones are removed until the rest fit in the budget. It only matters on Linux and
+    //! Mac OS, where shared memory outlives the processes.
+    //!
+    //! @param  budget      Size in bytes that shared memory nobody maps could take.
+    static void Trim( size_t budget );
+
+    //! @brief  Map the data published by another process.
+    //!
+    //! If another process is still filling the data, it waits for it for a while.
+    //!
+    //! @param  name        Name of the shared memory.
+    //! @return             Whether the data is mapped.
+    bool    Attach( const std::string& name );
+
+    //! @brief  Publish data decoded by this process, it is mapped by this process too.
+    //!
+    //! @param  name        Name of the shared memory.
+    //! @param  size        Size of the data in bytes.
+    //! @param  fill        Fill the data, nothing is published if it fails.
+    //! @return             Whether the data is published, or the one published by another process is mapped.
+    bool    Publish( const std::string& name , size_t size , const std::function<bool(char*)>& fill );
+
+    //! @brief  The shared data, it is aligned to 64 bytes.
+    //!
+    //! @return             The data, nullptr if nothing is mapped.
+    const char* GetData() const{
+        return m_data;
+    }
+
+    //! @brief  Size of the shared data.
+    //!
+    //! @return             Size of the data in bytes.
+    size_t      GetSize() const{
+        return m_size;
+    }
+
+private:
+    std::unique_ptr<PlatformSharedMemory>   m_memory;               /**< The mapped shared memory. */
+    const char*                             m_data = nullptr;       /**< The data right after the header. */
+    size_t                                  m_size = 0;             /**< Size of the data in bytes. */
+    int                                     m_lock = -1;            /**< File holding a shared lock while the data is mapped, it is always -1 on Windows. */
+};
@@ -16,7 +16,10 @@
  */
 
 #include <string>
+#include <fstream>
+#include <cmath>
 #include "stats.h"
+#include "cpu.h"
 
 #ifdef SORT_ENABLE_STATS_COLLECTION
 
@@ -42,6 +45,15 @@ private:
 
 static StatsSummary             g_StatsSummary;
 
+SORT_STATS_TLS bool             g_StatsSampled = true;
+
+// Only one of every 'g_StatsSamplingRate' units is sampled.
+static unsigned                 g_StatsSamplingRate = 1;
+// Number of sampling units started in the thread.
+static SORT_STATS_TLS StatsInt  g_StatsUnitCnt = 0;
+// Number of sampling units measured by hot path stats in the thread.
+static SORT_STATS_TLS StatsInt  g_StatsSampledUnitCnt = 0;
+
 // It is not a global variable because the order of intialization won't be correct if it were one.
 // Static variable in a function will gets intialized the first time it gets executed.
 static auto  GetStatsItemContainer(){
@@ -59,6 +71,8 @@ static std::string stringFormat( const char* format, Args... arg ){
 
 void StatsSummary::PrintStats() const {
     slog(INFO, GENERAL, "----------------------------------------------------------------");
+    if( g_StatsSamplingRate > 1 )
+        slog(INFO, GENERAL, "Hot path stats are measured in one of every %u pixels and scaled.", g_StatsSamplingRate);
     std::map<std::string, std::map<std::string, std::string>> outputs;
     for (const auto& counterCat : counters) {
         if( categories.count( counterCat.first ) == 0 )
@@ -71,7 +85,14 @@ void StatsSummary::PrintStats() const {
     for (const auto& counterCat : outputs) {
         slog(INFO, GENERAL, "%s", counterCat.first.c_str());
             for (const auto& counterItem : counterCat.second) {
-                slog(INFO, GENERAL, "    %-44s %s", counterItem.first.c_str() , counterItem.second.c_str());
+                // values taking multiple lines are aligned with the first line
+                const auto& value = counterItem.second;
+                size_t begin = 0;
+                do{
+                    const auto end = std::min( value.find( '\n' , begin ) , value.size() );
+                    slog(INFO, GENERAL, "    %-44s %s", begin == 0 ? counterItem.first.c_str() : "" , value.substr( begin , end - begin ).c_str());
+                    begin = end + 1;
+                }while( begin < value.size() );
             }
     }
     slog(INFO, GENERAL, "----------------------------------------------------------------");
@@ -90,6 +111,19 @@ void StatsSummary::EnableCategory(const std::string& s) {
     categories.insert(s);
 }
 
+// Hot path counters that need to be scaled by the sampling rate.
+static auto  GetStatsHotCounters(){
+    static std::unique_ptr<std::vector<stats_hot_counter>> counters = std::make_unique<std::vector<stats_hot_counter>>();
+    return counters.get();
+}
+
+StatsHotCounterRegister::StatsHotCounterRegister( const stats_hot_counter f ){
+    static std::mutex statsMutex;
+    std::lock_guard<std::mutex> lock(statsMutex);
+
+    GetStatsHotCounters()->push_back(f);
+}
+
 // Recording all necessary data in constructor
 StatsItemRegister::StatsItemRegister( const stats_update f , const std::string& cat , const std::string& name ): func(f){
     static std::mutex statsMutex;
@@ -147,16 +181,368 @@ std::string StatsFormatter_RayPerSecond::ToString( StatsData_Ratio ratio ){
     return stringFormat("%.2f(MRay/s)",r);
 }
 
+std::string StatsFormatter_SimdIsa::ToString( StatsInt v ){
+    return SimdIsaName( (SimdIsa)v );
+}
+
+std::string StatsFormatter_ElaspedTimeUs::ToString( StatsInt v ){
+    if( v < 1000 ) return stringFormat("%d(us)" , v);
+    if( v < 1000000 ) return stringFormat("%.2f(ms)" , (StatsFloat)v/1000.0f);
+    return StatsFormatter_ElaspedTime::ToString( v / 1000 );
+}
+
+std::string StatsFormatter_MaxElaspedTimeUs::ToString( StatsData_Max v ){
+    return StatsFormatter_ElaspedTimeUs::ToString( v.value );
+}
+
+std::string StatsFormatter_Histograms::ToString( StatsData_Histograms h ){
+    if( h.histograms.empty() )
+        return "N/A";
+    std::string ret = "Count per bucket: <0.1(ms) <1(ms) <10(ms) <0.1(s) <1(s) <10(s) >=10(s)";
+    for( const auto& histogram : h.histograms ){
+        const auto& hist = histogram.second;
+        ret += stringFormat( "\n%s: %lld, avg %s, max %s, [" , histogram.first.c_str() , hist.count ,
+                             StatsFormatter_ElaspedTimeUs::ToString( hist.count ? hist.sum / hist.count : 0 ).c_str() ,
+                             StatsFormatter_ElaspedTimeUs::ToString( hist.max ).c_str() );
+        for( auto i = 0 ; i < StatsHistogram::BUCKET_CNT ; ++i )
+            ret += stringFormat( i ? " %lld" : "%lld" , hist.buckets[i] );
+        ret += "]";
+    }
+    return ret;
+}
+
+std::string StatsFormatter_ThreadTime::ToString( StatsData_ThreadTime t ){
+    if( t.times.empty() )
+        return "N/A";
+    std::string ret;
+    for( const auto& time : t.times ){
+        const auto busy = time.second.first;
+        const auto idle = time.second.second;
+        ret += stringFormat( "%sThread %d: busy %s, idle %s(%.2f%%)" , ret.empty() ? "" : "\n" , time.first ,
+                             StatsFormatter_ElaspedTimeUs::ToString( busy ).c_str() , StatsFormatter_ElaspedTimeUs::ToString( idle ).c_str() ,
+                             busy + idle > 0 ? 100.0f * (StatsFloat)idle / (StatsFloat)( busy + idle ) : 0.0f );
+    }
+    return ret;
+}
+
+static std::string formatBytes( StatsInt v ){
+    if( v < 1024 ) return stringFormat( "%lld(B)" , v );
+    if( v < 1024 * 1024 ) return stringFormat( "%.2f(KB)" , (StatsFloat)v / 1024.0f );
+    if( v < 1024 * 1024 * 1024 ) return stringFormat( "%.2f(MB)" , (StatsFloat)v / ( 1024.0f * 1024.0f ) );
+    return stringFormat( "%.2f(GB)" , (StatsFloat)v / ( 1024.0f * 1024.0f * 1024.0f ) );
+}
+
+std::string StatsFormatter_Memory::ToString( StatsData_Memory m ){
+    if( IS_PTR_INVALID(m.memory) )
+        return "N/A";
+    return stringFormat( "current %s, peak %s" , formatBytes( m.memory->current.load() ).c_str() , formatBytes( m.memory->peak.load() ).c_str() );
+}
+
+// Items of a phase sorted by the time taken to load them, the slowest ones come first.
+static std::vector<std::pair<std::string, StatsLoadItem>> sortLoadItems( const std::map<std::string, StatsLoadItem>& items ){
+    std::vector<std::pair<std::string, StatsLoadItem>> ret( items.begin() , items.end() );
+    std::stable_sort( ret.begin() , ret.end() , []( const std::pair<std::string, StatsLoadItem>& a , const std::pair<std::string, StatsLoadItem>& b ){
+        return a.second.time > b.second.time;
+    });
+    return ret;
+}
+
+std::string StatsFormatter_LoadReport::ToString( StatsData_LoadReport r ){
+    if( r.phases.empty() )
+        return "N/A";
+
+    // Items in a phase could be loaded in parallel, the sum of their time could be longer than the phase itself.
+    constexpr size_t SLOWEST_ITEM_CNT = 3;
+    std::string ret;
+    for( const auto& phase : r.phases ){
+        StatsLoadItem total;
+        for( const auto& item : phase.second ){
+            total.time += item.second.time;
+            total.bytes += item.second.bytes;
+        }
+        ret += stringFormat( "%s%s: %d item(s), %s, %s" , ret.empty() ? "" : "\n" , phase.first.c_str() , (int)phase.second.size() ,
+                             StatsFormatter_ElaspedTimeUs::ToString( total.time ).c_str() , formatBytes( total.bytes ).c_str() );
+
+        const auto items = sortLoadItems( phase.second );
+        for( size_t i = 0 ; i < std::min( items.size() , SLOWEST_ITEM_CNT ) ; ++i )
+            ret += stringFormat( "\n    %s: %s, %s" , items[i].first.c_str() , StatsFormatter_ElaspedTimeUs::ToString( items[i].second.time ).c_str() ,
+                                 formatBytes( items[i].second.bytes ).c_str() );
+    }
+    return ret;
+}
+
+std::string StatsFormatter_LoadReport::ToJson( StatsData_LoadReport r ){
+    std::string ret = "{";
+    for( const auto& phase : r.phases ){
+        StatsLoadItem total;
+        std::string items;
+        for( const auto& item : sortLoadItems( phase.second ) ){
+            total.time += item.second.time;
+            total.bytes += item.second.bytes;
+            items += stringFormat( "%s{\"name\": %s, \"time_us\": %lld, \"bytes\": %lld}" , items.empty() ? "" : ", " ,
+                                   StatsJsonString( item.first ).c_str() , item.second.time , item.second.bytes );
+        }
+        ret += stringFormat( "%s%s: {\"time_us\": %lld, \"bytes\": %lld, \"items\": [%s]}" , ret.size() > 1 ? ", " : "" ,
+                             StatsJsonString( phase.first ).c_str() , total.time , total.bytes , items.c_str() );
+    }
+    return ret + "}";
+}
+
+// Materials sorted by the total time spent on shading them, the most expensive ones come first.
+static std::vector<std::pair<std::string, StatsShadingCost>> sortShadingCosts( const std::map<std::string, StatsShadingCost>& materials ){
+    const auto total_time = []( const StatsShadingCost& c ){
+        return c.surfaceShaderTime + c.volumeShaderTime + c.bxdfEvaluationTime + c.bxdfSamplingTime;
+    };
+    std::vector<std::pair<std::string, StatsShadingCost>> ret( materials.begin() , materials.end() );
+    std::stable_sort( ret.begin() , ret.end() , [&]( const std::pair<std::string, StatsShadingCost>& a , const std::pair<std::string, StatsShadingCost>& b ){
+        return total_time( a.second ) > total_time( b.second );
+    });
+    return ret;
+}
+
+// Average time in nanoseconds of an operation.
+static std::string formatAverageNs( StatsInt time , StatsInt cnt ){
+    return cnt ? stringFormat( "%.1f(ns)" , (StatsFloat)time / (StatsFloat)cnt ) : "N/A";
+}
+
+std::string StatsFormatter_ShadingReport::ToString( StatsData_ShadingReport r ){
+    if( r.materials.empty() )
+        return "N/A";
+
+    constexpr size_t MOST_EXPENSIVE_MATERIAL_CNT = 10;
+    std::string ret = "Surface shader, volume shader, bxdf count per scattering event, bxdf evaluation, bxdf sampling";
+    const auto materials = sortShadingCosts( r.materials );
+    for( size_t i = 0 ; i < std::min( materials.size() , MOST_EXPENSIVE_MATERIAL_CNT ) ; ++i ){
+        const auto& c = materials[i].second;
+        ret += stringFormat( "\n%s: %lld x %s, %lld x %s, %.2f, %lld x %s, %lld x %s" , materials[i].first.c_str() ,
+                             c.surfaceShaderCnt , formatAverageNs( c.surfaceShaderTime , c.surfaceShaderCnt ).c_str() ,
+                             c.volumeShaderCnt , formatAverageNs( c.volumeShaderTime , c.volumeShaderCnt ).c_str() ,
+                             c.surfaceShaderCnt ? (StatsFloat)c.bxdfCnt / (StatsFloat)c.surfaceShaderCnt : 0.0f ,
+                             c.bxdfEvaluationCnt , formatAverageNs( c.bxdfEvaluationTime , c.bxdfEvaluationCnt ).c_str() ,
+                             c.bxdfSamplingCnt , formatAverageNs( c.bxdfSamplingTime , c.bxdfSamplingCnt ).c_str() );
+    }
+    if( materials.size() > MOST_EXPENSIVE_MATERIAL_CNT )
+        ret += stringFormat( "\n%d more material(s)" , (int)( materials.size() - MOST_EXPENSIVE_MATERIAL_CNT ) );
+    return ret;
+}
+
+std::string StatsFormatter_ShadingReport::ToJson( StatsData_ShadingReport r ){
+    std::string ret = "[";
+    for( const auto& material : sortShadingCosts( r.materials ) ){
+        const auto& c = material.second;
+        ret += stringFormat( "%s{\"name\": %s, \"surface_shader_count\": %lld, \"surface_shader_ns\": %lld, \"volume_shader_count\": %lld, "
+                             "\"volume_shader_ns\": %lld, \"bxdf_count\": %lld, \"bxdf_evaluation_count\": %lld, \"bxdf_evaluation_ns\": %lld, "
+                             "\"bxdf_sampling_count\": %lld, \"bxdf_sampling_ns\": %lld}" , ret.size() > 1 ? ", " : "" ,
+                             StatsJsonString( material.first ).c_str() , c.surfaceShaderCnt , c.surfaceShaderTime , c.volumeShaderCnt ,
+                             c.volumeShaderTime , c.bxdfCnt , c.bxdfEvaluationCnt , c.bxdfEvaluationTime , c.bxdfSamplingCnt , c.bxdfSamplingTime );
+    }
+    return ret + "]";
+}
+
+// Events per thousand instructions, the usual way to compare misses across regions of different sizes.
+static std::string formatPerKiloInstructions( StatsInt events , StatsInt instructions ){
+    return instructions ? stringFormat( "%.2f" , (StatsFloat)events * 1000.0f / (StatsFloat)instructions ) : "N/A";
+}
+
+std::string StatsFormatter_HwCounters::ToString( StatsData_HwCounters c ){
+    if( c.regions.empty() )
+        return "N/A";
+
+    std::string ret = "Runs, cycles per run, IPC, cache misses per kilo instructions, branch misses per kilo instructions";
+    for( const auto& region : c.regions ){
+        const auto& r = region.second;
+        ret += stringFormat( "\n%s: %lld, %s, %s, %s, %s" , region.first.c_str() , r.cnt ,
+                             r.cnt ? stringFormat( "%.1f" , (StatsFloat)r.events[0] / (StatsFloat)r.cnt ).c_str() : "N/A" ,
+                             r.events[0] ? stringFormat( "%.2f" , (StatsFloat)r.events[1] / (StatsFloat)r.events[0] ).c_str() : "N/A" ,
+                             formatPerKiloInstructions( r.events[2] , r.events[1] ).c_str() , formatPerKiloInstructions( r.events[3] , r.events[1] ).c_str() );
+    }
+    return ret;
+}
+
+std::string StatsFormatter_HwCounters::ToJson( StatsData_HwCounters c ){
+    std::string ret = "{";
+    for( const auto& region : c.regions ){
+        const auto& r = region.second;
+        ret += stringFormat( "%s%s: {\"count\": %lld, \"cycles\": %lld, \"instructions\": %lld, \"cache_misses\": %lld, \"branch_misses\": %lld}" ,
+                             ret.size() > 1 ? ", " : "" , StatsJsonString( region.first ).c_str() , r.cnt , r.events[0] , r.events[1] , r.events[2] , r.events[3] );
+    }
+    return ret + "}";
+}
+
+std::string StatsFormatter_Int::ToJson( StatsInt v ){
+    return std::to_string( v );
+}
+
+// Numbers without a value, like ratios of nothing, are null in JSON.
+static std::string jsonNumber( double v ){
+    return std::isfinite( v ) ? stringFormat( "%.9g" , v ) : "null";
+}
+
+std::string StatsFormatter_Float::ToJson( StatsFloat v ){
+    return jsonNumber( v );
+}
+
+// Ratios are saved as fractions, instead of percentages.
+std::string StatsFormatter_Ratio::ToJson( StatsData_Ratio ratio ){
+    return jsonNumber( (double)ratio.nominator / (double)ratio.denominator );
+}
+
+std::string StatsFormatter_FloatRatio::ToJson( StatsData_Ratio ratio ){
+    return jsonNumber( (double)ratio.nominator / (double)ratio.denominator );
+}
+
+// Rays per second, the denominator is in milliseconds.
+std::string StatsFormatter_RayPerSecond::ToJson( StatsData_Ratio ratio ){
+    return jsonNumber( (double)ratio.nominator / (double)ratio.denominator * 1000.0 );
+}
+
+std::string StatsFormatter_MaxElaspedTimeUs::ToJson( StatsData_Max v ){
+    return std::to_string( v.value );
+}
+
+std::string StatsFormatter_Histograms::ToJson( StatsData_Histograms h ){
+    std::string ret = "{";
+    for( const auto& histogram : h.histograms ){
+        const auto& hist = histogram.second;
+        std::string buckets;
+        for( auto i = 0 ; i < StatsHistogram::BUCKET_CNT ; ++i )
+            buckets += stringFormat( i ? ", %lld" : "%lld" , hist.buckets[i] );
+        ret += stringFormat( "%s%s: {\"count\": %lld, \"sum_us\": %lld, \"max_us\": %lld, \"buckets\": [%s]}" , ret.size() > 1 ? ", " : "" ,
+                             StatsJsonString( histogram.first ).c_str() , hist.count , hist.sum , hist.max , buckets.c_str() );
+    }
+    return ret + "}";
+}
+
+std::string StatsFormatter_ThreadTime::ToJson( StatsData_ThreadTime t ){
+    std::string ret = "[";
+    for( const auto& time : t.times )
+        ret += stringFormat( "%s{\"thread\": %d, \"busy_us\": %lld, \"idle_us\": %lld}" , ret.size() > 1 ? ", " : "" ,
+                             time.first , time.second.first , time.second.second );
+    return ret + "]";
+}
+
+// All samples of a timeline are saved, as pairs of milliseconds and values.
+std::string StatsFormatter_Timeline::ToJson( StatsData_Timeline t ){
+    std::sort( t.samples.begin() , t.samples.end() );
+    std::string ret = "[";
+    for( const auto& sample : t.samples )
+        ret += stringFormat( "%s[%lld, %lld]" , ret.size() > 1 ? ", " : "" , sample.first , sample.second );
+    return ret + "]";
+}
+
+std::string StatsFormatter_Memory::ToJson( StatsData_Memory m ){
+    if( IS_PTR_INVALID(m.memory) )
+        return "null";
+    return stringFormat( "{\"current_bytes\": %lld, \"peak_bytes\": %lld}" , m.memory->current.load() , m.memory->peak.load() );
+}
+
+std::string StatsFormatter_ElaspedTime::ToJson( StatsInt v ){
+    return std::to_string( v );
+}
+
+std::string StatsFormatter_ElaspedTimeUs::ToJson( StatsInt v ){
+    return std::to_string( v );
+}
+
+std::string StatsJsonString( const std::string& s ){
+    std::string ret = "\"";
+    for( const auto c : s ){
+        if( c == '"' || c == '\\' )
+            ret += std::string( "\\" ) + c;
+        else if( c == '\n' )
+            ret += "\\n";
+        else if( (unsigned char)c < 0x20 )
+            ret += stringFormat( "\\u%04x" , (int)c );
+        else
+            ret += c;
+    }
+    return ret + "\"";
+}
+
+void StatsSummary::SaveJson(const std::string& filename) const {
+    // Times are saved in the units of the stats, which is a part of their names, like milliseconds for most time stats.
+    std::ofstream file( filename );
+    if( !file.is_open() ){
+        slog( WARNING , GENERAL , "Failed to save stats to %s." , filename.c_str() );
+        return;
+    }
+
+    file << "{";
+    auto first_cat = true;
+    for (const auto& counterCat : counters) {
+        if( categories.count( counterCat.first ) == 0 )
+            continue;
+        file << ( first_cat ? "\n    " : ",\n    " ) << StatsJsonString( counterCat.first ) << ": {";
+        auto first_item = true;
+        for (const auto& counterItem : counterCat.second) {
+            file << ( first_item ? "\n        " : ",\n        " ) << StatsJsonString( counterItem.first ) << ": " << counterItem.second->ToJson();
+            first_item = false;
+        }
+        file << "\n    }";
+        first_cat = false;
+    }
+    file << "\n}\n";
+}
+
+std::string StatsFormatter_Timeline::ToString( StatsData_Timeline t ){
+    if( t.samples.empty() )
+        return "N/A";
+
+    // Samples are averaged in a few windows of the same length across the whole time range.
+    constexpr int WINDOW_CNT = 8;
+    std::sort( t.samples.begin() , t.samples.end() );
+    const auto start = t.samples.front().first;
+    const auto length = std::max( t.samples.back().first - start + 1 , (StatsInt)WINDOW_CNT );
+    StatsInt sum[WINDOW_CNT] = { 0 } , cnt[WINDOW_CNT] = { 0 };
+    for( const auto& sample : t.samples ){
+        const auto window = (int)std::min( ( sample.first - start ) * WINDOW_CNT / length , (StatsInt)WINDOW_CNT - 1 );
+        sum[window] += sample.second;
+        ++cnt[window];
+    }
+
+    std::string ret;
+    for( auto i = 0 ; i < WINDOW_CNT ; ++i ){
+        if( 0 == cnt[i] )
+            continue;
+        ret += stringFormat( "%s%.2f(s):%lld" , ret.empty() ? "" : " " , (StatsFloat)( start + i * length / WINDOW_CNT ) / 1000.0f , sum[i] / cnt[i] );
+    }
+    return ret;
+}
+
 #endif
 
 void SortStatsFlushData( bool mainThread ){
 #ifdef SORT_ENABLE_STATS_COLLECTION
+    // hot path counters are scaled as if every unit were measured
+    if( g_StatsSampledUnitCnt > 0 && g_StatsSampledUnitCnt < g_StatsUnitCnt ){
+        const auto scale = (double)g_StatsUnitCnt / (double)g_StatsSampledUnitCnt;
+        for( const auto& counter : *GetStatsHotCounters() ){
+            auto value = counter();
+            *value = (StatsInt)( (double)*value * scale + 0.5 );
+        }
+    }
+    g_StatsUnitCnt = g_StatsSampledUnitCnt = 0;
+    g_StatsSampled = true;
+
     GetStatsItemContainer()->FlushData();
 #endif
 }
+void SortStatsSetSamplingRate( unsigned rate ){
+    SORT_STATS(g_StatsSamplingRate = std::max( 1u , rate ));
+}
+void SortStatsNextSample(){
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    g_StatsSampled = ( g_StatsUnitCnt++ % g_StatsSamplingRate ) == 0;
+    g_StatsSampledUnitCnt += g_StatsSampled ? 1 : 0;
+#endif
+}
 void SortStatsPrintData(){
     SORT_STATS(g_StatsSummary.PrintStats());
 }
+
+void SortStatsSaveJson( const std::string& filename ){
+    SORT_STATS(g_StatsSummary.SaveJson(filename));
+}
 void SortStatsEnableCategory( const std::string& s ){
     SORT_STATS(g_StatsSummary.EnableCategory(s));
 }
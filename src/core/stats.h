@@ -23,23 +23,41 @@
 void SortStatsFlushData( bool mainThread = false );
 // Print Stats Result, this should be called in main thread after all rendering thread is done
 void SortStatsPrintData();
+// Save Stats Result as JSON, this should be called in main thread after all rendering thread is done
+void SortStatsSaveJson( const std::string& filename );
 // Enable specific category
 void SortStatsEnableCategory( const std::string& s );
+// Only one of every 'rate' sampling units, like pixels, is measured by hot path stats, this should be called before rendering
+void SortStatsSetSamplingRate( unsigned rate );
+// Start a new sampling unit in the current thread, it decides whether hot path stats are measured in it
+void SortStatsNextSample();
 
 #define StatsInt                            long long
 #define StatsFloat                          float
 
 #ifdef SORT_ENABLE_STATS_COLLECTION
 #include <functional>
+#include <algorithm>
+#include <string>
 #include <map>
 #include <vector>
 #include <mutex>
 #include <memory>
 #include <unordered_set>
 #include <unordered_map>
+#include <atomic>
+#include <chrono>
 #include "core/sassert.h"
 #include "define.h"
 
+#ifdef SORT_IN_WINDOWS
+#define SORT_STATS_TLS                      thread_local
+#else
+// Accessing a 'thread_local' variable defined in another translation unit goes through a wrapper checking whether it
+// needs dynamic initialization, '__thread' variables never do, accessing them is a plain memory access.
+#define SORT_STATS_TLS                      __thread
+#endif
+
 #define SORT_CAT_PROXY(v0, v1)              v0 ## v1
 #define SORT_CAT(v0, v1)                    SORT_CAT_PROXY(v0,v1)
 #define SORT_STATS_UNIQUE_NAMESPACE(var)    SORT_CAT(SORT_CAT(sort_stats_namespace, __LINE__), var)
@@ -55,21 +73,295 @@ struct StatsData_Ratio{
     StatsData_Ratio(StatsInt& v0 , StatsInt& v1 ) : nominator( v0 ) , denominator( v1 ) {}
 };
 
+// Unlike other counters, the maximum value across threads is kept instead of the sum.
+struct StatsData_Max{
+    StatsInt& value;
+    StatsData_Max& operator += ( const StatsData_Max& m ){
+        value = std::max( value , m.value );
+        return *this;
+    }
+    StatsData_Max(StatsInt& v) : value( v ) {}
+};
+
+// Histogram of durations in microseconds, each bucket is ten times as long as the previous one, starting from 100 microseconds.
+struct StatsHistogram{
+    static constexpr int BUCKET_CNT = 7;
+    StatsInt count = 0;
+    StatsInt sum = 0;
+    StatsInt max = 0;
+    StatsInt buckets[BUCKET_CNT] = { 0 };
+    void Add( StatsInt v ){
+        auto bucket = 0;
+        for( auto bound = 100ll ; bucket < BUCKET_CNT - 1 && v >= bound ; bound *= 10 )
+            ++bucket;
+        ++buckets[bucket];
+        ++count;
+        sum += v;
+        max = std::max( max , v );
+    }
+    StatsHistogram& operator += ( const StatsHistogram& h ){
+        count += h.count;
+        sum += h.sum;
+        max = std::max( max , h.max );
+        for( auto i = 0 ; i < BUCKET_CNT ; ++i )
+            buckets[i] += h.buckets[i];
+        return *this;
+    }
+};
+
+// Histograms of durations keyed by names, like the names of tasks.
+struct StatsData_Histograms{
+    std::map<std::string, StatsHistogram> histograms;
+    void Add( const std::string& key , StatsInt v ){
+        histograms[key].Add( v );
+    }
+    StatsData_Histograms& operator += ( const StatsData_Histograms& h ){
+        for( const auto& histogram : h.histograms )
+            histograms[histogram.first] += histogram.second;
+        return *this;
+    }
+};
+
+// Busy and idle time in microseconds of each thread.
+struct StatsData_ThreadTime{
+    std::map<int, std::pair<StatsInt, StatsInt>> times;
+    void Add( int tid , StatsInt busy , StatsInt idle ){
+        times[tid].first += busy;
+        times[tid].second += idle;
+    }
+    StatsData_ThreadTime& operator += ( const StatsData_ThreadTime& t ){
+        for( const auto& time : t.times )
+            Add( time.first , time.second.first , time.second.second );
+        return *this;
+    }
+};
+
+// Values sampled over time, the time is in milliseconds.
+struct StatsData_Timeline{
+    std::vector<std::pair<StatsInt, StatsInt>> samples;
+    void Add( StatsInt time , StatsInt v ){
+        samples.push_back( std::make_pair( time , v ) );
+    }
+    StatsData_Timeline& operator += ( const StatsData_Timeline& t ){
+        samples.insert( samples.end() , t.samples.begin() , t.samples.end() );
+        return *this;
+    }
+};
+
+// Time in microseconds and bytes of an item loaded in a phase of scene loading, like a texture or an entity.
+struct StatsLoadItem{
+    StatsInt time = 0;
+    StatsInt bytes = 0;
+};
+
+// Items loaded in each phase of scene loading, keyed by the names of the phases and the items.
+struct StatsData_LoadReport{
+    std::map<std::string, std::map<std::string, StatsLoadItem>> phases;
+    void Add( const std::string& phase , const std::string& item , StatsInt time , StatsInt bytes ){
+        auto& i = phases[phase][item];
+        i.time += time;
+        i.bytes += bytes;
+    }
+    StatsData_LoadReport& operator += ( const StatsData_LoadReport& r ){
+        for( const auto& phase : r.phases )
+            for( const auto& item : phase.second )
+                Add( phase.first , item.first , item.second.time , item.second.bytes );
+        return *this;
+    }
+};
+
+// Shading cost of a material, time is in nanoseconds.
+struct StatsShadingCost{
+    StatsInt surfaceShaderCnt = 0;
+    StatsInt surfaceShaderTime = 0;
+    StatsInt volumeShaderCnt = 0;
+    StatsInt volumeShaderTime = 0;
+    StatsInt bxdfCnt = 0;
+    StatsInt bxdfEvaluationCnt = 0;
+    StatsInt bxdfEvaluationTime = 0;
+    StatsInt bxdfSamplingCnt = 0;
+    StatsInt bxdfSamplingTime = 0;
+    StatsShadingCost& operator += ( const StatsShadingCost& c ){
+        surfaceShaderCnt += c.surfaceShaderCnt;
+        surfaceShaderTime += c.surfaceShaderTime;
+        volumeShaderCnt += c.volumeShaderCnt;
+        volumeShaderTime += c.volumeShaderTime;
+        bxdfCnt += c.bxdfCnt;
+        bxdfEvaluationCnt += c.bxdfEvaluationCnt;
+        bxdfEvaluationTime += c.bxdfEvaluationTime;
+        bxdfSamplingCnt += c.bxdfSamplingCnt;
+        bxdfSamplingTime += c.bxdfSamplingTime;
+        return *this;
+    }
+};
+
+// Shading cost of each material keyed by the names of materials. It is measured in hot path, only sampled units count.
+struct StatsData_ShadingReport{
+    std::map<std::string, StatsShadingCost> materials;
+    StatsShadingCost& Get( const std::string& material ){
+        return materials[material];
+    }
+    StatsData_ShadingReport& operator += ( const StatsData_ShadingReport& r ){
+        for( const auto& material : r.materials )
+            materials[material.first] += material.second;
+        return *this;
+    }
+};
+
+// Hardware events of a region of code summed over all times it runs, nested regions are counted in both.
+struct StatsHwCounters{
+    static constexpr int EVENT_CNT = 4;     // cycles, instructions, cache misses, branch misses
+    StatsInt cnt = 0;
+    StatsInt events[EVENT_CNT] = { 0 };
+    StatsHwCounters& operator += ( const StatsHwCounters& c ){
+        cnt += c.cnt;
+        for( auto i = 0 ; i < EVENT_CNT ; ++i )
+            events[i] += c.events[i];
+        return *this;
+    }
+};
+struct StatsData_HwCounters{
+    std::map<std::string, StatsHwCounters> regions;
+    StatsHwCounters& Get( const std::string& region ){
+        return regions[region];
+    }
+    StatsData_HwCounters& operator += ( const StatsData_HwCounters& c ){
+        for( const auto& region : c.regions )
+            regions[region.first] += region.second;
+        return *this;
+    }
+};
+
+// Nanoseconds elapsed in the life time of the timer are added to a counter, nothing is measured without a counter.
+class StatsScopedTimer{
+public:
+    explicit StatsScopedTimer( StatsInt* v ) : value( v ) {
+        if( value )
+            start = clock::now();
+    }
+    ~StatsScopedTimer(){
+        if( value )
+            *value += (StatsInt)std::chrono::duration_cast<std::chrono::nanoseconds>( clock::now() - start ).count();
+    }
+
+private:
+    using clock = std::chrono::steady_clock;
+    StatsInt*           value;
+    clock::time_point   start;
+};
+
+// Current and peak bytes of memory used by a subsystem. Memory could be released by a different thread than the one
+// allocated it, it is tracked globally instead of per thread.
+struct StatsMemory{
+    std::atomic<StatsInt> current = { 0 };
+    std::atomic<StatsInt> peak = { 0 };
+    void Add( StatsInt bytes ){
+        const auto c = current += bytes;
+        auto p = peak.load();
+        while( c > p && !peak.compare_exchange_weak( p , c ) );
+    }
+};
+
+// Only the global memory record is referred, nothing is merged.
+struct StatsData_Memory{
+    const StatsMemory* memory;
+    StatsData_Memory& operator += ( const StatsData_Memory& m ){
+        memory = m.memory;
+        return *this;
+    }
+    StatsData_Memory( const StatsMemory* m ) : memory( m ) {}
+};
+
+// Memory accounted to a subsystem during the life time of the object holding it.
+class StatsMemoryRecord{
+public:
+    StatsMemoryRecord() = default;
+    StatsMemoryRecord( const StatsMemoryRecord& r ){ Track( r.memory , r.bytes ); }
+    StatsMemoryRecord( StatsMemoryRecord&& r ) : memory( r.memory ) , bytes( r.bytes ) { r.bytes = 0; }
+    StatsMemoryRecord& operator = ( const StatsMemoryRecord& r ){ Track( r.memory , r.bytes ); return *this; }
+    StatsMemoryRecord& operator = ( StatsMemoryRecord&& r ){
+        Release();
+        memory = r.memory;
+        bytes = r.bytes;
+        r.bytes = 0;
+        return *this;
+    }
+    ~StatsMemoryRecord(){ Release(); }
+
+    // Update the bytes of memory accounted to the subsystem.
+    void Track( StatsMemory* m , StatsInt b ){
+        if( m != memory )
+            Release();
+        memory = m;
+        if( memory )
+            memory->Add( b - bytes );
+        bytes = b;
+    }
+    void Release(){
+        if( memory )
+            memory->Add( -bytes );
+        bytes = 0;
+    }
+
+private:
+    StatsMemory*    memory = nullptr;
+    StatsInt        bytes = 0;
+};
+
 class StatsItemBase{
 public:
     virtual ~StatsItemBase(){}
     virtual std::string ToString() const = 0;
+    virtual std::string ToJson() const = 0;
     virtual void Merge( const StatsItemBase* item ) = 0;
     virtual std::unique_ptr<StatsItemBase> MakeItem() const = 0;
 };
 
+// Formatters without a JSON representation of their own are saved as JSON strings.
+std::string StatsJsonString( const std::string& s );
+template<class T, class D>
+auto StatsToJson( const D& d , int ) -> decltype( T::ToJson( d ) ){
+    return T::ToJson( d );
+}
+template<class T, class D>
+std::string StatsToJson( const D& d , long ){
+    return StatsJsonString( T::ToString( d ) );
+}
+
+// Whether hot path stats are measured in the current sampling unit of the thread.
+extern SORT_STATS_TLS bool g_StatsSampled;
+
+using stats_hot_counter = std::function<StatsInt*()>;
+class StatsHotCounterRegister {
+public:
+    // Register a hot path counter, whose per-thread value is scaled by the sampling rate before flushing
+    StatsHotCounterRegister( const stats_hot_counter f );
+};
+
 #define SORT_STATS(eva) eva
+// Stats in hot loops, they are only evaluated in sampled units.
+#define SORT_STATS_HOT(eva) ( LIKELY(g_StatsSampled) ? (void)(eva) : (void)0 )
 
-#define SORT_STATS_DEFINE_COUNTER( var ) thread_local StatsInt var = 0l;
-#define SORT_STATS_DEFINE_FCOUNTER( var ) thread_local StatsFloat var = 0.0f;
+#define SORT_STATS_DEFINE_COUNTER( var ) SORT_STATS_TLS StatsInt var = 0l;
+#define SORT_STATS_DEFINE_FCOUNTER( var ) SORT_STATS_TLS StatsFloat var = 0.0f;
+#define SORT_STATS_DEFINE_HOT_COUNTER( var ) SORT_STATS_TLS StatsInt var = 0l;\
+    namespace SORT_STATS_UNIQUE_NAMESPACE(var##_hot){\
+        static StatsHotCounterRegister g_StatsHotCounterRegister( [](){ return &var; } );\
+    }
+#define SORT_STATS_DEFINE_HISTOGRAMS( var ) thread_local StatsData_Histograms var;
+#define SORT_STATS_DEFINE_THREAD_TIME( var ) thread_local StatsData_ThreadTime var;
+#define SORT_STATS_DEFINE_TIMELINE( var ) thread_local StatsData_Timeline var;
+#define SORT_STATS_DEFINE_LOAD_REPORT( var ) thread_local StatsData_LoadReport var;
+#define SORT_STATS_DEFINE_SHADING_REPORT( var ) thread_local StatsData_ShadingReport var;
+#define SORT_STATS_DEFINE_HW_COUNTERS( var ) thread_local StatsData_HwCounters var;
+#define SORT_STATS_DEFINE_MEMORY( var ) StatsMemory var;
+#define SORT_STATS_MEMORY_RECORD( var ) StatsMemoryRecord var;
 
-#define SORT_STATS_DECLARE_COUNTER( var ) extern thread_local StatsInt var;
-#define SORT_STATS_DECLARE_FCOUNTER( var ) extern thread_local StatsFloat var;
+#define SORT_STATS_DECLARE_COUNTER( var ) extern SORT_STATS_TLS StatsInt var;
+#define SORT_STATS_DECLARE_FCOUNTER( var ) extern SORT_STATS_TLS StatsFloat var;
+#define SORT_STATS_DECLARE_MEMORY( var ) extern StatsMemory var;
+#define SORT_STATS_DECLARE_LOAD_REPORT( var ) extern thread_local StatsData_LoadReport var;
+#define SORT_STATS_DECLARE_SHADING_REPORT( var ) extern thread_local StatsData_ShadingReport var;
 
 #define SORT_STATS_ENABLE(category) \
     class StatsCategoryEnabler{ \
@@ -86,6 +378,9 @@ public:\
     std::string ToString() const override{\
         return T::ToString(data);\
     }\
+    std::string ToJson() const override{\
+        return StatsToJson<T>(data, 0);\
+    }\
     void Merge( const StatsItemBase* item ) override{\
         auto p = (const NAME*)(item);\
         sAssertMsg(IS_PTR_VALID(p), GENERAL , "Merging incorrect stats data." );\
@@ -104,22 +399,22 @@ public:\
     static StatsItemRegister g_StatsItemRegister( update_counter , cat , name );
 
 #define SORT_STATS_INT_TYPE( cat , name , var , formatter) \
-    extern thread_local StatsInt var;\
+    extern SORT_STATS_TLS StatsInt var;\
     namespace SORT_STATS_UNIQUE_NAMESPACE(var){\
         static StatsInt g_Global_Default = 0l;\
         SORT_STATS_BASE_TYPE( cat , name , var , formatter , StatsItemInt , StatsInt );\
     }
 
 #define SORT_STATS_FLOAT_TYPE( cat , name , var , formatter ) \
-    extern thread_local StatsFloat var;\
+    extern SORT_STATS_TLS StatsFloat var;\
     namespace SORT_STATS_UNIQUE_NAMESPACE(var){\
         static StatsFloat g_Global_Default = 0.0f;\
         SORT_STATS_BASE_TYPE( cat , name , var , formatter , StatsItemFloat , StatsFloat );\
     }
 
 #define SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , formatter ) \
-    extern thread_local StatsInt var0;\
-    extern thread_local StatsInt var1;\
+    extern SORT_STATS_TLS StatsInt var0;\
+    extern SORT_STATS_TLS StatsInt var1;\
     namespace SORT_STATS_UNIQUE_NAMESPACE(g##var0##_##var1){\
         static thread_local StatsData_Ratio g##var0##_##var1( var0 , var1 );\
         static StatsInt g_Global_Var0 = 0l;\
@@ -128,31 +423,77 @@ public:\
         SORT_STATS_BASE_TYPE( cat , name , g##var0##_##var1 , formatter , StatsItemRatio , StatsData_Ratio);\
     }
 
+#define SORT_STATS_MAX_TYPE( cat , name , var , formatter ) \
+    extern SORT_STATS_TLS StatsInt var;\
+    namespace SORT_STATS_UNIQUE_NAMESPACE(g##var##_max){\
+        static thread_local StatsData_Max g##var##_max( var );\
+        static StatsInt g_Global_Var = 0l;\
+        static StatsData_Max g_Global_Default( g_Global_Var );\
+        SORT_STATS_BASE_TYPE( cat , name , g##var##_max , formatter , StatsItemMax , StatsData_Max );\
+    }
+
+#define SORT_STATS_OBJECT_TYPE( cat , name , var , formatter , data_type ) \
+    extern thread_local data_type var;\
+    namespace SORT_STATS_UNIQUE_NAMESPACE(var){\
+        static data_type g_Global_Default;\
+        SORT_STATS_BASE_TYPE( cat , name , var , formatter , StatsItemObject , data_type );\
+    }
+
+#define SORT_STATS_MEMORY_TYPE( cat , name , var , formatter ) \
+    extern StatsMemory var;\
+    namespace SORT_STATS_UNIQUE_NAMESPACE(g##var##_memory){\
+        static thread_local StatsData_Memory g##var##_memory( &var );\
+        static StatsData_Memory g_Global_Default( nullptr );\
+        SORT_STATS_BASE_TYPE( cat , name , g##var##_memory , formatter , StatsItemMemory , StatsData_Memory );\
+    }
+
 #define SORT_STATS_COUNTER( cat , name , var ) SORT_STATS_INT_TYPE( cat , name , var , StatsFormatter_Int )
 #define SORT_STATS_TIME( cat , name , var ) SORT_STATS_INT_TYPE( cat , name , var , StatsFormatter_ElaspedTime )
 #define SORT_STATS_FCOUNTER( cat , name , var ) SORT_STATS_FLOAT_TYPE( cat , name , var , StatsFormatter_Float )
 #define SORT_STATS_RATIO( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_Ratio )
 #define SORT_STATS_AVG_COUNT( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_FloatRatio )
 #define SORT_STATS_AVG_RAY_SECOND( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_RayPerSecond )
+#define SORT_STATS_SIMD_ISA( cat , name , var ) SORT_STATS_INT_TYPE( cat , name , var , StatsFormatter_SimdIsa )
+#define SORT_STATS_TIME_US( cat , name , var ) SORT_STATS_INT_TYPE( cat , name , var , StatsFormatter_ElaspedTimeUs )
+#define SORT_STATS_MAX_TIME_US( cat , name , var ) SORT_STATS_MAX_TYPE( cat , name , var , StatsFormatter_MaxElaspedTimeUs )
+#define SORT_STATS_HISTOGRAMS( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_Histograms , StatsData_Histograms )
+#define SORT_STATS_THREAD_TIME( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_ThreadTime , StatsData_ThreadTime )
+#define SORT_STATS_TIMELINE( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_Timeline , StatsData_Timeline )
+#define SORT_STATS_LOAD_REPORT( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_LoadReport , StatsData_LoadReport )
+#define SORT_STATS_SHADING_REPORT( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_ShadingReport , StatsData_ShadingReport )
+#define SORT_STATS_HW_COUNTERS( cat , name , var ) SORT_STATS_OBJECT_TYPE( cat , name , var , StatsFormatter_HwCounters , StatsData_HwCounters )
+#define SORT_STATS_MEMORY( name , var ) SORT_STATS_MEMORY_TYPE( "Memory" , name , var , StatsFormatter_Memory )
 
 #define SORT_STATS_FORMATTER( name , type ) class name{ public: static std::string ToString( type v ); };
-SORT_STATS_FORMATTER( StatsFormatter_ElaspedTime , StatsInt )
-SORT_STATS_FORMATTER( StatsFormatter_Int , StatsInt )
-SORT_STATS_FORMATTER( StatsFormatter_Float , StatsFloat )
-SORT_STATS_FORMATTER( StatsFormatter_FloatRatio , StatsData_Ratio  )
-SORT_STATS_FORMATTER( StatsFormatter_Ratio , StatsData_Ratio )
-SORT_STATS_FORMATTER( StatsFormatter_RayPerSecond , StatsData_Ratio  )
+#define SORT_STATS_JSON_FORMATTER( name , type ) class name{ public: static std::string ToString( type v ); static std::string ToJson( type v ); };
+SORT_STATS_JSON_FORMATTER( StatsFormatter_ElaspedTime , StatsInt )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Int , StatsInt )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Float , StatsFloat )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_FloatRatio , StatsData_Ratio  )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Ratio , StatsData_Ratio )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_RayPerSecond , StatsData_Ratio  )
+SORT_STATS_FORMATTER( StatsFormatter_SimdIsa , StatsInt )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_ElaspedTimeUs , StatsInt )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_MaxElaspedTimeUs , StatsData_Max )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Histograms , StatsData_Histograms )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_ThreadTime , StatsData_ThreadTime )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Timeline , StatsData_Timeline )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_Memory , StatsData_Memory )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_LoadReport , StatsData_LoadReport )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_ShadingReport , StatsData_ShadingReport )
+SORT_STATS_JSON_FORMATTER( StatsFormatter_HwCounters , StatsData_HwCounters )
 
 // StatsSummary keeps all stats data after the rendering is done
 class StatsSummary {
 public:
     void FlushCounter(const std::string& category, const std::string& varname, const StatsItemBase* var);
     void PrintStats() const;
+    void SaveJson(const std::string& filename) const;
     void EnableCategory(const std::string& s);
 
 private:
     std::map<std::string, std::map<std::string, std::unique_ptr<StatsItemBase>>> counters;
-    std::unordered_set<std::string> categories = { "Performance" , "Statistics" };
+    std::unordered_set<std::string> categories = { "Performance" , "Statistics" , "Memory" };
 };
 
 using stats_update = std::function<void(StatsSummary&)>;
@@ -170,6 +511,7 @@ private:
 
 #else
 #define SORT_STATS(eva)
+#define SORT_STATS_HOT(eva)
 #define SORT_STATS_ENABLE(eva)
 #define SORT_STATS_COUNTER( cat , name , var )
 #define SORT_STATS_FCOUNTER( cat , name , var )
@@ -177,8 +519,30 @@ private:
 #define SORT_STATS_RATIO( cat , name , var0 , var1 )
 #define SORT_STATS_AVG_COUNT( cat , name , var0 , var1 )
 #define SORT_STATS_AVG_RAY_SECOND( cat , name , var0 , var1 )
+#define SORT_STATS_SIMD_ISA( cat , name , var )
+#define SORT_STATS_TIME_US( cat , name , var )
+#define SORT_STATS_MAX_TIME_US( cat , name , var )
+#define SORT_STATS_HISTOGRAMS( cat , name , var )
+#define SORT_STATS_THREAD_TIME( cat , name , var )
+#define SORT_STATS_TIMELINE( cat , name , var )
+#define SORT_STATS_LOAD_REPORT( cat , name , var )
+#define SORT_STATS_SHADING_REPORT( cat , name , var )
+#define SORT_STATS_HW_COUNTERS( cat , name , var )
+#define SORT_STATS_MEMORY( name , var )
 #define SORT_STATS_DEFINE_COUNTER( var )
 #define SORT_STATS_DEFINE_FCOUNTER( var )
+#define SORT_STATS_DEFINE_HOT_COUNTER( var )
 #define SORT_STATS_DECLARE_COUNTER( var )
 #define SORT_STATS_DECLARE_FCOUNTER( var )
+#define SORT_STATS_DEFINE_HISTOGRAMS( var )
+#define SORT_STATS_DEFINE_THREAD_TIME( var )
+#define SORT_STATS_DEFINE_TIMELINE( var )
+#define SORT_STATS_DEFINE_LOAD_REPORT( var )
+#define SORT_STATS_DECLARE_LOAD_REPORT( var )
+#define SORT_STATS_DEFINE_SHADING_REPORT( var )
+#define SORT_STATS_DECLARE_SHADING_REPORT( var )
+#define SORT_STATS_DEFINE_HW_COUNTERS( var )
+#define SORT_STATS_DEFINE_MEMORY( var )
+#define SORT_STATS_DECLARE_MEMORY( var )
+#define SORT_STATS_MEMORY_RECORD( var )
 #endif
@@ -0,0 +1,89 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <chrono>
+#include <algorithm>
+#include "telemetry.h"
+#include "perfreport.h"
+#include "log.h"
+
+TelemetryReporter::TelemetryReporter( float interval ){
+    const auto period = std::chrono::milliseconds( std::max( 1ll , (long long)( interval * 1000.0f ) ) );
+    m_thread = std::thread( [this , period](){
+        auto last = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while( !m_cv.wait_for( lock , period , [this](){ return m_quit; } ) ){
+            const auto now = std::chrono::steady_clock::now();
+            slog( INFO , GENERAL , "%s" , Report( std::chrono::duration<double>( now - last ).count() ).c_str() );
+            last = now;
+        }
+    } );
+}
+
+TelemetryReporter::~TelemetryReporter(){
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_quit = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+}
+
+// Durations are printed in the largest two units.
+static std::string formatDuration( double seconds ){
+    char ret[64];
+    const auto s = (long long)( seconds + 0.5 );
+    if( s < 60 )
+        snprintf( ret , sizeof( ret ) , "%llds" , s );
+    else if( s < 3600 )
+        snprintf( ret , sizeof( ret ) , "%lldm%02llds" , s / 60 , s % 60 );
+    else
+        snprintf( ret , sizeof( ret ) , "%lldh%02lldm" , s / 3600 , ( s % 3600 ) / 60 );
+    return ret;
+}
+
+std::string TelemetryReporter::Report( double elapsed ){
+    const auto& report = PerfReport::GetSingleton();
+    const auto tiles = report.GetTileCount();
+    const auto finished = report.GetFinishedTileCount();
+    const auto eta = report.GetEstimatedTimeLeft();
+    const auto rendering = report.GetTimeInPhase( PerfPhase::Rendering );
+
+    // rays are counted from zero again once the report is reset, like the next frame of a sequence.
+    const auto rays = report.GetRayCount();
+    const auto delta = rays >= m_rays ? rays - m_rays : rays;
+    m_rays = rays;
+
+    char line[256];
+    snprintf( line , sizeof( line ) , "Progress %.1f%% (%llu/%llu tiles), ETA %s, %.2f MRay/s (avg %.2f), peak memory %.1f MB, busy" ,
+              tiles ? 100.0 * (double)finished / (double)tiles : 0.0 , finished , tiles , eta < 0.0 ? "unknown" : formatDuration( eta ).c_str() ,
+              elapsed > 0.0 ? (double)delta * 1e-6 / elapsed : 0.0 , rendering > 0.0 ? (double)rays * 1e-6 / rendering : 0.0 ,
+              (double)PerfReport::GetPeakMemory() / ( 1024.0 * 1024.0 ) );
+    std::string ret = line;
+
+    // utilization of each thread since the previous report, only tiles that are done are counted.
+    const auto thread_cnt = report.GetThreadCount();
+    m_busy.resize( thread_cnt , 0.0 );
+    for( auto t = 0u ; t < thread_cnt ; ++t ){
+        const auto busy = report.GetThreadBusyTime( t );
+        const auto utilization = elapsed > 0.0 ? std::min( std::max( busy - m_busy[t] , 0.0 ) / elapsed , 1.0 ) : 0.0;
+        m_busy[t] = busy;
+        snprintf( line , sizeof( line ) , " %.0f%%" , utilization * 100.0 );
+        ret += line;
+    }
+    return ret;
+}
@@ -0,0 +1,56 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <thread>
+#include <string>
+#include <vector>
+#include <condition_variable>
+
+//! @brief  TelemetryReporter logs the progress and throughput of rendering periodically.
+/**
+ * Headless renders don't say anything until they are done. During the life time of a reporter, a background thread
+ * logs the finished tiles, an estimated time left, rays per second since the previous report and on average, peak
+ * memory and how busy each worker thread is rendering tiles. All numbers come from PerfReport, the same numbers are
+ * served to Prometheus by the metrics endpoint of a render server.
+ */
+class TelemetryReporter{
+public:
+    //! @brief  Constructor starts reporting.
+    //!
+    //! @param  interval    Seconds between two reports.
+    explicit TelemetryReporter( float interval );
+
+    //! @brief  Destructor stops reporting, it waits for the background thread to quit.
+    ~TelemetryReporter();
+
+    //! @brief  A line of the current telemetry.
+    //!
+    //! @param  elapsed     Seconds since the previous report.
+    //! @return             The line to be logged.
+    std::string Report( double elapsed );
+
+private:
+    std::thread                 m_thread;                   /**< The background thread reporting telemetry. */
+    std::mutex                  m_mutex;                    /**< Mutex protecting the quit flag. */
+    std::condition_variable     m_cv;                       /**< Wakes up the background thread to quit. */
+    bool                        m_quit = false;             /**< Whether the background thread should quit. */
+    unsigned long long          m_rays = 0;                 /**< Rays traced until the previous report. */
+    std::vector<double>         m_busy;                     /**< Busy time of each thread until the previous report. */
+};
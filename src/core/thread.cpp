@@ -25,15 +25,60 @@
 #include "task/task.h"
 #include "core/profile.h"
 #include "core/define.h"
+#include "core/numa.h"
+#include "core/globalconfig.h"
+
+SORT_STATS_DEFINE_COUNTER(sNumaNodeCnt)
+SORT_STATS_DEFINE_COUNTER(sPhysicalCoreCnt)
+SORT_STATS_DEFINE_COUNTER(sEfficiencyCoreCnt)
+SORT_STATS_DEFINE_COUNTER(sPinnedThreadCnt)
+SORT_STATS_DEFINE_COUNTER(sInterleavedThreadCnt)
+
+SORT_STATS_COUNTER("Performance", "NUMA node number", sNumaNodeCnt);
+SORT_STATS_COUNTER("Performance", "Physical core number", sPhysicalCoreCnt);
+SORT_STATS_COUNTER("Performance", "Efficiency core number", sEfficiencyCoreCnt);
+SORT_STATS_COUNTER("Performance", "Pinned worker thread number", sPinnedThreadCnt);
+SORT_STATS_COUNTER("Performance", "Worker thread number with interleaved scene memory", sInterleavedThreadCnt);
 
 static thread_local int g_ThreadId = 0;
 int ThreadId(){
     return g_ThreadId;
 }
 
+static thread_local bool g_MemoryInterleaved = false;
+
+void PlaceCurrentThread( unsigned tid ){
+    if( 0 == tid ){
+        SORT_STATS(sNumaNodeCnt = NumaNodeCount());
+        SORT_STATS(sPhysicalCoreCnt = CpuTopology().physical_cnt);
+        SORT_STATS(sEfficiencyCoreCnt = CpuTopology().efficiency_cnt);
+    }
+
+    if( g_threadPinningEnabled && PinCurrentThread( tid ) )
+        SORT_STATS(++sPinnedThreadCnt);
+
+    // There is nothing to interleave on a single socket machine.
+    if( g_numaInterleaveEnabled && NumaNodeCount() > 1 && SetCurrentThreadMemoryPolicy( NumaMemoryPolicy::Interleave ) ){
+        g_MemoryInterleaved = true;
+        SORT_STATS(++sInterleavedThreadCnt);
+    }
+}
+
+float WorkerThreadSpeed( unsigned tid ){
+    return g_threadPinningEnabled ? NumaThreadSpeed( tid ) : 1.0f;
+}
+
+void LocalizeCurrentThreadMemory(){
+    if( !g_MemoryInterleaved )
+        return;
+    SetCurrentThreadMemoryPolicy( NumaMemoryPolicy::Local );
+    g_MemoryInterleaved = false;
+}
+
 void WorkerThread::BeginThread(){
     m_thread = std::thread([&]() {
         g_ThreadId = m_tid;
+        PlaceCurrentThread( m_tid );
         RunThread();
     });
 }
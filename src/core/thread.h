@@ -17,14 +17,45 @@
 
 #pragma once
 
-#include <emmintrin.h>
+#if defined(__aarch64__) || defined(_M_ARM64)
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#else
+    #include <emmintrin.h>
+#endif
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include "core/define.h"
 
 // get the thread id
 int ThreadId();
 
+//! @brief  Pin the current thread and set up its memory placement according to the global configuration.
+//!
+//! While the scene is being loaded and its spatial accelerators are being built, pages touched by the
+//! thread are interleaved across NUMA nodes if it is enabled.
+//!
+//! @param  tid     Id of the current worker thread, 0 is the main thread.
+void PlaceCurrentThread( unsigned tid );
+
+//! @brief  Relative speed of a worker thread, faster ones are fed larger portions of work.
+//!
+//! Threads are only known to run on faster or slower cores if they are pinned, otherwise they are all
+//! considered equally fast.
+//!
+//! @param  tid     Id of the worker thread, 0 is the main thread.
+//! @return         Speed relative to the threads on performance cores.
+float WorkerThreadSpeed( unsigned tid );
+
+//! @brief  Keep memory allocated by the current thread from now on local to its NUMA node.
+//!
+//! It is called by rendering tasks, whose per-thread allocations should not be interleaved. Only the
+//! first call on each thread does anything.
+void LocalizeCurrentThreadMemory();
+
 class WorkerThread{
 public:
     // Constructor
@@ -46,6 +77,21 @@ private:
     unsigned    m_tid = 0;
 };
 
+//! @brief  Hint the CPU that the thread is spinning, so that other hardware threads could take the resources.
+//!
+//! https://software.intel.com/en-us/comment/1134767
+SORT_STATIC_FORCEINLINE void cpu_pause(){
+#if defined(__aarch64__) || defined(_M_ARM64)
+    #ifdef _MSC_VER
+        __yield();
+    #else
+        __asm__ __volatile__( "yield" );
+    #endif
+#else
+    _mm_pause();
+#endif
+}
+
 class spinlock_mutex{
 public:
     void lock() {
@@ -55,8 +101,7 @@ public:
             // In a very contended multi-threading environment, full busy loop may not be the most efficient thing to do since
             // they consume CPU cycles all the time. This instruction could allow delaying CPU instructions for a few cycles in
             // some cases to allow other threads to take ownership of hardware resources.
-            // https://software.intel.com/en-us/comment/1134767
-            _mm_pause(); 
+            cpu_pause();
         }
     }
     void unlock() {
@@ -67,3 +112,33 @@ public:
 private:
     std::atomic_flag locked = ATOMIC_FLAG_INIT ;
 };
+
+//! @brief  Counting semaphore limiting the number of threads doing something at the same time.
+/**
+ * It meets the requirements of BasicLockable, std::lock_guard works with it.
+ */
+class semaphore{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  cnt     Number of threads allowed at the same time.
+    explicit semaphore( unsigned cnt ) : m_cnt(cnt) {}
+
+    void lock() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait( lock , [this]{ return m_cnt > 0; } );
+        --m_cnt;
+    }
+    void unlock() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_cnt;
+        }
+        m_cv.notify_one();
+    }
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cv;
+    unsigned                m_cnt;
+};
@@ -32,4 +32,9 @@ void PerspectiveCameraEntity::Serialize(IStreamBase& stream) {
 
 void PerspectiveCameraEntity::FillScene(class Scene& scene) {
     scene.SetupCamera(m_camera.get());
-}
\ No newline at end of file
+}
+
+bool PerspectiveCameraEntity::Update(IStreamBase& stream) {
+    Serialize(stream);
+    return true;
+}
@@ -47,6 +47,14 @@ public:
     //! @param  scene       The scene to be filled.
     void    FillScene(class Scene& scene) override;
 
+    //! @brief  Update the camera for the next frame of a sequence.
+    //!
+    //! All properties of the camera are streamed again, in the same layout as 'Serialize'.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update(IStreamBase& stream) override;
+
 private:
     std::unique_ptr<PerspectiveCamera>  m_camera = std::make_unique<PerspectiveCamera>();   /**< Perspective camera. */
 };
\ No newline at end of file
@@ -42,6 +42,20 @@ public:
     //! @param  scene       The scene to be filled.
     virtual void   FillScene( class Scene& scene ) {};
 
+    //! @brief  Update the entity for the next frame of a sequence.
+    //!
+    //! Only the properties that could change between frames are streamed, like transforms of meshes. Entities that
+    //! can't be updated don't touch the stream at all.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             Whether the entity is updated.
+    virtual bool   Update( IStreamBase& stream ) { return false; }
+
+    //! @brief  Whether there is any visual attached to this entity.
+    //!
+    //! @return             Whether moving the entity moves primitives in the scene.
+    bool           HasVisuals() const { return !m_visuals.empty(); }
+
 protected:
     Transform                           m_transform;    /**< Transform of the entity from local space to world space. */
     std::list<std::unique_ptr<Visual>>  m_visuals;      /**< Visual attached to this entity. */
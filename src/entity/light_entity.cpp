@@ -33,6 +33,11 @@ void PointLightEntity::FillScene(class Scene& scene) {
     scene.AddLight(m_light.get());
 }
 
+bool PointLightEntity::Update(IStreamBase& stream) {
+    Serialize(stream);
+    return true;
+}
+
 void DirLightEntity::Serialize(IStreamBase& stream) {
     stream >> m_light->m_light2world;
 
@@ -46,6 +51,11 @@ void DirLightEntity::FillScene(class Scene& scene) {
     scene.AddLight(m_light.get());
 }
 
+bool DirLightEntity::Update(IStreamBase& stream) {
+    Serialize(stream);
+    return true;
+}
+
 void SpotLightEntity::Serialize(IStreamBase& stream) {
     stream >> m_light->m_light2world;
 
@@ -65,6 +75,11 @@ void SpotLightEntity::FillScene(class Scene& scene) {
     scene.AddLight(m_light.get());
 }
 
+bool SpotLightEntity::Update(IStreamBase& stream) {
+    Serialize(stream);
+    return true;
+}
+
 void SkyLightEntity::Serialize(IStreamBase& stream) {
     stream >> m_light->m_light2world;
     auto energy = 1.0f;
@@ -75,6 +90,16 @@ void SkyLightEntity::Serialize(IStreamBase& stream) {
     std::string filename;
     stream >> filename;
     m_light->sky.Load(filename);
+
+    // portals marking the openings that the sky is visible through
+    auto portal_cnt = 0u;
+    stream >> portal_cnt;
+    for( auto i = 0u ; i < portal_cnt ; ++i ){
+        Point corner;
+        Vector edge_u , edge_v , outward;
+        stream >> corner >> edge_u >> edge_v >> outward;
+        m_light->AddPortal( corner , edge_u , edge_v , outward );
+    }
 }
 
 void SkyLightEntity::FillScene(class Scene& scene) {
@@ -141,4 +166,43 @@ void AreaLightEntity::Serialize(IStreamBase& stream) {
 void AreaLightEntity::FillScene(class Scene& scene) {
     scene.AddLight(m_light.get());
     scene.AddPrimitive(m_primitive.get());
-}
\ No newline at end of file
+}
+
+void MeshLightEntity::Serialize( IStreamBase& stream ){
+    VisualEntity::Serialize( stream );
+    stream >> m_radiance;
+}
+
+void MeshLightEntity::FillScene( class Scene& scene ){
+    for( auto& visual : m_visuals ){
+        // only triangle meshes emit light, the rest of the visuals are filled as they are
+        auto mesh = dynamic_cast<MeshVisual*>( visual.get() );
+        if( !mesh ){
+            visual->FillScene( scene );
+            continue;
+        }
+
+        auto light = std::make_unique<MeshLight>();
+        light->intensity = m_radiance;
+
+        std::vector<const Primitive*> primitives;
+        mesh->FillPrimitives( primitives , light.get() );
+        for( const auto primitive : primitives )
+            scene.AddPrimitive( primitive );
+
+        light->Build( *mesh );
+        scene.AddLight( light.get() );
+        m_lights.push_back( std::move( light ) );
+    }
+}
+
+bool MeshLightEntity::Update( IStreamBase& stream ){
+    VisualEntity::Update( stream );
+
+    auto i = 0u;
+    for( auto& visual : m_visuals ){
+        if( auto mesh = dynamic_cast<MeshVisual*>( visual.get() ) )
+            m_lights[i++]->Build( *mesh );
+    }
+    return true;
+}
@@ -18,11 +18,13 @@
 #pragma once
 
 #include "entity.h"
+#include "visual_entity.h"
 #include "light/pointlight.h"
 #include "light/distant.h"
 #include "light/spot.h"
 #include "light/skylight.h"
 #include "light/area.h"
+#include "light/meshlight.h"
 
 //! @brief Light entity definition.
 /**
@@ -51,6 +53,14 @@ public:
     //! @param  scene       The scene to be filled.
     void    FillScene(class Scene& scene) override;
 
+    //! @brief  Update the light for the next frame of a sequence.
+    //!
+    //! All properties of the light are streamed again, in the same layout as 'Serialize'.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update( IStreamBase& stream ) override;
+
 protected:
     std::unique_ptr<PointLight>  m_light = std::make_unique<PointLight>();    /**< Light in the entity. */
 };
@@ -74,6 +84,14 @@ public:
     //! @param  scene       The scene to be filled.
     void    FillScene(class Scene& scene) override;
 
+    //! @brief  Update the light for the next frame of a sequence.
+    //!
+    //! All properties of the light are streamed again, in the same layout as 'Serialize'.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update( IStreamBase& stream ) override;
+
 protected:
     std::unique_ptr<SpotLight>  m_light = std::make_unique<SpotLight>();    /**< Light in the entity. */
 };
@@ -97,6 +115,14 @@ public:
     //! @param  scene       The scene to be filled.
     void    FillScene(class Scene& scene) override;
 
+    //! @brief  Update the light for the next frame of a sequence.
+    //!
+    //! All properties of the light are streamed again, in the same layout as 'Serialize'.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update( IStreamBase& stream ) override;
+
 protected:
     std::unique_ptr<DistantLight>  m_light = std::make_unique<DistantLight>();    /**< Light in the entity. */
 };
@@ -146,4 +172,38 @@ public:
 
 protected:
     std::unique_ptr<SkyLight>  m_light = std::make_unique<SkyLight>();    /**< Light in the entity. */
-};
\ No newline at end of file
+};
+
+//! @brief  Mesh light entity.
+/**
+ * A triangle mesh whose surface emits light. It is a visual entity in the first place, the triangles are part of the
+ * scene just like any other mesh, they also form a light source pointed to by the primitives of them.
+ */
+class MeshLightEntity : public VisualEntity {
+public:
+    DEFINE_RTTI( MeshLightEntity , Entity );
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! The meshes are serialized in the same layout as visual entity, followed by the emitted radiance.
+    //!
+    //! @param  stream      Input stream for data.
+    void    Serialize( IStreamBase& stream ) override;
+
+    //! @brief  Fill the scene with the triangles of the meshes and the lights emitted from them.
+    //!
+    //! @param  scene       The scene to be filled.
+    void    FillScene( class Scene& scene ) override;
+
+    //! @brief  Update the transform of the entity for the next frame of a sequence.
+    //!
+    //! The distribution of triangles of the lights is built again since the area of them could change.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update( IStreamBase& stream ) override;
+
+protected:
+    Spectrum                                    m_radiance;     /**< Radiance emitted from the surface of the meshes. */
+    std::vector<std::unique_ptr<MeshLight>>     m_lights;       /**< A light for each mesh visual in the entity. */
+};
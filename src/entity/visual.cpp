@@ -19,12 +19,101 @@
 #include "visual.h"
 #include "material/matmanager.h"
 #include "core/scene.h"
+#include "core/globalconfig.h"
+#include "accel/accelerator.h"
+#include "shape/instance.h"
+#include "camera/camera.h"
+
+// Maximum number of simplified levels of an instanced mesh.
+static constexpr unsigned   LOD_MAX_LEVELS          = 8;
+// Meshes are not simplified any further once they have less triangles than this.
+static constexpr unsigned   LOD_MIN_TRIANGLES       = 32;
+// A simplified level is dropped if it doesn't have less triangles than this portion of the previous level.
+static constexpr float      LOD_MIN_REDUCTION       = 0.75f;
+// Strands are never made wider than this times their original width, so that they don't turn into blobs.
+static constexpr float      LOD_MAX_STRAND_SCALE    = 16.0f;
+
+//! @brief  Build the spatial acceleration structure of an instanced mesh.
+//!
+//! @param  mesh        The instanced mesh, its primitives are created here.
+//! @param  bbox        Bounding box of the primitives of the full detail.
+static void buildInstancedMesh( InstancedMesh& mesh , const BBox& bbox ){
+    mesh.visual.FillPrimitives( mesh.primitives );
+    mesh.accelerator = g_accelerator->Clone();
+    mesh.accelerator->Build( mesh.primitives , bbox );
+}
+
+//! @brief  Build simplified levels of detail of an instanced mesh, each twice as coarse as the previous one.
+//!
+//! @param  mesh        The instanced mesh in full detail, its primitives need to be created already.
+//! @param  bbox        Bounding box of the primitives of the full detail.
+static void buildLevelsOfDetail( InstancedMesh& mesh , const BBox& bbox ){
+    const auto& memory = *mesh.visual.m_memory;
+    if( memory.m_indices.size() < LOD_MIN_TRIANGLES )
+        return;
+
+    // the size of the details of the full mesh is roughly the average length of its edges
+    auto total_length = 0.0;
+    for( const auto& mi : memory.m_indices ){
+        for( auto i = 0u ; i < 3u ; ++i )
+            total_length += distance( memory.m_vertices[mi.m_id[i]].m_position , memory.m_vertices[mi.m_id[(i+1)%3]].m_position );
+    }
+    mesh.feature = (float)( total_length / ( 3.0 * memory.m_indices.size() ) );
+    if( mesh.feature <= 0.0f )
+        return;
+
+    auto triangle_cnt = memory.m_indices.size();
+    auto cell = mesh.feature;
+    for( auto i = 0u ; i < 2 * LOD_MAX_LEVELS && mesh.levels.size() < LOD_MAX_LEVELS && triangle_cnt >= LOD_MIN_TRIANGLES ; ++i ){
+        cell *= 2.0f;
+
+        auto level = std::make_unique<InstancedMesh>();
+        level->visual.m_memory = std::make_unique<Mesh>();
+        memory.Simplify( cell , *level->visual.m_memory );
+
+        // cells not reducing much are skipped, the next one is twice as coarse
+        const auto cnt = level->visual.m_memory->m_indices.size();
+        if( cnt == 0 )
+            break;
+        if( (float)cnt > (float)triangle_cnt * LOD_MIN_REDUCTION )
+            continue;
+
+        level->feature = cell;
+        level->hash = mesh.hash;
+        buildInstancedMesh( *level , bbox );
+        if( !level->accelerator->GetIsValid() )
+            break;
+
+        triangle_cnt = cnt;
+        mesh.levels.push_back( std::move( level ) );
+    }
+
+    slog( INFO , GENERAL , "%d levels of detail are built for an instanced mesh with %d triangles, %d triangles in the coarsest level." ,
+          (int)mesh.levels.size() , (int)memory.m_indices.size() , (int)triangle_cnt );
+}
 
 void MeshVisual::FillScene( Scene& scene ){
+    std::vector<const Primitive*> primitives;
+    FillPrimitives( primitives );
+    for( const auto primitive : primitives )
+        scene.AddPrimitive( primitive );
+}
+
+void MeshVisual::FillPrimitives( std::vector<const Primitive*>& primitives , Light* light ){
+    // triangles and primitives are referred by pointers, the buffers can't be reallocated once they are filled.
+    sAssert( m_triangles.empty() , GENERAL );
+
+    if( light )
+        LargePageVector<Point>().swap( m_memory->m_motionPositions );
+
+    const auto cnt = m_memory->m_indices.size();
+    m_triangles.reserve( cnt );
+    m_trianglePrimitives.reserve( cnt );
+    primitives.reserve( primitives.size() + cnt );
     for (const auto& mi : m_memory->m_indices){
-        m_triangles.push_back( std::make_unique<Triangle>( this , mi ) );
-        m_primitives.push_back(std::make_unique<Primitive>(m_memory.get(), mi.m_mat, m_triangles.back().get()));
-        scene.AddPrimitive(m_primitives.back().get());
+        m_triangles.emplace_back( this , mi );
+        m_trianglePrimitives.emplace_back( m_memory.get() , m_memory->GetMaterial( mi ) , &m_triangles.back() , light );
+        primitives.push_back( &m_trianglePrimitives.back() );
     }
 }
 
@@ -34,26 +123,202 @@ void MeshVisual::Serialize( IStreamBase& stream ){
 }
 
 void MeshVisual::ApplyTransform( const Transform& transform ){
+    // Vertices could be loaded in world space with UV and tangents from the cache if the mesh was rendered before.
+    if( !g_meshCacheEnabled || !m_memory->LoadCache( transform , g_resourcePath ) ){
+        m_memory->ApplyTransform( transform );
+        m_memory->GenUV();
+        m_memory->GenSmoothTagent();
+
+        if( g_meshCacheEnabled )
+            m_memory->SaveCache( transform , g_resourcePath );
+    }
+
+    // volume shaders are evaluated in world space, they can only be baked once the mesh is in place
+    m_memory->BakeVolumes();
+}
+
+void MeshVisual::ApplyMotion( const Transform& transform , const Transform& motion ){
+    m_memory->ApplyMotion( transform , motion );
+}
+
+void MeshVisual::UpdateTransform( const Transform& previous , const Transform& transform ){
+    LargePageVector<Point>().swap( m_memory->m_motionPositions );
+
+    // Vertices are in world space already, they are moved back to the local space first. Generated UV stays the same.
+    m_memory->ApplyTransform( Inverse( previous ) );
     m_memory->ApplyTransform( transform );
-    m_memory->GenUV();
     m_memory->GenSmoothTagent();
+    m_memory->BakeVolumes();
+}
+
+InstancedMesh::~InstancedMesh() = default;
+
+InstancedMeshVisual::InstancedMeshVisual() = default;
+InstancedMeshVisual::~InstancedMeshVisual() = default;
+
+void InstancedMeshVisual::FillScene( Scene& scene ){
+    if( m_mesh )
+        scene.AddInstancedMesh( m_name , m_mesh );
+    else
+        m_mesh = scene.GetInstancedMesh( m_name );
+
+    if( IS_PTR_INVALID( m_mesh ) ){
+        slog( WARNING , GENERAL , "Instanced mesh is not loaded before being referred." );
+        return;
+    }
+
+    // Material proxies of SSS are shared by all instances since they are created while loading the mesh, this is the same
+    // with the case that multiple meshes share a same material.
+    if( m_mesh->flatten ){
+        m_flattened = std::make_unique<MeshVisual>();
+        m_flattened->m_memory = std::make_unique<Mesh>();
+        m_flattened->m_memory->m_vertices = m_mesh->visual.m_memory->m_vertices;
+        m_flattened->m_memory->m_indices = m_mesh->visual.m_memory->m_indices;
+        m_flattened->m_memory->m_materials = m_mesh->visual.m_memory->m_materials;
+        m_flattened->m_memory->m_hasUV = m_mesh->visual.m_memory->m_hasUV;
+        m_flattened->ApplyTransform( m_transform );
+        if( m_motion )
+            m_flattened->ApplyMotion( m_transform , *m_motion );
+        m_flattened->FillScene( scene );
+        return;
+    }
+
+    // the bottom level acceleration structure is built by the first instance
+    if( IS_PTR_INVALID( m_mesh->accelerator ) ){
+        m_mesh->visual.FillPrimitives( m_mesh->primitives );
+
+        BBox bbox;
+        m_mesh->hash = HASH_INITIAL_VALUE;
+        for( const auto primitive : m_mesh->primitives ){
+            bbox.Union( primitive->GetBBox() );
+            primitive->HashGeometry( m_mesh->hash );
+        }
+
+        // enlarge the bounding box a little, the same as what the scene does
+        const auto delta = ( bbox.m_Max - bbox.m_Min ) * 0.001f;
+        bbox.m_Min -= delta;
+        bbox.m_Max += delta;
+
+        m_mesh->accelerator = g_accelerator->Clone();
+        m_mesh->accelerator->Build( m_mesh->primitives , bbox );
+
+        // simplified levels share the bounding box of the full detail, clustered vertices never leave it
+        if( g_lodPixels > 0.0f && m_mesh->accelerator->GetIsValid() )
+            buildLevelsOfDetail( *m_mesh , bbox );
+    }
+
+    // there is nothing to instance for an empty mesh
+    if( !m_mesh->accelerator->GetIsValid() )
+        return;
+
+    m_instance = std::make_unique<Instance>( m_mesh->accelerator.get() , m_mesh->hash );
+    m_instance->SetTransform( m_transform );
+    if( m_motion )
+        m_instance->SetMotion( *m_motion );
+
+    // a level is used once the ray cone covers its details with the LOD size in pixels
+    for( const auto& level : m_mesh->levels )
+        m_instance->AddLevelOfDetail( level->accelerator.get() , level->feature / g_lodPixels );
+    m_primitive = std::make_unique<Primitive>( nullptr , nullptr , m_instance.get() );
+    scene.AddPrimitive( m_primitive.get() );
+}
+
+void InstancedMeshVisual::Serialize( IStreamBase& stream ){
+    auto has_mesh = false;
+    stream >> m_name >> has_mesh;
+    if( !has_mesh )
+        return;
+
+    m_mesh = std::make_shared<InstancedMesh>();
+    m_mesh->visual.Serialize( stream );
+
+    auto& memory = m_mesh->visual.m_memory;
+    memory->GenUV();
+    memory->GenSmoothTagent();
+
+    // SSS of a mesh doesn't bleed to other meshes and there is volume data in world space of each mesh, neither of them
+    // works with instancing.
+    for( const auto mat : memory->m_materials )
+        m_mesh->flatten |= mat->HasSSS() || mat->HasVolumeAttached();
+}
+
+void InstancedMeshVisual::ApplyTransform( const Transform& transform ){
+    m_transform = transform;
+}
+
+void InstancedMeshVisual::ApplyMotion( const Transform& transform , const Transform& motion ){
+    m_motion = std::make_unique<Transform>( motion );
+}
+
+void InstancedMeshVisual::UpdateTransform( const Transform& previous , const Transform& transform ){
+    m_transform = transform;
+    m_motion = nullptr;
+    if( m_instance )
+        m_instance->SetTransform( transform );
+    if( m_flattened )
+        m_flattened->UpdateTransform( previous , transform );
 }
 
 void HairVisual::FillScene( Scene& scene ){
-    for( const auto& line : m_lines ){
-        auto mat = MatManager::GetSingleton().GetMaterial(line->GetMaterialId());
-        m_primitives.push_back(std::make_unique<Primitive>(nullptr, mat, line.get()));
-        scene.AddPrimitive(m_primitives.back().get());
+    // primitives are referred by pointers, the buffer can't be reallocated once it is filled.
+    sAssert( m_linePrimitives.empty() , GENERAL );
+
+    // cameras fill the scene before visuals
+    if( g_lodPixels > 0.0f && scene.GetCamera() )
+        decimateStrands( *scene.GetCamera() );
+
+    // all lines of a hair visual share the same material
+    const auto mat = m_lines.empty() ? nullptr : MatManager::GetSingleton().GetMaterial( m_lines.front().GetMaterialId() );
+    m_linePrimitives.reserve( m_lines.size() );
+    for( auto& line : m_lines ){
+        m_linePrimitives.emplace_back( nullptr , mat , &line );
+        scene.AddPrimitive( &m_linePrimitives.back() );
     }
 }
 
+void HairVisual::decimateStrands( const Camera& camera ){
+    const auto spread = camera.GetPixelSpread();
+    if( spread <= 0.0f || m_rootWidth <= 0.0f || m_strands.empty() )
+        return;
+
+    std::vector<Line> lines;
+    std::vector<unsigned> strands;
+    for( auto i = 0u ; i < m_strands.size() ; ++i ){
+        const auto first = m_strands[i];
+        const auto last = i + 1 < m_strands.size() ? m_strands[i+1] : (unsigned)m_lines.size();
+
+        // A strand is kept with the probability of its width over the LOD size at its root, the kept ones get wider by the
+        // inverse of it. Each strand is assigned a fixed random number so that it doesn't flicker in a sequence.
+        const auto& bbox = m_lines[first].GetBBox();
+        const auto root = bbox.m_Min + ( bbox.m_Max - bbox.m_Min ) * 0.5f;
+        const auto pixel = distance( root , camera.GetEye() ) * spread * g_lodPixels;
+        const auto p = std::max( std::min( 1.0f , m_rootWidth / pixel ) , 1.0f / LOD_MAX_STRAND_SCALE );
+
+        auto hash = HASH_INITIAL_VALUE;
+        hashData( hash , &i , sizeof( i ) );
+        if( (float)( hash >> 40 ) * ( 1.0f / (float)( 1u << 24 ) ) >= p )
+            continue;
+
+        strands.push_back( (unsigned)lines.size() );
+        for( auto j = first ; j < last ; ++j )
+            lines.emplace_back( m_lines[j] , 1.0f / p );
+    }
+
+    slog( INFO , GENERAL , "%d of %d hair strands are kept with LOD." , (int)strands.size() , (int)m_strands.size() );
+
+    m_lines.swap( lines );
+    m_strands.swap( strands );
+}
+
 void HairVisual::Serialize( IStreamBase& stream ){
     auto hair_cnt = 0u;
     auto width_tip = 0.0f , width_bottom = 0.0f;
     stream >> hair_cnt;
     stream >> width_tip >> width_bottom;
+    m_rootWidth = width_bottom;
     auto mat_id = -1;
     stream >> mat_id;
+    MatManager::GetSingleton().BindMaterials({ mat_id });
     
     for( auto i = 0u ; i < hair_cnt ; ++i ){
         auto hair_step = 0u;
@@ -79,6 +344,8 @@ void HairVisual::Serialize( IStreamBase& stream ){
         if (UNLIKELY(total_length <= 0.0f))
             continue;
 
+        m_strands.push_back( (unsigned)m_lines.size() );
+
         auto prev_v = 0.0f;
         auto prev_w = width_bottom;
         auto cur_len = 0.0f;
@@ -92,7 +359,7 @@ void HairVisual::Serialize( IStreamBase& stream ){
             const auto cur_w = slerp(width_bottom, width_tip, t);
             const auto cur_v = slerp(0.0f, 1.0f, t);
 
-            m_lines.push_back(std::make_unique<Line>(prevP, curP, prev_v, cur_v, prev_w, cur_w, mat_id));
+            m_lines.emplace_back(prevP, curP, prev_v, cur_v, prev_w, cur_w, mat_id);
 
             prev_w = cur_w;
             prev_v = cur_v;
@@ -102,5 +369,10 @@ void HairVisual::Serialize( IStreamBase& stream ){
 
 void HairVisual::ApplyTransform( const Transform& transform ){
     for( auto& line : m_lines )
-        line->SetTransform( transform );
+        line.SetTransform( transform );
+}
+
+void HairVisual::UpdateTransform( const Transform& previous , const Transform& transform ){
+    // Lines keep their points in local space.
+    ApplyTransform( transform );
 }
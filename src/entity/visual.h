@@ -23,6 +23,10 @@
 #include "shape/line.h"
 #include "core/primitive.h"
 
+class Accelerator;
+class Instance;
+class Light;
+
 //! @brief Visual is the container for a specific type of shape that can be seen in SORT.
 /**
  * Visual could be a single shape, like sphere, triangle. It could also be a set of triangles,
@@ -40,9 +44,21 @@ public:
     //! @param  transform   The transform of the visual to be applied.
     virtual void        ApplyTransform( const Transform& transform ) = 0;
 
-protected:
-    /*< Primitives that shape the visual. */
-    std::vector<std::unique_ptr<Primitive>>  m_primitives;
+    //! @brief  Move the visual linearly during the shutter interval, it needs to be called after the transform is applied.
+    //!
+    //! Visuals not supporting motion blur stay where their transform places them, which is what the default does.
+    //!
+    //! @param  transform   The transform applied to the visual, it is where the visual is at the opening of the shutter.
+    //! @param  motion      The transform of the visual at the closing of the shutter.
+    virtual void        ApplyMotion( const Transform& transform , const Transform& motion ) {}
+
+    //! @brief  Move the visual to a new transform after the scene is filled, like in the next frame of a sequence.
+    //!
+    //! Cached bounding boxes of the primitives are not dropped, which needs to be done by the scene.
+    //!
+    //! @param  previous    The transform applied to the visual so far.
+    //! @param  transform   The new transform of the visual.
+    virtual void        UpdateTransform( const Transform& previous , const Transform& transform ) = 0;
 };
 
 //! @brief Triangle Mesh Visual.
@@ -71,17 +87,131 @@ public:
     //! @param  transform   The transform of the visual to be applied.
     void        ApplyTransform( const Transform& transform ) override;
 
+    //! @brief  Evaluate the positions of the vertices at the closing of the shutter.
+    //!
+    //! @param  transform   The transform applied to the visual.
+    //! @param  motion      The transform of the visual at the closing of the shutter.
+    void        ApplyMotion( const Transform& transform , const Transform& motion ) override;
+
+    //! @brief  Move the visual to a new transform after the scene is filled, the mesh doesn't move any more after this.
+    //!
+    //! @param  previous    The transform applied to the visual so far.
+    //! @param  transform   The new transform of the visual.
+    void        UpdateTransform( const Transform& previous , const Transform& transform ) override;
+
+    //! @brief  Create a primitive for each triangle of the mesh.
+    //!
+    //! Emissive meshes don't move, lights are sampled at where the meshes are at the opening of the shutter.
+    //!
+    //! @param  primitives  The created primitives are appended to it.
+    //! @param  light       The light emitted from the surface of the mesh, if there is one.
+    void        FillPrimitives( std::vector<const Primitive*>& primitives , Light* light = nullptr );
+
 public:
     /**< Memory for the mesh. */
     std::unique_ptr<Mesh>                 m_memory;
-    /**< This is to make sure the memory of triangles will be properly cleared. */
-    std::vector<std::unique_ptr<Triangle>>      m_triangles;
+    /**< Triangles of the mesh, they only refer to the vertices and indices of the mesh. */
+    std::vector<Triangle>                 m_triangles;
+    /**< Primitives of the triangles, they are allocated in one buffer instead of one by one. */
+    std::vector<Primitive>                m_trianglePrimitives;
+};
+
+//! @brief Geometry shared by all instances of a mesh.
+/**
+ * The triangles of the mesh stay in the local space of the mesh. The spatial acceleration structure of them, which is
+ * the bottom level structure of the instances, is only built once no matter how many times the mesh is instanced.
+ */
+struct InstancedMesh{
+    /**< The mesh in its local space. */
+    MeshVisual                          visual;
+    /**< Primitives of all triangles in the mesh. */
+    std::vector<const Primitive*>       primitives;
+    /**< Spatial acceleration structure of the triangles, it is not built until the mesh is instanced. */
+    std::unique_ptr<Accelerator>        accelerator;
+    /**< Hash of the geometry of the triangles. */
+    unsigned long long                  hash = 0;
+    /**< Meshes with SSS or volumes are not instanced, each instance is flattened to triangles in world space instead. */
+    bool                                flatten = false;
+    /**< Size of the details kept in a simplified level, it is the average length of edges for the full detail. */
+    float                               feature = 0.0f;
+    /**< Simplified levels of detail from the finest to the coarsest, they are only built with LOD enabled. */
+    std::vector<std::unique_ptr<InstancedMesh>> levels;
+
+    //! @brief  Destructor is defined where the accelerator is not an incomplete type.
+    ~InstancedMesh();
+};
+
+//! @brief Instance of a triangle mesh.
+/**
+ * Meshes shared by multiple entities are only loaded once. The first instance carries the mesh data, the rest only refer
+ * to it by name. Instead of creating triangles in world space for each instance, each instance is a single primitive
+ * referring to the geometry shared by all instances of the mesh. Memory and construction time of spatial acceleration
+ * structures scale with unique geometry this way.
+ * With LOD enabled, simplified versions of the mesh are built along with it, distant instances are intersected with them.
+ */
+class InstancedMeshVisual : public Visual{
+public:
+    DEFINE_RTTI( InstancedMeshVisual , Visual );
+
+    //! @brief  Constructor and destructor are defined where the instance is not an incomplete type.
+    InstancedMeshVisual();
+    ~InstancedMeshVisual();
+
+    //! @brief  Fill the scene with the instance.
+    //!
+    //! The first instance of a mesh registers the shared geometry in the scene, following instances refer to it.
+    //!
+    //! @param  scene       The scene to be filled.
+    void        FillScene( class Scene& scene ) override;
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! Serialize the visual. Loading from an IStreamBase, which could be coming from file, memory or network.
+    //!
+    //! @param  stream      Input stream for data.
+    void        Serialize( IStreamBase& stream ) override;
+
+    //! @brief  The transformation is not applied to the shared mesh, it is kept in the instance instead.
+    //!
+    //! @param  transform   The transform of the visual to be applied.
+    void        ApplyTransform( const Transform& transform ) override;
+
+    //! @brief  The instance moves from its transform to the one at the closing of the shutter.
+    //!
+    //! @param  transform   The transform applied to the visual.
+    //! @param  motion      The transform of the visual at the closing of the shutter.
+    void        ApplyMotion( const Transform& transform , const Transform& motion ) override;
+
+    //! @brief  Move the instance to a new transform, the shared mesh is not touched. It doesn't move any more after this.
+    //!
+    //! @param  previous    The transform applied to the visual so far.
+    //! @param  transform   The new transform of the visual.
+    void        UpdateTransform( const Transform& previous , const Transform& transform ) override;
+
+private:
+    /**< Name of the instanced mesh. */
+    StringID                            m_name;
+    /**< Transform of the instance from local space of the mesh to world space. */
+    Transform                           m_transform;
+    /**< Transform of the instance at the closing of the shutter, nullptr if it doesn't move. */
+    std::unique_ptr<Transform>          m_motion;
+    /**< The geometry shared by all instances of the mesh, only the first instance has it before filling the scene. */
+    std::shared_ptr<InstancedMesh>      m_mesh;
+    /**< Shape of the instance. */
+    std::unique_ptr<Instance>           m_instance;
+    /**< Primitive of the instance. */
+    std::unique_ptr<Primitive>          m_primitive;
+    /**< Triangles in world space if the mesh can't be instanced. */
+    std::unique_ptr<MeshVisual>         m_flattened;
 };
 
 //! HairVisual has a bunch of lines.
 /**
  * Just like MeshVisual may have lots of triangles, HairVisual has loads of line shape in it.
  * This visual is usually used to represent things like fur or hair.
+ * With LOD enabled, strands far away from the camera are decimated once the scene is filled. Only a random portion of
+ * the strands is kept and their widths are scaled up by the inverse of the portion, so that the hair covers roughly the
+ * same area on screen with way less lines.
  */
 class HairVisual : public Visual{
 public:
@@ -104,7 +234,24 @@ public:
     //! @param  transform   The transform of the visual to be applied.
     void        ApplyTransform( const Transform& transform ) override;
 
+    //! @brief  Move the visual to a new transform after the scene is filled.
+    //!
+    //! @param  previous    The transform applied to the visual so far.
+    //! @param  transform   The new transform of the visual.
+    void        UpdateTransform( const Transform& previous , const Transform& transform ) override;
+
 private:
-    /**< Memory container holding the lines. */
-    std::vector<std::unique_ptr<Line>>  m_lines;
+    /**< Lines of the hair, they are allocated in one buffer instead of one by one. */
+    std::vector<Line>                   m_lines;
+    /**< Index of the first line of each strand. */
+    std::vector<unsigned>               m_strands;
+    /**< Width of the strands at the root. */
+    float                               m_rootWidth = 0.0f;
+
+    //! @brief  Randomly drop strands thinner than the LOD size on screen, the rest of them get wider to keep the coverage.
+    //!
+    //! @param  camera      The camera looking at the hair.
+    void        decimateStrands( const class Camera& camera );
+    /**< Primitives of the lines, they are allocated in one buffer instead of one by one. */
+    std::vector<Primitive>              m_linePrimitives;
 };
\ No newline at end of file
@@ -47,6 +47,13 @@ public:
     void    Serialize( IStreamBase& stream ) override {
         stream >> m_transform;
 
+        // the transform at the closing of the shutter, it is only there if the entity moves during the shutter interval
+        auto has_motion = false;
+        Transform motion;
+        stream >> has_motion;
+        if( has_motion )
+            stream >> motion;
+
         unsigned int visualCnt = 0;
         stream >> visualCnt;
 
@@ -59,8 +66,27 @@ public:
 
             // Apply transform, some Visual applies transformation eariler for better performance.
             visual->ApplyTransform( m_transform );
+            if( has_motion )
+                visual->ApplyMotion( m_transform , motion );
 
             m_visuals.push_back( std::move(visual) );
         }
     }
+
+    //! @brief  Update the transform of the entity for the next frame of a sequence.
+    //!
+    //! The geometry of the visuals stays the same, only the transform is streamed. Visuals don't move during the shutter
+    //! interval any more after this.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             It always returns true.
+    bool    Update( IStreamBase& stream ) override {
+        Transform transform;
+        stream >> transform;
+
+        for( auto& visual : m_visuals )
+            visual->UpdateTransform( m_transform , transform );
+        m_transform = transform;
+        return true;
+    }
 };
\ No newline at end of file
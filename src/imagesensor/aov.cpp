@@ -0,0 +1,121 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "aov.h"
+#include "core/log.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
+
+namespace {
+    //! @brief  Description of the channels of an AOV in the image file.
+    struct AovLayout{
+        const char* name;           /**< Name of the AOV. */
+        const char* channels[3];    /**< Names of the channels, nullptr for the ones not saved. */
+        int         pixelType;      /**< Pixel type of the channels in the file. */
+    };
+
+    const AovLayout AOV_LAYOUTS[AOV_CNT] = {
+        { "albedo" , { "R" , "G" , "B" } , TINYEXR_PIXELTYPE_HALF },
+        { "normal" , { "X" , "Y" , "Z" } , TINYEXR_PIXELTYPE_HALF },
+        // half floats are not precise enough for depth far away
+        { "depth"  , { "Z" , nullptr , nullptr } , TINYEXR_PIXELTYPE_FLOAT },
+        // rays extending the path per sample is the average length of the paths
+        { "cost"   , { "time" , "rays" , "bounces" } , TINYEXR_PIXELTYPE_FLOAT },
+    };
+
+    //! @brief  A channel to be saved.
+    struct Channel{
+        std::string         name;       /**< Full name of the channel, including the name of the layer. */
+        std::vector<float>  pixels;     /**< Value of the channel in all pixels. */
+        int                 pixelType;  /**< Pixel type of the channel in the file. */
+    };
+}
+
+const char* AovName( int aov ){
+    return AOV_LAYOUTS[aov].name;
+}
+
+// Channels of a render target, the first three channels are named after 'names' and prefixed with 'layer'.
+static void appendChannels( std::vector<Channel>& channels , const RenderTarget& rt , const std::string& layer , const char* const names[3] , int pixelType ){
+    const auto w = rt.GetWidth();
+    const auto h = rt.GetHeight();
+    for( auto c = 0 ; c < 3 ; ++c ){
+        if( !names[c] )
+            continue;
+
+        Channel channel;
+        channel.name = layer.empty() ? names[c] : layer + "." + names[c];
+        channel.pixelType = pixelType;
+        channel.pixels.resize( w * h );
+        for( auto y = 0 ; y < h ; ++y )
+            for( auto x = 0 ; x < w ; ++x )
+                channel.pixels[y * w + x] = rt.GetColor( x , y )[c];
+        channels.push_back( std::move( channel ) );
+    }
+}
+
+bool OutputAovLayers( const std::string& filename , const RenderTarget& radiance , const RenderTarget* const aovs[AOV_CNT] ){
+    static const char* const rgb[3] = { "R" , "G" , "B" };
+
+    std::vector<Channel> channels;
+    appendChannels( channels , radiance , "" , rgb , TINYEXR_PIXELTYPE_HALF );
+    for( auto i = 0 ; i < AOV_CNT ; ++i ){
+        if( aovs[i] )
+            appendChannels( channels , *aovs[i] , AOV_LAYOUTS[i].name , AOV_LAYOUTS[i].channels , AOV_LAYOUTS[i].pixelType );
+    }
+
+    // Channels are sorted by name in EXR files.
+    std::sort( channels.begin() , channels.end() , []( const Channel& c0 , const Channel& c1 ){ return c0.name < c1.name; } );
+
+    const auto cnt = (int)channels.size();
+    std::vector<EXRChannelInfo> infos( cnt );
+    std::vector<int> pixel_types( cnt , TINYEXR_PIXELTYPE_FLOAT );
+    std::vector<int> requested_pixel_types( cnt );
+    std::vector<unsigned char*> images( cnt );
+    for( auto i = 0 ; i < cnt ; ++i ){
+        memset( &infos[i] , 0 , sizeof( EXRChannelInfo ) );
+        strncpy( infos[i].name , channels[i].name.c_str() , sizeof( infos[i].name ) - 1 );
+        requested_pixel_types[i] = channels[i].pixelType;
+        images[i] = reinterpret_cast<unsigned char*>( channels[i].pixels.data() );
+    }
+
+    EXRHeader header;
+    InitEXRHeader( &header );
+    header.num_channels = cnt;
+    header.channels = infos.data();
+    header.pixel_types = pixel_types.data();
+    header.requested_pixel_types = requested_pixel_types.data();
+    header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+    EXRImage image;
+    InitEXRImage( &image );
+    image.num_channels = cnt;
+    image.images = images.data();
+    image.width = radiance.GetWidth();
+    image.height = radiance.GetHeight();
+
+    const char* err = nullptr;
+    const auto ret = SaveEXRImageToFile( &image , &header , filename.c_str() , &err );
+    if( ret != TINYEXR_SUCCESS ){
+        slog( WARNING , IMAGE , "Fail to save image file %s, %s" , filename.c_str() , err ? err : "" );
+        FreeEXRErrorMessage( err );
+        return false;
+    }
+    return true;
+}
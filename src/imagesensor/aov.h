@@ -0,0 +1,54 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include "spectrum/spectrum.h"
+#include "texture/rendertarget.h"
+
+//! @brief  Arbitrary output variables, buffers other than the radiance of the image, like the ones for denoisers.
+enum AovType : int {
+    AOV_ALBEDO = 0,     /**< Directional albedo of the first surface hit by camera rays. */
+    AOV_NORMAL,         /**< Shading normal of the first surface hit by camera rays in world space. */
+    AOV_DEPTH,          /**< Distance from the camera to the first surface hit by camera rays, 0 if there is none. */
+    AOV_COST,           /**< Microseconds, rays and rays extending the path per sample, a heatmap of the rendering cost. */
+    AOV_CNT
+};
+
+//! @brief  Values of the AOVs of a sample, each one is three channels even if only the first one is used.
+//!
+//! Render tasks only hand a record to the integrator if any AOV is enabled, the surfaces hit by camera rays are
+//! recorded by render tasks, integrators only fill the ones depending on materials, like the albedo. The cost is
+//! measured by render tasks for a batch of samples of a pixel at once, it is only added to the AOVs of the pixel.
+struct AovSample{
+    Spectrum    values[AOV_CNT];    /**< Values of all AOVs. */
+};
+
+//! @brief  Get the name of an AOV, it is the name of its layer in the image file as well.
+//!
+//! @param  aov         The AOV.
+//! @return             Name of the AOV.
+const char* AovName( int aov );
+
+//! @brief  Save the radiance along with the AOVs to an EXR file, each AOV is in its own layer.
+//!
+//! @param  filename    Name of the image file.
+//! @param  radiance    Radiance of the image.
+//! @param  aovs        Values of all AOVs, nullptr for the ones not enabled.
+//! @return             Whether the image is saved.
+bool        OutputAovLayers( const std::string& filename , const RenderTarget& radiance , const RenderTarget* const aovs[AOV_CNT] );
@@ -15,64 +15,76 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
-#include <mutex>
+#include <string.h>
+#include <atomic>
 #include "blenderimage.h"
 #include "core/globalconfig.h"
 #include "core/path.h"
 
 static std::mutex g_cntLock;
 
-void BlenderImage::StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ){
+void BlenderImage::FinishTile( int tile_x , int tile_y , const Render_Task& rt ){
     if (!m_sharedMemory.sharedmemory.bytes)
         return;
 
-    int tile_w = rt.GetTileSize().x;
-    int tile_size = g_tileSize * g_tileSize;
-    int x_off = (int)(rt.GetTopLeft().x / g_tileSize);
-    int y_off = (int)(floor((m_height - 1 - rt.GetTopLeft().y) / (float)g_tileSize));
-    int tile_offset = y_off * m_tilenum_x + x_off;
-    int offset = 4 * tile_offset * tile_size;
-
-    // get the data pointer
-    float* data = (float*)(m_sharedMemory.sharedmemory.bytes + m_header_offset);
-
-    // get offset
-    int inner_offset = offset + 4 * (x - rt.GetTopLeft().x + (g_tileSize - 1 - (y - rt.GetTopLeft().y)) * tile_w);
+    const auto tile = tile_y * m_tilenum_x + tile_x;
+    {
+        std::lock_guard<std::mutex> lock(g_cntLock);
+        m_tileFinished[tile] = 1;
+        m_sharedMemory.sharedmemory.bytes[m_progressOffset] = (int)((++m_finishedTileCnt) / (float)m_tileCnt * 100.0f);
+    }
+    publishTile( tile , m_rendertarget , false );
+}
 
-    // copy data
-    data[ inner_offset ] = color.r;
-    data[ inner_offset + 1 ] = color.g;
-    data[ inner_offset + 2 ] = color.b;
-    data[ inner_offset + 3 ] = 1.0f;
+void BlenderImage::FinishPreviewPass( int block ){
+    if (!m_sharedMemory.sharedmemory.bytes)
+        return;
 
-    // for final update
     {
-        std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width+x]);
-        Spectrum _color = m_rendertarget.GetColor(x,y);
-        m_rendertarget.SetColor(x, y, color+_color);
+        std::lock_guard<std::mutex> lock(g_cntLock);
+        m_tileFinished.assign( m_tileCnt , 1 );
     }
+    for (auto i = 0; i < m_tileCnt; ++i)
+        publishTile( i , m_rendertarget , false , block );
 }
 
-void BlenderImage::FinishTile( int tile_x , int tile_y , const Render_Task& rt ){
+void BlenderImage::FinishPass( float progress ){
     if (!m_sharedMemory.sharedmemory.bytes)
         return;
 
-    m_sharedMemory.sharedmemory.bytes[tile_y * m_tilenum_x + tile_x] = 1;
+    {
+        std::lock_guard<std::mutex> lock(g_cntLock);
+        m_tileFinished.assign( m_tileCnt , 1 );
+        m_sharedMemory.sharedmemory.bytes[m_progressOffset] = (int)(progress * 100.0f);
+    }
+
+    // The preview is denoised in a copy of the image, later passes keep averaging the noisy radiance.
+    if( g_denoisePasses ){
+        if( !m_preview )
+            m_preview = std::make_unique<RenderTarget>( m_width , m_height );
+        for( auto y = 0 ; y < m_height ; ++y )
+            for( auto x = 0 ; x < m_width ; ++x )
+                m_preview->SetColor( x , y , m_rendertarget.GetColor( x , y ) );
+        denoise( *m_preview );
+    }
 
-    std::lock_guard<std::mutex> lock(g_cntLock);
-    m_sharedMemory.sharedmemory.bytes[m_sharedMemory.sharedmemory.size - 2] = (int)((++m_finishedTileCnt) / (float)( m_tilenum_x * m_tilenum_y ) * 100.0f);
+    const auto& image = g_denoisePasses ? *m_preview : m_rendertarget;
+    for (auto i = 0; i < m_tileCnt; ++i)
+        publishTile( i , image , false );
 }
 
 void BlenderImage::PreProcess(){
     // create shared memory
     m_tilenum_x = (int)(ceil(g_resultResollutionWidth / (float)g_tileSize));
     m_tilenum_y = (int)(ceil(g_resultResollutionHeight / (float)g_tileSize));
-    m_header_offset = m_tilenum_x * m_tilenum_y;
-    m_final_update_flag_offset = m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float) * 2 + m_header_offset + 1;
+    m_tileCnt = m_tilenum_x * m_tilenum_y;
+    m_tileFinished.assign( m_tileCnt , 0 );
+    m_tileSeq.assign( m_tileCnt , 0 );
+    m_seqOffset = ( m_tileCnt + 3 ) / 4 * 4;
+    m_dataOffset = m_seqOffset + m_tileCnt * (int)sizeof(unsigned);
+    m_progressOffset = m_dataOffset + m_tileCnt * g_tileSize * g_tileSize * 4 * sizeof(float) * 2;
 
-    int size = m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float) * 2    // image size
-             + m_header_offset                                                      // header size
-             + 2;                                                                   // progress data and final update flag
+    const auto size = m_progressOffset + 2;    // progress data and final update flag
 
     m_sharedMemory.CreateSharedMemory(GetFilePathInResourceFolder("sharedmem.bin"), size, SharedMmeory_All);
     auto& sm = m_sharedMemory.sharedmemory;
@@ -81,22 +93,80 @@ void BlenderImage::PreProcess(){
         memset(sm.bytes, 0, sm.size);
 }
 
-void BlenderImage::PostProcess(){
-    // perform a copy from render target to shared memory
-    float* data = (float*)(m_sharedMemory.sharedmemory.bytes + m_header_offset + m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float));
-
-    auto offset = 0;
-    for (auto i = 0; i < m_rendertarget.GetHeight(); ++i)
-        for (auto j = 0; j < m_rendertarget.GetWidth(); ++j){
-            const Spectrum& c = m_rendertarget.GetColor(j, m_rendertarget.GetHeight() - i - 1);
-            data[offset++] = c.r;
-            data[offset++] = c.g;
-            data[offset++] = c.b;
-            data[offset++] = 1.0f;
+void BlenderImage::publishTile( int tile , const RenderTarget& image , bool withSplats , int block ){
+    const auto tile_size = (int)g_tileSize;
+    const auto tl_x = ( tile % m_tilenum_x ) * tile_size;
+    const auto tl_y = ( m_tilenum_y - 1 - tile / m_tilenum_x ) * tile_size;
+    const auto tile_w = std::min( tile_size , m_width - tl_x );
+    const auto tile_h = std::min( tile_size , m_height - tl_y );
+
+    // Render target of a tile is only read once the tile is finished, it is still being written otherwise.
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(g_cntLock);
+        finished = 0 != m_tileFinished[tile];
+    }
+
+    // pixels are gathered locally, rows are bottom to top in Blender, each block of a preview pass takes the color of
+    // its top-left pixel
+    static thread_local std::vector<float> pixels;
+    pixels.resize( 4 * tile_w * tile_h );
+    auto dst = pixels.data();
+    for (auto y = tl_y + tile_h - 1; y >= tl_y; --y){
+        for (auto x = tl_x; x < tl_x + tile_w; ++x){
+            auto color = finished ? image.GetColor(x - x % block, y - y % block) : Spectrum();
+            if( withSplats )
+                color += m_splats.Get(x, y);
+            *dst++ = color.r;
+            *dst++ = color.g;
+            *dst++ = color.b;
+            *dst++ = 1.0f;
         }
+    }
 
-    // signal a final update
-    m_sharedMemory.sharedmemory.bytes[m_final_update_flag_offset] = 1;
+    // Partial tiles at the bottom of the image only fill the last rows of the tile, the same as what Blender expects.
+    std::lock_guard<std::mutex> lock(m_publishMutex);
+    auto& sm = m_sharedMemory.sharedmemory;
+    const auto seq = m_tileSeq[tile] + 1;
+    const auto buffer = (int)( seq & 1 ) * m_tileCnt + tile;
+    auto data = (float*)( sm.bytes + m_dataOffset ) + 4 * ( buffer * tile_size * tile_size + ( tile_size - tile_h ) * tile_w );
+    memcpy( data , pixels.data() , pixels.size() * sizeof(float) );
+
+    // Blender reads the sequence number before and after reading the buffer, it finds it if the buffer is being written.
+    std::atomic_thread_fence( std::memory_order_release );
+    m_tileSeq[tile] = seq;
+    ((volatile unsigned*)( sm.bytes + m_seqOffset ))[tile] = seq;
+    sm.bytes[tile] = 1;
+}
 
+void BlenderImage::RefreshSplats(){
+    if (!m_sharedMemory.sharedmemory.bytes)
+        return;
+
+    for (auto i = 0; i < m_tileCnt; ++i)
+        publishTile( i , m_rendertarget , true );
+}
+
+void BlenderImage::PostProcess(){
+    // merge splatted radiance and denoise the image first
+    const auto changed = !m_splats.IsEmpty() || g_denoise || g_denoisePasses;
     ImageSensor::PostProcess();
+
+    if (!m_sharedMemory.sharedmemory.bytes)
+        return;
+
+    // Tiles already published stay the same, unless splatted radiance is merged into them or they are denoised.
+    std::vector<char> finished;
+    {
+        std::lock_guard<std::mutex> lock(g_cntLock);
+        finished = m_tileFinished;
+        m_tileFinished.assign( m_tileCnt , 1 );
+    }
+    for (auto i = 0; i < m_tileCnt; ++i){
+        if( changed || !finished[i] || !m_sharedMemory.sharedmemory.bytes[i] )
+            publishTile( i , m_rendertarget , false );
+    }
+
+    // signal a final update
+    m_sharedMemory.sharedmemory.bytes[m_progressOffset + 1] = 1;
 }
@@ -17,36 +17,67 @@
 
 #pragma once
 
+#include <vector>
+#include <mutex>
 #include "imagesensor.h"
 #include "texture/rendertarget.h"
 #include "platform/sharedmemory/sharedmemory.h"
 
 // generate output
+//
+// Pixels are shown in Blender through shared memory, tile by tile. Each tile has two buffers in it, a tile is copied to
+// the buffer Blender is not reading with one memcpy and then the sequence number of the tile is bumped, whose lowest
+// bit tells Blender which buffer to read. Blender displays a tile again whenever its sequence number changes.
+//
+// Layout of the shared memory, with N tiles of T x T pixels,
+//   N bytes            whether each tile is published at least once
+//   N unsigned ints    sequence number of each tile, aligned to 4 bytes
+//   2N tiles           two buffers of all tiles, T x T pixels of 4 floats each, rows are bottom to top
+//   1 byte             progress between 0 and 100
+//   1 byte             final update flag, all tiles are published with their final pixels once it is set
 class BlenderImage : public ImageSensor
 {
 public:
     // constructor
     BlenderImage( int w , int h ) : ImageSensor( w , h ) {}
 
-    // store pixel information
-    void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) override;
-
     // finish image tile
     void FinishTile( int tile_x , int tile_y , const Render_Task& rt ) override;
 
+    // a pass of progressive rendering is done, all tiles are refreshed, they are denoised first if required
+    void FinishPass( float progress ) override;
+
+    // a quick preview pass is done, all tiles are refreshed with each block of pixels filled
+    void FinishPreviewPass( int block ) override;
+
     // pre process
     void PreProcess() override;
 
     // post process
     void PostProcess() override;
 
+protected:
+    // display splatted radiance in all tiles, rendered tiles are displayed with their own radiance as well
+    void RefreshSplats() override;
+
 private:
-    int             m_header_offset;
-    int             m_final_update_flag_offset;
     int             m_tilenum_x;
     int             m_tilenum_y;
+    int             m_tileCnt;
+    int             m_seqOffset;
+    int             m_dataOffset;
+    int             m_progressOffset;
 
     int             m_finishedTileCnt = 0;
+    std::vector<char>       m_tileFinished;     /**< Whether each tile is finished, in the order of tiles in shared memory. */
+    std::vector<unsigned>   m_tileSeq;          /**< Sequence number of each tile published so far. */
+    std::mutex              m_publishMutex;     /**< A tile could be published by a render task and a splat refresh at the same time. */
+    std::unique_ptr<RenderTarget>   m_preview;  /**< Denoised copy of the image after a progressive pass, nullptr if it is not denoised. */
 
     PlatformSharedMemory    m_sharedMemory;
+
+    // copy a tile of the image, in the order of tiles in shared memory, to the buffer Blender is not reading and flip
+    // the buffers, splatted radiance is added if required, the rendered radiance is only there if the tile is finished,
+    // blocks of pixels of a quick preview pass are filled with their top-left pixel
+    void publishTile( int tile , const RenderTarget& image , bool withSplats , int block = 1 );
 };
@@ -0,0 +1,185 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string.h>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include "checkpoint.h"
+#include "core/log.h"
+#include "core/stats.h"
+#include "stream/fstream.h"
+
+SORT_STATS_DEFINE_COUNTER(sCheckpointCnt)
+SORT_STATS_DEFINE_COUNTER(sResumedTileCnt)
+
+SORT_STATS_COUNTER("Checkpoint", "Saved checkpoints", sCheckpointCnt);
+SORT_STATS_COUNTER("Checkpoint", "Resumed tiles", sResumedTileCnt);
+
+// Identifier of checkpoint files.
+static constexpr unsigned   CHECKPOINT_MAGIC    = 0x504b4353;
+// This needs to be updated every time the layout of checkpoint files changes.
+static constexpr unsigned   CHECKPOINT_VERSION  = 1;
+
+Checkpoint::Checkpoint( int w , int h , int tileSize , unsigned samplePerPixel ) :
+    m_width( w ) , m_height( h ) , m_tileSize( tileSize ) ,
+    m_tileCntX( ( w + tileSize - 1 ) / tileSize ) , m_tileCntY( ( h + tileSize - 1 ) / tileSize ) ,
+    m_samplePerPixel( samplePerPixel ) , m_lastSave( std::chrono::steady_clock::now() ){
+    m_tileSamples = std::make_unique<unsigned[]>( m_tileCntX * m_tileCntY );
+    std::fill( m_tileSamples.get() , m_tileSamples.get() + m_tileCntX * m_tileCntY , 0u );
+    m_radiance = std::make_unique<float[]>( 3 * w * h );
+}
+
+Vector2i Checkpoint::tileSize( const Vector2i& topLeft ) const{
+    return Vector2i( std::min( m_tileSize , m_width - topLeft.x ) , std::min( m_tileSize , m_height - topLeft.y ) );
+}
+
+void Checkpoint::StoreTile( const RenderTarget& rt , const Vector2i& topLeft , unsigned samples ){
+    const auto size = tileSize( topLeft );
+
+    std::lock_guard<std::mutex> lock( m_tileMutex );
+    for( auto y = topLeft.y ; y < topLeft.y + size.y ; ++y ){
+        for( auto x = topLeft.x ; x < topLeft.x + size.x ; ++x ){
+            const auto color = rt.GetColor( x , y );
+            auto pixel = m_radiance.get() + 3 * ( y * m_width + x );
+            pixel[0] = color.r;
+            pixel[1] = color.g;
+            pixel[2] = color.b;
+        }
+    }
+    m_tileSamples[ ( topLeft.y / m_tileSize ) * m_tileCntX + topLeft.x / m_tileSize ] = samples;
+}
+
+unsigned Checkpoint::GetTileSamples( const Vector2i& topLeft ) const{
+    std::lock_guard<std::mutex> lock( m_tileMutex );
+    return m_tileSamples[ ( topLeft.y / m_tileSize ) * m_tileCntX + topLeft.x / m_tileSize ];
+}
+
+bool Checkpoint::IsComplete() const{
+    std::lock_guard<std::mutex> lock( m_tileMutex );
+    return std::all_of( m_tileSamples.get() , m_tileSamples.get() + m_tileCntX * m_tileCntY , [&]( unsigned samples ){
+        return samples >= m_samplePerPixel;
+    } );
+}
+
+void Checkpoint::SaveIfDue( const std::string& filename , unsigned interval ){
+    std::unique_lock<std::mutex> lock( m_saveMutex , std::try_to_lock );
+    if( lock.owns_lock() && std::chrono::steady_clock::now() - m_lastSave >= std::chrono::seconds( interval ) )
+        Save( filename );
+}
+
+bool Checkpoint::Save( const std::string& filename ){
+    const auto tile_cnt = m_tileCntX * m_tileCntY;
+
+    // Writing to disk could take a while, tiles finished in the meantime shouldn't wait for it.
+    std::unique_ptr<unsigned[]> tile_samples = std::make_unique<unsigned[]>( tile_cnt );
+    std::unique_ptr<float[]> radiance = std::make_unique<float[]>( 3 * m_width * m_height );
+    {
+        std::lock_guard<std::mutex> lock( m_tileMutex );
+        std::copy( m_tileSamples.get() , m_tileSamples.get() + tile_cnt , tile_samples.get() );
+        std::copy( m_radiance.get() , m_radiance.get() + 3 * m_width * m_height , radiance.get() );
+    }
+
+    const auto tmp_file = filename + ".tmp";
+    auto saved = false;
+    {
+        OFileStream stream( tmp_file );
+        stream << CHECKPOINT_MAGIC << CHECKPOINT_VERSION << m_width << m_height << m_tileSize << m_samplePerPixel << tile_cnt;
+        for( auto i = 0 ; i < tile_cnt ; ++i )
+            stream << tile_samples[i];
+
+        // Only pixels of rendered tiles are saved, row by row.
+        for( auto i = 0 ; i < tile_cnt ; ++i ){
+            if( 0 == tile_samples[i] )
+                continue;
+            const auto top_left = Vector2i( i % m_tileCntX , i / m_tileCntX ) * m_tileSize;
+            const auto size = tileSize( top_left );
+            for( auto y = top_left.y ; y < top_left.y + size.y ; ++y )
+                stream.Write( (char*)( radiance.get() + 3 * ( y * m_width + top_left.x ) ) , 3 * size.x * (int)sizeof( float ) );
+        }
+        saved = stream.IsValid();
+    }
+
+    m_lastSave = std::chrono::steady_clock::now();
+    if( !saved ){
+        std::remove( tmp_file.c_str() );
+        slog( WARNING , IMAGE , "Failed to save checkpoint %s." , filename.c_str() );
+        return false;
+    }
+
+    std::remove( filename.c_str() );
+    std::rename( tmp_file.c_str() , filename.c_str() );
+    SORT_STATS(++sCheckpointCnt);
+    return true;
+}
+
+bool Checkpoint::Load( const std::string& filename , RenderTarget& rt ){
+    // check whether the file exists first since missing checkpoint is not worth a warning
+    if( !std::ifstream( filename , std::ios::in | std::ios::binary ).good() )
+        return false;
+
+    IFileStream stream( filename );
+
+    const auto tile_cnt = m_tileCntX * m_tileCntY;
+    unsigned magic = 0 , version = 0 , spp = 0;
+    int w = 0 , h = 0 , tile_size = 0 , cnt = 0;
+    stream >> magic >> version >> w >> h >> tile_size >> spp >> cnt;
+    if( !stream.IsValid() || CHECKPOINT_MAGIC != magic || CHECKPOINT_VERSION != version ||
+        m_width != w || m_height != h || m_tileSize != tile_size || m_samplePerPixel != spp || tile_cnt != cnt ){
+        slog( WARNING , IMAGE , "Checkpoint %s doesn't match the render settings, rendering starts over." , filename.c_str() );
+        return false;
+    }
+
+    auto tile_samples = std::make_unique<unsigned[]>( tile_cnt );
+    for( auto i = 0 ; i < tile_cnt ; ++i )
+        stream >> tile_samples[i];
+
+    auto radiance = std::make_unique<float[]>( 3 * m_width * m_height );
+    for( auto i = 0 ; i < tile_cnt ; ++i ){
+        if( 0 == tile_samples[i] )
+            continue;
+        const auto top_left = Vector2i( i % m_tileCntX , i / m_tileCntX ) * m_tileSize;
+        const auto size = tileSize( top_left );
+        for( auto y = top_left.y ; y < top_left.y + size.y ; ++y )
+            stream.Load( (char*)( radiance.get() + 3 * ( y * m_width + top_left.x ) ) , 3 * size.x * (int)sizeof( float ) );
+    }
+
+    if( !stream.IsValid() ){
+        slog( WARNING , IMAGE , "Checkpoint %s is corrupted, rendering starts over." , filename.c_str() );
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock( m_tileMutex );
+    m_tileSamples = std::move( tile_samples );
+    m_radiance = std::move( radiance );
+    for( auto i = 0 ; i < tile_cnt ; ++i ){
+        if( 0 == m_tileSamples[i] )
+            continue;
+        const auto top_left = Vector2i( i % m_tileCntX , i / m_tileCntX ) * m_tileSize;
+        const auto size = tileSize( top_left );
+        for( auto y = top_left.y ; y < top_left.y + size.y ; ++y ){
+            for( auto x = top_left.x ; x < top_left.x + size.x ; ++x ){
+                const auto pixel = m_radiance.get() + 3 * ( y * m_width + x );
+                rt.SetColor( x , y , Spectrum( pixel[0] , pixel[1] , pixel[2] ) );
+            }
+        }
+        SORT_STATS(++sResumedTileCnt);
+    }
+
+    slog( INFO , IMAGE , "Rendering is resumed from checkpoint %s." , filename.c_str() );
+    return true;
+}
@@ -0,0 +1,105 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <string>
+#include "math/vector2.h"
+#include "texture/rendertarget.h"
+
+//! @brief  Checkpoint keeps the state of rendering on disk, so that preempted rendering could be resumed later.
+//!
+//! A snapshot of a tile is taken once all its pixels are rendered, along with the number of samples taken in each
+//! of its pixels. Tiles still being rendered are not in the snapshot, they are rendered again after resuming. Random
+//! numbers are seeded differently in each run, the samples taken after resuming are independent of the ones taken
+//! before, so there is no sampler state to be kept other than the number of samples taken in each tile.
+class Checkpoint{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w               Width of the image.
+    //! @param  h               Height of the image.
+    //! @param  tileSize        Size of the tiles.
+    //! @param  samplePerPixel  Number of samples per pixel once rendering is done.
+    Checkpoint( int w , int h , int tileSize , unsigned samplePerPixel );
+
+    //! @brief  Take a snapshot of a tile whose pixels are all rendered, it could be called from any worker thread.
+    //!
+    //! @param  rt              Render target holding the radiance of the tile.
+    //! @param  topLeft         Top-left corner of the tile.
+    //! @param  samples         Number of samples taken in each pixel of the tile so far.
+    void        StoreTile( const RenderTarget& rt , const Vector2i& topLeft , unsigned samples );
+
+    //! @brief  Get the number of samples taken in each pixel of a tile in the snapshot.
+    //!
+    //! @param  topLeft         Top-left corner of the tile.
+    //! @return                 Number of samples taken in each pixel of the tile, 0 if it is not rendered yet.
+    unsigned    GetTileSamples( const Vector2i& topLeft ) const;
+
+    //! @brief  Whether all samples per pixel are taken in all tiles.
+    //!
+    //! @return                 True if rendering is done.
+    bool        IsComplete() const;
+
+    //! @brief  Save the snapshot to disk if it hasn't been saved for a while.
+    //!
+    //! It returns immediately if another thread is saving it already, there is no point waiting for it.
+    //!
+    //! @param  filename        Name of the checkpoint file.
+    //! @param  interval        Number of seconds between two checkpoints.
+    void        SaveIfDue( const std::string& filename , unsigned interval );
+
+    //! @brief  Save the snapshot to disk.
+    //!
+    //! It is written to a temporary file first, which replaces the checkpoint file once it is complete. So there is
+    //! always a valid checkpoint file even if the process is killed in the middle of saving it.
+    //!
+    //! @param  filename        Name of the checkpoint file.
+    //! @return                 Whether the checkpoint is saved.
+    bool        Save( const std::string& filename );
+
+    //! @brief  Load the snapshot from disk, tiles in it are copied to the render target.
+    //!
+    //! @param  filename        Name of the checkpoint file.
+    //! @param  rt              Render target to be filled with the radiance of rendered tiles.
+    //! @return                 Whether there is a checkpoint matching the image and its settings.
+    bool        Load( const std::string& filename , RenderTarget& rt );
+
+private:
+    const int                   m_width;            /**< Width of the image. */
+    const int                   m_height;           /**< Height of the image. */
+    const int                   m_tileSize;         /**< Size of the tiles. */
+    const int                   m_tileCntX;         /**< Number of tiles in a row. */
+    const int                   m_tileCntY;         /**< Number of tiles in a column. */
+    const unsigned              m_samplePerPixel;   /**< Number of samples per pixel once rendering is done. */
+
+    std::unique_ptr<unsigned[]> m_tileSamples;      /**< Number of samples taken in each pixel of each tile. */
+    std::unique_ptr<float[]>    m_radiance;         /**< Radiance of the pixels in rendered tiles, three channels per pixel. */
+    mutable std::mutex          m_tileMutex;        /**< Protects the snapshot of tiles. */
+
+    std::mutex                                  m_saveMutex;    /**< Only one thread saves the checkpoint at a time. */
+    std::chrono::steady_clock::time_point       m_lastSave;     /**< When the checkpoint was saved the last time, protected by m_saveMutex. */
+
+    //! @brief  Get the size of a tile, tiles on the right and bottom edges could be smaller.
+    //!
+    //! @param  topLeft         Top-left corner of the tile.
+    //! @return                 Size of the tile.
+    Vector2i    tileSize( const Vector2i& topLeft ) const;
+};
@@ -0,0 +1,260 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "denoiser.h"
+#include "core/globalconfig.h"
+#include "core/log.h"
+#include "core/profile.h"
+#include "task/task.h"
+
+#ifdef SORT_ENABLE_OIDN
+#include <OpenImageDenoise/oidn.h>
+#endif
+
+// Number of iterations of the a-trous filter, the footprint of the last one is 65 x 65 pixels.
+static constexpr int    DENOISE_ITERATIONS      = 5;
+// Number of rows filtered by a task.
+static constexpr int    DENOISE_PARALLEL_ROWS   = 16;
+// Deviation of the tone mapped radiance stopping the filter at edges, it is halved in each iteration.
+static constexpr float  DENOISE_SIGMA_COLOR     = 0.5f;
+// Deviation of the normal stopping the filter at edges.
+static constexpr float  DENOISE_SIGMA_NORMAL    = 0.3f;
+// Deviation of the albedo stopping the filter at edges.
+static constexpr float  DENOISE_SIGMA_ALBEDO    = 0.1f;
+// Channels of albedo below this are not divided out of the radiance, there is barely any radiance to recover.
+static constexpr float  DENOISE_MIN_ALBEDO      = 0.01f;
+// B3 spline kernel of the a-trous filter.
+static constexpr float  DENOISE_KERNEL[5]       = { 1.0f / 16.0f , 1.0f / 4.0f , 3.0f / 8.0f , 1.0f / 4.0f , 1.0f / 16.0f };
+
+// Run a function on chunks of rows in parallel, the function takes the first row and the one after the last row.
+static void parallelRows( int height , const std::function<void(int,int)>& func ){
+    const auto chunk_cnt = ( height + DENOISE_PARALLEL_ROWS - 1 ) / DENOISE_PARALLEL_ROWS;
+    const auto run_chunk = [&]( int c ){
+        func( c * DENOISE_PARALLEL_ROWS , std::min( height , ( c + 1 ) * DENOISE_PARALLEL_ROWS ) );
+    };
+
+    if( chunk_cnt <= 1 ){
+        func( 0 , height );
+        return;
+    }
+
+    if( IS_PTR_VALID( GetCurrentTask() ) ){
+        for( auto c = 0 ; c < chunk_cnt ; ++c )
+            SPAWN_TASK<Function_Task>( "Denoise Rows" , DEFAULT_TASK_PRIORITY , {} , [&,c](){ run_chunk( c ); } );
+        WAIT_FOR_CHILDREN();
+        return;
+    }
+
+    // Render threads are done in post process, the same number of threads pick chunks one after another instead.
+    std::atomic<int> next = { 0 };
+    const auto worker = [&](){
+        for( auto c = next++ ; c < chunk_cnt ; c = next++ )
+            run_chunk( c );
+    };
+    const auto thread_cnt = std::min( (int)std::max( g_threadCnt , 1u ) , chunk_cnt );
+    std::vector<std::thread> threads;
+    for( auto i = 1 ; i < thread_cnt ; ++i )
+        threads.emplace_back( worker );
+    worker();
+    for( auto& thread : threads )
+        thread.join();
+}
+
+// Radiance is tone mapped before it is compared, so that bright pixels don't stop the filter everywhere.
+static SORT_FORCEINLINE Spectrum toneMap( const Spectrum& c ){
+    return Spectrum( c.r / ( 1.0f + c.r ) , c.g / ( 1.0f + c.g ) , c.b / ( 1.0f + c.b ) );
+}
+
+static SORT_FORCEINLINE float sqrDistance( const Spectrum& c0 , const Spectrum& c1 ){
+    const auto d = c0 - c1;
+    return d.r * d.r + d.g * d.g + d.b * d.b;
+}
+
+static void denoiseATrous( RenderTarget& image , const RenderTarget* albedo , const RenderTarget* normal ){
+    const auto w = image.GetWidth();
+    const auto h = image.GetHeight();
+    std::vector<Spectrum> irradiance( w * h ) , filtered( w * h );
+    std::vector<Spectrum> albedos( albedo ? w * h : 0 ) , normals( normal ? w * h : 0 );
+
+    parallelRows( h , [&]( int y0 , int y1 ){
+        for( auto y = y0 ; y < y1 ; ++y ){
+            for( auto x = 0 ; x < w ; ++x ){
+                const auto i = y * w + x;
+                auto color = image.GetColor( x , y );
+                if( albedo ){
+                    const auto a = albedo->GetColor( x , y );
+                    albedos[i] = Spectrum( a.r > DENOISE_MIN_ALBEDO ? a.r : 1.0f , a.g > DENOISE_MIN_ALBEDO ? a.g : 1.0f , a.b > DENOISE_MIN_ALBEDO ? a.b : 1.0f );
+                    color = color / albedos[i];
+                }
+                if( normal )
+                    normals[i] = normal->GetColor( x , y );
+                irradiance[i] = color;
+            }
+        }
+    });
+
+    for( auto it = 0 ; it < DENOISE_ITERATIONS ; ++it ){
+        const auto step = 1 << it;
+        const auto sigma_color = DENOISE_SIGMA_COLOR / (float)step;
+        const auto inv_sigma_color = 1.0f / ( sigma_color * sigma_color );
+        const auto inv_sigma_normal = 1.0f / ( DENOISE_SIGMA_NORMAL * DENOISE_SIGMA_NORMAL );
+        const auto inv_sigma_albedo = 1.0f / ( DENOISE_SIGMA_ALBEDO * DENOISE_SIGMA_ALBEDO );
+
+        parallelRows( h , [&]( int y0 , int y1 ){
+            for( auto y = y0 ; y < y1 ; ++y ){
+                for( auto x = 0 ; x < w ; ++x ){
+                    const auto i = y * w + x;
+                    const auto center = toneMap( irradiance[i] );
+
+                    Spectrum sum;
+                    auto weight_sum = 0.0f;
+                    for( auto dy = -2 ; dy <= 2 ; ++dy ){
+                        const auto sy = y + dy * step;
+                        if( sy < 0 || sy >= h )
+                            continue;
+                        for( auto dx = -2 ; dx <= 2 ; ++dx ){
+                            const auto sx = x + dx * step;
+                            if( sx < 0 || sx >= w )
+                                continue;
+
+                            const auto j = sy * w + sx;
+                            auto distance = sqrDistance( center , toneMap( irradiance[j] ) ) * inv_sigma_color;
+                            if( normal )
+                                distance += sqrDistance( normals[i] , normals[j] ) * inv_sigma_normal;
+                            if( albedo )
+                                distance += sqrDistance( albedos[i] , albedos[j] ) * inv_sigma_albedo;
+
+                            const auto weight = DENOISE_KERNEL[dy + 2] * DENOISE_KERNEL[dx + 2] * std::exp( -distance );
+                            sum += irradiance[j] * weight;
+                            weight_sum += weight;
+                        }
+                    }
+
+                    // the weight of the pixel itself is never zero
+                    filtered[i] = sum / weight_sum;
+                }
+            }
+        });
+
+        std::swap( irradiance , filtered );
+    }
+
+    parallelRows( h , [&]( int y0 , int y1 ){
+        for( auto y = y0 ; y < y1 ; ++y ){
+            for( auto x = 0 ; x < w ; ++x ){
+                const auto i = y * w + x;
+                image.SetColor( x , y , albedo ? irradiance[i] * albedos[i] : irradiance[i] );
+            }
+        }
+    });
+}
+
+#ifdef SORT_ENABLE_OIDN
+// Copy pixels of a render target to three floats per pixel.
+static std::vector<float> flatten( const RenderTarget& target ){
+    const auto w = target.GetWidth();
+    const auto h = target.GetHeight();
+    std::vector<float> pixels( 3 * w * h );
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto c = target.GetColor( x , y );
+            const auto i = 3 * ( y * w + x );
+            pixels[i] = c.r;
+            pixels[i + 1] = c.g;
+            pixels[i + 2] = c.b;
+        }
+    }
+    return pixels;
+}
+
+static bool denoiseOidn( RenderTarget& image , const RenderTarget* albedo , const RenderTarget* normal ){
+    const auto w = image.GetWidth();
+    const auto h = image.GetHeight();
+    auto color = flatten( image );
+    std::vector<float> output( color.size() );
+    const auto albedos = albedo ? flatten( *albedo ) : std::vector<float>();
+    // the normal is only used along with the albedo
+    const auto normals = albedo && normal ? flatten( *normal ) : std::vector<float>();
+
+    auto device = oidnNewDevice( OIDN_DEVICE_TYPE_CPU );
+#if OIDN_VERSION_MAJOR >= 2
+    oidnSetDeviceInt( device , "numThreads" , (int)g_threadCnt );
+#else
+    oidnSetDevice1i( device , "numThreads" , (int)g_threadCnt );
+#endif
+    oidnCommitDevice( device );
+
+    auto filter = oidnNewFilter( device , "RT" );
+    oidnSetSharedFilterImage( filter , "color" , color.data() , OIDN_FORMAT_FLOAT3 , w , h , 0 , 0 , 0 );
+    oidnSetSharedFilterImage( filter , "output" , output.data() , OIDN_FORMAT_FLOAT3 , w , h , 0 , 0 , 0 );
+    if( !albedos.empty() )
+        oidnSetSharedFilterImage( filter , "albedo" , const_cast<float*>( albedos.data() ) , OIDN_FORMAT_FLOAT3 , w , h , 0 , 0 , 0 );
+    if( !normals.empty() )
+        oidnSetSharedFilterImage( filter , "normal" , const_cast<float*>( normals.data() ) , OIDN_FORMAT_FLOAT3 , w , h , 0 , 0 , 0 );
+#if OIDN_VERSION_MAJOR >= 2
+    oidnSetFilterBool( filter , "hdr" , true );
+#else
+    oidnSetFilter1b( filter , "hdr" , true );
+#endif
+    oidnCommitFilter( filter );
+    oidnExecuteFilter( filter );
+
+    const char* message = nullptr;
+    const auto succeeded = OIDN_ERROR_NONE == oidnGetDeviceError( device , &message );
+    if( !succeeded )
+        slog( WARNING , IMAGE , "Open Image Denoise failed, %s. The built-in denoiser is used instead." , message ? message : "unknown error" );
+
+    oidnReleaseFilter( filter );
+    oidnReleaseDevice( device );
+
+    if( !succeeded )
+        return false;
+
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto i = 3 * ( y * w + x );
+            image.SetColor( x , y , Spectrum( output[i] , output[i + 1] , output[i + 2] ) );
+        }
+    }
+    return true;
+}
+#endif
+
+void Denoise( RenderTarget& image , const RenderTarget* albedo , const RenderTarget* normal ){
+    SORT_PROFILE("Denoise");
+
+#ifdef SORT_ENABLE_OIDN
+    if( denoiseOidn( image , albedo , normal ) )
+        return;
+#endif
+
+    denoiseATrous( image , albedo , normal );
+}
+
+const char* DenoiserName(){
+#ifdef SORT_ENABLE_OIDN
+    return "Open Image Denoise";
+#else
+    return "A-Trous Wavelet Filter";
+#endif
+}
@@ -0,0 +1,37 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "texture/rendertarget.h"
+
+//! @brief  Remove the noise of a rendered image, guided by the albedo and the normal of the surfaces hit by camera rays.
+//!
+//! Intel Open Image Denoise is used if SORT is built with it, it is limited to the same number of threads as rendering.
+//! Otherwise the image is filtered with an edge-avoiding a-trous wavelet filter [Dammertz et al. 2010], rows of the
+//! image are filtered in parallel by tasks if it is called in a task, or by the same number of threads as rendering.
+//! The albedo is divided out of the radiance before filtering, so that textures are not blurred.
+//!
+//! @param  image       The image to be denoised, the denoised pixels are stored in it.
+//! @param  albedo      Albedo of the first surfaces hit by camera rays, nullptr if it is not rendered.
+//! @param  normal      Normal of the first surfaces hit by camera rays, nullptr if it is not rendered.
+void    Denoise( RenderTarget& image , const RenderTarget* albedo , const RenderTarget* normal );
+
+//! @brief  Name of the denoiser used by Denoise.
+//!
+//! @return             Name of the denoiser.
+const char* DenoiserName();
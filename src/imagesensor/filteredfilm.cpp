@@ -0,0 +1,143 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <cmath>
+#include <algorithm>
+#include "filteredfilm.h"
+#include "math/utils.h"
+
+// Weighted radiance and weights of a pixel are added in one SSE register, SSE2 is available on any x86-64 CPU so that
+// it doesn't depend on the SIMD optimization of the accelerators. Other platforms use scalar code.
+#if defined(__SSE2__) || defined(_M_X64)
+#define SORT_SIMD_FILM
+#include <emmintrin.h>
+#endif
+
+static constexpr int MAX_PIXEL_FILTER_REACH = 4;
+
+PixelFilter::PixelFilter( PixelFilterType type , float radius ){
+    m_radius = PixelFilterType::Box == type ? 0.5f : std::min( std::max( radius , 0.5f ) , MAX_PIXEL_FILTER_RADIUS );
+    m_invRadius = 1.0f / m_radius;
+    m_reach = std::min( (int)std::ceil( m_radius - 0.5f ) , MAX_PIXEL_FILTER_REACH );
+
+    // Each entry takes the weight at the center of its interval of distances.
+    for( auto i = 0 ; i < PIXEL_FILTER_TABLE_SIZE ; ++i ){
+        const auto d = ( (float)i + 0.5f ) / PIXEL_FILTER_TABLE_SIZE * m_radius;
+        switch( type ){
+        case PixelFilterType::Gaussian:
+            // shifted down so that it drops to zero at the radius smoothly
+            m_table[i] = std::max( 0.0f , std::exp( -2.0f * d * d ) - std::exp( -2.0f * m_radius * m_radius ) );
+            break;
+        case PixelFilterType::BlackmanHarris:{
+            const auto t = TWO_PI * ( 0.5f + 0.5f * d * m_invRadius );
+            m_table[i] = std::max( 0.0f , 0.35875f - 0.48829f * std::cos( t ) + 0.14128f * std::cos( 2.0f * t ) - 0.01168f * std::cos( 3.0f * t ) );
+            break;
+        }
+        default:
+            m_table[i] = 1.0f;
+            break;
+        }
+    }
+}
+
+FilmTile::FilmTile( const PixelFilter& filter , const Vector2i& topLeft , const Vector2i& size ) : m_filter( filter ){
+    const auto reach = filter.GetReach();
+    m_origin = Vector2i( topLeft.x - reach , topLeft.y - reach );
+    m_size = Vector2i( size.x + 2 * reach , size.y + 2 * reach );
+    m_pixels.resize( 4 * m_size.x * m_size.y , 0.0f );
+}
+
+void FilmTile::AddSample( float x , float y , const Spectrum& radiance ){
+    const auto reach = m_filter.GetReach();
+    const auto px = (int)std::floor( x );
+    const auto py = (int)std::floor( y );
+
+    // The filter is separable, it is only evaluated once per row and column of pixels touched.
+    float wx[2 * MAX_PIXEL_FILTER_REACH + 1] , wy[2 * MAX_PIXEL_FILTER_REACH + 1];
+    for( auto i = -reach ; i <= reach ; ++i ){
+        wx[i + reach] = m_filter.Evaluate( (float)( px + i ) + 0.5f - x );
+        wy[i + reach] = m_filter.Evaluate( (float)( py + i ) + 0.5f - y );
+    }
+
+#ifdef SORT_SIMD_FILM
+    const auto sample = _mm_set_ps( 1.0f , radiance[2] , radiance[1] , radiance[0] );
+#endif
+
+    for( auto j = -reach ; j <= reach ; ++j ){
+        const auto row = py + j - m_origin.y;
+        if( 0.0f == wy[j + reach] || row < 0 || row >= m_size.y )
+            continue;
+        for( auto i = -reach ; i <= reach ; ++i ){
+            const auto col = px + i - m_origin.x;
+            const auto w = wx[i + reach] * wy[j + reach];
+            if( 0.0f == w || col < 0 || col >= m_size.x )
+                continue;
+
+            auto pixel = m_pixels.data() + 4 * ( row * m_size.x + col );
+#ifdef SORT_SIMD_FILM
+            _mm_storeu_ps( pixel , _mm_add_ps( _mm_loadu_ps( pixel ) , _mm_mul_ps( sample , _mm_set1_ps( w ) ) ) );
+#else
+            pixel[0] += radiance[0] * w;
+            pixel[1] += radiance[1] * w;
+            pixel[2] += radiance[2] * w;
+            pixel[3] += w;
+#endif
+        }
+    }
+}
+
+FilteredFilm::FilteredFilm( int w , int h , PixelFilterType type , float radius ) : m_width( w ) , m_height( h ) , m_filter( type , radius ){
+    m_pixels = std::make_unique<std::atomic<float>[]>( 4 * w * h );
+    Clear();
+}
+
+// There is no atomic addition of floats before C++20.
+static SORT_FORCEINLINE void atomicAdd( std::atomic<float>& target , float value ){
+    auto current = target.load( std::memory_order_relaxed );
+    while( !target.compare_exchange_weak( current , current + value , std::memory_order_relaxed ) );
+}
+
+void FilteredFilm::Merge( const FilmTile& tile ){
+    // Only the part of the padded tile inside the image is merged, samples are never filtered outside of it anyway.
+    const auto x0 = std::max( tile.m_origin.x , 0 ) , x1 = std::min( tile.m_origin.x + tile.m_size.x , m_width );
+    const auto y0 = std::max( tile.m_origin.y , 0 ) , y1 = std::min( tile.m_origin.y + tile.m_size.y , m_height );
+    for( auto y = y0 ; y < y1 ; ++y ){
+        for( auto x = x0 ; x < x1 ; ++x ){
+            const auto src = tile.m_pixels.data() + 4 * ( ( y - tile.m_origin.y ) * tile.m_size.x + x - tile.m_origin.x );
+            if( 0.0f == src[3] )
+                continue;
+            const auto dst = m_pixels.get() + 4 * ( y * m_width + x );
+            for( auto c = 0 ; c < 4 ; ++c )
+                atomicAdd( dst[c] , src[c] );
+        }
+    }
+}
+
+Spectrum FilteredFilm::Resolve( int x , int y ) const{
+    const auto pixel = m_pixels.get() + 4 * ( y * m_width + x );
+    const auto w = pixel[3].load( std::memory_order_relaxed );
+    if( w <= 0.0f )
+        return Spectrum( 0.0f );
+    const auto inv_w = 1.0f / w;
+    return Spectrum( pixel[0].load( std::memory_order_relaxed ) * inv_w , pixel[1].load( std::memory_order_relaxed ) * inv_w , pixel[2].load( std::memory_order_relaxed ) * inv_w );
+}
+
+void FilteredFilm::Clear(){
+    for( auto i = 0 ; i < 4 * m_width * m_height ; ++i )
+        m_pixels[i].store( 0.0f , std::memory_order_relaxed );
+}
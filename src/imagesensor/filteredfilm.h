@@ -0,0 +1,162 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+#include <cmath>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include "core/define.h"
+#include "math/vector2.h"
+#include "spectrum/spectrum.h"
+
+//! @brief  Reconstruction filter weighting camera samples into the pixels around them.
+enum class PixelFilterType : int {
+    Box = 0,        /**< Samples only count in their own pixel, with the same weight. */
+    Gaussian,       /**< Truncated gaussian, smooth but slightly blurry. */
+    BlackmanHarris, /**< Blackman-Harris window, sharper than the gaussian with little ringing. */
+};
+
+//! @brief  Number of entries in the precomputed table of a pixel filter.
+static constexpr int PIXEL_FILTER_TABLE_SIZE = 64;
+
+//! @brief  Pixels further than this from a sample never take it, wider filters are clamped.
+static constexpr float MAX_PIXEL_FILTER_RADIUS = 4.0f;
+
+//! @brief  PixelFilter weights a camera sample in the pixels around it.
+//!
+//! Filters are separable, the weight of a pixel is the product of the weights of its horizontal and vertical
+//! distances to the sample. The one dimensional filter is evaluated only once in a table, looking it up is much
+//! cheaper than evaluating exponentials or cosines twice for each pixel touched by each sample.
+class PixelFilter{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  type        Type of the filter.
+    //! @param  radius      Radius of the filter in pixels, the box filter is always half a pixel wide.
+    PixelFilter( PixelFilterType type , float radius );
+
+    //! @brief  Weight of a sample at a distance from the center of a pixel along one axis.
+    //!
+    //! @param  d           Distance in pixels.
+    //! @return             Weight of the sample, 0 outside the filter.
+    SORT_FORCEINLINE float  Evaluate( float d ) const {
+        d = std::abs( d );
+        if( d >= m_radius )
+            return 0.0f;
+        return m_table[std::min( (int)( d * m_invRadius * PIXEL_FILTER_TABLE_SIZE ) , PIXEL_FILTER_TABLE_SIZE - 1 )];
+    }
+
+    //! @brief  Radius of the filter.
+    //!
+    //! @return             Radius of the filter in pixels.
+    SORT_FORCEINLINE float  GetRadius() const {
+        return m_radius;
+    }
+
+    //! @brief  Number of pixels next to the one a sample falls in that could take the sample, along each axis.
+    //!
+    //! @return             0 for the box filter, which only touches the pixel of the sample.
+    SORT_FORCEINLINE int    GetReach() const {
+        return m_reach;
+    }
+
+private:
+    float   m_radius;
+    float   m_invRadius;
+    int     m_reach;
+    float   m_table[PIXEL_FILTER_TABLE_SIZE];
+};
+
+//! @brief  FilmTile accumulates the filtered samples of a render task locally.
+//!
+//! It covers the tile of the task padded by the reach of the filter, so that samples close to the edge of the tile
+//! are splatted to pixels of the neighbor tiles without touching any shared memory. Each pixel keeps the weighted
+//! radiance and the sum of weights next to each other, so that a sample is added to a pixel in one 4-wide vector
+//! operation. The tile is merged into the film once the task is done.
+class FilmTile{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  filter      Filter of the film.
+    //! @param  topLeft     Top-left corner of the tile in the image.
+    //! @param  size        Size of the tile.
+    FilmTile( const PixelFilter& filter , const Vector2i& topLeft , const Vector2i& size );
+
+    //! @brief  Splat a sample to the pixels around it.
+    //!
+    //! @param  x           Horizontal position of the sample in the image, in pixels.
+    //! @param  y           Vertical position of the sample in the image, in pixels.
+    //! @param  radiance    Radiance of the sample.
+    void        AddSample( float x , float y , const Spectrum& radiance );
+
+private:
+    const PixelFilter&  m_filter;
+    Vector2i            m_origin;   /**< Top-left corner of the padded tile in the image, it could be negative. */
+    Vector2i            m_size;     /**< Size of the padded tile. */
+    std::vector<float>  m_pixels;   /**< Weighted red, green, blue and the sum of weights of each pixel. */
+
+    friend class FilteredFilm;
+};
+
+//! @brief  FilteredFilm reconstructs the image from camera samples weighted by a pixel filter.
+//!
+//! Samples of each render task are filtered in its own FilmTile, pixels close to the border of a tile take samples
+//! of the tasks of all neighbor tiles though, and tasks split from each other share a tile as well. So tiles are
+//! merged with atomic additions instead of locks, each pixel is only contended by the few tasks next to it.
+//! Pixels are resolved by dividing the weighted radiance by the sum of weights.
+class FilteredFilm{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w           Width of the image.
+    //! @param  h           Height of the image.
+    //! @param  type        Type of the filter.
+    //! @param  radius      Radius of the filter in pixels.
+    FilteredFilm( int w , int h , PixelFilterType type , float radius );
+
+    //! @brief  Get the pixel filter.
+    //!
+    //! @return             Filter weighting the samples.
+    SORT_FORCEINLINE const PixelFilter& GetFilter() const {
+        return m_filter;
+    }
+
+    //! @brief  Add the samples filtered in a tile, it could be called from any worker thread.
+    //!
+    //! @param  tile        Tile filtered by a render task.
+    void        Merge( const FilmTile& tile );
+
+    //! @brief  Get the filtered radiance of a pixel.
+    //!
+    //! @param  x           X coordinate of the pixel.
+    //! @param  y           Y coordinate of the pixel.
+    //! @return             Radiance of the pixel, black if no sample touches it.
+    Spectrum    Resolve( int x , int y ) const;
+
+    //! @brief  Clear all samples, it should not be called while tiles are merged.
+    void        Clear();
+
+private:
+    const int   m_width;
+    const int   m_height;
+    PixelFilter m_filter;
+    std::unique_ptr<std::atomic<float>[]>   m_pixels;   /**< Weighted red, green, blue and the sum of weights of each pixel. */
+};
@@ -0,0 +1,48 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <mutex>
+#include <chrono>
+#include <future>
+#include <vector>
+#include <algorithm>
+#include "imageoutput.h"
+
+static std::mutex                       g_outputMutex;
+static std::vector<std::future<void>>   g_outputs;
+
+void WriteImageAsync( std::function<void()> write ){
+    std::lock_guard<std::mutex> lock( g_outputMutex );
+
+    // finished outputs don't need to be waited for
+    g_outputs.erase( std::remove_if( g_outputs.begin() , g_outputs.end() , []( const std::future<void>& output ){
+        return output.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+    } ) , g_outputs.end() );
+
+    g_outputs.push_back( std::async( std::launch::async , std::move( write ) ) );
+}
+
+void WaitForImageOutputs(){
+    std::vector<std::future<void>> outputs;
+    {
+        std::lock_guard<std::mutex> lock( g_outputMutex );
+        outputs.swap( g_outputs );
+    }
+    for( auto& output : outputs )
+        output.get();
+}
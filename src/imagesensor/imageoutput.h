@@ -0,0 +1,35 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+#include <functional>
+
+//! @brief  Run a function writing an image file on a background thread.
+//!
+//! Encoding a large image takes a while, it doesn't need to hold back tearing down, flushing stats or rendering the
+//! next frame of a sequence. Each image is written on its own thread, so images of consecutive frames or views are
+//! encoded concurrently. The function should only touch data owned by itself.
+//!
+//! @param  write       The function writing the image.
+void    WriteImageAsync( std::function<void()> write );
+
+//! @brief  Wait for all images being written in the background.
+//!
+//! It needs to be called before the process exits, or before anything reads the written files.
+void    WaitForImageOutputs();
@@ -0,0 +1,125 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstdio>
+#include "imagesensor.h"
+#include "core/globalconfig.h"
+#include "core/path.h"
+#include "denoiser.h"
+
+// Checkpoints are saved in the resource folder, next to the cached spatial accelerators of the same scene.
+static const char* CHECKPOINT_FILE = "render.checkpoint";
+
+ImageSensor::ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h , g_renderTargetFormat ) , m_splats( w , h , g_threadCnt , g_deterministic ) {
+    for( auto i = 0 ; i < AOV_CNT ; ++i ){
+        if( g_aovMask & ( 1u << i ) ){
+            m_aovs[i] = std::make_unique<RenderTarget>( w , h , g_renderTargetFormat );
+            m_hasAovs = true;
+        }
+    }
+
+    // Checkpoints only save the resolved pixels and distributed rendering only sends them, the film is also summed in
+    // a different order from run to run, so they all fall back to the box filter.
+    if( PixelFilterType::Box != g_pixelFilter ){
+        if( g_checkpointInterval > 0 || g_resumeEnabled || g_deterministic || g_coordinatorPort > 0 || !g_coordinatorAddress.empty() )
+            slog( WARNING , IMAGE , "The pixel filter is not supported with checkpoints, deterministic or distributed rendering, the box filter is used." );
+        else
+            m_film = std::make_unique<FilteredFilm>( w , h , g_pixelFilter , g_filterRadius );
+    }
+
+    if( 0 == g_checkpointInterval && !g_resumeEnabled )
+        return;
+
+    if( IS_PTR_INVALID(g_integrator) || !g_integrator->SupportCheckpoint() ){
+        slog( WARNING , IMAGE , "Checkpoints are not supported by the integrator, rendering can't be resumed." );
+        return;
+    }
+
+    m_checkpoint = std::make_unique<Checkpoint>( w , h , (int)g_tileSize , g_samplePerPixel );
+    if( g_resumeEnabled )
+        m_checkpoint->Load( GetFilePathInResourceFolder( CHECKPOINT_FILE ) , m_rendertarget );
+}
+
+void ImageSensor::StoreAovs( const Render_Task& rt , const AovSample* aovs ){
+    const auto offset = (float)rt.GetSampleOffset();
+    const auto weight = (float)rt.GetSampleCnt() / ( offset + (float)rt.GetSampleCnt() );
+    for( auto i = 0 ; i < AOV_CNT ; ++i ){
+        auto& target = m_aovs[i];
+        if( !target )
+            continue;
+
+        for( auto p = rt.GetPixelBegin() ; p < rt.GetPixelEnd() ; ++p ){
+            const auto coord = rt.GetPixelCoord( p );
+            const auto& value = aovs[p - rt.GetPixelBegin()].values[i];
+            target->SetColor( coord.x , coord.y , offset > 0.0f ? target->GetColor( coord.x , coord.y ) * ( 1.0f - weight ) + value * weight : value );
+        }
+    }
+}
+
+void ImageSensor::ResolveFilm(){
+    if( !m_film )
+        return;
+    for( auto y = 0 ; y < m_height ; ++y )
+        for( auto x = 0 ; x < m_width ; ++x )
+            m_rendertarget.SetColor( x , y , m_film->Resolve( x , y ) );
+}
+
+void ImageSensor::OnTileFinished( const Render_Task& rt ){
+    if( m_checkpoint ){
+        m_checkpoint->StoreTile( m_rendertarget , rt.GetTopLeft() , rt.GetSampleOffset() + rt.GetSampleCnt() );
+        if( g_checkpointInterval > 0 )
+            m_checkpoint->SaveIfDue( GetFilePathInResourceFolder( CHECKPOINT_FILE ) , g_checkpointInterval );
+    }
+
+    const auto interval = g_splatRefreshInterval;
+    if( 0 == interval || 0 != ++m_finishedTileCnt % interval )
+        return;
+
+    // Skip it if the previous refresh is not done yet, there is no point waiting for it.
+    std::unique_lock<std::mutex> lock( m_refreshMutex , std::try_to_lock );
+    if( lock.owns_lock() && !m_splats.IsEmpty() )
+        RefreshSplats();
+}
+
+void ImageSensor::PostProcess(){
+    // There is no need to resume a rendering that is done, otherwise the rendered tiles are kept for resuming it.
+    if( m_checkpoint ){
+        const auto filename = GetFilePathInResourceFolder( CHECKPOINT_FILE );
+        if( m_checkpoint->IsComplete() )
+            std::remove( filename.c_str() );
+        else if( g_checkpointInterval > 0 )
+            m_checkpoint->Save( filename );
+    }
+
+    ResolveFilm();
+
+    if( !m_splats.IsEmpty() ){
+        for( auto y = 0 ; y < m_height ; ++y )
+            for( auto x = 0 ; x < m_width ; ++x )
+                m_rendertarget.SetColor( x , y , m_rendertarget.GetColor( x , y ) + m_splats.Get( x , y ) );
+        m_splats.Clear();
+    }
+
+    if( g_denoise ){
+        slog( INFO , IMAGE , "Denoising the image with %s." , DenoiserName() );
+        denoise( m_rendertarget );
+    }
+}
+
+void ImageSensor::denoise( RenderTarget& image ) const{
+    Denoise( image , m_aovs[AOV_ALBEDO].get() , m_aovs[AOV_NORMAL].get() );
+}
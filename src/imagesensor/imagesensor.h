@@ -20,15 +20,24 @@
 #include "spectrum/spectrum.h"
 #include "texture/rendertarget.h"
 #include "task/render_task.h"
-#include "core/thread.h"
+#include "splatbuffer.h"
+#include "checkpoint.h"
+#include "aov.h"
+#include "filteredfilm.h"
 #include <mutex>
+#include <atomic>
 
 // generate output
+//
+// Each pixel is rendered by exactly one render task, which accumulates its pixels locally and stores them all at once
+// without any lock. Only splatting integrators, like light tracing, touch pixels of other tiles. Their radiance goes to
+// per-thread splat buffers, which are reduced in post process, or every few tiles for progressive display if required.
+// Finished tiles could be saved to a checkpoint as well, so that preempted rendering could be resumed later.
+// With a reconstruction filter other than the box, samples are splatted to the pixels around them in a filtered film,
+// each task only resolves its own pixels once it is done, the whole film is resolved after each pass and at the end.
 class ImageSensor{
 public:
-    ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h ) {
-        m_mutex = std::make_unique<spinlock_mutex[]>( m_width * m_height );
-    }
+    ImageSensor( int w , int h );
     virtual ~ImageSensor(){}
 
     // pre process
@@ -37,8 +46,73 @@ public:
     // finish image tile
     virtual void FinishTile( int tile_x , int tile_y , const Render_Task& rt ){}
 
-    // store pixel information
-    virtual void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) = 0;
+    // store pixels rendered by a render task, radiance[k] is the radiance of pixel 'rt.GetPixelBegin() + k'
+    // in progressive rendering, it is averaged with the radiance of the previous passes
+    // only the rendered pixels are stored in a quick preview pass
+    // with a filtered film, the pixels are resolved from the film instead, except in a quick preview pass
+    virtual void StoreTile( const Render_Task& rt , const Spectrum* radiance ){
+        if( m_film && 1 == rt.GetPreviewBlock() ){
+            for( auto p = rt.GetPixelBegin() ; p < rt.GetPixelEnd() ; ++p ){
+                const auto coord = rt.GetPixelCoord( p );
+                m_rendertarget.SetColor( coord.x , coord.y , m_film->Resolve( coord.x , coord.y ) );
+            }
+            return;
+        }
+
+        const auto offset = (float)rt.GetSampleOffset();
+        const auto weight = (float)rt.GetSampleCnt() / ( offset + (float)rt.GetSampleCnt() );
+        for( auto p = rt.GetPixelBegin() ; p < rt.GetPixelEnd() ; ++p ){
+            const auto coord = rt.GetPixelCoord( p );
+            if( !rt.IsPreviewPixel( coord ) )
+                continue;
+            const auto& color = radiance[p - rt.GetPixelBegin()];
+            m_rendertarget.SetColor( coord.x , coord.y , offset > 0.0f ? m_rendertarget.GetColor( coord.x , coord.y ) * ( 1.0f - weight ) + color * weight : color );
+        }
+    }
+
+    // store aovs of pixels rendered by a render task, aovs[k] is the aovs of pixel 'rt.GetPixelBegin() + k'
+    // they are averaged with the previous passes in progressive rendering, the same as the radiance
+    void StoreAovs( const Render_Task& rt , const AovSample* aovs );
+
+    // whether any aov is enabled
+    SORT_FORCEINLINE bool HasAovs() const {
+        return m_hasAovs;
+    }
+
+    // store pixels of a tile rendered by another node in distributed rendering, radiance is row by row
+    void StoreRemoteTile( const Vector2i& topLeft , const Vector2i& size , const Spectrum* radiance ){
+        for( auto y = 0 ; y < size.y ; ++y )
+            for( auto x = 0 ; x < size.x ; ++x )
+                m_rendertarget.SetColor( topLeft.x + x , topLeft.y + y , radiance[y * size.x + x] );
+    }
+
+    // get the filtered film, nullptr if samples are only reconstructed with the box filter
+    SORT_FORCEINLINE FilteredFilm* GetFilm() const {
+        return m_film.get();
+    }
+
+    // resolve all pixels of the filtered film, pixels taking samples of tasks finished after their own are updated
+    void ResolveFilm();
+
+    // get the render target, pixels of tiles not rendered yet are undefined
+    SORT_FORCEINLINE const RenderTarget& GetRenderTarget() const {
+        return m_rendertarget;
+    }
+
+    // a pass of progressive rendering is done, progress is between 0 and 1
+    virtual void FinishPass( float progress ) {}
+
+    // a quick preview pass is done, only the top-left pixel of each block of pixels is rendered
+    virtual void FinishPreviewPass( int block ) {}
+
+    // all pixels of a tile are rendered, splatted radiance is refreshed every few tiles and the checkpoint is saved
+    // every few seconds if required
+    void OnTileFinished( const Render_Task& rt );
+
+    // number of samples taken in each pixel of a tile before resuming rendering, 0 if it is not in the checkpoint
+    SORT_FORCEINLINE unsigned GetTileSamples( const Vector2i& topLeft ) const {
+        return m_checkpoint ? m_checkpoint->GetTileSamples( topLeft ) : 0;
+    }
 
     // get width
     SORT_FORCEINLINE int GetWidth() const {
@@ -50,23 +124,41 @@ public:
         return m_height;
     }
 
-    // post process
-    virtual void PostProcess(){}
+    // post process, splatted radiance is merged into the render target, which is denoised then if required
+    virtual void PostProcess();
 
-    // add radiance
-    virtual void UpdatePixel(int x, int y, const Spectrum& color){
-        std::lock_guard<spinlock_mutex> lock(m_mutex[y * m_width + x]);
-        Spectrum _color = m_rendertarget.GetColor(x, y);
-        m_rendertarget.SetColor(x, y, _color + color);
+    // splat radiance to a pixel, it could be called from any worker thread
+    SORT_FORCEINLINE void UpdatePixel(int x, int y, const Spectrum& color){
+        m_splats.Splat( x , y , color );
     }
 
 protected:
     const int m_width;
     const int m_height;
 
-    // the mutex
-    std::unique_ptr<spinlock_mutex[]>   m_mutex;
-
     // the render target
     RenderTarget m_rendertarget;
-};
+
+    // radiance splatted by splatting integrators
+    SplatBuffer  m_splats;
+
+    // render targets of aovs, nullptr for the ones not enabled
+    std::unique_ptr<RenderTarget> m_aovs[AOV_CNT];
+    bool         m_hasAovs = false;
+
+    // samples weighted by the reconstruction filter, nullptr for the box filter
+    std::unique_ptr<FilteredFilm> m_film;
+
+    // display splatted radiance reduced so far, it is never called by more than one thread at a time
+    virtual void RefreshSplats() {}
+
+    // remove the noise of an image of the same size, guided by the albedo and normal aovs
+    void denoise( RenderTarget& image ) const;
+
+private:
+    std::atomic<unsigned>   m_finishedTileCnt = { 0 };
+    std::mutex              m_refreshMutex;
+
+    // rendered tiles to be saved, nullptr if checkpoints are disabled
+    std::unique_ptr<Checkpoint> m_checkpoint;
+};
\ No newline at end of file
@@ -15,17 +15,76 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <stdlib.h>
+#include <array>
 #include "rendertargetimage.h"
+#include "imageoutput.h"
 #include "core/globalconfig.h"
 #include "core/path.h"
+#include "core/log.h"
+#include "aov.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
 
-void RenderTargetImage::StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ){
-    std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width + x]);
-    Spectrum _color = m_rendertarget.GetColor(x, y);
-    m_rendertarget.SetColor(x, y, color + _color);
+// Pixels outside the render region are taken from the existing output file, so that touching up a region of an image
+// doesn't lose the rest of it. Nothing is composited if the file doesn't exist or has a different resolution.
+static void compositeOutsideRegion( const std::string& filename , RenderTarget& rt ){
+    // the file could still be being written, like by the last frame of a sequence
+    WaitForImageOutputs();
+
+    float* rgba = nullptr;
+    int width = 0 , height = 0;
+    if( TINYEXR_SUCCESS != LoadEXR( &rgba , &width , &height , filename.c_str() , nullptr ) )
+        return;
+
+    if( width == rt.GetWidth() && height == rt.GetHeight() ){
+        const auto region_min = g_renderRegionMin;
+        const auto region_max = g_renderRegionMax;
+        for( auto y = 0 ; y < height ; ++y ){
+            for( auto x = 0 ; x < width ; ++x ){
+                if( x >= region_min.x && x < region_max.x && y >= region_min.y && y < region_max.y )
+                    continue;
+                const auto pixel = rgba + 4 * ( y * width + x );
+                rt.SetColor( x , y , Spectrum( pixel[0] , pixel[1] , pixel[2] ) );
+            }
+        }
+        slog( INFO , IMAGE , "Pixels outside the render region are composited from %s." , filename.c_str() );
+    }else{
+        slog( WARNING , IMAGE , "Resolution of %s doesn't match, pixels outside the render region are not composited." , filename.c_str() );
+    }
+    free( rgba );
+}
+
+// Pixels are copied for the image to be written in the background, the image sensor could be reused in the meantime.
+static std::shared_ptr<RenderTarget> copyRenderTarget( const RenderTarget& rt ){
+    auto copy = std::make_shared<RenderTarget>( rt.GetWidth() , rt.GetHeight() );
+    for( auto y = 0 ; y < rt.GetHeight() ; ++y ){
+        for( auto x = 0 ; x < rt.GetWidth() ; ++x )
+            copy->SetColor( x , y , rt.GetColor( x , y ) );
+    }
+    return copy;
 }
 
 void RenderTargetImage::PostProcess(){
     ImageSensor::PostProcess();
-    m_rendertarget.Output(GetFilePathInExeFolder(g_outputFileName));
+    const auto filename = GetFilePathInExeFolder(g_outputFileName);
+    if( g_hasRenderRegion )
+        compositeOutsideRegion( filename , m_rendertarget );
+
+    const auto radiance = copyRenderTarget( m_rendertarget );
+    if( !m_hasAovs ){
+        WriteImageAsync( [filename, radiance](){ radiance->Output( filename ); } );
+        return;
+    }
+
+    std::array<std::shared_ptr<RenderTarget>, AOV_CNT> aovs;
+    for( auto i = 0 ; i < AOV_CNT ; ++i ){
+        if( m_aovs[i] )
+            aovs[i] = copyRenderTarget( *m_aovs[i] );
+    }
+    WriteImageAsync( [filename, radiance, aovs](){
+        const RenderTarget* layers[AOV_CNT];
+        for( auto i = 0 ; i < AOV_CNT ; ++i )
+            layers[i] = aovs[i].get();
+        OutputAovLayers( filename , *radiance , layers );
+    } );
 }
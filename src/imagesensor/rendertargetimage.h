@@ -25,9 +25,6 @@ public:
     // constructor
     RenderTargetImage( int w , int h ):ImageSensor(w,h){}
 
-    // store pixel information
-    void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) override;
-
     // post process
     void PostProcess() override;
 };
@@ -0,0 +1,142 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include "splatbuffer.h"
+#include "core/thread.h"
+#include "core/sassert.h"
+
+SORT_STATS_DEFINE_MEMORY(sSplatMemory)
+
+SORT_STATS_MEMORY("Splat Buffers", sSplatMemory);
+
+// Radiance in fixed point, rounded to the nearest.
+static const double SPLAT_FIXED_POINT_SCALE = (double)( 1ll << SPLAT_FIXED_POINT_BITS );
+
+SplatBuffer::SplatBuffer( int w , int h , unsigned threadCnt , bool fixedPoint ) :
+    m_blockCntX( ( w + SPLAT_BLOCK_SIZE - 1 ) / SPLAT_BLOCK_SIZE ) , m_blockCntY( ( h + SPLAT_BLOCK_SIZE - 1 ) / SPLAT_BLOCK_SIZE ) ,
+    m_threadCnt( std::max( threadCnt , 1u ) ) , m_fixedPoint( fixedPoint ){
+    m_threads = std::make_unique<ThreadBuffer[]>( m_threadCnt );
+    for( auto t = 0u ; t < m_threadCnt ; ++t ){
+        auto& buffer = m_threads[t];
+        if( m_fixedPoint ){
+            buffer.m_fixedBlocks = std::make_unique<std::atomic<FixedBlock*>[]>( m_blockCntX * m_blockCntY );
+            for( auto i = 0 ; i < m_blockCntX * m_blockCntY ; ++i )
+                buffer.m_fixedBlocks[i].store( nullptr , std::memory_order_relaxed );
+        }else{
+            buffer.m_blocks = std::make_unique<std::atomic<Block*>[]>( m_blockCntX * m_blockCntY );
+            for( auto i = 0 ; i < m_blockCntX * m_blockCntY ; ++i )
+                buffer.m_blocks[i].store( nullptr , std::memory_order_relaxed );
+        }
+    }
+}
+
+SplatBuffer::~SplatBuffer(){
+    Clear();
+}
+
+template<class T>
+SplatBuffer::BlockT<T>* SplatBuffer::acquireBlock( ThreadBuffer& buffer , std::unique_ptr<std::atomic<BlockT<T>*>[]>& blocks , int index ){
+    auto& block_ptr = blocks[index];
+
+    // Only the owner thread allocates its blocks, the block is published to threads reducing the buffers.
+    auto block = block_ptr.load( std::memory_order_relaxed );
+    if( !block ){
+        block = new BlockT<T>();
+        for( auto& c : block->m_radiance )
+            c.store( T( 0 ) , std::memory_order_relaxed );
+        block_ptr.store( block , std::memory_order_release );
+
+        const auto block_cnt = buffer.m_blockCnt.fetch_add( 1 , std::memory_order_relaxed ) + 1;
+        SORT_STATS(buffer.m_memoryRecord.Track(&sSplatMemory, (StatsInt)(sizeof(BlockT<T>) * block_cnt)));
+    }
+    return block;
+}
+
+void SplatBuffer::Splat( int x , int y , const Spectrum& radiance ){
+    const auto tid = (unsigned)ThreadId();
+    sAssertMsg( tid < m_threadCnt , GENERAL , "Splatting from an unknown worker thread %d." , tid );
+
+    auto& buffer = m_threads[tid];
+    const auto index = ( y / SPLAT_BLOCK_SIZE ) * m_blockCntX + x / SPLAT_BLOCK_SIZE;
+
+    // There is no other writer, it doesn't need an atomic read-modify-write operation.
+    const auto offset = 3 * ( ( y % SPLAT_BLOCK_SIZE ) * SPLAT_BLOCK_SIZE + x % SPLAT_BLOCK_SIZE );
+    if( m_fixedPoint ){
+        auto block = acquireBlock( buffer , buffer.m_fixedBlocks , index );
+        for( auto i = 0 ; i < 3 ; ++i ){
+            auto& c = block->m_radiance[offset + i];
+            c.store( c.load( std::memory_order_relaxed ) + llround( (double)radiance[i] * SPLAT_FIXED_POINT_SCALE ) , std::memory_order_relaxed );
+        }
+    }else{
+        auto block = acquireBlock( buffer , buffer.m_blocks , index );
+        for( auto i = 0 ; i < 3 ; ++i ){
+            auto& c = block->m_radiance[offset + i];
+            c.store( c.load( std::memory_order_relaxed ) + radiance[i] , std::memory_order_relaxed );
+        }
+    }
+}
+
+Spectrum SplatBuffer::Get( int x , int y ) const{
+    const auto index = ( y / SPLAT_BLOCK_SIZE ) * m_blockCntX + x / SPLAT_BLOCK_SIZE;
+    const auto offset = 3 * ( ( y % SPLAT_BLOCK_SIZE ) * SPLAT_BLOCK_SIZE + x % SPLAT_BLOCK_SIZE );
+
+    // integers are added up to the same result in any order.
+    if( m_fixedPoint ){
+        long long fixed[3] = { 0 , 0 , 0 };
+        for( auto t = 0u ; t < m_threadCnt ; ++t ){
+            const auto block = m_threads[t].m_fixedBlocks[index].load( std::memory_order_acquire );
+            if( !block )
+                continue;
+            for( auto i = 0 ; i < 3 ; ++i )
+                fixed[i] += block->m_radiance[offset + i].load( std::memory_order_relaxed );
+        }
+        return Spectrum( (float)( fixed[0] / SPLAT_FIXED_POINT_SCALE ) , (float)( fixed[1] / SPLAT_FIXED_POINT_SCALE ) , (float)( fixed[2] / SPLAT_FIXED_POINT_SCALE ) );
+    }
+
+    float radiance[3] = { 0.0f , 0.0f , 0.0f };
+    for( auto t = 0u ; t < m_threadCnt ; ++t ){
+        const auto block = m_threads[t].m_blocks[index].load( std::memory_order_acquire );
+        if( !block )
+            continue;
+        for( auto i = 0 ; i < 3 ; ++i )
+            radiance[i] += block->m_radiance[offset + i].load( std::memory_order_relaxed );
+    }
+    return Spectrum( radiance[0] , radiance[1] , radiance[2] );
+}
+
+bool SplatBuffer::IsEmpty() const{
+    for( auto t = 0u ; t < m_threadCnt ; ++t ){
+        if( m_threads[t].m_blockCnt.load( std::memory_order_relaxed ) > 0 )
+            return false;
+    }
+    return true;
+}
+
+void SplatBuffer::Clear(){
+    for( auto t = 0u ; t < m_threadCnt ; ++t ){
+        auto& buffer = m_threads[t];
+        for( auto i = 0 ; i < m_blockCntX * m_blockCntY ; ++i ){
+            if( m_fixedPoint )
+                delete buffer.m_fixedBlocks[i].exchange( nullptr );
+            else
+                delete buffer.m_blocks[i].exchange( nullptr );
+        }
+        buffer.m_blockCnt = 0;
+        SORT_STATS(buffer.m_memoryRecord.Release());
+    }
+}
@@ -0,0 +1,108 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "spectrum/spectrum.h"
+#include "core/stats.h"
+
+//! @brief  Pixels of a splat buffer are allocated in square blocks of this size.
+static constexpr int SPLAT_BLOCK_SIZE = 16;
+
+//! @brief  Splatted radiance is accumulated in fixed point with this many fractional bits if it needs to be deterministic.
+//!
+//! The resolution is around 1.5e-11 while a pixel could still accumulate radiance up to 1.3e8.
+static constexpr int SPLAT_FIXED_POINT_BITS = 36;
+
+//! @brief  SplatBuffer accumulates radiance splatted by splatting integrators, like light tracing.
+//!
+//! Each worker thread splats into its own buffer, so that there is no contention at all even if lots of light
+//! paths hit the same bright region. Buffers are split in blocks of pixels, which are only allocated once a
+//! thread splats in them, so the memory cost stays low with lots of threads. Only the owner thread writes its
+//! buffer, while any thread could reduce all buffers at any time, for progressive display for example.
+//!
+//! Which thread splats what depends on how tasks are scheduled, so the sum of floats is different from run to run.
+//! A buffer in fixed point is reduced to exactly the same result however splats are distributed among threads.
+class SplatBuffer{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w           Width of the image.
+    //! @param  h           Height of the image.
+    //! @param  threadCnt   Number of worker threads splatting, including the main thread.
+    //! @param  fixedPoint  Whether radiance is accumulated in fixed point so that the result is deterministic.
+    SplatBuffer( int w , int h , unsigned threadCnt , bool fixedPoint = false );
+
+    //! @brief  Destructor releasing all blocks.
+    ~SplatBuffer();
+
+    //! @brief  Splat radiance to a pixel in the buffer of the current worker thread.
+    //!
+    //! @param  x           X coordinate of the pixel.
+    //! @param  y           Y coordinate of the pixel.
+    //! @param  radiance    Radiance to be accumulated.
+    void        Splat( int x , int y , const Spectrum& radiance );
+
+    //! @brief  Get the radiance splatted to a pixel by all threads so far.
+    //!
+    //! @param  x           X coordinate of the pixel.
+    //! @param  y           Y coordinate of the pixel.
+    //! @return             Sum of the radiance splatted by all threads.
+    Spectrum    Get( int x , int y ) const;
+
+    //! @brief  Whether nothing has been splatted yet.
+    //!
+    //! @return             True if no thread has splatted any radiance.
+    bool        IsEmpty() const;
+
+    //! @brief  Release all blocks, it should not be called while other threads are splatting.
+    void        Clear();
+
+private:
+    //! @brief  Radiance of a block of pixels, three channels per pixel, in floats or fixed point.
+    template<class T>
+    struct BlockT{
+        std::atomic<T>  m_radiance[SPLAT_BLOCK_SIZE * SPLAT_BLOCK_SIZE * 3];
+    };
+    using Block = BlockT<float>;
+    using FixedBlock = BlockT<long long>;
+
+    //! @brief  Blocks splatted by a worker thread.
+    struct ThreadBuffer{
+        std::unique_ptr<std::atomic<Block*>[]>      m_blocks;           /**< Blocks of the image, nullptr until splatted. */
+        std::unique_ptr<std::atomic<FixedBlock*>[]> m_fixedBlocks;      /**< Blocks in fixed point, only used in fixed point. */
+        std::atomic<int>                            m_blockCnt = { 0 }; /**< Number of blocks allocated. */
+        SORT_STATS_MEMORY_RECORD(m_memoryRecord)                        /**< Memory of the blocks accounted in stats. */
+    };
+
+    const int                           m_blockCntX;        /**< Number of blocks in a row. */
+    const int                           m_blockCntY;        /**< Number of blocks in a column. */
+    const unsigned                      m_threadCnt;        /**< Number of worker threads. */
+    const bool                          m_fixedPoint;       /**< Whether radiance is accumulated in fixed point. */
+    std::unique_ptr<ThreadBuffer[]>     m_threads;          /**< Buffers of all worker threads. */
+
+    //! @brief  Get a block of the current thread, allocating it if it is not splatted yet.
+    //!
+    //! @param  buffer      Buffer of the current thread.
+    //! @param  blocks      Blocks of the buffer, either in floats or in fixed point.
+    //! @param  index       Index of the block.
+    //! @return             The block.
+    template<class T>
+    BlockT<T>*  acquireBlock( ThreadBuffer& buffer , std::unique_ptr<std::atomic<BlockT<T>*>[]>& blocks , int index );
+};
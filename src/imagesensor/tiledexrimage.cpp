@@ -0,0 +1,73 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "tiledexrimage.h"
+#include "core/globalconfig.h"
+#include "core/path.h"
+
+void TiledExrImage::PreProcess(){
+    const auto tile_size = (int)g_tileSize;
+    m_tileCntX = ( m_width + tile_size - 1 ) / tile_size;
+    m_tileWritten.assign( m_tileCntX * ( ( m_height + tile_size - 1 ) / tile_size ) , 0 );
+    m_writer = std::make_unique<TiledExrWriter>( GetFilePathInExeFolder(g_outputFileName) , m_width , m_height , tile_size );
+
+    if( m_hasAovs )
+        slog( WARNING , IMAGE , "AOVs are not saved in tiled EXR files." );
+}
+
+void TiledExrImage::writeTile( const Vector2i& topLeft ){
+    const auto tile_size = (int)g_tileSize;
+    const auto w = std::min( tile_size , m_width - topLeft.x );
+    const auto h = std::min( tile_size , m_height - topLeft.y );
+
+    std::vector<Spectrum> radiance( w * h );
+    for( auto y = 0 ; y < h ; ++y )
+        for( auto x = 0 ; x < w ; ++x )
+            radiance[y * w + x] = m_rendertarget.GetColor( topLeft.x + x , topLeft.y + y );
+    m_writer->WriteTile( topLeft , std::move( radiance ) );
+
+    m_tileWritten[topLeft.y / tile_size * m_tileCntX + topLeft.x / tile_size] = 1;
+}
+
+void TiledExrImage::FinishTile( int tile_x , int tile_y , const Render_Task& rt ){
+    writeTile( rt.GetTopLeft() );
+}
+
+void TiledExrImage::FinishPass( float progress ){
+    const auto tile_size = (int)g_tileSize;
+    for( auto y = 0 ; y < m_height ; y += tile_size )
+        for( auto x = 0 ; x < m_width ; x += tile_size )
+            writeTile( Vector2i( x , y ) );
+}
+
+void TiledExrImage::PostProcess(){
+    const auto changed = !m_splats.IsEmpty() || g_denoise || m_film;
+    ImageSensor::PostProcess();
+
+    // Tiles not finished by render tasks, like the ones rendered by other nodes, are written now. All tiles are
+    // written again if splatted radiance is merged, the film is resolved or the image is denoised.
+    const auto tile_size = (int)g_tileSize;
+    for( auto y = 0 ; y < m_height ; y += tile_size ){
+        for( auto x = 0 ; x < m_width ; x += tile_size ){
+            if( changed || !m_tileWritten[y / tile_size * m_tileCntX + x / tile_size] )
+                writeTile( Vector2i( x , y ) );
+        }
+    }
+
+    if( !m_writer->Close() )
+        slog( WARNING , IMAGE , "Fail to save image file %s" , g_outputFileName.c_str() );
+}
@@ -0,0 +1,58 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "imagesensor.h"
+#include "tiledexrwriter.h"
+
+// stream the image to a tiled OpenEXR file
+//
+// Each tile is handed to a background thread writing it to disk as soon as it is finished, instead of writing the
+// whole image once rendering is done, so that the rendered tiles are on disk even if rendering never finishes.
+// Tiles are written again once splatted radiance is merged into them in post process.
+class TiledExrImage : public ImageSensor{
+public:
+    // constructor
+    TiledExrImage( int w , int h ):ImageSensor(w,h){}
+
+    // pre process, the image file is created
+    void PreProcess() override;
+
+    // finish image tile
+    void FinishTile( int tile_x , int tile_y , const Render_Task& rt ) override;
+
+    // all tiles are written in each pass of progressive rendering
+    void FinishPass( float progress ) override;
+
+    // post process
+    void PostProcess() override;
+
+private:
+    // the writer of the image file
+    std::unique_ptr<TiledExrWriter> m_writer;
+
+    // whether each tile is written, each one is only touched by the task finishing it
+    std::vector<char>   m_tileWritten;
+
+    // number of tiles in a row
+    int                 m_tileCntX = 0;
+
+    // copy a tile of the render target to the writer
+    void writeTile( const Vector2i& topLeft );
+};
@@ -0,0 +1,255 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string.h>
+#include "tiledexrwriter.h"
+#include "core/log.h"
+#include "core/stats.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sTiledExrTileCnt)
+SORT_STATS_DEFINE_COUNTER(sTiledExrByteCnt)
+
+SORT_STATS_COUNTER("Tiled EXR", "Written tiles", sTiledExrTileCnt);
+SORT_STATS_COUNTER("Tiled EXR", "Written bytes", sTiledExrByteCnt);
+
+// Channels are sorted by name in OpenEXR files.
+static const char*          EXR_CHANNELS[]      = { "B" , "G" , "R" };
+static constexpr int        EXR_PIXEL_HALF      = 1;
+static constexpr char       EXR_RLE_COMPRESSION = 1;
+// Runs of identical bytes are at least this long in RLE compressed chunks, otherwise the bytes are copied as they are.
+static constexpr int        EXR_MIN_RUN         = 3;
+static constexpr int        EXR_MAX_RUN         = 127;
+
+template<class T>
+static void appendValue( std::vector<char>& buf , const T& v ){
+    const auto p = reinterpret_cast<const char*>( &v );
+    buf.insert( buf.end() , p , p + sizeof( T ) );
+}
+
+static void appendAttribute( std::vector<char>& buf , const char* name , const char* type , const std::vector<char>& value ){
+    buf.insert( buf.end() , name , name + strlen( name ) + 1 );
+    buf.insert( buf.end() , type , type + strlen( type ) + 1 );
+    appendValue( buf , (int)value.size() );
+    buf.insert( buf.end() , value.begin() , value.end() );
+}
+
+// RLE compression of OpenEXR, bytes are reordered and replaced with the differences between neighbours first, so that
+// similar pixels end up with runs of identical bytes. Data is stored as it is if it can't be compressed.
+static std::vector<char> compressRle( const std::vector<char>& src ){
+    const auto n = (int)src.size();
+    std::vector<unsigned char> tmp( n );
+    for( auto i = 0 ; i < n ; ++i )
+        tmp[ ( i & 1 ) ? ( n + 1 ) / 2 + i / 2 : i / 2 ] = (unsigned char)src[i];
+    for( auto i = n - 1 ; i > 0 ; --i )
+        tmp[i] = (unsigned char)( (int)tmp[i] - (int)tmp[i - 1] + 128 + 256 );
+
+    std::vector<char> dst;
+    dst.reserve( n );
+    auto start = 0;
+    while( start < n ){
+        auto end = start + 1;
+        while( end < n && tmp[end] == tmp[start] && end - start <= EXR_MAX_RUN )
+            ++end;
+
+        if( end - start >= EXR_MIN_RUN ){
+            dst.push_back( (char)( end - start - 1 ) );
+            dst.push_back( (char)tmp[start] );
+        }else{
+            // copy the bytes until a run starts
+            end = start + 1;
+            while( end < n && end - start < EXR_MAX_RUN && !( end + 2 < n && tmp[end] == tmp[end + 1] && tmp[end] == tmp[end + 2] ) )
+                ++end;
+            dst.push_back( (char)( start - end ) );
+            dst.insert( dst.end() , tmp.begin() + start , tmp.begin() + end );
+        }
+        start = end;
+    }
+
+    return (int)dst.size() < n ? dst : src;
+}
+
+TiledExrWriter::TiledExrWriter( const std::string& filename , int w , int h , int tileSize ) :
+    m_width( w ) , m_height( h ) , m_tileSize( tileSize ) ,
+    m_tileCntX( ( w + tileSize - 1 ) / tileSize ) , m_tileCntY( ( h + tileSize - 1 ) / tileSize ) ,
+    m_chunkOffset( m_tileCntX * m_tileCntY , 0 ) , m_chunkCapacity( m_tileCntX * m_tileCntY , 0 ){
+    m_file.open( filename , std::ios::out | std::ios::binary | std::ios::trunc );
+    if( !m_file.is_open() ){
+        slog( WARNING , IMAGE , "Fail to create image file %s" , filename.c_str() );
+        return;
+    }
+
+    writeHeader();
+    m_thread = std::thread( &TiledExrWriter::writeTiles , this );
+}
+
+TiledExrWriter::~TiledExrWriter(){
+    Close();
+}
+
+bool TiledExrWriter::IsValid() const{
+    return m_file.is_open() && m_file.good();
+}
+
+void TiledExrWriter::writeHeader(){
+    std::vector<char> header;
+    appendValue( header , 20000630 );
+    // version 2, single part tiled file
+    appendValue( header , 2 | 0x200 );
+
+    std::vector<char> channels;
+    for( const auto name : EXR_CHANNELS ){
+        channels.insert( channels.end() , name , name + strlen( name ) + 1 );
+        appendValue( channels , EXR_PIXEL_HALF );
+        // linear flag and reserved bytes
+        appendValue( channels , 0 );
+        // sampling
+        appendValue( channels , 1 );
+        appendValue( channels , 1 );
+    }
+    channels.push_back( 0 );
+    appendAttribute( header , "channels" , "chlist" , channels );
+    appendAttribute( header , "compression" , "compression" , { EXR_RLE_COMPRESSION } );
+
+    std::vector<char> window;
+    for( const auto v : { 0 , 0 , m_width - 1 , m_height - 1 } )
+        appendValue( window , v );
+    appendAttribute( header , "dataWindow" , "box2i" , window );
+    appendAttribute( header , "displayWindow" , "box2i" , window );
+
+    // Tiles are in random order, but the line order only matters to readers expecting them in order.
+    appendAttribute( header , "lineOrder" , "lineOrder" , { 0 } );
+
+    std::vector<char> value;
+    appendValue( value , 1.0f );
+    appendAttribute( header , "pixelAspectRatio" , "float" , value );
+    appendAttribute( header , "screenWindowWidth" , "float" , value );
+    value.clear();
+    appendValue( value , 0.0f );
+    appendValue( value , 0.0f );
+    appendAttribute( header , "screenWindowCenter" , "v2f" , value );
+
+    // one level of tiles
+    value.clear();
+    appendValue( value , (unsigned)m_tileSize );
+    appendValue( value , (unsigned)m_tileSize );
+    value.push_back( 0 );
+    appendAttribute( header , "tiles" , "tiledesc" , value );
+    header.push_back( 0 );
+
+    m_tableOffset = (long long)header.size();
+    header.resize( header.size() + sizeof( long long ) * m_tileCntX * m_tileCntY , 0 );
+    m_fileEnd = (long long)header.size();
+
+    m_file.write( header.data() , header.size() );
+    m_file.flush();
+}
+
+void TiledExrWriter::WriteTile( const Vector2i& topLeft , std::vector<Spectrum>&& radiance ){
+    if( !m_thread.joinable() )
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock( m_queueMutex );
+        m_queue.push_back( { topLeft , std::move( radiance ) } );
+    }
+    m_queueCond.notify_one();
+}
+
+void TiledExrWriter::writeTiles(){
+    while( true ){
+        Tile tile;
+        {
+            std::unique_lock<std::mutex> lock( m_queueMutex );
+            m_queueCond.wait( lock , [&]{ return m_closing || !m_queue.empty(); } );
+            if( m_queue.empty() )
+                return;
+            tile = std::move( m_queue.front() );
+            m_queue.pop_front();
+        }
+        writeTile( tile );
+    }
+}
+
+void TiledExrWriter::writeTile( const Tile& tile ){
+    const auto tw = std::min( m_tileSize , m_width - tile.topLeft.x );
+    const auto th = std::min( m_tileSize , m_height - tile.topLeft.y );
+
+    // each line of the tile has all pixels of the first channel, followed by the other channels
+    std::vector<char> pixels;
+    pixels.reserve( tw * th * 3 * sizeof( unsigned short ) );
+    for( auto y = 0 ; y < th ; ++y ){
+        const auto line = tile.radiance.data() + y * tw;
+        for( auto x = 0 ; x < tw ; ++x )
+            appendValue( pixels , FloatToHalf( line[x].b ) );
+        for( auto x = 0 ; x < tw ; ++x )
+            appendValue( pixels , FloatToHalf( line[x].g ) );
+        for( auto x = 0 ; x < tw ; ++x )
+            appendValue( pixels , FloatToHalf( line[x].r ) );
+    }
+    const auto data = compressRle( pixels );
+
+    std::vector<char> chunk;
+    const auto tx = tile.topLeft.x / m_tileSize;
+    const auto ty = tile.topLeft.y / m_tileSize;
+    appendValue( chunk , tx );
+    appendValue( chunk , ty );
+    // level of the tile
+    appendValue( chunk , 0 );
+    appendValue( chunk , 0 );
+    appendValue( chunk , (int)data.size() );
+    chunk.insert( chunk.end() , data.begin() , data.end() );
+
+    // The previous chunk of the tile is overwritten if the new one fits in it.
+    const auto index = ty * m_tileCntX + tx;
+    auto offset = m_chunkOffset[index];
+    if( 0 == offset || (int)chunk.size() > m_chunkCapacity[index] ){
+        offset = m_fileEnd;
+        m_fileEnd += (long long)chunk.size();
+        m_chunkCapacity[index] = (int)chunk.size();
+    }
+    m_file.seekp( offset );
+    m_file.write( chunk.data() , chunk.size() );
+
+    // The tile is only in the file once the chunk is complete.
+    m_file.flush();
+    m_chunkOffset[index] = offset;
+    m_file.seekp( m_tableOffset + sizeof( long long ) * index );
+    m_file.write( reinterpret_cast<const char*>( &offset ) , sizeof( offset ) );
+    m_file.flush();
+
+    SORT_STATS(++sTiledExrTileCnt);
+    SORT_STATS(sTiledExrByteCnt += chunk.size());
+}
+
+bool TiledExrWriter::Close(){
+    if( !m_file.is_open() )
+        return false;
+
+    if( m_thread.joinable() ){
+        {
+            std::lock_guard<std::mutex> lock( m_queueMutex );
+            m_closing = true;
+        }
+        m_queueCond.notify_one();
+        m_thread.join();
+    }
+
+    const auto ret = m_file.good();
+    m_file.close();
+    return ret;
+}
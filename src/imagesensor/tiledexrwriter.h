@@ -0,0 +1,102 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <condition_variable>
+#include "math/vector2.h"
+#include "spectrum/spectrum.h"
+
+//! @brief  TiledExrWriter streams tiles of an image to a tiled OpenEXR file as soon as they are rendered.
+//!
+//! Tiles are queued by the caller and written by a background thread, so worker threads never wait for the disk. Each
+//! tile is its own RLE compressed chunk with half float RGB channels, written wherever it fits in the file, and its
+//! entry in the offset table is only updated once the chunk is on disk. So the file holds every tile written so far
+//! even if the process is killed, tiles not written yet are simply missing. A tile could be written more than once,
+//! like in progressive rendering, the offset table always points to the latest one.
+class TiledExrWriter{
+public:
+    //! @brief  Constructor, the header of the file is written immediately.
+    //!
+    //! @param  filename        Name of the image file.
+    //! @param  w               Width of the image.
+    //! @param  h               Height of the image.
+    //! @param  tileSize        Size of the tiles.
+    TiledExrWriter( const std::string& filename , int w , int h , int tileSize );
+
+    //! @brief  Destructor, tiles still in the queue are written before the file is closed.
+    ~TiledExrWriter();
+
+    //! @brief  Whether the file is open.
+    //!
+    //! @return                 It returns false if the file can't be created or writing to it failed.
+    bool        IsValid() const;
+
+    //! @brief  Queue a tile to be written, it could be called from any thread.
+    //!
+    //! @param  topLeft         Top-left corner of the tile.
+    //! @param  radiance        Radiance of the pixels in the tile row by row, tiles on the right and bottom edges could
+    //!                         be smaller.
+    void        WriteTile( const Vector2i& topLeft , std::vector<Spectrum>&& radiance );
+
+    //! @brief  Write all queued tiles and close the file.
+    //!
+    //! @return                 Whether all tiles are written.
+    bool        Close();
+
+private:
+    //! @brief  A tile queued to be written.
+    struct Tile{
+        Vector2i                topLeft;    /**< Top-left corner of the tile. */
+        std::vector<Spectrum>   radiance;   /**< Radiance of the pixels in the tile row by row. */
+    };
+
+    const int                   m_width;            /**< Width of the image. */
+    const int                   m_height;           /**< Height of the image. */
+    const int                   m_tileSize;         /**< Size of the tiles. */
+    const int                   m_tileCntX;         /**< Number of tiles in a row. */
+    const int                   m_tileCntY;         /**< Number of tiles in a column. */
+
+    std::ofstream               m_file;             /**< The image file, only touched by the writing thread once it starts. */
+    long long                   m_tableOffset = 0;  /**< Where the offset table starts in the file. */
+    long long                   m_fileEnd = 0;      /**< Where the next chunk is appended. */
+    std::vector<long long>      m_chunkOffset;      /**< Where the latest chunk of each tile is, 0 if it is not written yet. */
+    std::vector<int>            m_chunkCapacity;    /**< Number of bytes available at the latest chunk of each tile. */
+
+    std::deque<Tile>            m_queue;            /**< Tiles waiting to be written. */
+    std::mutex                  m_queueMutex;       /**< Protects the queue. */
+    std::condition_variable     m_queueCond;        /**< Wakes up the writing thread. */
+    bool                        m_closing = false;  /**< No more tiles are queued. */
+    std::thread                 m_thread;           /**< The writing thread. */
+
+    //! @brief  Write queued tiles until the writer is closed.
+    void        writeTiles();
+
+    //! @brief  Write the chunk of a tile and point its entry of the offset table to it.
+    //!
+    //! @param  tile            The tile to be written.
+    void        writeTile( const Tile& tile );
+
+    //! @brief  Write the header of the file and an empty offset table.
+    void        writeHeader();
+};
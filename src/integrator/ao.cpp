@@ -22,43 +22,77 @@
 #include "math/vector3.h"
 #include "core/samplemethod.h"
 #include "core/log.h"
+#include "accel/accelerator.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Ambient Occlusion", "Primary Ray Count" , sPrimaryRayCount);
 
 // radiance along a specific ray direction
-Spectrum AmbientOcclusion::Li( const Ray& r , const PixelSample& ps , const Scene& scene ) const
+Spectrum AmbientOcclusion::Li( const Ray& r , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const
 {
-    SORT_STATS(++sPrimaryRayCount);
+    SORT_STATS_HOT(++sPrimaryRayCount);
 
     if( r.m_Depth > max_recursive_depth )
         return 0.0f;
 
     // get the intersection between the ray and the scene
     SurfaceInteraction ip;
-    if( false == scene.GetIntersect( r , ip ) )
+    if( false == getPrimaryIntersection( r , primary , scene , ip ) )
         return 0.0f;
 
     Vector nn = faceForward( ip.normal , r.m_Dir ) ? -ip.normal : ip.normal;
     Vector tn = normalize(cross( nn , ip.tangent ));
     Vector sn = normalize(cross( tn , nn ));
-    Vector _wi = CosSampleHemisphere( sort_canonical() , sort_canonical() );
-    const float pdf = CosHemispherePdf(_wi);
-    Vector wi = Vector( _wi.x * sn.x + _wi.y * nn.x + _wi.z * tn.x ,
-                        _wi.x * sn.y + _wi.y * nn.y + _wi.z * tn.y ,
-                        _wi.x * sn.z + _wi.y * nn.z + _wi.z * tn.z );
-
-    // Due to precision issue, sometimes the dot product between normal and incident vector could be slightly smaller than 0, leading a negative value, ignoring these cases in AO evaluation.
-    const float d = dot(wi, nn);
-    if (d <= 0.0f)
-        return 0.0f;
 
-    // the ray to be tested
-    Ray ray( ip.intersect , wi , 0 , 0.001f , maxDistance );
+    const auto  sample_cnt = std::max( sampleCount , 1 );
+    Ray         rays[RAY_PACKET_SIZE];
+    float       weights[RAY_PACKET_SIZE];
+    auto        cnt = 0u;
+    auto        ao = 0.0f;
+
+    // trace the rays in the packet, only the ones not occluded contribute.
+    const auto flush = [&](){
+#ifndef ENABLE_TRANSPARENT_SHADOW
+        const auto visible = scene.IsVisible( rays , cnt );
+#else
+        SurfaceInteraction intersects[RAY_PACKET_SIZE];
+        scene.GetIntersect( rays , intersects , cnt );
+        auto visible = 0u;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( IS_PTR_INVALID( intersects[i].primitive ) )
+                visible |= ( 1u << i );
+        }
+#endif
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( visible & ( 1u << i ) )
+                ao += weights[i];
+        }
+        cnt = 0;
+    };
+
+    for( auto k = 0 ; k < sample_cnt ; ++k ){
+        // the directions are stratified along one dimension of the unit square
+        Vector _wi = CosSampleHemisphere( ( k + sort_canonical() ) / sample_cnt , sort_canonical() );
+        const float pdf = CosHemispherePdf(_wi);
+        Vector wi = Vector( _wi.x * sn.x + _wi.y * nn.x + _wi.z * tn.x ,
+                            _wi.x * sn.y + _wi.y * nn.y + _wi.z * tn.y ,
+                            _wi.x * sn.z + _wi.y * nn.z + _wi.z * tn.z );
+
+        // Due to precision issue, sometimes the dot product between normal and incident vector could be slightly smaller than 0, leading a negative value, ignoring these cases in AO evaluation.
+        const float d = dot(wi, nn);
+        if (d <= 0.0f || pdf <= 0.0f)
+            continue;
+
+        // the ray to be tested
+        rays[cnt] = ip.SpawnRay( wi , 0 , maxDistance );
+        weights[cnt] = d * INV_PI / pdf;
+        if( ++cnt == RAY_PACKET_SIZE )
+            flush();
+    }
+
+    if( cnt > 0 )
+        flush();
 
-    SurfaceInteraction aoip;
-    if( !scene.GetIntersect( ray , aoip ) )
-        return d * INV_PI / pdf;
-    return 0.0f;
+    return ao / (float)sample_cnt;
 }
\ No newline at end of file
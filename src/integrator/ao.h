@@ -22,6 +22,9 @@
 //! @brief  This is the only integrator that doesn't take light into account.
 /**
  * Unlike other integrator, AO integrator only evaluates ambient occlusion.
+ *
+ * All occlusion rays of a shading point start from the same position, they are traced in packets so that the spatial
+ * data structure shares the traversal among them and each of them stops at its first occluder.
  */
 class   AmbientOcclusion : public Integrator{
 public:
@@ -32,8 +35,9 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary) const override;
 
     //! @brief      Serializing data from stream
     //!
@@ -41,11 +45,15 @@ public:
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
         stream >> maxDistance;
+        stream >> sampleCount;
     }
 
 private:
     /**< Maximal distance to consider in ao evaluation. */
     float   maxDistance = 10.0f;
 
+    /**< Number of occlusion rays of a shading point. */
+    int     sampleCount = 1;
+
     SORT_STATS_ENABLE( "Ambient Occlusion" )
 };
@@ -15,6 +15,7 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <atomic>
 #include "core/define.h"
 #include "bidirpath.h"
 #include "core/scene.h"
@@ -24,24 +25,67 @@
 #include "core/memory.h"
 #include "core/globalconfig.h"
 
-SORT_STATS_DEFINE_COUNTER(sTotalLengthPathFromEye)
-SORT_STATS_DEFINE_COUNTER(sTotalLengthPathFromLight)
+SORT_STATS_DEFINE_HOT_COUNTER(sTotalLengthPathFromEye)
+SORT_STATS_DEFINE_HOT_COUNTER(sTotalLengthPathFromLight)
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Bi-directional Path Tracing", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_AVG_COUNT("Bi-directional Path Tracing", "Average Path Length Starting from Eye", sTotalLengthPathFromEye , sPrimaryRayCount);            // This also counts the case where ray hits sky
 SORT_STATS_AVG_COUNT("Bi-directional Path Tracing", "Average Path Length Starting from Lights", sTotalLengthPathFromLight , sPrimaryRayCount);       // This also counts the case where ray hits sky
 
-Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const{
-    SORT_STATS(++sPrimaryRayCount);
+// Number of light sub-paths kept in the light vertex cache of a thread.
+static constexpr unsigned LVC_PATH_CNT = 128;
+
+// Probability of tracing a new light sub-path for a camera sample with the light vertex cache.
+static constexpr float LVC_LIGHT_PATH_RATIO = 0.25f;
+
+namespace {
+    // Light sub-paths recently traced by a thread, the oldest one is replaced by a newly traced one.
+    struct LightVertexCache{
+        std::vector<BDPT_Vertex>    paths[LVC_PATH_CNT];
+        unsigned                    next = 0;
+        unsigned                    vertex_cnt = 0;
+        unsigned                    generation = 0;
+
+        // Scattering events are allocated for each sample, they are created again once the vertices are picked.
+        void Push( const std::vector<BDPT_Vertex>& path ){
+            auto& slot = paths[next];
+            vertex_cnt -= (unsigned)slot.size();
+            slot = path;
+            for( auto& vertex : slot )
+                vertex.se = nullptr;
+            vertex_cnt += (unsigned)slot.size();
+            next = ( next + 1 ) % LVC_PATH_CNT;
+        }
 
-    // pick a light randomly
-    float pdf;
-    const auto light = scene.SampleLight( sort_canonical() , &pdf );
-    if( light == 0 || pdf == 0.0f )
-        return 0.0f;
+        // Pick a vertex uniformly, there should be at least one vertex in the cache.
+        const BDPT_Vertex& Pick( float u ) const {
+            auto i = std::min( (unsigned)( u * vertex_cnt ) , vertex_cnt - 1 );
+            for( const auto& path : paths ){
+                if( i < path.size() )
+                    return path[i];
+                i -= (unsigned)path.size();
+            }
+            return paths[0][0];
+        }
+    };
 
-    Spectrum li;
+    thread_local LightVertexCache   t_lightVertexCache;
+    thread_local BDPT_Path          t_lightPath;
+    std::atomic<unsigned>           g_lightVertexCacheGeneration( 0 );
+}
+
+void BidirPathTracing::PreProcess( const Scene& scene ){
+    m_cacheGeneration = ++g_lightVertexCacheGeneration;
+}
+
+float BidirPathTracing::_LightPathRatio() const{
+    return ( m_lightVertexCache && !light_tracing_only ) ? LVC_LIGHT_PATH_RATIO : 1.0f;
+}
+
+void BidirPathTracing::_TraceLightPath( const Light* light , float pdf , const Scene& scene , bool splat , float time , BDPT_Path& light_path ) const{
+    light_path.Reserve( (unsigned)std::max( max_recursive_depth , 1 ) );
+    light_path.vertices.clear();
 
     auto    light_emission_pdf = 0.0f;
     auto    light_pdfa = 0.0f;
@@ -49,25 +93,28 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
     auto    cosAtLight = 1.0f;
     LightSample light_sample(true);
     const auto le = light->sample_l( light_sample , light_ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+    light_ray.m_time = time;
 
-    //-----------------------------------------------------------------------------------------------------
-    // Trace light path from light source
-    std::vector<BDPT_Vertex> light_path;
     auto    wi = light_ray;
     double  vc = (light->IsDelta())?0.0f: MIS(cosAtLight / light_emission_pdf);
     double  vcm = MIS(light_pdfa / light_emission_pdf);
     auto    throughput = le * cosAtLight / (light_emission_pdf * pdf);
     auto    rr = 1.0f;
-    while ((int)light_path.size() < max_recursive_depth){
-        SORT_STATS(++sTotalLengthPathFromLight);
+    while ((int)light_path.vertices.size() < max_recursive_depth){
+        SORT_STATS_HOT(++sTotalLengthPathFromLight);
 
-        BDPT_Vertex vert;
-        if (!scene.GetIntersect(wi, vert.inter))
+        // the vertex is created in place, the scattering event refers to its intersection
+        const auto index = (unsigned)light_path.vertices.size();
+        light_path.vertices.emplace_back();
+        auto& vert = light_path.vertices.back();
+        if (!scene.GetIntersect(wi, vert.inter)){
+            light_path.vertices.pop_back();
             break;
+        }
 
         const auto distSqr = vert.inter.t * vert.inter.t;
         const auto cosIn = absDot( wi.m_Dir , vert.inter.normal );
-        if( light_path.size() > 0 || ( light_path.size() == 0 && !light->IsInfinite() ) )
+        if( index > 0 || !light->IsInfinite() )
             vcm *= MIS( distSqr );
         vcm /= MIS( cosIn );
         vc /= MIS( cosIn );
@@ -80,20 +127,19 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         vert.n = vert.inter.normal;
         vert.wi = -wi.m_Dir;
 
-        vert.se = SORT_MALLOC(ScatteringEvent)(vert.inter, SE_EVALUATE_ALL_NO_SSS);
+        vert.se = light_path.CreateScatteringEvent( index );
         vert.inter.primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
 
         vert.throughput = throughput;
         vert.vcm = vcm;
         vert.vc = vc;
         vert.rr = rr;
-        vert.depth = (unsigned)(light_path.size() + 1);
-
-        light_path.push_back(vert);
+        vert.depth = (int)( index + 1 );
 
         //-----------------------------------------------------------------------------------------------------
         // Path evaluation: light tracing
-        _ConnectCamera( vert , (unsigned)light_path.size() , light , scene );
+        if( splat )
+            _ConnectCamera( vert , vert.depth , light , scene );
 
         // russian roulette
         if (sort_canonical() > rr)
@@ -116,30 +162,74 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         vc = MIS(cosOut/bsdf_pdf) * ( MIS(rev_bsdf_pdfw) * vc + vcm ) ;
         vcm = MIS(1.0f/bsdf_pdf);
 
-        wi = Ray(vert.inter.intersect, vert.wo, 0, 0.001f);
+        wi = vert.inter.SpawnRay(vert.wo);
+    }
+}
+
+Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SORT_STATS_HOT(++sPrimaryRayCount);
+
+    // pick a light randomly
+    float pdf;
+    const auto light = scene.SampleLight( sort_canonical() , &pdf );
+    if( light == 0 || pdf == 0.0f )
+        return 0.0f;
+
+    Spectrum li;
+
+    //-----------------------------------------------------------------------------------------------------
+    // Trace light path from light source, the storage of the path is reused by all samples of the thread
+    auto& light_path = t_lightPath;
+    light_path.vertices.clear();
+    const auto use_cache = m_lightVertexCache && !light_tracing_only;
+    if( use_cache ){
+        // the cache of the thread is filled with light sub-paths that are not splatted before it is used for the first time.
+        auto& cache = t_lightVertexCache;
+        auto trace_into_cache = [&]( bool splat ){
+            float light_pdf;
+            const auto cache_light = scene.SampleLight( sort_canonical() , &light_pdf );
+            light_path.vertices.clear();
+            if( cache_light && light_pdf > 0.0f )
+                _TraceLightPath( cache_light , light_pdf , scene , splat , ray.m_time , light_path );
+            cache.Push( light_path.vertices );
+        };
+        if( cache.generation != m_cacheGeneration ){
+            cache.generation = m_cacheGeneration;
+            for( auto i = 0u ; i < LVC_PATH_CNT ; ++i )
+                trace_into_cache( false );
+        }
+
+        // light sub-paths are traced with a probability, light tracing splats take it into account.
+        if( sort_canonical() < LVC_LIGHT_PATH_RATIO )
+            trace_into_cache( true );
+        light_path.vertices.clear();
+    }else{
+        _TraceLightPath( light , pdf , scene , true , ray.m_time , light_path );
     }
 
     //-----------------------------------------------------------------------------------------------------
     // Trace light path from eye point
-    const auto lps = (const unsigned)light_path.size();
-    const auto total_pixel = g_resultResollutionWidth * g_resultResollutionHeight;
-    wi = ray;
-    throughput = 1.0f;
+    const auto lps = (const unsigned)light_path.vertices.size();
+    const auto light_path_cnt = g_resultResollutionWidth * g_resultResollutionHeight * _LightPathRatio();
+    auto    wi = ray;
+    Spectrum throughput = 1.0f;
     auto light_path_len = 0;
-    vc = 0.0f;
-    vcm = MIS(total_pixel / ray.m_fPdfW);
-    rr = 1.0f;
+    double  vc = 0.0f;
+    double  vcm = MIS(light_path_cnt / ray.m_fPdfW);
+    auto    rr = 1.0f;
     while (light_path_len <= (int)max_recursive_depth){
-        SORT_STATS(++sTotalLengthPathFromEye);
+        SORT_STATS_HOT(++sTotalLengthPathFromEye);
 
         BDPT_Vertex vert;
         vert.depth = light_path_len;
-        if (!scene.GetIntersect(wi, vert.inter)){
+        if (!getPrimaryIntersection(wi, 0 == light_path_len ? primary : nullptr, scene, vert.inter)){
             // the following code needs to be modified
             if (scene.GetSkyLight() == light){
                 if( vert.depth <= max_recursive_depth && vert.depth > 0 ){
                     float emissionPdf;
                     float directPdfA;
+                    // the pdf of sampling the sky through portals depends on where the ray leaves the scene
+                    vert.inter.intersect = wi.m_Ori;
                     Spectrum _li = light->Le( vert.inter, -wi.m_Dir , &directPdfA , &emissionPdf ) * throughput / light->PickPDF();
                     const auto weight = (float)(1.0f / (1.0f + MIS(directPdfA) * vcm + MIS(emissionPdf) * vc));
                     li += _li * weight;
@@ -181,7 +271,9 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         vert.n = vert.inter.normal;
         vert.wi = -wi.m_Dir;
 
-        vert.se = SORT_MALLOC(ScatteringEvent)( vert.inter , SE_EVALUATE_ALL_NO_SSS );
+        // only the current eye vertex is alive, its scattering event lives on the stack
+        ScatteringEvent se( vert.inter , SE_EVALUATE_ALL_NO_SSS );
+        vert.se = &se;
         vert.inter.primitive->GetMaterial()->UpdateScatteringEvent(*vert.se);
 
         vert.throughput = throughput;
@@ -195,8 +287,30 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
 
         //-----------------------------------------------------------------------------------------------------
         // Path evaluation: connect vertices
-        for (unsigned j = 0; j < lps; ++j)
-            li += _ConnectVertices( light_path[j] , vert , light , scene );
+        if( use_cache ){
+            // connecting to as many vertices as the average length of the cached sub-paths costs about the same as
+            // connecting to a sub-path, each connection is weighted so that the expectation is the same too.
+            const auto& cache = t_lightVertexCache;
+            if( cache.vertex_cnt > 0 ){
+                const auto connection_cnt = std::max( 1u , ( cache.vertex_cnt + LVC_PATH_CNT / 2 ) / LVC_PATH_CNT );
+                const auto scale = (float)cache.vertex_cnt / (float)( connection_cnt * LVC_PATH_CNT );
+                for( auto j = 0u ; j < connection_cnt ; ++j ){
+                    // scattering events of cached vertices are only created for the ones that could be connected
+                    const auto& cached = cache.Pick( sort_canonical() );
+                    if( cached.depth + vert.depth >= max_recursive_depth )
+                        continue;
+
+                    auto light_vert = cached;
+                    ScatteringEvent light_se( light_vert.inter , SE_EVALUATE_ALL_NO_SSS );
+                    light_vert.se = &light_se;
+                    light_vert.inter.primitive->GetMaterial()->UpdateScatteringEvent( light_se );
+                    li += _ConnectVertices( light_vert , vert , light , scene ) * scale;
+                }
+            }
+        }else{
+            for (unsigned j = 0; j < lps; ++j)
+                li += _ConnectVertices( light_path.vertices[j] , vert , light , scene );
+        }
 
         ++light_path_len;
 
@@ -221,14 +335,14 @@ Spectrum BidirPathTracing::Li( const Ray& ray , const PixelSample& ps , const Sc
         vc = MIS( cosOut / bsdf_pdf ) * ( MIS( rev_bsdf_pdfw ) * vc + vcm );
         vcm = MIS( 1.0f / bsdf_pdf );
 
-        wi = Ray(vert.inter.intersect, vert.wo, 0, 0.001f);
+        wi = vert.inter.SpawnRay(vert.wo);
     }
 
     return li;
 }
 
-void BidirPathTracing::RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ){
-    Integrator::RequestSample( sampler, ps , ps_num );
+void BidirPathTracing::RequestSample( Sampler* sampler , PixelSampleBuffer& samples , unsigned ps_num ){
+    Integrator::RequestSample( sampler, samples , ps_num );
     sample_per_pixel = ps_num;
 }
 
@@ -243,13 +357,14 @@ Spectrum BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_
 
     const auto cosAtP0 = absDot( p0.n , n_delta );
     const auto cosAtP1 = absDot( p1.n , n_delta );
-    const Spectrum g = p1.se->Evaluate_BSDF( p1.wi , n_delta ) * p0.se->Evaluate_BSDF( p0.wi , -n_delta ) * invDistcSqr;
+    float p0_bsdf_pdfw , p1_bsdf_pdfw;
+    const Spectrum g = p1.se->Evaluate_BSDF( p1.wi , n_delta , p1_bsdf_pdfw ) * p0.se->Evaluate_BSDF( p0.wi , -n_delta , p0_bsdf_pdfw ) * invDistcSqr;
     if( g.IsBlack() )
         return 0.0f;
 
-    const auto p0_bsdf_pdfw     = p0.se->Pdf_BSDF( p0.wi , -n_delta ) * p0.rr;
+    p0_bsdf_pdfw *= p0.rr;
+    p1_bsdf_pdfw *= p1.rr;
     const auto p0_bsdf_rev_pdfw = p0.se->Pdf_BSDF( -n_delta , p0.wi ) * p0.rr;
-    const auto p1_bsdf_pdfw     = p1.se->Pdf_BSDF( p1.wi , n_delta ) * p1.rr;
     const auto p1_bsdf_rev_pdfw = p1.se->Pdf_BSDF( n_delta , p1.wi ) * p1.rr;
 
     const auto p0_a = p1_bsdf_pdfw * cosAtP0 * invDistcSqr;
@@ -265,7 +380,7 @@ Spectrum BidirPathTracing::_ConnectVertices( const BDPT_Vertex& p0 , const BDPT_
         return li;
 
     Visibility visibility( scene );
-    visibility.ray = Ray( p1.p , n_delta  , 0 , 0.001f , delta.Length() - 0.001f );
+    visibility.ray = p1.inter.SpawnRayTo( n_delta , delta.Length() );
 #ifndef ENABLE_TRANSPARENT_SHADOW
     if( visibility.IsVisible() == false )
         return 0.0f;
@@ -289,12 +404,14 @@ Spectrum BidirPathTracing::_ConnectLight(const BDPT_Vertex& eye_vertex , const L
     float emissionPdfW;
     float cosAtLight;
     auto  li = light->sample_l(eye_vertex.inter.intersect, &sample, wi, 0 , &directPdfW, &emissionPdfW , &cosAtLight , visibility);
+    visibility.ray.m_time = eye_vertex.inter.time;
 
     if( 0.0f == directPdfW )
         return 0.0f;
     
     const auto cosAtEyeVertex = absDot(eye_vertex.n, wi);
-    li *= eye_vertex.throughput * eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , wi ) / directPdfW;
+    float eye_bsdf_pdfw;
+    li *= eye_vertex.throughput * eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , wi , eye_bsdf_pdfw ) / directPdfW;
 
     if (li.IsBlack())
         return 0.0f;
@@ -308,7 +425,7 @@ Spectrum BidirPathTracing::_ConnectLight(const BDPT_Vertex& eye_vertex , const L
         return 0.0f;
 #endif
 
-    const auto eye_bsdf_pdfw = eye_vertex.se->Pdf_BSDF( eye_vertex.wi , wi ) * eye_vertex.rr;
+    eye_bsdf_pdfw *= eye_vertex.rr;
     const auto eye_bsdf_rev_pdfw = eye_vertex.se->Pdf_BSDF( wi , eye_vertex.wi ) * eye_vertex.rr;
 
     const double mis0 = light->IsDelta()?0.0f:MIS(eye_bsdf_pdfw / directPdfW);
@@ -336,6 +453,7 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
     Spectrum we;
     Point eye_point;
     const auto coord = camera->GetScreenCoord(light_vertex.inter, &camera_pdfW, &camera_pdfA , cosAtCamera , &we , &eye_point , &visibility );
+    visibility.ray.m_time = light_vertex.inter.time;
 
     const auto delta = light_vertex.inter.intersect - eye_point;
     const auto invSqrLen = 1.0f / delta.SquaredLength();
@@ -363,9 +481,9 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
         return;
 #endif
 
-    const auto total_pixel = (float)(g_resultResollutionWidth * g_resultResollutionHeight);
+    const auto light_path_cnt = (float)(g_resultResollutionWidth * g_resultResollutionHeight) * _LightPathRatio();
     const auto gterm = cosAtCamera * invSqrLen;    // the other cos in the g-term is hidden in the 'bsdf_value'.
-    auto radiance = light_vertex.throughput * bsdf_value * we * gterm / (float)( sample_per_pixel * total_pixel * camera_pdfA );
+    auto radiance = light_vertex.throughput * bsdf_value * we * gterm / (float)( sample_per_pixel * light_path_cnt * camera_pdfA );
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
     radiance *= attenuation;
@@ -374,7 +492,7 @@ void BidirPathTracing::_ConnectCamera(const BDPT_Vertex& light_vertex, int len ,
     if( !light_tracing_only ){
         const float lightvert_pdfA = camera_pdfW * absDot( light_vertex.n, n_delta ) * invSqrLen ;
         const float bsdf_rev_pdfw = light_vertex.se->Pdf_BSDF( -n_delta , light_vertex.wi ) * light_vertex.rr;
-        const double mis0 = ( light_vertex.vcm + light_vertex.vc * MIS( bsdf_rev_pdfw ) ) * MIS( lightvert_pdfA / total_pixel );
+        const double mis0 = ( light_vertex.vcm + light_vertex.vc * MIS( bsdf_rev_pdfw ) ) * MIS( lightvert_pdfA / light_path_cnt );
         const float weight = (float)(1.0f / (1.0f + mis0));
 
         radiance *= weight;
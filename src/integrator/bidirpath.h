@@ -17,6 +17,8 @@
 
 #pragma once
 
+#include <memory>
+#include <type_traits>
 #include "integrator.h"
 #include "math/point.h"
 #include "math/vector3.h"
@@ -44,6 +46,31 @@ struct BDPT_Vertex{
     int         depth = 0;
 };
 
+// A light sub-path, the vertices and their scattering events are allocated once for the maximum depth and reused for all
+// samples of a thread. Scattering events refer to the intersections of the vertices, neither of them moves while tracing.
+struct BDPT_Path{
+    using EventStorage = std::aligned_storage_t<sizeof(ScatteringEvent), alignof(ScatteringEvent)>;
+
+    std::vector<BDPT_Vertex>        vertices;       // vertices of the path
+    std::unique_ptr<EventStorage[]> events;         // storage of the scattering events, one for each vertex
+    unsigned                        capacity = 0;   // maximum number of vertices of the path
+
+    // make sure there is room for the vertices of the path, it only allocates if the maximum depth grows
+    void Reserve( unsigned depth ){
+        if( depth <= capacity )
+            return;
+        vertices.clear();
+        vertices.reserve( depth );
+        events = std::make_unique<EventStorage[]>( depth );
+        capacity = depth;
+    }
+
+    // construct the scattering event of a vertex in place, the vertex needs to be in the path already
+    ScatteringEvent* CreateScatteringEvent( unsigned i ){
+        return new (&events[i]) ScatteringEvent( vertices[i].inter , SE_EVALUATE_ALL_NO_SSS );
+    }
+};
+
 struct Pending_Sample{
     Vector2i    coord;
     Spectrum    radiance;
@@ -57,6 +84,13 @@ struct Pending_Sample{
  * The fact that bi-directional path tracing generates rays from light, allows it to evaluate Monte Carlo estimation
  * way more efficient than a standard path tracing algorithm.
  *
+ * With the light vertex cache, light sub-paths are not traced for every camera sample. Each thread keeps the vertices of
+ * the light sub-paths it traced recently, a camera sample only traces a new one with a small probability and camera
+ * vertices are connected to a few random vertices of the cache. The cost of tracing light sub-paths is amortized across
+ * many pixels this way.
+ * 'Light Transport Simulation with Vertex Connection and Merging', Iliyan Georgiev, Jaroslav Krivanek, Tomas Davidovic, Philipp Slusallek.
+ * 'Progressive Light Transport Simulation on the GPU: Survey and Improvements', Tomas Davidovic, Jaroslav Krivanek, Milos Hasan, Philipp Slusallek.
+ *
  * However, due to my limited spare time, there is no SSS and volume support in it for now. This is also not very high
  * priority in my to-do list for now.
  */
@@ -69,12 +103,37 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary) const override;
 
+    //! @brief  Invalidate light vertex caches of the last rendering.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void PreProcess( const Scene& scene ) override;
 
     //! @brief  The samples generated in this interface is not well used in this integrator for now.
-    void RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ) override;
+    void RequestSample( Sampler* sampler , PixelSampleBuffer& samples , unsigned ps_num ) override;
+
+    //! @brief  Light paths are splatted assuming every pixel takes the same number of samples.
+    bool SupportAdaptiveSampling() const override {
+        return false;
+    }
+
+    //! @brief  Light paths are splatted assuming all samples per pixel are taken.
+    bool SupportProgressiveRendering() const override {
+        return false;
+    }
+
+    //! @brief  Light paths splat radiance to tiles that may not be in the checkpoint.
+    bool SupportCheckpoint() const override {
+        return false;
+    }
+
+    //! @brief  Light paths splatted by a pixel stay in the image sensor if the pixel is rendered again.
+    bool SupportPixelDeferral() const override {
+        return false;
+    }
 
     //! @brief      Serializing data from stream
     //!
@@ -82,6 +141,7 @@ public:
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
         stream >> m_bMIS;
+        stream >> m_lightVertexCache;
     }
 
 protected:
@@ -100,10 +160,22 @@ protected:
     // connect vertices
     Spectrum    _ConnectVertices( const BDPT_Vertex& light_vertex , const BDPT_Vertex& eye_vertex , const Light* light , const Scene& scene ) const;
 
+    // trace a light sub-path from the light at the given shutter time, it is connected to the camera if 'splat' is true
+    void        _TraceLightPath( const Light* light , float pick_pdf , const Scene& scene , bool splat , float time , BDPT_Path& light_path ) const;
+
+    // number of light sub-paths traced per pixel sample
+    float       _LightPathRatio() const;
+
 private:
     // use multiple importance sampling to sample direct illumination
     bool    m_bMIS = true;
 
+    // connect camera vertices to the light vertex cache instead of a light sub-path traced for each camera sample
+    bool    m_lightVertexCache = false;
+
+    // generation of the light vertex caches, caches of other generations are rebuilt before use
+    unsigned    m_cacheGeneration = 0;
+
     // mis factor
     SORT_FORCEINLINE double MIS(double t) const {
         return m_bMIS ? t * t : 1.0f;
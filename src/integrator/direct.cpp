@@ -27,8 +27,81 @@ SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Direct Illumination", "Primary Ray Count" , sPrimaryRayCount);
 
-Spectrum DirectLight::Li( const Ray& r , const PixelSample& ps , const Scene& scene) const{
-    SORT_STATS(++sPrimaryRayCount);
+// Number of other samples of the same pixel whose reservoirs are combined into the reservoir of a sample.
+static constexpr unsigned RIS_REUSE_NEIGHBORS = 4;
+
+namespace {
+    // A reservoir keeps one of the light samples streamed through it, picked proportional to their weights.
+    struct Reservoir{
+        LightSample sample;             /**< The picked light sample. */
+        float       target = 0.0f;      /**< Target function of the picked light sample at the shading point. */
+        float       weightSum = 0.0f;   /**< Sum of the weights of all light samples streamed through it. */
+        unsigned    cnt = 0;            /**< Number of candidates streamed through it. */
+
+        void Update( const LightSample& ls , float target_pdf , float weight , unsigned candidates ){
+            weightSum += weight;
+            cnt += candidates;
+            if( weight > 0.0f && sort_canonical() * weightSum < weight ){
+                sample = ls;
+                target = target_pdf;
+            }
+        }
+    };
+
+    // Unshadowed contribution of a light sample to a shading point, divided by the pdf of the light sample.
+    Spectrum lightContribution( const ScatteringEvent& se , const Vector& wo , const Scene& scene , const LightSample& ls , Visibility* shadow ){
+        const auto& ip = se.GetInteraction();
+
+        auto light_pick_pdf = 0.0f;
+        const auto light = scene.SampleLight( ip.intersect , ip.normal , ls.t , &light_pick_pdf );
+        if( nullptr == light || light_pick_pdf <= 0.0f )
+            return 0.0f;
+
+        Visibility visibility(scene, light);
+        auto light_pdf = 0.0f;
+        Vector wi;
+        const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+        visibility.ray.m_time = ip.time;
+        if( light_pdf <= 0.0f || li.IsBlack() )
+            return 0.0f;
+
+        if( shadow ){
+            shadow->ray = visibility.ray;
+            shadow->light = light;
+        }
+        return li * se.Evaluate_BSDF( wo , wi ) / ( light_pick_pdf * light_pdf );
+    }
+
+    // Stream candidate light samples through a reservoir, the target function is the intensity of their contribution.
+    Reservoir resample( const ScatteringEvent& se , const Vector& wo , const Scene& scene , int candidates ){
+        Reservoir reservoir;
+        for( auto i = 0 ; i < candidates ; ++i ){
+            const LightSample ls(true);
+            const auto target = lightContribution( se , wo , scene , ls , nullptr ).GetIntensity();
+            reservoir.Update( ls , target , target , 1 );
+        }
+        return reservoir;
+    }
+
+    // Direct illumination of the light sample picked by a reservoir, 'z' is the number of candidates that could be picked.
+    Spectrum shade( const ScatteringEvent& se , const Vector& wo , const Scene& scene , const Reservoir& reservoir , unsigned z ){
+        if( reservoir.target <= 0.0f || 0 == z )
+            return 0.0f;
+
+        Visibility visibility(scene);
+        const auto contribution = lightContribution( se , wo , scene , reservoir.sample , &visibility );
+        const auto weight = reservoir.weightSum / ( reservoir.target * z );
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+        return visibility.IsVisible() ? contribution * weight : 0.0f;
+#else
+        return contribution * weight * visibility.GetAttenuation();
+#endif
+    }
+}
+
+Spectrum DirectLight::Li( const Ray& r , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SORT_STATS_HOT(++sPrimaryRayCount);
 
     if( r.m_Depth > max_recursive_depth )
         return 0.0f;
@@ -36,17 +109,71 @@ Spectrum DirectLight::Li( const Ray& r , const PixelSample& ps , const Scene& sc
     // get the intersection between the ray and the scene
     SurfaceInteraction ip;
     // evaluate light directly
-    if( false == scene.GetIntersect( r , ip ) )
+    if( false == getPrimaryIntersection( r , primary , scene , ip ) )
         return scene.Le( r );
 
     auto li = ip.Le( -r.m_Dir );
 
-    // evaluate direct light
-    auto light_num = scene.LightNum();
-    for( auto i = 0u ; i < light_num ; ++i ){
-        const auto light = scene.GetLight(i);
-        li += EvaluateDirect( r , scene , light , ip , LightSample(true) , BsdfSample(true) , true );
+    // evaluate direct light, the scattering event is shared by all lights
+    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
+    if( m_risCandidates > 0 ){
+        const auto reservoir = resample( se , -r.m_Dir , scene , m_risCandidates );
+        li += shade( se , -r.m_Dir , scene , reservoir , reservoir.cnt );
+    }else{
+        li += SampleAllLights( se , r , scene );
     }
 
     return li;
-}
\ No newline at end of file
+}
+
+void DirectLight::LiBatch( const Ray* rays , const SurfaceInteraction* intersections , const PixelSample* ps , unsigned cnt , const Scene& scene , Spectrum* radiance ) const{
+    SORT_STATS(sPrimaryRayCount += cnt);
+
+    // the scattering events are alive until all samples of the pixel are done.
+    std::vector<ScatteringEvent*>   events( cnt , nullptr );
+    std::vector<Reservoir>          reservoirs( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto& inter = intersections[i];
+        if( IS_PTR_INVALID(inter.primitive) ){
+            radiance[i] = scene.Le( rays[i] );
+            continue;
+        }
+
+        radiance[i] = inter.Le( -rays[i].m_Dir );
+
+        events[i] = SORT_MALLOC(ScatteringEvent)( inter , SE_EVALUATE_ALL_NO_SSS );
+        inter.primitive->GetMaterial()->UpdateScatteringEvent( *events[i] );
+        reservoirs[i] = resample( *events[i] , -rays[i].m_Dir , scene , m_risCandidates );
+    }
+
+    // Each sample combines its reservoir with the ones of a few other samples, their light samples are weighted by the
+    // target function of this sample. The combined weight is normalized by the candidates of the reservoirs that could
+    // have picked the final light sample, which keeps it unbiased even though the samples see different lights.
+    const auto neighbors = std::min( RIS_REUSE_NEIGHBORS , cnt - 1 );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( nullptr == events[i] )
+            continue;
+
+        const auto& se = *events[i];
+        const auto wo = -rays[i].m_Dir;
+
+        auto combined = reservoirs[i];
+        for( auto k = 1u ; k <= neighbors ; ++k ){
+            const auto& other = reservoirs[( i + k ) % cnt];
+            if( other.target <= 0.0f )
+                continue;
+            const auto target = lightContribution( se , wo , scene , other.sample , nullptr ).GetIntensity();
+            combined.Update( other.sample , target , target / other.target * other.weightSum , other.cnt );
+        }
+
+        auto z = reservoirs[i].cnt;
+        for( auto k = 1u ; k <= neighbors ; ++k ){
+            const auto j = ( i + k ) % cnt;
+            if( nullptr != events[j] && lightContribution( *events[j] , -rays[j].m_Dir , scene , combined.sample , nullptr ).GetIntensity() > 0.0f )
+                z += reservoirs[j].cnt;
+        }
+
+        radiance[i] += shade( se , wo , scene , combined , z );
+    }
+}
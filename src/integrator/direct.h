@@ -23,6 +23,13 @@
 /**
  * Comparing with whitted ray tracing , direct light requires more samples per pixel
  * and it supports soft shadow and area light.
+ *
+ * With resampled importance sampling, a lot of cheap light samples are drawn for a shading point and one of them is
+ * picked proportional to its unshadowed contribution, only the picked one traces a shadow ray. Light samples are kept
+ * as the random numbers generating them, the domain is the same for all shading points so that samples of a pixel
+ * could reuse the picked light samples of each other without any jacobian.
+ * 'Spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct lighting', Benedikt Bitterli,
+ * Chris Wyman, Matt Pharr, Peter Shirley, Aaron Lefohn, Wojciech Jarosz.
  */
 class   DirectLight : public Integrator{
 public:
@@ -33,16 +40,39 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary) const override;
+
+    //! @brief  Evaluate the radiance of all samples of a pixel, the samples reuse the light samples of each other.
+    //!
+    //! @param  rays            The camera rays.
+    //! @param  intersections   The resolved intersections of the camera rays.
+    //! @param  ps              Pixel samples, one for each camera ray.
+    //! @param  cnt             Number of camera rays.
+    //! @param  scene           The rendering scene.
+    //! @param  radiance        The radiance along the camera rays to be returned.
+    void        LiBatch( const Ray* rays , const SurfaceInteraction* intersections , const PixelSample* ps , unsigned cnt , const Scene& scene , Spectrum* radiance ) const override;
+
+    //! @brief  Samples of a pixel are evaluated together only if they reuse light samples of each other.
+    //!
+    //! @return     Whether batch evaluation is supported by the integrator.
+    bool        SupportBatchEvaluation() const override {
+        return m_risCandidates > 0 && m_pixelReuse;
+    }
 
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
+        stream >> m_risCandidates;
+        stream >> m_pixelReuse;
     }
 
 private:
+    int     m_risCandidates = 0;    /**< Number of candidate light samples of a shading point, all lights are sampled if it is zero. */
+    bool    m_pixelReuse = false;   /**< Whether samples of a pixel reuse the picked light samples of each other. */
+
     SORT_STATS_ENABLE( "Direct Illumination" )
 };
@@ -17,4 +17,4 @@
 
 #include "integrator.h"
 
-SORT_STATS_DEFINE_COUNTER(sPrimaryRayCount)
+SORT_STATS_DEFINE_HOT_COUNTER(sPrimaryRayCount)
@@ -50,8 +50,32 @@ public:
     //! @param  ray     The extent ray in rendering equation.
     //! @param  ps      The pixel samples. Currently not used.
     //! @param  scene   The rendering scene.
+    //! @param  primary The intersection of the ray resolved by the caller, like in a ray packet, nullptr if it is not resolved.
     //! @return         The spectrum of the radiance along the opposite direction of the ray.
-    virtual Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const = 0;
+    virtual Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const = 0;
+
+    //! @brief  Evaluate the radiance of a batch of camera rays.
+    //!
+    //! This is only called if the integrator supports batch evaluation, the memory pool is not cleared between the rays.
+    //! By default, the rays are evaluated one after another.
+    //!
+    //! @param  rays            The camera rays.
+    //! @param  intersections   The resolved intersections of the camera rays.
+    //! @param  ps              Pixel samples, one for each camera ray.
+    //! @param  cnt             Number of camera rays.
+    //! @param  scene           The rendering scene.
+    //! @param  radiance        The radiance along the camera rays to be returned.
+    virtual void LiBatch( const Ray* rays , const SurfaceInteraction* intersections , const PixelSample* ps , unsigned cnt , const Scene& scene , Spectrum* radiance ) const {
+        for( auto i = 0u ; i < cnt ; ++i )
+            radiance[i] = Li( rays[i] , ps[i] , scene , intersections + i );
+    }
+
+    //! @brief  Whether all samples of a pixel are evaluated at the same time through LiBatch.
+    //!
+    //! @return     Whether batch evaluation is supported by the integrator.
+    virtual bool SupportBatchEvaluation() const {
+        return false;
+    }
 
     //! @brief Pre-process before rendering.
     //!
@@ -60,13 +84,65 @@ public:
     virtual void PreProcess(const Scene& scene) {}
 
     //! @brief  Some integrator have a post process step.
+    //!
+    //! It is called once progressive rendering of a frame is done without being cancelled.
     virtual void PostProcess() {}
 
+    //! @brief  Called between passes of progressive rendering, when no sample is being evaluated.
+    //!
+    //! Integrators learning from the samples, like path guiding, could update what is learned here.
+    virtual void FinishPass() {}
+
     //! @brief  Though most integrators do support live update in Blender, some doesn't, like light tracing.
     virtual bool NeedRefreshTile() const {
         return true;
     }
 
+    //! @brief  Whether samples could be distributed adaptively among pixels.
+    //!
+    //! Splatting integrators, like light tracing, assume every pixel takes the same number of samples.
+    //!
+    //! @return     Whether adaptive sampling is supported by the integrator.
+    virtual bool SupportAdaptiveSampling() const {
+        return true;
+    }
+
+    //! @brief  Whether the image could be rendered in passes progressively.
+    //!
+    //! @return     Whether progressive rendering is supported by the integrator.
+    virtual bool SupportProgressiveRendering() const {
+        return true;
+    }
+
+    //! @brief  The largest number of samples per pixel taken in a pass of progressive rendering.
+    //!
+    //! Integrators depending on data updated between passes, like progressive photon mapping, could limit the passes.
+    //! Such integrators are always rendered progressively.
+    //!
+    //! @return     The largest number of samples in a pass, zero means there is no limit.
+    virtual unsigned SamplesPerPass() const {
+        return 0;
+    }
+
+    //! @brief  Whether rendering could be saved to a checkpoint and resumed later.
+    //!
+    //! Only tiles whose pixels are all rendered are saved, radiance splatted to other tiles can't be tracked this way.
+    //!
+    //! @return     Whether checkpoints are supported by the integrator.
+    virtual bool SupportCheckpoint() const {
+        return true;
+    }
+
+    //! @brief  Whether a pixel could be thrown away and rendered again later, like when it misses texture tiles.
+    //!
+    //! Only the estimate of the pixel is thrown away, integrators splatting radiance to the image sensor or recording
+    //! samples in what they learn would count the samples of the pixel twice.
+    //!
+    //! @return     Whether pixels could be deferred by the integrator.
+    virtual bool SupportPixelDeferral() const {
+        return true;
+    }
+
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
@@ -74,34 +150,66 @@ public:
         stream >> max_recursive_depth;
     }
 
-    //! @brief  This interface is not well supported in SORT for now.
-    virtual void GenerateSample(const Sampler* sampler, PixelSample* samples, unsigned ps, const Scene& scene) const {
-        auto data = std::make_unique<float[]>(2 * ps);
-        sampler->Generate2D(data.get(), ps, true);
+    //! @brief  Generate camera samples of a pixel.
+    //!
+    //! @param sampler      The sampler taking samples in the pixel.
+    //! @param samples      The samples of the pixel, with room reserved for at least 'ps' samples.
+    //! @param ps           The number of samples to generate.
+    //! @param scene        The scene to be rendered.
+    virtual void GenerateSample(const Sampler* sampler, PixelSampleBuffer& samples, unsigned ps, const Scene& scene) const {
+        auto data = samples.Scratch();
+        auto pixel_samples = samples.Samples();
+        sampler->Generate2D(data, ps, true);
         for (unsigned i = 0; i < ps; ++i)
         {
-            samples[i].img_u = data[2 * i];
-            samples[i].img_v = data[2 * i + 1];
+            pixel_samples[i].img_u = data[2 * i];
+            pixel_samples[i].img_v = data[2 * i + 1];
         }
 
-        auto shuffle = std::make_unique<unsigned[]>(ps);
+        auto shuffle = samples.Shuffle();
         for (unsigned i = 0; i < ps; i++)
             shuffle[i] = i;
-        std::shuffle(shuffle.get(), shuffle.get() + ps, std::default_random_engine(sort_rand()));
+        std::shuffle(shuffle, shuffle + ps, std::default_random_engine(sort_rand()));
 
-        sampler->Generate2D(data.get(), ps);
+        sampler->Generate2D(data, ps);
         for (unsigned i = 0; i < ps; ++i)
         {
             unsigned sid = 2 * shuffle[i];
-            samples[i].dof_u = data[sid];
-            samples[i].dof_v = data[sid + 1];
+            pixel_samples[i].dof_u = data[sid];
+            pixel_samples[i].dof_v = data[sid + 1];
+        }
+
+        // time is decorrelated from the other dimensions the same way
+        if (scene.HasMotion()) {
+            std::shuffle(shuffle, shuffle + ps, std::default_random_engine(sort_rand()));
+            sampler->Generate1D(data, ps);
+            for (unsigned i = 0; i < ps; ++i)
+                pixel_samples[i].time = data[shuffle[i]];
         }
     }
 
-    //! @brief  This is not well supported in SORT for now.
-    virtual void RequestSample(Sampler* sampler, PixelSample* ps, unsigned ps_num) {}
+    //! @brief  Request dimensions of samples before rendering.
+    //!
+    //! @param sampler      The sampler taking samples in pixels.
+    //! @param samples      The buffer of samples to request dimensions in.
+    //! @param ps_num       The number of samples per pixel.
+    virtual void RequestSample(Sampler* sampler, PixelSampleBuffer& samples, unsigned ps_num) {}
 
 protected:
+    //! @brief  Get the intersection of a camera ray, it is only traced if the caller didn't resolve it already.
+    //!
+    //! @param  ray     The camera ray.
+    //! @param  primary The intersection of the ray resolved by the caller, nullptr if it is not resolved.
+    //! @param  scene   The rendering scene.
+    //! @param  inter   The intersection to be filled.
+    //! @return         Whether the ray hits anything in the scene.
+    static bool getPrimaryIntersection( const Ray& ray , const SurfaceInteraction* primary , const Scene& scene , SurfaceInteraction& inter ){
+        if( !primary )
+            return scene.GetIntersect( ray , inter );
+        inter = *primary;
+        return IS_PTR_VALID( inter.primitive );
+    }
+
     int           max_recursive_depth = 6;      /*< maxium recursive depth. */
     PixelSample   pixel_sample;                 /*< the pixel sample. */
     unsigned      sample_per_pixel;             /*< light sample per pixel sample per light. */
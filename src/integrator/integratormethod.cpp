@@ -24,29 +24,61 @@
 #include "material/material.h"
 #include "light/light.h"
 #include "medium/phasefunction.h"
+#include "accel/accelerator.h"
+#include "core/hwcounter.h"
+#include "core/globalconfig.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sShadowRouletteTests)
+SORT_STATS_DEFINE_COUNTER(sShadowRouletteSkipped)
+
+SORT_STATS_COUNTER("Statistics", "Shadow Rays in Russian Roulette", sShadowRouletteTests);
+SORT_STATS_COUNTER("Statistics", "Shadow Rays Skipped by Russian Roulette", sShadowRouletteSkipped);
 
 SORT_FORCEINLINE float MisFactor( float f, float g ){
     return (f*f) / (f*f + g*g);
 }
 
+// Shadow rays whose unoccluded contribution is below the threshold are only traced with a probability proportional to
+// the contribution. Survivors are weighted by the inverse of the probability, so the estimate stays unbiased.
+// para 'contribution' : unoccluded contribution of the shadow ray, it is reweighted if the ray survives
+// result              : whether the shadow ray needs to be traced
+SORT_STATIC_FORCEINLINE bool shadowRoulette( Spectrum& contribution ){
+    const auto threshold = g_shadowRoulette;
+    const auto c = contribution.GetMaxComponent();
+    if( threshold <= 0.0f || c >= threshold )
+        return true;
+
+    SORT_STATS(++sShadowRouletteTests);
+    const auto survival = c / threshold;
+    if( sort_canonical() >= survival ){
+        SORT_STATS(++sShadowRouletteSkipped);
+        return false;
+    }
+    contribution /= survival;
+    return true;
+}
+
 Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Scene& scene , const Light* light , const LightSample& ls ,const BsdfSample& bs ){
+    SORT_HW_COUNTERS("Light Sampling");
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
-    Visibility visibility(scene);
+    Visibility visibility(scene, light);
     float light_pdf;
     float bsdf_pdf;
     const auto wo = -r.m_Dir;
     Vector wi;
     const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+    visibility.ray.m_time = ip.time;
     if( light_pdf > 0.0f && !li.IsBlack() ){
-        Spectrum f = se.Evaluate_BSDF( wo , wi );
+        // The pdf of bsdf sampling is only needed for MIS, it is evaluated along with the bsdf.
+        Spectrum f = light->IsDelta() ? se.Evaluate_BSDF( wo , wi ) : se.Evaluate_BSDF( wo , wi , bsdf_pdf );
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
         if( !f.IsBlack() && visibility.IsVisible() ){
             if( light->IsDelta() ){
                 radiance += li * f / light_pdf;
             }else{
-                bsdf_pdf = se.Pdf_BSDF( wo , wi );
                 const auto weight = MisFactor( light_pdf , bsdf_pdf );
                 radiance = li * f * weight / light_pdf;
             }
@@ -58,7 +90,6 @@ Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Sce
 				if (light->IsDelta()) {
 					radiance += attenuation * li * f / light_pdf;
 				} else {
-					bsdf_pdf = se.Pdf_BSDF(wo, wi);
 					const auto weight = MisFactor(light_pdf, bsdf_pdf);
 					radiance = attenuation * li * f * weight / light_pdf;
 				}
@@ -80,7 +111,7 @@ Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Sce
             if( false == light->Le( Ray( ip.intersect , wi ) , &_ip , li ) )
                 return radiance;
 
-            visibility.ray = Ray( ip.intersect , wi , 0 , 0.001f , _ip.t - 0.001f );
+            visibility.ray = ip.SpawnRayTo( wi , _ip.t );
 #ifndef ENABLE_TRANSPARENT_SHADOW
             if( !li.IsBlack() && visibility.IsVisible() )
                 radiance += li * f * weight / bsdf_pdf;
@@ -97,28 +128,38 @@ Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Sce
     return radiance;
 }
 
-Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material , const MediumStack& ms ) {
+Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material , const MediumStack& ms , const bool prefiltered ) {
+    SORT_HW_COUNTERS("Light Sampling");
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
-    Visibility visibility(scene);
+    Visibility visibility(scene, light);
     float light_pdf;
     float bsdf_pdf;
     const auto wo = -r.m_Dir;
     Vector wi;
-    const auto li = light->sample_l(ip.intersect, &ls, wi, 0, &light_pdf, 0, 0, visibility);
+
+    // The bsdf is sampled first so that prefiltered lookups of infinite lights know the width of the lobe, a lobe
+    // whose pdf is 'p' covers about '1/p' steradians, which spreads 'sqrt(1/p)' radians.
+    auto light_sample = ls;
+    Vector bsdf_wi;
+    float bsdf_sample_pdf = 0.0f;
+    Spectrum bsdf_f;
+    if (!light->IsDelta()) {
+        bsdf_f = se.Sample_BSDF(wo, bsdf_wi, bs, bsdf_sample_pdf);
+        if (prefiltered && light->IsInfinite() && bsdf_sample_pdf > 0.0f)
+            light_sample.spread = sqrt(1.0f / bsdf_sample_pdf);
+    }
+
+    const auto li = light->sample_l(ip.intersect, &light_sample, wi, 0, &light_pdf, 0, 0, visibility);
+    visibility.ray.m_time = ip.time;
     if (light_pdf > 0.0f && !li.IsBlack()) {
-        Spectrum f = se.Evaluate_BSDF(wo, wi);
+        // The pdf of bsdf sampling is only needed for MIS, it is evaluated along with the bsdf.
+        Spectrum f = light->IsDelta() ? se.Evaluate_BSDF(wo, wi) : se.Evaluate_BSDF(wo, wi, bsdf_pdf);
 
+        auto contribution = light->IsDelta() ? li * f / light_pdf : li * f * MisFactor(light_pdf, bsdf_pdf) / light_pdf;
 #ifndef ENABLE_TRANSPARENT_SHADOW
-        if (!f.IsBlack() && visibility.IsVisible()) {
-            if (light->IsDelta()) {
-                radiance += li * f / light_pdf;
-            } else {
-                bsdf_pdf = se.Pdf_BSDF(wo, wi);
-                const auto weight = MisFactor(light_pdf, bsdf_pdf);
-                radiance = li * f * weight / light_pdf;
-            }
-        }
+        if (!f.IsBlack() && shadowRoulette(contribution) && visibility.IsVisible())
+            radiance += contribution;
 #else
         // as long as the ray is passing through the surface, it is necessary to update the medium stack.
         // make sure a copy, instead of the original data is updated to avoid data pollution.
@@ -131,24 +172,18 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
             material->UpdateMediumStack(mi, interaction_flag, ms_copy);
         }
 
-        if (!f.IsBlack()) {
+        if (!f.IsBlack() && shadowRoulette(contribution)) {
             const auto attenuation = visibility.GetAttenuation( &ms_copy );
-            if (!attenuation.IsBlack()) {
-                if (light->IsDelta()) {
-                    radiance += attenuation * li * f / light_pdf;
-                }
-                else {
-                    bsdf_pdf = se.Pdf_BSDF(wo, wi);
-                    const auto weight = MisFactor(light_pdf, bsdf_pdf);
-                    radiance = attenuation * li * f * weight / light_pdf;
-                }
-            }
+            if (!attenuation.IsBlack())
+                radiance += attenuation * contribution;
         }
 #endif
     }
 
     if (!light->IsDelta()) {
-        const auto f = se.Sample_BSDF(wo, wi, bs, bsdf_pdf);
+        const auto& f = bsdf_f;
+        wi = bsdf_wi;
+        bsdf_pdf = bsdf_sample_pdf;
         if (!f.IsBlack() && bsdf_pdf != 0.0f) {
             float light_pdf;
             light_pdf = light->Pdf(ip.intersect, wi);
@@ -158,15 +193,18 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
 
             Spectrum li;
             SurfaceInteraction _ip;
-            if (false == light->Le(Ray(ip.intersect, wi), &_ip, li))
+            Ray light_ray(ip.intersect, wi);
+            light_ray.m_coneSpread = light_sample.spread;
+            if (false == light->Le(light_ray, &_ip, li))
                 return radiance;
 
             // Make sure the ray starts from the surface instead of the light because the state of medium stack is known at the surface intersection,
             // while the medium state at the light is totaly unknown. The medium state will be evaluated during shadow ray traversal.
-            visibility.ray = Ray(ip.intersect, wi, 0, 0.001f, _ip.t - 0.001f);
+            visibility.ray = ip.SpawnRayTo(wi, _ip.t);
+            auto contribution = li * f * weight / bsdf_pdf;
 #ifndef ENABLE_TRANSPARENT_SHADOW
-            if (!li.IsBlack() && visibility.IsVisible())
-                radiance += li * f * weight / bsdf_pdf;
+            if (!li.IsBlack() && shadowRoulette(contribution) && visibility.IsVisible())
+                radiance += contribution;
 #else
             // as long as the ray is passing through the surface, it is necessary to update the medium stack.
             // make sure a copy, instead of the original data is updated to avoid data pollution.
@@ -179,10 +217,10 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
                 material->UpdateMediumStack(mi, interaction_flag, ms_copy);
             }
 
-            if (!li.IsBlack()) {
+            if (!li.IsBlack() && shadowRoulette(contribution)) {
                 const auto attenuation = visibility.GetAttenuation(&ms_copy);
                 if (!attenuation.IsBlack())
-                    radiance += attenuation * li * f * weight / bsdf_pdf;
+                    radiance += attenuation * contribution;
             }
 #endif
         }
@@ -191,13 +229,16 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
     return radiance;
 }
 
-Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms) {
+Spectrum    EvaluateDirect(const InteractionCommon& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms) {
+    SORT_HW_COUNTERS("Light Sampling");
     Spectrum radiance;
-    Visibility visibility(scene);
+    Visibility visibility(scene, light);
     float light_pdf;
     Vector wi;
     const LightSample ls(true);
-    const auto li = light->sample_l(ip, &ls, wi, 0, &light_pdf, 0, nullptr, visibility);
+    const auto li = light->sample_l(ip.intersect, &ls, wi, 0, &light_pdf, 0, nullptr, visibility);
+    visibility.ray.m_time = ip.time;
+    visibility.ray.m_time = ip.time;
     if (light_pdf > 0.0f && !li.IsBlack() ) {
         const auto f = ph->P(wo, wi);
         if (f > 0.0f) {
@@ -218,19 +259,21 @@ Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vecto
 
 // This is only used by SSS for now, since it is a smooth BRDF, there is no need to do MIS.
 Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms) {
-    // Uniformly choose a light, this may not be the optimal solution in case of more lights, need more research in this topic later.
+    SORT_HW_COUNTERS("Light Sampling");
+    // Lights close to and facing the point are more likely to be chosen.
     float light_pick_pdf = 0.0f;
-    const auto light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
+    const auto light = scene.SampleLight( inter.intersect , inter.normal , sort_canonical() , &light_pick_pdf );
     if(IS_PTR_INVALID(light))
         return 0.0f;
 
     Spectrum radiance;
-    Visibility visibility(scene);
+    Visibility visibility(scene, light);
     const auto wo = -r.m_Dir;
     Vector wi;
     LightSample ls(true);
     auto light_pdf = 0.0f;
     const auto li = light->sample_l( inter.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+    visibility.ray.m_time = inter.time;
     if( light_pdf > 0.0f && !li.IsBlack() ){
         Spectrum f = se.Evaluate_BSDF( wo , wi );
 
@@ -259,6 +302,92 @@ Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const Surface
     return radiance;
 }
 
+// It is the same as evaluating direct illumination of each light with the above functions, except that none of the shadow
+// rays is traced right after it is generated. They are queued along with their unoccluded contribution and traced in batches.
+Spectrum SampleAllLights( const ScatteringEvent& se , const Ray& r , const Scene& scene ){
+    SORT_HW_COUNTERS("Light Sampling");
+    const auto& ip = se.GetInteraction();
+    const auto wo = -r.m_Dir;
+
+    Spectrum    radiance;
+    Ray         rays[RAY_PACKET_SIZE];
+    Spectrum    contributions[RAY_PACKET_SIZE];
+    auto        cnt = 0u;
+
+    const auto flush = [&](){
+#ifndef ENABLE_TRANSPARENT_SHADOW
+        const auto visible = scene.IsVisible( rays , cnt );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( visible & ( 1u << i ) )
+                radiance += contributions[i];
+        }
+#else
+        Spectrum attenuations[RAY_PACKET_SIZE];
+        const auto visible = scene.GetAttenuation( rays , attenuations , cnt );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( visible & ( 1u << i ) )
+                radiance += attenuations[i] * contributions[i];
+        }
+#endif
+        cnt = 0;
+    };
+    const auto queue = [&]( const Ray& ray , Spectrum contribution ){
+        if( !shadowRoulette( contribution ) )
+            return;
+
+        rays[cnt] = ray;
+        contributions[cnt] = contribution;
+        if( ++cnt == RAY_PACKET_SIZE )
+            flush();
+    };
+
+    const auto light_num = scene.LightNum();
+    for( auto i = 0u ; i < light_num ; ++i ){
+        const auto light = scene.GetLight(i);
+        const LightSample ls(true);
+        const BsdfSample bs(true);
+
+        Visibility visibility(scene, light);
+        float light_pdf;
+        Vector wi;
+        const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+        visibility.ray.m_time = ip.time;
+        if( light_pdf > 0.0f && !li.IsBlack() ){
+            auto bsdf_pdf = 0.0f;
+            const auto f = light->IsDelta() ? se.Evaluate_BSDF( wo , wi ) : se.Evaluate_BSDF( wo , wi , bsdf_pdf );
+            if( !f.IsBlack() ){
+                const auto weight = light->IsDelta() ? 1.0f : MisFactor( light_pdf , bsdf_pdf );
+                queue( visibility.ray , li * f * weight / light_pdf );
+            }
+        }
+
+        if( light->IsDelta() )
+            continue;
+
+        float bsdf_pdf;
+        const auto f = se.Sample_BSDF( wo , wi , bs , bsdf_pdf );
+        if( f.IsBlack() || bsdf_pdf == 0.0f )
+            continue;
+
+        const auto pdf = light->Pdf( ip.intersect , wi );
+        if( pdf <= 0.0f )
+            continue;
+
+        Spectrum le;
+        SurfaceInteraction _ip;
+        if( false == light->Le( Ray( ip.intersect , wi ) , &_ip , le ) || le.IsBlack() )
+            continue;
+
+        const auto weight = MisFactor( bsdf_pdf , pdf );
+        queue( ip.SpawnRayTo( wi , _ip.t ) , le * f * weight / bsdf_pdf );
+    }
+
+    if( cnt > 0 )
+        flush();
+
+    return radiance;
+}
+
 Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* light , const SurfaceInteraction& ip ,
                             const LightSample& ls ,const BsdfSample& bs , bool replaceSSS ){
     ScatteringEvent se( ip , replaceSSS ? SE_EVALUATE_ALL_NO_SSS : SE_EVALUATE_ALL );
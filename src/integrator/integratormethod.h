@@ -22,16 +22,20 @@
 struct	SurfaceInteraction;
 class	Light;
 class   MediumStack;
+class   PhaseFunction;
 
-// evaluate direct lighting
-Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material, const MediumStack& ms);
+// evaluate direct lighting, infinite lights are looked up prefiltered at the width of the bsdf lobe if 'prefiltered' is set
+Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material, const MediumStack& ms, const bool prefiltered = false);
 Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs);
 
-Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms);
+Spectrum    EvaluateDirect(const InteractionCommon& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms);
 
 // uniformly evaluate direct illumination from one light
 Spectrum    SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms);
 
+// evaluate direct illumination from all lights, shadow rays of all lights are traced in batches
+Spectrum    SampleAllLights( const ScatteringEvent& se , const Ray& r , const Scene& scene );
+
 // helper function to evaluate light contribution
 Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* light , const SurfaceInteraction& ip ,
                             const LightSample& ls , const BsdfSample& bs , bool replaceSSS = false );
\ No newline at end of file
@@ -15,97 +15,276 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
+#include <cfloat>
 #include "ir.h"
 #include "integratormethod.h"
 #include "math/interaction.h"
 #include "core/scene.h"
 #include "light/light.h"
 #include "scatteringevent/scatteringevent.h"
+#include "task/task.h"
+#include "math/utils.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 SORT_STATS_DEFINE_COUNTER(sVPLCount)
+SORT_STATS_DEFINE_MEMORY(sVPLMemory)
 
 SORT_STATS_COUNTER("Instant Radiosity", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_COUNTER("Instant Radiosity", "Virtual Point Lights Count" , sVPLCount);
+SORT_STATS_MEMORY("Virtual Point Lights", sVPLMemory);
+
+// Number of light paths traced in a task.
+static constexpr int IR_PARALLEL_PATHS = 16;
+
+// A cluster is refined if the bound of its error is larger than this fraction of the estimated indirect illumination.
+static constexpr float LIGHTCUTS_ERROR = 0.02f;
+
+// The maximum number of clusters in a cut.
+static constexpr size_t LIGHTCUTS_MAX_CUT = 512;
+
+// Upper bound of the geometry term and the cosine at the shading point for a cluster, without the materials.
+// Materials are bounded as if they were white lambert, the cosine is bounded on both sides of the surface so that
+// transmission is not ignored.
+static float clusterBound( const BBox& bbox , const Point& p , const Vector& n , float min_sqr_dist ){
+    auto sqr_dist = 0.0f;
+    for( auto i = 0u ; i < 3 ; ++i ){
+        const auto d = std::max( 0.0f , std::max( bbox.m_Min[i] - p[i] , p[i] - bbox.m_Max[i] ) );
+        sqr_dist += d * d;
+    }
+
+    // the bounding box is transformed to the local coordinate of the shading point to bound the cosine.
+    Vector t , b;
+    coordinateSystem( n , t , b );
+    BBox local;
+    for( auto i = 0u ; i < 8 ; ++i ){
+        const auto corner = Point( ( i & 1 ) ? bbox.m_Max.x : bbox.m_Min.x , ( i & 2 ) ? bbox.m_Max.y : bbox.m_Min.y , ( i & 4 ) ? bbox.m_Max.z : bbox.m_Min.z ) - p;
+        local.Union( Point( dot( corner , t ) , dot( corner , b ) , dot( corner , n ) ) );
+    }
+    auto closest = [&]( unsigned axis ){
+        return ( local.m_Min[axis] <= 0.0f && local.m_Max[axis] >= 0.0f ) ? 0.0f : std::min( fabs( local.m_Min[axis] ) , fabs( local.m_Max[axis] ) );
+    };
+    const auto z = std::max( fabs( local.m_Min[2] ) , fabs( local.m_Max[2] ) );
+    const auto x = closest( 0 ) , y = closest( 1 );
+    const auto len = sqrt( x * x + y * y + z * z );
+    const auto cos_bound = len > 0.0f ? z / len : 1.0f;
+
+    return cos_bound * INV_PI * INV_PI / std::max( min_sqr_dist , sqr_dist );
+}
+
+// Build a sub-tree of the clusters over the virtual light sources in range, it returns the index of the root.
+static unsigned buildCluster( VirtualLightSources& vpls , std::vector<unsigned>& indices , unsigned start , unsigned end ){
+    auto& clusters = vpls.clusters;
+    const auto index = (unsigned)clusters.size();
+    clusters.emplace_back();
+
+    if( end - start == 1 ){
+        const auto i = indices[start];
+        auto& cluster = clusters[index];
+        cluster.bbox.Union( Point( vpls.x[i] , vpls.y[i] , vpls.z[i] ) );
+        cluster.power = vpls.power[i];
+        cluster.representative = i;
+        cluster.depth = vpls.depth[i];
+        cluster.leaf = true;
+        return index;
+    }
+
+    // virtual light sources are split at the median along the longest axis of their bounding box
+    BBox bbox;
+    for( auto i = start ; i < end ; ++i )
+        bbox.Union( Point( vpls.x[indices[i]] , vpls.y[indices[i]] , vpls.z[indices[i]] ) );
+    const auto& axis_positions = bbox.MaxAxisId() == 0 ? vpls.x : ( bbox.MaxAxisId() == 1 ? vpls.y : vpls.z );
+    const auto mid = ( start + end ) / 2;
+    std::nth_element( indices.begin() + start , indices.begin() + mid , indices.begin() + end ,
+                      [&]( unsigned i0 , unsigned i1 ){ return axis_positions[i0] < axis_positions[i1]; } );
+
+    const auto first = buildCluster( vpls , indices , start , mid );
+    const auto second = buildCluster( vpls , indices , mid , end );
+
+    // the representative is picked proportional to the intensity, which keeps the estimation of the cluster unbiased.
+    const auto& c0 = clusters[first];
+    const auto& c1 = clusters[second];
+    const auto i0 = c0.power.GetIntensity() , i1 = c1.power.GetIntensity();
+    const auto pick_first = i0 + i1 > 0.0f ? sort_canonical() * ( i0 + i1 ) < i0 : true;
+
+    auto& cluster = clusters[index];
+    cluster.bbox = Union( c0.bbox , c1.bbox );
+    cluster.power = c0.power + c1.power;
+    cluster.representative = pick_first ? c0.representative : c1.representative;
+    cluster.depth = std::max( c0.depth , c1.depth );
+    cluster.offset = second;
+    return index;
+}
+
+void VirtualLightSources::BuildClusters( int max_depth ){
+    // virtual light sources without any power are not in the tree either
+    std::vector<unsigned> indices;
+    for( auto i = 0u ; i < Size() ; ++i ){
+        if( depth[i] <= max_depth && power[i].GetIntensity() > 0.0f )
+            indices.push_back( i );
+    }
+
+    clusters.clear();
+    if( !indices.empty() )
+        buildCluster( *this , indices , 0 , (unsigned)indices.size() );
+}
 
 // Preprocess
 void InstantRadiosity::PreProcess( const Scene& scene )
 {
     SORT_PROFILE("Instant Radiosity (LPV distribution stage)");
 
-    m_pVirtualLightSources = std::make_unique<std::list<VirtualLightSource>[]>(m_nLightPathSet);
+    m_virtualLightSources.clear();
+    m_virtualLightSources.resize( m_nLightPathSet );
+
+    // each chunk of light paths goes to its own container, they are merged in order once all tasks are done.
+    const auto chunk_cnt = ( m_nLightPaths + IR_PARALLEL_PATHS - 1 ) / IR_PARALLEL_PATHS;
+    std::vector<VirtualLightSources> chunks( m_nLightPathSet * chunk_cnt );
+    auto trace_chunk = [&]( int k , int c ){
+        const auto end = std::min( m_nLightPaths , ( c + 1 ) * IR_PARALLEL_PATHS );
+        for( auto i = c * IR_PARALLEL_PATHS ; i < end ; ++i ){
+            // keys of the streams are counted down from the largest one to stay away from the keys of pixels.
+            sort_seed( ~(unsigned)k , (unsigned)i );
+            tracePath( scene , chunks[k * chunk_cnt + c] );
+        }
+    };
+
+    if( 1 == m_nLightPathSet * chunk_cnt ){
+        trace_chunk( 0 , 0 );
+    }else{
+        for( int k = 0 ; k < m_nLightPathSet ; ++k ){
+            for( int c = 0 ; c < chunk_cnt ; ++c )
+                SPAWN_TASK<Function_Task>( "Instant Radiosity Light Paths" , DEFAULT_TASK_PRIORITY , {} , [&,k,c](){ trace_chunk( k , c ); } );
+        }
+        WAIT_FOR_CHILDREN();
+    }
 
     for( int k = 0 ; k < m_nLightPathSet ; ++k ){
-        for( int i = 0 ; i < m_nLightPaths ; ++i ){
-            // pick a light first
-            float light_pick_pdf;
-            const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
-
-            // sample a ray from the light source
-            float   light_emission_pdf = 0.0f;
-            float   light_pdfa = 0.0f;
-            Ray     ray;
-            float   cosAtLight = 1.0f;
-            Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
-
-            Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
-
-            int current_depth = 0;
-            SurfaceInteraction intersect;
-            while( true ){
-                if (false == scene.GetIntersect(ray, intersect))
-                    break;
-
-                VirtualLightSource ls;
-                ls.power = throughput;
-                ls.intersect = intersect;
-                ls.wi = -ray.m_Dir;
-                ls.depth = ++current_depth;
-                m_pVirtualLightSources[k].push_back( ls );
-
-                float bsdf_pdf;
-                Vector wo;
-                
-                ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
-                intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
-                Spectrum bsdf_value = se.Sample_BSDF( ls.wi , wo, BsdfSample(true) , bsdf_pdf );
-
-                if( bsdf_pdf == 0.0f )
-                    break;
-
-                // apply russian roulette
-                float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
-                if( sort_canonical() > continueProperbility )
-                    break;
-                throughput /= continueProperbility;
-
-                // update throughput
-                throughput *= bsdf_value / bsdf_pdf;
-
-                // update next ray
-                ray = Ray(intersect.intersect, wo, 0, 0.001f);
-            }
-        }
+        for( int c = 0 ; c < chunk_cnt ; ++c )
+            m_virtualLightSources[k].Append( chunks[k * chunk_cnt + c] );
+
+        // representatives are picked with a stream after the ones of the light paths
+        sort_seed( ~(unsigned)k , (unsigned)m_nLightPaths );
+        m_virtualLightSources[k].BuildClusters( max_recursive_depth );
+        SORT_STATS(sVPLCount+=m_virtualLightSources[k].Size());
+    }
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    StatsInt vpl_cnt = 0;
+    StatsInt cluster_cnt = 0;
+    for( const auto& vpls : m_virtualLightSources ){
+        vpl_cnt += vpls.Size();
+        cluster_cnt += vpls.clusters.size();
+    }
+    m_memoryRecord.Track( &sVPLMemory , vpl_cnt * (StatsInt)( 3 * sizeof(float) + sizeof(int) + sizeof(Spectrum) + sizeof(Vector) + sizeof(SurfaceInteraction) ) +
+                                        cluster_cnt * (StatsInt)sizeof(VirtualLightSources::Cluster) );
+#endif
+}
 
-        SORT_STATS(sVPLCount+=m_pVirtualLightSources[k].size());
+void InstantRadiosity::tracePath( const Scene& scene , VirtualLightSources& vpls ) const{
+    // scattering events of the path are not needed once it is done.
+    SORT_MEMPOOL_SCOPE();
+
+    // pick a light first
+    float light_pick_pdf;
+    const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
+
+    // sample a ray from the light source
+    float   light_emission_pdf = 0.0f;
+    float   light_pdfa = 0.0f;
+    Ray     ray;
+    float   cosAtLight = 1.0f;
+    Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+
+    Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
+
+    int current_depth = 0;
+    SurfaceInteraction intersect;
+    while( true ){
+        if (false == scene.GetIntersect(ray, intersect))
+            break;
+
+        const auto wi = -ray.m_Dir;
+        vpls.Add( intersect , wi , throughput , ++current_depth );
+
+        float bsdf_pdf;
+        Vector wo;
+        
+        ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
+        intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
+        Spectrum bsdf_value = se.Sample_BSDF( wi , wo, BsdfSample(true) , bsdf_pdf );
+
+        if( bsdf_pdf == 0.0f )
+            break;
+
+        // apply russian roulette
+        float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
+        if( sort_canonical() > continueProperbility )
+            break;
+        throughput /= continueProperbility;
+
+        // update throughput
+        throughput *= bsdf_value / bsdf_pdf;
+
+        // update next ray
+        ray = intersect.SpawnRay(wo);
     }
 }
 
+// contribution of a virtual light source to a shading point
+Spectrum InstantRadiosity::gather( const Ray& r , const SurfaceInteraction& ip , const ScatteringEvent& se , const VirtualLightSources& vpls , unsigned i , const Scene& scene ) const{
+    if( r.m_Depth + vpls.depth[i] > max_recursive_depth )
+        return 0.0f;
+
+    const auto  delta = Vector( ip.intersect.x - vpls.x[i] , ip.intersect.y - vpls.y[i] , ip.intersect.z - vpls.z[i] );
+    const auto  sqrLen = delta.SquaredLength();
+    const auto  len = sqrt( sqrLen );
+    const auto  n_delta = delta / len;
+
+    // the material of the virtual light source is only evaluated if the shading point could receive light from it.
+    const auto    f0 = se.Evaluate_BSDF( -r.m_Dir , -n_delta );
+    if( f0.IsBlack() )
+        return 0.0f;
+
+    // the scattering event of the virtual light source is not needed after this
+    SORT_MEMPOOL_SCOPE();
+
+    const auto& vpl_inter = vpls.intersect[i];
+    ScatteringEvent se1( vpl_inter , SE_EVALUATE_ALL_NO_SSS );
+    vpl_inter.primitive->GetMaterial()->UpdateScatteringEvent(se1);
+
+    const auto    gterm = 1.0f / std::max( m_fMinSqrDist , sqrLen );
+    const auto    f1 = se1.Evaluate_BSDF( n_delta , vpls.wi[i] );
+
+    Spectrum    contr = gterm * f0 * f1 * vpls.power[i];
+    if( contr.IsBlack() )
+        return 0.0f;
+
+    Visibility vis(scene);
+    vis.ray = vpl_inter.SpawnRayTo( n_delta , len );
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    return vis.IsVisible() ? contr : 0.0f;
+#else
+    return contr * vis.GetAttenuation();
+#endif
+}
+
 // radiance along a specific ray direction
-Spectrum InstantRadiosity::Li( const Ray& r , const PixelSample& ps  , const Scene& scene ) const{
-    SORT_STATS( ++sPrimaryRayCount );
-    return _li( r , scene );
+Spectrum InstantRadiosity::Li( const Ray& r , const PixelSample& ps  , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SORT_STATS_HOT( ++sPrimaryRayCount );
+    return _li( r , scene , false , nullptr , primary );
 }
 
 // private method of li
-Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreLe , float* first_intersect_dist ) const{
+Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreLe , float* first_intersect_dist , const SurfaceInteraction* primary ) const{
     // return if it is larger than the maximum depth
     if( r.m_Depth > max_recursive_depth )
         return 0.0f;
 
     // get intersection from camera ray
     SurfaceInteraction ip;
-    if( false == scene.GetIntersect( r , ip ) )
+    if( false == getPrimaryIntersection( r , primary , scene , ip ) )
         return ignoreLe?0.0f:scene.Le( r );
 
     // evaluate light path less than two vertices
@@ -121,48 +300,66 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
 
     // pick a virtual light source randomly
     const unsigned lps_id = std::min( m_nLightPathSet - 1 , (int)(sort_canonical() * m_nLightPathSet) );
-    std::list<VirtualLightSource> vps = m_pVirtualLightSources[lps_id];
+    const auto& vpls = m_virtualLightSources[lps_id];
 
     ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
     ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
 
-    // evaluate indirect illumination
+    // evaluate indirect illumination with a cut of the light tree, starting from the root, the cluster with the largest
+    // error bound is replaced with its children until all bounds are small enough compared with the estimation.
     Spectrum indirectIllum;
-    std::list<VirtualLightSource>::const_iterator it = vps.begin();
-    while( it != vps.end() ){
-        if( r.m_Depth + it->depth > max_recursive_depth ){
-            ++it;
-            continue;
-        }
-
-        const auto  delta = ip.intersect - it->intersect.intersect;
-        const auto  sqrLen = delta.SquaredLength();
-        const auto  len = sqrt( sqrLen );
-        const auto  n_delta = delta / len;
-
-        ScatteringEvent se1( it->intersect , SE_EVALUATE_ALL_NO_SSS );
-        it->intersect.primitive->GetMaterial()->UpdateScatteringEvent(se1);
-
-        const auto    gterm = 1.0f / std::max( m_fMinSqrDist , sqrLen );
-        const auto    f0 = se.Evaluate_BSDF( -r.m_Dir , -n_delta );
-        const auto    f1 = se1.Evaluate_BSDF( n_delta , it->wi );
-
-        Spectrum    contr = gterm * f0 * f1 * it->power;
-        if( !contr.IsBlack() ){
-            Visibility vis(scene);
-            vis.ray = Ray( it->intersect.intersect , n_delta , 0 , 0.001f , len - 0.001f );
-
-#ifndef ENABLE_TRANSPARENT_SHADOW
-            if( vis.IsVisible() )
-                indirectIllum += contr;
-#else
-            const auto attenuation = vis.GetAttenuation();
-            if( !attenuation.IsBlack() )
-                indirectIllum += contr * attenuation;
-#endif
+    if( !vpls.clusters.empty() ){
+        struct CutCluster{
+            unsigned    index;          /**< Index of the cluster. */
+            float       bound;          /**< Upper bound of the error of the estimation. */
+            Spectrum    contribution;   /**< Contribution of the representative. */
+            Spectrum    estimation;     /**< Estimated contribution of the cluster. */
+        };
+        const auto cmp = []( const CutCluster& c0 , const CutCluster& c1 ){ return c0.bound < c1.bound; };
+
+        auto make_cut_cluster = [&]( unsigned index , const Spectrum* contribution ){
+            const auto& cluster = vpls.clusters[index];
+            CutCluster ret;
+            ret.index = index;
+            ret.contribution = contribution ? *contribution : gather( r , ip , se , vpls , cluster.representative , scene );
+            if( cluster.leaf ){
+                ret.bound = 0.0f;
+                ret.estimation = ret.contribution;
+            }else{
+                // clusters with virtual light sources too deep for the ray are always refined.
+                const auto intensity = cluster.power.GetIntensity();
+                ret.bound = r.m_Depth + cluster.depth > max_recursive_depth ? FLT_MAX : intensity * clusterBound( cluster.bbox , ip.intersect , ip.normal , m_fMinSqrDist );
+                ret.estimation = ret.contribution * ( intensity / vpls.power[cluster.representative].GetIntensity() );
+            }
+            return ret;
+        };
+
+        std::vector<CutCluster> cut;
+        cut.push_back( make_cut_cluster( 0 , nullptr ) );
+        indirectIllum = cut[0].estimation;
+        while( cut.size() < LIGHTCUTS_MAX_CUT ){
+            if( cut.front().bound <= LIGHTCUTS_ERROR * indirectIllum.GetIntensity() )
+                break;
+
+            std::pop_heap( cut.begin() , cut.end() , cmp );
+            const auto refined = cut.back();
+            cut.pop_back();
+            indirectIllum -= refined.estimation;
+
+            // one of the children shares the representative of the cluster, its contribution is already evaluated.
+            const auto& cluster = vpls.clusters[refined.index];
+            for( const auto child : { refined.index + 1 , cluster.offset } ){
+                const auto shared = vpls.clusters[child].representative == cluster.representative;
+                cut.push_back( make_cut_cluster( child , shared ? &refined.contribution : nullptr ) );
+                indirectIllum += cut.back().estimation;
+                std::push_heap( cut.begin() , cut.end() , cmp );
+            }
         }
 
-        ++it;
+        // sum up the cut again to get rid of the error accumulated by subtracting the refined clusters
+        indirectIllum = 0.0f;
+        for( const auto& c : cut )
+            indirectIllum += c.estimation;
     }
     radiance += indirectIllum / (float)m_nLightPaths;
 
@@ -174,7 +371,7 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
         if( !f.IsBlack() && bsdf_pdf != 0.0f ){
             PixelSample ps;
             float gather_dist;
-            Ray gather_ray( ip.intersect , wi , r.m_Depth + 1 , 0.001f , m_fMinDist - 0.001f );
+            const auto gather_ray = ip.SpawnRay( wi , r.m_Depth + 1 , m_fMinDist );
             Spectrum li = _li( gather_ray , scene , true , &gather_dist );
 
             if( !li.IsBlack() ){
@@ -17,15 +17,67 @@
 
 #pragma once
 
-#include <list>
+#include <vector>
 #include "integrator.h"
 #include "math/interaction.h"
 
-struct VirtualLightSource{
-    SurfaceInteraction  intersect;
-    Vector              wi;
-    Spectrum            power;
-    int                 depth;
+//! @brief  Virtual light sources of a light path set, kept as a structure of arrays.
+/**
+ * Gathering illumination touches the position, depth and power of every virtual light source, while the surface
+ * interactions, which are a lot larger, are only touched for the ones that could contribute to the shading point.
+ * A light tree clusters the virtual light sources so that a shading point only evaluates a cut of the tree.
+ */
+struct VirtualLightSources{
+    //! @brief  A cluster in the light tree, children of an interior cluster are the next one and the one at 'offset'.
+    struct Cluster{
+        BBox        bbox;                   /**< Bounding box of the virtual light sources in the cluster. */
+        Spectrum    power;                  /**< Total power of the virtual light sources in the cluster. */
+        unsigned    representative = 0;     /**< The virtual light source representing the cluster. */
+        unsigned    offset = 0;             /**< Index of the second child of an interior cluster. */
+        int         depth = 0;              /**< The largest depth of the virtual light sources in the cluster. */
+        bool        leaf = false;           /**< Whether it is a single virtual light source. */
+    };
+
+    std::vector<float>              x , y , z;      /**< Positions of the virtual light sources. */
+    std::vector<int>                depth;          /**< Depths of the virtual light sources in their light paths. */
+    std::vector<Spectrum>           power;          /**< Power of the virtual light sources. */
+    std::vector<Vector>             wi;             /**< Directions where the light comes from. */
+    std::vector<SurfaceInteraction> intersect;      /**< Surfaces where the virtual light sources are. */
+    std::vector<Cluster>            clusters;       /**< The light tree, the first cluster is the root. */
+
+    //! @brief  Number of virtual light sources.
+    unsigned Size() const {
+        return (unsigned)depth.size();
+    }
+
+    //! @brief  Add a virtual light source.
+    void Add( const SurfaceInteraction& inter , const Vector& dir , const Spectrum& pow , int d ){
+        x.push_back( inter.intersect.x );
+        y.push_back( inter.intersect.y );
+        z.push_back( inter.intersect.z );
+        depth.push_back( d );
+        power.push_back( pow );
+        wi.push_back( dir );
+        intersect.push_back( inter );
+    }
+
+    //! @brief  Append all virtual light sources of another set.
+    void Append( const VirtualLightSources& other ){
+        x.insert( x.end() , other.x.begin() , other.x.end() );
+        y.insert( y.end() , other.y.begin() , other.y.end() );
+        z.insert( z.end() , other.z.begin() , other.z.end() );
+        depth.insert( depth.end() , other.depth.begin() , other.depth.end() );
+        power.insert( power.end() , other.power.begin() , other.power.end() );
+        wi.insert( wi.end() , other.wi.begin() , other.wi.end() );
+        intersect.insert( intersect.end() , other.intersect.begin() , other.intersect.end() );
+    }
+
+    //! @brief  Build the light tree over the virtual light sources.
+    //!
+    //! Representatives of the clusters are picked randomly, proportional to the intensity of the virtual light sources.
+    //!
+    //! @param  max_depth   Virtual light sources deeper than this are not in the tree since they never contribute.
+    void BuildClusters( int max_depth );
 };
 
 //! @brief  Instant radiosity integrator.
@@ -34,6 +86,11 @@ struct VirtualLightSource{
  * First pass generates virtual light sources along the path tracing from light sources.
  * Second pass will use those virtual light source to evaluate indirect illuimination.
  * Direct illumination is handled the same way in directlight integrator.
+ *
+ * Instead of gathering every virtual light source, a shading point evaluates a cut of the light tree, refining the
+ * cluster with the largest error bound until all bounds are small relative to the estimated illumination.
+ * 'Lightcuts: A Scalable Approach to Illumination', Bruce Walter, Sebastian Fernandez, Adam Arbree, Kavita Bala,
+ * Michael Donikian, Donald P. Greenberg.
  */
 class   InstantRadiosity : public Integrator{
 public:
@@ -44,12 +101,15 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary) const override;
 
     //! @brief  Preprocess before second phase happens.
     //!
     //! In preprocessing stage, numbers of virtual light sources are generated along the path tracing from light sources.
+    //! Light paths are traced in parallel tasks, each light path draws random numbers of its own stream so that the
+    //! virtual light sources don't depend on how the tasks are scheduled.
     //!
     //! @param  scene           The scene to be evaluated.
     void PreProcess( const Scene& scene ) override;
@@ -75,10 +135,30 @@ private:
     float   m_fMinDist      = 1.0f;
     float   m_fMinSqrDist   = 1.0f;
 
-    /**< container for light sources. */
-    std::unique_ptr<std::list<VirtualLightSource>[]>    m_pVirtualLightSources;
+    /**< virtual light sources of each light path set. */
+    std::vector<VirtualLightSources>    m_virtualLightSources;
+
+    /**< Memory of the virtual light sources accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
+
+    Spectrum _li( const Ray& ray , const Scene& scene , bool ignoreLe = false , float* first_intersect_dist = 0 , const SurfaceInteraction* primary = nullptr ) const;
+
+    //! @brief  Contribution of a virtual light source to a shading point, including its visibility.
+    //!
+    //! @param  r               The ray reaching the shading point.
+    //! @param  ip              The shading point.
+    //! @param  se              The scattering event of the shading point.
+    //! @param  vpls            The virtual light sources.
+    //! @param  i               Index of the virtual light source.
+    //! @param  scene           The scene to be evaluated.
+    //! @return                 The radiance reflected towards the ray from the virtual light source.
+    Spectrum gather( const Ray& r , const SurfaceInteraction& ip , const ScatteringEvent& se , const VirtualLightSources& vpls , unsigned i , const Scene& scene ) const;
 
-    Spectrum _li( const Ray& ray , const Scene& scene , bool ignoreLe = false , float* first_intersect_dist = 0 ) const;
+    //! @brief  Trace a light path and generate virtual light sources along it.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  vpls            The container of the generated virtual light sources.
+    void tracePath( const Scene& scene , VirtualLightSources& vpls ) const;
 
     SORT_STATS_ENABLE( "Instant Radiosity" )
 };
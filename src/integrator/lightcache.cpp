@@ -0,0 +1,166 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <cmath>
+#include <algorithm>
+#include "lightcache.h"
+#include "core/scene.h"
+
+// Upper bound of the number of entries in the table of contributions, 16MB of them along with the records.
+static constexpr unsigned MAX_ENTRIES = 1u << 21;
+
+// The most cells along each axis of the grid.
+static constexpr unsigned MAX_RESOLUTION = 16;
+
+// Fraction of lights picked by the light tree in cells that have learned their distributions.
+static constexpr float DEFENSIVE_FRACTION = 0.25f;
+
+// Cells with fewer records than this are not trusted.
+static constexpr unsigned MIN_RECORDS = 64;
+
+// Contributions are recorded in this number of passes, the first passes of progressive rendering are short.
+static constexpr unsigned LEARNING_PASSES = 5;
+
+// Accumulate into an atomic float, there is no 'fetch_add' for floats before C++20.
+static void atomicAdd( std::atomic<float>& dst , float v ){
+    auto cur = dst.load( std::memory_order_relaxed );
+    while( !dst.compare_exchange_weak( cur , cur + v , std::memory_order_relaxed ) );
+}
+
+LightCache::LightCache( const Scene& scene ){
+    const auto& bbox = scene.GetBBox();
+    m_origin = bbox.m_Min;
+    m_extent = bbox.m_Max - bbox.m_Min;
+
+    for( const auto light : scene.GetLights() ){
+        m_indices[light] = (unsigned)m_lights.size();
+        m_lights.push_back( light );
+    }
+
+    const auto light_cnt = std::max( (unsigned)m_lights.size() , 1u );
+    m_resolution = std::min( std::max( (unsigned)std::cbrt( (float)( MAX_ENTRIES / light_cnt ) ) , 1u ) , MAX_RESOLUTION );
+
+    const auto cell_cnt = m_resolution * m_resolution * m_resolution;
+    const auto entry_cnt = cell_cnt * light_cnt;
+    m_contribution = std::make_unique<std::atomic<float>[]>( entry_cnt );
+    m_records = std::make_unique<std::atomic<unsigned>[]>( entry_cnt );
+    for( auto i = 0u ; i < entry_cnt ; ++i ){
+        m_contribution[i].store( 0.0f , std::memory_order_relaxed );
+        m_records[i].store( 0u , std::memory_order_relaxed );
+    }
+    m_cdf.resize( cell_cnt );
+}
+
+unsigned LightCache::locate( const Point& p ) const{
+    unsigned c[3];
+    for( auto i = 0u ; i < 3 ; ++i ){
+        const auto x = m_extent[i] > 0.0f ? ( p[i] - m_origin[i] ) / m_extent[i] : 0.5f;
+        c[i] = std::min( (unsigned)std::max( x * m_resolution , 0.0f ) , m_resolution - 1 );
+    }
+    return ( c[2] * m_resolution + c[1] ) * m_resolution + c[0];
+}
+
+float LightCache::pmf( const std::vector<float>& cdf , unsigned i ){
+    return cdf[i] - ( i > 0 ? cdf[i - 1] : 0.0f );
+}
+
+const Light* LightCache::Sample( const Scene& scene , const Point& p , const Vector& n , float u , float* pdf ) const{
+    const auto& cdf = m_cdf[locate( p )];
+    if( cdf.empty() )
+        return scene.SampleLight( p , n , u , pdf );
+
+    // the random number is reused for picking the light after picking the strategy.
+    const Light* light = nullptr;
+    auto tree_pdf = 0.0f , cache_pdf = 0.0f;
+    if( u < DEFENSIVE_FRACTION ){
+        light = scene.SampleLight( p , n , std::min( u / DEFENSIVE_FRACTION , 1.0f ) , &tree_pdf );
+        if( nullptr == light )
+            return nullptr;
+        cache_pdf = pmf( cdf , m_indices.at( light ) );
+    }else{
+        // a cell where every light picked so far is blocked never picks lights with its own distribution.
+        const auto v = ( u - DEFENSIVE_FRACTION ) / ( 1.0f - DEFENSIVE_FRACTION ) * cdf.back();
+        const auto i = (unsigned)( std::upper_bound( cdf.begin() , cdf.end() , v ) - cdf.begin() );
+        if( cdf.back() <= 0.0f || i >= cdf.size() )
+            return nullptr;
+        light = m_lights[i];
+        cache_pdf = pmf( cdf , i );
+        tree_pdf = scene.LightPdf( p , n , light );
+    }
+
+    const auto mixed = DEFENSIVE_FRACTION * tree_pdf + ( 1.0f - DEFENSIVE_FRACTION ) * cache_pdf;
+    if( mixed <= 0.0f )
+        return nullptr;
+    if( pdf )
+        *pdf = mixed;
+    return light;
+}
+
+void LightCache::Record( const Point& p , const Light* light , float contribution ){
+    if( !m_learning || !( contribution >= 0.0f ) || std::isinf( contribution ) )
+        return;
+
+    const auto it = m_indices.find( light );
+    if( it == m_indices.end() )
+        return;
+
+    const auto entry = locate( p ) * (unsigned)m_lights.size() + it->second;
+    atomicAdd( m_contribution[entry] , contribution );
+    m_records[entry].fetch_add( 1 , std::memory_order_relaxed );
+}
+
+void LightCache::Update(){
+    if( !m_learning )
+        return;
+
+    // lights are picked proportionally to their average contribution when they are picked, which doesn't depend on how
+    // often they are picked. Lights never picked in a cell are only picked by the light tree.
+    const auto light_cnt = (unsigned)m_lights.size();
+    for( auto cell = 0u ; cell < m_cdf.size() ; ++cell ){
+        const auto offset = cell * light_cnt;
+
+        auto records = 0u;
+        for( auto i = 0u ; i < light_cnt ; ++i )
+            records += m_records[offset + i].load( std::memory_order_relaxed );
+        if( records < MIN_RECORDS )
+            continue;
+
+        auto& cdf = m_cdf[cell];
+        cdf.resize( light_cnt );
+        auto sum = 0.0f;
+        for( auto i = 0u ; i < light_cnt ; ++i ){
+            const auto cnt = m_records[offset + i].load( std::memory_order_relaxed );
+            sum += cnt > 0 ? m_contribution[offset + i].load( std::memory_order_relaxed ) / cnt : 0.0f;
+            cdf[i] = sum;
+        }
+
+        // the cdf is normalized unless everything is blocked, the last entry tells which it is.
+        if( sum > 0.0f ){
+            for( auto& c : cdf )
+                c /= sum;
+            cdf.back() = 1.0f;
+        }
+    }
+
+    // the table is not needed once the distributions are fixed.
+    if( ++m_passes >= LEARNING_PASSES ){
+        m_learning = false;
+        m_contribution = nullptr;
+        m_records = nullptr;
+    }
+}
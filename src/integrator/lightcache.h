@@ -0,0 +1,105 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include "math/bbox.h"
+
+class Light;
+class Scene;
+
+//! @brief  What light selection learns about the shadowed contribution of lights during progressive rendering.
+/**
+ * The light tree picks lights by how much they could contribute to a shading point, without knowing whether they are
+ * occluded, lights behind walls are picked as often as the visible ones. A coarse grid over the scene records the
+ * actual contribution of each light picked in each cell, shadowed, during the first passes. Once a cell has enough
+ * records, lights are picked proportionally to their average contribution there, mixed with the light tree so that
+ * every light that could contribute is still picked sometimes, which keeps it unbiased. Lights that are always blocked
+ * in a cell are only picked by the light tree part then, most of the shadow rays to them are gone.
+ *
+ * Contributions are accumulated with atomic operations in a table shared by all threads, since a table of every light
+ * in every cell is too large to be duplicated for every thread. The resolution of the grid drops with the number of
+ * lights to keep the table bounded.
+ */
+class LightCache{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  scene       The scene to be rendered, with its lights.
+    explicit LightCache( const Scene& scene );
+
+    //! @brief  Pick a light for a shading point.
+    //!
+    //! It is the same as 'Scene::SampleLight' in cells that haven't learned anything yet.
+    //!
+    //! @param  scene       The scene to be rendered.
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal of the shading point, zero vector if there is no surface, like inside media.
+    //! @param  u           A canonical random variable.
+    //! @param  pdf         The probability of picking the light.
+    //! @return             The light picked, nullptr if no light is picked.
+    const Light* Sample( const Scene& scene , const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Record the shadowed contribution of a light picked for a shading point.
+    //!
+    //! @param  p               The position of the shading point.
+    //! @param  light           The light picked.
+    //! @param  contribution    Intensity of the contribution of the light, not divided by the probability of picking it.
+    void Record( const Point& p , const Light* light , float contribution );
+
+    //! @brief  Whether contributions are still recorded.
+    //!
+    //! @return     Whether lights picked should be recorded.
+    bool IsLearning() const {
+        return m_learning;
+    }
+
+    //! @brief  Update the distributions of lights in all cells with what is recorded so far.
+    //!
+    //! It should only be called when no thread is recording or sampling. Recording stops after a few passes.
+    void Update();
+
+private:
+    //! @brief  Locate the cell holding a position.
+    //!
+    //! @param  p       The position.
+    //! @return         Index of the cell.
+    unsigned locate( const Point& p ) const;
+
+    //! @brief  Probability of picking a light with the learned distribution of a cell.
+    //!
+    //! @param  cdf     The cumulative distribution of the cell.
+    //! @param  i       Index of the light.
+    //! @return         The probability of picking the light.
+    static float pmf( const std::vector<float>& cdf , unsigned i );
+
+    Point                                       m_origin;               /**< The lower corner of the bounding box. */
+    Vector                                      m_extent;               /**< Size of the bounding box. */
+    unsigned                                    m_resolution = 1;       /**< Number of cells along each axis. */
+    std::vector<const Light*>                   m_lights;               /**< All lights in the scene. */
+    std::unordered_map<const Light*, unsigned>  m_indices;              /**< Index of each light. */
+    std::unique_ptr<std::atomic<float>[]>       m_contribution;         /**< Sum of contributions of every light in every cell. */
+    std::unique_ptr<std::atomic<unsigned>[]>    m_records;              /**< Number of records of every light in every cell. */
+    std::vector<std::vector<float>>             m_cdf;                  /**< Learned distributions of lights, empty for cells not learned yet. */
+    unsigned                                    m_passes = 0;           /**< Number of passes recorded so far. */
+    bool                                        m_learning = true;      /**< Whether contributions are still recorded. */
+};
@@ -15,104 +15,475 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <chrono>
+#include <cstdio>
+#include <fstream>
 #include "pathtracing.h"
 #include "math/interaction.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
 #include "core/scene.h"
 #include "integratormethod.h"
 #include "camera/camera.h"
+#include "light/light.h"
 #include "core/log.h"
 #include "core/profile.h"
 #include "scatteringevent/bsdf/lambert.h"
 #include "scatteringevent/scatteringevent.h"
 #include "medium/medium.h"
 #include "medium/phasefunction.h"
+#include "imagesensor/aov.h"
+#include "core/globalconfig.h"
+#include "core/path.h"
+#include "stream/fstream.h"
 
-SORT_STATS_DEFINE_COUNTER(sTotalPathLength)
+SORT_STATS_DEFINE_HOT_COUNTER(sTotalPathLength)
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Path Tracing", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_AVG_COUNT("Path Tracing", "Average Length of Path", sTotalPathLength , sPrimaryRayCount);    // This also counts the case where ray hits sky
 
-Spectrum PathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const{
+// The probability of sampling the learned radiance instead of the bsdf once something is learned.
+static constexpr float GUIDING_FRACTION = 0.5f;
+
+// A vertex of the path whose incident radiance is recorded into the guiding tree once the path is done.
+struct GuidingVertex{
+    Point       position;       /**< Position of the vertex. */
+    Vector      direction;      /**< The sampled direction where the radiance comes from. */
+    Spectrum    throughput;     /**< Throughput of the path after scattering at the vertex. */
+    Spectrum    radiance;       /**< The radiance gathered by the path before leaving the vertex. */
+    float       pdf = 0.0f;     /**< Pdf of sampling the direction. */
+};
+
+// Logarithm of the number of cells in the radiance cache.
+static constexpr unsigned RADIANCE_CACHE_BITS = 20;
+
+// Size of the cells of the radiance cache relative to the length of the path from the camera.
+static constexpr float RADIANCE_CACHE_CELL_SCALE = 0.02f;
+
+// Directions sampled with a pdf larger than this are not diffuse, which is more than the pdf of lambert anywhere.
+static constexpr float RADIANCE_CACHE_DIFFUSE_PDF = 1.0f;
+
+// Number of points on all surfaces with SSS in the irradiance cache.
+static constexpr unsigned SSS_IRRADIANCE_POINTS = 1u << 18;
+
+// Number of samples of the irradiance at each point in the irradiance cache.
+static constexpr unsigned SSS_IRRADIANCE_SAMPLES = 16;
+
+// Lights closer to a ray than this are not sampled with equiangular sampling, whose pdf is too peaked around them.
+static constexpr float EQUIANGULAR_MIN_DISTANCE = 1e-4f;
+
+// Equiangular sampling picks points along a ray segment with a pdf proportional to the inverse squared distance to a
+// point light. 'Importance Sampling Techniques for Path Tracing in Participating Media', Christopher Kulla et al.
+struct EquiangularSegment{
+    float   delta = 0.0f;       /**< Distance along the ray to the point closest to the light. */
+    float   distance = 0.0f;    /**< Distance between the light and the ray. */
+    float   thetaA = 0.0f;      /**< Angle of the start of the segment seen from the light. */
+    float   thetaB = 0.0f;      /**< Angle of the end of the segment seen from the light. */
+
+    EquiangularSegment( const Ray& r , const Point& light_pos , const float max_t ){
+        delta = dot( light_pos - r.m_Ori , r.m_Dir );
+        distance = ( light_pos - r( delta ) ).Length();
+        thetaA = atan2( -delta , distance );
+        thetaB = atan2( max_t - delta , distance );
+    }
+
+    bool IsValid() const{
+        return distance > EQUIANGULAR_MIN_DISTANCE && thetaB > thetaA;
+    }
+
+    float Sample( const float u , float& pdf ) const{
+        const auto t = delta + distance * tan( thetaA + u * ( thetaB - thetaA ) );
+        pdf = Pdf( t );
+        return t;
+    }
+
+    float Pdf( const float t ) const{
+        const auto d = t - delta;
+        return distance / ( ( thetaB - thetaA ) * ( distance * distance + d * d ) );
+    }
+};
+
+// The weight of equiangular sampling at a point on a ray segment of a medium, distance sampling takes the rest of it.
+// The pdf of distance sampling in heterogeneous media has no closed form, it is replaced with a uniform pdf along the
+// segment. Since both strategies use the same weights, which always sum up to one, the result stays unbiased.
+static float equiangularWeight( const EquiangularSegment& segment , const float max_t , const float t ){
+    if( !segment.IsValid() )
+        return 0.0f;
+    const auto pdf_e = segment.Pdf( t );
+    const auto pdf_d = 1.0f / max_t;
+    return pdf_e / ( pdf_e + pdf_d );
+}
+
+// What is learned in a frame is saved to these files in the resource folder, to warm start the next frame.
+static const char* GUIDING_TREE_FILE = "guiding.learned";
+static const char* ROULETTE_CACHE_FILE = "roulette.learned";
+static const char* RADIANCE_CACHE_FILE = "radiance.learned";
+
+// Identifier of files of learned caches.
+static constexpr unsigned   LEARNED_CACHE_MAGIC     = 0x4e524c53;
+// This needs to be updated every time the layout of any learned cache changes.
+static constexpr unsigned   LEARNED_CACHE_VERSION   = 1;
+
+// Save a learned cache to the resource folder, through a temporary file so that no process loads half of it.
+template<class T>
+static void saveLearnedCache( const T& cache , const char* name ){
+    const auto filename = GetFilePathInResourceFolder( name );
+    const auto tmp_file = filename + ".tmp";
+    auto saved = false;
+    {
+        OFileStream stream( tmp_file );
+        stream << LEARNED_CACHE_MAGIC << LEARNED_CACHE_VERSION;
+        cache.Save( stream );
+        saved = stream.IsValid();
+    }
+
+    if( !saved ){
+        std::remove( tmp_file.c_str() );
+        slog( WARNING , INTEGRATOR , "Failed to save learned cache %s." , filename.c_str() );
+        return;
+    }
+    std::remove( filename.c_str() );
+    std::rename( tmp_file.c_str() , filename.c_str() );
+}
+
+// Load a learned cache saved by the last frame into a newly created cache.
+template<class T>
+static bool loadLearnedCache( T& cache , const char* name ){
+    // check whether the file exists first since the first frame has nothing to load
+    const auto filename = GetFilePathInResourceFolder( name );
+    if( !std::ifstream( filename , std::ios::in | std::ios::binary ).good() )
+        return false;
+
+    IFileStream stream( filename );
+    unsigned magic = 0 , version = 0;
+    stream >> magic >> version;
+    if( !stream.IsValid() || LEARNED_CACHE_MAGIC != magic || LEARNED_CACHE_VERSION != version )
+        return false;
+    if( !cache.Load( stream ) || !stream.IsValid() ){
+        slog( WARNING , INTEGRATOR , "Learned cache %s doesn't match the settings or it is corrupted." , filename.c_str() );
+        return false;
+    }
+    return true;
+}
+
+// A diffuse vertex of the path whose incident radiance is recorded into the radiance cache once the path is done.
+struct CacheVertex{
+    Point       position;       /**< Position of the vertex. */
+    Vector      normal;         /**< Normal of the surface facing the path. */
+    float       cellSize;       /**< Size of the cell for the vertex. */
+    Spectrum    throughput;     /**< Throughput of the path after scattering at the vertex. */
+    Spectrum    radiance;       /**< The radiance gathered by the path before leaving the vertex. */
+    float       weight;         /**< Cosine of the sampled direction divided by its pdf and PI. */
+};
+
+// A vertex of the path whose reflected radiance is recorded into the roulette cache once the path is done.
+struct RouletteVertex{
+    Point       position;       /**< Position of the vertex. */
+    Spectrum    throughput;     /**< Throughput of the path arriving at the vertex. */
+    Spectrum    radiance;       /**< The radiance gathered by the path before the vertex. */
+};
+
+void PathTracing::PreProcess( const Scene& scene ){
+    // What is learned during rendering depends on the order samples are taken, and the roulette cache even on timing.
+    if( g_deterministic && ( m_pathGuiding || m_efficiencyAwareRoulette || m_useRadianceCache || m_useSSSIrradianceCache || m_useLightCache ) ){
+        slog( WARNING , INTEGRATOR , "Path guiding, efficiency aware roulette, radiance cache, SSS irradiance cache and light cache are disabled in deterministic mode." );
+        m_pathGuiding = m_efficiencyAwareRoulette = m_useRadianceCache = m_useSSSIrradianceCache = m_useLightCache = false;
+    }
+
+    // Paths traced for the SSS irradiance cache are not learned by any of the other caches, what is learned in the last
+    // frame of a sequence is put aside until the SSS irradiance cache is built.
+    auto last_guiding_tree = std::move( m_guidingTree );
+    auto last_roulette_cache = std::move( m_rouletteCache );
+    auto last_radiance_cache = std::move( m_radianceCache );
+    m_sssCache = nullptr;
+    m_lightCache = nullptr;
+    if( m_useSSSIrradianceCache ){
+        auto cache = std::make_unique<SSSIrradianceCache>();
+        cache->Build( scene , SSS_IRRADIANCE_POINTS , [&]( const SurfaceInteraction& inter ){
+            SORT_MEMPOOL_SCOPE();
+
+            // a white lambert reflects the irradiance divided by PI, SSS is replaced with lambert beyond the point
+            ScatteringEvent se( inter , SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ) );
+            se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
+
+            const auto material = inter.primitive->GetMaterial();
+            const Ray r( inter.intersect + inter.normal , -inter.normal );
+            const MediumStack ms;
+
+            Spectrum radiosity;
+            for( auto i = 0u ; i < SSS_IRRADIANCE_SAMPLES ; ++i ){
+                SORT_MEMPOOL_SCOPE();
+                radiosity += SampleOneLight( se , r , inter , scene , material , ms );
+
+                float pdf = 0.0f;
+                Vector wi;
+                const auto f = se.Sample_BSDF( inter.normal , wi , BsdfSample(true) , pdf );
+                if( !f.IsBlack() && pdf > 0.0f ){
+                    MediumStack ms_copy = ms;
+                    radiosity += li( inter.SpawnRay( wi ) , PixelSample() , scene , 1 , true , 1 , true , ms_copy ) * f / pdf;
+                }
+            }
+            return radiosity / (float)SSS_IRRADIANCE_SAMPLES;
+        } );
+        m_sssCache = std::move( cache );
+    }
+
+    m_guidingTree = m_pathGuiding ? std::make_unique<GuidingTree>( scene.GetBBox() , g_threadCnt ) : nullptr;
+    m_rouletteCache = m_efficiencyAwareRoulette ? std::make_unique<RouletteCache>( scene.GetBBox() , g_threadCnt ) : nullptr;
+    m_radianceCache = m_useRadianceCache ? std::make_unique<RadianceCache>( RADIANCE_CACHE_BITS ) : nullptr;
+    m_lightCache = m_useLightCache && scene.LightNum() > 0 ? std::make_unique<LightCache>( scene ) : nullptr;
+
+    // delta lights with bounds are the ones emitting from a single point, which are point lights and spot lights.
+    m_pointLights.clear();
+    if( g_equiangular ){
+        for( const auto light : scene.GetLights() ){
+            LightBounds bounds;
+            if( light->IsDelta() && light->GetBounds( bounds ) )
+                m_pointLights.push_back( std::make_pair( light , bounds.bbox.m_Min ) );
+        }
+    }
+
+    if( g_warmStartDecay <= 0.0f )
+        return;
+
+    // What is learned in the last frame is kept in memory by a sequence or a render server, otherwise it is loaded from
+    // the resource folder if the last frame was rendered by another process.
+    if( m_guidingTree && ( last_guiding_tree || loadLearnedCache( *m_guidingTree , GUIDING_TREE_FILE ) ) ){
+        if( last_guiding_tree )
+            m_guidingTree = std::move( last_guiding_tree );
+        m_guidingTree->Decay( g_warmStartDecay );
+    }
+    if( m_rouletteCache && ( last_roulette_cache || loadLearnedCache( *m_rouletteCache , ROULETTE_CACHE_FILE ) ) ){
+        if( last_roulette_cache )
+            m_rouletteCache = std::move( last_roulette_cache );
+        m_rouletteCache->Decay( g_warmStartDecay );
+    }
+    if( m_radianceCache && ( last_radiance_cache || loadLearnedCache( *m_radianceCache , RADIANCE_CACHE_FILE ) ) ){
+        if( last_radiance_cache )
+            m_radianceCache = std::move( last_radiance_cache );
+        m_radianceCache->Decay( g_warmStartDecay );
+    }
+}
+
+void PathTracing::PostProcess(){
+    if( g_warmStartDecay <= 0.0f )
+        return;
+
+    if( m_guidingTree )
+        saveLearnedCache( *m_guidingTree , GUIDING_TREE_FILE );
+    if( m_rouletteCache )
+        saveLearnedCache( *m_rouletteCache , ROULETTE_CACHE_FILE );
+    if( m_radianceCache )
+        saveLearnedCache( *m_radianceCache , RADIANCE_CACHE_FILE );
+}
+
+void PathTracing::FinishPass(){
+    if( m_guidingTree )
+        m_guidingTree->Refine();
+    if( m_rouletteCache )
+        m_rouletteCache->Update();
+    if( m_lightCache )
+        m_lightCache->Update();
+}
+
+const Light* PathTracing::sampleLight( const Scene& scene , const Point& p , const Vector& n , float u , float* pdf ) const{
+    return m_lightCache ? m_lightCache->Sample( scene , p , n , u , pdf ) : scene.SampleLight( p , n , u , pdf );
+}
+
+Spectrum PathTracing::sampleEquiangular( const Scene& scene , const Ray& r , float max_t , const MediumStack& ms ) const{
+    const auto light_cnt = (unsigned)m_pointLights.size();
+    const auto& point_light = m_pointLights[ std::min( (unsigned)( sort_canonical() * light_cnt ) , light_cnt - 1 ) ];
+
+    const EquiangularSegment segment( r , point_light.second , max_t );
+    if( !segment.IsValid() )
+        return 0.0f;
+
+    auto pdf = 0.0f;
+    const auto t = segment.Sample( sort_canonical() , pdf );
+    if( pdf <= 0.0f || t <= 0.0f || t >= max_t )
+        return 0.0f;
+
+    MediumInteraction mi;
+    mi.intersect = r( t );
+    mi.time = r.m_time;
+    mi.scattered = true;
+    const auto scattering = ms.m_mediums[0]->Scattering( mi.intersect , mi.anisotropy );
+    if( scattering.IsBlack() )
+        return 0.0f;
+
+    const HenyeyGreenstein phase_function( mi.anisotropy );
+    const auto direct = EvaluateDirect( mi , &phase_function , -r.m_Dir , scene , point_light.first , ms );
+    if( direct.IsBlack() )
+        return 0.0f;
+
+    // the light is picked uniformly among point lights, the transmittance is tracked from the ray origin to the point.
+    const auto weight = equiangularWeight( segment , max_t , t ) * light_cnt / pdf;
+    return ms.Tr( r , t ) * scattering * direct * weight;
+}
+
+void PathTracing::RequestSample( Sampler* sampler , PixelSampleBuffer& samples , unsigned ps_num ){
+    Integrator::RequestSample( sampler , samples , ps_num );
+    m_lightSampleOffset = samples.RequestMoreLightSample( m_lightSplitting );
+    m_bsdfSampleOffset = samples.RequestMoreBsdfSample( m_bsdfSplitting );
+}
+
+void PathTracing::GenerateSample( const Sampler* sampler , PixelSampleBuffer& samples , unsigned ps , const Scene& scene ) const{
+    Integrator::GenerateSample( sampler , samples , ps , scene );
+
+    // each dimension is stratified across the pixel, and decorrelated from the others by shuffling it, the same as
+    // the camera dimensions.
+    auto data = samples.Scratch();
+    auto shuffle = samples.Shuffle();
+    auto pixel_samples = samples.Samples();
+    const auto stratify = [&]( const auto& dimension ){
+        std::shuffle( shuffle , shuffle + ps , std::default_random_engine( sort_rand() ) );
+        sampler->Generate1D( data , ps );
+        for( auto i = 0u ; i < ps ; ++i )
+            dimension( pixel_samples[i] ).t = data[shuffle[i]];
+
+        std::shuffle( shuffle , shuffle + ps , std::default_random_engine( sort_rand() ) );
+        sampler->Generate2D( data , ps );
+        for( auto i = 0u ; i < ps ; ++i ){
+            auto& sample = dimension( pixel_samples[i] );
+            sample.u = data[2 * shuffle[i]];
+            sample.v = data[2 * shuffle[i] + 1];
+        }
+    };
+    for( auto k = 0u ; k < m_lightSplitting ; ++k )
+        stratify( [&]( PixelSample& sample ) -> LightSample& { return sample.light_sample[m_lightSampleOffset + k]; } );
+    for( auto k = 0u ; k < m_bsdfSplitting ; ++k )
+        stratify( [&]( PixelSample& sample ) -> BsdfSample& { return sample.bsdf_sample[m_bsdfSampleOffset + k]; } );
+}
+
+Spectrum PathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
 	MediumStack ms;
 	scene.RestoreMediumStack(ray.m_Ori, ms);
 
-    return li( ray , ps , scene , 0 , false , 0 , false , ms );
+    return li( ray , ps , scene , 0 , false , 0 , false , ms , 0.0f , 1.0f , primary );
 }
 
-Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const{
+Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms , float pixelEstimate , float pathWeight , const SurfaceInteraction* primary ) const{
     SORT_PROFILE("Path tracing");
-    SORT_STATS(++sPrimaryRayCount);
+    SORT_STATS_HOT(++sPrimaryRayCount);
 
     Spectrum    L = 0.0f;
     Spectrum    throughput = 1.0f;
 
+    // there is at most one vertex recorded per bounce.
+    GuidingVertex*  guiding_vertices = m_guidingTree ? SORT_MALLOC_ARRAY( GuidingVertex , max_recursive_depth ) : nullptr;
+    auto            guiding_vertex_cnt = 0;
+    RouletteVertex* roulette_vertices = m_rouletteCache ? SORT_MALLOC_ARRAY( RouletteVertex , max_recursive_depth ) : nullptr;
+    auto            roulette_vertex_cnt = 0;
+    CacheVertex*    cache_vertices = m_radianceCache ? SORT_MALLOC_ARRAY( CacheVertex , max_recursive_depth ) : nullptr;
+    auto            cache_vertex_cnt = 0;
+    auto            path_length = 0.0f;
+
     int local_bounce = 0;
     auto    r = ray;
     while(true){
         // This introduces bias in the algorithm. 'max_recursive_depth' could be set very large to reduce the side-effect.
         if( bounces >= max_recursive_depth )
-            return L;
+            break;
 
-        SORT_STATS(++sTotalPathLength);
+        SORT_STATS_HOT(++sTotalPathLength);
 
         // get the intersection between the ray and the scene if it's a light , accumulate the radiance and break
         SurfaceInteraction inter;
-        if( !scene.GetIntersect( r , inter ) ){
+        if( !getPrimaryIntersection( r , 0 == local_bounce ? primary : nullptr , scene , inter ) ){
             if( 0 == local_bounce )
                 return !indirectOnly ? scene.Le( r ) : 0.0f;
             break;
         }
+        path_length += inter.t;
 
-        Spectrum emission;
-        MediumInteraction* pMi = nullptr;
-        const auto medium_attenuation = ms.Sample(r, inter.t, pMi, emission);
+        // rays that are not in any medium, which are most of them in most scenes, skip everything about volumes.
+        if (!ms.IsEmpty()) {
+            Spectrum emission;
+            MediumInteraction mi;
+            mi.time = r.m_time;
 
-        L += emission * throughput;
+            // besides the scattering sampled by distance below, the segment is also sampled around point lights.
+            const auto equiangular = !m_pointLights.empty() && 1 == ms.m_mediumCnt;
+            if (equiangular)
+                L += throughput * sampleEquiangular(scene, r, inter.t, ms);
 
-        // update the through put based on the medium attenuation due to particle scattering and absorption.
-        throughput *= medium_attenuation;
+            const auto medium_attenuation = ms.Sample(r, inter.t, mi, emission);
 
-        if (pMi && pMi->phaseFunction) {
-            Vector wi;
-            float pdf = 0.0f;
-            const auto pf = pMi->phaseFunction->Sample(-r.m_Dir, wi, pdf);
+            L += emission * throughput;
 
-            if ( UNLIKELY(pdf == 0.0f) )
-                break;
+            // update the through put based on the medium attenuation due to particle scattering and absorption.
+            throughput *= medium_attenuation;
 
-            // evaluate direct light illumination
-            float light_pdf = 0.0f;
-            const auto  light = scene.SampleLight(sort_canonical(), &light_pdf);
-            L += throughput * EvaluateDirect(pMi->intersect, pMi->phaseFunction, -r.m_Dir, scene, light, ms) / light_pdf;
+            if (mi.scattered) {
+                const HenyeyGreenstein phase_function(mi.anisotropy);
 
-            // update path weight
-            throughput *= pf / pdf;
+                Vector wi;
+                float pdf = 0.0f;
+                const auto pf = phase_function.Sample(-r.m_Dir, wi, pdf);
 
-            if (0.0f == throughput.GetIntensity())
-                break;
+                if ( UNLIKELY(pdf == 0.0f) )
+                    break;
 
-            r.m_Ori = pMi->intersect;
-            r.m_Dir = wi;
-            r.m_fMin = 0.0f;    // no need for bias anymore since there is no geometry
+                // evaluate direct light illumination
+                float light_pdf = 0.0f;
+                const auto  light = sampleLight(scene, mi.intersect, Vector(), sort_canonical(), &light_pdf);
+                if( light_pdf > 0.0f ){
+                    auto direct = EvaluateDirect(mi, &phase_function, -r.m_Dir, scene, light, ms);
+                    if( m_lightCache && m_lightCache->IsLearning() )
+                        m_lightCache->Record( mi.intersect , light , direct.GetIntensity() );
+
+                    // point lights are shared with equiangular sampling of the segment.
+                    LightBounds bounds;
+                    if( equiangular && light->IsDelta() && light->GetBounds( bounds ) ){
+                        const EquiangularSegment segment( r , bounds.bbox.m_Min , inter.t );
+                        direct *= 1.0f - equiangularWeight( segment , inter.t , ( mi.intersect - r.m_Ori ).Length() );
+                    }
+                    L += throughput * direct / light_pdf;
+                }
 
-            // apply Prussian Roulette in volume scattering too
-            if (bounces > 3 && throughput.GetMaxComponent() < 0.1f) {
-                auto continueProperbility = std::max(0.05f, 1.0f - throughput.GetMaxComponent());
-                if (sort_canonical() < continueProperbility)
+                // update path weight
+                throughput *= pf / pdf;
+
+                if (0.0f == throughput.GetIntensity())
                     break;
-                throughput /= 1 - continueProperbility;
-            }
 
-            ++bounces;
-            ++local_bounce;
+                r.m_coneWidth += ( mi.intersect - r.m_Ori ).Length() * r.m_coneSpread;
+                r.m_Ori = mi.intersect;
+                r.m_Dir = wi;
+                r.m_fMin = 0.0f;    // no need for bias anymore since there is no geometry
+
+                // apply Prussian Roulette in volume scattering too
+                if (bounces > 3 && throughput.GetMaxComponent() < 0.1f) {
+                    auto continueProperbility = std::max(0.05f, 1.0f - throughput.GetMaxComponent());
+                    if (sort_canonical() < continueProperbility)
+                        break;
+                    throughput /= 1 - continueProperbility;
+                }
+
+                ++bounces;
+                ++local_bounce;
 
-            continue;
+                continue;
+            }
         }
 
         if( local_bounce == 0 && !indirectOnly ) 
             L += inter.Le(-r.m_Dir);
+
+        // the time spent on the vertex, including the rays traced for it, is the cost of the vertex.
+        std::chrono::steady_clock::time_point vertex_start;
+        if( roulette_vertices ){
+            vertex_start = std::chrono::steady_clock::now();
+
+            auto& vertex = roulette_vertices[roulette_vertex_cnt++];
+            vertex.position = inter.intersect;
+            vertex.throughput = throughput;
+            vertex.radiance = L;
+
+            // the pixel is estimated with the radiance reflected at the first vertex of the camera path.
+            if( pixelEstimate <= 0.0f )
+                pixelEstimate = std::max( m_rouletteCache->Radiance( inter.intersect ) , L.GetIntensity() );
+        }
         
         // make sure there is intersected primitive
         sAssert(IS_PTR_VALID(inter.primitive), INTEGRATOR );
@@ -128,17 +499,47 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
         ScatteringEvent se(inter, seFlag);
         material->UpdateScatteringEvent(se);
 
+        // The albedo of the first surface is estimated with one sample of its bsdf, it converges along with the radiance.
+        // SSS is replaced with lambert since denoisers only care about the color of the surface.
+        if( UNLIKELY( nullptr != ps.aov ) && 0 == bounces ){
+            ScatteringEvent albedo_se( inter , SE_EVALUATE_ALL_NO_SSS );
+            material->UpdateScatteringEvent( albedo_se );
+
+            Vector  wi;
+            float   pdf = 0.0f;
+            const auto f = albedo_se.Sample_BSDF( -r.m_Dir , wi , BsdfSample(true) , pdf );
+            ps.aov->values[AOV_ALBEDO] = pdf > 0.0f ? f / pdf : Spectrum();
+        }
+
         SE_Flag scattering_type_flag;
         auto pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
 
+        // the first vertex of camera paths takes more samples, with the dimensions of the pixel sample.
+        const auto first_vertex = 0 == bounces && !indirectOnly;
+
         if( scattering_type_flag & SE_EVALUATE_BXDF ){
-            // evaluate the light
-            auto        light_pdf = 0.0f;
-            const auto  light_sample = LightSample(true);
-            const auto  bsdf_sample = BsdfSample(true);
-            const auto  light = scene.SampleLight( light_sample.t , &light_pdf );
-            if( light_pdf > 0.0f )
-                L += throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms ) / light_pdf / pdf_scattering_type;
+            // evaluate the light, the sky is looked up prefiltered after the first vertex if it is enabled
+            const auto light_cnt = first_vertex ? m_lightSplitting : 1u;
+            const auto prefiltered_sky = g_skyProxy && !first_vertex;
+            for( auto k = 0u ; k < light_cnt ; ++k ){
+                auto        light_pdf = 0.0f;
+                const auto  light_sample = first_vertex && ps.light_sample ? ps.light_sample[m_lightSampleOffset + k] : LightSample(true);
+                const auto  bsdf_sample = BsdfSample(true);
+                const auto  light = sampleLight( scene , inter.intersect , inter.normal , light_sample.t , &light_pdf );
+                if( light_pdf > 0.0f ){
+                    // the contribution recorded for the light cache is shadowed, but not weighted by the path.
+                    const auto direct = EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms , prefiltered_sky );
+                    if( m_lightCache && m_lightCache->IsLearning() )
+                        m_lightCache->Record( inter.intersect , light , direct.GetIntensity() );
+                    L += throughput * direct / ( light_pdf * pdf_scattering_type * (float)light_cnt );
+                }
+            }
+        }else if( ( scattering_type_flag & SE_EVALUATE_BSSRDF ) && m_sssCache ){
+            // both direct and indirect illumination under the surface come from the irradiance cache
+            const auto material_id = material->GetUniqueID();
+            L += throughput * se.Integrate_BSSRDF( [&]( const Bssrdf& bssrdf ){
+                return m_sssCache->Integrate( material_id , inter.intersect , bssrdf );
+            } ) / pdf_scattering_type;
         }else if(scattering_type_flag & SE_EVALUATE_BSSRDF) {
             BSSRDFIntersections bssrdf_inter;
             float               bssrdf_pdf = 0.0f;
@@ -149,6 +550,9 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
                 Spectrum total_bssrdf;
 
                 for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+                    // the temporary lambert model is not needed after this iteration
+                    SORT_MEMPOOL_SCOPE();
+
                     const auto& pInter = bssrdf_inter.intersections[i];
                     const auto& intersection = pInter->intersection;
 
@@ -173,16 +577,97 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
             break;
 
         throughput /= pdf_scattering_type;
+
+        // Kill or split the path depending on how much it is expected to bring to the pixel, vertices not learned yet
+        // fall back to the russian roulette at the end of the bounce. SSS vertices are never split since their bounces
+        // are traced recursively already.
+        const auto vertex_type = ( scattering_type_flag & SE_EVALUATE_BXDF ) ? RouletteCache::SURFACE_VERTEX : RouletteCache::SUBSURFACE_VERTEX;
+        const auto roulette_factor = m_rouletteCache ? m_rouletteCache->Factor( inter.intersect , pathWeight * throughput.GetIntensity() , pixelEstimate , vertex_type ) : -1.0f;
+        auto split = 1u;
+        if( roulette_factor >= 0.0f && roulette_factor < 1.0f ){
+            if( sort_canonical() >= roulette_factor )
+                break;
+            throughput /= roulette_factor;
+        }else if( roulette_factor > 1.0f && RouletteCache::SURFACE_VERTEX == vertex_type ){
+            split = (unsigned)roulette_factor;
+            throughput /= (float)split;
+        }
+        if( first_vertex && m_bsdfSplitting > 1 && RouletteCache::SURFACE_VERTEX == vertex_type ){
+            split *= m_bsdfSplitting;
+            throughput /= (float)m_bsdfSplitting;
+        }
+
         if( scattering_type_flag & SE_EVALUATE_BXDF ){
-            // sample the next direction using bsdf
+            // sample the next direction using bsdf, or the learned radiance with path guiding.
+            const auto guiding = m_guidingTree ? m_guidingTree->Lookup( inter.intersect ) : nullptr;
+            const auto sample_direction = [&]( Vector& wi , float& path_pdf , const unsigned k ){
+                Spectrum f;
+                if( guiding && sort_canonical() < GUIDING_FRACTION ){
+                    const auto u = sort_canonical();
+                    const auto v = sort_canonical();
+                    wi = guiding->Sample( u , v );
+                    f = se.Evaluate_BSDF( -r.m_Dir , wi , path_pdf );
+                }else{
+                    const auto  _bsdf_sample = first_vertex && ps.bsdf_sample && k < m_bsdfSplitting ? ps.bsdf_sample[m_bsdfSampleOffset + k] : BsdfSample(true);
+                    f = se.Sample_BSDF( -r.m_Dir , wi , _bsdf_sample , path_pdf);
+                }
+
+                // one-sample MIS with the balance heuristic, both strategies take the pdf of the mixture.
+                if( guiding )
+                    path_pdf = GUIDING_FRACTION * guiding->Pdf( wi ) + ( 1.0f - GUIDING_FRACTION ) * path_pdf;
+                return f;
+            };
+
+            // paths split from this one are traced recursively, each of them takes its own medium stack.
+            for( auto k = 1u ; k < split ; ++k ){
+                float       split_pdf;
+                Vector      split_wi;
+                const auto  split_f = sample_direction( split_wi , split_pdf , k );
+                if( split_f.IsBlack() || split_pdf == 0.0f )
+                    continue;
+
+                MediumStack ms_copy = ms;
+                const auto interaction_flag = update_interaction_flag(dot(split_wi,inter.gnormal), dot(-r.m_Dir,inter.gnormal));
+                if (SE_Interaction::SE_REFLECTION != interaction_flag) {
+                    MediumInteraction mi;
+                    mi.intersect = inter.intersect;
+                    mi.mesh = inter.primitive->GetMesh();
+                    material->UpdateMediumStack(mi, interaction_flag, ms_copy);
+                }
+
+                const auto split_throughput = throughput * split_f / split_pdf;
+                auto split_ray = inter.SpawnRay( split_wi );
+                split_ray.m_coneWidth = inter.footprint;
+                L += split_throughput * li( split_ray , ps , scene , bounces + 1 , true , bssrdfBounces , false , ms_copy , pixelEstimate , pathWeight * split_throughput.GetIntensity() );
+            }
+
             float       path_pdf;
             Vector      wi;
-            Spectrum f;
-            BsdfSample  _bsdf_sample = BsdfSample(true);
-            f = se.Sample_BSDF( -r.m_Dir , wi , _bsdf_sample , path_pdf);
+            const auto  f = sample_direction( wi , path_pdf , 0 );
             if( ( f.IsBlack() || path_pdf == 0.0f ) )
                 break;
 
+            // Indirect illumination of diffuse surfaces after the first bounce comes from the radiance cache, the cache
+            // keeps the average incident radiance, which is scaled by the albedo estimated with the sampled direction.
+            if( cache_vertices && 1 == split && path_pdf <= RADIANCE_CACHE_DIFFUSE_PDF ){
+                const auto normal = dot( inter.gnormal , r.m_Dir ) < 0.0f ? inter.gnormal : -inter.gnormal;
+                const auto cell_size = RADIANCE_CACHE_CELL_SCALE * path_length;
+
+                Spectrum cached;
+                if( bounces > 0 && m_radianceCache->Lookup( inter.intersect , normal , cell_size , cached ) ){
+                    L += throughput * f * cached / path_pdf;
+                    break;
+                }
+
+                auto& vertex = cache_vertices[cache_vertex_cnt++];
+                vertex.position = inter.intersect;
+                vertex.normal = normal;
+                vertex.cellSize = cell_size;
+                vertex.throughput = throughput * f / path_pdf;
+                vertex.radiance = L;
+                vertex.weight = fabs( dot( wi , inter.normal ) ) * INV_PI / path_pdf;
+            }
+
             // as long as the ray is passing through the surface, it is necessary to update the medium stack.
             const auto interaction_flag = update_interaction_flag(dot(wi,inter.gnormal), dot(-r.m_Dir,inter.gnormal));
             if (SE_Interaction::SE_REFLECTION != interaction_flag) {
@@ -197,10 +682,24 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
 
             if( 0.0f == throughput.GetIntensity() )
                 break;
+
+            // radiance of the split paths is recorded along this direction too, the throughput before splitting
+            // averages them.
+            if( guiding_vertices ){
+                auto& vertex = guiding_vertices[guiding_vertex_cnt++];
+                vertex.position = inter.intersect;
+                vertex.direction = wi;
+                vertex.throughput = throughput * (float)split;
+                vertex.radiance = L;
+                vertex.pdf = path_pdf;
+            }
             
-            r.m_Ori = inter.intersect;
+            r.m_Ori = inter.SpawnOrigin( wi );
             r.m_Dir = wi;
-            r.m_fMin = 0.0001f;
+            r.m_fMin = 0.0f;
+
+            // the ray cone starts from the footprint on the surface, the curvature of the surface is not taken into account
+            r.m_coneWidth = inter.footprint;
         }else{
             // Strictly speaking, it should consider the possibility of crossing a volume when exit from the other point of the SSS object.
             // This is not handled properly in SORT because it is considered ill-defined scene in this case.
@@ -209,13 +708,19 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
 
             BSSRDFIntersections bssrdf_inter;
             float               bssrdf_pdf = 0.0f;
-            se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
+
+            // indirect illumination under the surface is in the irradiance cache already
+            if( !m_sssCache )
+                se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
 
             // Accumulate the contribution from direct illumination
             if( bssrdf_inter.cnt > 0 ){
                 Spectrum total_bssrdf;
 
                 for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+                    // the temporary lambert model is not needed after this iteration
+                    SORT_MEMPOOL_SCOPE();
+
                     const auto& pInter = bssrdf_inter.intersections[i];
                     const auto& intersection = pInter->intersection;
 
@@ -232,16 +737,23 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
                     Spectrum f = se.Sample_BSDF( -r.m_Dir, wi, BsdfSample(true), pdf);
                     if (!f.IsBlack() && pdf > 0.0f && !pInter->weight.IsBlack()) {
                         MediumStack ms_copy = ms;
-                        total_bssrdf += li(Ray(intersection.intersect, wi, 0, 0.0001f), PixelSample(), scene, bounces + 1, true, bssrdfBounces + 1, true, ms_copy) * f * pInter->weight / pdf;
+                        const auto weight = f * pInter->weight / pdf;
+                        total_bssrdf += li(intersection.SpawnRay(wi), PixelSample(), scene, bounces + 1, true, bssrdfBounces + 1, true, ms_copy, pixelEstimate, pathWeight * ( throughput * weight / bssrdf_pdf ).GetIntensity()) * weight;
                     }
                 }
                 
                 L += total_bssrdf * throughput / bssrdf_pdf;
             }
-            return L;
+
+            if( roulette_vertices )
+                m_rouletteCache->RecordCost( vertex_type , std::chrono::duration<float>( std::chrono::steady_clock::now() - vertex_start ).count() );
+            break;
         }
 
-        if( bounces > 3 && throughput.GetMaxComponent() < 0.1f ){
+        if( roulette_vertices )
+            m_rouletteCache->RecordCost( vertex_type , std::chrono::duration<float>( std::chrono::steady_clock::now() - vertex_start ).count() );
+
+        if( roulette_factor < 0.0f && bounces > 3 && throughput.GetMaxComponent() < 0.1f ){
             auto continueProperbility = std::max( 0.05f , 1.0f - throughput.GetMaxComponent() );
             if( sort_canonical() < continueProperbility )
                 break;
@@ -254,5 +766,47 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
         replaceSSS = false;
     }
 
+    // The radiance gathered after leaving a vertex, divided by the throughput up to the vertex, is the radiance arriving
+    // at the vertex along the sampled direction.
+    for( auto i = 0 ; i < guiding_vertex_cnt ; ++i ){
+        const auto& vertex = guiding_vertices[i];
+        const auto radiance = L - vertex.radiance;
+
+        auto incident = 0.0f;
+        for( auto c = 0 ; c < 3 ; ++c ){
+            if( vertex.throughput[c] > 0.0f )
+                incident += radiance[c] / vertex.throughput[c];
+        }
+        m_guidingTree->Record( vertex.position , vertex.direction , incident / ( 3.0f * vertex.pdf ) );
+    }
+
+    // The radiance gathered after arriving at a vertex, divided by the throughput up to the vertex, is the radiance
+    // reflected at the vertex.
+    for( auto i = 0 ; i < roulette_vertex_cnt ; ++i ){
+        const auto& vertex = roulette_vertices[i];
+        const auto radiance = L - vertex.radiance;
+
+        auto reflected = 0.0f;
+        for( auto c = 0 ; c < 3 ; ++c ){
+            if( vertex.throughput[c] > 0.0f )
+                reflected += radiance[c] / vertex.throughput[c];
+        }
+        m_rouletteCache->Record( vertex.position , reflected / 3.0f );
+    }
+
+    // The radiance gathered after leaving a vertex, divided by the throughput after the vertex, is the radiance arriving
+    // at the vertex along the sampled direction, it is turned into an estimation of the average incident radiance.
+    for( auto i = 0 ; i < cache_vertex_cnt ; ++i ){
+        const auto& vertex = cache_vertices[i];
+        const auto radiance = L - vertex.radiance;
+
+        Spectrum incident;
+        for( auto c = 0 ; c < 3 ; ++c ){
+            if( vertex.throughput[c] > 0.0f )
+                incident[c] = radiance[c] / vertex.throughput[c] * vertex.weight;
+        }
+        m_radianceCache->Record( vertex.position , vertex.normal , vertex.cellSize , incident );
+    }
+
     return L;
 }
@@ -18,11 +18,36 @@
 #pragma once
 
 #include "integrator.h"
+#include "sdtree.h"
+#include "roulettecache.h"
+#include "radiancecache.h"
+#include "sssirradiance.h"
+#include "lightcache.h"
 
 //! @brief  The core of path tracing algorithm, the most commonly used algorithm in SORT.
 /**
  * A path tracing algorithm works by tracing rays recursively to converge to the correct approximation of rendering equation.
  * It doesn't solve all corner cases well, but it is a pretty solid algorithm.
+ *
+ * With path guiding, the integrator learns the incident radiance in the scene with a spatial-directional tree during
+ * progressive rendering. Directions of paths are sampled with either the bsdf or the learned radiance, combined with
+ * one-sample MIS, which helps a lot in scenes lit through small openings. Nothing is learned without progressive
+ * rendering, in which case it falls back to pure bsdf sampling.
+ *
+ * With efficiency-aware russian roulette, paths are killed or split depending on how much they are expected to bring
+ * to the pixel and how expensive their vertices are, both are learned during progressive rendering too. Vertices not
+ * learned yet fall back to russian roulette based on the throughput.
+ *
+ * For quick previews, a radiance cache shared by all threads could replace indirect illumination of diffuse surfaces
+ * after the first bounce. It is biased and blurs the indirect illumination, it is not meant for final frames.
+ *
+ * For close-ups of skin, where probe rays of SSS need lots of samples to converge, the irradiance on surfaces with SSS
+ * could be cached in a point cloud before rendering. Reflectance profiles are then integrated hierarchically over the
+ * cached points instead of being sampled with probe rays. It is biased too, but free of the noise of probe rays.
+ *
+ * Everything after the first vertex of a camera path is expensive, more light samples and bsdf samples could be taken
+ * there, so that shadow rays and whole paths are traded against camera rays. Samples there take dimensions of the
+ * pixel samples, which are stratified across the pixel.
  */
 class   PathTracing : public Integrator{
 public:
@@ -33,8 +58,42 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary) const override;
+
+    //! @brief  Create the guiding tree, the roulette cache, the radiance cache, the SSS irradiance cache and the light cache for the scene if they are enabled.
+    //!
+    //! With warm start, the first three are taken over from the last frame instead, with what they learned decayed.
+    //!
+    //! @param  scene           The scene to be rendered.
+    void    PreProcess( const Scene& scene ) override;
+
+    //! @brief  Learn what is recorded in the last pass for guiding and killing paths in the next pass.
+    void    FinishPass() override;
+
+    //! @brief  Save what is learned in the frame to the resource folder if the next frame is warm started with it.
+    void    PostProcess() override;
+
+    //! @brief  Samples of a pixel rendered again would be recorded twice in the guiding tree and the learned caches.
+    bool    SupportPixelDeferral() const override {
+        return !m_guidingTree && !m_rouletteCache && !m_radianceCache && !m_lightCache;
+    }
+
+    //! @brief  Request light and bsdf dimensions for the samples taken at the first vertex of camera paths.
+    //!
+    //! @param sampler      The sampler taking samples in pixels.
+    //! @param samples      The buffer of samples to request dimensions in.
+    //! @param ps_num       The number of samples per pixel.
+    void    RequestSample( Sampler* sampler , PixelSampleBuffer& samples , unsigned ps_num ) override;
+
+    //! @brief  Generate camera samples of a pixel, along with the light and bsdf dimensions requested.
+    //!
+    //! @param sampler      The sampler taking samples in the pixel.
+    //! @param samples      The samples of the pixel, with room reserved for at least 'ps' samples.
+    //! @param ps           The number of samples to generate.
+    //! @param scene        The scene to be rendered.
+    void    GenerateSample( const Sampler* sampler , PixelSampleBuffer& samples , unsigned ps , const Scene& scene ) const override;
 
     //! @brief      Serializing data from stream
     //!
@@ -42,6 +101,15 @@ public:
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
         stream >> m_maxBouncesInBSSRDFPath;
+        stream >> m_pathGuiding;
+        stream >> m_efficiencyAwareRoulette;
+        stream >> m_useRadianceCache;
+        stream >> m_useSSSIrradianceCache;
+        stream >> m_useLightCache;
+        stream >> m_lightSplitting;
+        stream >> m_bsdfSplitting;
+        m_lightSplitting = std::max( m_lightSplitting , 1u );
+        m_bsdfSplitting = std::max( m_bsdfSplitting , 1u );
     }
 
     SORT_STATS_ENABLE( "Path Tracing" )
@@ -52,6 +120,71 @@ private:
     // Most importantly, it kills the performance and introduces quite some fireflies with bounces more than 2.
     int     m_maxBouncesInBSSRDFPath;
 
+    // Whether to guide paths with the radiance learned during progressive rendering.
+    bool    m_pathGuiding = false;
+
+    // The spatial-directional tree learning the radiance, it is only created if path guiding is enabled.
+    std::unique_ptr<GuidingTree>    m_guidingTree;
+
+    // Whether to kill and split paths depending on their expected contribution and cost learned during progressive rendering.
+    bool    m_efficiencyAwareRoulette = false;
+
+    // The reflected radiance and the cost of vertices, it is only created if efficiency-aware russian roulette is enabled.
+    std::unique_ptr<RouletteCache>  m_rouletteCache;
+
+    // Whether to take indirect illumination of diffuse surfaces after the first bounce from a radiance cache.
+    bool    m_useRadianceCache = false;
+
+    // The radiance cache built lazily during rendering, it is only created if it is enabled.
+    std::unique_ptr<RadianceCache>  m_radianceCache;
+
+    // Whether to integrate reflectance profiles of SSS over an irradiance cache instead of sampling them with probe rays.
+    bool    m_useSSSIrradianceCache = false;
+
+    // The irradiance on surfaces with SSS evaluated before rendering, it is only created if it is enabled.
+    std::unique_ptr<SSSIrradianceCache>  m_sssCache;
+
+    // Whether to pick lights by their shadowed contribution learned in the first passes of progressive rendering.
+    bool    m_useLightCache = false;
+
+    // The contribution of lights learned in cells of the scene, it is only created if it is enabled.
+    std::unique_ptr<LightCache>     m_lightCache;
+
+    // Number of light samples taken at the first vertex of camera paths, one light sample is taken at other vertices.
+    unsigned    m_lightSplitting = 1;
+
+    // Number of paths continued from the first vertex of camera paths, each of them samples the bsdf on its own.
+    unsigned    m_bsdfSplitting = 1;
+
+    // Offsets of the dimensions for the first vertex of camera paths in the pixel samples.
+    unsigned    m_lightSampleOffset = 0;
+    unsigned    m_bsdfSampleOffset = 0;
+
+    // Point and spot lights along with their positions, scattering in media is also sampled around them if equiangular
+    // sampling is enabled, it is empty otherwise.
+    std::vector<std::pair<const Light*, Point>>  m_pointLights;
+
+    //! @brief  Pick a light for a shading point, with the light cache if there is one.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  p               The position of the shading point.
+    //! @param  n               The normal of the shading point, zero vector if there is no surface.
+    //! @param  u               A canonical random variable.
+    //! @param  pdf             The probability of picking the light.
+    //! @return                 The light picked, nullptr if no light is picked.
+    const Light* sampleLight( const Scene& scene , const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Sample a scattering point along a ray segment in a medium around a point light, with equiangular sampling.
+    //!
+    //! The light picked is evaluated at the point and weighted against distance sampling, which is what the path takes.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  r               The ray along which the point is sampled.
+    //! @param  max_t           The length of the segment, which is where the ray hits a surface.
+    //! @param  ms              The medium stack of the ray, there is exactly one medium in it.
+    //! @return                 The weighted radiance scattered towards the ray origin, not attenuated by the path throughput.
+    Spectrum    sampleEquiangular( const Scene& scene , const Ray& r , float max_t , const MediumStack& ms ) const;
+
     //! @brief  Evaluate the radiance along a specific direction.
     //!
     //! @param  ray             The ray to be tested with.
@@ -62,6 +195,9 @@ private:
     //! @param  bssrdfBounces   Bounces on BSSRDF surfaces in the path.
     //! @param  replaceSSS      Whether to replace SSS with lambert.
     //! @param  ms              Medium stack during radiance evaluation.
+    //! @param  pixelEstimate   Estimation of the pixel for russian roulette, it is estimated at the first vertex if it is zero.
+    //! @param  pathWeight      Intensity of the throughput of the path before the ray.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const;
+    Spectrum    li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms , float pixelEstimate = 0.0f , float pathWeight = 1.0f , const SurfaceInteraction* primary = nullptr ) const;
 };
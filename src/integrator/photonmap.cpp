@@ -0,0 +1,119 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "photonmap.h"
+#include "task/task.h"
+
+// Number of bits sorted in each pass of the radix sort.
+static constexpr unsigned   PHOTON_RADIX_BITS       = 8;
+static constexpr unsigned   PHOTON_RADIX_SIZE       = 1u << PHOTON_RADIX_BITS;
+static constexpr unsigned   PHOTON_RADIX_MASK       = PHOTON_RADIX_SIZE - 1;
+// Number of photons processed by each task during parallel construction.
+static constexpr unsigned   PHOTON_PARALLEL_CHUNK   = 16384;
+
+// Process the photons chunk by chunk, each chunk is processed in a separate task if there are multiple chunks.
+template<class T>
+static void forEachChunk( const unsigned chunk_cnt , const unsigned cnt , const T& func ){
+    if( 1u == chunk_cnt ){
+        func( 0u , 0u , cnt );
+        return;
+    }
+
+    for( auto c = 0u ; c < chunk_cnt ; ++c ){
+        SPAWN_TASK<Function_Task>( "Photon Map Chunk" , DEFAULT_TASK_PRIORITY , {} , [&,c](){
+            const auto start = c * PHOTON_PARALLEL_CHUNK;
+            func( c , start , std::min( cnt , start + PHOTON_PARALLEL_CHUNK ) );
+        });
+    }
+    WAIT_FOR_CHILDREN();
+}
+
+void PhotonMap::Build( std::vector<Photon>&& photons , float radius ){
+    m_radius = radius;
+    m_invCellSize = 0.5f / radius;
+
+    const auto photon_cnt = (unsigned)photons.size();
+    const auto chunk_cnt = std::max( 1u , ( photon_cnt + PHOTON_PARALLEL_CHUNK - 1 ) / PHOTON_PARALLEL_CHUNK );
+
+    // the hash table has at least as many entries as the photons
+    auto hash_bits = 1u;
+    while( ( 1u << hash_bits ) < photon_cnt && hash_bits < 30 )
+        ++hash_bits;
+    m_hashMask = ( 1u << hash_bits ) - 1;
+
+    struct Key{
+        unsigned    hash;
+        unsigned    index;
+    };
+    std::vector<Key> keys( photon_cnt ) , sorted_keys( photon_cnt );
+    forEachChunk( chunk_cnt , photon_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+        for( auto i = start ; i < end ; ++i ){
+            const auto& p = photons[i].p;
+            keys[i] = { hash( (int)std::floor( p.x * m_invCellSize ) , (int)std::floor( p.y * m_invCellSize ) , (int)std::floor( p.z * m_invCellSize ) ) , i };
+        }
+    });
+
+    // Least significant digit radix sort. Each chunk counts its digits first, the chunk then scatters its photons
+    // starting from the total count of smaller digits and the same digit in preceding chunks, which keeps it stable.
+    std::vector<unsigned> histogram( chunk_cnt * PHOTON_RADIX_SIZE );
+    for( auto shift = 0u ; shift < hash_bits ; shift += PHOTON_RADIX_BITS ){
+        std::fill( histogram.begin() , histogram.end() , 0u );
+        forEachChunk( chunk_cnt , photon_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+            auto count = histogram.data() + c * PHOTON_RADIX_SIZE;
+            for( auto i = start ; i < end ; ++i )
+                ++count[ ( keys[i].hash >> shift ) & PHOTON_RADIX_MASK ];
+        });
+
+        auto offset = 0u;
+        for( auto d = 0u ; d < PHOTON_RADIX_SIZE ; ++d ){
+            for( auto c = 0u ; c < chunk_cnt ; ++c ){
+                const auto cnt = histogram[ c * PHOTON_RADIX_SIZE + d ];
+                histogram[ c * PHOTON_RADIX_SIZE + d ] = offset;
+                offset += cnt;
+            }
+        }
+
+        forEachChunk( chunk_cnt , photon_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+            auto dest = histogram.data() + c * PHOTON_RADIX_SIZE;
+            for( auto i = start ; i < end ; ++i )
+                sorted_keys[ dest[ ( keys[i].hash >> shift ) & PHOTON_RADIX_MASK ]++ ] = keys[i];
+        });
+
+        keys.swap( sorted_keys );
+    }
+
+    // reorder the photons and locate the first photon of each hash, every hash between the one of the previous photon
+    // and the one of the current photon starts at the current photon, so chunks never write the same entries.
+    m_photons.resize( photon_cnt );
+    m_cellStart.resize( (size_t)m_hashMask + 2 );
+    forEachChunk( chunk_cnt , photon_cnt , [&]( unsigned c , unsigned start , unsigned end ){
+        for( auto i = start ; i < end ; ++i ){
+            m_photons[i] = photons[keys[i].index];
+
+            const auto first = i == 0 ? 0u : keys[i - 1].hash + 1;
+            for( auto h = first ; h <= keys[i].hash ; ++h )
+                m_cellStart[h] = i;
+        }
+    });
+
+    const auto last = photon_cnt == 0 ? 0u : keys[photon_cnt - 1].hash + 1;
+    for( auto h = last ; h <= m_hashMask + 1 ; ++h )
+        m_cellStart[h] = photon_cnt;
+
+    photons.clear();
+}
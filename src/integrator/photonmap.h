@@ -0,0 +1,95 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include "math/point.h"
+#include "math/vector3.h"
+#include "spectrum/spectrum.h"
+
+//! @brief  A photon stored on a surface.
+struct Photon{
+    Point       p;          /**< Position of the photon. */
+    Vector      n;          /**< Normal of the surface where the photon is. */
+    Vector      wi;         /**< Direction where the photon comes from. */
+    Spectrum    power;      /**< Power carried by the photon. */
+};
+
+//! @brief  Hashed grid of photons for looking up photons around a position.
+/**
+ * The cells are as large as the diameter of the look-up, a look-up only visits the eight cells touching its sphere.
+ * Photons are sorted by the hashed cells with a parallel radix sort so that photons in a cell are next to each other,
+ * a cell is located through the offset of the first photon with its hash.
+ */
+class PhotonMap{
+public:
+    //! @brief  Build the photon map.
+    //!
+    //! It spawns tasks if there are a lot of photons, so it should be called in a task.
+    //!
+    //! @param  photons     The photons, they are moved into the photon map.
+    //! @param  radius      The radius of the look-ups.
+    void Build( std::vector<Photon>&& photons , float radius );
+
+    //! @brief  Visit all photons within the radius of a position.
+    //!
+    //! @param  p           The position.
+    //! @param  func        The function visiting a photon.
+    template<class T>
+    void Gather( const Point& p , const T& func ) const {
+        if( m_photons.empty() )
+            return;
+
+        // the eight cells closest to the position cover the whole sphere.
+        int base[3];
+        for( auto k = 0u ; k < 3 ; ++k )
+            base[k] = (int)std::floor( p[k] * m_invCellSize - 0.5f );
+
+        const auto sqr_radius = m_radius * m_radius;
+        for( auto i = 0u ; i < 8 ; ++i ){
+            const auto h = hash( base[0] + (int)( i & 1 ) , base[1] + (int)( ( i >> 1 ) & 1 ) , base[2] + (int)( ( i >> 2 ) & 1 ) );
+            for( auto j = m_cellStart[h] ; j < m_cellStart[h + 1] ; ++j ){
+                const auto& photon = m_photons[j];
+                if( ( photon.p - p ).SquaredLength() <= sqr_radius )
+                    func( photon );
+            }
+        }
+    }
+
+    //! @brief  Number of photons in the map.
+    //!
+    //! @return     Number of photons.
+    unsigned Size() const {
+        return (unsigned)m_photons.size();
+    }
+
+private:
+    std::vector<Photon>     m_photons;          /**< Photons sorted by their cells. */
+    std::vector<unsigned>   m_cellStart;        /**< Offset of the first photon of each hash, plus the total count. */
+    unsigned                m_hashMask = 0;     /**< Mask of the hash, the table size is a power of two. */
+    float                   m_radius = 0.0f;    /**< Radius of the look-ups. */
+    float                   m_invCellSize = 0.0f;   /**< Inverse of the size of a cell. */
+
+    //! @brief  Hash of a cell.
+    //!
+    //! 'Optimized Spatial Hashing for Collision Detection of Deformable Objects', Matthias Teschner et al.
+    unsigned hash( int x , int y , int z ) const {
+        return ( ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ^ ( (unsigned)z * 83492791u ) ) & m_hashMask;
+    }
+};
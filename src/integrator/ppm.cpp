@@ -0,0 +1,222 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "ppm.h"
+#include "integratormethod.h"
+#include "math/interaction.h"
+#include "core/scene.h"
+#include "light/light.h"
+#include "scatteringevent/scatteringevent.h"
+#include "task/task.h"
+#include "math/utils.h"
+
+SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
+SORT_STATS_DEFINE_COUNTER(sPhotonCount)
+SORT_STATS_DEFINE_MEMORY(sPhotonMemory)
+
+SORT_STATS_COUNTER("Progressive Photon Mapping", "Primary Ray Count" , sPrimaryRayCount);
+SORT_STATS_COUNTER("Progressive Photon Mapping", "Photon Count" , sPhotonCount);
+SORT_STATS_MEMORY("Photon Map", sPhotonMemory);
+
+// Number of photon paths traced in a task.
+static constexpr int PPM_PARALLEL_PHOTONS = 4096;
+
+// How fast the radius shrinks, a smaller value shrinks it faster with more noise left in the image.
+static constexpr float PPM_ALPHA = 2.0f / 3.0f;
+
+// The radius of the first pass relative to the diagonal of the scene, if it is not specified.
+static constexpr float PPM_RADIUS_SCALE = 0.002f;
+
+// Directions sampled with a pdf larger than this are glossy, camera paths keep going along them instead of gathering photons.
+static constexpr float PPM_GLOSSY_PDF = 4.0f;
+
+// Photons are only gathered from surfaces facing about the same direction, which avoids leaking light around corners.
+static constexpr float PPM_NORMAL_THRESHOLD = 0.5f;
+
+void ProgressivePhotonMapping::PreProcess( const Scene& scene ){
+    m_scene = &scene;
+    m_pass = 0;
+
+    const auto& bbox = scene.GetBBox();
+    const auto radius = m_initialRadius > 0.0f ? m_initialRadius : ( bbox.m_Max - bbox.m_Min ).Length() * PPM_RADIUS_SCALE;
+    m_sqrRadius = radius * radius;
+
+    emitPhotons();
+}
+
+void ProgressivePhotonMapping::FinishPass(){
+    ++m_pass;
+    m_sqrRadius *= ( m_pass + PPM_ALPHA ) / ( m_pass + 1.0f );
+
+    emitPhotons();
+}
+
+void ProgressivePhotonMapping::emitPhotons(){
+    SORT_PROFILE("Progressive Photon Mapping (photon distribution stage)");
+
+    // each chunk of photon paths goes to its own container, they are merged in order once all tasks are done.
+    const auto chunk_cnt = std::max( 1 , ( m_photonCount + PPM_PARALLEL_PHOTONS - 1 ) / PPM_PARALLEL_PHOTONS );
+    std::vector<std::vector<Photon>> chunks( chunk_cnt );
+    auto trace_chunk = [&]( int c ){
+        const auto end = std::min( m_photonCount , ( c + 1 ) * PPM_PARALLEL_PHOTONS );
+        for( auto i = c * PPM_PARALLEL_PHOTONS ; i < end ; ++i ){
+            // keys of the streams are counted down from the largest one to stay away from the keys of pixels.
+            sort_seed( ~m_pass , (unsigned)i );
+            tracePhoton( chunks[c] );
+        }
+    };
+
+    if( 1 == chunk_cnt ){
+        trace_chunk( 0 );
+    }else{
+        for( int c = 0 ; c < chunk_cnt ; ++c )
+            SPAWN_TASK<Function_Task>( "Photon Paths" , DEFAULT_TASK_PRIORITY , {} , [&,c](){ trace_chunk( c ); } );
+        WAIT_FOR_CHILDREN();
+    }
+
+    std::vector<Photon> photons;
+    for( auto& chunk : chunks ){
+        photons.insert( photons.end() , chunk.begin() , chunk.end() );
+        std::vector<Photon>().swap( chunk );
+    }
+    SORT_STATS(sPhotonCount+=photons.size());
+
+    m_photonMap.Build( std::move( photons ) , sqrt( m_sqrRadius ) );
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    m_memoryRecord.Track( &sPhotonMemory , (StatsInt)m_photonMap.Size() * (StatsInt)( sizeof(Photon) + sizeof(unsigned) ) );
+#endif
+}
+
+void ProgressivePhotonMapping::tracePhoton( std::vector<Photon>& photons ) const{
+    // scattering events of the path are not needed once it is done.
+    SORT_MEMPOOL_SCOPE();
+
+    // pick a light first
+    float light_pick_pdf;
+    const Light* light = m_scene->SampleLight( sort_canonical() , &light_pick_pdf );
+    if( !light || light_pick_pdf <= 0.0f )
+        return;
+
+    // sample a ray from the light source
+    float   light_emission_pdf = 0.0f;
+    float   light_pdfa = 0.0f;
+    Ray     ray;
+    float   cosAtLight = 1.0f;
+    Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+    if( le.IsBlack() || light_emission_pdf <= 0.0f )
+        return;
+
+    Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf * (float)m_photonCount );
+
+    int current_depth = 0;
+    SurfaceInteraction intersect;
+    while( current_depth < max_recursive_depth ){
+        if( false == m_scene->GetIntersect( ray , intersect ) )
+            break;
+
+        // direct illumination is evaluated with light samples, only photons bounced off surfaces are stored.
+        const auto wi = -ray.m_Dir;
+        if( ++current_depth > 1 )
+            photons.push_back( { intersect.intersect , intersect.normal , wi , throughput } );
+
+        float bsdf_pdf;
+        Vector wo;
+
+        ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
+        intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
+        Spectrum bsdf_value = se.Sample_BSDF( wi , wo , BsdfSample(true) , bsdf_pdf );
+
+        if( bsdf_pdf == 0.0f || bsdf_value.IsBlack() )
+            break;
+
+        // apply russian roulette
+        float continueProperbility = std::min( 1.0f , ( throughput * bsdf_value / bsdf_pdf ).GetIntensity() * (float)m_photonCount );
+        if( sort_canonical() > continueProperbility )
+            break;
+
+        // update throughput
+        throughput *= bsdf_value / ( bsdf_pdf * continueProperbility );
+
+        // update next ray
+        ray = intersect.SpawnRay( wo );
+    }
+}
+
+Spectrum ProgressivePhotonMapping::Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SORT_STATS_HOT( ++sPrimaryRayCount );
+
+    Spectrum    L;
+    Spectrum    throughput( 1.0f );
+    Ray         r( ray );
+    for( auto bounces = 0 ; bounces < max_recursive_depth ; ++bounces ){
+        SurfaceInteraction inter;
+        if( false == getPrimaryIntersection( r , 0 == bounces ? primary : nullptr , scene , inter ) ){
+            if( 0 == bounces )
+                L += scene.Le( r );
+            break;
+        }
+
+        // emission of the other surfaces along the path is counted in the direct illumination of the previous vertex.
+        if( 0 == bounces )
+            L += inter.Le( -r.m_Dir );
+
+        ScatteringEvent se( inter , SE_EVALUATE_ALL_NO_SSS );
+        inter.primitive->GetMaterial()->UpdateScatteringEvent(se);
+
+        // evaluate direct illumination
+        auto        light_pdf = 0.0f;
+        const auto  light_sample = LightSample(true);
+        const auto  light = scene.SampleLight( inter.intersect , inter.normal , light_sample.t , &light_pdf );
+        if( light_pdf > 0.0f )
+            L += throughput * EvaluateDirect( se , r , scene , light , light_sample , BsdfSample(true) ) / light_pdf;
+
+        // gather photons arriving from the directions that are not glossy, the cosine is already counted by the photons.
+        const auto wo = -r.m_Dir;
+        Spectrum indirect;
+        m_photonMap.Gather( inter.intersect , [&]( const Photon& photon ){
+            if( dot( photon.n , inter.normal ) < PPM_NORMAL_THRESHOLD )
+                return;
+            const auto cos = fabs( dot( photon.wi , inter.normal ) );
+            if( cos <= 0.0f || se.Pdf_BSDF( wo , photon.wi ) > PPM_GLOSSY_PDF )
+                return;
+            indirect += se.Evaluate_BSDF( wo , photon.wi ) * photon.power / cos;
+        });
+        L += throughput * indirect / ( PI * m_sqrRadius );
+
+        // indirect illumination of the glossy directions is evaluated by the following vertices.
+        Vector  wi;
+        float   bsdf_pdf = 0.0f;
+        const auto f = se.Sample_BSDF( wo , wi , BsdfSample(true) , bsdf_pdf );
+        if( bsdf_pdf <= PPM_GLOSSY_PDF || f.IsBlack() )
+            break;
+        throughput *= f / bsdf_pdf;
+
+        // apply russian roulette
+        if( bounces > 3 ){
+            const auto continueProperbility = std::min( 0.5f , throughput.GetIntensity() );
+            if( sort_canonical() > continueProperbility )
+                break;
+            throughput /= continueProperbility;
+        }
+
+        r = inter.SpawnRay( wi );
+    }
+
+    return L;
+}
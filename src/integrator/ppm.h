@@ -0,0 +1,102 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "integrator.h"
+#include "photonmap.h"
+
+//! @brief  Progressive photon mapping integrator.
+/**
+ * Each pass of progressive rendering takes one sample per pixel with a new photon map, the radius of the look-ups
+ * shrinks after every pass so that the average of the passes converges to the right answer.
+ * 'Progressive Photon Mapping: A Probabilistic Approach', Claude Knaus, Matthias Zwicker.
+ *
+ * Direct illumination is evaluated with light samples, photons only carry indirect illumination. Camera paths keep
+ * going through glossy directions, which photons can't resolve well, indirect illumination of the other directions
+ * comes from the photon map. Volumes and SSS are not supported.
+ */
+class   ProgressivePhotonMapping : public Integrator{
+public:
+    DEFINE_RTTI( ProgressivePhotonMapping , Integrator );
+
+    //! @brief  Evaluate the radiance along a specific direction.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
+    //! @return                 The radiance along the opposite direction that the ray points to.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const override;
+
+    //! @brief  Shoot the photons of the first pass.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void PreProcess( const Scene& scene ) override;
+
+    //! @brief  Shrink the radius and shoot the photons of the next pass.
+    void FinishPass() override;
+
+    //! @brief  Each pass takes one sample per pixel with its own photon map.
+    unsigned SamplesPerPass() const override {
+        return 1;
+    }
+
+    //! @brief  Samples of a pass depend on the photons of the pass, pixels can't take different number of samples.
+    bool SupportAdaptiveSampling() const override {
+        return false;
+    }
+
+    //! @brief  The radius of the look-ups depends on the number of passes, which is not saved in checkpoints.
+    bool SupportCheckpoint() const override {
+        return false;
+    }
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param stream    Where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        Integrator::Serialize( stream );
+        stream >> m_photonCount;
+        stream >> m_initialRadius;
+    }
+
+private:
+    int             m_photonCount = 1000000;    /**< Number of photon paths traced in each pass. */
+    float           m_initialRadius = 0.0f;     /**< Radius of the first pass, it depends on the size of the scene if it is zero. */
+    float           m_sqrRadius = 0.0f;         /**< Squared radius of the current pass. */
+    unsigned        m_pass = 0;                 /**< Index of the current pass. */
+    const Scene*    m_scene = nullptr;          /**< The scene where photons are traced. */
+    PhotonMap       m_photonMap;                /**< Photons of the current pass. */
+
+    /**< Memory of the photons accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
+
+    //! @brief  Trace photons of the current pass and build the photon map.
+    //!
+    //! Photon paths are traced in parallel tasks, each photon path draws random numbers of its own stream so that the
+    //! photons don't depend on how the tasks are scheduled.
+    void emitPhotons();
+
+    //! @brief  Trace a photon path and store photons where it bounces.
+    //!
+    //! @param  photons         The container of the photons.
+    void tracePhoton( std::vector<Photon>& photons ) const;
+
+    SORT_STATS_ENABLE( "Progressive Photon Mapping" )
+};
@@ -0,0 +1,176 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include "radiancecache.h"
+#include "core/rand.h"
+
+// Number of cells probed after the hashed one before giving up.
+static constexpr unsigned PROBE_COUNT = 16;
+
+// Cells with fewer records than this are not trusted.
+static constexpr unsigned MIN_RECORDS = 8;
+
+// Accumulate into an atomic float, there is no 'fetch_add' for floats before C++20.
+static void atomicAdd( std::atomic<float>& dst , float v ){
+    auto cur = dst.load( std::memory_order_relaxed );
+    while( !dst.compare_exchange_weak( cur , cur + v , std::memory_order_relaxed ) );
+}
+
+RadianceCache::RadianceCache( unsigned table_bits ){
+    const auto size = 1ull << table_bits;
+    m_mask = size - 1;
+    m_cells = std::make_unique<Cell[]>( size );
+    for( auto i = 0ull ; i < size ; ++i ){
+        auto& cell = m_cells[i];
+        cell.key.store( 0 , std::memory_order_relaxed );
+        for( auto& r : cell.radiance )
+            r.store( 0.0f , std::memory_order_relaxed );
+        cell.records.store( 0 , std::memory_order_relaxed );
+    }
+}
+
+unsigned long long RadianceCache::key( const Point& p , const Vector& n , float cell_size ){
+    // the size of cells is a power of two, its exponent is part of the key.
+    const auto level = (int)std::floor( std::log2( cell_size ) );
+    const auto inv_size = std::exp2( (float)-level );
+
+    // the orientation of the surface is the dominant axis of the normal along with its sign.
+    const auto ax = fabs( n.x ) , ay = fabs( n.y ) , az = fabs( n.z );
+    const auto axis = ( ax > ay && ax > az ) ? 0u : ( ay > az ? 1u : 2u );
+    const auto orientation = axis * 2 + ( n[axis] < 0.0f ? 1u : 0u );
+
+    auto h = 0xcbf29ce484222325ull;
+    const auto mix = [&]( unsigned long long v ){
+        h ^= v;
+        h *= 0x100000001b3ull;
+    };
+    mix( (unsigned long long)(long long)std::floor( p.x * inv_size ) );
+    mix( (unsigned long long)(long long)std::floor( p.y * inv_size ) );
+    mix( (unsigned long long)(long long)std::floor( p.z * inv_size ) );
+    mix( (unsigned long long)( level + 1024 ) );
+    mix( orientation );
+
+    // zero marks empty cells
+    return h ? h : 1ull;
+}
+
+RadianceCache::Cell* RadianceCache::find( unsigned long long key , bool insert ) const{
+    for( auto i = 0u ; i < PROBE_COUNT ; ++i ){
+        auto& cell = m_cells[( key + i ) & m_mask];
+        auto cur = cell.key.load( std::memory_order_acquire );
+        if( cur == key )
+            return &cell;
+        if( 0 == cur ){
+            if( !insert )
+                return nullptr;
+            if( cell.key.compare_exchange_strong( cur , key , std::memory_order_acq_rel ) || cur == key )
+                return &cell;
+        }
+    }
+    return nullptr;
+}
+
+bool RadianceCache::Lookup( const Point& p , const Vector& n , float cell_size , Spectrum& radiance ) const{
+    // jitter the position by up to a cell, averaging look-ups interpolates between the cells.
+    const auto jittered = p + Vector( sort_canonical() - 0.5f , sort_canonical() - 0.5f , sort_canonical() - 0.5f ) * cell_size;
+
+    const auto cell = find( key( jittered , n , cell_size ) , false );
+    if( nullptr == cell )
+        return false;
+
+    const auto records = cell->records.load( std::memory_order_relaxed );
+    if( records < MIN_RECORDS )
+        return false;
+
+    const auto inv = 1.0f / records;
+    radiance = Spectrum( cell->radiance[0].load( std::memory_order_relaxed ) * inv ,
+                         cell->radiance[1].load( std::memory_order_relaxed ) * inv ,
+                         cell->radiance[2].load( std::memory_order_relaxed ) * inv );
+    return true;
+}
+
+void RadianceCache::Record( const Point& p , const Vector& n , float cell_size , const Spectrum& radiance ){
+    for( auto c = 0 ; c < 3 ; ++c ){
+        if( !( radiance[c] >= 0.0f ) || std::isinf( radiance[c] ) )
+            return;
+    }
+
+    const auto cell = find( key( p , n , cell_size ) , true );
+    if( nullptr == cell )
+        return;
+
+    for( auto c = 0 ; c < 3 ; ++c )
+        atomicAdd( cell->radiance[c] , radiance[c] );
+    cell->records.fetch_add( 1 , std::memory_order_relaxed );
+}
+
+void RadianceCache::Decay( float decay ){
+    for( auto i = 0ull ; i <= m_mask ; ++i ){
+        auto& cell = m_cells[i];
+        const auto records = cell.records.load( std::memory_order_relaxed );
+        if( 0 == records )
+            continue;
+
+        const auto kept = (unsigned)( records * decay );
+        const auto scale = (float)kept / records;
+        for( auto& r : cell.radiance )
+            r.store( r.load( std::memory_order_relaxed ) * scale , std::memory_order_relaxed );
+        cell.records.store( kept , std::memory_order_relaxed );
+    }
+}
+
+void RadianceCache::Save( OStreamBase& stream ) const{
+    auto cnt = 0u;
+    for( auto i = 0ull ; i <= m_mask ; ++i )
+        cnt += m_cells[i].key.load( std::memory_order_relaxed ) ? 1u : 0u;
+
+    // cells are saved along with their slots, so that the probing finds them the same way after loading.
+    stream << (unsigned)( m_mask + 1 ) << cnt;
+    for( auto i = 0ull ; i <= m_mask ; ++i ){
+        const auto& cell = m_cells[i];
+        const auto key = cell.key.load( std::memory_order_relaxed );
+        if( 0 == key )
+            continue;
+        stream << (unsigned)i << (unsigned)( key >> 32 ) << (unsigned)key;
+        for( const auto& r : cell.radiance )
+            stream << r.load( std::memory_order_relaxed );
+        stream << cell.records.load( std::memory_order_relaxed );
+    }
+}
+
+bool RadianceCache::Load( IStreamBase& stream ){
+    unsigned size = 0 , cnt = 0;
+    stream >> size >> cnt;
+    if( size != m_mask + 1 || cnt > size )
+        return false;
+
+    for( auto j = 0u ; j < cnt ; ++j ){
+        unsigned index = 0 , key_high = 0 , key_low = 0 , records = 0;
+        float radiance[3];
+        stream >> index >> key_high >> key_low >> radiance[0] >> radiance[1] >> radiance[2] >> records;
+        if( index >= size )
+            return false;
+
+        auto& cell = m_cells[index];
+        cell.key.store( ( (unsigned long long)key_high << 32 ) | key_low , std::memory_order_relaxed );
+        for( auto c = 0 ; c < 3 ; ++c )
+            cell.radiance[c].store( radiance[c] , std::memory_order_relaxed );
+        cell.records.store( records , std::memory_order_relaxed );
+    }
+    return true;
+}
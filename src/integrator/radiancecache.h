@@ -0,0 +1,111 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "math/point.h"
+#include "math/vector3.h"
+#include "spectrum/spectrum.h"
+#include "stream/stream.h"
+
+//! @brief  A world space radiance cache shared by all threads, for previews of diffuse interreflection.
+/**
+ * 'Fast Path Space Filtering by Jittered Spatial Hashing', Nikolaus Binder, Sascha Fricke, Alexander Keller.
+ * Records are accumulated in cells of a spatial hash, keyed by the quantized position, the orientation of the
+ * surface and the size of the cell. Cells get larger with the length of the path from the camera, so that the cache
+ * resolves about the same amount of pixels everywhere. Look-ups jitter the position by up to a cell, which
+ * interpolates between the neighboring cells stochastically and hides the quantization.
+ *
+ * The cache is built lazily. A look-up missing the cache leaves the path to be traced as usual, whose result is
+ * recorded then. Cells are claimed with compare-and-swap on their keys, records are accumulated with atomic
+ * operations, so threads never wait for each other.
+ */
+class RadianceCache{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  table_bits      Logarithm of the number of cells in the hash table.
+    explicit RadianceCache( unsigned table_bits );
+
+    //! @brief  Look up the radiance around a position.
+    //!
+    //! @param  p           The position.
+    //! @param  n           Normal of the surface facing the direction where the radiance is reflected.
+    //! @param  cell_size   Size of the cell.
+    //! @param  radiance    The average radiance recorded in the cell.
+    //! @return             Whether the cell has enough records to be trusted.
+    bool Lookup( const Point& p , const Vector& n , float cell_size , Spectrum& radiance ) const;
+
+    //! @brief  Record radiance at a position.
+    //!
+    //! @param  p           The position.
+    //! @param  n           Normal of the surface facing the direction where the radiance is reflected.
+    //! @param  cell_size   Size of the cell.
+    //! @param  radiance    The radiance to record.
+    void Record( const Point& p , const Vector& n , float cell_size , const Spectrum& radiance );
+
+    //! @brief  Keep what is learned for the next frame of an animation.
+    //!
+    //! Cells keep their average radiance with fewer records, so that the radiance recorded in the next frame outweighs
+    //! it. Cells left with too few records are missed by look-ups until the next frame records more there, they are
+    //! never emptied since that would break the probing of the cells after them.
+    //! It should only be called when no thread is recording.
+    //!
+    //! @param  decay       Fraction of the records kept for the next frame.
+    void Decay( float decay );
+
+    //! @brief  Save the cells recorded so far to a stream.
+    //!
+    //! It should only be called when no thread is recording.
+    //!
+    //! @param  stream      The stream to save the cache to.
+    void Save( OStreamBase& stream ) const;
+
+    //! @brief  Load the cells saved by 'Save' into an empty cache of the same size.
+    //!
+    //! @param  stream      The stream to load the cache from.
+    //! @return             False if the size doesn't match or the data is corrupted.
+    bool Load( IStreamBase& stream );
+
+private:
+    //! @brief  A cell of the hash table.
+    struct Cell{
+        std::atomic<unsigned long long> key;            /**< Key of the cell, zero if the cell is empty. */
+        std::atomic<float>              radiance[3];    /**< Sum of the recorded radiance. */
+        std::atomic<unsigned>           records;        /**< Number of records. */
+    };
+
+    //! @brief  Key of the cell holding a position.
+    //!
+    //! @param  p           The position.
+    //! @param  n           Normal of the surface.
+    //! @param  cell_size   Size of the cell.
+    //! @return             Key of the cell, it is never zero.
+    static unsigned long long key( const Point& p , const Vector& n , float cell_size );
+
+    //! @brief  Find the cell of a key.
+    //!
+    //! @param  key         Key of the cell.
+    //! @param  insert      Whether to claim an empty cell if the key is not in the table.
+    //! @return             The cell, nullptr if it is not found or the table is too crowded around it.
+    Cell* find( unsigned long long key , bool insert ) const;
+
+    std::unique_ptr<Cell[]>     m_cells;        /**< The hash table. */
+    unsigned long long          m_mask = 0;     /**< Mask of the index in the hash table. */
+};
@@ -0,0 +1,180 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "roulettecache.h"
+#include "core/thread.h"
+
+// Number of cells along each axis of the grid caching the reflected radiance.
+static constexpr unsigned GRID_RESOLUTION = 32;
+
+// Ratio between the upper and lower bound of the weight window.
+static constexpr float WINDOW_RATIO = 5.0f;
+
+// The most paths a path could be split into at a vertex.
+static constexpr float MAX_SPLIT = 8.0f;
+
+// Cells with fewer records than this are not trusted.
+static constexpr unsigned MIN_RECORDS = 16;
+
+RouletteCache::RouletteCache( const BBox& bbox , unsigned thread_cnt ){
+    m_origin = bbox.m_Min;
+    m_extent = bbox.m_Max - bbox.m_Min;
+
+    const auto cell_cnt = GRID_RESOLUTION * GRID_RESOLUTION * GRID_RESOLUTION;
+    m_radiance.assign( cell_cnt , 0.0f );
+    m_records.assign( cell_cnt , 0u );
+    std::fill( m_costScale , m_costScale + VERTEX_TYPE_CNT , 1.0f );
+    m_buffers.resize( std::max( thread_cnt , 1u ) );
+    resetBuffers();
+}
+
+unsigned RouletteCache::locate( const Point& p ) const{
+    unsigned c[3];
+    for( auto i = 0u ; i < 3 ; ++i ){
+        const auto x = m_extent[i] > 0.0f ? ( p[i] - m_origin[i] ) / m_extent[i] : 0.5f;
+        c[i] = std::min( (unsigned)std::max( x * GRID_RESOLUTION , 0.0f ) , GRID_RESOLUTION - 1 );
+    }
+    return ( c[2] * GRID_RESOLUTION + c[1] ) * GRID_RESOLUTION + c[0];
+}
+
+float RouletteCache::Radiance( const Point& p ) const{
+    const auto cell = locate( p );
+    return m_records[cell] >= MIN_RECORDS ? m_radiance[cell] : 0.0f;
+}
+
+float RouletteCache::Factor( const Point& p , float weight , float pixel , VertexType type ) const{
+    const auto radiance = Radiance( p );
+    if( radiance <= 0.0f || pixel <= 0.0f )
+        return -1.0f;
+
+    // the center of the weight window is where the path is expected to bring exactly the pixel, it is raised for
+    // expensive vertices so that fewer of them are traced.
+    const auto center = m_costScale[type] * pixel / radiance;
+    const auto lower = 2.0f * center / ( 1.0f + WINDOW_RATIO );
+    const auto upper = WINDOW_RATIO * lower;
+
+    if( weight < lower )
+        return weight / center;
+    if( weight > upper )
+        return std::min( std::floor( weight / center + 0.5f ) , MAX_SPLIT );
+    return 1.0f;
+}
+
+void RouletteCache::Record( const Point& p , float radiance ){
+    if( !( radiance >= 0.0f ) || std::isinf( radiance ) )
+        return;
+
+    const auto tid = (unsigned)ThreadId();
+    if( tid >= m_buffers.size() )
+        return;
+
+    const auto cell = locate( p );
+    auto& buffer = m_buffers[tid];
+    buffer.radiance[cell] += radiance;
+    ++buffer.records[cell];
+}
+
+void RouletteCache::RecordCost( VertexType type , float seconds ){
+    const auto tid = (unsigned)ThreadId();
+    if( tid >= m_buffers.size() )
+        return;
+
+    auto& buffer = m_buffers[tid];
+    buffer.cost[type] += seconds;
+    ++buffer.costRecords[type];
+}
+
+void RouletteCache::Update(){
+    // the cache keeps the average of all passes, the later passes are not less accurate than the earlier ones.
+    for( auto i = 0u ; i < m_radiance.size() ; ++i ){
+        auto sum = m_radiance[i] * m_records[i];
+        for( const auto& buffer : m_buffers ){
+            sum += buffer.radiance[i];
+            m_records[i] += buffer.records[i];
+        }
+        m_radiance[i] = m_records[i] > 0 ? sum / m_records[i] : 0.0f;
+    }
+
+    double      cost[VERTEX_TYPE_CNT] = { 0.0 };
+    unsigned    records[VERTEX_TYPE_CNT] = { 0u };
+    for( const auto& buffer : m_buffers ){
+        for( auto t = 0u ; t < VERTEX_TYPE_CNT ; ++t ){
+            cost[t] += buffer.cost[t];
+            records[t] += buffer.costRecords[t];
+        }
+    }
+
+    // costs are relative to the surface vertices
+    if( records[SURFACE_VERTEX] > 0 && cost[SURFACE_VERTEX] > 0.0 ){
+        const auto surface_cost = cost[SURFACE_VERTEX] / records[SURFACE_VERTEX];
+        for( auto t = 0u ; t < VERTEX_TYPE_CNT ; ++t ){
+            if( records[t] > 0 )
+                m_costScale[t] = (float)std::sqrt( std::max( cost[t] / records[t] / surface_cost , 1.0 ) );
+        }
+    }
+
+    resetBuffers();
+}
+
+void RouletteCache::Decay( float decay ){
+    for( auto& records : m_records )
+        records = (unsigned)( records * decay );
+}
+
+void RouletteCache::Save( OStreamBase& stream ) const{
+    stream << m_origin << m_extent << (unsigned)m_radiance.size();
+    for( auto i = 0u ; i < m_radiance.size() ; ++i )
+        stream << m_radiance[i] << m_records[i];
+    for( auto t = 0u ; t < VERTEX_TYPE_CNT ; ++t )
+        stream << m_costScale[t];
+}
+
+bool RouletteCache::Load( IStreamBase& stream ){
+    Point       origin;
+    Vector      extent;
+    unsigned    cell_cnt = 0;
+    stream >> origin >> extent >> cell_cnt;
+    if( cell_cnt != m_radiance.size() )
+        return false;
+
+    std::vector<float>      radiance( cell_cnt );
+    std::vector<unsigned>   records( cell_cnt );
+    for( auto i = 0u ; i < cell_cnt ; ++i )
+        stream >> radiance[i] >> records[i];
+    float cost_scale[VERTEX_TYPE_CNT];
+    for( auto t = 0u ; t < VERTEX_TYPE_CNT ; ++t )
+        stream >> cost_scale[t];
+
+    m_origin = origin;
+    m_extent = extent;
+    m_radiance = std::move( radiance );
+    m_records = std::move( records );
+    std::copy( cost_scale , cost_scale + VERTEX_TYPE_CNT , m_costScale );
+    resetBuffers();
+    return true;
+}
+
+void RouletteCache::resetBuffers(){
+    for( auto& buffer : m_buffers ){
+        buffer.radiance.assign( m_radiance.size() , 0.0f );
+        buffer.records.assign( m_radiance.size() , 0u );
+        std::fill( buffer.cost , buffer.cost + VERTEX_TYPE_CNT , 0.0 );
+        std::fill( buffer.costRecords , buffer.costRecords + VERTEX_TYPE_CNT , 0u );
+    }
+}
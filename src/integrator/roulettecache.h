@@ -0,0 +1,129 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "math/bbox.h"
+#include "stream/stream.h"
+
+//! @brief  What efficiency-aware russian roulette and splitting learns during progressive rendering.
+/**
+ * 'Adjoint-Driven Russian Roulette and Splitting in Light Transport Simulation', Jiri Vorba, Jaroslav Krivanek.
+ * A path arriving at a vertex is expected to bring the radiance reflected at the vertex, weighted by its throughput,
+ * to the pixel. Paths expected to bring a small fraction of the pixel are killed with russian roulette, the ones
+ * bringing a large fraction are split. A coarse grid over the scene caches the reflected radiance, the pixel is
+ * estimated with the cached radiance at the first vertex of the camera path.
+ *
+ * It is also aware of the cost of the vertices, 'Optimal Splitting and Russian Roulette', Alexander Rath et al.
+ * The efficiency of a path is inversely proportional to the square root of its cost, vertices on SSS surfaces, which
+ * trace a lot more rays, are split less and killed more often than the cheap ones.
+ *
+ * Like the guiding tree, everything is recorded into buffers of the recording threads and merged between passes.
+ */
+class RouletteCache{
+public:
+    //! @brief  Types of vertices with different cost.
+    enum VertexType{
+        SURFACE_VERTEX = 0,     /**< Vertices scattered by the bsdf. */
+        SUBSURFACE_VERTEX,      /**< Vertices scattered by the bssrdf. */
+        VERTEX_TYPE_CNT
+    };
+
+    //! @brief  Constructor.
+    //!
+    //! @param  bbox            Bounding box of the scene.
+    //! @param  thread_cnt      Number of threads recording.
+    RouletteCache( const BBox& bbox , unsigned thread_cnt );
+
+    //! @brief  The reflected radiance learned in the last pass at a position.
+    //!
+    //! @param  p       The position.
+    //! @return         Intensity of the reflected radiance, zero if nothing is learned there.
+    float Radiance( const Point& p ) const;
+
+    //! @brief  Survival probability or number of splits of a path arriving at a vertex.
+    //!
+    //! @param  p           Position of the vertex.
+    //! @param  weight      Intensity of the throughput of the path up to the vertex.
+    //! @param  pixel       Estimation of the pixel.
+    //! @param  type        Type of the vertex.
+    //! @return             Survival probability if it is less than one, otherwise the number of paths to split into.
+    //!                     It is negative if nothing is learned for the vertex.
+    float Factor( const Point& p , float weight , float pixel , VertexType type ) const;
+
+    //! @brief  Record the reflected radiance at a position into the buffer of the current thread.
+    //!
+    //! @param  p           The position.
+    //! @param  radiance    Intensity of the reflected radiance.
+    void Record( const Point& p , float radiance );
+
+    //! @brief  Record the time spent on a vertex into the buffer of the current thread.
+    //!
+    //! @param  type        Type of the vertex.
+    //! @param  seconds     Time spent on the vertex.
+    void RecordCost( VertexType type , float seconds );
+
+    //! @brief  Merge everything recorded by all threads for the next pass.
+    //!
+    //! It should only be called when no thread is recording.
+    void Update();
+
+    //! @brief  Keep what is learned for the next frame of an animation.
+    //!
+    //! Cells keep their radiance with fewer records, so that the radiance recorded in the next frame outweighs it. Cells
+    //! left with too few records are not trusted until the next frame records more there.
+    //!
+    //! @param  decay       Fraction of the records kept for the next frame.
+    void Decay( float decay );
+
+    //! @brief  Save what is learned to a stream.
+    //!
+    //! @param  stream      The stream to save the cache to.
+    void Save( OStreamBase& stream ) const;
+
+    //! @brief  Load what is learned from a stream saved by 'Save', what is recorded in the current pass is dropped.
+    //!
+    //! @param  stream      The stream to load the cache from.
+    //! @return             False if the data doesn't match the grid or it is corrupted, the cache is untouched then.
+    bool Load( IStreamBase& stream );
+
+private:
+    //! @brief  What a thread records during a pass.
+    struct ThreadBuffer{
+        std::vector<float>      radiance;                   /**< Sum of the reflected radiance of all cells. */
+        std::vector<unsigned>   records;                    /**< Number of records of all cells. */
+        double                  cost[VERTEX_TYPE_CNT];      /**< Sum of the time spent on vertices of each type. */
+        unsigned                costRecords[VERTEX_TYPE_CNT];   /**< Number of vertices of each type. */
+    };
+
+    //! @brief  Locate the cell holding a position.
+    //!
+    //! @param  p       The position.
+    //! @return         Index of the cell.
+    unsigned locate( const Point& p ) const;
+
+    //! @brief  Clear the buffers of all threads.
+    void resetBuffers();
+
+    Point                       m_origin;                   /**< The lower corner of the bounding box. */
+    Vector                      m_extent;                   /**< Size of the bounding box. */
+    std::vector<float>          m_radiance;                 /**< Average reflected radiance of all cells learned so far. */
+    std::vector<unsigned>       m_records;                  /**< Number of records of all cells learned so far. */
+    float                       m_costScale[VERTEX_TYPE_CNT];   /**< Square root of the relative cost of each type of vertices. */
+    std::vector<ThreadBuffer>   m_buffers;                  /**< What every thread records. */
+};
@@ -0,0 +1,444 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "sdtree.h"
+#include "math/utils.h"
+#include "core/thread.h"
+
+// The largest float smaller than 1.
+static constexpr float ONE_MINUS_EPS = 0.99999994f;
+
+// Spatial leaves with more records than this, scaled by the square root of the samples of the pass, are subdivided.
+static constexpr float SPATIAL_THRESHOLD = 12000.0f;
+
+// Directional quadrants with more than this fraction of the radiance are subdivided.
+static constexpr float DIRECTIONAL_THRESHOLD = 0.01f;
+
+DirectionalTree::DirectionalTree(){
+    m_nodes.emplace_back();
+}
+
+float DirectionalTree::Total() const{
+    const auto& root = m_nodes[0];
+    return root.sum[0] + root.sum[1] + root.sum[2] + root.sum[3];
+}
+
+void DirectionalTree::ToSquare( const Vector& dir , float& u , float& v ){
+    u = std::min( std::max( ( dir.z + 1.0f ) * 0.5f , 0.0f ) , ONE_MINUS_EPS );
+
+    auto phi = std::atan2( dir.y , dir.x );
+    if( phi < 0.0f )
+        phi += TWO_PI;
+    v = std::min( std::max( phi * INV_TWOPI , 0.0f ) , ONE_MINUS_EPS );
+}
+
+Vector DirectionalTree::FromSquare( float u , float v ){
+    const auto cos_theta = 2.0f * u - 1.0f;
+    const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto phi = TWO_PI * v;
+    return Vector( sin_theta * std::cos( phi ) , sin_theta * std::sin( phi ) , cos_theta );
+}
+
+Vector DirectionalTree::Sample( float u , float v ) const{
+    auto x = 0.0f , y = 0.0f , size = 1.0f;
+    auto node = 0u;
+    while( true ){
+        const auto& n = m_nodes[node];
+
+        // pick the column of the quadrants first, then the quadrant in the column, reusing the random numbers.
+        const auto total = n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+        const auto left = total > 0.0f ? ( n.sum[0] + n.sum[2] ) / total : 0.5f;
+        auto bx = 0u;
+        if( u < left ){
+            u /= left;
+        }else{
+            u = ( u - left ) / ( 1.0f - left );
+            bx = 1u;
+        }
+
+        const auto column = n.sum[bx] + n.sum[bx + 2];
+        const auto bottom = column > 0.0f ? n.sum[bx] / column : 0.5f;
+        auto by = 0u;
+        if( v < bottom ){
+            v /= bottom;
+        }else{
+            v = ( v - bottom ) / ( 1.0f - bottom );
+            by = 1u;
+        }
+
+        u = std::min( std::max( u , 0.0f ) , ONE_MINUS_EPS );
+        v = std::min( std::max( v , 0.0f ) , ONE_MINUS_EPS );
+
+        size *= 0.5f;
+        x += bx * size;
+        y += by * size;
+
+        const auto child = n.child[bx + 2 * by];
+        if( 0 == child )
+            break;
+        node = child;
+    }
+
+    return FromSquare( x + u * size , y + v * size );
+}
+
+float DirectionalTree::Pdf( const Vector& dir ) const{
+    float u , v;
+    ToSquare( dir , u , v );
+
+    auto pdf = 1.0f;
+    auto node = 0u;
+    while( true ){
+        const auto& n = m_nodes[node];
+        const auto total = n.sum[0] + n.sum[1] + n.sum[2] + n.sum[3];
+        if( total <= 0.0f )
+            return 0.0f;
+
+        const auto bx = u < 0.5f ? 0u : 1u;
+        const auto by = v < 0.5f ? 0u : 1u;
+        const auto q = bx + 2 * by;
+        pdf *= 4.0f * n.sum[q] / total;
+
+        if( 0 == n.child[q] || 0.0f == pdf )
+            break;
+
+        u = 2.0f * u - bx;
+        v = 2.0f * v - by;
+        node = n.child[q];
+    }
+
+    // the cylindrical mapping preserves area, the unit square covers the whole sphere.
+    return pdf * INV_FOUR_PI;
+}
+
+unsigned DirectionalTree::Locate( const Vector& dir ) const{
+    float u , v;
+    ToSquare( dir , u , v );
+
+    auto node = 0u;
+    while( true ){
+        const auto bx = u < 0.5f ? 0u : 1u;
+        const auto by = v < 0.5f ? 0u : 1u;
+        const auto q = bx + 2 * by;
+
+        const auto child = m_nodes[node].child[q];
+        if( 0 == child )
+            return node * 4 + q;
+
+        u = 2.0f * u - bx;
+        v = 2.0f * v - by;
+        node = child;
+    }
+}
+
+void DirectionalTree::Build(){
+    // children are always created after their parents, visiting the nodes backward updates children first.
+    for( auto i = (int)m_nodes.size() - 1 ; i >= 0 ; --i ){
+        auto& n = m_nodes[i];
+        for( auto q = 0u ; q < 4 ; ++q ){
+            if( 0 == n.child[q] )
+                continue;
+            const auto& c = m_nodes[n.child[q]];
+            n.sum[q] = c.sum[0] + c.sum[1] + c.sum[2] + c.sum[3];
+        }
+    }
+}
+
+DirectionalTree DirectionalTree::Refine( float threshold ) const{
+    DirectionalTree ret;
+
+    const auto total = Total();
+    if( total <= 0.0f )
+        return ret;
+
+    // 'source' is the node of this tree covering the same quadrants, -1 if the quadrants were not subdivided, in which case
+    // the radiance is assumed to be evenly distributed in them.
+    struct Entry{
+        int         source;
+        unsigned    target;
+        unsigned    depth;
+        float       sum[4];
+    };
+    std::vector<Entry> stack;
+    stack.push_back( { 0 , 0 , 1 , { m_nodes[0].sum[0] , m_nodes[0].sum[1] , m_nodes[0].sum[2] , m_nodes[0].sum[3] } } );
+
+    while( !stack.empty() ){
+        const auto entry = stack.back();
+        stack.pop_back();
+
+        if( entry.depth >= MAX_DEPTH )
+            continue;
+
+        for( auto q = 0u ; q < 4 ; ++q ){
+            if( entry.sum[q] <= total * threshold )
+                continue;
+
+            const auto child = (unsigned)ret.m_nodes.size();
+            ret.m_nodes.emplace_back();
+            ret.m_nodes[entry.target].child[q] = child;
+
+            Entry next = { -1 , child , entry.depth + 1 , { 0.0f , 0.0f , 0.0f , 0.0f } };
+            const auto source = entry.source >= 0 ? m_nodes[entry.source].child[q] : 0u;
+            if( source ){
+                next.source = (int)source;
+                std::copy( m_nodes[source].sum , m_nodes[source].sum + 4 , next.sum );
+            }else{
+                std::fill( next.sum , next.sum + 4 , entry.sum[q] * 0.25f );
+            }
+            stack.push_back( next );
+        }
+    }
+
+    return ret;
+}
+
+void DirectionalTree::Accumulate( const DirectionalTree& other , float weight ){
+    // 'source' is the node of the other tree covering the same quadrants, -1 if the other tree is not subdivided as deep,
+    // in which case 'radiance' of the node is evenly distributed in its quadrants.
+    struct Entry{
+        unsigned    target;
+        int         source;
+        float       radiance;
+    };
+    std::vector<Entry> stack;
+    stack.push_back( { 0 , 0 , 0.0f } );
+
+    while( !stack.empty() ){
+        const auto entry = stack.back();
+        stack.pop_back();
+
+        for( auto q = 0u ; q < 4 ; ++q ){
+            const auto radiance = entry.source >= 0 ? other.m_nodes[entry.source].sum[q] : entry.radiance * 0.25f;
+            const auto child = m_nodes[entry.target].child[q];
+            if( 0 == child ){
+                m_nodes[entry.target].sum[q] += radiance * weight;
+                continue;
+            }
+
+            const auto source = entry.source >= 0 ? other.m_nodes[entry.source].child[q] : 0u;
+            stack.push_back( { child , source ? (int)source : -1 , radiance } );
+        }
+    }
+}
+
+void DirectionalTree::Save( OStreamBase& stream ) const{
+    stream << (unsigned)m_nodes.size();
+    for( const auto& node : m_nodes ){
+        for( auto q = 0u ; q < 4 ; ++q )
+            stream << node.sum[q] << node.child[q];
+    }
+}
+
+bool DirectionalTree::Load( IStreamBase& stream ){
+    unsigned cnt = 0;
+    stream >> cnt;
+    if( 0 == cnt || cnt > ( 1u << 24 ) )
+        return false;
+
+    // children are always created after their parents, anything else is corrupted.
+    std::vector<Node> nodes( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        for( auto q = 0u ; q < 4 ; ++q ){
+            stream >> nodes[i].sum[q] >> nodes[i].child[q];
+            if( nodes[i].child[q] && ( nodes[i].child[q] <= i || nodes[i].child[q] >= cnt ) )
+                return false;
+        }
+    }
+
+    m_nodes = std::move( nodes );
+    return true;
+}
+
+GuidingTree::GuidingTree( const BBox& bbox , unsigned thread_cnt ){
+    m_origin = bbox.m_Min;
+    m_extent = bbox.m_Max - bbox.m_Min;
+
+    m_nodes.emplace_back();
+    m_leaves.emplace_back();
+    m_buffers.resize( std::max( thread_cnt , 1u ) );
+    resetBuffers();
+}
+
+unsigned GuidingTree::locate( const Point& p ) const{
+    float c[3];
+    for( auto i = 0u ; i < 3 ; ++i )
+        c[i] = m_extent[i] > 0.0f ? std::min( std::max( ( p[i] - m_origin[i] ) / m_extent[i] , 0.0f ) , 1.0f ) : 0.5f;
+
+    auto node = 0u;
+    while( m_nodes[node].child ){
+        auto& x = c[m_nodes[node].axis];
+        if( x < 0.5f ){
+            x *= 2.0f;
+            node = m_nodes[node].child;
+        }else{
+            x = 2.0f * x - 1.0f;
+            node = m_nodes[node].child + 1;
+        }
+    }
+    return m_nodes[node].leaf;
+}
+
+const DirectionalTree* GuidingTree::Lookup( const Point& p ) const{
+    if( !m_trained )
+        return nullptr;
+
+    const auto& tree = m_leaves[locate( p )].sampling;
+    return tree.Total() > 0.0f ? &tree : nullptr;
+}
+
+void GuidingTree::Record( const Point& p , const Vector& dir , float radiance ){
+    if( !( radiance > 0.0f ) || std::isinf( radiance ) )
+        return;
+
+    const auto tid = (unsigned)ThreadId();
+    if( tid >= m_buffers.size() )
+        return;
+
+    const auto index = locate( p );
+    const auto& leaf = m_leaves[index];
+    auto& buffer = m_buffers[tid];
+    buffer.radiance[leaf.offset + leaf.recording.Locate( dir )] += radiance;
+    ++buffer.records[index];
+}
+
+void GuidingTree::Refine(){
+    // merge the buffers of all threads, the recorded trees are used for sampling in the next pass.
+    for( auto i = 0u ; i < m_leaves.size() ; ++i ){
+        auto& leaf = m_leaves[i];
+        const auto quadrants = leaf.recording.QuadrantCount();
+        for( const auto& buffer : m_buffers ){
+            leaf.records += buffer.records[i];
+            for( auto q = 0u ; q < quadrants ; ++q )
+                leaf.recording.Record( q , buffer.radiance[leaf.offset + q] );
+        }
+        leaf.recording.Build();
+
+        // what is learned in the last frame is scaled to the radiance of this pass before it is blended in.
+        const auto prior = leaf.sampling.Total();
+        if( m_prior > 0.0f && prior > 0.0f ){
+            const auto recorded = leaf.recording.Total();
+            leaf.recording.Accumulate( leaf.sampling , m_prior * ( recorded > 0.0f ? recorded / prior : 1.0f ) );
+            leaf.recording.Build();
+        }
+
+        leaf.sampling = leaf.recording;
+        m_trained |= leaf.sampling.Total() > 0.0f;
+    }
+    ++m_iteration;
+    m_prior = 0.0f;
+
+    // passes double the samples, the threshold grows with the square root of the samples so that the number of records
+    // per leaf grows along with the number of leaves.
+    const auto threshold = SPATIAL_THRESHOLD * std::sqrt( std::pow( 2.0f , (float)m_iteration ) );
+
+    // new nodes are appended, which are visited later in the same loop so that leaves are subdivided recursively.
+    for( auto i = 0u ; i < m_nodes.size() ; ++i ){
+        if( m_nodes[i].child )
+            continue;
+
+        const auto index = m_nodes[i].leaf;
+        if( m_leaves[index].records <= threshold )
+            continue;
+
+        // both children start with the same directional tree and half of the records.
+        m_leaves[index].records *= 0.5f;
+        auto leaf = m_leaves[index];
+
+        const auto axis = ( m_nodes[i].axis + 1 ) % 3;
+        const auto child = (unsigned)m_nodes.size();
+        m_nodes[i].child = child;
+
+        Node first , second;
+        first.axis = second.axis = axis;
+        first.leaf = index;
+        second.leaf = (unsigned)m_leaves.size();
+        m_nodes.push_back( first );
+        m_nodes.push_back( second );
+        m_leaves.push_back( std::move( leaf ) );
+    }
+
+    for( auto& leaf : m_leaves ){
+        leaf.recording = leaf.sampling.Refine( DIRECTIONAL_THRESHOLD );
+        leaf.records = 0.0f;
+    }
+
+    resetBuffers();
+}
+
+void GuidingTree::Decay( float decay ){
+    // the spatial tree is subdivided again from the thresholds of the first pass as the lighting could change.
+    m_prior = decay;
+    m_iteration = 0;
+}
+
+void GuidingTree::Save( OStreamBase& stream ) const{
+    stream << m_origin << m_extent << m_trained << (unsigned)m_nodes.size() << (unsigned)m_leaves.size();
+    for( const auto& node : m_nodes )
+        stream << node.child << node.axis << node.leaf;
+    for( const auto& leaf : m_leaves )
+        leaf.sampling.Save( stream );
+}
+
+bool GuidingTree::Load( IStreamBase& stream ){
+    Point       origin;
+    Vector      extent;
+    bool        trained = false;
+    unsigned    node_cnt = 0 , leaf_cnt = 0;
+    stream >> origin >> extent >> trained >> node_cnt >> leaf_cnt;
+    if( 0 == node_cnt || 0 == leaf_cnt || node_cnt > ( 1u << 24 ) || leaf_cnt > node_cnt )
+        return false;
+
+    std::vector<Node> nodes( node_cnt );
+    for( auto i = 0u ; i < node_cnt ; ++i ){
+        auto& node = nodes[i];
+        stream >> node.child >> node.axis >> node.leaf;
+        if( ( node.child && ( node.child <= i || node.child + 1 >= node_cnt ) ) || node.axis > 2 || node.leaf >= leaf_cnt )
+            return false;
+    }
+
+    std::vector<Leaf> leaves( leaf_cnt );
+    for( auto& leaf : leaves ){
+        if( !leaf.sampling.Load( stream ) )
+            return false;
+        leaf.recording = leaf.sampling.Refine( DIRECTIONAL_THRESHOLD );
+    }
+
+    m_origin = origin;
+    m_extent = extent;
+    m_trained = trained;
+    m_nodes = std::move( nodes );
+    m_leaves = std::move( leaves );
+    m_iteration = 0;
+    m_prior = 0.0f;
+    resetBuffers();
+    return true;
+}
+
+void GuidingTree::resetBuffers(){
+    auto offset = 0u;
+    for( auto& leaf : m_leaves ){
+        leaf.offset = offset;
+        offset += leaf.recording.QuadrantCount();
+    }
+
+    for( auto& buffer : m_buffers ){
+        buffer.radiance.assign( offset , 0.0f );
+        buffer.records.assign( m_leaves.size() , 0u );
+    }
+}
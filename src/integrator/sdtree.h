@@ -0,0 +1,242 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "math/point.h"
+#include "math/vector3.h"
+#include "math/bbox.h"
+#include "stream/stream.h"
+
+//! @brief  Distribution of incident radiance over the sphere of directions.
+/**
+ * Directions are mapped to the unit square with the cylindrical mapping, which preserves area, the square is
+ * subdivided with a quadtree whose nodes keep the radiance of their four quadrants. Quadrants with more radiance are
+ * subdivided deeper so that sampling the tree is close to sampling the radiance.
+ */
+class DirectionalTree{
+public:
+    //! @brief  Maximum depth of the quadtree.
+    static constexpr unsigned MAX_DEPTH = 20;
+
+    //! @brief  A node of the quadtree, the root is the first node so no quadrant has it as a child.
+    struct Node{
+        float       sum[4] = { 0.0f , 0.0f , 0.0f , 0.0f };     /**< Radiance of the quadrants. */
+        unsigned    child[4] = { 0 , 0 , 0 , 0 };               /**< Nodes of the quadrants, 0 for leaf quadrants. */
+    };
+
+    //! @brief  A tree with only the root.
+    DirectionalTree();
+
+    //! @brief  Total radiance recorded in the tree.
+    //!
+    //! @return     Total radiance recorded in the tree, it is 0 if there is nothing recorded.
+    float Total() const;
+
+    //! @brief  Take a direction proportional to the radiance in the tree.
+    //!
+    //! The tree should have some radiance recorded in it.
+    //!
+    //! @param  u       A canonical random number.
+    //! @param  v       Another canonical random number.
+    //! @return         The sampled direction in world space.
+    Vector Sample( float u , float v ) const;
+
+    //! @brief  Pdf of sampling a direction through 'Sample'.
+    //!
+    //! @param  dir     The direction, it should be normalized.
+    //! @return         Pdf w.r.t the solid angle, 0 if there is nothing recorded.
+    float Pdf( const Vector& dir ) const;
+
+    //! @brief  Locate the leaf quadrant holding a direction.
+    //!
+    //! @param  dir     The direction, it should be normalized.
+    //! @return         Index of the quadrant, four times the index of the node plus the quadrant in the node.
+    unsigned Locate( const Vector& dir ) const;
+
+    //! @brief  Add radiance to a leaf quadrant.
+    //!
+    //! Radiance of the inner nodes is not updated until 'Build' is called.
+    //!
+    //! @param  quadrant    Index of the quadrant returned by 'Locate'.
+    //! @param  radiance    The radiance to add.
+    void Record( unsigned quadrant , float radiance ){
+        m_nodes[quadrant / 4].sum[quadrant % 4] += radiance;
+    }
+
+    //! @brief  Update radiance of inner quadrants with the radiance of their leaves.
+    void Build();
+
+    //! @brief  Create an empty tree for the next pass of recording.
+    //!
+    //! Quadrants holding more than a fraction of the total radiance are subdivided, untouched quadrants are merged.
+    //!
+    //! @param  threshold   Fraction of the total radiance for a quadrant to be subdivided.
+    //! @return             The new tree without any radiance.
+    DirectionalTree Refine( float threshold ) const;
+
+    //! @brief  Add the radiance of another tree to the leaf quadrants of this tree.
+    //!
+    //! Quadrants not subdivided as deep in the other tree are assumed to have their radiance evenly distributed. Radiance
+    //! of the inner nodes is not updated until 'Build' is called.
+    //!
+    //! @param  other       The tree whose radiance is added, 'Build' should have been called on it.
+    //! @param  weight      Weight of the radiance of the other tree.
+    void Accumulate( const DirectionalTree& other , float weight );
+
+    //! @brief  Save the tree to a stream.
+    //!
+    //! @param  stream      The stream to save the tree to.
+    void Save( OStreamBase& stream ) const;
+
+    //! @brief  Load the tree saved by 'Save'.
+    //!
+    //! @param  stream      The stream to load the tree from.
+    //! @return             False if the data is corrupted, the tree is untouched then.
+    bool Load( IStreamBase& stream );
+
+    //! @brief  Number of quadrants, four per node.
+    //!
+    //! @return     Number of quadrants in the tree.
+    unsigned QuadrantCount() const {
+        return (unsigned)m_nodes.size() * 4;
+    }
+
+    //! @brief  Map a direction to the unit square.
+    //!
+    //! @param  dir     The direction, it should be normalized.
+    //! @param  u       Coordinate of the direction along the z axis.
+    //! @param  v       Coordinate of the direction around the z axis.
+    static void ToSquare( const Vector& dir , float& u , float& v );
+
+    //! @brief  Map a point in the unit square to a direction.
+    //!
+    //! @param  u       Coordinate of the direction along the z axis.
+    //! @param  v       Coordinate of the direction around the z axis.
+    //! @return         The normalized direction.
+    static Vector FromSquare( float u , float v );
+
+private:
+    std::vector<Node>   m_nodes;    /**< Nodes of the tree, the first one is the root. */
+};
+
+//! @brief  The spatial-directional tree for path guiding.
+/**
+ * 'Practical Path Guiding for Efficient Light-Transport Simulation', Thomas Muller, Markus Gross, Jan Novak.
+ * A binary tree subdivides the bounding box of the scene, every leaf of it holds a directional tree of incident
+ * radiance learned from the paths passing through it. The tree is learned in passes, paths of a pass record the
+ * radiance they find into a tree with the structure refined from the last pass, while they sample the directions
+ * with the tree recorded in the last pass.
+ *
+ * Radiance is recorded into buffers of the recording threads, so that there is neither lock nor atomic operation
+ * during a pass. The buffers are merged into the tree once the pass is done, spatial leaves with a lot of records
+ * are subdivided then, and the directional trees are refined for the next pass.
+ */
+class GuidingTree{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  bbox            Bounding box of the scene.
+    //! @param  thread_cnt      Number of threads recording radiance.
+    GuidingTree( const BBox& bbox , unsigned thread_cnt );
+
+    //! @brief  Get the directional tree to sample directions at a position.
+    //!
+    //! @param  p       The position.
+    //! @return         The directional tree learned in the last pass, nullptr if it has not learned anything.
+    const DirectionalTree* Lookup( const Point& p ) const;
+
+    //! @brief  Record radiance arriving at a position into the buffer of the current thread.
+    //!
+    //! @param  p           The position.
+    //! @param  dir         Direction where the radiance comes from, it should be normalized.
+    //! @param  radiance    Estimation of the incident radiance divided by the pdf of sampling the direction.
+    void Record( const Point& p , const Vector& dir , float radiance );
+
+    //! @brief  Merge recorded radiance of all threads and prepare the tree for the next pass.
+    //!
+    //! It should only be called when no thread is recording.
+    void Refine();
+
+    //! @brief  Keep what is learned for the next frame of an animation.
+    //!
+    //! Directions of the first pass of the next frame are sampled with the trees learned so far. Once the pass is done,
+    //! they are blended into what the pass records, scaled to the radiance of the pass and then by the decay.
+    //!
+    //! @param  decay       Weight of what is learned so far relative to the first pass of the next frame.
+    void Decay( float decay );
+
+    //! @brief  Save what is learned to a stream.
+    //!
+    //! @param  stream      The stream to save the tree to.
+    void Save( OStreamBase& stream ) const;
+
+    //! @brief  Load what is learned from a stream saved by 'Save', radiance recorded in the current pass is dropped.
+    //!
+    //! @param  stream      The stream to load the tree from.
+    //! @return             False if the data is corrupted, the tree is untouched then.
+    bool Load( IStreamBase& stream );
+
+    //! @brief  Number of leaves in the spatial tree.
+    //!
+    //! @return     Number of spatial leaves.
+    unsigned LeafCount() const {
+        return (unsigned)m_leaves.size();
+    }
+
+private:
+    //! @brief  A node of the spatial tree.
+    struct Node{
+        unsigned    child = 0;      /**< The first of the two children, 0 for leaves. */
+        unsigned    axis = 0;       /**< Axis to split the node along. */
+        unsigned    leaf = 0;       /**< Index of the leaf if the node is a leaf. */
+    };
+
+    //! @brief  A leaf of the spatial tree.
+    struct Leaf{
+        DirectionalTree sampling;       /**< Directional tree learned in the last pass. */
+        DirectionalTree recording;      /**< Directional tree to record the radiance of this pass. */
+        unsigned        offset = 0;     /**< Offset of the quadrants of the recording tree in the thread buffers. */
+        float           records = 0.0f; /**< Number of records in this pass. */
+    };
+
+    //! @brief  Radiance recorded by a thread.
+    struct ThreadBuffer{
+        std::vector<float>      radiance;   /**< Radiance of quadrants of all recording trees. */
+        std::vector<unsigned>   records;    /**< Number of records of all leaves. */
+    };
+
+    //! @brief  Locate the spatial leaf holding a position.
+    //!
+    //! @param  p       The position.
+    //! @return         Index of the leaf.
+    unsigned locate( const Point& p ) const;
+
+    //! @brief  Layout quadrants of recording trees in the thread buffers and clear the buffers.
+    void resetBuffers();
+
+    Point                       m_origin;           /**< The lower corner of the bounding box. */
+    Vector                      m_extent;           /**< Size of the bounding box. */
+    std::vector<Node>           m_nodes;            /**< Nodes of the spatial tree, the first one is the root. */
+    std::vector<Leaf>           m_leaves;           /**< Leaves of the spatial tree. */
+    std::vector<ThreadBuffer>   m_buffers;          /**< Radiance recorded by every thread. */
+    unsigned                    m_iteration = 0;    /**< Number of passes learned so far. */
+    bool                        m_trained = false;  /**< Whether any radiance is learned. */
+    float                       m_prior = 0.0f;     /**< Weight of what is learned in the last frame, blended into the next pass. */
+};
@@ -0,0 +1,225 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "sssirradiance.h"
+#include "core/scene.h"
+#include "core/primitive.h"
+#include "core/samplemethod.h"
+#include "material/material.h"
+#include "math/interaction.h"
+#include "math/utils.h"
+#include "sampler/sample.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
+#include "task/task.h"
+
+// Nodes with no more points than this are not split.
+static constexpr unsigned LEAF_SIZE = 8;
+
+// Maximum depth of the octree, points piling up at the same position end up in a leaf no matter how many they are.
+static constexpr unsigned MAX_DEPTH = 20;
+
+// Nodes looking smaller than this solid angle from the extant position are taken as a single point.
+static constexpr float MAX_SOLID_ANGLE = 0.1f;
+
+// Number of points evaluated by a task in the pre-pass.
+static constexpr unsigned TASK_SIZE = 256;
+
+void SSSIrradianceCache::Build( const Scene& scene , unsigned sample_cnt , const std::function<Spectrum(const SurfaceInteraction&)>& radiosity ){
+    const auto& groups = scene.GetPrimitivesSSS();
+
+    auto total_area = 0.0f;
+    for( const auto& group : groups )
+        for( const auto primitive : group.second )
+            total_area += primitive->SurfaceArea();
+    if( total_area <= 0.0f || 0 == sample_cnt )
+        return;
+
+    for( const auto& group : groups ){
+        const auto& primitives = group.second;
+        std::vector<float> areas( primitives.size() );
+        auto area = 0.0f;
+        for( auto i = 0u ; i < primitives.size() ; ++i )
+            area += ( areas[i] = primitives[i]->SurfaceArea() );
+
+        const auto cnt = (unsigned)( sample_cnt * area / total_area );
+        if( 0 == cnt || area <= 0.0f )
+            continue;
+        const Distribution1D distribution( areas.data() , (unsigned)areas.size() );
+
+        // Points are uniformly distributed on the surfaces, points missing their surfaces are dropped later.
+        std::vector<Sample> samples( cnt );
+        const auto evaluate = [&]( unsigned begin , unsigned end ){
+            for( auto i = begin ; i < end ; ++i ){
+                const auto primitive = primitives[distribution.SampleDiscrete( sort_canonical() , nullptr )];
+
+                // Find the point on the surface with a ray to get the shading normal and the rest of the interaction.
+                Ray r;
+                Vector n;
+                primitive->GetShape()->Sample_l( LightSample( true ) , r , n , nullptr );
+                const auto& bbox = primitive->GetBBox();
+                const auto offset = std::max( ( bbox.m_Max - bbox.m_Min ).Length() , 1e-4f ) * 0.01f;
+                const Ray probe( r.m_Ori + n * offset , -n , 0 , 0.0f , 2.0f * offset );
+                probe.Prepare();
+
+                SurfaceInteraction inter;
+                if( !primitive->GetIntersect( probe , &inter ) )
+                    continue;
+                inter.view = inter.normal;
+
+                auto& sample = samples[i];
+                sample.position = inter.intersect;
+                sample.area = area / cnt;
+                sample.radiosity = radiosity( inter );
+            }
+        };
+
+        if( IS_PTR_VALID( GetCurrentTask() ) ){
+            for( auto begin = 0u ; begin < cnt ; begin += TASK_SIZE ){
+                const auto end = std::min( begin + TASK_SIZE , cnt );
+                SPAWN_TASK<Function_Task>( "SSS Irradiance" , DEFAULT_TASK_PRIORITY , {} , [&evaluate, begin, end](){ evaluate( begin , end ); } );
+            }
+            WAIT_FOR_CHILDREN();
+        }else{
+            evaluate( 0 , cnt );
+        }
+
+        // the area of dropped points is shared by the rest
+        const auto it = std::remove_if( samples.begin() , samples.end() , []( const Sample& s ){ return s.area == 0.0f; } );
+        samples.erase( it , samples.end() );
+        for( auto& sample : samples )
+            sample.area = area / samples.size();
+
+        Add( group.first , std::move( samples ) );
+    }
+}
+
+void SSSIrradianceCache::Add( StringID material , std::vector<Sample> samples ){
+    if( samples.empty() )
+        return;
+
+    auto& tree = m_trees[material];
+    tree.samples = std::move( samples );
+    tree.nodes.clear();
+    build( tree , 0 , (unsigned)tree.samples.size() , 0 );
+}
+
+unsigned SSSIrradianceCache::build( Tree& tree , unsigned begin , unsigned end , unsigned depth ){
+    const auto index = (unsigned)tree.nodes.size();
+    tree.nodes.emplace_back();
+
+    Node node;
+    Vector center;
+    for( auto i = begin ; i < end ; ++i ){
+        const auto& sample = tree.samples[i];
+        node.bbox.Union( sample.position );
+        node.area += sample.area;
+        node.power += sample.radiosity * sample.area;
+        center += Vector( sample.position.x , sample.position.y , sample.position.z ) * sample.area;
+    }
+    if( node.area > 0.0f )
+        center /= node.area;
+    node.center = Point( center.x , center.y , center.z );
+
+    if( end - begin > LEAF_SIZE && depth < MAX_DEPTH ){
+        // points are sorted by the octant they fall in, each octant becomes a child
+        const auto mid = ( node.bbox.m_Min + node.bbox.m_Max ) * 0.5f;
+        const auto octant = [&]( const Sample& s ){
+            return ( s.position.x > mid.x ? 1u : 0u ) | ( s.position.y > mid.y ? 2u : 0u ) | ( s.position.z > mid.z ? 4u : 0u );
+        };
+        std::sort( tree.samples.begin() + begin , tree.samples.begin() + end , [&]( const Sample& s0 , const Sample& s1 ){
+            return octant( s0 ) < octant( s1 );
+        } );
+
+        // all points at the same position can't be split
+        if( octant( tree.samples[begin] ) != octant( tree.samples[end - 1] ) ){
+            node.leaf = false;
+            auto first = begin;
+            while( first < end ){
+                const auto o = octant( tree.samples[first] );
+                auto last = first + 1;
+                while( last < end && octant( tree.samples[last] ) == o )
+                    ++last;
+                node.child[o] = build( tree , first , last , depth + 1 );
+                first = last;
+            }
+        }
+    }
+
+    node.begin = begin;
+    node.end = end;
+    tree.nodes[index] = node;
+    return index;
+}
+
+Spectrum SSSIrradianceCache::Integrate( StringID material , const Point& po , const Bssrdf& bssrdf ) const{
+    return Integrate( material , po , [&]( float distance ){ return bssrdf.Profile( distance ); } , bssrdf.MaxProfileDistance() );
+}
+
+Spectrum SSSIrradianceCache::Integrate( StringID material , const Point& po , const std::function<Spectrum(float)>& profile , float max_distance ) const{
+    const auto it = m_trees.find( material );
+    if( it == m_trees.end() )
+        return 0.0f;
+    const auto& tree = it->second;
+
+    Spectrum radiance;
+    unsigned stack[8 * MAX_DEPTH + 1];
+    auto top = 0u;
+    stack[top++] = 0;
+    while( top > 0 ){
+        const auto& node = tree.nodes[stack[--top]];
+
+        // the closest and farthest distance from the extant position to the bounding box of the node
+        auto sq_dist = 0.0f , sq_far = 0.0f;
+        for( auto a = 0 ; a < 3 ; ++a ){
+            const auto d = std::max( std::max( node.bbox.m_Min[a] - po[a] , po[a] - node.bbox.m_Max[a] ) , 0.0f );
+            const auto f = std::max( fabs( node.bbox.m_Min[a] - po[a] ) , fabs( po[a] - node.bbox.m_Max[a] ) );
+            sq_dist += d * d;
+            sq_far += f * f;
+        }
+        if( sq_dist > max_distance * max_distance )
+            continue;
+
+        if( node.leaf ){
+            for( auto i = node.begin ; i < node.end ; ++i ){
+                const auto& sample = tree.samples[i];
+                const auto d = distance( po , sample.position );
+                if( d > max_distance )
+                    continue;
+
+                // The average of the profile over the disk around the point is roughly the profile at half of its
+                // radius, which keeps the singularity of the profile at zero distance from blowing up.
+                const auto r = std::max( d , 0.5f * sqrt( sample.area * INV_PI ) );
+                radiance += profile( r ) * sample.radiosity * sample.area;
+            }
+            continue;
+        }
+
+        // Far enough nodes are taken as a single point, the extant position is never in them. Nodes crossing the maximum
+        // distance are refined so that points beyond it are still ignored.
+        const auto d = distance( po , node.center );
+        if( sq_dist > 0.0f && sq_far <= max_distance * max_distance && node.area < MAX_SOLID_ANGLE * d * d ){
+            radiance += profile( d ) * node.power;
+            continue;
+        }
+
+        for( const auto child : node.child )
+            if( child )
+                stack[top++] = child;
+    }
+    return radiance;
+}
@@ -0,0 +1,111 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include "math/point.h"
+#include "math/bbox.h"
+#include "spectrum/spectrum.h"
+#include "core/strid.h"
+
+class Scene;
+class Bssrdf;
+struct SurfaceInteraction;
+
+//! @brief  A point-based irradiance cache on surfaces with SSS, for integrating reflectance profiles without probe rays.
+/**
+ * 'A Rapid Hierarchical Rendering Technique for Translucent Materials', Henrik Wann Jensen, Juan Buhler.
+ * Points are distributed uniformly on the surfaces of each material with SSS before rendering, the radiosity arriving
+ * at each of them is evaluated once. An octree over the points of each material keeps the total area and radiosity of
+ * the points in each node. Shading a point on the surface integrates the reflectance profile over the tree, nodes that
+ * are far enough, compared with their size, are taken as a single point at their area weighted center, the rest are
+ * refined down to the points.
+ *
+ * Light doesn't bleed between materials, the same as probe rays only hitting surfaces with the same material.
+ */
+class SSSIrradianceCache{
+public:
+    //! @brief  A point on the surface with its irradiance.
+    struct Sample{
+        Point       position;       /**< Position of the point. */
+        float       area = 0.0f;    /**< Area of the surface the point stands for. */
+        Spectrum    radiosity;      /**< Irradiance arriving at the point divided by PI. */
+    };
+
+    //! @brief  Distribute points on surfaces with SSS in the scene and evaluate their irradiance in parallel.
+    //!
+    //! @param  scene       The scene with surfaces with SSS.
+    //! @param  sample_cnt  Number of points on all surfaces, they are distributed by area.
+    //! @param  radiosity   Evaluate the irradiance divided by PI at a point on the surface.
+    void Build( const Scene& scene , unsigned sample_cnt , const std::function<Spectrum(const SurfaceInteraction&)>& radiosity );
+
+    //! @brief  Build the octree over points on the surfaces of a material.
+    //!
+    //! @param  material    Unique id of the material.
+    //! @param  samples     Points on the surfaces of the material.
+    void Add( StringID material , std::vector<Sample> samples );
+
+    //! @brief  Integrate the reflectance profile of a bssrdf over the irradiance around a point.
+    //!
+    //! @param  material    Unique id of the material of the surface.
+    //! @param  po          The extant position.
+    //! @param  bssrdf      The bssrdf whose profile is integrated.
+    //! @return             The radiance leaving the surface, Fresnel is ignored the same as sampling the bssrdf.
+    Spectrum Integrate( StringID material , const Point& po , const Bssrdf& bssrdf ) const;
+
+    //! @brief  Integrate a reflectance profile over the irradiance around a point.
+    //!
+    //! @param  material        Unique id of the material of the surface.
+    //! @param  po              The extant position.
+    //! @param  profile         The reflectance profile based on distance.
+    //! @param  max_distance    Distance beyond which the profile is ignored.
+    //! @return                 The radiance leaving the surface.
+    Spectrum Integrate( StringID material , const Point& po , const std::function<Spectrum(float)>& profile , float max_distance ) const;
+
+private:
+    //! @brief  A node of the octree.
+    struct Node{
+        BBox        bbox;               /**< Bounding box of the points in the node. */
+        Point       center;             /**< Area weighted center of the points. */
+        float       area = 0.0f;        /**< Total area of the points. */
+        Spectrum    power;              /**< Radiosity of the points weighted by their area. */
+        unsigned    child[8] = { 0 };   /**< Index of the children, zero if there is no child there. */
+        unsigned    begin = 0;          /**< First point of a leaf node. */
+        unsigned    end = 0;            /**< One past the last point of a leaf node. */
+        bool        leaf = true;        /**< Whether the node is a leaf. */
+    };
+
+    //! @brief  Points of a material and the octree over them.
+    struct Tree{
+        std::vector<Sample> samples;    /**< Points, the ones in a leaf are next to each other. */
+        std::vector<Node>   nodes;      /**< Nodes of the octree, the root comes first. */
+    };
+
+    //! @brief  Build a node over a range of points.
+    //!
+    //! @param  tree        The tree the node belongs to.
+    //! @param  begin       First point of the node.
+    //! @param  end         One past the last point of the node.
+    //! @param  depth       Depth of the node.
+    //! @return             Index of the node.
+    static unsigned build( Tree& tree , unsigned begin , unsigned end , unsigned depth );
+
+    std::unordered_map<StringID, Tree>  m_trees;    /**< Octree of each material. */
+};
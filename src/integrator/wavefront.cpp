@@ -0,0 +1,276 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <vector>
+#include "wavefront.h"
+#include "integratormethod.h"
+#include "math/interaction.h"
+#include "core/scene.h"
+#include "core/memory.h"
+#include "core/profile.h"
+#include "light/light.h"
+#include "material/material.h"
+#include "scatteringevent/scatteringevent.h"
+#include "accel/accelerator.h"
+#include "imagesensor/aov.h"
+
+SORT_STATS_DEFINE_COUNTER(sWavefrontPathCount)
+SORT_STATS_DEFINE_COUNTER(sWavefrontPathLength)
+SORT_STATS_DEFINE_COUNTER(sWavefrontShadedHits)
+SORT_STATS_DEFINE_COUNTER(sWavefrontShadingBatches)
+SORT_STATS_DEFINE_COUNTER(sWavefrontShadowRays)
+
+SORT_STATS_COUNTER("Wavefront Path Tracing", "Path Count", sWavefrontPathCount);
+SORT_STATS_AVG_COUNT("Wavefront Path Tracing", "Average Length of Path", sWavefrontPathLength, sWavefrontPathCount);
+SORT_STATS_AVG_COUNT("Wavefront Path Tracing", "Average Hits per Shading Batch", sWavefrontShadedHits, sWavefrontShadingBatches);
+SORT_STATS_COUNTER("Wavefront Path Tracing", "Shadow Ray Count", sWavefrontShadowRays);
+
+SORT_FORCEINLINE float MisFactor( float f, float g ){
+    return (f*f) / (f*f + g*g);
+}
+
+namespace {
+    // State of a path that is still being traced.
+    struct PathState{
+        Ray                     ray;            /**< The ray to be extended. */
+        SurfaceInteraction      inter;          /**< The intersection of the ray. */
+        Spectrum                throughput;     /**< Throughput of the path so far. */
+        const ScatteringEvent*  se = nullptr;   /**< Scattering event at the intersection, it is only valid in the current bounce. */
+    };
+
+    // A shadow ray along with its unoccluded contribution to a path.
+    struct ShadowRay{
+        Ray         ray;            /**< The shadow ray. */
+        Spectrum    contribution;   /**< Contribution to the path if the ray is not occluded. */
+        unsigned    path;           /**< Index of the path. */
+        unsigned    key;            /**< Key of the bin the ray falls in. */
+    };
+}
+
+Spectrum WavefrontPathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SurfaceInteraction inter;
+    getPrimaryIntersection( ray , primary , scene , inter );
+
+    Spectrum radiance;
+    LiBatch( &ray , &inter , &ps , 1 , scene , &radiance );
+    return radiance;
+}
+
+void WavefrontPathTracing::LiBatch( const Ray* rays , const SurfaceInteraction* intersections , const PixelSample* ps , unsigned cnt , const Scene& scene , Spectrum* radiance ) const{
+    SORT_PROFILE("Wavefront path tracing");
+    SORT_STATS(sWavefrontPathCount += cnt);
+
+    std::vector<PathState>  paths( cnt );
+    std::vector<unsigned>   active;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        paths[i].ray = rays[i];
+        paths[i].inter = intersections[i];
+        paths[i].throughput = 1.0f;
+        radiance[i] = 0.0f;
+
+        // camera rays hitting nothing only see the sky
+        if( IS_PTR_INVALID(paths[i].inter.primitive) )
+            radiance[i] = scene.Le( rays[i] );
+        else
+            active.push_back( i );
+    }
+
+    std::vector<unsigned>   bin_keys( cnt );
+    std::vector<ShadowRay>  shadow_rays;
+    std::vector<ScatteringEvent*>   batch;
+    for( auto bounces = 0 ; bounces < max_recursive_depth && !active.empty() ; ++bounces ){
+        SORT_STATS(sWavefrontPathLength += active.size());
+
+        // Extend, camera rays are already resolved by the time the paths get here.
+        if( bounces > 0 ){
+            // scattering events of the last bounce are not needed anymore
+            SORT_CLEAR_MEMPOOL();
+
+            // Secondary rays are incoherent, they are traced in the order of their bins so that rays in the same packet
+            // start close to each other and go in similar directions.
+            for( const auto i : active )
+                bin_keys[i] = RayBinKey( paths[i].ray , scene.GetBBox() );
+            std::sort( active.begin() , active.end() , [&]( unsigned i0 , unsigned i1 ){
+                return bin_keys[i0] < bin_keys[i1];
+            } );
+
+            Ray                 packet[RAY_PACKET_SIZE];
+            SurfaceInteraction  inters[RAY_PACKET_SIZE];
+            for( auto k = 0u ; k < active.size() ; k += RAY_PACKET_SIZE ){
+                const auto packet_cnt = std::min( RAY_PACKET_SIZE , (unsigned)active.size() - k );
+                for( auto i = 0u ; i < packet_cnt ; ++i ){
+                    packet[i] = paths[active[k + i]].ray;
+                    inters[i] = SurfaceInteraction();
+                }
+                scene.GetIntersect( packet , inters , packet_cnt );
+                for( auto i = 0u ; i < packet_cnt ; ++i )
+                    paths[active[k + i]].inter = inters[i];
+            }
+
+            // paths leaving the scene are done, the sky is already taken into account by sampling lights
+            active.erase( std::remove_if( active.begin() , active.end() , [&]( unsigned i ){
+                return IS_PTR_INVALID(paths[i].inter.primitive);
+            } ) , active.end() );
+        }else{
+            for( const auto i : active )
+                radiance[i] += paths[i].inter.Le( -paths[i].ray.m_Dir );
+        }
+
+        // Shade, hits on the same material are next to each other after sorting and are shaded in batches.
+        std::sort( active.begin() , active.end() , [&]( unsigned i0 , unsigned i1 ){
+            return paths[i0].inter.primitive->GetMaterial() < paths[i1].inter.primitive->GetMaterial();
+        } );
+        for( auto k = 0u ; k < active.size() ; ){
+            const auto material = paths[active[k]].inter.primitive->GetMaterial();
+            batch.clear();
+            for( ; k < active.size() && paths[active[k]].inter.primitive->GetMaterial() == material ; ++k ){
+                auto& path = paths[active[k]];
+                auto se = SORT_MALLOC(ScatteringEvent)( path.inter , SE_EVALUATE_ALL_NO_SSS );
+                batch.push_back( se );
+                path.se = se;
+            }
+            material->UpdateScatteringEvents( batch.data() , (unsigned)batch.size() );
+            SORT_STATS(sWavefrontShadedHits += batch.size());
+            SORT_STATS(++sWavefrontShadingBatches);
+        }
+
+        // The albedo of the first surface is estimated with one sample of its bsdf, it converges along with the radiance.
+        if( 0 == bounces ){
+            for( const auto i : active ){
+                if( LIKELY( nullptr == ps[i].aov ) )
+                    continue;
+
+                Vector  wi;
+                float   pdf = 0.0f;
+                const auto f = paths[i].se->Sample_BSDF( -paths[i].ray.m_Dir , wi , BsdfSample(true) , pdf );
+                ps[i].aov->values[AOV_ALBEDO] = pdf > 0.0f ? f / pdf : Spectrum();
+            }
+        }
+
+        // Direct illumination of one light for each path, shadow rays are only generated here, they are traced later.
+        shadow_rays.clear();
+        for( const auto i : active ){
+            const auto& path = paths[i];
+            const auto& se = *path.se;
+            const auto& ip = path.inter;
+            const auto wo = -path.ray.m_Dir;
+
+            auto        pick_pdf = 0.0f;
+            const auto  light = scene.SampleLight( ip.intersect , ip.normal , sort_canonical() , &pick_pdf );
+            if( IS_PTR_INVALID(light) || pick_pdf <= 0.0f )
+                continue;
+            const auto  throughput = path.throughput / pick_pdf;
+
+            const LightSample ls(true);
+            const BsdfSample bs(true);
+
+            Visibility visibility(scene);
+            float light_pdf;
+            Vector wi;
+            const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+            visibility.ray.m_time = ip.time;
+            if( light_pdf > 0.0f && !li.IsBlack() ){
+                auto bsdf_pdf = 0.0f;
+                const auto f = light->IsDelta() ? se.Evaluate_BSDF( wo , wi ) : se.Evaluate_BSDF( wo , wi , bsdf_pdf );
+                if( !f.IsBlack() ){
+                    const auto weight = light->IsDelta() ? 1.0f : MisFactor( light_pdf , bsdf_pdf );
+                    shadow_rays.push_back( { visibility.ray , throughput * li * f * weight / light_pdf , i , 0 } );
+                }
+            }
+
+            if( light->IsDelta() )
+                continue;
+
+            float bsdf_pdf;
+            const auto f = se.Sample_BSDF( wo , wi , bs , bsdf_pdf );
+            if( f.IsBlack() || bsdf_pdf == 0.0f )
+                continue;
+
+            const auto pdf = light->Pdf( ip.intersect , wi );
+            if( pdf <= 0.0f )
+                continue;
+
+            Spectrum le;
+            SurfaceInteraction _ip;
+            if( false == light->Le( Ray( ip.intersect , wi ) , &_ip , le ) || le.IsBlack() )
+                continue;
+
+            const auto weight = MisFactor( bsdf_pdf , pdf );
+            shadow_rays.push_back( { ip.SpawnRayTo( wi , _ip.t ) , throughput * le * f * weight / bsdf_pdf , i , 0 } );
+        }
+
+        // Shadow, shadow rays of all paths are traced in batches, in the order of their bins too.
+        SORT_STATS(sWavefrontShadowRays += shadow_rays.size());
+        for( auto& shadow_ray : shadow_rays )
+            shadow_ray.key = RayBinKey( shadow_ray.ray , scene.GetBBox() );
+        std::sort( shadow_rays.begin() , shadow_rays.end() , []( const ShadowRay& r0 , const ShadowRay& r1 ){
+            return r0.key < r1.key;
+        } );
+        Ray packet[RAY_PACKET_SIZE];
+        for( auto k = 0u ; k < shadow_rays.size() ; k += RAY_PACKET_SIZE ){
+            const auto packet_cnt = std::min( RAY_PACKET_SIZE , (unsigned)shadow_rays.size() - k );
+            for( auto i = 0u ; i < packet_cnt ; ++i )
+                packet[i] = shadow_rays[k + i].ray;
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+            const auto visible = scene.IsVisible( packet , packet_cnt );
+            for( auto i = 0u ; i < packet_cnt ; ++i ){
+                if( visible & ( 1u << i ) )
+                    radiance[shadow_rays[k + i].path] += shadow_rays[k + i].contribution;
+            }
+#else
+            Spectrum attenuations[RAY_PACKET_SIZE];
+            const auto visible = scene.GetAttenuation( packet , attenuations , packet_cnt );
+            for( auto i = 0u ; i < packet_cnt ; ++i ){
+                if( visible & ( 1u << i ) )
+                    radiance[shadow_rays[k + i].path] += attenuations[i] * shadow_rays[k + i].contribution;
+            }
+#endif
+        }
+
+        // Continue, sample the next direction of each path.
+        active.erase( std::remove_if( active.begin() , active.end() , [&]( unsigned i ){
+            auto& path = paths[i];
+
+            float   pdf;
+            Vector  wi;
+            const auto f = path.se->Sample_BSDF( -path.ray.m_Dir , wi , BsdfSample(true) , pdf );
+            if( f.IsBlack() || pdf == 0.0f )
+                return true;
+
+            path.throughput *= f / pdf;
+            if( 0.0f == path.throughput.GetIntensity() )
+                return true;
+
+            path.ray.m_Ori = path.inter.SpawnOrigin( wi );
+            path.ray.m_Dir = wi;
+            path.ray.m_fMin = 0.0f;
+
+            // the ray cone starts from the footprint on the surface, the curvature of the surface is not taken into account
+            path.ray.m_coneWidth = path.inter.footprint;
+
+            if( bounces > 3 && path.throughput.GetMaxComponent() < 0.1f ){
+                const auto continue_probability = std::max( 0.05f , 1.0f - path.throughput.GetMaxComponent() );
+                if( sort_canonical() < continue_probability )
+                    return true;
+                path.throughput /= 1 - continue_probability;
+            }
+            return false;
+        } ) , active.end() );
+    }
+}
@@ -0,0 +1,62 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "integrator.h"
+
+//! @brief  Path tracing in a wavefront manner.
+/**
+ * Instead of tracing one path to its end before starting the next one, all samples of a pixel are traced at the same
+ * time one bounce after another. Each bounce goes through a few stages, each of which works on all paths still alive.
+ *   - Extend, resolving the next intersection of the paths in ray packets, rays are sorted by RayBinKey first.
+ *   - Shade, hits are sorted by materials so that hits on the same material are shaded in batches.
+ *   - Shadow, shadow rays of all paths are queued and traced in batches.
+ *   - Continue, sampling the next direction of each path and applying Russian roulette.
+ * The result is the same as PathTracing in scenes without SSS or volumes. SSS is replaced with lambert and participating
+ * media are not taken into account, similar to bi-directional path tracing.
+ */
+class   WavefrontPathTracing : public Integrator{
+public:
+    DEFINE_RTTI( WavefrontPathTracing , Integrator );
+
+    //! @brief  Evaluate the radiance along a specific direction.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
+    //! @return                 The radiance along the opposite direction that the ray points to.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const override;
+
+    //! @brief  Evaluate the radiance of a batch of camera rays, all paths are traced at the same time.
+    //!
+    //! @param  rays            The camera rays.
+    //! @param  intersections   The resolved intersections of the camera rays.
+    //! @param  ps              Pixel samples, one for each camera ray.
+    //! @param  cnt             Number of camera rays.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  radiance        The radiance along the camera rays to be returned.
+    void        LiBatch( const Ray* rays , const SurfaceInteraction* intersections , const PixelSample* ps , unsigned cnt , const Scene& scene , Spectrum* radiance ) const override;
+
+    //! @brief  All samples of a pixel are evaluated at the same time.
+    bool        SupportBatchEvaluation() const override {
+        return true;
+    }
+
+    SORT_STATS_ENABLE( "Wavefront Path Tracing" )
+};
@@ -27,15 +27,15 @@ SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Whitted Ray Tracing", "Primary Ray Count" , sPrimaryRayCount);
 
-Spectrum WhittedRT::Li( const Ray& r , const PixelSample& ps , const Scene& scene) const{
-    SORT_STATS(++sPrimaryRayCount);
+Spectrum WhittedRT::Li( const Ray& r , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const{
+    SORT_STATS_HOT(++sPrimaryRayCount);
 
     if( r.m_Depth > max_recursive_depth )
         return 0.0f;
 
     // get the intersection between the ray and the scene
     SurfaceInteraction ip;
-    if( false == scene.GetIntersect( r , ip ) )
+    if( false == getPrimaryIntersection( r , primary , scene , ip ) )
         return scene.Le(r);
 
     Spectrum t;
@@ -54,6 +54,7 @@ Spectrum WhittedRT::Li( const Ray& r , const PixelSample& ps , const Scene& scen
             Vector  lightDir;
             float   pdf;
             Spectrum ld = (*it)->sample_l( ip.intersect , &ps.light_sample[0] , lightDir , 0 , &pdf , 0 , 0 , visibility );
+            visibility.ray.m_time = ip.time;
             if( ld.IsBlack() ){
                 it++;
                 continue;
@@ -35,8 +35,9 @@ public:
     //! @param  ray             The ray to be tested with.
     //! @param  ps              There is no Monte-Carlo evaluation in this integrator, this will be ignored.
     //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The intersection of the ray resolved by the caller, nullptr if it is not resolved.
     //! @return                 The radiance along the opposite direction that the ray points to.
-    virtual Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const;
+    virtual Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction* primary ) const;
 
 private:
     SORT_STATS_ENABLE( "Whitted Ray Tracing" )
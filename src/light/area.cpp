@@ -79,6 +79,16 @@ Spectrum AreaLight::Power() const{
     return m_shape->SurfaceArea() * intensity.GetIntensity() * TWO_PI;
 }
 
+bool AreaLight::GetBounds( LightBounds& bounds ) const{
+    sAssert(IS_PTR_VALID(m_shape), LIGHT );
+    bounds.bbox = m_shape->GetBBox();
+    bounds.axis = normalize( m_light2world.TransformNormal( DIR_UP ) );
+    bounds.cosThetaO = 1.0f;
+    bounds.cosThetaE = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
+
 Spectrum AreaLight::Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const{
     const float cos = satDot( wo , intersect.normal );
     if( cos == 0.0f )
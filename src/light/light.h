@@ -21,6 +21,7 @@
 #include "math/transform.h"
 #include "core/scene.h"
 #include "math/vector3.h"
+#include "math/bbox.h"
 
 struct SurfaceInteraction;
 class LightSample;
@@ -33,7 +34,8 @@ public:
     //! @brief  Constructor.
     //!
     //! @param  scene   The current rendering scene.
-    Visibility( const Scene& scene ):m_scene(scene){}
+    //! @param  light   The light the ray is shot towards, if there is one.
+    Visibility( const Scene& scene , const Light* light = nullptr ):light(light),m_scene(scene){}
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief  Whether there is a blocker.
@@ -54,18 +56,34 @@ public:
     //!                 to pass non-empty pointer.
     //! @return         The attenuation along the ray.
     Spectrum    GetAttenuation( MediumStack* ms = nullptr ) const {
-        return m_scene.GetAttenuation( ray , ms );
+        return m_scene.GetAttenuation( ray , ms , light );
     }
 #endif
 
     /**< The ray to be evaluated. */
     Ray ray;
 
+    /**< The light the ray is shot towards, the last occluder towards it is tested first if it is not nullptr. */
+    const Light* light = nullptr;
+
 private:
     /**< The rendering scene. */
     const Scene& m_scene;
 };
 
+//! @brief  Bounds of where and towards which directions a light emits.
+/**
+ * Emitting normals are bounded by a cone around 'axis' of half angle theta_o, each of them emits within theta_e.
+ * It is what the light tree estimates the importance of a group of lights for a shading point with.
+ */
+struct LightBounds{
+    BBox    bbox;                   /**< Bounding box of the emitting points. */
+    Vector  axis = DIR_UP;          /**< Axis of the cone bounding the emitting normals. */
+    float   cosThetaO = -1.0f;      /**< Cosine of the half angle of the cone bounding the emitting normals. */
+    float   cosThetaE = 0.0f;       /**< Cosine of the angle of emission around each normal. */
+    float   power = 0.0f;           /**< Power of the emission. */
+};
+
 //! @brief  Base interface for lights.
 class   Light{
 public:
@@ -102,6 +120,14 @@ public:
         return false;
     }
 
+    //! @brief  Get the bounds of the emission of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Whether the emission could be bounded, infinite lights can't be bounded.
+    virtual bool        GetBounds( LightBounds& bounds ) const {
+        return false;
+    }
+
     //! @brief  Get the shape of light, if there is one.
     //!
     //! Some light source has shape attached to it, like area light.
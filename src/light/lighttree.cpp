@@ -0,0 +1,267 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "lighttree.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sLightTreeNodes)
+
+SORT_STATS_COUNTER("Statistics", "Light Tree Nodes", sLightTreeNodes);
+
+namespace {
+    constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+    // Cosine of the difference of two angles, it is one if the first angle is not larger than the second.
+    SORT_FORCEINLINE void subtractAngle( float cos_a , float sin_a , float cos_b , float sin_b , float& cos_r , float& sin_r ){
+        if( cos_a >= cos_b ){
+            cos_r = 1.0f;
+            sin_r = 0.0f;
+            return;
+        }
+        cos_r = cos_a * cos_b + sin_a * sin_b;
+        sin_r = sin_a * cos_b - cos_a * sin_b;
+    }
+
+    // Rotate a vector around a normalized axis.
+    SORT_FORCEINLINE Vector rotate( const Vector& v , const Vector& axis , float cos_t , float sin_t ){
+        return v * cos_t + cross( axis , v ) * sin_t + axis * ( dot( axis , v ) * ( 1.0f - cos_t ) );
+    }
+
+    // Bounds of two sets of lights, the cone of normals is the smallest one containing both cones.
+    LightBounds unionBounds( const LightBounds& b0 , const LightBounds& b1 ){
+        if( b0.power <= 0.0f )
+            return b1;
+        if( b1.power <= 0.0f )
+            return b0;
+
+        LightBounds ret;
+        ret.bbox = Union( b0.bbox , b1.bbox );
+        ret.power = b0.power + b1.power;
+        ret.cosThetaE = std::min( b0.cosThetaE , b1.cosThetaE );
+
+        const auto theta_0 = acos( clamp( b0.cosThetaO , -1.0f , 1.0f ) );
+        const auto theta_1 = acos( clamp( b1.cosThetaO , -1.0f , 1.0f ) );
+        const auto theta_d = acos( clamp( dot( b0.axis , b1.axis ) , -1.0f , 1.0f ) );
+        if( std::min( theta_d + theta_1 , PI ) <= theta_0 ){
+            ret.axis = b0.axis;
+            ret.cosThetaO = b0.cosThetaO;
+            return ret;
+        }
+        if( std::min( theta_d + theta_0 , PI ) <= theta_1 ){
+            ret.axis = b1.axis;
+            ret.cosThetaO = b1.cosThetaO;
+            return ret;
+        }
+
+        // the new cone spans from the far side of one cone to the far side of the other
+        const auto theta_o = 0.5f * ( theta_0 + theta_d + theta_1 );
+        const auto rotation_axis = cross( b0.axis , b1.axis );
+        if( theta_o >= PI || rotation_axis.SquaredLength() == 0.0f ){
+            ret.axis = b0.axis;
+            ret.cosThetaO = -1.0f;
+            return ret;
+        }
+        const auto theta_r = theta_o - theta_0;
+        ret.axis = normalize( rotate( b0.axis , normalize( rotation_axis ) , cos( theta_r ) , sin( theta_r ) ) );
+        ret.cosThetaO = cos( theta_o );
+        return ret;
+    }
+
+    // How much a set of lights could contribute to a shading point, it is conservative so that no light is missed.
+    float importance( const LightBounds& b , const Point& p , const Vector& n ){
+        if( b.power <= 0.0f )
+            return 0.0f;
+
+        const auto half_diagonal = ( b.bbox.m_Max - b.bbox.m_Min ) * 0.5f;
+        const auto center = b.bbox.m_Min + half_diagonal;
+        const auto radius2 = half_diagonal.SquaredLength();
+
+        const auto delta = p - center;
+        const auto dist2 = delta.SquaredLength();
+        const auto wi = dist2 > 0.0f ? delta / sqrt( dist2 ) : b.axis;
+
+        // angle subtended by the bounding sphere of the lights
+        auto cos_b = -1.0f , sin_b = 0.0f;
+        if( dist2 > radius2 ){
+            const auto sin2_b = radius2 / dist2;
+            sin_b = sqrt( sin2_b );
+            cos_b = sqrt( 1.0f - sin2_b );
+        }
+
+        // the smallest angle between any emitting normal and the direction towards the shading point
+        const auto cos_w = dot( b.axis , wi );
+        const auto sin_w = ssqrt( 1.0f - cos_w * cos_w );
+        const auto cos_o = b.cosThetaO;
+        const auto sin_o = ssqrt( 1.0f - cos_o * cos_o );
+        float cos_x , sin_x , cos_p , sin_p;
+        subtractAngle( cos_w , sin_w , cos_o , sin_o , cos_x , sin_x );
+        subtractAngle( cos_x , sin_x , cos_b , sin_b , cos_p , sin_p );
+        if( cos_p <= b.cosThetaE )
+            return 0.0f;
+
+        // points inside the bounds are clamped so that they don't get unbounded importance
+        auto ret = b.power * cos_p / std::max( dist2 , std::max( radius2 , 1e-8f ) );
+
+        // the smallest angle between the normal of the shading point and any direction towards the lights
+        if( n.SquaredLength() > 0.0f ){
+            const auto cos_i = fabs( dot( wi , n ) );
+            const auto sin_i = ssqrt( 1.0f - cos_i * cos_i );
+            float cos_ip , sin_ip;
+            subtractAngle( cos_i , sin_i , cos_b , sin_b , cos_ip , sin_ip );
+            ret *= cos_ip;
+        }
+        return std::max( ret , 0.0f );
+    }
+
+    SORT_FORCEINLINE Point centroid( const LightBounds& b ){
+        return b.bbox.m_Min + ( b.bbox.m_Max - b.bbox.m_Min ) * 0.5f;
+    }
+}
+
+LightTree::LightTree( const std::vector<Light*>& lights ){
+    std::vector<std::pair<const Light*, LightBounds>> bounded_lights;
+    for( const auto light : lights ){
+        LightBounds bounds;
+        if( !light->GetBounds( bounds ) )
+            m_infiniteLights.push_back( light );
+        else if( bounds.power > 0.0f )
+            bounded_lights.push_back( std::make_pair( light , bounds ) );
+    }
+
+    if( !bounded_lights.empty() ){
+        m_nodes.reserve( 2 * bounded_lights.size() - 1 );
+        buildNode( bounded_lights , 0 , (unsigned)bounded_lights.size() , 0 , 0 );
+    }
+
+    SORT_STATS(sLightTreeNodes += (StatsInt)m_nodes.size());
+}
+
+unsigned LightTree::buildNode( std::vector<std::pair<const Light*, LightBounds>>& lights , unsigned start , unsigned end , unsigned long long path , unsigned depth ){
+    const auto index = (unsigned)m_nodes.size();
+    m_nodes.emplace_back();
+
+    if( end - start == 1 ){
+        m_nodes[index].bounds = lights[start].second;
+        m_nodes[index].offset = (unsigned)m_boundedLights.size();
+        m_nodes[index].leaf = true;
+        m_boundedLights.push_back( lights[start].first );
+        m_lightPaths[lights[start].first] = path;
+        return index;
+    }
+
+    // lights are split at the median along the longest axis of their centers, the depth is log2 of the light count
+    sAssertMsg( depth < 64 , LIGHT , "Light tree is too deep." );
+    BBox centroid_bbox;
+    for( auto i = start ; i < end ; ++i )
+        centroid_bbox.Union( centroid( lights[i].second ) );
+    const auto axis = centroid_bbox.MaxAxisId();
+    const auto mid = ( start + end ) / 2;
+    std::nth_element( lights.begin() + start , lights.begin() + mid , lights.begin() + end ,
+                      [axis]( const std::pair<const Light*, LightBounds>& l0 , const std::pair<const Light*, LightBounds>& l1 ){
+                          return centroid( l0.second )[axis] < centroid( l1.second )[axis];
+                      } );
+
+    buildNode( lights , start , mid , path , depth + 1 );
+    const auto second = buildNode( lights , mid , end , path | ( 1ull << depth ) , depth + 1 );
+    m_nodes[index].offset = second;
+    m_nodes[index].bounds = unionBounds( m_nodes[index + 1].bounds , m_nodes[second].bounds );
+    return index;
+}
+
+float LightTree::infiniteProbability() const{
+    if( m_infiniteLights.empty() )
+        return 0.0f;
+    return (float)m_infiniteLights.size() / (float)( m_infiniteLights.size() + ( m_nodes.empty() ? 0 : 1 ) );
+}
+
+const Light* LightTree::Sample( const Point& p , const Vector& n , float u , float* pdf ) const{
+    const auto p_infinite = infiniteProbability();
+    if( u < p_infinite ){
+        const auto cnt = (unsigned)m_infiniteLights.size();
+        const auto i = std::min( (unsigned)( u / p_infinite * cnt ) , cnt - 1 );
+        if( pdf )
+            *pdf = p_infinite / cnt;
+        return m_infiniteLights[i];
+    }
+
+    if( m_nodes.empty() )
+        return nullptr;
+
+    // the part of u not consumed by the choice so far drives the next one
+    u = std::min( ( u - p_infinite ) / ( 1.0f - p_infinite ) , ONE_MINUS_EPSILON );
+    auto pmf = 1.0f - p_infinite;
+    auto index = 0u;
+    while( !m_nodes[index].leaf ){
+        const auto i0 = importance( m_nodes[index + 1].bounds , p , n );
+        const auto i1 = importance( m_nodes[m_nodes[index].offset].bounds , p , n );
+        if( i0 + i1 <= 0.0f )
+            return nullptr;
+
+        const auto p0 = i0 / ( i0 + i1 );
+        if( u < p0 ){
+            u = std::min( u / p0 , ONE_MINUS_EPSILON );
+            pmf *= p0;
+            index = index + 1;
+        }else{
+            u = std::min( ( u - p0 ) / ( 1.0f - p0 ) , ONE_MINUS_EPSILON );
+            pmf *= 1.0f - p0;
+            index = m_nodes[index].offset;
+        }
+    }
+
+    // a single light in the tree is not checked on the way down
+    if( index == 0 && importance( m_nodes[0].bounds , p , n ) <= 0.0f )
+        return nullptr;
+
+    if( pdf )
+        *pdf = pmf;
+    return m_boundedLights[m_nodes[index].offset];
+}
+
+float LightTree::Pdf( const Point& p , const Vector& n , const Light* light ) const{
+    const auto p_infinite = infiniteProbability();
+    const auto it = m_lightPaths.find( light );
+    if( it == m_lightPaths.end() ){
+        if( std::find( m_infiniteLights.begin() , m_infiniteLights.end() , light ) == m_infiniteLights.end() )
+            return 0.0f;
+        return p_infinite / m_infiniteLights.size();
+    }
+
+    auto path = it->second;
+    auto pmf = 1.0f - p_infinite;
+    auto index = 0u;
+    while( !m_nodes[index].leaf ){
+        const auto i0 = importance( m_nodes[index + 1].bounds , p , n );
+        const auto i1 = importance( m_nodes[m_nodes[index].offset].bounds , p , n );
+        if( i0 + i1 <= 0.0f )
+            return 0.0f;
+
+        if( path & 1 ){
+            pmf *= i1 / ( i0 + i1 );
+            index = m_nodes[index].offset;
+        }else{
+            pmf *= i0 / ( i0 + i1 );
+            index = index + 1;
+        }
+        path >>= 1;
+    }
+
+    if( index == 0 && importance( m_nodes[0].bounds , p , n ) <= 0.0f )
+        return 0.0f;
+    return pmf;
+}
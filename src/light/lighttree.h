@@ -0,0 +1,84 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "light/light.h"
+
+//! @brief  Light tree is a bounding volume hierarchy over lights for picking lights for a shading point.
+/**
+ * Each node bounds the positions, the emitting directions and the total power of the lights under it. A light is
+ * picked by walking down the tree, taking a child with the probability proportional to how much it could contribute
+ * to the shading point, lights that are far away or facing away from it are hardly picked.
+ * Lights that can't be bounded, like sky light, are picked uniformly along with the whole tree.
+ */
+class LightTree{
+public:
+    //! @brief  Build the light tree.
+    //!
+    //! @param  lights      All lights in the scene.
+    LightTree( const std::vector<Light*>& lights );
+
+    //! @brief  Pick a light for a shading point.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal of the shading point, zero vector if there is no surface, like inside media.
+    //! @param  u           A canonical random variable.
+    //! @param  pdf         The probability of picking the light.
+    //! @return             The light picked, nullptr if no light could contribute to the shading point.
+    const Light*    Sample( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  Probability of picking a light for a shading point.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal of the shading point, zero vector if there is no surface, like inside media.
+    //! @param  light       The light of interest.
+    //! @return             The probability of picking the light by 'Sample'.
+    float           Pdf( const Point& p , const Vector& n , const Light* light ) const;
+
+private:
+    //! @brief  A node in the tree, children of an interior node are the next node and the one at 'offset'.
+    struct Node{
+        LightBounds     bounds;             /**< Bounds of all lights under the node. */
+        unsigned        offset = 0;         /**< Index of the second child or the light in a leaf node. */
+        bool            leaf = false;       /**< Whether it is a leaf node. */
+    };
+
+    std::vector<Node>           m_nodes;            /**< Nodes of the tree, the first one is the root. */
+    std::vector<const Light*>   m_boundedLights;    /**< Lights in the tree. */
+    std::vector<const Light*>   m_infiniteLights;   /**< Lights that can't be bounded. */
+
+    /**< Each bit tells whether the right child is taken on the way from the root to a light. */
+    std::unordered_map<const Light*, unsigned long long>    m_lightPaths;
+
+    //! @brief  Build a sub-tree.
+    //!
+    //! @param  lights      The lights with their bounds, the ones in range are reordered.
+    //! @param  start       The first light in the sub-tree.
+    //! @param  end         The one past the last light in the sub-tree.
+    //! @param  path        Bits of the path from the root to the sub-tree.
+    //! @param  depth       Depth of the sub-tree.
+    //! @return             Index of the root of the sub-tree.
+    unsigned buildNode( std::vector<std::pair<const Light*, LightBounds>>& lights , unsigned start , unsigned end , unsigned long long path , unsigned depth );
+
+    //! @brief  Probability of picking an infinite light instead of the tree.
+    //!
+    //! @return             The probability of picking any of the infinite lights.
+    float    infiniteProbability() const;
+};
@@ -0,0 +1,190 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "meshlight.h"
+#include "sampler/sample.h"
+#include "core/samplemethod.h"
+#include "core/primitive.h"
+#include "entity/visual.h"
+
+MeshLight::MeshLight() = default;
+MeshLight::~MeshLight() = default;
+
+void MeshLight::Build( const MeshVisual& visual ){
+    m_triangles.clear();
+    m_triangleIds.clear();
+    m_bounds = LightBounds();
+    m_area = 0.0f;
+
+    std::vector<float> areas;
+    Vector axis;
+    for( const auto& triangle : visual.m_triangles ){
+        const auto area = triangle.SurfaceArea();
+        m_triangleIds[&triangle] = (unsigned)m_triangles.size();
+        m_triangles.push_back( &triangle );
+        areas.push_back( area );
+
+        // the mesh could have moved since the bounding box of the triangle was cached
+        triangle.InvalidateBBox();
+
+        m_area += area;
+        m_bounds.bbox.Union( triangle.GetBBox() );
+        if( area > 0.0f )
+            axis += triangle.GetNormal() * area;
+    }
+
+    // Radiance is the same across the mesh, triangles are picked by area, while the power of the whole mesh is what
+    // lights are weighed against each other with.
+    m_distribution = std::make_unique<Distribution1D>( areas.data() , (unsigned)areas.size() );
+
+    // the normals are bounded by a cone around the average of them, it covers all directions if they cancel each other
+    if( axis.SquaredLength() > 0.0f ){
+        m_bounds.axis = normalize( axis );
+        m_bounds.cosThetaO = 1.0f;
+        for( auto i = 0u ; i < m_triangles.size() ; ++i ){
+            if( areas[i] > 0.0f )
+                m_bounds.cosThetaO = std::min( m_bounds.cosThetaO , dot( m_triangles[i]->GetNormal() , m_bounds.axis ) );
+        }
+    }
+    m_bounds.cosThetaE = 0.0f;
+}
+
+float MeshLight::pdfA( unsigned id ) const{
+    const auto area = m_triangles[id]->SurfaceArea();
+    return area > 0.0f ? m_distribution->GetProperty( id ) / area : 0.0f;
+}
+
+Spectrum MeshLight::sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfW , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const{
+    sAssert(IS_PTR_VALID(ls), LIGHT );
+    if( m_triangles.empty() ){
+        if( pdfW )
+            *pdfW = 0.0f;
+        return 0.0f;
+    }
+
+    // the canonical number picking the triangle is remapped to sample a point on it
+    auto triangle_pdf = 0.0f;
+    LightSample triangle_ls = *ls;
+    const auto id = m_distribution->SampleDiscrete( ls->u , &triangle_pdf , &triangle_ls.u );
+
+    Vector normal;
+    auto pdf = 0.0f;
+    const auto ps = m_triangles[id]->Sample_l( triangle_ls , ip , dirToLight , normal , &pdf );
+    if( pdfW )
+        *pdfW = pdf * triangle_pdf;
+    if( pdf == 0.0f )
+        return 0.0f;
+
+    const auto len = ( ps - ip ).Length();
+    if( cosAtLight )
+        *cosAtLight = dot( -dirToLight , normal );
+
+    if( distance )
+        *distance = len;
+
+    if( emissionPdf )
+        *emissionPdf = UniformHemispherePdf() * pdfA( id );
+
+    // setup visibility tester
+    const float delta = 0.01f;
+    visibility.ray = Ray( ip , dirToLight , 0 , delta , len - delta );
+
+    return intensity;
+}
+
+Spectrum MeshLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const{
+    sAssert( !m_triangles.empty() , LIGHT );
+
+    auto triangle_pdf = 0.0f;
+    LightSample triangle_ls = ls;
+    const auto id = m_distribution->SampleDiscrete( ls.u , &triangle_pdf , &triangle_ls.u );
+
+    Vector n;
+    auto pdf = 0.0f;
+    m_triangles[id]->Sample_l( triangle_ls , r , n , &pdf );
+
+    if( pdfW )
+        *pdfW = pdf * triangle_pdf;
+
+    if( pdfA )
+        *pdfA = this->pdfA( id );
+
+    if( cosAtLight )
+        *cosAtLight = satDot( r.m_Dir , n );
+
+    // to avoid self intersection
+    r.m_fMin = 0.01f;
+
+    return intensity;
+}
+
+float MeshLight::Pdf( const Point& p , const Vector& wi ) const{
+    sAssert(IS_PTR_VALID(m_scene), LIGHT );
+
+    SurfaceInteraction inter;
+    if( !m_scene->GetIntersect( Ray( p , wi , 0 , 0.001f ) , inter ) || inter.primitive->GetLight() != this )
+        return 0.0f;
+
+    const auto it = m_triangleIds.find( inter.primitive->GetShape() );
+    if( it == m_triangleIds.end() )
+        return 0.0f;
+    return m_distribution->GetProperty( it->second ) * m_triangles[it->second]->Pdf( p , wi );
+}
+
+Spectrum MeshLight::Power() const{
+    return m_area * intensity.GetIntensity() * TWO_PI;
+}
+
+bool MeshLight::GetBounds( LightBounds& bounds ) const{
+    if( m_triangles.empty() )
+        return false;
+    bounds = m_bounds;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
+
+Spectrum MeshLight::Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const{
+    // only the front side of the triangles emits
+    const float cos = satDot( wo , intersect.gnormal );
+    if( cos == 0.0f || IS_PTR_INVALID(intersect.primitive) )
+        return 0.0f;
+
+    const auto it = m_triangleIds.find( intersect.primitive->GetShape() );
+    if( it == m_triangleIds.end() )
+        return 0.0f;
+
+    const auto pdf = pdfA( it->second );
+    if( directPdfA )
+        *directPdfA = pdf;
+
+    if( emissionPdf )
+        *emissionPdf = UniformHemispherePdf() * pdf;
+
+    return intensity;
+}
+
+bool MeshLight::Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& radiance ) const{
+    sAssert(IS_PTR_VALID(m_scene), LIGHT );
+
+    SurfaceInteraction inter;
+    auto& target = intersect ? *intersect : inter;
+    if( !m_scene->GetIntersect( ray , target ) || target.primitive->GetLight() != this )
+        return false;
+
+    radiance = Le( target , -ray.m_Dir , 0 , 0 );
+    return true;
+}
@@ -0,0 +1,132 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "light.h"
+#include "shape/triangle.h"
+
+class Distribution1D;
+class MeshVisual;
+
+//! @brief  Light emitted from the surface of a triangle mesh.
+/**
+ * Every triangle of the mesh emits the same radiance from its front side. A triangle is picked with the probability
+ * proportional to its power, after which the triangle samples a point by the solid angle it subtends. Unlike area
+ * light, rays are not tested against the triangles of the light alone, the scene resolves the intersection instead
+ * since there could be a lot of them.
+ */
+class   MeshLight : public Light{
+public:
+    //! @brief  Constructor and destructor are defined where the distribution is not an incomplete type.
+    MeshLight();
+    ~MeshLight();
+
+    //! @brief  Sample a direction given the intersection.
+    //!
+    //! @param  ip              The point where we are interested in shading at.
+    //! @param  ls              The light sample information.
+    //! @param  dirToLight      The resulting direction goes from the intersection to light source.
+    //! @param  distance        The distance from the intersected point to the sampled point.
+    //! @param  pdfw            The resulting pdf w.r.t solid angle to pick such a direction.
+    //! @param  emissionPdf     The pdf w.r.t solid angle if such a direction and position is picked by the light source.
+    //! @param  cosAtLight      The cos of the angle between the light out-going direction, the opposite of 'dirToLight'.
+    //! @param  visibility      The visibility data structured filled by the light source.
+    //! @return                 The radiance goes from the light source to the intersected point.
+    Spectrum sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const override;
+
+    //! @brief      Sample a point and light out-going direction.
+    //!
+    //! @param  ls              The light sample.
+    //! @param  r               The resulting sampled ray.
+    //! @param  pdfW            The pdf w.r.t solid angle and area of picking such a light out-going ray.
+    //! @param  pdfA            The pdf w.r.t area of picking the origin of the ray.
+    //! @param  cosAtLight      The cos of the angle between the light out-going direction and the normal.
+    //! @return                 The radiance goes along the ray.
+    Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override;
+
+    //! @brief  Get the radiance light starting from the light source and ending at the intersection point.
+    //!
+    //! @param  intersect       The intersection with one of the triangles of the light.
+    //! @param  wo              The direction goes from the intersection to the light source.
+    //! @param  directPdfA      The pdf w.r.t area to pick the point.
+    //! @param  emissionPdf     The pdf w.r.t solid angle to pick to sample such a position and direction goes to the intersection.
+    //! @return                 The radiance goes from the light source to the intersection, black if there is no intersection.
+    Spectrum Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const override;
+
+    //! @brief  Given a ray, sample the light source if the first intersection of the ray in the scene is on the light.
+    //!
+    //! @param  ray             The ray to be evaluated.
+    //! @param  intersect       The intersection between the ray and the light source.
+    //! @param  radiance        The radiance goes from the light source to the ray origin.
+    //! @return                 Whether the ray hits the light source before anything else.
+    bool Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& radiance ) const override;
+
+    //! @brief  Approximation of total power of the light.
+    //!
+    //! @return     Approximation of the light power.
+    Spectrum Power() const override;
+
+    //! @brief  Get the bounds of the emission of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Whether there is any triangle in the light.
+    bool GetBounds( LightBounds& bounds ) const override;
+
+    //! @brief  Whether mesh light is a delta light.
+    //!
+    //! @return     Always return 'False' for mesh light because it is not delta light.
+    bool    IsDelta() const override{
+        return false;
+    }
+
+    //! @brief  The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
+    //!
+    //! @param  p       The point in world space to be shaded.
+    //! @param  wi      The direction pointing from the point.
+    //! @return         The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
+    float Pdf( const Point& p , const Vector& wi ) const override;
+
+    //! @brief  Build the distribution of the triangles of a mesh.
+    //!
+    //! It needs to be called again every time the mesh moves.
+    //!
+    //! @param  visual  The mesh visual whose triangles are filled already.
+    void    Build( const MeshVisual& visual );
+
+private:
+    /**< Triangles of the mesh. */
+    std::vector<const Triangle*>                    m_triangles;
+    /**< Index of each triangle in 'm_triangles'. */
+    std::unordered_map<const Shape*, unsigned>      m_triangleIds;
+    /**< Distribution of picking triangles, proportional to the power of them. */
+    std::unique_ptr<Distribution1D>                 m_distribution;
+    /**< Total surface area of the triangles. */
+    float                                           m_area = 0.0f;
+    /**< Bounds of the triangles and their normals. */
+    LightBounds                                     m_bounds;
+
+    //! @brief  Probability of picking the triangle divided by its surface area.
+    //!
+    //! @param  id      Index of the triangle.
+    //! @return         The pdf w.r.t area of picking a point on the triangle.
+    float   pdfA( unsigned id ) const;
+
+    friend class MeshLightEntity;
+};
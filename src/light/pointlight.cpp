@@ -76,3 +76,12 @@ Spectrum PointLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , fl
 
     return intensity;
 }
+
+bool PointLight::GetBounds( LightBounds& bounds ) const{
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.cosThetaO = -1.0f;
+    bounds.cosThetaE = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
@@ -52,6 +52,12 @@ public:
     //! @return                 The radiance goes from the light source to the intersected point.
     Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override;
 
+    //! @brief  Get the bounds of the emission of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Always true, point light emits towards all directions from a single point.
+    bool GetBounds( LightBounds& bounds ) const override;
+
     //! @brief  Approximation of total power of the light.
     //!
     //! The reason it is just an approximation is because there are certain kinds of light
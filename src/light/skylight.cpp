@@ -19,13 +19,43 @@
 #include "sampler/sample.h"
 #include "core/samplemethod.h"
 
+// Resolution of the distribution of each portal along both dimensions.
+static constexpr unsigned   SKY_PORTAL_RESOLUTION = 128;
+
+// Map a direction in the frame of a portal, whose z axis is the normal, to its rectified parameterization.
+SORT_STATIC_FORCEINLINE void portalDirToUV( const Vector& w , float uv[2] ){
+    uv[0] = atan2( w.x , w.z ) * INV_PI + 0.5f;
+    uv[1] = atan2( w.y , w.z ) * INV_PI + 0.5f;
+}
+
+// Map a point in the rectified parameterization of a portal to a direction in its frame.
+SORT_STATIC_FORCEINLINE Vector portalUVToDir( const float uv[2] ){
+    return normalize( Vector( tan( ( uv[0] - 0.5f ) * PI ) , tan( ( uv[1] - 0.5f ) * PI ) , 1.0f ) );
+}
+
+// Ratio of solid angle over area in the rectified parameterization of a portal, the direction is in its frame.
+SORT_STATIC_FORCEINLINE float portalJacobian( const Vector& w ){
+    return PI * PI * ( 1.0f - SQR( w.x ) ) * ( 1.0f - SQR( w.y ) ) / w.z;
+}
+
 Spectrum SkyLight::sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const{
-    // sample a ray
+    // sample a ray, through portals if there is any visible portal
     float _pdfw = 0.0f;
-    const Vector localDir = sky.sample_v( ls->u , ls->v , &_pdfw , 0 );
-    if( _pdfw == 0.0f )
-        return 0.0f;
-    dirToLight = m_light2world.TransformVector(localDir);
+    Vector localDir;
+    const auto total = portalTotal( ip );
+    if( total > 0.0f ){
+        if( !samplePortals( ip , total , ls->u , ls->v , dirToLight ) )
+            return 0.0f;
+        _pdfw = portalPdf( ip , dirToLight , total );
+        if( _pdfw == 0.0f )
+            return 0.0f;
+        localDir = m_light2world.GetInversed().TransformVector(dirToLight);
+    }else{
+        localDir = sky.sample_v( ls->u , ls->v , &_pdfw , 0 );
+        if( _pdfw == 0.0f )
+            return 0.0f;
+        dirToLight = m_light2world.TransformVector(localDir);
+    }
 
     if( pdfw )
         *pdfw = _pdfw;
@@ -40,27 +70,28 @@ Spectrum SkyLight::sample_l(const Point& ip, const LightSample* ls , Vector& dir
     {
         const BBox& box = m_scene->GetBBox();
         const Vector delta = box.m_Max - box.m_Min;
-        *emissionPdf = _pdfw * 4.0f * INV_PI / delta.SquaredLength();
+        // emitted rays are not restricted by portals
+        *emissionPdf = sky.Pdf( localDir ) * 4.0f * INV_PI / delta.SquaredLength();
     }
 
     // setup visibility tester
     const float delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , delta , FLT_MAX );
 
-    return sky.Evaluate( localDir ) * intensity;
+    return sky.Evaluate( localDir , ls->spread ) * intensity;
 }
 
 Spectrum SkyLight::Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const{
     const BBox& box = m_scene->GetBBox();
     const Vector delta = box.m_Max - box.m_Min;
 
-    const float directPdf = sky.Pdf( m_light2world.GetInversed().TransformVector(-wo) );
+    // the position of the interaction is where the ray leaving the scene starts
     const float positionPdf = 4.0f * INV_PI / delta.SquaredLength();
 
     if( directPdfA )
-        *directPdfA = directPdf;
+        *directPdfA = Pdf( intersect.intersect , -wo );
     if( emissionPdf )
-        *emissionPdf = directPdf * positionPdf;
+        *emissionPdf = sky.Pdf( m_light2world.GetInversed().TransformVector(-wo) ) * positionPdf;
 
     return sky.Evaluate( m_light2world.GetInversed().TransformVector(-wo) ) * intensity;
 }
@@ -108,10 +139,115 @@ bool SkyLight::Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& ra
     if( intersect && intersect->t != FLT_MAX )
         return false;
 
-    radiance = sky.Evaluate( m_light2world.GetInversed().TransformVector(ray.m_Dir) ) * intensity;
+    // rays spreading like the lobe they are sampled from look up the sky filtered over the lobe
+    radiance = sky.Evaluate( m_light2world.GetInversed().TransformVector(ray.m_Dir) , ray.m_coneSpread ) * intensity;
     return true;
 }
 
 float SkyLight::Pdf( const Point& p , const Vector& wi ) const{
+    const auto total = portalTotal( p );
+    if( total > 0.0f )
+        return portalPdf( p , wi , total );
     return sky.Pdf( m_light2world.GetInversed().TransformVector(wi) );
 }
+
+void SkyLight::AddPortal( const Point& corner , const Vector& edge_u , const Vector& edge_v , const Vector& outward ){
+    Portal portal;
+    portal.corner = corner;
+    portal.size_u = edge_u.Length();
+    portal.u = normalize( edge_u );
+    portal.v = edge_v - portal.u * dot( edge_v , portal.u );
+    portal.size_v = portal.v.Length();
+    portal.n = cross( portal.u , portal.v );
+    if( portal.size_u == 0.0f || portal.size_v == 0.0f || portal.n.SquaredLength() == 0.0f ){
+        slog( WARNING , LIGHT , "Degenerated sky portal is ignored." );
+        return;
+    }
+    portal.v = normalize( portal.v );
+    portal.n = normalize( portal.n );
+    if( dot( portal.n , outward ) < 0.0f )
+        portal.n = -portal.n;
+
+    // the sky radiance w.r.t solid angle is converted to the rectified parameterization
+    const auto world2light = m_light2world.GetInversed();
+    std::vector<float> data( SKY_PORTAL_RESOLUTION * SKY_PORTAL_RESOLUTION );
+    for( auto j = 0u ; j < SKY_PORTAL_RESOLUTION ; ++j ){
+        for( auto i = 0u ; i < SKY_PORTAL_RESOLUTION ; ++i ){
+            const float uv[2] = { ( i + 0.5f ) / SKY_PORTAL_RESOLUTION , ( j + 0.5f ) / SKY_PORTAL_RESOLUTION };
+            const auto w = portalUVToDir( uv );
+            const auto world = portal.u * w.x + portal.v * w.y + portal.n * w.z;
+            data[ j * SKY_PORTAL_RESOLUTION + i ] = sky.Evaluate( world2light.TransformVector( world ) ).GetIntensity() * portalJacobian( w );
+        }
+    }
+    portal.distribution = std::make_unique<WindowedDistribution2D>( data.data() , SKY_PORTAL_RESOLUTION , SKY_PORTAL_RESOLUTION );
+    m_portals.push_back( std::move( portal ) );
+}
+
+float SkyLight::portalWindow( const Portal& portal , const Point& p , float window[4] ) const{
+    // every point of the portal is at the same distance along the normal, directions through it form a rectangle
+    const auto d = portal.corner - p;
+    const auto h = dot( d , portal.n );
+    if( h <= 0.0f )
+        return 0.0f;
+    const auto du = dot( d , portal.u ) , dv = dot( d , portal.v );
+    window[0] = atan( du / h ) * INV_PI + 0.5f;
+    window[1] = atan( dv / h ) * INV_PI + 0.5f;
+    window[2] = atan( ( du + portal.size_u ) / h ) * INV_PI + 0.5f;
+    window[3] = atan( ( dv + portal.size_v ) / h ) * INV_PI + 0.5f;
+    return portal.distribution->Integral( window[0] , window[1] , window[2] , window[3] );
+}
+
+float SkyLight::portalTotal( const Point& p ) const{
+    auto total = 0.0f;
+    float window[4];
+    for( const auto& portal : m_portals )
+        total += portalWindow( portal , p , window );
+    return total;
+}
+
+bool SkyLight::samplePortals( const Point& p , float total , float u , float v , Vector& wi ) const{
+    // pick a portal based on the sky radiance through it, u is remapped to sample the direction
+    // the last visible portal is picked in case of floating point error
+    auto target = u * total;
+    const Portal* picked = nullptr;
+    float window[4] , picked_window[4];
+    auto remapped = 0.0f;
+    for( const auto& portal : m_portals ){
+        const auto weight = portalWindow( portal , p , window );
+        if( weight <= 0.0f )
+            continue;
+        picked = &portal;
+        std::copy( window , window + 4 , picked_window );
+        remapped = std::min( target / weight , 0x1.fffffep-1f );
+        if( target < weight )
+            break;
+        target -= weight;
+    }
+    if( IS_PTR_INVALID( picked ) )
+        return false;
+
+    float uv[2];
+    if( !picked->distribution->SampleContinuous( remapped , v , picked_window , uv , nullptr ) )
+        return false;
+    const auto w = portalUVToDir( uv );
+    wi = picked->u * w.x + picked->v * w.y + picked->n * w.z;
+    return true;
+}
+
+float SkyLight::portalPdf( const Point& p , const Vector& wi , float total ) const{
+    // directions through multiple portals could be sampled through any of them
+    auto pdf = 0.0f;
+    float window[4];
+    for( const auto& portal : m_portals ){
+        const auto w = Vector( dot( wi , portal.u ) , dot( wi , portal.v ) , dot( wi , portal.n ) );
+        if( w.z <= 0.0f )
+            continue;
+        const auto weight = portalWindow( portal , p , window );
+        if( weight <= 0.0f )
+            continue;
+        float uv[2];
+        portalDirToUV( w , uv );
+        pdf += weight / total * portal.distribution->Pdf( uv[0] , uv[1] , window ) / portalJacobian( w );
+    }
+    return pdf;
+}
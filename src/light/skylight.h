@@ -17,12 +17,23 @@
 
 #pragma once
 
+#include <vector>
 #include "light.h"
 #include "core/rtti.h"
 #include "math/sky.h"
 #include "core/log.h"
 
 //! @brief  Definition of sky light.
+/**
+ * Interiors lit by the sky through windows waste most sky samples on directions blocked by walls if the whole sky
+ * is importance sampled. Portals are quads marking such openings, sky samples of a point are restricted to the
+ * directions through the portals visible from it, which is described in this paper
+ * <a href="https://benedikt-bitterli.me/pmems.pdf">Portal-Masked Environment Map Sampling</a>.
+ * Each portal has its own distribution of the sky in its rectified parameterization, where directions through the
+ * portal from any point form a rectangle. Sampling the portal is then sampling the distribution inside the rectangle.
+ * Directions not through any portal are never sampled from points seeing any portal, which is fine as long as
+ * the contribution is combined with BSDF sampling through multiple importance sampling.
+ */
 class   SkyLight : public Light{
 public:
     //! @brief  Sample a direction given the intersection.
@@ -110,9 +121,63 @@ public:
     //! @return         The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
     float Pdf( const Point& p , const Vector& wi ) const override;
 
+    //! @brief  Add a portal, the sky needs to be loaded before.
+    //!
+    //! @param  corner          A corner of the portal quad.
+    //! @param  edge_u          The edge of the quad starting from the corner.
+    //! @param  edge_v          The other edge of the quad starting from the corner.
+    //! @param  outward         The direction going through the portal towards the sky.
+    void AddPortal( const Point& corner , const Vector& edge_u , const Vector& edge_v , const Vector& outward );
+
 private:
+    //! @brief  A quad marking an opening that the sky is visible through.
+    struct Portal{
+        /**< A corner of the portal. */
+        Point       corner;
+        /**< Unit vectors along the two edges and the normal pointing to the sky, they are orthogonal. */
+        Vector      u , v , n;
+        /**< Length of the two edges. */
+        float       size_u = 0.0f , size_v = 0.0f;
+        /**< Distribution of the sky radiance in the rectified parameterization of the portal. */
+        std::unique_ptr<WindowedDistribution2D> distribution;
+    };
+
     /**< Sky information. */
     Sky sky;
+    /**< Portals marking the openings that the sky is visible through. */
+    std::vector<Portal> m_portals;
+
+    //! @brief  Get the window of directions through a portal from a point.
+    //!
+    //! @param  portal          The portal to be evaluated.
+    //! @param  p               The point seeing the portal.
+    //! @param  window          The window in the rectified parameterization of the portal, { u0 , v0 , u1 , v1 }.
+    //! @return                 Sky radiance integrated over solid angles of the window, zero if the portal is not visible.
+    float portalWindow( const Portal& portal , const Point& p , float window[4] ) const;
+
+    //! @brief  Integrated sky radiance through all portals seen from a point.
+    //!
+    //! @param  p               The point seeing the portals.
+    //! @return                 Sky radiance integrated over solid angles through all portals.
+    float portalTotal( const Point& p ) const;
+
+    //! @brief  Pick a portal and sample a direction through it.
+    //!
+    //! @param  p               The point seeing the portals.
+    //! @param  total           Sky radiance integrated over solid angles through all portals.
+    //! @param  u               A canonical random variable to pick the portal and sample the direction.
+    //! @param  v               A canonical random variable to sample the direction.
+    //! @param  wi              The sampled direction in world space.
+    //! @return                 Whether a direction is sampled.
+    bool samplePortals( const Point& p , float total , float u , float v , Vector& wi ) const;
+
+    //! @brief  The pdf w.r.t solid angle of sampling a direction through portals.
+    //!
+    //! @param  p               The point seeing the portals.
+    //! @param  wi              The direction in world space.
+    //! @param  total           Sky radiance integrated over solid angles through all portals.
+    //! @return                 The pdf w.r.t solid angle.
+    float portalPdf( const Point& p , const Vector& wi , float total ) const;
 
     friend class SkyLightEntity;
 };
@@ -99,4 +99,15 @@ Spectrum SpotLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , flo
         return 0.0f;
 
     return intensity * d * d;
-}
\ No newline at end of file
+}
+
+bool SpotLight::GetBounds( LightBounds& bounds ) const{
+    const auto light_dir = Vector3f( m_light2world.matrix.m[1] , m_light2world.matrix.m[5] , m_light2world.matrix.m[9] );
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.axis = normalize( light_dir );
+    bounds.cosThetaO = cos_total_range;
+    bounds.cosThetaE = 1.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
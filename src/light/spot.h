@@ -64,6 +64,12 @@ public:
     //! @return                 The radiance goes from the light source to the intersected point.
     Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override;
 
+    //! @brief  Get the bounds of the emission of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Always true, spot light emits within its cone from a single point.
+    bool GetBounds( LightBounds& bounds ) const override;
+
     //! @brief  The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
     //!
     //! Instead of checking whether p and wi is valid, it always returns 1.0. It is higher level code's responsibility to
@@ -21,6 +21,7 @@
 #include "core/stats.h"
 #include "core/profile.h"
 #include "core/path.h"
+#include "imagesensor/imageoutput.h"
 
 #ifdef SORT_IN_WINDOWS
 int __cdecl main( int argc , char** argv )
@@ -35,22 +36,36 @@ int main(int argc, char* argv[])
     addLogDispatcher(std::make_unique<StdOutLogDispatcher>());
     addLogDispatcher(std::make_unique<FileLogDispatcher>("log.txt"));
 
+    // Rendering and loading threads should never be blocked by logging.
+    startAsyncLogging();
+
     const auto ret = RunSORT(argc, argv);
 
+    // Stats are printed synchronously, so that none of them is suppressed.
+    stopAsyncLogging();
+
     // Flush main thread data
     SortStatsFlushData(true);
     // Output stats data
-    if(ret == 0 && !g_unitTestMode)
+    if(ret == 0 && !g_unitTestMode){
         SortStatsPrintData();
+        if( !g_statsJsonFile.empty() ){
+            SortStatsSaveJson( g_statsJsonFile );
+            slog(INFO, GENERAL, "Stats file: \"%s\"", g_statsJsonFile.c_str());
+        }
+    }
 
     SORT_PROFILE_END; // Main Thread
 
     // dump profile data
     if (SORT_PROFILE_ISENABLED && ret == 0 ){
-        const std::string filename("sort.prof");
+        const std::string filename(SORT_PROFILE_FILE);
         SORT_PROFILE_DUMP(filename.c_str());
         slog(INFO, GENERAL, "Profiling file: \"%s\"", GetFilePathInExeFolder(filename).c_str());
     }
+    // The output image could still be being encoded in the background.
+    WaitForImageOutputs();
+
     slog(INFO, GENERAL, "Log file: \"%s\"", GetFilePathInExeFolder("log.txt").c_str());
 
     return ret;
@@ -0,0 +1,64 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include "core/define.h"
+
+//! @brief  Binary mask of the cut out parts of a surface in texture space.
+/**
+ * Foliage is usually modeled with cards of alpha textures, rays pass through most of the area of the cards. Instead of
+ * returning each hit on a card to the integrator, which executes the shader and traces a new ray past the card, cut out
+ * parts are rejected during traversal so that it goes on right where it is.
+ * Only transparency that is either fully transparent or fully opaque and depends on nothing but texture coordinates
+ * could be baked into a mask. The mask is looked up with the nearest texel, coordinates outside of [0,1) repeat.
+ */
+class AlphaMask{
+public:
+    /**< Resolution of the mask along both of the axes, it needs to be a power of two. */
+    static constexpr unsigned RESOLUTION = 512;
+
+    //! @brief  Constructor, nothing is cut out by default.
+    AlphaMask() : m_bits( RESOLUTION * RESOLUTION / 64 , 0ull ) {}
+
+    //! @brief  Mark a texel as cut out.
+    //!
+    //! @param  x       Texel coordinate along u.
+    //! @param  y       Texel coordinate along v.
+    void    SetCutOut( const unsigned x , const unsigned y ){
+        const auto i = y * RESOLUTION + x;
+        m_bits[i >> 6] |= 1ull << ( i & 63 );
+    }
+
+    //! @brief  Whether the surface is cut out at a texture coordinate.
+    //!
+    //! @param  u       U coordinate of the texture.
+    //! @param  v       V coordinate of the texture.
+    //! @return         True if rays pass through the surface there.
+    SORT_FORCEINLINE bool IsCutOut( const float u , const float v ) const{
+        const auto x = (unsigned)(int)std::floor( u * RESOLUTION ) & ( RESOLUTION - 1 );
+        const auto y = (unsigned)(int)std::floor( v * RESOLUTION ) & ( RESOLUTION - 1 );
+        const auto i = y * RESOLUTION + x;
+        return ( m_bits[i >> 6] >> ( i & 63 ) ) & 1ull;
+    }
+
+private:
+    /**< One bit for each texel, texels are laid out row by row. */
+    std::vector<unsigned long long>   m_bits;
+};
@@ -89,6 +89,24 @@ IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeEmpty)
 namespace {
      constexpr unsigned int MAX_CLOSURE_CNT = 128;
 
+     // SSS is replaced with a diffuse lobe once the footprint of the ray covers this many mean free paths.
+     constexpr float SSS_LOD_FOOTPRINT_RATIO = 16.0f;
+
+     //! @brief     Whether subsurface scattering is not visible under the footprint of the ray.
+     //!
+     //! Light scattered under the surface leaves it within a few mean free paths from where it enters, which is a tiny
+     //! fraction of the footprint of a distant surface, the surface is not told apart from a diffuse one with the same
+     //! albedo then. Unlike replacing SSS with small mean free path everywhere, surfaces close to the camera are left as
+     //! they are. Rays without a cone have no footprint and never replace SSS.
+     //!
+     //! @param se          The scattering event.
+     //! @param mfp         The mean free path of each channel.
+     //! @return            Whether the BSSRDF could be replaced with a diffuse lobe of the same albedo.
+     bool sssBelowFootprint(const ScatteringEvent& se, const float3& mfp) {
+         const auto max_mfp = fmax(mfp.x, fmax(mfp.y, mfp.z));
+         return se.GetInteraction().footprint > SSS_LOD_FOOTPRINT_RATIO * max_mfp;
+     }
+
      //! @brief     Base interface of closure types.
      struct Closure_Base {
          virtual ~Closure_Base() = default;
@@ -164,7 +182,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              ClosureTypeLambert* bxdf_param = (ClosureTypeLambert*)param;
-             se.AddBxdf(SORT_MALLOC(Lambert)(*bxdf_param, w));
+             se.AddBxdf(SE_MALLOC(se, Lambert)(*bxdf_param, w));
          }
      };
 
@@ -173,7 +191,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              ClosureTypeOrenNayar* bxdf_param = (ClosureTypeOrenNayar*)param;
-             se.AddBxdf(SORT_MALLOC(OrenNayar)(*bxdf_param, w));
+             se.AddBxdf(SE_MALLOC(se, OrenNayar)(*bxdf_param, w));
          }
      };
 
@@ -186,8 +204,8 @@ namespace {
              auto& params = *(ClosureTypeDisney*)param;
              auto& mfp = params.scatterDistance;
 
-             // Ignore SSS if necessary
-             if (SE_NONE != (se.GetFlag() & SE_REPLACE_BSSRDF))
+             // Ignore SSS if necessary, or if it is not visible under the footprint of the ray.
+             if (SE_NONE != (se.GetFlag() & SE_REPLACE_BSSRDF) || sssBelowFootprint(se, mfp))
                  mfp = Tsl_Namespace::make_float3(0.0f, 0.0f, 0.0f);
 
              RGBSpectrum sssBaseColor = params.baseColor;
@@ -230,18 +248,18 @@ namespace {
                  const auto bxdf_sampling_weight = DisneyBRDF::Evaluate_Sampling_Weight( params );
 
                  if( bxdf_sampling_weight > 0.0f )
-                     se.AddBxdf(SORT_MALLOC(DisneyBRDF)(params, weight, bxdf_sampling_weight * sample_weight));
+                     se.AddBxdf(SE_MALLOC(se, DisneyBRDF)(params, weight, bxdf_sampling_weight * sample_weight));
 
                  const auto diffuseWeight = (Spectrum)( weight * (1.0f - params.metallic) * (1.0 - params.specTrans) );
                  if (!sssBaseColor.IsBlack() && bxdf_sampling_weight < 1.0f && !diffuseWeight.IsBlack() )
-                     se.AddBssrdf( SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, params.scatterDistance, diffuseWeight , ( 1.0f - bxdf_sampling_weight ) * sample_weight * bssrdf_pdf ) );
+                     se.AddBssrdf(SE_MALLOC(se, DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, params.scatterDistance, diffuseWeight , ( 1.0f - bxdf_sampling_weight ) * sample_weight * bssrdf_pdf ) );
 
  #ifdef SSS_REPLACE_WITH_LAMBERT
                  if (addExtraLambert && !is_tsl_color_black(baseColor))
-                     se.AddBxdf(SORT_MALLOC(Lambert)(baseColor, diffuseWeight, ( 1.0f - bxdf_sampling_weight ) * sample_weight * ( 1.0f - bssrdf_pdf ) , params.normal));
+                     se.AddBxdf(SE_MALLOC(se, Lambert)(baseColor, diffuseWeight, ( 1.0f - bxdf_sampling_weight ) * sample_weight * ( 1.0f - bssrdf_pdf ) , params.normal));
  #endif
              }else{
-                 se.AddBxdf(SORT_MALLOC(DisneyBRDF)(params, weight, sample_weight));
+                 se.AddBxdf(SE_MALLOC(se, DisneyBRDF)(params, weight, sample_weight));
              }
          }
      };
@@ -251,7 +269,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetReflectionGGX*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetReflection)(params, w));
          }
      };
 
@@ -260,7 +278,7 @@ namespace {
 
         void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetReflectionBlinn*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetReflection)(params, w));
          }
      };
 
@@ -269,7 +287,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetReflectionBeckmann*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetReflection)(params, w));
          }
      };
 
@@ -278,7 +296,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetRefractionGGX*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetRefraction)(params, w));
          }
      };
 
@@ -287,7 +305,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetRefractionBlinn*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetRefraction)(params, w));
          }
      };
 
@@ -296,7 +314,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMicrofacetRefractionBeckmann*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetRefraction)(params, w));
          }
      };
 
@@ -305,7 +323,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(ClosureTypeAshikhmanShirley*)param;
-             se.AddBxdf(SORT_MALLOC(AshikhmanShirley)(params, w));
+             se.AddBxdf(SE_MALLOC(se, AshikhmanShirley)(params, w));
          }
      };
 
@@ -314,7 +332,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(ClosureTypePhong*)param;
-             se.AddBxdf(SORT_MALLOC(Phong)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Phong)(params, w));
          }
      };
 
@@ -323,7 +341,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeLambertTransmission*)param;
-             se.AddBxdf(SORT_MALLOC(LambertTransmission)(params, w));
+             se.AddBxdf(SE_MALLOC(se, LambertTransmission)(params, w));
          }
      };
 
@@ -332,7 +350,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(ClosureTypeMirror*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetReflection)(params, w));
          }
      };
 
@@ -341,7 +359,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(ClosureTypeDielectric*)param;
-             se.AddBxdf(SORT_MALLOC(Dielectric)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Dielectric)(params, w));
          }
      };
 
@@ -350,7 +368,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3 & w, ScatteringEvent & se) const override {
              const auto& params = *(ClosureTypeMicrofacetReflectionDielectric*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SE_MALLOC(se, MicroFacetReflection)(params, w));
          }
      };
 
@@ -359,7 +377,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeHair*)param;
-             se.AddBxdf(SORT_MALLOC(Hair)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Hair)(params, w));
          }
      };
 
@@ -368,7 +386,7 @@ namespace {
 
         void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeFourier*)param;
-             se.AddBxdf(SORT_MALLOC(FourierBxdf)(params, w));
+             se.AddBxdf(SE_MALLOC(se, FourierBxdf)(params, w));
          }
      };
 
@@ -377,7 +395,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeMERL*)param;
-             se.AddBxdf(SORT_MALLOC(Merl)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Merl)(params, w));
          }
      };
 
@@ -386,9 +404,10 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeCoat*)param;
-             ScatteringEvent* bottom = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             ScatteringEvent* bottom = SE_MALLOC(se, ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             bottom->ShareScatteringStorage(se);
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure, make_float3(1.0f, 1.0f, 1.0f), *bottom);
-             se.AddBxdf(SORT_MALLOC(Coat)(params, w, bottom));
+             se.AddBxdf(SE_MALLOC(se, Coat)(params, w, bottom));
          }
      };
 
@@ -397,11 +416,13 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3 & w, ScatteringEvent & se) const override {
              const auto& params = *(const ClosureTypeDoubleSided*)param;
-             ScatteringEvent* se0 = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
-             ScatteringEvent* se1 = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             ScatteringEvent* se0 = SE_MALLOC(se, ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             ScatteringEvent* se1 = SE_MALLOC(se, ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             se0->ShareScatteringStorage(se);
+             se1->ShareScatteringStorage(se);
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure0, make_float3(1.0f, 1.0f, 1.0f), *se0);
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure1, make_float3(1.0f, 1.0f, 1.0f), *se1);
-             se.AddBxdf(SORT_MALLOC(DoubleSided)(se0, se1, w));
+             se.AddBxdf(SE_MALLOC(se, DoubleSided)(se0, se1, w));
          }
      };
 
@@ -410,7 +431,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeDistributionBRDF*)param;
-             se.AddBxdf(SORT_MALLOC(DistributionBRDF)(params, w));
+             se.AddBxdf(SE_MALLOC(se, DistributionBRDF)(params, w));
          }
      };
 
@@ -419,7 +440,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeFabric*)param;
-             se.AddBxdf(SORT_MALLOC(Fabric)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Fabric)(params, w));
          }
      };
 
@@ -433,7 +454,8 @@ namespace {
 
              const auto weight = w;
 
-             if (SE_NONE == (se.GetFlag() & SE_REPLACE_BSSRDF)){
+             // the diffuse lobe has the same albedo as the BSSRDF.
+             if (SE_NONE == (se.GetFlag() & SE_REPLACE_BSSRDF) && !sssBelowFootprint(se, params.scatter_distance)){
  #ifdef SSS_REPLACE_WITH_LAMBERT
                  auto sssBaseColor = params.base_color;
                  const auto pdf_weight = (weight.x + weight.y + weight.z) / 3.0f;
@@ -470,18 +492,18 @@ namespace {
 
                  const auto bssrdf_pdf = bssrdf_channel_weight / total_channel_weight;
                  if (!is_tsl_color_black(mfp) && !is_tsl_color_black(sssBaseColor))
-                     se.AddBssrdf(SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, mfp, weight, pdf_weight * bssrdf_pdf ));
+                     se.AddBssrdf(SE_MALLOC(se, DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, mfp, weight, pdf_weight * bssrdf_pdf ));
 
                  if (addExtraLambert && !is_tsl_color_black(baseColor))
-                     se.AddBxdf(SORT_MALLOC(Lambert)(baseColor, weight, pdf_weight * ( 1.0f - bssrdf_pdf ), params.normal));
+                     se.AddBxdf(SE_MALLOC(se, Lambert)(baseColor, weight, pdf_weight * ( 1.0f - bssrdf_pdf ), params.normal));
  #else
                  if(is_tsl_color_black(params.scatter_distance))
-                    se.AddBxdf(SORT_MALLOC(Lambert)(params.base_color, weight, params.normal));
+                    se.AddBxdf(SE_MALLOC(se, Lambert)(params.base_color, weight, params.normal));
                  else
-                    se.AddBssrdf(SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), params, weight ));
+                    se.AddBssrdf(SE_MALLOC(se, DisneyBssrdf)(&se.GetInteraction(), params, weight ));
  #endif
              }else{
-                 se.AddBxdf(SORT_MALLOC(Lambert)(params.base_color, weight , params.normal));
+                 se.AddBxdf(SE_MALLOC(se, Lambert)(params.base_color, weight , params.normal));
              }
          }
      };
@@ -491,7 +513,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeTransparent*)param;
-             se.AddBxdf(SORT_MALLOC(Transparent)(params, w));
+             se.AddBxdf(SE_MALLOC(se, Transparent)(params, w));
          }
 
          Spectrum EvaluateOpacity(const ClosureParamPtr param, const float3& w) const override{
@@ -16,19 +16,232 @@
  */
 
 #include <string.h>
+#include <algorithm>
+#include <unordered_set>
 #include <tsl_system.h>
 #include "material.h"
 #include "matmanager.h"
 #include "core/log.h"
 #include "core/globalconfig.h"
 #include "core/strid.h"
+#include "core/timer.h"
+#include "core/scene.h"
 #include "scatteringevent/scatteringevent.h"
 #include "scatteringevent/bsdf/lambert.h"
 #include "scatteringevent/bsdf/transparent.h"
 #include "texture/imagetexture2d.h"
+#include "core/hwcounter.h"
 
 USE_TSL_NAMESPACE
 
+SORT_STATS_DEFINE_COUNTER(sFoldedClosureBranches)
+
+SORT_STATS_DEFINE_COUNTER(sConstantOpacityMaterials)
+SORT_STATS_DEFINE_COUNTER(sAlphaMaskedMaterials)
+
+SORT_STATS_COUNTER("Statistics", "Closure Branches Folded", sFoldedClosureBranches);
+SORT_STATS_COUNTER("Statistics", "Materials with Constant Opacity", sConstantOpacityMaterials);
+SORT_STATS_COUNTER("Statistics", "Materials with Alpha Mask", sAlphaMaskedMaterials);
+
+SORT_STATS_DEFINE_SHADING_REPORT(sShadingReport)
+
+SORT_STATS_SHADING_REPORT("Performance", "Material Shading Cost", sShadingReport);
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+// Shading cost of a material in the current thread, nothing is measured if the current unit is not sampled.
+static StatsShadingCost* get_shading_cost(const std::string& name) {
+    return g_StatsSampled ? &sShadingReport.Get(name) : nullptr;
+}
+
+// Bxdfs of a scattering event are attributed to the material once its surface shader is executed.
+static void record_surface_shading(StatsShadingCost* cost, ScatteringEvent& se) {
+    if (!cost)
+        return;
+    ++cost->surfaceShaderCnt;
+    cost->bxdfCnt += se.GetBxdfCount();
+    se.SetShadingCost(cost);
+}
+#endif
+
+namespace {
+    // A default value of a shader unit parameter as it is streamed, TSL default values can't be looked into.
+    struct StreamedDefaultValue {
+        ShaderParamDefaultValue default_value;
+        int                     channel_num = 0;
+        float                   value[3] = { 0.0f, 0.0f, 0.0f };
+        std::string             str;
+    };
+}
+
+// Specialize the shader graph of a material with its constant inputs before it is compiled.
+// A blend node with a constant factor of zero or one only takes one of its closures, the blend node is bypassed and the
+// other closure branch is dropped if nothing else uses it. The shader is never evaluated there, nor does it get compiled.
+static void fold_closure_branches(TSL_ShaderData& shader_data, std::vector<StreamedDefaultValue>& default_values, const std::string& output_node_name) {
+    auto& sources = shader_data.m_sources;
+    auto& connections = shader_data.m_connections;
+
+    // nodes feeding other nodes, they are dead once nothing reachable from the output node uses them
+    std::unordered_set<std::string> feeding_nodes;
+    for (const auto& connection : connections)
+        feeding_nodes.insert(connection.source_shader);
+
+    auto folded = false;
+    for (auto it = sources.begin(); it != sources.end(); ) {
+        const auto& name = it->name;
+        const auto is_input_of_node = [&](const ShaderConnection& connection, const char* property) {
+            return connection.target_shader == name && connection.target_property == property;
+        };
+
+        const auto foldable = [&]() -> const ShaderConnection* {
+            if (it->type != "SORTNode_Material_Blend")
+                return nullptr;
+
+            // the factor needs to be a constant
+            if (std::any_of(connections.begin(), connections.end(), [&](const ShaderConnection& c) { return is_input_of_node(c, "Factor"); }))
+                return nullptr;
+            const auto factor = std::find_if(default_values.begin(), default_values.end(), [&](const StreamedDefaultValue& dv) {
+                return dv.default_value.shader_unit_name == name && dv.default_value.shader_unit_param_name == "Factor" && dv.channel_num == 1;
+            });
+            if (factor == default_values.end() || (factor->value[0] != 0.0f && factor->value[0] != 1.0f))
+                return nullptr;
+
+            // the closure taken needs to be connected, an empty closure is left as it is
+            const auto taken = factor->value[0] == 0.0f ? "Surface0" : "Surface1";
+            const auto input = std::find_if(connections.begin(), connections.end(), [&](const ShaderConnection& c) { return is_input_of_node(c, taken); });
+            return input == connections.end() ? nullptr : &*input;
+        }();
+
+        if (!foldable) {
+            ++it;
+            continue;
+        }
+
+        // connect the closure taken to wherever the blend node goes
+        const auto source_shader = foldable->source_shader;
+        const auto source_property = foldable->source_property;
+        connections.erase(std::remove_if(connections.begin(), connections.end(), [&](const ShaderConnection& c) { return c.target_shader == name; }), connections.end());
+        for (auto& connection : connections) {
+            if (connection.source_shader == name) {
+                connection.source_shader = source_shader;
+                connection.source_property = source_property;
+            }
+        }
+
+        const auto folded_name = name;
+        default_values.erase(std::remove_if(default_values.begin(), default_values.end(), [&](const StreamedDefaultValue& dv) {
+            return dv.default_value.shader_unit_name == folded_name;
+        }), default_values.end());
+        it = sources.erase(it);
+        folded = true;
+        SORT_STATS(++sFoldedClosureBranches);
+    }
+
+    if (!folded)
+        return;
+
+    // nodes still reachable from the output node
+    std::unordered_set<std::string> reachable = { output_node_name };
+    std::vector<std::string> to_visit = { output_node_name };
+    while (!to_visit.empty()) {
+        const auto target = to_visit.back();
+        to_visit.pop_back();
+        for (const auto& connection : connections) {
+            if (connection.target_shader == target && reachable.insert(connection.source_shader).second)
+                to_visit.push_back(connection.source_shader);
+        }
+    }
+
+    const auto is_dead = [&](const std::string& name) {
+        return feeding_nodes.count(name) && !reachable.count(name);
+    };
+    sources.erase(std::remove_if(sources.begin(), sources.end(), [&](const ShaderSource& source) { return is_dead(source.name); }), sources.end());
+    connections.erase(std::remove_if(connections.begin(), connections.end(), [&](const ShaderConnection& c) { return is_dead(c.source_shader) || is_dead(c.target_shader); }), connections.end());
+    default_values.erase(std::remove_if(default_values.begin(), default_values.end(), [&](const StreamedDefaultValue& dv) {
+        return is_dead(dv.default_value.shader_unit_name);
+    }), default_values.end());
+}
+
+// Opacity only comes from the weights of closures and the attenuation of transparent closures, it is the same everywhere
+// on the surface if no shader unit reads anything of the intersection. Shader units not known to be free of it, like
+// textures and shader groups, are taken as varying.
+static bool is_opacity_constant(const TSL_ShaderData& shader_data) {
+    static const char* constant_types[] = { "SORTNode_Material_", "SORTNodeMathOp", "SORTNodeInputFloat", "SORTNodeInputColor", "SORTNodeExtract", "SORTNodeComposite" };
+    return std::all_of(shader_data.m_sources.begin(), shader_data.m_sources.end(), [](const ShaderSource& source) {
+        return std::any_of(std::begin(constant_types), std::end(constant_types), [&](const char* type) {
+            return source.type.compare(0, strlen(type), type) == 0;
+        });
+    });
+}
+
+// Transparency below this is taken as opaque and above one minus this as cut out while baking alpha masks.
+static constexpr float ALPHA_MASK_THRESHOLD = 0.01f;
+// Every this many texels along both axes the transparency is evaluated once more in a different setup.
+static constexpr unsigned ALPHA_MASK_PROBE_STRIDE = 16;
+
+// Transparency is baked into a binary mask only if it is a cutout, every texel is either fully transparent or fully
+// opaque, and nothing but the texture coordinates affects it. The latter is checked on a sparse set of texels, which
+// are evaluated again with different positions, normals and view directions.
+static std::unique_ptr<AlphaMask> bake_alpha_mask(Tsl_Namespace::ShaderInstance* shader) {
+    const auto classify = [&](const SurfaceInteraction& inter, bool& cut_out) {
+        const auto transparency = ::EvaluateTransparency(shader, inter);
+        if (transparency.GetMaxComponent() <= ALPHA_MASK_THRESHOLD) {
+            cut_out = false;
+            return true;
+        }
+        const auto min_component = std::min(transparency[0], std::min(transparency[1], transparency[2]));
+        cut_out = min_component >= 1.0f - ALPHA_MASK_THRESHOLD;
+        return cut_out;
+    };
+
+    auto mask = std::make_unique<AlphaMask>();
+    SurfaceInteraction inter, probe;
+    inter.normal = inter.gnormal = Vector(0.0f, 1.0f, 0.0f);
+    inter.view = Vector(0.0f, 1.0f, 0.0f);
+    probe.normal = probe.gnormal = Vector(0.6f, 0.0f, 0.8f);
+    probe.view = Vector(0.0f, 0.8f, 0.6f);
+    probe.intersect = Point(13.7f, -5.3f, 2.9f);
+
+    bool any_cut_out = false;
+    for (auto y = 0u; y < AlphaMask::RESOLUTION; ++y) {
+        SORT_MEMPOOL_SCOPE();
+        for (auto x = 0u; x < AlphaMask::RESOLUTION; ++x) {
+            inter.u = (x + 0.5f) / AlphaMask::RESOLUTION;
+            inter.v = (y + 0.5f) / AlphaMask::RESOLUTION;
+
+            bool cut_out;
+            if (!classify(inter, cut_out))
+                return nullptr;
+
+            if (x % ALPHA_MASK_PROBE_STRIDE == 0 && y % ALPHA_MASK_PROBE_STRIDE == 0) {
+                probe.u = inter.u;
+                probe.v = inter.v;
+                bool probe_cut_out;
+                if (!classify(probe, probe_cut_out) || probe_cut_out != cut_out)
+                    return nullptr;
+            }
+
+            if (cut_out) {
+                mask->SetCutOut(x, y);
+                any_cut_out = true;
+            }
+        }
+    }
+    if (!any_cut_out)
+        return nullptr;
+    return mask;
+}
+
+void MaterialBase::BuildOnBinding(){
+    std::call_once(m_bindOnce, [this]() {
+        BuildMaterial();
+        m_bound.store(true, std::memory_order_release);
+    });
+}
+
+bool MaterialBase::IsBound() const{
+    return m_bound.load(std::memory_order_acquire);
+}
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
 bool MaterialBase::IsMaterialBuilt() const{
     // std::memory_order_acquire is needed to make sure compiler doesn't do crazy out-of-order execution thing.
@@ -39,6 +252,7 @@ bool MaterialBase::IsMaterialBuilt() const{
 void Material::BuildMaterial() {
     const auto message = "Build Material '" + m_name + "'";
     SORT_PROFILE(message);
+    SORT_STATS(Timer timer);
 
     static constexpr auto surface_shader_root = R"(
             shader SORT_Surface_Shader( in closure Surface, out closure result ){
@@ -65,27 +279,30 @@ void Material::BuildMaterial() {
             for (const auto& shader : shader_data.m_sources)
                 shader_units[shader.name] = MatManager::GetSingleton().GetShaderUnitTemplate(shader.type);
     
-            // build the root shader
-            auto context = GetShadingContext();
+            // the root shader is the same for all materials, it is only compiled once
             const auto root_shader_name = prefix + output_node_name;
-            if(auto shader_unit_template = context->begin_shader_unit_template(root_shader_name)){
-                // register tsl global
-                TslGlobal::shader_unit_register(shader_unit_template.get());
-
-                // compile the root shader
-                const auto ret = shader_unit_template->compile_shader_source(root_shader);
-                if (!ret)
-                    return;
-
-                // indicate the shader unit is done
-                context->end_shader_unit_template(shader_unit_template.get());
-
-                shader_units[root_shader_name] = shader_unit_template;
-            } else {
+            const auto root_shader_unit = MatManager::GetSingleton().GetRootShaderUnitTemplate(prefix + "ShaderOutput", root_shader);
+            if (!root_shader_unit)
                 return;
+            shader_units[root_shader_name] = root_shader_unit;
+
+            // materials built from the same shader units, wiring and default values share the compiled shader
+            auto key = m_shaderHash;
+            hashData(key, prefix.c_str(), prefix.size() + 1);
+            std::vector<std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>> templates;
+            for (const auto& shader : shader_data.m_sources) {
+                templates.push_back(shader_units[shader.name]);
+                const auto ptr = templates.back().get();
+                hashData(key, &ptr, sizeof(ptr));
             }
-    
+            if (auto cached = MatManager::GetSingleton().GetCachedShaderInstance(key)) {
+                shader_instance = cached;
+                shader_valid = true;
+                return;
+            }
+
             // begin compiling shader group
+            auto context = GetShadingContext();
             auto shader_group = context->begin_shader_group_template(prefix + m_name);
             if (!shader_group)
                 return;
@@ -122,7 +339,8 @@ void Material::BuildMaterial() {
             ret = shader_instance->resolve_shader_instance();
             if (TSL_Resolving_Status::TSL_Resolving_Succeed != ret)
                 return;
-    
+
+            MatManager::GetSingleton().CacheShaderInstance(key, shader_instance, std::move(templates));
             shader_valid = true;
         }
     };
@@ -157,6 +375,31 @@ void Material::BuildMaterial() {
     if (m_special_transparent)
         m_hasTransparentNode = true;
 
+    // Transparency not varying on the surface is evaluated once here, the shader is never executed for shadow rays then.
+    // Surfaces ending up fully opaque are taken as opaque primitives by the spatial accelerators.
+    m_constantTransparency = 0.0f;
+    if (!m_hasTransparentNode || (!m_surface_shader_valid && !m_special_transparent)) {
+        m_opacityClass = OpacityClass::Opaque;
+    } else if (m_special_transparent) {
+        m_opacityClass = OpacityClass::Constant;
+        m_constantTransparency = 1.0f;
+    } else if (is_opacity_constant(m_surface_shader_data)) {
+        m_constantTransparency = ::EvaluateTransparency(m_surface_shader.get(), SurfaceInteraction());
+        m_opacityClass = m_constantTransparency.IsBlack() ? OpacityClass::Opaque : OpacityClass::Constant;
+        SORT_STATS(++sConstantOpacityMaterials);
+    } else {
+        m_opacityClass = OpacityClass::Textured;
+    }
+
+    // Cutouts of textured opacity are rejected during traversal with a baked mask instead of the shader.
+    m_alphaMask = nullptr;
+    if (m_opacityClass == OpacityClass::Textured) {
+        m_alphaMask = bake_alpha_mask(m_surface_shader.get());
+        SORT_STATS(sAlphaMaskedMaterials += m_alphaMask ? 1 : 0);
+    }
+
+    SORT_STATS(sSceneLoadReport.Add("Materials", m_name, timer.GetElapsedTimeInUs(), 0));
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
     // indicate the material has been built
     m_is_built.store(true, std::memory_order_release);
@@ -164,15 +407,41 @@ void Material::BuildMaterial() {
 }
 
 void Material::Serialize(IStreamBase& stream){
+    // A material could be serialized again with new parameters in interactive rendering, nothing of the old one is kept.
+    m_surface_shader_valid = m_volume_shader_valid = m_special_transparent = false;
+    m_surface_shader_data = TSL_ShaderData();
+    m_volume_shader_data = TSL_ShaderData();
+    m_surface_shader_units.clear();
+    m_volume_shader_units.clear();
+    m_paramDefaultValues.clear();
+    m_shaderHash = HASH_INITIAL_VALUE;
+    m_scatteringStorageSize.store(0, std::memory_order_relaxed);
+
     stream >> m_name;
     m_matID = StringID(m_name);
 
     const auto message = "Parsing Material '" + m_name + "'";
     SORT_PROFILE(message.c_str());
 
+    // Everything the shaders are built from is hashed. Names of the shader units are unique to each material, they are
+    // hashed by the order of the shader units instead so that identical materials have the same hash.
+    const auto hash_string = [&](const std::string& str) {
+        hashData(m_shaderHash, str.c_str(), str.size() + 1);
+    };
+    const auto hash_shader_name = [&](const TSL_ShaderData& shader_data, const std::string& name) {
+        const auto& sources = shader_data.m_sources;
+        const auto it = std::find_if(sources.begin(), sources.end(), [&](const ShaderSource& source) { return source.name == name; });
+        const auto index = it == sources.end() ? -1 : (int)(it - sources.begin());
+        hashData(m_shaderHash, &index, sizeof(index));
+        if (it == sources.end())
+            hash_string(name == "ShaderOutput_" + m_name ? "ShaderOutput_" : name);
+    };
+
     auto parse_shader_type = [&](TSL_ShaderData& shader_data, bool& is_shader_valid) {
         is_shader_valid = true;
 
+        std::vector<StreamedDefaultValue> default_values;
+
         unsigned shader_unit_cnt = 0;
         stream >> shader_unit_cnt;
 
@@ -184,29 +453,26 @@ void Material::Serialize(IStreamBase& stream){
             auto parameter_cnt = 0u;
             stream >> parameter_cnt;
             for (auto j = 0u; j < parameter_cnt; ++j) {
-                ShaderParamDefaultValue default_value;
+                StreamedDefaultValue dv;
+                auto& default_value = dv.default_value;
                 default_value.shader_unit_name = shader_source.name;
                 stream >> default_value.shader_unit_param_name;
-                int channel_num = 0;
-                stream >> channel_num;
+                stream >> dv.channel_num;
                 // currently only float and float3 are supported for now
-                if (channel_num == 1) {
-                    float x;
-                    stream >> x;
-                    default_value.default_value = x;
+                if (dv.channel_num == 1) {
+                    stream >> dv.value[0];
+                    default_value.default_value = dv.value[0];
                 }
-                else if (channel_num == 3) {
-                    float x, y, z;
-                    stream >> x >> y >> z;
-                    default_value.default_value = Tsl_Namespace::make_float3(x, y, z);
+                else if (dv.channel_num == 3) {
+                    stream >> dv.value[0] >> dv.value[1] >> dv.value[2];
+                    default_value.default_value = Tsl_Namespace::make_float3(dv.value[0], dv.value[1], dv.value[2]);
                 }
-                else if (channel_num == 4) { // this is fairly ugly, but it works, I will find time to refactor it later.
-                    std::string str;
-                    stream >> str;
-                    default_value.default_value = make_tsl_global_ref(str);
+                else if (dv.channel_num == 4) { // this is fairly ugly, but it works, I will find time to refactor it later.
+                    stream >> dv.str;
+                    default_value.default_value = make_tsl_global_ref(dv.str);
                 }
 
-                m_paramDefaultValues.push_back(default_value);
+                default_values.push_back(dv);
             }
 
             shader_data.m_sources.push_back(shader_source);
@@ -220,22 +486,55 @@ void Material::Serialize(IStreamBase& stream){
             stream >> connection.target_shader >> connection.target_property;
             shader_data.m_connections.push_back(connection);
         }
+
+        // the shader is specialized with the constant inputs of the material before it is hashed, materials that end up
+        // with the same shader share it.
+        fold_closure_branches(shader_data, default_values, "ShaderOutput_" + m_name);
+
+        for (const auto& source : shader_data.m_sources) {
+            hash_string(source.type);
+            for (const auto& dv : default_values) {
+                if (dv.default_value.shader_unit_name != source.name)
+                    continue;
+                hash_string(dv.default_value.shader_unit_param_name);
+                hashData(m_shaderHash, &dv.channel_num, sizeof(dv.channel_num));
+                if (dv.channel_num == 1 || dv.channel_num == 3)
+                    hashData(m_shaderHash, dv.value, sizeof(float) * dv.channel_num);
+                else if (dv.channel_num == 4)
+                    hash_string(dv.str);
+            }
+        }
+
+        for (const auto& connection : shader_data.m_connections) {
+            hash_shader_name(shader_data, connection.source_shader);
+            hash_string(connection.source_property);
+            hash_shader_name(shader_data, connection.target_shader);
+            hash_string(connection.target_property);
+        }
+
+        for (const auto& dv : default_values)
+            m_paramDefaultValues.push_back(dv.default_value);
     };
 
     StringID surface_shader_tag;
     stream >> surface_shader_tag;
+    hashData(m_shaderHash, &surface_shader_tag.m_sid, sizeof(surface_shader_tag.m_sid));
     if(surface_shader_tag == "Surface Shader"_sid)
         parse_shader_type(m_surface_shader_data, m_surface_shader_valid);
 
     // temporary for now
     StringID volume_shader_tag;
     stream >> volume_shader_tag;
+    hashData(m_shaderHash, &volume_shader_tag.m_sid, sizeof(volume_shader_tag.m_sid));
     if(volume_shader_tag == "Volume Shader"_sid)
         parse_shader_type(m_volume_shader_data, m_volume_shader_valid);
 
     stream >> m_hasTransparentNode;
     stream >> m_hasSSSNode;
 
+    // refined once the shaders are built
+    m_opacityClass = m_hasTransparentNode ? OpacityClass::Textured : OpacityClass::Opaque;
+
     stream >> m_volumeStep;
     stream >> m_volumeStepCnt;
 }
@@ -247,26 +546,82 @@ void Material::UpdateScatteringEvent( ScatteringEvent& se ) const {
         return;
     }
 
-    if( m_surface_shader_valid )
-        ExecuteSurfaceShader(m_surface_shader.get() , se );
+    if( m_surface_shader_valid ){
+        SORT_STATS(const auto cost = get_shading_cost(m_name));
+        se.ReserveScatteringStorage(m_scatteringStorageSize.load(std::memory_order_relaxed));
+        {
+            SORT_STATS(StatsScopedTimer timer(cost ? &cost->surfaceShaderTime : nullptr));
+            SORT_HW_COUNTERS("Shading");
+            ExecuteSurfaceShader(m_surface_shader.get() , se );
+        }
+        updateScatteringStorageSize(se.GetScatteringStorageUsed());
+        SORT_STATS(record_surface_shading(cost, se));
+    }
     else if( m_special_transparent )
         se.AddBxdf(SORT_MALLOC(Transparent)());
 }
 
+void Material::UpdateScatteringEvents( ScatteringEvent* const* ses, unsigned cnt ) const {
+    if (UNLIKELY(g_noMaterial || !m_surface_shader_valid)) {
+        MaterialBase::UpdateScatteringEvents(ses, cnt);
+        return;
+    }
+
+    const auto storage_size = m_scatteringStorageSize.load(std::memory_order_relaxed);
+    for (auto i = 0u; i < cnt; ++i)
+        ses[i]->ReserveScatteringStorage(storage_size);
+
+    SORT_STATS(const auto cost = get_shading_cost(m_name));
+    {
+        SORT_STATS(StatsScopedTimer timer(cost ? &cost->surfaceShaderTime : nullptr));
+        SORT_HW_COUNTERS("Shading");
+        ExecuteSurfaceShaders(m_surface_shader.get(), ses, cnt);
+    }
+
+    auto storage_used = 0u;
+    for (auto i = 0u; i < cnt; ++i) {
+        storage_used = std::max(storage_used, ses[i]->GetScatteringStorageUsed());
+        SORT_STATS(record_surface_shading(cost, *ses[i]));
+    }
+    updateScatteringStorageSize(storage_used);
+}
+
+void Material::updateScatteringStorageSize( unsigned used ) const {
+    // the storage starts at a cache line, it might as well take whole cache lines
+    used = ( used + SE_STORAGE_ALIGNMENT - 1 ) & ~( SE_STORAGE_ALIGNMENT - 1 );
+
+    auto size = m_scatteringStorageSize.load(std::memory_order_relaxed);
+    while (size < used && !m_scatteringStorageSize.compare_exchange_weak(size, used, std::memory_order_relaxed));
+}
+
 void Material::UpdateMediumStack( const MediumInteraction& mi , const SE_Interaction flag , MediumStack& ms ) const {
-    if (m_volume_shader_valid)
-        ExecuteVolumeShader(m_volume_shader.get(), mi, ms, flag, this);
+    if (!m_volume_shader_valid)
+        return;
+
+    SORT_STATS(const auto cost = get_shading_cost(m_name));
+    SORT_STATS(StatsScopedTimer timer(cost ? &cost->volumeShaderTime : nullptr));
+    SORT_STATS(cost ? ++cost->volumeShaderCnt : 0);
+    ExecuteVolumeShader(m_volume_shader.get(), mi, ms, flag, this);
 }
 
 void Material::EvaluateMediumSample(const MediumInteraction& mi, MediumSample& ms) const {
-    if (m_volume_shader_valid)
-        EvaluateVolumeSample(m_volume_shader.get(), mi, ms);
+    if (!m_volume_shader_valid)
+        return;
+
+    SORT_STATS(const auto cost = get_shading_cost(m_name));
+    SORT_STATS(StatsScopedTimer timer(cost ? &cost->volumeShaderTime : nullptr));
+    SORT_STATS(cost ? ++cost->volumeShaderCnt : 0);
+    EvaluateVolumeSample(m_volume_shader.get(), mi, ms);
 }
 
 void MaterialProxy::UpdateScatteringEvent(ScatteringEvent& se) const {
     return m_material.UpdateScatteringEvent(se);
 }
 
+void MaterialProxy::UpdateScatteringEvents(ScatteringEvent* const* ses, unsigned cnt) const {
+    return m_material.UpdateScatteringEvents(ses, cnt);
+}
+
 void MaterialProxy::UpdateMediumStack(const MediumInteraction& mi, const SE_Interaction flag, MediumStack& ms) const {
     return m_material.UpdateMediumStack(mi, flag, ms);
 }
@@ -289,6 +644,14 @@ bool MaterialProxy::HasTransparency() const {
     return m_material.HasTransparency();
 }
 
+OpacityClass MaterialProxy::GetOpacityClass() const {
+    return m_material.GetOpacityClass();
+}
+
+const AlphaMask* MaterialProxy::GetAlphaMask() const {
+    return m_material.GetAlphaMask();
+}
+
 bool MaterialProxy::HasSSS() const {
     return m_material.HasSSS();
 }
@@ -21,12 +21,13 @@
 #include <list>
 #include <vector>
 #include <string>
+#include <atomic>
+#include <mutex>
+#include <memory>
 #include "stream/stream.h"
+#include "core/hash.h"
 #include "tsl_system.h"
-
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-#include <atomic>
-#endif
+#include "alphamask.h"
 
 struct SurfaceInteraction;
 struct MediumInteraction;
@@ -49,6 +50,13 @@ struct ShaderSource {
     std::string type;
 };
 
+//! @brief  How the opacity of a material varies on its surface.
+enum class OpacityClass : unsigned char {
+    Opaque,     /**< Shadow rays are fully blocked, nothing needs to be evaluated. */
+    Constant,   /**< The same transparency everywhere, it is evaluated once when the material is built. */
+    Textured    /**< The transparency varies on the surface, the shader is executed at each hit. */
+};
+
 struct TSL_ShaderData {
     /**< Shader source code. */
     std::vector<ShaderSource>           m_sources;
@@ -67,6 +75,15 @@ public:
     //! @param      se              Scattering event to be returned.
     virtual void       UpdateScatteringEvent(ScatteringEvent& se) const = 0;
 
+    //! @brief      Parse scattering events of a batch of hits on this material.
+    //!
+    //! @param      ses             Scattering events to be returned.
+    //! @param      cnt             Number of scattering events.
+    virtual void       UpdateScatteringEvents(ScatteringEvent* const* ses, unsigned cnt) const {
+        for (auto i = 0u; i < cnt; ++i)
+            UpdateScatteringEvent(*ses[i]);
+    }
+
     //! @brief      Parse volume from the material shader.
     //!
     //! @param      mi              Interaction with the medium.
@@ -103,6 +120,16 @@ public:
     //! @return     Return true if there is transparency in the material.
     virtual bool       HasTransparency() const = 0;
 
+    //! @brief  Get how the opacity of the material varies on the surface.
+    //!
+    //! @return     The opacity class of the material.
+    virtual OpacityClass GetOpacityClass() const = 0;
+
+    //! @brief  Get the alpha mask baked from the transparency of the material.
+    //!
+    //! @return     The alpha mask, nullptr if the transparency of the material is not a cutout.
+    virtual const AlphaMask* GetAlphaMask() const = 0;
+
     //! @brief  Whether the material has sss
     //!
     //! @return     Return true if there is sss node in the material.
@@ -123,6 +150,16 @@ public:
     //! @return     Maximum steps to march during ray marching.
     virtual unsigned int GetVolumeStepCnt() const = 0;
 
+    //! @brief  Build the material the first time it is bound to a primitive, materials never bound stay as parsed.
+    //!
+    //! It is thread safe, others binding the material while it is being built wait for it.
+    void    BuildOnBinding();
+
+    //! @brief  Whether the material is bound to any primitive.
+    //!
+    //! @return     True if the material is bound, it is built then.
+    bool    IsBound() const;
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
     //! @brief  Whether the material has been built.
     //!
@@ -133,6 +170,10 @@ protected:
     /**< Whether the material has been built, even if it fails building, it is still considered built. */
     std::atomic<bool>   m_is_built = false;
 #endif
+
+private:
+    std::once_flag      m_bindOnce;             /**< The material is built only once, when it is bound the first time. */
+    std::atomic<bool>   m_bound = false;        /**< Whether the material is bound to any primitive. */
 };
 
 //! @brief  A thin layer of material definition.
@@ -152,6 +193,12 @@ public:
     //! @param      se              Scattering event to be returned.
     void        UpdateScatteringEvent( ScatteringEvent& se ) const override;
 
+    //! @brief      Parse scattering events of a batch of hits on this material, the shader is executed in batches.
+    //!
+    //! @param      ses             Scattering events to be returned.
+    //! @param      cnt             Number of scattering events.
+    void        UpdateScatteringEvents( ScatteringEvent* const* ses, unsigned cnt ) const override;
+
     //! @brief      Parse volume from the material shader.
     //!
     //! @param      mi              Interaction with the medium.
@@ -173,10 +220,12 @@ public:
     //! @return                     The transparency at the intersection.
     Spectrum    EvaluateTransparency( const SurfaceInteraction& intersection ) const override{
         // this should happen most of the time in the absence of transparent node.
-        if (!m_hasTransparentNode)
+        if (LIKELY(m_opacityClass == OpacityClass::Opaque))
             return 0.0f;
-        
-        return m_special_transparent ? 1.0f : (::EvaluateTransparency(m_surface_shader.get(), intersection));
+        if (m_opacityClass == OpacityClass::Constant)
+            return m_constantTransparency;
+
+        return ::EvaluateTransparency(m_surface_shader.get(), intersection);
     }
 
     //! @brief  Serialization interface. Loading data from stream.
@@ -202,7 +251,21 @@ public:
     //!
     //! @return Return true if there is transparency in the material.
     bool        HasTransparency() const override {
-        return m_hasTransparentNode;
+        return m_opacityClass != OpacityClass::Opaque;
+    }
+
+    //! @brief  Get how the opacity of the material varies on the surface.
+    //!
+    //! @return The opacity class of the material.
+    OpacityClass GetOpacityClass() const override {
+        return m_opacityClass;
+    }
+
+    //! @brief  Get the alpha mask baked from the transparency of the material.
+    //!
+    //! @return The alpha mask, nullptr if the transparency of the material is not a cutout.
+    const AlphaMask* GetAlphaMask() const override {
+        return m_alphaMask.get();
     }
     
     //! @brief  Whether the material has sss
@@ -262,9 +325,26 @@ private:
     /**< Shader unit default values. */
     std::vector<ShaderParamDefaultValue>        m_paramDefaultValues;
 
+    /**< Hash of the shader units, their wiring and default values, materials with the same hash share compiled shaders. */
+    unsigned long long              m_shaderHash = HASH_INITIAL_VALUE;
+
     bool                            m_hasTransparentNode = false;
     bool                            m_hasSSSNode = false;
 
+    /**< Opacity class of the surface, transparency of constant opacity materials is folded when they are built. */
+    OpacityClass                    m_opacityClass = OpacityClass::Opaque;
+    Spectrum                        m_constantTransparency = 0.0f;
+    /**< Cutout of textured opacity, it is evaluated during traversal instead of the shader. */
+    std::unique_ptr<AlphaMask>      m_alphaMask;
+
+    /**< Most memory the bxdfs of the material have taken in a scattering event, it is reserved in the following ones. */
+    mutable std::atomic<unsigned>   m_scatteringStorageSize = { 0 };
+
+    //! @brief  Grow the storage reserved for scattering events of the material.
+    //!
+    //! @param  used    Memory taken by the bxdfs of a scattering event in bytes.
+    void        updateScatteringStorageSize(unsigned used) const;
+
     float                           m_volumeStep = 0.1f;
     unsigned int                    m_volumeStepCnt = 1024;
 };
@@ -287,6 +367,12 @@ public:
     //! @param      se              Scattering event to be returned.
     void       UpdateScatteringEvent(ScatteringEvent& se) const override;
 
+    //! @brief      Parse scattering events of a batch of hits on this material.
+    //!
+    //! @param      ses             Scattering events to be returned.
+    //! @param      cnt             Number of scattering events.
+    void       UpdateScatteringEvents(ScatteringEvent* const* ses, unsigned cnt) const override;
+
     //! @brief      Parse volume from the material shader.
     //! @param      mi              Interaction with the medium.
     //! @param      flag            A flag indicates whether to add or remove the medium.
@@ -327,6 +413,16 @@ public:
     //! @return Return true if there is transparency in the material.
     bool       HasTransparency() const override;
 
+    //! @brief  Get how the opacity of the material varies on the surface.
+    //!
+    //! @return The opacity class of the material.
+    OpacityClass GetOpacityClass() const override;
+
+    //! @brief  Get the alpha mask baked from the transparency of the material.
+    //!
+    //! @return The alpha mask, nullptr if the transparency of the material is not a cutout.
+    const AlphaMask* GetAlphaMask() const override;
+
     //! @brief  Whether the material has sss
     //!
     //! @return Return true if there is sss node in the material.
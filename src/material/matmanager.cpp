@@ -15,6 +15,11 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <tuple>
+#include <vector>
 #include "matmanager.h"
 #include "material/material.h"
 #include "stream/stream.h"
@@ -22,112 +27,252 @@
 #include "core/globalconfig.h"
 #include "core/log.h"
 #include "core/timer.h"
+#include "core/hash.h"
+#include "core/assetresolver.h"
+#include "core/stats.h"
 #include "scatteringevent/bsdf/merl.h"
 #include "scatteringevent/bsdf/fourierbxdf.h"
 #include "texture/imagetexture2d.h"
+#include "core/scene.h"
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-#include <future>
-#endif
-
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-#include "task/task.h"
-#endif
+SORT_STATS_DEFINE_COUNTER(sSharedResources)
+SORT_STATS_DEFINE_COUNTER(sSharedShaders)
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-//! @brief  A task for compiling materials in a seperate thread
-class CompileMaterial_Task : public Task {
-public:
-    //! @brief Constructor
-    //!
-    //! @param priority     New priority of the task.
-    CompileMaterial_Task(Material* material, const char* name, unsigned int priority,
-        const Task::Task_Container& dependencies) :
-        Task(name, priority, dependencies), material(material) {}
-
-    //! @brief  Execute the task
-    void        Execute() override {
-        material->BuildMaterial();
-    }
-
-private:
-    Material* material;
-};
-#endif
+SORT_STATS_COUNTER("Statistics", "Resources Shared by Content", sSharedResources);
+SORT_STATS_COUNTER("Statistics", "Shaders Shared by Materials", sSharedShaders);
 
 namespace {
     struct ShaderResourceBinding {
         std::string resource_handle_name;
         std::string shader_resource_name;
     };
+
+    // A shader unit template streamed from the scene.
+    struct ShaderUnitSource {
+        std::string                                         type;
+        std::string                                         source_code;
+        std::vector<ShaderResourceBinding>                  resources;
+    };
+
+    // A shader group template streamed from the scene, the templates it is made of are compiled before it.
+    struct ShaderGroupSource {
+        std::string                                         type;
+        TSL_ShaderData                                      shader_data;
+        std::vector<ShaderParamDefaultValue>                default_values;
+        std::string                                         root_shader_name;
+        std::vector<std::string>                            exposed_out_args;
+        std::string                                         input_shader_name;
+        std::vector<std::string>                            exposed_in_args;
+    };
+}
+
+// A shader unit or shader group template streamed from the scene, it is only compiled the first time a material bound to
+// a primitive, or another template, needs it.
+struct MatManager::ShaderTemplateSource {
+    bool                                                is_group = false;
+    ShaderUnitSource                                    unit;
+    ShaderGroupSource                                   group;
+    std::once_flag                                      compiled_once;
+    std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>  compiled;
+};
+
+// load a resource, like a texture, and record how long it takes in the scene loading breakdown
+static bool load_resource(Resource* resource, std::string filename) {
+    SORT_STATS(Timer timer);
+    const auto ret = resource->LoadResource(filename);
+    SORT_STATS(sSceneLoadReport.Add("Resources", filename, timer.GetElapsedTimeInUs(),
+                                    (StatsInt)std::ifstream(filename, std::ios::binary | std::ios::ate).tellg()));
+    return ret;
 }
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-static bool async_load_resource(Resource* resource, std::string filename) {
-    return resource->LoadResource(filename);
+// hash of the type and the content of a resource file, reading a file is way cheaper than decoding it
+static bool hash_resource(const std::string& filename, StringID type, unsigned long long& hash, size_t& size) {
+    hash = HASH_INITIAL_VALUE;
+    hashData(hash, &type.m_sid, sizeof(type.m_sid));
+    return hashFile(hash, filename, &size);
 }
+
+// Run independent pieces of shader compilation, they are children of the current task so that each thread compiles
+// with its own shading context. This won't return until all of them are done.
+static void compile_in_parallel(const char* name, unsigned cnt, const std::function<void(unsigned)>& job) {
+#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
+    if (IS_PTR_VALID(GetCurrentTask()) && cnt > 1) {
+        for (auto i = 0u; i < cnt; ++i)
+            SPAWN_TASK<Function_Task>(name, DEFAULT_TASK_PRIORITY, {}, [&job, i]() { job(i); });
+        WAIT_FOR_CHILDREN();
+        return;
+    }
 #endif
+    for (auto i = 0u; i < cnt; ++i)
+        job(i);
+}
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-static void async_build_material(MaterialBase* material) {
-    material->BuildMaterial();
+// compile a shader unit template
+static std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> compile_shader_unit(const ShaderUnitSource& unit) {
+    auto shading_context = GetShadingContext();
+
+    // allocate the shader unit template
+    const auto shader_unit_template = shading_context->begin_shader_unit_template(unit.type);
+    if (!shader_unit_template)
+        return nullptr;
+
+    // register tsl global
+    TslGlobal::shader_unit_register(shader_unit_template.get());
+
+    // bind shader resources
+    for (const auto& sr : unit.resources) {
+        auto resource = MatManager::GetSingleton().GetResource(sr.shader_resource_name);
+        shader_unit_template->register_shader_resource(sr.resource_handle_name, (const Tsl_Namespace::ShaderResourceHandle*)resource);
+    }
+
+    // compile the shader unit
+    SORT_STATS(Timer timer);
+    const auto ret = shader_unit_template->compile_shader_source(unit.source_code.c_str());
+    SORT_STATS(sSceneLoadReport.Add("Shaders", unit.type, timer.GetElapsedTimeInUs(), (StatsInt)unit.source_code.size()));
+
+    // indicate the end of shader unit compilation
+    shading_context->end_shader_unit_template(shader_unit_template.get());
+
+    // keep it if it compiles the shader successful
+    return ret ? shader_unit_template : nullptr;
+}
+
+// compile a shader group template, the templates it is made of are compiled first if they aren't yet
+static std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> compile_shader_group(const ShaderGroupSource& group) {
+    std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>> shader_units;
+    for (const auto& shader : group.shader_data.m_sources)
+        shader_units[shader.name] = MatManager::GetSingleton().GetShaderUnitTemplate(shader.type);
+
+    auto context = GetShadingContext();
+
+    // begin compiling shader group
+    auto shader_group = context->begin_shader_group_template(group.type);
+    if (!shader_group)
+        return nullptr;
+
+    // register tsl global
+    TslGlobal::shader_unit_register(shader_group.get());
+
+    // expose arguments in output node
+    for (const auto& arg_name : group.exposed_out_args)
+        shader_group->expose_shader_argument(group.root_shader_name, arg_name);
+
+    // expose arguments in input node
+    for (const auto& arg_name : group.exposed_in_args)
+        shader_group->expose_shader_argument(group.input_shader_name, arg_name, false);
+
+    for (auto su : shader_units) {
+        const auto is_root = (su.first == group.root_shader_name);
+        const auto ret = shader_group->add_shader_unit(su.first, su.second, is_root);
+        if (!ret)
+            continue;
+    }
+
+    // connect the shader units
+    for (auto connection : group.shader_data.m_connections)
+        shader_group->connect_shader_units(connection.source_shader, connection.source_property, connection.target_shader, connection.target_property);
+
+    // update default values
+    for (const auto& dv : group.default_values)
+        shader_group->init_shader_input(dv.shader_unit_name, dv.shader_unit_param_name, dv.default_value);
+
+    // end building the shader group
+    auto ret = context->end_shader_group_template(shader_group.get());
+
+    // keep it if it compiles the shader successful
+    if (Tsl_Namespace::TSL_Resolving_Status::TSL_Resolving_Succeed == ret)
+        return shader_group;
+    return nullptr;
 }
-#endif
 
 // parse material file and add the materials into the manager
 unsigned MatManager::ParseMatFile( IStreamBase& stream ){
     SORT_PROFILE("Parsing Materials");
 
-    const auto current_task = GetCurrentTask();
-    const auto dependencies = current_task->GetDependencies();
-
     auto resource_cnt = 0u;
     stream >> resource_cnt;
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-    std::vector<std::future<bool>>      async_resource_reading;
-#endif
+    std::vector<std::pair<std::string, StringID>>   resources(resource_cnt);
+    std::vector<std::string>                        resource_files(resource_cnt);
+    for (auto i = 0u; i < resource_cnt; ++i) {
+        stream >> resources[i].first >> resources[i].second;
+        resource_files[i] = resources[i].first;
+    }
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-    std::vector<std::future<void>>      async_material_building;
-#endif
+    // remote resources, like textures on a http server, are all fetched in parallel to the local cache right away
+    AssetResolver::GetSingleton().Prefetch(resource_files);
 
-    for (auto i = 0u; i < resource_cnt; ++i) {
-        std::string resource_file;
-        StringID resource_type;
-        stream >> resource_file >> resource_type;
+    // resources to be loaded and the sizes of their files
+    std::vector<std::tuple<Resource*, std::string, size_t>>     resources_to_load;
+
+    for (const auto& resource : resources) {
+        const auto& resource_file = resource.first;
+        const auto& resource_type = resource.second;
 
         Resource* ptr_resource = nullptr;
 
         if (0 == m_resources.count(resource_file)) {
+            // resources are still named after their paths in the scene, only the files loaded are the cached ones
+            const auto local_file = AssetResolver::GetSingleton().Resolve(resource_file);
+
+            // files with the same content, like copies of a texture in different folders, are only loaded once
+            unsigned long long content_hash = 0;
+            size_t file_size = 0;
+            const auto hashed = hash_resource(local_file, resource_type, content_hash, file_size);
+            if (hashed && m_resourcesByContent.count(content_hash)) {
+                m_resources[resource_file] = m_resourcesByContent[content_hash];
+                SORT_STATS(++sSharedResources);
+                continue;
+            }
+
             if (resource_type == SID("MerlBRDFMeasuredData")) {
-                m_resources[resource_file] = std::make_unique<MerlData>();
+                m_resources[resource_file] = std::make_shared<MerlData>(g_merlHalfPrecision);
                 ptr_resource = m_resources[resource_file].get();
             }
             else if (resource_type == SID("FourierBRDFMeasuredData")) {
-                m_resources[resource_file] = std::make_unique<FourierBxdfData>();
+                m_resources[resource_file] = std::make_shared<FourierBxdfData>();
                 ptr_resource = m_resources[resource_file].get();
             }
             else if (resource_type == SID("Texture2D")) {
-                m_resources[resource_file] = std::make_unique<ImageTexture2D>();
+                m_resources[resource_file] = std::make_shared<ImageTexture2D>();
                 ptr_resource = m_resources[resource_file].get();
             }
 
+            if (ptr_resource && hashed) {
+                m_resourcesByContent[content_hash] = m_resources[resource_file];
+                if (g_sharedResourcesEnabled)
+                    ptr_resource->ShareAcrossProcesses(content_hash);
+            }
+
             if (!ptr_resource) {
                 sAssertMsg(false, MATERIAL, "Resource type not supported!");
             }
             else {
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-                async_resource_reading.push_back(std::async(std::launch::async, async_load_resource, ptr_resource, resource_file));
-#else
-                ptr_resource->LoadResource(resource_file);
-#endif
+                resources_to_load.push_back(std::make_tuple(ptr_resource, local_file, file_size));
             }
         }
     }
 
+    // Resources are loaded in their own tasks instead of children of the current one, loading the rest of the scene and
+    // building spatial accelerators don't wait for them, only rendering does. The largest files are the long poles, they
+    // are loaded first.
+    std::sort(resources_to_load.begin(), resources_to_load.end(), [](const auto& r0, const auto& r1) {
+        return std::get<2>(r0) > std::get<2>(r1);
+    });
+    for (auto i = 0u; i < resources_to_load.size(); ++i) {
+        const auto resource = std::get<0>(resources_to_load[i]);
+        const auto filename = std::get<1>(resources_to_load[i]);
+        m_pendingResources.fetch_add(1, std::memory_order_relaxed);
+        SCHEDULE_TASK<Function_Task>("Loading Resource", DEFAULT_TASK_PRIORITY + (unsigned)(resources_to_load.size() - i), {}, [this, resource, filename]() {
+            load_resource(resource, filename);
+            m_pendingResources.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
     const bool noMaterialSupport = g_noMaterial;
 
+    // Nothing is compiled while streaming, shader templates and materials stay as they are streamed until a primitive is
+    // bound to a material needing them. Blender exports all materials in the file, not only the ones used by the scene.
     StringID material_type;
     while (true) {
         stream >> material_type;
@@ -135,60 +280,34 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
         if (material_type == SID("End of Material"))
             break;
         else if (material_type == SID("ShaderUnitTemplate")) {
+            auto source = std::make_shared<ShaderTemplateSource>();
+            auto& unit = source->unit;
+
             // shader type, maybe I should use string id here.
-            std::string shader_node_type;
-            stream >> shader_node_type;
+            stream >> unit.type;
 
             // stream the shader source code
-            std::string source_code;
-            stream >> source_code;
-
-            /**< Shader reousrce binding. */
-            std::vector<ShaderResourceBinding>  m_shader_resources_binding;
+            stream >> unit.source_code;
 
             unsigned int shader_resources = 0;
             stream >> shader_resources;
             for (auto i = 0u; i < shader_resources; ++i) {
                 ShaderResourceBinding srb;
                 stream >> srb.resource_handle_name >> srb.shader_resource_name;
-                m_shader_resources_binding.push_back(srb);
-            }
-
-            // compile the shader unit template
-            auto shading_context = GetShadingContext();
-
-            // allocate the shader unit template
-            const auto shader_unit_template = shading_context->begin_shader_unit_template(shader_node_type);
-            
-            // register tsl global
-            TslGlobal::shader_unit_register(shader_unit_template.get());
-
-            // bind shader resources
-            for (auto sr : m_shader_resources_binding) {
-                auto resource = MatManager::GetSingleton().GetResource(sr.shader_resource_name);
-                shader_unit_template->register_shader_resource(sr.resource_handle_name, (const Tsl_Namespace::ShaderResourceHandle*)resource);
+                unit.resources.push_back(srb);
             }
 
-            // compile the shader unit
-            const auto ret = shader_unit_template->compile_shader_source(source_code.c_str());
-
-            // indicate the end of shader unit compilation
-            shading_context->end_shader_unit_template(shader_unit_template.get());
-
-            // push it if it compiles the shader successful
-            if( ret )
-                m_shader_units[shader_node_type] = shader_unit_template;
+            m_shaderTemplates[unit.type] = std::move(source);
         }
         else if (material_type == SID("ShaderGroupTemplate")) {
-            // The following logic is very similar with 
-            std::string shader_template_type;
-            stream >> shader_template_type;
+            auto source = std::make_shared<ShaderTemplateSource>();
+            source->is_group = true;
+            auto& group = source->group;
+            stream >> group.type;
 
             unsigned shader_unit_cnt = 0;
             stream >> shader_unit_cnt;
 
-            TSL_ShaderData shader_data;
-
             for (auto i = 0u; i < shader_unit_cnt; ++i) {
                 // parse surface shader
                 ShaderSource shader_source;
@@ -219,10 +338,10 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
                         default_value.default_value = Tsl_Namespace::make_tsl_global_ref(str);
                     }
 
-                    m_paramDefaultValues.push_back(default_value);
+                    group.default_values.push_back(default_value);
                 }
 
-                shader_data.m_sources.push_back(shader_source);
+                group.shader_data.m_sources.push_back(shader_source);
             }
 
             auto connection_cnt = 0u;
@@ -231,73 +350,28 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
                 ShaderConnection connection;
                 stream >> connection.source_shader >> connection.source_property;
                 stream >> connection.target_shader >> connection.target_property;
-                shader_data.m_connections.push_back(connection);
+                group.shader_data.m_connections.push_back(connection);
             }
 
-            // compiling the shader group template
-            std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>> shader_units;
-            for (const auto& shader : shader_data.m_sources)
-                shader_units[shader.name] = MatManager::GetSingleton().GetShaderUnitTemplate(shader.type);
-
-            auto context = GetShadingContext();
-
-            // begin compiling shader group
-            auto shader_group = context->begin_shader_group_template(shader_template_type);
-            if (!shader_group)
-                continue;
-
-            // register tsl global
-            TslGlobal::shader_unit_register(shader_group.get());
-
-            // expose arguments in output node
-            std::string root_shader_name;
-            stream >> root_shader_name;
+            // arguments exposed in output node
+            stream >> group.root_shader_name;
             unsigned int exposed_out_arg_cnt = 0;
             stream >> exposed_out_arg_cnt;
-            for (auto i = 0u; i < exposed_out_arg_cnt; ++i) {
-                std::string arg_name;
+            group.exposed_out_args.resize(exposed_out_arg_cnt);
+            for (auto& arg_name : group.exposed_out_args)
                 stream >> arg_name;
 
-                // expose the shader interface
-                shader_group->expose_shader_argument(root_shader_name, arg_name);
-            }
-
-            std::string shader_group_input_name;
-            stream >> shader_group_input_name;
-
-            if (!shader_group_input_name.empty()) {
+            // arguments exposed in input node
+            stream >> group.input_shader_name;
+            if (!group.input_shader_name.empty()) {
                 unsigned int exposed_in_arg_cnt = 0;
                 stream >> exposed_in_arg_cnt;
-                for (auto i = 0u; i < exposed_in_arg_cnt; ++i) {
-                    std::string arg_name;
+                group.exposed_in_args.resize(exposed_in_arg_cnt);
+                for (auto& arg_name : group.exposed_in_args)
                     stream >> arg_name;
-
-                    // expose the shader interface
-                    shader_group->expose_shader_argument(shader_group_input_name, arg_name, false);
-                }
-            }
-
-            for (auto su : shader_units) {
-                const auto is_root = (su.first == root_shader_name);
-                const auto ret = shader_group->add_shader_unit(su.first, su.second, is_root);
-                if (!ret)
-                    continue;
             }
 
-            // connect the shader units
-            for (auto connection : shader_data.m_connections)
-                shader_group->connect_shader_units(connection.source_shader, connection.source_property, connection.target_shader, connection.target_property);
-
-            // update default values
-            for (const auto& dv : m_paramDefaultValues)
-                shader_group->init_shader_input(dv.shader_unit_name, dv.shader_unit_param_name, dv.default_value);
-
-            // end building the shader group
-            auto ret = context->end_shader_group_template(shader_group.get());
-
-            // push it if it compiles the shader successful
-            if (Tsl_Namespace::TSL_Resolving_Status::TSL_Resolving_Succeed == ret)
-                m_shader_units[shader_template_type] = shader_group;
+            m_shaderTemplates[group.type] = std::move(source);
         }
         else if (material_type == SID("Material")) {
             // allocate a new material
@@ -306,42 +380,71 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
             // serialize the material
             mat->Serialize(stream);
 
-            if (LIKELY(!noMaterialSupport)) {
-         
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-                async_material_building.push_back(std::async(std::launch::async, async_build_material, mat.get()));
-#elif defined(ENABLE_MULTI_THREAD_SHADER_COMPILATION)
-                // build the material asynchronously
-                SCHEDULE_TASK<CompileMaterial_Task>("Compiling Material", DEFAULT_TASK_PRIORITY, {}, mat.get());
-#else
-                // build the material
-                mat->BuildMaterial();
-#endif
-
-                // push the compiled material in the pool
+            // push the material in the pool, it is built once it is bound to a primitive
+            if (LIKELY(!noMaterialSupport))
                 m_matPool.push_back(std::move(mat));
-            }
         }
         else {
             sAssertMsg(false, MATERIAL, "Serialization is broken.");
         }
     }
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-    std::for_each(async_resource_reading.begin(), async_resource_reading.end(), [](std::future<bool>& promise) { promise.wait(); });
-#endif
+    return (unsigned int)m_matPool.size();
+}
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-    std::for_each(async_material_building.begin(), async_material_building.end(), [](std::future<void>& promise) { promise.wait(); });
-#endif
+void MatManager::BindMaterials(const std::vector<int>& matIds) {
+    // only materials bound for the first time are built, the others are built already or being built by someone else
+    std::vector<MaterialBase*> materials;
+    for (const auto id : matIds) {
+        if (id < 0 || id >= (int)m_matPool.size())
+            continue;
+        const auto material = m_matPool[id].get();
+        if (!material->IsBound() && std::find(materials.begin(), materials.end(), material) == materials.end())
+            materials.push_back(material);
+    }
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-    // this is only a temporary solution before I have job system that is more robust and flexible to support spawning jobs inside other jobs.
-    // wait for all materials to be built before moving forward
-    MatManager::GetSingleton().WaitForMaterialBuilding();
-#endif
+    // Shader templates are compiled by the first material needing them, others needing the same ones wait for it.
+    compile_in_parallel("Compiling Material", (unsigned)materials.size(), [&](unsigned i) {
+        materials[i]->BuildOnBinding();
+    });
+}
 
-    return (unsigned int)m_matPool.size();
+bool MatManager::UpdateMaterial( IStreamBase& stream ){
+    std::string name;
+    stream >> name;
+
+    const auto id = StringID( name );
+    const auto it = std::find_if( m_matPool.begin() , m_matPool.end() , [&]( const std::unique_ptr<MaterialBase>& mat ){
+        return mat->GetUniqueID() == id;
+    } );
+    const auto mat = it == m_matPool.end() ? nullptr : dynamic_cast<Material*>( it->get() );
+    if( IS_PTR_INVALID( mat ) ){
+        slog( WARNING , MATERIAL , "Material '%s' can't be updated since it is not loaded." , name.c_str() );
+
+        // the material still needs to be streamed so that the following data is streamed correctly
+        Material discarded;
+        discarded.Serialize( stream );
+        return false;
+    }
+
+    // Primitives with SSS or volumes are grouped while loading the scene, the groups stay the same.
+    const auto has_sss = mat->HasSSS();
+    const auto has_volume = mat->HasVolumeAttached();
+    // Opaque primitives are also tagged while loading the scene so that shadow rays skip evaluating them.
+    const auto was_opaque = !mat->HasTransparency();
+    mat->Serialize( stream );
+    if( LIKELY( !g_noMaterial ) && mat->IsBound() )
+        mat->BuildMaterial();
+
+    if( has_sss != mat->HasSSS() || has_volume != mat->HasVolumeAttached() )
+        slog( WARNING , MATERIAL , "SSS or volume of material '%s' doesn't fully take effect until the scene is loaded again." , name.c_str() );
+    if( was_opaque && mat->HasTransparency() )
+        slog( WARNING , MATERIAL , "Transparent shadow of material '%s' doesn't fully take effect until the scene is loaded again." , name.c_str() );
+    return true;
+}
+
+void MatManager::WaitForResources() const {
+    WAIT_UNTIL([this]() { return 0 == m_pendingResources.load(std::memory_order_acquire); });
 }
 
 const Resource* MatManager::GetResource(const std::string& name) const {
@@ -352,23 +455,60 @@ const Resource* MatManager::GetResource(const std::string& name) const {
 }
 
 const MaterialBase* MatManager::CreateMaterialProxy(const MaterialBase& material) {
-    m_matPool.push_back(std::move(std::make_unique<MaterialProxy>(material)));
-    return m_matPool.back().get();
+    std::lock_guard<std::mutex> lock(m_proxyMutex);
+    m_proxyPool.push_back(std::make_unique<MaterialProxy>(material));
+    return m_proxyPool.back().get();
 }
 
 std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> MatManager::GetShaderUnitTemplate(const std::string& name_id) const {
-    auto it = m_shader_units.find(name_id);
-    if (it == m_shader_units.end())
+    auto it = m_shaderTemplates.find(name_id);
+    if (it == m_shaderTemplates.end())
         return nullptr;
-    return it->second;
-}
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-void MatManager::WaitForMaterialBuilding() const {
-    std::for_each(m_matPool.begin(), m_matPool.end(), [](const std::unique_ptr<MaterialBase>& mat) {
-        while (!mat->IsMaterialBuilt()) {
-            _mm_pause();
-        }
+    auto& source = *it->second;
+    std::call_once(source.compiled_once, [&source]() {
+        source.compiled = source.is_group ? compile_shader_group(source.group) : compile_shader_unit(source.unit);
     });
+    return source.compiled;
+}
+
+std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> MatManager::GetRootShaderUnitTemplate(const std::string& name, const char* source) {
+    std::lock_guard<std::mutex> lock(m_shaderCacheMutex);
+    auto it = m_rootShaderUnits.find(name);
+    if (it != m_rootShaderUnits.end())
+        return it->second;
+
+    auto context = GetShadingContext();
+    auto shader_unit_template = context->begin_shader_unit_template(name);
+    if (!shader_unit_template)
+        return nullptr;
+
+    // register tsl global
+    TslGlobal::shader_unit_register(shader_unit_template.get());
+
+    // compile the root shader
+    if (!shader_unit_template->compile_shader_source(source))
+        return nullptr;
+
+    // indicate the shader unit is done
+    context->end_shader_unit_template(shader_unit_template.get());
+
+    m_rootShaderUnits[name] = shader_unit_template;
+    return shader_unit_template;
+}
+
+std::shared_ptr<Tsl_Namespace::ShaderInstance> MatManager::GetCachedShaderInstance(unsigned long long key) {
+    std::lock_guard<std::mutex> lock(m_shaderCacheMutex);
+    auto it = m_shaderInstances.find(key);
+    if (it == m_shaderInstances.end())
+        return nullptr;
+    SORT_STATS(++sSharedShaders);
+    return it->second.instance;
+}
+
+void MatManager::CacheShaderInstance(unsigned long long key, std::shared_ptr<Tsl_Namespace::ShaderInstance> instance,
+                                     std::vector<std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>> templates) {
+    // identical materials built at the same time compile the shader more than once, the first one is kept
+    std::lock_guard<std::mutex> lock(m_shaderCacheMutex);
+    m_shaderInstances.emplace(key, CachedShaderInstance{ std::move(instance), std::move(templates) });
 }
-#endif
\ No newline at end of file
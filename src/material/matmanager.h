@@ -20,6 +20,8 @@
 #include "core/define.h"
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <unordered_map>
 #include "core/singleton.h"
 #include "material/material.h"
@@ -47,6 +49,8 @@ public:
 
     //! @brief  Create a material proxy given a material.
     //!
+    //! It is thread safe since meshes are loaded in parallel.
+    //!
     //! @param  material    The material to be proxied.
     //! @return             A material proxy that refers the to provided material.
     const MaterialBase* CreateMaterialProxy(const MaterialBase& material);
@@ -61,6 +65,32 @@ public:
     // result           : the number of materials in the file
     unsigned    ParseMatFile( class IStreamBase& stream );
 
+    //! @brief  Build the materials bound to primitives, along with the shader templates they need.
+    //!
+    //! Nothing is compiled while parsing the material file since the file could have many more materials than the scene
+    //! uses. Materials are built the first time a primitive is bound to them, binding them again is free. It needs to
+    //! be called before the primitives are created since they need to know whether the material is transparent.
+    //!
+    //! @param  matIds      Indices of the materials bound, invalid and duplicated ones are skipped.
+    void        BindMaterials( const std::vector<int>& matIds );
+
+    //! @brief  Update a loaded material with new parameters, like in interactive rendering.
+    //!
+    //! The stream has the name of the material, followed by the material in the same layout as the material file. The
+    //! material is updated in place so that primitives and proxies referring to it see the change, only its own shader
+    //! group is compiled again. Shader units and resources are not streamed, they need to be loaded already.
+    //!
+    //! @param  stream      The streaming source where the material is loaded from.
+    //! @return             Whether the material is updated, it fails if there is no material with the name.
+    bool        UpdateMaterial( class IStreamBase& stream );
+
+    //! @brief  Wait for all resources to be loaded.
+    //!
+    //! Resources are loaded in their own tasks, which block neither loading the rest of the scene nor building spatial
+    //! accelerators. Anything touching them, like rendering, needs to wait for them first. The current thread keeps
+    //! executing other tasks, including the loading ones, while waiting.
+    void        WaitForResources() const;
+
     //! @brief  Get resource data based on index.
     //!
     //! @param  name        Name of the resource.
@@ -73,20 +103,57 @@ public:
     //! @return             The shader unit template returned, nullptr if it doesn't exist.
     std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> GetShaderUnitTemplate(const std::string& name) const;
 
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
-    //! @brief  Wait for all materials to be built before moving forward
-    void WaitForMaterialBuilding() const;
-#endif
-
-private:
-    std::vector<std::unique_ptr<MaterialBase>>       m_matPool;         /**< Material pool holding all materials. */
+    //! @brief  Get the shader unit template of the root shader of materials, it is compiled the first time it is asked for.
+    //!
+    //! The root shaders of all materials are the same, there is no need to compile it for each of them. It is thread safe
+    //! since materials are built in parallel.
+    //!
+    //! @param  name        The name of the template.
+    //! @param  source      The source code of the root shader.
+    //! @return             The shader unit template, nullptr if it doesn't compile.
+    std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> GetRootShaderUnitTemplate(const std::string& name, const char* source);
 
-    std::unordered_map<std::string, std::unique_ptr<Resource>>  m_resources;       /**< Resources used during BXDF evaluation. */
+    //! @brief  Get the shader compiled for another material built from exactly the same shader group before.
+    //!
+    //! @param  key         The hash of the shader units, their wiring and default values of the shader group.
+    //! @return             The compiled shader, nullptr if nothing is compiled with the key yet.
+    std::shared_ptr<Tsl_Namespace::ShaderInstance> GetCachedShaderInstance(unsigned long long key);
 
-    std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>>     m_shader_units;
+    //! @brief  Keep a compiled shader so that materials built from the same shader group share it.
+    //!
+    //! @param  key         The hash of the shader units, their wiring and default values of the shader group.
+    //! @param  instance    The compiled shader.
+    //! @param  templates   The shader unit templates the shader is built from, they are kept alive with the shader.
+    void        CacheShaderInstance(unsigned long long key, std::shared_ptr<Tsl_Namespace::ShaderInstance> instance,
+                                    std::vector<std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>> templates);
 
-    /**< Shader unit default values. */
-    std::vector<ShaderParamDefaultValue>        m_paramDefaultValues;
+private:
+    std::vector<std::unique_ptr<MaterialBase>>       m_matPool;         /**< Material pool holding all materials. */
+    std::vector<std::unique_ptr<MaterialBase>>       m_proxyPool;       /**< Material proxies, they are never looked up by index. */
+    std::mutex                                       m_proxyMutex;      /**< Entities creating material proxies could be loaded in parallel. */
+
+    std::unordered_map<std::string, std::shared_ptr<Resource>>  m_resources;       /**< Resources used during BXDF evaluation. */
+
+    /**< Resources keyed by their type and the content of their files, files with identical content share one resource. */
+    std::unordered_map<unsigned long long, std::shared_ptr<Resource>>  m_resourcesByContent;
+    std::atomic<unsigned int>                                   m_pendingResources = { 0 };    /**< Number of resources not loaded yet. */
+
+    /**< Shader unit and group templates streamed from the scene, they are compiled the first time they are needed. */
+    struct ShaderTemplateSource;
+    std::unordered_map<std::string, std::shared_ptr<ShaderTemplateSource>>                  m_shaderTemplates;
+
+    //! @brief  A compiled shader shared by materials, along with the shader unit templates it is built from.
+    struct CachedShaderInstance {
+        std::shared_ptr<Tsl_Namespace::ShaderInstance>                      instance;
+        std::vector<std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>>     templates;
+    };
+
+    /**< Root shaders of materials, keyed by their names. */
+    std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>>     m_rootShaderUnits;
+    /**< Compiled shaders keyed by the hash of the shader groups they are built from. */
+    std::unordered_map<unsigned long long, CachedShaderInstance>                            m_shaderInstances;
+    /**< Materials are built in parallel, the shaders shared by them need to be protected. */
+    std::mutex                                                                              m_shaderCacheMutex;
 
     friend class Singleton<MatManager>;
 };
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <vector>
+#include <mutex>
 #include <tsl_system.h>
 #include "core/profile.h"
 #include "core/thread.h"
@@ -30,6 +31,15 @@
 
 USE_TSL_NAMESPACE
 
+// Width in texture space of the footprint of texture lookups in the shader being executed by this thread.
+static thread_local float g_textureFootprint = 0.0f;
+
+// The footprint of the ray cone stretches on the surface as it gets closer to grazing angles.
+static float textureFootprint( const SurfaceInteraction& intersection ){
+    const auto cos_theta = std::max( absDot( intersection.view , intersection.gnormal ) , 0.01f );
+    return intersection.footprint * sqrt( intersection.uvDensity ) / cos_theta;
+}
+
 IMPLEMENT_TSLGLOBAL_BEGIN(TslGlobal)
 IMPLEMENT_TSLGLOBAL_VAR(Tsl_float3, uvw)          // UV coordinate, W is preserved for now.
 IMPLEMENT_TSLGLOBAL_VAR(Tsl_float3, position)     // this is world space position
@@ -53,36 +63,70 @@ public:
     void    sample_2d(const void* texture, float u, float v, float3& color) const override {
         auto resource = (const Resource*)texture;
         auto sort_texture = dynamic_cast<const ImageTexture2D*>(resource);
-        auto ret = sort_texture->GetColorFromUV(u, v);
+        auto ret = sort_texture->GetColorFromUV(u, v, g_textureFootprint);
         color = make_float3(ret.x, ret.y, ret.z);
     }
 
     void    sample_alpha_2d(const void* texture, float u, float v, float& alpha) const override {
         auto resource = (const Resource*)texture;
         auto sort_texture = dynamic_cast<const ImageTexture2D*>(resource);
-        alpha = sort_texture->GetAlphaFromtUV(u, v);
+        alpha = sort_texture->GetAlphaFromtUV(u, v, g_textureFootprint);
     }
 };
 
-// Tsl shading system
-static std::vector<std::shared_ptr<ShadingContext>>    g_contexts;
+// Tsl shading system is initialized only once, either by the task overlapping it with loading the scene or by the first
+// thread asking for a shading context.
+static std::once_flag                                   g_tslInitialized;
+
+// Shading contexts not owned by any thread, worker threads are created again for each batch of tasks and the contexts of
+// the threads that quit are reused by the new ones.
+static std::mutex                                       g_contextPoolMutex;
+static std::vector<std::shared_ptr<ShadingContext>>     g_contextPool;
+
+// The shading context of a thread, it goes back to the pool once the thread quits.
+struct ThreadShadingContext {
+    std::shared_ptr<ShadingContext> context;
+
+    ~ThreadShadingContext() {
+        if (!context)
+            return;
+        std::lock_guard<std::mutex> lock(g_contextPoolMutex);
+        g_contextPool.push_back(std::move(context));
+    }
+};
+static thread_local ThreadShadingContext g_threadContext;
 
 std::shared_ptr<Tsl_Namespace::ShadingContext> GetShadingContext() {
-#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
-    // this is by no means a good approach, but I'll live with it before I have a proper job system.
-    return ShadingSystem::get_instance().make_shading_context();
-#else
-    return g_contexts[ThreadId()];
-#endif
+    // each thread has its own shading context, shaders could be compiled in multiple threads at the same time.
+    if (g_threadContext.context)
+        return g_threadContext.context;
+
+    InitializeTSLSystem();
+    {
+        std::lock_guard<std::mutex> lock(g_contextPoolMutex);
+        if (!g_contextPool.empty()) {
+            g_threadContext.context = std::move(g_contextPool.back());
+            g_contextPool.pop_back();
+            return g_threadContext.context;
+        }
+    }
+    g_threadContext.context = ShadingSystem::get_instance().make_shading_context();
+    return g_threadContext.context;
 }
 
-void ExecuteSurfaceShader( Tsl_Namespace::ShaderInstance* shader , ScatteringEvent& se ){
-    const SurfaceInteraction& intersection = se.GetInteraction();
-    TslGlobal global;
+// Setup the tsl global of a surface shader.
+static void setupSurfaceGlobal( const SurfaceInteraction& intersection , TslGlobal& global ){
     global.uvw = make_float3(intersection.u, intersection.v, 0.0f);
     global.normal = make_float3(intersection.normal.x, intersection.normal.y, intersection.normal.z);
     global.I = make_float3(intersection.view.x, intersection.view.y, intersection.view.z);
     global.position = make_float3(intersection.intersect.x, intersection.intersect.y, intersection.intersect.z);
+}
+
+void ExecuteSurfaceShader( Tsl_Namespace::ShaderInstance* shader , ScatteringEvent& se ){
+    const SurfaceInteraction& intersection = se.GetInteraction();
+    TslGlobal global;
+    setupSurfaceGlobal(intersection, global);
+    g_textureFootprint = textureFootprint(intersection);
 
     // shader execution
     ClosureTreeNodeBase* closure = nullptr;
@@ -93,6 +137,35 @@ void ExecuteSurfaceShader( Tsl_Namespace::ShaderInstance* shader , ScatteringEve
     ProcessSurfaceClosure(closure, Tsl_Namespace::make_float3(1.0f, 1.0f, 1.0f) , se );
 }
 
+void ExecuteSurfaceShaders( Tsl_Namespace::ShaderInstance* shader , ScatteringEvent* const* ses , unsigned cnt ){
+    auto raw_function = (void(*)(ClosureTreeNodeBase**, TslGlobal*))shader->get_function();
+
+    TslGlobal               globals[SURFACE_SHADING_BATCH_SIZE];
+    float                   footprints[SURFACE_SHADING_BATCH_SIZE];
+    ClosureTreeNodeBase*    closures[SURFACE_SHADING_BATCH_SIZE];
+    for( auto k = 0u ; k < cnt ; k += SURFACE_SHADING_BATCH_SIZE ){
+        const auto lanes = std::min( SURFACE_SHADING_BATCH_SIZE , cnt - k );
+
+        // setup the inputs of all hits in the batch
+        for( auto i = 0u ; i < lanes ; ++i ){
+            const auto& intersection = ses[k + i]->GetInteraction();
+            setupSurfaceGlobal(intersection, globals[i]);
+            footprints[i] = textureFootprint(intersection);
+            closures[i] = nullptr;
+        }
+
+        // shader execution
+        for( auto i = 0u ; i < lanes ; ++i ){
+            g_textureFootprint = footprints[i];
+            raw_function(&closures[i], &globals[i]);
+        }
+
+        // parse the surface shaders
+        for( auto i = 0u ; i < lanes ; ++i )
+            ProcessSurfaceClosure(closures[i], Tsl_Namespace::make_float3(1.0f, 1.0f, 1.0f) , *ses[k + i] );
+    }
+}
+
 void ExecuteVolumeShader(Tsl_Namespace::ShaderInstance* shader, const MediumInteraction& mi, MediumStack& ms, const SE_Interaction flag, const MaterialBase* material ) {
     //const SurfaceInteraction& intersection = se.GetInteraction();
     TslGlobal global;
@@ -124,6 +197,7 @@ Spectrum EvaluateTransparency(Tsl_Namespace::ShaderInstance* shader , const Surf
     global.I = make_float3(intersection.view.x, intersection.view.y, intersection.view.z);
     global.gnormal = make_float3(intersection.gnormal.x, intersection.gnormal.y, intersection.gnormal.z);
     global.position = make_float3(intersection.intersect.x, intersection.intersect.y, intersection.intersect.z);
+    g_textureFootprint = textureFootprint(intersection);
 
     // shader execution
     ClosureTreeNodeBase* closure = nullptr;
@@ -135,17 +209,16 @@ Spectrum EvaluateTransparency(Tsl_Namespace::ShaderInstance* shader , const Surf
     return Spectrum(1.0f - opacity).Clamp(0.0f, 1.0f);
 }
 
-void CreateTSLThreadContexts(){
-    auto& shading_system = ShadingSystem::get_instance();
-    shading_system.register_shadingsystem_interface(std::make_unique<TSL_ShadingSystemInterface>());
+void InitializeTSLSystem(){
+    std::call_once(g_tslInitialized, []() {
+        SORT_PROFILE("Initializing TSL");
 
-    // register all closures
-    RegisterClosures();
+        auto& shading_system = ShadingSystem::get_instance();
+        shading_system.register_shadingsystem_interface(std::make_unique<TSL_ShadingSystemInterface>());
 
-    // allocate shading context for each thread
-    g_contexts.resize( g_threadCnt );
-    for (auto i = 0u; i < g_threadCnt; ++i)
-        g_contexts[i] = shading_system.make_shading_context();
+        // register all closures
+        RegisterClosures();
+    });
 }
 
  void DestroyTSLThreadContexts(){
@@ -51,12 +51,29 @@ DECLARE_TSLGLOBAL_VAR(Tsl_float3, I)            // this is world space input dir
 DECLARE_TSLGLOBAL_VAR(Tsl_float, density)       // volume density
 DECLARE_TSLGLOBAL_END()
 
-//! @brief  Get Shading context.
+//! @brief  Get Shading context of the current thread.
+//!
+//! It is created on the first call of the thread, or taken from the contexts of threads that have quit. The shading
+//! system is initialized first if it isn't yet.
 std::shared_ptr<Tsl_Namespace::ShadingContext> GetShadingContext();
 
 //! @brief  Execute Jited shader code.
 void ExecuteSurfaceShader(Tsl_Namespace::ShaderInstance* shader, ScatteringEvent& se);
 
+//! @brief  Number of hits shaded together by ExecuteSurfaceShaders.
+constexpr unsigned SURFACE_SHADING_BATCH_SIZE = 16;
+
+//! @brief  Execute Jited shader code for a batch of hits sharing the same shader.
+//!
+//! Hits are shaded in batches of SURFACE_SHADING_BATCH_SIZE. The tsl globals of all hits in a batch are set up first,
+//! the shader is then executed on each of them in a tight loop before the closures of all hits are parsed. This keeps
+//! the jited code and its data hot in the cache instead of going back and forth between shading and closure parsing.
+//!
+//! @param  shader      The tsl shader to be executed.
+//! @param  ses         Scattering events of the hits, all of them are shaded by the same shader.
+//! @param  cnt         Number of scattering events.
+void ExecuteSurfaceShaders(Tsl_Namespace::ShaderInstance* shader, ScatteringEvent* const* ses, unsigned cnt);
+
 //! @brief  Execute a shader and populate the medium stack
 //!
 //! @param  shader      The tsl shader to be evaluated.
@@ -79,8 +96,11 @@ void EvaluateVolumeSample(Tsl_Namespace::ShaderInstance* shader, const MediumInt
 //! @param  intersection    The intersection of interest.
 Spectrum EvaluateTransparency(Tsl_Namespace::ShaderInstance* shader, const SurfaceInteraction& intersection);
 
-//! @brief  Create thread contexts
-void CreateTSLThreadContexts();
+//! @brief  Initialize the TSL shading system, including LLVM, and register all closures.
+//!
+//! It could be called from any thread at any time, only the first call does the work and the others wait for it. Shading
+//! contexts of threads are not created here, they are created on demand by GetShadingContext.
+void InitializeTSLSystem();
 
 //! @brief  Destroy thread contexts
 void DestroyTSLThreadContexts();
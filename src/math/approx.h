@@ -0,0 +1,264 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+/*
+    Approximations of transcendental functions.
+
+    Unlike fast math of the compiler, which is all or nothing, the accuracy is picked by each call site. There is no
+    branch or table in the approximations, so that loops calling them are vectorized by the compiler, they also don't
+    depend on errno or the rounding mode like the functions in libm.
+
+    The polynomials of the high accuracy versions are from Cephes, http://www.netlib.org/cephes/ , except that the one of
+    logarithm is from fdlibm, http://www.netlib.org/fdlibm/ .
+
+    Measured maximum errors against double precision, they are also verified in the unit tests.
+                        High                        Fast
+    ApproxExp           1e-7    relative            6e-5    relative
+    ApproxLog           2e-7    relative            7e-5    absolute, 2e-4 relative
+    ApproxPow           2e-7    relative            2e-4    relative,   both scaled by ( 1 + |y * ln(x)| )
+    ApproxSinCos        1e-7    absolute            4e-5    absolute,   for |x| < 8192
+    ApproxAtan2         3e-7    absolute            2e-5    absolute
+    ApproxAcos          3e-7    absolute            2e-5    absolute
+*/
+
+#include <cmath>
+#include <cfloat>
+#include <string.h>
+#include <algorithm>
+#include "core/define.h"
+
+//! @brief  Accuracy of the transcendental functions.
+enum class MathAccuracy{
+    Exact,      /**< Functions from the C++ standard library. */
+    High,       /**< Error is a few ulps, good for anything that is not a reference. */
+    Fast,       /**< Error is around 1e-4, good for look-ups and things converging stochastically anyway. */
+};
+
+namespace approx_detail {
+    SORT_FORCEINLINE unsigned AsUint( const float f ){
+        unsigned bits;
+        memcpy( &bits , &f , sizeof( bits ) );
+        return bits;
+    }
+
+    SORT_FORCEINLINE float AsFloat( const unsigned bits ){
+        float f;
+        memcpy( &f , &bits , sizeof( f ) );
+        return f;
+    }
+
+    // Closest integer of a float, std::floor and std::round are library calls without SSE4.1, a conversion is not.
+    SORT_FORCEINLINE int RoundToInt( const float x ){
+        return (int)( x + ( x < 0.0f ? -0.5f : 0.5f ) );
+    }
+
+    // ln(2) split into two parts so that n * LN2_HI is exact for the exponents of floats.
+    static constexpr float LN2_HI = 0.693359375f;
+    static constexpr float LN2_LO = -2.12194440e-4f;
+
+    // Natural logarithm of a positive normalized float.
+    template<MathAccuracy accuracy>
+    SORT_FORCEINLINE float LogNormalized( const float x ){
+        // x = 2^e * m, where m is in [sqrt(0.5), sqrt(2)).
+        const auto bits = AsUint( x );
+        auto e = (int)( bits >> 23 ) - 127;
+        auto m = AsFloat( ( bits & 0x7fffff ) | 0x3f800000 );
+        const auto large = m > 1.41421356237f;
+        m = large ? m * 0.5f : m;
+        e = large ? e + 1 : e;
+
+        // ln(m) = 2 * atanh(s), where s = (m - 1) / (m + 1) is within 0.1716 in absolute value.
+        const auto s = ( m - 1.0f ) / ( m + 1.0f );
+        const auto s2 = s * s;
+        const auto p = ( accuracy == MathAccuracy::High ) ?
+            s2 * ( 0.666666666666735130f + s2 * ( 0.399999999994094190f + s2 * ( 0.285714287436623914f + s2 * ( 0.222221984321497839f + s2 * 0.181835721616180501f ) ) ) ) :
+            s2 * 0.666666666666735130f;
+
+        const auto fe = (float)e;
+        return fe * LN2_HI + ( fe * LN2_LO + ( 2.0f * s + s * p ) );
+    }
+
+    // Arctangent of a number in [0, 1].
+    template<MathAccuracy accuracy>
+    SORT_FORCEINLINE float AtanUnit( const float a ){
+        if( accuracy == MathAccuracy::Fast ){
+            const auto a2 = a * a;
+            return a * ( 0.9998660f + a2 * ( -0.3302995f + a2 * ( 0.1801410f + a2 * ( -0.0851330f + a2 * 0.0208351f ) ) ) );
+        }
+
+        // atan(a) = pi/4 + atan((a - 1) / (a + 1)), it moves the range to [-tan(pi/8), tan(pi/8)].
+        const auto large = a > 0.414213562373095f;
+        const auto reduced = ( a - 1.0f ) / ( a + 1.0f );
+        const auto t = large ? reduced : a;
+        const auto t2 = t * t;
+        const auto p = ( ( ( 8.05374449538e-2f * t2 - 1.38776856032e-1f ) * t2 + 1.99777106478e-1f ) * t2 - 3.33329491539e-1f ) * t2 * t + t;
+        return large ? p + 0.785398163397448f : p;
+    }
+}
+
+//! @brief  Approximation of exp(x).
+//!
+//! The result is flushed to zero below exp(-87.3365) and saturates at exp(88.3762), it is never denormalized or infinite.
+//! The input can't be Nan.
+//!
+//! @param  x       The exponent.
+//! @return         e^x
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE float ApproxExp( float x ){
+    if( accuracy == MathAccuracy::Exact )
+        return std::exp( x );
+
+    constexpr auto lo = -87.3365f;
+    const auto underflow = x <= lo;
+    x = std::min( std::max( x , lo ) , 88.3762f );
+
+    // exp(x) = 2^n * exp(r), where n is the closest integer to x / ln(2).
+    const auto n = approx_detail::RoundToInt( x * 1.44269504088896341f );
+    const auto fn = (float)n;
+    const auto r = x - fn * approx_detail::LN2_HI - fn * approx_detail::LN2_LO;
+
+    float y;
+    if( accuracy == MathAccuracy::High ){
+        y = 1.9875691500e-4f;
+        y = y * r + 1.3981999507e-3f;
+        y = y * r + 8.3334519073e-3f;
+        y = y * r + 4.1665795894e-2f;
+        y = y * r + 1.6666665459e-1f;
+        y = y * r + 5.0000001201e-1f;
+        y = y * r * r + r + 1.0f;
+    }else{
+        y = 1.0f + r * ( 1.0f + r * ( 0.5f + r * ( 1.6666667e-1f + r * 4.1666668e-2f ) ) );
+    }
+
+    const auto ret = y * approx_detail::AsFloat( (unsigned)( n + 127 ) << 23 );
+    return underflow ? 0.0f : ret;
+}
+
+//! @brief  Approximation of the natural logarithm.
+//!
+//! Zero returns negative infinity, negative values return Nan and infinity returns infinity, like std::log.
+//!
+//! @param  x       The value.
+//! @return         ln(x)
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE float ApproxLog( float x ){
+    if( accuracy == MathAccuracy::Exact )
+        return std::log( x );
+
+    // denormalized values are scaled to be normalized first.
+    const auto denormal = x < FLT_MIN;
+    const auto scaled = x * 8388608.0f;
+    const auto ret = approx_detail::LogNormalized<accuracy>( denormal ? scaled : x ) - ( denormal ? 15.9423851528787f : 0.0f );
+
+    const auto special = ( x == 0.0f ) ? -INFINITY : ( ( x == INFINITY ) ? INFINITY : NAN );
+    return ( x > 0.0f && x < INFINITY ) ? ret : special;
+}
+
+//! @brief  Approximation of pow(x, y) for non-negative bases.
+//!
+//! The result is evaluated as exp(y * ln(x)), the relative error grows with |y * ln(x)|. Zero to the power of zero is one.
+//!
+//! @param  x       The base, it can't be negative.
+//! @param  y       The exponent.
+//! @return         x^y
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE float ApproxPow( float x , float y ){
+    if( accuracy == MathAccuracy::Exact )
+        return std::pow( x , y );
+
+    const auto ret = ApproxExp<accuracy>( y * approx_detail::LogNormalized<accuracy>( std::min( std::max( x , FLT_MIN ) , FLT_MAX ) ) );
+    const auto zero_base = y > 0.0f ? 0.0f : INFINITY;
+    return ( ( x > 0.0f ) | ( y == 0.0f ) ) ? ret : zero_base;
+}
+
+//! @brief  Approximation of sine and cosine of the same angle.
+//!
+//! The angle is reduced to [-pi/4, pi/4] first, the reduction loses accuracy if the absolute value of the angle is
+//! larger than 8192.
+//!
+//! @param  x       The angle in radian.
+//! @param  s       Sine of the angle.
+//! @param  c       Cosine of the angle.
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE void ApproxSinCos( float x , float& s , float& c ){
+    if( accuracy == MathAccuracy::Exact ){
+        s = std::sin( x );
+        c = std::cos( x );
+        return;
+    }
+
+    // x = q * pi / 2 + r, pi / 2 is split into three parts to keep the precision of r.
+    const auto q = approx_detail::RoundToInt( x * 0.636619772367581f );
+    const auto fq = (float)q;
+    const auto r = ( ( x - fq * 1.5703125f ) - fq * 4.837512969970703125e-4f ) - fq * 7.54978995489188216e-8f;
+    const auto r2 = r * r;
+
+    float sr , cr;
+    if( accuracy == MathAccuracy::High ){
+        sr = r + r * r2 * ( -1.6666654611e-1f + r2 * ( 8.3321608736e-3f + r2 * -1.9515295891e-4f ) );
+        cr = 1.0f - 0.5f * r2 + r2 * r2 * ( 4.166664568298827e-2f + r2 * ( -1.388731625493765e-3f + r2 * 2.443315711809948e-5f ) );
+    }else{
+        sr = r + r * r2 * ( -1.6666667e-1f + r2 * 8.3333333e-3f );
+        cr = 1.0f + r2 * ( -0.5f + r2 * ( 4.1666667e-2f + r2 * -1.3888889e-3f ) );
+    }
+
+    // odd quadrants swap sine and cosine, the signs depend on the quadrant too.
+    const auto swap = ( q & 1 ) != 0;
+    const auto ts = swap ? cr : sr;
+    const auto tc = swap ? sr : cr;
+    s = ( q & 2 ) ? -ts : ts;
+    c = ( ( q + 1 ) & 2 ) ? -tc : tc;
+}
+
+//! @brief  Approximation of atan2(y, x).
+//!
+//! The result is in [-pi, pi], both inputs being zero results in zero.
+//!
+//! @param  y       The y coordinate.
+//! @param  x       The x coordinate.
+//! @return         The angle between the positive x axis and the point (x, y).
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE float ApproxAtan2( float y , float x ){
+    if( accuracy == MathAccuracy::Exact )
+        return std::atan2( y , x );
+
+    const auto ax = std::abs( x );
+    const auto ay = std::abs( y );
+    const auto mx = std::max( ax , ay );
+    const auto a = std::min( ax , ay ) / std::max( mx , FLT_MIN );
+
+    auto r = approx_detail::AtanUnit<accuracy>( a );
+    r = ( ay > ax ) ? 1.57079632679490f - r : r;
+    r = ( x < 0.0f ) ? 3.14159265358979f - r : r;
+    return ( y < 0.0f ) ? -r : r;
+}
+
+//! @brief  Approximation of acos(x).
+//!
+//! The input is clamped to [-1, 1].
+//!
+//! @param  x       Cosine of the angle.
+//! @return         The angle in [0, pi].
+template<MathAccuracy accuracy>
+SORT_FORCEINLINE float ApproxAcos( float x ){
+    x = std::min( std::max( x , -1.0f ) , 1.0f );
+    if( accuracy == MathAccuracy::Exact )
+        return std::acos( x );
+    return ApproxAtan2<accuracy>( std::sqrt( ( 1.0f - x ) * ( 1.0f + x ) ) , x );
+}
@@ -125,6 +125,52 @@ SORT_FORCEINLINE BBox Union( const BBox& bbox0 , const BBox& bbox1 ){
     return result;
 }
 
+//! @brief  Get the overlapping part of two bounding boxes.
+//!
+//! @param bbox0    The first bounding box.
+//! @param bbox1    The second bounding box.
+//! @return         The overlapping part, it is an invalid bounding box if the two don't overlap.
+SORT_FORCEINLINE BBox Intersection( const BBox& bbox0 , const BBox& bbox1 ){
+    BBox result;
+    for( int i = 0 ; i < 3 ; i++ ){
+        result.m_Min[i] = std::max( bbox0.m_Min[i] , bbox1.m_Min[i] );
+        result.m_Max[i] = std::min( bbox0.m_Max[i] , bbox1.m_Max[i] );
+    }
+    return result;
+}
+
+//! @brief  Whether the bounding box contains anything.
+//!
+//! @param bbox     The bounding box to be checked.
+//! @return         False if the bounding box is an invalid one.
+SORT_FORCEINLINE bool IsValid( const BBox& bbox ){
+    return bbox.m_Min[0] <= bbox.m_Max[0] && bbox.m_Min[1] <= bbox.m_Max[1] && bbox.m_Min[2] <= bbox.m_Max[2];
+}
+
+//! @brief  Bounding boxes of something moving linearly during the shutter interval.
+/**
+ * Corners of bounding boxes move linearly if everything inside does, interpolating the boxes at the opening and closing
+ * of the shutter gives a conservative bounding box at any time in between, which is a lot tighter than the union of
+ * the two for fast moving objects.
+ */
+struct MotionBBox{
+    BBox    open;   /**< Bounding box at the opening of the shutter. */
+    BBox    close;  /**< Bounding box at the closing of the shutter. */
+
+    //! @brief  Get the bounding box at a specific time.
+    //!
+    //! @param time     Time within the shutter interval, normalized to [0,1].
+    //! @return         Bounding box at the time.
+    SORT_FORCEINLINE BBox At( const float time ) const{
+        BBox result;
+        for( int i = 0 ; i < 3 ; i++ ){
+            result.m_Min[i] = open.m_Min[i] + ( close.m_Min[i] - open.m_Min[i] ) * time;
+            result.m_Max[i] = open.m_Max[i] + ( close.m_Max[i] - open.m_Max[i] ) * time;
+        }
+        return result;
+    }
+};
+
 SORT_FORCEINLINE float Intersect( const Ray& ray , const BBox& bb , float* fmax = nullptr ){
     //set default value for tmax and tmin
     float tmax = ray.m_fMax;
@@ -0,0 +1,97 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "curve.h"
+#include <algorithm>
+
+//! @brief  Side length of the smallest power of two square covering the grid.
+static unsigned coveringSquare( const Vector2i& size ){
+    auto n = 1u;
+    while( n < (unsigned)size.x || n < (unsigned)size.y )
+        n <<= 1;
+    return n;
+}
+
+//! @brief  Take every other bit of a Morton code.
+static unsigned compactBits( unsigned v ){
+    v &= 0x55555555;
+    v = ( v | ( v >> 1 ) ) & 0x33333333;
+    v = ( v | ( v >> 2 ) ) & 0x0f0f0f0f;
+    v = ( v | ( v >> 4 ) ) & 0x00ff00ff;
+    v = ( v | ( v >> 8 ) ) & 0x0000ffff;
+    return v;
+}
+
+//! @brief  Insert two zero bits after each of the lowest 10 bits.
+static unsigned spreadBits3D( unsigned v ){
+    v &= 0x3ff;
+    v = ( v | ( v << 16 ) ) & 0x030000ff;
+    v = ( v | ( v << 8 ) ) & 0x0300f00f;
+    v = ( v | ( v << 4 ) ) & 0x030c30c3;
+    v = ( v | ( v << 2 ) ) & 0x09249249;
+    return v;
+}
+
+std::vector<Vector2i> MortonOrder( const Vector2i& size ){
+    std::vector<Vector2i> ret;
+    if( size.x <= 0 || size.y <= 0 )
+        return ret;
+    ret.reserve( size.x * size.y );
+
+    const auto n = coveringSquare( size );
+    for( auto d = 0u ; d < n * n ; ++d ){
+        const auto x = (int)compactBits( d );
+        const auto y = (int)compactBits( d >> 1 );
+        if( x < size.x && y < size.y )
+            ret.push_back( Vector2i( x , y ) );
+    }
+    return ret;
+}
+
+std::vector<Vector2i> HilbertOrder( const Vector2i& size ){
+    std::vector<Vector2i> ret;
+    if( size.x <= 0 || size.y <= 0 )
+        return ret;
+    ret.reserve( size.x * size.y );
+
+    const auto n = coveringSquare( size );
+    for( auto d = 0u ; d < n * n ; ++d ){
+        // Walk the quadrants from the finest level, rotating the sub-curve to connect with its neighbors.
+        auto x = 0u , y = 0u , t = d;
+        for( auto s = 1u ; s < n ; s <<= 1 ){
+            const auto rx = 1u & ( t >> 1 );
+            const auto ry = 1u & ( t ^ rx );
+            if( 0 == ry ){
+                if( 1 == rx ){
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap( x , y );
+            }
+            x += s * rx;
+            y += s * ry;
+            t >>= 2;
+        }
+        if( (int)x < size.x && (int)y < size.y )
+            ret.push_back( Vector2i( (int)x , (int)y ) );
+    }
+    return ret;
+}
+
+unsigned MortonCode3D( unsigned x , unsigned y , unsigned z ){
+    return ( spreadBits3D( x ) << 2 ) | ( spreadBits3D( y ) << 1 ) | spreadBits3D( z );
+}
@@ -0,0 +1,48 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "math/vector2.h"
+
+//! @brief  Cells of a 2D grid in the order of the Morton curve.
+//!
+//! The curve is defined on the smallest power of two square covering the grid, cells outside
+//! of the grid are skipped.
+//!
+//! @param  size    Size of the grid.
+//! @return         All cells of the grid, sorted along the curve.
+std::vector<Vector2i>   MortonOrder( const Vector2i& size );
+
+//! @brief  Cells of a 2D grid in the order of the Hilbert curve.
+//!
+//! Unlike the Morton curve, consecutive cells along the Hilbert curve are always adjacent to each
+//! other inside the square. The curve is defined on the smallest power of two square covering the
+//! grid, cells outside of the grid are skipped.
+//!
+//! @param  size    Size of the grid.
+//! @return         All cells of the grid, sorted along the curve.
+std::vector<Vector2i>   HilbertOrder( const Vector2i& size );
+
+//! @brief  Morton code of a cell in a 3D grid, bits of the three axes are interleaved.
+//!
+//! @param  x       Coordinate along the x axis, only the lowest 10 bits are taken.
+//! @param  y       Coordinate along the y axis, only the lowest 10 bits are taken.
+//! @param  z       Coordinate along the z axis, only the lowest 10 bits are taken.
+//! @return         Morton code of the cell.
+unsigned                MortonCode3D( unsigned x , unsigned y , unsigned z );
@@ -19,12 +19,15 @@
 
 #include <float.h>
 #include "math/point.h"
+#include "math/ray.h"
 #include "spectrum/spectrum.h"
 
 class Primitive;
-class PhaseFunction;
 class Mesh;
 
+// Relative distance left unoccluded at the end of a ray toward a point, the point itself may be on a surface.
+static constexpr float SHADOW_EPSILON = 0.0001f;
+
 /**
  * InteractionCommon keeps track of the common field shared by surface interfaction and
  * medium interaction.
@@ -36,6 +39,10 @@ struct   InteractionCommon{
 #endif
     // the intersection point
     Point   intersect;
+    // conservative bound of the absolute floating point error of the intersection point along each axis
+    Vector  error;
+    // time of the interaction within the shutter interval, rays spawned from the interaction inherit it
+    float   time = 0.0f;
 };
 
 //! @brief  Interaction at surface.
@@ -58,8 +65,63 @@ struct SurfaceInteraction : public InteractionCommon{
     float   u = 0.0f , v = 0.0f;
     // the delta distance from the original point
     float   t = FLT_MAX;
+    // world space width of the ray cone at the intersection, zero if the ray doesn't carry a cone
+    float   footprint = 0.0f;
+    // area in texture space per unit area in world space of the intersected surface
+    float   uvDensity = 0.0f;
     // the intersected primitive
     const Primitive*  primitive = nullptr;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    // the opaque primitive blocking a shadow ray, if it is known, it is only meaningful when 'primitive' is nullptr.
+    const Primitive*  occluder = nullptr;
+#endif
+
+    //! @brief  Origin of rays leaving the surface, offset just enough to avoid hitting the surface itself again.
+    //!
+    //! The intersection point is pushed along the geometry normal, by the projection of its error bound onto the normal,
+    //! toward the side of the surface the ray leaves to. Unlike a fixed distance, this is neither too small for large
+    //! scenes nor too large to miss contacts in small ones.
+    //!
+    //! @param  w       Direction of the ray to spawn.
+    //! @return         Origin of the ray.
+    SORT_FORCEINLINE Point SpawnOrigin( const Vector& w ) const{
+        const auto d = fabs( gnormal.x ) * error.x + fabs( gnormal.y ) * error.y + fabs( gnormal.z ) * error.z;
+        auto offset = d * gnormal;
+        if( dot( w , gnormal ) < 0.0f )
+            offset = -offset;
+
+        // round away from the intersection, so that the offset is not lost in rounding the sum.
+        auto p = intersect + offset;
+        for( auto i = 0u ; i < 3u ; ++i ){
+            if( offset[i] > 0.0f )
+                p[i] = nextafterf( p[i] , FLT_MAX );
+            else if( offset[i] < 0.0f )
+                p[i] = nextafterf( p[i] , -FLT_MAX );
+        }
+        return p;
+    }
+
+    //! @brief  Spawn a ray leaving the surface.
+    //!
+    //! @param  w       Direction of the ray.
+    //! @param  depth   Depth of the ray.
+    //! @param  fmax    The maximum range of the ray.
+    //! @return         The ray leaving the surface.
+    SORT_FORCEINLINE Ray SpawnRay( const Vector& w , unsigned depth = 0 , float fmax = FLT_MAX ) const{
+        Ray ret( SpawnOrigin( w ) , w , depth , 0.0f , fmax );
+        ret.m_time = time;
+        return ret;
+    }
+
+    //! @brief  Spawn a ray leaving the surface toward a point at a known distance, like a sample on a light.
+    //!
+    //! @param  w       Normalized direction of the ray.
+    //! @param  dist    Distance from the intersection to the point.
+    //! @param  depth   Depth of the ray.
+    //! @return         The ray stopping right before the point.
+    SORT_FORCEINLINE Ray SpawnRayTo( const Vector& w , float dist , unsigned depth = 0 ) const{
+        return SpawnRay( w , depth , dist * ( 1.0f - SHADOW_EPSILON ) );
+    }
 
     //! @brief  Reset the intersection.
     //!
@@ -77,6 +139,7 @@ struct SurfaceInteraction : public InteractionCommon{
  * Interaction between a ray and a medium.
  */
 struct MediumInteraction : public InteractionCommon{
-    const PhaseFunction*    phaseFunction = nullptr;      /**< Phase function of the interfaction. */
     const Mesh*             mesh = nullptr;               /**< Mesh that wraps this volume. */
+    bool                    scattered = false;            /**< Whether a real scattering event is sampled at the interaction. */
+    float                   anisotropy = 0.0f;            /**< Anisotropy of the Henyey-Greenstein phase function at the scattering event. */
 };
\ No newline at end of file
@@ -33,6 +33,7 @@ Matrix::Matrix( const float data[16] )
 {
     for( int i = 0 ; i < 16 ; i++ )
         m[i] = data[i];
+    updateAffine();
 }
 
 // constructrom from 16 float
@@ -45,6 +46,7 @@ Matrix::Matrix( float _11 , float _12 , float _13 , float _14 ,
     m[4] = _21;  m[5] = _22;  m[6] = _23;  m[7] = _24;
     m[8] = _31;  m[9] = _32;  m[10] = _33; m[11] = _34;
     m[12] = _41; m[13] = _42; m[14] = _43; m[15] = _44;
+    updateAffine();
 }
 
 // matrix mutiplication
@@ -66,31 +68,6 @@ Matrix Matrix::operator *( const Matrix& mat) const
     return Matrix(data);
 }
 
-// transform point
-Point Matrix::TransformPoint( const Point& p ) const{
-    const auto x = p.x * m[0] + p.y * m[1] + p.z * m[2] + m[3];
-    const auto y = p.x * m[4] + p.y * m[5] + p.z * m[6] + m[7];
-    const auto z = p.x * m[8] + p.y * m[9] + p.z * m[10] + m[11];
-    const auto w = p.x * m[12] + p.y * m[13] + p.z * m[14] + m[15];
-
-    // if w is one , just return the point
-    // note it is very common that w is one
-    if( LIKELY( w == 1.0f ) )
-        return Point( x , y , z );
-
-    return Point( x , y , z ) / w;
-}
-
-// transform vector
-Vector Matrix::TransformVector( const Vector& v ) const{
-    float _x = v.x * m[0] + v.y * m[1] + v.z * m[2];
-    float _y = v.x * m[4] + v.y * m[5] + v.z * m[6];
-    float _z = v.x * m[8] + v.y * m[9] + v.z * m[10];
-
-    // return the result
-    return Vector( _x , _y , _z );
-}
-
 // create a transpose matrix
 Matrix Matrix::Transpose() const
 {
@@ -138,6 +115,7 @@ bool Matrix::Inverse( Matrix& out ) const
     out.m[13] = d * (m[8] * (m[2] * m[13] - m[1] * m[14]) + m[9] * (m[0] * m[14] - m[2] * m[12]) + m[10] * (m[1] * m[12] - m[0] * m[13]));
     out.m[14] = d * (m[12] * (m[2] * m[5] - m[1] * m[6]) + m[13] * (m[0] * m[6] - m[2] * m[4]) + m[14] * (m[1] * m[4] - m[0] * m[5]));
     out.m[15] = d * (m[0] * (m[5] * m[10] - m[6] * m[9]) + m[1] * (m[6] * m[8] - m[4] * m[10]) + m[2] * (m[4] * m[9] - m[5] * m[8]));
+    out.updateAffine();
 
     return true;
 }
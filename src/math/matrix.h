@@ -19,6 +19,11 @@
 
 #include "math/ray.h"
 
+#ifdef SSE_ENABLED
+    // only SSE2 is used, which is available on all x86-64 CPUs even if the SIMD kernels are dispatched at runtime.
+    #include <emmintrin.h>
+#endif
+
 ////////////////////////////////////////////////////////////////////
 //  definition of matrix
 class   Matrix{
@@ -41,21 +46,93 @@ public:
 
     //! @brief  Transform a point.
     //!
+    //! The projective row is skipped for affine matrices, which are most matrices other than the projection of cameras.
+    //!
     //! @param p    Point to be transformed.
     //! @return     Transformed point.
-    Point TransformPoint( const Point& p ) const;
+    SORT_FORCEINLINE Point TransformPoint( const Point& p ) const{
+#ifdef SSE_ENABLED
+        float r[4];
+        _mm_storeu_ps( r , transform( _mm_setr_ps( p.x , p.y , p.z , 1.0f ) , !m_isAffine ) );
+        if( LIKELY( m_isAffine ) )
+            return Point( r[0] , r[1] , r[2] );
+        return Point( r[0] , r[1] , r[2] ) / r[3];
+#else
+        const auto x = p.x * m[0] + p.y * m[1] + p.z * m[2] + m[3];
+        const auto y = p.x * m[4] + p.y * m[5] + p.z * m[6] + m[7];
+        const auto z = p.x * m[8] + p.y * m[9] + p.z * m[10] + m[11];
+        if( LIKELY( m_isAffine ) )
+            return Point( x , y , z );
+
+        const auto w = p.x * m[12] + p.y * m[13] + p.z * m[14] + m[15];
+        return Point( x , y , z ) / w;
+#endif
+    }
+
+    //! @brief  Transform a point along with the bound of its floating point error.
+    //!
+    //! Only affine matrices are supported.
+    //!
+    //! @param p        Point to be transformed.
+    //! @param pError   Bound of the absolute error of the point along each axis.
+    //! @param error    Output, bound of the absolute error of the transformed point along each axis.
+    //! @return         Transformed point.
+    SORT_FORCEINLINE Point TransformPoint( const Point& p , const Vector& pError , Vector& error ) const{
+        // the rounding error of the transformation itself, then the error the point carries, scaled by the matrix.
+        for( auto i = 0u ; i < 3u ; ++i ){
+            const auto r = m + 4 * i;
+            error[i] = errorGamma( 3 ) * ( fabs( r[0] * p.x ) + fabs( r[1] * p.y ) + fabs( r[2] * p.z ) + fabs( r[3] ) ) +
+                       ( errorGamma( 3 ) + 1.0f ) * ( fabs( r[0] ) * pError.x + fabs( r[1] ) * pError.y + fabs( r[2] ) * pError.z );
+        }
+        return TransformPoint( p );
+    }
 
     //! @brief  Transform a vector.
     //!
     //! @param p    Vector to be transformed.
     //! @return     Transformed vector.
-    Vector TransformVector( const Vector& v ) const;
+    SORT_FORCEINLINE Vector TransformVector( const Vector& v ) const{
+#ifdef SSE_ENABLED
+        float r[4];
+        _mm_storeu_ps( r , transform( _mm_setr_ps( v.x , v.y , v.z , 0.0f ) , false ) );
+        return Vector( r[0] , r[1] , r[2] );
+#else
+        return Vector( v.x * m[0] + v.y * m[1] + v.z * m[2] ,
+                       v.x * m[4] + v.y * m[5] + v.z * m[6] ,
+                       v.x * m[8] + v.y * m[9] + v.z * m[10] );
+#endif
+    }
+
+    //! @brief  Transform a vector with the transpose of the matrix.
+    //!
+    //! Normals are transformed by the inverse transpose of a transform, this avoids transposing the inverse matrix.
+    //!
+    //! @param v    Vector to be transformed.
+    //! @return     Transformed vector.
+    SORT_FORCEINLINE Vector TransformVectorTransposed( const Vector& v ) const{
+#ifdef SSE_ENABLED
+        const auto r = _mm_add_ps( _mm_add_ps( _mm_mul_ps( _mm_set1_ps( v.x ) , _mm_loadu_ps( m ) ) ,
+                                               _mm_mul_ps( _mm_set1_ps( v.y ) , _mm_loadu_ps( m + 4 ) ) ) ,
+                                               _mm_mul_ps( _mm_set1_ps( v.z ) , _mm_loadu_ps( m + 8 ) ) );
+        float ret[4];
+        _mm_storeu_ps( ret , r );
+        return Vector( ret[0] , ret[1] , ret[2] );
+#else
+        return Vector( v.x * m[0] + v.y * m[4] + v.z * m[8] ,
+                       v.x * m[1] + v.y * m[5] + v.z * m[9] ,
+                       v.x * m[2] + v.y * m[6] + v.z * m[10] );
+#endif
+    }
 
     // transform a ray
     // para 'r' : the ray to transform
     // result   : transformed ray
     Ray operator * ( const Ray& r ) const{
-        return Ray( TransformPoint(r.m_Ori) , TransformVector( r.m_Dir ) , r.m_Depth , r.m_fMin , r.m_fMax );
+        Ray ret( TransformPoint(r.m_Ori) , TransformVector( r.m_Dir ) , r.m_Depth , r.m_fMin , r.m_fMax );
+        ret.m_coneWidth = r.m_coneWidth;
+        ret.m_coneSpread = r.m_coneSpread;
+        ret.m_time = r.m_time;
+        return ret;
     }
     Ray operator () ( const Ray& r ) const{
         return *this * r;
@@ -71,6 +148,13 @@ public:
     // whether the matrix have scale factor
     bool    HasScale() const;
 
+    //! @brief  Whether the last row of the matrix is (0,0,0,1), it is cached when the matrix is created.
+    //!
+    //! @return     Whether the matrix is affine.
+    bool    IsAffine() const{
+        return m_isAffine;
+    }
+
 public:
     // the data of the 4x4 matrix
     // m[0]  m[1]  m[2]  m[3]
@@ -78,4 +162,30 @@ public:
     // m[8]  m[9]  m[10] m[11]
     // m[12] m[13] m[14] m[15]
     float   m[16];
+
+private:
+    bool    m_isAffine = true;      /**< Whether the last row is (0,0,0,1). */
+
+    //! @brief  Check whether the matrix is affine, it needs to be called whenever the matrix is changed.
+    void    updateAffine(){
+        m_isAffine = m[12] == 0.0f && m[13] == 0.0f && m[14] == 0.0f && m[15] == 1.0f;
+    }
+
+#ifdef SSE_ENABLED
+    //! @brief  Multiply the matrix with a column of four floats.
+    //!
+    //! @param v            The column.
+    //! @param projective   Whether to evaluate the last row, it is zero otherwise.
+    //! @return             The result of the multiplication.
+    SORT_FORCEINLINE __m128 transform( const __m128& v , bool projective ) const{
+        auto r0 = _mm_mul_ps( _mm_loadu_ps( m ) , v );
+        auto r1 = _mm_mul_ps( _mm_loadu_ps( m + 4 ) , v );
+        auto r2 = _mm_mul_ps( _mm_loadu_ps( m + 8 ) , v );
+        auto r3 = projective ? _mm_mul_ps( _mm_loadu_ps( m + 12 ) , v ) : _mm_setzero_ps();
+
+        // the horizontal sums of the four rows are the four channels of the result.
+        _MM_TRANSPOSE4_PS( r0 , r1 , r2 , r3 );
+        return _mm_add_ps( _mm_add_ps( r0 , r1 ) , _mm_add_ps( r2 , r3 ) );
+    }
+#endif
 };
@@ -15,7 +15,10 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "ray.h"
+#include "bbox.h"
+#include "curve.h"
 
 Ray::Ray(){
     m_Depth = 0;
@@ -25,6 +28,9 @@ Ray::Ray(){
     m_fPdfA = 0.0f;
     m_we = 0.0f;
     m_fCosAtCamera = 0.0f;
+    m_coneWidth = 0.0f;
+    m_coneSpread = 0.0f;
+    m_time = 0.0f;
 }
 
 Ray::Ray( const Point& p , const Vector& dir , unsigned depth , float fmin , float fmax){
@@ -37,6 +43,9 @@ Ray::Ray( const Point& p , const Vector& dir , unsigned depth , float fmin , flo
     m_fPdfA = 0.0f;
     m_we = 0.0f;
     m_fCosAtCamera = 0.0f;
+    m_coneWidth = 0.0f;
+    m_coneSpread = 0.0f;
+    m_time = 0.0f;
 }
 
 Ray::Ray( const Ray& r ){
@@ -49,4 +58,24 @@ Ray::Ray( const Ray& r ){
     m_fPdfA = r.m_fPdfA;
     m_we = r.m_we;
     m_fCosAtCamera = r.m_fCosAtCamera;
-}
\ No newline at end of file
+    m_coneWidth = r.m_coneWidth;
+    m_coneSpread = r.m_coneSpread;
+    m_time = r.m_time;
+}
+
+// Number of cells of the grid binning ray origins along each axis.
+static constexpr unsigned RAY_BIN_GRID_BITS = 9;
+
+unsigned RayBinKey( const Ray& ray , const BBox& bbox ){
+    static constexpr unsigned RAY_BIN_GRID_MAX = ( 1u << RAY_BIN_GRID_BITS ) - 1;
+
+    unsigned cell[3];
+    for( auto k = 0 ; k < 3 ; ++k ){
+        const auto delta = bbox.Delta( k );
+        const auto t = delta > 0.0f ? ( ray.m_Ori[k] - bbox.m_Min[k] ) / delta : 0.0f;
+        cell[k] = (unsigned)( std::min( std::max( t , 0.0f ) , 1.0f ) * RAY_BIN_GRID_MAX );
+    }
+
+    const auto octant = ( ray.m_Dir.x < 0.0f ? 4u : 0u ) | ( ray.m_Dir.y < 0.0f ? 2u : 0u ) | ( ray.m_Dir.z < 0.0f ? 1u : 0u );
+    return ( octant << ( 3 * RAY_BIN_GRID_BITS ) ) | MortonCode3D( cell[0] , cell[1] , cell[2] );
+}
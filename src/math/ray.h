@@ -23,6 +23,8 @@
 #include "float.h"
 #include "spectrum/spectrum.h"
 
+class BBox;
+
 SORT_STATIC_FORCEINLINE int majorAxis(const Vector3f& v) {
     if (abs(v[0]) > abs(v[1]) && abs(v[0]) > abs(v[2]))
         return 0;
@@ -88,6 +90,25 @@ public:
     // importance value of the ray
     Spectrum m_we;
 
+    // ray cone, the footprint of the ray is 'm_coneWidth + t * m_coneSpread' wide at distance 't', it drives texture filtering.
+    // rays not carrying a cone have a zero spread angle and sample textures at the finest level.
+    float   m_coneWidth;
+    float   m_coneSpread;
+
+    // time of the ray within the shutter interval, normalized to [0,1), moving geometry is placed at this time.
+    float   m_time;
+
     mutable int     m_local_x , m_local_y , m_local_z;  /**< Id used to identify axis in local coordinate. */
     mutable float   m_scale_x , m_scale_y , m_scale_z;  /**< Scaling along each axis in local coordinate. */
 };
+
+//! @brief  Key of the bin a ray falls in, tracing rays in the order of their keys regains some coherence among them.
+//!
+//! Rays are binned by the octant of their directions first, then by the cell their origins are in. The cells form a
+//! grid in the bounding box of the scene, they are ordered along the Morton curve so that nearby cells have close keys.
+//! Origins outside of the bounding box are clamped into it.
+//!
+//! @param  ray     The ray to be binned.
+//! @param  bbox    Bounding box of the scene.
+//! @return         Key of the bin, rays in the same bin have the same key.
+unsigned    RayBinKey( const Ray& ray , const BBox& bbox );
@@ -15,21 +15,47 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <fstream>
+#include <vector>
 #include "sky.h"
 #include "math/ray.h"
 #include "core/samplemethod.h"
 #include "core/memory.h"
+#include "core/hash.h"
+#include "core/profile.h"
+#include "core/stats.h"
+#include "stream/fstream.h"
+#include "task/task.h"
+
+// Rows of the sky image processed in each task when building the importance sampling tables.
+static constexpr unsigned SKY_PARALLEL_ROWS = 64;
+
+// Widest prefiltered lookup in texture space, the level it lands on is around 22x11 texels for a 2:1 sky.
+static constexpr float SKY_PREFILTER_MAX_WIDTH = 1.0f / 16.0f;
+
+static constexpr unsigned SKY_CACHE_MAGIC   = 0x44594b53;  // 'SKYD'
+static constexpr unsigned SKY_CACHE_VERSION = 2;
+
+SORT_STATS_DEFINE_COUNTER(sSkyDistributionCacheHits)
+
+SORT_STATS_COUNTER("Statistics", "Sky Distributions Loaded from Cache", sSkyDistributionCacheHits);
 
 // evaluate value from sky
-Spectrum Sky::Evaluate( const Vector& wi ) const
+Spectrum Sky::Evaluate( const Vector& wi , float spread ) const
 {
-    float theta = sphericalTheta( wi );
-    float phi = sphericalPhi( wi );
+    // the error of the fast approximation is far smaller than a texel of the sky.
+    float theta = sphericalTheta<MathAccuracy::Fast>( wi );
+    float phi = sphericalPhi<MathAccuracy::Fast>( wi );
 
     float v = theta * INV_PI;
     float u = phi * INV_TWOPI;
 
-    return m_sky.GetColorFromUV( u , 1.0f - v );
+    if( spread <= 0.0f )
+        return m_sky.GetColorFromUV( u , 1.0f - v );
+
+    // the image spans PI vertically, very wide lobes stop at a level that still keeps the rough shape of the sky
+    const auto width = std::min( spread * INV_PI , SKY_PREFILTER_MAX_WIDTH );
+    return m_sky.GetColorFromUV( u , 1.0f - v , width );
 }
 
 // get the average radiance
@@ -38,24 +64,117 @@ Spectrum Sky::GetAverage() const
     return m_sky.GetAverage();
 }
 
+// Name of the file caching the importance sampling tables of a sky image, it sits next to the image.
+static std::string skyDistributionFile( const std::string& filename )
+{
+    return filename + ".distribution";
+}
+
+// load the cached tables, they are only valid for exactly the same image
+static std::unique_ptr<Distribution2D> loadSkyDistribution( const std::string& cache_file , unsigned long long hash , unsigned nu , unsigned nv )
+{
+    // check whether the file exists first since missing cache is not worth a warning
+    if( !std::ifstream( cache_file , std::ios::in | std::ios::binary ).good() )
+        return nullptr;
+
+    IFileStream stream( cache_file );
+    unsigned magic = 0 , version = 0 , width = 0 , height = 0;
+    unsigned long long file_hash = 0;
+    stream >> magic >> version;
+    stream.Load( (char*)&file_hash , sizeof( file_hash ) );
+    stream >> width >> height;
+    if( !stream.IsValid() || SKY_CACHE_MAGIC != magic || SKY_CACHE_VERSION != version || hash != file_hash || nu != width || nv != height )
+        return nullptr;
+
+    auto distribution = std::make_unique<Distribution2D>( stream );
+    if( !stream.IsValid() || distribution->GetWidth() != nu || distribution->GetHeight() != nv )
+        return nullptr;
+    return distribution;
+}
+
+// save the tables, a temporary file is written first so that nobody loads a partially saved cache
+static void saveSkyDistribution( const std::string& cache_file , unsigned long long hash , const Distribution2D& distribution )
+{
+    const auto tmp_file = cache_file + ".tmp";
+    auto saved = false;
+    {
+        OFileStream stream( tmp_file );
+        stream << SKY_CACHE_MAGIC << SKY_CACHE_VERSION;
+        stream.Write( (char*)&hash , sizeof( hash ) );
+        stream << distribution.GetWidth() << distribution.GetHeight();
+        distribution.Serialize( stream );
+        saved = stream.IsValid();
+    }
+
+    if( saved )
+    {
+        std::remove( cache_file.c_str() );
+        std::rename( tmp_file.c_str() , cache_file.c_str() );
+    }
+    else
+    {
+        std::remove( tmp_file.c_str() );
+    }
+}
+
 // generate 2d distribution
-void Sky::_generateDistribution2D()
+void Sky::_generateDistribution2D( const std::string& filename )
 {
-    auto nu = m_sky.GetWidth();
-    auto nv = m_sky.GetHeight();
+    SORT_PROFILE("Sky Distribution");
+
+    const auto nu = (unsigned)m_sky.GetWidth();
+    const auto nv = (unsigned)m_sky.GetHeight();
     sAssert( nu != 0 && nv != 0 , LIGHT );
-    auto data = std::make_unique<float[]>(nu*nv);
-    for( auto i = 0 ; i < nv ; i++ )
+
+    // the tables only depend on the content of the image, which is hashed along with its resolution
+    auto hash = HASH_INITIAL_VALUE;
+    const auto cache_file = skyDistributionFile( filename );
+    const auto hashed = hashFile( hash , filename );
+    if( hashed )
     {
-        auto offset = i * nu;
-        float sin_theta = sin( (float)i / (float)nv * PI );
+        distribution = loadSkyDistribution( cache_file , hash , nu , nv );
+        if( distribution )
+        {
+            SORT_STATS(++sSkyDistributionCacheHits);
+            return;
+        }
+    }
 
-        for( auto j = 0 ; j < nu ; j++ )
-            data[offset+j] = std::max( 0.0f , m_sky.GetColor( (int)j , (int)i ).GetIntensity() * sin_theta );
+    // each row has its own conditional distribution, rows are built in parallel chunks
+    std::vector<std::unique_ptr<Distribution1D>> conditions( nv );
+    const auto build_rows = [&]( unsigned start , unsigned end )
+    {
+        std::vector<float> data( nu );
+        for( auto i = start ; i < end ; i++ )
+        {
+            float sin_theta = sin( (float)i / (float)nv * PI );
+            for( auto j = 0u ; j < nu ; j++ )
+                data[j] = std::max( 0.0f , m_sky.GetColor( (int)j , (int)i ).GetIntensity() * sin_theta );
+            conditions[i] = std::make_unique<Distribution1D>( data.data() , nu );
+        }
+    };
+
+    const auto chunk_cnt = ( nv + SKY_PARALLEL_ROWS - 1 ) / SKY_PARALLEL_ROWS;
+    if( chunk_cnt == 1 )
+    {
+        build_rows( 0 , nv );
     }
+    else
+    {
+        for( auto c = 0u ; c < chunk_cnt ; ++c )
+        {
+            SPAWN_TASK<Function_Task>( "Sky Distribution Rows" , DEFAULT_TASK_PRIORITY , {} , [&,c]()
+            {
+                build_rows( c * SKY_PARALLEL_ROWS , std::min( nv , ( c + 1 ) * SKY_PARALLEL_ROWS ) );
+            });
+        }
+        WAIT_FOR_CHILDREN();
+    }
+
+    distribution = std::make_unique<Distribution2D>( std::move( conditions ) );
 
-    distribution.reset();
-    distribution = std::make_unique<Distribution2D>( data.get() , nu , nv );
+    if( hashed )
+        saveSkyDistribution( cache_file , hash , *distribution );
 }
 
 // sample direction
@@ -93,8 +212,8 @@ float Sky::Pdf( const Vector& lwi ) const
     float sin_theta = sinTheta(lwi);
     if( sin_theta == 0.0f ) return 0.0f;
     float u , v;
-    float theta = sphericalTheta( lwi );
-    float phi = sphericalPhi( lwi );
+    float theta = sphericalTheta<MathAccuracy::Fast>( lwi );
+    float phi = sphericalPhi<MathAccuracy::Fast>( lwi );
     v = 1.0f - theta * INV_PI;
     u = phi * INV_TWOPI;
 
@@ -28,9 +28,11 @@
 class   Sky{
 public:
     // evaluate value from sky
-    // para 'r' : the ray which misses all of the triangle in the scene
-    // result   : the spectrum in the sky
-    Spectrum Evaluate(const Vector& r) const;
+    // para 'r'      : the ray which misses all of the triangle in the scene
+    // para 'spread' : angular width of the lookup in radians, wider lookups are filtered in the smaller mip levels of the
+    //                 sky, zero means a bilinear lookup of the image itself
+    // result        : the spectrum in the sky
+    Spectrum Evaluate(const Vector& r, float spread = 0.0f) const;
 
     // get the average radiance
     Spectrum GetAverage() const;
@@ -44,13 +46,13 @@ public:
     // load image file
     void Load(const std::string& str) {
         m_sky.LoadResource(str);
-        _generateDistribution2D();
+        _generateDistribution2D(str);
     }
 
 private:
     ImageTexture2D    m_sky;
     std::unique_ptr<class Distribution2D>   distribution = nullptr;
 
-    // generate 2d distribution
-    void _generateDistribution2D();
+    // generate 2d distribution, it is cached next to the image file
+    void _generateDistribution2D(const std::string& filename);
 };
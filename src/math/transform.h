@@ -48,11 +48,14 @@ public:
     Point   TransformPoint( const Point& p ) const{
         return matrix.TransformPoint(p);
     }
+    Point   TransformPoint( const Point& p , const Vector& pError , Vector& error ) const{
+        return matrix.TransformPoint( p , pError , error );
+    }
     Vector  TransformVector( const Vector& v ) const{
         return matrix.TransformVector(v);
     }
     Vector  TransformNormal( const Vector& n ) const{
-        return invMatrix.Transpose().TransformVector(n);
+        return invMatrix.TransformVectorTransposed(n);
     }
 
     Ray     operator()( const Ray& r ) const {
@@ -213,5 +216,9 @@ SORT_FORCEINLINE Transform Transpose( const Transform& t )
 
 // transform a ray
 SORT_FORCEINLINE Ray  operator* ( const Transform& t , const Ray& r ){
-    return Ray( t.TransformPoint(r.m_Ori) , t.TransformVector(r.m_Dir) , r.m_Depth , r.m_fMin , r.m_fMax );
+    Ray ret( t.TransformPoint(r.m_Ori) , t.TransformVector(r.m_Dir) , r.m_Depth , r.m_fMin , r.m_fMax );
+    ret.m_coneWidth = r.m_coneWidth;
+    ret.m_coneSpread = r.m_coneSpread;
+    ret.m_time = r.m_time;
+    return ret;
 }
@@ -18,6 +18,8 @@
 #pragma once
 
 #include <math.h>
+#include <string.h>
+#include <float.h>
 #if defined(_MSC_VER) && (_MSC_VER >= 1800)
 #define NOMINMAX
 #  include <algorithm> // for std::min and std::max
@@ -97,6 +99,17 @@ SORT_FORCEINLINE int clamp( int x , int mi , int ma ){
     return x;
 }
 
+//! @brief  Bound of the relative error accumulated by a sequence of floating point operations.
+//!
+//! Each operation rounds its result with a relative error of at most half of the machine epsilon, 'n' of them together
+//! stay within 'n * eps / ( 1 - n * eps )'.
+//!
+//! @param  n   Number of operations.
+//! @return     Bound of the relative error.
+SORT_FORCEINLINE constexpr float errorGamma( int n ){
+    return ( (float)n * FLT_EPSILON * 0.5f ) / ( 1.0f - (float)n * FLT_EPSILON * 0.5f );
+}
+
 //! @brief  Degree to radian.
 //!
 //! @param  deg Degree to be converted.
@@ -129,4 +142,61 @@ SORT_FORCEINLINE float LinearToGamma( float value ){
 SORT_FORCEINLINE float GammaToLinear( float value ){
     if (value <= 0.04045f) return value * 1.f / 12.92f;
     return pow((value + 0.055f) * 1.f / 1.055f, (float)2.4f);
-}
\ No newline at end of file
+}
+
+//! @brief  Convert a float to the nearest half float.
+//!
+//! Finite numbers too large for half floats become the largest half float instead of infinity.
+//!
+//! @param  f       Value to be converted.
+//! @return         Bits of the half float.
+SORT_FORCEINLINE unsigned short FloatToHalf( float f ){
+    unsigned bits;
+    memcpy( &bits , &f , sizeof( bits ) );
+    const auto sign = ( bits >> 16 ) & 0x8000;
+    const auto exp = (int)( ( bits >> 23 ) & 0xff ) - 127 + 15;
+    auto mantissa = bits & 0x7fffff;
+
+    // infinity and nan
+    if( ( ( bits >> 23 ) & 0xff ) == 0xff )
+        return (unsigned short)( sign | 0x7c00 | ( mantissa ? 0x200 : 0 ) );
+    if( exp >= 31 )
+        return (unsigned short)( sign | 0x7bff );
+    if( exp <= 0 ){
+        // denormalized half float
+        if( exp < -10 )
+            return (unsigned short)sign;
+        mantissa |= 0x800000;
+        const auto shift = 14 - exp;
+        return (unsigned short)( sign | ( ( mantissa >> shift ) + ( ( mantissa >> ( shift - 1 ) ) & 1 ) ) );
+    }
+    // a carry of the rounding goes to the exponent, which is still the nearest half float
+    const auto half = ( sign | ( exp << 10 ) | ( mantissa >> 13 ) ) + ( ( mantissa >> 12 ) & 1 );
+    return (unsigned short)( ( half & 0x7fff ) == 0x7c00 ? ( sign | 0x7bff ) : half );
+}
+
+//! @brief  Convert a half float to float.
+//!
+//! @param  h       Bits of the half float.
+//! @return         Value of the half float.
+SORT_FORCEINLINE float HalfToFloat( unsigned short h ){
+    const auto sign = (unsigned)( h & 0x8000 ) << 16;
+    const auto exp = ( h >> 10 ) & 0x1f;
+    const auto mantissa = (unsigned)( h & 0x3ff );
+
+    unsigned bits;
+    if( 0 == exp ){
+        // zero and denormalized half floats are exact in float
+        const auto f = (float)mantissa * ( 1.0f / 16777216.0f );
+        memcpy( &bits , &f , sizeof( bits ) );
+        bits |= sign;
+    }else if( 0x1f == exp ){
+        bits = sign | 0x7f800000 | ( mantissa << 13 );
+    }else{
+        bits = sign | ( ( exp + 127 - 15 ) << 23 ) | ( mantissa << 13 );
+    }
+
+    float f;
+    memcpy( &f , &bits , sizeof( f ) );
+    return f;
+}
@@ -179,6 +179,47 @@ SORT_FORCEINLINE void coordinateSystem( const Vector3<T>& v0 , Vector3<T>& v1 ,
     v2 = cross( v0 , v1 );
 }
 
+//! @brief  Encode a unit vector in 32 bits with octahedral mapping.
+//!
+//! The vector is projected on the octahedron and the lower half is folded over the upper one, the two coordinates on
+//! the unfolded square are saved as 16 bits signed normalized integers. The angular error is below 0.01 degree,
+//! more details could be found in <a href="http://jcgt.org/published/0003/02/01/">A Survey of Efficient
+//! Representations for Independent Unit Vectors</a>.
+//!
+//! @param  v       The vector to be encoded, it doesn't need to be normalized.
+//! @return         The encoded vector, a zero vector is encoded as the z axis.
+SORT_FORCEINLINE unsigned EncodeOctahedral( const Vector& v ){
+    const auto l1 = fabs( v.x ) + fabs( v.y ) + fabs( v.z );
+    if( !( l1 > 0.0f ) )
+        return 0;
+
+    auto x = v.x / l1 , y = v.y / l1;
+    if( v.z < 0.0f ){
+        const auto ox = x;
+        x = ( 1.0f - fabs( y ) ) * ( ox >= 0.0f ? 1.0f : -1.0f );
+        y = ( 1.0f - fabs( ox ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+    }
+    const auto qx = (int)roundf( clamp( x , -1.0f , 1.0f ) * 32767.0f );
+    const auto qy = (int)roundf( clamp( y , -1.0f , 1.0f ) * 32767.0f );
+    return ( (unsigned)qx & 0xffffu ) | ( (unsigned)qy << 16u );
+}
+
+//! @brief  Decode a unit vector encoded with 'EncodeOctahedral'.
+//!
+//! @param  e       The encoded vector.
+//! @return         The normalized vector.
+SORT_FORCEINLINE Vector DecodeOctahedral( unsigned e ){
+    auto x = (float)(short)( e & 0xffffu ) / 32767.0f;
+    auto y = (float)(short)( e >> 16u ) / 32767.0f;
+    const auto z = 1.0f - fabs( x ) - fabs( y );
+    if( z < 0.0f ){
+        const auto ox = x;
+        x = ( 1.0f - fabs( y ) ) * ( ox >= 0.0f ? 1.0f : -1.0f );
+        y = ( 1.0f - fabs( ox ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+    }
+    return normalize( Vector( x , y , z ) );
+}
+
 template<class T>
 SORT_STATIC_FORCEINLINE Vector3<T> operator+( const Vector3<T>& v0 , const Vector3<T>& v1 ){
     return Vector3<T>( v0[0] + v1[0] , v0[1] + v1[1] , v0[2] + v1[2] );
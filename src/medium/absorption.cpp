@@ -26,10 +26,10 @@ IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeAbsorption)
 
 Spectrum AbsorptionMedium::Tr( const Ray& ray , const float max_t ) const{
     const auto e = m_globalMediumSample.basecolor * (m_globalMediumSample.absorption * -fmin(max_t, FLT_MAX ));
-    return e.Exp();
+    return e.Exp<MathAccuracy::High>();
 }
 
 // Since there is no scattering, medium interaction is never sampled in this type of medium.
-Spectrum AbsorptionMedium::Sample( const Ray& ray, const float max_t, MediumInteraction*& mi , Spectrum& emission ) const{
+Spectrum AbsorptionMedium::Sample( const Ray& ray, const float max_t, MediumInteraction& mi , Spectrum& emission ) const{
     return Tr( ray , max_t );
 }
\ No newline at end of file
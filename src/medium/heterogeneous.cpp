@@ -15,11 +15,12 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <cfloat>
+#include <algorithm>
 #include "heterogeneous.h"
 #include "core/rand.h"
-#include "core/memory.h"
 #include "material/material.h"
-#include "phasefunction.h"
+#include "core/mesh.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHeterogenous)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float3, base_color)
@@ -29,7 +30,261 @@ IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, scattering)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, anisotropy)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeHeterogenous)
 
+namespace {
+    // Walks through the cells of a regular grid in texture space along a ray front to back.
+    // 'A Fast Voxel Traversal Algorithm for Ray Tracing', John Amanatides and Andrew Woo
+    class GridWalker {
+    public:
+        GridWalker() = default;
+
+        // Only cells in [lo, hi) of each axis are walked through within [t0, t1) of the ray.
+        GridWalker(const Point& o, const Vector& d, const float scale[3], const unsigned lo[3], const unsigned hi[3],
+                   const unsigned width, const unsigned height, const float t0, const float t1) : m_width(width), m_height(height) {
+            // clip the ray against the cells
+            m_t = t0;
+            m_maxT = t1;
+            for (auto a = 0; a < 3; ++a) {
+                const auto g0 = lo[a] / scale[a], g1 = hi[a] / scale[a];
+                if (d[a] == 0.0f) {
+                    if (o[a] < g0 || o[a] > g1)
+                        m_maxT = -FLT_MAX;
+                    continue;
+                }
+                const auto s0 = (g0 - o[a]) / d[a];
+                const auto s1 = (g1 - o[a]) / d[a];
+                m_t = std::max(m_t, std::min(s0, s1));
+                m_maxT = std::min(m_maxT, std::max(s0, s1));
+            }
+            if (m_t >= m_maxT)
+                return;
+
+            for (auto a = 0; a < 3; ++a) {
+                const auto g = (o[a] + d[a] * m_t) * scale[a];
+                const auto gd = d[a] * scale[a];
+                m_cell[a] = clamp((int)g, (int)lo[a], (int)hi[a] - 1);
+                if (gd > 0.0f) {
+                    m_step[a] = 1;
+                    m_end[a] = (int)hi[a];
+                    m_nextT[a] = m_t + (m_cell[a] + 1 - g) / gd;
+                    m_deltaT[a] = 1.0f / gd;
+                } else if (gd < 0.0f) {
+                    m_step[a] = -1;
+                    m_end[a] = (int)lo[a] - 1;
+                    m_nextT[a] = m_t + (m_cell[a] - g) / gd;
+                    m_deltaT[a] = -1.0f / gd;
+                } else {
+                    m_step[a] = 0;
+                    m_end[a] = -1;
+                    m_nextT[a] = FLT_MAX;
+                    m_deltaT[a] = 0.0f;
+                }
+            }
+        }
+
+        // Step into the next cell along the ray, it returns false once the ray leaves the cells.
+        bool Next(float& t0, float& t1, unsigned& cell) {
+            if (m_t >= m_maxT)
+                return false;
+
+            const auto a = (m_nextT[0] < m_nextT[1]) ? (m_nextT[0] < m_nextT[2] ? 0 : 2) : (m_nextT[1] < m_nextT[2] ? 1 : 2);
+            t0 = m_t;
+            t1 = std::min(m_nextT[a], m_maxT);
+            cell = (m_cell[2] * m_height + m_cell[1]) * m_width + m_cell[0];
+
+            m_t = t1;
+            m_cell[a] += m_step[a];
+            m_nextT[a] += m_deltaT[a];
+            if (m_cell[a] == m_end[a])
+                m_maxT = m_t;
+            return true;
+        }
+
+    private:
+        unsigned    m_width = 0;
+        unsigned    m_height = 0;
+        float       m_t = 0.0f;     // where the ray enters the current cell
+        float       m_maxT = 0.0f;  // where the ray leaves the cells
+        int         m_cell[3];
+        int         m_step[3];
+        int         m_end[3];
+        float       m_nextT[3];
+        float       m_deltaT[3];
+    };
+
+    // Walks through the cells of a majorant grid along a ray front to back. The ray is clipped by the bounds of the
+    // occupied bricks first, then it only walks through the cells inside occupied bricks.
+    class MajorantWalker {
+    public:
+        MajorantWalker(const MediumMajorant& majorant, const Matrix& world2Volume, const Ray& ray, const float max_t) :
+            m_majorant(majorant), m_o(world2Volume.TransformPoint(ray.m_Ori)), m_d(world2Volume.TransformVector(ray.m_Dir)) {
+            // the transform is affine, the ray keeps the same parameterization in volume space
+            for (auto a = 0; a < 3; ++a)
+                m_brickScale[a] = majorant.m_scale[a] / MediumMajorant::OCCUPANCY_BRICK_SIZE;
+            m_bricks = GridWalker(m_o, m_d, m_brickScale, majorant.m_occupiedMin, majorant.m_occupiedMax,
+                                  majorant.m_brickCnt[0], majorant.m_brickCnt[1], 0.0f, max_t);
+        }
+
+        // Step into the next cell along the ray, it returns false once the ray leaves the occupied bricks.
+        bool Next(float& t0, float& t1, float& mu) {
+            unsigned c;
+            while (!m_cells.Next(t0, t1, c)) {
+                float b0, b1;
+                unsigned b;
+                do {
+                    if (!m_bricks.Next(b0, b1, b))
+                        return false;
+                } while (!m_majorant.m_occupied[b]);
+
+                const unsigned bx = b % m_majorant.m_brickCnt[0];
+                const unsigned by = (b / m_majorant.m_brickCnt[0]) % m_majorant.m_brickCnt[1];
+                const unsigned bz = b / (m_majorant.m_brickCnt[0] * m_majorant.m_brickCnt[1]);
+                const unsigned lo[3] = { bx * MediumMajorant::OCCUPANCY_BRICK_SIZE, by * MediumMajorant::OCCUPANCY_BRICK_SIZE, bz * MediumMajorant::OCCUPANCY_BRICK_SIZE };
+                const unsigned hi[3] = { std::min(lo[0] + MediumMajorant::OCCUPANCY_BRICK_SIZE, m_majorant.m_width),
+                                         std::min(lo[1] + MediumMajorant::OCCUPANCY_BRICK_SIZE, m_majorant.m_height),
+                                         std::min(lo[2] + MediumMajorant::OCCUPANCY_BRICK_SIZE, m_majorant.m_depth) };
+                m_cells = GridWalker(m_o, m_d, m_majorant.m_scale, lo, hi, m_majorant.m_width, m_majorant.m_height, b0, b1);
+            }
+            mu = m_majorant.m_value[c];
+            return true;
+        }
+
+    private:
+        const MediumMajorant&   m_majorant;
+        const Point             m_o;            // ray origin in texture space
+        const Vector            m_d;            // ray direction in texture space
+        float                   m_brickScale[3];
+        GridWalker              m_bricks;       // occupancy bricks along the ray
+        GridWalker              m_cells;        // cells in the current occupied brick
+    };
+
+    // Take tentative collisions along the ray at the rate of the majorant, tracking stops once 'collide' returns false.
+    // It returns whether the ray travels through the whole volume.
+    template<class Collide>
+    bool trackCollisions(MajorantWalker& walker, Collide collide) {
+        auto tau = -log(1.0f - sort_canonical());
+        float t0, t1, mu;
+        while (walker.Next(t0, t1, mu)) {
+            auto t = t0;
+            while (mu * (t1 - t) > tau) {
+                t += tau / mu;
+                if (!collide(t, mu))
+                    return false;
+                tau = -log(1.0f - sort_canonical());
+            }
+            tau -= mu * (t1 - t);
+        }
+        return true;
+    }
+
+    SORT_FORCEINLINE float averageMagnitude(const Spectrum& s) {
+        return (fabs(s[0]) + fabs(s[1]) + fabs(s[2])) / 3.0f;
+    }
+}
+
+HeterogenousMedium::HeterogenousMedium(const MaterialBase* material, const Mesh* mesh) :
+    Medium(WHITE_SPECTRUM, 0.0f, 0.0f, 0.0f, 0.0f, material), m_mesh(mesh), m_baked(mesh ? mesh->GetBakedMedium(material) : nullptr) {
+}
+
+void HeterogenousMedium::evaluateSample(const Point& p, MediumSample& ms) const {
+    if (m_baked) {
+        m_baked->Sample(m_mesh->GetWorldToVolume().TransformPoint(p), ms);
+        return;
+    }
+
+    MediumInteraction mi;
+    mi.intersect = p;
+    mi.mesh = m_mesh;
+    m_material->EvaluateMediumSample(mi, ms);
+}
+
+Spectrum HeterogenousMedium::Scattering(const Point& p, float& anisotropy) const {
+    MediumSample ms;
+    evaluateSample(p, ms);
+    anisotropy = ms.anisotropy;
+    return ms.basecolor * ms.scattering;
+}
+
 Spectrum HeterogenousMedium::Tr(const Ray& ray, const float max_t) const {
+    const auto majorant = m_mesh ? m_mesh->GetVolumeMajorant(m_material) : nullptr;
+    if (!majorant)
+        return trRayMarching(ray, max_t);
+
+    // Ratio tracking, every tentative collision attenuates the transmittance by the ratio of null collision.
+    // 'Residual Ratio Tracking for Estimating Attenuation in Participating Media', Jan Novak et al.
+    Spectrum tr(1.0f);
+    MajorantWalker walker(*majorant, m_mesh->GetWorldToVolume(), ray, max_t);
+    trackCollisions(walker, [&](const float t, const float mu) {
+        MediumSample ms;
+        evaluateSample(ray(t), ms);
+
+        tr *= 1.0f - ms.basecolor * ms.extinction / mu;
+
+        if (tr.IsBlack())
+            return false;
+
+        // russian roulette once there is little left to be attenuated
+        const auto m = tr.GetMaxComponent();
+        if (m > 0.0f && m < 0.1f) {
+            if (sort_canonical() >= m) {
+                tr = 0.0f;
+                return false;
+            }
+            tr /= m;
+        }
+        return true;
+    });
+    return tr;
+}
+
+Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInteraction& mi, Spectrum& emission) const {
+    const auto majorant = m_mesh ? m_mesh->GetVolumeMajorant(m_material) : nullptr;
+    if (!majorant)
+        return sampleRayMarching(ray, max_t, mi, emission);
+
+    // Spectral tracking with scattering and null collisions, absorption is accounted in the weight.
+    // 'Spectral and Decomposition Tracking for Rendering Heterogeneous Volumes', Peter Kutz et al.
+    // Probabilities of the collisions are the magnitude of the coefficients, so that it stays unbiased even if the
+    // majorant doesn't bound the extinction somewhere.
+    Spectrum weight(1.0f);
+    emission = 0.0f;
+    MajorantWalker walker(*majorant, m_mesh->GetWorldToVolume(), ray, max_t);
+    trackCollisions(walker, [&](const float t, const float mu) {
+        MediumSample ms;
+        evaluateSample(ray(t), ms);
+
+        const auto inv_mu = 1.0f / mu;
+        const auto scattering = ms.basecolor * ms.scattering;
+        const auto null_collision = mu - ms.basecolor * ms.extinction;
+
+        // This model is what is used in PBRT and different from 'Production Volume Rendering' by Disney.
+        emission += weight * ms.emission * ms.basecolor * ms.absorption * inv_mu;
+
+        const auto ps = averageMagnitude(weight * scattering);
+        const auto pn = averageMagnitude(weight * null_collision);
+        if (ps + pn <= 0.0f) {
+            weight = 0.0f;
+            return false;
+        }
+
+        if (sort_canonical() * (ps + pn) < ps) {
+            // sample a medium and scatter the ray
+            weight *= scattering * ((ps + pn) * inv_mu / ps);
+
+            mi.intersect = ray(t);
+            mi.scattered = true;
+            mi.anisotropy = ms.anisotropy;
+            return false;
+        }
+
+        weight *= null_collision * ((ps + pn) * inv_mu / pn);
+        return true;
+    });
+
+    // the ray either scatters in the medium or reaches the surface behind the volume with this weight.
+    return weight;
+}
+
+Spectrum HeterogenousMedium::trRayMarching(const Ray& ray, const float max_t) const {
     // get the step size and count
     auto        step_size = m_material->GetVolumeStep();
     const auto  step_cnt = m_material->GetVolumeStepCnt();
@@ -44,10 +299,7 @@ Spectrum HeterogenousMedium::Tr(const Ray& ray, const float max_t) const {
 
         // take a sample in the medium
         MediumSample ms;
-        MediumInteraction tmp_mi;
-        tmp_mi.intersect = ray(new_t);
-        tmp_mi.mesh = m_mesh;
-        m_material->EvaluateMediumSample(tmp_mi, ms);
+        evaluateSample(ray(new_t), ms);
 
         exponent -= ms.basecolor * ms.extinction * dt;
 
@@ -57,10 +309,10 @@ Spectrum HeterogenousMedium::Tr(const Ray& ray, const float max_t) const {
             break;
     }
 
-    return exponent.Exp();
+    return exponent.Exp<MathAccuracy::High>();
 }
 
-Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const {
+Spectrum HeterogenousMedium::sampleRayMarching(const Ray& ray, const float max_t, MediumInteraction& mi, Spectrum& emission) const {
     // Distance Sample, Jan Novak
     // https://cs.dartmouth.edu/~wjarosz/publications/novak18monte-slides-3-distance-sampling.pdf
 
@@ -87,26 +339,23 @@ Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInt
 
         // take a sample in the medium
         MediumSample ms;
-        MediumInteraction tmp_mi;
-        tmp_mi.intersect = ray(new_t);
-        tmp_mi.mesh = m_mesh;
-        m_material->EvaluateMediumSample(tmp_mi, ms);
+        evaluateSample(ray(new_t), ms);
 
         // beam transmittance along the ray through the short distance
         const auto extinction = ms.basecolor * ms.extinction;
         const auto exponent = -dt * extinction;
-        const auto beam_transmitancy = exponent.Exp();
+        const auto beam_transmitancy = exponent.Exp<MathAccuracy::High>();
 
         if (1.0f - r >= beam_transmitancy[ch]) {
             // sample a medium and scatter the ray
             const auto new_dt = -log(1.0f - r) / extinction[ch];
 
-            mi = SORT_MALLOC(MediumInteraction)();
-            mi->intersect = ray(t + new_dt);
-            mi->phaseFunction = SORT_MALLOC(HenyeyGreenstein)(ms.anisotropy);
+            mi.intersect = ray(t + new_dt);
+            mi.scattered = true;
+            mi.anisotropy = ms.anisotropy;
             
             const auto new_exponent = -new_dt * extinction;
-            const auto new_beam_transmitancy = new_exponent.Exp();
+            const auto new_beam_transmitancy = new_exponent.Exp<MathAccuracy::High>();
             accum_transmittance *= new_beam_transmitancy;
             const auto new_pdf = accum_transmittance * extinction;
             const auto pdf = (new_pdf[0] + new_pdf[1] + new_pdf[2]) / 3.0f;
@@ -20,6 +20,8 @@
 #include "core/define.h"
 #include "medium.h"
 
+class BakedMedium;
+
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeHeterogenous, "medium_heterogeneous")
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float3, base_color)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, emission)
@@ -46,8 +48,7 @@ public:
     //!
     //! @param material		Material that spawns the medium.
     //! @param mesh         Mesh that wraps the medium
-    HeterogenousMedium(const MaterialBase* material, const Mesh* mesh) :
-        Medium(WHITE_SPECTRUM, 0.0f, 0.0f, 0.0f, 0.0f, material), m_mesh(mesh){}
+    HeterogenousMedium(const MaterialBase* material, const Mesh* mesh);
 
     //! @brief  Evaluation of beam transmittance.
     //!
@@ -61,16 +62,46 @@ public:
 
     //! @brief  Importance sampling a point along the ray in the medium.
     //!
-    //! This is no way to use Delta-Tracking algorithm due to the lack of context of maximum density because
-    //! density is a shader driven property, there is no way to explictly evaluate the maximum value.
+    //! Collisions are tracked against the majorant grid of the volume data in the mesh, so that empty space is
+    //! skipped and the result is unbiased. Without volume data, it falls back to ray marching.
     //!
     //! @param ray          The ray we use to take sample.
     //! @param max_t        The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
-    //! @param mi           The interaction sampled.
+    //! @param mi           The interaction sampled, it is only marked as scattered if a scattering event is sampled in the medium.
     //! @param emission     The emission contribution in RTE.
     //! @return             The beam transmittance between the ray origin and the interaction.
-    Spectrum Sample(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const override;
+    Spectrum Sample(const Ray& ray, const float max_t, MediumInteraction& mi, Spectrum& emission) const override;
+
+    //! @brief  Evaluate the scattering coefficient at a point in the medium.
+    //!
+    //! @param  p           Position in world space.
+    //! @param  anisotropy  Anisotropy of the phase function at the point.
+    //! @return             The scattering coefficient of each spectrum channel.
+    Spectrum Scattering(const Point& p, float& anisotropy) const override;
 
 private:
-    const Mesh* m_mesh;
+    const Mesh*         m_mesh = nullptr;
+    const BakedMedium*  m_baked = nullptr;  /**< The volume shader baked into grids, nullptr if it is evaluated directly. */
+
+    //! @brief  Evaluate the medium at a position, it is looked up in the baked grids if there are any.
+    //!
+    //! @param  p           Position in world space.
+    //! @param  ms          The medium sample evaluated.
+    void evaluateSample(const Point& p, MediumSample& ms) const;
+
+    //! @brief  Evaluate beam transmittance by marching the ray with fixed steps.
+    //!
+    //! @param  ray         The ray, which it uses to evaluate beam transmittance.
+    //! @param  max_t       The maximum distance to be considered.
+    //! @return             The attenuation of each spectrum channel.
+    Spectrum trRayMarching(const Ray& ray, const float max_t) const;
+
+    //! @brief  Sample a point along the ray by marching the ray with fixed steps.
+    //!
+    //! @param ray          The ray we use to take sample.
+    //! @param max_t        The maximum distance to be considered.
+    //! @param mi           The interaction sampled, it is only marked as scattered if a scattering event is sampled in the medium.
+    //! @param emission     The emission contribution in RTE.
+    //! @return             The beam transmittance between the ray origin and the interaction.
+    Spectrum sampleRayMarching(const Ray& ray, const float max_t, MediumInteraction& mi, Spectrum& emission) const;
 };
\ No newline at end of file
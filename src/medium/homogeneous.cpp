@@ -17,8 +17,6 @@
 
 #include "homogeneous.h"
 #include "core/rand.h"
-#include "core/memory.h"
-#include "phasefunction.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHomogeneous)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float3, base_color)
@@ -30,10 +28,10 @@ IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeHomogeneous)
 
 Spectrum HomogeneousMedium::Tr( const Ray& ray , const float max_t ) const{
     const auto e = m_globalMediumSample.basecolor * m_globalMediumSample.extinction * (-fmin(max_t, FLT_MAX ));
-    return e.Exp();
+    return e.Exp<MathAccuracy::High>();
 }
 
-Spectrum HomogeneousMedium::Sample( const Ray& ray , const float max_t , MediumInteraction*& mi , Spectrum& emission ) const{
+Spectrum HomogeneousMedium::Sample( const Ray& ray , const float max_t , MediumInteraction& mi , Spectrum& emission ) const{
     const auto extinction = m_globalMediumSample.basecolor * m_globalMediumSample.extinction;
     const auto scattering = m_globalMediumSample.basecolor * m_globalMediumSample.scattering;
     const auto absorption = m_globalMediumSample.basecolor * m_globalMediumSample.absorption;
@@ -43,13 +41,13 @@ Spectrum HomogeneousMedium::Sample( const Ray& ray , const float max_t , MediumI
 
     const auto sample_medium = d < max_t;
     if (sample_medium) {
-        mi = SORT_MALLOC(MediumInteraction)();
-        mi->intersect = ray(d);
-        mi->phaseFunction = SORT_MALLOC(HenyeyGreenstein)(m_globalMediumSample.anisotropy);
+        mi.intersect = ray(d);
+        mi.scattered = true;
+        mi.anisotropy = m_globalMediumSample.anisotropy;
     }
 
     const auto e = extinction * (-fmin( d , FLT_MAX ));
-    const auto tr = e.Exp();
+    const auto tr = e.Exp<MathAccuracy::High>();
 
     const auto density = sample_medium ? (extinction * tr) : tr;
 
@@ -61,15 +61,22 @@ Spectrum MediumStack::Tr(const Ray& r, const float max_t) const {
     if (0 == m_mediumCnt)
         return 1.0f;
 
+    // no need to pick a medium randomly if there is only one of them.
+    if (1 == m_mediumCnt)
+        return m_mediums[0]->Tr(r, max_t);
+
     const auto k = clamp((int)(sort_canonical() * m_mediumCnt), 0, m_mediumCnt - 1);
     const Medium* medium = m_mediums[k];
     return medium->Tr(r, max_t) * m_mediumCnt;
 }
 
-Spectrum MediumStack::Sample(const Ray& r, const float max_t , MediumInteraction*& mi, Spectrum& emission) const {
+Spectrum MediumStack::Sample(const Ray& r, const float max_t , MediumInteraction& mi, Spectrum& emission) const {
     if (0 == m_mediumCnt)
         return 1.0f;
 
+    if (1 == m_mediumCnt)
+        return m_mediums[0]->Sample(r, max_t, mi, emission);
+
     const auto k = clamp((int)(sort_canonical() * m_mediumCnt), 0, m_mediumCnt - 1);
     const Medium* medium = m_mediums[k];
     return medium->Sample(r, max_t, mi, emission) * m_mediumCnt;
@@ -90,10 +90,22 @@ public:
     //!
     //! @param ray          The ray we use to take sample.
     //! @param  max_t       The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
-    //! @param mi           The interaction sampled.
+    //! @param mi           The interaction sampled, it is only marked as scattered if a scattering event is sampled in the medium.
     //! @param emission     The emission contribution in RTE.
     //! @return             The beam transmittance between the ray origin and the interaction.
-    virtual Spectrum Sample( const Ray& ray , const float max_t , MediumInteraction*& interaction, Spectrum& emission) const = 0;
+    virtual Spectrum Sample( const Ray& ray , const float max_t , MediumInteraction& interaction, Spectrum& emission) const = 0;
+
+    //! @brief  Evaluate the scattering coefficient at a point in the medium.
+    //!
+    //! This is for estimators picking points in the medium on their own, instead of sampling them along a ray.
+    //!
+    //! @param  p           Position in world space.
+    //! @param  anisotropy  Anisotropy of the phase function at the point.
+    //! @return             The scattering coefficient of each spectrum channel.
+    virtual Spectrum Scattering( const Point& p , float& anisotropy ) const {
+        anisotropy = m_globalMediumSample.anisotropy;
+        return m_globalMediumSample.basecolor * m_globalMediumSample.scattering;
+    }
 
 	//! @brief	Get the material that spawns the medium.
 	//!
@@ -142,6 +154,15 @@ public:
     //! @return             Whether the medium is removed. If the medium is not even in the container, it will return false.
     bool        RemoveMedium(const StringID medium_id);
 
+    //! @brief  Whether there is no medium in the data structure.
+    //!
+    //! Rays that never enter a medium, which is the case for most rays in most scenes, skip all volumetric work with this.
+    //!
+    //! @return             Whether the stack is empty.
+    SORT_FORCEINLINE bool IsEmpty() const {
+        return 0 == m_mediumCnt;
+    }
+
     //! @brief  Evaluate beam transmittance.
     //!
     //! @param  r           The ray along which the bema transmittance will be evaluated.
@@ -153,10 +174,10 @@ public:
     //!
     //! @param  r           The ray along which to take the sample.
     //! @param  max_t       The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
-    //! @param  mi          The medium interaction taken as a sample, null if no sample is taken in the medium.
+    //! @param  mi          The medium interaction taken as a sample, it is not marked as scattered if no sample is taken in the medium.
     //! @param  emission    The emission contribution in RTE.
     //! @return             Attenuation along the ray all the way to the sampled point.
-    Spectrum    Sample(const Ray& r, const float max_t, MediumInteraction*& mi, Spectrum& emission) const;
+    Spectrum    Sample(const Ray& r, const float max_t, MediumInteraction& mi, Spectrum& emission) const;
 
 public:
     /**< Mediums it holds. */
@@ -15,9 +15,56 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cfloat>
 #include "mediumdata.h"
+#include "medium.h"
 #include "math/point.h"
 #include "stream/stream.h"
+#include "core/stats.h"
+#include "task/task.h"
+
+SORT_STATS_DEFINE_MEMORY(sVolumeMemory)
+
+SORT_STATS_MEMORY("Volume Data", sVolumeMemory);
+
+void MediumMajorant::BuildOccupancy() {
+    const unsigned cnt[3] = { m_width , m_height , m_depth };
+    for (auto a = 0; a < 3; ++a) {
+        m_brickCnt[a] = (cnt[a] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE;
+        m_occupiedMin[a] = m_brickCnt[a];
+        m_occupiedMax[a] = 0;
+    }
+
+    m_occupied.assign(m_brickCnt[0] * m_brickCnt[1] * m_brickCnt[2], 0);
+    auto c = 0u;
+    for (auto z = 0u; z < m_depth; ++z) {
+        for (auto y = 0u; y < m_height; ++y) {
+            for (auto x = 0u; x < m_width; ++x, ++c) {
+                if (m_value[c] <= 0.0f)
+                    continue;
+
+                const unsigned b[3] = { x / OCCUPANCY_BRICK_SIZE , y / OCCUPANCY_BRICK_SIZE , z / OCCUPANCY_BRICK_SIZE };
+                m_occupied[(b[2] * m_brickCnt[1] + b[1]) * m_brickCnt[0] + b[0]] = 1;
+                for (auto a = 0; a < 3; ++a) {
+                    m_occupiedMin[a] = std::min(m_occupiedMin[a], b[a]);
+                    m_occupiedMax[a] = std::max(m_occupiedMax[a], b[a] + 1);
+                }
+            }
+        }
+    }
+
+    // nothing is occupied at all
+    for (auto a = 0; a < 3; ++a)
+        m_occupiedMin[a] = std::min(m_occupiedMin[a], m_occupiedMax[a]);
+}
+
+static std::atomic<unsigned long long> g_densityUid(0);
+
+MediumDensity::MediumDensity() : m_uid(++g_densityUid) {
+}
 
 float MediumDensity::Sample(const Point& uvw) const {
     return ImageTexture3D::Sample(uvw[0], uvw[1], uvw[2]);
@@ -32,9 +79,100 @@ void MediumDensity::Serialize(IStreamBase& stream) {
 
     const auto tex_cnt = m_width * m_height * m_depth;
 
-    m_memory = std::make_unique<ImgMemory<float>>();
-    m_memory->m_texel = std::make_unique<float[]>(tex_cnt);
-    stream.Load((char*)m_memory->m_texel.get(), sizeof(float) * tex_cnt);
+    // the dense grid only lives until empty bricks are elided.
+    std::vector<float> texels(tex_cnt);
+    stream.Load((char*)texels.data(), sizeof(float) * tex_cnt);
+    const auto bytes = setTexels(texels.data());
+
+    // Trilinear filtering inside a cell reaches one texel beyond it on each side, these texels bound the cell too.
+    const auto cell_w = (m_width + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+    const auto cell_h = (m_height + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+    const auto cell_d = (m_depth + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+    m_cellMax.resize(cell_w * cell_h * cell_d);
+    m_cellArgMax.resize(cell_w * cell_h * cell_d);
+    const auto texel_range = [](unsigned cell, unsigned cnt, unsigned& lo, unsigned& hi) {
+        lo = cell * MAJORANT_CELL_SIZE;
+        lo = lo > 0 ? lo - 1 : 0;
+        hi = std::min((cell + 1) * MAJORANT_CELL_SIZE + 1, cnt);
+    };
+    auto c = 0u;
+    for (auto cz = 0u; cz < cell_d; ++cz) {
+        unsigned z0, z1;
+        texel_range(cz, m_depth, z0, z1);
+        for (auto cy = 0u; cy < cell_h; ++cy) {
+            unsigned y0, y1;
+            texel_range(cy, m_height, y0, y1);
+            for (auto cx = 0u; cx < cell_w; ++cx, ++c) {
+                unsigned x0, x1;
+                texel_range(cx, m_width, x0, x1);
+
+                auto max_density = -FLT_MAX;
+                auto arg_max = 0u;
+                for (auto z = z0; z < z1; ++z) {
+                    for (auto y = y0; y < y1; ++y) {
+                        for (auto x = x0; x < x1; ++x) {
+                            const auto i = (z * m_height + y) * m_width + x;
+                            if (texels[i] > max_density) {
+                                max_density = texels[i];
+                                arg_max = i;
+                            }
+                        }
+                    }
+                }
+                m_cellMax[c] = max_density;
+                m_cellArgMax[c] = arg_max;
+            }
+        }
+    }
+
+    SORT_STATS(m_memoryRecord.Track(&sVolumeMemory, (StatsInt)(bytes + (sizeof(float) + sizeof(unsigned)) * m_cellMax.size())));
+}
+
+const MediumMajorant* MediumDensity::GetMajorant(const void* key, const std::function<float(const Point&)>& extinction) const {
+    if (m_cellMax.empty())
+        return nullptr;
+
+    // Rays in the same medium mostly come one after another, the last grid is remembered to avoid the lock.
+    static thread_local unsigned long long     last_density = 0;
+    static thread_local const void*            last_key = nullptr;
+    static thread_local const MediumMajorant*  last_majorant = nullptr;
+    if (last_density == m_uid && last_key == key)
+        return last_majorant;
+
+    std::lock_guard<std::mutex> lock(m_majorantMutex);
+    auto& majorant = m_majorants[key];
+    if (!majorant) {
+        majorant = std::make_unique<MediumMajorant>();
+        majorant->m_width = (m_width + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+        majorant->m_height = (m_height + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+        majorant->m_depth = (m_depth + MAJORANT_CELL_SIZE - 1) / MAJORANT_CELL_SIZE;
+        majorant->m_scale[0] = (float)m_width / MAJORANT_CELL_SIZE;
+        majorant->m_scale[1] = (float)m_height / MAJORANT_CELL_SIZE;
+        majorant->m_scale[2] = (float)m_depth / MAJORANT_CELL_SIZE;
+
+        // cells sharing the same maximum density, like the empty ones, share the evaluation too
+        std::unordered_map<float, float> evaluated;
+        majorant->m_value.resize(m_cellMax.size());
+        for (auto c = 0u; c < m_cellMax.size(); ++c) {
+            const auto it = evaluated.find(m_cellMax[c]);
+            if (it != evaluated.end()) {
+                majorant->m_value[c] = it->second;
+                continue;
+            }
+
+            // the center of a texel takes exactly its density
+            const auto i = m_cellArgMax[c];
+            const auto x = i % m_width, y = (i / m_width) % m_height, z = i / (m_width * m_height);
+            const Point uvw((x + 0.5f) / m_width, (y + 0.5f) / m_height, (z + 0.5f) / m_depth);
+            majorant->m_value[c] = evaluated[m_cellMax[c]] = std::max(0.0f, extinction(uvw));
+        }
+        majorant->BuildOccupancy();
+    }
+
+    last_density = m_uid;
+    last_key = key;
+    last_majorant = majorant.get();
+    return last_majorant;
 }
 
 Spectrum MediumColor::Sample(const Point& uvw) const {
@@ -46,4 +184,56 @@ Spectrum MediumColor::Sample(const Point& uvw) const {
 void MediumColor::Serialize(IStreamBase& stream) {
     // do nothing for now
     //stream >> m_width >> m_height >> m_depth;
-}
\ No newline at end of file
+}
+
+void BakedMedium::Bake(unsigned resolution, const std::function<void(const Point&, MediumSample&)>& evaluate) {
+    if (resolution == 0)
+        return;
+
+    // the dense grids only live until empty bricks are elided.
+    const auto slice_cnt = resolution * resolution;
+    const auto tex_cnt = (size_t)slice_cnt * resolution;
+    std::vector<Spectrum> basecolor(tex_cnt);
+    std::vector<float> emission(tex_cnt), absorption(tex_cnt), scattering(tex_cnt), anisotropy(tex_cnt);
+
+    const auto bake_slice = [&](unsigned z) {
+        for (auto y = 0u; y < resolution; ++y) {
+            for (auto x = 0u; x < resolution; ++x) {
+                const auto i = (size_t)z * slice_cnt + y * resolution + x;
+                const Point uvw((x + 0.5f) / resolution, (y + 0.5f) / resolution, (z + 0.5f) / resolution);
+
+                MediumSample ms;
+                evaluate(uvw, ms);
+                basecolor[i] = ms.basecolor;
+                emission[i] = ms.emission;
+                absorption[i] = ms.absorption;
+                scattering[i] = ms.scattering;
+                anisotropy[i] = ms.anisotropy;
+            }
+        }
+    };
+
+    if (IS_PTR_VALID(GetCurrentTask())) {
+        for (auto z = 0u; z < resolution; ++z)
+            SPAWN_TASK<Function_Task>("Baking Volume", DEFAULT_TASK_PRIORITY, {}, [&bake_slice, z]() { bake_slice(z); });
+        WAIT_FOR_CHILDREN();
+    } else {
+        for (auto z = 0u; z < resolution; ++z)
+            bake_slice(z);
+    }
+
+    auto bytes = m_basecolor.Build(resolution, basecolor.data());
+    bytes += m_emission.Build(resolution, emission.data());
+    bytes += m_absorption.Build(resolution, absorption.data());
+    bytes += m_scattering.Build(resolution, scattering.data());
+    bytes += m_anisotropy.Build(resolution, anisotropy.data());
+
+    SORT_STATS(m_memoryRecord.Track(&sVolumeMemory, (StatsInt)bytes));
+}
+
+void BakedMedium::Sample(const Point& uvw, MediumSample& ms) const {
+    // the scalar grids take the SIMD path of trilinear filtering
+    ms = MediumSample(m_basecolor.Sample(uvw[0], uvw[1], uvw[2]), m_emission.Sample(uvw[0], uvw[1], uvw[2]),
+                      m_absorption.Sample(uvw[0], uvw[1], uvw[2]), m_scattering.Sample(uvw[0], uvw[1], uvw[2]),
+                      m_anisotropy.Sample(uvw[0], uvw[1], uvw[2]));
+}
@@ -17,18 +17,56 @@
 
 #pragma once
 
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
 #include "core/define.h"
 #include "texture/imagetexture3d.h"
+#include "core/stats.h"
 
 struct Point;
+struct MediumSample;
 class IStreamBase;
 
+//! @brief  A coarse grid bounding the extinction coefficient of a medium.
+/**
+ * Each cell covers a brick of texels of the medium density. Delta tracking and ratio tracking take tentative
+ * collisions at the rate of the majorant of the cell the ray travels through, cells with zero majorant are
+ * skipped entirely.
+ *
+ * Cells are further grouped in occupancy bricks. Rays only walk through the cells of occupied bricks, and never
+ * get into the volume outside the bricks bounding all the occupied ones, like the empty space around a plume of
+ * smoke in its bounding mesh.
+ */
+struct MediumMajorant {
+    //! @brief  Number of cells along each axis of an occupancy brick.
+    static constexpr unsigned OCCUPANCY_BRICK_SIZE = 4;
+
+    unsigned            m_width = 0;    /**< Number of cells along X axis. */
+    unsigned            m_height = 0;   /**< Number of cells along Y axis. */
+    unsigned            m_depth = 0;    /**< Number of cells along Z axis. */
+    float               m_scale[3];     /**< Scale from texture coordinate to cell coordinate of each axis. */
+    std::vector<float>  m_value;        /**< Majorant of the extinction coefficient of each cell. */
+
+    unsigned            m_brickCnt[3] = { 0u , 0u , 0u };      /**< Number of occupancy bricks along each axis. */
+    unsigned            m_occupiedMin[3] = { 0u , 0u , 0u };   /**< First occupied brick along each axis. */
+    unsigned            m_occupiedMax[3] = { 0u , 0u , 0u };   /**< One past the last occupied brick along each axis. */
+    std::vector<unsigned char>  m_occupied;                     /**< Whether any cell in each brick has non-zero majorant. */
+
+    //! @brief  Group cells with non-zero majorant in occupancy bricks, it is called once the majorants are evaluated.
+    void    BuildOccupancy();
+};
+
 //! @brief  Medium density data structure allows variation of density inside a medium volume.
 /**
  * Medium density is essentially a 3D texture.
  */
 class MediumDensity : public ImageTexture3D<float> {
 public:
+    //! @brief  Default constructor.
+    MediumDensity();
+
     //! @brief  Take a sample in 3D texture.
     //!
     //! @param  uvw     Texture coordinate in volume space.
@@ -40,6 +78,31 @@ public:
     //! @param  Stream  where the serialization data comes from. Depending on different situation,
     //!                 it could come from different places.
     void    Serialize(IStreamBase& stream);
+
+    //! @brief  Get the majorant grid of the medium made of this density.
+    //!
+    //! The grid is built the first time it is requested for a material. Each cell evaluates the extinction at the
+    //! densest texel the cell could interpolate, which bounds the cell as long as the extinction is driven by the
+    //! density and doesn't drop when density goes up.
+    //!
+    //! @param  key         Identifies the medium, usually the material that turns density into extinction.
+    //! @param  extinction  Evaluates the maximum extinction coefficient of all channels at a texture coordinate.
+    //! @return             The majorant grid, nullptr if there is no density data at all.
+    const MediumMajorant* GetMajorant(const void* key, const std::function<float(const Point&)>& extinction) const;
+
+    //! @brief  Number of texels along each axis of a majorant cell.
+    static constexpr unsigned MAJORANT_CELL_SIZE = BRICK_SIZE;
+
+private:
+    const unsigned long long m_uid;         /**< Unique id of the density, addresses could be reused after reloading. */
+    std::vector<float>      m_cellMax;      /**< Maximum density each majorant cell could interpolate. */
+    std::vector<unsigned>   m_cellArgMax;   /**< Texel holding the maximum density of each majorant cell. */
+
+    mutable std::mutex      m_majorantMutex;    /**< Guards building majorant grids. */
+    mutable std::unordered_map<const void*, std::unique_ptr<MediumMajorant>> m_majorants; /**< Majorant grids built so far. */
+
+    /**< Memory of the density data accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
 };
 
 //! @brief  Medium color data structure allows variation of color inside a medium volume.
@@ -56,4 +119,52 @@ public:
     //! @param  Stream  where the serialization data comes from. Depending on different situation,
     //!                 it could come from different places.
     void    Serialize(IStreamBase& stream);
+};
+
+//! @brief  A volume shader baked into grids covering the volume data of a mesh.
+/**
+ * Procedural volume shaders are evaluated at every tentative collision, which is where most of the time goes in
+ * rendering smoke. Baking them once before rendering replaces the evaluations with trilinear lookups. Like the
+ * density, each grid is stored sparsely, the empty space around a plume of smoke mostly ends up in elided bricks.
+ */
+class BakedMedium {
+public:
+    //! @brief  Evaluate the volume shader at the center of every texel.
+    //!
+    //! Slices along Z axis are evaluated in parallel if it is called in a task.
+    //!
+    //! @param  resolution  Number of texels along each axis.
+    //! @param  evaluate    Evaluates the volume shader at a texture coordinate.
+    void    Bake(unsigned resolution, const std::function<void(const Point&, MediumSample&)>& evaluate);
+
+    //! @brief  Take a sample of the baked volume shader.
+    //!
+    //! @param  uvw     Texture coordinate in volume space.
+    //! @param  ms      The medium sample interpolated from the grids, it is empty outside the volume.
+    void    Sample(const Point& uvw, MediumSample& ms) const;
+
+private:
+    //! @brief  A 3D texture filled with the baked texels.
+    template<class T>
+    class Grid : public ImageTexture3D<T> {
+    public:
+        //! @brief  Build the sparse storage from dense texels.
+        //!
+        //! @param  resolution  Number of texels along each axis.
+        //! @param  texels      Texels of the whole volume, X varies the fastest, Z the slowest.
+        //! @return             Bytes taken by the sparse storage.
+        size_t  Build(unsigned resolution, const T* texels) {
+            this->m_width = this->m_height = this->m_depth = resolution;
+            return this->setTexels(texels);
+        }
+    };
+
+    Grid<Spectrum>  m_basecolor;    /**< Base color of the medium. */
+    Grid<float>     m_emission;     /**< Emission coefficient. */
+    Grid<float>     m_absorption;   /**< Absorption coefficient. */
+    Grid<float>     m_scattering;   /**< Scattering coefficient. */
+    Grid<float>     m_anisotropy;   /**< Anisotropy of the phase function. */
+
+    /**< Memory of the baked grids accounted in stats. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)
 };
\ No newline at end of file
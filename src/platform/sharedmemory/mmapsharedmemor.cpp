@@ -27,18 +27,34 @@
 #include "core/log.h"
 
 void MmapSharedMemory::CreateSharedMemory( const std::string& name , int size , unsigned type ){
-    fd = open(name.c_str(), O_RDWR , 0 );
-    if( fd == -1 )
-    {
-        slog( WARNING , GENERAL , "Failed to load shared memory file %s " , name.c_str() );
-        return;
+    const auto writable = ( type & ( SharedMemory_Write | SharedMemory_Create ) ) != 0;
+    if( type & SharedMemory_Create ){
+        fd = open(name.c_str(), O_RDWR | O_CREAT | O_EXCL , 0644 );
+        if( fd == -1 )
+            return;
+
+        // the file is as large as the shared memory
+        if( ftruncate( fd , size ) != 0 ){
+            close(fd);
+            fd = -1;
+            unlink(name.c_str());
+            return;
+        }
+    }else{
+        fd = open(name.c_str(), writable ? O_RDWR : O_RDONLY , 0 );
+        if( fd == -1 )
+        {
+            if( !( type & SharedMemory_Optional ) )
+                slog( WARNING , GENERAL , "Failed to load shared memory file %s " , name.c_str() );
+            return;
+        }
     }
 
     // map a new file
-    sharedmemory.bytes = (char*)mmap(0, size, PROT_READ|PROT_WRITE, MAP_FILE|MAP_SHARED, fd, 0);
+    sharedmemory.bytes = (char*)mmap(0, size, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_FILE|MAP_SHARED, fd, 0);
     if( sharedmemory.bytes == MAP_FAILED)
         sharedmemory.bytes = 0;
-    sharedmemory.size = size;
+    sharedmemory.size = sharedmemory.bytes ? size : 0;
 }
 
 // Release share memory resource
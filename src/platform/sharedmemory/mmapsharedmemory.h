@@ -35,7 +35,7 @@ public:
 
 // platform dependent fields, still invisible from others
 private:
-    int fd;
+    int fd = -1;
 };
 
 #endif
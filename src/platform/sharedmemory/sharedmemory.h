@@ -22,6 +22,8 @@
 #define SharedMemory_Read 0x01
 #define SharedMemory_Write 0x02
 #define SharedMmeory_All ( SharedMemory_Read | SharedMemory_Write )
+#define SharedMemory_Create 0x04    // create a new shared memory, it fails if there is one with the same name already
+#define SharedMemory_Optional 0x08  // it is not reported if there is no shared memory with the name
 
 struct SharedMemory
 {
@@ -23,19 +23,40 @@
 #include "core/log.h"
 
 void WinSharedMemory::CreateSharedMemory( const std::string& name , int size , unsigned type ){
-    hMapFile = OpenFileMapping(
-        FILE_MAP_ALL_ACCESS,    // read/write access
-        FALSE,                  // do not inherit the name
-        name.c_str());      // name of mapping object
+    const auto writable = ( type & ( SharedMemory_Write | SharedMemory_Create ) ) != 0;
+    if( type & SharedMemory_Create ){
+        // the mapping is backed by the paging file, it is gone once the last handle to it is closed
+        hMapFile = CreateFileMapping(
+            INVALID_HANDLE_VALUE,   // backed by the paging file
+            NULL,                   // default security
+            PAGE_READWRITE,         // read/write access
+            0,                      // high-order size
+            (DWORD)size,            // low-order size
+            name.c_str());          // name of mapping object
 
-    if (hMapFile == NULL)
-    {
-        slog( WARNING , MATERIAL , "Creating shared memory failed %s" , name.c_str() );
-        return;
+        if (hMapFile != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+        {
+            CloseHandle(hMapFile);
+            hMapFile = NULL;
+        }
+        if (hMapFile == NULL)
+            return;
+    }else{
+        hMapFile = OpenFileMapping(
+            writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,    // read/write access
+            FALSE,                  // do not inherit the name
+            name.c_str());      // name of mapping object
+
+        if (hMapFile == NULL)
+        {
+            if( !( type & SharedMemory_Optional ) )
+                slog( WARNING , MATERIAL , "Creating shared memory failed %s" , name.c_str() );
+            return;
+        }
     }
     sharedmemory.size = size;
     sharedmemory.bytes = (char*)MapViewOfFile(hMapFile,   // handle to map object
-        FILE_MAP_WRITE, // read/write permission
+        writable ? FILE_MAP_WRITE : FILE_MAP_READ, // read/write permission
         0,
         0,
         size);
@@ -44,6 +65,7 @@ void WinSharedMemory::CreateSharedMemory( const std::string& name , int size , u
     {
         sharedmemory.size = 0;
         CloseHandle(hMapFile);
+        hMapFile = NULL;
         slog( WARNING , MATERIAL ,  "Creating shared memory failed %s" , name.c_str() );
     }
 }
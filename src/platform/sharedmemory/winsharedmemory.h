@@ -35,7 +35,7 @@ public:
     SharedMemory    sharedmemory;
 
 private:
-    HANDLE  hMapFile;
+    HANDLE  hMapFile = NULL;
 };
 
 #endif
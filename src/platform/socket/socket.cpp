@@ -0,0 +1,221 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string.h>
+#include <mutex>
+#include "socket.h"
+#include "core/log.h"
+
+#if defined(SORT_IN_WINDOWS)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef SOCKET  SocketHandle;
+    typedef int     socklen_t;
+    #define SORT_CLOSE_SOCKET   closesocket
+    #define SORT_SEND_FLAGS     0
+#else
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+    #include <unistd.h>
+    typedef int     SocketHandle;
+    #define SORT_CLOSE_SOCKET   close
+    // Writing to a lost connection shouldn't kill the process with SIGPIPE.
+    #if defined(SORT_IN_LINUX)
+        #define SORT_SEND_FLAGS     MSG_NOSIGNAL
+    #else
+        #define SORT_SEND_FLAGS     0
+    #endif
+#endif
+
+namespace {
+    // Winsock needs to be initialized once before any socket is created, it is never cleaned up since sockets could
+    // be alive until the process exits.
+    void initSocketLibrary(){
+#if defined(SORT_IN_WINDOWS)
+        static std::once_flag flag;
+        std::call_once( flag , [](){
+            WSADATA data;
+            if( 0 != WSAStartup( MAKEWORD( 2 , 2 ) , &data ) )
+                slog( WARNING , GENERAL , "Failed to initialize Winsock." );
+        } );
+#endif
+    }
+
+    // Tiles are sent in small messages, they shouldn't wait for more data to fill a packet. Lost nodes are detected
+    // by keep-alive probes even if there is no message for a long time.
+    void setupConnection( SocketHandle s ){
+        int flag = 1;
+        setsockopt( s , IPPROTO_TCP , TCP_NODELAY , (const char*)&flag , sizeof( flag ) );
+        setsockopt( s , SOL_SOCKET , SO_KEEPALIVE , (const char*)&flag , sizeof( flag ) );
+#if defined(SORT_IN_MAC)
+        setsockopt( s , SOL_SOCKET , SO_NOSIGPIPE , (const char*)&flag , sizeof( flag ) );
+#endif
+    }
+}
+
+Socket::~Socket(){
+    Close();
+}
+
+bool Socket::IsValid() const{
+    return -1 != m_socket && !m_lost;
+}
+
+void Socket::Close(){
+    m_lost = false;
+    if( -1 == m_socket )
+        return;
+    SORT_CLOSE_SOCKET( (SocketHandle)m_socket );
+    m_socket = -1;
+}
+
+void Socket::Shutdown(){
+#if defined(SORT_IN_WINDOWS)
+    shutdown( (SocketHandle)m_socket , SD_BOTH );
+#else
+    shutdown( (SocketHandle)m_socket , SHUT_RDWR );
+#endif
+}
+
+bool Socket::Listen( unsigned short port ){
+    initSocketLibrary();
+    Close();
+
+    m_socket = (std::intptr_t)socket( AF_INET , SOCK_STREAM , IPPROTO_TCP );
+    if( !IsValid() )
+        return false;
+
+    // the port could be reused right after the previous coordinator exits
+    int flag = 1;
+    const auto s = (SocketHandle)m_socket;
+    setsockopt( s , SOL_SOCKET , SO_REUSEADDR , (const char*)&flag , sizeof( flag ) );
+
+    sockaddr_in addr;
+    memset( &addr , 0 , sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_ANY );
+    addr.sin_port = htons( port );
+    if( 0 != bind( s , (const sockaddr*)&addr , sizeof( addr ) ) || 0 != listen( s , SOMAXCONN ) ){
+        slog( WARNING , GENERAL , "Failed to listen on port %d." , port );
+        Close();
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<Socket> Socket::Accept( int timeoutMS ){
+    if( !IsValid() )
+        return nullptr;
+
+    const auto listener = (SocketHandle)m_socket;
+    fd_set fds;
+    FD_ZERO( &fds );
+    FD_SET( listener , &fds );
+    timeval timeout;
+    timeout.tv_sec = timeoutMS / 1000;
+    timeout.tv_usec = ( timeoutMS % 1000 ) * 1000;
+    if( select( (int)listener + 1 , &fds , nullptr , nullptr , &timeout ) <= 0 )
+        return nullptr;
+
+    sockaddr_in addr;
+    socklen_t len = sizeof( addr );
+    const auto s = (std::intptr_t)accept( listener , (sockaddr*)&addr , &len );
+    if( -1 == s )
+        return nullptr;
+
+    setupConnection( (SocketHandle)s );
+    auto ret = std::make_unique<Socket>();
+    ret->m_socket = s;
+    return ret;
+}
+
+bool Socket::Connect( const std::string& host , unsigned short port ){
+    initSocketLibrary();
+    Close();
+
+    addrinfo hints;
+    memset( &hints , 0 , sizeof( hints ) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* result = nullptr;
+    if( 0 != getaddrinfo( host.c_str() , std::to_string( port ).c_str() , &hints , &result ) ){
+        slog( WARNING , GENERAL , "Failed to resolve host %s." , host.c_str() );
+        return false;
+    }
+
+    for( auto it = result ; it ; it = it->ai_next ){
+        m_socket = (std::intptr_t)socket( it->ai_family , it->ai_socktype , it->ai_protocol );
+        if( !IsValid() )
+            continue;
+        if( 0 == connect( (SocketHandle)m_socket , it->ai_addr , (socklen_t)it->ai_addrlen ) )
+            break;
+        Close();
+    }
+    freeaddrinfo( result );
+
+    if( !IsValid() ){
+        slog( WARNING , GENERAL , "Failed to connect to %s:%d." , host.c_str() , port );
+        return false;
+    }
+
+    setupConnection( (SocketHandle)m_socket );
+    return true;
+}
+
+bool Socket::Send( const char* data , int size ){
+    while( size > 0 && IsValid() ){
+        const auto sent = (int)send( (SocketHandle)m_socket , data , size , SORT_SEND_FLAGS );
+        if( sent <= 0 ){
+            m_lost = true;
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return IsValid();
+}
+
+int Socket::Receive( char* data , int size ){
+    if( !IsValid() )
+        return 0;
+
+    const auto received = (int)recv( (SocketHandle)m_socket , data , size , 0 );
+    if( received <= 0 ){
+        m_lost = true;
+        return 0;
+    }
+    return received;
+}
+
+bool Socket::WaitForData( int timeoutMS ) const{
+    if( !IsValid() )
+        return true;
+
+    const auto s = (SocketHandle)m_socket;
+    fd_set fds;
+    FD_ZERO( &fds );
+    FD_SET( s , &fds );
+    timeval timeout;
+    timeout.tv_sec = timeoutMS / 1000;
+    timeout.tv_usec = ( timeoutMS % 1000 ) * 1000;
+    return 0 != select( (int)s + 1 , &fds , nullptr , nullptr , &timeout );
+}
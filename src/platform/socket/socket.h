@@ -0,0 +1,104 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "core/define.h"
+
+//! @brief  A blocking TCP socket.
+/**
+ * Socket is a thin wrapper of the platform socket API, Winsock on Windows and BSD sockets on the others. It is used by
+ * distributed rendering, where a coordinator hands out tiles to worker nodes, and by the render server, which renders
+ * jobs sent by its clients. A socket is either listening
+ * for connections or connected to another node, all data transfers block until they are done or the connection is
+ * lost. It is not thread safe, each thread talking to another node owns its own socket.
+ */
+class Socket{
+public:
+    //! @brief  Constructor of an invalid socket.
+    Socket() = default;
+
+    //! @brief  Destructor closes the socket.
+    ~Socket();
+
+    //! @brief  Sockets can't be copied.
+    Socket( const Socket& ) = delete;
+    Socket& operator = ( const Socket& ) = delete;
+
+    //! @brief  Listen for connections on a port of all network interfaces.
+    //!
+    //! @param  port        Port to listen on.
+    //! @return             Whether the socket is listening.
+    bool    Listen( unsigned short port );
+
+    //! @brief  Accept a connection from another node.
+    //!
+    //! @param  timeoutMS   Milliseconds to wait for a connection.
+    //! @return             The connected socket, nullptr if there is no connection in time.
+    std::unique_ptr<Socket> Accept( int timeoutMS );
+
+    //! @brief  Connect to a node listening on a port.
+    //!
+    //! @param  host        Host name or IP address of the node.
+    //! @param  port        Port the node listens on.
+    //! @return             Whether the socket is connected.
+    bool    Connect( const std::string& host , unsigned short port );
+
+    //! @brief  Send data to the connected node.
+    //!
+    //! @param  data        Data to be sent.
+    //! @param  size        Size of the data in bytes.
+    //! @return             Whether all data is sent, the connection is lost otherwise.
+    bool    Send( const char* data , int size );
+
+    //! @brief  Receive data from the connected node.
+    //!
+    //! @param  data        Buffer to be filled.
+    //! @param  size        Size of the buffer in bytes.
+    //! @return             Number of bytes received, at least one byte is received unless the connection is lost,
+    //!                     in which case 0 is returned.
+    int     Receive( char* data , int size );
+
+    //! @brief  Wait for data from the connected node without receiving it.
+    //!
+    //! @param  timeoutMS   Milliseconds to wait for data.
+    //! @return             Whether there is data to be received in time, or the connection is lost, in which case
+    //!                     receiving data returns right away too.
+    bool    WaitForData( int timeoutMS ) const;
+
+    //! @brief  Close the socket, the connected node will find the connection lost.
+    void    Close();
+
+    //! @brief  Shut down the connection without closing the socket.
+    //!
+    //! Unlike the others, this could be called from another thread, a thread blocked in sending or receiving data
+    //! through the socket returns right away as if the connection is lost. Since a lost connection doesn't close the
+    //! socket, the handle stays the same until the thread owning the socket closes or destroys it.
+    void    Shutdown();
+
+    //! @brief  Whether the socket is listening or connected.
+    //!
+    //! @return             False if the socket is closed or it fails to listen or connect.
+    bool    IsValid() const;
+
+private:
+    std::intptr_t   m_socket = -1;      /**< Platform handle of the socket, -1 is invalid on all platforms. */
+    bool            m_lost = false;     /**< Whether the connection is lost, the handle is kept open until it is closed. */
+};
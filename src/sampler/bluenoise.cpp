@@ -0,0 +1,159 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "bluenoise.h"
+
+namespace {
+    constexpr int N = BLUE_NOISE_TILE_SIZE;
+    constexpr int TEXEL_CNT = N * N;
+
+    // Standard deviation of the gaussian filter measuring how clustered the texels are.
+    constexpr float SIGMA = 1.5f;
+
+    SORT_FORCEINLINE unsigned hash( unsigned x ){
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    class VoidAndCluster{
+    public:
+        VoidAndCluster() : m_kernel( TEXEL_CNT ) , m_energy( TEXEL_CNT , 0.0f ) , m_on( TEXEL_CNT , false ){
+            for( auto y = 0 ; y < N ; ++y ){
+                for( auto x = 0 ; x < N ; ++x ){
+                    const auto dx = std::min( x , N - x ) , dy = std::min( y , N - y );
+                    m_kernel[y * N + x] = std::exp( -(float)( dx * dx + dy * dy ) / ( 2.0f * SIGMA * SIGMA ) );
+                }
+            }
+        }
+
+        //! @brief  Rank all texels, the rank of a texel is the order it is turned on.
+        std::vector<int> Rank(){
+            // A tenth of the texels randomly turned on, then spread evenly by moving the texel in the tightest
+            // cluster to the largest void, until that moves the same texel.
+            const auto initial_cnt = TEXEL_CNT / 10;
+            auto cnt = 0;
+            for( auto i = 0u ; cnt < initial_cnt ; ++i ){
+                const auto t = (int)( hash( i ) % TEXEL_CNT );
+                if( !m_on[t] ){
+                    toggle( t );
+                    ++cnt;
+                }
+            }
+            while( true ){
+                const auto cluster = tightestCluster();
+                toggle( cluster );
+                const auto void_texel = largestVoid();
+                toggle( void_texel );
+                if( void_texel == cluster )
+                    break;
+            }
+
+            // Texels of the initial pattern are ranked by turning them off from the tightest cluster, the rest are
+            // ranked by turning them on in the largest void.
+            std::vector<int> rank( TEXEL_CNT );
+            const auto initial_on = m_on;
+            const auto initial_energy = m_energy;
+            for( auto r = initial_cnt - 1 ; r >= 0 ; --r ){
+                const auto t = tightestCluster();
+                toggle( t );
+                rank[t] = r;
+            }
+            m_on = initial_on;
+            m_energy = initial_energy;
+            for( auto r = initial_cnt ; r < TEXEL_CNT ; ++r ){
+                const auto t = largestVoid();
+                toggle( t );
+                rank[t] = r;
+            }
+            return rank;
+        }
+
+    private:
+        std::vector<float>  m_kernel;   /**< Gaussian filter on the torus, indexed by the offset between texels. */
+        std::vector<float>  m_energy;   /**< Filtered texels that are on. */
+        std::vector<bool>   m_on;       /**< Whether each texel is on. */
+
+        void toggle( const int t ){
+            m_on[t] = !m_on[t];
+            const auto sign = m_on[t] ? 1.0f : -1.0f;
+            const auto tx = t % N , ty = t / N;
+            for( auto y = 0 ; y < N ; ++y ){
+                const auto row = ( ( y - ty + N ) % N ) * N;
+                for( auto x = 0 ; x < N ; ++x )
+                    m_energy[y * N + x] += sign * m_kernel[row + ( x - tx + N ) % N];
+            }
+        }
+
+        int tightestCluster() const{
+            auto ret = -1;
+            for( auto t = 0 ; t < TEXEL_CNT ; ++t ){
+                if( m_on[t] && ( ret < 0 || m_energy[t] > m_energy[ret] ) )
+                    ret = t;
+            }
+            return ret;
+        }
+
+        int largestVoid() const{
+            auto ret = -1;
+            for( auto t = 0 ; t < TEXEL_CNT ; ++t ){
+                if( !m_on[t] && ( ret < 0 || m_energy[t] < m_energy[ret] ) )
+                    ret = t;
+            }
+            return ret;
+        }
+    };
+
+    // The texture is only made once, the first time it is needed.
+    const std::vector<float>& blueNoiseTile(){
+        static const std::vector<float> tile = [](){
+            const auto rank = VoidAndCluster().Rank();
+            std::vector<float> ret( TEXEL_CNT );
+            for( auto t = 0 ; t < TEXEL_CNT ; ++t )
+                ret[t] = ( rank[t] + 0.5f ) / TEXEL_CNT;
+            return ret;
+        }();
+        return tile;
+    }
+
+    SORT_FORCEINLINE float rotate( const float x , const float offset ){
+        const auto ret = x + offset;
+        return ret >= 1.0f ? ret - 1.0f : ret;
+    }
+}
+
+float BlueNoise( int x , int y ){
+    x &= N - 1;
+    y &= N - 1;
+    return blueNoiseTile()[y * N + x];
+}
+
+void BlueNoiseSampler::sample( unsigned index , unsigned dimension , float& u , float& v ) const{
+    // the same sequence for all pixels, the sequence is still scrambled so that pairs of dimensions are decorrelated.
+    SobolSample2D( index , dimension , 0 , u , v );
+
+    // Dimensions take the tile at different offsets, so that samples of different dimensions of a pixel are not correlated.
+    const auto hu = hash( 2 * dimension + 1 ) , hv = hash( 2 * dimension + 2 );
+    u = rotate( u , BlueNoise( m_x + (int)( hu & 0xffff ) , m_y + (int)( hu >> 16 ) ) );
+    v = rotate( v , BlueNoise( m_x + (int)( hv & 0xffff ) , m_y + (int)( hv >> 16 ) ) );
+}
@@ -0,0 +1,56 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sobol.h"
+
+//! @brief  Size of the tiled blue noise texture.
+constexpr int BLUE_NOISE_TILE_SIZE = 64;
+
+//! @brief  Look up the tiled blue noise texture.
+//!
+//! The texture is made with the void-and-cluster method the first time it is needed, every value in [0,1) is
+//! taken by exactly one of its texels, neighbouring texels have very different values.
+//! 'The void-and-cluster method for dither array generation', Robert Ulichney.
+//!
+//! @param  x           X coordinate of the texel, it wraps around the tile.
+//! @param  y           Y coordinate of the texel, it wraps around the tile.
+//! @return             The value of the texel, in [0,1).
+float BlueNoise( int x , int y );
+
+//! @brief  Sampler distributing errors of pixels as blue noise in screen space.
+/**
+ * All pixels share the same Owen-scrambled Sobol sequence, each pixel rotates it toroidally by the values of the
+ * blue noise texture at the pixel, the texture is shifted differently for each dimension. Neighbouring pixels then
+ * take very different samples of each dimension, which pushes the error of the image to high frequencies that are
+ * much less visible at low sample counts, like in previews.
+ * 'Blue-noise Dithered Sampling', Iliyan Georgiev and Marcos Fajardo.
+ */
+class BlueNoiseSampler : public SobolSampler{
+public:
+    DEFINE_RTTI( BlueNoiseSampler , Sampler );
+
+protected:
+    //! @brief  Take a sample of a pair of dimensions of the current pixel.
+    //!
+    //! @param  index       Index of the sample in the pixel.
+    //! @param  dimension   Index of the pair of dimensions.
+    //! @param  u           The sample of the first dimension of the pair.
+    //! @param  v           The sample of the second dimension of the pair.
+    void sample( unsigned index , unsigned dimension , float& u , float& v ) const override;
+};
@@ -0,0 +1,104 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "cmj.h"
+#include "core/globalconfig.h"
+
+namespace {
+    // Permute 'i' in [0,l) with the permutation picked by 'p', it takes a few rounds of a hash with cycle walking
+    // to land in range.
+    SORT_FORCEINLINE unsigned permute( unsigned i , const unsigned l , const unsigned p ){
+        auto w = l - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do{
+            i ^= p;
+            i *= 0xe170893du;
+            i ^= p >> 16;
+            i ^= ( i & w ) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3fu;
+            i ^= p >> 23;
+            i ^= ( i & w ) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69u;
+            i ^= ( i & w ) >> 11;
+            i *= 0x74dcb303u;
+            i ^= ( i & w ) >> 2;
+            i *= 0x9e501cc3u;
+            i ^= ( i & w ) >> 2;
+            i *= 0xc860a3dfu;
+            i &= w;
+            i ^= i >> 5;
+        }while( i >= l );
+        return ( i + p ) % l;
+    }
+
+    // A random number in [0,1) picked by 'i' and 'p'.
+    SORT_FORCEINLINE float randFloat( unsigned i , const unsigned p ){
+        i ^= p;
+        i ^= i >> 17;
+        i ^= i >> 10;
+        i *= 0xb36534e5u;
+        i ^= i >> 12;
+        i ^= i >> 21;
+        i *= 0x93fc4795u;
+        i ^= 0xdf6e307fu;
+        i ^= i >> 17;
+        i *= 1 | p >> 18;
+        // same precision with 'sort_canonical', it is always smaller than one.
+        return ( i >> 8 ) / float( 1 << 24 );
+    }
+
+    SORT_FORCEINLINE unsigned hash( unsigned x ){
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    // The largest float smaller than one.
+    constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+}
+
+void CMJSample2D( const unsigned index , unsigned cnt , const unsigned dimension , const unsigned seed , float& u , float& v ){
+    cnt = std::max( cnt , 1u );
+
+    // every pattern of every pair of dimensions is permuted differently
+    const auto p = hash( seed ^ hash( dimension ^ hash( index / cnt ) ) );
+
+    const auto m = std::max( (unsigned)sqrtf( (float)cnt ) , 1u );
+    const auto n = ( cnt + m - 1 ) / m;
+    const auto s = permute( index % cnt , cnt , p * 0x51633e2du );
+    const auto sx = permute( s % m , m , p * 0x68bc21ebu );
+    const auto sy = permute( s / m , n , p * 0x02e5be93u );
+    const auto jx = randFloat( s , p * 0x967a889bu );
+    const auto jy = randFloat( s , p * 0x368cc8b7u );
+    u = std::min( ( (float)sx + ( (float)sy + jx ) / (float)n ) / (float)m , ONE_MINUS_EPSILON );
+    v = std::min( ( (float)s + jy ) / (float)cnt , ONE_MINUS_EPSILON );
+}
+
+void CMJSampler::sample( unsigned index , unsigned dimension , float& u , float& v ) const{
+    CMJSample2D( index , g_samplePerPixel , dimension , m_seed , u , v );
+}
@@ -0,0 +1,57 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sobol.h"
+
+//! @brief  Take a sample of a pair of dimensions of a correlated multi-jittered pattern.
+//!
+//! The samples of a pattern are jittered in a grid of m x n cells, m * n is the smallest product no less than the
+//! number of samples, which doesn't have to be a perfect square. Each row and each column of the grid holds
+//! exactly one sample and the first dimension is stratified in m x n sub-cells, the second one in 'cnt' strata.
+//! 'Correlated Multi-Jittered Sampling', Andrew Kensler.
+//!
+//! @param  index       Index of the sample, samples beyond the pattern size take following patterns.
+//! @param  cnt         Number of samples in a pattern.
+//! @param  dimension   Index of the pair of dimensions.
+//! @param  seed        Seed decorrelating the pattern from other patterns, like the ones of other pixels.
+//! @param  u           The sample of the first dimension of the pair, in [0,1).
+//! @param  v           The sample of the second dimension of the pair, in [0,1).
+void CMJSample2D( unsigned index , unsigned cnt , unsigned dimension , unsigned seed , float& u , float& v );
+
+//! @brief  Sampler taking correlated multi-jittered samples.
+/**
+ * Unlike the stratified sampler, which rounds the number of samples up to a perfect square, each pixel takes a
+ * pattern of exactly as many samples as requested with stratification close to multi-jittered sampling. Every
+ * pair of dimensions takes an independently permuted pattern. Adaptive and progressive sampling could take more
+ * samples than a pattern holds, they keep on taking samples of following patterns.
+ * Dimensions are drawn through 'sort_canonical' the same way as the Sobol sampler does.
+ */
+class CMJSampler : public SobolSampler{
+public:
+    DEFINE_RTTI( CMJSampler , Sampler );
+
+protected:
+    //! @brief  Take a sample of a pair of dimensions of the current pixel.
+    //!
+    //! @param  index       Index of the sample in the pixel.
+    //! @param  dimension   Index of the pair of dimensions.
+    //! @param  u           The sample of the first dimension of the pair.
+    //! @param  v           The sample of the second dimension of the pair.
+    void sample( unsigned index , unsigned dimension , float& u , float& v ) const override;
+};
@@ -24,6 +24,8 @@
 class RandomSampler : public Sampler
 {
 public:
+    DEFINE_RTTI( RandomSampler , Sampler );
+
     // generate sample in one dimension
     // para 'sample' : the memory to save the sampled data
     // para 'num'    : the number of samples to be generated
@@ -23,6 +23,8 @@
 #include "core/rand.h"
 #include "core/define.h"
 
+struct AovSample;
+
 // Light Sample
 class   LightSample
 {
@@ -32,7 +34,7 @@ public:
     float       t;      // 1d sample data
 
     float       u , v;  // 2d sample data
-    float       reserved;   // for memory alignment
+    float       spread; // angular width of the lobe the light is sampled for, lights with prefiltered radiance use it, zero for exact lookups
 
     // default constructor
     LightSample(bool auto_generate=false)
@@ -48,6 +50,7 @@ public:
             v = 0.0f;
             u = 0.0f;
         }
+        spread = 0.0f;
     }
 };
 
@@ -73,38 +76,103 @@ public:
     }
 };
 
-// light sample offset
-class SampleOffset{
-public:
-    unsigned num;   // the number of sample
-    unsigned offset;// the offset of the samples
-};
-
 // sample defination
+// It holds no memory of its own, the light and bsdf dimensions point into the buffer of the pixel.
 class PixelSample
 {
 // public field
 public:
     float                           img_u = 0.0f;
     float                           img_v = 0.0f;   // the range of the float2 should be (0,0) <-> (1,1)
-    float                           dof_u , dof_v;  // the range of the float2 should be (-1,-1) <-> (1,1)
-    std::unique_ptr<LightSample[]>  light_sample = nullptr;
-    std::unique_ptr<BsdfSample[]>   bsdf_sample = nullptr;
-    std::vector<unsigned>           light_dimension;
-    std::vector<unsigned>           bsdf_dimension;
-    std::unique_ptr<float[]>        data;       // the data to used
-
-    // request more samples
-    unsigned RequestMoreLightSample( unsigned num )
-    {
-        unsigned offset = (unsigned)light_dimension.size();
-        light_dimension.push_back( num );
+    float                           dof_u = 0.0f;
+    float                           dof_v = 0.0f;   // the range of the float2 should be (-1,-1) <-> (1,1)
+    float                           time = 0.0f;    // time within the shutter interval, the range is [0,1), it is only sampled with motion in the scene
+    LightSample*                    light_sample = nullptr; // light dimensions of the sample, nullptr if none is requested
+    BsdfSample*                     bsdf_sample = nullptr;  // bsdf dimensions of the sample, nullptr if none is requested
+    AovSample*                      aov = nullptr;  // aovs of the sample to be filled by the integrator, nullptr if no aov is enabled
+};
+
+// samples of a pixel
+// Everything the samples of a pixel need lives in a few contiguous arrays, the light dimensions of all samples are
+// packed in one array, so are the bsdf dimensions, followed by scratch memory for generating the samples. Arrays
+// only grow, a buffer owned by a thread is reused by all pixels rendered on it without touching the heap again.
+class PixelSampleBuffer
+{
+public:
+    // request more light dimensions for each sample
+    // para 'num' : the number of light dimensions
+    // result     : the offset of the first requested dimension in 'light_sample' of each sample
+    unsigned RequestMoreLightSample( unsigned num ){
+        const auto offset = m_lightDimension;
+        m_lightDimension += num;
         return offset;
     }
-    unsigned RequestMoreBsdfSample( unsigned num )
-    {
-        unsigned offset = (unsigned)bsdf_dimension.size();
-        bsdf_dimension.push_back( num );
+
+    // request more bsdf dimensions for each sample
+    // para 'num' : the number of bsdf dimensions
+    // result     : the offset of the first requested dimension in 'bsdf_sample' of each sample
+    unsigned RequestMoreBsdfSample( unsigned num ){
+        const auto offset = m_bsdfDimension;
+        m_bsdfDimension += num;
         return offset;
     }
+
+    // forget all requested dimensions, integrators request them again before rendering
+    void ClearRequests(){
+        m_lightDimension = 0;
+        m_bsdfDimension = 0;
+    }
+
+    // make sure there is room for a number of samples and point them to their dimensions, aovs are detached
+    // para 'cnt' : the number of samples
+    void Reserve( unsigned cnt ){
+        const auto light_cnt = cnt * m_lightDimension;
+        const auto bsdf_cnt = cnt * m_bsdfDimension;
+        if( cnt > m_capacity ){
+            m_samples = std::make_unique<PixelSample[]>( cnt );
+            m_scratch = std::make_unique<float[]>( 2 * cnt );
+            m_shuffle = std::make_unique<unsigned[]>( cnt );
+            m_capacity = cnt;
+        }
+        if( light_cnt > m_lightCapacity ){
+            m_lightSamples = std::make_unique<LightSample[]>( light_cnt );
+            m_lightCapacity = light_cnt;
+        }
+        if( bsdf_cnt > m_bsdfCapacity ){
+            m_bsdfSamples = std::make_unique<BsdfSample[]>( bsdf_cnt );
+            m_bsdfCapacity = bsdf_cnt;
+        }
+        for( auto i = 0u ; i < cnt ; ++i ){
+            m_samples[i].light_sample = m_lightDimension ? m_lightSamples.get() + i * m_lightDimension : nullptr;
+            m_samples[i].bsdf_sample = m_bsdfDimension ? m_bsdfSamples.get() + i * m_bsdfDimension : nullptr;
+            m_samples[i].aov = nullptr;
+        }
+    }
+
+    // the samples, there are as many as reserved
+    PixelSample* Samples() const{
+        return m_samples.get();
+    }
+
+    // two floats for each reserved sample, for generating samples
+    float* Scratch() const{
+        return m_scratch.get();
+    }
+
+    // one index for each reserved sample, for shuffling samples
+    unsigned* Shuffle() const{
+        return m_shuffle.get();
+    }
+
+private:
+    std::unique_ptr<PixelSample[]>  m_samples;          // the samples
+    std::unique_ptr<LightSample[]>  m_lightSamples;     // light dimensions of all samples
+    std::unique_ptr<BsdfSample[]>   m_bsdfSamples;      // bsdf dimensions of all samples
+    std::unique_ptr<float[]>        m_scratch;          // scratch memory for generating samples
+    std::unique_ptr<unsigned[]>     m_shuffle;          // scratch memory for shuffling samples
+    unsigned                        m_capacity = 0;     // the number of samples there is room for
+    unsigned                        m_lightCapacity = 0;    // the number of light dimensions there is room for
+    unsigned                        m_bsdfCapacity = 0;     // the number of bsdf dimensions there is room for
+    unsigned                        m_lightDimension = 0;   // light dimensions of each sample
+    unsigned                        m_bsdfDimension = 0;    // bsdf dimensions of each sample
 };
\ No newline at end of file
@@ -53,4 +53,17 @@ public:
     // para 'sample' : the memory to save the sampled data
     // para 'num'    : the number of samples to be generated
     virtual void Generate2D( float* sample , unsigned num , bool accept_uniform = false ) const = 0;
+
+    // start taking samples in a pixel, low discrepancy samplers decorrelate pixels with it
+    // para 'x' , 'y'      : the coordinate of the pixel
+    // para 'first_sample' : the number of samples taken in the pixel before
+    virtual void StartPixel( int x , int y , unsigned first_sample ) {}
+
+    // start evaluating a sample of the current pixel, samplers could take over 'sort_canonical' on the current
+    // thread so that numbers drawn during the evaluation are the following dimensions of the sample
+    // para 'sample' : index of the sample, relative to the first sample taken since 'StartPixel'
+    virtual void StartSample( unsigned sample ) {}
+
+    // finish evaluating the current sample
+    virtual void EndSample() {}
 };
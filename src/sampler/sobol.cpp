@@ -0,0 +1,131 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "sobol.h"
+#include "core/sassert.h"
+
+namespace {
+    SORT_FORCEINLINE unsigned reverseBits( unsigned x ){
+        x = ( ( x >> 1 ) & 0x55555555u ) | ( ( x & 0x55555555u ) << 1 );
+        x = ( ( x >> 2 ) & 0x33333333u ) | ( ( x & 0x33333333u ) << 2 );
+        x = ( ( x >> 4 ) & 0x0f0f0f0fu ) | ( ( x & 0x0f0f0f0fu ) << 4 );
+        x = ( ( x >> 8 ) & 0x00ff00ffu ) | ( ( x & 0x00ff00ffu ) << 8 );
+        return ( x >> 16 ) | ( x << 16 );
+    }
+
+    SORT_FORCEINLINE unsigned hash( unsigned x ){
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    SORT_FORCEINLINE unsigned hashCombine( unsigned seed , unsigned v ){
+        return hash( seed ^ ( v * 0x9e3779b9u ) );
+    }
+
+    // Owen scrambling permutes the elementary intervals of all levels randomly, the permutation of each level only
+    // depends on the higher bits. It is done in the reversed bit order, in which higher bits affect lower bits.
+    SORT_FORCEINLINE unsigned owenScramble( unsigned x , const unsigned seed ){
+        x = reverseBits( x );
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverseBits( x );
+    }
+
+    // The second dimension of Sobol sequence, its generator matrix is the Pascal matrix modulo two.
+    SORT_FORCEINLINE unsigned sobolDimension1( unsigned index ){
+        auto ret = 0u;
+        for( auto v = 1u << 31 ; index ; index >>= 1 , v ^= v >> 1 ){
+            if( index & 1 )
+                ret ^= v;
+        }
+        return ret;
+    }
+
+    SORT_FORCEINLINE float toCanonical( const unsigned x ){
+        // same precision with 'sort_canonical', it is always smaller than one.
+        return ( x >> 8 ) / float( 1 << 24 );
+    }
+}
+
+void SobolSample2D( unsigned index , const unsigned dimension , const unsigned seed , float& u , float& v ){
+    const auto pair_seed = hashCombine( seed , dimension );
+
+    // Shuffling the index with Owen scrambling keeps the stratification of the first power-of-two samples.
+    index = owenScramble( index , pair_seed );
+
+    // The first dimension of Sobol sequence is the radical inverse in base two.
+    u = toCanonical( owenScramble( reverseBits( index ) , hashCombine( pair_seed , 0 ) ) );
+    v = toCanonical( owenScramble( sobolDimension1( index ) , hashCombine( pair_seed , 1 ) ) );
+}
+
+void SobolSampler::Generate1D( float* sample , unsigned num , bool accept_uniform ) const{
+    sAssert( sample != nullptr , SAMPLING );
+
+    const auto dimension = m_arrayDimension++;
+    float v;
+    for( auto i = 0u ; i < num ; ++i )
+        this->sample( m_firstSample + i , dimension , sample[i] , v );
+}
+
+void SobolSampler::Generate2D( float* sample , unsigned num , bool accept_uniform ) const{
+    sAssert( sample != nullptr , SAMPLING );
+
+    const auto dimension = m_arrayDimension++;
+    for( auto i = 0u ; i < num ; ++i )
+        this->sample( m_firstSample + i , dimension , sample[2 * i] , sample[2 * i + 1] );
+}
+
+void SobolSampler::StartPixel( int x , int y , unsigned first_sample ){
+    m_x = x;
+    m_y = y;
+    m_seed = hashCombine( hash( (unsigned)x ) , (unsigned)y );
+    m_firstSample = first_sample;
+    m_arrayDimension = 0;
+}
+
+void SobolSampler::StartSample( unsigned sample ){
+    // dimensions drawn during the evaluation follow the ones taken by the sample arrays, like camera samples.
+    m_sequence.sampler = this;
+    m_sequence.index = m_firstSample + sample;
+    m_sequence.dimension = 2 * m_arrayDimension;
+    sort_set_sequence( &m_sequence );
+}
+
+void SobolSampler::EndSample(){
+    sort_set_sequence( nullptr );
+}
+
+float SobolSampler::Sequence::Next(){
+    const auto dimension = this->dimension++;
+    if( dimension & 1 )
+        return pending;
+
+    float u;
+    sampler->sample( index , dimension >> 1 , u , pending );
+    return u;
+}
+
+void SobolSampler::sample( unsigned index , unsigned dimension , float& u , float& v ) const{
+    SobolSample2D( index , dimension , m_seed , u , v );
+}
@@ -0,0 +1,109 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sampler.h"
+#include "core/rand.h"
+
+//! @brief  Take a sample of a pair of dimensions of the Owen-scrambled Sobol sequence.
+//!
+//! The first two dimensions of Sobol sequence are used for every pair of dimensions, pairs are decorrelated
+//! by shuffling the sample index and scrambling the values with seeds derived from the pair.
+//! 'Practical Hash-based Owen Scrambling', Brent Burley.
+//!
+//! @param  index       Index of the sample in the sequence.
+//! @param  dimension   Index of the pair of dimensions.
+//! @param  seed        Seed decorrelating the sequence from other sequences, like the ones of other pixels.
+//! @param  u           The sample of the first dimension of the pair, in [0,1).
+//! @param  v           The sample of the second dimension of the pair, in [0,1).
+void SobolSample2D( unsigned index , unsigned dimension , unsigned seed , float& u , float& v );
+
+//! @brief  Sampler taking samples of Owen-scrambled Sobol sequence.
+/**
+ * Every pixel has its own scrambled sequence and samples of it are indexed by the number of samples taken in the
+ * pixel so far, adaptive and progressive sampling keep on taking the following samples of the same sequence.
+ * Camera samples take the first dimensions, numbers drawn through 'sort_canonical' during the evaluation of a
+ * sample take the following dimensions, one at a time, so that the first bounces of all paths of a pixel are
+ * well stratified. Paths could draw different numbers of dimensions at the same bounce, which only costs some
+ * stratification since every sample of the scrambled sequence is still uniformly distributed.
+ */
+class SobolSampler : public Sampler{
+public:
+    DEFINE_RTTI( SobolSampler , Sampler );
+
+    //! @brief  Take samples of the next dimension of the pixel.
+    //!
+    //! @param  sample          The memory to save the samples.
+    //! @param  num             The number of samples to take.
+    //! @param  accept_uniform  Not used.
+    void Generate1D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+    //! @brief  Take samples of the next pair of dimensions of the pixel.
+    //!
+    //! @param  sample          The memory to save the samples, two floats each.
+    //! @param  num             The number of samples to take.
+    //! @param  accept_uniform  Not used.
+    void Generate2D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+    //! @brief  Start taking samples in a pixel.
+    //!
+    //! @param  x               X coordinate of the pixel.
+    //! @param  y               Y coordinate of the pixel.
+    //! @param  first_sample    Index of the first sample to take in the pixel.
+    void StartPixel( int x , int y , unsigned first_sample ) override;
+
+    //! @brief  Draw numbers of a sample of the pixel through 'sort_canonical' on the current thread.
+    //!
+    //! @param  sample          Index of the sample, relative to the first sample of the pixel.
+    void StartSample( unsigned sample ) override;
+
+    //! @brief  Switch 'sort_canonical' on the current thread back to the random number generator.
+    void EndSample() override;
+
+protected:
+    //! @brief  Take a sample of a pair of dimensions of the current pixel.
+    //!
+    //! @param  index       Index of the sample in the pixel.
+    //! @param  dimension   Index of the pair of dimensions.
+    //! @param  u           The sample of the first dimension of the pair.
+    //! @param  v           The sample of the second dimension of the pair.
+    virtual void sample( unsigned index , unsigned dimension , float& u , float& v ) const;
+
+    int                 m_x = 0;                /**< X coordinate of the current pixel. */
+    int                 m_y = 0;                /**< Y coordinate of the current pixel. */
+    unsigned            m_seed = 0;             /**< Seed of the current pixel. */
+
+private:
+    //! @brief  Dimensions of a sample, drawn one after another.
+    class Sequence : public CanonicalSequence{
+    public:
+        //! @brief  Draw the number of the next dimension.
+        //!
+        //! @return         The number of the next dimension, in [0,1).
+        float Next() override;
+
+        const SobolSampler* sampler = nullptr;  /**< Sampler of the pixel. */
+        unsigned    index = 0;          /**< Index of the sample in the pixel. */
+        unsigned    dimension = 0;      /**< The next dimension to draw. */
+        float       pending = 0.0f;     /**< The second dimension of the pair taken along with the last even dimension. */
+    };
+
+    unsigned            m_firstSample = 0;      /**< Index of the first sample taken in the current pixel. */
+    mutable unsigned    m_arrayDimension = 0;   /**< Pairs of dimensions taken by sample arrays in the current pixel. */
+    Sequence            m_sequence;             /**< Dimensions of the sample being evaluated. */
+};
@@ -103,6 +103,20 @@ public:
         return pdf( bsdfToBxdf(wo) , bsdfToBxdf(wi) );
     }
 
+    //! Evaluate the BXDF and the PDF of sampling the incident vector at once.
+    //!
+    //! MIS needs both of them for the same pair of directions. By default, they are evaluated one after another,
+    //! bxdfs sharing terms between the two could do better.
+    //!
+    //! @param  wo      The exitant direction in local space.
+    //! @param  wi      The incident direction in local space.
+    //! @param  pdf     The PDF w.r.t the solid angle to pick the incident direction (@param wi).
+    //! @return         Evaluted BRDF by cos(\theta)
+    virtual Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const{
+        pdf = Pdf( wo , wi );
+        return F( wo , wi );
+    }
+
     //! @brief  Check the type of the bxdf, it shouldn't be overridden by derived classes.
     //!
     //! @param type     The type to check.
@@ -20,6 +20,7 @@
 #include "core/define.h"
 #include "spectrum/spectrum.h"
 #include "math/vector3.h"
+#include "math/approx.h"
 
 SORT_FORCEINLINE float cosTheta(const Vector &w){
     return w.y;
@@ -77,12 +78,14 @@ SORT_FORCEINLINE bool sameHemisphere(const Vector &w, const Vector &wp) {
     return w.y * wp.y > 0.f;
 }
 
+template<MathAccuracy accuracy = MathAccuracy::Exact>
 SORT_FORCEINLINE float sphericalTheta(const Vector &v) {
-    return acosf(clamp(v.y, -1.f, 1.f));
+    return ApproxAcos<accuracy>(v.y);
 }
 
+template<MathAccuracy accuracy = MathAccuracy::Exact>
 SORT_FORCEINLINE float sphericalPhi(const Vector &v) {
-    float p = atan2f(v.z, v.x);
+    float p = ApproxAtan2<accuracy>(v.z, v.x);
     return (p < 0.f) ? p + 2.f*PI : p;
 }
 
@@ -147,3 +147,40 @@ float Coat::Pdf( const Vector& wo , const Vector& wi ) const{
     const auto layer1_pdf = (tir_o || tir_i) ? 0.0f : bottom->Pdf_BSDF(-r_wo, -r_wi);
     return slerp( layer1_pdf , layer0_pdf , specProp );
 }
+
+Spectrum Coat::F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const{
+    pdf = 0.0f;
+    if (!SameHemiSphere(wo, wi)) return 0.0f;
+    if (!PointingUp(wo)) return 0.0f;
+
+    const auto swo = bsdfToBxdf( wo );
+    const auto swi = bsdfToBxdf( wi );
+
+    auto layer0_pdf = 0.0f;
+    auto ret = coat.f_pdf(swo, swi, layer0_pdf);
+
+    auto tir_o = false, tir_i = false;
+    const auto r_wo = refract(swo, DIR_UP, ior, 1.0f, tir_o);
+    const auto r_wi = refract(swi, DIR_UP, ior, 1.0f, tir_i);
+    const auto F_o = fresnel.Evaluate(cosTheta(swo));
+
+    // the proportion of sampling the top layer only depends on the exitant direction
+    const auto attenuation_o = ( -thickness * sigma / absCosTheta(r_wo) ).Exp();
+    const auto I1 = F_o.GetIntensity();
+    const auto I2 = ( 1.0f - I1 ) * ( 1.0f - I1 ) * ( attenuation_o * attenuation_o ).GetIntensity() / ( ior * ior );
+    const auto specProp = I1 / ( I1 + I2 );
+
+    auto layer1_pdf = 0.0f;
+    if (!tir_o && !tir_i) {
+        // Bouguer-Lambert-Beer law
+        const auto attenuation = attenuation_o * ( -thickness * sigma / absCosTheta(r_wi) ).Exp();
+        // Fresnel attenuation between the boundary across layer0 and layer1
+        const auto T12 = (1.0f - F_o);
+        const auto T21 = slerp( 1.0f - fresnel.Evaluate(cosTheta(swi)), 1.0f, TIR_COMPENSATION);
+
+        ret += bottom->Evaluate_BSDF( -r_wo , -r_wi , layer1_pdf ) * attenuation * T12 * T21 / ( ior * ior );
+    }
+
+    pdf = slerp( layer1_pdf , layer0_pdf , specProp );
+    return ret;
+}
@@ -79,6 +79,16 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float Pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Evaluate the BRDF and the pdf of an exitant direction at once.
+    //!
+    //! The refracted directions and fresnel terms are shared, so is the evaluation of the top and bottom layers.
+    //!
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @param wi   Incident direction in shading coordinate.
+    //! @param pdf  The probability of choosing the out-going direction based on the Incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const override;
+
 private:
     const float thickness ;     /**< Thickness of the layer. */
     const float ior ;           /**< Index of refraction out side the surface where the normal points. */
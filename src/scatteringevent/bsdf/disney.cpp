@@ -15,6 +15,7 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <array>
 #include "disney.h"
 #include "sampler/sample.h"
 #include "core/samplemethod.h"
@@ -74,6 +75,28 @@ constexpr static float burley_max_r_d = 16.0f;
 constexpr static float burley_max_cdf = burley_max_cdf_calc( burley_max_r_d );
 constexpr static float burley_inv_max_cdf = 1.0f / burley_max_cdf;
 
+// The burley profile only depends on r / d, exp( -r / d ) + exp( -r / ( 3 * d ) ) is tabulated once for all materials
+// within the maximum sampling range, where the pdf of sampling is evaluated once per channel, axis and probe ray.
+constexpr static int burley_table_res = 64;
+constexpr static int burley_table_cnt = (int)burley_max_r_d * burley_table_res;
+static const auto burley_table = [](){
+    std::array<float, burley_table_cnt + 1> table;
+    for( auto i = 0 ; i <= burley_table_cnt ; ++i ){
+        const auto x = (double)i / burley_table_res;
+        table[i] = (float)( exp( -x ) + exp( -x / 3.0 ) );
+    }
+    return table;
+}();
+
+SORT_STATIC_FORCEINLINE float burleyExp( const float r_d ){
+    if( r_d >= burley_max_r_d )
+        return exp( -r_d ) + exp( -r_d / 3.0f );
+    const auto x = r_d * burley_table_res;
+    const auto i = (int)x;
+    const auto t = x - i;
+    return burley_table[i] * ( 1.0f - t ) + burley_table[i+1] * t;
+}
+
 float ClearcoatGGX::D(const Vector& h) const {
     // D(h) = ( alpha^2 - 1 ) / ( 2 * PI * ln(alpha) * ( 1 + ( alpha^2 - 1 ) * cos(\theta) ^ 2 )
 
@@ -128,6 +151,7 @@ DisneyBssrdf::DisneyBssrdf( const SurfaceInteraction* intersection , const Spect
     // the divide four pi thing is just to get similar result with Cycles SSS implementation with same inputs.
     const auto l = mfp * INV_FOUR_PI;
     d = l.Clamp( 0.0001f , FLT_MAX ) / s;
+    invD = Spectrum( 1.0f ) / d;
 }
 
 int DisneyBssrdf::Sample_Ch() const{
@@ -153,8 +177,9 @@ Spectrum DisneyBssrdf::S( const Vector& wo , const Point& po , const Vector& wi
 
 Spectrum DisneyBssrdf::Sr( float r ) const{
     r = ( r < 0.000001f ) ? 0.000001f : r;
-    constexpr auto EIGHT_PI = 4.0 * TWO_PI;
-    return R * ( ( Spectrum( -r ) / d ).Exp() + ( Spectrum( -r ) / ( 3.0f * d ) ).Exp() ) / ( EIGHT_PI * d * r );
+    constexpr auto EIGHT_PI = 4.0f * TWO_PI;
+    const auto h = Spectrum( burleyExp( r * invD[0] ) , burleyExp( r * invD[1] ) , burleyExp( r * invD[2] ) );
+    return R * h * invD * ( 1.0f / ( EIGHT_PI * r ) );
 }
 
 float DisneyBssrdf::Sample_Sr(int ch, float r) const{
@@ -171,7 +196,14 @@ float DisneyBssrdf::Pdf_Sr(int ch, float r) const{
     // Sr(ch,r) = ( 0.25f * exp( -r / d[ch] ) / ( TWO_PI * d[ch] * r ) + 0.75f * exp( -r / ( 3.0f * d[ch] ) ) / ( SIX_PI * d[ch] * r )
     constexpr auto EIGHT_PI = 4.0f * TWO_PI;
     r = ( r < 0.000001f ) ? 0.000001f : r;
-    return ( exp( -r / d[ch] ) + exp( -r / ( 3.0f * d[ch] ) ) ) / ( EIGHT_PI * d[ch] * r ) * burley_inv_max_cdf;
+    return burleyExp( r * invD[ch] ) * invD[ch] / ( EIGHT_PI * r ) * burley_inv_max_cdf;
+}
+
+Spectrum DisneyBssrdf::Pdf_Sr( float r ) const{
+    constexpr auto EIGHT_PI = 4.0f * TWO_PI;
+    r = ( r < 0.000001f ) ? 0.000001f : r;
+    const auto h = Spectrum( burleyExp( r * invD[0] ) , burleyExp( r * invD[1] ) , burleyExp( r * invD[2] ) );
+    return h * invD * ( burley_inv_max_cdf / ( EIGHT_PI * r ) );
 }
 
 float DisneyBssrdf::Max_Sr(int ch) const{
@@ -179,8 +211,17 @@ float DisneyBssrdf::Max_Sr(int ch) const{
 }
 
 Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
+    return evaluate( wo , wi , true , nullptr );
+}
+
+Spectrum DisneyBRDF::F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const {
+    return evaluate( bsdfToBxdf( wo ) , bsdfToBxdf( wi ) , true , &pdf );
+}
+
+Spectrum DisneyBRDF::evaluate( const Vector& wo , const Vector& wi , bool evaluateF , float* pPdf ) const {
     const auto aspect = sqrt(sqrt(1.0f - anisotropic * 0.9f));
     const auto diffuseWeight = (1.0f - metallic) * (1.0 - specTrans);
+    const auto hasSSS = !scatterDistance.IsBlack();
 
     const auto wh = normalize(wo + wi);
     const auto HoO = dot(wo, wh);
@@ -188,12 +229,28 @@ Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
 
     const auto luminance = basecolor.GetIntensity();
     const auto Ctint = luminance > 0.0f ? basecolor * (1.0f / luminance) : Spectrum(1.0f);
+    const auto Cspec0 = slerp(specular * SchlickR0FromEta( ior_ex / ior_in ) * slerp(Spectrum(1.0f), Ctint, specularTint), basecolor, metallic);
+
+    // Weights of picking each lobe in importance sampling, they are only needed for the pdf.
+    auto clearcoat_weight = 0.0f, specular_reflection_weight = 0.0f, specular_transmission_weight = 0.0f;
+    auto diffuse_reflection_weight = 0.0f, diffuse_transmission_weight = 0.0f, total_weight = 0.0f;
+    if( pPdf ){
+        clearcoat_weight = clearcoat * 0.04f;
+        specular_reflection_weight = Cspec0.GetIntensity() * specularPdfScale( roughness );
+        specular_transmission_weight = luminance * (1.0f - metallic) * specTrans;
+        diffuse_reflection_weight = hasSSS ? 0.0f : luminance * (1.0f - metallic) * (1.0f - specTrans) * (thinSurface ? (1.0f - diffTrans) : 1.0f);
+        diffuse_transmission_weight = thinSurface ? luminance * (1.0f - metallic) * (1.0f - specTrans) * diffTrans : 0.0f;
+        total_weight = clearcoat_weight + specular_reflection_weight + specular_transmission_weight + diffuse_reflection_weight + diffuse_transmission_weight;
+        *pPdf = 0.0f;
+    }
+    const auto evaluatePdf = total_weight > 0.0f;
 
     auto ret = RGBSpectrum(0.0f);
+    auto total_pdf = 0.0f;
 
     const auto evaluate_reflection = PointingUp( wo ) && PointingUp( wi );
 
-    if (diffuseWeight > 0.0f) {
+    if (evaluateF && diffuseWeight > 0.0f) {
         const auto NoO = cosTheta(wo);
         const auto NoI = cosTheta(wi);
         const auto Clampped_NoI = saturate(NoI);
@@ -222,7 +279,7 @@ Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
                 }
             }
         } else {
-            if (!scatterDistance.IsBlack()) {
+            if (hasSSS) {
                 // Nothing needs to be done in this branch, it is intentional.
             } else if( evaluate_reflection ){
                 // Fall back to the Disney diffuse due to the lack of sub-surface scattering
@@ -249,25 +306,42 @@ Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
         }
     }
 
+    // Microfacet reflection lobes share D(h) and G1(wo) between the BRDF and its pdf.
+    const auto NoV = absCosTheta(wo);
+    const auto reflection_valid = evaluate_reflection && wo.y * wi.y > 0.0f && NoV > 0.0f;
+    const auto EoH = absDot(wo, wh);
+
     // Specular reflection term in Disney BRDF
     const GGX ggx(roughness / aspect, roughness * aspect);
-    const auto Cspec0 = slerp(specular * SchlickR0FromEta( ior_ex / ior_in ) * slerp(Spectrum(1.0f), Ctint, specularTint), basecolor, metallic);
-    if (!Cspec0.IsBlack() && evaluate_reflection) {
-        const FresnelSchlick<Spectrum> fresnel(Cspec0);
-        const MicroFacetReflection mf(WHITE_SPECTRUM, &fresnel, &ggx, FULL_WEIGHT, nn);
-        ret += mf.f(wo, wi);
+    const auto specular_f = evaluateF && !Cspec0.IsBlack() && reflection_valid;
+    const auto specular_pdf = evaluatePdf && specular_reflection_weight > 0.0f;
+    if (specular_f) {
+        float pdf_wh;
+        const auto dg = ggx.DGWithPdf(wo, wi, wh, pdf_wh);
+        ret += SchlickFresnel(Cspec0, HoO) * dg / (4.0f * NoV);
+        if (specular_pdf)
+            total_pdf += specular_reflection_weight * pdf_wh / (4.0f * EoH);
+    } else if (specular_pdf) {
+        total_pdf += specular_reflection_weight * ggx.PdfVisibleNormal(wo, wh) / (4.0f * EoH);
     }
 
     // Another layer of clear coat on top of everything below.
-    if (clearcoat > 0.0f && evaluate_reflection) {
+    const auto clearcoat_f = evaluateF && clearcoat > 0.0f && reflection_valid;
+    const auto clearcoat_pdf = evaluatePdf && clearcoat_weight > 0.0f;
+    if (clearcoat_f || clearcoat_pdf) {
         const ClearcoatGGX cggx(sqrt(slerp(0.1f, 0.001f, clearcoatGloss)));
-        const FresnelSchlick<float> fresnel(0.04f);
-        const MicroFacetReflection mf_clearcoat(WHITE_SPECTRUM, &fresnel, &cggx, FULL_WEIGHT, nn);
-        ret += clearcoat * mf_clearcoat.f(wo, wi);
+        float pdf_wh;
+        const auto dg = cggx.DGWithPdf(wo, wi, wh, pdf_wh);
+        if (clearcoat_f)
+            ret += clearcoat * SchlickFresnel(0.04f, HoO) * dg / (4.0f * NoV);
+        if (clearcoat_pdf)
+            total_pdf += clearcoat_weight * pdf_wh / (4.0f * EoH);
     }
 
     // Specular transmission
-    if (specTrans > 0.0f) {
+    const auto transmission_f = evaluateF && specTrans > 0.0f;
+    const auto transmission_pdf = evaluatePdf && specular_transmission_weight > 0.0f;
+    if (transmission_f || transmission_pdf) {
         if (thinSurface) {
             // Scale roughness based on IOR (Burley 2015, Figure 15).
             const auto rscaled = (0.65f * inv_eta - 0.35f) * roughness;
@@ -276,21 +350,39 @@ Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
             const GGX scaledDist(ru, rv);
 
             MicroFacetRefraction mr(basecolor.Sqrt(), &scaledDist, ior_ex, ior_in, FULL_WEIGHT, nn);
-            ret += specTrans * (1.0f - metallic) * mr.f(wo, wi);
+            if (transmission_f)
+                ret += specTrans * (1.0f - metallic) * mr.f(wo, wi);
+            if (transmission_pdf)
+                total_pdf += specular_transmission_weight * mr.pdf(wo, wi);
         } else {
             // Microfacet Models for Refraction through Rough Surfaces
             // https://www.cs.cornell.edu/~srm/publications/EGSR07-btdf.pdf
             MicroFacetRefraction mr(basecolor, &ggx, ior_ex, ior_in, FULL_WEIGHT, nn);
-            ret += specTrans * (1.0f - metallic) * mr.f(wo, wi);
+            if (transmission_f)
+                ret += specTrans * (1.0f - metallic) * mr.f(wo, wi);
+            if (transmission_pdf)
+                total_pdf += specular_transmission_weight * mr.pdf(wo, wi);
         }
     }
 
+    // Diffuse reflection is sampled with cosine weighted hemisphere, no pdf is returned with SSS, otherwise it will introduce bugs!!
+    if (evaluatePdf && diffuse_reflection_weight > 0.0f)
+        total_pdf += diffuse_reflection_weight * CosHemispherePdf(wi);
+
     // Diffuse transmission
-    if ( thinSurface && diffTrans > 0.0f && diffuseWeight > 0.0f ) {
+    const auto diffuse_transmission_f = evaluateF && thinSurface && diffTrans > 0.0f && diffuseWeight > 0.0f;
+    const auto diffuse_transmission_pdf = evaluatePdf && diffuse_transmission_weight > 0.0f;
+    if (diffuse_transmission_f || diffuse_transmission_pdf) {
         LambertTransmission lambert_transmission(basecolor , 1.0f, nn);
-        ret += diffTrans * diffuseWeight * lambert_transmission.f(wo, wi) ;
+        if (diffuse_transmission_f)
+            ret += diffTrans * diffuseWeight * lambert_transmission.f(wo, wi);
+        if (diffuse_transmission_pdf)
+            total_pdf += diffuse_transmission_weight * lambert_transmission.pdf(wo, wi);
     }
 
+    if (evaluatePdf)
+        *pPdf = total_pdf / total_weight;
+
     return ret;
 }
 
@@ -334,7 +426,7 @@ Spectrum DisneyBRDF::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs
     }else if (r <= sr_w) {
         BsdfSample sample(true);
         Vector wh;
-        wh = ggx.sample_f(sample);
+        wh = ggx.SampleVisibleNormal(wo, sample);
         wi = 2 * dot(wo, wh) * wh - wo;
     }else if (r <= st_w) {
         if (thinSurface) {
@@ -365,72 +457,14 @@ Spectrum DisneyBRDF::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs
         lambert_transmission.sample_f(wo, wi, bs, pPdf);
     }
 
-    if (pPdf) *pPdf = pdf(wo, wi);
-
-    auto ret = f( wo , wi );
-    return ret;
+    // The pdf shares most of its terms with the BRDF.
+    return evaluate( wo , wi , true , pPdf );
 }
 
 float DisneyBRDF::pdf( const Vector& wo , const Vector& wi ) const {
-    const auto aspect = sqrt(sqrt(1.0f - anisotropic * 0.9f));
-    const auto luminance = basecolor.GetIntensity();
-    const auto Ctint = luminance > 0.0f ? basecolor * (1.0f / luminance) : Spectrum(1.0f);
-    const auto min_specular_amount = SchlickR0FromEta(ior_ex / ior_in);
-    const auto Cspec0 = slerp(specular * min_specular_amount * slerp(Spectrum(1.0f), Ctint, specularTint), basecolor, metallic);
-    const auto hasSSS = !scatterDistance.IsBlack();
-
-    const auto base_color_intensity = basecolor.GetIntensity();
-    const auto clearcoat_weight = clearcoat * 0.04f;
-    const auto specular_reflection_weight = Cspec0.GetIntensity() * specularPdfScale( roughness );
-    const auto specular_transmission_weight = base_color_intensity * (1.0f - metallic) * specTrans;
-    const auto diffuse_reflection_weight = hasSSS ? 0.0f : base_color_intensity * (1.0f - metallic) * (1.0f - specTrans) * (thinSurface ? (1.0f - diffTrans) : 1.0f);
-    const auto diffuse_transmission_weight = thinSurface ? base_color_intensity * (1.0f - metallic) * (1.0f - specTrans) * diffTrans : 0.0f;
-    
-    const auto total_weight = clearcoat_weight + specular_reflection_weight + specular_transmission_weight + diffuse_reflection_weight + diffuse_transmission_weight;
-    if (total_weight <= 0.0f)
-        return 0.0f;
-
-    auto total_pdf = 0.0f;
-    const auto wh = normalize(wi + wo);
-    const GGX ggx(roughness / aspect, roughness * aspect);
-    if (clearcoat_weight > 0.0f) {
-        const ClearcoatGGX cggx(sqrt(slerp(0.1f, 0.001f, clearcoatGloss)));
-        total_pdf += clearcoat_weight * cggx.Pdf(wh) / (4.0f * absDot(wo, wh));
-    }
-    if (specular_reflection_weight > 0.0f) {
-        total_pdf += specular_reflection_weight * ggx.Pdf(wh) / (4.0f * absDot(wo, wh));
-    }
-    if (specular_transmission_weight > 0.0f) {
-        if (thinSurface) {
-            // Scale roughness based on IOR (Burley 2015, Figure 15).
-            const auto rscaled = (0.65f * inv_eta - 0.35f) * roughness;
-            const auto ru = SQR(rscaled) / aspect;
-            const auto rv = SQR(rscaled) * aspect;
-            const GGX scaledDist(ru, rv);
-
-            MicroFacetRefraction mr(WHITE_SPECTRUM, &scaledDist, ior_ex, ior_in, FULL_WEIGHT, nn);
-            total_pdf += specular_transmission_weight * mr.pdf(wo, wi);
-        }
-        else {
-            // Sampling the transmission BTDF
-            MicroFacetRefraction mr(WHITE_SPECTRUM, &ggx, ior_ex, ior_in, FULL_WEIGHT, nn);
-            total_pdf += specular_transmission_weight * mr.pdf(wo, wi);
-        }
-    }
-    if (diffuse_reflection_weight > 0.0f) {
-        // albedo doesn't matter here, we are only interested in light direction.
-        if( hasSSS ){
-            // No PDF should be returned, otherwise it will introduce bugs!!
-        }else{
-            total_pdf += diffuse_reflection_weight * CosHemispherePdf(wi);
-        }
-    }
-    if (diffuse_transmission_weight > 0.0f) {
-        LambertTransmission lambert_transmission(basecolor, diffTrans, nn);
-        total_pdf += diffuse_transmission_weight * lambert_transmission.pdf(wo, wi);
-    }
-
-    return total_pdf / total_weight;
+    auto pdf = 0.0f;
+    evaluate( wo , wi , false , &pdf );
+    return pdf;
 }
 
  float DisneyBRDF::Evaluate_Sampling_Weight( const ClosureTypeDisney& params ){
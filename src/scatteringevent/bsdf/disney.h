@@ -156,6 +156,13 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Evaluate the BRDF and the pdf of sampling the incident direction at once, sharing the terms between them.
+    //! @param wo   Exitant direction in local space.
+    //! @param wi   Incident direction in local space.
+    //! @param pdf  The probability of choosing the incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const override;
+
     //! @brief Helper function to evaluate the sampline weight of disney brdf.
     //!
     //! @param  params      Parameters used to construct the class instance.
@@ -178,6 +185,14 @@ private:
     const float     flatness;           /**< Blending factor between diffuse and fakeSS model. */
     const Spectrum  scatterDistance;    /**< Distance of scattering in SSS. */
     const bool      thinSurface;        /**< Whether the surface is thin surface. */
+
+    //! @brief Evaluate the BRDF and its pdf, all lobes share dot products, lobe weights and microfacet terms.
+    //! @param wo           Exitant direction in shading coordinate.
+    //! @param wi           Incident direction in shading coordinate.
+    //! @param evaluateF    Whether the BRDF is evaluated, only the pdf is evaluated otherwise.
+    //! @param pdf          The probability of choosing the incident direction, it is not evaluated if it is nullptr.
+    //! @return             The Evaluated BRDF value, it is zero if evaluateF is false.
+    Spectrum evaluate( const Vector& wo , const Vector& wi , bool evaluateF , float* pdf ) const;
 };
 
 //! @brief  Clearcoat GGX NDF.
@@ -196,6 +211,23 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f(const BsdfSample& bs) const override;
 
+    //! @brief Clearcoat lobe samples the full NDF, visible normal sampling of GGX doesn't apply to it.
+    Vector SampleVisibleNormal(const Vector& wo, const BsdfSample& bs) const override {
+        return MicroFacetDistribution::SampleVisibleNormal(wo, bs);
+    }
+
+    //! @brief PDF of sampling a specific normal direction, the same as sampling the full NDF.
+    float PdfVisibleNormal(const Vector& wo, const Vector& wh) const override {
+        return MicroFacetDistribution::PdfVisibleNormal(wo, wh);
+    }
+
+    //! @brief Evaluate D(h) * G(wo, wi) along with the PDF of sampling h from the full NDF, D(h) is shared.
+    float DGWithPdf(const Vector& wo, const Vector& wi, const Vector& wh, float& pdf) const override {
+        const auto d = D(wh);
+        pdf = d * absCosTheta(wh);
+        return d * G(wo, wi);
+    }
+
 protected:
     //! @brief Smith shadow-masking function G1
     float G1(const Vector& v) const override;
@@ -276,6 +308,13 @@ protected:
     //! @return             Pdf of sampling it.
     float       Pdf_Sr(int ch, float d) const override;
 
+    //! @brief  Pdf of sampling such a distance based on the reflectance profile of all channels at once.
+    //!
+    //! @param  d           Distance from the extant point.
+    //! @return             Pdf of sampling it in each channel.
+    Spectrum    Pdf_Sr( float d ) const override;
+
 private:
     Spectrum    d;
+    Spectrum    invD;       /**< Reciprocal of d. */
 };
\ No newline at end of file
@@ -57,3 +57,16 @@ float DoubleSided::pdf(const Vector& wo, const Vector& wi) const {
     if (back0) return m_se1 ? m_se1->Pdf_BSDF(-wo, -wi) : 0.0f;
     return 0.0f;
 }
+
+Spectrum DoubleSided::F_Pdf(const Vector& wo, const Vector& wi, float& pdf) const {
+    pdf = 0.0f;
+
+    const auto lwo = bsdfToBxdf(wo);
+    const auto lwi = bsdfToBxdf(wi);
+    const auto back0 = cosTheta(lwo) < 0.0f;
+    const auto back1 = cosTheta(lwi) < 0.0f;
+    if (back0 ^ back1) return 0.0f;
+
+    if (!back0) return m_se0 ? m_se0->Evaluate_BSDF(lwo, lwi, pdf) : 0.0f;
+    return m_se1 ? m_se1->Evaluate_BSDF(-lwo, -lwi, pdf) : 0.0f;
+}
@@ -59,6 +59,13 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Evaluate the BRDF and the pdf at once, the scattering event of the visible side evaluates both together.
+    //! @param wo   Exitant direction in local space.
+    //! @param wi   Incident direction in local space.
+    //! @param pdf  The probability of choosing the out-going direction based on the Incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const override;
+
 private:
     const ScatteringEvent* m_se0;      /**< Scattering event on the front side of the surface. */
     const ScatteringEvent* m_se1;      /**< Scattering event on the back side of the surface. */
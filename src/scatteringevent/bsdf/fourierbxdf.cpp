@@ -16,7 +16,9 @@
  */
 
 #include <string.h>
-#include <fstream>
+#ifdef SSE_ENABLED
+#include <emmintrin.h>
+#endif
 #include "fourierbxdf.h"
 #include "core/memory.h"
 #include "core/samplemethod.h"
@@ -29,14 +31,15 @@ IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeFourier, Tsl_float3, normal)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeFourier)
 
 bool FourierBxdfData::LoadResource( const std::string filename ){
-    std::ifstream file( filename.c_str(), std::ios::binary);
-    if( !file.is_open() )
+    auto file = std::make_unique<IMappedFileStream>( filename );
+    if( !file->IsValid() )
         return false;
 
     // We assume both of the system and the file are of the same endian, which should be little endian on Intel chip.
+    // Everything is accessed in place, the tables are 4 bytes aligned since the header is 64 bytes.
     auto ReadFile = [&]( char* data , int sizeInByte )-> bool {
-        file.read( data , sizeInByte );
-        return sizeInByte == file.gcount();
+        file->Load( data , sizeInByte );
+        return file->IsValid();
     };
 
     const char* header = "SCATFUN\x01";
@@ -47,44 +50,43 @@ bool FourierBxdfData::LoadResource( const std::string filename ){
         return false;
 
     int flags = 0, coeff = 0, unused[4];
-    std::unique_ptr<int[]> offsetAndLength;
 
-    if( !ReadFile( (char*)&flags , 4 ) || flags != 1 ) {file.close(); return false;}
-    if( !ReadFile( (char*)&bsdfTable.nMu , 4 ) || bsdfTable.nMu <= 1 ) {file.close(); return false;}
-    if( !ReadFile( (char*)&coeff , 4 ) || coeff <= 0 ) {file.close(); return false;}
-    if( !ReadFile( (char*)&bsdfTable.nMax , 4 ) || bsdfTable.nMax <= 0 ) {file.close(); return false;}
-    if( !ReadFile( (char*)&bsdfTable.nChannels , 4 ) || (bsdfTable.nChannels != 1 && bsdfTable.nChannels != 3) ) {file.close(); return false;}
-    if( !ReadFile( (char*)unused , 16 ) ) {file.close(); return false;}
-    if( !ReadFile( (char*)&bsdfTable.eta , 4 ) ) {file.close(); return false;}
-    if( !ReadFile( (char*)unused , 16 ) ) {file.close(); return false;}
+    if( !ReadFile( (char*)&flags , 4 ) || flags != 1 ) return false;
+    if( !ReadFile( (char*)&bsdfTable.nMu , 4 ) || bsdfTable.nMu <= 1 ) return false;
+    if( !ReadFile( (char*)&coeff , 4 ) || coeff <= 0 ) return false;
+    if( !ReadFile( (char*)&bsdfTable.nMax , 4 ) || bsdfTable.nMax <= 0 ) return false;
+    if( !ReadFile( (char*)&bsdfTable.nChannels , 4 ) || (bsdfTable.nChannels != 1 && bsdfTable.nChannels != 3) ) return false;
+    if( !ReadFile( (char*)unused , 16 ) ) return false;
+    if( !ReadFile( (char*)&bsdfTable.eta , 4 ) ) return false;
+    if( !ReadFile( (char*)unused , 16 ) ) return false;
 
     const auto sqMu = bsdfTable.nMu * bsdfTable.nMu;
-    bsdfTable.mu = std::make_unique<float[]>(bsdfTable.nMu);
-    bsdfTable.cdf = std::make_unique<float[]>(sqMu);
-    offsetAndLength = std::make_unique<int[]>(sqMu * 2);
-    bsdfTable.m = std::make_unique<int[]>(sqMu);
-    bsdfTable.aOffset = std::make_unique<int[]>(sqMu);
-    bsdfTable.a = std::make_unique<float[]>(coeff);
-    bsdfTable.a0 = std::make_unique<float[]>(sqMu);
-    bsdfTable.recip = std::make_unique<float[]>(bsdfTable.nMu);
+    bsdfTable.mu = (const float*)file->View( (int)( bsdfTable.nMu * sizeof(float) ) );
+    bsdfTable.cdf = (const float*)file->View( (int)( sqMu * sizeof(float) ) );
+    bsdfTable.offsetAndLength = (const int*)file->View( (int)( 2 * sqMu * sizeof(int) ) );
+    bsdfTable.a = (const float*)file->View( (int)( coeff * sizeof( float ) ) );
+    if( !file->IsValid() )
+        return false;
 
-    if(!ReadFile( (char*)bsdfTable.mu.get() , bsdfTable.nMu * sizeof(float) ) ||
-       !ReadFile( (char*)bsdfTable.cdf.get() , sqMu * sizeof(float) ) ||
-       !ReadFile( (char*)offsetAndLength.get() , 2 * sqMu * sizeof(int) ) ||
-       !ReadFile( (char*)bsdfTable.a.get() , coeff * sizeof( float ) ) )
-        {file.close(); return false;}
+    // The tables are sampled all over the place during rendering.
+    file->AdviseRandomAccess();
 
-    for( int i = 0 ; i < bsdfTable.nMu * bsdfTable.nMu ; ++i ){
-        bsdfTable.aOffset[i] = offsetAndLength[2*i];
-        bsdfTable.m[i] = offsetAndLength[2*i+1];
-        bsdfTable.a0[i] = ( bsdfTable.m[i] > 0 )?bsdfTable.a[offsetAndLength[2*i]]:0.0f;
+    // Coefficients out of the file can't be accessed in place.
+    bsdfTable.a0 = std::make_unique<float[]>(sqMu);
+    for( int i = 0 ; i < sqMu ; ++i ){
+        const auto offset = bsdfTable.offsetAndLength[2*i];
+        const auto length = bsdfTable.offsetAndLength[2*i+1];
+        if( offset < 0 || length < 0 || length > bsdfTable.nMax || offset > coeff - length * bsdfTable.nChannels )
+            return false;
+        bsdfTable.a0[i] = ( length > 0 )?bsdfTable.a[offset]:0.0f;
     }
 
+    bsdfTable.recip = std::make_unique<float[]>(bsdfTable.nMu);
     bsdfTable.recip[0] = 0.0f;
     for( int i = 1 ; i < bsdfTable.nMu ; ++i )
         bsdfTable.recip[i] = 1.0f / (float) i;
 
-    file.close();
+    m_file = std::move( file );
     return true;
 }
 
@@ -125,7 +127,7 @@ Spectrum FourierBxdfData::sample_f( const Vector& wo , Vector& wi , const BsdfSa
 {
     auto muO = cosTheta(wo);
     float pdfMu;
-    auto muI = sampleCatmullRom2D(bsdfTable.nMu, bsdfTable.nMu, bsdfTable.mu.get(), bsdfTable.mu.get(), bsdfTable.a0.get(), bsdfTable.cdf.get(), muO, bs.u, nullptr, &pdfMu);
+    auto muI = sampleCatmullRom2D(bsdfTable.nMu, bsdfTable.nMu, bsdfTable.mu, bsdfTable.mu, bsdfTable.a0.get(), bsdfTable.cdf, muO, bs.u, nullptr, &pdfMu);
 
     int offsetI , offsetO;
     float weightsI[4] , weightsO[4];
@@ -322,7 +324,48 @@ float FourierBxdfData::fourier( const float* ak , int m , double cosPhi ) const
     double value = 0.0;
     double cosKMinusOnePhi = cosPhi;
     double cosKPhi = 1.0;
-    for(auto i = 0 ; i < m ; ++i ){
+    auto i = 0;
+
+#ifdef SSE_ENABLED
+    // Four independent chains of the same recurrence, each takes every fourth coefficient,
+    // cos( (K+4) * phi ) = 2.0 * cos( 4 * phi ) * cos( K * phi ) - cos( (K-4) * phi ).
+    if( m >= 4 ){
+        const auto cos2Phi = 2.0 * cosPhi * cosPhi - 1.0;
+        const auto cos3Phi = 2.0 * cosPhi * cos2Phi - cosPhi;
+        const auto cos4Phi = 2.0 * cosPhi * cos3Phi - cos2Phi;
+        const auto step = _mm_set1_pd( 2.0 * cos4Phi );
+
+        // lanes of K and K+1, K+2 and K+3, starting from K = 0
+        auto cur0 = _mm_set_pd( cosPhi , 1.0 ) , cur1 = _mm_set_pd( cos3Phi , cos2Phi );
+        auto prev0 = _mm_set_pd( cos3Phi , cos4Phi ) , prev1 = _mm_set_pd( cosPhi , cos2Phi );
+        auto sum0 = _mm_setzero_pd() , sum1 = _mm_setzero_pd();
+        for( ; i + 4 <= m ; i += 4 ){
+            const auto a0 = _mm_cvtps_pd( _mm_castsi128_ps( _mm_loadl_epi64( (const __m128i*)( ak + i ) ) ) );
+            const auto a1 = _mm_cvtps_pd( _mm_castsi128_ps( _mm_loadl_epi64( (const __m128i*)( ak + i + 2 ) ) ) );
+            sum0 = _mm_add_pd( sum0 , _mm_mul_pd( cur0 , a0 ) );
+            sum1 = _mm_add_pd( sum1 , _mm_mul_pd( cur1 , a1 ) );
+
+            const auto next0 = _mm_sub_pd( _mm_mul_pd( step , cur0 ) , prev0 );
+            const auto next1 = _mm_sub_pd( _mm_mul_pd( step , cur1 ) , prev1 );
+            prev0 = cur0;
+            prev1 = cur1;
+            cur0 = next0;
+            cur1 = next1;
+        }
+
+        alignas(16) double sum[2] , cosK[2] , cosKMinusOne[2];
+        _mm_store_pd( sum , _mm_add_pd( sum0 , sum1 ) );
+        value = sum[0] + sum[1];
+
+        // the rest of the coefficients go through the scalar recurrence
+        _mm_store_pd( cosK , cur0 );
+        _mm_store_pd( cosKMinusOne , prev1 );
+        cosKPhi = cosK[0];
+        cosKMinusOnePhi = cosKMinusOne[1];
+    }
+#endif
+
+    for( ; i < m ; ++i ){
         value += cosKPhi * ak[i];
         double cosKPlusPhi = 2.0 * cosPhi * cosKPhi - cosKMinusOnePhi;
         cosKMinusOnePhi = cosKPhi;
@@ -394,11 +437,19 @@ int FourierBxdfData::blendCoefficients( float* ak , int channel , int offsetI ,
             auto w = weightsI[j] * weightsO[i];
             if( w != 0.0f ){
                 int m;
-                float* a = bsdfTable.GetAk(offsetI + j , offsetO + i, &m );
+                const float* a = bsdfTable.GetAk(offsetI + j , offsetO + i, &m );
                 nMax = std::max( nMax , m );
                 for(auto c = 0 ; c < channel ; ++c ){
-                    for(auto k = 0 ; k < m ; ++k )
-                        ak[ c * bsdfTable.nMax + k ] += w * a[ c * m + k ];
+                    const auto src = a + c * m;
+                    const auto dst = ak + c * bsdfTable.nMax;
+                    auto k = 0;
+#ifdef SSE_ENABLED
+                    const auto w4 = _mm_set1_ps( w );
+                    for( ; k + 4 <= m ; k += 4 )
+                        _mm_storeu_ps( dst + k , _mm_add_ps( _mm_loadu_ps( dst + k ) , _mm_mul_ps( w4 , _mm_loadu_ps( src + k ) ) ) );
+#endif
+                    for( ; k < m ; ++k )
+                        dst[k] += w * src[k];
                 }
             }
         }
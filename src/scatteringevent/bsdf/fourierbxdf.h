@@ -19,6 +19,7 @@
 
 #include "bxdf.h"
 #include "core/resource.h"
+#include "stream/mmapstream.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeFourier, "fourier")
@@ -31,6 +32,8 @@ DECLARE_CLOSURE_TYPE_END(ClosureTypeFourier)
  * Same with MERL brdf, FourierBxdf is also a measured bxdf.
  * However, it is much compact comparing with MERL in term of memory usage.
  * There is also an importance sampling method provided in the bxdf type.
+ * The file is mapped in memory instead of being read, the tables are used in place. Pages of the tables are only
+ * read when they are touched, and they are shared by all processes rendering with the same file.
  */
 class FourierBxdfData : public Resource {
 public:
@@ -71,28 +74,28 @@ public:
     bool    LoadResource(const std::string filename) override;
 
 private:
-    // Bxdf Table
+    // Bxdf Table, the arrays that are not owned point to the mapped file
     struct FourierBxdfTable{
         float   eta = 1.0f;
         int     nMax = 0;
         int     nChannels = 1;
         int     nMu = 0;
-        std::unique_ptr<float[]>   mu = nullptr;
-        std::unique_ptr<int[]>     m = nullptr;
-        std::unique_ptr<int[]>     aOffset = nullptr;
-        std::unique_ptr<float[]>   a = nullptr;
+        const float*    mu = nullptr;
+        const float*    cdf = nullptr;
+        const int*      offsetAndLength = nullptr;  // offset of the coefficients in 'a' and the number of them, for each pair of nodes
+        const float*    a = nullptr;
         std::unique_ptr<float[]>   a0 = nullptr;
-        std::unique_ptr<float[]>   cdf = nullptr;
         std::unique_ptr<float[]>   recip = nullptr;
 
-        float* GetAk( int offsetI , int offsetO , int* mptr ) const{
+        const float* GetAk( int offsetI , int offsetO , int* mptr ) const{
             const int offset = offsetO * nMu + offsetI;
-            *mptr = m[offset];
-            return a.get() + aOffset[offset];
+            *mptr = offsetAndLength[2 * offset + 1];
+            return a + offsetAndLength[2 * offset];
         }
     };
 
-    FourierBxdfTable    bsdfTable;
+    FourierBxdfTable                    bsdfTable;
+    std::unique_ptr<IMappedFileStream>  m_file;     /**< The mapped file holding the tables. */
 
     // Fourier interpolation
     float fourier( const float* ak , int m , double cosPhi ) const;
@@ -15,11 +15,18 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <array>
+#include <mutex>
+#include <unordered_map>
+#ifdef SSE_ENABLED
+#include <emmintrin.h>
+#endif
 #include "hair.h"
 #include "sampler/sample.h"
 #include "core/samplemethod.h"
 #include "fresnel.h"
 #include "math/utils.h"
+#include "core/globalconfig.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHair)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHair, Tsl_float3, sigma)
@@ -110,11 +117,212 @@ SORT_STATIC_FORCEINLINE void ComputeApPdf(const float cosThetaO , const float co
         pdf[i] = ap[i].GetIntensity() / sumY;
 }
 
-Hair::Hair(const ClosureTypeHair& params, const Spectrum& weight): Hair(params.sigma, params.longtitudinalRoughness, params.azimuthalRoughness, params.ior, weight, true ){}
+// Logistic function with unit scale, e^-t / ( 1 + e^-t )^2, tabulated for t in [0, HAIR_LOGISTIC_RANGE].
+// It is a few ulps away from zero beyond the range.
+#define HAIR_LOGISTIC_RANGE     32
+#define HAIR_LOGISTIC_RES       16
+#define HAIR_LOGISTIC_CNT       ( HAIR_LOGISTIC_RANGE * HAIR_LOGISTIC_RES )
+// Up to this number of tables are cached, hair with even more different parameters falls back to per hit evaluation.
+#define HAIR_TABLE_MAX          4096
+
+static const auto g_logistic = [](){
+    std::array<float, HAIR_LOGISTIC_CNT + 1> table;
+    for( auto i = 0 ; i <= HAIR_LOGISTIC_CNT ; ++i ){
+        const auto e = exp( -(double)i / HAIR_LOGISTIC_RES );
+        table[i] = (float)( e / SQR( 1.0 + e ) );
+    }
+    return table;
+}();
+
+// Coefficients of the series in I0, 1 / ( 4^i * ( i! )^2 ).
+static const auto g_I0Coeff = [](){
+    std::array<float, 10> coeff;
+    auto ifact = 1.0;
+    for( auto i = 0 ; i < 10 ; ++i ){
+        if( i > 1 ) ifact *= i;
+        coeff[i] = (float)( 1.0 / ( pow( 4.0 , i ) * ifact * ifact ) );
+    }
+    return coeff;
+}();
+
+HairAzimuthalTable::HairAzimuthalTable( const float lRoughness , const float aRoughness , const float ior ){
+    v[0] = SQR(0.726f * lRoughness + 0.812f * SQR(lRoughness) + 3.7f * Pow<20>(lRoughness));
+    v[1] = 0.25f * v[0];
+    v[2] = 4 * v[0];
+    for (int p = 3; p <= PMAX; ++p)
+        v[p] = v[2];
+
+    for( auto p = 0 ; p <= PMAX ; ++p ){
+        invV[p] = 1.0f / v[p];
+        mpNorm[p] = ( v[p] <= .1 ) ? ( -1 / v[p] + 0.6931f + log( 1 / ( 2 * v[p] ) ) ) : 1.0f / ( sinh( 1 / v[p] ) * 2 * v[p] );
+        expV[p] = exp( -2.0f / v[p] );
+    }
+
+    constexpr auto SqrtPiOver8 = 0.626657069f; //sqrt( PI / 8.0f );
+    scale = SqrtPiOver8 * (0.265f * aRoughness + 1.194f * SQR(aRoughness) + 5.372f * Pow<22>(aRoughness));
+    invScale = 1.0f / scale;
+    cdfLow = LogisticCDF( -PI , scale );
+    cdfRange = LogisticCDF( PI , scale ) - cdfLow;
+    npNorm = 1.0f / ( scale * cdfRange );
+
+    etaSqr = SQR( ior );
+}
+
+namespace {
+    struct HairTableKey{
+        float lRoughness;
+        float aRoughness;
+        float eta;
+
+        bool operator == ( const HairTableKey& key ) const {
+            return lRoughness == key.lRoughness && aRoughness == key.aRoughness && eta == key.eta;
+        }
+    };
+
+    struct HairTableKeyHash{
+        size_t operator()( const HairTableKey& key ) const {
+            const auto h0 = std::hash<float>()( key.lRoughness );
+            const auto h1 = std::hash<float>()( key.aRoughness );
+            const auto h2 = std::hash<float>()( key.eta );
+            return h0 ^ ( h1 * 0x9e3779b97f4a7c15ull ) ^ ( h2 * 0xc2b2ae3d27d4eb4full );
+        }
+    };
+}
+
+// Tables are never released, they are tiny and hair with the same parameters shows up again in the next frame.
+static const HairAzimuthalTable* GetAzimuthalTable( const float lRoughness , const float aRoughness , const float eta ){
+    const HairTableKey key = { lRoughness , aRoughness , eta };
+
+    // Neighbouring hits mostly share the same material, there is no need to lock for them.
+    thread_local static HairTableKey            g_lastKey = { -1.0f , -1.0f , -1.0f };
+    thread_local static const HairAzimuthalTable*  g_lastTable = nullptr;
+    if( key == g_lastKey )
+        return g_lastTable;
+
+    static std::mutex mutex;
+    static std::unordered_map<HairTableKey, std::unique_ptr<HairAzimuthalTable>, HairTableKeyHash> tables;
+
+    const HairAzimuthalTable* table = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = tables.find( key );
+        if( it != tables.end() )
+            table = it->second.get();
+        else if( tables.size() < HAIR_TABLE_MAX )
+            table = ( tables[key] = std::make_unique<HairAzimuthalTable>( lRoughness , aRoughness , eta ) ).get();
+    }
+
+    g_lastKey = key;
+    g_lastTable = table;
+    return table;
+}
+
+SORT_STATIC_FORCEINLINE float LogisticLookup( const float t ){
+    const auto x = std::min( t * HAIR_LOGISTIC_RES , (float)HAIR_LOGISTIC_CNT - 0.001f );
+    const auto i = (int)x;
+    const auto d = x - i;
+    return g_logistic[i] * ( 1.0f - d ) + g_logistic[i+1] * d;
+}
+
+SORT_STATIC_FORCEINLINE float MpTabulated( const float a , const float b , const float i0 , const float v , const float norm ){
+    if( v <= .1 )
+        return exp( ( a > 12 ? a + 0.5f * ( -log( TWO_PI ) + log( 1 / a ) + 1 / ( 8 * a ) ) : log( i0 ) ) - b + norm );
+    return exp( -b ) * i0 * norm;
+}
+
+SORT_STATIC_FORCEINLINE float SampleTrimmedLogisticTabulated( const float r , const HairAzimuthalTable& table ){
+    const auto x = -table.scale * log( 1 / ( r * table.cdfRange + table.cdfLow ) - 1 );
+    return clamp( x , -PI , PI );
+}
+
+// Evaluate Mp * Np of all lobes with the shared table, the last lobe is uniform in azimuth.
+SORT_STATIC_FORCEINLINE void LobesTabulated( const HairAzimuthalTable& table , const float cosThetaI , const float cosThetaO , const float sinThetaI , const float sinThetaO ,
+                                             const float phi , const float gammaO , const float gammaT , float w[] ){
+#ifdef SSE_ENABLED
+    static_assert( PMAX == 3 , "Hair lobes are evaluated in one SSE register." );
+
+    // Longtitudinal terms, the series in I0 is evaluated for all lobes at once.
+    const auto invV = _mm_loadu_ps( table.invV );
+    const auto a = _mm_mul_ps( _mm_set1_ps( cosThetaI * cosThetaO ) , invV );
+    const auto b = _mm_mul_ps( _mm_set1_ps( sinThetaI * sinThetaO ) , invV );
+    const auto x2 = _mm_mul_ps( a , a );
+    auto i0 = _mm_set1_ps( g_I0Coeff[9] );
+    for( auto i = 8 ; i >= 0 ; --i )
+        i0 = _mm_add_ps( _mm_mul_ps( i0 , x2 ) , _mm_set1_ps( g_I0Coeff[i] ) );
+
+    alignas(16) float av[4], bv[4], i0v[4], mp[4];
+    _mm_store_ps( av , a );
+    _mm_store_ps( bv , b );
+    _mm_store_ps( i0v , i0 );
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        mp[p] = MpTabulated( av[p] , bv[p] , i0v[p] , table.v[p] , table.mpNorm[p] );
+
+    // Azimuthal terms, dphi = phi - Phi( p , gammaO , gammaT ) wrapped into [-PI, PI].
+    const auto p = _mm_set_ps( 3.0f , 2.0f , 1.0f , 0.0f );
+    const auto phiP = _mm_sub_ps( _mm_mul_ps( p , _mm_set1_ps( 2.0f * gammaT + PI ) ) , _mm_set1_ps( 2.0f * gammaO ) );
+    auto dphi = _mm_sub_ps( _mm_set1_ps( phi ) , phiP );
+    const auto k = _mm_mul_ps( _mm_add_ps( dphi , _mm_set1_ps( PI ) ) , _mm_set1_ps( INV_TWOPI ) );
+    auto kf = _mm_cvtepi32_ps( _mm_cvttps_epi32( k ) );
+    kf = _mm_sub_ps( kf , _mm_and_ps( _mm_cmpgt_ps( kf , k ) , _mm_set1_ps( 1.0f ) ) );
+    dphi = _mm_sub_ps( dphi , _mm_mul_ps( kf , _mm_set1_ps( TWO_PI ) ) );
+
+    const auto absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+    const auto t = _mm_mul_ps( _mm_mul_ps( _mm_and_ps( dphi , absMask ) , _mm_set1_ps( table.invScale ) ) , _mm_set1_ps( (float)HAIR_LOGISTIC_RES ) );
+    const auto x = _mm_min_ps( t , _mm_set1_ps( (float)HAIR_LOGISTIC_CNT - 0.001f ) );
+    const auto xi = _mm_cvttps_epi32( x );
+    const auto d = _mm_sub_ps( x , _mm_cvtepi32_ps( xi ) );
+
+    alignas(16) int idx[4];
+    _mm_store_si128( (__m128i*)idx , xi );
+    const auto l0 = _mm_set_ps( g_logistic[idx[3]] , g_logistic[idx[2]] , g_logistic[idx[1]] , g_logistic[idx[0]] );
+    const auto l1 = _mm_set_ps( g_logistic[idx[3]+1] , g_logistic[idx[2]+1] , g_logistic[idx[1]+1] , g_logistic[idx[0]+1] );
+    auto np = _mm_mul_ps( _mm_add_ps( l0 , _mm_mul_ps( _mm_sub_ps( l1 , l0 ) , d ) ) , _mm_set1_ps( table.npNorm ) );
+
+    // The last lobe is uniform in azimuth.
+    const auto last = _mm_castsi128_ps( _mm_set_epi32( -1 , 0 , 0 , 0 ) );
+    np = _mm_or_ps( _mm_andnot_ps( last , np ) , _mm_and_ps( last , _mm_set1_ps( INV_TWOPI ) ) );
+
+    _mm_storeu_ps( w , _mm_mul_ps( _mm_load_ps( mp ) , np ) );
+#else
+    for( auto p = 0 ; p <= PMAX ; ++p ){
+        const auto a = cosThetaI * cosThetaO * table.invV[p];
+        const auto b = sinThetaI * sinThetaO * table.invV[p];
+        auto i0 = g_I0Coeff[9];
+        for( auto i = 8 ; i >= 0 ; --i )
+            i0 = i0 * a * a + g_I0Coeff[i];
+        const auto mp = MpTabulated( a , b , i0 , table.v[p] , table.mpNorm[p] );
+
+        if( p == PMAX ){
+            w[p] = mp * INV_TWOPI;
+            break;
+        }
 
-Hair::Hair(const Spectrum& absorption, const float lRoughness, const float aRoughness, const float ior, const Spectrum& weight, bool doubleSided)
+        float dphi = phi - Phi( p , gammaO , gammaT );
+        while( dphi > PI ) dphi -= TWO_PI;
+        while( dphi < -PI ) dphi += TWO_PI;
+        w[p] = mp * LogisticLookup( abs( dphi ) * table.invScale ) * table.npNorm;
+    }
+#endif
+}
+
+Hair::Hair(const ClosureTypeHair& params, const Spectrum& weight): Hair(params.sigma, params.longtitudinalRoughness, params.azimuthalRoughness, params.ior, weight, true, g_hairTabulated ){}
+
+Hair::Hair(const Spectrum& absorption, const float lRoughness, const float aRoughness, const float ior, const Spectrum& weight, bool doubleSided, bool tabulated)
         : Bxdf(weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), Vector(0.0f,1.0f,0.0f), doubleSided) ,
         m_sigma(absorption), m_lRoughness( std::max( 0.01f , lRoughness) ), m_aRoughness( std::max( 0.01f , aRoughness ) ), m_eta(ior){
+#ifdef DISABLE_ANGLE_TILT
+    // The shared table doesn't take the tilting angle into account.
+    if( tabulated )
+        m_table = GetAzimuthalTable( m_lRoughness , m_aRoughness , m_eta );
+    if( m_table ){
+        for( auto p = 0 ; p <= PMAX ; ++p )
+            m_v[p] = m_table->v[p];
+        m_scale = m_table->scale;
+        m_etaSqr = m_table->etaSqr;
+        return;
+    }
+#endif
+
     m_v[0] = SQR(0.726f * m_lRoughness + 0.812f * SQR(m_lRoughness) + 3.7f * Pow<20>(m_lRoughness));
     m_v[1] = 0.25f * m_v[0];
     m_v[2] = 4 * m_v[0];
@@ -174,6 +382,14 @@ Spectrum Hair::f( const Vector& wo , const Vector& wi ) const{
     Ap( cosThetaO , m_eta , cosGammaO , expT , ap );
 
     Spectrum fsum(0.0f);
+    if( m_table ){
+        float w[PMAX + 1];
+        LobesTabulated( *m_table , cosThetaI , cosThetaO , sinThetaI , sinThetaO , phi , gammaO , gammaT , w );
+        for( auto p = 0 ; p <= PMAX ; ++p )
+            fsum += ap[p] * w[p];
+        return fsum;
+    }
+
     for( auto p = 0 ; p < PMAX ; ++p ){
 #ifndef DISABLE_ANGLE_TILT
         float sinThetaIp , cosThetaIp;
@@ -234,7 +450,8 @@ Spectrum Hair::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs, floa
 
     r = sort_canonical();
     // special handling for corner case where 'r' equals to 0, leading exp( -2.0f / m_v[p] ) potentially reaches 0, eventually resulting in a 'Nan'
-    const auto cosTheta = r > 0.0f ? ( 1.0f + m_v[p] * log( r + ( 1.0f - r ) * exp( -2.0f / m_v[p] ) ) ) : -1.0f ;
+    const auto expV = m_table ? m_table->expV[p] : exp( -2.0f / m_v[p] );
+    const auto cosTheta = r > 0.0f ? ( 1.0f + m_v[p] * log( r + ( 1.0f - r ) * expV ) ) : -1.0f ;
     const auto sinTheta = ssqrt( 1.0f - SQR( cosTheta ) );
     const auto cosPhi = cos( TWO_PI * sort_canonical() );
     auto sinThetaI = -cosTheta * sinThetaO + sinTheta * cosPhi * cosThetaO;
@@ -260,12 +477,18 @@ Spectrum Hair::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs, floa
 
     const auto gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
     const auto gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
-    const auto dphi = ( p < PMAX ) ? Phi( p , gammaO , gammaT ) + SampleTrimmedLogistic( sort_canonical() , m_scale , -PI , PI ) : TWO_PI * sort_canonical();
+    const auto dphi = ( p < PMAX ) ? Phi( p , gammaO , gammaT ) + ( m_table ? SampleTrimmedLogisticTabulated( sort_canonical() , *m_table ) : SampleTrimmedLogistic( sort_canonical() , m_scale , -PI , PI ) ) : TWO_PI * sort_canonical();
 
     const auto phiI = phiO + dphi;
     wi = Vector3f( sinThetaI , cosThetaI * sin( phiI ) , cosThetaI * cos( phiI ) );
 
-    if( pPdf ){
+    if( pPdf && m_table ){
+        float w[PMAX + 1];
+        LobesTabulated( *m_table , cosThetaI , cosThetaO , sinThetaI , sinThetaO , dphi , gammaO , gammaT , w );
+        *pPdf = 0.0f;
+        for( auto p = 0 ; p <= PMAX ; ++p )
+            *pPdf += apPdf[p] * w[p];
+    }else if( pPdf ){
         *pPdf = 0.0f;
         for( auto p = 0 ; p < PMAX ; ++p ){
 #ifndef DISABLE_ANGLE_TILT
@@ -324,6 +547,13 @@ float Hair::pdf( const Vector& wo , const Vector& wi ) const{
 
     auto phi = phiI - phiO;
     auto pdf = 0.0f;
+    if( m_table ){
+        float w[PMAX + 1];
+        LobesTabulated( *m_table , cosThetaI , cosThetaO , sinThetaI , sinThetaO , phi , gammaO , gammaT , w );
+        for( auto p = 0 ; p <= PMAX ; ++p )
+            pdf += apPdf[p] * w[p];
+        return pdf;
+    }
     for( auto p = 0 ; p < PMAX ; ++p ){
 #ifndef DISABLE_ANGLE_TILT
         float sinThetaIp , cosThetaIp;
@@ -349,3 +579,83 @@ float Hair::pdf( const Vector& wo , const Vector& wi ) const{
     pdf += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[PMAX] ) * apPdf[PMAX] * INV_TWOPI;
     return pdf;
 }
+
+Spectrum Hair::F_Pdf( const Vector& bwo , const Vector& bwi , float& pdf ) const{
+    pdf = 0.0f;
+
+    const auto wo = bsdfToBxdf( bwo );
+    const auto wi = bsdfToBxdf( bwi );
+    if( wo.y <= 0.0f || wi.y == 0.0f )
+        return 0.0f;
+
+    const auto sinThetaO = wo.x;
+    const auto cosThetaO = ssqrt( 1.0f - SQR(sinThetaO) );
+    const auto phiO = atan2(wo.y, wo.z);
+
+    const auto sinThetaI = wi.x;
+    const auto cosThetaI = ssqrt( 1.0f - SQR(sinThetaI) );
+    const auto phiI = atan2(wi.y, wi.z);
+
+    const auto sinThetaT = sinThetaO / m_eta;
+    const auto cosThetaT = ssqrt( 1.0f - SQR(sinThetaT) );
+
+    const auto etap = sqrt( m_etaSqr - SQR( sinThetaO ) ) / cosThetaO;
+
+    const auto cosGammaO = wo.y / cosThetaO;
+    const auto sinGammaO = wo.z / cosThetaO;
+    const auto gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
+
+    const auto sinGammaT = sinGammaO / etap;
+    const auto cosGammaT = ssqrt( 1.0f - SQR(sinGammaT) );
+    const auto gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
+
+    const auto T = m_sigma * ( -2.0f * cosGammaT / cosThetaT );
+    const auto expT = T.Exp();
+    const auto phi = phiI - phiO;
+
+    // the pdf of picking a lobe is the normalized intensity of its attenuation
+    Spectrum ap[PMAX + 1];
+    Ap( cosThetaO , m_eta , cosGammaO , expT , ap );
+    float apPdf[PMAX + 1];
+    auto sumY = 0.0f;
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        sumY += ( apPdf[p] = ap[p].GetIntensity() );
+
+    // Mp * Np of each lobe is shared by the BRDF and the pdf
+    float w[PMAX + 1];
+    if( m_table ){
+        LobesTabulated( *m_table , cosThetaI , cosThetaO , sinThetaI , sinThetaO , phi , gammaO , gammaT , w );
+    }else{
+        for( auto p = 0 ; p < PMAX ; ++p ){
+#ifndef DISABLE_ANGLE_TILT
+            float sinThetaIp , cosThetaIp;
+            if( p == 0 ){
+                sinThetaIp = sinThetaI * m_cos2kAlpha[1] + cosThetaI * m_sin2kAlpha[1];
+                cosThetaIp = cosThetaI * m_cos2kAlpha[1] - sinThetaI * m_sin2kAlpha[1];
+            }else if( p == 1 ){
+                sinThetaIp = sinThetaI * m_cos2kAlpha[0] - cosThetaI * m_sin2kAlpha[0];
+                cosThetaIp = cosThetaI * m_cos2kAlpha[0] + sinThetaI * m_sin2kAlpha[0];
+            }else if( p == 2 ){
+                sinThetaIp = sinThetaI * m_cos2kAlpha[2] - cosThetaI * m_sin2kAlpha[2];
+                cosThetaIp = cosThetaI * m_cos2kAlpha[2] + sinThetaI * m_sin2kAlpha[2];
+            }else{
+                sinThetaIp = sinThetaI;
+                cosThetaIp = cosThetaI;
+            }
+            cosThetaIp = abs( cosThetaIp );
+            w[p] = Mp( cosThetaIp , cosThetaO , sinThetaIp , sinThetaO , m_v[p] ) * Np( phi, p, m_scale, gammaO, gammaT );
+#else
+            w[p] = Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[p] ) * Np( phi, p, m_scale, gammaO, gammaT );
+#endif
+        }
+        w[PMAX] = Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[PMAX] ) * INV_TWOPI;
+    }
+
+    Spectrum fsum(0.0f);
+    for( auto p = 0 ; p <= PMAX ; ++p ){
+        fsum += ap[p] * w[p];
+        pdf += apPdf[p] * w[p];
+    }
+    pdf /= sumY;
+    return fsum;
+}
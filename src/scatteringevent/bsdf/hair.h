@@ -31,6 +31,33 @@ DECLARE_CLOSURE_TYPE_END(ClosureTypeHair)
 #define DISABLE_ANGLE_TILT
 #define PMAX                    3
 
+//! @brief Terms of the hair BRDF depending only on its roughness and index of refraction.
+/**
+ * Groom renders construct hair bxdfs with the same parameters at tens of millions of hits. Everything derived
+ * from roughness and index of refraction is computed once in this table and shared by all of them. The azimuthal
+ * logistic function is normalized so that it is looked up in a table shared by all roughness values. Absorption
+ * only attenuates each lobe, it is still evaluated per hit.
+ */
+struct HairAzimuthalTable{
+    //! Constructor
+    //!
+    //! @param lRoughness       Longtitudinal roughness, clamped already.
+    //! @param aRoughness       Azimuthal roughness, clamped already.
+    //! @param ior              Index of refraction inside hair.
+    HairAzimuthalTable( const float lRoughness , const float aRoughness , const float ior );
+
+    float   v[PMAX+1];          /**< Longtitudinal variance of each lobe. */
+    float   invV[PMAX+1];       /**< Reciprocal of the longtitudinal variance of each lobe. */
+    float   mpNorm[PMAX+1];     /**< Normalization factor of Mp, in log space if the variance is not larger than 0.1. */
+    float   expV[PMAX+1];       /**< exp( -2 / v ), used in sampling the longtitudinal terms. */
+    float   scale;              /**< Azimuhthal logisitic scale factor. */
+    float   invScale;           /**< Reciprocal of the scale factor. */
+    float   npNorm;             /**< Normalization factor of the logistic function trimmed to [-PI, PI]. */
+    float   cdfLow;             /**< Logistic CDF at -PI. */
+    float   cdfRange;           /**< Logistic CDF at PI minus the one at -PI. */
+    float   etaSqr;             /**< Squared eta. */
+};
+
 //! @brief Hair BRDF.
 /**
  * 'The Implementation of a Hair Scattering Model' by Matt Pharr.
@@ -51,7 +78,9 @@ public:
     //! @param aRoughness       Azimuthal Roughness.
     //! @param ior              Index of Refraction inside hair.
     //! @param weight           Weight of the BXDF
-    Hair(const Spectrum& absorption, const float lRoughness, const float aRoughness, const float ior, const Spectrum& weight, bool doubleSided = false);
+    //! @param doubleSided      Whether the BXDF is double sided.
+    //! @param tabulated        Share the table of the parameters with other hair bxdfs instead of computing it.
+    Hair(const Spectrum& absorption, const float lRoughness, const float aRoughness, const float ior, const Spectrum& weight, bool doubleSided = false, bool tabulated = false);
 
     //! Evaluate the BRDF
     //! @param wo   Exitant direction in shading coordinate.
@@ -73,6 +102,13 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Evaluate the BRDF and the pdf at once, both are weighted sums of the same longitudinal and azimuthal lobes.
+    //! @param wo   Exitant direction in local space.
+    //! @param wi   Incident direction in local space.
+    //! @param pdf  The probability of choosing the out-going direction based on the Incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const override;
+
 private:
     const Spectrum  m_sigma;            /**< Absorption coefficient. */
     const float     m_lRoughness;       /**< Longtitudinal roughness. */
@@ -82,6 +118,7 @@ private:
     float           m_v[PMAX+1];          /**< Some pre-calculated cached data. */
     float           m_scale;              /**< Azimuhthal logisitic scale factor. */
     float           m_etaSqr;             /**< Squared eta. */
+    const HairAzimuthalTable* m_table = nullptr;    /**< Shared table of the parameters, lobes are evaluated with it if available. */
 #ifndef DISABLE_ANGLE_TILT
     float           m_cos2kAlpha[PMAX];   /**< Some pre-calculated cached data, cos( 2 ^ k ). */
     float           m_sin2kAlpha[PMAX];   /**< Some pre-calculated cached data, sin( 2 ^ k ). */
@@ -17,11 +17,16 @@
 
 #include <string.h>
 #include <fstream>
+#include <vector>
+#ifdef SSE_ENABLED
+#include <emmintrin.h>
+#endif
 #include "merl.h"
 #include "core/define.h"
 #include "core/memory.h"
 #include "core/path.h"
 #include "math/vector3.h"
+#include "math/utils.h"
 #include "material/matmanager.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeMERL)
@@ -38,6 +43,9 @@ static const double MERL_RED_SCALE = 0.0006666666666667;
 static const double MERL_GREEN_SCALE = 0.000766666666666667;
 static const double MERL_BLUE_SCALE = 0.0011066666666666667;
 
+SORT_STATS_DEFINE_MEMORY(sMerlMemory)
+SORT_STATS_MEMORY("Measured BRDF Data", sMerlMemory);
+
 // Load data from file
 bool MerlData::LoadResource( const std::string filename )
 {
@@ -60,22 +68,70 @@ bool MerlData::LoadResource( const std::string filename )
         return false;
     }
 
-    // allocate data
-    auto trunksize = dims[0] * dims[1] * dims[2];
-    auto size = 3u * trunksize;
-    m_data = std::make_unique<double[]>(size);
-    file.read( (char*)m_data.get() , sizeof( double ) * size );
+    // the half floats are padded with one more element so that a sample can be loaded with one 64 bits read
+    const auto trunksize = dims[0] * dims[1] * dims[2];
+    const auto size = 3u * trunksize;
+    const auto bytes = m_halfPrecision ? sizeof( unsigned short ) * ( size + 1 ) : sizeof( float ) * size;
+
+    // the file keeps the channels one after another in doubles, they are interleaved and scaled while loading
+    auto decode = [&]( char* out ) -> bool {
+        static const double scales[3] = { MERL_RED_SCALE , MERL_GREEN_SCALE , MERL_BLUE_SCALE };
+        const auto half_out = (unsigned short*)out;
+        const auto float_out = (float*)out;
+        std::vector<double> channel( trunksize );
+        for( auto c = 0u ; c < 3u ; ++c ){
+            file.read( (char*)channel.data() , sizeof( double ) * trunksize );
+            for( auto i = 0u ; i < trunksize ; ++i ){
+                const auto v = (float)( channel[i] * scales[c] );
+                if( m_halfPrecision )
+                    half_out[3 * i + c] = FloatToHalf( v );
+                else
+                    float_out[3 * i + c] = v;
+            }
+        }
+        if( m_halfPrecision )
+            half_out[size] = 0;
+        return !file.fail();
+    };
+
+    // the table decoded by another process is used as it is, the file isn't even read
+    if( m_sharedHash ){
+        const auto name = SharedResourceData::Name( m_halfPrecision ? "merl16" : "merl32" , m_sharedHash );
+        auto shared = std::make_unique<SharedResourceData>();
+        if( ( shared->Attach( name ) && shared->GetSize() == bytes ) || shared->Publish( name , bytes , decode ) ){
+            m_shared = std::move( shared );
+            m_table = m_halfPrecision ? nullptr : (const float*)m_shared->GetData();
+            m_halfTable = m_halfPrecision ? (const unsigned short*)m_shared->GetData() : nullptr;
+            return true;
+        }
+
+        // the file could be partially read by the failed attempt
+        file.clear();
+        file.seekg( sizeof( unsigned int ) * 3 );
+    }
 
-    unsigned offset = 0;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_RED_SCALE;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_GREEN_SCALE;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_BLUE_SCALE;
+    auto valid = false;
+    if( m_halfPrecision ){
+        m_halfData = std::make_unique<unsigned short[]>(size + 1);
+        valid = decode( (char*)m_halfData.get() );
+        m_halfTable = m_halfData.get();
+    }else{
+        m_data = std::make_unique<float[]>(size);
+        valid = decode( (char*)m_data.get() );
+        m_table = m_data.get();
+    }
+    SORT_STATS(m_memoryRecord.Track(&sMerlMemory, (StatsInt)GetDataSize()));
 
     file.close();
-    return true;
+    return valid;
+}
+
+// size of the loaded data
+size_t MerlData::GetDataSize() const
+{
+    if( m_halfTable )
+        return sizeof( unsigned short ) * ( 3 * MERL_SAMPLING_COUNT + 1 );
+    return m_table ? sizeof( float ) * 3 * MERL_SAMPLING_COUNT : 0;
 }
 
 // evaluate bxdf
@@ -117,16 +173,30 @@ Spectrum MerlData::f( const Vector& Wo , const Vector& Wi ) const
     auto wdThetaIndex = (int)clamp(wdTheta * INV_PI * 2.0f * MERL_SAMPLING_RES_THETA_D, 0.f , (float)(MERL_SAMPLING_RES_THETA_D-1));
     auto wdPhiIndex = (int)clamp(wdPhi * INV_PI * MERL_SAMPLING_RES_PHI_D, 0.f , (float)(MERL_SAMPLING_RES_PHI_D - 1));
 
-    // calculate the index
-    auto index = wdPhiIndex + MERL_SAMPLING_RES_PHI_D * (wdThetaIndex + whThetaIndex * MERL_SAMPLING_RES_THETA_D);
+    // calculate the index, all three channels of the sample are next to each other
+    const auto index = 3 * ( wdPhiIndex + MERL_SAMPLING_RES_PHI_D * (wdThetaIndex + whThetaIndex * MERL_SAMPLING_RES_THETA_D) );
 
-    const auto r = (float)( m_data[ index ] );
-    index += MERL_SAMPLING_COUNT;
-    const auto g = (float)( m_data[ index ] );
-    index += MERL_SAMPLING_COUNT;
-    const auto b = (float)( m_data[ index ] );
+    if( !m_halfTable ){
+        const auto rgb = m_table + index;
+        return Spectrum( rgb[0] , rgb[1] , rgb[2] );
+    }
 
-    return Spectrum( r , g , b );
+#ifdef SSE_ENABLED
+    // Converting the three channels at once. The exponent and mantissa of a half float shifted to the position of a float
+    // is the value scaled by 2^-112, which takes care of denormalized half floats too. The data has neither infinity nor
+    // nan since they are clamped to the largest half float when it is loaded.
+    const auto h = _mm_unpacklo_epi16( _mm_loadl_epi64( (const __m128i*)( m_halfTable + index ) ) , _mm_setzero_si128() );
+    const auto sign = _mm_slli_epi32( _mm_and_si128( h , _mm_set1_epi32( 0x8000 ) ) , 16 );
+    const auto em = _mm_slli_epi32( _mm_and_si128( h , _mm_set1_epi32( 0x7fff ) ) , 13 );
+    const auto v = _mm_or_ps( _mm_mul_ps( _mm_castsi128_ps( em ) , _mm_castsi128_ps( _mm_set1_epi32( 0x77800000 ) ) ) , _mm_castsi128_ps( sign ) );
+
+    alignas(16) float rgb[4];
+    _mm_store_ps( rgb , v );
+    return Spectrum( rgb[0] , rgb[1] , rgb[2] );
+#else
+    const auto rgb = m_halfTable + index;
+    return Spectrum( HalfToFloat( rgb[0] ) , HalfToFloat( rgb[1] ) , HalfToFloat( rgb[2] ) );
+#endif
 }
 
  Merl::Merl(const ClosureTypeMERL& params, const Spectrum& weight, bool doubleSided)
@@ -19,6 +19,8 @@
 
 #include "bxdf.h"
 #include "core/resource.h"
+#include "core/sharedresource.h"
+#include "core/stats.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeMERL, "merl")
@@ -39,6 +41,14 @@ DECLARE_CLOSURE_TYPE_END(ClosureTypeMERL)
 class MerlData : public Resource
 {
 public:
+    //! Constructor
+    //!
+    //! The measured data is stored as floats, or half floats if memory matters more than precision. Either way, the three
+    //! channels of a sample are next to each other so that an evaluation only touches one place in the table.
+    //!
+    //! @param halfPrecision    Whether the data is stored as half floats.
+    MerlData( bool halfPrecision = false ) : m_halfPrecision( halfPrecision ) {}
+
     //! Evaluate the BRDF
     //! @param wo   Exitant direction in shading coordinate.
     //! @param wi   Incident direction in shading coordinate.
@@ -51,10 +61,20 @@ public:
 
     //! Whether there is valid data loaded.
     //! @return True if data is valid, otherwise it will return false.
-    bool    IsValid() { return m_data != 0; }
+    bool    IsValid() { return m_table != nullptr || m_halfTable != nullptr; }
+
+    //! Size of the loaded data.
+    //! @return Size of the loaded data in bytes.
+    size_t  GetDataSize() const;
 
 private:
-    std::unique_ptr<double[]>    m_data = nullptr;   /**< The actual data of MERL brdf. */
+    const bool                          m_halfPrecision;        /**< Whether the data is stored as half floats. */
+    std::unique_ptr<float[]>            m_data = nullptr;       /**< The actual data of MERL brdf, three channels of each sample are interleaved. */
+    std::unique_ptr<unsigned short[]>   m_halfData = nullptr;   /**< The actual data of MERL brdf in half floats, only if it is in half precision. */
+    std::unique_ptr<SharedResourceData> m_shared = nullptr;     /**< The data shared with other processes, the data above is empty if it is valid. */
+    const float*                        m_table = nullptr;      /**< The data in floats, either owned or shared. */
+    const unsigned short*               m_halfTable = nullptr;  /**< The data in half floats, either owned or shared. */
+    SORT_STATS_MEMORY_RECORD(m_memoryRecord)                    /**< Memory of the data accounted in stats. */
 };
 
 //! @brief  MERL brdf.
@@ -90,6 +90,37 @@ IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeMicrofacetRefractionBeckmann, Tsl_float3,
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeMicrofacetRefractionBeckmann, Tsl_float3, normal)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeMicrofacetRefractionBeckmann)
 
+// Inverse of the error function, 'Approximating the erfinv function' (Mike Giles 2010).
+SORT_STATIC_FORCEINLINE float erfInv( float x ){
+    x = clamp( x , -0.99999f , 0.99999f );
+    auto w = -std::log( ( 1.0f - x ) * ( 1.0f + x ) );
+    auto p = 0.0f;
+    if( w < 5.0f ){
+        w = w - 2.5f;
+        p = 2.81022636e-08f;
+        p = 3.43273939e-07f + p * w;
+        p = -3.5233877e-06f + p * w;
+        p = -4.39150654e-06f + p * w;
+        p = 0.00021858087f + p * w;
+        p = -0.00125372503f + p * w;
+        p = -0.00417768164f + p * w;
+        p = 0.246640727f + p * w;
+        p = 1.50140941f + p * w;
+    }else{
+        w = std::sqrt( w ) - 3.0f;
+        p = -0.000200214257f;
+        p = 0.000100950558f + p * w;
+        p = 0.00134934322f + p * w;
+        p = -0.00367342844f + p * w;
+        p = 0.00573950773f + p * w;
+        p = -0.0076224613f + p * w;
+        p = 0.00943887047f + p * w;
+        p = 1.00167406f + p * w;
+        p = 2.83297682f + p * w;
+    }
+    return p * x;
+}
+
 Blinn::Blinn( float roughnessU , float roughnessV ) {
     // UE4 style way to convert roughness to alpha used here because it still keeps sharp reflection with low value of roughness
     // http://graphicrants.blogspot.com/2013/08/specular-brdf-reference.html
@@ -216,6 +247,85 @@ float Beckmann::G1( const Vector& v ) const {
     return ( 3.535f * a + 2.181f * a * a ) / ( 1.0f + 2.276f * a + 2.577f * a * a );
 }
 
+Vector Beckmann::SampleVisibleNormal( const Vector& wo , const BsdfSample& bs ) const {
+    // Sampling happens in the upper hemisphere, the normal is flipped back if wo is below the surface.
+    const auto flip = wo.y < 0.0f;
+    const auto v = flip ? -wo : wo;
+
+    // Stretching the view direction so that the problem becomes sampling the visible slopes of an isotropic surface with unit roughness.
+    const auto vs = normalize( Vector( alphaU * v.x , v.y , alphaV * v.z ) );
+    const auto cos_theta = cosTheta( vs );
+
+    float slope_x, slope_z;
+    if( cos_theta > 0.9999f ){
+        // Normal incidence, visible slopes are distributed the same as all slopes.
+        const auto r = std::sqrt( -std::log( 1.0f - bs.u ) );
+        const auto phi = TWO_PI * bs.v;
+        slope_x = r * std::cos( phi );
+        slope_z = r * std::sin( phi );
+    }else{
+        // Inverting the CDF of the visible slope along the view direction with a few Newton-Raphson iterations, it starts
+        // from a fitted initial guess and falls back to bisection whenever an iteration leaves the bracket.
+        static const auto inv_sqrt_pi = 1.0f / std::sqrt( PI );
+        const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - SQR( cos_theta ) ) );
+        const auto tan_theta = sin_theta / cos_theta;
+        const auto cot_theta = 1.0f / tan_theta;
+
+        const auto u = std::max( bs.u , 1e-6f );
+        const auto theta = std::acos( cos_theta );
+        const auto fit = 1.0f + theta * ( -0.876f + theta * ( 0.4265f - 0.0594f * theta ) );
+
+        auto a = -1.0f , c = std::erf( cot_theta );
+        auto b = c - ( 1.0f + c ) * std::pow( 1.0f - u , fit );
+        const auto normalization = 1.0f / ( 1.0f + c + inv_sqrt_pi * tan_theta * std::exp( -SQR( cot_theta ) ) );
+
+        for( auto it = 0 ; it < 9 ; ++it ){
+            if( !( b >= a && b <= c ) )
+                b = 0.5f * ( a + c );
+            const auto inv_erf = erfInv( b );
+            const auto value = normalization * ( 1.0f + b + inv_sqrt_pi * tan_theta * std::exp( -SQR( inv_erf ) ) ) - u;
+            if( std::fabs( value ) < 1e-5f )
+                break;
+            if( value > 0.0f ) c = b;
+            else a = b;
+            b -= value / ( normalization * ( 1.0f - inv_erf * tan_theta ) );
+        }
+        slope_x = erfInv( b );
+        slope_z = erfInv( 2.0f * std::max( bs.v , 1e-6f ) - 1.0f );
+    }
+
+    // Rotating the slopes back to the azimuth of the view direction and unstretching them.
+    const auto cos_phi = cosPhi( vs );
+    const auto sin_phi = sinPhi( vs );
+    const auto sx = alphaU * ( cos_phi * slope_x - sin_phi * slope_z );
+    const auto sz = alphaV * ( sin_phi * slope_x + cos_phi * slope_z );
+
+    const auto wh = normalize( Vector( -sx , 1.0f , -sz ) );
+    return flip ? -wh : wh;
+}
+
+float Beckmann::PdfVisibleNormal( const Vector& wo , const Vector& wh ) const {
+    // D_wo(h) = G1(wo) * max( 0 , wo . h ) * D(h) / |wo . n|, with h flipped to the same hemisphere as wo
+    const auto NoV = absCosTheta( wo );
+    if( NoV == 0.0f ) return 0.0f;
+    const auto VoH = wo.y * wh.y < 0.0f ? -dot( wo , wh ) : dot( wo , wh );
+    if( VoH <= 0.0f ) return 0.0f;
+    return G1( wo ) * VoH * D( wh ) / NoV;
+}
+
+float Beckmann::DGWithPdf( const Vector& wo , const Vector& wi , const Vector& wh , float& pdf ) const {
+    const auto d = D( wh );
+    const auto g1o = G1( wo );
+
+    pdf = 0.0f;
+    const auto NoV = absCosTheta( wo );
+    const auto VoH = wo.y * wh.y < 0.0f ? -dot( wo , wh ) : dot( wo , wh );
+    if( NoV > 0.0f && VoH > 0.0f )
+        pdf = g1o * VoH * d / NoV;
+
+    return d * g1o * G1( wi );
+}
+
 GGX::GGX( float roughnessU , float roughnessV ) {
     // UE4 style way to convert roughness to alpha used here because it still keeps sharp reflection with low value of roughness
     // http://graphicrants.blogspot.com/2013/08/specular-brdf-reference.html
@@ -273,6 +383,54 @@ float GGX::G1( const Vector& v ) const {
     return 2.0f / ( 1.0f + sqrt( 1.0f + alpha2 * tan_theta_sq ) );
 }
 
+Vector GGX::SampleVisibleNormal( const Vector& wo , const BsdfSample& bs ) const {
+    // Sampling happens in the upper hemisphere, the normal is flipped back if wo is below the surface.
+    const auto flip = wo.y < 0.0f;
+    const auto v = flip ? -wo : wo;
+
+    // Stretching the view direction so that the micro surface becomes a hemisphere.
+    const auto vh = normalize( Vector( alphaU * v.x , v.y , alphaV * v.z ) );
+
+    // Orthonormal basis around the stretched view direction, t2 points towards the top of the hemisphere.
+    const auto len_sq = SQR( vh.x ) + SQR( vh.z );
+    const auto t1 = len_sq > 0.0f ? Vector( -vh.z , 0.0f , vh.x ) * ( 1.0f / std::sqrt( len_sq ) ) : Vector( 1.0f , 0.0f , 0.0f );
+    const auto t2 = cross( t1 , vh );
+
+    // Uniformly sampling the projected area of the hemisphere, the half of the disk facing away from the view direction is squeezed.
+    const auto r = std::sqrt( bs.u );
+    const auto phi = TWO_PI * bs.v;
+    const auto p1 = r * std::cos( phi );
+    const auto s = 0.5f * ( 1.0f + vh.y );
+    const auto p2 = ( 1.0f - s ) * std::sqrt( 1.0f - SQR( p1 ) ) + s * r * std::sin( phi );
+    const auto nh = t1 * p1 + t2 * p2 + vh * std::sqrt( std::max( 0.0f , 1.0f - SQR( p1 ) - SQR( p2 ) ) );
+
+    // Unstretching the normal back to the original micro surface.
+    const auto wh = normalize( Vector( alphaU * nh.x , std::max( 1e-6f , nh.y ) , alphaV * nh.z ) );
+    return flip ? -wh : wh;
+}
+
+float GGX::PdfVisibleNormal( const Vector& wo , const Vector& wh ) const {
+    // D_wo(h) = G1(wo) * max( 0 , wo . h ) * D(h) / |wo . n|, with h flipped to the same hemisphere as wo
+    const auto NoV = absCosTheta( wo );
+    if( NoV == 0.0f ) return 0.0f;
+    const auto VoH = wo.y * wh.y < 0.0f ? -dot( wo , wh ) : dot( wo , wh );
+    if( VoH <= 0.0f ) return 0.0f;
+    return G1( wo ) * VoH * D( wh ) / NoV;
+}
+
+float GGX::DGWithPdf( const Vector& wo , const Vector& wi , const Vector& wh , float& pdf ) const {
+    const auto d = D( wh );
+    const auto g1o = G1( wo );
+
+    pdf = 0.0f;
+    const auto NoV = absCosTheta( wo );
+    const auto VoH = wo.y * wh.y < 0.0f ? -dot( wo , wh ) : dot( wo , wh );
+    if( NoV > 0.0f && VoH > 0.0f )
+        pdf = g1o * VoH * d / NoV;
+
+    return d * g1o * G1( wi );
+}
+
 Microfacet::Microfacet(const MF_Dist_Type distType, float ru , float rv , const Spectrum& w, const BXDF_TYPE t , const Vector& n , bool doubleSided ) :
     Bxdf(w, t, n, doubleSided ) {
     if(distType == MF_DIST_GGX)
@@ -322,8 +480,8 @@ Spectrum MicroFacetReflection::f( const Vector& wo , const Vector& wi ) const {
 }
 
 Spectrum MicroFacetReflection::sample_f( const Vector& wo , Vector& wi , const BsdfSample& bs , float* pPdf ) const {
-    // sampling the normal
-    const auto wh = distribution->sample_f( bs );
+    // sampling the normal visible from wo
+    const auto wh = distribution->SampleVisibleNormal( wo , bs );
 
     // reflect the incident direction
     wi = reflect( wo , wh );
@@ -342,7 +500,27 @@ float MicroFacetReflection::pdf( const Vector& wo , const Vector& wi ) const {
 
     const auto h = normalize( wo + wi );
     const auto EoH = absDot( wo , h );
-    return distribution->Pdf(h) / (4.0f * EoH);
+    return distribution->PdfVisibleNormal(wo, h) / (4.0f * EoH);
+}
+
+Spectrum MicroFacetReflection::f_pdf( const Vector& wo , const Vector& wi , float& pdf ) const {
+    pdf = 0.0f;
+    if (!SameHemiSphere(wo, wi)) return 0.0f;
+    if (!doubleSided && !PointingUp(wo)) return 0.0f;
+
+    const auto NoV = absCosTheta( wo );
+    if (NoV == 0.f)
+        return Spectrum(0.f);
+
+    // D(h) and G1(wo) are shared between the BRDF and the pdf of sampling the visible normal
+    const auto wh = normalize( wi + wo );
+    const auto EoH = dot( wo , wh );
+    float pdf_wh;
+    const auto dg = distribution->DGWithPdf( wo , wi , wh , pdf_wh );
+    pdf = pdf_wh / ( 4.0f * fabs( EoH ) );
+
+    const auto F = fresnel->Evaluate( EoH );
+    return R * dg * F / ( 4.0f * NoV );
 }
 
 MicroFacetRefraction::MicroFacetRefraction(const ClosureTypeMicrofacetRefractionGGX&params, const Spectrum& weight):
@@ -387,8 +565,9 @@ Spectrum MicroFacetRefraction::sample_f( const Vector& wo , Vector& wi , const B
     if( cosTheta( wo ) == 0.0f )
         return 0.0f;
 
-    // sampling the normal
-    const auto wh = distribution->sample_f( bs );
+    // sampling the normal visible from wo, refraction expects it to point outside the surface
+    auto wh = distribution->SampleVisibleNormal( wo , bs );
+    if( wh.y < 0.0f ) wh = -wh;
 
     // try to get refracted ray
     auto total_reflection = false;
@@ -409,5 +588,5 @@ float MicroFacetRefraction::pdf( const Vector& wo , const Vector& wi ) const {
     // Compute change of variables _dwh\_dwi_ for microfacet transmission
     const auto sqrtDenom = dot(wo, wh) + eta * dot(wi, wh);
     const auto dwh_dwi = eta * eta * absDot(wi, wh) / (sqrtDenom * sqrtDenom);
-    return distribution->Pdf(wh) * dwh_dwi;
+    return distribution->PdfVisibleNormal(wo, wh) * dwh_dwi;
 }
@@ -112,6 +112,39 @@ public:
         return D( wh ) * absCosTheta(wh);
     }
 
+    //! @brief Sampling a normal that is visible from a specific direction.
+    //!
+    //! Distributions without visible normal sampling fall back to sampling the full NDF, ignoring wo.
+    //!
+    //! @param wo   Direction the micro surface is viewed from. It can be in either hemisphere.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction, it is in the same hemisphere as wo.
+    virtual Vector SampleVisibleNormal( const Vector& wo , const BsdfSample& bs ) const {
+        return sample_f( bs );
+    }
+
+    //! @brief PDF of sampling a specific normal direction through SampleVisibleNormal.
+    //!
+    //! @param wo   Direction the micro surface is viewed from.
+    //! @param wh   Normal direction to be sampled.
+    virtual float PdfVisibleNormal( const Vector& wo , const Vector& wh ) const {
+        return Pdf( wh );
+    }
+
+    //! @brief Evaluate D(h) * G(wo, wi) along with the PDF of sampling h through SampleVisibleNormal.
+    //!
+    //! Evaluating a reflection lobe and its pdf at once, distributions could share the terms between the two.
+    //!
+    //! @param wo   Exitant direction.
+    //! @param wi   Incident direction.
+    //! @param wh   Half vector between wo and wi.
+    //! @param pdf  PDF of sampling wh through SampleVisibleNormal.
+    //! @return     D(wh) * G(wo, wi).
+    virtual float DGWithPdf( const Vector& wo , const Vector& wi , const Vector& wh , float& pdf ) const {
+        pdf = PdfVisibleNormal( wo , wh );
+        return D( wh ) * G( wo , wi );
+    }
+
 protected:
     //! @brief Smith shadow-masking function G1
     virtual float G1( const Vector& v ) const  = 0;
@@ -162,6 +195,30 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f( const BsdfSample& bs ) const override;
 
+    //! @brief Sampling a normal respect to the distribution of visible normals.
+    //!
+    //! Slope space sampling, 'Importance Sampling Microfacet-Based BSDFs using the Distribution of Visible Normals'.
+    //!
+    //! @param wo   Direction the micro surface is viewed from.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction, it is in the same hemisphere as wo.
+    Vector SampleVisibleNormal( const Vector& wo , const BsdfSample& bs ) const override;
+
+    //! @brief PDF of sampling a specific normal direction through SampleVisibleNormal.
+    //!
+    //! @param wo   Direction the micro surface is viewed from.
+    //! @param wh   Normal direction to be sampled.
+    float PdfVisibleNormal( const Vector& wo , const Vector& wh ) const override;
+
+    //! @brief Evaluate D(h) * G(wo, wi) along with the PDF of sampling h through SampleVisibleNormal, D(h) and G1(wo) are shared.
+    //!
+    //! @param wo   Exitant direction.
+    //! @param wi   Incident direction.
+    //! @param wh   Half vector between wo and wi.
+    //! @param pdf  PDF of sampling wh through SampleVisibleNormal.
+    //! @return     D(wh) * G(wo, wi).
+    float DGWithPdf( const Vector& wo , const Vector& wi , const Vector& wh , float& pdf ) const override;
+
 private:
     float alphaU , alphaV;        /**< Internal data used for NDF calculation. */
     float alphaU2 , alphaV2 , alphaUV, alpha;
@@ -187,6 +244,30 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f( const BsdfSample& bs ) const override;
 
+    //! @brief Sampling a normal respect to the distribution of visible normals.
+    //!
+    //! 'Sampling the GGX Distribution of Visible Normals' (Eric Heitz 2018).
+    //!
+    //! @param wo   Direction the micro surface is viewed from.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction, it is in the same hemisphere as wo.
+    Vector SampleVisibleNormal( const Vector& wo , const BsdfSample& bs ) const override;
+
+    //! @brief PDF of sampling a specific normal direction through SampleVisibleNormal.
+    //!
+    //! @param wo   Direction the micro surface is viewed from.
+    //! @param wh   Normal direction to be sampled.
+    float PdfVisibleNormal( const Vector& wo , const Vector& wh ) const override;
+
+    //! @brief Evaluate D(h) * G(wo, wi) along with the PDF of sampling h through SampleVisibleNormal, D(h) and G1(wo) are shared.
+    //!
+    //! @param wo   Exitant direction.
+    //! @param wi   Incident direction.
+    //! @param wh   Half vector between wo and wi.
+    //! @param pdf  PDF of sampling wh through SampleVisibleNormal.
+    //! @return     D(wh) * G(wo, wi).
+    float DGWithPdf( const Vector& wo , const Vector& wi , const Vector& wh , float& pdf ) const override;
+
 protected:
     float alphaU , alphaV;        /**< Internal data used for NDF calculation. */
     float alphaU2 , alphaV2 , alphaUV , alpha;
@@ -295,6 +376,22 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Evaluate the BRDF and the pdf of sampling the incident direction at once, sharing the distribution terms.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @param wi   Incident direction in shading coordinate.
+    //! @param pdf  The probability of choosing the incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum f_pdf( const Vector& wo , const Vector& wi , float& pdf ) const;
+
+    //! @brief Evaluate the BRDF and the pdf of sampling the incident direction at once.
+    //! @param wo   Exitant direction in local space.
+    //! @param wi   Incident direction in local space.
+    //! @param pdf  The probability of choosing the incident direction.
+    //! @return     The Evaluated BRDF value.
+    Spectrum F_Pdf( const Vector& wo , const Vector& wi , float& pdf ) const override{
+        return f_pdf( bsdfToBxdf(wo) , bsdfToBxdf(wi) , pdf );
+    }
+
 private:
     const Spectrum R;                   /**< Direction-hemisphere reflection. */
     const Fresnel* fresnel = nullptr;   /**< Fresnel term. */
@@ -63,13 +63,15 @@ void SeparableBssrdf::Sample_S( const Scene& scene , const Vector& wo , const Po
     const auto phi = TWO_PI * sort_canonical();
     const auto source = po + r * ( vx * cos(phi) + vz * sin(phi) ) + l * vy * 0.5f;
     
-    const Ray ray( source , -vy , 0 , 0.0001f , l );
+    Ray ray( source , -vy , 0 , 0.0001f , l );
+    ray.m_time = intersection->time;
     scene.GetIntersect( ray , inter , intersection->primitive->GetMaterial()->GetUniqueID() );
 
     for( auto i = 0u ; i < inter.cnt ; ++i ){
         sAssert(IS_PTR_VALID(inter.intersections[i]), MATERIAL );
 
         auto pIntersection = inter.intersections[i];
+        pIntersection->intersection.time = intersection->time;
         const auto bssrdf = Sr( distance( po , pIntersection->intersection.intersect ) );
         const auto pdf = Pdf_Sp( po , pIntersection->intersection.intersect , pIntersection->intersection.gnormal );
         if( pdf > 0.0f && !bssrdf.IsBlack() )
@@ -87,16 +89,37 @@ float SeparableBssrdf::Pdf_Sp( const Point& po , const Point& pi , const Vector&
                        sqrt( SQR( dLocal.x ) + SQR( dLocal.y ) ) };
 
     constexpr float axisProb[3] = { 0.25f , 0.5f , 0.25f };
-    auto pdf = 0.0f ;
-    for( auto axis = 0 ; axis < 3 ; ++axis ){
-        for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch ){
-            #ifdef SSS_REPLACE_WITH_LAMBERT
-            if( R[ch] == 0.0f )
-                continue;
-            #endif
-            pdf += Pdf_Sr( ch , rProj[axis] ) * std::abs( nLocal[axis] ) * axisProb[axis];
-        }
+    Spectrum pdfCh;
+    for( auto axis = 0 ; axis < 3 ; ++axis )
+        pdfCh += Pdf_Sr( rProj[axis] ) * ( std::abs( nLocal[axis] ) * axisProb[axis] );
+
+    auto pdf = 0.0f;
+    for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch ){
+        #ifdef SSS_REPLACE_WITH_LAMBERT
+        if( R[ch] == 0.0f )
+            continue;
+        #endif
+        pdf += pdfCh[ch];
     }
     pdf /= channels;
     return pdf;
 }
+
+Spectrum SeparableBssrdf::Profile( float distance ) const {
+    return Sr( distance ) * GetEvalWeight();
+}
+
+float SeparableBssrdf::MaxProfileDistance() const {
+    // the same lower bound as sampling the profile
+    auto r = 0.0015f;
+    for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch )
+        r = fmax( r , Max_Sr( ch ) );
+    return r;
+}
+
+Spectrum SeparableBssrdf::Pdf_Sr( float d ) const {
+    Spectrum pdf;
+    for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch )
+        pdf[ch] = Pdf_Sr( ch , d );
+    return pdf;
+}
@@ -90,6 +90,17 @@ public:
     //! @param  po      Extant position.
     //! @param  inter   Incident intersection sampled.
     virtual void        Sample_S( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter ) const = 0;
+
+    //! @brief  Evaluate the reflectance profile with the evaluation weight, it is what probe rays sample.
+    //!
+    //! @param  distance    Distance between the incident and extant positions.
+    //! @return             The weighted reflectance profile.
+    virtual Spectrum    Profile( float distance ) const = 0;
+
+    //! @brief  Distance beyond which the reflectance profile is ignored in all channels.
+    //!
+    //! @return             The maximum distance.
+    virtual float       MaxProfileDistance() const = 0;
 };
 
 //! @brief  Separable BSSRDF implementation.
@@ -131,6 +142,17 @@ public:
     //! @return         Pdf of sampling the distance based on the reflectance profile.
     float       Pdf_Sp( const Point& po , const Point& pi , const Vector& n ) const;
 
+    //! @brief  Evaluate the reflectance profile with the evaluation weight, it is what probe rays sample.
+    //!
+    //! @param  distance    Distance between the incident and extant positions.
+    //! @return             The weighted reflectance profile.
+    Spectrum    Profile( float distance ) const override;
+
+    //! @brief  Distance beyond which the reflectance profile is ignored in all channels.
+    //!
+    //! @return             The maximum distance.
+    float       MaxProfileDistance() const override;
+
 protected:
     //! @brief  Evaluate the reflectance profile based on distance between the two points.
     //!
@@ -152,6 +174,14 @@ protected:
     //! @return         Pdf of sampling it.
     virtual float       Pdf_Sr(int ch, float d) const = 0;
 
+    //! @brief  Pdf of sampling such a distance based on the reflectance profile of all channels at once.
+    //!
+    //! By default, each channel is evaluated one after another. Profiles could share the work between channels.
+    //!
+    //! @param  d       Distance from the extant point.
+    //! @return         Pdf of sampling it in each channel.
+    virtual Spectrum    Pdf_Sr( float d ) const;
+
     //! @brief  Get maximum profile sampling distance
     //!
     //! @param  ch      Spectrum channel of interest. The returned distance sometimes depends on spectrum channel.
@@ -80,6 +80,12 @@ float ScatteringEvent::SampleScatteringType( SE_Flag& flag ) const{
 }
 
 Spectrum ScatteringEvent::Evaluate_BSDF( const Vector& wo , const Vector& wi ) const{
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    StatsScopedTimer timer( m_shadingCost ? &m_shadingCost->bxdfEvaluationTime : nullptr );
+    if( m_shadingCost )
+        ++m_shadingCost->bxdfEvaluationCnt;
+#endif
+
     const auto swo = worldToLocal( wo );
     const auto swi = worldToLocal( wi );
     Spectrum r;
@@ -89,7 +95,33 @@ Spectrum ScatteringEvent::Evaluate_BSDF( const Vector& wo , const Vector& wi ) c
     return r;
 }
 
+Spectrum ScatteringEvent::Evaluate_BSDF( const Vector& wo , const Vector& wi , float& pdf ) const{
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    StatsScopedTimer timer( m_shadingCost ? &m_shadingCost->bxdfEvaluationTime : nullptr );
+    if( m_shadingCost )
+        ++m_shadingCost->bxdfEvaluationCnt;
+#endif
+
+    const auto swo = worldToLocal( wo );
+    const auto swi = worldToLocal( wi );
+    Spectrum r;
+    pdf = 0.0f;
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+        float bxdfPdf;
+        r += m_bxdfs[i]->F_Pdf( swo , swi , bxdfPdf ) * m_bxdfs[i]->GetEvalWeight();
+        pdf += bxdfPdf * m_bxdfs[i]->GetSampleWeight();
+    }
+
+    return r;
+}
+
 Spectrum ScatteringEvent::Sample_BSDF( const Vector& wo , Vector& wi , const class BsdfSample& bs , float& pdf ) const{
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    StatsScopedTimer timer( m_shadingCost ? &m_shadingCost->bxdfSamplingTime : nullptr );
+    if( m_shadingCost )
+        ++m_shadingCost->bxdfSamplingCnt;
+#endif
+
     pdf = 0.0f;
 
     Spectrum ret;
@@ -145,4 +177,11 @@ void ScatteringEvent::Sample_BSSRDF( const Scene& scene , const Vector& wo , con
 
     // importance sampling the bssrdf
     bssrdf->Sample_S( scene , wo , po , inter );
+}
+
+Spectrum ScatteringEvent::Integrate_BSSRDF( const std::function<Spectrum(const Bssrdf&)>& integrate ) const{
+    Spectrum ret;
+    for( auto i = 0u ; i < m_bssrdfCnt ; ++i )
+        ret += integrate( *m_bssrdfs[i] );
+    return ret;
 }
\ No newline at end of file
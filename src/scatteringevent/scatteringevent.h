@@ -17,7 +17,9 @@
 
 #pragma once
 
+#include <functional>
 #include "core/define.h"
+#include "core/memory.h"
 #include "math/interaction.h"
 #include "bssrdf/bssrdf.h"
 
@@ -35,6 +37,10 @@ enum SE_Flag : unsigned int{
 
 #define SE_MAX_BXDF_COUNT          16      // Maximum number of bxdf in a material is 16 by default
 #define SE_MAX_BSSRDF_COUNT        4       // Maximum number of bssrdf in a material is 4 by default 
+#define SE_STORAGE_ALIGNMENT       64      // Bxdfs of a scattering event are packed from the start of a cache line
+
+// Allocate a bxdf/bssrdf in the storage of a scattering event, it falls back to the memory pool once the storage is full.
+#define SE_MALLOC(se,T)            new ((se).AllocateScattering<T>()) T
 
 class Bxdf;
 class MediumStack;
@@ -89,6 +95,64 @@ public:
         m_bssrdfTotalSampleWeight += bssrdf->GetSampleWeight();
     }
 
+    //! @brief  Reserve a contiguous block of memory for the bxdfs and bssrdfs of the scattering event.
+    //!
+    //! Bxdfs and bssrdfs allocated through SE_MALLOC are packed in the block, all of them sit in a few cache lines
+    //! instead of being scattered in the memory pool. The block is allocated from the memory pool too, it has the
+    //! same life time as the bxdfs allocated through SORT_MALLOC.
+    //!
+    //! @param  size        Size of the block in bytes, it is usually the most memory the material has ever taken.
+    SORT_FORCEINLINE  void    ReserveScatteringStorage( unsigned size ){
+        if( 0 == size )
+            return;
+        m_storage = (char*)GetStaticAllocator().AllocateBytes( size , SE_STORAGE_ALIGNMENT );
+        m_storageSize = size;
+        m_storageUsed = 0;
+    }
+
+    //! @brief  Share the storage of another scattering event, this is for sub-events of layered closures.
+    //!
+    //! @param  se          The scattering event whose storage is shared.
+    SORT_FORCEINLINE  void    ShareScatteringStorage( ScatteringEvent& se ){
+        m_storageOwner = se.m_storageOwner;
+    }
+
+    //! @brief  Allocate memory of a bxdf/bssrdf from the storage of the scattering event.
+    //!
+    //! @return             Memory for the bxdf/bssrdf, it comes from the memory pool if the storage is not large enough.
+    template<class T>
+    SORT_FORCEINLINE  void*   AllocateScattering(){
+        auto& owner = *m_storageOwner;
+        const auto offset = ( owner.m_storageUsed + (unsigned)alignof(T) - 1 ) & ~( (unsigned)alignof(T) - 1 );
+        owner.m_storageUsed = offset + (unsigned)sizeof(T);
+        if( owner.m_storageUsed <= owner.m_storageSize )
+            return owner.m_storage + offset;
+        return GetStaticAllocator().Allocate<T>();
+    }
+
+    //! @brief  Get the size of the storage needed to hold all bxdfs/bssrdfs allocated so far.
+    //!
+    //! @return             Size of the storage in bytes, including the ones falling back to the memory pool.
+    SORT_FORCEINLINE  unsigned GetScatteringStorageUsed() const {
+        return m_storageOwner->m_storageUsed;
+    }
+
+    //! @brief  Get the number of bxdfs in the scattering event.
+    //!
+    //! @return             Number of bxdfs in the scattering event.
+    SORT_FORCEINLINE  unsigned GetBxdfCount() const {
+        return m_bxdfCnt;
+    }
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    //! @brief  Attribute the time spent on evaluating and sampling the bxdfs to the shading cost of a material.
+    //!
+    //! @param  cost        Shading cost of the material, nothing is measured if it is nullptr.
+    SORT_FORCEINLINE  void    SetShadingCost( StatsShadingCost* cost ){
+        m_shadingCost = cost;
+    }
+#endif
+
     //! @brief Get intersection information of the point at which the bsdf is evaluated.
     //! @return The intersection information of the point at which the bsdf is evaluated.
     SORT_FORCEINLINE const SurfaceInteraction& GetInteraction() const {
@@ -116,6 +180,14 @@ public:
     //! @return             The Evaluated value of the BSDF.
     Spectrum    Evaluate_BSDF( const Vector& wo , const Vector& wi ) const;
 
+    //! @brief Evaluate the value of BSDF and the pdf of sampling the incident direction at once.
+    //!
+    //! @param wo           Exitant direction in shading coordinate.
+    //! @param wi           Incident direction in shading coordinate.
+    //! @param pdf          The probability of choosing the incident direction based on the exitant direction.
+    //! @return             The Evaluated value of the BSDF.
+    Spectrum    Evaluate_BSDF( const Vector& wo , const Vector& wi , float& pdf ) const;
+
     //! @brief Importance sampling for the bsdf.
     //!
     //! @param wo           Exitant direction in shading coordinate.
@@ -143,6 +215,12 @@ public:
     //! @param  pdf         The pdf of sampling this bssrdf among all bssrdfs.
     void        Sample_BSSRDF( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter , float& pdf ) const;
 
+    //! @brief  Sum what is integrated with each bssrdf, like its reflectance profile over cached irradiance.
+    //!
+    //! @param  integrate   Integrate with a bssrdf.
+    //! @return             The sum of the integrals of all bssrdfs.
+    Spectrum    Integrate_BSSRDF( const std::function<Spectrum(const Bssrdf&)>& integrate ) const;
+
 private:
     const Bxdf*         m_bxdfs[SE_MAX_BXDF_COUNT]      = { nullptr };     /**< All bsdfs in the scattering event. */
     unsigned            m_bxdfCnt                       = 0;               /**< Number of bxdfs in the scattering event. */
@@ -151,6 +229,14 @@ private:
     unsigned            m_bssrdfCnt                     = 0;               /**< Number of bssrdfs in the scattering event. */
     float               m_bssrdfTotalSampleWeight       = 0.0f;            /**< Total weight of BSSRDF. */
 
+    char*               m_storage                       = nullptr;         /**< Storage of the bxdfs and bssrdfs. */
+    unsigned            m_storageSize                   = 0;               /**< Size of the storage in bytes. */
+    unsigned            m_storageUsed                   = 0;               /**< Bytes taken in the storage, it goes beyond the size once it overflows. */
+    ScatteringEvent*    m_storageOwner                  = this;            /**< The scattering event owning the storage being used. */
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    StatsShadingCost*   m_shadingCost                   = nullptr;         /**< Shading cost of the material the bxdfs come from. */
+#endif
+
     const SE_Flag       m_flag;             /**< Some scattering event is under other scattering event, like 'Blend' and 'Coat'. */
     Vector              m_n;                /**< Normal at the point to be evaluated. */
     Vector              m_t;                /**< Bi-tangent at the point to be evaluated. */
@@ -19,26 +19,66 @@
 #include "core/samplemethod.h"
 #include "sampler/sample.h"
 
+// The spherical rectangle the bounding square of the disk subtends from a shading point, it is empty if the point is
+// behind the disk.
+SORT_STATIC_FORCEINLINE SphericalRectangle sphericalBoundingSquare( const Transform& transform , const float radius , const Point& p ){
+    const auto corner = transform.TransformPoint( Point( -radius , 0.0f , -radius ) );
+    if( dot( p - corner , transform.TransformNormal( DIR_UP ) ) <= 0.0f )
+        return SphericalRectangle( p , corner , Vector() , Vector() );
+    return SphericalRectangle( p , corner , transform.TransformVector( Vector( 2.0f * radius , 0.0f , 0.0f ) ) , transform.TransformVector( Vector( 0.0f , 0.0f , 2.0f * radius ) ) );
+}
+
 Point Disk::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const{
-    float u , v;
-    UniformSampleDisk( ls.u , ls.v , u , v );
+    n = m_transform.TransformNormal( DIR_UP );
+
+    // There is no closed form of sampling the solid angle of a disk. Its bounding square is sampled uniformly in
+    // solid angle instead, samples falling outside of the disk are rejected with a zero pdf. Less than a quarter of
+    // samples are wasted this way, it is way better than the variance of area sampling close to the disk.
+    Point lp;
+    const auto rect = sphericalBoundingSquare( m_transform , radius , p );
+    const auto solid_angle = rect.SolidAngle();
+    if( solid_angle > 0.0f ){
+        lp = rect.Sample( ls.u , ls.v );
+    }else{
+        float u , v;
+        UniformSampleDisk( ls.u , ls.v , u , v );
+        lp = m_transform.TransformPoint( Point( u * radius , 0.0f , v * radius ) );
+    }
 
-    Point lp = m_transform.TransformPoint( Point( u * radius , 0.0f , v * radius ) );
-    n = m_transform.TransformVector( Vector( 0 , 1.0f , 0 ) );
-    Vector delta = lp - p;
+    const auto delta = lp - p;
     wi = normalize( delta );
 
-    float d = dot( -wi , n );
     if( pdf ){
+        const auto d = dot( -wi , n );
         if( d <= 0.0f )
             *pdf = 0.0f;
-        else
+        else if( solid_angle > 0.0f ){
+            const auto local = m_transform.invMatrix.TransformPoint( lp );
+            *pdf = local.x * local.x + local.z * local.z <= radius * radius ? 1.0f / solid_angle : 0.0f;
+        }else
             *pdf = delta.SquaredLength() / ( SurfaceArea() * d );
     }
 
     return lp;
 }
 
+float Disk::Pdf( const Point& p , const Vector& wi ) const{
+    const Ray ray( p , wi );
+    ray.Prepare();
+
+    SurfaceInteraction inter;
+    if( !GetIntersect( ray , &inter ) )
+        return 0.0f;
+
+    const auto delta = p - inter.intersect;
+    const auto d = dot( normalize( delta ) , inter.normal );
+    if( d <= 0.0f )
+        return 0.0f;
+
+    const auto solid_angle = sphericalBoundingSquare( m_transform , radius , p ).SolidAngle();
+    return solid_angle > 0.0f ? 1.0f / solid_angle : delta.SquaredLength() / ( SurfaceArea() * d );
+}
+
 void Disk::Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const{
     float u , v;
     UniformSampleDisk( ls.u , ls.v , u , v );
@@ -66,14 +106,16 @@ bool Disk::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
     if( t > limit || t <= ray.m_fMin || t > ray.m_fMax )
         return false;
 
-    const auto p = ray(t);
+    auto p = ray(t);
     const auto sqLength = p.x * p.x + p.z * p.z;
     if( sqLength > radius * radius )
         return false;
 
     if( intersect ){
         intersect->t = t;
-        intersect->intersect = m_transform.TransformPoint( p );
+        // the point is exactly on the plane in local space, only transforming it introduces error.
+        p.y = 0.0f;
+        intersect->intersect = m_transform.TransformPoint( p , Vector() , intersect->error );
         intersect->normal = m_transform.TransformNormal(DIR_UP);
         intersect->gnormal = intersect->normal;
         intersect->tangent = m_transform.TransformVector(Vector( 0.0f , 0.0f , 1.0f ));
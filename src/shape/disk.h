@@ -18,6 +18,18 @@
 #pragma once
 
 #include "shape.h"
+
+#ifdef SIMD4_ENABLED
+struct Planar4;
+#endif
+
+#ifdef AVX_ENABLED
+struct Planar8;
+#endif
+
+#ifdef AVX512_ENABLED
+struct Planar16;
+#endif
 #include "core/rtti.h"
 
 //! @brief Disk class defines the basic behavior of disk.
@@ -25,7 +37,7 @@
  * The disk center is always at the origin of its local coordinate, the normal of the disk points exactly
  * upward in its local coordinate.
  */
-class   Disk : public Shape{
+class   Disk : public TransformedShape{
 public:
     //! @brief Sample a point on the surface of the shape given a shading point.
     //!
@@ -51,6 +63,13 @@ public:
     //! @param pdf      The pdf w.r.t solid angle of picking the ray.
     void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override;
 
+    //! @brief The pdf w.r.t solid angle of sampling the direction from a shading point with 'Sample_l'.
+    //!
+    //! @param p        The position of shading point to be lit.
+    //! @param wi       The direction pointing from the point.
+    //! @return         The pdf w.r.t solid angle, it is zero if the ray misses the front side of the disk.
+    float           Pdf( const Point& p , const Vector& wi ) const override;
+
     //! @brief      Get intersected point between the ray and the shape.
     //!
     //! Get the intersection between a ray and the shape. This is a function that every child
@@ -97,4 +116,16 @@ public:
 
 private:
     float radius = 1.0f;    /**< The radius of the disk. */
+
+#ifdef SIMD4_ENABLED
+    friend struct Planar4;
+#endif
+
+#ifdef AVX_ENABLED
+    friend struct Planar8;
+#endif
+
+#ifdef AVX512_ENABLED
+    friend struct Planar16;
+#endif
 };
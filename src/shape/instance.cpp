@@ -0,0 +1,164 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "instance.h"
+#include "accel/accelerator.h"
+#include "core/hash.h"
+
+void Instance::AddLevelOfDetail( const Accelerator* accelerator , const float footprint ){
+    sAssert( m_levels.empty() || m_levels.back().footprint < footprint , GENERAL );
+    m_levels.push_back( { accelerator , footprint } );
+}
+
+void Instance::SetTransform( const Transform& transform ){
+    m_transform = transform;
+    m_motion = nullptr;
+}
+
+void Instance::SetMotion( const Transform& motion ){
+    m_motion = std::make_unique<Transform>( motion );
+    InvalidateBBox();
+}
+
+const Accelerator* Instance::pickLevel( const Ray& ray , const Ray& r ) const{
+    // rays without cones, like shadow rays, always see the full detail
+    if( m_levels.empty() || ( ray.m_coneWidth <= 0.0f && ray.m_coneSpread <= 0.0f ) )
+        return m_accelerator;
+
+    // The footprint is measured where the ray enters the instance, it is converted to local space by the ratio of the
+    // lengths of the directions since the distance along the ray is the same in both of the spaces.
+    const auto t = std::max( 0.0f , Intersect( r , m_accelerator->GetBBox() ) );
+    const auto footprint = ( ray.m_coneWidth + t * ray.m_coneSpread ) * r.m_Dir.Length() / ray.m_Dir.Length();
+
+    auto level = 0u;
+    while( level < m_levels.size() && footprint >= m_levels[level].footprint )
+        ++level;
+    if( level < m_levels.size() ){
+        const auto w = 2.0f * footprint / m_levels[level].footprint - 1.0f;
+        if( w > 0.0f ){
+            // the same ray always picks the same level, hashing it is cheaper than passing a random number around
+            auto hash = HASH_INITIAL_VALUE;
+            hashData( hash , &ray.m_Ori , sizeof( ray.m_Ori ) );
+            hashData( hash , &ray.m_Dir , sizeof( ray.m_Dir ) );
+            if( (float)( hash >> 40 ) * ( 1.0f / (float)( 1u << 24 ) ) < w )
+                ++level;
+        }
+    }
+    return level ? m_levels[level-1].accelerator : m_accelerator;
+}
+
+bool Instance::GetIntersect( const Ray& ray , SurfaceInteraction* intersect ) const{
+    if( LIKELY( !m_motion ) )
+        return intersectAt( ray , intersect , m_transform );
+
+    // the matrices are interpolated at the time of the ray
+    Matrix m;
+    for( auto i = 0u ; i < 16u ; ++i )
+        m.m[i] = m_transform.matrix.m[i] + ( m_motion->matrix.m[i] - m_transform.matrix.m[i] ) * ray.m_time;
+    return intersectAt( ray , intersect , FromMatrix( m ) );
+}
+
+bool Instance::intersectAt( const Ray& ray , SurfaceInteraction* intersect , const Transform& transform ) const{
+    // the distance along the ray is not changed by the transformation since the direction is not normalized
+    const auto r = transform.invMatrix( ray );
+    const auto accelerator = pickLevel( ray , r );
+
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    if( IS_PTR_INVALID( intersect ) )
+        return accelerator->IsOccluded( r );
+#endif
+
+    SurfaceInteraction local;
+    if( intersect ){
+        local.t = intersect->t;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        local.query_shadow = intersect->query_shadow;
+#endif
+    }
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    else{
+        local.query_shadow = true;
+    }
+#endif
+
+    if( !accelerator->GetIntersect( r , local ) )
+        return false;
+    if( IS_PTR_INVALID( intersect ) )
+        return true;
+
+    // primitive being nullptr means the shadow ray is blocked by an opaque primitive
+    intersect->primitive = local.primitive;
+    intersect->t = local.t;
+    if( IS_PTR_INVALID( local.primitive ) )
+        return true;
+
+    intersect->intersect = transform.TransformPoint( local.intersect , local.error , intersect->error );
+    intersect->normal = normalize( transform.TransformNormal( local.normal ) );
+    intersect->gnormal = normalize( transform.TransformNormal( local.gnormal ) );
+    intersect->tangent = normalize( transform.TransformVector( local.tangent ) );
+    intersect->view = -ray.m_Dir;
+    intersect->u = local.u;
+    intersect->v = local.v;
+
+    // the ray cone is transformed along with the ray, only the surface area is scaled by the transform
+    intersect->footprint = local.footprint;
+    intersect->uvDensity = local.uvDensity * transform.TransformNormal( local.gnormal ).SquaredLength();
+
+    return true;
+}
+
+void Instance::HashGeometry( unsigned long long& hash ) const{
+    hashData( hash , &m_hash , sizeof( m_hash ) );
+    hashData( hash , m_transform.matrix.m , sizeof( m_transform.matrix.m ) );
+    if( m_motion )
+        hashData( hash , m_motion->matrix.m , sizeof( m_motion->matrix.m ) );
+}
+
+//! @brief Bounding box of the transformed bounding box of the instanced primitives.
+//!
+//! @param bbox         Bounding box of the instanced primitives in their local space.
+//! @param transform    Transform of the instance.
+//! @return             Bounding box in world space.
+static BBox transformBBox( const BBox& bbox , const Transform& transform ){
+    BBox ret;
+    for( auto i = 0u ; i < 8u ; ++i ){
+        const Point corner( ( i & 1 ) ? bbox.m_Max.x : bbox.m_Min.x ,
+                            ( i & 2 ) ? bbox.m_Max.y : bbox.m_Min.y ,
+                            ( i & 4 ) ? bbox.m_Max.z : bbox.m_Min.z );
+        ret.Union( transform.TransformPoint( corner ) );
+    }
+    return ret;
+}
+
+const BBox& Instance::GetBBox() const{
+    if( !m_bbox ){
+        m_bbox = std::make_unique<BBox>( transformBBox( m_accelerator->GetBBox() , m_transform ) );
+
+        // moving instances are bounded during the whole shutter interval
+        if( m_motion )
+            m_bbox->Union( transformBBox( m_accelerator->GetBBox() , *m_motion ) );
+    }
+    return *m_bbox;
+}
+
+bool Instance::GetMotionBBox( BBox& open , BBox& close ) const{
+    if( !m_motion )
+        return false;
+    open = transformBBox( m_accelerator->GetBBox() , m_transform );
+    close = transformBBox( m_accelerator->GetBBox() , *m_motion );
+    return true;
+}
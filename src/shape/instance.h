@@ -0,0 +1,175 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "shape.h"
+
+class Accelerator;
+
+//! @brief Instance of a shared set of primitives.
+/**
+ * Instance places a set of primitives, usually triangles of a mesh, in the world with its own transform. The primitives
+ * stay in their local space and have their own spatial acceleration structure, which is shared by all instances of them.
+ * Rays are transformed to the local space of the primitives at the boundary of the instance. Since the direction of the
+ * ray is not normalized after the transformation, the distance along the ray is the same in both of the spaces.
+ * With instances in the scene, the spatial acceleration structure of the scene serves as the top level structure while
+ * the shared ones serve as the bottom level structures.
+ * Instances could have simplified levels of detail, each with its own bottom level structure. The level is picked for
+ * each ray from the footprint of its ray cone at the instance. Around the footprint where one level switches to the
+ * next, rays pick either of them randomly, which turns popping between levels into noise.
+ * Moving instances have a second transform at the closing of the shutter. The matrices are interpolated linearly at the
+ * time of each ray, corners of bounding boxes move linearly this way so that interpolated bounding boxes stay conservative.
+ */
+class   Instance : public TransformedShape{
+public:
+    //! @brief Constructor of Instance.
+    //!
+    //! @param accelerator  The spatial acceleration structure of the instanced primitives, it needs to be built already.
+    //! @param hash         Hash of the geometry of the instanced primitives.
+    Instance( const Accelerator* accelerator , const unsigned long long hash ) : m_accelerator( accelerator ) , m_hash( hash ) {}
+
+    //! @brief Add a simplified level of detail of the instanced primitives.
+    //!
+    //! Levels need to be added from the finest to the coarsest, each of them is usually twice as coarse as the previous
+    //! one. Rays start picking the level randomly at half of its footprint and always pick it from its footprint on.
+    //!
+    //! @param accelerator  The spatial acceleration structure of the simplified primitives, it needs to be built already.
+    //! @param footprint    Width of ray cones in local space of the primitives from which on the level is used.
+    void            AddLevelOfDetail( const Accelerator* accelerator , const float footprint );
+
+    //! @brief Set the transform of the instance, it doesn't move any more after this.
+    //!
+    //! @param transform    The new transform of the shape to be set.
+    void            SetTransform( const Transform& transform ) override;
+
+    //! @brief Set the transform at the closing of the shutter, the instance moves from its transform to it.
+    //!
+    //! @param motion       Transform of the instance at the closing of the shutter.
+    void            SetMotion( const Transform& motion );
+
+    //! @brief Sample a point on the surface of the shape given a shading point.
+    //!
+    //! Instances are never attached with lights, this should not be called at all.
+    //!
+    //! @param ls       The light sample.
+    //! @param p        The position of shading point to be lit.
+    //! @param wi       The vector from shading point to sampled point, it is normalized.
+    //! @param pdf      The pdf w.r.t solid angle ( not surface area ) of picking the sampled point.
+    //! @return         The sampled point on the surface of the shape.
+    Point           Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const override{
+        sAssertMsg( false , LIGHT , "Using instance as a area light source shape.");
+        return Point();
+    }
+
+    //! @brief Sample a ray from the light source without a given shading point.
+    //!
+    //! Instances are never attached with lights, this should not be called at all.
+    //!
+    //! @param ls       The light sample.
+    //! @param r        The ray randomly sampled, whose origin lies on the surface of the shape,
+    //!                 the direction of the ray will point outward depending on the normal.
+    //! @param n        The normal at the surface where the ray shoots from.
+    //! @param pdf      The pdf w.r.t solid angle of picking the ray.
+    void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override{
+        sAssertMsg( false , LIGHT , "Using instance as a area light source shape.");
+    }
+
+    //! @brief      Get intersected point between the ray and the instanced primitives.
+    //!
+    //! Unlike other shapes, the intersected primitive is filled by the instance since it is one of the instanced
+    //! primitives instead of the instance itself.
+    //!
+    //! @param ray      The ray to be tested against.
+    //! @param inter    The intersection data to be filled. If it is nullptr, there is no detailed information
+    //!                 for the intersection.
+    //! @return         Whether the ray intersects the shape.
+    bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
+
+    //! @brief Hash the geometry of the instance.
+    //!
+    //! Instead of hashing all instanced primitives again, the hash of them is combined with the transform.
+    //!
+    //! @param hash     The hash to be updated.
+    void            HashGeometry( unsigned long long& hash ) const override;
+
+    //! @brief      Get bounding box of the shape in world space.
+    //!
+    //! It is the bounding box of the transformed bounding box of the instanced primitives, which is a bit conservative.
+    //!
+    //! @return     The bounding box of the shape.
+    const BBox&     GetBBox() const override;
+
+    //! @brief      Get bounding boxes of the instance at the opening and closing of the shutter.
+    //!
+    //! @param open     Bounding box at the opening of the shutter.
+    //! @param close    Bounding box at the closing of the shutter.
+    //! @return         Whether the instance moves.
+    bool            GetMotionBBox( BBox& open , BBox& close ) const override;
+
+    //! @brief      Whether the instance moves during the shutter interval.
+    //!
+    //! @return     Whether the instance moves.
+    bool            IsMoving() const override{
+        return (bool)m_motion;
+    }
+
+    //! @brief      Get the surface area of the shape.
+    //!
+    //! Instances are never attached with lights, there is no need to evaluate surface area.
+    //!
+    //! @return     It always returns 0.
+    float           SurfaceArea() const override{
+        return 0.0f;
+    }
+
+    //! @brief      Get the type of the shape
+    //!
+    //! @return     The type of the shape.
+    SHAPE_TYPE      GetShapeType() const override{
+        return SHAPE_INSTANCE;
+    }
+
+private:
+    //! @brief Simplified level of detail of the instanced primitives.
+    struct LevelOfDetail{
+        const Accelerator*  accelerator;    /**< Spatial acceleration structure of the simplified primitives. */
+        float               footprint;      /**< Width of ray cones in local space from which on the level is used. */
+    };
+
+    const Accelerator*  m_accelerator = nullptr;    /**< Spatial acceleration structure of the instanced primitives. */
+    unsigned long long  m_hash = 0;                 /**< Hash of the geometry of the instanced primitives. */
+    std::vector<LevelOfDetail>  m_levels;           /**< Simplified levels of detail, from the finest to the coarsest. */
+    std::unique_ptr<Transform>  m_motion;           /**< Transform at the closing of the shutter, nullptr if the instance doesn't move. */
+
+    //! @brief Pick the level of detail for a ray.
+    //!
+    //! @param ray      The ray in world space.
+    //! @param r        The ray in local space of the instanced primitives.
+    //! @return         The spatial acceleration structure of the picked level.
+    const Accelerator*  pickLevel( const Ray& ray , const Ray& r ) const;
+
+    //! @brief Get intersection between a ray and the instanced primitives placed with a specific transform.
+    //!
+    //! @param ray          The ray to be tested against.
+    //! @param intersect    The intersection data to be filled, it could be nullptr.
+    //! @param transform    Transform of the instance at the time of the ray.
+    //! @return             Whether the ray intersects the shape.
+    bool                intersectAt( const Ray& ray , SurfaceInteraction* intersect , const Transform& transform ) const;
+};
@@ -53,7 +53,11 @@ bool Line::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
         return false;
 
     if( intersect ){
+        // the point found by solving the quadratic equation is not accurate, a fiber is thin enough to bound its error
+        // with its diameter instead.
+        const auto radius = slerp( m_w0 , m_w1 , inter.y / m_length );
         intersect->intersect = r(t);
+        intersect->error = Vector( 2.0f * radius );
 
         if( inter.y == m_length ){
             // A corner case where the tip of the line is being intersected.
@@ -102,12 +106,73 @@ float Line::SurfaceArea() const{
 }
 
 bool Line::GetIntersect(const BBox& box) const{
+    // clip the axis of the line with the enlarged bounding box
+    const auto radius = std::max( m_w0 , m_w1 );
+    const auto d = m_gp1 - m_gp0;
+    auto t0 = 0.0f , t1 = 1.0f;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto mn = box.m_Min[i] - radius;
+        const auto mx = box.m_Max[i] + radius;
+        if( d[i] == 0.0f ){
+            if( m_gp0[i] < mn || m_gp0[i] > mx )
+                return false;
+            continue;
+        }
+        auto tn = ( mn - m_gp0[i] ) / d[i];
+        auto tf = ( mx - m_gp0[i] ) / d[i];
+        if( tn > tf )
+            std::swap( tn , tf );
+        t0 = std::max( t0 , tn );
+        t1 = std::min( t1 , tf );
+        if( t0 > t1 )
+            return false;
+    }
     return true;
 }
 
-void Line::SetTransform( const Transform& transform ){
-    m_transform = transform;
+void Line::SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const{
+    // A point of the line is within the larger half width of its axis. So the part of the line on one side of the plane
+    // only comes from the part of the axis that is on the same side of the plane shifted by the half width.
+    const auto radius = std::max( m_w0 , m_w1 );
+    const auto part = [&]( const float threshold , const bool negative ){
+        BBox ret;
+        const auto a0 = m_gp0[axis] , a1 = m_gp1[axis];
+        auto t0 = 0.0f , t1 = 1.0f;
+        if( a0 != a1 ){
+            const auto t = ( threshold - a0 ) / ( a1 - a0 );
+            if( ( a1 > a0 ) == negative )
+                t1 = std::min( t1 , t );
+            else
+                t0 = std::max( t0 , t );
+        }else if( negative ? a0 > threshold : a0 < threshold ){
+            return ret;
+        }
+        if( t0 > t1 )
+            return ret;
+
+        ret.Union( m_gp0 + ( m_gp1 - m_gp0 ) * t0 );
+        ret.Union( m_gp0 + ( m_gp1 - m_gp0 ) * t1 );
+        ret.Expend( radius );
+        if( negative )
+            ret.m_Max[axis] = std::min( ret.m_Max[axis] , pos );
+        else
+            ret.m_Min[axis] = std::max( ret.m_Min[axis] , pos );
+        return ret;
+    };
+
+    // the line may have been split before, only the part inside the box matters
+    left = Intersection( part( pos + radius , true ) , box );
+    right = Intersection( part( pos - radius , false ) , box );
+}
+
+void Line::HashGeometry( unsigned long long& hash ) const{
+    hashData( hash , m_gp0.data , sizeof( m_gp0.data ) );
+    hashData( hash , m_gp1.data , sizeof( m_gp1.data ) );
+    hashData( hash , &m_w0 , sizeof( m_w0 ) );
+    hashData( hash , &m_w1 , sizeof( m_w1 ) );
+}
 
+void Line::SetTransform( const Transform& transform ){
     m_gp0 = transform.TransformPoint( m_p0 );
     m_gp1 = transform.TransformPoint( m_p1 );
 
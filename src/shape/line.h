@@ -19,7 +19,7 @@
 
 #include "shape.h"
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 struct Line4;
 struct Ray4_Data;
 #endif
@@ -29,6 +29,11 @@ struct Line8;
 struct Ray8_Data;
 #endif
 
+#ifdef AVX512_ENABLED
+struct Line16;
+struct Ray16_Data;
+#endif
+
 //! @brief  Line is a common type for hair or fur rendering.
 /**
  * Although being called line, this shape is essentially open cylinder. Other choose is to represent line
@@ -56,6 +61,14 @@ public:
         m_length = distance( p0 , p1 );
     }
 
+    //! @brief Copy a line with its widths scaled, the transform of the line is kept.
+    //!
+    //! @param  line    The line to be copied.
+    //! @param  scale   Scale of the widths.
+    Line( const Line& line , const float scale ) :
+        m_p0(line.m_p0), m_p1(line.m_p1), m_gp0(line.m_gp0), m_gp1(line.m_gp1), m_w0(line.m_w0 * scale), m_w1(line.m_w1 * scale),
+        m_v0(line.m_v0), m_v1(line.m_v1), m_length(line.m_length), m_matId(line.m_matId), m_world2Line(line.m_world2Line) {}
+
     //! @brief Sample a point on the surface of the shape given a shading point.
     //!
     //! Sample a position on the surface of the shape. This function is heavily
@@ -96,11 +109,32 @@ public:
     //! @brief Intersection test between the shape and a bounding box.
     //!
     //! Because the accurate intersection test depends also on the viewing angle, which is not available
-    //! as an input here, this is more of a conservative solution.
+    //! as an input here, this is more of a conservative solution. The axis of the line is tested against
+    //! the bounding box enlarged by the larger half width.
     //!
     //! param box       Bounding box to be checked.
     bool            GetIntersect( const BBox& box ) const override;
 
+    //! @brief Split the part of the line inside a bounding box with an axis aligned plane.
+    //!
+    //! Long and thin lines that are not aligned with any axis have very loose bounding boxes. Each side of
+    //! the plane only gets the bounding box of the part of the line close enough to it, so that spatial
+    //! splits could tighten the bounding boxes of hair a lot.
+    //!
+    //! @param box      Bounding box of the part of the line to be split.
+    //! @param axis     Axis perpendicular to the split plane.
+    //! @param pos      Position of the split plane along the axis.
+    //! @param left     Bounding box of the part of the line on the negative side of the plane.
+    //! @param right    Bounding box of the part of the line on the positive side of the plane.
+    void            SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const override;
+
+    //! @brief Hash the geometry of the line.
+    //!
+    //! Both of the bounding box intersection test and splitting depend on the end points and the widths.
+    //!
+    //! @param hash     The hash to be updated.
+    void            HashGeometry( unsigned long long& hash ) const override;
+
     //! @brief      Get bounding box of the shape in world space.
     //!
     //! This is also a conservative solution by expending the AABB by half width, whichever is larger on
@@ -130,7 +164,7 @@ public:
     //! on shapes, leading us a more unified way of defining width of the line, no matter what the transformation is.
     //!
     //! @param transform    The new transform of the shape to be set.
-    void    SetTransform( const Transform& transform ) override;
+    void    SetTransform( const Transform& transform );
 
     //! @brief      Get the type of the shape
     //!
@@ -164,7 +198,7 @@ private:
      * there is no scaling in the matrix. */
     Transform       m_world2Line;
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
     friend struct Line4;
     friend SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Ray4_Data& ray_simd , const Line4& line_simd , SurfaceInteraction* ret );
 #endif
@@ -173,4 +207,9 @@ private:
     friend struct Line8;
     friend SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Ray8_Data& ray_simd , const Line8& line_simd , SurfaceInteraction* ret );
 #endif
+
+#ifdef AVX512_ENABLED
+    friend struct Line16;
+    friend SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Ray16_Data& ray_simd , const Line16& line_simd , SurfaceInteraction* ret );
+#endif
 };
@@ -19,29 +19,60 @@
 #include "sampler/sample.h"
 #include "core/samplemethod.h"
 
+// The spherical rectangle the quad subtends from a shading point, it is empty if the point is behind the quad.
+SORT_STATIC_FORCEINLINE SphericalRectangle sphericalQuad( const Transform& transform , const float sizeX , const float sizeY , const Point& p ){
+    const auto corner = transform.TransformPoint( Point( -sizeX * 0.5f , 0.0f , -sizeY * 0.5f ) );
+    if( dot( p - corner , transform.TransformNormal( DIR_UP ) ) <= 0.0f )
+        return SphericalRectangle( p , corner , Vector() , Vector() );
+    return SphericalRectangle( p , corner , transform.TransformVector( Vector( sizeX , 0.0f , 0.0f ) ) , transform.TransformVector( Vector( 0.0f , 0.0f , sizeY ) ) );
+}
+
 Point Quad::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const{
-    const float halfx = sizeX * 0.5f;
-    const float halfy = sizeY * 0.5f;
-
-    float u = 2 * ls.u - 1.0f;
-    float v = 2 * ls.v - 1.0f;
-    Point lp = m_transform.TransformPoint( Point( halfx * u , 0.0f , halfy * v ) );
-    n = m_transform.TransformVector( Vector( 0 , 1 , 0 ) );
-    Vector delta = lp - p;
+    n = m_transform.TransformNormal( DIR_UP );
+
+    // the quad is sampled uniformly in the solid angle it subtends, unless it is too small for it
+    Point lp;
+    const auto rect = sphericalQuad( m_transform , sizeX , sizeY , p );
+    const auto solid_angle = rect.SolidAngle();
+    if( solid_angle > 0.0f ){
+        lp = rect.Sample( ls.u , ls.v );
+    }else{
+        const auto u = 2.0f * ls.u - 1.0f;
+        const auto v = 2.0f * ls.v - 1.0f;
+        lp = m_transform.TransformPoint( Point( sizeX * 0.5f * u , 0.0f , sizeY * 0.5f * v ) );
+    }
+
+    const auto delta = lp - p;
     wi = normalize( delta );
 
-    float d = dot( -wi , n );
-    if( pdf )
-    {
-        if( d <= 0 )
+    if( pdf ){
+        const auto d = dot( -wi , n );
+        if( d <= 0.0f )
             *pdf = 0.0f;
         else
-            *pdf = delta.SquaredLength() / ( SurfaceArea() * d );
+            *pdf = solid_angle > 0.0f ? 1.0f / solid_angle : delta.SquaredLength() / ( SurfaceArea() * d );
     }
 
     return lp;
 }
 
+float Quad::Pdf( const Point& p , const Vector& wi ) const{
+    const Ray ray( p , wi );
+    ray.Prepare();
+
+    SurfaceInteraction inter;
+    if( !GetIntersect( ray , &inter ) )
+        return 0.0f;
+
+    const auto delta = p - inter.intersect;
+    const auto d = dot( normalize( delta ) , inter.normal );
+    if( d <= 0.0f )
+        return 0.0f;
+
+    const auto solid_angle = sphericalQuad( m_transform , sizeX , sizeY , p ).SolidAngle();
+    return solid_angle > 0.0f ? 1.0f / solid_angle : delta.SquaredLength() / ( SurfaceArea() * d );
+}
+
 void Quad::Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const{
     const auto halfx = sizeX * 0.5f;
     const auto halfy = sizeY * 0.5f;
@@ -72,7 +103,7 @@ bool Quad::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
     if( t > limit || t <= ray.m_fMin || t > ray.m_fMax )
         return false;
 
-    const auto p = ray(t);
+    auto p = ray(t);
     const auto halfx = sizeX * 0.5f;
     const auto halfy = sizeY * 0.5f;
     if( p.x > halfx || p.x < -halfx )
@@ -82,7 +113,9 @@ bool Quad::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
 
     if( intersect ){
         intersect->t = t;
-        intersect->intersect = r(t);
+        // the point is exactly on the plane in local space, only transforming it introduces error.
+        p.y = 0.0f;
+        intersect->intersect = m_transform.TransformPoint( p , Vector() , intersect->error );
         intersect->normal = m_transform.TransformNormal(DIR_UP);
         intersect->gnormal = intersect->normal;
         intersect->tangent = m_transform.TransformVector(Vector( 0.0f , 0.0f , 1.0f ));
@@ -19,6 +19,7 @@
 
 #include <memory>
 #include "core/log.h"
+#include "core/hash.h"
 #include "math/transform.h"
 #include "math/bbox.h"
 #include "math/ray.h"
@@ -32,6 +33,7 @@ enum SHAPE_TYPE{
     SHAPE_DISK      = 2,
     SHAPE_QUAD      = 3,
     SHAPE_SPHERE    = 4,
+    SHAPE_INSTANCE  = 5,
 };
 
 //! @brief Shape class defines basic interface of shape.
@@ -44,6 +46,12 @@ enum SHAPE_TYPE{
 class Shape
 {
 public:
+    //! @brief  Default constructor.
+    Shape() = default;
+
+    //! @brief  Shapes are moved into contiguous buffers, like triangles of a mesh.
+    Shape( Shape&& ) = default;
+
     //! @brief  Empty virtual destructor.
     virtual ~Shape(){}
 
@@ -113,6 +121,50 @@ public:
     //! param box       Bounding box to be checked.
     virtual bool    GetIntersect( const BBox& box ) const { return true; }
 
+    //! @brief Split the part of the shape inside a bounding box with an axis aligned plane.
+    //!
+    //! This is used by spatial split BVH construction. The default implementation simply splits the bounding box with
+    //! the plane, shapes could provide a tighter bounding box for each side of the plane.
+    //!
+    //! @param box      Bounding box of the part of the shape to be split.
+    //! @param axis     Axis perpendicular to the split plane.
+    //! @param pos      Position of the split plane along the axis.
+    //! @param left     Bounding box of the part of the shape on the negative side of the plane.
+    //! @param right    Bounding box of the part of the shape on the positive side of the plane.
+    virtual void    SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const {
+        left = right = box;
+        left.m_Max[axis] = std::min( left.m_Max[axis] , pos );
+        right.m_Min[axis] = std::max( right.m_Min[axis] , pos );
+    }
+
+    //! @brief Hash the geometry of the shape.
+    //!
+    //! The hash is used to identify cached spatial acceleration structures, it needs to cover everything that the
+    //! construction depends on. The default implementation only hashes the bounding box, shapes whose intersection test
+    //! against bounding boxes or splitting depends on more than that need to hash the extra data too.
+    //!
+    //! @param hash     The hash to be updated.
+    virtual void    HashGeometry( unsigned long long& hash ) const {
+        const auto& bbox = GetBBox();
+        hashData( hash , bbox.m_Min.data , sizeof( bbox.m_Min.data ) );
+        hashData( hash , bbox.m_Max.data , sizeof( bbox.m_Max.data ) );
+    }
+
+    //! @brief Hash the topology of the shape.
+    //!
+    //! Different from the geometry hash, this only covers what stays the same when the shape is deformed, like vertex
+    //! indices of a triangle. The default implementation hashes nothing since most shapes have no topology at all.
+    //!
+    //! @param hash     The hash to be updated.
+    virtual void    HashTopology( unsigned long long& hash ) const {}
+
+    //! @brief Drop the cached bounding box so that it is evaluated again next time.
+    //!
+    //! This needs to be called after the shape is moved or deformed.
+    SORT_FORCEINLINE void   InvalidateBBox() const {
+        m_bbox = nullptr;
+    }
+
     //! @brief      Get bounding box of the shape in world space.
     //!
     //! Get the bounding box of the shape. Some shape may return a relatively conservative bounding
@@ -121,6 +173,21 @@ public:
     //! @return     The bounding box of the shape.
     virtual const   BBox&   GetBBox() const = 0;
 
+    //! @brief      Get bounding boxes of the shape at the opening and closing of the shutter.
+    //!
+    //! Shapes moving linearly during the shutter interval are bounded at any time by interpolating the two boxes, which
+    //! is what motion blur aware spatial structures rely on. 'GetBBox' of these shapes covers the whole swept volume.
+    //!
+    //! @param open     Bounding box at the opening of the shutter.
+    //! @param close    Bounding box at the closing of the shutter.
+    //! @return         Whether the shape moves, the boxes are not touched if it doesn't.
+    virtual bool    GetMotionBBox( BBox& open , BBox& close ) const { return false; }
+
+    //! @brief      Whether the shape moves during the shutter interval.
+    //!
+    //! @return     Whether the shape moves.
+    virtual bool    IsMoving() const { return false; }
+
     //! @brief      Get the surface area of the shape.
     //!
     //! Get the surface area of the shape. This function is heavily used in the case of picking a area light
@@ -129,17 +196,28 @@ public:
     //! @return     Surface area of the shape.
     virtual float   SurfaceArea() const = 0;
 
-    //! @brief      Set transform for the shape.
-    //!
-    //! @param transform    The new transform of the shape to be set.
-    virtual void    SetTransform( const Transform& transform ) { m_transform = transform; }
-
     //! @brief      Get the type of the shape
     //!
     //! @return     The type of the shape.
     virtual SHAPE_TYPE GetShapeType() const = 0;
     
 protected:
-    Transform                       m_transform;    /**< Transform of the shape from local space to world space. It is assumed there is no scaling in this matrix, the upper level code should handle it. */
     mutable std::unique_ptr<BBox>   m_bbox;         /**< Bounding box of the shape in world coordinate. */
 };
+
+//! @brief  Shape defined in its own local space, which is placed in the world with a transform.
+/**
+ * Triangles and lines are defined in world space directly, they don't carry a transform, which saves a lot of memory
+ * for scenes with millions of them.
+ */
+class TransformedShape : public Shape
+{
+public:
+    //! @brief      Set transform for the shape.
+    //!
+    //! @param transform    The new transform of the shape to be set.
+    virtual void    SetTransform( const Transform& transform ) { m_transform = transform; }
+
+protected:
+    Transform                       m_transform;    /**< Transform of the shape from local space to world space. It is assumed there is no scaling in this matrix, the upper level code should handle it. */
+};
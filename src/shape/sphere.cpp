@@ -21,10 +21,18 @@
 #include "core/log.h"
 
 Point Sphere::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const{
-    sAssertMsg(false, SAMPLING, "N is not filled in Sphere::sample_l");
-
     const auto center = m_transform.TransformPoint( Point( 0.0f , 0.0f , 0.0f ) );
     const auto delta = center - p;
+    const auto sq_dist = delta.SquaredLength();
+
+    // a shading point inside the sphere sees its back side only, which doesn't emit anything
+    if( sq_dist <= radius * radius ){
+        wi = UniformSampleSphere( ls.u , ls.v );
+        n = -wi;
+        if( pdf ) *pdf = 0.0f;
+        return p + wi * radius;
+    }
+
     const auto dir = normalize( delta );
     Vector wcx , wcy;
     coordinateSystem( dir , wcx , wcy );
@@ -34,7 +42,8 @@ Point Sphere::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Ve
                 wcx.z , dir.z , wcy.z , 0.0f ,
                 0.0f , 0.0f , 0.0f , 1.0f );
 
-    const auto sq_sin_theta = radius * radius / delta.SquaredLength();
+    // the direction is sampled uniformly in the cone of directions toward the sphere
+    const auto sq_sin_theta = radius * radius / sq_dist;
     const auto cos_theta = sqrt( std::max( 0.0f , 1.0f - sq_sin_theta ) );
 
     wi = UniformSampleCone( ls.u , ls.v , cos_theta );
@@ -42,18 +51,25 @@ Point Sphere::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Ve
 
     if( pdf ) *pdf = UniformConePdf( cos_theta );
 
-    SurfaceInteraction intersection;
-    const auto r = m_transform.invMatrix(Ray( p , wi ));
-    if( !GetIntersect( r , &intersection ) )
-        intersection.intersect = r( dot( delta , wi ) );
+    // the nearest intersection along the sampled direction, directions grazing the silhouette are clamped onto it
+    const auto proj = dot( delta , wi );
+    const auto t = proj - sqrt( std::max( 0.0f , radius * radius - ( sq_dist - proj * proj ) ) );
+    const auto lp = p + t * wi;
+    n = normalize( lp - center );
 
-    return m_transform.TransformPoint(intersection.intersect);
+    return lp;
 }
 
 float Sphere::Pdf( const Point& p ,  const Vector& wi ) const{
-    Point center;
-    const auto sin_theta_sq = radius * radius / ( p - center ).SquaredLength();
+    const auto delta = m_transform.TransformPoint( Point( 0.0f , 0.0f , 0.0f ) ) - p;
+    const auto sq_dist = delta.SquaredLength();
+    if( sq_dist <= radius * radius )
+        return 0.0f;
+
+    const auto sin_theta_sq = radius * radius / sq_dist;
     const auto cos_theta = sqrt( std::max( 0.0f , 1.0f - sin_theta_sq ) );
+    if( dot( normalize( delta ) , wi ) < cos_theta )
+        return 0.0f;
     return UniformConePdf( cos_theta );
 }
 
@@ -90,13 +106,17 @@ bool Sphere::GetIntersect( const Ray& ray , SurfaceInteraction* intersect ) cons
     if( t > r.m_fMax || t < r.m_fMin )
         return false;
 
-    const auto p = r(t);
+    auto p = r(t);
     if( intersect ){
         intersect->t = t;
         Vector n = normalize(Vector( p.x , p.y , p.z ));
         Vector v0 , v1;
         coordinateSystem( n , v0 , v1 );
-        intersect->intersect = m_transform.TransformPoint(p);
+
+        // project the point back onto the sphere, this bounds its error way tighter than evaluating it along the ray.
+        p = Point( n.x , n.y , n.z ) * radius;
+        const auto error = errorGamma( 5 ) * Vector( fabs( p.x ) , fabs( p.y ) , fabs( p.z ) );
+        intersect->intersect = m_transform.TransformPoint( p , error , intersect->error );
         intersect->normal = m_transform.TransformNormal(n);
         intersect->gnormal = intersect->normal;
         intersect->tangent = m_transform.TransformVector(v0);
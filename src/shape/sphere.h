@@ -19,11 +19,23 @@
 
 #include "shape.h"
 
+#ifdef SIMD4_ENABLED
+struct Sphere4;
+#endif
+
+#ifdef AVX_ENABLED
+struct Sphere8;
+#endif
+
+#ifdef AVX512_ENABLED
+struct Sphere16;
+#endif
+
 //! @brief Sphere class defines the basic behavior of sphere.
 /**
  * The sphere center is always at the origin of its local coordinate.
  */
-class   Sphere : public Shape{
+class   Sphere : public TransformedShape{
 public:
     //! @brief Sample a point on the surface of the shape given a shading point.
     //!
@@ -99,4 +111,16 @@ public:
 
 private:
     float radius = 1.0f;    /**< Radius of the sphere. */
+
+#ifdef SIMD4_ENABLED
+    friend struct Sphere4;
+#endif
+
+#ifdef AVX_ENABLED
+    friend struct Sphere8;
+#endif
+
+#ifdef AVX512_ENABLED
+    friend struct Sphere16;
+#endif
 };
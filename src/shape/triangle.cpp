@@ -17,23 +17,39 @@
 
 #include "triangle.h"
 #include "entity/visual.h"
+#include "sampler/sample.h"
+#include "core/samplemethod.h"
+
+// Spherical triangle sampling loses precision for triangles that are too small or too large in solid angle.
+static constexpr float MIN_SPHERICAL_SAMPLE_AREA = 3e-4f;
+static constexpr float MAX_SPHERICAL_SAMPLE_AREA = 6.22f;
 
 SORT_STATIC_FORCEINLINE Vector3f Permute( const Vector3f& v , int ax , int ay , int az ){
     return Vector3f( v[ax] , v[ay] , v[az] );
 }
 
-bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
-    // get the memory
-    // note : reference is not used here because it's not thread-safe
-    auto& mem = m_meshVisual->m_memory;
-    const auto id0 = m_index.m_id[0];
-    const auto id1 = m_index.m_id[1];
-    const auto id2 = m_index.m_id[2];
+// Fill the intersection of a ray hitting a triangle with the given vertices.
+static void setupTriangleIntersection( const Ray& r , float t , float u , float v , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersect ){
+    const auto w = 1 - u - v;
 
-    const auto& mv0 = mem->m_vertices[id0];
-    const auto& mv1 = mem->m_vertices[id1];
-    const auto& mv2 = mem->m_vertices[id2];
+    // store the intersection
+    setupIntersectionPoint( u , v , mv0 , mv1 , mv2 , intersect );
+
+    intersect->gnormal = normalize(cross( ( mv2.m_position - mv0.m_position ) , ( mv1.m_position - mv0.m_position ) ));
+    intersect->normal = ( w * mv0.GetNormal() + u * mv1.GetNormal() + v * mv2.GetNormal()).Normalize();
+    intersect->tangent = ( w * mv0.GetTangent() + u * mv1.GetTangent() + v * mv2.GetTangent()).Normalize();
+    intersect->view = -r.m_Dir;
 
+    const auto uv = w * mv0.m_texCoord + u * mv1.m_texCoord + v * mv2.m_texCoord;
+    intersect->u = uv.x;
+    intersect->v = uv.y;
+    intersect->t = t;
+
+    setupRayFootprint( r , t , mv0 , mv1 , mv2 , intersect );
+}
+
+// Intersection between a ray and a triangle with the given vertices.
+static bool intersectTriangle( const Ray& r , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersect ){
     // get three vertexes
     const auto& op0 = mv0.m_position;
     const auto& op1 = mv1.m_position;
@@ -93,24 +109,78 @@ bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) cons
     if( t > intersect->t || t <= 0.0f )
         return false;
 
-    const auto u = e1 * invDet;
-    const auto v = e2 * invDet;
-    const auto w = 1 - u - v;
+    setupTriangleIntersection( r , t , e1 * invDet , e2 * invDet , mv0 , mv1 , mv2 , intersect );
+    return true;
+}
 
-    // store the intersection
-    intersect->intersect = r(t);
+bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    // get the memory
+    // note : reference is not used here because it's not thread-safe
+    auto& mem = m_meshVisual->m_memory;
+    const auto id0 = m_index.m_id[0];
+    const auto id1 = m_index.m_id[1];
+    const auto id2 = m_index.m_id[2];
 
-    intersect->gnormal = normalize(cross( ( op2 - op0 ) , ( op1 - op0 ) ));
-    intersect->normal = ( w * mv0.m_normal + u * mv1.m_normal + v * mv2.m_normal).Normalize();
-    intersect->tangent = ( w * mv0.m_tangent + u * mv1.m_tangent + v * mv2.m_tangent).Normalize();
-    intersect->view = -r.m_Dir;
+    const auto& mv0 = mem->m_vertices[id0];
+    const auto& mv1 = mem->m_vertices[id1];
+    const auto& mv2 = mem->m_vertices[id2];
 
-    const auto uv = w * mv0.m_texCoord + u * mv1.m_texCoord + v * mv2.m_texCoord;
-    intersect->u = uv.x;
-    intersect->v = uv.y;
-    intersect->t = t;
+    if( UNLIKELY( mem->IsMoving() ) ){
+        // vertices are placed where they are at the time of the ray, only the positions move.
+        MeshVertex mv[3] = { mv0 , mv1 , mv2 };
+        for( auto i = 0u ; i < 3u ; ++i ){
+            const auto& close = mem->m_motionPositions[m_index.m_id[i]];
+            mv[i].m_position = mv[i].m_position + ( close - mv[i].m_position ) * r.m_time;
+        }
+        return intersectTriangle( r , mv[0] , mv[1] , mv[2] , intersect );
+    }
 
-    return true;
+    return intersectTriangle( r , mv0 , mv1 , mv2 , intersect );
+}
+
+void Triangle::SetupIntersection( const Ray& r , float t , float u , float v , SurfaceInteraction* intersect ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    const auto& mv0 = mem->m_vertices[m_index.m_id[0]];
+    const auto& mv1 = mem->m_vertices[m_index.m_id[1]];
+    const auto& mv2 = mem->m_vertices[m_index.m_id[2]];
+
+    if( UNLIKELY( mem->IsMoving() ) ){
+        MeshVertex mv[3] = { mv0 , mv1 , mv2 };
+        for( auto i = 0u ; i < 3u ; ++i ){
+            const auto& close = mem->m_motionPositions[m_index.m_id[i]];
+            mv[i].m_position = mv[i].m_position + ( close - mv[i].m_position ) * r.m_time;
+        }
+        setupTriangleIntersection( r , t , u , v , mv[0] , mv[1] , mv[2] , intersect );
+        return;
+    }
+
+    setupTriangleIntersection( r , t , u , v , mv0 , mv1 , mv2 , intersect );
+}
+
+void setupRayFootprint( const Ray& ray , float t , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersection ){
+    intersection->footprint = ray.m_coneWidth + t * ray.m_coneSpread;
+    if( intersection->footprint <= 0.0f ){
+        intersection->uvDensity = 0.0f;
+        return;
+    }
+
+    // the ratio between the areas of the triangle in texture space and world space, both are doubled
+    const auto world_area = cross( mv1.m_position - mv0.m_position , mv2.m_position - mv0.m_position ).Length();
+    const auto duv0 = mv1.m_texCoord - mv0.m_texCoord;
+    const auto duv1 = mv2.m_texCoord - mv0.m_texCoord;
+    const auto uv_area = fabs( duv0.x * duv1.y - duv0.y * duv1.x );
+    intersection->uvDensity = world_area > 0.0f ? uv_area / world_area : 0.0f;
+}
+
+void setupIntersectionPoint( float u , float v , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersection ){
+    const auto w = 1.0f - u - v;
+    const auto p0 = w * mv0.m_position;
+    const auto p1 = u * mv1.m_position;
+    const auto p2 = v * mv2.m_position;
+    intersection->intersect = p0 + p1 + p2;
+    intersection->error = errorGamma( 7 ) * Vector( fabs( p0.x ) + fabs( p1.x ) + fabs( p2.x ) ,
+                                                    fabs( p0.y ) + fabs( p1.y ) + fabs( p2.y ) ,
+                                                    fabs( p0.z ) + fabs( p1.z ) + fabs( p2.z ) );
 }
 
 const BBox& Triangle::GetBBox() const{
@@ -130,11 +200,92 @@ const BBox& Triangle::GetBBox() const{
         m_bbox->Union( p0 );
         m_bbox->Union( p1 );
         m_bbox->Union( p2 );
+
+        // moving triangles are bounded during the whole shutter interval
+        if( mem->IsMoving() ){
+            m_bbox->Union( mem->m_motionPositions[id0] );
+            m_bbox->Union( mem->m_motionPositions[id1] );
+            m_bbox->Union( mem->m_motionPositions[id2] );
+        }
     }
 
     return *m_bbox;
 }
 
+bool Triangle::GetMotionBBox( BBox& open , BBox& close ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    if( !mem->IsMoving() )
+        return false;
+
+    open.InvalidBBox();
+    close.InvalidBBox();
+    for( auto i = 0u ; i < 3u ; ++i ){
+        open.Union( mem->m_vertices[m_index.m_id[i]].m_position );
+        close.Union( mem->m_motionPositions[m_index.m_id[i]] );
+    }
+    return true;
+}
+
+bool Triangle::IsMoving() const{
+    return m_meshVisual->m_memory->IsMoving();
+}
+
+void Triangle::SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const{
+    const auto& mem = m_meshVisual->m_memory;
+
+    // clipping the triangle at one time doesn't bound it at other times
+    if( mem->IsMoving() ){
+        Shape::SplitBBox( box , axis , pos , left , right );
+        return;
+    }
+
+    const Point p[3] = { mem->m_vertices[m_index.m_id[0]].m_position ,
+                         mem->m_vertices[m_index.m_id[1]].m_position ,
+                         mem->m_vertices[m_index.m_id[2]].m_position };
+
+    left.InvalidBBox();
+    right.InvalidBBox();
+    for( auto i = 0u ; i < 3u ; ++i ){
+        const auto& v0 = p[i];
+        const auto& v1 = p[( i + 1 ) % 3];
+        if( v0[axis] <= pos )
+            left.Union( v0 );
+        if( v0[axis] >= pos )
+            right.Union( v0 );
+
+        // the edge crosses the plane, the crossing point belongs to both sides
+        if( ( v0[axis] < pos && v1[axis] > pos ) || ( v0[axis] > pos && v1[axis] < pos ) ){
+            const auto t = ( pos - v0[axis] ) / ( v1[axis] - v0[axis] );
+            auto crossing = v0 + ( v1 - v0 ) * t;
+            crossing[axis] = pos;
+            left.Union( crossing );
+            right.Union( crossing );
+        }
+    }
+
+    // the triangle may have been split before, only the part inside the box matters
+    left = Intersection( left , box );
+    right = Intersection( right , box );
+}
+
+void Triangle::HashGeometry( unsigned long long& hash ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    for( auto i = 0u ; i < 3u ; ++i ){
+        const auto& p = mem->m_vertices[m_index.m_id[i]].m_position;
+        hashData( hash , p.data , sizeof( p.data ) );
+    }
+    if( mem->IsMoving() ){
+        for( auto i = 0u ; i < 3u ; ++i ){
+            const auto& p = mem->m_motionPositions[m_index.m_id[i]];
+            hashData( hash , p.data , sizeof( p.data ) );
+        }
+    }
+}
+
+void Triangle::HashTopology( unsigned long long& hash ) const{
+    hashData( hash , m_index.m_id , sizeof( m_index.m_id ) );
+}
+
 float Triangle::SurfaceArea() const{
     const auto& mem = m_meshVisual->m_memory;
     const auto id0 = m_index.m_id[0];
@@ -163,6 +314,11 @@ bool Triangle::GetIntersect(const BBox& box) const{
     };
 
     const auto& mem = m_meshVisual->m_memory;
+
+    // the triangle sweeps through a volume during the shutter interval, the test is conservative for it
+    if( mem->IsMoving() )
+        return true;
+
     const auto id0 = m_index.m_id[0];
     const auto id1 = m_index.m_id[1];
     const auto id2 = m_index.m_id[2];
@@ -224,3 +380,169 @@ bool Triangle::GetIntersect(const BBox& box) const{
 
     return true;
 }
+
+Vector Triangle::GetNormal() const{
+    const auto& mem = m_meshVisual->m_memory;
+    const auto& p0 = mem->m_vertices[m_index.m_id[0]].m_position;
+    const auto& p1 = mem->m_vertices[m_index.m_id[1]].m_position;
+    const auto& p2 = mem->m_vertices[m_index.m_id[2]].m_position;
+    return normalize( cross( p2 - p0 , p1 - p0 ) );
+}
+
+// The angle between two normalized vectors, it is more accurate than 'acos' when they are close to parallel.
+SORT_STATIC_FORCEINLINE float angleBetween( const Vector& v0 , const Vector& v1 ){
+    if( dot( v0 , v1 ) < 0.0f )
+        return PI - 2.0f * asin( std::min( ( v0 + v1 ).Length() * 0.5f , 1.0f ) );
+    return 2.0f * asin( std::min( ( v1 - v0 ).Length() * 0.5f , 1.0f ) );
+}
+
+// The interior angles of the spherical triangle with vertices a, b and c on the unit sphere.
+// It returns false if the spherical triangle is degenerated.
+SORT_STATIC_FORCEINLINE bool sphericalTriangleAngles( const Vector& a , const Vector& b , const Vector& c , float& alpha , float& beta , float& gamma ){
+    auto n_ab = cross( a , b );
+    auto n_bc = cross( b , c );
+    auto n_ca = cross( c , a );
+    if( n_ab.SquaredLength() == 0.0f || n_bc.SquaredLength() == 0.0f || n_ca.SquaredLength() == 0.0f )
+        return false;
+    n_ab = normalize( n_ab );
+    n_bc = normalize( n_bc );
+    n_ca = normalize( n_ca );
+
+    alpha = angleBetween( n_ab , -n_ca );
+    beta = angleBetween( n_bc , -n_ab );
+    gamma = angleBetween( n_ca , -n_bc );
+    return true;
+}
+
+// The solid angle of the triangle seen from p, it is zero if the triangle is not suitable for spherical sampling.
+SORT_STATIC_FORCEINLINE float sphericalSampleArea( const Point& p , const Point& p0 , const Point& p1 , const Point& p2 ){
+    auto alpha = 0.0f , beta = 0.0f , gamma = 0.0f;
+    if( !sphericalTriangleAngles( normalize( p0 - p ) , normalize( p1 - p ) , normalize( p2 - p ) , alpha , beta , gamma ) )
+        return 0.0f;
+    const auto area = alpha + beta + gamma - PI;
+    return ( area >= MIN_SPHERICAL_SAMPLE_AREA && area <= MAX_SPHERICAL_SAMPLE_AREA ) ? area : 0.0f;
+}
+
+Point Triangle::Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    const auto& p0 = mem->m_vertices[m_index.m_id[0]].m_position;
+    const auto& p1 = mem->m_vertices[m_index.m_id[1]].m_position;
+    const auto& p2 = mem->m_vertices[m_index.m_id[2]].m_position;
+    n = GetNormal();
+
+    auto b0 = 0.0f , b1 = 0.0f , b2 = 0.0f;
+    auto solid_angle = sphericalSampleArea( p , p0 , p1 , p2 );
+    if( solid_angle > 0.0f ){
+        const auto a = normalize( p0 - p );
+        const auto b = normalize( p1 - p );
+        const auto c = normalize( p2 - p );
+        auto alpha = 0.0f , beta = 0.0f , gamma = 0.0f;
+        sphericalTriangleAngles( a , b , c , alpha , beta , gamma );
+
+        // pick the sub-triangle with the area proportional to the first canonical number, it determines the
+        // new vertex c' on the arc between a and c
+        const auto area_pi = alpha + beta + gamma;
+        const auto sub_area_pi = PI + ls.u * ( area_pi - PI );
+        const auto cos_alpha = cos( alpha );
+        const auto sin_alpha = sin( alpha );
+        const auto sin_phi = sin( sub_area_pi ) * cos_alpha - cos( sub_area_pi ) * sin_alpha;
+        const auto cos_phi = cos( sub_area_pi ) * cos_alpha + sin( sub_area_pi ) * sin_alpha;
+        const auto k1 = cos_phi + cos_alpha;
+        const auto k2 = sin_phi - sin_alpha * dot( a , b );
+        const auto cos_bp = clamp( ( k2 + ( k2 * cos_phi - k1 * sin_phi ) * cos_alpha ) / ( ( k2 * sin_phi + k1 * cos_phi ) * sin_alpha ) , -1.0f , 1.0f );
+        const auto sin_bp = sqrt( std::max( 0.0f , 1.0f - cos_bp * cos_bp ) );
+        const auto cp = cos_bp * a + sin_bp * normalize( c - dot( c , a ) * a );
+
+        // the direction is picked on the arc between b and c' with the second canonical number
+        const auto cos_theta = 1.0f - ls.v * ( 1.0f - dot( cp , b ) );
+        const auto sin_theta = sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+        wi = cos_theta * b + sin_theta * normalize( cp - dot( cp , b ) * b );
+
+        // barycentric coordinate of the point where the direction hits the triangle
+        const auto e1 = p1 - p0;
+        const auto e2 = p2 - p0;
+        const auto s1 = cross( wi , e2 );
+        const auto divisor = dot( s1 , e1 );
+        if( divisor != 0.0f ){
+            const auto s = p - p0;
+            b1 = saturate( dot( s , s1 ) / divisor );
+            b2 = saturate( dot( wi , cross( s , e1 ) ) / divisor );
+            if( b1 + b2 > 1.0f ){
+                const auto sum = b1 + b2;
+                b1 /= sum;
+                b2 /= sum;
+            }
+            b0 = 1.0f - b1 - b2;
+        }else{
+            // the direction is parallel to the triangle, which only happens because of numerical issues
+            solid_angle = 0.0f;
+        }
+    }
+
+    // fall back to uniformly sampling the triangle by area
+    if( solid_angle == 0.0f ){
+        const auto su = sqrt( ls.u );
+        b0 = 1.0f - su;
+        b1 = ls.v * su;
+        b2 = 1.0f - b0 - b1;
+    }
+
+    const auto lp = b0 * p0 + b1 * p1 + b2 * p2;
+    const auto delta = lp - p;
+    wi = normalize( delta );
+
+    if( pdf ){
+        const auto d = dot( -wi , n );
+        if( d <= 0.0f )
+            *pdf = 0.0f;
+        else
+            *pdf = solid_angle > 0.0f ? 1.0f / solid_angle : delta.SquaredLength() / ( SurfaceArea() * d );
+    }
+
+    return lp;
+}
+
+void Triangle::Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    const auto& p0 = mem->m_vertices[m_index.m_id[0]].m_position;
+    const auto& p1 = mem->m_vertices[m_index.m_id[1]].m_position;
+    const auto& p2 = mem->m_vertices[m_index.m_id[2]].m_position;
+
+    const auto su = sqrt( ls.u );
+    const auto b0 = 1.0f - su;
+    const auto b1 = ls.v * su;
+    n = GetNormal();
+
+    Vector t , s;
+    coordinateSystem( n , t , s );
+    const auto dir = UniformSampleHemisphere( sort_canonical() , sort_canonical() );
+
+    r.m_fMin = 0.0f;
+    r.m_fMax = FLT_MAX;
+    r.m_Ori = b0 * p0 + b1 * p1 + ( 1.0f - b0 - b1 ) * p2;
+    r.m_Dir = dir.x * t + dir.y * n + dir.z * s;
+
+    if( pdf )
+        *pdf = UniformHemispherePdf() / SurfaceArea();
+}
+
+float Triangle::Pdf( const Point& p , const Vector& wi ) const{
+    // the ray is tested against the triangle directly without going through an accelerator, which prepares it
+    const Ray ray( p , wi );
+    ray.Prepare();
+
+    SurfaceInteraction inter;
+    if( !GetIntersect( ray , &inter ) )
+        return 0.0f;
+
+    const auto delta = p - inter.intersect;
+    const auto d = dot( normalize( delta ) , inter.gnormal );
+    if( d <= 0.0f )
+        return 0.0f;
+
+    const auto& mem = m_meshVisual->m_memory;
+    const auto solid_angle = sphericalSampleArea( p , mem->m_vertices[m_index.m_id[0]].m_position ,
+                                                      mem->m_vertices[m_index.m_id[1]].m_position ,
+                                                      mem->m_vertices[m_index.m_id[2]].m_position );
+    return solid_angle > 0.0f ? 1.0f / solid_angle : delta.SquaredLength() / ( SurfaceArea() * d );
+}
@@ -20,12 +20,21 @@
 #include "core/define.h"
 #include "shape.h"
 
+#if defined(AVX_ENABLED) || defined(AVX512_ENABLED)
+    #include <immintrin.h>
+#endif
+
+#ifdef NEON_ENABLED
+    #include <arm_neon.h>
+#endif
+
 class   MeshVisual;
 struct  MeshFaceIndex;
+struct  MeshVertex;
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
     struct Triangle4;
-#ifdef SORT_IN_WINDOWS
+#if defined(SORT_IN_WINDOWS) && defined(SSE_ENABLED)
     struct simd_data_sse;
 #endif
 #endif
@@ -37,6 +46,13 @@ struct  MeshFaceIndex;
 #endif
 #endif
 
+#ifdef AVX512_ENABLED
+    struct Triangle16;
+#ifdef SORT_IN_WINDOWS
+    struct simd_data_avx512;
+#endif
+#endif
+
 //! @brief Triangle class defines the basic behavior of triangle.
 /**
  * Triangle is the most common shape that is used in a ray tracer.
@@ -51,19 +67,19 @@ public:
 
     //! @brief Sample a point on the surface of the shape given a shading point.
     //!
-    //! Sample a position on the surface of the shape. This function is heavily
-    //! used in area light, where it is necessary to take random sample on the surface to
-    //! support multiple importance sampling.
+    //! The spherical triangle subtended by the triangle is sampled uniformly, which is what the detail algorithm in
+    //! this paper describes, <a href="https://www.graphics.cornell.edu/pubs/1995/Arv95c.pdf">Stratified Sampling of
+    //! Spherical Triangles</a>. Triangles that are either too small or too large in solid angle for it to be robust
+    //! are sampled uniformly by area instead.
     //!
     //! @param ls       The light sample.
     //! @param p        The position of shading point to be lit.
     //! @param wi       The vector from shading point to sampled point, it is normalized.
-    //! @param pdf      The pdf w.r.t solid angle ( not surface area ) of picking the sampled point.
+    //! @param n        The geometric normal of the triangle.
+    //! @param pdf      The pdf w.r.t solid angle ( not surface area ) of picking the sampled point. It is zero if
+    //!                 the shading point is behind the triangle.
     //! @return         The sampled point on the surface of the shape.
-    Point           Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n, float* pdf ) const override{
-        // to be implemented
-        return Point();
-    }
+    Point           Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n, float* pdf ) const override;
 
     //! @brief Sample a ray from the light source without a given shading point.
     //!
@@ -74,9 +90,21 @@ public:
     //!                 the direction of the ray will point outward depending on the normal.
     //! @param n        The normal at the surface where the ray shoots from.
     //! @param pdf      The pdf w.r.t solid angle of picking the ray.
-    void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override{
-        // to be implemented.
-    }
+    void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override;
+
+    //! @brief The pdf w.r.t solid angle of sampling the direction from a shading point with 'Sample_l'.
+    //!
+    //! @param p        The position of shading point to be lit.
+    //! @param wi       The direction pointing from the point.
+    //! @return         The pdf w.r.t solid angle, it is zero if the ray misses the front side of the triangle.
+    float           Pdf( const Point& p , const Vector& wi ) const override;
+
+    //! @brief Get the geometric normal of the triangle.
+    //!
+    //! It points to the same side as the geometric normal of the intersections with the triangle.
+    //!
+    //! @return         The normalized geometric normal.
+    Vector          GetNormal() const;
 
     //! @brief      Get intersected point between the ray and the shape.
     //!
@@ -90,6 +118,31 @@ public:
     //! @return         Whether the ray intersects the shape.
     bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
 
+    //! @brief      Fill the intersection of a hit found outside of SORT, like by Embree.
+    //!
+    //! The primitive of the intersection is not touched.
+    //!
+    //! @param ray      The ray hitting the triangle.
+    //! @param t        Distance from the origin of the ray to the hit.
+    //! @param u        Barycentric coordinate of the second vertex.
+    //! @param v        Barycentric coordinate of the third vertex.
+    //! @param inter    The intersection data to be filled.
+    void            SetupIntersection( const Ray& ray , float t , float u , float v , SurfaceInteraction* inter ) const;
+
+    //! @brief      Get the visual holding the vertex buffer of the triangle.
+    //!
+    //! @return     The visual of the triangle.
+    const MeshVisual*       GetMeshVisual() const{
+        return m_meshVisual;
+    }
+
+    //! @brief      Get the indices of the vertices of the triangle, it is an element of the index buffer of its mesh.
+    //!
+    //! @return     The indices of the triangle.
+    const MeshFaceIndex&    GetIndex() const{
+        return m_index;
+    }
+
     //! @brief Intersection test between the shape and a bounding box.
     //!
     //! Detail algorithm of triangle and bounding box intersection comes from this paper,
@@ -98,6 +151,32 @@ public:
     //! param box       Bounding box to be checked.
     bool            GetIntersect( const BBox& box ) const override;
 
+    //! @brief Split the part of the triangle inside a bounding box with an axis aligned plane.
+    //!
+    //! The triangle is clipped against the plane so that each side gets the bounding box of its own part of the triangle,
+    //! instead of half of the original bounding box.
+    //!
+    //! @param box      Bounding box of the part of the triangle to be split.
+    //! @param axis     Axis perpendicular to the split plane.
+    //! @param pos      Position of the split plane along the axis.
+    //! @param left     Bounding box of the part of the triangle on the negative side of the plane.
+    //! @param right    Bounding box of the part of the triangle on the positive side of the plane.
+    void            SplitBBox( const BBox& box , const unsigned axis , const float pos , BBox& left , BBox& right ) const override;
+
+    //! @brief Hash the geometry of the triangle.
+    //!
+    //! Both of the bounding box intersection test and splitting depend on the positions of the vertices.
+    //!
+    //! @param hash     The hash to be updated.
+    void            HashGeometry( unsigned long long& hash ) const override;
+
+    //! @brief Hash the topology of the triangle.
+    //!
+    //! Only the indices of the vertices are hashed, they don't change when the mesh is deformed.
+    //!
+    //! @param hash     The hash to be updated.
+    void            HashTopology( unsigned long long& hash ) const override;
+
     //! @brief      Get bounding box of the shape in world space.
     //!
     //! Get the bounding box of the shape. Some shape may return a relatively conservative bounding
@@ -106,6 +185,18 @@ public:
     //! @return     The bounding box of the shape.
     const BBox&     GetBBox() const override;
 
+    //! @brief      Get bounding boxes of the triangle at the opening and closing of the shutter.
+    //!
+    //! @param open     Bounding box at the opening of the shutter.
+    //! @param close    Bounding box at the closing of the shutter.
+    //! @return         Whether the mesh of the triangle moves.
+    bool            GetMotionBBox( BBox& open , BBox& close ) const override;
+
+    //! @brief      Whether the mesh of the triangle moves during the shutter interval.
+    //!
+    //! @return     Whether the triangle moves.
+    bool            IsMoving() const override;
+
     //! @brief      Get the surface area of the shape.
     //!
     //! Get the surface area of the shape. This function is heavily used in the case of picking a area light
@@ -125,9 +216,11 @@ private:
     const MeshVisual*        m_meshVisual = nullptr;     /**< Visual holding the vertex buffer. */
     const MeshFaceIndex&     m_index;                    /**< Index buffer points to the index of this triangle. */
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
     friend struct Triangle4;
-    #ifdef SORT_IN_WINDOWS
+    #if defined(NEON_ENABLED)
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const float32x4_t& t4, const float32x4_t& u4, const float32x4_t& v4, const int id, SurfaceInteraction* intersection);
+    #elif defined(SORT_IN_WINDOWS)
         friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const simd_data_sse& t4, const simd_data_sse& u4, const simd_data_sse& v4, const int id, SurfaceInteraction* intersection);
     #else
         friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const __m128& t4, const __m128& u4, const __m128& v4, const int id, SurfaceInteraction* intersection);
@@ -142,4 +235,34 @@ private:
         friend SORT_FORCEINLINE void setupIntersection(const Triangle8& tri8, const Ray& ray, const __m256& t8, const __m256& u8, const __m256& v8, const int id, SurfaceInteraction* intersection);
     #endif
 #endif
-};
\ No newline at end of file
+
+#ifdef AVX512_ENABLED
+    friend struct Triangle16;
+    #ifdef SORT_IN_WINDOWS
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle16& tri16, const Ray& ray, const simd_data_avx512& t16, const simd_data_avx512& u16, const simd_data_avx512& v16, const int id, SurfaceInteraction* intersection);
+    #else
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle16& tri16, const Ray& ray, const __m512& t16, const __m512& u16, const __m512& v16, const int id, SurfaceInteraction* intersection);
+    #endif
+#endif
+};
+//! @brief  Fill the footprint of a ray cone hitting a triangle, it is the input of texture filtering.
+//!
+//! @param  ray             The ray hitting the triangle.
+//! @param  t               Distance from the origin of the ray to the intersection.
+//! @param  mv0             The first vertex of the triangle.
+//! @param  mv1             The second vertex of the triangle.
+//! @param  mv2             The third vertex of the triangle.
+//! @param  intersection    The intersection to be filled.
+void    setupRayFootprint( const Ray& ray , float t , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersection );
+
+//! @brief  Fill the intersection point on a triangle and the bound of its floating point error.
+//!
+//! The point is interpolated from the vertices instead of being evaluated along the ray, its error is a lot smaller.
+//!
+//! @param  u               Barycentric coordinate of the second vertex.
+//! @param  v               Barycentric coordinate of the third vertex.
+//! @param  mv0             The first vertex of the triangle.
+//! @param  mv1             The second vertex of the triangle.
+//! @param  mv2             The third vertex of the triangle.
+//! @param  intersection    The intersection to be filled.
+void    setupIntersectionPoint( float u , float v , const MeshVertex& mv0 , const MeshVertex& mv1 , const MeshVertex& mv2 , SurfaceInteraction* intersection );
@@ -17,29 +17,38 @@
 
 #pragma once
 
+#include <cmath>
+#include <algorithm>
 #include "core/define.h"
 #include "math/bbox.h"
 
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_BBOX_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_bbox." );
 #endif
 
 #ifdef SIMD_BVH_IMPLEMENTATION
 
 #if defined(SIMD_AVX_IMPLEMENTATION)
-    #define Simd_BBox   BBox8
+    #define Simd_BBox               BBox8
+    #define Simd_Quantized_BBox     Quantized_BBox8
 #endif
 
 #if defined(SIMD_SSE_IMPLEMENTATION)
-    #define Simd_BBox   BBox4
+    #define Simd_BBox               BBox4
+    #define Simd_Quantized_BBox     Quantized_BBox4
+#endif
+
+#if defined(SIMD_AVX512_IMPLEMENTATION)
+    #define Simd_BBox               BBox16
+    #define Simd_Quantized_BBox     Quantized_BBox16
 #endif
 
 //! @brief  SIMD version bounding box.
 /**
- * This is basically 4/8 bounding box in a single data structure. For best performance, they are saved in
+ * This is basically 4/8/16 bounding box in a single data structure. For best performance, they are saved in
  * structure of arrays.
  * Since this data structure is only used in limited places, only very few interfaces are implemented for
  * simplicity.
@@ -59,6 +68,26 @@ public:
 
 static_assert( sizeof( Simd_BBox ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_BBox." );
 
+//! @brief  Interpolate 4/8/16 bounding boxes between both ends of the shutter interval.
+//!
+//! @param  open        Bounding boxes at the opening of the shutter.
+//! @param  close       Bounding boxes at the closing of the shutter.
+//! @param  time        Time within the shutter interval, normalized to [0,1].
+//! @return             The bounding boxes at the time, the mask is the one of the boxes at the opening of the shutter.
+SORT_STATIC_FORCEINLINE Simd_BBox InterpolateBBox_SIMD( const Simd_BBox& open , const Simd_BBox& close , const float time ){
+    const auto t = simd_set_ps1( time );
+
+    Simd_BBox bbox;
+    bbox.m_min_x = simd_mad_ps( simd_sub_ps( close.m_min_x , open.m_min_x ) , t , open.m_min_x );
+    bbox.m_min_y = simd_mad_ps( simd_sub_ps( close.m_min_y , open.m_min_y ) , t , open.m_min_y );
+    bbox.m_min_z = simd_mad_ps( simd_sub_ps( close.m_min_z , open.m_min_z ) , t , open.m_min_z );
+    bbox.m_max_x = simd_mad_ps( simd_sub_ps( close.m_max_x , open.m_max_x ) , t , open.m_max_x );
+    bbox.m_max_y = simd_mad_ps( simd_sub_ps( close.m_max_y , open.m_max_y ) , t , open.m_max_y );
+    bbox.m_max_z = simd_mad_ps( simd_sub_ps( close.m_max_z , open.m_max_z ) , t , open.m_max_z );
+    bbox.m_mask = open.m_mask;
+    return bbox;
+}
+
 SORT_FORCEINLINE int IntersectBBox_SIMD(const Ray& ray, const Simd_Ray_Data& simd_ray , const Simd_BBox& bb, simd_data& f_min ) {
 #ifndef SIMD_BBOX_REFERENCE_IMPLEMENTATION
     f_min = simd_set_ps1( ray.m_fMin );
@@ -107,4 +136,156 @@ SORT_FORCEINLINE int IntersectBBox_SIMD(const Ray& ray, const Simd_Ray_Data& sim
     return ret;
 #endif
 }
+
+//! @brief  SIMD version bounding box with quantized coordinates.
+/**
+ * Bounding boxes of the children are saved as 8 bits offsets relative to the union of them, in the style of
+ * 'Efficient Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs' by Ylitie et al. It takes about a third of
+ * the memory of the full precision version. The size of one quantization step along an axis is a power of two so that
+ * there is no error in scaling the offsets.
+ * Quantized bounding boxes are conservative, they could be slightly larger than the original ones, but never smaller.
+ * Invalid boxes are saved as inverted boxes.
+ */
+struct alignas(16) Simd_Quantized_BBox{
+public:
+    float           m_origin[3];                /**< Minimum corner of the union of all valid boxes. */
+    float           m_scale[3];                 /**< Size of one quantization step along each axis. */
+
+    unsigned char   m_min_x[SIMD_CHANNEL];      /**< Quantized minimum corners along X. */
+    unsigned char   m_min_y[SIMD_CHANNEL];      /**< Quantized minimum corners along Y. */
+    unsigned char   m_min_z[SIMD_CHANNEL];      /**< Quantized minimum corners along Z. */
+
+    unsigned char   m_max_x[SIMD_CHANNEL];      /**< Quantized maximum corners along X. */
+    unsigned char   m_max_y[SIMD_CHANNEL];      /**< Quantized maximum corners along Y. */
+    unsigned char   m_max_z[SIMD_CHANNEL];      /**< Quantized maximum corners along Z. */
+};
+
+//! @brief  Quantize 4/8/16 bounding boxes.
+//!
+//! @param  bbox        Bounding boxes to be quantized.
+//! @param  valid       Whether each bounding box is valid.
+//! @return             The quantized bounding boxes.
+SORT_STATIC_FORCEINLINE Simd_Quantized_BBox QuantizeBBox_SIMD( const BBox* bbox , const bool* valid ){
+    BBox parent;
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        if( valid[i] )
+            parent.Union( bbox[i] );
+    }
+
+    Simd_Quantized_BBox qbb;
+    unsigned char* q_min[] = { qbb.m_min_x , qbb.m_min_y , qbb.m_min_z };
+    unsigned char* q_max[] = { qbb.m_max_x , qbb.m_max_y , qbb.m_max_z };
+    for( auto axis = 0 ; axis < 3 ; ++axis ){
+        const auto origin = parent.m_Min[axis];
+        const auto extent = parent.m_Max[axis] - parent.m_Min[axis];
+
+        // the smallest power of two that covers the extent with 255 steps, the extent itself could be rounded down
+        auto scale = 0.0f;
+        if( extent > 0.0f ){
+            auto exponent = 0;
+            frexp( extent / 255.0f , &exponent );
+            scale = ldexp( 1.0f , exponent );
+            if( origin + 255.0f * scale < parent.m_Max[axis] )
+                scale *= 2.0f;
+        }
+        qbb.m_origin[axis] = origin;
+        qbb.m_scale[axis] = scale;
+
+        // This is exactly how the boxes are decoded. Offsets are adjusted until the decoded boxes cover the original
+        // ones since rounding in the evaluation of the offsets could make them slightly smaller.
+        const auto decode = [&]( const int q ){
+            return origin + (float)q * scale;
+        };
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if( !valid[i] ){
+                q_min[axis][i] = 255;
+                q_max[axis][i] = 0;
+                continue;
+            }
+
+            auto lo = scale > 0.0f ? (int)floor( ( bbox[i].m_Min[axis] - origin ) / scale ) : 0;
+            lo = std::min( std::max( lo , 0 ) , 255 );
+            while( lo > 0 && decode( lo ) > bbox[i].m_Min[axis] )
+                --lo;
+
+            auto hi = scale > 0.0f ? (int)ceil( ( bbox[i].m_Max[axis] - origin ) / scale ) : 0;
+            hi = std::min( std::max( hi , 0 ) , 255 );
+            while( hi < 255 && decode( hi ) < bbox[i].m_Max[axis] )
+                ++hi;
+
+            q_min[axis][i] = (unsigned char)lo;
+            q_max[axis][i] = (unsigned char)hi;
+        }
+    }
+
+    return qbb;
+}
+
+//! @brief  Decode one of the quantized bounding boxes.
+//!
+//! @param  qbb         The quantized bounding boxes.
+//! @param  i           Index of the bounding box to be decoded.
+//! @return             The decoded bounding box, it is inverted if it is not a valid one.
+SORT_STATIC_FORCEINLINE BBox DequantizeBBox_SIMD( const Simd_Quantized_BBox& qbb , const int i ){
+    const auto decode = [&]( const int axis , const unsigned char q ){
+        return qbb.m_origin[axis] + (float)q * qbb.m_scale[axis];
+    };
+
+    BBox bbox;
+    bbox.m_Min = Point( decode( 0 , qbb.m_min_x[i] ) , decode( 1 , qbb.m_min_y[i] ) , decode( 2 , qbb.m_min_z[i] ) );
+    bbox.m_Max = Point( decode( 0 , qbb.m_max_x[i] ) , decode( 1 , qbb.m_max_y[i] ) , decode( 2 , qbb.m_max_z[i] ) );
+    return bbox;
+}
+
+SORT_FORCEINLINE int IntersectBBox_SIMD(const Ray& ray, const Simd_Ray_Data& simd_ray , const Simd_Quantized_BBox& bb, simd_data& f_min ) {
+#ifndef SIMD_BBOX_REFERENCE_IMPLEMENTATION
+    f_min = simd_set_ps1( ray.m_fMin );
+    simd_data f_max = simd_set_ps1( ray.m_fMax );
+
+    // Decoding is merged in the slab test, the distance along the ray of a quantized plane is
+    // ( origin + q * scale ) * rcp_dir + ori_dir = q * ( scale * rcp_dir ) + ( origin * rcp_dir + ori_dir )
+    const simd_data min_x = simd_cvtu8_ps( bb.m_min_x );
+    const simd_data max_x = simd_cvtu8_ps( bb.m_max_x );
+    simd_data step  = simd_mul_ps( simd_set_ps1( bb.m_scale[0] ) , ray_rcp_dir_x(simd_ray) );
+    simd_data base  = simd_mad_ps( simd_set_ps1( bb.m_origin[0] ) , ray_rcp_dir_x(simd_ray) , ray_ori_dir_x(simd_ray) );
+    simd_data t1    = simd_mad_ps( max_x , step , base );
+    simd_data t2    = simd_mad_ps( min_x , step , base );
+    f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
+    f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
+
+    step            = simd_mul_ps( simd_set_ps1( bb.m_scale[1] ) , ray_rcp_dir_y(simd_ray) );
+    base            = simd_mad_ps( simd_set_ps1( bb.m_origin[1] ) , ray_rcp_dir_y(simd_ray) , ray_ori_dir_y(simd_ray) );
+    t1              = simd_mad_ps( simd_cvtu8_ps( bb.m_max_y ) , step , base );
+    t2              = simd_mad_ps( simd_cvtu8_ps( bb.m_min_y ) , step , base );
+    f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
+    f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
+
+    step            = simd_mul_ps( simd_set_ps1( bb.m_scale[2] ) , ray_rcp_dir_z(simd_ray) );
+    base            = simd_mad_ps( simd_set_ps1( bb.m_origin[2] ) , ray_rcp_dir_z(simd_ray) , ray_ori_dir_z(simd_ray) );
+    t1              = simd_mad_ps( simd_cvtu8_ps( bb.m_max_z ) , step , base );
+    t2              = simd_mad_ps( simd_cvtu8_ps( bb.m_min_z ) , step , base );
+    f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
+    f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
+
+    // invalid boxes are inverted along all axes, checking one of them is enough
+    const simd_data mask = simd_and_ps( simd_cmple_ps( min_x , max_x ) , simd_cmple_ps( f_min , f_max ) );
+    f_min = simd_pick_ps( mask , f_min , simd_neg_ones );
+
+    return simd_movemask_ps( mask );
+#else
+    int ret = 0;
+    for( auto i = 0u ; i < SIMD_CHANNEL ; ++i ){
+        if( bb.m_min_x[i] > bb.m_max_x[i] ){
+            f_min[i] = -1.0f;
+            continue;
+        }
+
+        f_min[i] = Intersect( ray , DequantizeBBox_SIMD( bb , i ) );
+
+        if( f_min[i] >= 0.0f )
+            ret |= ( 1 << i );
+    }
+    return ret;
+#endif
+}
 #endif
\ No newline at end of file
@@ -25,7 +25,7 @@
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_LINE_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_line.h." );
 #endif
 
@@ -39,6 +39,10 @@
     #define Simd_Line   Line8
 #endif
 
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Line   Line16
+#endif
+
 //! @brief  Like Triangle8, Line8 is the corresponding version for line shape.
 struct alignas(SIMD_ALIGNMENT) Simd_Line{
     simd_data  m_p0_x , m_p0_y , m_p0_z;   /**< Point at the end of the line. */
@@ -46,6 +50,8 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
 
     simd_data  m_w0 , m_w1;                /**< Half width of the line. */
     simd_data  m_length;                   /**< Length of the line. */
+    simd_data  m_radius;                   /**< Half extent of the oriented box bounding the line in its local space. */
+    simd_data  m_margin;                   /**< How much the oriented box is widened, so that rays on its slabs are not culled. */
 
     /**< Transformation from world space to line local space. */
     simd_data  m_mat_00, m_mat_01, m_mat_02, m_mat_03;
@@ -122,6 +128,16 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_ori_line[7] = line;
         return true;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        const Line* line = dynamic_cast<const Line*>(primitive->GetShape());
+        auto i = 0;
+        while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(m_ori_pri[i]) )
+            ++i;
+        m_ori_pri[i] = primitive;
+        m_ori_line[i] = line;
+        return i == SIMD_CHANNEL - 1;
+#endif
     }
 
     //! @brief  Pack line information into SIMD compatible data.
@@ -133,7 +149,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
 
 		bool	mask[SIMD_CHANNEL] = { false };
         float   p0_x[SIMD_CHANNEL] , p0_y[SIMD_CHANNEL] , p0_z[SIMD_CHANNEL] , p1_x[SIMD_CHANNEL] , p1_y[SIMD_CHANNEL] , p1_z[SIMD_CHANNEL];
-        float   w0[SIMD_CHANNEL] , w1[SIMD_CHANNEL] , length[SIMD_CHANNEL];
+        float   w0[SIMD_CHANNEL] , w1[SIMD_CHANNEL] , length[SIMD_CHANNEL] , radius[SIMD_CHANNEL] , margin[SIMD_CHANNEL];
         float   mat_00[SIMD_CHANNEL] , mat_01[SIMD_CHANNEL] , mat_02[SIMD_CHANNEL] , mat_03[SIMD_CHANNEL];
         float   mat_10[SIMD_CHANNEL] , mat_11[SIMD_CHANNEL] , mat_12[SIMD_CHANNEL] , mat_13[SIMD_CHANNEL];
         float   mat_20[SIMD_CHANNEL] , mat_21[SIMD_CHANNEL] , mat_22[SIMD_CHANNEL] , mat_23[SIMD_CHANNEL];
@@ -157,6 +173,8 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
             w1[i] = line->m_w1;
 
             length[i] = line->m_length;
+            radius[i] = std::max( line->m_w0 , line->m_w1 );
+            margin[i] = 1e-4f * std::max( length[i] , radius[i] ) + 1e-6f;
 
             mat_00[i] = line->m_world2Line.matrix.m[0];
             mat_01[i] = line->m_world2Line.matrix.m[1];
@@ -183,6 +201,8 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_w0 = simd_set_ps( w0 );
         m_w1 = simd_set_ps( w1 );
         m_length = simd_set_ps( length );
+        m_radius = simd_set_ps( radius );
+        m_margin = simd_set_ps( margin );
 
         m_mat_00 = simd_set_ps( mat_00 );
         m_mat_01 = simd_set_ps( mat_01 );
@@ -213,6 +233,13 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_ori_pri[0] = m_ori_pri[1] = m_ori_pri[2] = m_ori_pri[3] = m_ori_pri[4] = m_ori_pri[5] = m_ori_pri[6] = m_ori_pri[7] = nullptr;
         m_ori_line[0] = m_ori_line[1] = m_ori_line[2] = m_ori_line[3] = m_ori_line[4] = m_ori_line[5] = m_ori_line[6] = m_ori_line[7] = nullptr;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            m_ori_pri[i] = nullptr;
+            m_ori_line[i] = nullptr;
+        }
+#endif
     }
 };
 
@@ -240,6 +267,41 @@ SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data&
     const simd_data _ray_dir_y = simd_mad_ps( line_simd.m_mat_12, ray_dir_z(ray_simd), simd_mad_ps( line_simd.m_mat_11, ray_dir_y(ray_simd), simd_mul_ps( line_simd.m_mat_10, ray_dir_x(ray_simd) )));
     const simd_data _ray_dir_z = simd_mad_ps( line_simd.m_mat_22, ray_dir_z(ray_simd), simd_mad_ps( line_simd.m_mat_21, ray_dir_y(ray_simd), simd_mul_ps( line_simd.m_mat_20, ray_dir_x(ray_simd) )));
 
+    // Segments of a strand are nearly parallel to their neighbours, a ray hitting the infinite cone of most lines in a leaf
+    // doesn't mean it gets close to any of the segments. The box [-r,r]x[0,length]x[-r,r] in line space is an oriented bound
+    // of each segment, which is way tighter than its axis aligned box in world space and rejects them before solving the quadric.
+    // The reciprocals are exact so that the box is never shrunk by their error. The box is slightly widened too, a ray parallel
+    // to a slab would otherwise get 0 * inf = NaN and be culled if its origin is right on the slab.
+    const simd_data zeros = simd_zero();
+    const simd_data ray_min_t = simd_set_ps1(ray.m_fMin);
+    const simd_data ray_max_t = simd_set_ps1(ray.m_fMax);
+    const simd_data box_max_xz = simd_add_ps( line_simd.m_radius , line_simd.m_margin );
+    const simd_data box_min_xz = simd_sub_ps( zeros , box_max_xz );
+    const simd_data box_max_y = simd_add_ps( line_simd.m_length , line_simd.m_margin );
+    const simd_data box_min_y = simd_sub_ps( zeros , line_simd.m_margin );
+
+    simd_data rcp_dir = simd_div_ps( simd_ones , _ray_dir_x );
+    simd_data t_near  = simd_mul_ps( simd_sub_ps( box_max_xz , _ray_ori_x ) , rcp_dir );
+    simd_data t_far   = simd_mul_ps( simd_sub_ps( box_min_xz , _ray_ori_x ) , rcp_dir );
+    simd_data f_min   = simd_max_ps( ray_min_t , simd_min_ps( t_near , t_far ) );
+    simd_data f_max   = simd_min_ps( ray_max_t , simd_max_ps( t_near , t_far ) );
+
+    rcp_dir = simd_div_ps( simd_ones , _ray_dir_y );
+    t_near  = simd_mul_ps( simd_sub_ps( box_max_y , _ray_ori_y ) , rcp_dir );
+    t_far   = simd_mul_ps( simd_sub_ps( box_min_y , _ray_ori_y ) , rcp_dir );
+    f_min   = simd_max_ps( f_min , simd_min_ps( t_near , t_far ) );
+    f_max   = simd_min_ps( f_max , simd_max_ps( t_near , t_far ) );
+
+    rcp_dir = simd_div_ps( simd_ones , _ray_dir_z );
+    t_near  = simd_mul_ps( simd_sub_ps( box_max_xz , _ray_ori_z ) , rcp_dir );
+    t_far   = simd_mul_ps( simd_sub_ps( box_min_xz , _ray_ori_z ) , rcp_dir );
+    f_min   = simd_max_ps( f_min , simd_min_ps( t_near , t_far ) );
+    f_max   = simd_min_ps( f_max , simd_max_ps( t_near , t_far ) );
+
+    mask = simd_and_ps( mask , simd_cmple_ps( f_min , f_max ) );
+    if( 0 == simd_movemask_ps(mask) )
+        return false;
+
     const simd_data tmp =  simd_div_ps( simd_sub_ps( line_simd.m_w1 , line_simd.m_w0 ) , line_simd.m_length );
     const simd_data tmp0 = simd_mad_ps( _ray_ori_y, tmp, line_simd.m_w0 );
     const simd_data tmp1 = simd_mul_ps( _ray_dir_y, tmp);
@@ -249,7 +311,6 @@ SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data&
     const simd_data b = simd_sub_ps( simd_mad_ps( _ray_dir_x , _ray_ori_x , simd_mul_ps( _ray_dir_z , _ray_ori_z ) ) , simd_mul_ps( tmp0 , tmp1 ) );
     const simd_data c = simd_sub_ps( simd_add_ps( simd_sqr_ps( _ray_ori_x ) , simd_sqr_ps( _ray_ori_z ) ) , simd_sqr_ps( tmp0 ) );
 
-    const simd_data zeros = simd_zero();
     const simd_data discriminant = simd_sub_ps( simd_sqr_ps( b ) , simd_mul_ps( a , c ) );
     mask = simd_and_ps( mask , simd_cmpgt_ps( discriminant , zeros ) );
     auto cm = simd_movemask_ps(mask);
@@ -273,8 +334,6 @@ SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data&
     t_simd = simd_pick_ps( mask0 , t0 , t1 );
     t_simd = simd_pick_ps( mask , t_simd , simd_infinites );
 
-    const simd_data ray_min_t = simd_set_ps1(ray.m_fMin);
-    const simd_data ray_max_t = simd_set_ps1(ray.m_fMax);
     mask = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t_simd , ray_min_t ) , simd_cmplt_ps( t_simd , ray_max_t ) ) );
     cm = simd_movemask_ps(mask);
     if (0 == cm)
@@ -315,7 +374,10 @@ SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Simd_Ray_Data&
     const auto res_i = __bsf(resolved_mask);
     const auto line = line_simd.m_ori_line[res_i];
 
+    // same as Line::GetIntersect, the error of the intersection is bounded by the diameter of the fiber.
+    const auto radius = slerp( line->m_w0 , line->m_w1 , inter_y[res_i] / line->m_length );
     ret->intersect = ray( t_simd[res_i] );
+    ret->error = Vector( 2.0f * radius );
 
     if( inter_y[res_i] == line->m_length ){
         // A corner case where the tip of the line is being intersected.
@@ -21,11 +21,11 @@
 #include "simd_wrapper.h"
 #include "math/ray.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_bbox." );
 #endif
 
-#if defined(SSE_ENABLED) || defined(AVX_ENABLED)
+#if defined(SIMD4_ENABLED) || defined(AVX_ENABLED) || defined(AVX512_ENABLED)
 #ifdef SIMD_BVH_IMPLEMENTATION
 
 #ifdef SIMD_SSE_IMPLEMENTATION
@@ -34,6 +34,9 @@
 #ifdef SIMD_AVX_IMPLEMENTATION
     #define Simd_Ray_Data   Ray8_Data
 #endif
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Ray_Data   Ray16_Data
+#endif
 
 SORT_STATIC_FORCEINLINE float sign( const float x ){
     return x < 0.0f ? -1.0f : 1.0f;
@@ -55,6 +58,9 @@ struct alignas(SIMD_ALIGNMENT) Simd_Ray_Data{
 	simd_data  scale_x;      /**< Scaling along each axis in local coordinate. */
 	simd_data  scale_y;      /**< Scaling along each axis in local coordinate. */
 	simd_data  scale_z;      /**< Scaling along each axis in local coordinate. */
+	simd_data  ori_local_x;  /**< Ori permuted to local coordinate, this is used in ray Triangle intersection. */
+	simd_data  ori_local_y;  /**< Ori permuted to local coordinate, this is used in ray Triangle intersection. */
+	simd_data  ori_local_z;  /**< Ori permuted to local coordinate, this is used in ray Triangle intersection. */
 };
 
 void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
@@ -80,6 +86,14 @@ void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
     simd_ray_data.scale_x = simd_set_ps1( ray.m_scale_x );
     simd_ray_data.scale_y = simd_set_ps1( ray.m_scale_y );
     simd_ray_data.scale_z = simd_set_ps1( ray.m_scale_z );
+
+    // the same axes picked in Ray::Prepare, they are not read from the ray in case it is not prepared.
+    const auto local_y = majorAxis( ray.m_Dir );
+    const auto local_z = ( local_y + 1 ) % 3;
+    const auto local_x = ( local_z + 1 ) % 3;
+    simd_ray_data.ori_local_x = simd_set_ps1( ray.m_Ori[local_x] );
+    simd_ray_data.ori_local_y = simd_set_ps1( ray.m_Ori[local_y] );
+    simd_ray_data.ori_local_z = simd_set_ps1( ray.m_Ori[local_z] );
 }
 
 SORT_STATIC_FORCEINLINE simd_data   ray_ori_dir_x( const Simd_Ray_Data& ray ){
@@ -127,6 +141,15 @@ SORT_STATIC_FORCEINLINE simd_data   ray_scale_y( const Simd_Ray_Data& ray ){
 SORT_STATIC_FORCEINLINE simd_data   ray_scale_z( const Simd_Ray_Data& ray ){
     return ray.scale_z;
 }
+SORT_STATIC_FORCEINLINE simd_data   ray_ori_local_x( const Simd_Ray_Data& ray ){
+    return ray.ori_local_x;
+}
+SORT_STATIC_FORCEINLINE simd_data   ray_ori_local_y( const Simd_Ray_Data& ray ){
+    return ray.ori_local_y;
+}
+SORT_STATIC_FORCEINLINE simd_data   ray_ori_local_z( const Simd_Ray_Data& ray ){
+    return ray.ori_local_z;
+}
 #endif
 
 #endif
\ No newline at end of file
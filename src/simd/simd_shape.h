@@ -0,0 +1,345 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/define.h"
+#include "math/ray.h"
+#include "shape/sphere.h"
+#include "shape/quad.h"
+#include "shape/disk.h"
+#include "core/primitive.h"
+
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
+    static_assert( false , "More than one SIMD version is defined before including simd_shape.h." );
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+
+#ifdef SIMD_SSE_IMPLEMENTATION
+    #define Simd_Sphere     Sphere4
+    #define Simd_Planar     Planar4
+    #define Simd_Transform  Transform4
+#endif
+
+#ifdef SIMD_AVX_IMPLEMENTATION
+    #define Simd_Sphere     Sphere8
+    #define Simd_Planar     Planar8
+    #define Simd_Transform  Transform8
+#endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Sphere     Sphere16
+    #define Simd_Planar     Planar16
+    #define Simd_Transform  Transform16
+#endif
+
+//! @brief  Transformations from world space to local spaces of shapes, there is no scaling in them.
+struct alignas(SIMD_ALIGNMENT) Simd_Transform{
+    simd_data  m_mat_00, m_mat_01, m_mat_02, m_mat_03;
+    simd_data  m_mat_10, m_mat_11, m_mat_12, m_mat_13;
+    simd_data  m_mat_20, m_mat_21, m_mat_22, m_mat_23;
+
+    //! @brief  Pack the transformations.
+    //!
+    //! @param  transforms  Transformations of all channels, nullptr for invalid channels.
+    void Pack( const Transform* const transforms[SIMD_CHANNEL] ){
+        float m[12][SIMD_CHANNEL];
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            for( auto j = 0 ; j < 12 ; ++j )
+                m[j][i] = transforms[i] ? transforms[i]->invMatrix.m[j] : 0.0f;
+        }
+        m_mat_00 = simd_set_ps( m[0] ); m_mat_01 = simd_set_ps( m[1] ); m_mat_02 = simd_set_ps( m[2] ); m_mat_03 = simd_set_ps( m[3] );
+        m_mat_10 = simd_set_ps( m[4] ); m_mat_11 = simd_set_ps( m[5] ); m_mat_12 = simd_set_ps( m[6] ); m_mat_13 = simd_set_ps( m[7] );
+        m_mat_20 = simd_set_ps( m[8] ); m_mat_21 = simd_set_ps( m[9] ); m_mat_22 = simd_set_ps( m[10] ); m_mat_23 = simd_set_ps( m[11] );
+    }
+
+    //! @brief  Transform the ray to the local spaces.
+    SORT_FORCEINLINE void TransformRay( const Simd_Ray_Data& ray_simd , simd_data& ori_x , simd_data& ori_y , simd_data& ori_z ,
+                                        simd_data& dir_x , simd_data& dir_y , simd_data& dir_z ) const {
+        ori_x = simd_add_ps( simd_mad_ps( m_mat_02, ray_ori_z(ray_simd), simd_mad_ps( m_mat_01, ray_ori_y(ray_simd), simd_mul_ps( m_mat_00, ray_ori_x(ray_simd)) ) ) , m_mat_03 );
+        ori_y = simd_add_ps( simd_mad_ps( m_mat_12, ray_ori_z(ray_simd), simd_mad_ps( m_mat_11, ray_ori_y(ray_simd), simd_mul_ps( m_mat_10, ray_ori_x(ray_simd)) ) ) , m_mat_13 );
+        ori_z = simd_add_ps( simd_mad_ps( m_mat_22, ray_ori_z(ray_simd), simd_mad_ps( m_mat_21, ray_ori_y(ray_simd), simd_mul_ps( m_mat_20, ray_ori_x(ray_simd)) ) ) , m_mat_23 );
+        dir_x = simd_mad_ps( m_mat_02, ray_dir_z(ray_simd), simd_mad_ps( m_mat_01, ray_dir_y(ray_simd), simd_mul_ps( m_mat_00, ray_dir_x(ray_simd) )));
+        dir_y = simd_mad_ps( m_mat_12, ray_dir_z(ray_simd), simd_mad_ps( m_mat_11, ray_dir_y(ray_simd), simd_mul_ps( m_mat_10, ray_dir_x(ray_simd) )));
+        dir_z = simd_mad_ps( m_mat_22, ray_dir_z(ray_simd), simd_mad_ps( m_mat_21, ray_dir_y(ray_simd), simd_mul_ps( m_mat_20, ray_dir_x(ray_simd) )));
+    }
+};
+
+//! @brief  Push a primitive in the first free channel.
+//!
+//! @param  primitives  Primitives of all channels.
+//! @param  primitive   The primitive to be pushed.
+//! @return             Whether all channels are taken.
+SORT_STATIC_FORCEINLINE bool pushPrimitive_SIMD( const Primitive* primitives[SIMD_CHANNEL] , const Primitive* primitive ){
+    auto i = 0;
+    while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(primitives[i]) )
+        ++i;
+    primitives[i] = primitive;
+    return i == SIMD_CHANNEL - 1;
+}
+
+//! @brief  Fill the intersection of the closest channel that is hit.
+//!
+//! The kernels only tell which channels are hit and how far they are, the closest one is then intersected again by
+//! itself to fill the intersection, which is exactly the same as a primitive that is not packed. In the rare case that
+//! it disagrees with the kernel due to rounding, the next closest one is tried.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  primitives  Primitives of all channels.
+//! @param  t_simd      Distance to the intersection of each channel.
+//! @param  cm          Mask of channels that are hit.
+//! @param  ret         The result of intersection.
+//! @return             Whether any channel is intersected.
+SORT_STATIC_FORCEINLINE bool resolveClosestHit_SIMD( const Ray& ray , const Primitive* const primitives[SIMD_CHANNEL] , const simd_data& t_simd , int cm , SurfaceInteraction* ret ){
+    while( cm ){
+        auto res_i = __bsf( cm );
+        for( auto bits = cm & ( cm - 1 ) ; bits ; bits &= bits - 1 ){
+            const auto i = __bsf( bits );
+            if( t_simd[i] < t_simd[res_i] )
+                res_i = i;
+        }
+        if( primitives[res_i]->GetIntersect( ray , ret ) )
+            return true;
+        cm &= ~( 1 << res_i );
+    }
+    return false;
+}
+
+//! @brief  Like Line8, Sphere8 packs eight spheres so that a ray is tested against all of them at once.
+struct alignas(SIMD_ALIGNMENT) Simd_Sphere{
+    Simd_Transform      m_world2Local;                          /**< Transformation from world space to local space of spheres. */
+    simd_data           m_radius_sq;                            /**< Squared radius of spheres. */
+    simd_data           m_mask;                                 /**< Mask marks which sphere is valid. */
+
+    const Primitive*    m_ori_pri[SIMD_CHANNEL] = { nullptr };  /**< Pointers to original primitive. */
+
+    //! @brief  Push a sphere in the data structure.
+    //!
+    //! @param  primitive   The original primitive.
+    //! @return             Whether the data structure is full.
+    bool PushSphere( const Primitive* primitive ){
+        return pushPrimitive_SIMD( m_ori_pri , primitive );
+    }
+
+    //! @brief  Pack sphere information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid sphere inside.
+    bool PackData(){
+        if( !m_ori_pri[0] )
+            return false;
+
+        bool                mask[SIMD_CHANNEL] = { false };
+        float               radius_sq[SIMD_CHANNEL] = { 0.0f };
+        const Transform*    transforms[SIMD_CHANNEL] = { nullptr };
+        for( auto i = 0 ; i < SIMD_CHANNEL && IS_PTR_VALID(m_ori_pri[i]) ; ++i ){
+            const auto sphere = static_cast<const Sphere*>( m_ori_pri[i]->GetShape() );
+            radius_sq[i] = sphere->radius * sphere->radius;
+            transforms[i] = &sphere->m_transform;
+            mask[i] = true;
+        }
+
+        m_world2Local.Pack( transforms );
+        m_radius_sq = simd_set_ps( radius_sq );
+        m_mask = simd_set_mask( mask );
+        return true;
+    }
+
+    //! @brief  Reset the data for reuse
+    void Reset(){
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+            m_ori_pri[i] = nullptr;
+    }
+};
+
+static_assert( sizeof( Simd_Sphere ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Sphere." );
+
+//! @brief  Quads and disks lie on the plane of y = 0 in their local spaces, they are packed together.
+struct alignas(SIMD_ALIGNMENT) Simd_Planar{
+    Simd_Transform      m_world2Local;                          /**< Transformation from world space to local space of shapes. */
+    simd_data           m_half_x;                               /**< Half size of quads along x axis. */
+    simd_data           m_half_z;                               /**< Half size of quads along z axis. */
+    simd_data           m_radius_sq;                            /**< Squared radius of disks. */
+    simd_data           m_disk;                                 /**< Mask marks which shape is a disk. */
+    simd_data           m_mask;                                 /**< Mask marks which shape is valid. */
+
+    const Primitive*    m_ori_pri[SIMD_CHANNEL] = { nullptr };  /**< Pointers to original primitive. */
+
+    //! @brief  Push a quad or a disk in the data structure.
+    //!
+    //! @param  primitive   The original primitive.
+    //! @return             Whether the data structure is full.
+    bool PushPlanar( const Primitive* primitive ){
+        return pushPrimitive_SIMD( m_ori_pri , primitive );
+    }
+
+    //! @brief  Pack shape information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid shape inside.
+    bool PackData(){
+        if( !m_ori_pri[0] )
+            return false;
+
+        bool                mask[SIMD_CHANNEL] = { false } , disk[SIMD_CHANNEL] = { false };
+        float               half_x[SIMD_CHANNEL] = { 0.0f } , half_z[SIMD_CHANNEL] = { 0.0f } , radius_sq[SIMD_CHANNEL] = { 0.0f };
+        const Transform*    transforms[SIMD_CHANNEL] = { nullptr };
+        for( auto i = 0 ; i < SIMD_CHANNEL && IS_PTR_VALID(m_ori_pri[i]) ; ++i ){
+            if( SHAPE_DISK == m_ori_pri[i]->GetShapeType() ){
+                const auto d = static_cast<const Disk*>( m_ori_pri[i]->GetShape() );
+                radius_sq[i] = d->radius * d->radius;
+                transforms[i] = &d->m_transform;
+                disk[i] = true;
+            }else{
+                const auto quad = static_cast<const Quad*>( m_ori_pri[i]->GetShape() );
+                half_x[i] = quad->sizeX * 0.5f;
+                half_z[i] = quad->sizeY * 0.5f;
+                transforms[i] = &quad->m_transform;
+            }
+            mask[i] = true;
+        }
+
+        m_world2Local.Pack( transforms );
+        m_half_x = simd_set_ps( half_x );
+        m_half_z = simd_set_ps( half_z );
+        m_radius_sq = simd_set_ps( radius_sq );
+        m_disk = simd_set_mask( disk );
+        m_mask = simd_set_mask( mask );
+        return true;
+    }
+
+    //! @brief  Reset the data for reuse
+    void Reset(){
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+            m_ori_pri[i] = nullptr;
+    }
+};
+
+static_assert( sizeof( Simd_Planar ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Planar." );
+
+//! @brief  Core algorithm of ray sphere intersection, it matches 'Sphere::GetIntersect'.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  sphere_simd The data structure holds the spheres.
+//! @param  limit       Intersections farther than it are ignored.
+//! @param  t_simd      Distance from the ray origin to the intersection of each sphere.
+//! @return             Mask of spheres that are intersected.
+SORT_FORCEINLINE int intersectSphere_Inner( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Sphere& sphere_simd , const float limit , simd_data& t_simd ){
+    simd_data ori_x , ori_y , ori_z , dir_x , dir_y , dir_z;
+    sphere_simd.m_world2Local.TransformRay( ray_simd , ori_x , ori_y , ori_z , dir_x , dir_y , dir_z );
+
+    // there is no scaling in the transformation, the direction is still normalized.
+    const simd_data b = simd_mad_ps( dir_z , ori_z , simd_mad_ps( dir_y , ori_y , simd_mul_ps( dir_x , ori_x ) ) );
+    const simd_data c = simd_sub_ps( simd_mad_ps( ori_z , ori_z , simd_mad_ps( ori_y , ori_y , simd_mul_ps( ori_x , ori_x ) ) ) , sphere_simd.m_radius_sq );
+    const simd_data discriminant = simd_sub_ps( simd_sqr_ps( b ) , c );
+    const simd_data zeros = simd_zero();
+    simd_data mask = simd_and_ps( sphere_simd.m_mask , simd_cmpge_ps( discriminant , zeros ) );
+    if( 0 == simd_movemask_ps( mask ) )
+        return 0;
+
+    const simd_data sqrt_dist = simd_sqrt_ps( discriminant );
+    const simd_data t0 = simd_sub_ps( simd_sub_ps( zeros , b ) , sqrt_dist );
+    const simd_data t1 = simd_sub_ps( sqrt_dist , b );
+    t_simd = simd_pick_ps( simd_cmpgt_ps( t0 , zeros ) , t0 , t1 );
+
+    mask = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t_simd , zeros ) , simd_cmple_ps( t_simd , simd_set_ps1( limit ) ) ) );
+    mask = simd_and_ps( mask , simd_and_ps( simd_cmpge_ps( t_simd , simd_set_ps1( ray.m_fMin ) ) , simd_cmple_ps( t_simd , simd_set_ps1( ray.m_fMax ) ) ) );
+    return simd_movemask_ps( mask );
+}
+
+//! @brief  Core algorithm of ray quad and ray disk intersection, it matches 'Quad::GetIntersect' and 'Disk::GetIntersect'.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd The data structure holds the quads and disks.
+//! @param  limit       Intersections farther than it are ignored.
+//! @param  t_simd      Distance from the ray origin to the intersection of each shape.
+//! @return             Mask of shapes that are intersected.
+SORT_FORCEINLINE int intersectPlanar_Inner( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Planar& planar_simd , const float limit , simd_data& t_simd ){
+    simd_data ori_x , ori_y , ori_z , dir_x , dir_y , dir_z;
+    planar_simd.m_world2Local.TransformRay( ray_simd , ori_x , ori_y , ori_z , dir_x , dir_y , dir_z );
+
+    const simd_data zeros = simd_zero();
+    simd_data mask = simd_and_ps( planar_simd.m_mask , simd_cmpneq_ps( dir_y , zeros ) );
+    t_simd = simd_div_ps( simd_sub_ps( zeros , ori_y ) , dir_y );
+    mask = simd_and_ps( mask , simd_cmple_ps( t_simd , simd_set_ps1( limit ) ) );
+    mask = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t_simd , simd_set_ps1( ray.m_fMin ) ) , simd_cmple_ps( t_simd , simd_set_ps1( ray.m_fMax ) ) ) );
+    if( 0 == simd_movemask_ps( mask ) )
+        return 0;
+
+    const simd_data x = simd_mad_ps( t_simd , dir_x , ori_x );
+    const simd_data z = simd_mad_ps( t_simd , dir_z , ori_z );
+    const simd_data in_disk = simd_cmple_ps( simd_add_ps( simd_sqr_ps( x ) , simd_sqr_ps( z ) ) , planar_simd.m_radius_sq );
+    const simd_data in_quad = simd_and_ps( simd_and_ps( simd_cmple_ps( x , planar_simd.m_half_x ) , simd_cmpge_ps( x , simd_sub_ps( zeros , planar_simd.m_half_x ) ) ) ,
+                                           simd_and_ps( simd_cmple_ps( z , planar_simd.m_half_z ) , simd_cmpge_ps( z , simd_sub_ps( zeros , planar_simd.m_half_z ) ) ) );
+    mask = simd_and_ps( mask , simd_pick_ps( planar_simd.m_disk , in_disk , in_quad ) );
+    return simd_movemask_ps( mask );
+}
+
+//! @brief  Intersect a ray with all spheres in the data structure at once.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  sphere_simd Data structure holds the spheres.
+//! @param  ret         The result of intersection.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectSphere_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Sphere& sphere_simd , SurfaceInteraction* ret ){
+    sAssert(IS_PTR_VALID(ret), SPATIAL_ACCELERATOR );
+
+    simd_data t_simd;
+    const auto cm = intersectSphere_Inner( ray , ray_simd , sphere_simd , ret->t , t_simd );
+    return cm && resolveClosestHit_SIMD( ray , sphere_simd.m_ori_pri , t_simd , cm , ret );
+}
+
+//! @brief  Whether a ray is blocked by any sphere in the data structure.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  sphere_simd Data structure holds the spheres.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectSphereFast_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Sphere& sphere_simd ){
+    simd_data t_simd;
+    return 0 != intersectSphere_Inner( ray , ray_simd , sphere_simd , FLT_MAX , t_simd );
+}
+
+//! @brief  Intersect a ray with all quads and disks in the data structure at once.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd Data structure holds the quads and disks.
+//! @param  ret         The result of intersection.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectPlanar_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Planar& planar_simd , SurfaceInteraction* ret ){
+    sAssert(IS_PTR_VALID(ret), SPATIAL_ACCELERATOR );
+
+    simd_data t_simd;
+    const auto cm = intersectPlanar_Inner( ray , ray_simd , planar_simd , ret->t , t_simd );
+    return cm && resolveClosestHit_SIMD( ray , planar_simd.m_ori_pri , t_simd , cm , ret );
+}
+
+//! @brief  Whether a ray is blocked by any quad or disk in the data structure.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd Data structure holds the quads and disks.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectPlanarFast_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd , const Simd_Planar& planar_simd ){
+    simd_data t_simd;
+    return 0 != intersectPlanar_Inner( ray , ray_simd , planar_simd , FLT_MAX , t_simd );
+}
+
+#endif // SIMD_BVH_IMPLEMENTATION
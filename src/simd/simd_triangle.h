@@ -30,7 +30,7 @@
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_TRI_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_triangle.h." );
 #endif
 
@@ -44,6 +44,10 @@
     #define Simd_Triangle       Triangle8
 #endif
 
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Triangle       Triangle16
+#endif
+
 //! @brief  Simd_Triangle is more of a simplified resolved data structure holds only bare bone information of triangle.
 /**
  * Simd_Triangle is used in OBVH/QBVH to accelerate ray triangle intersection using AVX/SSE. Its sole purpose is to accelerate 
@@ -53,9 +57,11 @@
  * incur more cost in term of memory usage.
  */
 struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
-    simd_data  m_p0_x , m_p0_y , m_p0_z ;  /**< Position of point 0 of the triangle. */
-    simd_data  m_p1_x , m_p1_y , m_p1_z ;  /**< Position of point 1 of the triangle. */
-    simd_data  m_p2_x , m_p2_y , m_p2_z ;  /**< Position of point 2 of the triangle. */
+    // Vertices are indexed by axis so that the kernel loads them in the local coordinate of the ray directly, instead of
+    // permuting registers, which would force the compiler to spill them to the stack.
+    simd_data  m_p0[3];                     /**< Position of point 0 of the triangle. */
+    simd_data  m_p1[3];                     /**< Position of point 1 of the triangle. */
+    simd_data  m_p2[3];                     /**< Position of point 2 of the triangle. */
     simd_data  m_mask;
 
     /**< Pointers to original primitives. */
@@ -126,6 +132,16 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_ori_tri[7] = triangle;
         return true;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        const Triangle* triangle = dynamic_cast<const Triangle*>(primitive->GetShape());
+        auto i = 0;
+        while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(m_ori_pri[i]) )
+            ++i;
+        m_ori_pri[i] = primitive;
+        m_ori_tri[i] = triangle;
+        return i == SIMD_CHANNEL - 1;
+#endif
     }
 
     //! @brief  Pack triangle information into SSE/AVX compatible data.
@@ -169,15 +185,15 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
             mask[i] = true;
         }
 
-        m_p0_x = simd_set_ps( p0_x );
-        m_p0_y = simd_set_ps( p0_y );
-        m_p0_z = simd_set_ps( p0_z );
-        m_p1_x = simd_set_ps( p1_x );
-        m_p1_y = simd_set_ps( p1_y );
-        m_p1_z = simd_set_ps( p1_z );
-        m_p2_x = simd_set_ps( p2_x );
-        m_p2_y = simd_set_ps( p2_y );
-        m_p2_z = simd_set_ps( p2_z );
+        m_p0[0] = simd_set_ps( p0_x );
+        m_p0[1] = simd_set_ps( p0_y );
+        m_p0[2] = simd_set_ps( p0_z );
+        m_p1[0] = simd_set_ps( p1_x );
+        m_p1[1] = simd_set_ps( p1_y );
+        m_p1[2] = simd_set_ps( p1_z );
+        m_p2[0] = simd_set_ps( p2_x );
+        m_p2[1] = simd_set_ps( p2_y );
+        m_p2[2] = simd_set_ps( p2_z );
         m_mask = simd_set_mask( mask );
 
         return true;
@@ -194,10 +210,17 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_ori_pri[0] = m_ori_pri[1] = m_ori_pri[2] = m_ori_pri[3] = m_ori_pri[4] = m_ori_pri[5] = m_ori_pri[6] = m_ori_pri[7] = nullptr;
         m_ori_tri[0] = m_ori_tri[1] = m_ori_tri[2] = m_ori_tri[3] = m_ori_tri[4] = m_ori_tri[5] = m_ori_tri[6] = m_ori_tri[7] = nullptr;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            m_ori_pri[i] = nullptr;
+            m_ori_tri[i] = nullptr;
+        }
+#endif
     }
 };
 
-static_assert( sizeof( Simd_Triangle ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Triangle8." );
+static_assert( sizeof( Simd_Triangle ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Triangle." );
 
 //! @brief  Core algorithm of ray triangle intersection.
 //!
@@ -212,33 +235,23 @@ template< bool quick_quit >
 SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd, const Simd_Triangle& tri_simd, simd_data& t_simd, simd_data& u_simd, simd_data& v_simd, simd_data& mask) {
     mask = tri_simd.m_mask;
 
-    // step 0 : translate the vertices to ray coordinate system
-    simd_data p0[3], p1[3], p2[3];
-    p0[0] = simd_sub_ps(tri_simd.m_p0_x, ray_ori_x(ray_simd));
-    p0[1] = simd_sub_ps(tri_simd.m_p0_y, ray_ori_y(ray_simd));
-    p0[2] = simd_sub_ps(tri_simd.m_p0_z, ray_ori_z(ray_simd));
+    // step 0 & 1 : translate the vertices to ray coordinate system, picking the major axis to avoid dividing by zero in
+    //              the sheering pass. by picking the major axis, we can also make sure we sheer as little as possible.
+    //              vertices are translated before being sheered, shared edges of adjacent triangles go through exactly
+    //              the same operations, this is what keeps the algorithm watertight. Precomputing edges or planes of
+    //              triangles would break it.
+    const auto lx = ray.m_local_x, ly = ray.m_local_y, lz = ray.m_local_z;
+    simd_data p0_x = simd_sub_ps(tri_simd.m_p0[lx], ray_ori_local_x(ray_simd));
+    simd_data p0_y = simd_sub_ps(tri_simd.m_p0[ly], ray_ori_local_y(ray_simd));
+    simd_data p0_z = simd_sub_ps(tri_simd.m_p0[lz], ray_ori_local_z(ray_simd));
 
-    p1[0] = simd_sub_ps(tri_simd.m_p1_x, ray_ori_x(ray_simd));
-    p1[1] = simd_sub_ps(tri_simd.m_p1_y, ray_ori_y(ray_simd));
-    p1[2] = simd_sub_ps(tri_simd.m_p1_z, ray_ori_z(ray_simd));
+    simd_data p1_x = simd_sub_ps(tri_simd.m_p1[lx], ray_ori_local_x(ray_simd));
+    simd_data p1_y = simd_sub_ps(tri_simd.m_p1[ly], ray_ori_local_y(ray_simd));
+    simd_data p1_z = simd_sub_ps(tri_simd.m_p1[lz], ray_ori_local_z(ray_simd));
 
-    p2[0] = simd_sub_ps(tri_simd.m_p2_x, ray_ori_x(ray_simd));
-    p2[1] = simd_sub_ps(tri_simd.m_p2_y, ray_ori_y(ray_simd));
-    p2[2] = simd_sub_ps(tri_simd.m_p2_z, ray_ori_z(ray_simd));
-
-    // step 1 : pick the major axis to avoid dividing by zero in the sheering pass.
-    //          by picking the major axis, we can also make sure we sheer as little as possible
-    simd_data& p0_x = p0[ray.m_local_x];
-    simd_data& p0_y = p0[ray.m_local_y];
-    simd_data& p0_z = p0[ray.m_local_z];
-
-    simd_data& p1_x = p1[ray.m_local_x];
-    simd_data& p1_y = p1[ray.m_local_y];
-    simd_data& p1_z = p1[ray.m_local_z];
-
-    simd_data& p2_x = p2[ray.m_local_x];
-    simd_data& p2_y = p2[ray.m_local_y];
-    simd_data& p2_z = p2[ray.m_local_z];
+    simd_data p2_x = simd_sub_ps(tri_simd.m_p2[lx], ray_ori_local_x(ray_simd));
+    simd_data p2_y = simd_sub_ps(tri_simd.m_p2[ly], ray_ori_local_y(ray_simd));
+    simd_data p2_z = simd_sub_ps(tri_simd.m_p2[lz], ray_ori_local_z(ray_simd));
 
     // step 2 : sheer the vertices so that the ray direction points to ( 0 , 1 , 0 )
     p0_x = simd_mad_ps(p0_y, ray_scale_x(ray_simd), p0_x);
@@ -253,18 +266,14 @@ SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray
     const simd_data e1 = simd_sub_ps(simd_mul_ps(p2_x, p0_z), simd_mul_ps(p2_z, p0_x));
     const simd_data e2 = simd_sub_ps(simd_mul_ps(p0_x, p1_z), simd_mul_ps(p0_z, p1_x));
 
+    // degenerated triangles are rejected along with the edge tests, so that there is only one early out before dividing.
     const simd_data zeros = simd_zero();
+    const simd_data det = simd_add_ps(e0, simd_add_ps(e1, e2));
     const simd_data c0 = simd_and_ps(simd_and_ps(simd_cmpge_ps(e0, zeros), simd_cmpge_ps(e1, zeros)), simd_cmpge_ps(e2, zeros));
     const simd_data c1 = simd_and_ps(simd_and_ps(simd_cmple_ps(e0, zeros), simd_cmple_ps(e1, zeros)), simd_cmple_ps(e2, zeros));
-    mask = simd_or_ps( simd_and_ps(mask,c0) , simd_and_ps(mask,c1) );
-    
-    auto c = simd_movemask_ps(mask);
-    if (0 == c)
-        return false;
+    mask = simd_and_ps( simd_and_ps( mask , simd_or_ps(c0, c1) ) , simd_cmpneq_ps(det, zeros) );
 
-    const simd_data det = simd_add_ps(e0, simd_add_ps(e1, e2));
-    mask = simd_and_ps(mask, simd_cmpneq_ps(det, zeros));
-    c = simd_movemask_ps(mask);
+    auto c = simd_movemask_ps(mask);
     if (0 == c)
         return false;
 
@@ -324,18 +333,20 @@ SORT_FORCEINLINE void setupIntersection(const Simd_Triangle& tri_simd, const Ray
     const auto& mv2 = mem->m_vertices[id2];
 
     const auto res_t = t_simd[id];
-    intersection->intersect = ray(res_t);
+    setupIntersectionPoint(u, v, mv0, mv1, mv2, intersection);
     intersection->t = res_t;
 
     intersection->gnormal = normalize(cross((mv2.m_position - mv0.m_position), (mv1.m_position - mv0.m_position)));
-    intersection->normal = (w * mv0.m_normal + u * mv1.m_normal + v * mv2.m_normal).Normalize();
-    intersection->tangent = (w * mv0.m_tangent + u * mv1.m_tangent + v * mv2.m_tangent).Normalize();
+    intersection->normal = (w * mv0.GetNormal() + u * mv1.GetNormal() + v * mv2.GetNormal()).Normalize();
+    intersection->tangent = (w * mv0.GetTangent() + u * mv1.GetTangent() + v * mv2.GetTangent()).Normalize();
     intersection->view = -ray.m_Dir;
 
     const auto uv = w * mv0.m_texCoord + u * mv1.m_texCoord + v * mv2.m_texCoord;
     intersection->u = uv.x;
     intersection->v = uv.y;
 
+    setupRayFootprint(ray, res_t, mv0, mv1, mv2, intersection);
+
     intersection->primitive = tri_simd.m_ori_pri[id];
 }
 
@@ -355,7 +366,9 @@ SORT_FORCEINLINE bool intersectTriangle_SIMD( const Ray& ray , const Simd_Ray_Da
     if (!intersected)
         return false;
 
-	mask = simd_and_ps(mask, simd_cmplt_ps(t_simd, simd_set_ps1(ret->t)));
+	// Same with the scalar version, an intersection at exactly the current distance is accepted, instanced primitives
+	// could be tested again with the distance found by themselves in spatial structures like KD-Tree.
+	mask = simd_and_ps(mask, simd_cmple_ps(t_simd, simd_set_ps1(ret->t)));
 	const auto c = simd_movemask_ps(mask);
 	if (0 == c)
 		return false;
@@ -388,17 +401,26 @@ SORT_FORCEINLINE bool intersectTriangle_SIMD( const Ray& ray , const Simd_Ray_Da
 //! @param  ray         Ray to be tested against.
 //! @param  simd_ray    Resolved simd ray data.
 //! @param  tri_simd    Data structure holds four/eight triangles.
+//! @param  occluder    One of the triangles blocking the ray, it is untouched if nullptr is passed in or nothing is hit.
 //! @return             Whether there is any intersection that is valid.
-SORT_FORCEINLINE bool intersectTriangleFast_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd , const Simd_Triangle& tri_simd) {
+SORT_FORCEINLINE bool intersectTriangleFast_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd , const Simd_Triangle& tri_simd, const Primitive** occluder = nullptr) {
 #ifndef SIMD_TRI_REFERENCE_IMPLEMENTATION
     // please optimize these value, compiler.
     simd_data   dummy_u, dummy_v, dummy_t, mask;
-    return intersectTriangleInner_SIMD<true>(ray, ray_simd, tri_simd, dummy_t, dummy_u, dummy_v, mask);
+    if( !intersectTriangleInner_SIMD<true>(ray, ray_simd, tri_simd, dummy_t, dummy_u, dummy_v, mask) )
+        return false;
+    if( occluder )
+        *occluder = tri_simd.m_ori_pri[__bsf(simd_movemask_ps(mask))];
+    return true;
 #else
-    bool ret = false;
-    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(tri_simd.m_ori_pri[i]) && !ret ; ++i )
-        ret |= tri_simd.m_ori_pri[i]->GetIntersect( ray , nullptr );
-    return ret;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(tri_simd.m_ori_pri[i]) ; ++i ){
+        if( tri_simd.m_ori_pri[i]->GetIntersect( ray , nullptr ) ){
+            if( occluder )
+                *occluder = tri_simd.m_ori_pri[i];
+            return true;
+        }
+    }
+    return false;
 #endif
 }
 
@@ -432,6 +454,17 @@ SORT_FORCEINLINE void intersectTriangleMulti_SIMD(const Ray& ray, const Simd_Ray
         if (matID != primitive->GetMaterial()->GetUniqueID())
             continue;
 
+        // spatial splits could reference the same triangle in multiple leaves
+        auto checked = false;
+        for (auto j = 0u; j < intersections.cnt; ++j) {
+            if (primitive == intersections.intersections[j]->intersection.primitive) {
+                checked = true;
+                break;
+            }
+        }
+        if (checked)
+            continue;
+
         if (intersections.cnt < TOTAL_SSS_INTERSECTION_CNT) {
             intersections.intersections[intersections.cnt] = SORT_MALLOC(BSSRDFIntersection)();
             setupIntersection(tri_simd, ray, t_simd, u_simd, v_simd, res_i, &intersections.intersections[intersections.cnt++]->intersection);
@@ -457,6 +490,17 @@ SORT_FORCEINLINE void intersectTriangleMulti_SIMD(const Ray& ray, const Simd_Ray
         if (matID != primitive->GetMaterial()->GetUniqueID())
             continue;
 
+        // spatial splits could reference the same triangle in multiple leaves
+        auto checked = false;
+        for (auto j = 0u; j < intersections.cnt; ++j) {
+            if (primitive == intersections.intersections[j]->intersection.primitive) {
+                checked = true;
+                break;
+            }
+        }
+        if (checked)
+            continue;
+
         intersection.Reset();
         const auto intersected = primitive->GetIntersect(ray, &intersection);
         if (intersected) {
@@ -22,9 +22,10 @@
 //  - Nan != Nan     ( SIMD, 0xffffffff )     ( Non-SIMD, false )
 
 #include <float.h>
+#include <string.h>
 #include "core/define.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including the wrapper." );
 #endif
 
@@ -104,6 +105,11 @@ SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
     return _mm_set_ps(MASK_TO_INT(mask[3]), MASK_TO_INT(mask[2]), MASK_TO_INT(mask[1]), MASK_TO_INT(mask[0]));
 #undef MASK_TO_INT
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_cvtu8_ps( const unsigned char d[] ){
+    int packed;
+    memcpy( &packed , d , sizeof( packed ) );
+    return _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( packed ) ) );
+}
 SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
     return _mm_add_ps( get_sse_data(s0) , get_sse_data(s1) );
 }
@@ -172,6 +178,128 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
 #endif // SIMD_SSE_IMPLEMENTATION
 #endif // SSE_ENABLED
 
+// NEON takes the place of SSE on ARM64, it provides the same four lanes so that QBVH doesn't need to know about it.
+// Only GCC and Clang are supported, whose vector types could be indexed like arrays.
+#ifdef NEON_ENABLED
+#include <arm_neon.h>
+
+#define simd_data_sse   float32x4_t
+
+#ifdef  SIMD_SSE_IMPLEMENTATION
+
+static const float32x4_t neon_zeros       = vdupq_n_f32( 0.0f );
+static const float32x4_t neon_infinites   = vdupq_n_f32( FLT_MAX );
+static const float32x4_t neon_neg_ones    = vdupq_n_f32( -1.0f );
+static const float32x4_t neon_ones        = vdupq_n_f32( 1.0f );
+
+#define simd_data       simd_data_sse
+#define simd_ones       neon_ones
+#define simd_zeros      neon_zeros
+#define simd_neg_ones   neon_neg_ones
+#define simd_infinites  neon_infinites
+
+#define SIMD_CHANNEL    4
+#define SIMD_ALIGNMENT  16
+
+// comparisons produce masks of integers, they are kept as floats like the masks of SSE.
+#define NEON_MASK(m)    vreinterpretq_f32_u32(m)
+#define NEON_BITS(d)    vreinterpretq_u32_f32(d)
+
+SORT_STATIC_FORCEINLINE simd_data   simd_zero(){
+    return vdupq_n_f32( 0.0f );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float d ){
+    return vdupq_n_f32( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
+    return vld1q_f32( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
+    const uint32_t bits[4] = { mask[0] ? mask_true_i : 0u , mask[1] ? mask_true_i : 0u , mask[2] ? mask_true_i : 0u , mask[3] ? mask_true_i : 0u };
+    return NEON_MASK( vld1q_u32( bits ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cvtu8_ps( const unsigned char d[] ){
+    unsigned packed;
+    memcpy( &packed , d , sizeof( packed ) );
+    const auto u16 = vmovl_u8( vreinterpret_u8_u32( vdup_n_u32( packed ) ) );
+    return vcvtq_f32_u32( vmovl_u16( vget_low_u16( u16 ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vaddq_f32( s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sub_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vsubq_f32( s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mul_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vmulq_f32( s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_div_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vdivq_f32( s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqr_ps( const simd_data& m ){
+    return vmulq_f32( m , m );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqrt_ps( const simd_data& m ){
+    return vsqrtq_f32( m );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_rcp_ps( const simd_data& m ){
+    return vdivq_f32( neon_ones , m );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mad_ps( const simd_data& a , const simd_data& b , const simd_data& c ){
+    // not fused, so that the results match SSE.
+    return vaddq_f32( vmulq_f32( a , b ) , c );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_pick_ps( const simd_data& mask , const simd_data& a , const simd_data& b ){
+    return vbslq_f32( NEON_BITS( mask ) , a , b );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpeq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vceqq_f32( s0 , s1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpneq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vmvnq_u32( vceqq_f32( s0 , s1 ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmple_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vcleq_f32( s0 , s1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmplt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vcltq_f32( s0 , s1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpge_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vcgeq_f32( s0 , s1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpgt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vcgtq_f32( s0 , s1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_and_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vandq_u32( NEON_BITS( s0 ) , NEON_BITS( s1 ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_or_ps( const simd_data& s0 , const simd_data& s1 ){
+    return NEON_MASK( vorrq_u32( NEON_BITS( s0 ) , NEON_BITS( s1 ) ) );
+}
+SORT_STATIC_FORCEINLINE int         simd_movemask_ps( const simd_data& mask ){
+    static const int32_t shifts[4] = { 0 , 1 , 2 , 3 };
+    const auto signs = vshrq_n_u32( NEON_BITS( mask ) , 31 );
+    return (int)vaddvq_u32( vshlq_u32( signs , vld1q_s32( shifts ) ) );
+}
+// vminq_f32 and vmaxq_f32 return Nan if any input is Nan, SSE returns the second input instead, which the
+// ray-box intersection relies on.
+SORT_STATIC_FORCEINLINE simd_data   simd_min_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vbslq_f32( vcltq_f32( s0 , s1 ) , s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_max_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vbslq_f32( vcgtq_f32( s0 , s1 ) , s0 , s1 );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
+    const auto t_min = simd_min_ps( s , vrev64q_f32( s ) );
+    return simd_min_ps( t_min , vextq_f32( t_min , t_min , 2 ) );
+}
+
+#undef NEON_MASK
+#undef NEON_BITS
+
+#endif // SIMD_SSE_IMPLEMENTATION
+#endif // NEON_ENABLED
+
 #ifdef  AVX_ENABLED
 
 #include <immintrin.h>
@@ -238,6 +366,13 @@ SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
     return _mm256_set_ps( MASK_TO_INT( mask[7] ) , MASK_TO_INT( mask[6] ) , MASK_TO_INT( mask[5] ) , MASK_TO_INT( mask[4] ) , MASK_TO_INT( mask[3] ) , MASK_TO_INT( mask[2] ) , MASK_TO_INT( mask[1] ) , MASK_TO_INT( mask[0] ) );
 #undef MASK_TO_INT
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_cvtu8_ps( const unsigned char d[] ){
+    // there is no 256 bits integer conversion in AVX, the two halves are converted separately
+    const auto packed = _mm_loadl_epi64( (const __m128i*)d );
+    const auto lo = _mm_cvtepu8_epi32( packed );
+    const auto hi = _mm_cvtepu8_epi32( _mm_srli_si128( packed , 4 ) );
+    return _mm256_cvtepi32_ps( _mm256_insertf128_si256( _mm256_castsi128_si256( lo ) , hi , 1 ) );
+}
 SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
     return _mm256_add_ps( get_avx_data(s0) , get_avx_data(s1) );
 }
@@ -315,6 +450,155 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
 
 #endif
 
+#ifdef  AVX512_ENABLED
+
+#include <immintrin.h>
+
+#ifndef SORT_IN_WINDOWS
+#define simd_data_avx512   __m512
+#else
+struct simd_data_avx512 {
+    union {
+        __m512  avx512_data;
+        float   float_data[16];
+    };
+
+    SORT_FORCEINLINE simd_data_avx512() {}
+    SORT_FORCEINLINE simd_data_avx512(const __m512& data) :avx512_data(data) {}
+
+    SORT_FORCEINLINE float  operator [](const int i) const {
+        return float_data[i];
+    }
+    SORT_FORCEINLINE float& operator [](const int i) {
+        return float_data[i];
+    }
+};
+#endif
+
+SORT_STATIC_FORCEINLINE __m512 get_avx512_data( const simd_data_avx512& d ){
+#ifdef SORT_IN_WINDOWS
+    return d.avx512_data;
+#else
+    return d;
+#endif
+}
+
+// zero tolerance in any extra size in this structure.
+static_assert(sizeof(simd_data_avx512) == sizeof(__m512), "Incorrect AVX512 data size.");
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+
+static const __m512 avx512_zeros        = _mm512_set1_ps( 0.0f );
+static const __m512 avx512_infinites    = _mm512_set1_ps( FLT_MAX );
+static const __m512 avx512_neg_ones     = _mm512_set1_ps( -1.0f );
+static const __m512 avx512_ones         = _mm512_set1_ps( 1.0f );
+
+#define simd_data       simd_data_avx512
+#define simd_ones       avx512_ones
+#define simd_zeros      avx512_zeros
+#define simd_neg_ones   avx512_neg_ones
+#define simd_infinites  avx512_infinites
+
+#define SIMD_CHANNEL    16
+#define SIMD_ALIGNMENT  64
+
+// Comparisons in AVX512 result in mask registers instead of vectors. To keep the same interface with SSE and AVX, lanes
+// of masks are still expanded to all ones or zeros in vectors, they are converted back to mask registers wherever
+// a mask is consumed, which is a single instruction with AVX512DQ.
+SORT_STATIC_FORCEINLINE __mmask16   simd_to_kmask( const simd_data& mask ){
+    return _mm512_movepi32_mask( _mm512_castps_si512( get_avx512_data(mask) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_from_kmask( const __mmask16 mask ){
+    return _mm512_castsi512_ps( _mm512_movm_epi32( mask ) );
+}
+
+SORT_STATIC_FORCEINLINE simd_data   simd_zero(){
+    return _mm512_setzero_ps();
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float f ){
+    return _mm512_set1_ps( f );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
+    return _mm512_loadu_ps( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
+    __mmask16 k = 0;
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        k |= mask[i] ? ( 1 << i ) : 0;
+    return simd_from_kmask( k );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cvtu8_ps( const unsigned char d[] ){
+    return _mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( _mm_loadu_si128( (const __m128i*)d ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_add_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sub_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_sub_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mul_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_mul_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_div_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_div_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqr_ps( const simd_data& m ){
+    return _mm512_mul_ps( get_avx512_data(m) , get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqrt_ps( const simd_data& m ){
+    return _mm512_sqrt_ps( get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_rcp_ps( const simd_data& m ){
+    return _mm512_div_ps( avx512_ones , get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mad_ps( const simd_data& a , const simd_data& b , const simd_data& c ){
+    // not fused, the results have to be the same with the other versions.
+    return _mm512_add_ps( _mm512_mul_ps( get_avx512_data(a) , get_avx512_data(b) ) , get_avx512_data(c) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_pick_ps( const simd_data& mask , const simd_data& a , const simd_data& b ){
+    return _mm512_mask_blend_ps( simd_to_kmask(mask) , get_avx512_data(b) , get_avx512_data(a) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpeq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_EQ_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpneq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_NEQ_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmple_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_LE_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmplt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_LT_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpge_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_GE_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpgt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return simd_from_kmask( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_GT_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_and_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_and_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_or_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_or_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE int         simd_movemask_ps( const simd_data& mask ){
+    return (int)simd_to_kmask( mask );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_min_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_min_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_max_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_max_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
+    return _mm512_set1_ps( _mm512_reduce_min_ps( get_avx512_data(s) ) );
+}
+
+#endif
+
+#endif
+
 SORT_STATIC_FORCEINLINE int __bsf(int v) {
 #ifdef SORT_IN_WINDOWS
     unsigned long r = 0;
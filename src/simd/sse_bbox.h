@@ -19,7 +19,7 @@
 
 #include "core/define.h"
 
-#ifdef  SSE_ENABLED
+#ifdef  SIMD4_ENABLED
 #include "simd_wrapper.h"
 #include "simd_bbox.h"
 #endif
\ No newline at end of file
@@ -15,15 +15,33 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <chrono>
+#include <atomic>
+#include <thread>
 #include "sort.h"
 #include "core/globalconfig.h"
 #include "thirdparty/gtest/gtest.h"
 #include "task/init_tasks.h"
+#include "task/benchmark_task.h"
+#include "task/estimate_task.h"
+#include "task/distributed_task.h"
 #include "core/scene.h"
 #include "sampler/random.h"
 #include "core/timer.h"
-#include "stream/fstream.h"
+#include "core/perfreport.h"
+#include "core/metrics.h"
+#include "core/telemetry.h"
+#include "core/cpu.h"
+#include "core/numa.h"
+#include "core/thread.h"
+#include "math/curve.h"
+#include "stream/zstream.h"
+#include "stream/shmstream.h"
+#include "stream/socketstream.h"
+#include "imagesensor/imageoutput.h"
+#include "entity/camera_entity.h"
 #include "material/tsl_system.h"
+#include "material/matmanager.h"
 
 SORT_STATS_DEFINE_COUNTER(sRenderingTimeMS)
 SORT_STATS_DEFINE_COUNTER(sSamplePerPixel)
@@ -33,16 +51,42 @@ SORT_STATS_TIME("Performance", "Rendering Time", sRenderingTimeMS);
 SORT_STATS_AVG_RAY_SECOND("Performance", "Number of rays per second", sRayCount , sRenderingTimeMS);
 SORT_STATS_COUNTER("Statistics", "Sample per Pixel", sSamplePerPixel);
 SORT_STATS_COUNTER("Performance", "Worker thread number", sThreadCnt);
+SORT_STATS_SIMD_ISA("Performance", "SIMD instruction set", sSimdIsa);
 
-void SchedulTasks( Scene& scene , IStreamBase& stream ){
-    SORT_PROFILE("Schedule Tasks");
+// All render tasks of a frame share the same token, a render server resets it for every job.
+static auto g_renderCancellation = std::make_shared<CancellationToken>();
 
-    auto loading_task       = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
-    auto sac_task           = SCHEDULE_TASK<SpatialAccelerationConstruction_Task>( "Spatial Data Structure Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
-    auto savc_task          = SCHEDULE_TASK<SpatialAccelerationVolConstruction_Task>( "Spatial Data Structure (Volume) Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
-    auto pre_render_task    = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task} , scene);
+// Commands sent to a render server.
+enum class ServerCommand : unsigned {
+    Render = 0,     /**< Render an image with the camera, resolution, sample count and output file in the command. */
+    Quit,           /**< Shut the server down. */
+    Update,         /**< Update materials and entities of the loaded scene, like in interactive rendering. */
+};
 
-    // Push render task into the queue
+// Identifier of the render jobs sent to a render server.
+static constexpr unsigned   SERVER_MAGIC    = 0x56525353;
+// This needs to be updated every time the protocol changes.
+static constexpr unsigned   SERVER_VERSION  = 2;
+
+void CancelRendering(){
+    g_renderCancellation->Cancel();
+}
+
+void FocusRendering( int x , int y ){
+    Scheduler::GetSingleton().Reprioritize( [x,y]( const Task& task ){
+        const auto render_task = dynamic_cast<const Render_Task*>( &task );
+        if( IS_PTR_INVALID(render_task) )
+            return task.GetPriority();
+
+        // The closer the center of the tile is to the pixel, the higher the priority is.
+        const auto center = render_task->GetTopLeft() + render_task->GetTileSize() / 2;
+        const auto distance = (unsigned int)( abs( center.x - x ) + abs( center.y - y ) );
+        return DEFAULT_TASK_PRIORITY - std::min( distance , DEFAULT_TASK_PRIORITY - 1u );
+    } );
+}
+
+// Top-left corners of all tiles in the order to be rendered.
+static std::vector<Vector2i> orderedTiles(){
     const auto tilesize = (int)g_tileSize;
     const auto width = (int)g_resultResollution[0];
     const auto height = (int)g_resultResollution[1];
@@ -50,35 +94,376 @@ void SchedulTasks( Scene& scene , IStreamBase& stream ){
     // get the number of total task
     Vector2i tile_num = Vector2i( (int)ceil(width / (float)tilesize) , (int)ceil(height / (float)tilesize) );
 
-    // start tile from center instead of top-left corner
-    Vector2i cur_pos( tile_num / 2 );
-    int cur_dir = 0;
-    int cur_len = 0;
-    int cur_dir_len = 1;
-    const Vector2i dir[4] = { Vector2i( 0 , -1 ) , Vector2i( -1 , 0 ) , Vector2i( 0 , 1 ) , Vector2i( 1 , 0 ) };
-
-    unsigned int priority = DEFAULT_TASK_PRIORITY;
-    while (true){
-        // only process node inside the image region
-        if (cur_pos.x >= 0 && cur_pos.x < tile_num.x && cur_pos.y >= 0 && cur_pos.y < tile_num.y ){
-            Vector2i tl( cur_pos.x * tilesize , cur_pos.y * tilesize );
+    std::vector<Vector2i> tiles;
+    if( TileOrder::Morton == g_tileOrder ){
+        tiles = MortonOrder( tile_num );
+    }else if( TileOrder::Hilbert == g_tileOrder ){
+        tiles = HilbertOrder( tile_num );
+    }else{
+        // start tile from center instead of top-left corner
+        Vector2i cur_pos( tile_num / 2 );
+        int cur_dir = 0;
+        int cur_len = 0;
+        int cur_dir_len = 1;
+        const Vector2i dir[4] = { Vector2i( 0 , -1 ) , Vector2i( -1 , 0 ) , Vector2i( 0 , 1 ) , Vector2i( 1 , 0 ) };
+
+        while (true){
+            // only process node inside the image region
+            if (cur_pos.x >= 0 && cur_pos.x < tile_num.x && cur_pos.y >= 0 && cur_pos.y < tile_num.y )
+                tiles.push_back( cur_pos );
+
+            // turn to the next direction
+            if (cur_len >= cur_dir_len){
+                cur_dir = (cur_dir + 1) % 4;
+                cur_len = 0;
+                cur_dir_len += 1 - cur_dir % 2;
+            }
+
+            cur_pos += dir[cur_dir];
+            ++cur_len;
+            if( (cur_pos.x < 0 || cur_pos.x >= tile_num.x ) && (cur_pos.y < 0 || cur_pos.y >= tile_num.y ) )
+                break;
+        }
+    }
+
+    for( auto& tile : tiles )
+        tile *= tilesize;
+
+    // Only tiles intersecting the render region are rendered, pixels of them outside the region are rendered too.
+    if( g_hasRenderRegion ){
+        const auto region_min = g_renderRegionMin;
+        const auto region_max = g_renderRegionMax;
+        tiles.erase( std::remove_if( tiles.begin() , tiles.end() , [&]( const Vector2i& tile ){
+            return tile.x >= region_max.x || tile.y >= region_max.y || tile.x + tilesize <= region_min.x || tile.y + tilesize <= region_min.y;
+        } ) , tiles.end() );
+    }
+    return tiles;
+}
+
+// Load the scene and build spatial accelerators, it returns the last task before rendering.
+static Task* scheduleLoadingTasks( Scene& scene , IStreamBase& stream ){
+    auto loading_task       = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
+
+    // Geometry out of the views is pruned before any accelerator is built, so that none of them sees it.
+    auto geometry_task      = g_frustumPrune >= 0.0f ? SCHEDULE_TASK<GeometryPruning_Task>( "Geometry Pruning" , DEFAULT_TASK_PRIORITY, {loading_task} , scene) : loading_task;
+    auto sac_task           = SCHEDULE_TASK<SpatialAccelerationConstruction_Task>( "Spatial Data Structure Construction" , DEFAULT_TASK_PRIORITY, {geometry_task} , scene);
+    auto savc_task          = SCHEDULE_TASK<SpatialAccelerationVolConstruction_Task>( "Spatial Data Structure (Volume) Construction" , DEFAULT_TASK_PRIORITY, {geometry_task} , scene);
+    auto sassc_task         = SCHEDULE_TASK<SpatialAccelerationSSSConstruction_Task>( "Spatial Data Structure (SSS) Construction" , DEFAULT_TASK_PRIORITY, {geometry_task} , scene);
+    return SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task, sassc_task} , scene);
+}
+
+// Render the image once pre_render_task is done, it could be nullptr if the scene is loaded already.
+static void scheduleRenderTasks( Scene& scene , const Task* pre_render_task ){
+    const auto dependencies = pre_render_task ? Task::Task_Container{ pre_render_task } : Task::Task_Container{};
+
+    // Push render task into the queue
+    const auto tilesize = (int)g_tileSize;
+    const auto width = (int)g_resultResollution[0];
+    const auto height = (int)g_resultResollution[1];
+    const auto tiles = orderedTiles();
+
+    // Along a space filling curve, each worker thread starts with its own consecutive section of the curve so that
+    // the tiles it renders one after another are next to each other. Threads running out of tiles steal from others.
+    // Faster threads, like the ones on P-cores of hybrid CPUs, take larger sections, the boundaries of the sections
+    // are the accumulated speeds of the threads.
+    const auto tile_affinity = TileOrder::Spiral != g_tileOrder;
+    std::vector<float> sections;
+    for( auto t = 0u ; tile_affinity && t < g_threadCnt ; ++t )
+        sections.push_back( ( sections.empty() ? 0.0f : sections.back() ) + WorkerThreadSpeed( t ) );
+
+    // Render tasks of tiles in [begin, end), they are children of the current task in progressive and distributed rendering.
+    // Tiles resumed from a checkpoint only take the samples missing in it, or are skipped if there is none.
+    // Pixels of quick preview passes are rendered in blocks of the given size.
+    auto schedule_tiles = [tiles, tilesize, width, height, tile_affinity, sections, &scene]( const Task::Task_Container& dependencies , unsigned sample_cnt , unsigned sample_offset , Task* parent , unsigned begin , unsigned end , unsigned block ){
+        unsigned int priority = DEFAULT_TASK_PRIORITY;
+        auto scheduled = 0u;
+        for( auto i = begin ; i < end ; ++i ){
+            const auto& tl = tiles[i];
             Vector2i size( (tilesize < (width - tl.x)) ? tilesize : (width - tl.x) ,
                            (tilesize < (height - tl.y)) ? tilesize : (height - tl.y) );
 
-            SCHEDULE_TASK<Render_Task>( "render task" , priority-- , {pre_render_task} , tl , size , scene );
+            const auto rendered = std::max( g_imageSensor->GetTileSamples( tl ) , sample_offset );
+            if( rendered >= sample_offset + sample_cnt )
+                continue;
+
+            auto task = std::make_unique<Render_Task>( tl , size , scene , "render task" , priority-- , dependencies );
+            task->SetCancellationToken( g_renderCancellation );
+            task->SetSamples( sample_offset + sample_cnt - rendered , rendered );
+            task->SetPreviewBlock( block );
+            task->SetParent( parent );
+            if( tile_affinity ){
+                const auto position = ( (float)( i - begin ) + 0.5f ) / (float)( end - begin ) * sections.back();
+                task->SetAffinity( (int)( std::upper_bound( sections.begin() , sections.end() , position ) - sections.begin() ) );
+            }
+            Scheduler::GetSingleton().Schedule( std::move( task ) );
+            ++scheduled;
+        }
+        PerfReport::GetSingleton().AddTiles( scheduled );
+    };
+    const auto tile_cnt = (unsigned)tiles.size();
+
+    if( !g_coordinatorAddress.empty() ){
+        auto task = std::make_unique<DistributedRender_Task>( tiles , [schedule_tiles]( unsigned begin , unsigned end ){
+            schedule_tiles( {} , g_samplePerPixel , 0 , const_cast<Task*>( GetCurrentTask() ) , begin , end , 1 );
+        } , "Distributed rendering" , DEFAULT_TASK_PRIORITY , dependencies );
+        task->SetCancellationToken( g_renderCancellation );
+        Scheduler::GetSingleton().Schedule( std::move( task ) );
+    }else if( ( g_progressive || g_integrator->SamplesPerPass() > 0 ) && g_integrator->SupportProgressiveRendering() ){
+        auto task = std::make_unique<ProgressiveRender_Task>( [schedule_tiles, tile_cnt]( unsigned sample_cnt , unsigned sample_offset , unsigned block ){
+            schedule_tiles( {} , sample_cnt , sample_offset , const_cast<Task*>( GetCurrentTask() ) , 0 , tile_cnt , block );
+        } , "Progressive rendering" , DEFAULT_TASK_PRIORITY , dependencies );
+        task->SetCancellationToken( g_renderCancellation );
+        Scheduler::GetSingleton().Schedule( std::move( task ) );
+    }else{
+        schedule_tiles( dependencies , g_samplePerPixel , 0 , nullptr , 0 , tile_cnt , 1 );
+    }
+}
+
+void SchedulTasks( Scene& scene , IStreamBase& stream ){
+    SORT_PROFILE("Schedule Tasks");
+
+    scheduleRenderTasks( scene , scheduleLoadingTasks( scene , stream ) );
+}
+
+// Execute all scheduled tasks, the main thread is one of the worker threads. Worker threads quit once there is no task
+// alive, so they are created again every time. Progress is logged periodically if asked.
+static void executeTasks(){
+    std::unique_ptr<TelemetryReporter> telemetry;
+    if( g_telemetryInterval > 0.0f )
+        telemetry = std::make_unique<TelemetryReporter>( g_telemetryInterval );
+
+    std::vector< std::unique_ptr<WorkerThread> > threads;
+    for( unsigned i = 0 ; i < g_threadCnt - 1 ; ++i )
+        threads.push_back( std::make_unique<WorkerThread>( i + 1 ) );
+
+    // start all threads
+    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->BeginThread(); } );
+
+    EXECUTING_TASKS();
+
+    // wait for all the threads to be finished
+    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->Join(); } );
+}
+
+// Print the settings and the time of rendering as a line of JSON, so that scripts of performance sweeps could parse it.
+// Rays per second only count the time of rendering tiles, while samples per second count the whole time of the tasks.
+static void printTiming( const double seconds ){
+    const auto& report = PerfReport::GetSingleton();
+    const auto accelerator = Factory<Accelerator>::GetSingleton().GetTypeName( GlobalConfiguration::GetSingleton().GetAcceleratorType() );
+    const auto integrator = Factory<Integrator>::GetSingleton().GetTypeName( GlobalConfiguration::GetSingleton().GetIntegratorType() );
+    const auto sampler = Factory<Sampler>::GetSingleton().GetTypeName( g_samplerType );
+    const auto samples = (double)g_resultResollutionWidth * (double)g_resultResollutionHeight * (double)g_samplePerPixel;
+    const auto rays = report.GetRayCount();
+    const auto rendering = report.GetPhaseTime( PerfPhase::Rendering );
+
+    std::string phases;
+    for( auto i = 0u ; i < (unsigned)PerfPhase::Count ; ++i ){
+        char phase[64];
+        snprintf( phase , sizeof( phase ) , "%s\"%s\":%.6f" , i ? "," : "" , PerfReport::GetPhaseName( (PerfPhase)i ) , report.GetPhaseTime( (PerfPhase)i ) );
+        phases += phase;
+    }
+
+    printf( "{\"threads\":%u,\"spp\":%u,\"tilesize\":%u,\"width\":%u,\"height\":%u,\"accelerator\":\"%s\",\"integrator\":\"%s\",\"sampler\":\"%s\",\"seconds\":%.6f,\"samples_per_second\":%.1f,"
+            "\"rays\":%llu,\"mrays_per_second\":%.3f,\"time_to_first_pixel\":%.6f,\"peak_memory_mb\":%.1f,\"phases\":{%s}}\n" ,
+            g_threadCnt , g_samplePerPixel , g_tileSize , g_resultResollutionWidth , g_resultResollutionHeight ,
+            accelerator.c_str() , integrator.c_str() , sampler.c_str() , seconds , seconds > 0.0 ? samples / seconds : 0.0 ,
+            rays , rendering > 0.0 ? (double)rays * 1e-6 / rendering : 0.0 , report.GetTimeToFirstPixel() ,
+            (double)PerfReport::GetPeakMemory() / ( 1024.0 * 1024.0 ) , phases.c_str() );
+    fflush( stdout );
+}
+
+// Render one job of a render server. The camera, resolution, sample count and output file could be different from
+// the ones in the input file, everything else in the scene is kept between jobs. Any command sent by the client while
+// rendering interrupts it, the image is not post processed then.
+static bool renderJob( Scene& scene , ISocketStream& stream , std::unique_ptr<PerspectiveCameraEntity>& camera , bool& interrupted ){
+    unsigned width = 0 , height = 0 , spp = 0;
+    std::string output;
+    bool has_camera = false;
+    stream >> width >> height >> spp >> output >> has_camera;
+    if( has_camera ){
+        camera = std::make_unique<PerspectiveCameraEntity>();
+        camera->Serialize( stream );
+    }
+    if( !stream.IsValid() || 0 == width || 0 == height || 0 == spp )
+        return false;
+
+    slog( INFO , GENERAL , "Rendering %s, %dx%d with %d samples per pixel." , output.c_str() , width , height , spp );
+    GlobalConfiguration::GetSingleton().SetRenderJob( width , height , spp , output );
+    if( has_camera )
+        camera->FillScene( scene );
+    // The camera depends on the resolution.
+    scene.GetCamera()->PreProcess();
+
+    g_renderCancellation = std::make_shared<CancellationToken>();
+    PerfReport::GetSingleton().Reset( g_threadCnt );
+    scheduleRenderTasks( scene , SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {} , scene ) );
+
+    std::atomic<bool> done( false ) , cancelled( false );
+    std::thread watcher( [&](){
+        while( !done ){
+            if( stream.WaitForData( 100 ) ){
+                cancelled = true;
+                CancelRendering();
+                return;
+            }
         }
+    } );
+    {
+        SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
+        executeTasks();
+    }
+    done = true;
+    watcher.join();
+
+    interrupted = cancelled;
+    if( !interrupted ){
+        g_imageSensor->PostProcess();
+        // the client reads the image once it is told the job is done
+        WaitForImageOutputs();
+    }
+    return true;
+}
+
+// Update materials and entities of the scene on a render server. The command has the number of updated materials,
+// each of which is in the layout of 'MatManager::UpdateMaterial', followed by the changes of entities in the layout
+// of 'Scene::UpdateScene'. The same as the following frames of a sequence, spatial acceleration structures are
+// refitted if anything moves.
+static bool updateJob( Scene& scene , ISocketStream& stream ){
+    auto ret = true;
+    unsigned int material_cnt = 0;
+    stream >> material_cnt;
+    while( material_cnt-- > 0 )
+        ret &= MatManager::GetSingleton().UpdateMaterial( stream );
+    return scene.UpdateScene( stream ) && ret && stream.IsValid();
+}
+
+// Output file of an extra view, the index of the view goes right before the extension, like 'image_view1.exr'.
+static std::string viewOutputFile( const std::string& output , size_t view ){
+    const auto suffix = "_view" + std::to_string( view );
+    const auto dot = output.find_last_of( '.' );
+    const auto slash = output.find_last_of( "/\\" );
+    if( std::string::npos == dot || ( std::string::npos != slash && dot < slash ) )
+        return output + suffix;
+    return output.substr( 0 , dot ) + suffix + output.substr( dot );
+}
 
-        // turn to the next direction
-        if (cur_len >= cur_dir_len){
-            cur_dir = (cur_dir + 1) % 4;
-            cur_len = 0;
-            cur_dir_len += 1 - cur_dir % 2;
+// Render the extra views of a scene carrying more than one camera, the first view is rendered already. The loaded
+// scene, compiled shaders, textures and spatial accelerators are shared by all views, each view only takes its own
+// pre-rendering pass and tiles, and writes its own output file. Views are rendered one after another, since the
+// camera and the image sensor are shared by everything running during rendering. Blender only shows the first view.
+static void renderViews( Scene& scene ){
+    const auto& views = scene.GetViews();
+    if( views.size() < 2 || g_blenderMode )
+        return;
+
+    const auto output = g_outputFileName;
+    const auto width = g_resultResollutionWidth , height = g_resultResollutionHeight;
+    for( auto i = 1u ; i < views.size() ; ++i ){
+        const auto view_output = viewOutputFile( output , i );
+        slog( INFO , GENERAL , "Rendering view %d of %d, %s." , (int)i + 1 , (int)views.size() , view_output.c_str() );
+        GlobalConfiguration::GetSingleton().SetRenderJob( width , height , g_samplePerPixel , view_output );
+        scene.SetupCamera( views[i] );
+        scene.GetCamera()->PreProcess();
+
+        g_renderCancellation = std::make_shared<CancellationToken>();
+        scheduleRenderTasks( scene , SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {} , scene ) );
+        {
+            SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
+            executeTasks();
         }
+        g_imageSensor->PostProcess();
+    }
+
+    // the following frames of a sequence start with the first view again
+    GlobalConfiguration::GetSingleton().SetRenderJob( width , height , g_samplePerPixel , output );
+    scene.SetupCamera( views.front() );
+}
+
+// Render the following frames of a sequence in the input stream, if there are any. Each frame starts with its output
+// file, followed by the changes of the scene since the previous frame. Everything else is kept between frames.
+static void renderSequence( Scene& scene , ICompressedFileStream& stream ){
+    while( true ){
+        StringID frame;
+        stream >> frame;
+        if( !stream.IsValid() || SID("Frame") != frame )
+            return;
+
+        std::string output;
+        stream >> output;
+        if( !scene.UpdateScene( stream ) )
+            return;
+
+        slog( INFO , GENERAL , "Rendering frame %s." , output.c_str() );
+        GlobalConfiguration::GetSingleton().SetRenderJob( g_resultResollutionWidth , g_resultResollutionHeight , g_samplePerPixel , output );
 
-        cur_pos += dir[cur_dir];
-        ++cur_len;
-        if( (cur_pos.x < 0 || cur_pos.x >= tile_num.x ) && (cur_pos.y < 0 || cur_pos.y >= tile_num.y ) )
-            break;
+        g_renderCancellation = std::make_shared<CancellationToken>();
+        scheduleRenderTasks( scene , SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {} , scene ) );
+        {
+            SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
+            executeTasks();
+        }
+        g_imageSensor->PostProcess();
+        renderViews( scene );
+    }
+}
+
+// Keep the loaded scene, compiled shaders and spatial accelerators, and render jobs sent to the port one after
+// another until a client asks the server to quit.
+static void runServer( Scene& scene , unsigned short port ){
+    Socket listener;
+    if( !listener.Listen( port ) )
+        return;
+    slog( INFO , GENERAL , "Waiting for render jobs on port %d." , port );
+
+    // ray counters are allocated before the metrics endpoint reads them.
+    PerfReport::GetSingleton().Reset( g_threadCnt );
+    MetricsServer metrics;
+    if( g_metricsPort > 0 )
+        metrics.Start( (unsigned short)g_metricsPort );
+
+    std::unique_ptr<PerspectiveCameraEntity> camera;
+    auto quit = false;
+    while( !quit ){
+        auto socket = listener.Accept( 1000 );
+        if( !socket )
+            continue;
+
+        ISocketStream is( *socket );
+        OSocketStream os( *socket );
+        unsigned magic = 0 , version = 0;
+        is >> magic >> version;
+        if( SERVER_MAGIC != magic || SERVER_VERSION != version ){
+            slog( WARNING , GENERAL , "Incompatible client of the render server." );
+            continue;
+        }
+
+        // A client could send any number of jobs before closing the connection. In interactive rendering, a client
+        // interrupts rendering with updates of the scene, and asks for rendering again.
+        while( !quit ){
+            unsigned command = 0;
+            is >> command;
+            if( !is.IsValid() )
+                break;
+
+            if( (unsigned)ServerCommand::Quit == command ){
+                quit = true;
+                break;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            auto interrupted = false;
+            auto ret = false;
+            if( (unsigned)ServerCommand::Render == command ){
+                ret = renderJob( scene , is , camera , interrupted );
+                if( ret )
+                    metrics.FinishJob( interrupted );
+            }else if( (unsigned)ServerCommand::Update == command )
+                ret = updateJob( scene , is );
+            os << ret << interrupted << std::chrono::duration<float>( std::chrono::steady_clock::now() - start ).count();
+            os.Flush();
+            if( !ret )
+                break;
+        }
     }
 }
 
@@ -93,13 +478,68 @@ int RunSORT( int argc , char** argv ){
     if (!valid_args) {
         slog(INFO, GENERAL, "There is not enough command line arguments.");
         slog(INFO, GENERAL, "  --input:<filename>   Specify the sort input file.");
+        slog(INFO, GENERAL, "  --sharedinput:<name> Stream the input from shared memory exported by Blender instead of a file.");
         slog(INFO, GENERAL, "  --blendermode        SORT is triggered from Blender.");
         slog(INFO, GENERAL, "  --unittest           Run unit tests.");
         slog(INFO, GENERAL, "  --nomaterial         Disable materials in SORT.");
-        slog(INFO, GENERAL, "  --profiling:<on|off> Toggling profiling option, false by default.");
+        slog(INFO, GENERAL, "  --accelcache         Cache spatial accelerator in the resource folder.");
+        slog(INFO, GENERAL, "  --meshcache          Cache processed meshes in the resource folder.");
+        slog(INFO, GENERAL, "  --outofcore:<MB>     Page vertices of cached meshes in from the cache files, keeping at most MB resident.");
+        slog(INFO, GENERAL, "                       Only vertices are paged, accelerators and their leaves always stay in memory.");
+        slog(INFO, GENERAL, "  --texturecache:<MB>  Convert textures to tiles in the resource folder, loading at most MB of tiles on demand.");
+        slog(INFO, GENERAL, "  --volumebake:<N>     Bake volume shaders of meshes with volume data into grids of N^3 texels before rendering.");
+        slog(INFO, GENERAL, "  --sharedresources[:<MB>] Share decoded textures and measured BRDFs with other SORT processes on the machine, keeping at most MB of them unused, 1024 by default.");
+        slog(INFO, GENERAL, "  --benchmark          Benchmark all spatial accelerators with the input scene instead of rendering it.");
+        slog(INFO, GENERAL, "  --estimate:<F>       Render a fraction F of pixels, 0.01 by default, and print the estimated memory and render time as JSON.");
+        slog(INFO, GENERAL, "  --pinthreads         Pin worker threads to logical cores, spread across NUMA nodes.");
+        slog(INFO, GENERAL, "  --numa               Interleave scene data across NUMA nodes.");
+        slog(INFO, GENERAL, "  --hugepages          Back large arrays of scene data with 2MB/1GB pages if available.");
+        slog(INFO, GENERAL, "  --statssampling:<N>  Measure hot path stats in one of every N pixels only, 1 by default.");
+        slog(INFO, GENERAL, "  --statsjson:<file>   Save stats, including the breakdown of scene loading, to the file as JSON.");
+        slog(INFO, GENERAL, "  --splatrefresh:<N>   Refresh splatted radiance in Blender every N finished tiles, 0 (never) by default.");
+        slog(INFO, GENERAL, "  --checkpoint:<N>     Save rendered tiles in the resource folder every N seconds, 0 (never) by default.");
+        slog(INFO, GENERAL, "  --resume             Resume rendering from the checkpoint in the resource folder.");
+        slog(INFO, GENERAL, "  --tiledexr           Write each tile to the output tiled EXR file as soon as it is finished.");
+        slog(INFO, GENERAL, "  --framebuffer:<float|half> Storage format of the pixels of the image, float by default.");
+        slog(INFO, GENERAL, "  --merlhalf           Store MERL measured BRDF data as half floats instead of floats.");
+        slog(INFO, GENERAL, "  --hairtable          Share tables of hair parameters across hits instead of computing them at every hit.");
+        slog(INFO, GENERAL, "  --skyproxy           Look up prefiltered levels of the sky, chosen by the BSDF lobe, for indirect lighting.");
+        slog(INFO, GENERAL, "  --shadowroulette[:<threshold>] Trace shadow rays contributing less than the threshold with russian roulette, 0.01 by default.");
+        slog(INFO, GENERAL, "  --equiangular        Sample scattering in media around point and spot lights too, combined with distance sampling.");
+        slog(INFO, GENERAL, "  --frustumprune[:<margin>] Remove geometry farther out of the camera view than the margin, relative to the scene size, 0.1 by default.");
+        slog(INFO, GENERAL, "  --lod[:<pixels>]     Simplify instanced meshes and hair whose details are smaller than the pixels on screen, 1 by default.");
+        slog(INFO, GENERAL, "  --warmstart[:<decay>] Warm start path guiding and learned caches with the last frame, weighted by the decay, 0.5 by default.");
+        slog(INFO, GENERAL, "  --aov:<albedo,normal,depth,cost|all> Save the AOVs as layers of the output EXR file, for denoisers. Cost is a heatmap of time and rays per sample, it is not in all.");
+        slog(INFO, GENERAL, "  --preview            Render 1/16 and 1/4 of the pixels for quick previews before the first pass of progressive rendering.");
+        slog(INFO, GENERAL, "  --denoise[:passes]   Denoise the image once it is rendered, the preview of each progressive pass in Blender is denoised too with passes.");
+        slog(INFO, GENERAL, "  --coordinator:<port> Hand out tiles to worker nodes listening on the port, and assemble the image.");
+        slog(INFO, GENERAL, "  --worker:<host:port> Render tiles handed out by the coordinator.");
+        slog(INFO, GENERAL, "  --server:<port>      Keep the scene loaded and render jobs sent to the port, until asked to quit.");
+        slog(INFO, GENERAL, "  --assetcache:<folder> Cache textures and measured BRDFs with urls, like http:// and s3://, in the folder.");
+        slog(INFO, GENERAL, "  --s3endpoint:<host:port> Fetch s3:// assets through the plain http endpoint, like a gateway on the local network.");
+        slog(INFO, GENERAL, "  --metrics:<port>     Serve live rays per second and progress of a render server to Prometheus on the port.");
+        slog(INFO, GENERAL, "  --region:<x0,y0,x1,y1> Only render tiles intersecting the pixels in [x0,x1)x[y0,y1), the rest of an existing output EXR file is kept.");
+        slog(INFO, GENERAL, "  --filter:<box|gaussian|blackmanharris>[,radius] Reconstruction filter of camera samples, box by default.");
+        slog(INFO, GENERAL, "  --tileorder:<spiral|morton|hilbert> Order of tiles and pixels to be rendered, spiral by default.");
+        slog(INFO, GENERAL, "  --threads:<N|auto>   Override the number of worker threads in the input file, auto is one per physical core.");
+        slog(INFO, GENERAL, "  --spp:<N>            Override the number of samples per pixel in the input file.");
+        slog(INFO, GENERAL, "  --tilesize:<N>       Override the size of tiles in the input file.");
+        slog(INFO, GENERAL, "  --resolution:<WxH>   Override the resolution of the image in the input file.");
+        slog(INFO, GENERAL, "  --clamp:<value>      Override the clampping of radiance in the input file, 0 means no clampping.");
+        slog(INFO, GENERAL, "  --sampler:<name>     Override the sampler in the input file, like SobolSampler.");
+        slog(INFO, GENERAL, "  --accelerator:<name> Override the spatial accelerator in the input file with its default settings, like Obvh.");
+        slog(INFO, GENERAL, "  --integrator:<name>  Override the integrator in the input file with its default settings, like PathTracing.");
+        slog(INFO, GENERAL, "  --timing             Print the settings, timing of phases, rays per second and peak memory in a line of JSON once it is done.");
+        slog(INFO, GENERAL, "  --telemetry:<sec>    Log progress, ETA, rays per second, memory and thread utilization every few seconds, 5 by default.");
+        slog(INFO, GENERAL, "  --deterministic      Render bitwise identical images for any thread count, features learned during rendering are disabled.");
+        slog(INFO, GENERAL, "  --profiling:<on|off> Toggling profiling option, false by default. Blocks are saved in the Chrome trace format.");
         return -1;
     }else{
-        slog(INFO, GENERAL, "Number of CPU cores %d", std::thread::hardware_concurrency());
+        const auto& topology = CpuTopology();
+        slog(INFO, GENERAL, "Number of CPU cores %d, %d physical cores (%d performance, %d efficiency) in %d sockets.", topology.logical_cnt,
+             topology.physical_cnt, topology.performance_cnt, topology.efficiency_cnt, topology.package_cnt);
+        slog(INFO, GENERAL, "Widest SIMD instruction set supported by the CPU is %s.", SimdIsaName(BestSimdIsa()));
+        slog(INFO, GENERAL, "Number of NUMA nodes %d", NumaNodeCount());
         #ifdef SORT_ENABLE_STATS_COLLECTION
             slog(INFO, GENERAL, "Stats collection is enabled.");
         #else
@@ -111,41 +551,117 @@ int RunSORT( int argc , char** argv ){
     // Run in unit test mode if required.
     if( g_unitTestMode ){
         ::testing::InitGoogleTest(&argc, argv);
+
+        // SIMD tests of instruction sets that the CPU doesn't support would crash, they are filtered out instead.
+        std::string unsupported;
+        for( const auto isa : { SimdIsa::SSE , SimdIsa::AVX , SimdIsa::AVX512 } ){
+            // tests of four lanes run with NEON on ARM64.
+            if( IsSimdIsaSupported( isa ) || ( isa == SimdIsa::SSE && IsSimdIsaSupported( SimdIsa::NEON ) ) )
+                continue;
+            const auto test_case = std::string( isa == SimdIsa::SSE ? "SIMD_SSE" : isa == SimdIsa::AVX ? "SIMD_AVX" : "SIMD_AVX512" );
+            slog( INFO , GENERAL , "%s is not supported by the CPU, tests of %s are skipped." , SimdIsaName( isa ) , test_case.c_str() );
+            unsupported += ( unsupported.empty() ? "" : ":" ) + test_case + ".*";
+        }
+        if( !unsupported.empty() ){
+            auto& filter = ::testing::GTEST_FLAG(filter);
+            filter += ( filter.find( '-' ) == std::string::npos ? "-" : ":" ) + unsupported;
+        }
+
         auto ret = RUN_ALL_TESTS();
         slog( INFO , GENERAL , ( ret ? "There are broken tests." : "All tests are passed." ) ) ;
         return ret;
     }
 
-    // Load the global configuration from stream
-    IFileStream stream( g_inputFilePath );
+    // Load the global configuration from stream, Blender could export the scene into shared memory instead of a file.
+    std::unique_ptr<ICompressedFileStream> file_stream;
+    std::unique_ptr<ISharedMemoryStream> shared_stream;
+    if( g_sharedInputName.empty() )
+        file_stream = std::make_unique<ICompressedFileStream>( g_inputFilePath );
+    else
+        shared_stream = std::make_unique<ISharedMemoryStream>( g_sharedInputName );
+    IStreamBase& stream = file_stream ? static_cast<IStreamBase&>( *file_stream ) : *shared_stream;
     GlobalConfiguration::GetSingleton().Serialize(stream);
 
-    CreateTSLThreadContexts();
+    // The coordinator of distributed rendering doesn't load the scene, it only assembles tiles rendered by workers.
+    if( g_coordinatorPort > 0 ){
+        SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
+        if( !RunCoordinator( orderedTiles() , (unsigned short)g_coordinatorPort ) )
+            return -1;
+        g_imageSensor->PostProcess();
+        return 0;
+    }
+
+    SortStatsSetSamplingRate( g_statsSamplingRate );
+    if( g_meshCacheEnabled )
+        SortStatsEnableCategory( "Mesh Cache" );
+    if( g_textureCacheBudget > 0 )
+        SortStatsEnableCategory( "Texture Cache" );
+
+    // Each worker thread, including the main thread, owns a task queue in the scheduler.
+    Scheduler::GetSingleton().Initialize( g_threadCnt );
+
+    // The main thread is a worker thread too, it needs to be placed before loading the scene.
+    PlaceCurrentThread( 0 );
+
+    // Initializing TSL, mostly LLVM, overlaps with loading the scene, threads compiling shaders before it is done wait
+    // for it. Nothing needs it without material support.
+    if( !g_noMaterial )
+        SCHEDULE_TASK<Function_Task>( "Initializing TSL" , DEFAULT_TASK_PRIORITY + 1 , {} , [](){ InitializeTSLSystem(); } );
 
     Scene scene;
-    // Schedule all tasks.
-    SchedulTasks( scene , stream );
 
-    std::vector< std::unique_ptr<WorkerThread> > threads;
-    for( unsigned i = 0 ; i < g_threadCnt - 1 ; ++i )
-        threads.push_back( std::make_unique<WorkerThread>( i + 1 ) );
+    // A render server only loads the scene once, it renders jobs sent to it afterwards.
+    if( g_serverPort > 0 ){
+        scheduleLoadingTasks( scene , stream );
+        executeTasks();
+        runServer( scene , (unsigned short)g_serverPort );
 
-    // start all threads
-    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->BeginThread(); } );
+        SORT_STATS(sThreadCnt = g_threadCnt);
+        DestroyTSLThreadContexts();
+        return 0;
+    }
 
+    // Schedule all tasks.
+    if( g_benchmarkMode ){
+        auto loading_task = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
+        SCHEDULE_TASK<Benchmark_Task>( "Benchmark" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
+    }else if( g_estimateFraction > 0.0f ){
+        SCHEDULE_TASK<Estimate_Task>( "Estimate" , DEFAULT_TASK_PRIORITY, {scheduleLoadingTasks( scene , stream )} , scene);
+    }else{
+        SchedulTasks( scene , stream );
+    }
+
+    // the time includes loading the scene, which is part of the tasks too.
+    auto seconds = 0.0;
     {
         SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
-        EXECUTING_TASKS();
-
-        // wait for all the threads to be finished
-        for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->Join(); } );
+        PerfReport::GetSingleton().Reset( g_threadCnt );
+        const auto start = std::chrono::steady_clock::now();
+        executeTasks();
+        seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
     }
 
     SORT_STATS(sSamplePerPixel = g_samplePerPixel);
     SORT_STATS(sThreadCnt = g_threadCnt);
 
-    // Post process for image sensor
-    g_imageSensor->PostProcess();
+    // Post process for image sensor, nothing is rendered in benchmark or estimate mode, workers send tiles to the coordinator instead.
+    // The timing of the first frame is printed before the following frames of a sequence are rendered.
+    const auto render_mode = !g_benchmarkMode && g_estimateFraction <= 0.0f;
+    const auto print_timing = g_timingEnabled && render_mode;
+    if( render_mode && g_coordinatorAddress.empty() ){
+        {
+            PERF_PHASE( PerfPhase::PostProcess );
+            g_imageSensor->PostProcess();
+        }
+        if( print_timing )
+            printTiming( seconds );
+        renderViews( scene );
+        // only input files could have a sequence of frames.
+        if( file_stream )
+            renderSequence( scene , *file_stream );
+    }else if( print_timing ){
+        printTiming( seconds );
+    }
 
     DestroyTSLThreadContexts();
 
@@ -82,4 +82,19 @@
 //! @param  argc    Number of arguments, including the executable instance itself.
 //! @param  argv    The command arguments.
 //! @return         Return value of '0' means nothing goes wrong, otherwise there is something wrong.
-int     RunSORT( int argc , char** argv );
\ No newline at end of file
+int     RunSORT( int argc , char** argv );
+
+//! @brief      Cancel rendering of the current frame.
+//!
+//! Tiles that are not started yet are skipped, tiles being rendered stop after their current pixel.
+//! It is safe to call it from any thread.
+void    CancelRendering();
+
+//! @brief      Render tiles closer to a pixel first.
+//!
+//! Only tiles that are ready to be rendered but not started yet are reprioritized, like the tiles under
+//! the mouse when rendering interactively. It is safe to call it from any thread.
+//!
+//! @param  x       Horizontal coordinate of the pixel.
+//! @param  y       Vertical coordinate of the pixel, starting from the top of the image.
+void    FocusRendering( int x , int y );
\ No newline at end of file
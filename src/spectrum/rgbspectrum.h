@@ -18,37 +18,94 @@
 #pragma once
 
 #include <string>
+#include <cfloat>
 #include <tsl_args.h>
 #include "core/define.h"
 #include "core/sassert.h"
 #include "math/utils.h"
+#include "math/approx.h"
+
+// The spectrum is padded to four floats and its arithmetic is vectorized if it is enabled, SSE2 is available on any
+// x86-64 CPU so that it doesn't depend on the SIMD optimization of the accelerators. Other platforms use scalar code.
+#if defined(SIMD_SPECTRUM_ENABLED) && ( defined(__SSE2__) || defined(_M_X64) )
+#define SORT_SIMD_SPECTRUM
+#include <emmintrin.h>
+#endif
 
 #define RGBSPECTRUM_SAMPLE      3
 
+#ifdef SORT_SIMD_SPECTRUM
+//! @brief  Exponential of four floats.
+//!
+//! The approximation from Cephes, the relative error is around the precision of float. The input is clamped so that
+//! the result is always finite, very small results are flushed to zero.
+SORT_STATIC_FORCEINLINE __m128 exp_sse( __m128 x ){
+    const auto lo = _mm_set1_ps( -87.3365f );
+    x = _mm_min_ps( _mm_max_ps( x , lo ) , _mm_set1_ps( 88.3762f ) );
+
+    // exp(x) = 2^n * exp(r), where n is the closest integer to x / ln(2).
+    const auto n = _mm_cvtps_epi32( _mm_mul_ps( x , _mm_set1_ps( 1.44269504088896341f ) ) );
+    const auto fn = _mm_cvtepi32_ps( n );
+    auto r = _mm_sub_ps( x , _mm_mul_ps( fn , _mm_set1_ps( 0.693359375f ) ) );
+    r = _mm_sub_ps( r , _mm_mul_ps( fn , _mm_set1_ps( -2.12194440e-4f ) ) );
+
+    auto y = _mm_set1_ps( 1.9875691500e-4f );
+    y = _mm_add_ps( _mm_mul_ps( y , r ) , _mm_set1_ps( 1.3981999507e-3f ) );
+    y = _mm_add_ps( _mm_mul_ps( y , r ) , _mm_set1_ps( 8.3334519073e-3f ) );
+    y = _mm_add_ps( _mm_mul_ps( y , r ) , _mm_set1_ps( 4.1665795894e-2f ) );
+    y = _mm_add_ps( _mm_mul_ps( y , r ) , _mm_set1_ps( 1.6666665459e-1f ) );
+    y = _mm_add_ps( _mm_mul_ps( y , r ) , _mm_set1_ps( 5.0000001201e-1f ) );
+    y = _mm_add_ps( _mm_mul_ps( _mm_mul_ps( y , r ) , r ) , _mm_add_ps( r , _mm_set1_ps( 1.0f ) ) );
+
+    const auto pow2n = _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( n , _mm_set1_epi32( 127 ) ) , 23 ) );
+    return _mm_and_ps( _mm_mul_ps( y , pow2n ) , _mm_cmpgt_ps( x , lo ) );
+}
+#endif
+
 // @brief   Basic color representation based on RGB color.
 /**
  * The color space is linear and sRGB. SORT doesn't support more advanced HDR color spaces, like
  * Rec 2020. All colors are in sRGB space and linear in SORT.
+ *
+ * With SIMD_SPECTRUM_ENABLED, the color takes four floats and all arithmetic is done in SSE registers. The fourth
+ * channel holds no meaningful value, it is ignored by everything reading the color.
  */
 class   RGBSpectrum{
 public:
     //! @brief  Default constructor.
+#ifdef SORT_SIMD_SPECTRUM
+    SORT_FORCEINLINE RGBSpectrum():m(_mm_setzero_ps()){}
+
+    //! @brief  Constructor from the SIMD data.
+    //!
+    //! @param  m   The SIMD data, the fourth channel is ignored.
+    SORT_FORCEINLINE explicit RGBSpectrum( const __m128& m ):m(m){}
+#else
     SORT_FORCEINLINE RGBSpectrum():r(0.0f),g(0.0f),b(0.0f){}
+#endif
 
     //! @brief  Conversion from tsl float3
-    SORT_FORCEINLINE RGBSpectrum(const Tsl_Namespace::float3& f3) : r(f3.x), g(f3.y), b(f3.z) {}
+    SORT_FORCEINLINE RGBSpectrum(const Tsl_Namespace::float3& f3) : RGBSpectrum(f3.x, f3.y, f3.z) {}
 
     //! @brief  Constructor from three float values.
     //!
     //! @param  r   Value in red channel.
     //! @param  g   Value in green channel.
     //! @param  b   Value in blue channel.
+#ifdef SORT_SIMD_SPECTRUM
+    SORT_FORCEINLINE RGBSpectrum( float r , float g , float b ):m(_mm_setr_ps(r,g,b,0.0f)){}
+#else
     SORT_FORCEINLINE RGBSpectrum( float r , float g , float b ):r(r),g(g),b(b){}
+#endif
 
     //! @brief  Constructor from a single value that propogates to all channels
     //!
     //! @param  g   Value to be propergated.
+#ifdef SORT_SIMD_SPECTRUM
+    SORT_FORCEINLINE RGBSpectrum( float g ):m(_mm_set1_ps(g)){}
+#else
     SORT_FORCEINLINE RGBSpectrum( float g ):RGBSpectrum(g,g,g){}
+#endif
 
     //! @brief  Get the value of the maximum channel.
     //!
@@ -63,7 +120,11 @@ public:
     //! @param  high    Maximum value of the range of clamping.
     //! @return         The clamped color.
     SORT_FORCEINLINE RGBSpectrum Clamp(float low, float high) const {
+#ifdef SORT_SIMD_SPECTRUM
+        return RGBSpectrum( _mm_min_ps( _mm_max_ps( m , _mm_set1_ps( low ) ) , _mm_set1_ps( high ) ) );
+#else
         return RGBSpectrum(clamp(r, low, high), clamp(g,low,high), clamp(b,low,high));
+#endif
     }
 
     //! = operator
@@ -71,7 +132,11 @@ public:
     //! @param  color   Source color to copy from.
     //! @return         The copied color.
     const RGBSpectrum& operator = ( const RGBSpectrum& color ){
+#ifdef SORT_SIMD_SPECTRUM
+        m = color.m;
+#else
         x = color.x; y = color.y; z = color.z;
+#endif
         return *this;
     }
 
@@ -102,7 +167,11 @@ public:
     //!
     //! @return     Whether the color is black.
     SORT_FORCEINLINE bool IsBlack() const{
+#ifdef SORT_SIMD_SPECTRUM
+        return ( _mm_movemask_ps( _mm_cmpeq_ps( m , _mm_setzero_ps() ) ) & 0x7 ) == 0x7;
+#else
         return ( r == 0.0f ) && ( g == 0.0f ) && ( b == 0.0f );
+#endif
     }
 
     //! @brief  Get the intensity of the color.
@@ -115,27 +184,44 @@ public:
 
     //! @brief  Return the x^e of each channel.
     //!
+    //! The vectorized spectrum always evaluates all channels in the SSE version, whose accuracy is the same as the high one.
+    //!
     //! @return     A color with each channel as exp of the original color.
+    template<MathAccuracy accuracy = MathAccuracy::Exact>
     SORT_FORCEINLINE RGBSpectrum Exp() const {
-        return RGBSpectrum( exp( r ) , exp( g ) , exp( b ) );
+#ifdef SORT_SIMD_SPECTRUM
+        return RGBSpectrum( exp_sse( m ) );
+#else
+        return RGBSpectrum( ApproxExp<accuracy>( r ) , ApproxExp<accuracy>( g ) , ApproxExp<accuracy>( b ) );
+#endif
     }
 
     //! @brief  Return the squared root of each channel.
     //!
     //! @return     A color with each channel as squared root of the original color.
     SORT_FORCEINLINE RGBSpectrum Sqrt() const {
+#ifdef SORT_SIMD_SPECTRUM
+        return RGBSpectrum( _mm_sqrt_ps( m ) );
+#else
         return RGBSpectrum( sqrt( r ) , sqrt( g ) , sqrt( b ) );
+#endif
     }
 
     //! @brief  Whether the color is valid.
     //!
     //! @return     Whether the color contains Nan or Inf
     SORT_FORCEINLINE bool IsValid() const {
+#ifdef SORT_SIMD_SPECTRUM
+        // neither Nan nor Inf is smaller than the largest float in absolute value.
+        const auto abs = _mm_andnot_ps( _mm_set1_ps( -0.0f ) , m );
+        return ( _mm_movemask_ps( _mm_cmple_ps( abs , _mm_set1_ps( FLT_MAX ) ) ) & 0x7 ) == 0x7;
+#else
         if( isnan( r ) || isnan( g ) || isnan( b ) )
             return false;
         if( isinf( r ) || isinf( g ) || isinf( b ) )
             return false;
         return true;
+#endif
     }
 
     union{
@@ -148,6 +234,9 @@ public:
         struct{
             float data[3];
         };
+#ifdef SORT_SIMD_SPECTRUM
+        __m128  m;
+#endif
     };
 
     static const RGBSpectrum    m_White;
@@ -156,6 +245,106 @@ public:
 #define WHITE_SPECTRUM      RGBSpectrum::m_White
 #define FULL_WEIGHT         WHITE_SPECTRUM
 
+#ifdef SORT_SIMD_SPECTRUM
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return RGBSpectrum( _mm_add_ps( c0.m , c1.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return RGBSpectrum( _mm_sub_ps( c0.m , c1.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return RGBSpectrum( _mm_mul_ps( c0.m , c1.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return RGBSpectrum( _mm_div_ps( c0.m , c1.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const RGBSpectrum& c0 , const float f ){
+    return RGBSpectrum( _mm_add_ps( c0.m , _mm_set1_ps( f ) ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const RGBSpectrum& c0 , const float f ){
+    return RGBSpectrum( _mm_sub_ps( c0.m , _mm_set1_ps( f ) ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const RGBSpectrum& c0 , const float f ){
+    return RGBSpectrum( _mm_mul_ps( c0.m , _mm_set1_ps( f ) ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const RGBSpectrum& c0 , const float f ){
+    return RGBSpectrum( _mm_div_ps( c0.m , _mm_set1_ps( f ) ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const float f , const RGBSpectrum& c0 ){
+    return RGBSpectrum( _mm_add_ps( _mm_set1_ps( f ) , c0.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const float f , const RGBSpectrum& c0 ){
+    return RGBSpectrum( _mm_sub_ps( _mm_set1_ps( f ) , c0.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const float f , const RGBSpectrum& c0 ){
+    return RGBSpectrum( _mm_mul_ps( _mm_set1_ps( f ) , c0.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const float f , const RGBSpectrum& c0 ){
+    return RGBSpectrum( _mm_div_ps( _mm_set1_ps( f ) , c0.m ) );
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator += ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    c0.m = _mm_add_ps( c0.m , c1.m );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator -= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    c0.m = _mm_sub_ps( c0.m , c1.m );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator *= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    c0.m = _mm_mul_ps( c0.m , c1.m );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator /= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    c0.m = _mm_div_ps( c0.m , c1.m );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator += ( RGBSpectrum& c0 , const float f ){
+    c0.m = _mm_add_ps( c0.m , _mm_set1_ps( f ) );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator -= ( RGBSpectrum& c0 , const float f ){
+    c0.m = _mm_sub_ps( c0.m , _mm_set1_ps( f ) );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator *= ( RGBSpectrum& c0 , const float f ){
+    c0.m = _mm_mul_ps( c0.m , _mm_set1_ps( f ) );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator /= ( RGBSpectrum& c0 , const float f ){
+    c0.m = _mm_div_ps( c0.m , _mm_set1_ps( f ) );
+    return c0;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator == ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return ( _mm_movemask_ps( _mm_cmpeq_ps( c0.m , c1.m ) ) & 0x7 ) == 0x7;
+}
+
+SORT_STATIC_FORCEINLINE RGBSpectrum operator != ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+    return ( _mm_movemask_ps( _mm_cmpeq_ps( c0.m , c1.m ) ) & 0x7 ) != 0x7;
+}
+
+#else
+
 SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
     return RGBSpectrum( c0.r + c1.r , c0.g + c1.g , c0.b + c1.b );
 }
@@ -250,4 +439,6 @@ SORT_STATIC_FORCEINLINE RGBSpectrum operator == ( const RGBSpectrum& c0 , const
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator != ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
     return ( c0.r != c1.r ) || ( c0.g != c1.g ) || ( c0.b != c1.b );
-}
\ No newline at end of file
+}
+
+#endif // SORT_SIMD_SPECTRUM
\ No newline at end of file
@@ -41,6 +41,9 @@ public:
         Close();
     }
 
+    //! @brief Values of other types, like StringID, are streamed through the overloads of StreamBase.
+    using StreamBase::operator >>;
+
     //! @brief Open a new stream file.
     //!
     //! @param filename     Name of the file to be streamed to.
@@ -70,6 +73,13 @@ public:
         return true;
     }
 
+    //! @brief Whether all data streamed from the file so far is valid.
+    //!
+    //! @return             It returns false if the file is not opened or the stream has gone beyond the end of the file.
+    bool    IsValid() const{
+        return m_file.good();
+    }
+
     //! @brief Streaming in a float number to file.
     //!
     //! @param v            Value to be loaded.
@@ -188,6 +198,13 @@ public:
         return true;
     }
 
+    //! @brief Whether all data streamed to the file so far is written.
+    //!
+    //! @return             It returns false if the file is not opened or writing to it failed, like running out of disk space.
+    SORT_FORCEINLINE bool    IsValid() const{
+        return m_file.good();
+    }
+
     //! @brief Streaming out a float number from file.
     //!
     //! @param v            Value to be saved.
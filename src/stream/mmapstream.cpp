@@ -0,0 +1,173 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "mmapstream.h"
+
+#if defined(SORT_IN_WINDOWS)
+    #include <Windows.h>
+#elif defined(SORT_IN_MAC) || defined(SORT_IN_LINUX)
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <vector>
+#endif
+
+#if defined(SORT_IN_WINDOWS)
+
+IMappedFileStream::IMappedFileStream( const std::string& filename ){
+    const auto file = CreateFileA( filename.c_str() , GENERIC_READ , FILE_SHARE_READ , nullptr , OPEN_EXISTING , FILE_FLAG_SEQUENTIAL_SCAN , nullptr );
+    if( file == INVALID_HANDLE_VALUE ){
+        slog( WARNING , STREAM , "File %s can't be loaded." , filename.c_str() );
+        return;
+    }
+    m_file = file;
+
+    LARGE_INTEGER size;
+    if( !GetFileSizeEx( file , &size ) ){
+        slog( WARNING , STREAM , "File %s can't be loaded." , filename.c_str() );
+        return;
+    }
+    m_size = (size_t)size.QuadPart;
+    m_valid = true;
+
+    // An empty file can't be mapped, there is nothing to stream from it anyway.
+    if( m_size == 0 )
+        return;
+
+    m_mapping = CreateFileMappingA( file , nullptr , PAGE_READONLY , 0 , 0 , nullptr );
+    if( m_mapping )
+        m_data = (const char*)MapViewOfFile( m_mapping , FILE_MAP_READ , 0 , 0 , 0 );
+    if( !m_data ){
+        slog( WARNING , STREAM , "File %s can't be mapped." , filename.c_str() );
+        m_size = 0;
+        m_valid = false;
+    }
+}
+
+IMappedFileStream::~IMappedFileStream(){
+    if( m_data )
+        UnmapViewOfFile( m_data );
+    if( m_mapping )
+        CloseHandle( m_mapping );
+    if( m_file )
+        CloseHandle( m_file );
+}
+
+void IMappedFileStream::AdviseRandomAccess(){
+    // There is no way to change the access pattern of a mapped view after the file is opened.
+}
+
+size_t IMappedFileStream::GetResidentSize() const{
+    return m_size;
+}
+
+void IMappedFileStream::Evict(){
+    // Unlocking pages that are not locked removes them from the working set of the process.
+    if( m_data )
+        VirtualUnlock( (void*)m_data , m_size );
+}
+
+#elif defined(SORT_IN_MAC) || defined(SORT_IN_LINUX)
+
+IMappedFileStream::IMappedFileStream( const std::string& filename ){
+    const auto fd = open( filename.c_str() , O_RDONLY );
+    if( fd == -1 ){
+        slog( WARNING , STREAM , "File %s can't be loaded." , filename.c_str() );
+        return;
+    }
+
+    struct stat st;
+    if( fstat( fd , &st ) == 0 ){
+        m_size = (size_t)st.st_size;
+        m_valid = true;
+    }
+
+    // An empty file can't be mapped, there is nothing to stream from it anyway.
+    if( m_valid && m_size > 0 ){
+        auto data = mmap( nullptr , m_size , PROT_READ , MAP_PRIVATE , fd , 0 );
+        if( data != MAP_FAILED ){
+            // The file is streamed from the beginning to the end, let the kernel read ahead aggressively.
+            madvise( data , m_size , MADV_SEQUENTIAL );
+            m_data = (const char*)data;
+        }else{
+            m_size = 0;
+            m_valid = false;
+        }
+    }
+
+#if defined(SORT_IN_LINUX)
+    // The descriptor is kept to drop pages of the file from the page cache when it is evicted.
+    if( m_data )
+        m_fd = fd;
+    else
+        close( fd );
+#else
+    // The mapping keeps the file alive, the descriptor is not needed anymore.
+    close( fd );
+#endif
+
+    if( !m_valid )
+        slog( WARNING , STREAM , "File %s can't be mapped." , filename.c_str() );
+}
+
+IMappedFileStream::~IMappedFileStream(){
+    if( m_data )
+        munmap( (void*)m_data , m_size );
+#if defined(SORT_IN_LINUX)
+    if( m_fd != -1 )
+        close( m_fd );
+#endif
+}
+
+void IMappedFileStream::AdviseRandomAccess(){
+    if( m_data )
+        madvise( (void*)m_data , m_size , MADV_RANDOM );
+}
+
+size_t IMappedFileStream::GetResidentSize() const{
+    if( !m_data )
+        return 0;
+
+    const auto page_size = (size_t)sysconf( _SC_PAGESIZE );
+    const auto page_cnt = ( m_size + page_size - 1 ) / page_size;
+#if defined(SORT_IN_MAC)
+    std::vector<char> resident( page_cnt );
+#else
+    std::vector<unsigned char> resident( page_cnt );
+#endif
+    if( mincore( (void*)m_data , m_size , resident.data() ) != 0 )
+        return m_size;
+
+    size_t resident_cnt = 0;
+    for( const auto r : resident )
+        resident_cnt += r & 1;
+    return resident_cnt * page_size;
+}
+
+void IMappedFileStream::Evict(){
+    // The mapping is private and read only, dropped pages are read from the file again when they are touched.
+    if( m_data )
+        madvise( (void*)m_data , m_size , MADV_DONTNEED );
+#if defined(SORT_IN_LINUX)
+    // Pages unmapped from the process stay in the page cache unless they are dropped explicitly.
+    if( m_fd != -1 )
+        posix_fadvise( m_fd , 0 , 0 , POSIX_FADV_DONTNEED );
+#endif
+}
+
+#endif
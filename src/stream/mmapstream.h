@@ -0,0 +1,174 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string.h>
+#include "stream.h"
+#include "core/define.h"
+
+//! @brief Streaming from a memory mapped file.
+/**
+ * IMappedFileStream maps the whole file into the address space instead of reading it through std::ifstream. Every
+ * value streamed out of it is a bounds checked copy from the mapped memory followed by a bump of the read position,
+ * there is no per value call into the C++ runtime. Large blocks of data could also be accessed in place through View
+ * without any copy at all.
+ * Reading beyond the end of the file invalidates the stream, values that can't be fully read are zero filled.
+ */
+class IMappedFileStream : public IStreamBase{
+public:
+    //! @brief Constructing from a file name.
+    //!
+    //! @param filename     Name of the file to be streamed.
+    IMappedFileStream( const std::string& filename );
+
+    //! @brief Destructor will unmap the file.
+    ~IMappedFileStream();
+
+    //! @brief Values of other types, like StringID, are streamed through the overloads of StreamBase.
+    using StreamBase::operator >>;
+
+    //! @brief Whether all data streamed from the file so far is valid.
+    //!
+    //! @return             It returns false if the file is not mapped or the stream has gone beyond the end of the file.
+    bool    IsValid() const{
+        return m_valid;
+    }
+
+    //! @brief Memory the whole file is mapped to.
+    //!
+    //! @return             Pointer to the beginning of the file, nullptr if the file is not mapped or empty.
+    const char* GetData() const{
+        return m_data;
+    }
+
+    //! @brief Size of the mapped file.
+    //!
+    //! @return             Size of the file in bytes.
+    size_t  GetSize() const{
+        return m_size;
+    }
+
+    //! @brief Tell the OS that the mapped file will be accessed randomly instead of from the beginning to the end.
+    //!
+    //! It stops the OS from reading ahead pages that are likely not needed, like when the file is paged in on demand
+    //! during rendering.
+    void    AdviseRandomAccess();
+
+    //! @brief Size of the pages of the mapped file that are currently in memory.
+    //!
+    //! @return             Resident size in bytes, the whole size of the file if it can't be queried on the platform.
+    size_t  GetResidentSize() const;
+
+    //! @brief Drop the pages of the mapped file from memory.
+    //!
+    //! The memory is still accessible, pages are read from the file again the next time they are touched.
+    void    Evict();
+
+    //! @brief Streaming in a float number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(float) );
+    }
+
+    //! @brief Streaming in an integer number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(int) );
+    }
+
+    //! @brief Streaming in an unsigned integer number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming in a string from file.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override {
+        const auto end = ( m_valid && m_pos < m_size ) ? static_cast<const char*>( memchr( m_data + m_pos , 0 , m_size - m_pos ) ) : nullptr;
+        if( !end ){
+            m_valid = false;
+            v.clear();
+            return *this;
+        }
+        v.assign( m_data + m_pos , end );
+        m_pos = end - m_data + 1;
+        return *this;
+    }
+
+    //! @brief Streaming in a boolean value from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(bool) );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override {
+        const auto src = View( size );
+        if( src )
+            memcpy( data , src , size );
+        else
+            memset( data , 0 , size );
+        return *this;
+    }
+
+    //! @brief Accessing data in the mapped file without copying it.
+    //!
+    //! The returned memory stays valid as long as the stream is alive.
+    //!
+    //! @param  size    Size of the data to be accessed in bytes.
+    //! @return         Pointer to the data, nullptr if there is not enough data left in the file.
+    const char* View( int size ) override {
+        if( !m_valid || size < 0 || (size_t)size > m_size - m_pos ){
+            m_valid = false;
+            return nullptr;
+        }
+        const auto ret = m_data + m_pos;
+        m_pos += size;
+        return ret;
+    }
+
+private:
+    const char*     m_data = nullptr;       /**< Memory the file is mapped to. */
+    size_t          m_size = 0;             /**< Size of the file in bytes. */
+    size_t          m_pos = 0;              /**< Current reading position in the file. */
+    bool            m_valid = false;        /**< Whether everything streamed so far is in the file. */
+
+#if defined(SORT_IN_WINDOWS)
+    void*           m_file = nullptr;       /**< Handle of the opened file. */
+    void*           m_mapping = nullptr;    /**< Handle of the file mapping object. */
+#elif defined(SORT_IN_LINUX)
+    int             m_fd = -1;              /**< Descriptor of the mapped file. */
+#endif
+};
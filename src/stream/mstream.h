@@ -181,6 +181,12 @@ public:
         memcpy( m_data.get() , istream.m_data.get() , istream.m_pos );
     }
 
+    //! @brief  Constructor taking over a block of memory without copying it.
+    //!
+    //! @param  data        The memory to be streamed from.
+    //! @param  size        Size of the memory in bytes.
+    OMemoryStream( std::unique_ptr<char[]> data , unsigned int size ) : m_data( std::move( data ) ) , m_capacity( size ) {}
+
     //! @brief  Resize the stream.
     //!
     //! @param  size    The new size to be resized.
@@ -277,12 +283,24 @@ public:
         if( m_pos + size > m_capacity ){
             memset( data , 0 , size );
         }else{
-            memcpy( data , m_data.get() , size );
+            memcpy( data , m_data.get() + m_pos , size );
             m_pos += size;
         }
         return *this;
     }
 
+    //! @brief Accessing data in memory without copying it.
+    //!
+    //! @param  size    Size of the data to be accessed in bytes.
+    //! @return         Pointer to the data, nullptr if there is not enough data left in the stream.
+    const char* View( int size ) override {
+        if( m_pos + size > m_capacity )
+            return nullptr;
+        const auto ret = m_data.get() + m_pos;
+        m_pos += size;
+        return ret;
+    }
+
 private:
     /**< Pointer points to the address where the memory is. */
     std::unique_ptr<char[]>     m_data = nullptr;
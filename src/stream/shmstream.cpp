@@ -0,0 +1,58 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <limits.h>
+#include "shmstream.h"
+#include "core/log.h"
+
+// The header of the shared memory, it is followed by the stream.
+struct SharedMemoryStreamHeader{
+    unsigned int    magic;      /**< SHARED_MEMORY_STREAM_MAGIC. */
+    unsigned int    size;       /**< Size of the stream in bytes. */
+};
+
+ISharedMemoryStream::ISharedMemoryStream( const std::string& name ){
+    // The size of the stream is only known after its header is mapped.
+    unsigned int size = 0;
+    {
+        PlatformSharedMemory header;
+        header.CreateSharedMemory( name , sizeof( SharedMemoryStreamHeader ) , SharedMemory_Read );
+        if( !header.sharedmemory.bytes ){
+            slog( WARNING , STREAM , "Shared memory %s can't be mapped." , name.c_str() );
+            return;
+        }
+
+        SharedMemoryStreamHeader h;
+        memcpy( &h , header.sharedmemory.bytes , sizeof( h ) );
+        if( SHARED_MEMORY_STREAM_MAGIC != h.magic || h.size > (unsigned int)INT_MAX - sizeof( h ) ){
+            slog( WARNING , STREAM , "Shared memory %s doesn't hold a stream." , name.c_str() );
+            return;
+        }
+        size = h.size;
+    }
+
+    m_sharedMemory = std::make_unique<PlatformSharedMemory>();
+    m_sharedMemory->CreateSharedMemory( name , (int)( sizeof( SharedMemoryStreamHeader ) + size ) , SharedMemory_Read );
+    if( !m_sharedMemory->sharedmemory.bytes ){
+        slog( WARNING , STREAM , "Shared memory %s can't be mapped." , name.c_str() );
+        return;
+    }
+
+    m_data = m_sharedMemory->sharedmemory.bytes + sizeof( SharedMemoryStreamHeader );
+    m_size = size;
+    m_valid = true;
+}
@@ -0,0 +1,149 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string.h>
+#include "stream.h"
+#include "core/define.h"
+#include "platform/sharedmemory/sharedmemory.h"
+
+//! @brief  Identifier at the beginning of shared memory holding a stream.
+constexpr unsigned int SHARED_MEMORY_STREAM_MAGIC = 0x4d485353;
+
+//! @brief Streaming from shared memory another process wrote a stream to.
+/**
+ * Blender exports the scene into shared memory instead of a file, so that it doesn't go through the disk before SORT
+ * loads it. The shared memory starts with a header of the magic number and the size of the stream in bytes, followed
+ * by the stream itself.
+ *
+ * Similar to IMappedFileStream, every value is a bounds checked copy from the shared memory and large blocks of data
+ * could be accessed in place through View without any copy at all. Reading beyond the end of the stream invalidates
+ * it, values that can't be fully read are zero filled.
+ */
+class ISharedMemoryStream : public IStreamBase{
+public:
+    //! @brief Constructing from the name of the shared memory.
+    //!
+    //! @param name         Name of the shared memory, it is the path of the shared file on Linux and Mac OS.
+    ISharedMemoryStream( const std::string& name );
+
+    //! @brief Values of other types, like StringID, are streamed through the overloads of StreamBase.
+    using StreamBase::operator >>;
+
+    //! @brief Whether all data streamed from the shared memory so far is valid.
+    //!
+    //! @return             It returns false if the shared memory is not mapped or the stream has gone beyond the end of it.
+    bool    IsValid() const{
+        return m_valid;
+    }
+
+    //! @brief Size of the stream in the shared memory.
+    //!
+    //! @return             Size of the stream in bytes, the header is not counted.
+    size_t  GetSize() const{
+        return m_size;
+    }
+
+    //! @brief Streaming in a float number from shared memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(float) );
+    }
+
+    //! @brief Streaming in an integer number from shared memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(int) );
+    }
+
+    //! @brief Streaming in an unsigned integer number from shared memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming in a string from shared memory.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override {
+        const auto end = ( m_valid && m_pos < m_size ) ? static_cast<const char*>( memchr( m_data + m_pos , 0 , m_size - m_pos ) ) : nullptr;
+        if( !end ){
+            m_valid = false;
+            v.clear();
+            return *this;
+        }
+        v.assign( m_data + m_pos , end );
+        m_pos = end - m_data + 1;
+        return *this;
+    }
+
+    //! @brief Streaming in a boolean value from shared memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(bool) );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override {
+        const auto src = View( size );
+        if( src )
+            memcpy( data , src , size );
+        else
+            memset( data , 0 , size );
+        return *this;
+    }
+
+    //! @brief Accessing data in the shared memory without copying it.
+    //!
+    //! The returned memory stays valid as long as the stream is alive.
+    //!
+    //! @param  size    Size of the data to be accessed in bytes.
+    //! @return         Pointer to the data, nullptr if there is not enough data left in the stream.
+    const char* View( int size ) override {
+        if( !m_valid || size < 0 || (size_t)size > m_size - m_pos ){
+            m_valid = false;
+            return nullptr;
+        }
+        const auto ret = m_data + m_pos;
+        m_pos += size;
+        return ret;
+    }
+
+private:
+    std::unique_ptr<PlatformSharedMemory>   m_sharedMemory;     /**< The mapped shared memory, including the header. */
+    const char*                             m_data = nullptr;   /**< The stream right after the header. */
+    size_t                                  m_size = 0;         /**< Size of the stream in bytes. */
+    size_t                                  m_pos = 0;          /**< Current reading position in the stream. */
+    bool                                    m_valid = false;    /**< Whether everything streamed so far is in the stream. */
+};
@@ -0,0 +1,240 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include "stream.h"
+#include "platform/socket/socket.h"
+
+//! @brief Streaming from a socket.
+/**
+ * ISocketStream streams data sent by the node connected to a socket. Data is received in chunks and buffered, since
+ * receiving values one by one would be very slow. Once the connection is lost, all values streamed are zero and the
+ * stream is not valid anymore. The socket needs to outlive the stream.
+ */
+class ISocketStream : public IStreamBase{
+public:
+    //! @brief Constructing from a connected socket.
+    //!
+    //! @param socket       Socket to receive data from.
+    ISocketStream( Socket& socket ) : m_socket( socket ) {}
+
+    //! @brief Values of other types, like Spectrum, are streamed through the overloads of StreamBase.
+    using StreamBase::operator >>;
+
+    //! @brief Whether all data streamed from the socket so far is valid.
+    //!
+    //! @return             It returns false if the connection is lost.
+    bool    IsValid() const{
+        return m_valid;
+    }
+
+    //! @brief Wait for more data sent by the connected node, data buffered already counts too.
+    //!
+    //! @param timeoutMS    Milliseconds to wait for data.
+    //! @return             Whether there is data to be streamed in time, or the connection is lost.
+    bool    WaitForData( int timeoutMS ) const{
+        return m_pos < m_size || !m_valid || m_socket.WaitForData( timeoutMS );
+    }
+
+    //! @brief Streaming in a float number from socket.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(float) );
+    }
+
+    //! @brief Streaming in an integer number from socket.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(int) );
+    }
+
+    //! @brief Streaming in an unsigned integer number from socket.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming in a string from socket.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override {
+        v = "";
+        char c = 0;
+        do{
+            Load( &c , sizeof(char) );
+            if( c == 0 )
+                break;
+            v += c;
+        }while(true);
+        return *this;
+    }
+
+    //! @brief Streaming in a boolean value from socket.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(bool) );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override {
+        while( size > 0 ){
+            if( m_pos == m_size ){
+                m_pos = 0;
+                m_size = m_valid ? m_socket.Receive( m_buffer , sizeof( m_buffer ) ) : 0;
+                if( 0 == m_size ){
+                    m_valid = false;
+                    memset( data , 0 , size );
+                    return *this;
+                }
+            }
+
+            const auto cnt = std::min( size , m_size - m_pos );
+            memcpy( data , m_buffer + m_pos , cnt );
+            m_pos += cnt;
+            data += cnt;
+            size -= cnt;
+        }
+        return *this;
+    }
+
+private:
+    Socket&     m_socket;               /**< Socket to receive data from. */
+    char        m_buffer[64 * 1024];    /**< Data received but not streamed yet. */
+    int         m_pos = 0;              /**< Position of the first byte in the buffer not streamed yet. */
+    int         m_size = 0;             /**< Number of bytes in the buffer. */
+    bool        m_valid = true;         /**< Whether the connection is still alive. */
+};
+
+//! @brief Streaming to a socket.
+/**
+ * OSocketStream streams data to the node connected to a socket. Data is buffered and only sent once the buffer is full
+ * or it is flushed, a message needs to be flushed before waiting for the reply. The socket needs to outlive the stream.
+ */
+class OSocketStream : public OStreamBase{
+public:
+    //! @brief Constructing from a connected socket.
+    //!
+    //! @param socket       Socket to send data to.
+    OSocketStream( Socket& socket ) : m_socket( socket ) {}
+
+    //! @brief Values of other types, like Spectrum, are streamed through the overloads of StreamBase.
+    using StreamBase::operator <<;
+
+    //! @brief Data not flushed yet is sent before the stream is destroyed.
+    ~OSocketStream() {
+        Flush();
+    }
+
+    //! @brief Whether all data streamed to the socket so far is sent.
+    //!
+    //! @return             It returns false if the connection is lost.
+    bool    IsValid() const{
+        return m_valid;
+    }
+
+    //! @brief Streaming out a float number to socket.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const float v) override {
+        return Write( (char*)&v , sizeof(float) );
+    }
+
+    //! @brief Streaming out an integer number to socket.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const int v) override {
+        return Write( (char*)&v , sizeof(int) );
+    }
+
+    //! @brief Streaming out an unsigned integer number to socket.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const unsigned int v) override {
+        return Write( (char*)&v , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming out a string to socket.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const std::string& v) override {
+        return Write( (char*)v.c_str() , (int)v.size() + 1 );
+    }
+
+    //! @brief Streaming out a boolean value to socket.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const bool v) override {
+        return Write( (char*)&v , sizeof(bool) );
+    }
+
+    //! @brief Writing data to stream.
+    //!
+    //! @param  data    Data to be written.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Write( char* data , int size ) override {
+        while( size > 0 ){
+            if( m_size == (int)sizeof( m_buffer ) )
+                Flush();
+
+            const auto cnt = std::min( size , (int)sizeof( m_buffer ) - m_size );
+            memcpy( m_buffer + m_size , data , cnt );
+            m_size += cnt;
+            data += cnt;
+            size -= cnt;
+        }
+        return *this;
+    }
+
+    //! @brief Send all buffered data to the socket.
+    void Flush() override{
+        if( m_size > 0 && m_valid )
+            m_valid = m_socket.Send( m_buffer , m_size );
+        m_size = 0;
+    }
+
+private:
+    Socket&     m_socket;               /**< Socket to send data to. */
+    char        m_buffer[64 * 1024];    /**< Data streamed but not sent yet. */
+    int         m_size = 0;             /**< Number of bytes in the buffer. */
+    bool        m_valid = true;         /**< Whether the connection is still alive. */
+};
@@ -186,8 +186,10 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     SORT_FORCEINLINE StreamBase&  operator >> (Matrix& v) {
+        float data[16];
         for (int i = 0; i < 16; ++i)
-            *this >> v.m[i];
+            *this >> data[i];
+        v = Matrix(data);
         return *this;
     }
 
@@ -285,6 +287,15 @@ public:
     //! @param  data    Data to be written.
     //! @param  size    Size of the data to be filled in bytes.
     StreamBase& Write( char* data , int size ) override final { sAssertMsg(false, STREAM, "Streaming in data by using OStreamBase!"); return *this; }
+
+    //! @brief Accessing the next block of data in place without copying it.
+    //!
+    //! Only streams backed by memory support it, the others return nullptr without consuming anything and the data
+    //! needs to be copied out through Load instead.
+    //!
+    //! @param  size    Size of the data to be accessed in bytes.
+    //! @return         Pointer to the data, nullptr if it is not accessible in place.
+    virtual const char* View( int size ) { return nullptr; }
 };
 
 //! @brief Streaming out data
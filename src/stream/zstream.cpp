@@ -0,0 +1,291 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "zstream.h"
+#include "core/stats.h"
+
+// The zlib compatible codec of miniz is part of tinyexr, it is compiled along with the implementation of tinyexr.
+extern "C" {
+    int             mz_compress2( unsigned char* pDest , unsigned long* pDest_len , const unsigned char* pSource , unsigned long source_len , int level );
+    int             mz_uncompress( unsigned char* pDest , unsigned long* pDest_len , const unsigned char* pSource , unsigned long source_len );
+    unsigned long   mz_compressBound( unsigned long source_len );
+}
+
+SORT_STATS_DEFINE_COUNTER(sCompressedChunks)
+SORT_STATS_DEFINE_COUNTER(sReaderStalls)
+
+SORT_STATS_COUNTER("Compressed Stream", "Decompressed Chunks", sCompressedChunks);
+SORT_STATS_COUNTER("Compressed Stream", "Reader Stalls", sReaderStalls);
+
+// Size of the header and the footer in bytes.
+static constexpr size_t HEADER_SIZE = 3 * sizeof(unsigned int);
+static constexpr size_t FOOTER_SIZE = 2 * sizeof(unsigned int);
+
+// Decompressing is a lot faster than reading from network storage, a few threads are enough to keep up with it.
+static constexpr unsigned int MAX_DECOMPRESSING_THREADS = 8;
+
+static unsigned int readUInt( const char* p ){
+    unsigned int v;
+    memcpy( &v , p , sizeof( v ) );
+    return v;
+}
+
+ICompressedFileStream::ICompressedFileStream( const std::string& filename ) : m_file( filename ){
+    if( !m_file.IsValid() )
+        return;
+
+    // Files without the magic at both ends are not compressed, the whole file is streamed as it is.
+    const auto data = m_file.GetData();
+    const auto size = m_file.GetSize();
+    m_compressed = size >= HEADER_SIZE + FOOTER_SIZE && readUInt( data ) == COMPRESSED_STREAM_MAGIC &&
+                   readUInt( data + size - sizeof(unsigned int) ) == COMPRESSED_STREAM_MAGIC;
+    if( !m_compressed ){
+        m_data = data;
+        m_size = size;
+        m_valid = true;
+        return;
+    }
+
+    if( !parseIndex() )
+        return;
+
+    const auto thread_cnt = std::min( { std::max( 1u , std::thread::hardware_concurrency() ) , MAX_DECOMPRESSING_THREADS , (unsigned int)m_chunks.size() } );
+    const auto slot_cnt = 2 * thread_cnt;
+    for( auto i = 0u ; i < slot_cnt ; ++i )
+        m_slots.push_back( std::make_unique<char[]>( m_chunkSize ) );
+    m_slotChunk.resize( slot_cnt , -1 );
+    m_slotFailed.resize( slot_cnt , false );
+
+    m_valid = true;
+    for( auto i = 0u ; i < thread_cnt ; ++i )
+        m_threads.emplace_back( [this](){ decompress(); } );
+}
+
+ICompressedFileStream::~ICompressedFileStream(){
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stop = true;
+    }
+    m_slotFree.notify_all();
+    for( auto& thread : m_threads )
+        thread.join();
+}
+
+bool ICompressedFileStream::parseIndex(){
+    const auto data = m_file.GetData();
+    const auto size = m_file.GetSize();
+
+    const auto version = readUInt( data + sizeof(unsigned int) );
+    if( version != COMPRESSED_STREAM_VERSION ){
+        slog( WARNING , STREAM , "Unsupported version %u of compressed stream file." , version );
+        return false;
+    }
+    m_chunkSize = readUInt( data + 2 * sizeof(unsigned int) );
+
+    const size_t chunk_cnt = readUInt( data + size - FOOTER_SIZE );
+    const auto index_size = 2 * sizeof(unsigned int) * chunk_cnt;
+    if( size < HEADER_SIZE + FOOTER_SIZE + index_size ){
+        slog( WARNING , STREAM , "Corrupted compressed stream file." );
+        return false;
+    }
+
+    auto index = data + size - FOOTER_SIZE - index_size;
+    auto offset = HEADER_SIZE;
+    for( auto i = 0u ; i < chunk_cnt ; ++i , index += 2 * sizeof(unsigned int) ){
+        Chunk chunk;
+        chunk.data = data + offset;
+        chunk.compressedSize = readUInt( index );
+        chunk.size = readUInt( index + sizeof(unsigned int) );
+        offset += chunk.compressedSize;
+        if( chunk.size > m_chunkSize || offset > size - FOOTER_SIZE - index_size ){
+            slog( WARNING , STREAM , "Corrupted compressed stream file." );
+            return false;
+        }
+        m_chunks.push_back( chunk );
+    }
+    return true;
+}
+
+void ICompressedFileStream::decompress(){
+    const auto slot_cnt = (int)m_slots.size();
+    const auto chunk_cnt = (int)m_chunks.size();
+    while( true ){
+        int chunk_id , slot;
+        {
+            // A chunk could only be decompressed once the reader is done with the previous chunk in the same slot.
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_slotFree.wait( lock , [&](){ return m_stop || m_next >= chunk_cnt || m_next < m_current + slot_cnt; } );
+            if( m_stop || m_next >= chunk_cnt )
+                return;
+            chunk_id = m_next++;
+            slot = chunk_id % slot_cnt;
+        }
+
+        const auto& chunk = m_chunks[chunk_id];
+        unsigned long size = chunk.size;
+        const auto ret = mz_uncompress( (unsigned char*)m_slots[slot].get() , &size , (const unsigned char*)chunk.data , chunk.compressedSize );
+        SORT_STATS(++sCompressedChunks);
+
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_slotChunk[slot] = chunk_id;
+            m_slotFailed[slot] = ret != 0 || size != chunk.size;
+        }
+        m_chunkReady.notify_all();
+    }
+}
+
+bool ICompressedFileStream::nextChunk(){
+    if( m_current + 1 >= (int)m_chunks.size() )
+        return false;
+
+    const auto slot = ( m_current + 1 ) % (int)m_slots.size();
+    bool failed = false;
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        ++m_current;
+        if( m_slotChunk[slot] != m_current )
+            SORT_STATS(++sReaderStalls);
+        m_chunkReady.wait( lock , [&](){ return m_slotChunk[slot] == m_current; } );
+        failed = m_slotFailed[slot];
+    }
+    m_slotFree.notify_all();
+
+    if( failed ){
+        slog( WARNING , STREAM , "Failed to decompress chunk %d of the compressed stream file." , m_current );
+        return false;
+    }
+
+    m_data = m_slots[slot].get();
+    m_size = m_chunks[m_current].size;
+    m_pos = 0;
+    return true;
+}
+
+StreamBase& ICompressedFileStream::operator >> (std::string& v){
+    v.clear();
+    while( m_valid ){
+        const auto begin = m_data + m_pos;
+        const auto end = m_pos < m_size ? static_cast<const char*>( memchr( begin , 0 , m_size - m_pos ) ) : nullptr;
+        if( end ){
+            v.append( begin , end );
+            m_pos = end - m_data + 1;
+            return *this;
+        }
+
+        // The string continues in the next chunk.
+        v.append( begin , m_size - m_pos );
+        m_pos = m_size;
+        if( !nextChunk() )
+            m_valid = false;
+    }
+    v.clear();
+    return *this;
+}
+
+StreamBase& ICompressedFileStream::Load( char* data , int size ){
+    while( size > 0 && m_valid ){
+        if( m_pos == m_size && !nextChunk() ){
+            m_valid = false;
+            break;
+        }
+
+        const auto copy = std::min( (size_t)size , m_size - m_pos );
+        memcpy( data , m_data + m_pos , copy );
+        m_pos += copy;
+        data += copy;
+        size -= (int)copy;
+    }
+
+    if( size > 0 )
+        memset( data , 0 , size );
+    return *this;
+}
+
+const char* ICompressedFileStream::View( int size ){
+    if( !m_valid || size < 0 )
+        return nullptr;
+    if( m_pos == m_size && size > 0 && !nextChunk() ){
+        m_valid = false;
+        return nullptr;
+    }
+    if( (size_t)size > m_size - m_pos )
+        return nullptr;
+
+    const auto ret = m_data + m_pos;
+    m_pos += size;
+    return ret;
+}
+
+OCompressedFileStream::OCompressedFileStream( const std::string& filename , unsigned int chunkSize ) : m_chunkSize( std::max( 1u , chunkSize ) ){
+    m_file.open( filename , std::ios::out | std::ios::binary );
+    if( !m_file.is_open() ){
+        slog( WARNING , STREAM , "File %s can't be created." , filename.c_str() );
+        return;
+    }
+
+    const unsigned int header[] = { COMPRESSED_STREAM_MAGIC , COMPRESSED_STREAM_VERSION , m_chunkSize };
+    m_file.write( (const char*)header , sizeof( header ) );
+    m_pending.reserve( m_chunkSize );
+}
+
+StreamBase& OCompressedFileStream::Write( char* data , int size ){
+    while( size > 0 ){
+        const auto copy = std::min( (unsigned int)size , m_chunkSize - (unsigned int)m_pending.size() );
+        m_pending.insert( m_pending.end() , data , data + copy );
+        data += copy;
+        size -= copy;
+        if( m_pending.size() == m_chunkSize )
+            flushChunk();
+    }
+    return *this;
+}
+
+void OCompressedFileStream::flushChunk(){
+    if( m_pending.empty() )
+        return;
+
+    unsigned long size = mz_compressBound( (unsigned long)m_pending.size() );
+    auto compressed = std::make_unique<unsigned char[]>( size );
+    if( mz_compress2( compressed.get() , &size , (const unsigned char*)m_pending.data() , (unsigned long)m_pending.size() , 1 ) != 0 ){
+        slog( WARNING , STREAM , "Failed to compress stream data." );
+        m_file.setstate( std::ios::failbit );
+        return;
+    }
+
+    m_file.write( (const char*)compressed.get() , size );
+    m_index.push_back( (unsigned int)size );
+    m_index.push_back( (unsigned int)m_pending.size() );
+    m_pending.clear();
+}
+
+bool OCompressedFileStream::Close(){
+    if( !m_file.is_open() )
+        return false;
+
+    flushChunk();
+    if( !m_index.empty() )
+        m_file.write( (const char*)m_index.data() , m_index.size() * sizeof( unsigned int ) );
+    const unsigned int footer[] = { (unsigned int)( m_index.size() / 2 ) , COMPRESSED_STREAM_MAGIC };
+    m_file.write( (const char*)footer , sizeof( footer ) );
+
+    const auto ret = m_file.good();
+    m_file.close();
+    return ret;
+}
@@ -0,0 +1,261 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <fstream>
+#include <condition_variable>
+#include "stream.h"
+#include "stream/mmapstream.h"
+
+//! @brief  Identifier at both the beginning and the end of a compressed stream file.
+constexpr unsigned int COMPRESSED_STREAM_MAGIC = 0x5a524f53;
+//! @brief  This needs to be updated every time the layout of compressed stream files changes.
+constexpr unsigned int COMPRESSED_STREAM_VERSION = 0;
+
+//! @brief Streaming from a compressed file.
+/**
+ * A compressed stream file is made of the header, the zlib compressed chunks of the original stream one after another,
+ * the size of each chunk before and after compression and the footer.
+ *
+ *   header : magic, version, maximum size of uncompressed chunks
+ *   chunks : compressed data
+ *   index  : compressed size and uncompressed size of each chunk
+ *   footer : chunk count, magic
+ *
+ * The file is mapped into memory and background threads decompress the chunks ahead of the reader, the reader only
+ * waits if it catches up with them. Files that are not compressed are streamed from the mapped memory as they are, so
+ * it could be used to stream any input file.
+ */
+class ICompressedFileStream : public IStreamBase{
+public:
+    //! @brief Constructing from a file name.
+    //!
+    //! @param filename     Name of the file to be streamed.
+    ICompressedFileStream( const std::string& filename );
+
+    //! @brief Destructor waits for the decompressing threads.
+    ~ICompressedFileStream();
+
+    //! @brief Values of other types, like StringID, are streamed through the overloads of StreamBase.
+    using StreamBase::operator >>;
+
+    //! @brief Whether all data streamed from the file so far is valid.
+    //!
+    //! @return             It returns false if the file can't be loaded, it is corrupted or the stream has gone beyond
+    //!                     the end of it.
+    bool    IsValid() const{
+        return m_valid;
+    }
+
+    //! @brief Whether the file is compressed.
+    //!
+    //! @return             It returns true if the file is a compressed stream file.
+    bool    IsCompressed() const{
+        return m_compressed;
+    }
+
+    //! @brief Streaming in a float number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(float) );
+    }
+
+    //! @brief Streaming in an integer number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(int) );
+    }
+
+    //! @brief Streaming in an unsigned integer number from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming in a string from file.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override;
+
+    //! @brief Streaming in a boolean value from file.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return Load( reinterpret_cast<char*>(&v) , sizeof(bool) );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override;
+
+    //! @brief Accessing data without copying it, it is only possible if the data doesn't cross chunks.
+    //!
+    //! The returned memory stays valid until anything else is streamed from the stream.
+    //!
+    //! @param  size    Size of the data to be accessed in bytes.
+    //! @return         Pointer to the data, nullptr if it is not accessible in place.
+    const char* View( int size ) override;
+
+private:
+    //! @brief  A compressed chunk in the file.
+    struct Chunk{
+        const char*     data;               /**< Compressed data in the mapped file. */
+        unsigned int    compressedSize;     /**< Size of the compressed data in bytes. */
+        unsigned int    size;               /**< Size of the data after decompression in bytes. */
+    };
+
+    //! @brief  Parse the header, the index and the footer of a compressed file.
+    //!
+    //! @return         Whether the file is a valid compressed stream file.
+    bool    parseIndex();
+
+    //! @brief  Move to the next chunk, it waits until the chunk is decompressed.
+    //!
+    //! @return         Whether there is a valid chunk left.
+    bool    nextChunk();
+
+    //! @brief  Loop of the decompressing threads.
+    void    decompress();
+
+    IMappedFileStream                       m_file;             /**< The mapped file. */
+    bool                                    m_compressed = false;  /**< Whether the file is compressed. */
+    std::vector<Chunk>                      m_chunks;           /**< Chunks in the file, empty if it is not compressed. */
+    unsigned int                            m_chunkSize = 0;    /**< Maximum size of a chunk after decompression. */
+
+    const char*                             m_data = nullptr;   /**< Data of the chunk being read. */
+    size_t                                  m_size = 0;         /**< Size of the chunk being read. */
+    size_t                                  m_pos = 0;          /**< Reading position in the chunk being read. */
+    bool                                    m_valid = false;    /**< Whether everything streamed so far is valid. */
+
+    std::vector<std::unique_ptr<char[]>>    m_slots;            /**< Buffers of the decompressed chunks ahead of the reader. */
+    std::vector<int>                        m_slotChunk;        /**< Chunk decompressed in each slot, -1 if it is not ready. */
+    std::vector<bool>                       m_slotFailed;       /**< Whether decompressing the chunk in each slot failed. */
+    int                                     m_current = -1;     /**< Index of the chunk being read. */
+    int                                     m_next = 0;         /**< Index of the next chunk to be decompressed. */
+    bool                                    m_stop = false;     /**< Whether the decompressing threads should quit. */
+    std::mutex                              m_mutex;            /**< Mutex protecting the states shared with the threads. */
+    std::condition_variable                 m_chunkReady;       /**< Signaled when a chunk is decompressed. */
+    std::condition_variable                 m_slotFree;         /**< Signaled when the reader moves to the next chunk. */
+    std::vector<std::thread>                m_threads;          /**< The decompressing threads. */
+};
+
+//! @brief Streaming to a compressed file.
+/**
+ * OCompressedFileStream writes the layout read by ICompressedFileStream. Data is compressed chunk by chunk when a chunk
+ * is full, so only one chunk is kept in memory.
+ */
+class OCompressedFileStream : public OStreamBase{
+public:
+    //! @brief Constructing from a file name.
+    //!
+    //! @param filename     Name of the file to be streamed to.
+    //! @param chunkSize    Size of the chunks before compression.
+    OCompressedFileStream( const std::string& filename , unsigned int chunkSize = 4u * 1024u * 1024u );
+
+    //! @brief Destructor will close the file.
+    ~OCompressedFileStream() {
+        Close();
+    }
+
+    //! @brief Compress the remaining data and write the index of the chunks.
+    //!
+    //! @return             It returns true if there was an open file and everything is written to it.
+    bool    Close();
+
+    //! @brief Whether all data streamed to the file so far is written.
+    //!
+    //! @return             It returns false if the file is not opened or writing to it failed.
+    bool    IsValid() const{
+        return m_file.good();
+    }
+
+    //! @brief Streaming out a float number to file.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const float v) override {
+        return Write( (char*)&v , sizeof(float) );
+    }
+
+    //! @brief Streaming out an integer number to file.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const int v) override {
+        return Write( (char*)&v , sizeof(int) );
+    }
+
+    //! @brief Streaming out an unsigned integer number to file.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const unsigned int v) override {
+        return Write( (char*)&v , sizeof(unsigned int) );
+    }
+
+    //! @brief Streaming out a string to file.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const std::string& v) override {
+        return Write( (char*)v.c_str() , (int)v.size() + 1 );
+    }
+
+    //! @brief Streaming out a boolean value to file.
+    //!
+    //! @param v            Value to be saved.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator << (const bool v) override {
+        return Write( (char*)&v , sizeof(bool) );
+    }
+
+    //! @brief Writing data to stream.
+    //!
+    //! @param  data    Data to be written.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Write( char* data , int size ) override;
+
+private:
+    //! @brief  Compress the pending data as a chunk and write it.
+    void    flushChunk();
+
+    std::ofstream               m_file;         /**< File to be streamed to. */
+    const unsigned int          m_chunkSize;    /**< Size of the chunks before compression. */
+    std::vector<char>           m_pending;      /**< Data not compressed yet. */
+    std::vector<unsigned int>   m_index;        /**< Compressed size and uncompressed size of the written chunks. */
+};
@@ -0,0 +1,268 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <random>
+#include <vector>
+#include "benchmark_task.h"
+#include "core/scene.h"
+#include "core/timer.h"
+#include "core/memory.h"
+#include "core/globalconfig.h"
+#include "accel/accelerator.h"
+#include "light/light.h"
+#include "material/material.h"
+#include "sampler/sample.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
+
+#if defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+    #include <psapi.h>
+#elif defined(SORT_IN_MAC)
+    #include <mach/mach.h>
+#elif defined(SORT_IN_LINUX)
+    #include <stdio.h>
+    #include <unistd.h>
+    #include <malloc.h>
+#endif
+
+namespace {
+    //! @brief  Acceleration structures to be benchmarked.
+    const char* BENCHMARK_ACCELERATORS[] = { "Bvh" , "Lbvh" , "Qbvh" , "Obvh" , "Hbvh" , "KDTree" , "OcTree" , "UniGrid" , "Embree" };
+
+    //! @brief  Seed of the random number generator that generates the ray sets.
+    constexpr unsigned BENCHMARK_SEED = 0x5eed;
+
+    //! @brief  Each ray set is traced again and again until it takes at least this long, in milliseconds.
+    constexpr unsigned BENCHMARK_MIN_TIME_MS = 200;
+
+    //! @brief  Radius of BSSRDF probe rays, relative to the diagonal of the scene bounding box.
+    constexpr float BENCHMARK_BSSRDF_PROBE_RADIUS = 0.002f;
+
+    //! @brief  Offset of secondary ray origins to avoid self intersection.
+    constexpr float BENCHMARK_RAY_OFFSET = 0.0001f;
+
+    //! @brief  A BSSRDF probe ray only finds intersections with primitives sharing the same material.
+    struct BSSRDF_Probe{
+        Ray         ray;                    /**< The probe ray. */
+        StringID    matID = INVALID_SID;    /**< Material of the primitive where the probe ray is generated. */
+    };
+
+    //! @brief  All ray sets that every acceleration structure is traced with.
+    struct Benchmark_Rays{
+        std::vector<Ray>            primary;    /**< Camera rays, one for each pixel. */
+        std::vector<Ray>            diffuse;    /**< Rays bounced off primary hits with cosine distribution. */
+        std::vector<Ray>            shadow;     /**< Rays from primary hits towards sampled points on lights. */
+        std::vector<BSSRDF_Probe>   bssrdf;     /**< BSSRDF probe rays around primary hits. */
+    };
+
+    //! @brief  Resident memory of the current process in bytes.
+    //!
+    //! Freed memory is returned to the system first where it is possible, so that the memory of a newly built
+    //! structure shows up as growth of the resident memory instead of reusing the freed pages.
+    //!
+    //! @return     Resident memory in bytes, 0 if it is not supported on the platform.
+    size_t residentMemory(){
+    #if defined(SORT_IN_WINDOWS)
+        PROCESS_MEMORY_COUNTERS pmc;
+        if( GetProcessMemoryInfo( GetCurrentProcess() , &pmc , sizeof( pmc ) ) )
+            return pmc.WorkingSetSize;
+    #elif defined(SORT_IN_MAC)
+        mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+        if( task_info( mach_task_self() , MACH_TASK_BASIC_INFO , (task_info_t)&info , &count ) == KERN_SUCCESS )
+            return info.resident_size;
+    #elif defined(SORT_IN_LINUX)
+        #ifdef __GLIBC__
+        malloc_trim( 0 );
+        #endif
+        size_t pages = 0 , resident = 0;
+        if( auto file = fopen( "/proc/self/statm" , "r" ) ){
+            const auto read = fscanf( file , "%zu %zu" , &pages , &resident );
+            fclose( file );
+            if( read == 2 )
+                return resident * (size_t)sysconf( _SC_PAGESIZE );
+        }
+    #endif
+        return 0;
+    }
+
+    //! @brief  Generate all ray sets from the camera of the scene.
+    //!
+    //! Primary rays are traced against the given acceleration structure, secondary rays are generated at the hits.
+    //!
+    //! @param  scene   The scene to generate rays for.
+    //! @param  accel   A built acceleration structure of the scene.
+    //! @param  rays    The generated ray sets.
+    void generateRays( const Scene& scene , const Accelerator& accel , Benchmark_Rays& rays ){
+        std::mt19937 rng( BENCHMARK_SEED );
+        std::uniform_real_distribution<float> dist( 0.0f , 1.0f );
+        const auto canonical = [&](){ return dist( rng ); };
+
+        const auto camera = scene.GetCamera();
+        if( IS_PTR_INVALID( camera ) )
+            return;
+
+        const auto probe_radius = BENCHMARK_BSSRDF_PROBE_RADIUS * ( scene.GetBBox().m_Max - scene.GetBBox().m_Min ).Length();
+        const auto width = g_resultResollutionWidth;
+        const auto height = g_resultResollutionHeight;
+        for( auto y = 0 ; y < height ; ++y ){
+            for( auto x = 0 ; x < width ; ++x ){
+                PixelSample ps;
+                ps.img_u = canonical();
+                ps.img_v = canonical();
+                ps.dof_u = canonical();
+                ps.dof_v = canonical();
+                const auto ray = camera->GenerateRay( (float)x , (float)y , ps );
+                rays.primary.push_back( ray );
+
+                SurfaceInteraction inter;
+                if( !accel.GetIntersect( ray , inter ) )
+                    continue;
+
+                // shading frame facing the camera
+                const auto n = dot( inter.normal , ray.m_Dir ) > 0.0f ? -inter.normal : inter.normal;
+                const auto t = inter.tangent;
+                const auto b = cross( n , t );
+
+                const auto local = CosSampleHemisphere( canonical() , canonical() );
+                rays.diffuse.push_back( Ray( inter.intersect , t * local.x + n * local.y + b * local.z , 0 , BENCHMARK_RAY_OFFSET ) );
+
+                if( scene.LightNum() > 0 ){
+                    float pdf = 0.0f;
+                    const auto light = scene.SampleLight( canonical() , &pdf );
+                    if( IS_PTR_VALID( light ) ){
+                        LightSample ls;
+                        ls.t = canonical();
+                        ls.u = canonical();
+                        ls.v = canonical();
+
+                        Vector wi;
+                        float pdfw = 0.0f;
+                        Visibility visibility( scene );
+                        light->sample_l( inter.intersect , &ls , wi , nullptr , &pdfw , nullptr , nullptr , visibility );
+                        visibility.ray.m_time = inter.time;
+                        if( pdfw > 0.0f ){
+                            visibility.ray.m_fMin = std::max( visibility.ray.m_fMin , BENCHMARK_RAY_OFFSET );
+                            rays.shadow.push_back( visibility.ray );
+                        }
+                    }
+                }
+
+                // the probe ray goes through a sphere around the hit along the normal, the same way BSSRDF samples it
+                const auto r = probe_radius * sqrt( canonical() );
+                const auto l = 2.0f * sqrt( SQR( probe_radius ) - SQR( r ) );
+                const auto phi = TWO_PI * canonical();
+                const auto source = inter.intersect + r * ( t * cos( phi ) + b * sin( phi ) ) + l * n * 0.5f;
+
+                BSSRDF_Probe probe;
+                probe.ray = Ray( source , -n , 0 , BENCHMARK_RAY_OFFSET , l );
+                probe.matID = inter.primitive->GetMaterial()->GetUniqueID();
+                rays.bssrdf.push_back( probe );
+            }
+        }
+    }
+
+    //! @brief  Trace a ray set again and again until it takes long enough to be measured.
+    //!
+    //! @param  rays    The ray set to be traced.
+    //! @param  trace   Function to trace one ray.
+    //! @return         Ray throughput in million rays per second.
+    template< class T , class F >
+    float traceRays( const std::vector<T>& rays , F&& trace ){
+        if( rays.empty() )
+            return 0.0f;
+
+        Timer timer;
+        auto passes = 0ull;
+        do{
+            for( const auto& ray : rays )
+                trace( ray );
+            ++passes;
+        }while( timer.GetElapsedTime() < BENCHMARK_MIN_TIME_MS );
+
+        return (float)( passes * rays.size() ) / ( 1000.0f * (float)timer.GetElapsedTime() );
+    }
+}
+
+void Benchmark_Task::Execute(){
+    const auto& primitives = m_scene.GetPrimitives();
+    const auto& bbox = m_scene.GetBBox();
+
+    slog( INFO , PERFORMANCE , "Benchmarking spatial acceleration structures with %d primitives." , (int)primitives.size() );
+
+    // The ray sets are generated with a separate structure before benchmarking, they are shared by all structures.
+    Benchmark_Rays rays;
+    {
+        auto accel = MakeUniqueInstance<Accelerator>( StringID( BENCHMARK_ACCELERATORS[0] ) );
+        accel->Build( primitives , bbox );
+        generateRays( m_scene , *accel , rays );
+    }
+
+    slog( INFO , PERFORMANCE , "Ray sets: %d primary, %d diffuse, %d shadow, %d BSSRDF probe rays." ,
+          (int)rays.primary.size() , (int)rays.diffuse.size() , (int)rays.shadow.size() , (int)rays.bssrdf.size() );
+    slog( INFO , PERFORMANCE , "%-10s %12s %12s %12s %12s %12s %12s" , "Structure" , "Build (ms)" , "Memory (MB)" ,
+          "Primary" , "Diffuse" , "Shadow" , "BSSRDF" );
+
+    for( const auto name : BENCHMARK_ACCELERATORS ){
+        // No fallback here, an accelerator that can't run on this CPU is skipped instead of being measured twice.
+        const auto isa = AcceleratorSimdIsa( StringID( name ) );
+        if( !IsSimdIsaSupported( isa ) ){
+            slog( INFO , PERFORMANCE , "%-10s skipped, %s is not supported by the CPU." , name , SimdIsaName( isa ) );
+            continue;
+        }
+
+        auto accel = MakeUniqueInstance<Accelerator>( StringID( name ) );
+        if( IS_PTR_INVALID( accel ) )
+            continue;
+
+        const auto memory_before = residentMemory();
+        Timer timer;
+        accel->Build( primitives , bbox );
+        const auto build_time = timer.GetElapsedTime();
+        const auto memory_after = residentMemory();
+        const auto memory = memory_after > memory_before ? memory_after - memory_before : 0;
+
+        const auto primary = traceRays( rays.primary , [&]( const Ray& ray ){
+            SurfaceInteraction inter;
+            accel->GetIntersect( ray , inter );
+        });
+        const auto diffuse = traceRays( rays.diffuse , [&]( const Ray& ray ){
+            SurfaceInteraction inter;
+            accel->GetIntersect( ray , inter );
+        });
+        const auto shadow = traceRays( rays.shadow , [&]( const Ray& ray ){
+        #ifndef ENABLE_TRANSPARENT_SHADOW
+            accel->IsOccluded( ray );
+        #else
+            // only the first blocker is needed to tell the occlusion
+            Ray r = ray;
+            Spectrum attenuation;
+            accel->GetAttenuation( r , attenuation );
+        #endif
+        });
+        const auto bssrdf = traceRays( rays.bssrdf , [&]( const BSSRDF_Probe& probe ){
+            BSSRDFIntersections inter;
+            accel->GetIntersect( probe.ray , inter , probe.matID );
+            SORT_CLEAR_MEMPOOL();
+        });
+
+        slog( INFO , PERFORMANCE , "%-10s %12d %12.2f %12.3f %12.3f %12.3f %12.3f" , name , (int)build_time ,
+              (float)memory / ( 1024.0f * 1024.0f ) , primary , diffuse , shadow , bssrdf );
+    }
+
+    slog( INFO , PERFORMANCE , "Ray throughput is in million rays per second, rays are traced on a single thread." );
+}
@@ -0,0 +1,46 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "task.h"
+
+//! @brief  Benchmark_Task measures all spatial acceleration structures on the loaded scene.
+/**
+ * Each acceleration structure is built with its default configuration and then traced with the same ray sets,
+ * primary rays, diffuse bounce rays, shadow rays and BSSRDF probe rays. The ray sets are generated with a fixed
+ * seed so that numbers are comparable across runs. Build time, memory and ray throughput of each structure are
+ * reported in the log.
+ * Construction is done on all worker threads, the same way as it is during rendering, while rays are traced on
+ * the current thread only so that the throughput is not affected by other running tasks.
+ */
+class Benchmark_Task : public Task{
+public:
+    //! @brief Constructor.
+    //!
+    //! @param  scene     Scene to be benchmarked, it should be loaded already.
+    Benchmark_Task( const class Scene& scene , const char* name , unsigned int priority ,
+                    const Task::Task_Container& dependencies ) :
+        Task( name , DEFAULT_TASK_PRIORITY , dependencies ) , m_scene(scene) {}
+
+    //! @brief  Benchmark all spatial acceleration structures.
+    void        Execute() override;
+
+private:
+    /**< The scene to be benchmarked. */
+    const class Scene&      m_scene;
+};
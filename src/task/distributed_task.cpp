@@ -0,0 +1,259 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include "distributed_task.h"
+#include "core/globalconfig.h"
+#include "core/stats.h"
+#include "core/log.h"
+#include "stream/socketstream.h"
+
+SORT_STATS_DEFINE_COUNTER(sRemoteTileCnt)
+SORT_STATS_DEFINE_COUNTER(sDuplicatedTileCnt)
+SORT_STATS_DEFINE_COUNTER(sLostWorkerCnt)
+
+SORT_STATS_COUNTER("Distributed Rendering", "Tiles rendered by this node for others", sRemoteTileCnt);
+SORT_STATS_COUNTER("Distributed Rendering", "Tiles rendered more than once", sDuplicatedTileCnt);
+SORT_STATS_COUNTER("Distributed Rendering", "Lost workers", sLostWorkerCnt);
+
+// Identifier of the messages between the coordinator and workers.
+static constexpr unsigned   DISTRIBUTED_MAGIC   = 0x54524f53;
+// This needs to be updated every time the protocol changes.
+static constexpr unsigned   DISTRIBUTED_VERSION = 1;
+
+namespace {
+    // Size of a tile, tiles on the right and bottom edges could be smaller.
+    Vector2i tileSize( const Vector2i& topLeft ){
+        const auto tile_size = (int)g_tileSize;
+        return Vector2i( std::min( tile_size , g_resultResollutionWidth - topLeft.x ) , std::min( tile_size , g_resultResollutionHeight - topLeft.y ) );
+    }
+
+    // Split 'host:port' in two.
+    bool parseAddress( const std::string& address , std::string& host , unsigned short& port ){
+        const auto pos = address.rfind( ':' );
+        if( std::string::npos == pos || 0 == pos )
+            return false;
+        host = address.substr( 0 , pos );
+        port = (unsigned short)atoi( address.substr( pos + 1 ).c_str() );
+        return 0 != port;
+    }
+
+    enum class TileState : int {
+        Pending = 0,    /**< The tile is not handed out, or the worker rendering it is lost. */
+        Rendering,      /**< The tile is handed out to at least one worker. */
+        Done,           /**< The tile is in the image. */
+    };
+
+    // Tiles shared by all threads talking to workers on the coordinator.
+    struct Coordinator{
+        const std::vector<Vector2i>&        tiles;
+        std::vector<TileState>              states;
+        unsigned                            doneCnt = 0;
+        std::vector<Socket*>                connections;
+        std::mutex                          mutex;
+
+        Coordinator( const std::vector<Vector2i>& tiles ) : tiles( tiles ) , states( tiles.size() , TileState::Pending ) {}
+
+        // The next range of tiles to be rendered by a worker, the first run of pending tiles if there is one, otherwise the
+        // first run of tiles rendered by other workers. An empty range means all tiles are done.
+        void nextRange( unsigned maxCnt , unsigned& begin , unsigned& end ){
+            std::lock_guard<std::mutex> lock( mutex );
+            const auto cnt = (unsigned)tiles.size();
+            begin = end = cnt;
+            for( const auto state : { TileState::Pending , TileState::Rendering } ){
+                begin = (unsigned)( std::find( states.begin() , states.end() , state ) - states.begin() );
+                if( begin == cnt )
+                    continue;
+                for( end = begin ; end < cnt && end - begin < maxCnt && states[end] == state ; ++end )
+                    states[end] = TileState::Rendering;
+                SORT_STATS(sDuplicatedTileCnt += ( state == TileState::Rendering ) ? ( end - begin ) : 0);
+                return;
+            }
+            begin = end = cnt;
+        }
+
+        // Tiles of a lost worker are handed out again, unless they are done by others already.
+        void releaseRange( unsigned begin , unsigned end ){
+            std::lock_guard<std::mutex> lock( mutex );
+            for( auto i = begin ; i < end ; ++i )
+                if( TileState::Rendering == states[i] )
+                    states[i] = TileState::Pending;
+        }
+
+        // Store tiles sent by a worker, tiles that arrived already from other workers are skipped.
+        void storeRange( unsigned begin , unsigned end , const std::vector<Spectrum>& radiance ){
+            std::lock_guard<std::mutex> lock( mutex );
+            auto offset = 0;
+            for( auto i = begin ; i < end ; ++i ){
+                const auto size = tileSize( tiles[i] );
+                if( TileState::Done != states[i] ){
+                    g_imageSensor->StoreRemoteTile( tiles[i] , size , radiance.data() + offset );
+                    states[i] = TileState::Done;
+                    ++doneCnt;
+                }
+                offset += size.x * size.y;
+            }
+        }
+
+        bool isDone(){
+            std::lock_guard<std::mutex> lock( mutex );
+            return doneCnt == tiles.size();
+        }
+    };
+
+    // Talk to a worker until all tiles are done or the worker is lost.
+    void talkToWorker( Coordinator& coordinator , Socket& socket ){
+        ISocketStream in( socket );
+        OSocketStream out( socket );
+
+        // Make sure the worker renders the same image before handing out anything to it.
+        unsigned magic = 0 , version = 0 , tile_size = 0 , spp = 0 , tile_cnt = 0 , thread_cnt = 0;
+        int w = 0 , h = 0;
+        in >> magic >> version >> w >> h >> tile_size >> spp >> tile_cnt >> thread_cnt;
+        if( !in.IsValid() || DISTRIBUTED_MAGIC != magic || DISTRIBUTED_VERSION != version || g_resultResollutionWidth != w ||
+            g_resultResollutionHeight != h || g_tileSize != tile_size || g_samplePerPixel != spp || coordinator.tiles.size() != tile_cnt ){
+            slog( WARNING , GENERAL , "A worker rendering a different image is rejected." );
+            return;
+        }
+
+        // Each worker renders as many tiles at a time as its threads, so that none of its threads is idle.
+        const auto range_cnt = std::max( thread_cnt , 1u );
+        std::vector<Spectrum> radiance;
+        while( true ){
+            unsigned begin = 0 , end = 0;
+            coordinator.nextRange( range_cnt , begin , end );
+
+            out << begin << end;
+            out.Flush();
+            if( begin == end || !out.IsValid() ){
+                coordinator.releaseRange( begin , end );
+                break;
+            }
+
+            unsigned result_begin = 0 , result_end = 0;
+            in >> result_begin >> result_end;
+            radiance.clear();
+            for( auto i = begin ; i < end && result_begin == begin && result_end == end ; ++i ){
+                const auto size = tileSize( coordinator.tiles[i] );
+                const auto offset = radiance.size();
+                radiance.resize( offset + size.x * size.y );
+                for( auto p = offset ; p < radiance.size() ; ++p )
+                    in >> radiance[p];
+            }
+
+            if( !in.IsValid() || result_begin != begin || result_end != end ){
+                SORT_STATS(++sLostWorkerCnt);
+                slog( WARNING , GENERAL , "A worker is lost, its tiles will be rendered by others." );
+                coordinator.releaseRange( begin , end );
+                break;
+            }
+            coordinator.storeRange( begin , end , radiance );
+        }
+    }
+
+    // Serve a worker on its own thread, the socket is taken out of the connections however talking to it ends, before
+    // it is destroyed, so that the coordinator never shuts down a socket that is gone.
+    void serveWorker( Coordinator& coordinator , std::unique_ptr<Socket> socket ){
+        talkToWorker( coordinator , *socket );
+
+        std::lock_guard<std::mutex> lock( coordinator.mutex );
+        coordinator.connections.erase( std::find( coordinator.connections.begin() , coordinator.connections.end() , socket.get() ) );
+    }
+}
+
+void DistributedRender_Task::Execute(){
+    std::string host;
+    unsigned short port = 0;
+    if( !parseAddress( g_coordinatorAddress , host , port ) ){
+        slog( WARNING , GENERAL , "Invalid address of the coordinator %s, it should be 'host:port'." , g_coordinatorAddress.c_str() );
+        return;
+    }
+
+    Socket socket;
+    if( !socket.Connect( host , port ) )
+        return;
+
+    ISocketStream in( socket );
+    OSocketStream out( socket );
+    out << DISTRIBUTED_MAGIC << DISTRIBUTED_VERSION << g_resultResollutionWidth << g_resultResollutionHeight;
+    out << g_tileSize << g_samplePerPixel << (unsigned)m_tiles.size() << g_threadCnt;
+    out.Flush();
+    slog( INFO , GENERAL , "Connected to the coordinator %s." , g_coordinatorAddress.c_str() );
+
+    while( !IsCancelled() ){
+        unsigned begin = 0 , end = 0;
+        in >> begin >> end;
+        if( !in.IsValid() || begin >= end || end > m_tiles.size() )
+            break;
+
+        m_scheduleRange( begin , end );
+        WAIT_FOR_CHILDREN();
+        if( IsCancelled() )
+            break;
+
+        // Tiles are sent row by row, in the same order as they are handed out.
+        const auto& rt = g_imageSensor->GetRenderTarget();
+        out << begin << end;
+        for( auto i = begin ; i < end ; ++i ){
+            const auto& tl = m_tiles[i];
+            const auto size = tileSize( tl );
+            for( auto y = tl.y ; y < tl.y + size.y ; ++y )
+                for( auto x = tl.x ; x < tl.x + size.x ; ++x )
+                    out << rt.GetColor( x , y );
+        }
+        out.Flush();
+        if( !out.IsValid() )
+            break;
+
+        SORT_STATS(sRemoteTileCnt += end - begin);
+    }
+
+    slog( INFO , GENERAL , "Disconnected from the coordinator %s." , g_coordinatorAddress.c_str() );
+}
+
+bool RunCoordinator( const std::vector<Vector2i>& tiles , unsigned short port ){
+    Socket listener;
+    if( !listener.Listen( port ) )
+        return false;
+    slog( INFO , GENERAL , "Waiting for workers on port %d." , port );
+
+    Coordinator coordinator( tiles );
+    std::vector<std::thread> threads;
+    while( !coordinator.isDone() ){
+        auto socket = listener.Accept( 100 );
+        if( !socket )
+            continue;
+
+        std::lock_guard<std::mutex> lock( coordinator.mutex );
+        coordinator.connections.push_back( socket.get() );
+        threads.emplace_back( serveWorker , std::ref( coordinator ) , std::move( socket ) );
+        slog( INFO , GENERAL , "A worker joins, there are %d workers." , (int)coordinator.connections.size() );
+    }
+
+    // Workers still rendering tiles done by others won't be waited for.
+    {
+        std::lock_guard<std::mutex> lock( coordinator.mutex );
+        for( auto connection : coordinator.connections )
+            connection->Shutdown();
+    }
+    for( auto& thread : threads )
+        thread.join();
+
+    return true;
+}
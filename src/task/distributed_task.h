@@ -0,0 +1,65 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include "task.h"
+#include "math/vector2.h"
+
+//! @brief  DistributedRender_Task renders tiles handed out by the coordinator on a worker node.
+//!
+//! In distributed rendering, every node loads the scene and builds the spatial accelerator itself. Once it is
+//! ready, the worker connects to the coordinator and keeps asking for ranges of tiles, in the same order as a
+//! single node would render them. Render tasks of a range are children of this task, finished tiles are sent
+//! back to the coordinator before asking for the next range. It stops once there are no tiles left, or the
+//! connection to the coordinator is lost.
+class DistributedRender_Task : public Task {
+public:
+    //! @brief  Schedule render tasks of a range of tiles, as children of the current task.
+    //!
+    //! The parameters are the index of the first tile in the range and the index after the last one.
+    using RangeScheduler = std::function<void( unsigned , unsigned )>;
+
+    //! @brief Constructor
+    //!
+    //! @param tiles            Top-left corners of all tiles in the order to be rendered.
+    //! @param scheduleRange    Callback to schedule render tasks of a range of tiles.
+    DistributedRender_Task( const std::vector<Vector2i>& tiles , const RangeScheduler& scheduleRange , const char* name ,
+                    unsigned int priority , const Task::Task_Container& dependencies ) :
+                    Task( name , priority , dependencies ), m_tiles(tiles), m_scheduleRange(scheduleRange){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    std::vector<Vector2i>   m_tiles;
+    RangeScheduler          m_scheduleRange;
+};
+
+//! @brief  Hand out tiles to worker nodes and assemble the image on the coordinator.
+//!
+//! It listens for worker nodes and hands out ranges of tiles to them until all tiles are rendered. Workers could join
+//! at any time. Tiles of a worker that is lost are handed out again, and once there are no tiles left to be handed out,
+//! idle workers render the tiles still being rendered by others, so that a node that hangs doesn't hold up the image.
+//! Whichever copy of a tile arrives first is kept.
+//!
+//! @param  tiles       Top-left corners of all tiles in the order to be rendered.
+//! @param  port        Port to listen on.
+//! @return             Whether all tiles are rendered.
+bool        RunCoordinator( const std::vector<Vector2i>& tiles , unsigned short port );
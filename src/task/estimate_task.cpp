@@ -0,0 +1,140 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <unordered_set>
+#include "estimate_task.h"
+#include "core/scene.h"
+#include "core/globalconfig.h"
+#include "core/primitive.h"
+#include "core/mesh.h"
+#include "core/memory.h"
+#include "core/rand.h"
+#include "core/stats.h"
+#include "core/perfreport.h"
+#include "camera/camera.h"
+#include "integrator/integrator.h"
+#include "sampler/sampler.h"
+#include "sampler/random.h"
+
+SORT_STATS_DECLARE_MEMORY(sQbvhMemory)
+SORT_STATS_DECLARE_MEMORY(sObvhMemory)
+SORT_STATS_DECLARE_MEMORY(sHbvhMemory)
+SORT_STATS_DECLARE_MEMORY(sTextureMemory)
+SORT_STATS_DECLARE_MEMORY(sTextureTileMemory)
+SORT_STATS_DECLARE_MEMORY(sVolumeMemory)
+
+// Current memory tracked by a counter, 0 if stats are not collected.
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    #define ESTIMATE_MEMORY( var )  ( (double)var.current.load() )
+#else
+    #define ESTIMATE_MEMORY( var )  ( 0.0 )
+#endif
+
+namespace {
+    //! @brief  Seed of the random number generator that picks the pixels to be rendered.
+    constexpr unsigned ESTIMATE_SEED = 0x5eed;
+
+    //! @brief  Each picked pixel takes at most this many samples, the cost is assumed to be linear in samples.
+    constexpr unsigned ESTIMATE_MAX_SAMPLES = 4;
+
+    //! @brief  At least this many pixels are rendered, no matter how small the fraction is.
+    constexpr unsigned ESTIMATE_MIN_PIXELS = 64;
+
+    constexpr double MB = 1024.0 * 1024.0;
+}
+
+void Estimate_Task::Execute(){
+    // Geometry is counted from the meshes referred to by primitives, a mesh is shared by all of its primitives.
+    const auto& primitives = m_scene.GetPrimitives();
+    std::unordered_set<const Mesh*> meshes;
+    auto geometry = (double)( primitives.size() * sizeof( Primitive ) );
+    for( const auto primitive : primitives ){
+        const auto mesh = primitive->GetMesh();
+        if( mesh && meshes.insert( mesh ).second )
+            geometry += (double)( mesh->m_vertices.size() * sizeof( MeshVertex ) + mesh->m_indices.size() * sizeof( MeshFaceIndex ) );
+    }
+    const auto bvh = ESTIMATE_MEMORY( sQbvhMemory ) + ESTIMATE_MEMORY( sObvhMemory ) + ESTIMATE_MEMORY( sHbvhMemory );
+    const auto textures = ESTIMATE_MEMORY( sTextureMemory ) + ESTIMATE_MEMORY( sTextureTileMemory );
+    const auto volumes = ESTIMATE_MEMORY( sVolumeMemory );
+
+    // Render a random subset of pixels, the picked pixels are spread over the whole image.
+    const auto width = g_resultResollutionWidth;
+    const auto height = g_resultResollutionHeight;
+    const auto total_pixels = (unsigned long long)width * height;
+    const auto pixel_cnt = (unsigned)std::min<unsigned long long>( total_pixels ,
+                            std::max<unsigned long long>( ESTIMATE_MIN_PIXELS , (unsigned long long)( g_estimateFraction * total_pixels ) ) );
+    const auto sample_cnt = std::max( 1u , std::min( g_samplePerPixel , ESTIMATE_MAX_SAMPLES ) );
+
+    auto sampler = MakeUniqueInstance<Sampler>( g_samplerType );
+    if( !sampler )
+        sampler = std::make_unique<RandomSampler>();
+    PixelSampleBuffer samples;
+    samples.ClearRequests();
+    g_integrator->RequestSample( sampler.get() , samples , sample_cnt );
+    samples.Reserve( sample_cnt );
+    const auto pixel_samples = samples.Samples();
+    std::vector<Ray> rays( sample_cnt );
+
+    const auto camera = m_scene.GetCamera();
+    const auto& report = PerfReport::GetSingleton();
+    const auto ray_start = report.GetThreadRayCount( false );
+    const auto start = std::chrono::steady_clock::now();
+
+    std::mt19937 rng( ESTIMATE_SEED );
+    std::uniform_int_distribution<unsigned long long> dist( 0 , total_pixels ? total_pixels - 1 : 0 );
+    for( auto i = 0u ; camera && i < pixel_cnt ; ++i ){
+        const auto pixel = dist( rng );
+        const auto x = (unsigned)( pixel % width );
+        const auto y = (unsigned)( pixel / width );
+
+        sort_seed( (unsigned)pixel , 0 );
+        sampler->StartPixel( x , y , 0 );
+        g_integrator->GenerateSample( sampler.get() , samples , sample_cnt , m_scene );
+        camera->GenerateRays( (float)x , (float)y , pixel_samples , sample_cnt , rays.data() );
+
+        for( auto k = 0u ; k < sample_cnt ; ++k ){
+            SORT_CLEAR_MEMPOOL();
+            sort_seed( (unsigned)pixel , k );
+            sampler->StartSample( k );
+            g_integrator->Li( rays[k] , pixel_samples[k] , m_scene , nullptr );
+            sampler->EndSample();
+        }
+    }
+
+    const auto seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    const auto rays_traced = report.GetThreadRayCount( false ) - ray_start;
+    const auto measured_samples = camera ? (double)pixel_cnt * sample_cnt : 0.0;
+
+    // The whole image takes all samples of all pixels, spread over all threads.
+    const auto seconds_per_sample = measured_samples > 0.0 ? seconds / measured_samples : 0.0;
+    const auto rays_per_sample = measured_samples > 0.0 ? (double)rays_traced / measured_samples : 0.0;
+    const auto total_samples = (double)total_pixels * g_samplePerPixel;
+    const auto estimated_seconds = seconds_per_sample * total_samples / std::max( 1u , g_threadCnt );
+
+    printf( "{\"width\":%u,\"height\":%u,\"spp\":%u,\"threads\":%u,\"primitives\":%zu,\"meshes\":%zu,"
+            "\"memory_mb\":{\"geometry\":%.1f,\"bvh\":%.1f,\"textures\":%.1f,\"volumes\":%.1f,\"peak\":%.1f},"
+            "\"measured_pixels\":%u,\"measured_spp\":%u,\"measured_seconds\":%.6f,\"rays_per_sample\":%.3f,"
+            "\"us_per_sample\":%.3f,\"estimated_seconds\":%.3f}\n" ,
+            width , height , g_samplePerPixel , g_threadCnt , primitives.size() , meshes.size() ,
+            geometry / MB , bvh / MB , textures / MB , volumes / MB , (double)PerfReport::GetPeakMemory() / MB ,
+            camera ? pixel_cnt : 0u , sample_cnt , seconds , rays_per_sample , seconds_per_sample * 1e6 , estimated_seconds );
+    fflush( stdout );
+}
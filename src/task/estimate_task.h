@@ -0,0 +1,46 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+#include "task.h"
+
+//! @brief  Estimate_Task estimates the cost of rendering the loaded scene without rendering it.
+/**
+ * Memory of geometry, acceleration structures, textures and volumes is gathered from what is loaded, then a sparse
+ * random subset of pixels is rendered with a few samples each. The time to render the whole image is extrapolated
+ * from the measured cost of these samples. Everything is reported as a single line of JSON so that scripts could
+ * decide whether a scene fits a machine before submitting it.
+ * Pixels are rendered on the current thread only, the estimated time assumes perfect scaling over all threads.
+ */
+class Estimate_Task : public Task{
+public:
+    //! @brief Constructor.
+    //!
+    //! @param  scene     Scene to be estimated, it should be ready for rendering already.
+    Estimate_Task( const class Scene& scene , const char* name , unsigned int priority ,
+                   const Task::Task_Container& dependencies ) :
+        Task( name , DEFAULT_TASK_PRIORITY , dependencies ) , m_scene(scene) {}
+
+    //! @brief  Estimate the memory and time of rendering the scene.
+    void        Execute() override;
+
+private:
+    /**< The scene to be estimated. */
+    const class Scene&      m_scene;
+};
@@ -18,33 +18,99 @@
 #include <string.h>
 #include "init_tasks.h"
 #include "core/timer.h"
+#include "core/perfreport.h"
 #include "material/matmanager.h"
 #include "core/globalconfig.h"
 #include "core/scene.h"
+#include "core/log.h"
 
 SORT_STATS_DEFINE_COUNTER(sPreprocessTimeMS)
+SORT_STATS_DEFINE_COUNTER(sSSSAcceleratorCount)
+SORT_STATS_DEFINE_COUNTER(sMaterialLoadingTimeMS)
+SORT_STATS_DEFINE_COUNTER(sEntityLoadingTimeMS)
+SORT_STATS_DEFINE_COUNTER(sPrunedPrimitiveCount)
 SORT_STATS_TIME("Performance", "Pre-processing Time", sPreprocessTimeMS);
+SORT_STATS_TIME("Performance", "Material Loading Time", sMaterialLoadingTimeMS);
+SORT_STATS_TIME("Performance", "Entity Loading Time", sEntityLoadingTimeMS);
+SORT_STATS_COUNTER("Statistics", "SSS Accelerator Count", sSSSAcceleratorCount);
+SORT_STATS_COUNTER("Statistics", "Primitives Pruned Out of Views", sPrunedPrimitiveCount);
 
 void Loading_Task::Execute(){
     TIMING_EVENT( "Serializing scene" );
+    PERF_PHASE( PerfPhase::Loading );
 
-    // Load materials from stream
-    MatManager::GetSingleton().ParseMatFile(m_stream);
+    // Load materials from stream, materials compiled in child tasks are not included in the time.
+    {
+        SORT_STATS( TIMING_EVENT_STAT( "" , sMaterialLoadingTimeMS ) );
+        MatManager::GetSingleton().ParseMatFile(m_stream);
+    }
 
     // Serialize the scene entities
-    m_scene.LoadScene(m_stream);
+    {
+        SORT_STATS( TIMING_EVENT_STAT( "" , sEntityLoadingTimeMS ) );
+        m_scene.LoadScene(m_stream);
+    }
+}
+
+void GeometryPruning_Task::Execute(){
+    SORT_STATS( TIMING_EVENT_STAT( "Geometry pruning" , sPreprocessTimeMS ) );
+
+    const auto pruned = m_scene.PruneOutsideViews( g_frustumPrune );
+    SORT_STATS( sPrunedPrimitiveCount = pruned );
+    slog( INFO , GENERAL , "%u primitives out of views are pruned." , pruned );
 }
 
 void SpatialAccelerationConstruction_Task::Execute(){
     SORT_STATS( TIMING_EVENT_STAT( "Spatial acceleration structure construction" , sPreprocessTimeMS ) );
+    PERF_PHASE( PerfPhase::AcceleratorBuild );
 
 	sAssert( g_accelerator , SPATIAL_ACCELERATOR );
-	g_accelerator->Build(m_scene.GetPrimitives(), m_scene.GetBBox());
+	SORT_STATS( Timer timer );
+	if( g_accelCacheEnabled )
+		g_accelerator->BuildWithCache(m_scene.GetPrimitives(), m_scene.GetBBox(), g_resourcePath);
+	else
+		g_accelerator->Build(m_scene.GetPrimitives(), m_scene.GetBBox());
+	SORT_STATS( sSceneLoadReport.Add( "Accelerators" , "Surfaces" , timer.GetElapsedTimeInUs() , (StatsInt)( sizeof( Primitive ) * m_scene.GetPrimitives().size() ) ) );
 }
 
 void SpatialAccelerationVolConstruction_Task::Execute() {
 	SORT_STATS(TIMING_EVENT_STAT("Spatial acceleration (Volume) structure construction", sPreprocessTimeMS));
+	PERF_PHASE( PerfPhase::AcceleratorBuild );
 
 	sAssert(g_acceleratorVol, SPATIAL_ACCELERATOR );
-	g_acceleratorVol->Build(m_scene.GetPrimitivesVol(), m_scene.GetBBoxVol());
+	SORT_STATS( Timer timer );
+	if( g_accelCacheEnabled )
+		g_acceleratorVol->BuildWithCache(m_scene.GetPrimitivesVol(), m_scene.GetBBoxVol(), g_resourcePath);
+	else
+		g_acceleratorVol->Build(m_scene.GetPrimitivesVol(), m_scene.GetBBoxVol());
+	SORT_STATS( sSceneLoadReport.Add( "Accelerators" , "Volumes" , timer.GetElapsedTimeInUs() , (StatsInt)( sizeof( Primitive ) * m_scene.GetPrimitivesVol().size() ) ) );
+}
+
+void SpatialAccelerationSSSConstruction_Task::Execute() {
+    SORT_STATS(TIMING_EVENT_STAT("Spatial acceleration (SSS) structure construction", sPreprocessTimeMS));
+    PERF_PHASE( PerfPhase::AcceleratorBuild );
+
+    sAssert(g_accelerator, SPATIAL_ACCELERATOR );
+    for( const auto& it : m_scene.GetPrimitivesSSS() ){
+        const auto& primitives = it.second;
+
+        // enlarge the bounding box a little, the same as what the scene does
+        BBox bbox;
+        for( const auto primitive : primitives )
+            bbox.Union( primitive->GetBBox() );
+        const auto delta = ( bbox.m_Max - bbox.m_Min ) * 0.001f;
+        bbox.m_Min -= delta;
+        bbox.m_Max += delta;
+
+        auto accelerator = g_accelerator->Clone();
+        SORT_STATS( Timer timer );
+        if( g_accelCacheEnabled )
+            accelerator->BuildWithCache( primitives , bbox , g_resourcePath );
+        else
+            accelerator->Build( primitives , bbox );
+        m_scene.SetAcceleratorSSS( it.first , std::move( accelerator ) );
+        SORT_STATS( sSceneLoadReport.Add( "Accelerators" , "SSS #" + std::to_string( sSSSAcceleratorCount ) , timer.GetElapsedTimeInUs() , (StatsInt)( sizeof( Primitive ) * primitives.size() ) ) );
+
+        SORT_STATS(++sSSSAcceleratorCount);
+    }
 }
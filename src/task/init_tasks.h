@@ -38,6 +38,24 @@ private:
     class IStreamBase&      m_stream;
 };
 
+//! @brief  Geometry pruning pass, it removes surface primitives far away from the views before accelerators are built.
+class GeometryPruning_Task : public Task{
+public:
+    //! @brief Constructor.
+    //!
+    //! @param  scene     Scene to be pruned.
+    GeometryPruning_Task( class Scene& scene, const char* name ,
+                 unsigned int priority , const Task::Task_Container& dependencies ) :
+        Task( name , DEFAULT_TASK_PRIORITY, dependencies  ) , m_scene(scene) {}
+
+    //! @brief  Remove primitives out of the view frustums.
+    void        Execute() override;
+
+private:
+    /**< The scene to be pruned. */
+    class Scene&      m_scene;
+};
+
 //! @brief  Spatial acceleration data structure construction pass.
 class SpatialAccelerationConstruction_Task : public Task{
 public:
@@ -73,3 +91,25 @@ private:
 	/**< The scene description to be filled with during loading. */
 	class Scene&      m_scene;
 };
+
+//! @brief  Spatial acceleration data structure construction pass, this is for probe rays of materials with SSS.
+/**
+ * Each material with SSS gets an accelerator holding its own primitives only, so that probe rays don't need to
+ * traverse and reject primitives of other materials.
+ */
+class SpatialAccelerationSSSConstruction_Task : public Task {
+public:
+    //! @brief Constructor.
+    //!
+    //! @param  scene     Scene to be filled during loading.
+    SpatialAccelerationSSSConstruction_Task(class Scene& scene, const char* name,
+        unsigned int priority, const Task::Task_Container& dependencies) :
+        Task(name, DEFAULT_TASK_PRIORITY, dependencies), m_scene(scene) {}
+
+    //! @brief  Build accelerators for all materials with SSS.
+    void        Execute() override;
+
+private:
+    /**< The scene description to be filled with during loading. */
+    class Scene&      m_scene;
+};
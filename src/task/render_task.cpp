@@ -15,6 +15,10 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <chrono>
 #include "render_task.h"
 #include "integrator/integrator.h"
 #include "sampler/sampler.h"
@@ -22,70 +26,525 @@
 #include "core/globalconfig.h"
 #include "core/scene.h"
 #include "core/profile.h"
+#include "core/rand.h"
 #include "sampler/random.h"
+#include "sampler/sobol.h"
+#include "sampler/bluenoise.h"
+#include "sampler/cmj.h"
 #include "medium/medium.h"
+#include "math/interaction.h"
+#include "accel/accelerator.h"
+#include "core/thread.h"
+#include "core/stats.h"
+#include "core/perfreport.h"
+#include "math/curve.h"
+#include "texture/texturecache.h"
+#include "core/mesh.h"
+#include "material/matmanager.h"
+
+SORT_STATS_DEFINE_COUNTER(sSplitRenderTaskCnt)
+SORT_STATS_DEFINE_COUNTER(sAdaptivePixelCnt)
+SORT_STATS_DEFINE_COUNTER(sAdaptiveSampleCnt)
+SORT_STATS_DEFINE_COUNTER(sConvergedPixelCnt)
+SORT_STATS_DEFINE_COUNTER(sProgressivePassCnt)
+SORT_STATS_DEFINE_COUNTER(sProgressiveSamples)
+SORT_STATS_DEFINE_COUNTER(sPreviewPassCnt)
+SORT_STATS_DEFINE_COUNTER(sDeferredPixelCnt)
+
+SORT_STATS_COUNTER("Performance", "Split render task number", sSplitRenderTaskCnt);
+SORT_STATS_AVG_COUNT("Statistics", "Adaptive samples per pixel", sAdaptiveSampleCnt, sAdaptivePixelCnt);
+SORT_STATS_RATIO("Statistics", "Converged pixels", sConvergedPixelCnt, sAdaptivePixelCnt);
+SORT_STATS_COUNTER("Statistics", "Progressive rendering passes", sProgressivePassCnt);
+SORT_STATS_COUNTER("Statistics", "Progressive samples per pixel", sProgressiveSamples);
+SORT_STATS_COUNTER("Statistics", "Quick preview passes", sPreviewPassCnt);
+SORT_STATS_COUNTER("Statistics", "Pixels deferred on texture misses", sDeferredPixelCnt);
+
+// A task is not split if either half would have fewer pixels than this, it is not worth the overhead.
+static constexpr int MIN_SPLIT_PIXEL_CNT = 16;
+// With adaptive sampling, a noisy pixel takes at most this many times the number of samples per pixel.
+static constexpr unsigned ADAPTIVE_MAX_SAMPLE_RATIO = 4;
+// Luminance below this is considered black when evaluating the relative error of a pixel.
+static constexpr float ADAPTIVE_DARK_LUMINANCE = 0.001f;
+// Size of blocks of the coarsest quick preview pass, one pixel in each block is rendered.
+static constexpr unsigned PREVIEW_MAX_BLOCK = 4;
+// Random numbers of a pixel are drawn from a stream of each sample, numbers shared by samples taken together, like
+// camera samples, are drawn from streams with this bit set, no pixel takes enough samples to collide with them.
+static constexpr unsigned SHARED_SAMPLE_STREAM = 0x80000000u;
+
+namespace {
+    //! @brief  Running estimation of the radiance of a pixel.
+    struct PixelEstimate{
+        Spectrum    sum;                /**< Sum of the radiance of all valid samples. */
+        unsigned    taken = 0;          /**< Number of samples taken, including invalid ones. */
+        unsigned    valid = 0;          /**< Number of valid samples. */
+        double      mean = 0.0;         /**< Running mean of the luminance of valid samples. */
+        double      m2 = 0.0;           /**< Running sum of squared differences from the mean of the luminance. */
+
+        void Add( const Spectrum& li ){
+            // Welford's algorithm is stable even with lots of samples.
+            const double l = li.GetIntensity();
+            const auto delta = l - mean;
+            sum += li;
+            mean += delta / ++valid;
+            m2 += delta * ( l - mean );
+        }
+
+        //! @brief  Standard error of the luminance relative to the luminance.
+        double Error() const{
+            if( valid < 2 )
+                return std::numeric_limits<double>::max();
+            return sqrt( m2 / ( valid - 1 ) / valid ) / ( mean + ADAPTIVE_DARK_LUMINANCE );
+        }
+
+        Spectrum Radiance() const{
+            return valid > 0 ? sum / (float)valid : Spectrum();
+        }
+    };
+
+    //! @brief  Create the sampler selected in the scene, random sampler is the fallback of unknown types.
+    std::unique_ptr<Sampler> makeSampler(){
+        auto sampler = MakeUniqueInstance<Sampler>( g_samplerType );
+        if( sampler )
+            return sampler;
+        return std::make_unique<RandomSampler>();
+    }
+
+    //! @brief  Everything taking and evaluating the samples of a pixel needs.
+    //!
+    //! It is owned by a worker thread and reused by all render tasks executed on it, there are thousands of tiles
+    //! and each of them would otherwise allocate all of these before tracing any ray.
+    struct SamplingState{
+        StringID                        sampler_type;       /**< Type of the sampler. */
+        std::unique_ptr<Sampler>        sampler;            /**< Sampler for taking samples in pixels. */
+        PixelSampleBuffer               samples;            /**< Samples of a pixel. */
+        std::unique_ptr<Ray[]>          rays;               /**< Camera rays of the samples. */
+        std::unique_ptr<SurfaceInteraction[]>   intersections;  /**< Primary intersections of the samples. */
+        std::unique_ptr<Spectrum[]>     radiances;          /**< Radiance of the samples. */
+        unsigned                        capacity = 0;       /**< Number of samples there is room for. */
+
+        //! @brief  Get ready for taking a number of samples in each pixel.
+        //!
+        //! @param  cnt         The number of samples per pixel.
+        void Prepare( const unsigned cnt ){
+            // the sampler type could change between renderings, like in interactive rendering from Blender
+            if( !sampler || sampler_type != g_samplerType ){
+                sampler = makeSampler();
+                sampler_type = g_samplerType;
+            }
+
+            samples.ClearRequests();
+            g_integrator->RequestSample( sampler.get() , samples , cnt );
+            samples.Reserve( cnt );
+
+            if( cnt > capacity ){
+                rays = std::make_unique<Ray[]>( cnt );
+                intersections = std::make_unique<SurfaceInteraction[]>( cnt );
+                radiances = std::make_unique<Spectrum[]>( cnt );
+                capacity = cnt;
+            }
+        }
+    };
+
+    //! @brief  Sampling states of the current thread that are not in use.
+    //!
+    //! A thread usually needs only one, unless a render task is executed while another one on the same thread is
+    //! waiting for something, each of them takes its own state then.
+    thread_local std::vector<std::unique_ptr<SamplingState>>    t_samplingStates;
+
+    //! @brief  Take a sampling state of the current thread for the lifetime of the scope.
+    class SamplingScope{
+    public:
+        SamplingScope(){
+            if( t_samplingStates.empty() ){
+                m_state = std::make_unique<SamplingState>();
+            }else{
+                m_state = std::move( t_samplingStates.back() );
+                t_samplingStates.pop_back();
+            }
+        }
+        ~SamplingScope(){
+            t_samplingStates.push_back( std::move( m_state ) );
+        }
+
+        SamplingState* operator->() const{
+            return m_state.get();
+        }
+
+    private:
+        std::unique_ptr<SamplingState>  m_state;
+    };
+}
 
 Render_Task::Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
             const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
-            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_scene(scene){
-    m_sampler = std::make_unique<RandomSampler>();
-    m_pixelSamples = std::make_unique<PixelSample[]>(g_samplePerPixel);
+            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_pixelBegin(0), m_pixelEnd(size.x * size.y), m_sampleCnt(g_samplePerPixel), m_scene(scene){
+    m_pendingPixels = std::make_shared<std::atomic<int>>( m_pixelEnd );
+
+    // Pixels are rendered row by row by default, there is no need for a table.
+    if( TileOrder::Morton == g_tileOrder )
+        m_pixelOrder = std::make_shared<const std::vector<Vector2i>>( MortonOrder( size ) );
+    else if( TileOrder::Hilbert == g_tileOrder )
+        m_pixelOrder = std::make_shared<const std::vector<Vector2i>>( HilbertOrder( size ) );
+}
+
+Render_Task::Render_Task(const Render_Task& task , int pixel ,
+            const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+            Task( name , priority , dependencies ), m_coord(task.m_coord), m_size(task.m_size), m_pixelBegin(pixel), m_pixelEnd(task.m_pixelEnd),
+            m_pendingPixels(task.m_pendingPixels), m_pixelOrder(task.m_pixelOrder), m_sampleCnt(task.m_sampleCnt), m_sampleOffset(task.m_sampleOffset),
+            m_previewBlock(task.m_previewBlock), m_scene(task.m_scene){
+}
+
+bool Render_Task::IsProgressivePass() const{
+    return m_sampleOffset > 0 || m_sampleCnt < g_samplePerPixel || m_previewBlock > 1;
 }
 
 void Render_Task::Execute(){
     if(IS_PTR_INVALID(g_integrator))
         return;
 
+    PERF_PHASE( PerfPhase::Rendering );
+
+    // The scene is ready by now, memory allocated during rendering is only touched by this thread.
+    LocalizeCurrentThreadMemory();
+
     auto camera = m_scene.GetCamera();
 
-    // request samples
-    g_integrator->RequestSample( m_sampler.get() , m_pixelSamples.get() , g_samplePerPixel);
+    // request samples, the buffers of the thread are reused
+    SamplingScope state;
+    state->Prepare( g_samplePerPixel );
+    const auto sampler = state->sampler.get();
+    const auto pixel_samples = state->samples.Samples();
 
-    Vector2i rb = m_coord + m_size;
+    // Camera rays of the same pixel are very coherent, they are traced in packets before evaluating the radiance.
+    const auto rays = state->rays.get();
+    const auto intersections = state->intersections.get();
+    const auto radiances = state->radiances.get();
+    const auto batched = g_integrator->SupportBatchEvaluation();
 
-    for( int i = m_coord.y ; i < rb.y ; i++ ){
-        for( int j = m_coord.x ; j < rb.x ; j++ ){
-            // generate samples to be used later
-            g_integrator->GenerateSample( m_sampler.get() , m_pixelSamples.get(), g_samplePerPixel, m_scene );
+    // AOVs of each sample are only recorded if any is enabled, otherwise the integrator doesn't even see a record.
+    const auto aov_enabled = g_imageSensor->HasAovs();
+    std::vector<AovSample> aov_samples( aov_enabled ? g_samplePerPixel : 0 );
+    const auto cost_enabled = 0 != ( g_aovMask & ( 1u << AOV_COST ) );
+    const auto& report = PerfReport::GetSingleton();
+
+    // With a reconstruction filter, samples of a pixel are only splatted to the local tile of the task once the pixel
+    // is done, a pixel rendered again after missing texture tiles drops its samples. Quick previews use the box filter.
+    const auto film = m_previewBlock > 1 ? nullptr : g_imageSensor->GetFilm();
+    std::unique_ptr<FilmTile> film_tile;
+    if( film )
+        film_tile = std::make_unique<FilmTile>( film->GetFilter() , m_coord , m_size );
+    std::vector<std::pair<Vector2f, Spectrum>> film_samples;
+    auto flush_film_samples = [&](){
+        for( const auto& sample : film_samples )
+            film_tile->AddSample( sample.first.x , sample.first.y , sample.second );
+        film_samples.clear();
+    };
+
+    // take a number of samples in a pixel, it should be no more than the number of samples per pixel.
+    // the aovs of the samples are added to 'aov' if it is not nullptr.
+    auto sample_pixel = [&]( const Vector2i& coord , unsigned sample_cnt , PixelEstimate& estimate , AovSample* aov ){
+        // the cost of the samples is measured from here, including generating them
+        std::chrono::steady_clock::time_point start;
+        unsigned long long ray_cnt = 0 , extension_cnt = 0;
+        if( cost_enabled ){
+            start = std::chrono::steady_clock::now();
+            ray_cnt = report.GetThreadRayCount( false );
+            extension_cnt = report.GetThreadRayCount( true );
+        }
 
-            // the radiance
-            Spectrum radiance;
+        // generate samples to be used later, they follow the samples taken in the pixel so far
+        const auto first_sample = m_sampleOffset + estimate.taken;
+        const auto pixel_key = (unsigned)( coord.y * g_resultResollutionWidth + coord.x );
+        sort_seed( pixel_key , SHARED_SAMPLE_STREAM | first_sample );
+        sampler->StartPixel( coord.x , coord.y , first_sample );
+        g_integrator->GenerateSample( sampler , state->samples , sample_cnt , m_scene );
 
-            auto valid_pixel_cnt = g_samplePerPixel;
-            for( unsigned k = 0 ; k < g_samplePerPixel; ++k ){
+        // generate rays
+        camera->GenerateRays( (float)coord.x , (float)coord.y , pixel_samples , sample_cnt , rays );
+
+        // resolve the primary intersections in packets
+        for( unsigned k = 0 ; k < sample_cnt; k += RAY_PACKET_SIZE ){
+            const auto cnt = std::min( RAY_PACKET_SIZE , sample_cnt - k );
+            for( unsigned l = k ; l < k + cnt ; ++l )
+                intersections[l] = SurfaceInteraction();
+            m_scene.GetIntersect( rays + k , intersections + k , cnt );
+        }
+
+        if( aov ){
+            for( unsigned k = 0 ; k < sample_cnt; ++k ){
+                auto& aov_sample = aov_samples[k];
+                const auto& inter = intersections[k];
+                aov_sample = AovSample();
+                if( inter.primitive ){
+                    aov_sample.values[AOV_NORMAL] = Spectrum( inter.normal.x , inter.normal.y , inter.normal.z );
+                    aov_sample.values[AOV_DEPTH] = Spectrum( inter.t );
+                }
+                pixel_samples[k].aov = &aov_sample;
+            }
+        }
+
+        // integrators evaluating samples in batches take all samples of the pixel at once
+        if( batched ){
+            SORT_CLEAR_MEMPOOL();
+            g_integrator->LiBatch( rays , intersections , pixel_samples , sample_cnt , m_scene , radiances );
+        }
+
+        for( unsigned k = 0 ; k < sample_cnt; ++k ){
+            auto li = radiances[k];
+            if( !batched ){
                 // clear managed memory after each pixel
                 SORT_CLEAR_MEMPOOL();
 
-                // generate rays
-                auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[k] );
-                // accumulate the radiance
-                auto li = g_integrator->Li( r , m_pixelSamples[k] , m_scene );
-                if( g_clammping > 0.0f )
-                    li = li.Clamp( 0.0f , g_clammping );
-                
-                sAssert( li.IsValid() , GENERAL );
-                
-                if( li.IsValid() )
-                    radiance += li;
-                else
-                    --valid_pixel_cnt;
+                // accumulate the radiance, the integrator takes the resolved intersection of the camera ray
+                sort_seed( pixel_key , first_sample + k );
+                sampler->StartSample( k );
+                li = g_integrator->Li( rays[k] , pixel_samples[k] , m_scene , intersections + k );
+                sampler->EndSample();
             }
-
-            if( valid_pixel_cnt > 0 )
-                radiance /= (float)valid_pixel_cnt;
+            if( g_clammping > 0.0f )
+                li = li.Clamp( 0.0f , g_clammping );
             
-            // store the pixel
-            g_imageSensor->StorePixel( j , i , radiance , *this );
+            sAssert( li.IsValid() , GENERAL );
+            
+            if( li.IsValid() ){
+                estimate.Add( li );
+                if( film_tile )
+                    film_samples.push_back( { Vector2f( (float)coord.x + pixel_samples[k].img_u , (float)coord.y + pixel_samples[k].img_v ) , li } );
+            }
+
+            if( aov ){
+                for( auto i = 0 ; i < AOV_CNT ; ++i )
+                    aov->values[i] += aov_samples[k].values[i];
+            }
+        }
+        estimate.taken += sample_cnt;
+
+        // the cost is averaged over the samples of the pixel, along with other aovs
+        if( cost_enabled && aov ){
+            const auto us = std::chrono::duration<float, std::micro>( std::chrono::steady_clock::now() - start ).count();
+            aov->values[AOV_COST] += Spectrum( us , (float)( report.GetThreadRayCount( false ) - ray_cnt ) , (float)( report.GetThreadRayCount( true ) - extension_cnt ) );
+        }
+    };
+
+    // Converged pixels stop taking samples after the minimum number of samples, in batches of the same size.
+    const auto adaptive = g_adaptiveSampling && g_integrator->SupportAdaptiveSampling() && !IsProgressivePass();
+    const auto batch = std::min( std::max( g_adaptiveMinSamples , 2u ) , g_samplePerPixel );
+    const auto threshold = (double)g_adaptiveThreshold;
+
+    // Pixels are only touched by this task, they are accumulated locally and stored in the image sensor all at once.
+    std::vector<PixelEstimate> estimates( m_pixelEnd - m_pixelBegin );
+    std::vector<AovSample> aovs( aov_enabled ? m_pixelEnd - m_pixelBegin : 0 );
+
+    // take all samples of a pixel, or samples until it converges with adaptive sampling
+    auto render_pixel = [&]( int p ){
+        const auto coord = GetPixelCoord( p );
+        auto& estimate = estimates[p - m_pixelBegin];
+        auto aov = aov_enabled ? &aovs[p - m_pixelBegin] : nullptr;
+        if( !adaptive ){
+            sample_pixel( coord , m_sampleCnt , estimate , aov );
+            return;
+        }
+
+        while( estimate.taken < g_samplePerPixel && ( estimate.taken < batch || estimate.Error() > threshold ) )
+            sample_pixel( coord , std::min( batch , g_samplePerPixel - estimate.taken ) , estimate , aov );
+    };
+
+    // With textures paged in by tiles, a pixel missing tiles is rendered again after the rest of the pixels, the tiles
+    // are loaded in the background meanwhile instead of stalling the thread. Integrators with side effects other than
+    // the estimate of the pixel can't throw a pixel away.
+    const auto defer_misses = g_textureCacheBudget > 0 && g_integrator->SupportPixelDeferral();
+    std::vector<int> deferred;
+
+    for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p ){
+        // Stop right away if the rendering is cancelled, the rest of the pixels are left unrendered.
+        if( IsCancelled() ){
+            m_pixelEnd = p;
+            break;
+        }
+
+        // Hand the second half of the unrendered pixels over to other threads if they are running out of work.
+        const auto rest = m_pixelEnd - p;
+        if( rest >= 2 * MIN_SPLIT_PIXEL_CNT && Scheduler::GetSingleton().IsStarving() ){
+            const auto pixel = p + ( rest + 1 ) / 2;
+            SPAWN_TASK<Render_Task>( "render task" , GetPriority() , {} , *this , pixel );
+            m_pixelEnd = pixel;
+            SORT_STATS(++sSplitRenderTaskCnt);
         }
+
+        // Hot path stats are only measured in some of the pixels if sampling is enabled.
+        SORT_STATS(SortStatsNextSample());
+
+        // Pixels skipped in a quick preview pass are filled by the display.
+        if( !IsPreviewPixel( GetPixelCoord( p ) ) )
+            continue;
+
+        if( !defer_misses ){
+            render_pixel( p );
+            flush_film_samples();
+            continue;
+        }
+
+        TextureMissDeferral deferral;
+        render_pixel( p );
+        if( deferral.HasMissed() ){
+            estimates[p - m_pixelBegin] = PixelEstimate();
+            if( aov_enabled )
+                aovs[p - m_pixelBegin] = AovSample();
+            film_samples.clear();
+            deferred.push_back( p );
+            SORT_STATS(++sDeferredPixelCnt);
+        }
+        flush_film_samples();
     }
 
-    if( g_integrator->NeedRefreshTile() ){
-        auto x_off = m_coord.x / g_tileSize;
-        auto y_off = (g_resultResollutionHeight - 1 - m_coord.y ) / g_tileSize ;
-        g_imageSensor->FinishTile( x_off, y_off, *this );
+    // Tiles missed by the deferred pixels are most likely loaded by now, they are loaded right away if not.
+    for( const auto p : deferred ){
+        if( IsCancelled() )
+            break;
+        render_pixel( p );
+        flush_film_samples();
     }
+
+    // The samples saved in converged pixels are taken by the noisiest pixels of the task, a batch each time.
+    if( adaptive ){
+        const auto max_sample_cnt = ADAPTIVE_MAX_SAMPLE_RATIO * g_samplePerPixel;
+        auto budget = (long long)( m_pixelEnd - m_pixelBegin ) * g_samplePerPixel;
+        for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p )
+            budget -= estimates[p - m_pixelBegin].taken;
+
+        std::vector<std::pair<double, int>> noisy_pixels;
+        while( budget > 0 && !IsCancelled() ){
+            noisy_pixels.clear();
+            for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p ){
+                const auto& estimate = estimates[p - m_pixelBegin];
+                const auto error = estimate.Error();
+                if( estimate.taken < max_sample_cnt && error > threshold )
+                    noisy_pixels.push_back( { error , p } );
+            }
+            if( noisy_pixels.empty() )
+                break;
+
+            std::sort( noisy_pixels.begin() , noisy_pixels.end() , std::greater<std::pair<double, int>>() );
+            for( const auto& noisy_pixel : noisy_pixels ){
+                auto& estimate = estimates[noisy_pixel.second - m_pixelBegin];
+                const auto cnt = (unsigned)std::min<long long>( budget , std::min( batch , max_sample_cnt - estimate.taken ) );
+                sample_pixel( GetPixelCoord( noisy_pixel.second ) , cnt , estimate , aov_enabled ? &aovs[noisy_pixel.second - m_pixelBegin] : nullptr );
+                flush_film_samples();
+                budget -= cnt;
+                if( budget <= 0 )
+                    break;
+            }
+        }
+
+        for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p ){
+            const auto& estimate = estimates[p - m_pixelBegin];
+            SORT_STATS(++sAdaptivePixelCnt);
+            SORT_STATS(sAdaptiveSampleCnt += estimate.taken);
+            SORT_STATS(sConvergedPixelCnt += estimate.Error() <= threshold);
+        }
+    }
+
+    // store the pixels rendered by this task, samples filtered locally are merged into the film first
+    if( film_tile )
+        film->Merge( *film_tile );
+    std::vector<Spectrum> tile_radiance( m_pixelEnd - m_pixelBegin );
+    for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p )
+        tile_radiance[p - m_pixelBegin] = estimates[p - m_pixelBegin].Radiance();
+    g_imageSensor->StoreTile( *this , tile_radiance.data() );
+
+    // aovs are averaged over all samples taken, including the invalid ones, they are not previewed
+    const auto preview = m_previewBlock > 1;
+    if( aov_enabled && !preview ){
+        for( auto p = m_pixelBegin ; p < m_pixelEnd ; ++p ){
+            auto& aov = aovs[p - m_pixelBegin];
+            const auto taken = std::max( estimates[p - m_pixelBegin].taken , 1u );
+            for( auto i = 0 ; i < AOV_CNT ; ++i )
+                aov.values[i] /= (float)taken;
+        }
+        g_imageSensor->StoreAovs( *this , aovs.data() );
+    }
+
+    // Only the last task finishing pixels of the tile refreshes it.
+    const auto pixels = m_pixelEnd - m_pixelBegin;
+    if( pixels == m_pendingPixels->fetch_sub( pixels , std::memory_order_acq_rel ) ){
+        // Passes of progressive rendering are refreshed all at once.
+        if( g_integrator->NeedRefreshTile() && !IsProgressivePass() ){
+            auto x_off = m_coord.x / g_tileSize;
+            auto y_off = (g_resultResollutionHeight - 1 - m_coord.y ) / g_tileSize ;
+            g_imageSensor->FinishTile( x_off, y_off, *this );
+        }
+        // Preview pixels are not saved in checkpoints, the first pass renders them again.
+        if( !preview )
+            g_imageSensor->OnTileFinished( *this );
+        PerfReport::GetSingleton().FinishTile();
+    }
+
+    // vertices paged in by this task could push the resident memory over the out of core budget
+    Mesh::TrimPagedVertices();
 }
 
 void PreRender_Task::Execute(){
+    // resources are loaded along with spatial accelerators, rendering can't start without them
+    MatManager::GetSingleton().WaitForResources();
+
+    PERF_PHASE( PerfPhase::PreProcess );
     g_integrator->PreProcess(m_scene);
 }
+
+void ProgressiveRender_Task::Execute(){
+    const auto start = std::chrono::steady_clock::now();
+    // Passes cut by the time budget depend on how fast the machine is, the budget is ignored in deterministic mode.
+    const auto budget = g_deterministic ? 0.0f : g_progressiveTimeBudget;
+
+    // Quick preview passes render 1/16 and then 1/4 of the pixels, the display fills the rest of the pixels.
+    if( g_previewPasses ){
+        for( auto block = PREVIEW_MAX_BLOCK ; block > 1 ; block /= 2 ){
+            m_schedulePass( 1 , 0 , block );
+            WAIT_FOR_CHILDREN();
+            if( IsCancelled() )
+                return;
+
+            SORT_STATS(++sPreviewPassCnt);
+            g_imageSensor->FinishPreviewPass( (int)block );
+        }
+    }
+
+    auto rendered = 0u;
+    auto sample_time = 0.0f;
+    while( rendered < g_samplePerPixel ){
+        // Double the samples taken so far, the last pass is shortened to fit in the time budget if there is one.
+        const auto elapsed = std::chrono::duration<float>( std::chrono::steady_clock::now() - start ).count();
+        auto cnt = std::min( std::max( rendered , 1u ) , g_samplePerPixel - rendered );
+        if( budget > 0.0f && rendered > 0 )
+            cnt = std::min( cnt , (unsigned)( std::max( budget - elapsed , 0.0f ) / sample_time ) );
+        if( g_integrator->SamplesPerPass() > 0 )
+            cnt = std::min( cnt , g_integrator->SamplesPerPass() );
+        if( 0 == cnt )
+            break;
+
+        m_schedulePass( cnt , rendered , 1 );
+        WAIT_FOR_CHILDREN();
+        if( IsCancelled() )
+            break;
+
+        g_integrator->FinishPass();
+
+        // Pixels resolved by their own tasks miss the samples of the neighbor tasks finished later.
+        g_imageSensor->ResolveFilm();
+
+        rendered += cnt;
+        const auto now = std::chrono::duration<float>( std::chrono::steady_clock::now() - start ).count();
+        sample_time = std::max( ( now - elapsed ) / cnt , 1e-6f );
+        SORT_STATS(++sProgressivePassCnt);
+
+        // The progress is whichever is closer to the end, the samples or the time budget.
+        const auto progress = std::max( (float)rendered / g_samplePerPixel , budget > 0.0f ? now / budget : 0.0f );
+        g_imageSensor->FinishPass( std::min( progress , 1.0f ) );
+        slog( INFO , GENERAL , "Progressive rendering pass is done with %d samples per pixel in %.2f seconds." , rendered , now );
+    }
+    SORT_STATS(sProgressiveSamples = rendered);
+
+    // what is learned is only kept for the next frame if the frame is done.
+    if( !IsCancelled() )
+        g_integrator->PostProcess();
+}
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <functional>
 #include "task.h"
 #include "sampler/sampler.h"
 #include "math/vector2.h"
@@ -27,6 +28,15 @@
 //! Each render task is usually responsible for a tile of image to be rendered in
 //! most cases. In other cases, like light tracing, there is no difference between
 //! different render_task.
+//! Pixels of a tile are rendered row by row, or along a space filling curve depending on
+//! the tile order of the global configuration.
+//! A tile with expensive pixels could easily become the last task running while all
+//! other threads are idle. Whenever the scheduler is starving, a render task splits
+//! its unrendered pixels in half and spawns a new task for the second half, which could
+//! be split again by whichever thread picks it.
+//! In progressive rendering, a render task only takes the samples of a pass, which are
+//! averaged with the samples taken in the previous passes. A render task of a quick preview pass
+//! only renders one pixel in each block of pixels, the rest of the block is filled by the display.
 class Render_Task : public Task{
 public:
     //! @brief Constructor
@@ -35,9 +45,73 @@ public:
     Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
                 const char* name , unsigned int priority , const Task::Task_Container& dependencies );
 
+    //! @brief Constructor splitting the unrendered pixels of a task.
+    //!
+    //! The new task belongs to the same tile, it starts from the given pixel and takes all pixels
+    //! left in the task being split.
+    //!
+    //! @param task         The task to be split.
+    //! @param pixel        Index of the first pixel of the new task, in the order pixels are rendered.
+    Render_Task(const Render_Task& task , int pixel ,
+                const char* name , unsigned int priority , const Task::Task_Container& dependencies );
+
     //! @brief  Execute the task
     void        Execute() override;
 
+    //! @brief  Setup the samples taken in each pixel by this task, all samples per pixel are taken by default.
+    //!
+    //! This should only be called before the task is scheduled.
+    //!
+    //! @param  sampleCnt       Number of samples taken in each pixel, it can't be more than the number of samples per pixel.
+    //! @param  sampleOffset    Number of samples taken in each pixel by previous passes of progressive rendering.
+    SORT_FORCEINLINE void        SetSamples( unsigned sampleCnt , unsigned sampleOffset ){
+        m_sampleCnt = sampleCnt;
+        m_sampleOffset = sampleOffset;
+    }
+
+    //! @brief  Get the number of samples taken in each pixel by this task.
+    //!
+    //! @return Number of samples taken in each pixel.
+    SORT_FORCEINLINE unsigned    GetSampleCnt() const {
+        return m_sampleCnt;
+    }
+
+    //! @brief  Get the number of samples taken in each pixel by the previous passes.
+    //!
+    //! @return Number of samples taken before this task, the radiance of pixels are averaged with them.
+    SORT_FORCEINLINE unsigned    GetSampleOffset() const {
+        return m_sampleOffset;
+    }
+
+    //! @brief  Setup the size of blocks of a quick preview pass, only the top-left pixel of each block is rendered.
+    //!
+    //! This should only be called before the task is scheduled.
+    //!
+    //! @param  block           Size of the blocks in pixels, 1 renders all pixels.
+    SORT_FORCEINLINE void        SetPreviewBlock( unsigned block ){
+        m_previewBlock = (int)block;
+    }
+
+    //! @brief  Get the size of blocks of a quick preview pass.
+    //!
+    //! @return Size of the blocks in pixels, 1 if it is not a preview pass.
+    SORT_FORCEINLINE int         GetPreviewBlock() const {
+        return m_previewBlock;
+    }
+
+    //! @brief  Whether a pixel is rendered by the task, all pixels are rendered unless it is a quick preview pass.
+    //!
+    //! @param coord        Coordinate of the pixel in the image.
+    //! @return Whether the pixel is rendered.
+    SORT_FORCEINLINE bool        IsPreviewPixel( const Vector2i& coord ) const {
+        return 1 == m_previewBlock || ( 0 == coord.x % m_previewBlock && 0 == coord.y % m_previewBlock );
+    }
+
+    //! @brief  Whether the task only renders a pass of progressive rendering.
+    //!
+    //! @return Whether some samples per pixel are taken in other passes, or it is a quick preview pass.
+    bool                         IsProgressivePass() const;
+
     //! @brief  Get the coordinate of the tile, top-left corner.
     //!
     //! @return Top-left corner of the tile.
@@ -52,12 +126,70 @@ public:
         return m_size;
     }
 
+    //! @brief  Get the index of the first pixel rendered by this task.
+    //!
+    //! @return Index of the first pixel, in the order pixels are rendered.
+    SORT_FORCEINLINE int         GetPixelBegin() const {
+        return m_pixelBegin;
+    }
+
+    //! @brief  Get the index after the last pixel rendered by this task.
+    //!
+    //! @return Index after the last pixel, in the order pixels are rendered.
+    SORT_FORCEINLINE int         GetPixelEnd() const {
+        return m_pixelEnd;
+    }
+
+    //! @brief  Get the coordinate of a pixel of the tile in the image.
+    //!
+    //! @param pixel        Index of the pixel, in the order pixels are rendered.
+    //! @return Coordinate of the pixel in the image.
+    SORT_FORCEINLINE Vector2i    GetPixelCoord( int pixel ) const {
+        return m_coord + ( m_pixelOrder ? (*m_pixelOrder)[pixel] : Vector2i( pixel % m_size.x , pixel / m_size.x ) );
+    }
+
 private:
     Vector2i                            m_coord;            /**< Top-left corner of the current tile. */
     Vector2i                            m_size;             /**< Size of the current tile to be rendered. */
+    int                                 m_pixelBegin;       /**< Index of the first pixel of the tile to be rendered by this task. */
+    int                                 m_pixelEnd;         /**< Index after the last pixel of the tile to be rendered by this task. */
+    std::shared_ptr<std::atomic<int>>   m_pendingPixels;    /**< Pixels of the tile not rendered yet, shared by all tasks of the tile. */
+    std::shared_ptr<const std::vector<Vector2i>>    m_pixelOrder;   /**< Offsets of pixels in the order to be rendered, nullptr for row by row. */
+    unsigned                            m_sampleCnt;        /**< Number of samples taken in each pixel. */
+    unsigned                            m_sampleOffset = 0; /**< Number of samples taken in each pixel by previous passes. */
+    int                                 m_previewBlock = 1; /**< Size of blocks of a quick preview pass, 1 if it is not a preview pass. */
     const Scene&                        m_scene;            /**< Scene for ray tracing. */
-    std::unique_ptr<Sampler>            m_sampler;          /**< Sampler for taking samples. Currently not used. */
-    std::unique_ptr<PixelSample[]>      m_pixelSamples;     /**< Samples to take. Currently not used. */
+};
+
+//! @brief  ProgressiveRender_Task renders the whole image in passes for a quick preview.
+//!
+//! The first pass takes one sample in each pixel, each of the following passes doubles the number of samples
+//! taken so far. Render tasks of a pass are children of this task, the image sensor is refreshed once they are
+//! all done. It stops once all samples per pixel are taken, or the time budget runs out, in which case the last
+//! pass is shortened to fit in the budget.
+//! Quick preview passes could go before the first pass, each of them takes one sample in one pixel of each block,
+//! the blocks get smaller in each preview pass until the first pass renders all pixels. Rendering stops after the
+//! pass being rendered once it is cancelled, like when the scene is updated in interactive rendering.
+class ProgressiveRender_Task : public Task {
+public:
+    //! @brief  Schedule render tasks of all tiles for a pass, as children of the current task.
+    //!
+    //! The first parameter is the number of samples taken in each pixel in the pass, the second one is the
+    //! number of samples taken in previous passes, the last one is the size of blocks of a quick preview pass.
+    using PassScheduler = std::function<void( unsigned , unsigned , unsigned )>;
+
+    //! @brief Constructor
+    //!
+    //! @param schedulePass     Callback to schedule render tasks of a pass.
+    ProgressiveRender_Task( const PassScheduler& schedulePass , const char* name , unsigned int priority ,
+                    const Task::Task_Container& dependencies ) :
+                    Task( name , priority , dependencies ), m_schedulePass(schedulePass){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    PassScheduler   m_schedulePass;
 };
 
 //! @brief  PreRender_Task provides a chance for integrators to preprocess some data before rendering.
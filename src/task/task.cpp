@@ -15,120 +15,328 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <thread>
+#include <algorithm>
 #include "task.h"
 #include "core/sassert.h"
 #include "core/profile.h"
 
-thread_local static const Task* g_currentTask = nullptr;
+// Number of times an idle thread tries to steal tasks before it goes to sleep.
+static constexpr unsigned int IDLE_SPIN_CNT = 64;
+
+SORT_STATS_DEFINE_COUNTER(sBusyTime)
+SORT_STATS_DEFINE_COUNTER(sIdleTime)
+SORT_STATS_DEFINE_COUNTER(sWorkerTime)
+SORT_STATS_DEFINE_COUNTER(sCriticalPath)
+SORT_STATS_DEFINE_THREAD_TIME(sThreadTime)
+SORT_STATS_DEFINE_HISTOGRAMS(sTaskRunTime)
+SORT_STATS_DEFINE_TIMELINE(sAvailableTasks)
+
+SORT_STATS_TIME_US("Scheduler", "Total Busy Time", sBusyTime);
+SORT_STATS_TIME_US("Scheduler", "Total Idle Time", sIdleTime);
+SORT_STATS_RATIO("Scheduler", "Idle Ratio", sIdleTime, sWorkerTime);
+SORT_STATS_MAX_TIME_US("Scheduler", "Critical Path Length", sCriticalPath);
+SORT_STATS_THREAD_TIME("Scheduler", "Time per Thread", sThreadTime);
+SORT_STATS_HISTOGRAMS("Scheduler", "Task Run Time", sTaskRunTime);
+SORT_STATS_TIMELINE("Scheduler", "Available Tasks over Time", sAvailableTasks);
+
+#ifdef SORT_ENABLE_STATS_COLLECTION
+// Interval between two samples of the number of available tasks, in milliseconds.
+static constexpr StatsInt SAMPLE_INTERVAL = 10;
+
+// Time of a thread accounted to tasks or idling, it makes sure nested tasks are not counted twice.
+thread_local static StatsInt g_accountedTime = 0;
+// The last time any thread sampled the number of available tasks, so that the number of samples doesn't grow with threads.
+static std::atomic<StatsInt> g_lastSampleTime( -SAMPLE_INTERVAL );
+
+//! @brief  Time since the first call, in microseconds.
+static StatsInt nowUs(){
+    static const auto start = std::chrono::steady_clock::now();
+    return (StatsInt)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - start ).count();
+}
+
+//! @brief  Account time of the current thread not executing any task.
+static void accountIdleTime( StatsInt t ){
+    sIdleTime += t;
+    sWorkerTime += t;
+    g_accountedTime += t;
+}
+
+//! @brief  Sample the number of available tasks if it has not been done for a while by any thread.
+static void sampleAvailableTasks( unsigned int cnt ){
+    const auto t = nowUs() / 1000;
+    auto last = g_lastSampleTime.load( std::memory_order_relaxed );
+    if( t - last < SAMPLE_INTERVAL || !g_lastSampleTime.compare_exchange_strong( last , t , std::memory_order_relaxed ) )
+        return;
+    sAvailableTasks.Add( t , cnt );
+}
+
+//! @brief  Update an atomic value if the new value is larger.
+static void atomicMax( std::atomic<StatsInt>& v , StatsInt x ){
+    auto cur = v.load( std::memory_order_relaxed );
+    while( cur < x && !v.compare_exchange_weak( cur , x , std::memory_order_relaxed ) );
+}
+#endif
+
+thread_local static Task* g_currentTask = nullptr;
 
 class UpdateCurrentTaskWrapper{
 public:
     //! Update current task
-    UpdateCurrentTaskWrapper( const Task* task ){
+    UpdateCurrentTaskWrapper( Task* task ) : m_previousTask( g_currentTask ){
         g_currentTask = task;
     }
 
-    //! There is no current on-going task any more.
+    //! Restore the previous task, a task could be executed while another task is waiting for its children.
     ~UpdateCurrentTaskWrapper(){
-        g_currentTask = nullptr;
+        g_currentTask = m_previousTask;
     }
+
+private:
+    Task*   m_previousTask;
 };
 
 void Task::ExecuteTask(){
-    SORT_PROFILE(m_name);
-
+    SORT_STATS(const auto start = nowUs());
+    SORT_STATS(const auto accounted = g_accountedTime);
     {
+        SORT_PROFILE(m_name);
         UpdateCurrentTaskWrapper uctw( this );
 
-        // Execute the task.
-        Execute();
+        // Execute the task, a cancelled task is finished without doing anything.
+        if( !IsCancelled() )
+            Execute();
+
+        // A task is not finished until all of its children are finished.
+        WAIT_FOR_CHILDREN();
     }
 
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    // Nested tasks and idling while waiting for children are already accounted.
+    const auto elapsed = nowUs() - start;
+    const auto own = std::max( elapsed - ( g_accountedTime - accounted ) , (StatsInt)0 );
+    g_accountedTime = accounted + elapsed;
+    sBusyTime += own;
+    sWorkerTime += own;
+    sTaskRunTime.Add( m_name , own );
+    atomicMax( m_pathEnd , m_pathStart.load( std::memory_order_relaxed ) + own );
+#endif
+
     // Upon termination of a task, release its dependents' dependencies on this task.
+    // Nothing in the task should be touched after this since it is destroyed by the scheduler.
     Scheduler::GetSingleton().TaskFinished( this );
 }
 
-// Compare tasks based on its priority, tasks with higher priority get executed earlier.
-Scheduler::Task_Comp Scheduler::task_comp = []( const Task* t0 , const Task* t1 ){
-    return t0->GetPriority() < t1->GetPriority();
-};
+void Scheduler::WorkerQueue::Push( Task* task ){
+    std::lock_guard<spinlock_mutex> lock(m_lock);
+    m_tasks.push_back( task );
+    std::push_heap( m_tasks.begin() , m_tasks.end() , Task_Comp() );
+    m_size.store( (unsigned int)m_tasks.size() , std::memory_order_release );
+}
+
+Task* Scheduler::WorkerQueue::Pop(){
+    // A quick check without touching the lock, this is what makes stealing cheap.
+    if( 0 == m_size.load( std::memory_order_acquire ) )
+        return nullptr;
+
+    std::lock_guard<spinlock_mutex> lock(m_lock);
+    if( m_tasks.empty() )
+        return nullptr;
+
+    std::pop_heap( m_tasks.begin() , m_tasks.end() , Task_Comp() );
+    auto ret = m_tasks.back();
+    m_tasks.pop_back();
+    m_size.store( (unsigned int)m_tasks.size() , std::memory_order_release );
+    return ret;
+}
+
+void Scheduler::WorkerQueue::Reprioritize( const std::function<unsigned int(const Task&)>& priority ){
+    std::lock_guard<spinlock_mutex> lock(m_lock);
+    for( auto task : m_tasks )
+        task->SetPriority( priority( *task ) );
+    std::make_heap( m_tasks.begin() , m_tasks.end() , Task_Comp() );
+}
+
+Scheduler::Scheduler(){
+    Initialize( std::thread::hardware_concurrency() );
+}
+
+void Scheduler::Initialize( unsigned int workerCnt ){
+    sAssertMsg( 0 == m_aliveTaskCnt.load() , GENERAL , "Scheduler can't be re-initialized with tasks in it." );
+
+    workerCnt = std::max( workerCnt , 1u );
+    m_queues.clear();
+    for( auto i = 0u ; i < workerCnt ; ++i )
+        m_queues.push_back( std::make_unique<WorkerQueue>() );
+}
+
+void Scheduler::pushAvailableTask( Task* task ){
+    const auto affinity = task->GetAffinity();
+    const auto tid = affinity >= 0 ? (unsigned int)affinity : (unsigned int)ThreadId();
+    m_queues[ tid % m_queues.size() ]->Push( task );
+    m_availableTaskCnt.fetch_add( 1 , std::memory_order_release );
+
+    // Only wake up a thread if there is any sleeping one.
+    if( m_sleepingCnt.load( std::memory_order_acquire ) > 0 ){
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_cv.notify_one();
+    }
+}
+
+void Scheduler::Reprioritize( const std::function<unsigned int(const Task&)>& priority ){
+    for( auto& queue : m_queues )
+        queue->Reprioritize( priority );
+}
 
 Task* Scheduler::Schedule( std::unique_ptr<Task> task ){
     if(IS_PTR_INVALID(task))
         return nullptr;
 
-    std::lock_guard<std::mutex> lock(m_mutex);
+    m_aliveTaskCnt.fetch_add( 1 , std::memory_order_acq_rel );
 
-    auto taskID = task->GetTaskID();
-    m_tasks[taskID] = std::move(task);
+    // The task will be destroyed by the scheduler once it is finished.
+    auto task_ptr = task.release();
 
-    const auto task_ptr = m_tasks[taskID].get();
-    if(task_ptr->NoDependency() )
-        m_availbleTasks.push(task_ptr);
-    else{
-        auto dependencies = task_ptr->GetDependencies();
-        for (auto dep : dependencies) {
-            auto no_const_dep = const_cast<Task*>(dep);
-            no_const_dep->AddDependent(task_ptr);
-        }
-        m_backupTasks.insert(task_ptr);
+    Task::Task_Container dependencies;
+    task_ptr->TakeDependencies( dependencies );
+
+    // A task scheduled by a running task can't start before it, the time the running task has taken so far is ignored.
+    SORT_STATS(if( IS_PTR_VALID(g_currentTask) ) task_ptr->m_pathStart.store( g_currentTask->m_pathStart.load( std::memory_order_relaxed ) , std::memory_order_relaxed ));
+
+    // A dependency that is finishing right now has handed its dependents over already, it is not counted. Dependencies
+    // are deleted once they are finished, so they can't be anything older than that.
+    auto pending_cnt = 0u;
+    for( auto dep : dependencies ){
+        auto no_const_dep = const_cast<Task*>(dep);
+        if( IS_PTR_VALID(no_const_dep) )
+            pending_cnt += no_const_dep->AddDependent(task_ptr) ? 1 : 0;
     }
+    task_ptr->AddPendingDependencies( pending_cnt );
+
+    // Release the extra count held by the scheduler, the task is available if it is not waiting for any dependency.
+    if( task_ptr->DependencyFinished() )
+        pushAvailableTask( task_ptr );
     return task_ptr;
 }
 
+Task* Scheduler::TryPickTask(){
+    if( 0 == m_availableTaskCnt.load( std::memory_order_acquire ) )
+        return nullptr;
+
+    // Always starts from the queue of itself, steal tasks from other threads' queue if there is nothing in its own.
+    const auto queue_cnt = (unsigned int)m_queues.size();
+    const auto self = (unsigned int)ThreadId() % queue_cnt;
+    for( auto i = 0u ; i < queue_cnt ; ++i ){
+        auto task = m_queues[ ( self + i ) % queue_cnt ]->Pop();
+        if( task ){
+            const auto cnt = m_availableTaskCnt.fetch_sub( 1 , std::memory_order_acq_rel );
+            SORT_STATS(sampleAvailableTasks( cnt - 1 ));
+            return task;
+        }
+    }
+    return nullptr;
+}
+
 Task* Scheduler::PickTask(){
-    std::unique_lock<std::mutex> lock(m_mutex);
+    while( true ){
+        // Spin for a while before going to sleep, it is quite likely some task will be available very soon.
+        for( auto i = 0u ; i < IDLE_SPIN_CNT ; ++i ){
+            auto task = TryPickTask();
+            if( task )
+                return task;
 
-    // Wait until this is at least one available task
-    while( !( (m_backupTasks.empty() && m_availbleTasks.empty()) || m_availbleTasks.size() ) )
-        m_cv.wait_for( lock , std::chrono::seconds(1) );
+            // Return nullptr if there is no task in the scheduler at all
+            if( 0 == m_aliveTaskCnt.load( std::memory_order_acquire ) )
+                return nullptr;
 
-    // Return nullptr if there is no task available in the scheduler
-    if (m_backupTasks.empty() && m_availbleTasks.empty())
-        return nullptr;
+            cpu_pause();
+        }
 
-    // Get the available task that is with highest priority
-    Task* ret = m_availbleTasks.top();
-    m_availbleTasks.pop();
-    return ret;
+        // Wait until this is at least one available task, or there is no task in the scheduler anymore.
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_sleepingCnt.fetch_add( 1 , std::memory_order_acq_rel );
+        m_cv.wait_for( lock , std::chrono::milliseconds(1) , [&](){
+            return m_availableTaskCnt.load( std::memory_order_acquire ) > 0 || 0 == m_aliveTaskCnt.load( std::memory_order_acquire );
+        });
+        m_sleepingCnt.fetch_sub( 1 , std::memory_order_acq_rel );
+    }
 }
 
-void Scheduler::TaskFinished( const Task* task ){
-    std::lock_guard<std::mutex> lock(m_mutex);
+void Scheduler::TaskFinished( Task* task ){
+    // No more dependents can be added after this.
+    Task::DependentTask_Container dependents;
+    task->MarkFinished( dependents );
 
-    // Starting remove all dependencies.
-    const auto& dependent = task->GetDependents();
-    for( auto dep : dependent ){
-        // Remove its dependencies.
-        dep->RemoveDependency( task );
+    // The critical path of dependents and the parent goes through this task.
+    SORT_STATS(const auto path = task->m_pathEnd.load( std::memory_order_acquire ));
+    SORT_STATS(sCriticalPath = std::max( sCriticalPath , path ));
 
-        // There is no dependent task of this 'dep' task anymore, push it into the heap and remove it from the backup tasks.
-        if( dep->NoDependency() ){
-            m_backupTasks.erase( dep );
-            m_availbleTasks.push( dep );
-
-            // Notify one waiting thread to pick up task.
-            m_cv.notify_one();
-        }
+    // Any dependent without other unfinished dependencies is pushed in the queue of the current thread.
+    for( auto dep : dependents ){
+        SORT_STATS(atomicMax( dep->m_pathStart , path ));
+        if( dep->DependencyFinished() )
+            pushAvailableTask( dep );
     }
 
-    m_tasks.erase(task->GetTaskID());
+    // Notify its parent one of its children is done.
+    auto parent = task->GetParent();
+    SORT_STATS(if( IS_PTR_VALID(parent) ) atomicMax( parent->m_pathEnd , path ));
+
+    // The task is not needed anymore.
+    delete task;
+
+    if( IS_PTR_VALID(parent) )
+        parent->ChildFinished();
+
+    // Wake up all sleeping threads so that they can exit if there is no other task.
+    if( 1 == m_aliveTaskCnt.fetch_sub( 1 , std::memory_order_acq_rel ) ){
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_cv.notify_all();
+    }
 }
 
 void    EXECUTING_TASKS(){
+    SORT_STATS(const auto busy = sBusyTime);
+    SORT_STATS(const auto idle = sIdleTime);
     while( true ){
         // Pick a task that is available.
+        SORT_STATS(const auto start = nowUs());
         auto task = Scheduler::GetSingleton().PickTask();
+        SORT_STATS(accountIdleTime( nowUs() - start ));
 
         // If there is no task to be picked, break out of the loop.
         if(IS_PTR_INVALID(task))
-            return;
+            break;
 
         // Execute the task.
         task->ExecuteTask();
     }
+    SORT_STATS(sThreadTime.Add( ThreadId() , sBusyTime - busy , sIdleTime - idle ));
+}
+
+void    WAIT_FOR_CHILDREN(){
+    const auto task = g_currentTask;
+    if( IS_PTR_INVALID(task) )
+        return;
+
+    WAIT_UNTIL( [task](){ return !task->HasPendingChildren(); } );
+}
+
+void    WAIT_UNTIL( const std::function<bool()>& done ){
+    auto& scheduler = Scheduler::GetSingleton();
+    while( !done() ){
+        // Instead of idling, keep executing other tasks, it is very likely that the work being waited on is picked here.
+        auto other = scheduler.TryPickTask();
+        if( IS_PTR_VALID(other) ){
+            other->ExecuteTask();
+        }else{
+            SORT_STATS(const auto start = nowUs());
+            std::this_thread::yield();
+            SORT_STATS(accountIdleTime( nowUs() - start ));
+        }
+    }
 }
 
 const Task* GetCurrentTask(){
     return g_currentTask;
-}
\ No newline at end of file
+}
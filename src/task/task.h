@@ -17,20 +17,48 @@
 
 #pragma once
 
-#include <unordered_set>
-#include <unordered_map>
+#include <string>
 #include <queue>
+#include <vector>
 #include <memory>
 #include <mutex>
 #include <functional>
+#include <atomic>
 #include <condition_variable>
 #include "core/singleton.h"
+#include "core/thread.h"
+#include "core/stats.h"
 
 // Default task priority is 100000.
 #define DEFAULT_TASK_PRIORITY       100000
 
 using TaskID = unsigned int;
 
+//! @brief  Token for cancelling a group of tasks cooperatively.
+/**
+ * Tasks sharing the same token are cancelled together. A cancelled task that is not started yet is
+ * skipped by the scheduler, it is still considered finished so that its dependents are not blocked.
+ * A running task needs to check it by itself through Task::IsCancelled, long running tasks like
+ * rendering a tile check it between pixels.
+ */
+class CancellationToken{
+public:
+    //! @brief  Cancel all tasks holding this token.
+    void    Cancel(){
+        m_cancelled.store( true , std::memory_order_release );
+    }
+
+    //! @brief  Whether the token is cancelled.
+    //!
+    //! @return True if the token is cancelled.
+    bool    IsCancelled() const {
+        return m_cancelled.load( std::memory_order_acquire );
+    }
+
+private:
+    std::atomic<bool>   m_cancelled = { false };    /**< Whether the token is cancelled. */
+};
+
 //! @brief  Basic unit task in SORT system.
 /**
  * SORT is driven by a graph based task system. The tasks form a directed acyclic graph (DAG).
@@ -39,22 +67,25 @@ using TaskID = unsigned int;
  * data from streams. Upon finishing of each task, it will remove its dependencies. Each task comes
  * with a priority number. Default priority is 100000, higher priority task will be executed earlier
  * than lower ones.
+ * Instead of keeping track of the exact tasks it depends on, each task only counts the number of its
+ * unfinished dependencies. The task becomes available the moment its counter reaches zero.
+ * A running task can also spawn child tasks through SPAWN_TASK. A task is not considered finished
+ * until all of its children are finished, tasks depending on it won't be executed before that either.
+ * With stats collection enabled, each task also keeps track of the longest chain of task run time
+ * leading to it, following both dependencies and children, which is the critical path of the graph.
  */
 class Task{
 public:
     // Dependency container for task
-    using Task_Container = std::unordered_set<const Task*>;
-    using DependentTask_Container = std::unordered_set<Task*>;
+    using Task_Container = std::vector<const Task*>;
+    using DependentTask_Container = std::vector<Task*>;
 
     //! @brief  Default constructor.
     Task(   const char* name  , unsigned int priority = DEFAULT_TASK_PRIORITY ,
             const Task_Container& dependencies = {} ):
             m_name(name), m_dependencies(dependencies),m_priority(priority) {
-        static std::mutex m;
-        static unsigned int taskId = 0;
-
-        std::lock_guard<std::mutex> lock(m);
-        m_taskId = (TaskID)++taskId;
+        static std::atomic<TaskID> taskId(0);
+        m_taskId = ++taskId;
     }
 
     //! @brief  Virtual destructor.
@@ -64,6 +95,9 @@ public:
     virtual void        Execute() = 0;
 
     //! @brief  Execute the task, this also includes outputting profiling data and removing dependencies.
+    //!
+    //! If the task spawns any child tasks, this function won't return until all of them are finished.
+    //! The task will be destroyed once this function returns.
     void                ExecuteTask();
 
     //! @brief  Get priority of the task.
@@ -73,32 +107,59 @@ public:
         return m_priority;
     }
 
-    //! @brief  Remove dependency from task.
+    //! @brief  Update priority of the task.
+    //!
+    //! Once the task is scheduled, this should only be done through Scheduler::Reprioritize.
+    //!
+    //! @param  priority    New priority of the task.
+    SORT_FORCEINLINE void SetPriority( unsigned int priority ){
+        m_priority = priority;
+    }
+
+    //! @brief  Setup the cancellation token of the task.
+    //!
+    //! This should only be called before the task is scheduled. Children spawned by the task share its token.
     //!
-    //! Upon the termination of any dependent task, it is necessary to remove it from its dependency.
-    SORT_FORCEINLINE void         RemoveDependency( const Task* taskid ) {
-        m_dependencies.erase( taskid );
+    //! @param  token       The cancellation token, nullptr means the task can't be cancelled.
+    SORT_FORCEINLINE void SetCancellationToken( const std::shared_ptr<const CancellationToken>& token ){
+        m_cancellationToken = token;
     }
 
-    //! @brief  If there is no dependent task anymore.
+    //! @brief  Whether the task is cancelled.
     //!
-    //! @return True if all dependent tasks are finished. Otherwise, return false.
-    SORT_FORCEINLINE bool         NoDependency() const {
-        return m_dependencies.empty();
+    //! @return True if the cancellation token of the task is cancelled.
+    SORT_FORCEINLINE bool IsCancelled() const {
+        return m_cancellationToken && m_cancellationToken->IsCancelled();
     }
 
-    //! @brief  Get tasks depending on this task.
+    //! @brief  Notify the task that one of its dependencies is finished.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE const DependentTask_Container& GetDependents() const  {
-        return m_dependents;
+    //! @return True if all dependencies are finished, meaning the task is ready to be executed.
+    SORT_FORCEINLINE bool         DependencyFinished() {
+        return 1 == m_pendingDependencyCnt.fetch_sub( 1 , std::memory_order_acq_rel );
     }
 
     //! @brief  Add dependent.
     //!
-    //! @param  Task to be added as a dependent.
-    SORT_FORCEINLINE void AddDependent( Task* task ){
-        m_dependents.insert( task );
+    //! @param  task    Task to be added as a dependent.
+    //! @return         False if the task is finishing and its dependents are taken, the dependent doesn't need to wait.
+    SORT_FORCEINLINE bool AddDependent( Task* task ){
+        std::lock_guard<spinlock_mutex> lock(m_dependentsLock);
+        if( m_finished )
+            return false;
+        m_dependents.push_back( task );
+        return true;
+    }
+
+    //! @brief  Mark the task as finished and take all of its dependents.
+    //!
+    //! No dependent can be added to the task once it is finished.
+    //!
+    //! @param  dependents  Tasks depending on this task.
+    SORT_FORCEINLINE void MarkFinished( DependentTask_Container& dependents ){
+        std::lock_guard<spinlock_mutex> lock(m_dependentsLock);
+        m_finished = true;
+        dependents.swap( m_dependents );
     }
 
     //! @brief  Get the id of the task
@@ -108,58 +169,185 @@ public:
         return m_taskId;
     }
 
-    //! @brief  Get tasks this task depends on.
+    //! @brief  Take the tasks this task depends on.
+    //!
+    //! This is only used once when the task gets scheduled, the task doesn't hold its dependencies after it.
+    //!
+    //! @param  dependencies    Tasks this task depends on.
+    SORT_FORCEINLINE void TakeDependencies( Task_Container& dependencies ){
+        dependencies.swap( m_dependencies );
+    }
+
+    //! @brief  Count the number of dependencies that are not finished yet.
+    //!
+    //! @param  cnt     Number of unfinished dependencies.
+    SORT_FORCEINLINE void AddPendingDependencies( unsigned int cnt ){
+        m_pendingDependencyCnt.fetch_add( cnt , std::memory_order_relaxed );
+    }
+
+    //! @brief  Get the parent task that spawned this task.
+    //!
+    //! @return The parent task, nullptr if the task is not spawned by another task.
+    SORT_FORCEINLINE Task* GetParent() const {
+        return m_parent;
+    }
+
+    //! @brief  Setup the parent of this task.
+    //!
+    //! This should only be called before the task is scheduled.
+    //!
+    //! @param  parent      The task that spawns this task.
+    SORT_FORCEINLINE void SetParent( Task* parent ){
+        m_parent = parent;
+        if( IS_PTR_VALID(parent) ){
+            parent->m_pendingChildren.fetch_add( 1 , std::memory_order_relaxed );
+            if( !m_cancellationToken )
+                m_cancellationToken = parent->m_cancellationToken;
+        }
+    }
+
+    //! @brief  Setup the worker thread that the task prefers to be executed on.
+    //!
+    //! This should only be called before the task is scheduled. The task is pushed in the queue of the
+    //! worker thread once it is available, other threads could still steal it.
+    //!
+    //! @param  tid         Id of the worker thread, a negative value means no preference.
+    SORT_FORCEINLINE void SetAffinity( int tid ){
+        m_affinity = tid;
+    }
+
+    //! @brief  Get the worker thread that the task prefers to be executed on.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE Task_Container& GetDependencies(){
-        return m_dependencies;
+    //! @return Id of the worker thread, a negative value means no preference.
+    SORT_FORCEINLINE int GetAffinity() const {
+        return m_affinity;
     }
 
-    //! @brief  Get tasks this task depends on.
+    //! @brief  Notify the task that one of its children is finished.
+    SORT_FORCEINLINE void ChildFinished(){
+        m_pendingChildren.fetch_sub( 1 , std::memory_order_release );
+    }
+
+    //! @brief  Whether there is any child of this task is not finished yet.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE const Task_Container& GetDependencies() const {
-        return m_dependencies;
+    //! @return True if there is still child task running or waiting to be executed.
+    SORT_FORCEINLINE bool HasPendingChildren() const {
+        return m_pendingChildren.load( std::memory_order_acquire ) > 0;
     }
 
 private:
-    Task_Container              m_dependencies;     /**< Tasks this task depends on. */
-    DependentTask_Container     m_dependents;       /**< Tasks depending on this task. */
-    unsigned int                m_priority;         /**< Priority of the task. */
     const std::string           m_name;             /**< Name of the task. */
+    Task_Container              m_dependencies;     /**< Tasks this task depends on, it is only valid before the task gets scheduled. */
+    unsigned int                m_priority;         /**< Priority of the task. */
     TaskID                      m_taskId;           /**< This is to identify the task with id. */
+    Task*                       m_parent = nullptr; /**< The task that spawns this task, if there is any. */
+    int                         m_affinity = -1;    /**< Worker thread whose queue the task is pushed in, negative for the thread making it available. */
+    std::shared_ptr<const CancellationToken>    m_cancellationToken;    /**< Token to cancel the task, nullptr if the task can't be cancelled. */
+    std::atomic<StatsInt>       m_pathStart = { 0 };        /**< Length of the critical path before the task could start, in microseconds. */
+    std::atomic<StatsInt>       m_pathEnd = { 0 };          /**< Length of the critical path by the time the task and its children are finished, in microseconds. */
+    std::atomic<unsigned int>   m_pendingChildren = { 0 };  /**< Number of children that are not finished yet. */
+
+    /**< Number of unfinished dependencies. It starts with one so that the task won't be available before all its dependencies are counted. */
+    std::atomic<unsigned int>   m_pendingDependencyCnt = { 1 };
+    DependentTask_Container     m_dependents;       /**< Tasks depending on this task. */
+    spinlock_mutex              m_dependentsLock;   /**< Lock protecting dependents, it is only contended when a task depending on this one is scheduled while it is finishing. */
+    bool                        m_finished = false; /**< Whether the task is finished. */
+
+    friend class Scheduler;
+};
+
+//! @brief  A task that simply executes a function.
+//!
+//! This is handy for spawning small pieces of work, like building a sub-tree of a BVH, without defining
+//! a new type of task every time.
+class Function_Task : public Task{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  func        The function to be executed.
+    Function_Task( const std::function<void()>& func , const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+        Task( name , priority , dependencies ) , m_func( func ) {}
+
+    //! @brief  Execute the function.
+    void    Execute() override {
+        m_func();
+    }
+
+private:
+    std::function<void()>   m_func;     /**< Function to be executed. */
 };
 
 //! @brief  Scheduler for scheduling tasks.
 /**
- * Scheduler will pick a task without any dependencies that has highest priority. If there are
- * multiple candidate tasks, a random one will be picked. Each task dependencies will only be
- * removed after it is fully finished, not after it gets started.
+ * Scheduler is a work-stealing scheduler. Each worker thread owns its own queue of tasks that are
+ * ready to be executed. A worker always picks the highest priority task in its own queue first, if
+ * its own queue is empty, it will try stealing the highest priority task of other workers' queue.
+ * Tasks that become available because of a finished dependency are pushed in the queue of the
+ * thread finishing the dependency, the same goes for newly scheduled tasks without dependencies.
+ * Unless the task has an affinity, in which case it is pushed in the queue of that worker thread.
+ * Since each queue only gets touched by other threads when they have nothing left to do, there is
+ * barely any contention in a busy system.
+ * Priority is respected in each queue, but not strictly respected across different queues. Each
+ * task dependencies will only be removed after it is fully finished, not after it gets started.
+ * There is no global lock in the scheduler at all, finishing a task only touches the counters of
+ * its dependents.
  * Scheduler is thread-safe, which means that multiple threads can retrieve tasks from scheduler
- * concurrently.
+ * concurrently. A task is destroyed by the scheduler once it is finished, it is up to the higher
+ * level code to make sure a finished task is not used as a dependency of a newly scheduled task.
  */
 class Scheduler : public Singleton<Scheduler>{
-    /**< Task comparison functor. */
-    using Task_Comp = std::function<bool(const Task* , const Task*)>;
-    /**< Static task comparison functor based on its priority. */
-    static Task_Comp task_comp;
-    /**< Task queue for available tasks is actually a heap. */
-    using TaskQueue = std::priority_queue<Task*,std::vector<Task*>,decltype(task_comp)>;
-    /**< Task container for back-up tasks is just a hash container. */
-    using BackupTaskContainer = std::unordered_set<Task*>;
-    /**< Task container for keeping tasks alive. */
-    using TaskContainer = std::unordered_map<TaskID, std::unique_ptr<Task>>;
+    /**< Task comparison functor based on its priority. */
+    struct Task_Comp{
+        bool operator()( const Task* t0 , const Task* t1 ) const {
+            return t0->GetPriority() < t1->GetPriority();
+        }
+    };
+    /**< Task queue for available tasks is actually a heap, it is a plain vector so that it can be rebuilt after reprioritization. */
+    using TaskQueue = std::vector<Task*>;
+
+    //! @brief  Task queue owned by a worker thread.
+    /**
+     * A classic work stealing deque is LIFO for its owner and FIFO for thieves, which doesn't respect
+     * task priority at all. Instead, each worker owns a small heap protected by a spinlock. The owner
+     * and the thieves both pick the highest priority task in it. The lock is only contended when
+     * other threads are out of tasks, which is when it matters the least.
+     */
+    struct alignas(64) WorkerQueue{
+        spinlock_mutex              m_lock;             /**< Lock protecting the heap. */
+        TaskQueue                   m_tasks;            /**< Heap of available tasks. */
+        std::atomic<unsigned int>   m_size = { 0 };     /**< Number of tasks in the heap, this allows checking without locking. */
+
+        //! @brief  Push a task in the queue.
+        void    Push( Task* task );
+        //! @brief  Pop the task with highest priority in the queue.
+        Task*   Pop();
+        //! @brief  Update priorities of all tasks in the queue.
+        void    Reprioritize( const std::function<unsigned int(const Task&)>& priority );
+    };
 
 public:
+    //! @brief  Setup the number of worker queues.
+    //!
+    //! This needs to be called before any task is scheduled. By default, there are as many queues as
+    //! the number of hardware threads.
+    //!
+    //! @param  workerCnt   Number of worker threads, including the main thread.
+    void    Initialize( unsigned int workerCnt );
+
     //! @brief  Schedule a task.
     //!
+    //! The scheduler takes the ownership of the task, it will be available as soon as all its dependencies
+    //! are finished. Finished tasks are deleted by the scheduler, all dependencies have to be alive when the
+    //! task is scheduled.
+    //!
     //! @param  task        Task to be scheduled.
     //! @param              Raw pointer to the task.
     Task*    Schedule( std::unique_ptr<Task> task );
 
     //! @brief  Pick a task with highest priority, but no dependencies.
     //!
-    //! The scheduler will try picking a task with highest priority, but no dependencies.
+    //! The scheduler will try picking a task with highest priority in the queue of the current thread,
+    //! it will steal tasks from other threads if there is nothing left in its own queue.
     //! If there is no such a task available for now, the scheduler will hang the thread
     //! and share its CPU resources to other threads for executing. In the case of a cycle
     //! graph tasks, it will hang forever. The task picked will be removed from the data
@@ -169,27 +357,63 @@ public:
     //! @return    The task picked from scheduler.
     Task*   PickTask();
 
+    //! @brief  Pick a task that is available without blocking the thread.
+    //!
+    //! @return    The task picked from scheduler, nullptr if there is no available task at the moment.
+    Task*   TryPickTask();
+
+    //! @brief  Update priorities of tasks that are available but not started yet.
+    //!
+    //! This allows changing the order of scheduled work on the fly, like rendering tiles under the mouse
+    //! first. Tasks that are still waiting for their dependencies are not touched.
+    //!
+    //! @param  priority    Function returning the new priority of a task.
+    void    Reprioritize( const std::function<unsigned int(const Task&)>& priority );
+
+    //! @brief  Whether the worker threads are about to run out of tasks.
+    //!
+    //! Long running tasks can check this to hand part of their remaining work over to idle threads,
+    //! which is how the tail at the end of a frame is avoided.
+    //!
+    //! @return    True if there are fewer available tasks than worker threads.
+    bool    IsStarving() const {
+        return m_availableTaskCnt.load( std::memory_order_relaxed ) < m_queues.size();
+    }
+
     //! @brief  Remove dependencies for a task.
     //!
     //! Upon finish of each task, it needs to update scheduler it is finished so that other
     //! tasks depending on this task will get chance to be executed in the future.
+    //! The task will be destroyed in this function.
     //!
     //! @param task     Task that is finished. This task should not be in the scheduler.
-    void    TaskFinished( const Task* task );
+    void    TaskFinished( Task* task );
 
 private:
     //! @brief  Default constructor
-    Scheduler():m_availbleTasks(task_comp){}
+    Scheduler();
+
+    //! @brief  Push an available task in the queue of the current thread.
+    //!
+    //! @param task     Task that is ready to be executed.
+    void    pushAvailableTask( Task* task );
 
-    TaskQueue                   m_availbleTasks;        /**< Heap of available tasks. */
-    BackupTaskContainer         m_backupTasks;          /**< Container for all tasks not direct available. */
-    std::mutex                  m_mutex;                /**< Mutex to make sure scheduler is thread-safe. */
+    std::vector<std::unique_ptr<WorkerQueue>>   m_queues;           /**< Task queues, one for each worker thread. */
+    std::atomic<unsigned int>   m_availableTaskCnt = { 0 };         /**< Number of tasks in all queues. */
+    std::atomic<unsigned int>   m_aliveTaskCnt = { 0 };             /**< Number of tasks that are not finished yet. */
+
+    std::mutex                  m_sleepMutex;           /**< Mutex for idle threads to sleep on. */
     std::condition_variable     m_cv;                   /**< Conditional variable for pick task. */
-    TaskContainer               m_tasks;                /**< This holds all tasks to keep them alive. */
+    std::atomic<unsigned int>   m_sleepingCnt = { 0 };  /**< Number of threads sleeping. */
 
     friend class Singleton<Scheduler>;
+
+    SORT_STATS_ENABLE( "Scheduler" )
 };
 
+//! @brief      Get the current ongoing task.
+const Task* GetCurrentTask();
+
 //! @brief      Schedule a task in task scheduler.
 template<class T, typename... Args>
 SORT_FORCEINLINE Task*  SCHEDULE_TASK( const char* name , unsigned int priority , const Task::Task_Container& dependencies , Args&&... args ){
@@ -197,8 +421,30 @@ SORT_FORCEINLINE Task*  SCHEDULE_TASK( const char* name , unsigned int priority
     return Scheduler::GetSingleton().Schedule( std::move(ret) );
 }
 
+//! @brief      Spawn a child task of the current task.
+//!
+//! The current task won't be considered finished until its children are all done. A task can wait for
+//! its children to be finished through WAIT_FOR_CHILDREN in the middle of its execution.
+template<class T, typename... Args>
+SORT_FORCEINLINE Task*  SPAWN_TASK( const char* name , unsigned int priority , const Task::Task_Container& dependencies , Args&&... args ){
+    auto ret = std::make_unique<T>(args..., name, priority, dependencies);
+    ret->SetParent( const_cast<Task*>(GetCurrentTask()) );
+    return Scheduler::GetSingleton().Schedule( std::move(ret) );
+}
+
 //! @brief      Executing tasks. It will exit if there is no other tasks.
 void        EXECUTING_TASKS();
 
-//! @brief      Get the current ongoing task.
-const Task* GetCurrentTask();
\ No newline at end of file
+//! @brief      Wait for all children of the current task to be finished.
+//!
+//! Instead of blocking the thread, the current thread will keep executing other available tasks, including the
+//! children of the current task, until all children are finished.
+void        WAIT_FOR_CHILDREN();
+
+//! @brief      Wait until a condition is met.
+//!
+//! Like WAIT_FOR_CHILDREN, the current thread keeps executing other available tasks in the meantime. This is for
+//! waiting on work that is not a child of the current task, like resources loaded in their own tasks.
+//!
+//! @param      done    Whether the condition is met, it is checked between tasks.
+void        WAIT_UNTIL( const std::function<bool()>& done );
@@ -0,0 +1,323 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <random>
+#include "thirdparty/gtest/gtest.h"
+#include "accel/auto.h"
+#include "accel/bvh.h"
+#include "accel/octree.h"
+#ifdef SORT_ENABLE_EMBREE
+#include "accel/embree.h"
+#endif
+#include "entity/visual.h"
+#include "shape/triangle.h"
+#include "core/primitive.h"
+
+// The decision only depends on statistics of primitives, so it is tested without any geometry.
+TEST(ACCELERATOR, AutoPick) {
+    AutoAccelStats stats;
+    stats.primitive_cnt = stats.triangle_cnt = 100;
+    stats.sah_build_time = 0.001f;
+    EXPECT_TRUE( Auto::PickAccelerator( stats , 0.0f ).type == SID( "Bvh" ) );
+
+    // without a budget, a SAH BVH is always built
+    stats.primitive_cnt = stats.triangle_cnt = 100000;
+    stats.sah_build_time = 10.0f;
+    auto choice = Auto::PickAccelerator( stats , 0.0f );
+    EXPECT_TRUE( choice.type != SID( "Lbvh" ) && choice.type != SID( "UniGrid" ) );
+    EXPECT_FALSE( choice.spatial_split );
+
+    // primitives of similar sizes are put in a grid if the budget is tight
+    EXPECT_TRUE( Auto::PickAccelerator( stats , 1.0f ).type == SID( "UniGrid" ) );
+
+    // otherwise LBVH is built
+    stats.size_spread = 2.0f;
+    choice = Auto::PickAccelerator( stats , 1.0f );
+    EXPECT_TRUE( choice.type == SID( "Lbvh" ) );
+
+    // hair is built with spatial splits as long as there is enough time
+    stats.triangle_cnt = 0;
+    stats.line_cnt = stats.primitive_cnt;
+    stats.sah_build_time = 0.1f;
+    EXPECT_TRUE( Auto::PickAccelerator( stats , 1.0f ).spatial_split );
+    EXPECT_FALSE( Auto::PickAccelerator( stats , 0.15f ).spatial_split );
+}
+
+// The OcTree, whether it is traversed with SIMD or not, finds the same closest intersections as testing all triangles.
+TEST(ACCELERATOR, OcTree) {
+    constexpr auto TRIANGLE_CNT = 2000u;
+    constexpr auto RAY_CNT = 2000u;
+
+    std::mt19937 rng( 0x5eed );
+    std::uniform_real_distribution<float> canonical( -1.0f , 1.0f );
+    const auto random_point = [&](){
+        const auto x = canonical( rng ) , y = canonical( rng ) , z = canonical( rng );
+        return Point( x , y , z );
+    };
+
+    // triangles of very different sizes so that some of them span across many leaves
+    auto visual = std::make_unique<MeshVisual>();
+    visual->m_memory = std::make_unique<Mesh>();
+    visual->m_memory->m_vertices.resize( TRIANGLE_CNT * 3 );
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        const auto center = random_point();
+        const auto size = i % 10 ? 0.05f : 0.5f;
+        for( auto k = 0u ; k < 3 ; ++k )
+            visual->m_memory->m_vertices[i * 3 + k].m_position = center + ( random_point() - Point( 0.0f ) ) * size;
+
+        MeshFaceIndex index;
+        index.m_id[0] = i * 3;
+        index.m_id[1] = i * 3 + 1;
+        index.m_id[2] = i * 3 + 2;
+        visual->m_memory->m_indices.push_back( index );
+    }
+
+    std::vector<std::unique_ptr<Triangle>> triangles;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    BBox bbox;
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        triangles.push_back( std::make_unique<Triangle>( visual.get() , visual->m_memory->m_indices[i] ) );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , triangles.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        bbox.Union( primitives.back()->GetBBox() );
+    }
+
+    OcTree octree;
+    octree.Build( primitives , bbox );
+    ASSERT_TRUE( octree.GetIsValid() );
+
+    auto mismatch = 0u;
+    for( auto i = 0u ; i < RAY_CNT ; ++i ){
+        const auto ori = Point( 0.0f ) + normalize( random_point() - Point( 0.0f ) ) * 3.0f;
+        const Ray ray( ori , normalize( random_point() - ori ) );
+        ray.Prepare();
+
+        SurfaceInteraction expected;
+        for( const auto primitive : primitives )
+            primitive->GetIntersect( ray , &expected );
+
+        SurfaceInteraction intersection;
+        const auto hit = octree.GetIntersect( ray , intersection );
+        EXPECT_EQ( hit , IS_PTR_VALID( expected.primitive ) );
+        mismatch += intersection.primitive != expected.primitive;
+    }
+
+    // rays grazing shared edges could numerically pick a different triangle, but they should be really rare.
+    EXPECT_LE( mismatch , RAY_CNT / 200 );
+}
+
+#ifdef SORT_ENABLE_EMBREE
+// Triangles traced by Embree itself find the same closest intersections as testing all of them.
+TEST(ACCELERATOR, Embree) {
+    constexpr auto TRIANGLE_CNT = 2000u;
+    constexpr auto RAY_CNT = 2000u;
+
+    std::mt19937 rng( 0x5eed );
+    std::uniform_real_distribution<float> canonical( -1.0f , 1.0f );
+    const auto random_point = [&](){
+        const auto x = canonical( rng ) , y = canonical( rng ) , z = canonical( rng );
+        return Point( x , y , z );
+    };
+
+    // two meshes, all triangles of the first one share its index buffer, only every other one of the second is used
+    std::unique_ptr<MeshVisual> visuals[2];
+    for( auto& visual : visuals ){
+        visual = std::make_unique<MeshVisual>();
+        visual->m_memory = std::make_unique<Mesh>();
+        visual->m_memory->m_vertices.resize( TRIANGLE_CNT * 3 );
+        for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+            const auto center = random_point();
+            for( auto k = 0u ; k < 3 ; ++k )
+                visual->m_memory->m_vertices[i * 3 + k].m_position = center + ( random_point() - Point( 0.0f ) ) * 0.1f;
+
+            MeshFaceIndex index;
+            index.m_id[0] = i * 3;
+            index.m_id[1] = i * 3 + 1;
+            index.m_id[2] = i * 3 + 2;
+            visual->m_memory->m_indices.push_back( index );
+        }
+    }
+
+    std::vector<std::unique_ptr<Triangle>> triangles;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    BBox bbox;
+    for( auto i = 0u ; i < TRIANGLE_CNT * 2 ; ++i ){
+        const auto& visual = visuals[i / TRIANGLE_CNT];
+        if( i >= TRIANGLE_CNT && i % 2 )
+            continue;
+        triangles.push_back( std::make_unique<Triangle>( visual.get() , visual->m_memory->m_indices[i % TRIANGLE_CNT] ) );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , triangles.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        bbox.Union( primitives.back()->GetBBox() );
+    }
+
+    Embree embree;
+    embree.Build( primitives , bbox );
+    ASSERT_TRUE( embree.GetIsValid() );
+
+    auto mismatch = 0u;
+    for( auto i = 0u ; i < RAY_CNT ; ++i ){
+        const auto ori = Point( 0.0f ) + normalize( random_point() - Point( 0.0f ) ) * 3.0f;
+        const Ray ray( ori , normalize( random_point() - ori ) );
+        ray.Prepare();
+
+        SurfaceInteraction expected;
+        for( const auto primitive : primitives )
+            primitive->GetIntersect( ray , &expected );
+
+        SurfaceInteraction intersection;
+        const auto hit = embree.GetIntersect( ray , intersection );
+        EXPECT_EQ( hit , IS_PTR_VALID( expected.primitive ) );
+        mismatch += intersection.primitive != expected.primitive;
+        if( intersection.primitive == expected.primitive && hit )
+            EXPECT_NEAR( intersection.t , expected.t , 1e-4f );
+    }
+
+    // rays grazing shared edges could numerically pick a different triangle, but they should be really rare.
+    EXPECT_LE( mismatch , RAY_CNT / 200 );
+}
+#endif
+
+// Moving triangles are only hit where they are at the time of the ray, the BVH bounds follow them through the shutter.
+TEST(ACCELERATOR, MotionBlur) {
+    constexpr auto TRIANGLE_CNT = 500u;
+    constexpr auto RAY_CNT = 2000u;
+
+    std::mt19937 rng( 0x5eed );
+    std::uniform_real_distribution<float> canonical( -1.0f , 1.0f );
+    const auto random_point = [&](){
+        const auto x = canonical( rng ) , y = canonical( rng ) , z = canonical( rng );
+        return Point( x , y , z );
+    };
+
+    auto visual = std::make_unique<MeshVisual>();
+    visual->m_memory = std::make_unique<Mesh>();
+    visual->m_memory->m_vertices.resize( TRIANGLE_CNT * 3 );
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        const auto center = random_point();
+        for( auto k = 0u ; k < 3 ; ++k )
+            visual->m_memory->m_vertices[i * 3 + k].m_position = center + ( random_point() - Point( 0.0f ) ) * 0.05f;
+
+        MeshFaceIndex index;
+        index.m_id[0] = i * 3;
+        index.m_id[1] = i * 3 + 1;
+        index.m_id[2] = i * 3 + 2;
+        visual->m_memory->m_indices.push_back( index );
+    }
+    visual->m_memory->ApplyMotion( Transform() , Translate( 1.0f , 0.0f , 0.0f ) );
+    ASSERT_TRUE( visual->m_memory->IsMoving() );
+
+    std::vector<std::unique_ptr<Triangle>> triangles;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    BBox bbox;
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        triangles.push_back( std::make_unique<Triangle>( visual.get() , visual->m_memory->m_indices[i] ) );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , triangles.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        bbox.Union( primitives.back()->GetBBox() );
+    }
+
+    Bvh bvh;
+    bvh.Build( primitives , bbox );
+    ASSERT_TRUE( bvh.GetIsValid() );
+
+    std::uniform_real_distribution<float> shutter( 0.0f , 1.0f );
+    auto mismatch = 0u;
+    for( auto i = 0u ; i < RAY_CNT ; ++i ){
+        const auto ori = Point( 0.5f , 0.0f , 0.0f ) + normalize( random_point() - Point( 0.0f ) ) * 3.0f;
+        Ray ray( ori , normalize( random_point() - ori ) );
+        ray.m_time = shutter( rng );
+        ray.Prepare();
+
+        SurfaceInteraction expected;
+        for( const auto primitive : primitives )
+            primitive->GetIntersect( ray , &expected );
+
+        SurfaceInteraction intersection;
+        const auto hit = bvh.GetIntersect( ray , intersection );
+        EXPECT_EQ( hit , IS_PTR_VALID( expected.primitive ) );
+        mismatch += intersection.primitive != expected.primitive;
+    }
+    EXPECT_LE( mismatch , RAY_CNT / 200 );
+}
+
+// Shadow rays blocked by opaque triangles report one of them, which blocks the ray on its own too.
+TEST(ACCELERATOR, ShadowOccluder) {
+    constexpr auto TRIANGLE_CNT = 2000u;
+    constexpr auto RAY_CNT = 2000u;
+
+    std::mt19937 rng( 0x5eed );
+    std::uniform_real_distribution<float> canonical( -1.0f , 1.0f );
+    const auto random_point = [&](){
+        const auto x = canonical( rng ) , y = canonical( rng ) , z = canonical( rng );
+        return Point( x , y , z );
+    };
+
+    auto visual = std::make_unique<MeshVisual>();
+    visual->m_memory = std::make_unique<Mesh>();
+    visual->m_memory->m_vertices.resize( TRIANGLE_CNT * 3 );
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        const auto center = random_point();
+        for( auto k = 0u ; k < 3 ; ++k )
+            visual->m_memory->m_vertices[i * 3 + k].m_position = center + ( random_point() - Point( 0.0f ) ) * 0.1f;
+
+        MeshFaceIndex index;
+        index.m_id[0] = i * 3;
+        index.m_id[1] = i * 3 + 1;
+        index.m_id[2] = i * 3 + 2;
+        visual->m_memory->m_indices.push_back( index );
+    }
+
+    std::vector<std::unique_ptr<Triangle>> triangles;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    BBox bbox;
+    for( auto i = 0u ; i < TRIANGLE_CNT ; ++i ){
+        triangles.push_back( std::make_unique<Triangle>( visual.get() , visual->m_memory->m_indices[i] ) );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , triangles.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        bbox.Union( primitives.back()->GetBBox() );
+    }
+
+    OcTree octree;
+    octree.Build( primitives , bbox );
+    ASSERT_TRUE( octree.GetIsValid() );
+
+    auto blocked = 0u;
+    for( auto i = 0u ; i < RAY_CNT ; ++i ){
+        const auto ori = Point( 0.0f ) + normalize( random_point() - Point( 0.0f ) ) * 3.0f;
+        const auto target = random_point();
+        const Ray shadow_ray( ori , normalize( target - ori ) , 0 , 0.0f , ( target - ori ).Length() );
+        shadow_ray.Prepare();
+
+        auto ray = shadow_ray;
+        Spectrum attenuation( 1.0f );
+        const Primitive* occluder = nullptr;
+        if( !octree.GetAttenuation( ray , attenuation , nullptr , &occluder ) )
+            continue;
+
+        ++blocked;
+        ASSERT_TRUE( attenuation.IsBlack() );
+        ASSERT_TRUE( IS_PTR_VALID( occluder ) );
+        EXPECT_TRUE( occluder->IsOpaque() );
+        EXPECT_TRUE( occluder->GetIntersect( shadow_ray , nullptr ) );
+    }
+    EXPECT_GT( blocked , 0u );
+}
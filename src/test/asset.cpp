@@ -0,0 +1,131 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include "thirdparty/gtest/gtest.h"
+#include "core/assetresolver.h"
+#include "platform/socket/socket.h"
+
+// Content of the assets served by the fetcher, keyed by the url.
+static std::string assetContent( const std::string& url ){
+    return url.find( "copy" ) != std::string::npos ? "shared content" : "content of " + url;
+}
+
+// Each run has its own cache folder, assets cached by previous runs would not be fetched at all.
+static std::string cacheFolder(){
+    return "test_asset_cache_" + std::to_string( std::chrono::system_clock::now().time_since_epoch().count() );
+}
+
+static std::string readAll( const std::string& filename ){
+    std::ifstream file( filename , std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ) , std::istreambuf_iterator<char>() );
+}
+
+// A fetcher counting how many times it is asked for assets.
+class CountingFetcher : public AssetFetcher{
+public:
+    CountingFetcher( std::atomic<int>& cnt ) : m_cnt( cnt ) {}
+
+    bool Fetch( const std::string& url , const std::string& filename ) override{
+        ++m_cnt;
+        if( url.find( "missing" ) != std::string::npos )
+            return false;
+        std::ofstream( filename , std::ios::binary ) << assetContent( url );
+        return true;
+    }
+
+private:
+    std::atomic<int>&   m_cnt;
+};
+
+TEST(ASSET, ContentAddressedCache) {
+    auto& resolver = AssetResolver::GetSingleton();
+    std::atomic<int> cnt = { 0 };
+    resolver.RegisterFetcher( "counting" , std::make_unique<CountingFetcher>( cnt ) );
+    resolver.SetCacheFolder( cacheFolder() );
+
+    // local files are not touched at all
+    EXPECT_FALSE( AssetResolver::IsRemote( "C:\\textures\\a.png" ) );
+    EXPECT_EQ( resolver.Resolve( "textures/a.png" ) , "textures/a.png" );
+
+    // each asset is only fetched once no matter how many threads ask for it
+    std::vector<std::string> urls;
+    for( auto i = 0 ; i < 64 ; ++i )
+        urls.push_back( "counting://server/texture" + std::to_string( i % 8 ) + ".exr?version=1" );
+    urls.push_back( "counting://server/copy0.png" );
+    urls.push_back( "counting://server/copy1.png" );
+    resolver.Prefetch( urls );
+    resolver.Prefetch( urls );
+    EXPECT_EQ( cnt , 10 );
+
+    for( const auto& url : urls ){
+        const auto filename = resolver.Resolve( url );
+        ASSERT_FALSE( filename.empty() );
+        EXPECT_EQ( readAll( filename ) , assetContent( url ) );
+
+        // loaders depend on the extension
+        EXPECT_EQ( filename.substr( filename.size() - 4 ) , url.find( ".exr" ) != std::string::npos ? ".exr" : ".png" );
+    }
+    EXPECT_EQ( cnt , 10 );
+
+    // identical content is stored once
+    EXPECT_EQ( resolver.Resolve( "counting://server/copy0.png" ) , resolver.Resolve( "counting://server/copy1.png" ) );
+
+    // failures are reported as empty paths
+    EXPECT_TRUE( resolver.Resolve( "counting://server/missing.png" ).empty() );
+    EXPECT_TRUE( resolver.Resolve( "unknown://server/a.png" ).empty() );
+}
+
+TEST(ASSET, HttpFetch) {
+    Socket listener;
+    ASSERT_TRUE( listener.Listen( 27183 ) );
+
+    // a tiny http server redirecting the first request and serving the second one
+    const std::string body( 100000 , 'x' );
+    std::thread server( [&](){
+        for( auto i = 0 ; i < 2 ; ++i ){
+            auto socket = listener.Accept( 10000 );
+            if( !socket )
+                return;
+            std::string request;
+            char buffer[1024];
+            while( request.find( "\r\n\r\n" ) == std::string::npos ){
+                const auto received = socket->Receive( buffer , sizeof( buffer ) );
+                if( received <= 0 )
+                    return;
+                request.append( buffer , received );
+            }
+            const auto response = i == 0 ? std::string( "HTTP/1.0 302 Found\r\nLOCATION: /real.hdr\r\n\r\n" ) :
+                "HTTP/1.0 200 OK\r\nContent-Length: " + std::to_string( body.size() ) + "\r\n\r\n" + body;
+            socket->Send( response.c_str() , (int)response.size() );
+        }
+    } );
+
+    auto& resolver = AssetResolver::GetSingleton();
+    resolver.SetCacheFolder( cacheFolder() );
+    const std::string url = "http://127.0.0.1:27183/moved.hdr";
+    const auto filename = resolver.Resolve( url );
+    server.join();
+
+    ASSERT_FALSE( filename.empty() );
+    EXPECT_EQ( readAll( filename ) , body );
+    EXPECT_EQ( resolver.Resolve( url ) , filename );
+}
@@ -22,6 +22,7 @@
 #endif
 
 #include "simd.hpp"
+#include "simd_benchmark.hpp"
 
 #ifdef AVX_ENABLED
 #undef SIMD_AVX_IMPLEMENTATION
@@ -0,0 +1,57 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#pragma once
+
+// Benchmarks are tests disabled by default, they are run with
+//   --unittest --gtest_also_run_disabled_tests --gtest_filter=<BENCHMARK SUITE>.*
+// Each benchmark only times its own kernel with the helpers below and reports what it measures in one line.
+
+#include <chrono>
+#include <iostream>
+
+//! @brief  Time of running a function once in seconds.
+template<class T>
+double BenchmarkSeconds( const T& func ){
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+//! @brief  Average time of calling a function with 0 to cnt - 1 in nanoseconds per call.
+//!
+//! @param  cnt         Number of calls in each round.
+//! @param  rounds      Number of rounds, the first one is not timed to warm up the caches.
+//! @param  func        The function to be called, it takes the index of the call in its round.
+template<class T>
+double BenchmarkNanoseconds( unsigned cnt , unsigned rounds , const T& func ){
+    for( auto i = 0u ; i < cnt ; ++i )
+        func( i );
+
+    const auto seconds = BenchmarkSeconds( [&](){
+        for( auto round = 1u ; round < rounds ; ++round )
+            for( auto i = 0u ; i < cnt ; ++i )
+                func( i );
+    } );
+    return seconds * 1e9 / ( (double)( rounds - 1 ) * cnt );
+}
+
+//! @brief  Start a line of benchmark result, it is aligned with the messages of gtest.
+inline std::ostream& BenchmarkReport(){
+    return std::cout << "[ BENCHMARK] ";
+}
@@ -17,6 +17,9 @@
 
 #include <thread>
 #include <mutex>
+#include <cstdio>
+#include <fstream>
+#include <vector>
 #include "unittest_common.h"
 #include "thirdparty/gtest/gtest.h"
 #include "sampler/sample.h"
@@ -32,6 +35,8 @@
 #include "scatteringevent/bsdf/dielectric.h"
 #include "scatteringevent/bsdf/hair.h"
 #include "scatteringevent/bsdf/fabric.h"
+#include "scatteringevent/bsdf/merl.h"
+#include "scatteringevent/bsdf/fourierbxdf.h"
 
 // A physically based BRDF should obey the rule of reciprocity
 void checkReciprocity(const Bxdf* bxdf) {
@@ -123,6 +128,23 @@ void checkAll( const Bxdf* bxdf , bool cPdf = true , bool cReciprocity = true ,
         checkEnergyConservation(bxdf);
 }
 
+// Evaluating a bxdf along with its pdf should give the same result as evaluating them separately.
+void checkFPdf( const Bxdf* bxdf , bool upperHemisphere = false ){
+    for( auto i = 0 ; i < 256 ; ++i ){
+        const auto wo = upperHemisphere ? UniformSampleHemisphere( sort_canonical() , sort_canonical() ) : UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+        float pdf;
+        const auto f = bxdf->F_Pdf( wo , wi , pdf );
+        const auto f0 = bxdf->F( wo , wi );
+        const auto pdf0 = bxdf->Pdf( wo , wi );
+        EXPECT_NEAR( f.r , f0.r , fabs( f0.r ) * 1e-4f + 1e-6f );
+        EXPECT_NEAR( f.g , f0.g , fabs( f0.g ) * 1e-4f + 1e-6f );
+        EXPECT_NEAR( f.b , f0.b , fabs( f0.b ) * 1e-4f + 1e-6f );
+        EXPECT_NEAR( pdf , pdf0 , pdf0 * 1e-4f + 1e-6f );
+    }
+}
+
 TEST (BXDF, Labmert) {
     Lambert lambert( WHITE_SPECTRUM , WHITE_SPECTRUM , DIR_UP );
     checkAll( &lambert );
@@ -159,6 +181,28 @@ TEST(BXDF, DISABLED_Disney) {
     checkAll(&disney);
 }
 
+// Evaluating the Disney BRDF along with its pdf should give the same result as evaluating them separately.
+TEST(BXDF, DisneyFPdf) {
+    for( auto i = 0 ; i < 16 ; ++i ){
+        DisneyBRDF disney( Spectrum( sort_canonical() , sort_canonical() , sort_canonical() ) , sort_canonical() , sort_canonical() , sort_canonical() , sort_canonical() , sort_canonical() ,
+                           sort_canonical() , sort_canonical() , sort_canonical() , sort_canonical() , sort_canonical() , 0.0f ,
+                           sort_canonical() , sort_canonical() , i % 2 , FULL_WEIGHT , DIR_UP );
+        for( auto j = 0 ; j < 64 ; ++j ){
+            const auto wo = UniformSampleSphere( sort_canonical() , sort_canonical() );
+            const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+            float pdf;
+            const auto f = disney.F_Pdf( wo , wi , pdf );
+            const auto f0 = disney.F( wo , wi );
+            const auto pdf0 = disney.Pdf( wo , wi );
+            EXPECT_NEAR( f.r , f0.r , fabs( f0.r ) * 1e-5f );
+            EXPECT_NEAR( f.g , f0.g , fabs( f0.g ) * 1e-5f );
+            EXPECT_NEAR( f.b , f0.b , fabs( f0.b ) * 1e-5f );
+            EXPECT_NEAR( pdf , pdf0 , pdf0 * 1e-5f );
+        }
+    }
+}
+
 TEST(BXDF, DISABLED_MicroFacetReflection) {
     const FresnelConductor fresnel( 1.0f , 1.5f );
     const GGX ggx(0.5f, 0.5f);
@@ -166,6 +210,16 @@ TEST(BXDF, DISABLED_MicroFacetReflection) {
     checkAll(&mf);
 }
 
+TEST(BXDF, MicroFacetReflectionFPdf) {
+    const FresnelConductor fresnel( 1.0f , 1.5f );
+    const GGX ggx( sort_canonical() , sort_canonical() );
+    const Beckmann beckmann( sort_canonical() , sort_canonical() );
+    const MicroFacetReflection mf0( WHITE_SPECTRUM , &fresnel , &ggx , FULL_WEIGHT , DIR_UP );
+    const MicroFacetReflection mf1( WHITE_SPECTRUM , &fresnel , &beckmann , FULL_WEIGHT , DIR_UP , true );
+    checkFPdf( &mf0 );
+    checkFPdf( &mf1 );
+}
+
 TEST(BXDF, MicroFacetRefraction) {
     const FresnelConductor fresnel( 1.0f , 1.5f );
     const GGX ggx( sort_canonical() , sort_canonical() );
@@ -191,6 +245,104 @@ TEST(BXDF, DISABLED_DreamWork_Fabric) {
     test_fabric( 1.0f );
 }
 
+// MERL data in half floats takes half of the memory of floats, and evaluates to almost the same values.
+TEST(BXDF, MerlDataPrecision) {
+    static const char* filename = "test_merl.binary";
+    {
+        const unsigned dims[3] = { 90 , 90 , 180 };
+        std::vector<double> data( 3 * dims[0] * dims[1] * dims[2] );
+        for( auto& d : data )
+            d = sort_canonical() * 1000.0;
+        std::ofstream file( filename , std::ios::binary );
+        file.write( (const char*)dims , sizeof( dims ) );
+        file.write( (const char*)data.data() , sizeof( double ) * data.size() );
+    }
+
+    MerlData data , half_data( true );
+    ASSERT_TRUE( data.LoadResource( filename ) );
+    ASSERT_TRUE( half_data.LoadResource( filename ) );
+    EXPECT_EQ( data.GetDataSize() , 2 * ( half_data.GetDataSize() - sizeof( unsigned short ) ) );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto wo = UniformSampleHemisphere( sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleHemisphere( sort_canonical() , sort_canonical() );
+        const auto f0 = data.f( wo , wi );
+        const auto f1 = half_data.f( wo , wi );
+        EXPECT_NEAR( f0.r , f1.r , f0.r * 0.001f );
+        EXPECT_NEAR( f0.g , f1.g , f0.g * 0.001f );
+        EXPECT_NEAR( f0.b , f1.b , f0.b * 0.001f );
+    }
+
+    std::remove( filename );
+}
+
+// Save a Fourier bxdf file whose nodes all share the same coefficients.
+static void saveFourierBxdf( const char* filename , int nMu , int nMax , const std::vector<float>& coefficients , int offset ){
+    const int header[5] = { 1 , nMu , (int)coefficients.size() , nMax , 3 };
+    const int unused[4] = { 0 };
+    const float eta = 1.0f;
+    std::vector<float> mu( nMu ) , cdf( nMu * nMu , 1.0f );
+    std::vector<int> offsetAndLength;
+    for( auto i = 0 ; i < nMu ; ++i )
+        mu[i] = -1.0f + 2.0f * i / ( nMu - 1 );
+    for( auto i = 0 ; i < nMu * nMu ; ++i ){
+        offsetAndLength.push_back( offset );
+        offsetAndLength.push_back( nMax );
+    }
+
+    std::ofstream file( filename , std::ios::binary );
+    file.write( "SCATFUN\x01" , 8 );
+    file.write( (const char*)header , sizeof( header ) );
+    file.write( (const char*)unused , sizeof( unused ) );
+    file.write( (const char*)&eta , sizeof( eta ) );
+    file.write( (const char*)unused , sizeof( unused ) );
+    file.write( (const char*)mu.data() , sizeof( float ) * mu.size() );
+    file.write( (const char*)cdf.data() , sizeof( float ) * cdf.size() );
+    file.write( (const char*)offsetAndLength.data() , sizeof( int ) * offsetAndLength.size() );
+    file.write( (const char*)coefficients.data() , sizeof( float ) * coefficients.size() );
+}
+
+// Fourier bxdf tables are used in place from the mapped file, the interpolated series matches the one evaluated directly.
+TEST(BXDF, FourierBxdfData) {
+    static const char* filename = "test_fourier.bsdf";
+    static constexpr int nMu = 8 , nMax = 13;
+
+    // channels of Y, R and B, the constant term keeps the series positive
+    std::vector<float> coefficients( 3 * nMax );
+    for( auto i = 0 ; i < 3 * nMax ; ++i )
+        coefficients[i] = ( i % nMax == 0 ) ? 10.0f : sort_canonical() - 0.5f;
+
+    // coefficients beyond the end of the file are rejected
+    saveFourierBxdf( filename , nMu , nMax , coefficients , 1 );
+    EXPECT_FALSE( FourierBxdfData().LoadResource( filename ) );
+
+    saveFourierBxdf( filename , nMu , nMax , coefficients , 0 );
+    FourierBxdfData data;
+    ASSERT_TRUE( data.LoadResource( filename ) );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto wo = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const auto phi = std::acos( (double)cosDPhi( wo , -wi ) );
+        const auto series = [&]( int channel ){
+            auto value = 0.0;
+            for( auto k = 0 ; k < nMax ; ++k )
+                value += coefficients[channel * nMax + k] * std::cos( k * phi );
+            return (float)value;
+        };
+
+        const auto scale = 1.0f / fabs( cosTheta( wi ) );
+        const auto Y = series( 0 ) , R = series( 1 ) , B = series( 2 );
+        const auto expected = Spectrum( R , 1.39829f * Y - 0.100913f * B - 0.297375f * R , B ) * scale;
+        const auto f = data.f( wo , wi );
+        EXPECT_NEAR( f.r , expected.r , expected.r * 1e-4f );
+        EXPECT_NEAR( f.g , expected.g , expected.g * 1e-4f );
+        EXPECT_NEAR( f.b , expected.b , expected.b * 1e-4f );
+    }
+
+    std::remove( filename );
+}
+
 TEST(BXDF, DISABLED_HairFurnace) {
     Spectrum sigma_a = 0.0f;
 
@@ -237,6 +389,49 @@ TEST(BXDF, HairPDFConsistant) {
         for (float beta_n = 0.1f; beta_n < 1.0f; beta_n += 0.5f) {
             Hair hair( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT);
             checkPDF( &hair );
+
+            Hair tabulated( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT, false, true );
+            checkPDF( &tabulated );
+        }
+    }
+}
+
+// Hair bxdfs evaluated with the shared tables should match the ones computing everything at each hit.
+TEST(BXDF, HairTabulated) {
+    static const Spectrum sigma_a( 0.3f , 0.6f , 1.2f );
+
+    for (float beta_m = 0.1f; beta_m < 1.0f; beta_m += 0.3f) {
+        for (float beta_n = 0.1f; beta_n < 1.0f; beta_n += 0.3f) {
+            const Hair hair( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT );
+            const Hair tabulated( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT, false, true );
+
+            for( auto i = 0 ; i < 256 ; ++i ){
+                const auto wo = UniformSampleHemisphere( sort_canonical() , sort_canonical() );
+                const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+                const auto f0 = hair.f( wo , wi );
+                const auto f1 = tabulated.f( wo , wi );
+                EXPECT_NEAR( f1.r , f0.r , f0.r * 2e-3f + 1e-5f );
+                EXPECT_NEAR( f1.g , f0.g , f0.g * 2e-3f + 1e-5f );
+                EXPECT_NEAR( f1.b , f0.b , f0.b * 2e-3f + 1e-5f );
+
+                const auto pdf0 = hair.pdf( wo , wi );
+                EXPECT_NEAR( tabulated.pdf( wo , wi ) , pdf0 , pdf0 * 2e-3f + 1e-5f );
+
+            }
+        }
+    }
+}
+
+TEST(BXDF, HairFPdf) {
+    static const Spectrum sigma_a( 0.3f , 0.6f , 1.2f );
+
+    for (float beta_m = 0.1f; beta_m < 1.0f; beta_m += 0.3f) {
+        for (float beta_n = 0.1f; beta_n < 1.0f; beta_n += 0.3f) {
+            const Hair hair( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT );
+            const Hair tabulated( sigma_a, beta_m, beta_n, 1.55f, FULL_WEIGHT, false, true );
+            checkFPdf( &hair , true );
+            checkFPdf( &tabulated , true );
         }
     }
 }
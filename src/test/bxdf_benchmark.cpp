@@ -0,0 +1,210 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include "thirdparty/gtest/gtest.h"
+#include "benchmark.h"
+#include "sampler/sample.h"
+#include "spectrum/spectrum.h"
+#include "core/samplemethod.h"
+#include "scatteringevent/scatteringevent.h"
+#include "scatteringevent/bsdf/lambert.h"
+#include "scatteringevent/bsdf/orennayar.h"
+#include "scatteringevent/bsdf/phong.h"
+#include "scatteringevent/bsdf/ashikhmanshirley.h"
+#include "scatteringevent/bsdf/disney.h"
+#include "scatteringevent/bsdf/microfacet.h"
+#include "scatteringevent/bsdf/dielectric.h"
+#include "scatteringevent/bsdf/hair.h"
+#include "scatteringevent/bsdf/fabric.h"
+#include "scatteringevent/bsdf/distributionbrdf.h"
+#include "scatteringevent/bsdf/coat.h"
+#include "scatteringevent/bsdf/merl.h"
+#include "scatteringevent/bsdf/fourierbxdf.h"
+
+// Measured bxdfs need their data files, which are passed in through SORT_BENCHMARK_MERL and SORT_BENCHMARK_FOURIER.
+
+namespace {
+    //! @brief  Seed of the random number generator that generates the direction sets.
+    constexpr unsigned BENCHMARK_SEED = 0x5eed;
+
+    //! @brief  Number of directions in each direction set.
+    constexpr unsigned BENCHMARK_DIRECTION_CNT = 4096;
+
+    //! @brief  Number of times a direction set is evaluated, the first one is not timed to warm up the caches.
+    constexpr unsigned BENCHMARK_ROUND_CNT = 65;
+
+    //! @brief  Every bxdf is evaluated with the same directions and samples.
+    struct Bxdf_Benchmark_Data{
+        std::vector<Vector>     wo;         /**< Exitant directions in the upper hemisphere. */
+        std::vector<Vector>     wi;         /**< Incident directions on the whole sphere. */
+        std::vector<BsdfSample> samples;    /**< Samples for importance sampling the bxdf. */
+    };
+
+    const Bxdf_Benchmark_Data& benchmarkData(){
+        static const auto data = [](){
+            std::mt19937 rng( BENCHMARK_SEED );
+            std::uniform_real_distribution<float> canonical( 0.0f , 1.0f - FLT_EPSILON );
+            Bxdf_Benchmark_Data ret;
+            for( auto i = 0u ; i < BENCHMARK_DIRECTION_CNT ; ++i ){
+                const auto u0 = canonical( rng ) , v0 = canonical( rng );
+                ret.wo.push_back( UniformSampleHemisphere( u0 , v0 ) );
+                const auto u1 = canonical( rng ) , v1 = canonical( rng );
+                ret.wi.push_back( UniformSampleSphere( u1 , v1 ) );
+
+                BsdfSample bs;
+                bs.t = canonical( rng );
+                bs.u = canonical( rng );
+                bs.v = canonical( rng );
+                ret.samples.push_back( bs );
+            }
+            return ret;
+        }();
+        return data;
+    }
+
+    //! @brief  Average time of evaluating a direction set in nanoseconds per evaluation.
+    template<class T>
+    double measure( const T& eval ){
+        return BenchmarkNanoseconds( BENCHMARK_DIRECTION_CNT , BENCHMARK_ROUND_CNT , eval );
+    }
+}
+
+// Time F, Sample_F and Pdf of a bxdf, the results are accumulated so that none of the evaluation is optimized away.
+void benchmarkBxdf( const char* name , const Bxdf* bxdf ){
+    const auto& data = benchmarkData();
+
+    Spectrum f_sum , sample_sum;
+    auto pdf_sum = 0.0f;
+    const auto f_ns = measure( [&]( unsigned i ){
+        f_sum += bxdf->F( data.wo[i] , data.wi[i] );
+    } );
+    const auto sample_f_ns = measure( [&]( unsigned i ){
+        Vector wi;
+        float pdf = 0.0f;
+        sample_sum += bxdf->Sample_F( data.wo[i] , wi , data.samples[i] , &pdf );
+    } );
+    const auto pdf_ns = measure( [&]( unsigned i ){
+        pdf_sum += bxdf->Pdf( data.wo[i] , data.wi[i] );
+    } );
+
+    BenchmarkReport() << name << ": F " << f_ns << "(ns), Sample_F " << sample_f_ns << "(ns), Pdf " << pdf_ns << "(ns)" << std::endl;
+
+    EXPECT_FALSE( IsNan( f_sum.GetIntensity() ) );
+    EXPECT_FALSE( IsNan( sample_sum.GetIntensity() ) );
+    EXPECT_FALSE( IsNan( pdf_sum ) );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Lambert) {
+    Lambert lambert( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "Lambert" , &lambert );
+
+    LambertTransmission lambert_transmission( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "LambertTransmission" , &lambert_transmission );
+
+    OrenNayar orenNayar( WHITE_SPECTRUM , 0.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "OrenNayar" , &orenNayar );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Analytic) {
+    Phong phong( WHITE_SPECTRUM * 0.5f , WHITE_SPECTRUM * 0.5f , 0.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "Phong" , &phong );
+
+    AshikhmanShirley as( WHITE_SPECTRUM , 0.5f , 0.3f , 0.6f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "AshikhmanShirley" , &as );
+
+    DistributionBRDF distribution( WHITE_SPECTRUM , 0.5f , 0.5f , 0.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "DistributionBRDF" , &distribution );
+
+    Fabric fabric( WHITE_SPECTRUM , 0.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "Fabric" , &fabric );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Disney) {
+    DisneyBRDF disney( WHITE_SPECTRUM , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f , 0.5f ,
+                       0.5f , 0.5f , 0 , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "Disney" , &disney );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Microfacet) {
+    const FresnelConductor fresnel( 1.0f , 1.5f );
+    const GGX ggx( 0.3f , 0.5f );
+    MicroFacetReflection reflection( WHITE_SPECTRUM , &fresnel , &ggx , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "MicroFacetReflection" , &reflection );
+
+    MicroFacetRefraction refraction( WHITE_SPECTRUM , &ggx , 1.0f , 1.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "MicroFacetRefraction" , &refraction );
+
+    Dielectric dielectric( WHITE_SPECTRUM , WHITE_SPECTRUM , &ggx , 1.0f , 1.5f , FULL_WEIGHT , DIR_UP );
+    benchmarkBxdf( "Dielectric" , &dielectric );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Hair) {
+    Hair hair( 0.1f , 0.3f , 0.3f , 1.55f , FULL_WEIGHT );
+    benchmarkBxdf( "Hair" , &hair );
+
+    Hair tabulated( 0.1f , 0.3f , 0.3f , 1.55f , FULL_WEIGHT , false , true );
+    benchmarkBxdf( "Hair (tabulated)" , &tabulated );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Coat) {
+    SurfaceInteraction intersection;
+    intersection.normal = DIR_UP;
+    intersection.gnormal = DIR_UP;
+    intersection.tangent = Vector( 1.0f , 0.0f , 0.0f );
+
+    Lambert lambert( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP );
+    ScatteringEvent bottom( intersection , SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+    bottom.AddBxdf( &lambert );
+
+    ClosureTypeCoat params;
+    params.closure = nullptr;
+    params.roughness = 0.3f;
+    params.ior = 1.5f;
+    params.sigma = Tsl_Namespace::make_float3( 0.1f , 0.1f , 0.1f );
+    params.normal = Tsl_Namespace::make_float3( DIR_UP.x , DIR_UP.y , DIR_UP.z );
+    Coat coat( params , FULL_WEIGHT , &bottom );
+    benchmarkBxdf( "Coat" , &coat );
+}
+
+TEST(BXDF_BENCHMARK, DISABLED_Measured) {
+    const auto normal = Tsl_Namespace::make_float3( DIR_UP.x , DIR_UP.y , DIR_UP.z );
+
+    if( const auto filename = std::getenv( "SORT_BENCHMARK_MERL" ) ){
+        MerlData data;
+        ASSERT_TRUE( data.LoadResource( filename ) );
+
+        ClosureTypeMERL params;
+        params.merl_data = &data;
+        params.normal = normal;
+        Merl merl( params , FULL_WEIGHT );
+        benchmarkBxdf( "Merl" , &merl );
+    }
+
+    if( const auto filename = std::getenv( "SORT_BENCHMARK_FOURIER" ) ){
+        FourierBxdfData data;
+        ASSERT_TRUE( data.LoadResource( filename ) );
+
+        ClosureTypeFourier params;
+        params.measured_data = &data;
+        params.normal = normal;
+        FourierBxdf fourier( params , FULL_WEIGHT );
+        benchmarkBxdf( "FourierBxdf" , &fourier );
+    }
+}
@@ -23,6 +23,7 @@
 #include "scatteringevent/bsdf/disney.h"
 #include <thread>
 #include "core/samplemethod.h"
+#include "stream/mstream.h"
 
 // Check PDF evaluation
 void checkDist( const MicroFacetDistribution* dist ){
@@ -67,6 +68,39 @@ TEST(DISTRIBUTION, DISABLED_Blinn) {
     checkAll(&blinn);
 }
 
+// Visible normals are sampled exactly as the PDF describes, which integrates to one over the hemisphere.
+void checkVisibleNormal( const MicroFacetDistribution* dist , const Vector& wo ){
+    const auto pdf_total = ParrallReduction<double, 8, 1024 * 256>( [&](){
+            const Vector h = UniformSampleHemisphere(sort_canonical(), sort_canonical());
+            return dist->PdfVisibleNormal(wo, h) / UniformHemispherePdf();
+        } );
+    EXPECT_NEAR(pdf_total, 1.0f, 0.02f);
+
+    // The expected projected area of visible normals in the hemisphere, estimated through both visible normal sampling and uniform sampling.
+    const auto visible_total = ParrallReduction<double, 8, 1024 * 256>( [&](){
+            const auto h = dist->SampleVisibleNormal(wo, BsdfSample(true));
+            const auto pdf = dist->PdfVisibleNormal(wo, h);
+            return pdf > 0.0f && dot(wo, h) > 0.0f ? dist->Pdf(h) / pdf : 0.0f;
+        } );
+    const auto uniform_total = ParrallReduction<double, 8, 1024 * 256>( [&](){
+            const Vector h = UniformSampleHemisphere(sort_canonical(), sort_canonical());
+            return dot(wo, h) > 0.0f ? dist->Pdf(h) / UniformHemispherePdf() : 0.0f;
+        } );
+    EXPECT_NEAR(visible_total, uniform_total, 0.02f);
+}
+
+TEST(DISTRIBUTION, GGXVisibleNormal) {
+    const GGX ggx(0.7f, 0.5f);
+    checkVisibleNormal(&ggx, normalize(Vector(0.3f, 0.8f, 0.2f)));
+    checkVisibleNormal(&ggx, normalize(Vector(0.9f, 0.1f, -0.3f)));
+}
+
+TEST(DISTRIBUTION, BeckmannVisibleNormal) {
+    const Beckmann beckmann(0.7f, 0.5f);
+    checkVisibleNormal(&beckmann, normalize(Vector(0.3f, 0.8f, 0.2f)));
+    checkVisibleNormal(&beckmann, normalize(Vector(0.9f, 0.1f, -0.3f)));
+}
+
 #if 0
 // Somehow, this unit test always fails. Need to investigate.
 TEST(DISTRIBUTION, ClearcoatGGX) {
@@ -74,3 +108,121 @@ TEST(DISTRIBUTION, ClearcoatGGX) {
     checkAll(&cggx);
 }
 #endif
+
+// Importance sampling tables loaded from a stream sample exactly the same as the ones they were saved from.
+TEST(DISTRIBUTION, Distribution2DSerialization) {
+    static constexpr unsigned NU = 33, NV = 17;
+    std::vector<float> data( NU * NV );
+    for( auto& d : data )
+        d = sort_canonical() < 0.2f ? 0.0f : sort_canonical();
+    Distribution2D distribution( data.data() , NU , NV );
+
+    IMemoryStream out;
+    distribution.Serialize( out );
+    OMemoryStream in( out );
+    Distribution2D loaded( in );
+    EXPECT_EQ( loaded.GetWidth() , NU );
+    EXPECT_EQ( loaded.GetHeight() , NV );
+
+    for( auto k = 0 ; k < 1024 ; ++k ){
+        const auto u = sort_canonical() , v = sort_canonical();
+        EXPECT_EQ( loaded.Pdf( u , v ) , distribution.Pdf( u , v ) );
+
+        float uv0[2] , uv1[2] , pdf0 , pdf1;
+        distribution.SampleContinuous( u , v , uv0 , &pdf0 );
+        loaded.SampleContinuous( u , v , uv1 , &pdf1 );
+        EXPECT_EQ( uv0[0] , uv1[0] );
+        EXPECT_EQ( uv0[1] , uv1[1] );
+        EXPECT_EQ( pdf0 , pdf1 );
+    }
+}
+
+// Buckets are picked as often as their share of the total, empty ones are never picked.
+TEST(DISTRIBUTION, Distribution1DAlias) {
+    static constexpr unsigned N = 37;
+    static constexpr unsigned SAMPLE_CNT = 1024 * 1024;
+    float data[N];
+    for( auto& d : data )
+        d = sort_canonical() < 0.2f ? 0.0f : sort_canonical();
+    const Distribution1D distribution( data , N );
+
+    unsigned histogram[N] = { 0 };
+    for( auto k = 0u ; k < SAMPLE_CNT ; ++k ){
+        const auto u = ( k + sort_canonical() ) / SAMPLE_CNT;
+        float pdf;
+        const auto i = distribution.SampleDiscrete( std::min( u , 1.0f ) , &pdf );
+        ASSERT_GE( i , 0 );
+        ASSERT_LT( i , (int)N );
+        EXPECT_GT( data[i] , 0.0f );
+        EXPECT_EQ( pdf , distribution.GetProperty( i ) );
+        ++histogram[i];
+
+        // continuous samples land in a bucket with the matching density, samples right on the edge of two buckets are
+        // skipped since rounding could put them on either side
+        const auto x = distribution.SampleContinuous( std::min( u , 1.0f ) , &pdf );
+        EXPECT_GE( x , 0.0f );
+        EXPECT_LT( x , 1.0f );
+        const auto bucket = x * N;
+        if( fabs( bucket - std::round( bucket ) ) > 1e-4f )
+            EXPECT_NEAR( pdf , distribution.GetProperty( std::min( (unsigned)bucket , N - 1 ) ) * N , 1e-4f );
+    }
+
+    for( auto i = 0u ; i < N ; ++i )
+        EXPECT_NEAR( (float)histogram[i] / SAMPLE_CNT , data[i] / distribution.GetSum() , 0.002f );
+
+    // edges of the canonical range
+    EXPECT_GT( data[ distribution.SampleDiscrete( 0.0f , nullptr ) ] , 0.0f );
+    EXPECT_GT( data[ distribution.SampleDiscrete( 1.0f , nullptr ) ] , 0.0f );
+}
+
+// Continuous samples keep the order of the canonical numbers, stratified numbers stay stratified after warping.
+TEST(DISTRIBUTION, Distribution1DMonotonic) {
+    static constexpr unsigned N = 37;
+    static constexpr unsigned SAMPLE_CNT = 1024 * 16;
+    float data[N];
+    for( auto& d : data )
+        d = sort_canonical() < 0.2f ? 0.0f : sort_canonical();
+    const Distribution1D distribution( data , N );
+
+    auto last = 0.0f;
+    for( auto k = 0u ; k <= SAMPLE_CNT ; ++k ){
+        const auto x = distribution.SampleContinuous( (float)k / SAMPLE_CNT , nullptr );
+        EXPECT_GE( x , last );
+        last = x;
+    }
+}
+
+// Samples stay inside the window, and the expectation of 1/pdf is the area of the window with non-zero density.
+TEST(DISTRIBUTION, WindowedDistribution2D) {
+    static constexpr unsigned NU = 23, NV = 31;
+    static constexpr unsigned SAMPLE_CNT = 1024 * 256;
+    std::vector<float> data( NU * NV );
+    for( auto& d : data )
+        d = 0.1f + sort_canonical();
+    const WindowedDistribution2D distribution( data.data() , NU , NV );
+
+    // integral over the whole domain is the average of the data
+    auto sum = 0.0;
+    for( const auto d : data )
+        sum += d;
+    EXPECT_NEAR( distribution.Integral( 0.0f , 0.0f , 1.0f , 1.0f ) , sum / ( NU * NV ) , 1e-4f );
+
+    const float window[4] = { 0.13f , 0.41f , 0.77f , 0.52f };
+    const auto area = ( window[2] - window[0] ) * ( window[3] - window[1] );
+    auto total = 0.0;
+    for( auto k = 0u ; k < SAMPLE_CNT ; ++k ){
+        float uv[2] , pdf = 0.0f;
+        ASSERT_TRUE( distribution.SampleContinuous( sort_canonical() , sort_canonical() , window , uv , &pdf ) );
+        EXPECT_GE( uv[0] , window[0] );
+        EXPECT_LE( uv[0] , window[2] );
+        EXPECT_GE( uv[1] , window[1] );
+        EXPECT_LE( uv[1] , window[3] );
+        ASSERT_GT( pdf , 0.0f );
+        EXPECT_EQ( pdf , distribution.Pdf( uv[0] , uv[1] , window ) );
+        total += 1.0 / pdf;
+    }
+    EXPECT_NEAR( total / SAMPLE_CNT , area , area * 0.01f );
+
+    // nothing outside of the window is sampled
+    EXPECT_EQ( distribution.Pdf( 0.1f , 0.45f , window ) , 0.0f );
+}
@@ -0,0 +1,333 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <cstdio>
+#include "core/define.h"
+#include "thirdparty/gtest/gtest.h"
+#include "imagesensor/splatbuffer.h"
+#include "imagesensor/checkpoint.h"
+#include "imagesensor/tiledexrwriter.h"
+#include "imagesensor/aov.h"
+#include "imagesensor/denoiser.h"
+#include "imagesensor/imageoutput.h"
+#include "imagesensor/filteredfilm.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
+#include "core/rand.h"
+
+TEST(ImageSensor, SplatBuffer) {
+    // the image size is not a multiple of the block size on purpose
+    const auto w = 3 * SPLAT_BLOCK_SIZE + 5;
+    const auto h = 2 * SPLAT_BLOCK_SIZE + 3;
+    SplatBuffer buffer( w , h , 4 );
+    EXPECT_TRUE( buffer.IsEmpty() );
+    EXPECT_EQ( buffer.Get( 0 , 0 ).r , 0.0f );
+
+    // splat on block borders and image borders
+    for( auto k = 0 ; k < 10 ; ++k ){
+        buffer.Splat( SPLAT_BLOCK_SIZE - 1 , SPLAT_BLOCK_SIZE , Spectrum( 1.0f , 2.0f , 3.0f ) );
+        buffer.Splat( w - 1 , h - 1 , Spectrum( 0.5f ) );
+    }
+    EXPECT_FALSE( buffer.IsEmpty() );
+
+    const auto c0 = buffer.Get( SPLAT_BLOCK_SIZE - 1 , SPLAT_BLOCK_SIZE );
+    EXPECT_EQ( c0.r , 10.0f );
+    EXPECT_EQ( c0.g , 20.0f );
+    EXPECT_EQ( c0.b , 30.0f );
+    EXPECT_EQ( buffer.Get( w - 1 , h - 1 ).g , 5.0f );
+
+    // pixels next to the splatted ones are untouched
+    EXPECT_EQ( buffer.Get( SPLAT_BLOCK_SIZE , SPLAT_BLOCK_SIZE ).r , 0.0f );
+    EXPECT_EQ( buffer.Get( w - 2 , h - 1 ).r , 0.0f );
+
+    buffer.Clear();
+    EXPECT_TRUE( buffer.IsEmpty() );
+    EXPECT_EQ( buffer.Get( w - 1 , h - 1 ).g , 0.0f );
+}
+
+TEST(ImageSensor, Checkpoint) {
+    // the image size is not a multiple of the tile size on purpose
+    const auto tile_size = 8;
+    const auto w = 2 * tile_size + 3;
+    const auto h = tile_size + 5;
+    RenderTarget rt( w , h );
+    for( auto y = 0 ; y < h ; ++y )
+        for( auto x = 0 ; x < w ; ++x )
+            rt.SetColor( x , y , Spectrum( (float)x , (float)y , 1.0f ) );
+
+    Checkpoint checkpoint( w , h , tile_size , 16 );
+    checkpoint.StoreTile( rt , Vector2i( tile_size , 0 ) , 16 );
+    checkpoint.StoreTile( rt , Vector2i( 2 * tile_size , tile_size ) , 4 );
+    EXPECT_FALSE( checkpoint.IsComplete() );
+    EXPECT_TRUE( checkpoint.Save( "test.checkpoint" ) );
+
+    // only the tiles in the checkpoint are loaded
+    RenderTarget loaded( w , h );
+    Checkpoint resumed( w , h , tile_size , 16 );
+    EXPECT_TRUE( resumed.Load( "test.checkpoint" , loaded ) );
+    EXPECT_EQ( resumed.GetTileSamples( Vector2i( 0 , 0 ) ) , 0u );
+    EXPECT_EQ( resumed.GetTileSamples( Vector2i( tile_size , 0 ) ) , 16u );
+    EXPECT_EQ( resumed.GetTileSamples( Vector2i( 2 * tile_size , tile_size ) ) , 4u );
+    EXPECT_EQ( loaded.GetColor( 0 , 0 ).b , 0.0f );
+    EXPECT_EQ( loaded.GetColor( tile_size + 3 , 5 ).r , (float)( tile_size + 3 ) );
+    EXPECT_EQ( loaded.GetColor( w - 1 , h - 1 ).g , (float)( h - 1 ) );
+    EXPECT_EQ( loaded.GetColor( w - 1 , h - 1 ).b , 1.0f );
+
+    // a checkpoint of different render settings is rejected
+    Checkpoint mismatched( w , h , tile_size , 32 );
+    EXPECT_FALSE( mismatched.Load( "test.checkpoint" , loaded ) );
+    EXPECT_EQ( mismatched.GetTileSamples( Vector2i( tile_size , 0 ) ) , 0u );
+
+    std::remove( "test.checkpoint" );
+}
+
+TEST(ImageSensor, TiledExr) {
+    // the image size is not a multiple of the tile size on purpose
+    const auto tile_size = 8;
+    const auto w = 2 * tile_size + 3;
+    const auto h = tile_size + 5;
+    TiledExrWriter writer( "test_tiled.exr" , w , h , tile_size );
+    EXPECT_TRUE( writer.IsValid() );
+
+    // tiles are written in random order, and written again like in progressive rendering
+    for( auto pass = 0 ; pass < 2 ; ++pass ){
+        for( auto ty = h - 1 ; ty >= 0 ; ty -= tile_size ){
+            for( auto tx = 0 ; tx < w ; tx += tile_size ){
+                const auto top = ty / tile_size * tile_size;
+                const auto tw = std::min( tile_size , w - tx );
+                const auto th = std::min( tile_size , h - top );
+                std::vector<Spectrum> radiance( tw * th );
+                for( auto y = 0 ; y < th ; ++y )
+                    for( auto x = 0 ; x < tw ; ++x )
+                        radiance[y * tw + x] = Spectrum( (float)( tx + x ) , 0.25f * ( top + y ) , pass ? 1.0f : 3.0f );
+                writer.WriteTile( Vector2i( tx , top ) , std::move( radiance ) );
+            }
+        }
+    }
+    EXPECT_TRUE( writer.Close() );
+
+    float* rgba = nullptr;
+    int width = 0 , height = 0;
+    EXPECT_EQ( LoadEXR( &rgba , &width , &height , "test_tiled.exr" , nullptr ) , TINYEXR_SUCCESS );
+    std::remove( "test_tiled.exr" );
+    EXPECT_EQ( width , w );
+    EXPECT_EQ( height , h );
+    if( !rgba )
+        return;
+
+    // these values are exact in half floats
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto pixel = rgba + 4 * ( y * w + x );
+            EXPECT_EQ( pixel[0] , (float)x );
+            EXPECT_EQ( pixel[1] , 0.25f * y );
+            EXPECT_EQ( pixel[2] , 1.0f );
+        }
+    }
+    free( rgba );
+}
+
+TEST(ImageSensor, AovLayers) {
+    const auto w = 19;
+    const auto h = 13;
+    RenderTarget radiance( w , h ) , albedo( w , h ) , depth( w , h ) , cost( w , h );
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            radiance.SetColor( x , y , Spectrum( (float)x , (float)y , 1.0f ) );
+            albedo.SetColor( x , y , Spectrum( 0.5f ) );
+            depth.SetColor( x , y , Spectrum( 1000.125f + x ) );
+            cost.SetColor( x , y , Spectrum( 1234.5f , 7.0f , 3.0f ) );
+        }
+    }
+    const RenderTarget* aovs[AOV_CNT] = { nullptr };
+    aovs[AOV_ALBEDO] = &albedo;
+    aovs[AOV_DEPTH] = &depth;
+    aovs[AOV_COST] = &cost;
+    EXPECT_TRUE( OutputAovLayers( "test_aov.exr" , radiance , aovs ) );
+
+    // only the enabled aovs are saved, each in its own layer
+    EXRVersion version;
+    EXRHeader header;
+    InitEXRHeader( &header );
+    EXPECT_EQ( ParseEXRVersionFromFile( &version , "test_aov.exr" ) , TINYEXR_SUCCESS );
+    EXPECT_EQ( ParseEXRHeaderFromFile( &header , &version , "test_aov.exr" , nullptr ) , TINYEXR_SUCCESS );
+    ASSERT_EQ( header.num_channels , 10 );
+    EXPECT_STREQ( header.channels[0].name , "B" );
+    EXPECT_STREQ( header.channels[3].name , "albedo.B" );
+    EXPECT_STREQ( header.channels[6].name , "cost.bounces" );
+    EXPECT_STREQ( header.channels[8].name , "cost.time" );
+    EXPECT_STREQ( header.channels[9].name , "depth.Z" );
+    for( auto i = 0 ; i < header.num_channels ; ++i )
+        header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_FLOAT;
+
+    EXRImage image;
+    InitEXRImage( &image );
+    EXPECT_EQ( LoadEXRImageFromFile( &image , &header , "test_aov.exr" , nullptr ) , TINYEXR_SUCCESS );
+    const auto channels = reinterpret_cast<float**>( image.images );
+    EXPECT_EQ( channels[2][w + 3] , 3.0f );
+    EXPECT_EQ( channels[5][w + 3] , 0.5f );
+    // depth is saved in full precision
+    EXPECT_EQ( channels[9][w + 3] , 1003.125f );
+    // so is the cost
+    EXPECT_EQ( channels[6][w + 3] , 3.0f );
+    EXPECT_EQ( channels[8][w + 3] , 1234.5f );
+    FreeEXRImage( &image );
+    FreeEXRHeader( &header );
+}
+
+TEST(ImageSensor, SplatBufferDeterministic) {
+    const auto w = 2 * SPLAT_BLOCK_SIZE;
+    const auto h = SPLAT_BLOCK_SIZE;
+
+    // the same splats in a different order, like splats scheduled differently among threads, sum up to the same bits
+    SplatBuffer forward( w , h , 4 , true ) , backward( w , h , 4 , true );
+    for( auto k = 0u ; k < 1000u ; ++k ){
+        forward.Splat( k % 3 , 0 , Spectrum( 1.0f / ( k + 1 ) , 0.1f * k , 1e-6f ) );
+        const auto j = 999u - k;
+        backward.Splat( j % 3 , 0 , Spectrum( 1.0f / ( j + 1 ) , 0.1f * j , 1e-6f ) );
+    }
+    for( auto x = 0 ; x < 3 ; ++x ){
+        const auto a = forward.Get( x , 0 );
+        const auto b = backward.Get( x , 0 );
+        EXPECT_EQ( a.r , b.r );
+        EXPECT_EQ( a.g , b.g );
+        EXPECT_EQ( a.b , b.b );
+    }
+    EXPECT_NEAR( forward.Get( 0 , 0 ).b , 334e-6f , 1e-8f );
+    EXPECT_EQ( forward.Get( 3 , 0 ).r , 0.0f );
+
+    forward.Clear();
+    EXPECT_TRUE( forward.IsEmpty() );
+}
+
+TEST(ImageSensor, Denoise) {
+    // the image size is not a multiple of the chunk size on purpose
+    const auto w = 67;
+    const auto h = 41;
+
+    // two flat surfaces with different albedos and normals meet in the middle of the image
+    RenderTarget image( w , h ) , albedo( w , h ) , normal( w , h );
+    const auto truth = [&]( int x ){ return x < w / 2 ? 0.8f : 0.2f; };
+    auto noisy_error = 0.0f;
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto noise = ( sort_canonical() - 0.5f ) * truth( x );
+            image.SetColor( x , y , Spectrum( truth( x ) + noise ) );
+            albedo.SetColor( x , y , Spectrum( truth( x ) ) );
+            normal.SetColor( x , y , x < w / 2 ? Spectrum( 0.0f , 0.0f , 1.0f ) : Spectrum( 1.0f , 0.0f , 0.0f ) );
+            noisy_error += noise * noise;
+        }
+    }
+
+    Denoise( image , &albedo , &normal );
+
+    auto error = 0.0f;
+    for( auto y = 0 ; y < h ; ++y ){
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto d = image.GetColor( x , y ).g - truth( x );
+            error += d * d;
+        }
+    }
+    EXPECT_LT( error , noisy_error * 0.1f );
+
+    // the edge is not blurred
+    EXPECT_NEAR( image.GetColor( w / 2 - 1 , h / 2 ).r , 0.8f , 0.05f );
+    EXPECT_NEAR( image.GetColor( w / 2 , h / 2 ).r , 0.2f , 0.02f );
+}
+
+// Images written in the background are all on disk once they are waited for.
+TEST(ImageSensor, AsyncOutput) {
+    static constexpr int IMAGE_CNT = 4;
+    for( auto i = 0 ; i < IMAGE_CNT ; ++i ){
+        auto image = std::make_shared<RenderTarget>( 64 , 32 );
+        for( auto y = 0 ; y < 32 ; ++y )
+            for( auto x = 0 ; x < 64 ; ++x )
+                image->SetColor( x , y , Spectrum( (float)i ) );
+        const auto filename = "test_async_" + std::to_string( i ) + ".exr";
+        WriteImageAsync( [image, filename](){ image->Output( filename ); } );
+    }
+    WaitForImageOutputs();
+
+    for( auto i = 0 ; i < IMAGE_CNT ; ++i ){
+        float* rgba = nullptr;
+        int width = 0 , height = 0;
+        const auto filename = "test_async_" + std::to_string( i ) + ".exr";
+        ASSERT_EQ( LoadEXR( &rgba , &width , &height , filename.c_str() , nullptr ) , TINYEXR_SUCCESS );
+        EXPECT_EQ( width , 64 );
+        EXPECT_EQ( height , 32 );
+        EXPECT_EQ( rgba[0] , (float)i );
+        free( rgba );
+    }
+}
+
+// The precomputed filters peak at the center of the pixel and fade out to zero at the radius.
+TEST(ImageSensor, PixelFilter) {
+    const PixelFilter box( PixelFilterType::Box , 2.0f );
+    EXPECT_EQ( box.GetReach() , 0 );
+    EXPECT_EQ( box.Evaluate( 0.49f ) , 1.0f );
+    EXPECT_EQ( box.Evaluate( -0.5f ) , 0.0f );
+
+    for( const auto type : { PixelFilterType::Gaussian , PixelFilterType::BlackmanHarris } ){
+        const PixelFilter filter( type , 2.0f );
+        EXPECT_EQ( filter.GetReach() , 2 );
+        EXPECT_GT( filter.Evaluate( 0.0f ) , 0.9f );
+        EXPECT_EQ( filter.Evaluate( 1.0f ) , filter.Evaluate( -1.0f ) );
+        EXPECT_EQ( filter.Evaluate( 2.0f ) , 0.0f );
+        for( auto d = 0.1f ; d < 2.0f ; d += 0.1f )
+            EXPECT_LE( filter.Evaluate( d ) , filter.Evaluate( d - 0.1f ) );
+    }
+}
+
+// Tiles filtered separately are merged into the same image as if they were filtered together, any constant radiance
+// is reconstructed exactly, including pixels on the borders of tiles and the image.
+TEST(ImageSensor, FilteredFilm) {
+    static constexpr int TILE_SIZE = 8;
+    static constexpr int TILE_CNT = 3;
+    const auto size = TILE_SIZE * TILE_CNT;
+    FilteredFilm film( size , size , PixelFilterType::BlackmanHarris , 2.0f );
+    const Spectrum radiance( 0.25f , 0.5f , 2.0f );
+
+    for( auto ty = 0 ; ty < TILE_CNT ; ++ty ){
+        for( auto tx = 0 ; tx < TILE_CNT ; ++tx ){
+            const Vector2i top_left( tx * TILE_SIZE , ty * TILE_SIZE );
+            FilmTile tile( film.GetFilter() , top_left , Vector2i( TILE_SIZE , TILE_SIZE ) );
+            for( auto y = 0 ; y < TILE_SIZE ; ++y )
+                for( auto x = 0 ; x < TILE_SIZE ; ++x )
+                    for( auto k = 0 ; k < 16 ; ++k )
+                        tile.AddSample( (float)( top_left.x + x ) + sort_canonical() , (float)( top_left.y + y ) + sort_canonical() , radiance );
+            film.Merge( tile );
+        }
+    }
+
+    for( auto y = 0 ; y < size ; ++y ){
+        for( auto x = 0 ; x < size ; ++x ){
+            const auto color = film.Resolve( x , y );
+            EXPECT_NEAR( color.r , radiance.r , 1e-4f );
+            EXPECT_NEAR( color.g , radiance.g , 1e-4f );
+            EXPECT_NEAR( color.b , radiance.b , 1e-4f );
+        }
+    }
+
+    // a single sample is only taken by the pixels within the radius, including the ones of the neighbor tiles
+    film.Clear();
+    FilmTile tile( film.GetFilter() , Vector2i( TILE_SIZE , TILE_SIZE ) , Vector2i( TILE_SIZE , TILE_SIZE ) );
+    tile.AddSample( (float)TILE_SIZE + 0.5f , (float)TILE_SIZE + 0.5f , Spectrum( 1.0f ) );
+    film.Merge( tile );
+    EXPECT_NEAR( film.Resolve( TILE_SIZE - 1 , TILE_SIZE ).r , 1.0f , 1e-5f );
+    EXPECT_NEAR( film.Resolve( TILE_SIZE - 1 , TILE_SIZE - 1 ).r , 1.0f , 1e-5f );
+    EXPECT_EQ( film.Resolve( TILE_SIZE - 2 , TILE_SIZE ).r , 0.0f );
+}
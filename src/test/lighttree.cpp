@@ -0,0 +1,120 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "light/lighttree.h"
+#include "core/rand.h"
+#include "core/samplemethod.h"
+
+namespace {
+    // A light with nothing but its bounds, which is all the light tree cares about.
+    class BoundedLight : public Light{
+    public:
+        BoundedLight( const LightBounds& bounds , bool infinite = false ) : m_bounds( bounds ) , m_infinite( infinite ) {}
+
+        bool GetBounds( LightBounds& bounds ) const override {
+            bounds = m_bounds;
+            return !m_infinite;
+        }
+
+        Spectrum Power() const override { return m_bounds.power; }
+        float Pdf( const Point& p , const Vector& wi ) const override { return 1.0f; }
+        Spectrum sample_l( const Point& ip , const LightSample* ls , Vector& dirToLight , float* distance , float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const override { return 0.0f; }
+        Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override { return 0.0f; }
+
+    private:
+        LightBounds m_bounds;
+        bool        m_infinite;
+    };
+
+    // Lights scattered in a box, half of them are area lights facing random directions.
+    std::vector<std::unique_ptr<BoundedLight>> randomLights( unsigned cnt ){
+        std::vector<std::unique_ptr<BoundedLight>> lights;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            LightBounds bounds;
+            const auto p = Point( sort_canonical() , sort_canonical() , sort_canonical() ) * 10.0f;
+            bounds.bbox = BBox( p , p + Vector( 0.1f , 0.1f , 0.1f ) * sort_canonical() );
+            bounds.power = sort_canonical() + 0.1f;
+            if( i % 2 ){
+                bounds.axis = UniformSampleSphere( sort_canonical() , sort_canonical() );
+                bounds.cosThetaO = 1.0f;
+            }
+            lights.push_back( std::make_unique<BoundedLight>( bounds ) );
+        }
+        return lights;
+    }
+}
+
+// The probability of picking a light matches how often it is picked.
+TEST(LIGHT_TREE, SampleMatchesPdf) {
+    static constexpr unsigned LIGHT_CNT = 97;
+    static constexpr unsigned SAMPLE_CNT = 1024 * 1024;
+
+    const auto owned = randomLights( LIGHT_CNT );
+    std::vector<Light*> lights;
+    for( const auto& light : owned )
+        lights.push_back( light.get() );
+    LightBounds sky_bounds;
+    sky_bounds.power = 1.0f;
+    BoundedLight sky( sky_bounds , true );
+    lights.push_back( &sky );
+
+    const LightTree tree( lights );
+    const auto p = Point( 3.0f , 4.0f , 5.0f );
+    const auto n = normalize( Vector( 1.0f , 1.0f , 0.0f ) );
+
+    // Bounds of a node are conservative, it could happen that none of its children could light the point, which is
+    // when no light is picked.
+    auto total = 0.0f;
+    for( const auto light : lights )
+        total += tree.Pdf( p , n , light );
+    EXPECT_LE( total , 1.0f + 1e-4f );
+    EXPECT_GT( total , 0.95f );
+    EXPECT_NEAR( tree.Pdf( p , n , &sky ) , 0.5f , 1e-6f );
+
+    std::unordered_map<const Light*, unsigned> histogram;
+    for( auto k = 0u ; k < SAMPLE_CNT ; ++k ){
+        float pdf = 0.0f;
+        const auto light = tree.Sample( p , n , ( k + sort_canonical() ) / SAMPLE_CNT , &pdf );
+        if( !light )
+            continue;
+        EXPECT_NEAR( pdf , tree.Pdf( p , n , light ) , 1e-5f );
+        ++histogram[light];
+    }
+    for( const auto light : lights )
+        EXPECT_NEAR( (float)histogram[light] / SAMPLE_CNT , tree.Pdf( p , n , light ) , 0.002f );
+}
+
+// Lights facing away from the shading point are never picked, the closer ones are more likely to be picked.
+TEST(LIGHT_TREE, SpatialImportance) {
+    LightBounds near_bounds , far_bounds , away_bounds;
+    near_bounds.bbox = BBox( Point( 0.0f , 1.0f , 0.0f ) , Point( 0.0f , 1.0f , 0.0f ) );
+    far_bounds.bbox = BBox( Point( 0.0f , 10.0f , 0.0f ) , Point( 0.0f , 10.0f , 0.0f ) );
+    away_bounds.bbox = BBox( Point( 1.0f , 1.0f , 1.0f ) , Point( 1.5f , 1.0f , 1.5f ) );
+    away_bounds.axis = DIR_UP;
+    away_bounds.cosThetaO = 1.0f;
+    near_bounds.power = far_bounds.power = away_bounds.power = 1.0f;
+
+    BoundedLight near_light( near_bounds ) , far_light( far_bounds ) , away_light( away_bounds );
+    const LightTree tree( { &near_light , &far_light , &away_light } );
+
+    const auto p = Point( 0.0f , 0.0f , 0.0f );
+    EXPECT_EQ( tree.Pdf( p , DIR_UP , &away_light ) , 0.0f );
+    EXPECT_GT( tree.Pdf( p , DIR_UP , &near_light ) , 0.9f );
+    EXPECT_NEAR( tree.Pdf( p , DIR_UP , &near_light ) + tree.Pdf( p , DIR_UP , &far_light ) , 1.0f , 1e-5f );
+}
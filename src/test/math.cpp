@@ -16,9 +16,19 @@
 */
 
 #include <math.h>
+#include <cmath>
+#include <random>
+#include <vector>
 #include "core/define.h"
 #include "thirdparty/gtest/gtest.h"
+#include "benchmark.h"
 #include "math/exp.h"
+#include "math/approx.h"
+#include "math/curve.h"
+#include "math/utils.h"
+#include "math/ray.h"
+#include "math/bbox.h"
+#include "math/transform.h"
 
 SORT_FORCEINLINE void exp_accuracy_test( const double x ){
     const double e0 = exp( x );
@@ -46,4 +56,253 @@ TEST(MATH, EXP_NEGATIVE) {
     exp_accuracy_test( -4.0 );
     exp_accuracy_test( -128.0 );
     exp_accuracy_test( -256.0 );
-}
\ No newline at end of file
+}
+// Space filling curves should visit every cell of a grid exactly once, even if the grid is not a power of two square.
+TEST(MATH, CURVE_COVERAGE) {
+    for( const auto& size : { Vector2i( 64 , 64 ) , Vector2i( 30 , 17 ) , Vector2i( 1 , 5 ) } ){
+        for( const auto& order : { MortonOrder( size ) , HilbertOrder( size ) } ){
+            EXPECT_EQ( order.size() , (size_t)( size.x * size.y ) );
+            std::vector<int> visited( size.x * size.y , 0 );
+            for( const auto& cell : order ){
+                ASSERT_TRUE( cell.x >= 0 && cell.x < size.x && cell.y >= 0 && cell.y < size.y );
+                ++visited[ cell.y * size.x + cell.x ];
+            }
+            for( const auto v : visited )
+                EXPECT_EQ( v , 1 );
+        }
+    }
+}
+
+// Consecutive cells along the Hilbert curve are always adjacent in a power of two square.
+TEST(MATH, CURVE_HILBERT_ADJACENCY) {
+    const auto order = HilbertOrder( Vector2i( 32 , 32 ) );
+    for( auto i = 1u ; i < order.size() ; ++i )
+        EXPECT_EQ( abs( order[i].x - order[i-1].x ) + abs( order[i].y - order[i-1].y ) , 1 );
+}
+
+TEST(MATH, MORTON_CODE_3D) {
+    EXPECT_EQ( MortonCode3D( 0 , 0 , 0 ) , 0u );
+    EXPECT_EQ( MortonCode3D( 1 , 0 , 0 ) , 4u );
+    EXPECT_EQ( MortonCode3D( 0 , 1 , 0 ) , 2u );
+    EXPECT_EQ( MortonCode3D( 0 , 0 , 1 ) , 1u );
+    EXPECT_EQ( MortonCode3D( 1023 , 1023 , 1023 ) , ( 1u << 30 ) - 1 );
+}
+
+// Rays are binned by direction octants first, then by the cells their origins are in.
+TEST(MATH, RAY_BIN_KEY) {
+    const BBox bbox( Point( -1.0f , -1.0f , -1.0f ) , Point( 1.0f , 1.0f , 1.0f ) );
+    const auto key = [&]( const Point& p , const Vector& d ){
+        return RayBinKey( Ray( p , d ) , bbox );
+    };
+
+    // the same bin
+    EXPECT_EQ( key( Point( 0.1f , 0.2f , 0.3f ) , Vector( 1.0f , 0.0f , 0.0f ) ) , key( Point( 0.1f , 0.2f , 0.3f ) , Vector( 0.0f , 1.0f , 0.0f ) ) );
+
+    // rays in different octants never share the same bin, wherever they start
+    const auto k0 = key( Point( -1.0f , -1.0f , -1.0f ) , Vector( -1.0f , 0.0f , 0.0f ) );
+    const auto k1 = key( Point( 1.0f , 1.0f , 1.0f ) , Vector( 1.0f , 0.0f , 0.0f ) );
+    EXPECT_GT( k0 , k1 );
+
+    // origins outside the bounding box are clamped
+    EXPECT_EQ( key( Point( 5.0f , 5.0f , 5.0f ) , Vector( 1.0f , 1.0f , 1.0f ) ) , key( Point( 1.0f , 1.0f , 1.0f ) , Vector( 1.0f , 1.0f , 1.0f ) ) );
+    EXPECT_EQ( key( Point( -5.0f , -5.0f , -5.0f ) , Vector( 1.0f , 1.0f , 1.0f ) ) , 0u );
+}
+
+TEST(MATH, HALF_FLOAT) {
+    // every half float survives a round trip, except nans which stay nans
+    for( auto h = 0u ; h < 0x10000 ; ++h ){
+        const auto f = HalfToFloat( (unsigned short)h );
+        if( ( h & 0x7c00 ) == 0x7c00 && ( h & 0x3ff ) )
+            EXPECT_TRUE( std::isnan( f ) );
+        else
+            EXPECT_EQ( FloatToHalf( f ) , h );
+    }
+
+    // rounding to the nearest half float, large numbers are clamped instead of becoming infinity
+    EXPECT_EQ( HalfToFloat( FloatToHalf( 1.0f + 1.0f / 4096.0f ) ) , 1.0f );
+    EXPECT_EQ( HalfToFloat( FloatToHalf( 1.0f + 3.0f / 4096.0f ) ) , 1.0f + 1.0f / 1024.0f );
+    EXPECT_EQ( HalfToFloat( FloatToHalf( 1e6f ) ) , 65504.0f );
+    EXPECT_EQ( HalfToFloat( FloatToHalf( -1e6f ) ) , -65504.0f );
+}
+
+// Unit vectors survive octahedral encoding with tiny angular error, including the axes and the folded lower half.
+TEST(MATH, OCTAHEDRAL) {
+    std::mt19937 rng( 0 );
+    std::uniform_real_distribution<float> dist( -1.0f , 1.0f );
+    for( auto i = 0u ; i < 100000u ; ++i ){
+        const auto v = normalize( Vector( dist( rng ) , dist( rng ) , dist( rng ) ) );
+        const auto d = DecodeOctahedral( EncodeOctahedral( v ) );
+        EXPECT_NEAR( d.Length() , 1.0f , 1e-5f );
+        // the cosine of such small angles is one in single precision, the sine is checked instead
+        EXPECT_LT( cross( v , d ).Length() , sinf( Radians( 0.01f ) ) );
+    }
+
+    const Vector axes[] = { Vector( 1.0f , 0.0f , 0.0f ) , Vector( 0.0f , 1.0f , 0.0f ) , Vector( 0.0f , 0.0f , 1.0f ) ,
+                            Vector( -1.0f , 0.0f , 0.0f ) , Vector( 0.0f , -1.0f , 0.0f ) , Vector( 0.0f , 0.0f , -1.0f ) };
+    for( const auto& axis : axes ){
+        const auto d = DecodeOctahedral( EncodeOctahedral( axis ) );
+        EXPECT_NEAR( dot( axis , d ) , 1.0f , 1e-6f );
+    }
+
+    // the length doesn't matter, while a zero vector is encoded as the z axis
+    EXPECT_EQ( EncodeOctahedral( Vector( 0.0f , 3.0f , 4.0f ) ) , EncodeOctahedral( Vector( 0.0f , 0.6f , 0.8f ) ) );
+    EXPECT_EQ( DecodeOctahedral( EncodeOctahedral( Vector() ) ) , Vector( 0.0f , 0.0f , 1.0f ) );
+}
+
+// Transforming points, vectors and normals should match the plain matrix multiplication.
+TEST(MATH, TRANSFORM) {
+    const auto t = Translate( 1.0f , -2.0f , 3.0f ) * RotateY( 0.7f ) * Scale( 2.0f , 0.5f , 3.0f );
+    EXPECT_TRUE( t.matrix.IsAffine() );
+    EXPECT_TRUE( t.invMatrix.IsAffine() );
+
+    const auto& m = t.matrix.m;
+    const Point p( 0.3f , -1.2f , 2.5f );
+    const auto tp = t.TransformPoint( p );
+    EXPECT_NEAR( tp.x , m[0] * p.x + m[1] * p.y + m[2] * p.z + m[3] , 1e-5f );
+    EXPECT_NEAR( tp.y , m[4] * p.x + m[5] * p.y + m[6] * p.z + m[7] , 1e-5f );
+    EXPECT_NEAR( tp.z , m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11] , 1e-5f );
+
+    const Vector v( 0.5f , 0.25f , -1.0f );
+    const auto tv = t.TransformVector( v );
+    EXPECT_NEAR( tv.x , m[0] * v.x + m[1] * v.y + m[2] * v.z , 1e-5f );
+    EXPECT_NEAR( tv.y , m[4] * v.x + m[5] * v.y + m[6] * v.z , 1e-5f );
+    EXPECT_NEAR( tv.z , m[8] * v.x + m[9] * v.y + m[10] * v.z , 1e-5f );
+
+    // transformed normals stay perpendicular to transformed tangents.
+    const Vector n( 0.0f , 1.0f , 0.0f ) , tangent( 1.0f , 0.0f , 1.0f );
+    EXPECT_NEAR( dot( t.TransformNormal( n ) , t.TransformVector( tangent ) ) , 0.0f , 1e-5f );
+
+    // the inverse of a point should be the point itself.
+    const auto back = t.invMatrix.TransformPoint( tp );
+    EXPECT_NEAR( back.x , p.x , 1e-4f );
+    EXPECT_NEAR( back.y , p.y , 1e-4f );
+    EXPECT_NEAR( back.z , p.z , 1e-4f );
+
+    // projective matrices divide by the last row.
+    const auto proj = Perspective( 2.0f , 1.0f );
+    EXPECT_FALSE( proj.matrix.IsAffine() );
+    const auto pp = proj.TransformPoint( Point( 1.0f , 1.0f , 4.0f ) );
+    EXPECT_NEAR( pp.x , 0.5f , 1e-5f );
+    EXPECT_NEAR( pp.y , 0.25f , 1e-5f );
+}
+
+namespace {
+    // Largest error of an approximation against the double precision version in a range.
+    template<class A , class R>
+    double approxError( float lo , float hi , const A& approx , const R& reference , bool relative ){
+        std::mt19937 rng( 0 );
+        std::uniform_real_distribution<float> dist( lo , hi );
+        auto ret = 0.0;
+        for( auto i = 0 ; i < 100000 ; ++i ){
+            const auto x = dist( rng );
+            const auto r = reference( (double)x );
+            const auto err = std::abs( (double)approx( x ) - r );
+            ret = std::max( ret , relative ? err / std::abs( r ) : err );
+        }
+        return ret;
+    }
+
+    template<MathAccuracy accuracy>
+    float sinPlusCos( float x ){
+        float s , c;
+        ApproxSinCos<accuracy>( x , s , c );
+        return s + c;
+    }
+}
+
+// The approximations should be within the errors documented in 'math/approx.h'.
+TEST(MATH, APPROX_ACCURACY) {
+    const auto ref_exp = []( double x ){ return std::exp( x ); };
+    EXPECT_LT( approxError( -80.0f , 80.0f , ApproxExp<MathAccuracy::High> , ref_exp , true ) , 1e-7 );
+    EXPECT_LT( approxError( -80.0f , 80.0f , ApproxExp<MathAccuracy::Fast> , ref_exp , true ) , 6e-5 );
+
+    const auto ref_log = []( double x ){ return std::log( x ); };
+    EXPECT_LT( approxError( 1.1f , 1e30f , ApproxLog<MathAccuracy::High> , ref_log , true ) , 2e-7 );
+    EXPECT_LT( approxError( 1e-30f , 0.9f , ApproxLog<MathAccuracy::High> , ref_log , true ) , 2e-7 );
+    EXPECT_LT( approxError( 1e-30f , 1e30f , ApproxLog<MathAccuracy::Fast> , ref_log , false ) , 7e-5 );
+
+    const auto ref_pow = []( double x ){ return std::pow( x , 20.0 ); };
+    EXPECT_LT( approxError( 0.1f , 1.0f , []( float x ){ return ApproxPow<MathAccuracy::High>( x , 20.0f ); } , ref_pow , true ) , 2e-7 * ( 1.0 + 20.0 * std::log( 10.0 ) ) );
+    EXPECT_LT( approxError( 0.1f , 1.0f , []( float x ){ return ApproxPow<MathAccuracy::Fast>( x , 20.0f ); } , ref_pow , true ) , 2e-4 * ( 1.0 + 20.0 * std::log( 10.0 ) ) );
+
+    const auto sin_of = []( float x ){ float s , c; ApproxSinCos<MathAccuracy::High>( x , s , c ); return s; };
+    const auto cos_of = []( float x ){ float s , c; ApproxSinCos<MathAccuracy::High>( x , s , c ); return c; };
+    const auto fast_sin_of = []( float x ){ float s , c; ApproxSinCos<MathAccuracy::Fast>( x , s , c ); return s; };
+    const auto fast_cos_of = []( float x ){ float s , c; ApproxSinCos<MathAccuracy::Fast>( x , s , c ); return c; };
+    const auto ref_sin = []( double x ){ return std::sin( x ); };
+    const auto ref_cos = []( double x ){ return std::cos( x ); };
+    EXPECT_LT( approxError( -100.0f , 100.0f , sin_of , ref_sin , false ) , 1e-7 );
+    EXPECT_LT( approxError( -100.0f , 100.0f , cos_of , ref_cos , false ) , 1e-7 );
+    EXPECT_LT( approxError( -100.0f , 100.0f , fast_sin_of , ref_sin , false ) , 4e-5 );
+    EXPECT_LT( approxError( -100.0f , 100.0f , fast_cos_of , ref_cos , false ) , 4e-5 );
+
+    // the angle of points on the unit circle.
+    const auto atan2_of = []( float a ){ return ApproxAtan2<MathAccuracy::High>( std::sin( a ) , std::cos( a ) ); };
+    const auto fast_atan2_of = []( float a ){ return ApproxAtan2<MathAccuracy::Fast>( std::sin( a ) , std::cos( a ) ); };
+    const auto ref_atan2 = []( double a ){ return std::atan2( (double)std::sin( (float)a ) , (double)std::cos( (float)a ) ); };
+    EXPECT_LT( approxError( -3.14f , 3.14f , atan2_of , ref_atan2 , false ) , 3e-7 );
+    EXPECT_LT( approxError( -3.14f , 3.14f , fast_atan2_of , ref_atan2 , false ) , 2e-5 );
+
+    const auto ref_acos = []( double x ){ return std::acos( x ); };
+    EXPECT_LT( approxError( -1.0f , 1.0f , ApproxAcos<MathAccuracy::High> , ref_acos , false ) , 3e-7 );
+    EXPECT_LT( approxError( -1.0f , 1.0f , ApproxAcos<MathAccuracy::Fast> , ref_acos , false ) , 2e-5 );
+}
+
+// Special values should behave like the functions in the standard library.
+TEST(MATH, APPROX_SPECIAL_VALUES) {
+    EXPECT_EQ( ApproxExp<MathAccuracy::High>( 0.0f ) , 1.0f );
+    EXPECT_EQ( ApproxExp<MathAccuracy::High>( -200.0f ) , 0.0f );
+    EXPECT_EQ( ApproxExp<MathAccuracy::Fast>( -INFINITY ) , 0.0f );
+    EXPECT_FALSE( IsInf( ApproxExp<MathAccuracy::High>( 200.0f ) ) );
+
+    EXPECT_EQ( ApproxLog<MathAccuracy::High>( 1.0f ) , 0.0f );
+    EXPECT_EQ( ApproxLog<MathAccuracy::High>( 0.0f ) , -INFINITY );
+    EXPECT_EQ( ApproxLog<MathAccuracy::High>( INFINITY ) , INFINITY );
+    EXPECT_TRUE( IsNan( ApproxLog<MathAccuracy::High>( -1.0f ) ) );
+    EXPECT_NEAR( ApproxLog<MathAccuracy::High>( 1e-40f ) , std::log( 1e-40f ) , 1e-4f );
+
+    EXPECT_EQ( ApproxPow<MathAccuracy::High>( 0.0f , 0.0f ) , 1.0f );
+    EXPECT_EQ( ApproxPow<MathAccuracy::High>( 0.0f , 2.0f ) , 0.0f );
+    EXPECT_EQ( ApproxPow<MathAccuracy::Fast>( 0.0f , -2.0f ) , INFINITY );
+
+    EXPECT_EQ( ApproxAtan2<MathAccuracy::High>( 0.0f , 0.0f ) , 0.0f );
+    EXPECT_NEAR( ApproxAtan2<MathAccuracy::High>( 0.0f , -1.0f ) , 3.14159265f , 1e-6f );
+    EXPECT_NEAR( ApproxAcos<MathAccuracy::Fast>( 2.0f ) , 0.0f , 1e-6f );
+}
+
+// Benchmark of the approximations against the standard library.
+TEST(MATH_BENCHMARK, DISABLED_Approx) {
+    constexpr auto cnt = 4096u;
+    constexpr auto rounds = 1025u;
+    std::mt19937 rng( 0 );
+    std::uniform_real_distribution<float> dist( 0.01f , 4.0f );
+    std::vector<float> input( cnt ) , output( cnt );
+    for( auto& x : input )
+        x = dist( rng );
+
+    // time of evaluating a function over the whole input in nanoseconds per evaluation.
+    const auto measure = [&]( const char* name , const auto& func ){
+        const auto ns = BenchmarkNanoseconds( cnt , rounds , [&]( unsigned i ){
+            output[i] = func( input[i] ) + output[i];
+        } );
+        BenchmarkReport() << name << ": " << ns << "(ns)" << std::endl;
+    };
+
+#define BENCHMARK_APPROX( NAME , EXPR )  \
+    measure( NAME " (exact)" , []( float x ){ constexpr auto accuracy = MathAccuracy::Exact; return EXPR; } ); \
+    measure( NAME " (high)" , []( float x ){ constexpr auto accuracy = MathAccuracy::High; return EXPR; } ); \
+    measure( NAME " (fast)" , []( float x ){ constexpr auto accuracy = MathAccuracy::Fast; return EXPR; } );
+
+    BENCHMARK_APPROX( "exp" , ApproxExp<accuracy>( -x ) );
+    BENCHMARK_APPROX( "log" , ApproxLog<accuracy>( x ) );
+    BENCHMARK_APPROX( "pow" , ApproxPow<accuracy>( x , 2.2f ) );
+    BENCHMARK_APPROX( "sincos" , sinPlusCos<accuracy>( x ) );
+    BENCHMARK_APPROX( "atan2" , ApproxAtan2<accuracy>( x - 2.0f , 1.0f - x ) );
+    BENCHMARK_APPROX( "acos" , ApproxAcos<accuracy>( x * 0.5f - 1.0f ) );
+#undef BENCHMARK_APPROX
+
+    auto sum = 0.0f;
+    for( const auto x : output )
+        sum += x;
+    EXPECT_FALSE( IsNan( sum ) );
+}
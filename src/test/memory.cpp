@@ -47,4 +47,88 @@ TEST(Memory, AlignedAllocation_ZeroInput) {
 
     // this line should do nothing.
     free_aligned( ret );
-}
\ No newline at end of file
+}
+
+TEST(Memory, AllocatorAlignment) {
+    struct alignas(64) Aligned { float data[4]; };
+
+    MemoryAllocator allocator(1024);
+    for( auto i = 0 ; i < 100 ; ++i ){
+        // mix allocations with different alignments
+        auto c = allocator.Allocate<char>(i % 7 + 1);
+        auto a = allocator.Allocate<Aligned>();
+        auto d = allocator.Allocate<double>(3);
+
+        EXPECT_NE( (void*)c , (void*)nullptr );
+        EXPECT_EQ( ((uintptr_t)a) % alignof(Aligned) , (uintptr_t)0 );
+        EXPECT_EQ( ((uintptr_t)d) % alignof(double) , (uintptr_t)0 );
+    }
+}
+
+TEST(Memory, AllocatorLargeAllocation) {
+    MemoryAllocator allocator(1024);
+
+    // allocations larger than the block size used to be rejected
+    auto large = allocator.Allocate<float>(MEM_BLOCK_SIZE);
+    EXPECT_NE( (void*)large , (void*)nullptr );
+    for( auto i = 0u ; i < MEM_BLOCK_SIZE ; ++i )
+        large[i] = (float)i;
+    EXPECT_EQ( large[MEM_BLOCK_SIZE - 1] , (float)(MEM_BLOCK_SIZE - 1) );
+
+    allocator.Reset();
+}
+
+TEST(Memory, AllocatorMarker) {
+    MemoryAllocator allocator(256);
+
+    auto persistent = allocator.Allocate<int>();
+    *persistent = 7;
+
+    for( auto bounce = 0 ; bounce < 4 ; ++bounce ){
+        const auto marker = allocator.GetMarker();
+
+        auto first = allocator.Allocate<int>(16);
+        for( auto i = 0 ; i < 64 ; ++i )
+            allocator.Allocate<int>(16);
+        allocator.Allocate<char>(1024);
+
+        allocator.ResetTo(marker);
+
+        // memory after the marker is reused, memory before it is untouched
+        EXPECT_EQ( allocator.Allocate<int>(16) , first );
+        allocator.ResetTo(marker);
+        EXPECT_EQ( *persistent , 7 );
+    }
+
+    {
+        SORT_MEMPOOL_SCOPE();
+        SORT_MALLOC_ARRAY(int, 256);
+    }
+    const auto marker = GetStaticAllocator().GetMarker();
+    {
+        SORT_MEMPOOL_SCOPE();
+        SORT_MALLOC_ARRAY(int, 256);
+    }
+    EXPECT_EQ( GetStaticAllocator().GetMarker().m_offset , marker.m_offset );
+    EXPECT_EQ( GetStaticAllocator().GetMarker().m_block , marker.m_block );
+}
+
+TEST(Memory, LargePageVector) {
+    // both small arrays and the ones large enough for large pages
+    for( auto cnt : { 16u , ( MEM_LARGE_PAGE_THRESHOLD / (unsigned)sizeof(double) ) * 3u } ){
+        LargePageVector<double> data( cnt );
+        EXPECT_EQ( ((uintptr_t)data.data()) % alignof(double) , (uintptr_t)0 );
+        for( auto i = 0u ; i < cnt ; ++i )
+            data[i] = (double)i;
+
+        // growing the array moves it across the threshold
+        data.resize( cnt * 2 , 1.0 );
+        EXPECT_EQ( data[cnt - 1] , (double)(cnt - 1) );
+        EXPECT_EQ( data[cnt * 2 - 1] , 1.0 );
+    }
+
+    // memory that doesn't come from the OS directly is freed as regular memory
+    free_large_pages( malloc_large_pages( 1024 ) );
+    free_large_pages( nullptr );
+    EXPECT_EQ( malloc_large_pages( 0 ) , nullptr );
+}
@@ -0,0 +1,174 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include "thirdparty/gtest/gtest.h"
+#include "integrator/sdtree.h"
+#include "stream/mstream.h"
+#include "core/rand.h"
+#include "math/utils.h"
+
+namespace {
+    // Uniformly distributed direction on the sphere.
+    Vector uniformDirection(){
+        const auto u = sort_canonical();
+        const auto v = sort_canonical();
+        return DirectionalTree::FromSquare( u , v );
+    }
+
+    // Radiance mostly coming from a small cone around the z axis, with a little from everywhere else.
+    float coneRadiance( const Vector& dir ){
+        return dir.z > 0.95f ? 100.0f : 1.0f;
+    }
+
+    // A directional tree learning 'coneRadiance' in a few passes.
+    DirectionalTree learnCone(){
+        DirectionalTree tree;
+        for( auto pass = 0 ; pass < 4 ; ++pass ){
+            auto recording = tree.Refine( 0.01f );
+            for( auto i = 0 ; i < 100000 ; ++i ){
+                const auto dir = uniformDirection();
+                recording.Record( recording.Locate( dir ) , coneRadiance( dir ) * FOUR_PI );
+            }
+            recording.Build();
+            tree = recording;
+        }
+        return tree;
+    }
+}
+
+// The cylindrical mapping between directions and the unit square should be invertible.
+TEST(PATHGUIDING, SquareMapping) {
+    sort_seed( 0 , 0 );
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto u = sort_canonical();
+        const auto v = sort_canonical();
+        const auto dir = DirectionalTree::FromSquare( u , v );
+        EXPECT_NEAR( dir.Length() , 1.0f , 1e-4f );
+
+        float x , y;
+        DirectionalTree::ToSquare( dir , x , y );
+        EXPECT_NEAR( x , u , 1e-3f );
+        EXPECT_NEAR( std::fmod( y - v + 1.5f , 1.0f ) - 0.5f , 0.0f , 1e-3f );
+    }
+}
+
+// The pdf of the learned tree should integrate to one and match the distribution of the samples.
+TEST(PATHGUIDING, DirectionalTreeSampling) {
+    sort_seed( 0 , 1 );
+    const auto tree = learnCone();
+    ASSERT_GT( tree.Total() , 0.0f );
+
+    constexpr auto cnt = 1000000;
+    auto integral = 0.0f;
+    for( auto i = 0 ; i < cnt ; ++i )
+        integral += tree.Pdf( uniformDirection() ) * FOUR_PI;
+    EXPECT_NEAR( integral / cnt , 1.0f , 0.01f );
+
+    // estimate the integral of the radiance with samples of the tree, which should be close to the radiance itself.
+    const auto expected = ( 100.0f * 0.025f + 1.0f * 0.975f ) * FOUR_PI;
+    auto estimated = 0.0f;
+    auto in_cone = 0;
+    for( auto i = 0 ; i < cnt ; ++i ){
+        const auto dir = tree.Sample( sort_canonical() , sort_canonical() );
+        const auto pdf = tree.Pdf( dir );
+        ASSERT_GT( pdf , 0.0f );
+        estimated += coneRadiance( dir ) / pdf;
+        in_cone += dir.z > 0.95f ? 1 : 0;
+    }
+    EXPECT_NEAR( estimated / cnt , expected , expected * 0.01f );
+
+    // most samples should be in the cone, where most of the radiance comes from.
+    EXPECT_GT( (float)in_cone / cnt , 0.6f );
+}
+
+// The guiding tree should subdivide the space with a lot of records and learn different radiance in different places.
+TEST(PATHGUIDING, GuidingTree) {
+    sort_seed( 0 , 2 );
+    GuidingTree tree( BBox( Point( -1.0f , -1.0f , -1.0f ) , Point( 1.0f , 1.0f , 1.0f ) ) , 1 );
+    EXPECT_EQ( nullptr , tree.Lookup( Point( 0.5f , 0.0f , 0.0f ) ) );
+
+    // radiance comes from +x in the half space of x > 0, and from -x in the other half.
+    for( auto pass = 0 ; pass < 3 ; ++pass ){
+        for( auto i = 0 ; i < 200000 ; ++i ){
+            const auto p = Point( sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f );
+            const auto dir = uniformDirection();
+            const auto radiance = ( p.x > 0.0f ? dir.x : -dir.x ) > 0.9f ? 100.0f : 1.0f;
+            tree.Record( p , dir , radiance * FOUR_PI );
+        }
+        tree.Refine();
+    }
+    EXPECT_GT( tree.LeafCount() , 1u );
+
+    const auto right = tree.Lookup( Point( 0.5f , 0.0f , 0.0f ) );
+    const auto left = tree.Lookup( Point( -0.5f , 0.0f , 0.0f ) );
+    ASSERT_NE( nullptr , right );
+    ASSERT_NE( nullptr , left );
+    EXPECT_GT( right->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) , 10.0f * right->Pdf( Vector( -1.0f , 0.0f , 0.0f ) ) );
+    EXPECT_GT( left->Pdf( Vector( -1.0f , 0.0f , 0.0f ) ) , 10.0f * left->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) );
+}
+
+// A guiding tree loaded from what is saved by the last frame guides the first pass of the next frame, what it learned is
+// blended into the first pass of the next frame.
+TEST(PATHGUIDING, WarmStart) {
+    sort_seed( 0 , 3 );
+    const auto bbox = BBox( Point( -1.0f , -1.0f , -1.0f ) , Point( 1.0f , 1.0f , 1.0f ) );
+    const auto record = [&]( GuidingTree& tree , float sign , int cnt ){
+        for( auto i = 0 ; i < cnt ; ++i ){
+            const auto p = Point( sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f );
+            const auto dir = uniformDirection();
+            tree.Record( p , dir , ( sign * dir.x > 0.9f ? 100.0f : 1.0f ) * FOUR_PI );
+        }
+        tree.Refine();
+    };
+
+    // the last frame learns radiance from +x.
+    GuidingTree last( bbox , 1 );
+    for( auto pass = 0 ; pass < 3 ; ++pass )
+        record( last , 1.0f , 100000 );
+
+    IMemoryStream saved;
+    last.Save( saved );
+    OMemoryStream stream( saved );
+    GuidingTree tree( bbox , 1 );
+    ASSERT_TRUE( tree.Load( stream ) );
+    EXPECT_EQ( last.LeafCount() , tree.LeafCount() );
+
+    const auto p = Point( 0.5f , 0.0f , 0.0f );
+    ASSERT_NE( nullptr , tree.Lookup( p ) );
+    EXPECT_FLOAT_EQ( last.Lookup( p )->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) , tree.Lookup( p )->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) );
+
+    // the radiance comes from -x in the next frame, both directions are learned after the first pass with the decay.
+    tree.Decay( 0.5f );
+    record( tree , -1.0f , 100000 );
+    const auto blended = tree.Lookup( p );
+    ASSERT_NE( nullptr , blended );
+    EXPECT_GT( blended->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) , 0.2f * blended->Pdf( Vector( -1.0f , 0.0f , 0.0f ) ) );
+    EXPECT_GT( blended->Pdf( Vector( -1.0f , 0.0f , 0.0f ) ) , blended->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) );
+
+    // the stale radiance is gone after the next pass.
+    record( tree , -1.0f , 100000 );
+    const auto refined = tree.Lookup( p );
+    ASSERT_NE( nullptr , refined );
+    EXPECT_GT( refined->Pdf( Vector( -1.0f , 0.0f , 0.0f ) ) , 10.0f * refined->Pdf( Vector( 1.0f , 0.0f , 0.0f ) ) );
+
+    // corrupted data is rejected.
+    IMemoryStream broken;
+    static_cast<OStreamBase&>( broken ) << Point( 0.0f ) << Vector( 1.0f , 1.0f , 1.0f ) << true << 0u << 0u;
+    OMemoryStream broken_stream( broken );
+    EXPECT_FALSE( tree.Load( broken_stream ) );
+}
@@ -0,0 +1,70 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "integrator/photonmap.h"
+#include "core/rand.h"
+
+// Photons gathered from the photon map should be exactly the ones within the radius.
+TEST(PHOTONMAP, Gather) {
+    sort_seed( 0 , 0 );
+
+    std::vector<Photon> photons( 8192 );
+    for( auto i = 0u ; i < photons.size() ; ++i ){
+        photons[i].p = Point( sort_canonical() * 4.0f - 2.0f , sort_canonical() * 4.0f - 2.0f , sort_canonical() * 4.0f - 2.0f );
+        photons[i].power = (float)i;
+    }
+    const auto reference = photons;
+
+    constexpr auto radius = 0.3f;
+    PhotonMap map;
+    map.Build( std::move( photons ) , radius );
+    EXPECT_EQ( reference.size() , map.Size() );
+
+    for( auto k = 0 ; k < 256 ; ++k ){
+        const auto p = Point( sort_canonical() * 5.0f - 2.5f , sort_canonical() * 5.0f - 2.5f , sort_canonical() * 5.0f - 2.5f );
+
+        auto expected_cnt = 0u;
+        auto expected_sum = 0.0f;
+        for( const auto& photon : reference ){
+            if( ( photon.p - p ).SquaredLength() <= radius * radius ){
+                ++expected_cnt;
+                expected_sum += photon.power.GetIntensity();
+            }
+        }
+
+        auto cnt = 0u;
+        auto sum = 0.0f;
+        map.Gather( p , [&]( const Photon& photon ){
+            ++cnt;
+            sum += photon.power.GetIntensity();
+        });
+        EXPECT_EQ( expected_cnt , cnt );
+        EXPECT_NEAR( expected_sum , sum , 1e-3f * ( expected_sum + 1.0f ) );
+    }
+}
+
+// Nothing is gathered from an empty photon map.
+TEST(PHOTONMAP, Empty) {
+    PhotonMap map;
+    map.Build( {} , 1.0f );
+    EXPECT_EQ( 0u , map.Size() );
+
+    auto cnt = 0u;
+    map.Gather( Point( 0.0f , 0.0f , 0.0f ) , [&]( const Photon& ){ ++cnt; } );
+    EXPECT_EQ( 0u , cnt );
+}
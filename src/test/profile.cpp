@@ -0,0 +1,80 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include "thirdparty/gtest/gtest.h"
+#include "core/profile.h"
+
+#ifndef SORT_ENABLE_PROFILER
+
+namespace {
+    // Count the occurrences of a string in a file.
+    unsigned countInFile( const char* filename , const std::string& str ){
+        std::string content;
+        if( auto file = fopen( filename , "r" ) ){
+            char buf[4096];
+            size_t read;
+            while( ( read = fread( buf , 1 , sizeof( buf ) , file ) ) > 0 )
+                content.append( buf , read );
+            fclose( file );
+        }
+        auto cnt = 0u;
+        for( auto pos = content.find( str ) ; pos != std::string::npos ; pos = content.find( str , pos + 1 ) )
+            ++cnt;
+        return cnt;
+    }
+}
+
+// Blocks are only recorded while the profiler is enabled, they are saved with escaped names.
+TEST(PROFILE, ChromeTrace) {
+    const auto enabled = SORT_PROFILE_ISENABLED;
+    SORT_PROFILE_ENABLE;
+    EXPECT_TRUE( SORT_PROFILE_ISENABLED );
+    {
+        SORT_PROFILE( "Profile \"outer\"" );
+        for( auto i = 0 ; i < 3 ; ++i ){
+            SORT_PROFILE( std::string( "Profile inner" ) );
+        }
+
+        // blocks of other threads are saved too.
+        std::thread thread( [](){ SORT_PROFILE( "Profile thread" ); } );
+        thread.join();
+
+        SORT_PROFILE( "Profile closed early" );
+        SORT_PROFILE_END;
+    }
+    SORT_PROFILE_DISABLE;
+    {
+        SORT_PROFILE( "Profile disabled" );
+    }
+
+    const auto filename = "profile_test_trace.json";
+    EXPECT_GE( SORT_PROFILE_DUMP( filename ) , 6u );
+    EXPECT_EQ( countInFile( filename , "\"name\":\"Profile \\\"outer\\\"\",\"ph\":\"X\"" ) , 1u );
+    EXPECT_EQ( countInFile( filename , "\"name\":\"Profile inner\"" ) , 3u );
+    EXPECT_EQ( countInFile( filename , "\"name\":\"Profile thread\"" ) , 1u );
+    EXPECT_EQ( countInFile( filename , "\"name\":\"Profile closed early\"" ) , 1u );
+    EXPECT_EQ( countInFile( filename , "Profile disabled" ) , 0u );
+    remove( filename );
+
+    if( enabled )
+        SORT_PROFILE_ENABLE;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include "thirdparty/gtest/gtest.h"
+#include "integrator/radiancecache.h"
+#include "core/rand.h"
+
+// Look-ups should return the average of the records around, and only where there are enough records.
+TEST(RADIANCECACHE, LookupAndRecord) {
+    sort_seed( 0 , 0 );
+    RadianceCache cache( 16 );
+
+    const auto up = Vector( 0.0f , 1.0f , 0.0f );
+    Spectrum radiance;
+    EXPECT_FALSE( cache.Lookup( Point( 0.5f , 0.0f , 0.5f ) , up , 0.25f , radiance ) );
+
+    // radiance in the square from (0,0) to (1,1) is one or three with equal chances.
+    for( auto i = 0 ; i < 100000 ; ++i ){
+        const auto p = Point( sort_canonical() , 0.0f , sort_canonical() );
+        cache.Record( p , up , 0.25f , Spectrum( i % 2 ? 1.0f : 3.0f ) );
+    }
+
+    ASSERT_TRUE( cache.Lookup( Point( 0.5f , 0.0f , 0.5f ) , up , 0.25f , radiance ) );
+    EXPECT_NEAR( radiance.GetIntensity() , 2.0f , 0.1f );
+
+    // nothing is recorded far away, on the other side of the surface or with a different size of cells.
+    EXPECT_FALSE( cache.Lookup( Point( 10.5f , 0.0f , 0.5f ) , up , 0.25f , radiance ) );
+    EXPECT_FALSE( cache.Lookup( Point( 0.5f , 0.0f , 0.5f ) , -up , 0.25f , radiance ) );
+    EXPECT_FALSE( cache.Lookup( Point( 0.5f , 0.0f , 0.5f ) , up , 2.0f , radiance ) );
+}
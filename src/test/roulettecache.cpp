@@ -0,0 +1,48 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "integrator/roulettecache.h"
+
+// Paths are killed or split depending on the fraction of the pixel they are expected to bring.
+TEST(ROULETTECACHE, WeightWindow) {
+    RouletteCache cache( BBox( Point( -1.0f , -1.0f , -1.0f ) , Point( 1.0f , 1.0f , 1.0f ) ) , 1 );
+
+    const auto p = Point( 0.5f , 0.5f , 0.5f );
+    EXPECT_EQ( 0.0f , cache.Radiance( p ) );
+    EXPECT_LT( cache.Factor( p , 1.0f , 1.0f , RouletteCache::SURFACE_VERTEX ) , 0.0f );
+
+    for( auto i = 0 ; i < 100 ; ++i ){
+        cache.Record( p , 2.0f );
+        cache.RecordCost( RouletteCache::SURFACE_VERTEX , 1.0f );
+        cache.RecordCost( RouletteCache::SUBSURFACE_VERTEX , 4.0f );
+    }
+    cache.Update();
+    EXPECT_NEAR( 2.0f , cache.Radiance( p ) , 1e-5f );
+
+    // nothing is learned in other cells
+    EXPECT_LT( cache.Factor( Point( -0.5f , -0.5f , -0.5f ) , 1.0f , 1.0f , RouletteCache::SURFACE_VERTEX ) , 0.0f );
+
+    // the center of the window is 0.5, where the path brings exactly the pixel.
+    EXPECT_EQ( 1.0f , cache.Factor( p , 0.5f , 1.0f , RouletteCache::SURFACE_VERTEX ) );
+    EXPECT_NEAR( 0.1f , cache.Factor( p , 0.05f , 1.0f , RouletteCache::SURFACE_VERTEX ) , 1e-5f );
+    EXPECT_EQ( 4.0f , cache.Factor( p , 2.0f , 1.0f , RouletteCache::SURFACE_VERTEX ) );
+
+    // SSS vertices are four times as expensive, the center of the window is twice as large.
+    EXPECT_NEAR( 0.05f , cache.Factor( p , 0.05f , 1.0f , RouletteCache::SUBSURFACE_VERTEX ) , 1e-5f );
+    EXPECT_EQ( 2.0f , cache.Factor( p , 2.0f , 1.0f , RouletteCache::SUBSURFACE_VERTEX ) );
+}
@@ -0,0 +1,267 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include "thirdparty/gtest/gtest.h"
+#include "sampler/sobol.h"
+#include "sampler/bluenoise.h"
+#include "sampler/cmj.h"
+#include "core/rand.h"
+#include "math/utils.h"
+
+// The first 2^m samples of every pair of dimensions should have exactly one sample in each elementary interval
+// of area 1/2^m, no matter how the sequence is scrambled and shuffled.
+TEST(SAMPLER, SobolStratification) {
+    constexpr auto m = 8u;
+    constexpr auto cnt = 1u << m;
+    for( auto seed : { 0u , 1u , 12345u } ){
+        for( auto dimension = 0u ; dimension < 16u ; ++dimension ){
+            std::vector<float> u( cnt ) , v( cnt );
+            for( auto i = 0u ; i < cnt ; ++i )
+                SobolSample2D( i , dimension , seed , u[i] , v[i] );
+
+            for( auto a = 0u ; a <= m ; ++a ){
+                const auto nx = 1u << a , ny = 1u << ( m - a );
+                std::vector<unsigned> hits( cnt , 0u );
+                for( auto i = 0u ; i < cnt ; ++i ){
+                    ASSERT_GE( u[i] , 0.0f );
+                    ASSERT_LT( u[i] , 1.0f );
+                    ASSERT_GE( v[i] , 0.0f );
+                    ASSERT_LT( v[i] , 1.0f );
+                    ++hits[ (unsigned)( v[i] * ny ) * nx + (unsigned)( u[i] * nx ) ];
+                }
+                for( auto h : hits )
+                    EXPECT_EQ( h , 1u );
+            }
+        }
+    }
+}
+
+// Pixels and pairs of dimensions take differently scrambled sequences.
+TEST(SAMPLER, SobolDecorrelation) {
+    float u0 , v0 , u1 , v1 , u2 , v2;
+    SobolSample2D( 3 , 0 , 7 , u0 , v0 );
+    SobolSample2D( 3 , 1 , 7 , u1 , v1 );
+    SobolSample2D( 3 , 0 , 8 , u2 , v2 );
+    EXPECT_NE( u0 , u1 );
+    EXPECT_NE( v0 , v1 );
+    EXPECT_NE( u0 , u2 );
+    EXPECT_NE( v0 , v2 );
+}
+
+// Numbers drawn during the evaluation of a sample are the dimensions following the ones taken by sample arrays.
+TEST(SAMPLER, SobolSequence) {
+    SobolSampler sampler;
+    sampler.StartPixel( 5 , 9 , 4 );
+
+    float camera[4];
+    sampler.Generate2D( camera , 2 );
+
+    sampler.StartSample( 1 );
+    const auto x0 = sort_canonical();
+    const auto x1 = sort_canonical();
+    const auto x2 = sort_canonical();
+    sampler.EndSample();
+
+    // the same sample drawn again gives the same numbers
+    sampler.StartSample( 1 );
+    EXPECT_EQ( x0 , sort_canonical() );
+    EXPECT_EQ( x1 , sort_canonical() );
+    EXPECT_EQ( x2 , sort_canonical() );
+    sampler.EndSample();
+
+    // the camera samples of the same sample index in the pixel match too
+    float pixel[2];
+    sampler.StartPixel( 5 , 9 , 5 );
+    sampler.Generate2D( pixel , 1 );
+    EXPECT_EQ( pixel[0] , camera[2] );
+    EXPECT_EQ( pixel[1] , camera[3] );
+
+    // the random number generator takes over after the sample
+    sampler.StartSample( 0 );
+    const auto y = sort_canonical();
+    sampler.EndSample();
+    auto different = false;
+    for( auto i = 0 ; i < 4 && !different ; ++i )
+        different = sort_canonical() != y;
+    EXPECT_TRUE( different );
+}
+
+// Integrating a smooth function converges much faster than with random numbers.
+TEST(SAMPLER, SobolIntegration) {
+    constexpr auto cnt = 1024u;
+    for( auto seed : { 3u , 17u } ){
+        for( auto dimension : { 0u , 5u } ){
+            double sum = 0.0;
+            for( auto i = 0u ; i < cnt ; ++i ){
+                float u , v;
+                SobolSample2D( i , dimension , seed , u , v );
+                sum += u * v * 4.0;
+            }
+            // the standard deviation of the random estimation is about 0.028
+            EXPECT_NEAR( sum / cnt , 1.0 , 0.002 );
+        }
+    }
+}
+
+// Numbers of a stream only depend on the key and index of the stream, not on the thread drawing them.
+TEST(SAMPLER, RandomStreams) {
+    sort_seed( 42 , 7 );
+    float stream[16];
+    for( auto& x : stream )
+        x = sort_canonical();
+
+    float other_thread[16];
+    std::thread thread( [&](){
+        sort_seed( 42 , 7 );
+        for( auto& x : other_thread )
+            x = sort_canonical();
+    } );
+    thread.join();
+
+    sort_seed( 42 , 8 );
+    auto different = 0;
+    for( auto i = 0 ; i < 16 ; ++i ){
+        EXPECT_EQ( stream[i] , other_thread[i] );
+        different += sort_canonical() != stream[i];
+    }
+    EXPECT_GE( different , 15 );
+}
+
+// Numbers drawn from a stream should be uniformly distributed.
+TEST(SAMPLER, RandomUniformity) {
+    constexpr auto cnt = 1u << 20;
+    constexpr auto bins = 64u;
+    std::vector<unsigned> hits( bins , 0u );
+    sort_seed( 3 , 0 );
+    double sum = 0.0;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto x = sort_canonical();
+        ASSERT_GE( x , 0.0f );
+        ASSERT_LT( x , 1.0f );
+        sum += x;
+        ++hits[ (unsigned)( x * bins ) ];
+    }
+    EXPECT_NEAR( sum / cnt , 0.5 , 0.002 );
+
+    // chi-square with 63 degrees of freedom is below 110 with a probability way higher than 99.9%.
+    const auto expected = (double)cnt / bins;
+    auto chi2 = 0.0;
+    for( auto h : hits )
+        chi2 += ( h - expected ) * ( h - expected ) / expected;
+    EXPECT_LT( chi2 , 110.0 );
+}
+
+// Root mean square of the average of 4x4 blocks of values taken as unit vectors at angles 2*PI*value. It is 0.25 for
+// white noise, blue noise cancels out much better. Angles make it insensitive to values being rotated toroidally.
+template<class T>
+double blockCircularMean( const T& value , int size ){
+    auto error = 0.0;
+    for( auto y = 0 ; y < size ; y += 4 ){
+        for( auto x = 0 ; x < size ; x += 4 ){
+            auto c = 0.0 , s = 0.0;
+            for( auto i = 0 ; i < 16 ; ++i ){
+                const auto v = value( x + i % 4 , y + i / 4 );
+                c += cos( TWO_PI * v );
+                s += sin( TWO_PI * v );
+            }
+            error += ( c * c + s * s ) / 256.0;
+        }
+    }
+    return sqrt( error / ( size * size / 16 ) );
+}
+
+// Every value is taken by exactly one texel of the blue noise texture.
+TEST(SAMPLER, BlueNoiseTile) {
+    constexpr auto N = BLUE_NOISE_TILE_SIZE;
+    std::vector<bool> taken( N * N , false );
+    for( auto y = 0 ; y < N ; ++y ){
+        for( auto x = 0 ; x < N ; ++x ){
+            const auto rank = (int)( BlueNoise( x , y ) * N * N );
+            ASSERT_GE( rank , 0 );
+            ASSERT_LT( rank , N * N );
+            EXPECT_FALSE( taken[rank] );
+            taken[rank] = true;
+        }
+    }
+    EXPECT_EQ( BlueNoise( 3 , 5 ) , BlueNoise( 3 + N , 5 - N ) );
+
+    const auto error = blockCircularMean( []( int x , int y ){ return BlueNoise( x , y ); } , N );
+    EXPECT_LT( error , 0.15 );
+}
+
+// The first sample of neighbouring pixels should be spread evenly in every dimension.
+TEST(SAMPLER, BlueNoiseSampler) {
+    BlueNoiseSampler sampler;
+    for( auto dimension = 0 ; dimension < 4 ; ++dimension ){
+        const auto error = blockCircularMean( [&]( int x , int y ){
+            sampler.StartPixel( x , y , 0 );
+            sampler.StartSample( 0 );
+            for( auto d = 0 ; d < dimension ; ++d )
+                sort_canonical();
+            const auto ret = sort_canonical();
+            sampler.EndSample();
+            return ret;
+        } , BLUE_NOISE_TILE_SIZE );
+        EXPECT_LT( error , 0.15 );
+    }
+}
+
+// Patterns of any size hold exactly one sample in each stratum of the second dimension, and at most one in each
+// sub-cell of the first dimension, whose number of columns is the integer square root of the size.
+TEST(SAMPLER, CMJStratification) {
+    for( auto cnt : { 1u , 7u , 10u , 16u , 37u , 100u } ){
+        const auto m = (unsigned)sqrtf( (float)cnt );
+        const auto n = ( cnt + m - 1 ) / m;
+        for( auto pattern = 0u ; pattern < 3u ; ++pattern ){
+            for( auto dimension = 0u ; dimension < 4u ; ++dimension ){
+                std::vector<unsigned> hits_u( m * n , 0u ) , hits_v( cnt , 0u );
+                for( auto i = 0u ; i < cnt ; ++i ){
+                    float u , v;
+                    CMJSample2D( pattern * cnt + i , cnt , dimension , 12345u , u , v );
+                    ASSERT_GE( u , 0.0f );
+                    ASSERT_LT( u , 1.0f );
+                    ASSERT_GE( v , 0.0f );
+                    ASSERT_LT( v , 1.0f );
+                    ++hits_u[ (unsigned)( u * m * n ) ];
+                    ++hits_v[ (unsigned)( v * cnt ) ];
+                }
+                for( auto h : hits_u )
+                    EXPECT_LE( h , 1u );
+                for( auto h : hits_v )
+                    EXPECT_EQ( h , 1u );
+            }
+        }
+    }
+}
+
+// Following patterns, pairs of dimensions and pixels take differently permuted patterns.
+TEST(SAMPLER, CMJDecorrelation) {
+    float u0 , v0 , u1 , v1 , u2 , v2 , u3 , v3;
+    CMJSample2D( 3 , 10 , 0 , 7 , u0 , v0 );
+    CMJSample2D( 3 , 10 , 1 , 7 , u1 , v1 );
+    CMJSample2D( 3 , 10 , 0 , 8 , u2 , v2 );
+    CMJSample2D( 13 , 10 , 0 , 7 , u3 , v3 );
+    EXPECT_NE( u0 , u1 );
+    EXPECT_NE( v0 , v1 );
+    EXPECT_NE( u0 , u2 );
+    EXPECT_NE( v0 , v2 );
+    EXPECT_NE( u0 , u3 );
+    EXPECT_NE( v0 , v3 );
+}
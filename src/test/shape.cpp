@@ -0,0 +1,375 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "shape/triangle.h"
+#include "entity/visual.h"
+#include "sampler/sample.h"
+#include "core/rand.h"
+
+namespace {
+    // A mesh visual with a single triangle.
+    std::unique_ptr<MeshVisual> singleTriangle( const Point& p0 , const Point& p1 , const Point& p2 ){
+        auto visual = std::make_unique<MeshVisual>();
+        visual->m_memory = std::make_unique<Mesh>();
+        visual->m_memory->m_vertices.resize( 3 );
+        visual->m_memory->m_vertices[0].m_position = p0;
+        visual->m_memory->m_vertices[1].m_position = p1;
+        visual->m_memory->m_vertices[2].m_position = p2;
+
+        MeshFaceIndex index;
+        index.m_id[0] = 0;
+        index.m_id[1] = 1;
+        index.m_id[2] = 2;
+        visual->m_memory->m_indices.push_back( index );
+        return visual;
+    }
+
+    // Solid angle of a triangle seen from a point, the formula comes from 'The Solid Angle of a Plane Triangle'.
+    float solidAngle( const Point& p , const Point& p0 , const Point& p1 , const Point& p2 ){
+        const auto a = p0 - p , b = p1 - p , c = p2 - p;
+        const auto la = a.Length() , lb = b.Length() , lc = c.Length();
+        const auto numerator = fabs( dot( a , cross( b , c ) ) );
+        const auto denominator = la * lb * lc + dot( a , b ) * lc + dot( a , c ) * lb + dot( b , c ) * la;
+        return 2.0f * atan2( numerator , denominator );
+    }
+
+    // Sampled directions hit the triangle with the pdf 'Pdf' returns, which integrates to one over the solid angle.
+    void checkTriangleSampling( const Point& p , const Point& p0 , const Point& p1 , const Point& p2 ){
+        static constexpr unsigned SAMPLE_CNT = 64 * 1024;
+
+        const auto visual = singleTriangle( p0 , p1 , p2 );
+        const Triangle triangle( visual.get() , visual->m_memory->m_indices[0] );
+
+        // directions sampled right on the edges could numerically miss the triangle
+        auto total = 0.0;
+        auto mismatch = 0u;
+        for( auto i = 0u ; i < SAMPLE_CNT ; ++i ){
+            const LightSample ls( true );
+            Vector wi , n;
+            auto pdf = 0.0f;
+            triangle.Sample_l( ls , p , wi , n , &pdf );
+            ASSERT_GT( pdf , 0.0f );
+            mismatch += fabs( triangle.Pdf( p , wi ) / pdf - 1.0f ) > 0.01f;
+            total += 1.0 / pdf;
+        }
+        EXPECT_LT( mismatch , SAMPLE_CNT / 1000 );
+
+        const auto expected = solidAngle( p , p0 , p1 , p2 );
+        EXPECT_NEAR( total / SAMPLE_CNT / expected , 1.0 , 0.01 );
+    }
+}
+
+// A triangle large in solid angle is sampled by the spherical triangle it subtends.
+TEST(TRIANGLE, SphericalSampling) {
+    const Point p0( 0.0f , 1.0f , 0.0f ) , p1( 0.0f , 1.0f , 1.0f ) , p2( 1.0f , 1.0f , 0.0f );
+    const Point p( 0.2f , 0.0f , 0.3f );
+
+    // the uniform pdf is the reciprocal of the solid angle
+    const auto visual = singleTriangle( p0 , p1 , p2 );
+    const Triangle triangle( visual.get() , visual->m_memory->m_indices[0] );
+    const LightSample ls( true );
+    Vector wi , n;
+    auto pdf = 0.0f;
+    triangle.Sample_l( ls , p , wi , n , &pdf );
+    EXPECT_NEAR( pdf * solidAngle( p , p0 , p1 , p2 ) , 1.0f , 0.001f );
+
+    checkTriangleSampling( p , p0 , p1 , p2 );
+}
+
+// A triangle small in solid angle is sampled by area.
+TEST(TRIANGLE, AreaSampling) {
+    const Point p0( 0.0f , 100.0f , 0.0f ) , p1( 0.0f , 100.0f , 1.0f ) , p2( 1.0f , 100.0f , 0.0f );
+    checkTriangleSampling( Point( 0.2f , 0.0f , 0.3f ) , p0 , p1 , p2 );
+}
+
+// Only the front side of a triangle could be sampled.
+TEST(TRIANGLE, BackFacing) {
+    const Point p0( 0.0f , 1.0f , 0.0f ) , p1( 1.0f , 1.0f , 0.0f ) , p2( 0.0f , 1.0f , 1.0f );
+    const Point p( 0.2f , 0.0f , 0.3f );
+    const auto visual = singleTriangle( p0 , p1 , p2 );
+    const Triangle triangle( visual.get() , visual->m_memory->m_indices[0] );
+
+    const LightSample ls( true );
+    Vector wi , n;
+    auto pdf = 1.0f;
+    triangle.Sample_l( ls , p , wi , n , &pdf );
+    EXPECT_EQ( pdf , 0.0f );
+    EXPECT_EQ( triangle.Pdf( p , wi ) , 0.0f );
+}
+
+// Rays spawned from a triangle far away from the origin never hit the triangle itself again.
+TEST(TRIANGLE, SpawnRay) {
+    static constexpr unsigned RAY_CNT = 64 * 1024;
+
+    const Point p0( 100000.0f , 100000.3f , 100000.0f ) , p1( 100001.0f , 100000.1f , 100000.2f ) , p2( 100000.2f , 100000.9f , 100001.0f );
+    const auto visual = singleTriangle( p0 , p1 , p2 );
+    const Triangle triangle( visual.get() , visual->m_memory->m_indices[0] );
+
+    auto hit = 0u , self_hit = 0u;
+    for( auto i = 0u ; i < RAY_CNT ; ++i ){
+        const auto u = sort_canonical() , v = sort_canonical() * ( 1.0f - u );
+        const auto target = p0 + u * ( p1 - p0 ) + v * ( p2 - p0 );
+        const auto ori = Point( 100000.5f , 100002.0f , 100000.5f ) + Vector( sort_canonical() , sort_canonical() , sort_canonical() ) * 2.0f - Vector( 1.0f );
+
+        const Ray ray( ori , normalize( target - ori ) );
+        ray.Prepare();
+        SurfaceInteraction inter;
+        if( !triangle.GetIntersect( ray , &inter ) )
+            continue;
+        ++hit;
+
+        // both reflected and transmitted rays are spawned
+        const auto w = normalize( Vector( sort_canonical() , sort_canonical() , sort_canonical() ) * 2.0f - Vector( 1.0f ) );
+        const auto spawned = inter.SpawnRay( w );
+        spawned.Prepare();
+        self_hit += triangle.GetIntersect( spawned , nullptr );
+    }
+    EXPECT_GT( hit , RAY_CNT / 2 );
+    EXPECT_EQ( self_hit , 0u );
+}
+
+// Clustering vertices of a dense grid reduces the triangles a lot, the simplified mesh stays inside and roughly covers it.
+TEST(TRIANGLE, MeshSimplification) {
+    static constexpr unsigned GRID = 32;
+
+    Mesh mesh;
+    mesh.m_vertices.resize( ( GRID + 1 ) * ( GRID + 1 ) );
+    for( auto i = 0u ; i <= GRID ; ++i ){
+        for( auto j = 0u ; j <= GRID ; ++j ){
+            auto& mv = mesh.m_vertices[i * ( GRID + 1 ) + j];
+            mv.m_position = Point( (float)i / GRID , (float)j / GRID , 0.0f );
+            mv.SetNormal( Vector( 0.0f , 0.0f , 1.0f ) );
+        }
+    }
+    for( auto i = 0u ; i < GRID ; ++i ){
+        for( auto j = 0u ; j < GRID ; ++j ){
+            const int v = i * ( GRID + 1 ) + j;
+            MeshFaceIndex f0 , f1;
+            f0.m_id[0] = v; f0.m_id[1] = v + GRID + 1; f0.m_id[2] = v + GRID + 2;
+            f1.m_id[0] = v; f1.m_id[1] = v + GRID + 2; f1.m_id[2] = v + 1;
+            mesh.m_indices.push_back( f0 );
+            mesh.m_indices.push_back( f1 );
+        }
+    }
+
+    Mesh simplified;
+    mesh.Simplify( 1.0f / 8.0f , simplified );
+    EXPECT_GT( simplified.m_indices.size() , 0u );
+    EXPECT_LT( simplified.m_indices.size() , mesh.m_indices.size() / 8 );
+
+    auto area = 0.0f;
+    for( const auto& mi : simplified.m_indices ){
+        const auto& p0 = simplified.m_vertices[mi.m_id[0]].m_position;
+        const auto& p1 = simplified.m_vertices[mi.m_id[1]].m_position;
+        const auto& p2 = simplified.m_vertices[mi.m_id[2]].m_position;
+        area += 0.5f * cross( p1 - p0 , p2 - p0 ).Length();
+    }
+    EXPECT_GT( area , 0.6f );
+    EXPECT_LT( area , 1.0f + 1e-4f );
+
+    for( const auto& mv : simplified.m_vertices ){
+        EXPECT_GE( mv.m_position.x , 0.0f );
+        EXPECT_LE( mv.m_position.x , 1.0f );
+        EXPECT_NEAR( mv.GetNormal().z , 1.0f , 1e-3f );
+    }
+}
+
+#include "shape/sphere.h"
+#include "shape/quad.h"
+#include "shape/disk.h"
+
+namespace {
+    // Directions sampled toward a light shape hit it with the pdf 'Pdf' returns, which integrates to one over the
+    // solid angle the shape subtends. Samples with zero pdf are rejected ones, they don't contribute.
+    void checkShapeSampling( const Shape& shape , const Point& p , const float expected ){
+        static constexpr unsigned SAMPLE_CNT = 64 * 1024;
+
+        auto total = 0.0;
+        auto mismatch = 0u;
+        for( auto i = 0u ; i < SAMPLE_CNT ; ++i ){
+            const LightSample ls( true );
+            Vector wi , n;
+            auto pdf = 0.0f;
+            shape.Sample_l( ls , p , wi , n , &pdf );
+            if( pdf == 0.0f )
+                continue;
+            mismatch += fabs( shape.Pdf( p , wi ) / pdf - 1.0f ) > 0.01f;
+            total += 1.0 / pdf;
+        }
+        EXPECT_LT( mismatch , SAMPLE_CNT / 1000 );
+        EXPECT_NEAR( total / SAMPLE_CNT / expected , 1.0 , 0.01 );
+    }
+}
+
+// A quad close to the shading point is sampled by the spherical rectangle it subtends.
+TEST(QUAD, SphericalSampling) {
+    Quad quad;
+    quad.SetSizeX( 2.0f );
+    quad.SetSizeY( 1.0f );
+    quad.SetTransform( Translate( 0.3f , 1.0f , -0.2f ) * RotateX( PI ) );
+
+    // the quad faces down, its solid angle is the sum of the two triangles it is made of
+    const Point p( 0.5f , 0.4f , 0.1f );
+    const Point p0( -0.7f , 1.0f , 0.3f ) , p1( 1.3f , 1.0f , 0.3f ) , p2( 1.3f , 1.0f , -0.7f ) , p3( -0.7f , 1.0f , -0.7f );
+    const auto expected = solidAngle( p , p0 , p1 , p2 ) + solidAngle( p , p0 , p2 , p3 );
+
+    const LightSample ls( true );
+    Vector wi , n;
+    auto pdf = 0.0f;
+    quad.Sample_l( ls , p , wi , n , &pdf );
+    EXPECT_NEAR( pdf * expected , 1.0f , 0.001f );
+    checkShapeSampling( quad , p , expected );
+
+    // nothing is sampled behind the quad
+    quad.Sample_l( ls , Point( 0.5f , 1.4f , 0.1f ) , wi , n , &pdf );
+    EXPECT_EQ( pdf , 0.0f );
+    EXPECT_EQ( quad.Pdf( Point( 0.5f , 1.4f , 0.1f ) , Vector( 0.0f , -1.0f , 0.0f ) ) , 0.0f );
+}
+
+// A disk is sampled by the spherical rectangle of its bounding square, samples outside of the disk are rejected.
+TEST(DISK, SphericalSampling) {
+    Disk disk;
+    disk.SetRadius( 0.8f );
+    disk.SetTransform( Translate( 0.0f , 2.0f , 0.0f ) * RotateX( PI ) );
+
+    // the solid angle of a disk seen from a point on its axis
+    const auto h = 0.5f;
+    const auto expected = TWO_PI * ( 1.0f - h / sqrt( h * h + 0.8f * 0.8f ) );
+    checkShapeSampling( disk , Point( 0.0f , 2.0f - h , 0.0f ) , expected );
+}
+
+// A sphere is sampled uniformly in the cone of directions toward it.
+TEST(SPHERE, ConeSampling) {
+    Sphere sphere;
+    sphere.SetTransform( Translate( 1.0f , 2.0f , 3.0f ) );
+
+    const Point center( 1.0f , 2.0f , 3.0f ) , p( 1.5f , 0.5f , 2.0f );
+    const auto cos_theta = sqrt( 1.0f - 1.0f / ( p - center ).SquaredLength() );
+    checkShapeSampling( sphere , p , TWO_PI * ( 1.0f - cos_theta ) );
+
+    // sampled points lie on the sphere with outward normals
+    const LightSample ls( true );
+    Vector wi , n;
+    const auto lp = sphere.Sample_l( ls , p , wi , n , nullptr );
+    EXPECT_NEAR( ( lp - center ).Length() , 1.0f , 1e-4f );
+    EXPECT_NEAR( dot( n , normalize( lp - center ) ) , 1.0f , 1e-4f );
+    EXPECT_GT( dot( -wi , n ) , 0.0f );
+
+    // nothing is sampled from inside the sphere
+    auto pdf = 1.0f;
+    sphere.Sample_l( ls , center + Vector( 0.1f , 0.2f , 0.0f ) , wi , n , &pdf );
+    EXPECT_EQ( pdf , 0.0f );
+}
+
+#ifdef SIMD4_ENABLED
+
+#define SIMD_SSE_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#include "simd/simd_ray_utils.h"
+#include "simd/sse_shape.h"
+#include "core/primitive.h"
+
+namespace {
+    // Random rays shot from around the origin toward the shapes.
+    Ray randomRay(){
+        const Point ori( sort_canonical() * 4.0f - 2.0f , sort_canonical() * 4.0f - 2.0f , sort_canonical() * 4.0f - 2.0f );
+        const Point target( sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f , sort_canonical() * 2.0f - 1.0f );
+        return Ray( ori , normalize( target - ori ) );
+    }
+
+    // SIMD kernels of packed shapes should agree with intersecting the shapes one by one.
+    template<class T>
+    void checkSimdShapes( T& simd_shapes , const Primitive* const* primitives , const unsigned cnt ){
+        static constexpr unsigned RAY_CNT = 16 * 1024;
+
+        auto mismatch = 0u;
+        for( auto i = 0u ; i < RAY_CNT ; ++i ){
+            const auto ray = randomRay();
+            Simd_Ray_Data ray_simd;
+            resolveRayData( ray , ray_simd );
+
+            SurfaceInteraction expected;
+            auto blocked = false;
+            for( auto j = 0u ; j < cnt ; ++j )
+                blocked |= primitives[j]->GetIntersect( ray , &expected );
+
+            SurfaceInteraction actual;
+            bool hit , occluded;
+            if constexpr( std::is_same<T, Simd_Sphere>::value ){
+                hit = intersectSphere_SIMD( ray , ray_simd , simd_shapes , &actual );
+                occluded = intersectSphereFast_SIMD( ray , ray_simd , simd_shapes );
+            }else{
+                hit = intersectPlanar_SIMD( ray , ray_simd , simd_shapes , &actual );
+                occluded = intersectPlanarFast_SIMD( ray , ray_simd , simd_shapes );
+            }
+
+            // rays grazing the shapes could numerically disagree, but they should be really rare.
+            if( hit != blocked || occluded != blocked || ( hit && ( actual.primitive != expected.primitive || fabs( actual.t - expected.t ) > 1e-4f ) ) )
+                ++mismatch;
+        }
+        EXPECT_LE( mismatch , RAY_CNT / 1000 );
+    }
+}
+
+TEST(SHAPE, SimdSphere) {
+    std::unique_ptr<Sphere> spheres[SIMD_CHANNEL];
+    std::unique_ptr<Primitive> primitives[SIMD_CHANNEL];
+    Simd_Sphere simd_sphere;
+    for( auto i = 0 ; i < SIMD_CHANNEL - 1 ; ++i ){
+        spheres[i] = std::make_unique<Sphere>();
+        spheres[i]->SetTransform( Translate( (float)i * 0.4f - 0.6f , 0.1f * (float)i , 0.0f ) * RotateY( (float)i ) );
+        primitives[i] = std::make_unique<Primitive>( nullptr , nullptr , spheres[i].get() );
+        simd_sphere.PushSphere( primitives[i].get() );
+    }
+    // one channel is left empty on purpose.
+    ASSERT_TRUE( simd_sphere.PackData() );
+
+    const Primitive* pris[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL - 1 ; ++i )
+        pris[i] = primitives[i].get();
+    checkSimdShapes( simd_sphere , pris , SIMD_CHANNEL - 1 );
+}
+
+TEST(SHAPE, SimdQuadAndDisk) {
+    std::unique_ptr<TransformedShape> shapes[SIMD_CHANNEL];
+    std::unique_ptr<Primitive> primitives[SIMD_CHANNEL];
+    Simd_Planar simd_planar;
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        if( i % 2 ){
+            auto disk = std::make_unique<Disk>();
+            disk->SetRadius( 0.3f + 0.1f * (float)i );
+            shapes[i] = std::move( disk );
+        }else{
+            auto quad = std::make_unique<Quad>();
+            quad->SetSizeX( 0.5f + 0.1f * (float)i );
+            quad->SetSizeY( 1.0f - 0.1f * (float)i );
+            shapes[i] = std::move( quad );
+        }
+        shapes[i]->SetTransform( Translate( 0.2f * (float)i - 0.3f , 0.3f * (float)i - 0.5f , 0.1f ) * RotateX( (float)i * 0.7f ) * RotateZ( (float)i * 0.3f ) );
+        primitives[i] = std::make_unique<Primitive>( nullptr , nullptr , shapes[i].get() );
+        simd_planar.PushPlanar( primitives[i].get() );
+    }
+    ASSERT_TRUE( simd_planar.PackData() );
+
+    const Primitive* pris[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        pris[i] = primitives[i].get();
+    checkSimdShapes( simd_planar , pris , SIMD_CHANNEL );
+}
+
+#endif
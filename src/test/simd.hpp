@@ -27,7 +27,11 @@
     #define SIMD_TEST       SIMD_SSE
 #endif
 
-#if defined( SIMD_AVX_IMPLEMENTATION ) || defined( SIMD_SSE_IMPLEMENTATION )
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define SIMD_TEST       SIMD_AVX512
+#endif
+
+#if defined( SIMD_AVX_IMPLEMENTATION ) || defined( SIMD_SSE_IMPLEMENTATION ) || defined( SIMD_AVX512_IMPLEMENTATION )
 
 static constexpr float nan_unsigned = 0xffc00000;
 static constexpr float nan_float = *((float*)(&nan_unsigned));
@@ -61,6 +65,16 @@ TEST(SIMD_TEST, simd_set_mask) {
     }
 }
 
+TEST(SIMD_TEST, simd_cvtu8_ps) {
+    unsigned char data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = (unsigned char)( 255 - 31 * i );
+
+    const auto simd_data = simd_cvtu8_ps( data );
+    for( int i = 0 ; i < SIMD_CHANNEL ; ++i )
+        EXPECT_EQ( simd_data[i] , (float)data[i] );
+}
+
 TEST(SIMD_TEST, simd_add_ps) {
     float data0[SIMD_CHANNEL] , data1[SIMD_CHANNEL];
     for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
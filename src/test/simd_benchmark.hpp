@@ -0,0 +1,297 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+// Micro benchmarks of the raw SIMD intersection kernels, included by sse.cpp, avx.cpp and avx512.cpp so that each
+// instruction set is compiled with its own flags, their suites are SIMD_*_KERNEL_BENCHMARK. Each kernel is timed with rays hitting none, half and all of the tested primitives, the scalar intersection of the
+// same primitives one by one is timed as the baseline.
+
+#if defined( SIMD_AVX_IMPLEMENTATION ) || defined( SIMD_SSE_IMPLEMENTATION ) || defined( SIMD_AVX512_IMPLEMENTATION )
+
+#include <random>
+#include <vector>
+#include <memory>
+#include "benchmark.h"
+#include "core/cpu.h"
+#include "entity/visual.h"
+#include "shape/line.h"
+
+#define SIMD_BVH_IMPLEMENTATION
+#include "simd/simd_ray_utils.h"
+#include "simd/simd_triangle.h"
+#include "simd/simd_line.h"
+#include "simd/simd_bbox.h"
+#undef SIMD_BVH_IMPLEMENTATION
+
+#ifdef SIMD_SSE_IMPLEMENTATION
+    #define SIMD_KERNEL_BENCHMARK   SIMD_SSE_KERNEL_BENCHMARK
+    #define SIMD_KERNEL_ISA         SimdIsa::SSE
+#endif
+
+#ifdef SIMD_AVX_IMPLEMENTATION
+    #define SIMD_KERNEL_BENCHMARK   SIMD_AVX_KERNEL_BENCHMARK
+    #define SIMD_KERNEL_ISA         SimdIsa::AVX
+#endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define SIMD_KERNEL_BENCHMARK   SIMD_AVX512_KERNEL_BENCHMARK
+    #define SIMD_KERNEL_ISA         SimdIsa::AVX512
+#endif
+
+namespace {
+    //! @brief  Seed of the random number generator that generates primitives and rays.
+    constexpr unsigned KERNEL_BENCHMARK_SEED = 0x5eed;
+
+    //! @brief  Number of packs of primitives, they are small enough to stay in the cache like the hot nodes of a BVH.
+    constexpr unsigned KERNEL_BENCHMARK_PACK_CNT = 64;
+
+    //! @brief  Number of rays in each ray set, each ray is tested against one pack.
+    constexpr unsigned KERNEL_BENCHMARK_RAY_CNT = 4096;
+
+    //! @brief  Number of times a ray set is tested, the first one is not timed to warm up the caches.
+    constexpr unsigned KERNEL_BENCHMARK_ROUND_CNT = 65;
+
+    //! @brief  Portions of rays hitting the primitives they are tested against.
+    constexpr float KERNEL_BENCHMARK_HIT_RATIOS[] = { 0.0f , 0.5f , 1.0f };
+
+    //! @brief  Rays to be tested, both the scalar version and the resolved SIMD version.
+    struct Kernel_Benchmark_Rays{
+        std::vector<Ray>            rays;       /**< Rays to be tested. */
+        std::vector<Simd_Ray_Data>  simd_rays;  /**< Resolved SIMD data of the rays. */
+    };
+
+    //! @brief  Random point in the unit cube.
+    Point randomPoint( std::mt19937& rng ){
+        std::uniform_real_distribution<float> canonical( -1.0f , 1.0f );
+        const auto x = canonical( rng ) , y = canonical( rng ) , z = canonical( rng );
+        return Point( x , y , z );
+    }
+
+    //! @brief  Rays shot from a sphere around the unit cube, a ray hitting a pack is aimed at the center of one of its
+    //!         primitives, a ray missing it is aimed in the opposite direction.
+    Kernel_Benchmark_Rays benchmarkRays( const std::vector<Point>& centers , const float hit_ratio ){
+        std::mt19937 rng( KERNEL_BENCHMARK_SEED );
+        std::uniform_real_distribution<float> canonical( 0.0f , 1.0f - FLT_EPSILON );
+        Kernel_Benchmark_Rays ret;
+        ret.rays.reserve( KERNEL_BENCHMARK_RAY_CNT );
+        ret.simd_rays.resize( KERNEL_BENCHMARK_RAY_CNT );
+        for( auto i = 0u ; i < KERNEL_BENCHMARK_RAY_CNT ; ++i ){
+            const auto pack = i % KERNEL_BENCHMARK_PACK_CNT;
+            const auto& center = centers[pack * SIMD_CHANNEL + i % SIMD_CHANNEL];
+            const auto ori = Point( 0.0f ) + normalize( Vector( randomPoint( rng ) - Point( 0.0f ) ) ) * 4.0f;
+            const auto dir = normalize( center - ori );
+            ret.rays.push_back( Ray( ori , canonical( rng ) < hit_ratio ? dir : -dir ) );
+            ret.rays.back().Prepare();
+            resolveRayData( ret.rays.back() , ret.simd_rays[i] );
+        }
+        return ret;
+    }
+
+    //! @brief  Average time of testing a ray set in nanoseconds per test.
+    template<class T>
+    double measureKernel( const T& test ){
+        return BenchmarkNanoseconds( KERNEL_BENCHMARK_RAY_CNT , KERNEL_BENCHMARK_ROUND_CNT , test );
+    }
+
+    //! @brief  Time the closest hit and any hit kernels of packs of primitives, and intersecting them one by one.
+    //!
+    //! The number of rays hitting anything is checked against the scalar version, so that none of the tests is
+    //! optimized away and the kernels are verified to do the same work.
+    template<class Closest, class Any>
+    void benchmarkKernel( const char* name , const std::vector<const Primitive*>& primitives , const std::vector<Point>& centers ,
+                          const Closest& closest , const Any& any ){
+        for( const auto hit_ratio : KERNEL_BENCHMARK_HIT_RATIOS ){
+            const auto data = benchmarkRays( centers , hit_ratio );
+
+            auto simd_hits = 0u , simd_any_hits = 0u , scalar_hits = 0u , scalar_any_hits = 0u;
+            const auto simd_closest_ns = measureKernel( [&]( unsigned i ){
+                SurfaceInteraction intersection;
+                simd_hits += closest( data.rays[i] , data.simd_rays[i] , i % KERNEL_BENCHMARK_PACK_CNT , &intersection ) ? 1 : 0;
+            } );
+            const auto simd_any_ns = measureKernel( [&]( unsigned i ){
+                simd_any_hits += any( data.rays[i] , data.simd_rays[i] , i % KERNEL_BENCHMARK_PACK_CNT ) ? 1 : 0;
+            } );
+            const auto scalar_closest_ns = measureKernel( [&]( unsigned i ){
+                SurfaceInteraction intersection;
+                auto hit = false;
+                const auto pack = i % KERNEL_BENCHMARK_PACK_CNT;
+                for( auto j = 0 ; j < SIMD_CHANNEL ; ++j )
+                    hit |= primitives[pack * SIMD_CHANNEL + j]->GetIntersect( data.rays[i] , &intersection );
+                scalar_hits += hit ? 1 : 0;
+            } );
+            const auto scalar_any_ns = measureKernel( [&]( unsigned i ){
+                const auto pack = i % KERNEL_BENCHMARK_PACK_CNT;
+                auto hit = false;
+                for( auto j = 0 ; j < SIMD_CHANNEL && !hit ; ++j )
+                    hit = primitives[pack * SIMD_CHANNEL + j]->GetIntersect( data.rays[i] , nullptr );
+                scalar_any_hits += hit ? 1 : 0;
+            } );
+
+            BenchmarkReport() << name << " x" << SIMD_CHANNEL << ", " << (int)( hit_ratio * 100.0f ) << "% hits: closest "
+                      << simd_closest_ns << "(ns), any " << simd_any_ns << "(ns), scalar closest " << scalar_closest_ns
+                      << "(ns), scalar any " << scalar_any_ns << "(ns)" << std::endl;
+
+            // rays grazing the primitives could numerically disagree, but they should be really rare.
+            const auto tolerance = KERNEL_BENCHMARK_RAY_CNT * KERNEL_BENCHMARK_ROUND_CNT / 1000;
+            EXPECT_NEAR( simd_hits , scalar_hits , tolerance );
+            EXPECT_NEAR( simd_any_hits , scalar_any_hits , tolerance );
+        }
+    }
+}
+
+TEST(SIMD_KERNEL_BENCHMARK, DISABLED_Triangle) {
+    if( !IsSimdIsaSupported( SIMD_KERNEL_ISA ) )
+        return;
+
+    // Small triangles scattered in the unit cube, all of them in one mesh.
+    std::mt19937 rng( KERNEL_BENCHMARK_SEED );
+    const auto cnt = KERNEL_BENCHMARK_PACK_CNT * SIMD_CHANNEL;
+    auto visual = std::make_unique<MeshVisual>();
+    visual->m_memory = std::make_unique<Mesh>();
+    visual->m_memory->m_vertices.resize( cnt * 3 );
+    std::vector<Point> centers;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto center = randomPoint( rng );
+        for( auto k = 0u ; k < 3 ; ++k )
+            visual->m_memory->m_vertices[i * 3 + k].m_position = center + Vector( randomPoint( rng ) - Point( 0.0f ) ) * 0.2f;
+        const auto& vertices = visual->m_memory->m_vertices;
+        centers.push_back( ( vertices[i * 3].m_position + vertices[i * 3 + 1].m_position + vertices[i * 3 + 2].m_position ) / 3.0f );
+
+        MeshFaceIndex index;
+        index.m_id[0] = i * 3;
+        index.m_id[1] = i * 3 + 1;
+        index.m_id[2] = i * 3 + 2;
+        visual->m_memory->m_indices.push_back( index );
+    }
+
+    std::vector<std::unique_ptr<Triangle>> triangles;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    std::vector<Simd_Triangle> packs( KERNEL_BENCHMARK_PACK_CNT );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        triangles.push_back( std::make_unique<Triangle>( visual.get() , visual->m_memory->m_indices[i] ) );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , triangles.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        packs[i / SIMD_CHANNEL].PushTriangle( primitives.back() );
+    }
+    for( auto& pack : packs )
+        ASSERT_TRUE( pack.PackData() );
+
+    benchmarkKernel( "Triangle" , primitives , centers ,
+        [&]( const Ray& ray , const Simd_Ray_Data& simd_ray , unsigned pack , SurfaceInteraction* intersection ){
+            return intersectTriangle_SIMD( ray , simd_ray , packs[pack] , intersection );
+        } ,
+        [&]( const Ray& ray , const Simd_Ray_Data& simd_ray , unsigned pack ){
+            return intersectTriangleFast_SIMD( ray , simd_ray , packs[pack] );
+        } );
+}
+
+TEST(SIMD_KERNEL_BENCHMARK, DISABLED_Line) {
+    if( !IsSimdIsaSupported( SIMD_KERNEL_ISA ) )
+        return;
+
+    // Short hair strands scattered in the unit cube.
+    std::mt19937 rng( KERNEL_BENCHMARK_SEED );
+    const auto cnt = KERNEL_BENCHMARK_PACK_CNT * SIMD_CHANNEL;
+    std::vector<std::unique_ptr<Line>> lines;
+    std::vector<std::unique_ptr<Primitive>> owned;
+    std::vector<const Primitive*> primitives;
+    std::vector<Point> centers;
+    std::vector<Simd_Line> packs( KERNEL_BENCHMARK_PACK_CNT );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto p0 = randomPoint( rng );
+        const auto p1 = p0 + Vector( randomPoint( rng ) - Point( 0.0f ) ) * 0.2f;
+        lines.push_back( std::make_unique<Line>( p0 , p1 , 0.0f , 1.0f , 0.02f , 0.01f , 0 ) );
+        lines.back()->SetTransform( Transform() );
+        owned.push_back( std::make_unique<Primitive>( nullptr , nullptr , lines.back().get() ) );
+        primitives.push_back( owned.back().get() );
+        centers.push_back( p0 + ( p1 - p0 ) * 0.5f );
+        packs[i / SIMD_CHANNEL].PushLine( primitives.back() );
+    }
+    for( auto& pack : packs )
+        ASSERT_TRUE( pack.PackData() );
+
+    benchmarkKernel( "Line" , primitives , centers ,
+        [&]( const Ray& ray , const Simd_Ray_Data& simd_ray , unsigned pack , SurfaceInteraction* intersection ){
+            return intersectLine_SIMD( ray , simd_ray , packs[pack] , intersection );
+        } ,
+        [&]( const Ray& ray , const Simd_Ray_Data& simd_ray , unsigned pack ){
+            return intersectLineFast_SIMD( ray , simd_ray , packs[pack] );
+        } );
+}
+
+TEST(SIMD_KERNEL_BENCHMARK, DISABLED_BBox) {
+    if( !IsSimdIsaSupported( SIMD_KERNEL_ISA ) )
+        return;
+
+    // Boxes of children of BVH nodes scattered in the unit cube.
+    std::mt19937 rng( KERNEL_BENCHMARK_SEED );
+    const auto cnt = KERNEL_BENCHMARK_PACK_CNT * SIMD_CHANNEL;
+    std::vector<BBox> bboxes;
+    std::vector<Point> centers;
+    std::vector<Simd_BBox> packs( KERNEL_BENCHMARK_PACK_CNT );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        const auto center = randomPoint( rng );
+        const auto extent = Vector( randomPoint( rng ) - Point( -1.0f ) ) * 0.1f;
+        bboxes.push_back( BBox( center - extent , center + extent ) );
+        centers.push_back( center );
+    }
+    for( auto i = 0u ; i < KERNEL_BENCHMARK_PACK_CNT ; ++i ){
+        float min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL] , max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
+        bool mask[SIMD_CHANNEL];
+        for( auto j = 0 ; j < SIMD_CHANNEL ; ++j ){
+            const auto& bbox = bboxes[i * SIMD_CHANNEL + j];
+            min_x[j] = bbox.m_Min.x; min_y[j] = bbox.m_Min.y; min_z[j] = bbox.m_Min.z;
+            max_x[j] = bbox.m_Max.x; max_y[j] = bbox.m_Max.y; max_z[j] = bbox.m_Max.z;
+            mask[j] = true;
+        }
+        packs[i].m_min_x = simd_set_ps( min_x );
+        packs[i].m_min_y = simd_set_ps( min_y );
+        packs[i].m_min_z = simd_set_ps( min_z );
+        packs[i].m_max_x = simd_set_ps( max_x );
+        packs[i].m_max_y = simd_set_ps( max_y );
+        packs[i].m_max_z = simd_set_ps( max_z );
+        packs[i].m_mask = simd_set_mask( mask );
+    }
+
+    // Traversal needs the distances to all children, the closest hit and any hit tests of boxes are the same kernel.
+    for( const auto hit_ratio : KERNEL_BENCHMARK_HIT_RATIOS ){
+        const auto data = benchmarkRays( centers , hit_ratio );
+
+        auto simd_hits = 0u , scalar_hits = 0u;
+        const auto simd_ns = measureKernel( [&]( unsigned i ){
+            simd_data f_min;
+            for( auto mask = IntersectBBox_SIMD( data.rays[i] , data.simd_rays[i] , packs[i % KERNEL_BENCHMARK_PACK_CNT] , f_min ) ; mask ; mask &= mask - 1 )
+                ++simd_hits;
+        } );
+        const auto scalar_ns = measureKernel( [&]( unsigned i ){
+            const auto pack = i % KERNEL_BENCHMARK_PACK_CNT;
+            for( auto j = 0 ; j < SIMD_CHANNEL ; ++j )
+                scalar_hits += Intersect( data.rays[i] , bboxes[pack * SIMD_CHANNEL + j] ) >= 0.0f ? 1 : 0;
+        } );
+
+        BenchmarkReport() << "BBox x" << SIMD_CHANNEL << ", " << (int)( hit_ratio * 100.0f ) << "% hits: "
+                  << simd_ns << "(ns), scalar " << scalar_ns << "(ns)" << std::endl;
+
+        const auto tolerance = KERNEL_BENCHMARK_RAY_CNT * KERNEL_BENCHMARK_ROUND_CNT / 1000;
+        EXPECT_NEAR( simd_hits , scalar_hits , tolerance );
+    }
+}
+
+#undef SIMD_KERNEL_BENCHMARK
+#undef SIMD_KERNEL_ISA
+
+#endif
@@ -0,0 +1,69 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+
+#include <cmath>
+#include "thirdparty/gtest/gtest.h"
+#include "spectrum/spectrum.h"
+
+// Arithmetic of colors should match the arithmetic of each channel, whether it is vectorized or not.
+TEST(SPECTRUM, Arithmetic) {
+    const Spectrum c0( 0.5f , 2.0f , -1.0f );
+    const Spectrum c1( 4.0f , 0.25f , 3.0f );
+
+    const auto check = []( const Spectrum& c , float r , float g , float b ){
+        EXPECT_FLOAT_EQ( c.r , r );
+        EXPECT_FLOAT_EQ( c.g , g );
+        EXPECT_FLOAT_EQ( c.b , b );
+    };
+    check( c0 + c1 , 4.5f , 2.25f , 2.0f );
+    check( c0 - c1 , -3.5f , 1.75f , -4.0f );
+    check( c0 * c1 , 2.0f , 0.5f , -3.0f );
+    check( c0 / c1 , 0.125f , 8.0f , -1.0f / 3.0f );
+    check( c0 * 2.0f , 1.0f , 4.0f , -2.0f );
+    check( 1.0f - c0 , 0.5f , -1.0f , 2.0f );
+    check( 1.0f / c1 , 0.25f , 4.0f , 1.0f / 3.0f );
+
+    auto c = c0;
+    c += c1;
+    c *= 2.0f;
+    check( c , 9.0f , 4.5f , 4.0f );
+
+    check( c0.Clamp( 0.0f , 1.0f ) , 0.5f , 1.0f , 0.0f );
+    check( c1.Sqrt() , 2.0f , 0.5f , std::sqrt( 3.0f ) );
+    EXPECT_FLOAT_EQ( c0.GetMaxComponent() , 2.0f );
+    EXPECT_TRUE( Spectrum( 0.0f ).IsBlack() );
+    EXPECT_FALSE( Spectrum( 0.0f , 0.0f , 1e-8f ).IsBlack() );
+}
+
+// The exponential should be accurate in the whole range where it matters, like the transmittance of media.
+TEST(SPECTRUM, Exp) {
+    for( auto x = -80.0f ; x < 80.0f ; x += 0.37f ){
+        const auto e = Spectrum( x , -x , x * 0.5f ).Exp();
+        EXPECT_NEAR( e.r / std::exp( x ) , 1.0f , 1e-5f );
+        EXPECT_NEAR( e.g / std::exp( -x ) , 1.0f , 1e-5f );
+        EXPECT_NEAR( e.b / std::exp( x * 0.5f ) , 1.0f , 1e-5f );
+    }
+    EXPECT_NEAR( Spectrum( -1000.0f ).Exp().GetMaxComponent() , 0.0f , 1e-30f );
+}
+
+// Colors with Nan or Inf in any channel are invalid.
+TEST(SPECTRUM, IsValid) {
+    EXPECT_TRUE( Spectrum( 1.0f , -2.0f , 1e30f ).IsValid() );
+    EXPECT_FALSE( Spectrum( 1.0f , NAN , 0.0f ).IsValid() );
+    EXPECT_FALSE( Spectrum( 0.0f , 0.0f , -INFINITY ).IsValid() );
+}
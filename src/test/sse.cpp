@@ -17,12 +17,13 @@
 
 #include "core/define.h"
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #define SIMD_SSE_IMPLEMENTATION
 #endif
 
 #include "simd.hpp"
+#include "simd_benchmark.hpp"
 
-#ifdef SSE_ENABLED
+#ifdef SIMD4_ENABLED
 #undef SIMD_SSE_IMPLEMENTATION
 #endif
\ No newline at end of file
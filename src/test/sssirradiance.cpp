@@ -0,0 +1,56 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include "thirdparty/gtest/gtest.h"
+#include "integrator/sssirradiance.h"
+#include "core/rand.h"
+
+// Integrating over the octree should be close to summing up all points, and nothing bleeds between materials.
+TEST(SSSIRRADIANCE, Integrate) {
+    sort_seed( 0 , 0 );
+
+    // a unit square lit by a gradient along X axis
+    static constexpr unsigned N = 20000;
+    std::vector<SSSIrradianceCache::Sample> samples( N );
+    for( auto& sample : samples ){
+        sample.position = Point( sort_canonical() , 0.0f , sort_canonical() );
+        sample.area = 1.0f / N;
+        sample.radiosity = Spectrum( sample.position.x );
+    }
+
+    SSSIrradianceCache cache;
+    cache.Add( SID( "skin" ) , samples );
+
+    const auto profile = []( float r ){ return Spectrum( exp( -r * 8.0f ) ); };
+    const auto max_distance = 0.5f;
+    for( auto k = 0 ; k < 16 ; ++k ){
+        const auto po = Point( sort_canonical() , 0.0f , sort_canonical() );
+
+        Spectrum expected;
+        for( const auto& sample : samples ){
+            const auto d = distance( po , sample.position );
+            if( d <= max_distance )
+                expected += profile( std::max( d , 0.5f * sqrt( sample.area / 3.1415926f ) ) ) * sample.radiosity * sample.area;
+        }
+
+        const auto radiance = cache.Integrate( SID( "skin" ) , po , profile , max_distance );
+        EXPECT_NEAR( radiance.GetIntensity() , expected.GetIntensity() , expected.GetIntensity() * 0.05f + 1e-4f );
+    }
+
+    EXPECT_TRUE( cache.Integrate( SID( "wax" ) , Point( 0.5f , 0.0f , 0.5f ) , profile , max_distance ).IsBlack() );
+}
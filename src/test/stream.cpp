@@ -18,7 +18,12 @@
 #include "thirdparty/gtest/gtest.h"
 #include "stream/fstream.h"
 #include "stream/mstream.h"
+#include "stream/mmapstream.h"
+#include "stream/zstream.h"
+#include "stream/shmstream.h"
+#include "stream/socketstream.h"
 #include "core/rand.h"
+#include <thread>
 
 #define STREAM_SAMPLE_COUNT 10000
 
@@ -63,6 +68,171 @@ TEST(STREAM, FileStream) {
     }
 }
 
+TEST(STREAM, MappedFileStream) {
+    std::vector<float>           vec_f;
+    std::vector<int>             vec_i;
+    OFileStream ofile("test_mapped.bin");
+    std::string str = "this is a random string";
+    std::string empty_str = "";
+    ofile << str << true << empty_str;
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i) {
+        vec_f.push_back( sort_canonical() );
+        vec_i.push_back( (int)( ( 2.0f * sort_canonical() - 1.0f ) * STREAM_SAMPLE_COUNT ) );
+        ofile << vec_f.back() << vec_i.back();
+    }
+    ofile << vec_f[0];
+    ofile.Close();
+
+    IMappedFileStream ifile("test_mapped.bin");
+    ASSERT_TRUE( ifile.IsValid() );
+    std::string str_copy , empty_str_copy;
+    bool flag_copy = false;
+    ifile >> str_copy >> flag_copy >> empty_str_copy;
+    EXPECT_EQ( str_copy , str );
+    EXPECT_TRUE( flag_copy );
+    EXPECT_EQ( empty_str_copy , empty_str );
+
+    // half of the values are accessed in place, the other half are copied out one by one
+    const auto half = STREAM_SAMPLE_COUNT / 2;
+    const auto view = ifile.View( (int)( ( sizeof(float) + sizeof(int) ) * half ) );
+    ASSERT_TRUE( view != nullptr );
+    for (int i = 0; i < half; ++i) {
+        float t0 = 0.0f;
+        int t1 = 0;
+        memcpy( &t0 , view + ( sizeof(float) + sizeof(int) ) * i , sizeof(float) );
+        memcpy( &t1 , view + ( sizeof(float) + sizeof(int) ) * i + sizeof(float) , sizeof(int) );
+        EXPECT_EQ(t0, vec_f[i]);
+        EXPECT_EQ(t1, vec_i[i]);
+    }
+    for (int i = half; i < STREAM_SAMPLE_COUNT; ++i) {
+        float t0 = 0.0f;
+        int t1 = 0;
+        ifile >> t0 >> t1;
+        EXPECT_EQ(t0, vec_f[i]);
+        EXPECT_EQ(t1, vec_i[i]);
+    }
+    EXPECT_TRUE( ifile.IsValid() );
+
+    // evicted pages are read from the file again when they are touched
+    ifile.AdviseRandomAccess();
+    ifile.Evict();
+    EXPECT_LE( ifile.GetResidentSize() , ( ifile.GetSize() + 65535 ) / 65536 * 65536 );
+    for (int i = 0; i < half; ++i) {
+        float t0 = 0.0f;
+        memcpy( &t0 , view + ( sizeof(float) + sizeof(int) ) * i , sizeof(float) );
+        EXPECT_EQ(t0, vec_f[i]);
+    }
+
+    // reading beyond the end of the file invalidates the stream
+    float last = 0.0f;
+    int beyond = 1;
+    ifile >> last >> beyond;
+    EXPECT_EQ( last , vec_f[0] );
+    EXPECT_EQ( beyond , 0 );
+    EXPECT_FALSE( ifile.IsValid() );
+}
+
+#if defined(SORT_IN_LINUX) || defined(SORT_IN_MAC)
+// Shared memory is a shared file on Linux and Mac OS, it is written the same way Blender exports the scene.
+TEST(STREAM, SharedMemoryStream) {
+    std::vector<float>           vec_f;
+    std::vector<int>             vec_i;
+    const std::string str = "this is a random string";
+    OFileStream ofile("test_shared.bin");
+    ofile << SHARED_MEMORY_STREAM_MAGIC << (unsigned int)( str.size() + 1 + ( sizeof(float) + sizeof(int) ) * STREAM_SAMPLE_COUNT );
+    ofile << str;
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i) {
+        vec_f.push_back( sort_canonical() );
+        vec_i.push_back( (int)( ( 2.0f * sort_canonical() - 1.0f ) * STREAM_SAMPLE_COUNT ) );
+        ofile << vec_f.back() << vec_i.back();
+    }
+    ofile.Close();
+
+    ISharedMemoryStream ifile("test_shared.bin");
+    ASSERT_TRUE( ifile.IsValid() );
+    std::string str_copy;
+    ifile >> str_copy;
+    EXPECT_EQ( str_copy , str );
+
+    // the first value is accessed in place, the rest are copied out one by one
+    const auto view = ifile.View( (int)( sizeof(float) + sizeof(int) ) );
+    ASSERT_TRUE( view != nullptr );
+    float t = 0.0f;
+    memcpy( &t , view , sizeof(float) );
+    EXPECT_EQ( t , vec_f[0] );
+    for (int i = 1; i < STREAM_SAMPLE_COUNT; ++i) {
+        float t0 = 0.0f;
+        int t1 = 0;
+        ifile >> t0 >> t1;
+        EXPECT_EQ(t0, vec_f[i]);
+        EXPECT_EQ(t1, vec_i[i]);
+    }
+    EXPECT_TRUE( ifile.IsValid() );
+
+    // reading beyond the end of the stream invalidates it
+    int beyond = 1;
+    ifile >> beyond;
+    EXPECT_EQ( beyond , 0 );
+    EXPECT_FALSE( ifile.IsValid() );
+
+    // anything without the header is not a stream
+    ISharedMemoryStream invalid("test.bin");
+    EXPECT_FALSE( invalid.IsValid() );
+}
+#endif
+
+TEST(STREAM, CompressedFileStream) {
+    std::vector<float>           vec_f;
+    std::vector<unsigned int>    vec_u;
+    {
+        // tiny chunks so that values and strings cross the boundaries of chunks
+        OCompressedFileStream ofile("test_compressed.bin", 37u);
+        ofile << std::string("this is a random string that is longer than a chunk") << true;
+        for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i) {
+            vec_f.push_back( sort_canonical() );
+            vec_u.push_back( (unsigned int)( sort_canonical() * 16.0f ) );
+            ofile << vec_f.back() << vec_u.back();
+        }
+        EXPECT_TRUE( ofile.Close() );
+    }
+
+    ICompressedFileStream ifile("test_compressed.bin");
+    ASSERT_TRUE( ifile.IsValid() );
+    EXPECT_TRUE( ifile.IsCompressed() );
+    std::string str_copy;
+    bool flag_copy = false;
+    ifile >> str_copy >> flag_copy;
+    EXPECT_EQ( str_copy , "this is a random string that is longer than a chunk" );
+    EXPECT_TRUE( flag_copy );
+    for (int i = 0; i < STREAM_SAMPLE_COUNT; ++i) {
+        float t0 = 0.0f;
+        unsigned int t1 = 0;
+        ifile >> t0 >> t1;
+        EXPECT_EQ(t0, vec_f[i]);
+        EXPECT_EQ(t1, vec_u[i]);
+    }
+    EXPECT_TRUE( ifile.IsValid() );
+
+    // reading beyond the end of the file invalidates the stream
+    int beyond = 1;
+    ifile >> beyond;
+    EXPECT_EQ( beyond , 0 );
+    EXPECT_FALSE( ifile.IsValid() );
+
+    // files that are not compressed are streamed as they are
+    {
+        OFileStream ofile("test_uncompressed.bin");
+        ofile << std::string("uncompressed") << 1.0f;
+    }
+    ICompressedFileStream raw("test_uncompressed.bin");
+    EXPECT_FALSE( raw.IsCompressed() );
+    float f = 0.0f;
+    raw >> str_copy >> f;
+    EXPECT_EQ( str_copy , "uncompressed" );
+    EXPECT_EQ( f , 1.0f );
+    EXPECT_TRUE( raw.IsValid() );
+}
+
 TEST(STREAM, MemoryStream) {
     std::vector<float>           vec_f;
     std::vector<int>             vec_i;
@@ -101,4 +271,48 @@ TEST(STREAM, MemoryStream) {
         EXPECT_EQ(t1, vec_i[i]);
         EXPECT_EQ(t2, vec_u[i]);
     }
-}
\ No newline at end of file
+}
+
+TEST(STREAM, SocketStream) {
+    Socket listener;
+    ASSERT_TRUE( listener.Listen( 27182 ) );
+
+    // more data than the buffer of the streams on purpose
+    std::vector<float>  vec_f;
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT * 4; ++i)
+        vec_f.push_back( sort_canonical() );
+
+    std::thread sender( [&](){
+        Socket socket;
+        if( !socket.Connect( "127.0.0.1" , 27182 ) )
+            return;
+        OSocketStream ostream( socket );
+        ostream << std::string( "this is a random string" ) << true << Spectrum( 1.0f , 2.0f , 3.0f );
+        for( const auto f : vec_f )
+            ostream << f;
+    } );
+
+    auto socket = listener.Accept( 10000 );
+    ASSERT_TRUE( socket != nullptr );
+    ISocketStream istream( *socket );
+    std::string str_copy;
+    bool flag_copy = false;
+    Spectrum spectrum_copy;
+    istream >> str_copy >> flag_copy >> spectrum_copy;
+    EXPECT_EQ( str_copy , "this is a random string" );
+    EXPECT_TRUE( flag_copy );
+    EXPECT_EQ( spectrum_copy.b , 3.0f );
+    for( const auto f : vec_f ){
+        float t = 0.0f;
+        istream >> t;
+        EXPECT_EQ( t , f );
+    }
+    EXPECT_TRUE( istream.IsValid() );
+    sender.join();
+
+    // the connection is closed once the sender is gone
+    float t = 1.0f;
+    istream >> t;
+    EXPECT_FALSE( istream.IsValid() );
+    EXPECT_EQ( t , 0.0f );
+}
@@ -0,0 +1,307 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include "thirdparty/gtest/gtest.h"
+#include "task/task.h"
+#include "core/perfreport.h"
+#include "core/metrics.h"
+#include "core/telemetry.h"
+
+namespace {
+    //! @brief  Execute all tasks in a few threads.
+    void executeTasksInThreads( unsigned int thread_cnt ){
+        std::vector<std::thread> threads;
+        for( auto i = 1u ; i < thread_cnt ; ++i )
+            threads.push_back( std::thread( [](){ EXECUTING_TASKS(); } ) );
+        EXECUTING_TASKS();
+        for( auto& thread : threads )
+            thread.join();
+    }
+}
+
+// Tasks without dependencies are executed in the order of priority in a single thread.
+TEST(TASK, Priority) {
+    std::vector<int> order;
+    for( auto i = 0 ; i < 16 ; ++i )
+        SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY + i , {} , [&order,i](){ order.push_back(i); } );
+
+    EXECUTING_TASKS();
+
+    EXPECT_EQ( order.size() , 16u );
+    for( auto i = 0u ; i < order.size() ; ++i )
+        EXPECT_EQ( order[i] , 15 - (int)i );
+}
+
+// A task should never be executed before its dependencies are finished.
+TEST(TASK, Dependency) {
+    static constexpr int TASK_CNT = 1024;
+
+    std::atomic<int> stage0_cnt(0), stage1_cnt(0), failure(0);
+    Task::Task_Container stage0;
+    for( auto i = 0 ; i < TASK_CNT ; ++i )
+        stage0.push_back( SCHEDULE_TASK<Function_Task>( "stage 0" , DEFAULT_TASK_PRIORITY , {} , [&](){ ++stage0_cnt; } ) );
+
+    for( auto i = 0 ; i < TASK_CNT ; ++i ){
+        SCHEDULE_TASK<Function_Task>( "stage 1" , DEFAULT_TASK_PRIORITY , stage0 , [&](){
+            if( stage0_cnt.load() != TASK_CNT )
+                ++failure;
+            ++stage1_cnt;
+        } );
+    }
+
+    executeTasksInThreads( 4 );
+
+    EXPECT_EQ( stage0_cnt.load() , TASK_CNT );
+    EXPECT_EQ( stage1_cnt.load() , TASK_CNT );
+    EXPECT_EQ( failure.load() , 0 );
+}
+
+// A task won't be finished until its children are done, nested children should also work.
+TEST(TASK, SpawnChildren) {
+    static constexpr int CHILD_CNT = 64;
+
+    std::atomic<int> leaf_cnt(0), failure(0);
+    auto parent = SCHEDULE_TASK<Function_Task>( "parent" , DEFAULT_TASK_PRIORITY , {} , [&](){
+        for( auto i = 0 ; i < CHILD_CNT ; ++i ){
+            SPAWN_TASK<Function_Task>( "child" , DEFAULT_TASK_PRIORITY , {} , [&](){
+                for( auto j = 0 ; j < CHILD_CNT ; ++j )
+                    SPAWN_TASK<Function_Task>( "grand child" , DEFAULT_TASK_PRIORITY , {} , [&](){ ++leaf_cnt; } );
+            } );
+        }
+
+        // all children and grand children should be finished by the time this returns.
+        WAIT_FOR_CHILDREN();
+        if( leaf_cnt.load() != CHILD_CNT * CHILD_CNT )
+            ++failure;
+    } );
+
+    SCHEDULE_TASK<Function_Task>( "dependent" , DEFAULT_TASK_PRIORITY , { parent } , [&](){
+        if( leaf_cnt.load() != CHILD_CNT * CHILD_CNT )
+            ++failure;
+    } );
+
+    executeTasksInThreads( 4 );
+
+    EXPECT_EQ( leaf_cnt.load() , CHILD_CNT * CHILD_CNT );
+    EXPECT_EQ( failure.load() , 0 );
+}
+
+// Scheduling a task depending on a running task should work, the dependent has to wait.
+TEST(TASK, DependOnRunningTask) {
+    std::atomic<int> stage(0), failure(0);
+    SCHEDULE_TASK<Function_Task>( "first" , DEFAULT_TASK_PRIORITY , {} , [&](){
+        const auto self = GetCurrentTask();
+        SCHEDULE_TASK<Function_Task>( "second" , DEFAULT_TASK_PRIORITY , { self } , [&](){
+            if( stage.load() != 1 )
+                ++failure;
+            stage = 2;
+        } );
+
+        // give other threads a chance to pick up the dependent if it is incorrectly available.
+        std::this_thread::sleep_for( std::chrono::milliseconds(10) );
+        stage = 1;
+    } );
+
+    executeTasksInThreads( 4 );
+
+    EXPECT_EQ( stage.load() , 2 );
+    EXPECT_EQ( failure.load() , 0 );
+}
+
+// A long task splitting its remaining work while the scheduler is starving should still process everything exactly once.
+TEST(TASK, SplitWhenStarving) {
+    static constexpr int ROW_CNT = 256;
+
+    std::atomic<int> rows[ROW_CNT];
+    for( auto& row : rows )
+        row = 0;
+    std::atomic<int> split_cnt(0);
+
+    std::function<void(int,int)> process = [&]( int begin , int end ){
+        for( auto i = begin ; i < end ; ++i ){
+            const auto rest = end - i;
+            if( rest > 1 && Scheduler::GetSingleton().IsStarving() ){
+                const auto split = i + ( rest + 1 ) / 2;
+                SPAWN_TASK<Function_Task>( "split" , DEFAULT_TASK_PRIORITY , {} , [&process,split,end](){ process( split , end ); } );
+                end = split;
+                ++split_cnt;
+            }
+            ++rows[i];
+            std::this_thread::sleep_for( std::chrono::microseconds(50) );
+        }
+    };
+    SCHEDULE_TASK<Function_Task>( "rows" , DEFAULT_TASK_PRIORITY , {} , [&](){ process( 0 , ROW_CNT ); } );
+
+    executeTasksInThreads( 4 );
+
+    EXPECT_GT( split_cnt.load() , 0 );
+    for( auto& row : rows )
+        EXPECT_EQ( row.load() , 1 );
+}
+
+// Cancelled tasks are skipped, but tasks depending on them should still be executed.
+TEST(TASK, Cancellation) {
+    static constexpr int TASK_CNT = 64;
+
+    auto token = std::make_shared<CancellationToken>();
+    std::atomic<int> executed(0), dependent(0);
+    Task::Task_Container cancelled;
+    for( auto i = 0 ; i < TASK_CNT ; ++i ){
+        auto task = std::make_unique<Function_Task>( [&](){
+            ++executed;
+            token->Cancel();
+        } , "cancelled" , DEFAULT_TASK_PRIORITY , Task::Task_Container() );
+        task->SetCancellationToken( token );
+        cancelled.push_back( Scheduler::GetSingleton().Schedule( std::move( task ) ) );
+    }
+    SCHEDULE_TASK<Function_Task>( "dependent" , DEFAULT_TASK_PRIORITY , cancelled , [&](){ ++dependent; } );
+
+    EXECUTING_TASKS();
+
+    EXPECT_EQ( executed.load() , 1 );
+    EXPECT_EQ( dependent.load() , 1 );
+}
+
+// Available tasks should be executed in the order of their updated priorities.
+TEST(TASK, Reprioritize) {
+    std::vector<int> order;
+    for( auto i = 0 ; i < 16 ; ++i )
+        SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY + i , {} , [&order,i](){ order.push_back(i); } );
+
+    // reverse the order of execution
+    Scheduler::GetSingleton().Reprioritize( []( const Task& task ){ return 2 * DEFAULT_TASK_PRIORITY - task.GetPriority(); } );
+
+    EXECUTING_TASKS();
+
+    EXPECT_EQ( order.size() , 16u );
+    for( auto i = 0u ; i < order.size() ; ++i )
+        EXPECT_EQ( order[i] , (int)i );
+}
+
+// Waiting on tasks that are not children keeps executing them in the waiting thread, even with only one thread.
+TEST(TASK, WaitUntil) {
+    static constexpr int TASK_CNT = 64;
+
+    std::atomic<int> done_cnt(0);
+    auto waited = false;
+    SCHEDULE_TASK<Function_Task>( "waiting" , DEFAULT_TASK_PRIORITY + 1 , {} , [&](){
+        for( auto i = 0 ; i < TASK_CNT ; ++i )
+            SCHEDULE_TASK<Function_Task>( "independent" , DEFAULT_TASK_PRIORITY , {} , [&](){ ++done_cnt; } );
+
+        WAIT_UNTIL( [&](){ return done_cnt.load() == TASK_CNT; } );
+        waited = true;
+    } );
+
+    EXECUTING_TASKS();
+
+    EXPECT_TRUE( waited );
+    EXPECT_EQ( done_cnt.load() , TASK_CNT );
+}
+
+// A phase spans from the first task running it to the last one, rays are counted by all tasks.
+TEST(TASK, PerfPhase) {
+    auto& report = PerfReport::GetSingleton();
+    report.Reset( 1 );
+    report.AddTiles( 2 );
+    EXPECT_EQ( report.GetPhaseTime( PerfPhase::Rendering ) , 0.0 );
+    EXPECT_EQ( report.GetTimeToFirstPixel() , 0.0 );
+
+    auto work = [&report](){
+        PERF_PHASE( PerfPhase::Rendering );
+        report.AddRays( 10 , true );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+        report.FinishTile();
+    };
+    auto first = SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY , {} , work );
+    SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY , { first } , work );
+    EXECUTING_TASKS();
+
+    EXPECT_GE( report.GetPhaseTime( PerfPhase::Rendering ) , 0.04 );
+    EXPECT_GE( report.GetTimeToFirstPixel() , 0.02 );
+    EXPECT_LT( report.GetTimeToFirstPixel() , report.GetPhaseTime( PerfPhase::Rendering ) );
+    EXPECT_EQ( report.GetRayCount() , 20u );
+    EXPECT_EQ( report.GetThreadRayCount( true ) , 20u );
+    EXPECT_EQ( report.GetTileCount() , 2u );
+    EXPECT_EQ( report.GetFinishedTileCount() , 2u );
+    EXPECT_EQ( report.GetPhaseTime( PerfPhase::Loading ) , 0.0 );
+}
+
+// Telemetry reports the progress of scheduled tiles and how busy threads are rendering them.
+TEST(TASK, Telemetry) {
+    auto& report = PerfReport::GetSingleton();
+    report.Reset( 1 );
+    report.AddTiles( 4 );
+
+    auto work = [&report](){
+        PERF_PHASE( PerfPhase::Rendering );
+        report.AddRays( 1000 , true );
+        std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+        report.FinishTile();
+    };
+    auto first = SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY , {} , work );
+    SCHEDULE_TASK<Function_Task>( "task" , DEFAULT_TASK_PRIORITY , { first } , work );
+    EXECUTING_TASKS();
+
+    EXPECT_GE( report.GetThreadBusyTime( 0 ) , 0.04 );
+    EXPECT_GE( report.GetEstimatedTimeLeft() , 0.04 );
+
+    // the background thread doesn't report anything before it is destroyed.
+    TelemetryReporter telemetry( 1000.0f );
+    const auto line = telemetry.Report( report.GetThreadBusyTime( 0 ) );
+    EXPECT_EQ( line.find( "Progress 50.0% (2/4 tiles), ETA " ) , 0u );
+    EXPECT_NE( line.find( " busy 100%" ) , std::string::npos );
+}
+
+// Metrics of the current report are served in the Prometheus text format, anything other than '/metrics' is not found.
+TEST(TASK, Metrics) {
+    auto& report = PerfReport::GetSingleton();
+    report.Reset( 1 );
+    report.AddTiles( 4 );
+    report.FinishTile();
+
+    MetricsServer metrics;
+    ASSERT_TRUE( metrics.Start( 27183 ) );
+    metrics.FinishJob( false );
+
+    auto scrape = []( const std::string& path ){
+        Socket socket;
+        if( !socket.Connect( "127.0.0.1" , 27183 ) )
+            return std::string();
+        const auto request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        socket.Send( request.data() , (int)request.size() );
+
+        // the server closes the connection once the response is sent.
+        std::string response;
+        char buffer[1024];
+        for( auto size = socket.Receive( buffer , sizeof( buffer ) ) ; size > 0 ; size = socket.Receive( buffer , sizeof( buffer ) ) )
+            response.append( buffer , size );
+        return response;
+    };
+
+    const auto response = scrape( "/metrics" );
+    EXPECT_EQ( response.compare( 0 , 15 , "HTTP/1.1 200 OK" ) , 0 );
+    EXPECT_NE( response.find( "# TYPE sort_rays_total counter\n" ) , std::string::npos );
+    EXPECT_NE( response.find( "\nsort_tiles 4\n" ) , std::string::npos );
+    EXPECT_NE( response.find( "\nsort_render_progress 0.25\n" ) , std::string::npos );
+    EXPECT_NE( response.find( "\nsort_render_jobs_total 1\n" ) , std::string::npos );
+    EXPECT_EQ( scrape( "/" ).compare( 0 , 22 , "HTTP/1.1 404 Not Found" ) , 0 );
+    metrics.Stop();
+}
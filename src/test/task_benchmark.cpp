@@ -0,0 +1,168 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "thirdparty/gtest/gtest.h"
+#include "benchmark.h"
+#include "task/task.h"
+#include "core/thread.h"
+
+// Each scheduler workload is executed with 1, 2, 4, ... threads up to the number of hardware threads. Tasks do almost nothing,
+// so the time per task is the overhead of scheduling, picking and finishing a task.
+
+namespace {
+    //! @brief  Number of tasks in the workload of tiny independent tasks.
+    constexpr unsigned BENCHMARK_TINY_TASK_CNT = 1u << 20;
+
+    //! @brief  Length of the dependency chain, no two tasks of it could be executed concurrently.
+    constexpr unsigned BENCHMARK_CHAIN_LENGTH = 1u << 16;
+
+    //! @brief  Number of stages and tasks in each stage of the fan-out/fan-in workload.
+    constexpr unsigned BENCHMARK_STAGE_CNT = 64;
+    constexpr unsigned BENCHMARK_STAGE_WIDTH = 4096;
+
+    //! @brief  Depth of the tree of spawned tasks, similar to building a BVH in parallel.
+    constexpr unsigned BENCHMARK_SPAWN_DEPTH = 18;
+
+    //! @brief  Number of tiles depending on the loading tasks, similar to the tasks of rendering an image.
+    constexpr unsigned BENCHMARK_TILE_CNT = 1u << 16;
+
+    //! @brief  Execute all scheduled tasks in a number of worker threads and return the time it takes in seconds.
+    //!
+    //! Like rendering, the current thread is one of the workers and each worker has its own queue.
+    double executeTasksInThreads( unsigned thread_cnt ){
+        return BenchmarkSeconds( [&](){
+            std::vector<std::unique_ptr<WorkerThread>> threads;
+            for( auto i = 1u ; i < thread_cnt ; ++i )
+                threads.push_back( std::make_unique<WorkerThread>( i ) );
+            for( auto& thread : threads )
+                thread->BeginThread();
+            EXECUTING_TASKS();
+            for( auto& thread : threads )
+                thread->Join();
+        } );
+    }
+
+    //! @brief  Schedule a workload with all thread counts and report the throughput of each.
+    //!
+    //! @param  name        Name of the workload.
+    //! @param  schedule    Schedule the tasks of the workload, it returns the number of tasks to be executed.
+    //! @param  executed    Number of tasks executed so far, it is checked after each run.
+    template<class T>
+    void benchmarkScheduler( const char* name , const T& schedule , std::atomic<unsigned>& executed ){
+        const auto max_thread_cnt = std::max( 1u , std::thread::hardware_concurrency() );
+        std::vector<unsigned> thread_cnts;
+        for( auto thread_cnt = 1u ; thread_cnt < max_thread_cnt ; thread_cnt *= 2 )
+            thread_cnts.push_back( thread_cnt );
+        thread_cnts.push_back( max_thread_cnt );
+
+        for( const auto thread_cnt : thread_cnts ){
+            Scheduler::GetSingleton().Initialize( thread_cnt );
+            executed = 0;
+
+            // scheduling is done by the current thread before any task is executed, it is part of the overhead
+            auto task_cnt = 0u;
+            const auto scheduling = BenchmarkSeconds( [&](){ task_cnt = schedule(); } );
+            const auto executing = executeTasksInThreads( thread_cnt );
+            const auto seconds = scheduling + executing;
+
+            BenchmarkReport() << name << " (" << thread_cnt << " threads): " << (double)task_cnt / seconds << " tasks/s, "
+                      << seconds * 1e9 / task_cnt << "(ns) per task, scheduling " << scheduling * 1e9 / task_cnt << "(ns) per task" << std::endl;
+            EXPECT_EQ( executed.load() , task_cnt );
+        }
+
+        // other tests run with the default number of queues
+        Scheduler::GetSingleton().Initialize( max_thread_cnt );
+    }
+}
+
+// Lots of independent tasks, each picked and finished on its own.
+TEST(TASK_BENCHMARK, DISABLED_TinyTasks) {
+    std::atomic<unsigned> executed(0);
+    benchmarkScheduler( "Tiny tasks" , [&](){
+        for( auto i = 0u ; i < BENCHMARK_TINY_TASK_CNT ; ++i )
+            SCHEDULE_TASK<Function_Task>( "tiny" , DEFAULT_TASK_PRIORITY , {} , [&](){ ++executed; } );
+        return BENCHMARK_TINY_TASK_CNT;
+    } , executed );
+}
+
+// A long chain of dependencies, the latency of making a dependent available is all that matters.
+TEST(TASK_BENCHMARK, DISABLED_DependencyChain) {
+    std::atomic<unsigned> executed(0);
+    benchmarkScheduler( "Dependency chain" , [&](){
+        Task* previous = nullptr;
+        for( auto i = 0u ; i < BENCHMARK_CHAIN_LENGTH ; ++i ){
+            const auto dependencies = previous ? Task::Task_Container{ previous } : Task::Task_Container{};
+            previous = SCHEDULE_TASK<Function_Task>( "chain" , DEFAULT_TASK_PRIORITY , dependencies , [&](){ ++executed; } );
+        }
+        return BENCHMARK_CHAIN_LENGTH;
+    } , executed );
+}
+
+// Wide stages joined by a single task, every task of a stage depends on the join task of the previous stage.
+TEST(TASK_BENCHMARK, DISABLED_FanOutFanIn) {
+    std::atomic<unsigned> executed(0);
+    benchmarkScheduler( "Fan-out/fan-in" , [&](){
+        Task* join = nullptr;
+        for( auto s = 0u ; s < BENCHMARK_STAGE_CNT ; ++s ){
+            const auto dependencies = join ? Task::Task_Container{ join } : Task::Task_Container{};
+            Task::Task_Container stage;
+            for( auto i = 0u ; i < BENCHMARK_STAGE_WIDTH ; ++i )
+                stage.push_back( SCHEDULE_TASK<Function_Task>( "fan-out" , DEFAULT_TASK_PRIORITY , dependencies , [&](){ ++executed; } ) );
+            join = SCHEDULE_TASK<Function_Task>( "fan-in" , DEFAULT_TASK_PRIORITY , stage , [&](){ ++executed; } );
+        }
+        return BENCHMARK_STAGE_CNT * ( BENCHMARK_STAGE_WIDTH + 1 );
+    } , executed );
+}
+
+// A binary tree of spawned children waiting for each other, like parallel construction of spatial accelerators.
+TEST(TASK_BENCHMARK, DISABLED_SpawnTree) {
+    std::atomic<unsigned> executed(0);
+    std::function<void(unsigned)> split = [&]( unsigned depth ){
+        ++executed;
+        if( depth == 0 )
+            return;
+        SPAWN_TASK<Function_Task>( "left" , DEFAULT_TASK_PRIORITY , {} , [&split,depth](){ split( depth - 1 ); } );
+        SPAWN_TASK<Function_Task>( "right" , DEFAULT_TASK_PRIORITY , {} , [&split,depth](){ split( depth - 1 ); } );
+        WAIT_FOR_CHILDREN();
+    };
+    benchmarkScheduler( "Spawn tree" , [&](){
+        SCHEDULE_TASK<Function_Task>( "root" , DEFAULT_TASK_PRIORITY , {} , [&split](){ split( BENCHMARK_SPAWN_DEPTH ); } );
+        return ( 1u << ( BENCHMARK_SPAWN_DEPTH + 1 ) ) - 1;
+    } , executed );
+}
+
+// Tiles of an image depending on the tasks preparing the scene, the same shape of graph rendering an image has.
+TEST(TASK_BENCHMARK, DISABLED_RenderTiles) {
+    std::atomic<unsigned> executed(0);
+    benchmarkScheduler( "Render tiles" , [&](){
+        auto loading = SCHEDULE_TASK<Function_Task>( "loading" , DEFAULT_TASK_PRIORITY , {} , [&](){ ++executed; } );
+        Task::Task_Container construction;
+        for( auto i = 0u ; i < 3 ; ++i )
+            construction.push_back( SCHEDULE_TASK<Function_Task>( "construction" , DEFAULT_TASK_PRIORITY , { loading } , [&](){ ++executed; } ) );
+        auto pre_render = SCHEDULE_TASK<Function_Task>( "pre-render" , DEFAULT_TASK_PRIORITY , construction , [&](){ ++executed; } );
+        for( auto i = 0u ; i < BENCHMARK_TILE_CNT ; ++i )
+            SCHEDULE_TASK<Function_Task>( "tile" , DEFAULT_TASK_PRIORITY + ( BENCHMARK_TILE_CNT - i ) , { pre_render } , [&](){ ++executed; } );
+        return BENCHMARK_TILE_CNT + 5;
+    } , executed );
+}
@@ -0,0 +1,400 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include "thirdparty/gtest/gtest.h"
+#include "texture/texturecache.h"
+#include "texture/imagetexture2d.h"
+#include "texture/texel.h"
+#include "texture/imagetexture3d.h"
+#include "medium/mediumdata.h"
+#include "medium/medium.h"
+#include "stream/mstream.h"
+#include "math/point.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
+#include "core/rand.h"
+#include "math/sky.h"
+#include "scatteringevent/bsdf/bxdf_utils.h"
+
+// Texels of a tiled texture are the same as the image it is converted from, including the partial tiles on the edges.
+TEST(TEXTURE, TiledTexture) {
+    const auto width = TEXTURE_TILE_SIZE * 2 + 17;
+    const auto height = TEXTURE_TILE_SIZE + 5;
+    std::vector<Spectrum> rgb( width * height );
+    std::vector<float> alpha( width * height );
+    for( auto i = 0 ; i < width * height ; ++i ){
+        rgb[i] = Spectrum( sort_canonical() , sort_canonical() , sort_canonical() );
+        alpha[i] = sort_canonical();
+    }
+
+    ASSERT_TRUE( TiledTexture::Save( "test_texture.tiles" , width , height , rgb.data() , alpha.data() , Spectrum( 0.5f ) ) );
+
+    TiledTexture texture;
+    ASSERT_TRUE( texture.Open( "test_texture.tiles" ) );
+    EXPECT_EQ( texture.GetWidth() , width );
+    EXPECT_EQ( texture.GetHeight() , height );
+    EXPECT_TRUE( texture.HasAlpha() );
+    EXPECT_EQ( texture.GetAverage().g , 0.5f );
+
+    // texels are accessed out of order so that tiles go in and out of the per-thread handles
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto x = (int)( sort_canonical() * width ) % width;
+        const auto y = (int)( sort_canonical() * height ) % height;
+        const auto color = texture.GetColor( x , y );
+        EXPECT_EQ( color.r , rgb[y * width + x].r );
+        EXPECT_EQ( color.g , rgb[y * width + x].g );
+        EXPECT_EQ( color.b , rgb[y * width + x].b );
+        EXPECT_EQ( texture.GetAlpha( x , y ) , alpha[y * width + x] );
+    }
+
+    // files that are not tiled textures are rejected
+    TiledTexture invalid;
+    EXPECT_FALSE( invalid.Open( "test_texture_missing.tiles" ) );
+
+    std::remove( "test_texture.tiles" );
+}
+
+// Missed tiles are loaded in the background within a deferral scope, the average color stands in for them meanwhile.
+TEST(TEXTURE, DeferredTileMiss) {
+    const auto width = TEXTURE_TILE_SIZE * 2;
+    const auto height = TEXTURE_TILE_SIZE;
+    std::vector<Spectrum> rgb( width * height , Spectrum( 0.25f ) );
+    rgb[width + TEXTURE_TILE_SIZE + 1] = Spectrum( 1.0f );
+    ASSERT_TRUE( TiledTexture::Save( "test_texture_deferred.tiles" , width , height , rgb.data() , nullptr , Spectrum( 0.5f ) ) );
+
+    {
+        TiledTexture texture;
+        ASSERT_TRUE( texture.Open( "test_texture_deferred.tiles" ) );
+
+        {
+            TextureMissDeferral deferral;
+            EXPECT_EQ( texture.GetColor( TEXTURE_TILE_SIZE + 1 , 1 ).r , 0.5f );
+            EXPECT_EQ( texture.GetAlpha( TEXTURE_TILE_SIZE + 1 , 1 ) , 1.0f );
+            EXPECT_TRUE( deferral.HasMissed() );
+        }
+
+        // the tile shows up once it is loaded by the I/O threads
+        auto loaded = false;
+        for( auto k = 0 ; k < 1000 && !loaded ; ++k ){
+            TextureMissDeferral deferral;
+            const auto color = texture.GetColor( TEXTURE_TILE_SIZE + 1 , 1 );
+            loaded = !deferral.HasMissed();
+            if( loaded )
+                EXPECT_EQ( color.r , 1.0f );
+            else
+                std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        }
+        EXPECT_TRUE( loaded );
+
+        // misses out of any deferral scope are loaded right away
+        EXPECT_EQ( texture.GetColor( 3 , 5 ).g , 0.25f );
+    }
+
+    std::remove( "test_texture_deferred.tiles" );
+}
+
+// Lookups with a footprint as wide as the texture end up on the last mip level, which is the average of the image.
+TEST(TEXTURE, MipMap) {
+    const auto width = 64 , height = 16;
+    std::vector<float> rgb( width * height * 3 );
+    for( auto& c : rgb )
+        c = sort_canonical();
+    ASSERT_EQ( SaveEXR( rgb.data() , width , height , 3 , 0 , "test_mipmap.exr" ) , TINYEXR_SUCCESS );
+
+    ImageTexture2D texture;
+    ASSERT_TRUE( texture.LoadResource( "test_mipmap.exr" ) );
+
+    // a footprint narrower than a texel is the same as sampling the image itself
+    for( auto k = 0 ; k < 64 ; ++k ){
+        const auto u = sort_canonical() , v = sort_canonical();
+        const auto color = texture.GetColorFromUV( u , v , 0.0f );
+        EXPECT_EQ( color.g , texture.GetColorFromUV( u , v ).g );
+    }
+
+    // the last level is a single texel, which is the average of the image up to the precision of texels
+    const auto average = texture.GetAverage();
+    const auto color = texture.GetColorFromUV( sort_canonical() , sort_canonical() , 1000.0f );
+    EXPECT_NEAR( color.r , average.r , 0.002f );
+    EXPECT_NEAR( color.g , average.g , 0.002f );
+    EXPECT_NEAR( color.b , average.b , 0.002f );
+
+    std::remove( "test_mipmap.exr" );
+}
+
+// Wide sky lookups are filtered over the lobe, but they stop at a level still keeping the rough shape of the sky.
+TEST(TEXTURE, SkyPrefilter) {
+    // stripes of 0 and 2 in one half of the sky, 3 in the other half
+    const auto width = 64 , height = 32;
+    std::vector<float> rgb( width * height * 3 );
+    for( auto y = 0 ; y < height ; ++y )
+        for( auto x = 0 ; x < width ; ++x )
+            for( auto c = 0 ; c < 3 ; ++c )
+                rgb[ ( y * width + x ) * 3 + c ] = x < width / 2 ? (float)( x % 2 ) * 2.0f : 3.0f;
+    ASSERT_EQ( SaveEXR( rgb.data() , width , height , 3 , 0 , "test_sky.exr" ) , TINYEXR_SUCCESS );
+
+    Sky sky;
+    sky.Load( "test_sky.exr" );
+
+    // directions on the horizon through the centers of two neighboring texels in the middle of each half
+    const auto striped0 = sphericalVec( 0.5f * PI , 16.5f / (float)width * TWO_PI );
+    const auto striped1 = sphericalVec( 0.5f * PI , 17.5f / (float)width * TWO_PI );
+    const auto constant = sphericalVec( 0.5f * PI , 48.5f / (float)width * TWO_PI );
+
+    // exact lookups see the stripes
+    EXPECT_NEAR( sky.Evaluate( striped0 ).g , 0.0f , 0.05f );
+    EXPECT_NEAR( sky.Evaluate( striped1 ).g , 2.0f , 0.05f );
+
+    // a wide lobe averages the stripes without blending the two halves, whose average is 2
+    EXPECT_NEAR( sky.Evaluate( striped0 , 10.0f ).g , 1.0f , 0.01f );
+    EXPECT_NEAR( sky.Evaluate( striped1 , 10.0f ).g , 1.0f , 0.01f );
+    EXPECT_NEAR( sky.Evaluate( constant , 10.0f ).g , 3.0f , 0.01f );
+
+    std::remove( "test_sky.exr" );
+    std::remove( "test_sky.exr.distribution" );
+}
+
+// Texels shared by another texture of the same content are used without the image, down to the last mip level.
+TEST(TEXTURE, SharedAcrossProcesses) {
+    const auto width = 48 , height = 20;
+    std::vector<float> rgb( width * height * 3 );
+    for( auto& c : rgb )
+        c = sort_canonical();
+    ASSERT_EQ( SaveEXR( rgb.data() , width , height , 3 , 0 , "test_shared.exr" ) , TINYEXR_SUCCESS );
+
+    const auto hash = (unsigned long long)( sort_canonical() * 1e9 ) + 1;
+    SharedResourceData::Remove( SharedResourceData::Name( "texture" , hash ) );
+
+    ImageTexture2D texture;
+    texture.ShareAcrossProcesses( hash );
+    ASSERT_TRUE( texture.LoadResource( "test_shared.exr" ) );
+
+    // the image is gone, it can only be the shared texels
+    std::remove( "test_shared.exr" );
+    ImageTexture2D shared;
+    shared.ShareAcrossProcesses( hash );
+    ASSERT_TRUE( shared.LoadResource( "test_shared.exr" ) );
+    EXPECT_EQ( shared.GetAverage().g , texture.GetAverage().g );
+
+    for( auto k = 0 ; k < 256 ; ++k ){
+        const auto u = sort_canonical() , v = sort_canonical() , w = sort_canonical() * 0.5f;
+        const auto c0 = texture.GetColorFromUV( u , v , w );
+        const auto c1 = shared.GetColorFromUV( u , v , w );
+        EXPECT_EQ( c0.r , c1.r );
+        EXPECT_EQ( c0.g , c1.g );
+        EXPECT_EQ( c0.b , c1.b );
+    }
+
+    SharedResourceData::Remove( SharedResourceData::Name( "texture" , hash ) );
+}
+
+// Shared resources mapped by a process are never trimmed, they are gone once nobody maps them without a budget.
+TEST(TEXTURE, SharedResourceTrim) {
+    const auto name = SharedResourceData::Name( "trim" , (unsigned long long)( sort_canonical() * 1e9 ) + 1 );
+    SharedResourceData::Remove( name );
+    {
+        SharedResourceData published;
+        ASSERT_TRUE( published.Publish( name , 4096 , []( char* data ){ memset( data , 1 , 4096 ); return true; } ) );
+
+        SharedResourceData::Trim( 0 );
+        SharedResourceData attached;
+        ASSERT_TRUE( attached.Attach( name ) );
+        EXPECT_EQ( attached.GetData()[4095] , 1 );
+    }
+
+    SharedResourceData::Trim( 0 );
+    SharedResourceData attached;
+    EXPECT_FALSE( attached.Attach( name ) );
+}
+
+// Half precision floats keep 11 significant bits, values beyond their range are clamped instead of becoming infinity.
+TEST(TEXTURE, HalfFloat) {
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto v = ( sort_canonical() - 0.5f ) * 1000.0f;
+        EXPECT_NEAR( halfToFloat( floatToHalf( v ) ) , v , fabs( v ) * 0.0005f + 1e-7f );
+    }
+
+    EXPECT_EQ( halfToFloat( floatToHalf( 0.0f ) ) , 0.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( 1.0f ) ) , 1.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( 65504.0f ) ) , 65504.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( 1e10f ) ) , 65504.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( -1e10f ) ) , -65504.0f );
+
+    // denormalized halfs
+    EXPECT_NEAR( halfToFloat( floatToHalf( 1e-6f ) ) , 1e-6f , 1e-7f );
+
+    // every half precision float survives the round trip
+    for( unsigned h = 0 ; h < 0x7c00 ; ++h )
+        EXPECT_EQ( floatToHalf( halfToFloat( (unsigned short)h ) ) , h );
+}
+
+// 8 bits texels hold the exact values decoded by image loaders, which is the byte divided by 255.
+TEST(TEXTURE, TexelFormat) {
+    unsigned char texel[8];
+    for( unsigned v = 0 ; v < 256 ; ++v ){
+        const Spectrum color( v / 255.0f , ( 255 - v ) / 255.0f , 0.5f );
+        encodeTexel( TexelFormat::RGBA8 , color , v / 255.0f , texel );
+        EXPECT_EQ( texel[0] , v );
+        EXPECT_EQ( texel[1] , 255 - v );
+        EXPECT_EQ( decodeTexelColor( TexelFormat::RGBA8 , texel ).r , v / 255.0f );
+        EXPECT_EQ( decodeTexelAlpha( TexelFormat::RGBA8 , texel ) , v / 255.0f );
+        EXPECT_EQ( decodeTexelAlpha( TexelFormat::RGB8 , texel ) , 1.0f );
+
+        // single channel textures are grey
+        encodeTexel( TexelFormat::R8 , color , 1.0f , texel );
+        EXPECT_EQ( decodeTexelColor( TexelFormat::R8 , texel ).b , v / 255.0f );
+    }
+
+    encodeTexel( TexelFormat::RGB16F , Spectrum( 0.25f , 2.0f , 1000.0f ) , 1.0f , texel );
+    const auto color = decodeTexelColor( TexelFormat::RGB16F , texel );
+    EXPECT_EQ( color.r , 0.25f );
+    EXPECT_EQ( color.g , 2.0f );
+    EXPECT_EQ( color.b , 1000.0f );
+}
+
+// Volumes drop the bricks without detail and still filter exactly like the dense grid.
+TEST(TEXTURE, SparseVolume) {
+    static constexpr unsigned W = 37, H = 21, D = 19;
+
+    class Volume : public ImageTexture3D<float> {
+    public:
+        Volume(const float* texels) {
+            m_width = W; m_height = H; m_depth = D;
+            setTexels(texels);
+        }
+        size_t DenseBrickCount() const {
+            return m_memory->m_texel.size() / BRICK_TEXEL_CNT;
+        }
+    };
+
+    // a small puff of smoke in an otherwise empty volume
+    std::vector<float> texels( W * H * D , 0.0f );
+    for( auto z = 8u ; z < 13u ; ++z )
+        for( auto y = 3u ; y < 7u ; ++y )
+            for( auto x = 5u ; x < 12u ; ++x )
+                texels[ ( z * H + y ) * W + x ] = sort_canonical();
+
+    const Volume volume( texels.data() );
+    EXPECT_LE( volume.DenseBrickCount() , 8u );
+
+    const auto dense = [&]( unsigned x , unsigned y , unsigned z ){
+        return texels[ ( std::min( z , D - 1 ) * H + std::min( y , H - 1 ) ) * W + std::min( x , W - 1 ) ];
+    };
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto u = sort_canonical() , v = sort_canonical() , w = sort_canonical();
+        const auto fx = u * W - 0.5f , fy = v * H - 0.5f , fz = w * D - 0.5f;
+        const auto x = (unsigned)fx , y = (unsigned)fy , z = (unsigned)fz;
+        const auto dx = fx - x , dy = fy - y , dz = fz - z;
+
+        auto expected = 0.0f;
+        for( auto i = 0u ; i < 8u ; ++i )
+            expected += dense( x + ( i & 1 ) , y + ( ( i >> 1 ) & 1 ) , z + ( i >> 2 ) ) *
+                        ( ( i & 1 ) ? dx : 1.0f - dx ) * ( ( i & 2 ) ? dy : 1.0f - dy ) * ( ( i & 4 ) ? dz : 1.0f - dz );
+        EXPECT_NEAR( volume.Sample( u , v , w ) , expected , 1e-5f );
+
+        const auto ix = (int)( u * W ) , iy = (int)( v * H ) , iz = (int)( w * D );
+        EXPECT_EQ( volume.Sample( ix , iy , iz ) , texels[ ( iz * H + iy ) * W + ix ] );
+    }
+    EXPECT_EQ( volume.Sample( -1 , 0 , 0 ) , 0.0f );
+    EXPECT_EQ( volume.Sample( 0.5f , 1.5f , 0.5f ) , 0.0f );
+}
+
+// Each cell of the majorant grid should bound the density interpolated anywhere inside it.
+TEST(TEXTURE, VolumeMajorant) {
+    static constexpr unsigned W = 37, H = 21, D = 19;
+
+    std::vector<float> texels( W * H * D , 0.0f );
+    for( auto z = 8u ; z < 13u ; ++z )
+        for( auto y = 3u ; y < 7u ; ++y )
+            for( auto x = 5u ; x < 12u ; ++x )
+                texels[ ( z * H + y ) * W + x ] = sort_canonical();
+
+    IMemoryStream out;
+    out << W << H << D;
+    for( const auto t : texels )
+        out << t;
+    OMemoryStream in( out );
+    MediumDensity density;
+    density.Serialize( in );
+
+    // extinction is twice the density
+    const auto majorant = density.GetMajorant( &density , [&]( const Point& uvw ){ return 2.0f * density.Sample( uvw ); } );
+    ASSERT_NE( majorant , nullptr );
+    EXPECT_EQ( majorant , density.GetMajorant( &density , []( const Point& ){ return 0.0f; } ) );
+
+    auto empty = 0u;
+    for( const auto v : majorant->m_value )
+        empty += v == 0.0f;
+    EXPECT_GT( empty , 0u );
+
+    // cells with non-zero majorant should all be in occupied bricks
+    static constexpr auto B = MediumMajorant::OCCUPANCY_BRICK_SIZE;
+    auto c = 0u;
+    for( auto z = 0u ; z < majorant->m_depth ; ++z )
+        for( auto y = 0u ; y < majorant->m_height ; ++y )
+            for( auto x = 0u ; x < majorant->m_width ; ++x , ++c ){
+                if( majorant->m_value[c] == 0.0f )
+                    continue;
+                const unsigned b[3] = { x / B , y / B , z / B };
+                EXPECT_TRUE( majorant->m_occupied[ ( b[2] * majorant->m_brickCnt[1] + b[1] ) * majorant->m_brickCnt[0] + b[0] ] );
+                for( auto a = 0 ; a < 3 ; ++a ){
+                    EXPECT_GE( b[a] , majorant->m_occupiedMin[a] );
+                    EXPECT_LT( b[a] , majorant->m_occupiedMax[a] );
+                }
+            }
+
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const Point uvw( sort_canonical() , sort_canonical() , sort_canonical() );
+        const auto cx = std::min( (unsigned)( uvw[0] * majorant->m_scale[0] ) , majorant->m_width - 1 );
+        const auto cy = std::min( (unsigned)( uvw[1] * majorant->m_scale[1] ) , majorant->m_height - 1 );
+        const auto cz = std::min( (unsigned)( uvw[2] * majorant->m_scale[2] ) , majorant->m_depth - 1 );
+        const auto mu = majorant->m_value[ ( cz * majorant->m_height + cy ) * majorant->m_width + cx ];
+        EXPECT_LE( 2.0f * density.Sample( uvw ) , mu * ( 1.0f + 1e-6f ) );
+    }
+}
+
+TEST(TEXTURE, BakedMedium) {
+    static constexpr unsigned N = 20;
+
+    // trilinear filtering reproduces a linear function exactly between texel centers
+    BakedMedium baked;
+    baked.Bake( N , []( const Point& uvw , MediumSample& ms ){
+        ms = MediumSample( Spectrum( uvw[0] , uvw[1] , uvw[2] ) , uvw[0] + uvw[1] , 2.0f * uvw[2] , uvw[1] , 0.5f * uvw[0] );
+    } );
+
+    for( auto k = 0 ; k < 4096 ; ++k ){
+        const auto r = [](){ return ( 0.5f + sort_canonical() * ( N - 1 ) ) / N; };
+        const Point uvw( r() , r() , r() );
+        MediumSample ms;
+        baked.Sample( uvw , ms );
+        EXPECT_NEAR( ms.basecolor[0] , uvw[0] , 1e-4f );
+        EXPECT_NEAR( ms.basecolor[1] , uvw[1] , 1e-4f );
+        EXPECT_NEAR( ms.basecolor[2] , uvw[2] , 1e-4f );
+        EXPECT_NEAR( ms.emission , uvw[0] + uvw[1] , 1e-4f );
+        EXPECT_NEAR( ms.extinction , 2.0f * uvw[2] + uvw[1] , 1e-4f );
+        EXPECT_NEAR( ms.anisotropy , 0.5f * uvw[0] , 1e-4f );
+    }
+
+    // there is no medium outside the volume
+    MediumSample ms;
+    baked.Sample( Point( 1.5f , 0.5f , 0.5f ) , ms );
+    EXPECT_EQ( ms.extinction , 0.0f );
+}
@@ -16,8 +16,19 @@
  */
 
 #include <regex>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <sys/stat.h>
+#include <fstream>
+#include <vector>
 #include "imagetexture2d.h"
 #include "core/sassert.h"
+#include "core/stats.h"
+#include "core/hash.h"
+#include "core/globalconfig.h"
+#include "core/thread.h"
+#include "core/hwcounter.h"
 
 #define TINYEXR_IMPLEMENTATION
 #include "thirdparty/tiny_exr/tinyexr.h"
@@ -25,9 +36,81 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "thirdparty/stb_image/stb_image.h"
 
+SORT_STATS_DEFINE_MEMORY(sTextureMemory)
+
+SORT_STATS_MEMORY("Textures", sTextureMemory);
+
+// Name of the file of tiles converted from an image, it changes whenever the image is modified.
+static std::string tiledTextureFile( const std::string& filename ){
+    struct stat st;
+    if( stat( filename.c_str() , &st ) != 0 )
+        return "";
+
+    auto hash = HASH_INITIAL_VALUE;
+    const long long size = st.st_size , time = st.st_mtime;
+    hashData( hash , filename.c_str() , filename.size() );
+    hashData( hash , &size , sizeof( size ) );
+    hashData( hash , &time , sizeof( time ) );
+
+    char name[64];
+    snprintf( name , sizeof( name ) , "texture_%016llx.tiles" , hash );
+    return g_resourcePath + name;
+}
+
+// Name of the file of tiles of a mip level, the image itself is level zero.
+static std::string mipTiledFile( const std::string& tiled_file , int level ){
+    if( level == 0 )
+        return tiled_file;
+    return tiled_file + "." + std::to_string( level );
+}
+
+// Header of texels shared across processes, the texels of all levels follow it, each level starts at a 64 bytes boundary.
+struct SharedTextureHeader{
+    unsigned int    format;         /**< TexelFormat of all levels. */
+    int             width;          /**< Width of the image. */
+    int             height;         /**< Height of the image. */
+    float           average[3];     /**< Average color of the image. */
+};
+
+// Offsets of all levels of shared texels, from the image itself to the level of one texel, followed by the total size.
+static std::vector<size_t> sharedTextureLayout( TexelFormat format , int w , int h ){
+    auto align = []( size_t size ){ return ( size + 63 ) / 64 * 64; };
+
+    std::vector<size_t> offsets;
+    auto offset = align( sizeof( SharedTextureHeader ) );
+    while( true ){
+        offsets.push_back( offset );
+        offset += align( (size_t)texelSize( format ) * w * h );
+        if( w <= 1 && h <= 1 )
+            break;
+        w = std::max( 1 , ( w + 1 ) / 2 );
+        h = std::max( 1 , ( h + 1 ) / 2 );
+    }
+    offsets.push_back( offset );
+    return offsets;
+}
+
+// Read the whole file, only a few files are read at the same time since it is IO bound. Decoding is not limited.
+static bool readImageFile( const std::string& filename , std::vector<unsigned char>& data ){
+    static semaphore io_slots( TEXTURE_IO_CONCURRENCY );
+    std::lock_guard<semaphore> lock( io_slots );
+
+    std::ifstream file( filename , std::ios::binary | std::ios::ate );
+    if( !file.is_open() )
+        return false;
+    data.resize( (size_t)file.tellg() );
+    file.seekg( 0 );
+    return (bool)file.read( (char*)data.data() , data.size() );
+}
+
 Spectrum ImageTexture2D::GetColor( int x , int y ) const{
+    if( m_tiled ){
+        texCoordFilter( x , y );
+        return m_tiled->GetColor( x , m_iTexHeight - 1 - y );
+    }
+
     // if there is no image, just crash
-    sAssertMsg(IS_PTR_VALID(m_memory) && IS_PTR_VALID(m_memory->m_rgb) , IMAGE , "Texture %s not loaded!" , m_name.c_str() );
+    sAssertMsg(IS_PTR_VALID(m_memory) && !m_memory->Empty() , IMAGE , "Texture %s not loaded!" , m_name.c_str() );
 
     // filter the texture coordinate
     texCoordFilter( x , y );
@@ -36,15 +119,20 @@ Spectrum ImageTexture2D::GetColor( int x , int y ) const{
     int offset = ( m_iTexHeight - 1 - y ) * m_iTexWidth + x;
 
     // get the color
-    return m_memory->m_rgb[ offset ];
+    return m_memory->GetColor( offset );
 }
 
 float ImageTexture2D::GetAlpha( int x , int y ) const{
+    if( m_tiled ){
+        texCoordFilter( x , y );
+        return m_tiled->GetAlpha( x , m_iTexHeight - 1 - y );
+    }
+
     // if there is no image, just crash
     sAssertMsg(IS_PTR_VALID(m_memory), IMAGE , "Texture %s not loaded!" , m_name.c_str() );
 
     // in case of acquiring alpha value in a texture without this channel, 1.0 is returned by default.
-    if(IS_PTR_INVALID(m_memory->m_a))
+    if(!m_memory->HasAlpha())
         return 1.0f;
 
     // filter the texture coordinate
@@ -54,7 +142,7 @@ float ImageTexture2D::GetAlpha( int x , int y ) const{
     int offset = ( m_iTexHeight - 1 - y ) * m_iTexWidth + x;
 
     // get the color
-    return m_memory->m_a[ offset ];
+    return m_memory->GetAlpha( offset );
 }
 
 // load image from file
@@ -63,69 +151,86 @@ bool ImageTexture2D::LoadResource( const std::string str ){
 
     m_memory = std::make_unique<ImgMemory>();
     m_name = str;
+
+    // the image doesn't need to be decoded at all if it is converted to tiles before
+    const auto tiled_file = g_textureCacheBudget > 0 ? tiledTextureFile(m_name) : "";
+    if (!tiled_file.empty() && openTiles(tiled_file))
+        return true;
+
+    // tiles are already shared through the mapped files, texels in memory are shared once decoded by any process
+    const auto shared_name = (tiled_file.empty() && m_sharedHash) ? SharedResourceData::Name("texture", m_sharedHash) : "";
+    if (!shared_name.empty() && attachShared(shared_name))
+        return true;
+
+    std::vector<unsigned char> file;
+    if (!readImageFile(m_name, file) || file.empty())
+        return false;
+
+    // high dynamic range images are kept in half precision floats
     if (std::regex_match(m_name, exr_reg)) {
         float* out = nullptr;
         const char* err;
 
-        const auto ret = LoadEXR(&out, &m_iTexWidth, &m_iTexHeight, m_name.c_str(), &err);
+        const auto ret = LoadEXRFromMemory(&out, &m_iTexWidth, &m_iTexHeight, file.data(), file.size(), &err);
 
         if (ret >= 0) {
             const auto total = m_iTexWidth * m_iTexHeight;
-            m_memory->m_rgb = std::make_unique<Spectrum[]>(total);
+            m_memory->Resize(TexelFormat::RGB16F, total);
             for (auto i = 0; i < total; i++)
-                m_memory->m_rgb[i] = Spectrum(out[4 * i], out[4 * i + 1], out[4 * i + 2]);
+                m_memory->SetTexel(i, Spectrum(out[4 * i], out[4 * i + 1], out[4 * i + 2]), 1.0f);
 
             free(out);
 
+            SORT_STATS(m_memory->m_memoryRecord.Track(&sTextureMemory, (StatsInt)m_memory->m_texels.size()));
+
             average();
+            buildMipmaps();
+            convertToTiles(tiled_file);
+            publishShared(shared_name);
             return true;
         }
 
         return false;
     }
 
-    stbi_ldr_to_hdr_gamma(1.0f);
-    stbi_ldr_to_hdr_scale(1.0f);
-
-    auto comp = 0;
-    const auto* data = stbi_loadf(m_name.c_str(), &m_iTexWidth, &m_iTexHeight, &comp, STBI_rgb_alpha);
-
-    if (data) {
-        if( m_iTexWidth > 0 && m_iTexHeight > 0 ){
-            m_memory->m_rgb = std::make_unique<Spectrum[]>(m_iTexWidth*m_iTexHeight);
-            for (auto i = 0; i < m_iTexHeight; ++i) {
-                for (auto j = 0; j < m_iTexWidth; ++j) {
-                    const auto k = i * m_iTexWidth + j;
-
-                    auto& color = m_memory->m_rgb[i * m_iTexWidth + j];
-
-                    color.r = data[4 * k];
-                    color.g = data[4 * k + 1];
-                    color.b = data[4 * k + 2];
-                }
-            }
+    if (stbi_is_hdr_from_memory(file.data(), (int)file.size())) {
+        auto comp = 0;
+        auto* data = stbi_loadf_from_memory(file.data(), (int)file.size(), &m_iTexWidth, &m_iTexHeight, &comp, STBI_rgb);
+        if (!data)
+            return false;
+
+        const auto total = m_iTexWidth * m_iTexHeight;
+        m_memory->Resize(TexelFormat::RGB16F, total);
+        for (auto i = 0; i < total; i++)
+            m_memory->SetTexel(i, Spectrum(data[3 * i], data[3 * i + 1], data[3 * i + 2]), 1.0f);
+
+        stbi_image_free(data);
+    } else {
+        // low dynamic range images keep the channels in the file, texels are copied as they are
+        auto comp = 0;
+        auto* data = stbi_load_from_memory(file.data(), (int)file.size(), &m_iTexWidth, &m_iTexHeight, &comp, 0);
+        if (!data)
+            return false;
+
+        static const TexelFormat formats[] = { TexelFormat::R8 , TexelFormat::RA8 , TexelFormat::RGB8 , TexelFormat::RGBA8 };
+        if (comp < 1 || comp > 4) {
+            stbi_image_free(data);
+            return false;
         }
 
-        // there is alpha channel in the texture.
-        if( comp == STBI_rgb_alpha ){
-            m_memory->m_a = std::make_unique<float[]>(m_iTexWidth*m_iTexHeight);
-            for (auto i = 0; i < m_iTexHeight; ++i) {
-                for (auto j = 0; j < m_iTexWidth; ++j) {
-                    const auto k = i * m_iTexWidth + j;
-
-                    auto& alpha = m_memory->m_a[i * m_iTexWidth + j];
+        m_memory->Resize(formats[comp - 1], m_iTexWidth * m_iTexHeight);
+        memcpy(m_memory->m_texels.data(), data, m_memory->m_texels.size());
 
-                    alpha = data[4 * k + 3];
-                }
-            }
-        }
+        stbi_image_free(data);
+    }
 
-        stbi_image_free((void*)data);
+    SORT_STATS(m_memory->m_memoryRecord.Track(&sTextureMemory, (StatsInt)m_memory->m_texels.size()));
 
-        average();
-        return true;
-    }
-    return false;
+    average();
+    buildMipmaps();
+    convertToTiles(tiled_file);
+    publishShared(shared_name);
+    return true;
 }
 
 Spectrum ImageTexture2D::GetAverage() const{
@@ -134,7 +239,7 @@ Spectrum ImageTexture2D::GetAverage() const{
 
 void ImageTexture2D::average(){
     // if there is no image, just crash
-    if(IS_PTR_INVALID(m_memory) || IS_PTR_INVALID(m_memory->m_rgb))
+    if(IS_PTR_INVALID(m_memory) || m_memory->Empty())
         return;
 
     Spectrum average;
@@ -143,9 +248,220 @@ void ImageTexture2D::average(){
             // get the offset
             int offset = i * m_iTexWidth + j;
             // get the color
-            average += m_memory->m_rgb[offset];
+            average += m_memory->GetColor(offset);
         }
     }
 
     m_average = average / (float)( m_iTexWidth * m_iTexHeight );
 }
+
+Spectrum ImageTexture2D::GetColorFromUV( float u , float v , float width ) const{
+    SORT_HW_COUNTERS("Texture Lookup");
+    const auto lod = mipLevel( width );
+    const auto level = (int)lod;
+    const auto t = lod - level;
+
+    // trilinear filtering between the two levels closest to the footprint
+    const auto color = mip( level ).GetColorFromUV( u , v );
+    if( t == 0.0f )
+        return color;
+    return color * ( 1.0f - t ) + mip( level + 1 ).GetColorFromUV( u , v ) * t;
+}
+
+float ImageTexture2D::GetAlphaFromtUV( float u , float v , float width ) const{
+    const auto lod = mipLevel( width );
+    const auto level = (int)lod;
+    const auto t = lod - level;
+
+    const auto alpha = mip( level ).GetAlphaFromtUV( u , v );
+    if( t == 0.0f )
+        return alpha;
+    return alpha * ( 1.0f - t ) + mip( level + 1 ).GetAlphaFromtUV( u , v ) * t;
+}
+
+float ImageTexture2D::mipLevel( float width ) const{
+    // footprints narrower than a texel are sampled on the image itself
+    const auto texels = width * sqrt( (float)m_iTexWidth * (float)m_iTexHeight );
+    if( texels <= 1.0f )
+        return 0.0f;
+    return std::min( log2( texels ) , (float)m_mips.size() );
+}
+
+void ImageTexture2D::buildMipmaps(){
+    m_mips.clear();
+    if(IS_PTR_INVALID(m_memory) || m_memory->Empty())
+        return;
+
+    const ImageTexture2D* src = this;
+    while( src->m_iTexWidth > 1 || src->m_iTexHeight > 1 ){
+        auto mip = std::make_unique<ImageTexture2D>();
+        mip->m_name = m_name;
+        mip->m_average = m_average;
+        mip->m_iTexWidth = std::max( 1 , ( src->m_iTexWidth + 1 ) / 2 );
+        mip->m_iTexHeight = std::max( 1 , ( src->m_iTexHeight + 1 ) / 2 );
+        mip->m_memory = std::make_unique<ImgMemory>();
+
+        const auto sw = src->m_iTexWidth , sh = src->m_iTexHeight;
+        const auto w = mip->m_iTexWidth , h = mip->m_iTexHeight;
+        const auto& in = *src->m_memory;
+        auto& out = *mip->m_memory;
+        out.Resize( in.m_format , w * h );
+
+        // each texel averages the two by two texels above it, texels on the border are repeated for odd sizes
+        for( auto i = 0 ; i < h ; ++i ){
+            const auto i0 = std::min( 2 * i , sh - 1 ) * sw;
+            const auto i1 = std::min( 2 * i + 1 , sh - 1 ) * sw;
+            for( auto j = 0 ; j < w ; ++j ){
+                const auto j0 = std::min( 2 * j , sw - 1 );
+                const auto j1 = std::min( 2 * j + 1 , sw - 1 );
+                const auto color = ( in.GetColor( i0 + j0 ) + in.GetColor( i0 + j1 ) + in.GetColor( i1 + j0 ) + in.GetColor( i1 + j1 ) ) * 0.25f;
+                const auto alpha = ( in.GetAlpha( i0 + j0 ) + in.GetAlpha( i0 + j1 ) + in.GetAlpha( i1 + j0 ) + in.GetAlpha( i1 + j1 ) ) * 0.25f;
+                out.SetTexel( i * w + j , color , alpha );
+            }
+        }
+
+        SORT_STATS(out.m_memoryRecord.Track(&sTextureMemory, (StatsInt)out.m_texels.size()));
+
+        src = mip.get();
+        m_mips.push_back( std::move( mip ) );
+    }
+}
+
+bool ImageTexture2D::openTiles( const std::string& tiled_file ){
+    std::vector<std::unique_ptr<TiledTexture>> levels;
+
+    auto w = 0 , h = 0;
+    do{
+        auto tiled = std::make_unique<TiledTexture>();
+        if( !tiled->Open( mipTiledFile( tiled_file , (int)levels.size() ) ) )
+            return false;
+
+        // a level not matching the size expected from the previous one is from a different image
+        if( !levels.empty() && ( tiled->GetWidth() != std::max( 1 , ( w + 1 ) / 2 ) || tiled->GetHeight() != std::max( 1 , ( h + 1 ) / 2 ) ) )
+            return false;
+
+        w = tiled->GetWidth();
+        h = tiled->GetHeight();
+        levels.push_back( std::move( tiled ) );
+    }while( w > 1 || h > 1 );
+
+    m_mips.clear();
+    for( auto i = 0u ; i < levels.size() ; ++i ){
+        auto& texture = ( i == 0 ) ? *this : *m_mips.emplace_back( std::make_unique<ImageTexture2D>() );
+        texture.m_name = m_name;
+        texture.m_iTexWidth = levels[i]->GetWidth();
+        texture.m_iTexHeight = levels[i]->GetHeight();
+        texture.m_average = levels[0]->GetAverage();
+        texture.m_tiled = std::move( levels[i] );
+        texture.m_memory.reset();
+    }
+    return true;
+}
+
+void ImageTexture2D::convertToTiles( const std::string& tiled_file ){
+    if (tiled_file.empty())
+        return;
+
+    // each level stays in memory if it can't be converted
+    for (auto level = 0; level <= (int)m_mips.size(); ++level) {
+        auto& texture = (level == 0) ? *this : *m_mips[level - 1];
+        if (IS_PTR_INVALID(texture.m_memory) || texture.m_memory->Empty())
+            continue;
+
+        // tiles are saved as floats
+        const auto& memory = *texture.m_memory;
+        const auto total = texture.m_iTexWidth * texture.m_iTexHeight;
+        std::vector<Spectrum> rgb(total);
+        std::vector<float> alpha(memory.HasAlpha() ? total : 0);
+        for (auto i = 0; i < total; ++i) {
+            rgb[i] = memory.GetColor(i);
+            if (!alpha.empty())
+                alpha[i] = memory.GetAlpha(i);
+        }
+
+        const auto file = mipTiledFile(tiled_file, level);
+        if (!TiledTexture::Save(file, texture.m_iTexWidth, texture.m_iTexHeight, rgb.data(), alpha.empty() ? nullptr : alpha.data(), m_average))
+            continue;
+
+        auto tiled = std::make_unique<TiledTexture>();
+        if (!tiled->Open(file))
+            continue;
+        texture.m_tiled = std::move(tiled);
+        texture.m_memory.reset();
+    }
+}
+
+bool ImageTexture2D::attachShared( const std::string& name ){
+    auto shared = std::make_unique<SharedResourceData>();
+    if( !shared->Attach( name ) || shared->GetSize() < sizeof( SharedTextureHeader ) )
+        return false;
+
+    SharedTextureHeader header;
+    memcpy( &header , shared->GetData() , sizeof( header ) );
+    if( header.format > (unsigned)TexelFormat::RGB16F || header.width <= 0 || header.height <= 0 )
+        return false;
+
+    const auto format = (TexelFormat)header.format;
+    const auto offsets = sharedTextureLayout( format , header.width , header.height );
+    if( offsets.back() > shared->GetSize() )
+        return false;
+
+    m_mips.clear();
+    auto w = header.width , h = header.height;
+    for( auto i = 0u ; i + 1 < offsets.size() ; ++i ){
+        auto& texture = ( i == 0 ) ? *this : *m_mips.emplace_back( std::make_unique<ImageTexture2D>() );
+        texture.m_name = m_name;
+        texture.m_iTexWidth = w;
+        texture.m_iTexHeight = h;
+        texture.m_average = Spectrum( header.average[0] , header.average[1] , header.average[2] );
+        texture.m_memory = std::make_unique<ImgMemory>();
+        texture.m_memory->m_format = format;
+        texture.m_memory->m_view = (const unsigned char*)shared->GetData() + offsets[i];
+
+        w = std::max( 1 , ( w + 1 ) / 2 );
+        h = std::max( 1 , ( h + 1 ) / 2 );
+    }
+
+    m_shared = std::move( shared );
+    return true;
+}
+
+void ImageTexture2D::publishShared( const std::string& name ){
+    if( name.empty() || IS_PTR_INVALID(m_memory) || m_memory->Empty() )
+        return;
+
+    const auto format = m_memory->m_format;
+    const auto offsets = sharedTextureLayout( format , m_iTexWidth , m_iTexHeight );
+    if( offsets.size() != m_mips.size() + 2 )
+        return;
+
+    auto shared = std::make_unique<SharedResourceData>();
+    const auto published = shared->Publish( name , offsets.back() , [&]( char* data ){
+        SharedTextureHeader header;
+        header.format = (unsigned)format;
+        header.width = m_iTexWidth;
+        header.height = m_iTexHeight;
+        header.average[0] = m_average.r;
+        header.average[1] = m_average.g;
+        header.average[2] = m_average.b;
+        memcpy( data , &header , sizeof( header ) );
+
+        for( auto i = 0u ; i + 1 < offsets.size() ; ++i ){
+            const auto& memory = *mip( (int)i ).m_memory;
+            memcpy( data + offsets[i] , memory.Texels() , memory.m_texels.size() );
+        }
+        return true;
+    } );
+
+    // the texels published by another process at the same time are identical, either one is fine
+    if( !published || shared->GetSize() != offsets.back() )
+        return;
+
+    for( auto i = 0u ; i + 1 < offsets.size() ; ++i ){
+        auto& memory = *( i == 0 ? this : m_mips[i - 1].get() )->m_memory;
+        memory.m_view = (const unsigned char*)shared->GetData() + offsets[i];
+        LargePageVector<unsigned char>().swap( memory.m_texels );
+        SORT_STATS(memory.m_memoryRecord.Track(&sTextureMemory, 0));
+    }
+    m_shared = std::move( shared );
+}
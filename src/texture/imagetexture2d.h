@@ -18,13 +18,24 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "core/resource.h"
+#include "core/sharedresource.h"
 #include "texturebase.h"
+#include "core/stats.h"
+#include "core/memory.h"
+#include "texture/texturecache.h"
+#include "texture/texel.h"
 
 //! @brief  Image texture.
 /**
  * Image texture is the most commonly used texture. It is just a two dimensional set of pixels.
- * There is no mip-map solution for now.
+ * A box filtered mip-map is built along with the image, lookups with a footprint blend the two levels closest to it.
+ * Texels are kept in the format of the image file, like 8 bits per channel, and only expanded to floats on lookups.
+ * With the texture cache enabled, decoded images are saved as tiles in the resource folder and paged in on demand,
+ * later renderings with the same image don't even decode it again.
+ * Otherwise, texels of all levels could be shared with other SORT processes on the same machine, only the first one
+ * decodes the image.
  */
 class ImageTexture2D : public Texture2DBase, public Resource{
 public:
@@ -48,11 +59,31 @@ public:
     //! @return             The alpha at the specific position, it will return 1.0 for textures without alpha channel.
     float GetAlpha( int x , int y ) const override;
 
+    //! @brief  Get the color given a texture coordinate and the width of the lookup footprint.
+    //!
+    //! @param  u           U coordinate. If out of range, it will be filtered.
+    //! @param  v           V coordinate. If out of range, it will be filtered.
+    //! @param  width       Width of the footprint in texture space, zero means sampling the image itself.
+    //! @return             The color filtered over the footprint.
+    Spectrum GetColorFromUV( float u , float v , float width ) const;
+
+    //! @brief  Get the alpha given a texture coordinate and the width of the lookup footprint.
+    //!
+    //! @param  u           U coordinate. If out of range, it will be filtered.
+    //! @param  v           V coordinate. If out of range, it will be filtered.
+    //! @param  width       Width of the footprint in texture space, zero means sampling the image itself.
+    //! @return             The alpha filtered over the footprint.
+    float GetAlphaFromtUV( float u , float v , float width ) const;
+
+    //! @brief  Lookups without a footprint are still bilinear samples of the image.
+    using Texture2DBase::GetColorFromUV;
+    using Texture2DBase::GetAlphaFromtUV;
+
     //! @brief  Whether the 2d texture is valid or not.
     //!
     //! @return             True if the texture is valid.
     bool IsValid() const override { 
-        return IS_PTR_VALID(m_memory); 
+        return IS_PTR_VALID(m_memory) || IS_PTR_VALID(m_tiled); 
     }
 
     //! @brief  Get the average color of the texture.
@@ -63,13 +94,73 @@ public:
 private:
     class ImgMemory{
     public:
-        std::unique_ptr<Spectrum[]>     m_rgb = nullptr;   /**< RGB Channels. */
-        std::unique_ptr<float[]>        m_a  = nullptr;   /**< Alpha Channel. */
+        TexelFormat                     m_format = TexelFormat::RGB8;   /**< Format of the texels. */
+        LargePageVector<unsigned char>  m_texels;                       /**< Texels in their format. */
+        const unsigned char*            m_view = nullptr;               /**< Texels shared with other processes, there is no texel owned if it is valid. */
+        SORT_STATS_MEMORY_RECORD(m_memoryRecord)                        /**< Memory of the texels accounted in stats. */
+
+        //! @brief  Allocate the texels.
+        //!
+        //! @param  format      Format of the texels.
+        //! @param  cnt         Number of texels.
+        void Resize( TexelFormat format , int cnt ){
+            m_format = format;
+            m_texels.resize( (size_t)texelSize( format ) * cnt );
+        }
+
+        //! @brief  Whether there is no texel at all.
+        bool Empty() const {
+            return m_texels.empty() && !m_view;
+        }
+
+        //! @brief  The texels, either owned or shared.
+        const unsigned char* Texels() const {
+            return m_view ? m_view : m_texels.data();
+        }
+
+        //! @brief  Whether the texels have an alpha channel.
+        bool HasAlpha() const {
+            return texelHasAlpha( m_format );
+        }
+
+        //! @brief  Get the color of a texel.
+        //!
+        //! @param  offset      Index of the texel.
+        //! @return             Color of the texel.
+        Spectrum GetColor( int offset ) const {
+            return decodeTexelColor( m_format , Texels() + (size_t)texelSize( m_format ) * offset );
+        }
+
+        //! @brief  Get the alpha of a texel.
+        //!
+        //! @param  offset      Index of the texel.
+        //! @return             Alpha of the texel.
+        float GetAlpha( int offset ) const {
+            return decodeTexelAlpha( m_format , Texels() + (size_t)texelSize( m_format ) * offset );
+        }
+
+        //! @brief  Fill a texel.
+        //!
+        //! @param  offset      Index of the texel.
+        //! @param  color       Color of the texel.
+        //! @param  alpha       Alpha of the texel.
+        void SetTexel( int offset , const Spectrum& color , float alpha ){
+            encodeTexel( m_format , color , alpha , m_texels.data() + (size_t)texelSize( m_format ) * offset );
+        }
     };
 
     // array saving the color of image
     std::unique_ptr<ImgMemory>  m_memory = nullptr;
 
+    // tiles of the image paged in through the texture cache, the image is not in memory if it is valid
+    std::unique_ptr<TiledTexture>   m_tiled = nullptr;
+
+    // mip levels from the second one on, each is half the size of the previous one, the last one has only one texel
+    std::vector<std::unique_ptr<ImageTexture2D>>    m_mips;
+
+    // texels of all levels shared with other processes, only the image itself keeps it
+    std::unique_ptr<SharedResourceData> m_shared = nullptr;
+
     // the average radiance of the texture
     Spectrum    m_average;
 
@@ -78,4 +169,27 @@ private:
 
     // compute average radiance
     void    average();
+
+    // build the mip levels by box filtering the image
+    void    buildMipmaps();
+
+    // get a level of the mip-map, level zero is the image itself
+    const ImageTexture2D&   mip( int level ) const {
+        return level == 0 ? *this : *m_mips[level - 1];
+    }
+
+    // the mip level to look up for a footprint of the given width in texture space
+    float   mipLevel( float width ) const;
+
+    // open the image and all its mip levels converted to tiles before, nothing is changed if any of them is missing
+    bool    openTiles( const std::string& tiled_file );
+
+    // page the image in through the texture cache instead of keeping it in memory
+    void    convertToTiles( const std::string& tiled_file );
+
+    // map the image and all its mip levels published by another process, nothing is changed if it fails
+    bool    attachShared( const std::string& name );
+
+    // publish the image and all its mip levels to other processes, the texels are shared instead of owned then
+    void    publishShared( const std::string& name );
 };
@@ -15,18 +15,132 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "imagetexture3d.h"
+#include "math/utils.h"
+
+#ifdef SSE_ENABLED
+    #include <nmmintrin.h>
+#endif
 
 template class ImageTexture3D<float>;
 template class ImageTexture3D<Spectrum>;
 
+namespace {
+    SORT_FORCEINLINE bool sameTexel(float t0, float t1) {
+        return t0 == t1;
+    }
+
+    SORT_FORCEINLINE bool sameTexel(const Spectrum& t0, const Spectrum& t1) {
+        return t0[0] == t1[0] && t0[1] == t1[1] && t0[2] == t1[2];
+    }
+
+    // Interpolate the eight corners of a cell, corners are indexed as 'z * 4 + y * 2 + x'.
+    template<class T>
+    SORT_FORCEINLINE T trilerp(const T c[8], float dx, float dy, float dz) {
+        const auto t0 = slerp(c[0], c[1], dx);
+        const auto t1 = slerp(c[4], c[5], dx);
+        const auto t2 = slerp(c[2], c[3], dx);
+        const auto t3 = slerp(c[6], c[7], dx);
+
+        const auto t02 = slerp(t0, t2, dy);
+        const auto t13 = slerp(t1, t3, dy);
+
+        return slerp(t02, t13, dz);
+    }
+
+#ifdef SSE_ENABLED
+    // Density is sampled once per ray marching step, the four lerps along X axis are done at once.
+    template<>
+    SORT_FORCEINLINE float trilerp(const float c[8], float dx, float dy, float dz) {
+        // lanes are ( y0z0 , y1z0 , y0z1 , y1z1 )
+        const auto c0 = _mm_setr_ps(c[0], c[2], c[4], c[6]);
+        const auto c1 = _mm_setr_ps(c[1], c[3], c[5], c[7]);
+        const auto tx = _mm_set1_ps(dx);
+        const auto x = _mm_add_ps(_mm_mul_ps(c0, _mm_sub_ps(_mm_set1_ps(1.0f), tx)), _mm_mul_ps(c1, tx));
+
+        // lanes are ( z0 , z1 , z0 , z1 )
+        const auto y0 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 0, 2, 0));
+        const auto y1 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 1, 3, 1));
+        const auto ty = _mm_set1_ps(dy);
+        const auto y = _mm_add_ps(_mm_mul_ps(y0, _mm_sub_ps(_mm_set1_ps(1.0f), ty)), _mm_mul_ps(y1, ty));
+
+        alignas(16) float r[4];
+        _mm_store_ps(r, y);
+        return slerp(r[0], r[1], dz);
+    }
+#endif
+}
+
+template<class T>
+size_t ImageTexture3D<T>::setTexels(const T* texels) {
+    const auto width    = Texture3DBase<T>::m_width;
+    const auto height   = Texture3DBase<T>::m_height;
+    const auto depth    = Texture3DBase<T>::m_depth;
+
+    m_memory = std::make_unique<ImgMemory>();
+    m_memory->m_brickWidth = (width + BRICK_MASK) >> BRICK_SIZE_LOG2;
+    m_memory->m_brickHeight = (height + BRICK_MASK) >> BRICK_SIZE_LOG2;
+    const auto brick_depth = (depth + BRICK_MASK) >> BRICK_SIZE_LOG2;
+    const auto brick_cnt = m_memory->m_brickWidth * m_memory->m_brickHeight * brick_depth;
+
+    m_memory->m_brickOffset.resize(brick_cnt, UNIFORM_BRICK);
+    m_memory->m_brickValue.resize(brick_cnt, T(0.0f));
+
+    // texels outside the volume are padded with the closest texel inside, so that they never break uniformity.
+    const auto dense_texel = [&](unsigned x, unsigned y, unsigned z) {
+        x = std::min(x, width - 1);
+        y = std::min(y, height - 1);
+        z = std::min(z, depth - 1);
+        return texels[(z * height + y) * width + x];
+    };
+
+    std::vector<T> brick(BRICK_TEXEL_CNT);
+    auto b = 0u;
+    for (auto bz = 0u; bz < brick_depth; ++bz) {
+        for (auto by = 0u; by < m_memory->m_brickHeight; ++by) {
+            for (auto bx = 0u; bx < m_memory->m_brickWidth; ++bx, ++b) {
+                auto uniform = true;
+                auto i = 0u;
+                for (auto z = 0u; z < BRICK_SIZE; ++z) {
+                    for (auto y = 0u; y < BRICK_SIZE; ++y) {
+                        for (auto x = 0u; x < BRICK_SIZE; ++x, ++i) {
+                            brick[i] = dense_texel((bx << BRICK_SIZE_LOG2) + x, (by << BRICK_SIZE_LOG2) + y, (bz << BRICK_SIZE_LOG2) + z);
+                            uniform &= sameTexel(brick[i], brick[0]);
+                        }
+                    }
+                }
+
+                if (uniform) {
+                    m_memory->m_brickValue[b] = brick[0];
+                    continue;
+                }
+
+                m_memory->m_brickOffset[b] = (unsigned)m_memory->m_texel.size();
+                m_memory->m_texel.insert(m_memory->m_texel.end(), brick.begin(), brick.end());
+            }
+        }
+    }
+    m_memory->m_texel.shrink_to_fit();
+
+    return sizeof(unsigned) * m_memory->m_brickOffset.size() + sizeof(T) * (m_memory->m_brickValue.size() + m_memory->m_texel.size());
+}
+
+template<class T>
+T ImageTexture3D<T>::texel(unsigned x, unsigned y, unsigned z) const {
+    const auto b = ((z >> BRICK_SIZE_LOG2) * m_memory->m_brickHeight + (y >> BRICK_SIZE_LOG2)) * m_memory->m_brickWidth + (x >> BRICK_SIZE_LOG2);
+    const auto offset = m_memory->m_brickOffset[b];
+    if (offset == UNIFORM_BRICK)
+        return m_memory->m_brickValue[b];
+    return m_memory->m_texel[offset + ((((z & BRICK_MASK) << BRICK_SIZE_LOG2) + (y & BRICK_MASK)) << BRICK_SIZE_LOG2) + (x & BRICK_MASK)];
+}
+
 template<class T>
 T ImageTexture3D<T>::Sample(int x, int y, int z) const {
     if (x < 0 || x >= (int)Texture3DBase<T>::m_width || y < 0 || y >= (int)Texture3DBase<T>::m_height || z < 0 || z >= (int)Texture3DBase<T>::m_depth)
         return 0.0f;
 
-    const auto offset = z * Texture3DBase<T>::m_width * Texture3DBase<T>::m_height + y * Texture3DBase<T>::m_width + x;
-    return m_memory->m_texel[offset];
+    return texel(x, y, z);
 }
 
 template<class T>
@@ -53,23 +167,39 @@ T ImageTexture3D<T>::Sample(float u, float v, float w) const{
     const auto dy = fy - y;
     const auto dz = fz - z;
 
-    const auto slice_strand = width * height;
-    const auto offset00 = z * slice_strand + y * width + x;
-    const auto offset01 = (x < width - 1) ? offset00 + 1 : offset00;
-    const auto offset10 = (z < depth - 1) ? offset00 + slice_strand : offset00;
-    const auto offset11 = (x < width - 1) ? offset10 + 1 : offset10;
-    const auto offset20 = (y < height - 1) ? offset00 + width : offset00;
-    const auto offset21 = (x < width - 1) ? offset20 + 1 : offset20;
-    const auto offset30 = (z < depth - 1) ? offset20 + slice_strand : offset20;
-    const auto offset31 = (x < width - 1) ? offset30 + 1 : offset30;
-
-    const auto t0 = slerp(m_memory->m_texel[offset00], m_memory->m_texel[offset01], dx);
-    const auto t1 = slerp(m_memory->m_texel[offset10], m_memory->m_texel[offset11], dx);
-    const auto t2 = slerp(m_memory->m_texel[offset20], m_memory->m_texel[offset21], dx);
-    const auto t3 = slerp(m_memory->m_texel[offset30], m_memory->m_texel[offset31], dx);
-
-    const auto t02 = slerp(t0, t2, dy);
-    const auto t13 = slerp(t1, t3, dy);
-    
-    return slerp(t02, t13, dz);
-}
\ No newline at end of file
+    const auto x1 = (x < width - 1) ? x + 1 : x;
+    const auto y1 = (y < height - 1) ? y + 1 : y;
+    const auto z1 = (z < depth - 1) ? z + 1 : z;
+
+    T c[8];
+    const auto b = ((z >> BRICK_SIZE_LOG2) * m_memory->m_brickHeight + (y >> BRICK_SIZE_LOG2)) * m_memory->m_brickWidth + (x >> BRICK_SIZE_LOG2);
+    const auto same_brick = ((x ^ x1) | (y ^ y1) | (z ^ z1)) >> BRICK_SIZE_LOG2 == 0;
+    if (same_brick && m_memory->m_brickOffset[b] == UNIFORM_BRICK) {
+        // nothing to interpolate inside an elided brick, this is where most empty space ends up.
+        return m_memory->m_brickValue[b];
+    } else if (same_brick) {
+        const auto base = m_memory->m_texel.data() + m_memory->m_brickOffset[b];
+        const auto ox = x & BRICK_MASK, oy = y & BRICK_MASK, oz = z & BRICK_MASK;
+        const auto sx = x1 - x, sy = (y1 - y) << BRICK_SIZE_LOG2, sz = (z1 - z) << (2 * BRICK_SIZE_LOG2);
+        const auto o = (((oz << BRICK_SIZE_LOG2) + oy) << BRICK_SIZE_LOG2) + ox;
+        c[0] = base[o];
+        c[1] = base[o + sx];
+        c[2] = base[o + sy];
+        c[3] = base[o + sy + sx];
+        c[4] = base[o + sz];
+        c[5] = base[o + sz + sx];
+        c[6] = base[o + sz + sy];
+        c[7] = base[o + sz + sy + sx];
+    } else {
+        c[0] = texel(x, y, z);
+        c[1] = texel(x1, y, z);
+        c[2] = texel(x, y1, z);
+        c[3] = texel(x1, y1, z);
+        c[4] = texel(x, y, z1);
+        c[5] = texel(x1, y, z1);
+        c[6] = texel(x, y1, z1);
+        c[7] = texel(x1, y1, z1);
+    }
+
+    return trilerp(c, dx, dy, dz);
+}
@@ -17,11 +17,18 @@
 
 #pragma once
 
+#include <vector>
 #include "texturebase.h"
+#include "core/memory.h"
 
 //! @brief  3D image texture.
 /**
  * 3D image texture is a three dimentional set of pixel data.
+ *
+ * Texels are stored sparsely in bricks of 8x8x8 texels. A brick whose texels all share the same value, like
+ * the empty space around a smoke plume, is elided and only keeps that value, the rest are packed one after
+ * another in a pool. Since neighbouring texels mostly live in the same brick, trilinear filtering resolves
+ * the brick only once for all eight corners in most cases.
  */
 template<class T>
 class ImageTexture3D : public Texture3DBase<T>{
@@ -44,12 +51,35 @@ public:
     T Sample(float u, float v, float w) const override;
 
 protected:
-    template<class D>
+    static constexpr unsigned BRICK_SIZE_LOG2   = 3;
+    static constexpr unsigned BRICK_SIZE        = 1u << BRICK_SIZE_LOG2;
+    static constexpr unsigned BRICK_MASK        = BRICK_SIZE - 1;
+    static constexpr unsigned BRICK_TEXEL_CNT   = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+    static constexpr unsigned UNIFORM_BRICK     = ~0u;
+
     class ImgMemory {
     public:
-        std::unique_ptr<D[]>     m_texel = nullptr;   /**< RGB Channels. */
+        unsigned                m_brickWidth = 0;   /**< Number of bricks along X axis. */
+        unsigned                m_brickHeight = 0;  /**< Number of bricks along Y axis. */
+        std::vector<unsigned>   m_brickOffset;      /**< Offset of each brick in the pool, UNIFORM_BRICK if it is elided. */
+        std::vector<T>          m_brickValue;       /**< Value of every texel in each elided brick. */
+        LargePageVector<T>      m_texel;            /**< Texels of the bricks that are not elided. */
     };
 
+    //! @brief  Build the sparse storage from dense texels.
+    //!
+    //! @param  texels  Texels of the whole volume, X varies the fastest, Z the slowest.
+    //! @return         Bytes taken by the sparse storage.
+    size_t  setTexels(const T* texels);
+
+    //! @brief  Fetch a texel, the position is assumed to be inside the volume.
+    //!
+    //! @param  x       X coordinate position.
+    //! @param  y       Y coordinate position.
+    //! @param  z       Z coordinate position.
+    //! @return         The texel value.
+    T       texel(unsigned x, unsigned y, unsigned z) const;
+
     /**< 3d texture memory. */
-    std::unique_ptr<ImgMemory<T>>  m_memory = nullptr;
+    std::unique_ptr<ImgMemory>  m_memory = nullptr;
 };
\ No newline at end of file
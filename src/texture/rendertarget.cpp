@@ -17,11 +17,12 @@
 
 #include "rendertarget.h"
 #include "core/sassert.h"
+#include "math/utils.h"
 
 // set the color
 void RenderTarget::SetColor( int x , int y , const Spectrum& color ){
     // check if there is memory
-    sAssertMsg(IS_PTR_VALID(m_pData), IMAGE , "There is no data in render target , can't set color" );
+    sAssertMsg(IS_PTR_VALID(m_pData) || IS_PTR_VALID(m_pHalfData), IMAGE , "There is no data in render target , can't set color" );
 
     // use filter first
     texCoordFilter( x , y );
@@ -30,11 +31,18 @@ void RenderTarget::SetColor( int x , int y , const Spectrum& color ){
     unsigned offset = y * m_iTexWidth + x;
 
     // set the color
-    m_pData[offset] = color;
+    if( m_pHalfData ){
+        auto pixel = m_pHalfData.get() + 3 * offset;
+        pixel[0] = FloatToHalf( color.r );
+        pixel[1] = FloatToHalf( color.g );
+        pixel[2] = FloatToHalf( color.b );
+    }else{
+        m_pData[offset] = color;
+    }
 }
 
 Spectrum RenderTarget::GetColor( int x , int y ) const{
-    sAssertMsg(IS_PTR_VALID(m_pData) , IMAGE , "No memory in the render target, can't get color." );
+    sAssertMsg(IS_PTR_VALID(m_pData) || IS_PTR_VALID(m_pHalfData) , IMAGE , "No memory in the render target, can't get color." );
 
     // filter the x y coordinate
     texCoordFilter( x , y );
@@ -42,5 +50,9 @@ Spectrum RenderTarget::GetColor( int x , int y ) const{
     // get the offset
     int offset = y * m_iTexWidth + x;
 
+    if( m_pHalfData ){
+        const auto pixel = m_pHalfData.get() + 3 * offset;
+        return Spectrum( HalfToFloat( pixel[0] ) , HalfToFloat( pixel[1] ) , HalfToFloat( pixel[2] ) );
+    }
     return m_pData[offset];
 }
\ No newline at end of file
@@ -20,10 +20,19 @@
 #include <memory>
 #include "texturebase.h"
 
+//! @brief  Storage format of the pixels in a render target.
+enum class RenderTargetFormat : int {
+    Float = 0,      /**< Three floats per pixel. */
+    Half,           /**< Three half floats per pixel, converted to floats when they are read. */
+};
+
 class   RenderTarget : public Texture2DBase{
 public:
-    RenderTarget( int w , int h ) : Texture2DBase( w , h ){
-        m_pData = std::make_unique<Spectrum[]>( w * h );
+    RenderTarget( int w , int h , RenderTargetFormat format = RenderTargetFormat::Float ) : Texture2DBase( w , h ){
+        if( RenderTargetFormat::Half == format )
+            m_pHalfData = std::make_unique<unsigned short[]>( 3 * w * h );
+        else
+            m_pData = std::make_unique<Spectrum[]>( w * h );
     }
 
     void SetColor( int x , int y , const Spectrum& c );
@@ -31,4 +40,6 @@ public:
 
 private:
     std::unique_ptr<Spectrum[]> m_pData;
+    // pixels in half floats, only if the render target is in half floats
+    std::unique_ptr<unsigned short[]> m_pHalfData;
 };
@@ -0,0 +1,193 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include "core/define.h"
+#include "spectrum/spectrum.h"
+
+#ifdef __F16C__
+    #include <immintrin.h>
+#endif
+
+//! @brief  Formats of texels kept in memory.
+/**
+ * Images are kept in the format they are decoded from instead of one Spectrum per texel, texels are only
+ * expanded to floats when they are looked up.
+ */
+enum class TexelFormat : unsigned char {
+    R8 = 0 ,    /**< One channel of 8 bits, like roughness or masks. It is broadcast to all color channels. */
+    RA8 ,       /**< Grey scale and alpha channels of 8 bits each. */
+    RGB8 ,      /**< Three channels of 8 bits each. */
+    RGBA8 ,     /**< Four channels of 8 bits each. */
+    RGB16F ,    /**< Three channels of half precision floats, for high dynamic range images. */
+};
+
+//! @brief  Size of a texel in bytes.
+//!
+//! @param  format      Format of the texel.
+//! @return             Size of the texel.
+SORT_STATIC_FORCEINLINE unsigned texelSize( TexelFormat format ){
+    switch( format ){
+    case TexelFormat::R8:       return 1;
+    case TexelFormat::RA8:      return 2;
+    case TexelFormat::RGB8:     return 3;
+    case TexelFormat::RGBA8:    return 4;
+    case TexelFormat::RGB16F:   return 6;
+    }
+    return 0;
+}
+
+//! @brief  Whether there is an alpha channel in texels of a format.
+//!
+//! @param  format      Format of the texel.
+//! @return             Whether the format has an alpha channel.
+SORT_STATIC_FORCEINLINE bool texelHasAlpha( TexelFormat format ){
+    return format == TexelFormat::RA8 || format == TexelFormat::RGBA8;
+}
+
+//! @brief  Convert a half precision float to a single precision float.
+//!
+//! @param  h           Bits of the half precision float.
+//! @return             The single precision float.
+SORT_STATIC_FORCEINLINE float halfToFloat( unsigned short h ){
+    const unsigned int sign = ( h & 0x8000u ) << 16;
+    const unsigned int exponent = ( h >> 10 ) & 0x1fu;
+    const unsigned int mantissa = h & 0x3ffu;
+
+    // denormalized halfs are normalized floats
+    if( exponent == 0 ){
+        const auto f = (float)mantissa * ( 1.0f / 16777216.0f );
+        return sign ? -f : f;
+    }
+
+    const unsigned int bits = ( exponent == 0x1fu ) ? ( sign | 0x7f800000u | ( mantissa << 13 ) ) :
+                                                      ( sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 ) );
+    float ret;
+    memcpy( &ret , &bits , sizeof( ret ) );
+    return ret;
+}
+
+//! @brief  Convert a single precision float to a half precision float, rounding to the nearest.
+//!
+//! Values beyond the range of half precision floats are clamped to the largest finite one.
+//!
+//! @param  f           The single precision float.
+//! @return             Bits of the half precision float.
+SORT_STATIC_FORCEINLINE unsigned short floatToHalf( float f ){
+    unsigned int bits;
+    memcpy( &bits , &f , sizeof( bits ) );
+    const unsigned int sign = ( bits >> 16 ) & 0x8000u;
+    const unsigned int abs = bits & 0x7fffffffu;
+
+    // NaN is kept, infinity and values rounding up to it are clamped
+    if( abs > 0x7f800000u )
+        return (unsigned short)( sign | 0x7e00u );
+    if( abs >= 0x477ff000u )
+        return (unsigned short)( sign | 0x7bffu );
+
+    // values too small to be normalized halfs
+    if( abs < 0x38800000u ){
+        if( abs < 0x33000000u )
+            return (unsigned short)sign;
+        const unsigned int shift = 126 - ( abs >> 23 );
+        const unsigned int mantissa = ( abs & 0x7fffffu ) | 0x800000u;
+        return (unsigned short)( sign | ( ( mantissa >> shift ) + ( ( mantissa >> ( shift - 1 ) ) & 1 ) ) );
+    }
+
+    // re-bias the exponent and round the mantissa to nearest even
+    return (unsigned short)( sign | ( ( abs - 0x38000000u + 0xfffu + ( ( abs >> 13 ) & 1 ) ) >> 13 ) );
+}
+
+//! @brief  Expand the color of a texel.
+//!
+//! @param  format      Format of the texel.
+//! @param  texel       Address of the texel.
+//! @return             Color of the texel.
+SORT_STATIC_FORCEINLINE Spectrum decodeTexelColor( TexelFormat format , const unsigned char* texel ){
+    // dividing instead of multiplying by the reciprocal gives exactly the values image loaders used to decode
+    switch( format ){
+    case TexelFormat::R8:
+    case TexelFormat::RA8:
+        return Spectrum( texel[0] / 255.0f );
+    case TexelFormat::RGB8:
+    case TexelFormat::RGBA8:
+        return Spectrum( texel[0] / 255.0f , texel[1] / 255.0f , texel[2] / 255.0f );
+    case TexelFormat::RGB16F:
+    {
+        unsigned short h[4] = { 0 , 0 , 0 , 0 };
+        memcpy( h , texel , sizeof( unsigned short ) * 3 );
+#ifdef __F16C__
+        // all channels are converted by one instruction
+        float rgb[4];
+        _mm_storeu_ps( rgb , _mm_cvtph_ps( _mm_loadl_epi64( (const __m128i*)h ) ) );
+        return Spectrum( rgb[0] , rgb[1] , rgb[2] );
+#else
+        return Spectrum( halfToFloat( h[0] ) , halfToFloat( h[1] ) , halfToFloat( h[2] ) );
+#endif
+    }
+    }
+    return Spectrum();
+}
+
+//! @brief  Expand the alpha of a texel.
+//!
+//! @param  format      Format of the texel.
+//! @param  texel       Address of the texel.
+//! @return             Alpha of the texel, it is 1.0 for formats without alpha channel.
+SORT_STATIC_FORCEINLINE float decodeTexelAlpha( TexelFormat format , const unsigned char* texel ){
+    switch( format ){
+    case TexelFormat::RA8:      return texel[1] / 255.0f;
+    case TexelFormat::RGBA8:    return texel[3] / 255.0f;
+    default:                    return 1.0f;
+    }
+}
+
+//! @brief  Pack a color and an alpha value in a texel.
+//!
+//! @param  format      Format of the texel.
+//! @param  color       Color of the texel, only the red channel is kept for grey scale formats.
+//! @param  alpha       Alpha of the texel, it is dropped for formats without alpha channel.
+//! @param  texel       Address of the texel to be filled.
+SORT_STATIC_FORCEINLINE void encodeTexel( TexelFormat format , const Spectrum& color , float alpha , unsigned char* texel ){
+    const auto unorm = []( float v ){ return (unsigned char)( std::min( std::max( v , 0.0f ) , 1.0f ) * 255.0f + 0.5f ); };
+    switch( format ){
+    case TexelFormat::R8:
+        texel[0] = unorm( color.r );
+        break;
+    case TexelFormat::RA8:
+        texel[0] = unorm( color.r );
+        texel[1] = unorm( alpha );
+        break;
+    case TexelFormat::RGBA8:
+        texel[3] = unorm( alpha );
+        // fall through
+    case TexelFormat::RGB8:
+        texel[0] = unorm( color.r );
+        texel[1] = unorm( color.g );
+        texel[2] = unorm( color.b );
+        break;
+    case TexelFormat::RGB16F:
+    {
+        const unsigned short h[3] = { floatToHalf( color.r ) , floatToHalf( color.g ) , floatToHalf( color.b ) };
+        memcpy( texel , h , sizeof( h ) );
+        break;
+    }
+    }
+}
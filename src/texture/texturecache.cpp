@@ -0,0 +1,377 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <atomic>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <unordered_set>
+#include <string.h>
+#include "texturecache.h"
+#include "core/globalconfig.h"
+#include "core/log.h"
+#include "stream/fstream.h"
+#include "stream/mmapstream.h"
+
+SORT_STATS_DEFINE_MEMORY(sTextureTileMemory)
+SORT_STATS_DEFINE_COUNTER(sTextureTileLoads)
+SORT_STATS_DEFINE_COUNTER(sTextureTileEvictions)
+SORT_STATS_DEFINE_HOT_COUNTER(sTextureTileLookups)
+SORT_STATS_DEFINE_HOT_COUNTER(sTextureTileHandleHits)
+SORT_STATS_DEFINE_COUNTER(sTextureTileDeferredMisses)
+SORT_STATS_DEFINE_COUNTER(sTextureTileBackgroundLoads)
+
+SORT_STATS_MEMORY("Texture Tiles", sTextureTileMemory);
+SORT_STATS_COUNTER("Texture Cache", "Tiles loaded", sTextureTileLoads);
+SORT_STATS_COUNTER("Texture Cache", "Tiles evicted", sTextureTileEvictions);
+SORT_STATS_RATIO("Texture Cache", "Tile handle hit rate", sTextureTileHandleHits, sTextureTileLookups);
+SORT_STATS_COUNTER("Texture Cache", "Deferred misses", sTextureTileDeferredMisses);
+SORT_STATS_COUNTER("Texture Cache", "Tiles loaded in background", sTextureTileBackgroundLoads);
+
+// Identifier and version of tiled texture files.
+static constexpr unsigned TILED_TEXTURE_MAGIC = 0x53454c54;
+static constexpr unsigned TILED_TEXTURE_VERSION = 0;
+
+// magic, version, width, height, tile size, whether there is alpha and the average color
+static constexpr size_t TILED_TEXTURE_HEADER_SIZE = 6 * sizeof(unsigned) + 3 * sizeof(float);
+
+// Number of tile handles kept by each thread.
+static constexpr unsigned TILE_HANDLE_CNT = 16;
+
+// Number of I/O threads loading missed tiles in the background.
+static constexpr unsigned TILE_LOADER_THREAD_CNT = 2;
+
+// Handle of a recently accessed tile, it keeps the tile alive.
+struct TileHandle {
+    unsigned long long                  key = 0;
+    std::shared_ptr<const TextureTile>  tile;
+};
+static thread_local TileHandle g_tileHandles[TILE_HANDLE_CNT];
+
+// Ids start from 1 so that no key of a tile is 0, which is the key of empty handles.
+static std::atomic<unsigned> g_tiledTextureId( 1 );
+
+// The innermost scope deferring misses of the current thread, nullptr if misses are not deferred.
+static thread_local TextureMissDeferral* g_missDeferral = nullptr;
+
+// Tiles missed within TextureMissDeferral are loaded by a few I/O threads, which are only started once there is a miss.
+// It outlives the texture cache and all textures, the texture cache stops it before being destroyed.
+class TextureTileLoader {
+public:
+    ~TextureTileLoader(){
+        Stop();
+    }
+
+    // Queue a tile to be loaded, it returns false if it is queued or being loaded already.
+    bool Request( const TiledTexture& texture , unsigned tile , unsigned long long key ){
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if( m_stopped || !m_requested.insert( key ).second )
+            return false;
+        m_queue.push_back( PendingTile{ &texture , tile , key } );
+        if( m_threads.empty() ){
+            for( auto i = 0u ; i < TILE_LOADER_THREAD_CNT ; ++i )
+                m_threads.emplace_back( [this](){ load(); } );
+        }
+        m_queued.notify_one();
+        return true;
+    }
+
+    // Drop the queued tiles of a texture and wait for the ones being loaded.
+    void Cancel( unsigned textureId ){
+        std::unique_lock<std::mutex> lock( m_mutex );
+        const auto of_texture = [textureId]( unsigned long long key ){ return ( key >> 32 ) == textureId; };
+        for( auto it = m_queue.begin() ; it != m_queue.end() ; ){
+            if( of_texture( it->key ) ){
+                m_requested.erase( it->key );
+                it = m_queue.erase( it );
+            }else{
+                ++it;
+            }
+        }
+        m_loaded.wait( lock , [&](){ return std::none_of( m_loading.begin() , m_loading.end() , of_texture ); } );
+    }
+
+    // Stop the I/O threads, tiles not loaded yet are dropped.
+    void Stop(){
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stopped = true;
+            m_queue.clear();
+        }
+        m_queued.notify_all();
+        for( auto& thread : m_threads )
+            thread.join();
+        m_threads.clear();
+    }
+
+private:
+    struct PendingTile {
+        const TiledTexture* texture;
+        unsigned            tile;
+        unsigned long long  key;
+    };
+
+    std::mutex                              m_mutex;        /**< Mutex protecting everything below. */
+    std::condition_variable                 m_queued;       /**< Signaled when a tile is queued or the loader stops. */
+    std::condition_variable                 m_loaded;       /**< Signaled when a tile is loaded. */
+    std::deque<PendingTile>                    m_queue;        /**< Tiles waiting to be loaded. */
+    std::unordered_set<unsigned long long>  m_requested;    /**< Keys of tiles queued or being loaded. */
+    std::vector<unsigned long long>         m_loading;      /**< Keys of tiles being loaded. */
+    std::vector<std::thread>                m_threads;      /**< The I/O threads. */
+    bool                                    m_stopped = false;
+
+    void load(){
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while( true ){
+            m_queued.wait( lock , [this](){ return m_stopped || !m_queue.empty(); } );
+            if( m_stopped )
+                return;
+
+            const auto request = m_queue.front();
+            m_queue.pop_front();
+            m_loading.push_back( request.key );
+            lock.unlock();
+
+            // Page faults of the mapped file happen here instead of on the render threads.
+            TextureCache::GetSingleton().insert( request.key , request.texture->LoadTile( request.tile ) );
+
+            lock.lock();
+            m_loading.erase( std::find( m_loading.begin() , m_loading.end() , request.key ) );
+            m_requested.erase( request.key );
+            m_loaded.notify_all();
+        }
+    }
+};
+static TextureTileLoader g_tileLoader;
+
+// Size of a tile in the file in bytes.
+static size_t tileSizeInFile( bool alpha ){
+    return ( alpha ? 4 : 3 ) * sizeof(float) * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+}
+
+TiledTexture::TiledTexture() : m_id( g_tiledTextureId++ ) {}
+
+TiledTexture::~TiledTexture(){
+    g_tileLoader.Cancel( m_id );
+}
+
+bool TiledTexture::Save( const std::string& filename , int width , int height , const Spectrum* rgb , const float* alpha , const Spectrum& average ){
+    if( width <= 0 || height <= 0 || IS_PTR_INVALID(rgb) )
+        return false;
+
+    const auto tile_cnt_x = ( width + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+    const auto tile_cnt_y = ( height + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+
+    // Textures are saved in parallel, the file is renamed once it is complete so that nobody opens a partial one.
+    char suffix[32];
+    snprintf( suffix , sizeof( suffix ) , ".%p.tmp" , (const void*)rgb );
+    const auto tmp_file = filename + suffix;
+    auto saved = false;
+    {
+        OFileStream stream( tmp_file );
+        stream << TILED_TEXTURE_MAGIC << TILED_TEXTURE_VERSION << (unsigned)width << (unsigned)height << (unsigned)TEXTURE_TILE_SIZE;
+        stream << (unsigned)( alpha ? 1 : 0 ) << average.r << average.g << average.b;
+
+        // Each tile has the rgb channels of all of its texels followed by the alpha channel, texels out of the texture are zero.
+        const auto texel_cnt = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+        std::vector<float> tile( ( alpha ? 4 : 3 ) * texel_cnt );
+        for( auto ty = 0 ; ty < tile_cnt_y ; ++ty ){
+            for( auto tx = 0 ; tx < tile_cnt_x ; ++tx ){
+                std::fill( tile.begin() , tile.end() , 0.0f );
+                for( auto j = 0 ; j < TEXTURE_TILE_SIZE && ty * TEXTURE_TILE_SIZE + j < height ; ++j ){
+                    for( auto i = 0 ; i < TEXTURE_TILE_SIZE && tx * TEXTURE_TILE_SIZE + i < width ; ++i ){
+                        const auto src = ( ty * TEXTURE_TILE_SIZE + j ) * width + tx * TEXTURE_TILE_SIZE + i;
+                        const auto dst = j * TEXTURE_TILE_SIZE + i;
+                        tile[3 * dst] = rgb[src].r;
+                        tile[3 * dst + 1] = rgb[src].g;
+                        tile[3 * dst + 2] = rgb[src].b;
+                        if( alpha )
+                            tile[3 * texel_cnt + dst] = alpha[src];
+                    }
+                }
+                stream.Write( (char*)tile.data() , (int)( sizeof(float) * tile.size() ) );
+            }
+        }
+        saved = stream.IsValid();
+    }
+
+    if( !saved ){
+        std::remove( tmp_file.c_str() );
+        slog( WARNING , IMAGE , "Failed to save texture tiles to %s." , filename.c_str() );
+        return false;
+    }
+    std::remove( filename.c_str() );
+    std::rename( tmp_file.c_str() , filename.c_str() );
+    return true;
+}
+
+bool TiledTexture::Open( const std::string& filename ){
+    auto file = std::make_unique<IMappedFileStream>( filename );
+    unsigned magic = 0 , version = 0 , width = 0 , height = 0 , tile_size = 0 , alpha = 0;
+    float r = 0.0f , g = 0.0f , b = 0.0f;
+    *file >> magic >> version >> width >> height >> tile_size >> alpha >> r >> g >> b;
+    if( !file->IsValid() || TILED_TEXTURE_MAGIC != magic || TILED_TEXTURE_VERSION != version || TEXTURE_TILE_SIZE != tile_size ||
+        0 == width || 0 == height || width > (unsigned)INT32_MAX || height > (unsigned)INT32_MAX )
+        return false;
+
+    const size_t tile_cnt_x = ( width + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+    const size_t tile_cnt_y = ( height + TEXTURE_TILE_SIZE - 1 ) / TEXTURE_TILE_SIZE;
+    if( file->GetSize() != TILED_TEXTURE_HEADER_SIZE + tile_cnt_x * tile_cnt_y * tileSizeInFile( alpha != 0 ) )
+        return false;
+
+    m_width = (int)width;
+    m_height = (int)height;
+    m_tileCntX = (int)tile_cnt_x;
+    m_hasAlpha = alpha != 0;
+    m_average = Spectrum( r , g , b );
+    m_tiles = file->GetData() + TILED_TEXTURE_HEADER_SIZE;
+    m_file = std::move( file );
+    return true;
+}
+
+std::shared_ptr<const TextureTile> TiledTexture::LoadTile( unsigned tile ) const{
+    const auto texel_cnt = TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE;
+    const auto src = m_tiles + tile * tileSizeInFile( m_hasAlpha );
+
+    auto ret = std::make_shared<TextureTile>();
+    std::vector<float> rgb( 3 * texel_cnt );
+    memcpy( rgb.data() , src , sizeof(float) * rgb.size() );
+    for( auto i = 0 ; i < texel_cnt ; ++i )
+        ret->m_rgb[i] = Spectrum( rgb[3 * i] , rgb[3 * i + 1] , rgb[3 * i + 2] );
+    if( m_hasAlpha ){
+        ret->m_a = std::make_unique<float[]>( texel_cnt );
+        memcpy( ret->m_a.get() , src + sizeof(float) * rgb.size() , sizeof(float) * texel_cnt );
+    }
+    return ret;
+}
+
+const TextureTile* TiledTexture::getTile( int x , int y ) const{
+    const auto tile = ( y / TEXTURE_TILE_SIZE ) * m_tileCntX + x / TEXTURE_TILE_SIZE;
+    return TextureCache::GetSingleton().GetTile( *this , (unsigned)tile );
+}
+
+Spectrum TiledTexture::GetColor( int x , int y ) const{
+    const auto tile = getTile( x , y );
+    if( IS_PTR_INVALID(tile) )
+        return m_average;
+    return tile->m_rgb[( y % TEXTURE_TILE_SIZE ) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE];
+}
+
+float TiledTexture::GetAlpha( int x , int y ) const{
+    if( !m_hasAlpha )
+        return 1.0f;
+    const auto tile = getTile( x , y );
+    if( IS_PTR_INVALID(tile) )
+        return 1.0f;
+    return tile->m_a[( y % TEXTURE_TILE_SIZE ) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE];
+}
+
+const TextureTile* TextureCache::GetTile( const TiledTexture& texture , unsigned tile ){
+    const auto key = ( (unsigned long long)texture.GetId() << 32 ) | tile;
+
+    // Neighboring tiles of the same texture go to different handles.
+    auto& handle = g_tileHandles[( key * 0x9E3779B97F4A7C15ull ) >> 60];
+    SORT_STATS_HOT(++sTextureTileLookups);
+    if( handle.key == key ){
+        SORT_STATS_HOT(++sTextureTileHandleHits);
+        return handle.tile.get();
+    }
+
+    // The tile is loaded in the background if the miss is deferred, the handle is left untouched.
+    if( g_missDeferral ){
+        auto cached = find( key );
+        if( !cached ){
+            // stats of I/O threads are never flushed, the tiles are counted here instead
+            if( g_tileLoader.Request( texture , tile , key ) )
+                SORT_STATS(++sTextureTileBackgroundLoads);
+            g_missDeferral->m_missed = true;
+            SORT_STATS(++sTextureTileDeferredMisses);
+            return nullptr;
+        }
+        handle.tile = std::move( cached );
+        handle.key = key;
+        return handle.tile.get();
+    }
+
+    handle.tile = fetch( texture , tile , key );
+    handle.key = key;
+    return handle.tile.get();
+}
+
+void TextureCache::CancelLoads( const TiledTexture& texture ){
+    g_tileLoader.Cancel( texture.GetId() );
+}
+
+TextureCache::~TextureCache(){
+    g_tileLoader.Stop();
+}
+
+TextureMissDeferral::TextureMissDeferral() : m_previous( g_missDeferral ) {
+    g_missDeferral = this;
+}
+
+TextureMissDeferral::~TextureMissDeferral(){
+    g_missDeferral = m_previous;
+}
+
+std::shared_ptr<const TextureTile> TextureCache::fetch( const TiledTexture& texture , unsigned tile , unsigned long long key ){
+    if( auto cached = find( key ) )
+        return cached;
+
+    // Loading the tile doesn't block other threads, a tile could occasionally be loaded by two threads at the same time.
+    SORT_STATS(++sTextureTileLoads);
+    return insert( key , texture.LoadTile( tile ) );
+}
+
+std::shared_ptr<const TextureTile> TextureCache::find( unsigned long long key ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    const auto it = m_lookup.find( key );
+    if( it == m_lookup.end() )
+        return nullptr;
+    m_tiles.splice( m_tiles.begin() , m_tiles , it->second );
+    return it->second->tile;
+}
+
+std::shared_ptr<const TextureTile> TextureCache::insert( unsigned long long key , std::shared_ptr<const TextureTile> loaded ){
+    const auto size = sizeof( TextureTile ) + ( loaded->m_a ? sizeof(float) * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE : 0 );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    const auto it = m_lookup.find( key );
+    if( it != m_lookup.end() ){
+        m_tiles.splice( m_tiles.begin() , m_tiles , it->second );
+        return it->second->tile;
+    }
+
+    m_tiles.push_front( Entry{ key , loaded , size } );
+    m_lookup[key] = m_tiles.begin();
+    m_size += size;
+    SORT_STATS(sTextureTileMemory.Add( (StatsInt)size ));
+
+    // the tile just loaded is never dropped, even if it alone exceeds the budget
+    const auto budget = (size_t)g_textureCacheBudget * 1024 * 1024;
+    while( m_size > budget && m_tiles.size() > 1 ){
+        const auto& entry = m_tiles.back();
+        m_size -= entry.size;
+        SORT_STATS(++sTextureTileEvictions);
+        SORT_STATS(sTextureTileMemory.Add( -(StatsInt)entry.size ));
+        m_lookup.erase( entry.key );
+        m_tiles.pop_back();
+    }
+    return loaded;
+}
@@ -0,0 +1,192 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "core/define.h"
+#include "core/singleton.h"
+#include "core/stats.h"
+#include "spectrum/spectrum.h"
+
+class IMappedFileStream;
+class TextureTileLoader;
+
+//! @brief  Number of texels along each side of a texture tile.
+constexpr int TEXTURE_TILE_SIZE = 64;
+
+//! @brief  A square block of texels of a texture, it is the unit textures are paged in by.
+struct TextureTile {
+    Spectrum                    m_rgb[TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE];   /**< RGB channels of the texels. */
+    std::unique_ptr<float[]>    m_a;                                            /**< Alpha channel, nullptr if there is none. */
+};
+
+//! @brief  Texture stored as tiles in a file, tiles are only loaded when they are accessed.
+/**
+ * Decoding an image is only needed once, the decoded texels are saved to a file as tiles. Texels of the texture are
+ * accessed through the texture cache, which keeps the recently used tiles in memory within a budget.
+ * Coordinates of texels are the same as the order texels are stored in the image, from the top row to the bottom.
+ */
+class TiledTexture {
+public:
+    //! @brief  Every tiled texture has a unique id, tiles of textures that are destroyed are never confused with others.
+    //!
+    //! Tiles of destroyed textures are not dropped from the texture cache explicitly, they are never used again and
+    //! get dropped as the least recently used ones.
+    TiledTexture();
+
+    //! @brief  Destructor is defined where the mapped file is not an incomplete type.
+    ~TiledTexture();
+
+    //! @brief  Save decoded texels as tiles to a file.
+    //!
+    //! @param  filename    Name of the file.
+    //! @param  width       Width of the texture.
+    //! @param  height      Height of the texture.
+    //! @param  rgb         RGB channels of all texels, row by row.
+    //! @param  alpha       Alpha channel of all texels, nullptr if there is none.
+    //! @param  average     Average color of the texture.
+    //! @return             Whether the file is saved.
+    static bool Save( const std::string& filename , int width , int height , const Spectrum* rgb , const float* alpha , const Spectrum& average );
+
+    //! @brief  Open a file of tiles saved before.
+    //!
+    //! @param  filename    Name of the file.
+    //! @return             Whether the file is a valid tiled texture.
+    bool    Open( const std::string& filename );
+
+    //! @brief  Get the color of a texel.
+    //!
+    //! @param  x           Column of the texel, it has to be in the texture.
+    //! @param  y           Row of the texel, it has to be in the texture.
+    //! @return             The color of the texel, the average color if its tile is missed within a TextureMissDeferral.
+    Spectrum    GetColor( int x , int y ) const;
+
+    //! @brief  Get the alpha of a texel.
+    //!
+    //! @param  x           Column of the texel, it has to be in the texture.
+    //! @param  y           Row of the texel, it has to be in the texture.
+    //! @return             The alpha of the texel, 1.0 for textures without alpha channel or a missed tile.
+    float       GetAlpha( int x , int y ) const;
+
+    //! @brief  Load a tile from the file, this is only supposed to be called by the texture cache.
+    //!
+    //! @param  tile        Index of the tile, tiles are indexed row by row.
+    //! @return             The loaded tile.
+    std::shared_ptr<const TextureTile> LoadTile( unsigned tile ) const;
+
+    int             GetWidth() const { return m_width; }
+    int             GetHeight() const { return m_height; }
+    bool            HasAlpha() const { return m_hasAlpha; }
+    const Spectrum& GetAverage() const { return m_average; }
+    unsigned        GetId() const { return m_id; }
+
+private:
+    std::unique_ptr<IMappedFileStream>  m_file;                 /**< The mapped file of tiles. */
+    const char*                         m_tiles = nullptr;      /**< The first tile in the file. */
+    unsigned                            m_id = 0;               /**< Unique id of the texture. */
+    int                                 m_width = 0;            /**< Width of the texture. */
+    int                                 m_height = 0;           /**< Height of the texture. */
+    int                                 m_tileCntX = 0;         /**< Number of tiles in each row of tiles. */
+    bool                                m_hasAlpha = false;     /**< Whether there is alpha channel in the texture. */
+    Spectrum                            m_average;              /**< Average color of the texture. */
+
+    //! @brief  Get the tile holding a texel through the texture cache, nullptr if the miss is deferred.
+    const TextureTile*  getTile( int x , int y ) const;
+};
+
+//! @brief  Misses of the texture cache on the current thread are deferred within the lifetime of the scope.
+/**
+ * Instead of stalling the thread on a tile that is not in the cache, the tile is loaded by I/O threads in the background
+ * and the average color of the texture stands in for it. Whoever opens the scope checks whether anything is missed and
+ * does the work again later, like a render task rendering a pixel again after the rest of its pixels, by which time
+ * the tile is most likely in the cache. Scopes could be nested, the innermost one takes the misses.
+ */
+class TextureMissDeferral {
+public:
+    TextureMissDeferral();
+    ~TextureMissDeferral();
+
+    TextureMissDeferral( const TextureMissDeferral& ) = delete;
+    TextureMissDeferral& operator = ( const TextureMissDeferral& ) = delete;
+
+    //! @brief  Whether any tile is missed in the scope so far.
+    //!
+    //! @return             True if anything read from textures in the scope is not the real texels.
+    bool    HasMissed() const { return m_missed; }
+
+private:
+    TextureMissDeferral*    m_previous = nullptr;   /**< The scope this one is nested in. */
+    bool                    m_missed = false;       /**< Whether any tile is missed. */
+
+    friend class TextureCache;
+};
+
+//! @brief  Cache of tiles of all tiled textures.
+/**
+ * Tiles recently used are kept in memory, the least recently used ones are dropped once the budget is exceeded.
+ * Each thread also keeps a handful of handles of the tiles it accessed recently, hitting those doesn't touch the
+ * global cache at all, there is no lock involved. Tiles referred by those handles stay alive even if they are
+ * dropped by the global cache, the memory used could exceed the budget by a few tiles per thread.
+ */
+class TextureCache : public Singleton<TextureCache> {
+public:
+    //! @brief  Get a tile of a texture, it is loaded if it is not in the cache yet.
+    //!
+    //! The tile stays valid until the same thread accesses another few tiles.
+    //!
+    //! @param  texture     The texture.
+    //! @param  tile        Index of the tile in the texture.
+    //! @return             The tile, nullptr if it is missed within a TextureMissDeferral.
+    const TextureTile*  GetTile( const TiledTexture& texture , unsigned tile );
+
+    //! @brief  Drop the tiles of a texture waiting to be loaded in the background, and wait for the ones being loaded.
+    //!
+    //! @param  texture     The texture that is about to be destroyed.
+    void                CancelLoads( const TiledTexture& texture );
+
+private:
+    //! @brief  A tile in the cache.
+    struct Entry {
+        unsigned long long                  key;        /**< Id of the texture and index of the tile. */
+        std::shared_ptr<const TextureTile>  tile;       /**< The tile. */
+        size_t                              size;       /**< Size of the tile in bytes. */
+    };
+
+    std::mutex                                                          m_mutex;        /**< Mutex protecting the cache. */
+    std::list<Entry>                                                    m_tiles;        /**< Tiles from the most recently used to the least. */
+    std::unordered_map<unsigned long long, std::list<Entry>::iterator>  m_lookup;       /**< Tiles keyed by texture id and tile index. */
+    size_t                                                              m_size = 0;     /**< Size of all tiles in the cache in bytes. */
+
+    //! @brief  Find a tile in the global cache, it is loaded if it is not there.
+    std::shared_ptr<const TextureTile>  fetch( const TiledTexture& texture , unsigned tile , unsigned long long key );
+
+    //! @brief  Find a tile in the global cache, nullptr if it is not there.
+    std::shared_ptr<const TextureTile>  find( unsigned long long key );
+
+    //! @brief  Add a loaded tile to the global cache, the one already there is returned if it is loaded by others too.
+    std::shared_ptr<const TextureTile>  insert( unsigned long long key , std::shared_ptr<const TextureTile> loaded );
+
+    TextureCache() = default;
+    ~TextureCache();
+    friend class Singleton<TextureCache>;
+    friend class TextureTileLoader;
+};